@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -41,7 +41,7 @@ typedef void (*OutputFn) (void* cb_data, const char* data, unsigned int length);
 
 /* This version number should be bumped whenever incompatible changes
  * are made, to invalidate old caches. */
-#define COLLADA_CONVERTER_VERSION 3
+#define COLLADA_CONVERTER_VERSION 4
 
 EXPORT void set_logger(LogFn logger, void* cb_data);
 EXPORT int set_skeleton_definitions(const char* xml, int length);
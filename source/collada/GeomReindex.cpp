@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -19,6 +19,8 @@
 
 #include "GeomReindex.h"
 
+#include "DLL.h"
+
 #include "FCollada.h"
 #include "FCDocument/FCDEntity.h"
 #include "FCDocument/FCDGeometryMesh.h"
@@ -28,6 +30,7 @@
 #include "FCDocument/FCDSkinController.h"
 
 #include <cassert>
+#include <deque>
 #include <vector>
 #include <map>
 #include <algorithm>
@@ -131,6 +134,204 @@ void CanonicaliseWeights(std::vector<FCDJointWeightPair>& weights)
 	std::sort(weights.begin(), weights.end());
 }
 
+// Number of entries in the simulated post-transform vertex cache. Real GPUs
+// vary, but the optimisation isn't very sensitive to the exact size.
+static const size_t VERTEX_CACHE_SIZE = 32;
+
+/**
+ * Average cache miss ratio (transformed vertices per triangle) of the given
+ * triangle list, simulating a FIFO vertex cache of VERTEX_CACHE_SIZE entries.
+ */
+static float CalculateACMR(const std::vector<uint32>& indices)
+{
+	if (indices.empty())
+		return 0.f;
+
+	std::deque<uint32> cache;
+	size_t misses = 0;
+	for (size_t i = 0; i < indices.size(); ++i)
+	{
+		if (std::find(cache.begin(), cache.end(), indices[i]) != cache.end())
+			continue;
+
+		++misses;
+		cache.push_back(indices[i]);
+		if (cache.size() > VERTEX_CACHE_SIZE)
+			cache.pop_front();
+	}
+
+	return misses / (indices.size() / 3.f);
+}
+
+/**
+ * Score of a vertex in Forsyth's algorithm, given its position in the
+ * simulated LRU cache (-1 if it's not in there) and the number of
+ * not-yet-added triangles that use it.
+ */
+static float VertexCacheScore(int cachePosition, size_t remainingTris)
+{
+	if (remainingTris == 0)
+		return -1.f;
+
+	float score = 0.f;
+	if (cachePosition < 0)
+	{
+		// Not in the cache, so no bonus
+	}
+	else if (cachePosition < 3)
+	{
+		// Used by the last triangle - give it a fixed score, so we don't
+		// prefer triangles that would form a strip over the rest of the cache
+		score = 0.75f;
+	}
+	else
+	{
+		score = powf(1.f - (cachePosition - 3) / (float)(VERTEX_CACHE_SIZE - 3), 1.5f);
+	}
+
+	// Prefer vertices with few triangles left, to avoid leaving isolated triangles behind
+	score += 2.f / sqrtf((float)remainingTris);
+
+	return score;
+}
+
+/**
+ * Reorder the triangles in the given list to make good use of the vertex
+ * cache, using Tom Forsyth's linear-speed algorithm
+ * (<http://home.comcast.net/~tom_forsyth/papers/fast_vert_cache_opt.html>).
+ */
+static void OptimiseTriangleOrder(std::vector<uint32>& indices, size_t numVertices)
+{
+	const size_t numTris = indices.size() / 3;
+	if (numTris == 0)
+		return;
+
+	// Find the triangles that use each vertex: vertexTris[firstTri[v]...] are the
+	// ones using vertex v, with the first remainingTris[v] of them not added yet
+	std::vector<size_t> firstTri(numVertices + 1, 0);
+	for (size_t i = 0; i < indices.size(); ++i)
+		++firstTri[indices[i] + 1];
+	for (size_t v = 0; v < numVertices; ++v)
+		firstTri[v + 1] += firstTri[v];
+
+	std::vector<size_t> vertexTris(indices.size());
+	std::vector<size_t> remainingTris(numVertices, 0);
+	for (size_t i = 0; i < indices.size(); ++i)
+	{
+		uint32 v = indices[i];
+		vertexTris[firstTri[v] + remainingTris[v]++] = i / 3;
+	}
+
+	std::vector<float> vertexScore(numVertices);
+	for (size_t v = 0; v < numVertices; ++v)
+		vertexScore[v] = VertexCacheScore(-1, remainingTris[v]);
+
+	std::vector<float> triScore(numTris);
+	std::vector<bool> triAdded(numTris, false);
+	size_t bestTri = 0;
+	for (size_t t = 0; t < numTris; ++t)
+	{
+		triScore[t] = vertexScore[indices[t*3]] + vertexScore[indices[t*3 + 1]] + vertexScore[indices[t*3 + 2]];
+		if (triScore[t] > triScore[bestTri])
+			bestTri = t;
+	}
+
+	std::vector<uint32> newIndices;
+	newIndices.reserve(indices.size());
+
+	// Most recently used vertex first; it can temporarily grow beyond the cache
+	// size when a triangle is added
+	std::vector<uint32> cache;
+	cache.reserve(VERTEX_CACHE_SIZE + 3);
+
+	size_t nextUnadded = 0;
+
+	for (size_t n = 0; n < numTris; ++n)
+	{
+		if (bestTri == numTris)
+		{
+			// None of the cached vertices have any triangles left, so just take
+			// the next one that hasn't been added yet
+			while (triAdded[nextUnadded])
+				++nextUnadded;
+			bestTri = nextUnadded;
+		}
+
+		triAdded[bestTri] = true;
+
+		for (size_t k = 0; k < 3; ++k)
+		{
+			uint32 v = indices[bestTri*3 + k];
+			newIndices.push_back(v);
+
+			// Move this triangle past the vertex's remaining ones
+			size_t* tris = &vertexTris[firstTri[v]];
+			size_t* last = tris + --remainingTris[v];
+			std::swap(*std::find(tris, last + 1, bestTri), *last);
+
+			std::vector<uint32>::iterator it = std::find(cache.begin(), cache.end(), v);
+			if (it != cache.end())
+				cache.erase(it);
+			cache.insert(cache.begin(), v);
+		}
+
+		for (size_t i = 0; i < cache.size(); ++i)
+			vertexScore[cache[i]] = VertexCacheScore(i < VERTEX_CACHE_SIZE ? (int)i : -1, remainingTris[cache[i]]);
+
+		// Only the triangles using cached vertices can have changed score, and
+		// they're the best candidates for the next one
+		bestTri = numTris;
+		float bestScore = -1.f;
+		for (size_t i = 0; i < cache.size(); ++i)
+		{
+			uint32 v = cache[i];
+			for (size_t j = 0; j < remainingTris[v]; ++j)
+			{
+				size_t t = vertexTris[firstTri[v] + j];
+				triScore[t] = vertexScore[indices[t*3]] + vertexScore[indices[t*3 + 1]] + vertexScore[indices[t*3 + 2]];
+				if (triScore[t] > bestScore)
+				{
+					bestScore = triScore[t];
+					bestTri = t;
+				}
+			}
+		}
+
+		if (cache.size() > VERTEX_CACHE_SIZE)
+			cache.resize(VERTEX_CACHE_SIZE);
+	}
+
+	indices.swap(newIndices);
+}
+
+/**
+ * Renumber the vertices in the order the triangles first use them, so
+ * they're fetched from memory sequentially too.
+ */
+static void OptimiseVertexOrder(std::vector<uint32>& indices, std::vector<VertexData>& vertexes)
+{
+	const uint32 unused = (uint32)-1;
+	std::vector<uint32> remap(vertexes.size(), unused);
+	std::vector<VertexData> newVertexes;
+	newVertexes.reserve(vertexes.size());
+
+	for (size_t i = 0; i < indices.size(); ++i)
+	{
+		uint32& newIndex = remap[indices[i]];
+		if (newIndex == unused)
+		{
+			newIndex = (uint32)newVertexes.size();
+			newVertexes.push_back(vertexes[indices[i]]);
+		}
+		indices[i] = newIndex;
+	}
+
+	// (ReindexGeometry only creates vertexes that are used, so there's nothing left over)
+	assert(newVertexes.size() == vertexes.size());
+
+	vertexes.swap(newVertexes);
+}
+
 void ReindexGeometry(FCDGeometryPolygons* polys, FCDSkinController* skin)
 {
 	// Given geometry with:
@@ -218,9 +419,13 @@ void ReindexGeometry(FCDGeometryPolygons* polys, FCDSkinController* skin)
 		indicesCombined.push_back((uint32)idx);
 	}
 
-	// TODO: rearrange indicesCombined (and rearrange vertexes to match) to use
+	// Rearrange indicesCombined (and rearrange vertexes to match) to use
 	// the vertex cache efficiently
-	// (<http://home.comcast.net/~tom_forsyth/papers/fast_vert_cache_opt.html> etc)
+	float acmrBefore = CalculateACMR(indicesCombined);
+	OptimiseTriangleOrder(indicesCombined, vertexes.size());
+	OptimiseVertexOrder(indicesCombined, vertexes);
+	Log(LOG_INFO, "Vertex cache ACMR: %.3f before optimisation, %.3f after (%d triangles, %d vertexes)",
+		acmrBefore, CalculateACMR(indicesCombined), (int)(indicesCombined.size() / 3), (int)vertexes.size());
 
 	FloatList newDataPosition;
 	FloatList newDataNormal;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -27,6 +27,10 @@
 #include "ps/CStr.h"
 #include "ps/DllLoader.h"
 #include "ps/Filesystem.h"
+#include "ps/ThreadPool.h"
+#include "ps/ThreadUtil.h"
+
+#include <deque>
 
 namespace Collada
 {
@@ -56,6 +60,8 @@ namespace
 
 class CColladaManagerImpl
 {
+	NONCOPYABLE(CColladaManagerImpl);
+
 	DllLoader dll;
 
 	void (*set_logger)(Collada::LogFn logger, void* cb_data);
@@ -65,18 +71,70 @@ class CColladaManagerImpl
 
 public:
 	CColladaManagerImpl(const PIVFS& vfs)
-		: dll("Collada"), m_VFS(vfs)
+		: dll("Collada"), m_VFS(vfs), m_Converting(false)
 	{
 	}
 
 	~CColladaManagerImpl()
 	{
+		// Abandon the queued conversions, and wait for the current one
+		{
+			CScopeLock lock(m_QueueMutex);
+			m_Queue.clear();
+		}
+		if (g_ThreadPool)
+			g_ThreadPool->Wait(m_Tasks);
+
 		if (dll.IsLoaded())
 			set_logger(NULL, NULL); // unregister the log handler
 	}
 
+	/**
+	 * Queues a conversion to run on g_ThreadPool, unless it's already queued.
+	 * Returns false if it already failed (so it shouldn't be retried).
+	 */
+	bool QueueConversion(const VfsPath& daeFilename, const VfsPath& pmdFilename, CColladaManager::FileType type)
+	{
+		CScopeLock lock(m_QueueMutex);
+
+		if (m_Failed.count(pmdFilename))
+			return false;
+
+		if (!m_Pending.insert(daeFilename).second)
+			return true;
+
+		QueuedConversion conversion = { daeFilename, pmdFilename, type };
+		m_Queue.push_back(conversion);
+
+		// FCollada isn't thread-safe, so only one conversion can run at once;
+		// each task does one and then submits the next, so that a long queue
+		// doesn't occupy a worker the whole time
+		if (!m_Converting)
+		{
+			m_Converting = true;
+			g_ThreadPool->Submit(&RunConversionTask, this, &m_Tasks);
+		}
+		return true;
+	}
+
+	bool IsPending(const VfsPath& daeFilename)
+	{
+		CScopeLock lock(m_QueueMutex);
+		return m_Pending.count(daeFilename) != 0;
+	}
+
+	void GetFinished(std::vector<VfsPath>& daeFilenames)
+	{
+		CScopeLock lock(m_QueueMutex);
+		daeFilenames.swap(m_Finished);
+		m_Finished.clear();
+	}
+
 	bool Convert(const VfsPath& daeFilename, const VfsPath& pmdFilename, CColladaManager::FileType type)
 	{
+		// (Synchronous conversions might happen while a queued one is running)
+		CScopeLock lock(m_DllMutex);
+
 		// To avoid always loading the DLL when it's usually not going to be
 		// used (and to do the same on Linux where delay-loading won't help),
 		// and to avoid compile-time dependencies (because it's a minor pain
@@ -168,11 +226,61 @@ public:
 	}
 
 private:
+	struct QueuedConversion
+	{
+		VfsPath daeFilename;
+		VfsPath pmdFilename;
+		CColladaManager::FileType type;
+	};
+
+	static void RunConversionTask(void* cbdata)
+	{
+		CColladaManagerImpl* self = static_cast<CColladaManagerImpl*>(cbdata);
+
+		QueuedConversion conversion;
+		{
+			CScopeLock lock(self->m_QueueMutex);
+			if (self->m_Queue.empty())
+			{
+				self->m_Converting = false;
+				return;
+			}
+			conversion = self->m_Queue.front();
+			self->m_Queue.pop_front();
+		}
+
+		const bool ok = self->Convert(conversion.daeFilename, conversion.pmdFilename, conversion.type);
+
+		CScopeLock lock(self->m_QueueMutex);
+		if (!ok)
+			self->m_Failed.insert(conversion.pmdFilename);
+		self->m_Pending.erase(conversion.daeFilename);
+		self->m_Finished.push_back(conversion.daeFilename);
+
+		if (self->m_Queue.empty())
+			self->m_Converting = false;
+		else
+			g_ThreadPool->Submit(&RunConversionTask, self, &self->m_Tasks);
+	}
+
 	PIVFS m_VFS;
+
+	// Protects the DLL, since FCollada isn't thread-safe
+	CMutex m_DllMutex;
+
+	// Protects the following members
+	CMutex m_QueueMutex;
+	std::deque<QueuedConversion> m_Queue;
+	std::set<VfsPath> m_Pending; // source files that are queued or being converted
+	std::set<VfsPath> m_Failed; // cache files that couldn't be converted
+	std::vector<VfsPath> m_Finished; // source files whose conversions finished since GetFinished
+	bool m_Converting; // whether a conversion task has been submitted
+
+	CThreadPool::TaskGroup m_Tasks;
 };
 
 CColladaManager::CColladaManager(const PIVFS& vfs)
-: m(new CColladaManagerImpl(vfs)), m_VFS(vfs)
+: m(new CColladaManagerImpl(vfs)), m_VFS(vfs), m_AsyncConversion(false)
 {
 }
 
@@ -289,6 +397,14 @@ VfsPath CColladaManager::GetLoadablePath(const VfsPath& pathnameNoExtension, Fil
 	}
 
 	// We have a source .dae and invalid cached version, so regenerate cached version
+	// (or let the caller try again once it's been regenerated)
+	if (m_AsyncConversion && g_ThreadPool)
+	{
+		// (if it's failed before, the caller will report the error)
+		m->QueueConversion(sourcePath, cachePath, type);
+		return L"";
+	}
+
 	if (! m->Convert(sourcePath, cachePath, type))
 	{
 		// The COLLADA converter failed for some reason, this will need to be handled
@@ -315,3 +431,18 @@ bool CColladaManager::GenerateCachedFile(const VfsPath& sourcePath, FileType typ
 
 	return m->Convert(sourcePath, VfsPath("cache") / archiveCachePath, type);
 }
+
+void CColladaManager::SetAsyncConversion(bool enabled)
+{
+	m_AsyncConversion = enabled;
+}
+
+bool CColladaManager::IsConversionPending(const VfsPath& pathnameNoExtension)
+{
+	return m->IsPending(pathnameNoExtension.ChangeExtension(L".dae"));
+}
+
+void CColladaManager::GetFinishedConversions(std::vector<VfsPath>& sourcePaths)
+{
+	m->GetFinished(sourcePaths);
+}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -58,6 +58,28 @@ public:
 	 */
 	bool GenerateCachedFile(const VfsPath& sourcePath, FileType type, VfsPath& archiveCachePath);
 
+	/**
+	 * Enable or disable (the default) asynchronous conversion.
+	 * While enabled, GetLoadablePath doesn't convert files itself: it queues
+	 * the conversion on g_ThreadPool and returns an empty path, and
+	 * IsConversionPending returns true until the converted file is ready.
+	 * This avoids stalling on COLLADA files when the caller can use them later.
+	 */
+	void SetAsyncConversion(bool enabled);
+
+	/**
+	 * Returns whether GetLoadablePath couldn't return a file because it's
+	 * still waiting for an asynchronous conversion.
+	 */
+	bool IsConversionPending(const VfsPath& pathnameNoExtension);
+
+	/**
+	 * Returns the source .dae paths of files whose asynchronous conversions
+	 * have finished (successfully or not) since the last call, so that
+	 * anything waiting for them can be reloaded.
+	 */
+	void GetFinishedConversions(std::vector<VfsPath>& sourcePaths);
+
 private:
 	/**
 	 * Creates MD5 hash key from skeletons.xml info and COLLADA converter version,
@@ -71,6 +93,7 @@ private:
 
 	CColladaManagerImpl* m;
 	PIVFS m_VFS;
+	bool m_AsyncConversion;
 };
 
 #endif // INCLUDED_COLLADAMANAGER
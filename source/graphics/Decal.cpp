@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -88,9 +88,10 @@ void CModelDecal::ValidatePosition()
 		// a parent animation state that is out of date.
 		m_Parent->ValidatePosition();
 
-		// Parent will recursively call our validation.
-		ENSURE(m_PositionValid);
-		return;
+		// Parent will recursively call our validation, unless we're
+		// a hidden prop (in which case it only updated our transform)
+		if (m_PositionValid)
+			return;
 	}
 
 	m_PositionValid = true;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -31,6 +31,13 @@ portal rendering, where a portal may have 3 or more edges.
 #include "maths/BoundingBoxAligned.h"
 #include "maths/MathUtil.h"
 
+#if ARCH_X86_X64 && HAVE_SSE
+# include <xmmintrin.h>
+# define FRUSTUM_SSE 1
+#else
+# define FRUSTUM_SSE 0
+#endif
+
 CFrustum::CFrustum ()
 {
 	m_NumPlanes = 0;
@@ -185,4 +192,63 @@ bool CFrustum::IsBoxVisible (const CVector3D &position,const CBoundingBoxAligned
 	return true;
 }
 
+void CFrustum::AreBoxesVisible(size_t count,
+	const float* minX, const float* minY, const float* minZ,
+	const float* maxX, const float* maxY, const float* maxZ,
+	u8* visible) const
+{
+	// Same test as IsBoxVisible: a box is outside if the corner furthest along
+	// a plane's normal is behind that plane. All the boxes use the same corner
+	// for each plane, so we can just pick the right arrays of coordinates
+	const float EPS = 0.001f;
+
+	size_t i = 0;
+
+#if FRUSTUM_SSE
+	const __m128 minDist = _mm_set1_ps(-EPS);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 inside = _mm_cmpeq_ps(minDist, minDist); // all bits set
+
+		for (size_t p = 0; p < m_NumPlanes; ++p)
+		{
+			const CPlane& plane = m_aPlanes[p];
+			__m128 x = _mm_loadu_ps((plane.m_Norm.X > 0.0f ? maxX : minX) + i);
+			__m128 y = _mm_loadu_ps((plane.m_Norm.Y > 0.0f ? maxY : minY) + i);
+			__m128 z = _mm_loadu_ps((plane.m_Norm.Z > 0.0f ? maxZ : minZ) + i);
+
+			// (Summed in the same order as CPlane::ClassifyPoint, to get identical results)
+			__m128 dist = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.m_Norm.X)), _mm_mul_ps(y, _mm_set1_ps(plane.m_Norm.Y)));
+			dist = _mm_add_ps(dist, _mm_mul_ps(z, _mm_set1_ps(plane.m_Norm.Z)));
+			dist = _mm_add_ps(dist, _mm_set1_ps(plane.m_Dist));
+
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(dist, minDist));
+		}
+
+		int mask = _mm_movemask_ps(inside);
+		visible[i+0] = (mask & 1) ? 1 : 0;
+		visible[i+1] = (mask & 2) ? 1 : 0;
+		visible[i+2] = (mask & 4) ? 1 : 0;
+		visible[i+3] = (mask & 8) ? 1 : 0;
+	}
+#endif
+
+	for (; i < count; ++i)
+	{
+		visible[i] = 1;
+		for (size_t p = 0; p < m_NumPlanes; ++p)
+		{
+			const CPlane& plane = m_aPlanes[p];
+			float x = (plane.m_Norm.X > 0.0f ? maxX : minX)[i];
+			float y = (plane.m_Norm.Y > 0.0f ? maxY : minY)[i];
+			float z = (plane.m_Norm.Z > 0.0f ? maxZ : minZ)[i];
+			if (plane.m_Norm.X * x + plane.m_Norm.Y * y + plane.m_Norm.Z * z + plane.m_Dist < -EPS)
+			{
+				visible[i] = 0;
+				break;
+			}
+		}
+	}
+}
+
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -57,6 +57,17 @@ public:
 	bool IsSphereVisible (const CVector3D &center, float radius) const;
 	bool IsBoxVisible (const CVector3D &position,const CBoundingBoxAligned &bounds) const;
 
+	/**
+	 * Tests a batch of boxes, like IsBoxVisible, several at a time with SIMD.
+	 * The boxes are given as separate arrays of their minimum and maximum coordinates.
+	 * Sets visible[i] to 1 if box i is partially or completely in front of the
+	 * frustum planes, else 0.
+	 */
+	void AreBoxesVisible(size_t count,
+		const float* minX, const float* minY, const float* minZ,
+		const float* maxX, const float* maxY, const float* maxZ,
+		u8* visible) const;
+
 	CPlane& operator[](size_t idx) { return m_aPlanes[idx]; }
 	const CPlane& operator[](size_t idx) const { return m_aPlanes[idx]; }
 
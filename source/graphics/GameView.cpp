@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -33,6 +33,7 @@
 #include "graphics/TerrainTextureManager.h"
 #include "graphics/TerritoryTexture.h"
 #include "graphics/Unit.h"
+#include "graphics/UnitAnimation.h"
 #include "graphics/UnitManager.h"
 #include "lib/input.h"
 #include "lib/timer.h"
@@ -52,6 +53,7 @@
 #include "ps/Pyrogenesis.h"
 #include "ps/TouchInput.h"
 #include "ps/World.h"
+#include "renderer/PatchRData.h"
 #include "renderer/Renderer.h"
 #include "renderer/WaterManager.h"
 #include "scripting/ScriptableObject.h"
@@ -352,6 +354,12 @@ CGameView::CGameView(CGame *pGame):
 
 	m->CullCamera = m->ViewCamera;
 	g_Renderer.SetSceneCamera(m->ViewCamera, m->CullCamera);
+
+	// Don't stall while converting COLLADA files; the units will be
+	// hotloaded by BeginFrame once their meshes are ready
+	m->ColladaManager.SetAsyncConversion(true);
+
+	CUnitAnimation::SetLODCameraPosition(m->ViewCamera.GetOrientation().GetTranslation());
 }
 
 CGameView::~CGameView()
@@ -453,6 +461,12 @@ int CGameView::Initialize()
 	CFG_GET_VAL("view.far", Float, m->ViewFar);
 	CFG_GET_VAL("view.fov", Float, m->ViewFOV);
 
+	float animLODNear = 150.f;
+	float animLODFar = 300.f;
+	CFG_GET_VAL("view.animlod.near", Float, animLODNear);
+	CFG_GET_VAL("view.animlod.far", Float, animLODFar);
+	CUnitAnimation::SetLODDistances(animLODNear, animLODFar);
+
 	// Convert to radians
 	m->RotateX.SetValue(DEGTORAD(m->ViewRotateXDefault));
 	m->RotateY.SetValue(DEGTORAD(m->ViewRotateYDefault));
@@ -463,6 +477,12 @@ int CGameView::Initialize()
 
 
 
+int CGameView::PrepareTerrain()
+{
+	CPatchRData::BuildAll(m->Game->GetWorld()->GetTerrain(), m->Game->GetSimulation2());
+	return 0;
+}
+
 void CGameView::RegisterInit()
 {
 	// CGameView init
@@ -493,6 +513,15 @@ void CGameView::BeginFrame()
 	}
 	g_Renderer.SetSceneCamera(m->ViewCamera, m->CullCamera);
 
+	// Show the units whose meshes and animations have finished converting
+	std::vector<VfsPath> converted;
+	m->ColladaManager.GetFinishedConversions(converted);
+	if (!converted.empty())
+		m->ObjectManager.ReloadChangedFiles(converted);
+
+	// Show the units whose actors have finished prefetching
+	m->ObjectManager.UpdatePrefetches();
+
 	CheckLightEnv();
 
 	m->Game->CachePlayerColours();
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -67,6 +67,12 @@ public:
 	void RegisterInit();
 	int Initialize();
 
+	/**
+	 * Builds the render data for the whole terrain (using the thread pool),
+	 * once the map has been loaded. Called by the loader; returns 0 when done.
+	 */
+	int PrepareTerrain();
+
 	CObjectManager& GetObjectManager() const;
 
 	/**
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,8 +24,11 @@
 #include "HFTracer.h"
 #include "Terrain.h"
 #include "maths/BoundingBoxAligned.h"
+#include "maths/MathUtil.h"
 #include "maths/Vector3D.h"
 
+#include <cfloat>
+
 // To cope well with points that are slightly off the edge of the map,
 // we act as if there's an N-tile margin around the edges of the heightfield.
 // (N shouldn't be too huge else it'll hurt performance a little when
@@ -121,6 +124,15 @@ bool CHFTracer::CellIntersect(int cx, int cz, const CVector3D& origin, const CVe
 	return res;
 }
 
+// Distance along the ray at which it crosses the boundary at the given
+// coordinate, or FLT_MAX if it's parallel to it
+static float BoundaryDistance(float boundary, float origin, float dir)
+{
+	if (fabs(dir) <= 1.0e-20f)
+		return FLT_MAX;
+	return (boundary - origin) / dir;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // RayIntersect: intersect ray with this heightfield; return true if
 // intersection occurs (and fill in grid coordinates of intersection), or false
@@ -146,37 +158,90 @@ bool CHFTracer::RayIntersect(const CVector3D& origin, const CVector3D& dir, int&
 		return false;
 	}
 
-	// project origin onto grid, if necessary, to get starting point for traversal
-	CVector3D traversalPt;
-	if (tmin>0) {
-		traversalPt=origin+dir*tmin;
-	} else {
-		traversalPt=origin;
-	}
-
-	// setup traversal variables
-	int sx=dir.X<0 ? -1 : 1;
-	int sz=dir.Z<0 ? -1 : 1;
-
-	float invCellSize=1.0f/float(m_CellSize);
-
-	float fcx=traversalPt.X*invCellSize;
-	int cx=(int)floor(fcx);
-
-	float fcz=traversalPt.Z*invCellSize;
-	int cz=(int)floor(fcz);
+	// start traversal where the ray enters the box, or at the origin if it's inside
+	float t = std::max(tmin, 0.0f);
+	if (t > tmax)
+		return false;
 
-	float invdx = 1.0e20f;
-	float invdz = 1.0e20f;
+	const int cellMin = -MARGIN_SIZE;
+	const int cellMax = (int)(m_MapSize + MARGIN_SIZE - 1);
+	const int tiles = (int)m_MapSize - 1;
+
+	CVector3D traversalPt = origin + dir*t;
+	int cx = clamp((int)floor(traversalPt.X / m_CellSize), cellMin, cellMax - 1);
+	int cz = clamp((int)floor(traversalPt.Z / m_CellSize), cellMin, cellMax - 1);
+
+	int sx = dir.X<0 ? -1 : 1;
+	int sz = dir.Z<0 ? -1 : 1;
+
+	// distance along the ray to the next cell boundary in x and z, and between boundaries
+	float nextX = BoundaryDistance((cx + (sx > 0 ? 1 : 0)) * m_CellSize, origin.X, dir.X);
+	float nextZ = BoundaryDistance((cz + (sz > 0 ? 1 : 0)) * m_CellSize, origin.Z, dir.Z);
+	const float deltaX = BoundaryDistance(m_CellSize, 0.0f, fabs(dir.X));
+	const float deltaZ = BoundaryDistance(m_CellSize, 0.0f, fabs(dir.Z));
+
+	// Blocks of tiles that the ray passes entirely above can't contain an
+	// intersection, so use the height mipmap's min/max pyramid to skip over
+	// the largest such block containing the current cell, rather than testing
+	// every tile in it. (Level 0 blocks are single tiles, so aren't worth it.)
+	// Blocks the ray passes below aren't skipped: that only happens once the
+	// ray has gone through the surface, and CellIntersect's tolerance means the
+	// hit may be reported by a tile just past the one where that happened.
+	const CHeightMipmap& mipmap = m_pTerrain->GetHeightMipmap();
+	const int levels = (int)mipmap.GetHeightRangeLevels();
+
+	while (t <= tmax)
+	{
+		bool skipped = false;
+		if (cx >= 0 && cz >= 0 && cx < tiles && cz < tiles)
+		{
+			for (int level = levels - 1; level > 0; --level)
+			{
+				const int bx = cx >> level;
+				const int bz = cz >> level;
+				const int x0 = bx << level;
+				const int z0 = bz << level;
+				const int x1 = std::min((bx + 1) << level, tiles);
+				const int z1 = std::min((bz + 1) << level, tiles);
+
+				const float exitX = BoundaryDistance((sx > 0 ? x1 : x0) * m_CellSize, origin.X, dir.X);
+				const float exitZ = BoundaryDistance((sz > 0 ? z1 : z0) * m_CellSize, origin.Z, dir.Z);
+				const float exit = std::min(std::min(exitX, exitZ), tmax);
+
+				const float y0 = origin.Y + dir.Y*t;
+				const float y1 = origin.Y + dir.Y*exit;
+				// (RayTriIntersect's tolerance extends triangles 1% past their edges,
+				// which can poke up slightly above the highest vertex)
+				const SHeightRange& range = mipmap.GetHeightRange(level, bx, bz);
+				const float maxHeight = (range.m_Max + (range.m_Max - range.m_Min) / 64 + 1) * m_HeightScale;
+				if (std::min(y0, y1) <= maxHeight)
+					continue;
+
+				if (exit >= tmax)
+					return false;
+
+				// continue from the cell the ray leaves the block into
+				t = exit;
+				traversalPt = origin + dir*t;
+				cx = clamp((int)floor(traversalPt.X / m_CellSize), x0, x1 - 1);
+				cz = clamp((int)floor(traversalPt.Z / m_CellSize), z0, z1 - 1);
+				if (exitX <= exit)
+					cx = (sx > 0 ? x1 : x0 - 1);
+				if (exitZ <= exit)
+					cz = (sz > 0 ? z1 : z0 - 1);
+
+				nextX = BoundaryDistance((cx + (sx > 0 ? 1 : 0)) * m_CellSize, origin.X, dir.X);
+				nextZ = BoundaryDistance((cz + (sz > 0 ? 1 : 0)) * m_CellSize, origin.Z, dir.Z);
+				skipped = true;
+				break;
+			}
+		}
 
-	if (fabs(dir.X) > 1.0e-20)
-		invdx = float(1.0/fabs(dir.X));
-	if (fabs(dir.Z) > 1.0e-20)
-		invdz = float(1.0/fabs(dir.Z));
+		if (skipped)
+			continue;
 
-	do {
 		// test current cell
-		if (cx >= -MARGIN_SIZE && cx < int(m_MapSize + MARGIN_SIZE - 1) && cz >= -MARGIN_SIZE && cz < int(m_MapSize + MARGIN_SIZE - 1))
+		if (cx >= cellMin && cx < cellMax && cz >= cellMin && cz < cellMax)
 		{
 			float dist;
 
@@ -189,41 +254,98 @@ bool CHFTracer::RayIntersect(const CVector3D& origin, const CVector3D& dir, int&
 		}
 		else
 		{
-			// Degenerate case: y close to zero
-			// catch travelling off the map
-			if ((cx < -MARGIN_SIZE) && (sx < 0))
-				return false;
-			if ((cx >= (int)(m_MapSize + MARGIN_SIZE - 1)) && (sx > 0))
-				return false;
-			if ((cz < -MARGIN_SIZE) && (sz < 0))
-				return false;
-			if ((cz >= (int)(m_MapSize + MARGIN_SIZE - 1)) && (sz > 0))
-				return false;
+			// travelled off the edge of the map
+			return false;
 		}
 
-		// get coords of current cell
-		fcx=traversalPt.X*invCellSize;
-		fcz=traversalPt.Z*invCellSize;
-
-		// get distance to next cell in x,z
-		float dx=(sx==-1) ? fcx-float(cx) : 1-(fcx-float(cx));
-		dx*=invdx;
-		float dz=(sz==-1) ? fcz-float(cz) : 1-(fcz-float(cz));
-		dz*=invdz;
-
-		// advance ..
-		float dist;
-		if (dx<dz) {
-			cx+=sx;
-			dist=dx;
+		// advance to the next cell
+		if (nextX < nextZ) {
+			t = nextX;
+			cx += sx;
+			nextX += deltaX;
 		} else {
-			cz+=sz;
-			dist=dz;
+			t = nextZ;
+			cz += sz;
+			nextZ += deltaZ;
 		}
-
-		traversalPt+=dir*dist;
-	} while (traversalPt.Y>=0);
+	}
 
 	// fell off end of heightmap with no intersection; return a miss
 	return false;
 }
+
+// Clip the range [t0, t1] of the segment start + delta*t to the slab
+// [lo, hi] along one axis; return false if nothing is left
+static bool ClipToSlab(float lo, float hi, float start, float delta, float& t0, float& t1)
+{
+	if (fabs(delta) <= 1.0e-20f)
+		return (start >= lo && start <= hi);
+
+	float ta = (lo - start) / delta;
+	float tb = (hi - start) / delta;
+	if (ta > tb)
+		std::swap(ta, tb);
+	t0 = std::max(t0, ta);
+	t1 = std::min(t1, tb);
+	return (t0 <= t1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// IsSegmentOccludedInBlock: test whether the segment passes below every vertex
+// of some block of tiles, using the height mipmap's min/max pyramid to skip
+// blocks the segment passes entirely above
+bool CHFTracer::IsSegmentOccludedInBlock(int level, int bx, int bz, const CVector3D& start, const CVector3D& delta, float t0, float t1) const
+{
+	const int tiles = (int)m_MapSize - 1;
+	const float x0 = (bx << level) * m_CellSize;
+	const float z0 = (bz << level) * m_CellSize;
+	const float x1 = std::min((bx + 1) << level, tiles) * m_CellSize;
+	const float z1 = std::min((bz + 1) << level, tiles) * m_CellSize;
+
+	if (!ClipToSlab(x0, x1, start.X, delta.X, t0, t1) || !ClipToSlab(z0, z1, start.Z, delta.Z, t0, t1))
+		return false;
+
+	const float y0 = start.Y + delta.Y*t0;
+	const float y1 = start.Y + delta.Y*t1;
+
+	// The terrain surface never goes below the lowest vertex of the tiles it
+	// covers, so if the segment is below that it's definitely occluded
+	const SHeightRange& range = m_pTerrain->GetHeightMipmap().GetHeightRange(level, bx, bz);
+	if (std::max(y0, y1) < range.m_Min * m_HeightScale)
+		return true;
+
+	// If it's above the highest vertex it can't be occluded in this block
+	if (std::min(y0, y1) > range.m_Max * m_HeightScale)
+		return false;
+
+	// Give up on single tiles that the segment partly passes through
+	if (level == 0)
+		return false;
+
+	// (number of blocks in each direction on the level below)
+	const int childSize = (tiles + (1 << (level - 1)) - 1) >> (level - 1);
+	for (int dj = 0; dj < 2; ++dj)
+	{
+		for (int di = 0; di < 2; ++di)
+		{
+			const int cx = 2*bx + di;
+			const int cz = 2*bz + dj;
+			if (cx < childSize && cz < childSize && IsSegmentOccludedInBlock(level - 1, cx, cz, start, delta, t0, t1))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// IsSegmentOccluded: return true if the segment definitely passes below the
+// heightfield somewhere between its ends
+bool CHFTracer::IsSegmentOccluded(const CVector3D& start, const CVector3D& end) const
+{
+	const int levels = (int)m_pTerrain->GetHeightMipmap().GetHeightRangeLevels();
+	if (m_MapSize < 2 || levels == 0)
+		return false;
+
+	return IsSegmentOccludedInBlock(levels - 1, 0, 0, start, end - start, 0.f, 1.f);
+}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -37,7 +37,16 @@ public:
 	// occurs (and fill in grid coordinates and point of intersection), or false otherwise
 	bool RayIntersect(const CVector3D& origin, const CVector3D& dir, int& x, int& z, CVector3D& ipt) const;
 
+	// return true if the line segment between the given points definitely passes
+	// below the heightfield somewhere (so one end can't be seen from the other).
+	// This is conservative: segments that only graze the surface may return false.
+	bool IsSegmentOccluded(const CVector3D& start, const CVector3D& end) const;
+
 private:
+	// recursive part of IsSegmentOccluded: test the part of the segment (start + delta*t
+	// for t in [t0, t1]) that lies above the given block of the height range pyramid
+	bool IsSegmentOccludedInBlock(int level, int bx, int bz, const CVector3D& start, const CVector3D& delta, float t0, float t1) const;
+
 	// intersect a ray with triangle defined by vertices 
 	// v0,v1,v2; return true if ray hits triangle at distance less than dist,
 	// or false otherwise
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -45,6 +45,7 @@ void CHeightMipmap::ReleaseData()
 		m_Mipmap[i].m_MapSize = 0;
 	}
 	m_Mipmap.clear();
+	m_HeightRanges.clear();
 }
 
 void CHeightMipmap::Update(const u16* ptr)
@@ -58,6 +59,8 @@ void CHeightMipmap::Update(const u16* ptr, size_t left, size_t bottom, size_t ri
 {
 	ENSURE(ptr != 0);
 
+	HeightRangeUpdate(ptr, left, bottom, right, top);
+
 	size_t mapSize = m_MapSize;
 
 	for (size_t i = 0; i < m_Mipmap.size(); ++i)
@@ -95,6 +98,15 @@ void CHeightMipmap::Initialize(size_t mapSize, const u16* ptr)
 		mipmapSize >>= 1;
 	};
 
+	// (Stop at the level with a single block, which covers the whole map)
+	for (size_t blocks = mapSize - 1; blocks > 0; blocks = (blocks > 1 ? (blocks + 1) / 2 : 0))
+	{
+		SHeightRangeLevel level;
+		level.m_Size = blocks;
+		level.m_Ranges.resize(blocks*blocks);
+		m_HeightRanges.push_back(level);
+	}
+
 	Update(ptr);
 }
 
@@ -219,6 +231,65 @@ void CHeightMipmap::BilinearUpdate(SMipmap &out_mipmap, size_t mapSize, const u1
 	}
 }
 
+void CHeightMipmap::HeightRangeUpdate(const u16* ptr, size_t left, size_t bottom, size_t right, size_t top)
+{
+	if (m_HeightRanges.empty())
+		return;
+
+	// Tiles that use any of the changed vertices
+	const size_t tiles = m_HeightRanges[0].m_Size;
+	left = (left > 0 ? left - 1 : 0);
+	bottom = (bottom > 0 ? bottom - 1 : 0);
+	right = std::min(right, tiles);
+	top = std::min(top, tiles);
+
+	SHeightRangeLevel& base = m_HeightRanges[0];
+	for (size_t j = bottom; j < top; ++j)
+	{
+		for (size_t i = left; i < right; ++i)
+		{
+			const u16 h00 = ptr[j*m_MapSize + i];
+			const u16 h10 = ptr[j*m_MapSize + i+1];
+			const u16 h01 = ptr[(j+1)*m_MapSize + i];
+			const u16 h11 = ptr[(j+1)*m_MapSize + i+1];
+
+			SHeightRange& range = base.m_Ranges[j*tiles + i];
+			range.m_Min = std::min(std::min(h00, h10), std::min(h01, h11));
+			range.m_Max = std::max(std::max(h00, h10), std::max(h01, h11));
+		}
+	}
+
+	for (size_t l = 1; l < m_HeightRanges.size(); ++l)
+	{
+		const SHeightRangeLevel& in = m_HeightRanges[l-1];
+		SHeightRangeLevel& out = m_HeightRanges[l];
+
+		left /= 2;
+		bottom /= 2;
+		right = (right + 1) / 2;
+		top = (top + 1) / 2;
+
+		for (size_t j = bottom; j < top; ++j)
+		{
+			for (size_t i = left; i < right; ++i)
+			{
+				// Blocks on the upper edges might have only one child in each direction
+				const size_t i1 = std::min(2*i + 1, in.m_Size - 1);
+				const size_t j1 = std::min(2*j + 1, in.m_Size - 1);
+
+				SHeightRange range = in.m_Ranges[2*j*in.m_Size + 2*i];
+				const SHeightRange& r10 = in.m_Ranges[2*j*in.m_Size + i1];
+				const SHeightRange& r01 = in.m_Ranges[j1*in.m_Size + 2*i];
+				const SHeightRange& r11 = in.m_Ranges[j1*in.m_Size + i1];
+				range.m_Min = std::min(std::min(range.m_Min, r10.m_Min), std::min(r01.m_Min, r11.m_Min));
+				range.m_Max = std::max(std::max(range.m_Max, r10.m_Max), std::max(r01.m_Max, r11.m_Max));
+
+				out.m_Ranges[j*out.m_Size + i] = range;
+			}
+		}
+	}
+}
+
 void CHeightMipmap::DumpToDisk(const VfsPath& filename) const
 {
 	const size_t w = m_MapSize;
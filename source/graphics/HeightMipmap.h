@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -35,6 +35,13 @@ struct SMipmap
 	u16* m_Heightmap;
 };
 
+// Lowest and highest heights of a square block of tiles
+struct SHeightRange
+{
+	u16 m_Min;
+	u16 m_Max;
+};
+
 class CHeightMipmap
 {
 	NONCOPYABLE(CHeightMipmap);
@@ -56,6 +63,23 @@ public:
 
 	float GetTrilinearGroundLevel(float x, float z, float radius) const;
 
+	/**
+	 * Number of levels in the min/max height pyramid. Level 0 has one entry
+	 * per terrain tile, and each level above it covers 2x2 blocks of the one below.
+	 */
+	size_t GetHeightRangeLevels() const { return m_HeightRanges.size(); }
+
+	/**
+	 * Get the range of heights of all the vertices of block (i, j) of the given
+	 * level, which covers tiles [i << level, (i+1) << level) in each direction
+	 * (clipped to the edges of the map).
+	 */
+	const SHeightRange& GetHeightRange(size_t level, size_t i, size_t j) const
+	{
+		const SHeightRangeLevel& ranges = m_HeightRanges[level];
+		return ranges.m_Ranges[j*ranges.m_Size + i];
+	}
+
 	void DumpToDisk(const VfsPath& path) const;
 
 private:
@@ -69,11 +93,23 @@ private:
 	// update rectangle of the output mipmap by bilinear interpolating the input mipmap
 	void BilinearUpdate(SMipmap &out_mipmap, size_t mapSize, const u16* ptr, size_t left, size_t bottom, size_t right, size_t top);
 
+	// update the min/max pyramid for a rectangle of heightmap vertices
+	void HeightRangeUpdate(const u16* ptr, size_t left, size_t bottom, size_t right, size_t top);
+
 	// size of this map in each direction
 	size_t m_MapSize;
 
 	// mipmap list
 	std::vector<SMipmap> m_Mipmap;
+
+	struct SHeightRangeLevel
+	{
+		size_t m_Size; // number of blocks in each direction
+		std::vector<SHeightRange> m_Ranges;
+	};
+
+	// min/max pyramid, finest level first
+	std::vector<SHeightRangeLevel> m_HeightRanges;
 };
 
 #endif
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -44,6 +44,10 @@ then the blur shifts the image back into the corner.
 
 The blurred bitmap is then uploaded into a GL texture for use by the renderer.
 
+Usually only a small part of the LOS changes between turns, so we only recompute
+and upload the texels within the blur radius of the region of vertexes that
+CCmpRangeManager reports as changed.
+
 */
 
 
@@ -51,7 +55,8 @@ The blurred bitmap is then uploaded into a GL texture for use by the renderer.
 static const size_t g_BlurSize = 7;
 
 CLOSTexture::CLOSTexture(CSimulation2& simulation) :
-	m_Simulation(simulation), m_Dirty(true), m_Texture(0), m_smoothFbo(0), m_MapSize(0), m_TextureSize(0), whichTex(true)
+	m_Simulation(simulation), m_Dirty(true), m_Player(INVALID_PLAYER), m_SharedLosMask(0), m_RevealAll(false),
+	m_Texture(0), m_smoothFbo(0), m_MapSize(0), m_TextureSize(0), whichTex(true)
 {
 	if (CRenderer::IsInitialised() && g_Renderer.m_Options.m_SmoothLOS)
 	{
@@ -286,16 +291,42 @@ void CLOSTexture::RecomputeTexture(int unit)
 
 	PROFILE("recompute LOS texture");
 
-	std::vector<u8> losData;
-	losData.resize(GetBitmapSize(m_MapSize, m_MapSize));
-
 	CmpPtr<ICmpRangeManager> cmpRangeManager(m_Simulation, SYSTEM_ENTITY);
 	if (!cmpRangeManager)
 		return;
 
-	ICmpRangeManager::CLosQuerier los(cmpRangeManager->GetLosQuerier(g_Game->GetPlayerID()));
+	player_id_t player = g_Game->GetPlayerID();
+	ICmpRangeManager::CLosQuerier los(cmpRangeManager->GetLosQuerier(player));
+
+	// (Always call this, so the dirty region is reset even when we recompute everything)
+	GridDirtyRegion dirty = cmpRangeManager->GetLosDirtyRegion(player);
+
+	u32 sharedLosMask = cmpRangeManager->GetSharedLosMask(player);
+	bool revealAll = cmpRangeManager->GetLosRevealAll(player);
+	if (recreated || player != m_Player || sharedLosMask != m_SharedLosMask || revealAll != m_RevealAll)
+	{
+		m_Player = player;
+		m_SharedLosMask = sharedLosMask;
+		m_RevealAll = revealAll;
+		dirty.SetAll((u16)m_MapSize, (u16)m_MapSize);
+	}
+
+	if (dirty.IsEmpty())
+		return;
+
+	// Every texel within the blur radius of a changed vertex needs to be recomputed
+	const ssize_t radius = g_BlurSize/2;
+	size_t i0 = (size_t)std::max((ssize_t)dirty.i0 - radius, (ssize_t)0);
+	size_t j0 = (size_t)std::max((ssize_t)dirty.j0 - radius, (ssize_t)0);
+	size_t i1 = (size_t)std::min((ssize_t)dirty.i1 + radius, m_MapSize - 1);
+	size_t j1 = (size_t)std::min((ssize_t)dirty.j1 + radius, m_MapSize - 1);
+	size_t w = i1 - i0 + 1;
+	size_t h = j1 - j0 + 1;
+
+	std::vector<u8> losData;
+	losData.resize(GetBitmapSize(w, h));
 
-	GenerateBitmap(los, &losData[0], m_MapSize, m_MapSize);
+	GenerateBitmap(los, &losData[0], m_MapSize, m_MapSize, i0, j0, w, h);
 
 	if (CRenderer::IsInitialised() && g_Renderer.m_Options.m_SmoothLOS && recreated)
 	{
@@ -306,7 +337,21 @@ void CLOSTexture::RecomputeTexture(int unit)
 	}
 
 	g_Renderer.BindTexture(unit, m_Texture);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_MapSize + g_BlurSize - 1, m_MapSize + g_BlurSize - 1, GL_ALPHA, GL_UNSIGNED_BYTE, &losData[0]);
+
+	if (w == (size_t)m_MapSize && h == (size_t)m_MapSize)
+	{
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_MapSize + g_BlurSize - 1, m_MapSize + g_BlurSize - 1, GL_ALPHA, GL_UNSIGNED_BYTE, &losData[0]);
+	}
+	else
+	{
+		// The blurred data is in the top-left corner of each padded row,
+		// so pack it tightly for uploading
+		const size_t rowSize = w + g_BlurSize - 1;
+		for (size_t j = 1; j < h; ++j)
+			memmove(&losData[j*w], &losData[j*rowSize], w);
+
+		glTexSubImage2D(GL_TEXTURE_2D, 0, (GLint)i0, (GLint)j0, (GLsizei)w, (GLsizei)h, GL_ALPHA, GL_UNSIGNED_BYTE, &losData[0]);
+	}
 }
 
 size_t CLOSTexture::GetBitmapSize(size_t w, size_t h)
@@ -316,23 +361,42 @@ size_t CLOSTexture::GetBitmapSize(size_t w, size_t h)
 
 void CLOSTexture::GenerateBitmap(ICmpRangeManager::CLosQuerier los, u8* losData, size_t w, size_t h)
 {
+	GenerateBitmap(los, losData, w, h, 0, 0, w, h);
+}
+
+/**
+ * Computes the blurred texels (i0,j0)-(i0+w-1,j0+h-1) of the LOS texture for a
+ * mapW*mapH vertex map.
+ * The result is stored in the top-left corner of a bitmap of GetBitmapSize(w, h).
+ */
+void CLOSTexture::GenerateBitmap(ICmpRangeManager::CLosQuerier los, u8* losData, size_t mapW, size_t mapH, size_t i0, size_t j0, size_t w, size_t h)
+{
+	ENSURE(i0 + w <= mapW && j0 + h <= mapH);
+
 	const size_t rowSize = w + g_BlurSize-1; // size of losData rows
+	const ssize_t radius = g_BlurSize/2;
 
 	u8 *dataPtr = losData;
 
-	// Initialise the top padding
-	for (size_t j = 0; j < g_BlurSize/2; ++j)
-		for (size_t i = 0; i < rowSize; ++i)
-			*dataPtr++ = 0;
-
-	for (size_t j = 0; j < h; ++j)
+	// Fill in the visibility data for every vertex the blur will reach,
+	// with zero padding for vertexes outside the map
+	for (ssize_t j = (ssize_t)j0 - radius; j < (ssize_t)(j0 + h) + radius; ++j)
 	{
+		if (j < 0 || j >= (ssize_t)mapH)
+		{
+			for (size_t i = 0; i < rowSize; ++i)
+				*dataPtr++ = 0;
+			continue;
+		}
+
+		ssize_t iBegin = std::max((ssize_t)i0 - radius, (ssize_t)0);
+		ssize_t iEnd = std::min((ssize_t)(i0 + w) + radius, (ssize_t)mapW);
+
 		// Initialise the left padding
-		for (size_t i = 0; i < g_BlurSize/2; ++i)
+		for (ssize_t i = (ssize_t)i0 - radius; i < iBegin; ++i)
 			*dataPtr++ = 0;
 
-		// Fill in the visibility data
-		for (size_t i = 0; i < w; ++i)
+		for (ssize_t i = iBegin; i < iEnd; ++i)
 		{
 			if (los.IsVisible_UncheckedRange(i, j))
 				*dataPtr++ = 255;
@@ -343,18 +407,15 @@ void CLOSTexture::GenerateBitmap(ICmpRangeManager::CLosQuerier los, u8* losData,
 		}
 
 		// Initialise the right padding
-		for (size_t i = 0; i < g_BlurSize/2; ++i)
+		for (ssize_t i = iEnd; i < (ssize_t)(i0 + w) + radius; ++i)
 			*dataPtr++ = 0;
 	}
 
-	// Initialise the bottom padding
-	for (size_t j = 0; j < g_BlurSize/2; ++j)
-		for (size_t i = 0; i < rowSize; ++i)
-			*dataPtr++ = 0;
-
 	// Horizontal blur:
+	// (This includes the padding rows, since they contain the vertexes
+	// around the region when it's not the whole map)
 
-	for (size_t j = g_BlurSize/2; j < h + g_BlurSize/2; ++j)
+	for (size_t j = 0; j < h + g_BlurSize - 1; ++j)
 	{
 		for (size_t i = 0; i < w; ++i)
 		{
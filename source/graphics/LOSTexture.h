@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -83,11 +83,18 @@ private:
 
 	size_t GetBitmapSize(size_t w, size_t h);
 	void GenerateBitmap(ICmpRangeManager::CLosQuerier los, u8* losData, size_t w, size_t h);
+	void GenerateBitmap(ICmpRangeManager::CLosQuerier los, u8* losData, size_t mapW, size_t mapH, size_t i0, size_t j0, size_t w, size_t h);
 
 	CSimulation2& m_Simulation;
 
 	bool m_Dirty;
 
+	// Settings that the current texture was computed with; if any change,
+	// the whole texture must be recomputed
+	player_id_t m_Player;
+	u32 m_SharedLosMask;
+	bool m_RevealAll;
+
 	GLuint m_Texture;
 	GLuint m_TextureSmooth1, m_TextureSmooth2;
 	
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -19,6 +19,7 @@
 
 #include "MapGenerator.h"
 
+#include "graphics/MapGeneratorPrimitives.h"
 #include "lib/timer.h"
 #include "ps/CLogger.h"
 
@@ -98,6 +99,10 @@ bool CMapGeneratorWorker::Run()
 	m_ScriptInterface->RegisterFunction<void, int, CMapGeneratorWorker::SetProgress>("SetProgress");
 	m_ScriptInterface->RegisterFunction<void, CMapGeneratorWorker::MaybeGC>("MaybeGC");
 	m_ScriptInterface->RegisterFunction<std::vector<std::string>, CMapGeneratorWorker::GetCivData>("GetCivData");
+	m_ScriptInterface->RegisterFunction<std::vector<u32>, CScriptValRooted, std::vector<u8>, CMapGeneratorWorker::ClumpArea>("ClumpArea");
+	m_ScriptInterface->RegisterFunction<std::vector<float>, std::vector<float>, float, u32, CMapGeneratorWorker::SmoothHeightmap>("SmoothHeightmap");
+	m_ScriptInterface->RegisterFunction<std::vector<float>, u32, float, u32, u32, CMapGeneratorWorker::NoiseField>("NoiseField");
+	m_ScriptInterface->RegisterFunction<std::vector<u32>, std::vector<u8>, u32, float, u32, CMapGeneratorWorker::PlaceObjects>("PlaceObjects");
 
 	// Parse settings
 	CScriptValRooted settingsVal = m_ScriptInterface->ParseJSON(m_Settings);
@@ -216,6 +221,50 @@ std::vector<std::string> CMapGeneratorWorker::GetCivData(void* UNUSED(cbdata))
 
 }
 
+std::vector<u32> CMapGeneratorWorker::ClumpArea(void* cbdata, CScriptValRooted placer, std::vector<u8> allowed)
+{
+	CMapGeneratorWorker* self = static_cast<CMapGeneratorWorker*>(cbdata);
+
+	// Read the settings from the script's ClumpPlacer object
+	float x, z, size, coherence, smoothness, failFraction = 0.0f;
+	if (!self->m_ScriptInterface->GetProperty(placer.get(), "x", x) ||
+		!self->m_ScriptInterface->GetProperty(placer.get(), "z", z) ||
+		!self->m_ScriptInterface->GetProperty(placer.get(), "size", size) ||
+		!self->m_ScriptInterface->GetProperty(placer.get(), "coherence", coherence) ||
+		!self->m_ScriptInterface->GetProperty(placer.get(), "smoothness", smoothness))
+	{
+		LOGERROR(L"CMapGeneratorWorker::ClumpArea: Invalid placer");
+		return std::vector<u32>();
+	}
+	self->m_ScriptInterface->GetProperty(placer.get(), "failFraction", failFraction);
+
+	if (!MapGenGetGridSize(allowed.size()))
+		LOGERROR(L"CMapGeneratorWorker::ClumpArea: Tile grid isn't square");
+
+	return MapGenClumpArea(x, z, size, coherence, smoothness, failFraction, allowed, self->m_MapGenRNG);
+}
+
+std::vector<float> CMapGeneratorWorker::SmoothHeightmap(void* UNUSED(cbdata), std::vector<float> heights, float strength, u32 passes)
+{
+	if (!MapGenGetGridSize(heights.size()))
+		LOGERROR(L"CMapGeneratorWorker::SmoothHeightmap: Heightmap isn't square");
+	MapGenSmoothHeightmap(heights, strength, passes);
+	return heights;
+}
+
+std::vector<float> CMapGeneratorWorker::NoiseField(void* UNUSED(cbdata), u32 mapSize, float period, u32 octaves, u32 seed)
+{
+	return MapGenNoiseField(mapSize, period, octaves, seed);
+}
+
+std::vector<u32> CMapGeneratorWorker::PlaceObjects(void* cbdata, std::vector<u8> allowed, u32 count, float minDistance, u32 maxAttempts)
+{
+	CMapGeneratorWorker* self = static_cast<CMapGeneratorWorker*>(cbdata);
+	if (!MapGenGetGridSize(allowed.size()))
+		LOGERROR(L"CMapGeneratorWorker::PlaceObjects: Tile grid isn't square");
+	return MapGenPlaceObjects(allowed, count, minDistance, maxAttempts, self->m_MapGenRNG);
+}
+
 bool CMapGeneratorWorker::LoadScripts(const std::wstring& libraryName)
 {
 	// Ignore libraries that are already loaded
@@ -282,3 +331,66 @@ shared_ptr<ScriptInterface::StructuredClone> CMapGenerator::GetResults()
 {
 	return m_Worker->GetResults();
 }
+
+// Map being generated in advance of loading, and the script and settings it was
+// started with. (These are only touched by the main thread.)
+static CMapGenerator* g_PregeneratedMap = NULL;
+static VfsPath g_PregeneratedScript;
+static std::string g_PregeneratedSettings;
+
+// Discarded generators whose threads haven't finished yet (deleting them
+// would block until they have)
+static std::vector<CMapGenerator*> g_DiscardedMaps;
+
+static void DeleteFinishedMaps(bool wait)
+{
+	for (size_t i = 0; i < g_DiscardedMaps.size(); )
+	{
+		if (wait || g_DiscardedMaps[i]->GetProgress() <= 0)
+		{
+			delete g_DiscardedMaps[i];
+			g_DiscardedMaps[i] = g_DiscardedMaps.back();
+			g_DiscardedMaps.pop_back();
+		}
+		else
+			++i;
+	}
+}
+
+void CMapGenerator::Pregenerate(const VfsPath& scriptFile, const std::string& settings)
+{
+	if (g_PregeneratedMap && g_PregeneratedScript == scriptFile && g_PregeneratedSettings == settings)
+		return;
+
+	DiscardPregenerated(false);
+
+	g_PregeneratedMap = new CMapGenerator();
+	g_PregeneratedScript = scriptFile;
+	g_PregeneratedSettings = settings;
+	g_PregeneratedMap->GenerateMap(scriptFile, settings);
+}
+
+CMapGenerator* CMapGenerator::TakePregenerated(const VfsPath& scriptFile, const std::string& settings)
+{
+	if (!g_PregeneratedMap || g_PregeneratedScript != scriptFile || g_PregeneratedSettings != settings)
+	{
+		DiscardPregenerated(false);
+		return NULL;
+	}
+
+	CMapGenerator* mapGen = g_PregeneratedMap;
+	g_PregeneratedMap = NULL;
+	DeleteFinishedMaps(false);
+	return mapGen;
+}
+
+void CMapGenerator::DiscardPregenerated(bool wait)
+{
+	if (g_PregeneratedMap)
+	{
+		g_DiscardedMaps.push_back(g_PregeneratedMap);
+		g_PregeneratedMap = NULL;
+	}
+
+	DeleteFinishedMaps(wait);
+}
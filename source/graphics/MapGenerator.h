@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -64,6 +64,34 @@ public:
 	 */
 	shared_ptr<ScriptInterface::StructuredClone> GetResults();
 
+	/**
+	 * Start generating a map in the background before it's needed (e.g. while
+	 * the player is still on the game setup screen), so that loading can use
+	 * the result immediately. Does nothing if the same map is already being
+	 * generated; any other pregenerated map is discarded.
+	 * Must be called from the main thread.
+	 *
+	 * @param scriptFile The VFS path for the script, as for GenerateMap
+	 * @param settings JSON string containing settings for the map generator
+	 */
+	static void Pregenerate(const VfsPath& scriptFile, const std::string& settings);
+
+	/**
+	 * Take ownership of the pregenerated map, if it was started with exactly
+	 * the given script and settings. Otherwise the pregenerated map (if any)
+	 * is discarded, since the settings must have changed.
+	 *
+	 * @return generator (which may still be running), or NULL if there's no match
+	 */
+	static CMapGenerator* TakePregenerated(const VfsPath& scriptFile, const std::string& settings);
+
+	/**
+	 * Discard the pregenerated map, if any. Generators that are still running
+	 * are left to finish on their own thread, unless @p wait is true (which
+	 * must be done before shutting down the VFS).
+	 */
+	static void DiscardPregenerated(bool wait);
+
 private:
 	CMapGeneratorWorker* m_Worker;
 
@@ -125,6 +153,12 @@ private:
 	static void MaybeGC(void* cbdata);
 	static std::vector<std::string> GetCivData(void* cbdata);
 
+	// native versions of rmgen's slowest operations (see MapGeneratorPrimitives.h)
+	static std::vector<u32> ClumpArea(void* cbdata, CScriptValRooted placer, std::vector<u8> allowed);
+	static std::vector<float> SmoothHeightmap(void* cbdata, std::vector<float> heights, float strength, u32 passes);
+	static std::vector<float> NoiseField(void* cbdata, u32 mapSize, float period, u32 octaves, u32 seed);
+	static std::vector<u32> PlaceObjects(void* cbdata, std::vector<u8> allowed, u32 count, float minDistance, u32 maxAttempts);
+
 	std::set<std::wstring> m_LoadedLibraries;
 	shared_ptr<ScriptInterface::StructuredClone> m_MapData;
 	boost::rand48 m_MapGenRNG;
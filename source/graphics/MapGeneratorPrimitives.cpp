@@ -0,0 +1,294 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "MapGeneratorPrimitives.h"
+
+#include "maths/MathUtil.h"
+
+// Random number in [0, 1), generated the same way as the map script's Math.random
+static double RandFloat(boost::rand48& rng)
+{
+	while (true)
+	{
+		double n = (double)(rng() - rng.min());
+		double d = (double)(rng.max() - rng.min()) + 1.0;
+		double r = n / d;
+		if (r < 1.0)
+			return r;
+	}
+}
+
+// Random integer in [0, n)
+static size_t RandIndex(boost::rand48& rng, size_t n)
+{
+	return std::min((size_t)(RandFloat(rng) * n), n - 1);
+}
+
+size_t MapGenGetGridSize(size_t count)
+{
+	size_t mapSize = (size_t)(sqrt((double)count) + 0.5);
+	if (mapSize == 0 || mapSize * mapSize != count)
+		return 0;
+	return mapSize;
+}
+
+std::vector<u32> MapGenClumpArea(float x, float z, float area, float coherence, float smoothness,
+	float failFraction, const std::vector<u8>& allowed, boost::rand48& rng)
+{
+	std::vector<u32> tiles;
+
+	const size_t mapSize = MapGenGetGridSize(allowed.size());
+	if (mapSize == 0 || !(area > 0.0f))
+		return tiles;
+
+	const float radius = sqrtf(area / (float)M_PI);
+	const float perim = 4.0f * radius * 2.0f * (float)M_PI;
+	const size_t intPerim = (size_t)ceilf(perim);
+
+	// Pick random radius variations at some control points around the edge
+	// (fewer for smoother clumps)
+	size_t ctrlPts = 1 + (size_t)floorf(1.0f / std::max(smoothness, 1.0f / intPerim));
+	if (ctrlPts > radius * 2.0f * (float)M_PI)
+		ctrlPts = (size_t)floorf(radius * 2.0f * (float)M_PI) + 1;
+
+	std::vector<float> ctrlCoords(ctrlPts);
+	std::vector<float> ctrlVals(ctrlPts);
+	for (size_t i = 0; i < ctrlPts; ++i)
+	{
+		ctrlCoords[i] = i * perim / ctrlPts;
+		ctrlVals[i] = 2.0f * (float)RandFloat(rng);
+	}
+
+	// Interpolate between them with a cubic spline, for every point on the edge
+	std::vector<float> noise(intPerim);
+	size_t c = 0;
+	bool looped = false;
+	for (size_t i = 0; i < intPerim; ++i)
+	{
+		if (ctrlCoords[(c+1) % ctrlPts] < i && !looped)
+		{
+			c = (c+1) % ctrlPts;
+			if (c == ctrlPts-1)
+				looped = true;
+		}
+
+		float next = looped ? perim : ctrlCoords[(c+1) % ctrlPts];
+		float t = (next > ctrlCoords[c]) ? (i - ctrlCoords[c]) / (next - ctrlCoords[c]) : 0.0f;
+
+		float v0 = ctrlVals[(c+ctrlPts-1) % ctrlPts];
+		float v1 = ctrlVals[c];
+		float v2 = ctrlVals[(c+1) % ctrlPts];
+		float v3 = ctrlVals[(c+2) % ctrlPts];
+		float P = (v3 - v2) - (v0 - v1);
+		float Q = (v0 - v1) - P;
+		float R = v2 - v0;
+		float S = v1;
+		noise[i] = P*t*t*t + Q*t*t + R*t + S;
+	}
+
+	// Fill the clump with rays from the centre to each point on the edge
+	std::vector<u8> covered(allowed.size(), 0);
+	size_t failed = 0;
+	for (size_t p = 0; p < intPerim; ++p)
+	{
+		float th = 2.0f * (float)M_PI * p / perim;
+		float r = radius * (1.0f + (1.0f - coherence) * noise[p]);
+		float s = sinf(th);
+		float co = cosf(th);
+		float xx = x;
+		float zz = z;
+		for (size_t k = 0; k < (size_t)ceilf(r); ++k)
+		{
+			ssize_t i = (ssize_t)floorf(xx);
+			ssize_t j = (ssize_t)floorf(zz);
+			if (i >= 0 && j >= 0 && i < (ssize_t)mapSize && j < (ssize_t)mapSize && allowed[j*mapSize + i])
+			{
+				u32 idx = (u32)(j*mapSize + i);
+				if (!covered[idx])
+				{
+					covered[idx] = 1;
+					tiles.push_back(idx);
+				}
+			}
+			else
+			{
+				failed++;
+			}
+			xx += s;
+			zz += co;
+		}
+	}
+
+	if (failed > area * failFraction)
+		tiles.clear();
+
+	return tiles;
+}
+
+void MapGenSmoothHeightmap(std::vector<float>& heights, float strength, size_t passes)
+{
+	const size_t mapSize = MapGenGetGridSize(heights.size());
+	if (mapSize < 2)
+		return;
+
+	std::vector<float> prev;
+	for (size_t pass = 0; pass < passes; ++pass)
+	{
+		prev = heights;
+		for (size_t z = 0; z < mapSize; ++z)
+		{
+			for (size_t x = 0; x < mapSize; ++x)
+			{
+				float sum = 0.0f;
+				size_t n = 0;
+				for (size_t nz = (z > 0 ? z-1 : 0); nz <= std::min(z+1, mapSize-1); ++nz)
+				{
+					for (size_t nx = (x > 0 ? x-1 : 0); nx <= std::min(x+1, mapSize-1); ++nx)
+					{
+						if (nx == x && nz == z)
+							continue;
+						sum += prev[nz*mapSize + nx];
+						n++;
+					}
+				}
+
+				const float h = prev[z*mapSize + x];
+				heights[z*mapSize + x] = h + strength * (sum / n - h);
+			}
+		}
+	}
+}
+
+// Smooth interpolation weight for t in [0, 1]
+static float Fade(float t)
+{
+	return t * t * (3.0f - 2.0f * t);
+}
+
+// Pseudo-random value in [0, 1] for a point on the noise lattice
+static float LatticeValue(int x, int z, u32 seed)
+{
+	u32 h = seed ^ ((u32)x * 0x27d4eb2dU) ^ ((u32)z * 0x165667b1U);
+	h ^= h >> 15;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+	return (h & 0xFFFFFF) / (float)0xFFFFFF;
+}
+
+std::vector<float> MapGenNoiseField(size_t mapSize, float period, size_t octaves, u32 seed)
+{
+	std::vector<float> field(mapSize * mapSize, 0.0f);
+
+	period = std::max(period, 1.0f);
+	octaves = std::max(octaves, (size_t)1);
+
+	float amplitude = 1.0f;
+	float totalAmplitude = 0.0f;
+	for (size_t octave = 0; octave < octaves; ++octave)
+	{
+		const u32 octaveSeed = seed + (u32)octave * 0x9E3779B9U;
+		for (size_t z = 0; z < mapSize; ++z)
+		{
+			const float fz = z / period;
+			const int iz = (int)floorf(fz);
+			const float tz = Fade(fz - iz);
+			for (size_t x = 0; x < mapSize; ++x)
+			{
+				const float fx = x / period;
+				const int ix = (int)floorf(fx);
+				const float tx = Fade(fx - ix);
+
+				float v0 = Interpolate(LatticeValue(ix, iz, octaveSeed), LatticeValue(ix+1, iz, octaveSeed), tx);
+				float v1 = Interpolate(LatticeValue(ix, iz+1, octaveSeed), LatticeValue(ix+1, iz+1, octaveSeed), tx);
+				field[z*mapSize + x] += amplitude * Interpolate(v0, v1, tz);
+			}
+		}
+
+		totalAmplitude += amplitude;
+		amplitude *= 0.5f;
+		period = std::max(period * 0.5f, 1.0f);
+	}
+
+	for (size_t i = 0; i < field.size(); ++i)
+		field[i] /= totalAmplitude;
+
+	return field;
+}
+
+std::vector<u32> MapGenPlaceObjects(const std::vector<u8>& allowed, size_t count, float minDistance,
+	size_t maxAttempts, boost::rand48& rng)
+{
+	std::vector<u32> chosen;
+
+	const size_t mapSize = MapGenGetGridSize(allowed.size());
+	if (mapSize == 0)
+		return chosen;
+
+	std::vector<u32> candidates;
+	for (size_t i = 0; i < allowed.size(); ++i)
+		if (allowed[i])
+			candidates.push_back((u32)i);
+	if (candidates.empty())
+		return chosen;
+
+	// Bucket the chosen tiles into cells at least minDistance wide, so only
+	// the neighbouring cells need to be checked for each new tile
+	const float cellSize = std::max(minDistance, 1.0f);
+	const size_t gridSize = (size_t)ceilf(mapSize / cellSize);
+	std::vector<std::vector<u32> > buckets(gridSize * gridSize);
+	const float minDistanceSq = minDistance * minDistance;
+
+	for (size_t attempt = 0; attempt < maxAttempts && chosen.size() < count; ++attempt)
+	{
+		const u32 idx = candidates[RandIndex(rng, candidates.size())];
+		const ssize_t x = idx % mapSize;
+		const ssize_t z = idx / mapSize;
+		const ssize_t cx = (ssize_t)(x / cellSize);
+		const ssize_t cz = (ssize_t)(z / cellSize);
+
+		bool ok = true;
+		for (ssize_t bz = std::max(cz-1, (ssize_t)0); ok && bz <= std::min(cz+1, (ssize_t)gridSize-1); ++bz)
+		{
+			for (ssize_t bx = std::max(cx-1, (ssize_t)0); ok && bx <= std::min(cx+1, (ssize_t)gridSize-1); ++bx)
+			{
+				const std::vector<u32>& bucket = buckets[bz*gridSize + bx];
+				for (size_t i = 0; i < bucket.size(); ++i)
+				{
+					const ssize_t dx = (ssize_t)(bucket[i] % mapSize) - x;
+					const ssize_t dz = (ssize_t)(bucket[i] / mapSize) - z;
+					if (bucket[i] == idx || (float)(dx*dx + dz*dz) < minDistanceSq)
+					{
+						ok = false;
+						break;
+					}
+				}
+			}
+		}
+
+		if (!ok)
+			continue;
+
+		buckets[cz*gridSize + cx].push_back(idx);
+		chosen.push_back(idx);
+	}
+
+	return chosen;
+}
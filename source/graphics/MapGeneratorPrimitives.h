@@ -0,0 +1,86 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Native versions of the bulk operations that random map scripts spend most of
+ * their time in, which CMapGeneratorWorker exposes to the scripts.
+ *
+ * Grids are square, mapSize*mapSize tiles (or vertices), stored row by row
+ * (i.e. index = z*mapSize + x) so they can be passed as typed arrays.
+ * Randomness comes from the given RNG (normally the map generator's, which
+ * also drives Math.random), so maps stay deterministic for a given seed.
+ */
+
+#ifndef INCLUDED_MAPGENERATORPRIMITIVES
+#define INCLUDED_MAPGENERATORPRIMITIVES
+
+#include <boost/random/linear_congruential.hpp>
+
+#include <vector>
+
+/**
+ * Returns the width of a square grid with @p count cells,
+ * or 0 if @p count isn't a (non-zero) square number.
+ */
+size_t MapGenGetGridSize(size_t count);
+
+/**
+ * Shape an irregular blob ("clump") of about @p area tiles around (x, z),
+ * like rmgen's ClumpPlacer.
+ *
+ * @param coherence 0..1: how close to a circle the clump is
+ * @param smoothness 0..1: how smoothly the edge of the clump varies
+ * @param failFraction maximum fraction of the clump's tiles that may be
+ *        outside the map or disallowed before the clump fails
+ * @param allowed mapSize*mapSize grid, non-zero for tiles the clump may cover
+ * @return indexes of the covered tiles, or an empty list if the clump failed
+ */
+std::vector<u32> MapGenClumpArea(float x, float z, float area, float coherence, float smoothness,
+	float failFraction, const std::vector<u8>& allowed, boost::rand48& rng);
+
+/**
+ * Blend each height towards the average of its neighbours.
+ *
+ * @param heights mapSize*mapSize grid of heights, updated in place
+ * @param strength 0..1: how far to move towards the average in each pass
+ * @param passes number of times to repeat the smoothing
+ */
+void MapGenSmoothHeightmap(std::vector<float>& heights, float strength, size_t passes);
+
+/**
+ * Generate a mapSize*mapSize grid of fractal value noise in the range [0, 1].
+ *
+ * @param period size (in tiles) of the largest features
+ * @param octaves number of layers of finer detail to add, each with half the
+ *        period and half the amplitude of the previous one
+ * @param seed differently seeded fields are unrelated
+ */
+std::vector<float> MapGenNoiseField(size_t mapSize, float period, size_t octaves, u32 seed);
+
+/**
+ * Pick random allowed tiles that are at least @p minDistance apart, e.g. for
+ * placing forests or resources.
+ *
+ * @param allowed mapSize*mapSize grid, non-zero for tiles that may be chosen
+ * @param count maximum number of tiles to pick
+ * @param maxAttempts give up after trying this many random tiles
+ * @return indexes of the chosen tiles, in the order they were chosen
+ */
+std::vector<u32> MapGenPlaceObjects(const std::vector<u8>& allowed, size_t count, float minDistance,
+	size_t maxAttempts, boost::rand48& rng);
+
+#endif // INCLUDED_MAPGENERATORPRIMITIVES
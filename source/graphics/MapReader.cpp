@@ -34,6 +34,8 @@
 #include "ps/CLogger.h"
 #include "ps/Loader.h"
 #include "ps/LoaderThunks.h"
+#include "ps/Profile.h"
+#include "ps/ThreadPool.h"
 #include "ps/World.h"
 #include "ps/XML/Xeromyces.h"
 #include "renderer/PostprocManager.h"
@@ -53,7 +55,7 @@
 
 
 CMapReader::CMapReader()
-	: xml_reader(0), m_PatchesPerSide(0), m_MapGen(0)
+	: xml_reader(0), m_PatchesPerSide(0), m_MapGen(0), m_UnpackFailed(false)
 {
 	cur_terrain_tex = 0;	// important - resets generator state
 
@@ -108,6 +110,12 @@ void CMapReader::LoadMap(const VfsPath& pathname, CTerrain *pTerrain_,
 	if (file_format_version < FILE_READ_VERSION)
 		throw PSERROR_File_InvalidVersion();
 
+	// unpack the terrain in the background, while the settings scripts are
+	// being run and the XML file is being loaded
+	LoadTaskId unpackTask = 0;
+	if (!only_xml)
+		unpackTask = RegMemFun(this, &CMapReader::UnpackTerrainData, L"CMapReader::UnpackTerrainData", 100, LDR_ANY_THREAD);
+
 	// delete all existing entities
 	if (pSimulation2)
 		pSimulation2->ResetState();
@@ -124,7 +132,7 @@ void CMapReader::LoadMap(const VfsPath& pathname, CTerrain *pTerrain_,
 
 	// unpack the data
 	if (!only_xml)
-		RegMemFun(this, &CMapReader::UnpackMap, L"CMapReader::UnpackMap", 1200);
+		RegMemFun(this, &CMapReader::UnpackMap, L"CMapReader::UnpackMap", 1100, LDR_MAIN_THREAD, &unpackTask, 1);
 
 	// read the corresponding XML file
 	RegMemFun(this, &CMapReader::ReadXML, L"CMapReader::ReadXML", 5800);
@@ -223,44 +231,63 @@ int CMapReader::UnpackTerrain()
 	// i.e. when the loop below was interrupted)
 	if (cur_terrain_tex == 0)
 	{
-		m_PatchesPerSide = (ssize_t)unpacker.UnpackSize();
-
-		// unpack heightmap [600us]
-		size_t verticesPerSide = m_PatchesPerSide*PATCH_SIZE+1;
-		m_Heightmap.resize(SQR(verticesPerSide));
-		unpacker.UnpackRaw(&m_Heightmap[0], SQR(verticesPerSide)*sizeof(u16));
+		// (the raw data has already been unpacked by UnpackTerrainData)
+		if (m_UnpackFailed)
+			throw PSERROR_File_UnexpectedEOF();
 
-		// unpack # textures
-		num_terrain_tex = unpacker.UnpackSize();
+		num_terrain_tex = m_TerrainTextureNames.size();
 		m_TerrainTextures.reserve(num_terrain_tex);
 	}
 
-	// unpack texture names; find handle for each texture.
+	// find handle for each texture (this has to be done in the main thread).
 	// interruptible.
 	while (cur_terrain_tex < num_terrain_tex)
 	{
-		CStr texturename;
-		unpacker.UnpackString(texturename);
-
 		ENSURE(CTerrainTextureManager::IsInitialised()); // we need this for the terrain properties (even when graphics are disabled)
-		CTerrainTextureEntry* texentry = g_TexMan.FindTexture(texturename);
+		CTerrainTextureEntry* texentry = g_TexMan.FindTexture(m_TerrainTextureNames[cur_terrain_tex]);
 		m_TerrainTextures.push_back(texentry);
 
 		cur_terrain_tex++;
 		LDR_CHECK_TIMEOUT(cur_terrain_tex, num_terrain_tex);
 	}
 
-	// unpack tile data [3ms]
-	ssize_t tilesPerSide = m_PatchesPerSide*PATCH_SIZE;
-	m_Tiles.resize(size_t(SQR(tilesPerSide)));
-	unpacker.UnpackRaw(&m_Tiles[0], sizeof(STileDesc)*m_Tiles.size());
-
 	// reset generator state.
 	cur_terrain_tex = 0;
 
 	return 0;
 }
 
+int CMapReader::UnpackTerrainData()
+{
+	try
+	{
+		m_PatchesPerSide = (ssize_t)unpacker.UnpackSize();
+
+		// unpack heightmap [600us]
+		size_t verticesPerSide = m_PatchesPerSide*PATCH_SIZE+1;
+		m_Heightmap.resize(SQR(verticesPerSide));
+		unpacker.UnpackRaw(&m_Heightmap[0], SQR(verticesPerSide)*sizeof(u16));
+
+		// unpack texture names
+		size_t numTextures = unpacker.UnpackSize();
+		m_TerrainTextureNames.resize(numTextures);
+		for (size_t i = 0; i < numTextures; ++i)
+			unpacker.UnpackString(m_TerrainTextureNames[i]);
+
+		// unpack tile data [3ms]
+		ssize_t tilesPerSide = m_PatchesPerSide*PATCH_SIZE;
+		m_Tiles.resize(size_t(SQR(tilesPerSide)));
+		unpacker.UnpackRaw(&m_Tiles[0], sizeof(STileDesc)*m_Tiles.size());
+	}
+	catch (PSERROR_File&)
+	{
+		// (we can't throw out of a background task)
+		m_UnpackFailed = true;
+	}
+
+	return 0;
+}
+
 // ApplyData: take all the input data, and rebuild the scene from it
 int CMapReader::ApplyData()
 {
@@ -419,7 +446,8 @@ private:
 
 	// loop counters
 	int node_idx;
-	int entity_idx;
+	size_t entity_idx; // index into m_EntityBatches
+	bool entities_parsed;
 
 	// # entities+nonentities processed and total (for progress calc)
 	int completed_jobs, total_jobs;
@@ -435,13 +463,42 @@ private:
 	void ReadCinema(XMBElement parent);
 	void ReadTriggers(XMBElement parent);
 	int ReadEntities(XMBElement parent, double end_time);
+
+public:
+	// Settings of an entity, parsed from the XML before any entities are created
+	struct EntityData
+	{
+		CStrW templateName;
+		entity_id_t uid;
+		int playerID;
+		CFixedVector3D position;
+		CFixedVector3D orientation;
+		long seed;
+		// obstruction control groups
+		entity_id_t controlGroup;
+		entity_id_t controlGroup2;
+		// the entity that was created, or INVALID_ENTITY if that failed
+		entity_id_t ent;
+	};
+
+private:
+	// (thread-safe, since it only reads the XMB data)
+	void ReadEntity(XMBElement entity, EntityData& data) const;
+	static void ReadEntitiesCB(void* cbdata, size_t begin, size_t end);
+
+	std::vector<EntityData> m_Entities;
+	// indexes into m_Entities, grouped into batches with the same template
+	// (in order of the templates' first use)
+	std::vector<std::vector<size_t> > m_EntityBatches;
 };
 
 
 void CXMLReader::Init(const VfsPath& xml_filename)
 {
 	// must only assign once, so do it here
-	node_idx = entity_idx = 0;
+	node_idx = 0;
+	entity_idx = 0;
+	entities_parsed = false;
 
 	if (xmb_file.Load(g_VFS, xml_filename) != PSRETURN_OK)
 		throw PSERROR_File_ReadFailed();
@@ -929,114 +986,179 @@ void CXMLReader::ReadTriggers(XMBElement UNUSED(parent))
 {
 }
 
-int CXMLReader::ReadEntities(XMBElement parent, double end_time)
+void CXMLReader::ReadEntity(XMBElement entity, EntityData& data) const
 {
-	XMBElementList entities = parent.GetChildNodes();
+	ENSURE(entity.GetNodeName() == el_entity);
 
-	ENSURE(m_MapReader.pSimulation2);
-	CSimulation2& sim = *m_MapReader.pSimulation2;
-	CmpPtr<ICmpPlayerManager> cmpPlayerManager(sim, SYSTEM_ENTITY);
+	XMBAttributeList attrs = entity.GetAttributes();
+	CStr uid = attrs.GetNamedItem(at_uid);
+	ENSURE(!uid.empty());
+	data.uid = uid.ToInt();
+
+	data.playerID = 0;
+	data.seed = 0;
+	data.controlGroup = INVALID_ENTITY;
+	data.controlGroup2 = INVALID_ENTITY;
+	data.ent = INVALID_ENTITY;
 
-	while (entity_idx < entities.Count)
+	XERO_ITER_EL(entity, setting)
 	{
-		// all new state at this scope and below doesn't need to be
-		// wrapped, since we only yield after a complete iteration.
+		int element_name = setting.GetNodeName();
 
-		XMBElement entity = entities.Item(entity_idx++);
-		ENSURE(entity.GetNodeName() == el_entity);
+		// <template>
+		if (element_name == el_template)
+		{
+			data.templateName = setting.GetText().FromUTF8();
+		}
+		// <player>
+		else if (element_name == el_player)
+		{
+			data.playerID = setting.GetText().ToInt();
+		}
+		// <position>
+		else if (element_name == el_position)
+		{
+			XMBAttributeList attrs = setting.GetAttributes();
+			data.position = CFixedVector3D(
+				fixed::FromString(attrs.GetNamedItem(at_x)),
+				fixed::FromString(attrs.GetNamedItem(at_y)),
+				fixed::FromString(attrs.GetNamedItem(at_z)));
+		}
+		// <orientation>
+		else if (element_name == el_orientation)
+		{
+			XMBAttributeList attrs = setting.GetAttributes();
+			data.orientation = CFixedVector3D(
+				fixed::FromString(attrs.GetNamedItem(at_x)),
+				fixed::FromString(attrs.GetNamedItem(at_y)),
+				fixed::FromString(attrs.GetNamedItem(at_z)));
+			// TODO: what happens if some attributes are missing?
+		}
+		// <obstruction>
+		else if (element_name == el_obstruction)
+		{
+			XMBAttributeList attrs = setting.GetAttributes();
+			data.controlGroup = attrs.GetNamedItem(at_group).ToInt();
+			data.controlGroup2 = attrs.GetNamedItem(at_group2).ToInt();
+		}
+		// <actor>
+		else if (element_name == el_actor)
+		{
+			XMBAttributeList attrs = setting.GetAttributes();
+			data.seed = attrs.GetNamedItem(at_seed).ToLong();
+		}
+		else
+			debug_warn(L"Invalid map XML data");
+	}
+}
 
-		XMBAttributeList attrs = entity.GetAttributes();
-		CStr uid = attrs.GetNamedItem(at_uid);
-		ENSURE(!uid.empty());
-		int EntityUid = uid.ToInt();
+struct ReadEntitiesJob
+{
+	const CXMLReader* reader;
+	const std::vector<XMBElement>* elements;
+	std::vector<CXMLReader::EntityData>* entities;
+};
 
-		CStrW TemplateName;
-		int PlayerID = 0;
-		CFixedVector3D Position;
-		CFixedVector3D Orientation;
-		long Seed = 0;
+void CXMLReader::ReadEntitiesCB(void* cbdata, size_t begin, size_t end)
+{
+	ReadEntitiesJob* job = static_cast<ReadEntitiesJob*>(cbdata);
+	for (size_t i = begin; i < end; ++i)
+		job->reader->ReadEntity((*job->elements)[i], (*job->entities)[i]);
+}
 
-		// Obstruction control groups.
-		entity_id_t ControlGroup = INVALID_ENTITY;
-		entity_id_t ControlGroup2 = INVALID_ENTITY;
+int CXMLReader::ReadEntities(XMBElement parent, double end_time)
+{
+	ENSURE(m_MapReader.pSimulation2);
+	CSimulation2& sim = *m_MapReader.pSimulation2;
+	CmpPtr<ICmpPlayerManager> cmpPlayerManager(sim, SYSTEM_ENTITY);
 
-		XERO_ITER_EL(entity, setting)
-		{
-			int element_name = setting.GetNodeName();
+	// first call to generator: parse all the entities (in parallel, since that's
+	// independent of the simulation), and group them into batches by template
+	if (!entities_parsed)
+	{
+		PROFILE("parse entities");
+
+		XMBElementList entityNodes = parent.GetChildNodes();
+		std::vector<XMBElement> elements;
+		elements.reserve(entityNodes.Count);
+		for (int i = 0; i < entityNodes.Count; ++i)
+			elements.push_back(entityNodes.Item(i));
+
+		m_Entities.resize(elements.size());
+		ReadEntitiesJob job = { this, &elements, &m_Entities };
+		if (g_ThreadPool)
+			g_ThreadPool->ParallelFor(elements.size(), 64, &CXMLReader::ReadEntitiesCB, &job);
+		else
+			ReadEntitiesCB(&job, 0, elements.size());
 
-			// <template>
-			if (element_name == el_template)
-			{
-				TemplateName = setting.GetText().FromUTF8();
-			}
-			// <player>
-			else if (element_name == el_player)
-			{
-				PlayerID = setting.GetText().ToInt();
-			}
-			// <position>
-			else if (element_name == el_position)
-			{
-				XMBAttributeList attrs = setting.GetAttributes();
-				Position = CFixedVector3D(
-					fixed::FromString(attrs.GetNamedItem(at_x)),
-					fixed::FromString(attrs.GetNamedItem(at_y)),
-					fixed::FromString(attrs.GetNamedItem(at_z)));
-			}
-			// <orientation>
-			else if (element_name == el_orientation)
-			{
-				XMBAttributeList attrs = setting.GetAttributes();
-				Orientation = CFixedVector3D(
-					fixed::FromString(attrs.GetNamedItem(at_x)),
-					fixed::FromString(attrs.GetNamedItem(at_y)),
-					fixed::FromString(attrs.GetNamedItem(at_z)));
-				// TODO: what happens if some attributes are missing?
-			}
-			// <obstruction>
-			else if (element_name == el_obstruction)
+		// (Batches are split up so that we can still yield regularly for the progress bar)
+		const size_t maxBatchSize = 256;
+		std::map<CStrW, size_t> openBatches;
+		for (size_t i = 0; i < m_Entities.size(); ++i)
+		{
+			std::map<CStrW, size_t>::iterator it = openBatches.find(m_Entities[i].templateName);
+			if (it == openBatches.end() || m_EntityBatches[it->second].size() >= maxBatchSize)
 			{
-				XMBAttributeList attrs = setting.GetAttributes();
-				ControlGroup = attrs.GetNamedItem(at_group).ToInt();
-				ControlGroup2 = attrs.GetNamedItem(at_group2).ToInt();
+				openBatches[m_Entities[i].templateName] = m_EntityBatches.size();
+				m_EntityBatches.push_back(std::vector<size_t>(1, i));
 			}
-			// <actor>
-			else if (element_name == el_actor)
+			else
 			{
-				XMBAttributeList attrs = setting.GetAttributes();
-				Seed = attrs.GetNamedItem(at_seed).ToLong();
+				m_EntityBatches[it->second].push_back(i);
 			}
-			else
-				debug_warn(L"Invalid map XML data");
 		}
 
-		entity_id_t ent = sim.AddEntity(TemplateName, EntityUid);
-		entity_id_t player = cmpPlayerManager->GetPlayerByID(PlayerID);
-		if (ent == INVALID_ENTITY || player == INVALID_ENTITY)
-		{	// Don't add entities with invalid player IDs
-			LOGERROR(L"Failed to load entity template '%ls'", TemplateName.c_str());
-		}
-		else
+		entities_parsed = true;
+		LDR_CHECK_TIMEOUT(completed_jobs, total_jobs);
+	}
+
+	while (entity_idx < m_EntityBatches.size())
+	{
+		// all new state at this scope and below doesn't need to be
+		// wrapped, since we only yield after a complete iteration.
+
+		const std::vector<size_t>& batch = m_EntityBatches[entity_idx++];
+		const CStrW& templateName = m_Entities[batch[0]].templateName;
+
+		std::vector<entity_id_t> ents(batch.size());
+		for (size_t i = 0; i < batch.size(); ++i)
+			ents[i] = m_Entities[batch[i]].uid;
+
+		sim.AddEntities(templateName, ents);
+
+		for (size_t i = 0; i < batch.size(); ++i)
 		{
+			EntityData& data = m_Entities[batch[i]];
+			entity_id_t ent = ents[i];
+
+			entity_id_t player = cmpPlayerManager->GetPlayerByID(data.playerID);
+			if (ent == INVALID_ENTITY || player == INVALID_ENTITY)
+			{	// Don't add entities with invalid player IDs
+				LOGERROR(L"Failed to load entity template '%ls'", templateName.c_str());
+				continue;
+			}
+
+			data.ent = ent;
+
 			CmpPtr<ICmpPosition> cmpPosition(sim, ent);
 			if (cmpPosition)
 			{
-				cmpPosition->JumpTo(Position.X, Position.Z);
-				cmpPosition->SetYRotation(Orientation.Y);
+				cmpPosition->JumpTo(data.position.X, data.position.Z);
+				cmpPosition->SetYRotation(data.orientation.Y);
 				// TODO: other parts of the position
 			}
 
 			CmpPtr<ICmpOwnership> cmpOwnership(sim, ent);
 			if (cmpOwnership)
-				cmpOwnership->SetOwner(PlayerID);
+				cmpOwnership->SetOwner(data.playerID);
 
 			CmpPtr<ICmpObstruction> cmpObstruction(sim, ent);
 			if (cmpObstruction)
 			{
-				if (ControlGroup != INVALID_ENTITY)
-					cmpObstruction->SetControlGroup(ControlGroup);
-				if (ControlGroup2 != INVALID_ENTITY)
-					cmpObstruction->SetControlGroup2(ControlGroup2);
+				if (data.controlGroup != INVALID_ENTITY)
+					cmpObstruction->SetControlGroup(data.controlGroup);
+				if (data.controlGroup2 != INVALID_ENTITY)
+					cmpObstruction->SetControlGroup2(data.controlGroup2);
 
 				cmpObstruction->ResolveFoundationCollisions();
 			}
@@ -1044,22 +1166,25 @@ int CXMLReader::ReadEntities(XMBElement parent, double end_time)
 			CmpPtr<ICmpVisual> cmpVisual(sim, ent);
 			if (cmpVisual)
 			{
-				if (Seed != -1)
-					cmpVisual->SetActorSeed((u32)Seed);
+				if (data.seed != -1)
+					cmpVisual->SetActorSeed((u32)data.seed);
 				// TODO: variation/selection strings
 			}
-
-			if (PlayerID == m_MapReader.m_PlayerID && (boost::algorithm::ends_with(TemplateName, L"civil_centre") || m_MapReader.m_StartingCameraTarget == INVALID_ENTITY))
-			{
-				// Focus on civil centre or first entity owned by player
-				m_MapReader.m_StartingCameraTarget = ent;
-			}
 		}
 
-		completed_jobs++;
+		completed_jobs += (int)batch.size();
 		LDR_CHECK_TIMEOUT(completed_jobs, total_jobs);
 	}
 
+	// Focus on civil centre or first entity owned by player
+	// (in the map's order, not the order they were created in)
+	for (size_t i = 0; i < m_Entities.size(); ++i)
+	{
+		const EntityData& data = m_Entities[i];
+		if (data.ent != INVALID_ENTITY && data.playerID == m_MapReader.m_PlayerID && (boost::algorithm::ends_with(data.templateName, L"civil_centre") || m_MapReader.m_StartingCameraTarget == INVALID_ENTITY))
+			m_MapReader.m_StartingCameraTarget = data.ent;
+	}
+
 	return 0;
 }
 
@@ -1200,9 +1325,6 @@ int CMapReader::GenerateMap()
 {
 	if (!m_MapGen)
 	{
-		// Initialize map generator
-		m_MapGen = new CMapGenerator();
-
 		VfsPath scriptPath;
 		
 		if (m_ScriptFile.length())
@@ -1210,9 +1332,17 @@ int CMapReader::GenerateMap()
 
 		// Stringify settings to pass across threads
 		std::string scriptSettings = pSimulation2->GetScriptInterface().StringifyJSON(m_ScriptSettings.get());
-		
-		// Try to generate map
-		m_MapGen->GenerateMap(scriptPath, scriptSettings);
+
+		// Use the map that was generated during game setup, if the settings haven't changed since
+		m_MapGen = CMapGenerator::TakePregenerated(scriptPath, scriptSettings);
+		if (!m_MapGen)
+		{
+			// Initialize map generator
+			m_MapGen = new CMapGenerator();
+
+			// Try to generate map
+			m_MapGen->GenerateMap(scriptPath, scriptSettings);
+		}
 	}
 
 	// Check status
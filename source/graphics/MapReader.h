@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -71,6 +71,9 @@ private:
 
 	// UnpackTerrain: unpack the terrain from the input stream
 	int UnpackTerrain();
+	// UnpackTerrainData: unpack the raw terrain data (everything except looking up
+	// the textures), which is thread-safe so can be done while other stages load
+	int UnpackTerrainData();
 	//UnpackCinema: unpack the cinematic tracks from the input stream
 	int UnpackCinema();
 
@@ -111,6 +114,8 @@ private:
 	std::vector<u16> m_Heightmap;
 	// list of terrain textures used by map
 	std::vector<CTerrainTextureEntry*> m_TerrainTextures;
+	// names of m_TerrainTextures, as unpacked from the file
+	std::vector<CStr> m_TerrainTextureNames;
 	// tile descriptions for each tile
 	std::vector<STileDesc> m_Tiles;
 	// lightenv stored in file
@@ -149,6 +154,10 @@ private:
 	size_t cur_terrain_tex;
 	size_t num_terrain_tex;
 
+	// Whether UnpackTerrainData (which runs as a background load task) failed,
+	// so the error can be reported by UnpackTerrain on the main thread
+	bool m_UnpackFailed;
+
 	CXMLReader* xml_reader;
 };
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -53,7 +53,9 @@ CModelDefPtr CMeshManager::GetMesh(const VfsPath& pathname)
 
 	if (pmdFilename.empty())
 	{
-		LOGERROR(L"Could not load mesh '%ls'", pathname.string().c_str());
+		// (it's not an error if it just hasn't been converted yet)
+		if (!m_ColladaManager.IsConversionPending(name))
+			LOGERROR(L"Could not load mesh '%ls'", pathname.string().c_str());
 		return CModelDefPtr();
 	}
 
@@ -69,3 +71,19 @@ CModelDefPtr CMeshManager::GetMesh(const VfsPath& pathname)
 		return CModelDefPtr();
 	}
 }
+
+bool CMeshManager::IsMeshPending(const VfsPath& pathname)
+{
+	return m_ColladaManager.IsConversionPending(pathname.ChangeExtension(L""));
+}
+
+VfsPath CMeshManager::GetMeshFile(const VfsPath& pathname)
+{
+	const VfsPath name = pathname.ChangeExtension(L"");
+
+	mesh_map::iterator iter = m_MeshMap.find(name);
+	if (iter != m_MeshMap.end() && !iter->second.expired())
+		return VfsPath();
+
+	return m_ColladaManager.GetLoadablePath(name, CColladaManager::PMD);
+}
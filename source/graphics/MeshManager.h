@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -38,6 +38,19 @@ public:
 
 	CModelDefPtr GetMesh(const VfsPath& pathname);
 
+	/**
+	 * Returns whether GetMesh failed because the mesh is still being
+	 * converted (see CColladaManager::SetAsyncConversion).
+	 */
+	bool IsMeshPending(const VfsPath& pathname);
+
+	/**
+	 * Returns the file that GetMesh would read the mesh from, or an empty path
+	 * if it's already loaded or can't be loaded yet. (This is used for prefetching,
+	 * and will start converting the mesh if necessary.)
+	 */
+	VfsPath GetMeshFile(const VfsPath& pathname);
+
 private:
 	typedef boost::unordered_map<VfsPath, boost::weak_ptr<CModelDef> > mesh_map;
 	mesh_map m_MeshMap;
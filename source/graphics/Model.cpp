@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -25,6 +25,7 @@
 #include "ModelDef.h"
 #include "maths/Quaternion.h"
 #include "maths/BoundingBoxAligned.h"
+#include "Camera.h"
 #include "SkeletonAnim.h"
 #include "SkeletonAnimDef.h"
 #include "SkeletonAnimManager.h"
@@ -40,7 +41,7 @@
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Constructor
 CModel::CModel(CSkeletonAnimManager& skeletonAnimManager)
-	: m_Flags(0), m_Anim(NULL), m_AnimTime(0),
+	: m_Flags(0), m_CurrentLOD(0), m_Anim(NULL), m_AnimTime(0),
 	m_BoneMatrices(NULL),
 	m_AmmoPropPoint(NULL), m_AmmoLoadedProp(0),
 	m_SkeletonAnimManager(skeletonAnimManager)
@@ -65,6 +66,9 @@ void CModel::ReleaseData()
 	m_Props.clear();
 
 	m_pModelDef = CModelDefPtr();
+	m_BaseModelDef = CModelDefPtr();
+	m_LODs.clear();
+	m_CurrentLOD = 0;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -75,6 +79,7 @@ bool CModel::InitModel(const CModelDefPtr& modeldef)
 	ReleaseData();
 
 	m_pModelDef = modeldef;
+	m_BaseModelDef = modeldef;
 	
 	size_t numBones = modeldef->GetNumBones();
 	if (numBones != 0)
@@ -96,6 +101,87 @@ bool CModel::InitModel(const CModelDefPtr& modeldef)
 }
 
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// SetLODs: set the simplified meshes for this model
+void CModel::SetLODs(const std::vector<LOD>& lods)
+{
+	ENSURE(m_BaseModelDef);
+
+	if (m_CurrentLOD != 0)
+	{
+		m_pModelDef = m_BaseModelDef;
+		m_CurrentLOD = 0;
+		SetRenderData(NULL);
+	}
+
+	m_LODs = lods;
+
+	size_t numBones = m_BaseModelDef->GetNumBones();
+	size_t numBlends = m_BaseModelDef->GetNumBlends();
+	for (size_t i = 0; i < m_LODs.size(); ++i)
+	{
+		ENSURE(m_LODs[i].m_ModelDef->GetNumBones() == numBones);
+		numBlends = std::max(numBlends, m_LODs[i].m_ModelDef->GetNumBlends());
+
+		// Keep the list sorted from most to least detailed
+		for (size_t j = i; j > 0 && m_LODs[j].m_ScreenSize > m_LODs[j-1].m_ScreenSize; --j)
+			std::swap(m_LODs[j], m_LODs[j-1]);
+	}
+
+	// The blend matrices are stored after the bone matrices, so make sure
+	// there's enough space for whichever mesh ends up being used
+	if (numBones != 0 && numBlends > m_BaseModelDef->GetNumBlends())
+	{
+		rtl_FreeAligned(m_BoneMatrices);
+		m_BoneMatrices = (CMatrix3D*)rtl_AllocateAligned(sizeof(CMatrix3D) * (numBones + 1 + numBlends), 16);
+		for (size_t i = 0; i < numBones + 1 + numBlends; ++i)
+			m_BoneMatrices[i].SetIdentity();
+		InvalidatePosition();
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// SelectLOD: choose the mesh to render based on size on screen
+void CModel::SelectLOD(const CCamera& camera)
+{
+	if (m_LODs.empty())
+		return;
+
+	// Models near a threshold must move this much further past it before switching
+	const float hysteresis = 0.1f;
+
+	// Estimate the fraction of the screen height covered by the model
+	const CBoundingBoxAligned& bounds = GetWorldBounds();
+	CVector3D centre;
+	bounds.GetCentre(centre);
+	float radius = (bounds[1] - bounds[0]).Length() * 0.5f;
+	float distance = (centre - camera.GetOrientation().GetTranslation()).Length();
+
+	float screenSize;
+	if (distance <= radius)
+		screenSize = 1.f;
+	else
+		screenSize = radius / (distance * tanf(camera.GetFOV() * 0.5f));
+
+	size_t lod = m_CurrentLOD;
+	while (lod < m_LODs.size() && screenSize < m_LODs[lod].m_ScreenSize * (1.f - hysteresis))
+		++lod;
+	while (lod > 0 && screenSize > m_LODs[lod-1].m_ScreenSize * (1.f + hysteresis))
+		--lod;
+
+	if (lod == m_CurrentLOD)
+		return;
+
+	m_CurrentLOD = lod;
+	m_pModelDef = (lod == 0 ? m_BaseModelDef : m_LODs[lod-1].m_ModelDef);
+
+	// The renderer's per-model data depends on the mesh, so it has to be recreated
+	SetRenderData(NULL);
+
+	// Blend matrices depend on the mesh too
+	InvalidatePosition();
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // CalcBound: calculate the world space bounds of this model
 void CModel::CalcBounds()
@@ -321,9 +407,10 @@ void CModel::ValidatePosition()
 		// a parent animation state that is out of date.
 		m_Parent->ValidatePosition();
 		
-		// Parent will recursively call our validation.
-		ENSURE(m_PositionValid);
-		return;
+		// Parent will recursively call our validation, unless we're
+		// a hidden prop (in which case it only updated our transform)
+		if (m_PositionValid)
+			return;
 	}
 
 	if (m_Anim && m_BoneMatrices)
@@ -332,7 +419,7 @@ void CModel::ValidatePosition()
 	
 		ENSURE(m_pModelDef->GetNumBones() == m_Anim->m_AnimDef->GetNumKeys());
 	
-		m_Anim->m_AnimDef->BuildBoneMatrices(m_AnimTime, m_BoneMatrices, !(m_Flags & MODELFLAG_NOLOOPANIMATION));
+		m_Anim->m_AnimDef->BuildBoneMatricesShared(m_AnimTime, m_BoneMatrices, !(m_Flags & MODELFLAG_NOLOOPANIMATION));
 	}
 	else if (m_BoneMatrices)
 	{
@@ -375,22 +462,29 @@ void CModel::ValidatePosition()
 	{
 		const Prop& prop=m_Props[j];
 
-		CMatrix3D proptransform = prop.m_Point->m_Transform;;
+		CMatrix3D proptransform;
 		if (prop.m_Point->m_BoneIndex != 0xff)
 		{
-			CMatrix3D boneMatrix = m_BoneMatrices[prop.m_Point->m_BoneIndex];
-			if (!worldSpaceBoneMatrices)
-				boneMatrix.Concatenate(GetTransform());
-			proptransform.Concatenate(boneMatrix);
+			if (worldSpaceBoneMatrices)
+				proptransform = m_BoneMatrices[prop.m_Point->m_BoneIndex] * prop.m_Point->m_Transform;
+			else
+				proptransform = m_Transform * m_BoneMatrices[prop.m_Point->m_BoneIndex] * prop.m_Point->m_Transform;
 		}
 		else
 		{
 			// not relative to any bone; just apply world-space transformation (i.e. relative to object-space origin)
-			proptransform.Concatenate(m_Transform);
+			proptransform = m_Transform * prop.m_Point->m_Transform;
 		}
 		
 		prop.m_Model->SetTransform(proptransform);
-		prop.m_Model->ValidatePosition();
+
+		// Hidden props aren't rendered, so their bones and sub-props don't need
+		// computing until they're shown (or something asks for them), at which
+		// point their ValidatePosition will find them still invalid. Their own
+		// transform is kept current since it's cheap and e.g. projectile launch
+		// points are read from hidden ammo props.
+		if (!prop.m_Hidden)
+			prop.m_Model->ValidatePosition();
 	}
 
 	if (m_BoneMatrices)
@@ -561,7 +655,9 @@ CModelAbstract* CModel::Clone() const
 {
 	CModel* clone = new CModel(m_SkeletonAnimManager);
 	clone->m_ObjectBounds = m_ObjectBounds;
-	clone->InitModel(m_pModelDef);
+	clone->InitModel(m_BaseModelDef);
+	if (!m_LODs.empty())
+		clone->SetLODs(m_LODs);
 	clone->SetMaterial(m_Material);
 	clone->SetAnimation(m_Anim);
 	clone->SetFlags(m_Flags);
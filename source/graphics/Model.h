@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -31,6 +31,7 @@
 #include "ps/Overlay.h"
 
 struct SPropPoint;
+class CCamera;
 class CObjectEntry;
 class CSkeletonAnim;
 class CSkeletonAnimDef;
@@ -73,6 +74,19 @@ public:
 		bool m_Hidden; ///< Should this prop be temporarily removed from rendering?
 	};
 
+	/**
+	 * A simplified version of the model's mesh, used when the model is small on screen.
+	 */
+	struct LOD
+	{
+		LOD(const CModelDefPtr& modelDef, float screenSize) : m_ModelDef(modelDef), m_ScreenSize(screenSize) {}
+
+		CModelDefPtr m_ModelDef;
+
+		/// Fraction of the screen height below which this mesh is used
+		float m_ScreenSize;
+	};
+
 public:
 	// constructor
 	CModel(CSkeletonAnimManager& skeletonAnimManager);
@@ -90,9 +104,22 @@ public:
 	// update this model's state; 'time' is the absolute time since the start of the animation, in MS
 	void UpdateTo(float time);
 
-	// get the model's geometry data
+	// get the model's geometry data (for the current level of detail)
 	const CModelDefPtr& GetModelDef() { return m_pModelDef; }
 
+	/**
+	 * Set the simplified meshes that can replace the one given to InitModel.
+	 * They must have the same skeleton (since they share the animations and prop points).
+	 */
+	void SetLODs(const std::vector<LOD>& lods);
+
+	/**
+	 * Choose the mesh to render, based on the model's current size in the given camera's view.
+	 * To avoid popping, the model has to be a little past a level's threshold before
+	 * switching to or from it.
+	 */
+	void SelectLOD(const CCamera& camera);
+
 	// set the model's material
 	void SetMaterial(const CMaterial &material);
 	// set the model's player ID, recursively through props
@@ -256,6 +283,12 @@ private:
 	CMaterial m_Material;
 	// pointer to the model's raw 3d data
 	CModelDefPtr m_pModelDef;
+	// full-detail mesh, when m_pModelDef is one of m_LODs
+	CModelDefPtr m_BaseModelDef;
+	// simplified meshes, in order of decreasing detail
+	std::vector<LOD> m_LODs;
+	// index of the current mesh (0 for m_BaseModelDef, else m_LODs[m_CurrentLOD-1])
+	size_t m_CurrentLOD;
 	// object space bounds of model - accounts for bounds of all possible animations
 	// that can play on a model. Not always up-to-date - currently CalcBounds()
 	// updates it when necessary.
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,6 +24,7 @@
 #include "ModelDef.h"
 #include "graphics/SkeletonAnimDef.h"
 #include "ps/FileIo.h"
+#include "ps/MemoryStats.h"
 #include "maths/Vector4D.h"
 
 #if ARCH_X86_X64
@@ -229,13 +230,15 @@ CModelDef::CModelDef() :
 	m_NumVertices(0), m_NumUVsPerVertex(0), m_pVertices(0), m_NumFaces(0), m_pFaces(0),
 	m_NumBones(0), m_Bones(0), m_InverseBindBoneMatrices(NULL),
 	m_NumBlends(0), m_pBlends(0), m_pBlendIndices(0),
-	m_Name(L"[not loaded]")
+	m_Name(L"[not loaded]"), m_AccountedMemorySize(0)
 {
 }
 
 // CModelDef Destructor
 CModelDef::~CModelDef()
 {
+	MemoryStats::Add(MEMORY_MESHES, -(ssize_t)m_AccountedMemorySize);
+
 	for(RenderDataMap::iterator it = m_RenderData.begin(); it != m_RenderData.end(); ++it)
 		delete it->second;
 	delete[] m_pVertices;
@@ -257,6 +260,19 @@ const SPropPoint* CModelDef::FindPropPoint(const char* name) const
 	return 0;
 }
 
+// GetMemorySize: return the approximate number of bytes used by the model data
+size_t CModelDef::GetMemorySize() const
+{
+	size_t size = m_NumVertices * (sizeof(SModelVertex) + m_NumUVsPerVertex*2*sizeof(float))
+		+ m_NumFaces * sizeof(SModelFace)
+		+ m_NumBones * (sizeof(CBoneState) + sizeof(CMatrix3D))
+		+ m_NumBlends * sizeof(SVertexBlend)
+		+ m_PropPoints.size() * sizeof(SPropPoint);
+	if (m_pBlendIndices)
+		size += m_NumVertices * sizeof(size_t);
+	return size;
+}
+
 // Load: read and return a new CModelDef initialised with data from given file
 CModelDef* CModelDef::Load(const VfsPath& filename, const VfsPath& name)
 {
@@ -272,6 +288,7 @@ CModelDef* CModelDef::Load(const VfsPath& filename, const VfsPath& name)
 
 	std::auto_ptr<CModelDef> mdef (new CModelDef());
 	mdef->m_Name = name;
+	mdef->m_Filename = filename;
 
 	// now unpack everything 
 	mdef->m_NumVertices = unpacker.UnpackSize();
@@ -416,6 +433,9 @@ CModelDef* CModelDef::Load(const VfsPath& filename, const VfsPath& name)
 		mdef->m_InverseBindBoneMatrices[i].Rotate(defpose[i].m_Rotation.GetInverse());
 	}
 
+	mdef->m_AccountedMemorySize = mdef->GetMemorySize();
+	MemoryStats::Add(MEMORY_MESHES, (ssize_t)mdef->m_AccountedMemorySize);
+
 	return mdef.release();
 }
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -187,6 +187,9 @@ public:
 	// null if no match (case insensitive search)
 	const SPropPoint* FindPropPoint(const char* name) const;
 
+	// return the approximate number of bytes used by the model data
+	size_t GetMemorySize() const;
+
 	/**
 	 * Transform the given vertex's position from the bind pose into the new pose.
 	 *
@@ -256,6 +259,10 @@ public:
 	// accessor: get model name (for debugging)
 	const VfsPath& GetName() const { return m_Name; }
 
+	// accessor: get the file the model was loaded from (empty if it wasn't loaded
+	// from a file), so the renderer can cache data derived from it
+	const VfsPath& GetFilename() const { return m_Filename; }
+
 public:
 	// vertex data
 	size_t m_NumVertices;
@@ -277,6 +284,9 @@ public:
 
 private:
 	VfsPath m_Name;	// filename
+	VfsPath m_Filename;	// the .pmd file this was loaded from
+
+	size_t m_AccountedMemorySize; // bytes counted in MEMORY_MESHES
 
 	// renderdata shared by models of the same modeldef,
 	// by render path
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -31,6 +31,9 @@
 
 #include <boost/random/uniform_int.hpp>
 
+// Maximum number of different selections to cache the variation keys of, per object
+static const size_t MAX_CACHED_VARIATION_KEYS = 256;
+
 CObjectBase::CObjectBase(CObjectManager& objectManager)
 : m_ObjectManager(objectManager)
 {
@@ -41,6 +44,7 @@ CObjectBase::CObjectBase(CObjectManager& objectManager)
 bool CObjectBase::Load(const VfsPath& pathname)
 {
 	m_UsedFiles.clear();
+	m_VariationKeys.clear();
 	m_UsedFiles.insert(pathname);
 
 	CXeromyces XeroFile;
@@ -61,6 +65,8 @@ bool CObjectBase::Load(const VfsPath& pathname)
 	EL(props);
 	EL(prop);
 	EL(mesh);
+	EL(lods);
+	EL(lod);
 	EL(texture);
 	EL(textures);
 	EL(colour);
@@ -79,6 +85,7 @@ bool CObjectBase::Load(const VfsPath& pathname)
 	AT(angle);
 	AT(offsetx);
 	AT(offsetz);
+	AT(screensize);
 	#undef AT
 	#undef EL
 
@@ -148,6 +155,23 @@ bool CObjectBase::Load(const VfsPath& pathname)
 					{
 						currentVariant->m_ModelFilename = VfsPath("art/meshes") / option.GetText().FromUTF8();
 					}
+					else if (option_name == el_lods)
+					{
+						XERO_ITER_EL(option, lod_element)
+						{
+							ENSURE(lod_element.GetNodeName() == el_lod);
+
+							LOD lod;
+							lod.m_ModelFilename = VfsPath("art/meshes") / lod_element.GetText().FromUTF8();
+							lod.m_ScreenSize = lod_element.GetAttributes().GetNamedItem(at_screensize).ToFloat();
+							if (lod.m_ScreenSize <= 0.f)
+							{
+								LOGERROR(L"Actor LOD '%ls' has invalid screensize ('%ls')", lod.m_ModelFilename.string().c_str(), pathname.string().c_str());
+								continue;
+							}
+							currentVariant->m_LODs.push_back(lod);
+						}
+					}
 					else if (option_name == el_textures)
 					{
 						XERO_ITER_EL(option, textures_element)
@@ -286,10 +310,51 @@ bool CObjectBase::UsesFile(const VfsPath& pathname)
 	return m_UsedFiles.find(pathname) != m_UsedFiles.end();
 }
 
+void CObjectBase::AddUsedFile(const VfsPath& pathname)
+{
+	m_UsedFiles.insert(pathname);
+}
+
+void CObjectBase::AddUsedFiles(const CObjectBase& prop)
+{
+	m_UsedFiles.insert(prop.m_UsedFiles.begin(), prop.m_UsedFiles.end());
+}
+
+void CObjectBase::GetPossibleDependencies(std::set<VfsPath>& meshes, std::set<VfsPath>& animations, std::set<CStrW>& props) const
+{
+	for (size_t i = 0; i < m_VariantGroups.size(); ++i)
+	{
+		for (size_t j = 0; j < m_VariantGroups[i].size(); ++j)
+		{
+			const Variant& var = m_VariantGroups[i][j];
+
+			if (!var.m_ModelFilename.empty())
+				meshes.insert(var.m_ModelFilename);
+
+			for (size_t k = 0; k < var.m_LODs.size(); ++k)
+				meshes.insert(var.m_LODs[k].m_ModelFilename);
+
+			for (size_t k = 0; k < var.m_Anims.size(); ++k)
+				if (!var.m_Anims[k].m_FileName.empty())
+					animations.insert(var.m_Anims[k].m_FileName);
+
+			for (size_t k = 0; k < var.m_Props.size(); ++k)
+				if (!var.m_Props[k].m_ModelName.empty())
+					props.insert(var.m_Props[k].m_ModelName);
+		}
+	}
+}
+
+void CObjectBase::ResetVariationKeys()
+{
+	m_VariationKeys.clear();
+}
+
 std::vector<u8> CObjectBase::CalculateVariationKey(const std::vector<std::set<CStr> >& selections)
 {
-	// (TODO: see CObjectManager::FindObjectVariation for an opportunity to
-	// call this function a bit less frequently)
+	std::map<std::vector<std::set<CStr> >, std::vector<u8> >::iterator cached = m_VariationKeys.find(selections);
+	if (cached != m_VariationKeys.end())
+		return cached->second;
 
 	// Calculate a complete list of choices, one per group, based on the
 	// supposedly-complete selections (i.e. not making random choices at this
@@ -375,6 +440,12 @@ std::vector<u8> CObjectBase::CalculateVariationKey(const std::vector<std::set<CS
 		}
 	}
 
+	// Units with random variations can use many different selections, so
+	// don't let the cache grow without limit
+	if (m_VariationKeys.size() >= MAX_CACHED_VARIATION_KEYS)
+		m_VariationKeys.clear();
+	m_VariationKeys[selections] = choices;
+
 	return choices;
 }
 
@@ -411,7 +482,11 @@ const CObjectBase::Variation CObjectBase::BuildVariation(const std::vector<u8>&
 		// Apply its data:
 
 		if (! var.m_ModelFilename.empty())
+		{
+			// The LODs are simplified versions of this particular mesh
 			variation.model = var.m_ModelFilename;
+			variation.lods = var.m_LODs;
+		}
 
 		if (var.m_Decal.m_SizeX && var.m_Decal.m_SizeZ)
 			variation.decal = var.m_Decal;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -80,6 +80,16 @@ public:
 		float m_OffsetZ;
 	};
 
+	struct LOD
+	{
+		LOD() : m_ScreenSize(0.f) {}
+
+		// fraction of the screen height below which this mesh replaces the more detailed ones
+		float m_ScreenSize;
+		// filename of the simplified mesh
+		VfsPath m_ModelFilename;
+	};
+
 	struct Variant
 	{
 		Variant() : m_Frequency(0) {}
@@ -87,6 +97,7 @@ public:
 		CStr m_VariantName; // lowercase name
 		int m_Frequency;
 		VfsPath m_ModelFilename;
+		std::vector<LOD> m_LODs; // simplified versions of m_ModelFilename
 		Decal m_Decal;
 		VfsPath m_Particles;
 		CStr m_Color;
@@ -99,6 +110,7 @@ public:
 	struct Variation
 	{
 		VfsPath model;
+		std::vector<LOD> lods;
 		Decal decal;
 		VfsPath particles;
 		CStr color;
@@ -110,9 +122,16 @@ public:
 	CObjectBase(CObjectManager& objectManager);
 
 	// Get the variation key (indices of chosen variants from each group)
-	// based on the selection strings
+	// based on the selection strings. The results are cached, since this is
+	// called whenever a unit's selections change (e.g. for every animation)
 	std::vector<u8> CalculateVariationKey(const std::vector<std::set<CStr> >& selections);
 
+	/**
+	 * Forget the cached variation keys, e.g. because one of the props
+	 * (whose choices are included in the keys) has been reloaded.
+	 */
+	void ResetVariationKeys();
+
 	// Get the final actor data, combining all selected variants
 	const Variation BuildVariation(const std::vector<u8>& variationKey);
 
@@ -152,6 +171,25 @@ public:
 	 */
 	bool UsesFile(const VfsPath& pathname);
 
+	/**
+	 * Record that this object depends on the given file, in addition to the
+	 * ones it was loaded from, so that it's hotloaded when that file changes
+	 * (e.g. a mesh that was still being converted when the object was built).
+	 */
+	void AddUsedFile(const VfsPath& pathname);
+
+	/**
+	 * Record that this object depends on all the files used by @p prop.
+	 */
+	void AddUsedFiles(const CObjectBase& prop);
+
+	/**
+	 * Add the meshes and animations used by any of this object's variants,
+	 * and the names of all the props they might attach, to the given sets.
+	 * (This is used for prefetching.)
+	 */
+	void GetPossibleDependencies(std::set<VfsPath>& meshes, std::set<VfsPath>& animations, std::set<CStrW>& props) const;
+
 	// filename that this was loaded from
 	VfsPath m_Pathname;
 
@@ -180,6 +218,9 @@ private:
 	CObjectManager& m_ObjectManager;
 
 	boost::unordered_set<VfsPath> m_UsedFiles;
+
+	// CalculateVariationKey's previous results
+	std::map<std::vector<std::set<CStr> >, std::vector<u8> > m_VariationKeys;
 };
 
 #endif
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -29,6 +29,7 @@
 #include "graphics/ObjectManager.h"
 #include "graphics/ParticleManager.h"
 #include "graphics/SkeletonAnim.h"
+#include "graphics/SkeletonAnimManager.h"
 #include "graphics/TextureManager.h"
 #include "lib/rand.h"
 #include "ps/CLogger.h"
@@ -118,6 +119,13 @@ bool CObjectEntry::BuildVariation(const std::vector<std::set<CStr> >& selections
 	CModelDefPtr modeldef (objectManager.GetMeshManager().GetMesh(m_ModelName));
 	if (!modeldef)
 	{
+		// If it's still being converted, we'll be hotloaded once it's ready
+		if (objectManager.GetMeshManager().IsMeshPending(m_ModelName))
+		{
+			m_Base->AddUsedFile(m_ModelName.ChangeExtension(L".dae"));
+			return false;
+		}
+
 		LOGERROR(L"CObjectEntry::BuildVariation(): Model %ls failed to load", m_ModelName.string().c_str());
 		return false;
 	}
@@ -151,6 +159,36 @@ bool CObjectEntry::BuildVariation(const std::vector<std::set<CStr> >& selections
 	// calculate initial object space bounds, based on vertex positions
 	model->CalcStaticObjectBounds();
 
+	// load the simplified meshes for when the model is small on screen
+	std::vector<CModel::LOD> lods;
+	for (std::vector<CObjectBase::LOD>::iterator it = variation.lods.begin(); it != variation.lods.end(); ++it)
+	{
+		CModelDefPtr loddef (objectManager.GetMeshManager().GetMesh(it->m_ModelFilename));
+		if (!loddef)
+		{
+			if (objectManager.GetMeshManager().IsMeshPending(it->m_ModelFilename))
+			{
+				m_Base->AddUsedFile(it->m_ModelFilename.ChangeExtension(L".dae"));
+				continue;
+			}
+
+			LOGERROR(L"CObjectEntry::BuildVariation(): LOD model %ls failed to load", it->m_ModelFilename.string().c_str());
+			continue;
+		}
+
+		// The LODs share the animations and prop points, so they must have the same skeleton
+		if (loddef->GetNumBones() != modeldef->GetNumBones())
+		{
+			LOGERROR(L"CObjectEntry::BuildVariation(): LOD model %ls has a different number of bones to %ls",
+				it->m_ModelFilename.string().c_str(), m_ModelName.string().c_str());
+			continue;
+		}
+
+		lods.push_back(CModel::LOD(loddef, it->m_ScreenSize));
+	}
+	if (!lods.empty())
+		model->SetLODs(lods);
+
 	// load the animations
 	for (std::multimap<CStr, CObjectBase::Anim>::iterator it = variation.anims.begin(); it != variation.anims.end(); ++it)
 	{
@@ -167,6 +205,8 @@ bool CObjectEntry::BuildVariation(const std::vector<std::set<CStr> >& selections
 			CSkeletonAnim* anim = model->BuildAnimation(it->second.m_FileName, name, it->second.m_Speed, it->second.m_ActionPos, it->second.m_ActionPos2);
 			if (anim)
 				m_Animations.insert(std::make_pair(name, anim));
+			else if (objectManager.GetSkeletonAnimManager().IsAnimationPending(it->second.m_FileName))
+				m_Base->AddUsedFile(it->second.m_FileName.ChangeExtension(L".dae"));
 		}
 	}
 
@@ -204,7 +244,14 @@ bool CObjectEntry::BuildVariation(const std::vector<std::set<CStr> >& selections
 			continue;
 		}
 
-		CObjectEntry* oe = objectManager.FindObjectVariation(prop.m_ModelName.c_str(), selections);
+		CObjectBase* propBase = objectManager.FindObjectBase(prop.m_ModelName.c_str());
+		CObjectEntry* oe = propBase ? objectManager.FindObjectVariation(propBase, selections) : NULL;
+
+		// Props can be waiting for conversions too, so make sure we're
+		// hotloaded when they are
+		if (propBase)
+			m_Base->AddUsedFiles(*propBase);
+
 		if (!oe)
 		{
 			LOGERROR(L"Failed to build prop model \"%ls\" on actor \"%ls\"", prop.m_ModelName.c_str(), m_Base->m_ShortName.c_str());
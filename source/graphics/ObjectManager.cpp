@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -21,6 +21,9 @@
 
 #include "graphics/ObjectBase.h"
 #include "graphics/ObjectEntry.h"
+#include "graphics/MeshManager.h"
+#include "graphics/SkeletonAnimManager.h"
+#include "lib/sysdep/cpu.h"
 #include "ps/CLogger.h"
 #include "ps/Game.h"
 #include "ps/Profile.h"
@@ -53,9 +56,9 @@ bool CObjectManager::ObjectKey::operator< (const CObjectManager::ObjectKey& a) c
 		return ActorVariation < a.ActorVariation;
 }
 
-static Status ReloadChangedFileCB(void* param, const VfsPath& path)
+static Status ReloadChangedFileCB(void* param, const std::vector<VfsPath>& paths)
 {
-	return static_cast<CObjectManager*>(param)->ReloadChangedFile(path);
+	return static_cast<CObjectManager*>(param)->ReloadChangedFiles(paths);
 }
 
 CObjectManager::CObjectManager(CMeshManager& meshManager, CSkeletonAnimManager& skeletonAnimManager, CSimulation2& simulation)
@@ -66,6 +69,16 @@ CObjectManager::CObjectManager(CMeshManager& meshManager, CSkeletonAnimManager&
 
 CObjectManager::~CObjectManager()
 {
+	// Make sure no prefetches are still using our data
+	if (g_ThreadPool)
+		g_ThreadPool->Wait(m_PrefetchTasks);
+
+	std::for_each(
+		m_Prefetches.begin(),
+		m_Prefetches.end(),
+		delete_pair_2nd<CStrW, Prefetch*>
+	);
+
 	UnloadObjects();
 
 	UnregisterFileReloadFunc(ReloadChangedFileCB, this);
@@ -191,17 +204,35 @@ void CObjectManager::UnloadObjects()
 	m_ObjectBases.clear();
 }
 
-Status CObjectManager::ReloadChangedFile(const VfsPath& path)
+static bool UsesAnyFile(CObjectBase* base, const std::vector<VfsPath>& paths)
+{
+	for (size_t i = 0; i < paths.size(); ++i)
+		if (base->UsesFile(paths[i]))
+			return true;
+	return false;
+}
+
+Status CObjectManager::ReloadChangedFiles(const std::vector<VfsPath>& paths)
 {
 	// Mark old entries as outdated so we don't reload them from the cache
 	for (std::map<ObjectKey, CObjectEntry*>::iterator it = m_Objects.begin(); it != m_Objects.end(); ++it)
-		if (it->second->m_Base->UsesFile(path))
+		if (UsesAnyFile(it->second->m_Base, paths))
 			it->second->m_Outdated = true;
 
-	// Reload actors that use a changed object
+	// Objects' cached variation keys include their props' choices, so they
+	// might all be outdated if any object is reloaded
+	bool reloaded = false;
+	for (std::map<CStrW, CObjectBase*>::iterator it = m_ObjectBases.begin(); it != m_ObjectBases.end(); ++it)
+		if (UsesAnyFile(it->second, paths))
+			reloaded = true;
+	if (reloaded)
+		for (std::map<CStrW, CObjectBase*>::iterator it = m_ObjectBases.begin(); it != m_ObjectBases.end(); ++it)
+			it->second->ResetVariationKeys();
+
+	// Reload actors that use a changed object (once, however many of their files changed)
 	for (std::map<CStrW, CObjectBase*>::iterator it = m_ObjectBases.begin(); it != m_ObjectBases.end(); ++it)
 	{
-		if (it->second->UsesFile(path))
+		if (UsesAnyFile(it->second, paths))
 		{
 			it->second->Reload();
 
@@ -209,11 +240,107 @@ Status CObjectManager::ReloadChangedFile(const VfsPath& path)
 			// object with all correct variations, and we don't want to waste space storing it just for the
 			// rare occurrence of hotloading, so we'll tell the component (which does preserve the information)
 			// to do the reloading itself
-			const CSimulation2::InterfaceListUnordered& cmps = m_Simulation.GetEntitiesWithInterfaceUnordered(IID_Visual);
-			for (CSimulation2::InterfaceListUnordered::const_iterator eit = cmps.begin(); eit != cmps.end(); ++eit)
-				static_cast<ICmpVisual*>(eit->second)->Hotload(it->first);
+			HotloadObject(it->first);
 		}
 	}
 
 	return INFO::OK;
 }
+
+void CObjectManager::HotloadObject(const CStrW& objname)
+{
+	const CSimulation2::InterfaceListUnordered& cmps = m_Simulation.GetEntitiesWithInterfaceUnordered(IID_Visual);
+	for (CSimulation2::InterfaceListUnordered::const_iterator it = cmps.begin(); it != cmps.end(); ++it)
+		static_cast<ICmpVisual*>(it->second)->Hotload(objname);
+}
+
+void CObjectManager::PrefetchFileLoadedCB(void* cbdata, const VfsPath& UNUSED(pathname), Status UNUSED(ret), const shared_ptr<u8>& UNUSED(fileContents), size_t UNUSED(size))
+{
+	// The VFS's file cache keeps the contents, so the mesh and animation managers
+	// won't have to wait for the disk. (Errors will be reported when they load it.)
+	cpu_AtomicAdd(&static_cast<Prefetch*>(cbdata)->m_Pending, -1);
+}
+
+void CObjectManager::PrefetchObject(const CStrW& objname)
+{
+	if (!m_PrefetchedObjects.insert(objname).second)
+		return;
+
+	PROFILE("prefetch object");
+
+	// Find everything this actor and its props might need. (The actor XML files
+	// themselves are loaded immediately, since we need their contents.)
+	std::set<VfsPath> meshes, animations;
+	std::set<CStrW> props, visited;
+	props.insert(objname);
+	while (!props.empty())
+	{
+		CStrW name = *props.begin();
+		props.erase(props.begin());
+		if (!visited.insert(name).second)
+			continue;
+
+		CObjectBase* base = FindObjectBase(name);
+		if (base)
+			base->GetPossibleDependencies(meshes, animations, props);
+	}
+
+	std::vector<VfsPath> files;
+	for (std::set<VfsPath>::const_iterator it = meshes.begin(); it != meshes.end(); ++it)
+	{
+		VfsPath file = m_MeshManager.GetMeshFile(*it);
+		if (!file.empty())
+			files.push_back(file);
+	}
+	for (std::set<VfsPath>::const_iterator it = animations.begin(); it != animations.end(); ++it)
+	{
+		VfsPath file = m_SkeletonAnimManager.GetAnimationFile(*it);
+		if (!file.empty())
+			files.push_back(file);
+	}
+
+	if (files.empty())
+		return;
+
+	// (Set the count before starting any loads, since without a thread pool
+	// they'll finish immediately)
+	Prefetch* prefetch = new Prefetch();
+	prefetch->m_Pending = (intptr_t)files.size();
+	m_Prefetches[objname] = prefetch;
+
+	for (size_t i = 0; i < files.size(); ++i)
+		LoadFileAsync(g_VFS, files[i], &PrefetchFileLoadedCB, prefetch, &m_PrefetchTasks);
+}
+
+bool CObjectManager::DeferUntilPrefetched(const CStrW& objname)
+{
+	std::map<CStrW, Prefetch*>::iterator it = m_Prefetches.find(objname);
+	if (it == m_Prefetches.end() || it->second->m_Pending == 0)
+		return false;
+
+	it->second->m_Deferred = true;
+	return true;
+}
+
+void CObjectManager::UpdatePrefetches()
+{
+	std::vector<CStrW> finished;
+
+	for (std::map<CStrW, Prefetch*>::iterator it = m_Prefetches.begin(); it != m_Prefetches.end(); )
+	{
+		if (it->second->m_Pending != 0)
+		{
+			++it;
+			continue;
+		}
+
+		if (it->second->m_Deferred)
+			finished.push_back(it->first);
+		delete it->second;
+		m_Prefetches.erase(it++);
+	}
+
+	// (This is done after updating m_Prefetches, so the units won't just be deferred again)
+	for (size_t i = 0; i < finished.size(); ++i)
+		HotloadObject(finished[i]);
+}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -23,6 +23,7 @@
 #include <set>
 
 #include "ps/CStr.h"
+#include "ps/ThreadPool.h"
 #include "lib/file/vfs/vfs_path.h"
 
 class CMeshManager;
@@ -80,18 +81,60 @@ public:
 	CTerrain* GetTerrain();
 
 	/**
-	 * Reload any scripts that were loaded from the given filename.
+	 * Reload any actors that were loaded from the given files.
 	 * (This is used to implement hotloading.)
 	 */
-	Status ReloadChangedFile(const VfsPath& path);
+	Status ReloadChangedFiles(const std::vector<VfsPath>& paths);
+
+	/**
+	 * Start loading the meshes and animations used by any variant of the given
+	 * actor (and of its props) on the thread pool, so that units of it can be
+	 * created later without waiting for the disk. Does nothing if the actor
+	 * has already been prefetched.
+	 */
+	void PrefetchObject(const CStrW& objname);
+
+	/**
+	 * Returns true if the given actor is still being prefetched, in which case
+	 * its units shouldn't be created yet; ICmpVisual::Hotload will be called
+	 * for it once loading has finished (see UpdatePrefetches).
+	 */
+	bool DeferUntilPrefetched(const CStrW& objname);
+
+	/**
+	 * Finish any prefetches whose files have all been loaded, and hotload the
+	 * actors that were deferred while waiting for them. Should be called once
+	 * per frame.
+	 */
+	void UpdatePrefetches();
 
 private:
+	struct Prefetch
+	{
+		Prefetch() : m_Pending(0), m_Deferred(false) {}
+
+		// number of files still being loaded by the thread pool
+		volatile intptr_t m_Pending;
+		// whether DeferUntilPrefetched was called for this actor
+		bool m_Deferred;
+	};
+
+	static void PrefetchFileLoadedCB(void* cbdata, const VfsPath& pathname, Status ret, const shared_ptr<u8>& fileContents, size_t size);
+
+	void HotloadObject(const CStrW& objname);
+
 	CMeshManager& m_MeshManager;
 	CSkeletonAnimManager& m_SkeletonAnimManager;
 	CSimulation2& m_Simulation;
 
 	std::map<ObjectKey, CObjectEntry*> m_Objects;
 	std::map<CStrW, CObjectBase*> m_ObjectBases;
+
+	// actors that PrefetchObject has been called for
+	std::set<CStrW> m_PrefetchedObjects;
+	// prefetches that haven't finished yet
+	std::map<CStrW, Prefetch*> m_Prefetches;
+	CThreadPool::TaskGroup m_PrefetchTasks;
 };
 
 #endif
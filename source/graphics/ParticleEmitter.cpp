@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -23,14 +23,16 @@
 #include "graphics/ParticleEmitterType.h"
 #include "graphics/ParticleManager.h"
 #include "graphics/TextureManager.h"
+#include "maths/Vector4D.h"
 
 #include "renderer/Renderer.h"
 
 CParticleEmitter::CParticleEmitter(const CParticleEmitterTypePtr& type) :
-	m_Type(type), m_Active(true), m_NextParticleIdx(0), m_EmissionRoundingError(0.f),
-	m_LastUpdateTime(type->m_Manager.GetCurrentTime()),
+	m_Type(type), m_Active(true), m_NextParticleIdx(0), m_GPUSimulated(false), m_EmissionRoundingError(0.f),
+	m_LastUpdateTime(type->m_Manager.GetCurrentTime()), m_NewParticles(0),
 	m_IndexArray(GL_DYNAMIC_DRAW),
-	m_VertexArray(GL_DYNAMIC_DRAW)
+	m_VertexArray(GL_STREAM_DRAW),
+	m_GPUVertexArray(GL_DYNAMIC_DRAW)
 {
 	// If we should start with particles fully emitted, pretend that we
 	// were created in the past so the first update will produce lots of
@@ -63,6 +65,27 @@ CParticleEmitter::CParticleEmitter(const CParticleEmitterTypePtr& type) :
 	m_VertexArray.SetNumVertices(m_Type->m_MaxParticles * 4);
 	m_VertexArray.Layout();
 
+	// (The GPU simulation's array is only laid out if it gets used)
+	m_AttributeGPUPos.type = GL_FLOAT;
+	m_AttributeGPUPos.elems = 3;
+	m_GPUVertexArray.AddAttribute(&m_AttributeGPUPos);
+
+	m_AttributeGPUUV.type = GL_FLOAT;
+	m_AttributeGPUUV.elems = 2;
+	m_GPUVertexArray.AddAttribute(&m_AttributeGPUUV);
+
+	m_AttributeGPUMotion.type = GL_FLOAT;
+	m_AttributeGPUMotion.elems = 4;
+	m_GPUVertexArray.AddAttribute(&m_AttributeGPUMotion);
+
+	m_AttributeGPUParams.type = GL_FLOAT;
+	m_AttributeGPUParams.elems = 4;
+	m_GPUVertexArray.AddAttribute(&m_AttributeGPUParams);
+
+	m_AttributeGPUColor.type = GL_UNSIGNED_BYTE;
+	m_AttributeGPUColor.elems = 4;
+	m_GPUVertexArray.AddAttribute(&m_AttributeGPUColor);
+
 	m_IndexArray.SetNumVertices(m_Type->m_MaxParticles * 6);
 	m_IndexArray.Layout();
 	VertexArrayIterator<u16> index = m_IndexArray.GetIterator();
@@ -79,12 +102,42 @@ CParticleEmitter::CParticleEmitter(const CParticleEmitterTypePtr& type) :
 	m_IndexArray.FreeBackingStore();
 }
 
-void CParticleEmitter::UpdateArrayData()
+void CParticleEmitter::UpdateArrayData(bool allowGPUSimulation)
 {
+	bool gpuSimulated = allowGPUSimulation && m_Type->m_GPUSimulation;
+	if (gpuSimulated != m_GPUSimulated)
+		SetGPUSimulated(gpuSimulated);
+
 	// Update m_Particles
 	m_Type->UpdateEmitter(*this, m_Type->m_Manager.GetCurrentTime() - m_LastUpdateTime);
 	m_LastUpdateTime = m_Type->m_Manager.GetCurrentTime();
 
+	if (m_GPUSimulated)
+		UpdateGPUArrayData();
+	else
+		UpdateCPUArrayData();
+}
+
+void CParticleEmitter::SetGPUSimulated(bool gpuSimulated)
+{
+	// The two simulations store different state in the vertex arrays (and the
+	// particles' positions mean different things), so just start again
+	m_GPUSimulated = gpuSimulated;
+	m_Particles.clear();
+	m_NextParticleIdx = 0;
+	m_NewParticles = 0;
+
+	VertexArray& usedArray = m_GPUSimulated ? m_GPUVertexArray : m_VertexArray;
+	VertexArray& unusedArray = m_GPUSimulated ? m_VertexArray : m_GPUVertexArray;
+
+	// (Setting the size to 0 frees the array's memory)
+	unusedArray.SetNumVertices(0);
+	usedArray.SetNumVertices(m_Type->m_MaxParticles * 4);
+	usedArray.Layout();
+}
+
+void CParticleEmitter::UpdateCPUArrayData()
+{
 	// Regenerate the vertex array data:
 
 	VertexArrayIterator<CVector3D> attrPos = m_AttributePos.GetIterator<CVector3D>();
@@ -163,11 +216,90 @@ void CParticleEmitter::UpdateArrayData()
 	m_VertexArray.Upload();
 }
 
+void CParticleEmitter::UpdateGPUArrayData()
+{
+	size_t maxParticles = m_Type->m_MaxParticles;
+	size_t count = std::min(m_NewParticles, m_Particles.size());
+	m_NewParticles = 0;
+
+	if (count)
+	{
+		// The new particles are the ones just before m_NextParticleIdx in the ring buffer
+		size_t first = (m_NextParticleIdx + maxParticles - count) % maxParticles;
+		size_t firstCount = std::min(count, maxParticles - first);
+
+		for (size_t i = first; i < first + firstCount; ++i)
+			WriteGPUParticle(i);
+		m_GPUVertexArray.UploadRange(first * 4, firstCount * 4);
+
+		// (the rest have wrapped around to the start)
+		if (firstCount < count)
+		{
+			for (size_t i = 0; i < count - firstCount; ++i)
+				WriteGPUParticle(i);
+			m_GPUVertexArray.UploadRange(0, (count - firstCount) * 4);
+		}
+	}
+
+	// The particles' current positions aren't known here, so use the bounds of
+	// everywhere they might have moved to since they were emitted
+	CBoundingBoxAligned bounds;
+	float time = m_Type->m_Manager.GetCurrentTime();
+	for (size_t i = 0; i < m_Particles.size(); ++i)
+		if (time < m_Particles[i].birthTime + m_Particles[i].maxAge)
+			bounds += m_Particles[i].pos;
+
+	if (!bounds.IsEmpty())
+	{
+		bounds[0] += m_Type->m_MaxBounds[0];
+		bounds[1] += m_Type->m_MaxBounds[1];
+	}
+
+	m_ParticleBounds = bounds;
+}
+
+void CParticleEmitter::WriteGPUParticle(size_t idx)
+{
+	const SParticle& particle = m_Particles[idx];
+
+	VertexArrayIterator<CVector3D> attrPos = m_AttributeGPUPos.GetIterator<CVector3D>() + idx*4;
+	VertexArrayIterator<float[2]> attrUV = m_AttributeGPUUV.GetIterator<float[2]>() + idx*4;
+	VertexArrayIterator<CVector4D> attrMotion = m_AttributeGPUMotion.GetIterator<CVector4D>() + idx*4;
+	VertexArrayIterator<CVector4D> attrParams = m_AttributeGPUParams.GetIterator<CVector4D>() + idx*4;
+	VertexArrayIterator<SColor4ub> attrColor = m_AttributeGPUColor.GetIterator<SColor4ub>() + idx*4;
+
+	// (same corner order as the CPU path)
+	static const float uvs[4][2] = { { 1, 0 }, { 0, 0 }, { 0, 1 }, { 1, 1 } };
+
+	CVector4D motion(particle.velocity.X, particle.velocity.Y, particle.velocity.Z, particle.size);
+	CVector4D params(particle.birthTime, particle.maxAge, particle.angle, particle.angleSpeed);
+	SColor4ub color = particle.color;
+	color.A = 255;
+
+	for (size_t v = 0; v < 4; ++v)
+	{
+		*attrPos++ = particle.pos;
+		(*attrUV)[0] = uvs[v][0];
+		(*attrUV)[1] = uvs[v][1];
+		++attrUV;
+		*attrMotion++ = motion;
+		*attrParams++ = params;
+		*attrColor++ = color;
+	}
+}
+
 void CParticleEmitter::Bind(const CShaderProgramPtr& shader)
 {
 	shader->BindTexture("baseTex", m_Type->m_Texture);
 	shader->Uniform("fogColor", g_Renderer.GetLightEnv().m_FogColor);
 	shader->Uniform("fogParams", g_Renderer.GetLightEnv().m_FogFactor, g_Renderer.GetLightEnv().m_FogMax, 0.f, 0.f);
+	if (m_GPUSimulated)
+	{
+		shader->Uniform("time", m_Type->m_Manager.GetCurrentTime());
+		shader->Uniform("acceleration", m_Type->m_Acceleration);
+		// (see the special case in UpdateCPUArrayData)
+		shader->Uniform("premultiplyAlpha", m_Type->m_BlendFuncDst == GL_ONE_MINUS_SRC_COLOR ? 1.f : 0.f);
+	}
 	pglBlendEquationEXT(m_Type->m_BlendEquation);
 	glBlendFunc(m_Type->m_BlendFuncSrc, m_Type->m_BlendFuncDst);
 }
@@ -180,6 +312,26 @@ void CParticleEmitter::RenderArray(const CShaderProgramPtr& shader)
 		return;
 
 	u8* indexBase = m_IndexArray.Bind();
+
+	if (m_GPUSimulated)
+	{
+		u8* base = m_GPUVertexArray.Bind();
+		GLsizei stride = (GLsizei)m_GPUVertexArray.GetStride();
+
+		shader->VertexPointer(3, GL_FLOAT, stride, base + m_AttributeGPUPos.offset);
+		shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, stride, base + m_AttributeGPUUV.offset);
+		shader->TexCoordPointer(GL_TEXTURE1, 4, GL_FLOAT, stride, base + m_AttributeGPUMotion.offset);
+		shader->TexCoordPointer(GL_TEXTURE2, 4, GL_FLOAT, stride, base + m_AttributeGPUParams.offset);
+		shader->ColorPointer(4, GL_UNSIGNED_BYTE, stride, base + m_AttributeGPUColor.offset);
+
+		shader->AssertPointersBound();
+		glDrawElements(GL_TRIANGLES, (GLsizei)(m_Particles.size() * 6), GL_UNSIGNED_SHORT, indexBase);
+
+		g_Renderer.GetStats().m_DrawCalls++;
+		g_Renderer.GetStats().m_Particles += m_Particles.size();
+		return;
+	}
+
 	u8* base = m_VertexArray.Bind();
 
 	GLsizei stride = (GLsizei)m_VertexArray.GetStride();
@@ -214,6 +366,19 @@ void CParticleEmitter::AddParticle(const SParticle& particle)
 		m_Particles[m_NextParticleIdx] = particle;
 
 	m_NextParticleIdx = (m_NextParticleIdx + 1) % m_Type->m_MaxParticles;
+	m_NewParticles = std::min(m_NewParticles + 1, m_Type->m_MaxParticles);
+}
+
+bool CParticleEmitter::HasLiveParticles() const
+{
+	float time = m_Type->m_Manager.GetCurrentTime();
+	for (size_t i = 0; i < m_Particles.size(); ++i)
+	{
+		const SParticle& p = m_Particles[i];
+		if (m_GPUSimulated ? (time < p.birthTime + p.maxAge) : (p.age < p.maxAge))
+			return true;
+	}
+	return false;
 }
 
 void CParticleEmitter::SetEntityVariable(const std::string& name, float value)
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -38,6 +38,7 @@ struct SParticle
 	SColor4ub color;
 	float age;
 	float maxAge;
+	float birthTime; // (only used by the GPU simulation)
 };
 
 typedef shared_ptr<CParticleEmitter> CParticleEmitterPtr;
@@ -59,6 +60,20 @@ typedef shared_ptr<CParticleEmitter> CParticleEmitterPtr;
  * array with alpha=0 until they're overwritten by a new particle after the maximum
  * lifetime.
  *
+ * If the emitter type allows it (see CParticleEmitterType::m_GPUSimulation) and the
+ * renderer supports it, the particles are simulated on the GPU instead: the vertex
+ * array then contains each particle's initial state, and is only updated for newly
+ * emitted particles, while the vertex shader computes the current position, rotation
+ * and alpha from the particle's age. The vertex attributes in that case are:
+ *  * position: initial position
+ *  * texcoord0: UV coordinates of the billboard corner
+ *  * texcoord1: initial velocity (xyz) and size (w)
+ *  * texcoord2: emission time, lifetime, initial angle, angular speed
+ *  * color: RGB color (alpha is computed by the shader)
+ * with uniforms "time" (the current time), "acceleration" (the emitter type's
+ * constant acceleration) and "premultiplyAlpha" (1 if the blend mode needs the
+ * color to be multiplied by alpha, else 0).
+ *
  * (It's quite likely this could be made more efficient, if the overhead of any added
  * complexity is not high.)
  */
@@ -92,8 +107,22 @@ public:
 
 	/**
 	 * Update particle and vertex array data. Must be called before RenderArray.
+	 * @param allowGPUSimulation whether the renderer can draw particles simulated
+	 *  on the GPU; if the emitter switches between the CPU and GPU simulation,
+	 *  its existing particles are discarded.
+	 */
+	void UpdateArrayData(bool allowGPUSimulation);
+
+	/**
+	 * Returns whether the particles are simulated by the vertex shader, and so
+	 * need to be drawn with a GPU particle shader.
+	 */
+	bool IsGPUSimulated() const { return m_GPUSimulated; }
+
+	/**
+	 * Returns whether any particles are still alive.
 	 */
-	void UpdateArrayData();
+	bool HasLiveParticles() const;
 
 	/**
 	 * Bind rendering state (textures and blend modes).
@@ -128,13 +157,28 @@ public:
 	std::vector<SParticle> m_Particles;
 	size_t m_NextParticleIdx;
 
+	/// Whether m_Particles is simulated by the vertex shader (in which case only their
+	/// initial state is updated)
+	bool m_GPUSimulated;
+
 	float m_LastUpdateTime;
 	float m_EmissionRoundingError;
 
 private:
+	void SetGPUSimulated(bool gpuSimulated);
+	void UpdateCPUArrayData();
+	void UpdateGPUArrayData();
+
+	/// Writes the vertices of the given GPU-simulated particle into m_GPUVertexArray
+	void WriteGPUParticle(size_t idx);
+
 	/// Bounding box of the current particle center points
 	CBoundingBoxAligned m_ParticleBounds;
 
+	/// Number of particles added since the vertex array was last updated
+	/// (only used by the GPU simulation)
+	size_t m_NewParticles;
+
 	VertexIndexArray m_IndexArray;
 
 	VertexArray m_VertexArray;
@@ -142,6 +186,13 @@ private:
 	VertexArray::Attribute m_AttributeAxis;
 	VertexArray::Attribute m_AttributeUV;
 	VertexArray::Attribute m_AttributeColor;
+
+	VertexArray m_GPUVertexArray;
+	VertexArray::Attribute m_AttributeGPUPos;
+	VertexArray::Attribute m_AttributeGPUUV;
+	VertexArray::Attribute m_AttributeGPUMotion;
+	VertexArray::Attribute m_AttributeGPUParams;
+	VertexArray::Attribute m_AttributeGPUColor;
 };
 
 /**
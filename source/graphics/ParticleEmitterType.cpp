@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -220,6 +220,9 @@ public:
 	/// Returns maximum acceleration caused by this effector.
 	virtual CVector3D Max() = 0;
 
+	/// Returns true if this effector always applies the acceleration returned by Max(),
+	/// so its effect on particles can be computed without evaluating it every frame.
+	virtual bool IsConstantAcceleration() { return false; }
 };
 
 /**
@@ -246,6 +249,11 @@ public:
 		return m_Accel;
 	}
 
+	virtual bool IsConstantAcceleration()
+	{
+		return true;
+	}
+
 private:
 	CVector3D m_Accel;
 };
@@ -278,8 +286,14 @@ CParticleEmitterType::CParticleEmitterType(const VfsPath& path, CParticleManager
 
 	// Compute combined acceleration (assume constant)
 	CVector3D accel;
+	m_GPUSimulation = true;
 	for (size_t i = 0; i < m_Effectors.size(); ++i)
+	{
 		accel += m_Effectors[i]->Max();
+		if (!m_Effectors[i]->IsConstantAcceleration())
+			m_GPUSimulation = false;
+	}
+	m_Acceleration = accel;
 
 	CVector3D vmin(m_Variables[VAR_VELOCITY_X]->Min(*this), m_Variables[VAR_VELOCITY_Y]->Min(*this), m_Variables[VAR_VELOCITY_Z]->Min(*this));
 	CVector3D vmax(m_Variables[VAR_VELOCITY_X]->Max(*this), m_Variables[VAR_VELOCITY_Y]->Max(*this), m_Variables[VAR_VELOCITY_Z]->Max(*this));
@@ -494,22 +508,25 @@ void CParticleEmitterType::UpdateEmitter(CParticleEmitter& emitter, float dt)
 	// period of the particles
 	dt = std::min(dt, m_MaxLifetime);
 
+	float time = m_Manager.GetCurrentTime() - dt;
+
 	while (dt > maxStepLength)
 	{
-		UpdateEmitterStep(emitter, maxStepLength);
+		time += maxStepLength;
+		UpdateEmitterStep(emitter, maxStepLength, time);
 		dt -= maxStepLength;
 	}
 
-	UpdateEmitterStep(emitter, dt);
+	UpdateEmitterStep(emitter, dt, m_Manager.GetCurrentTime());
 }
 
-void CParticleEmitterType::UpdateEmitterStep(CParticleEmitter& emitter, float dt)
+void CParticleEmitterType::UpdateEmitterStep(CParticleEmitter& emitter, float dt, float time)
 {
 	ENSURE(emitter.m_Type.get() == this);
 
 	if (emitter.m_Active)
 	{
-		float emissionRate = m_Variables[VAR_EMISSIONRATE]->Evaluate(emitter);
+		float emissionRate = m_Variables[VAR_EMISSIONRATE]->Evaluate(emitter) * m_Manager.GetDensity();
 
 		// Find how many new particles to spawn, and accumulate any rounding errors
 		// (to maintain a constant emission rate even if dt is very small)
@@ -547,11 +564,16 @@ void CParticleEmitterType::UpdateEmitterStep(CParticleEmitter& emitter, float dt
 
 			particle.age = 0.f;
 			particle.maxAge = m_Variables[VAR_LIFETIME]->Evaluate(emitter);
+			particle.birthTime = time;
 
 			emitter.AddParticle(particle);
 		}
 	}
 
+	// The vertex shader computes the rest from the initial state
+	if (emitter.m_GPUSimulated)
+		return;
+
 	// Update particle states
 	for (size_t i = 0; i < emitter.m_Particles.size(); ++i)
 	{
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -84,9 +84,10 @@ private:
 
 	/**
 	 * Update the state of an emitter's particles, by a short time @p dt that can
-	 * be computed in a single step.
+	 * be computed in a single step ending at time @p time.
+	 * If the emitter is simulated on the GPU, this only emits the new particles.
 	 */
-	void UpdateEmitterStep(CParticleEmitter& emitter, float dt);
+	void UpdateEmitterStep(CParticleEmitter& emitter, float dt, float time);
 
 	CBoundingBoxAligned CalculateBounds(CVector3D emitterPos, CBoundingBoxAligned emittedBounds);
 
@@ -101,6 +102,12 @@ private:
 	size_t m_MaxParticles;
 	CBoundingBoxAligned m_MaxBounds;
 
+	/// Whether the particles' motion can be computed from their initial state by
+	/// a vertex shader (i.e. all the effectors apply a constant acceleration)
+	bool m_GPUSimulation;
+	/// Combined acceleration of all the effectors, if m_GPUSimulation
+	CVector3D m_Acceleration;
+
 	typedef shared_ptr<IParticleVar> IParticleVarPtr;
 	std::vector<IParticleVarPtr> m_Variables;
 
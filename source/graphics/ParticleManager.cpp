@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -23,13 +23,15 @@
 #include "ps/Profile.h"
 #include "renderer/Scene.h"
 
-static Status ReloadChangedFileCB(void* param, const VfsPath& path)
+static Status ReloadChangedFileCB(void* param, const std::vector<VfsPath>& paths)
 {
-	return static_cast<CParticleManager*>(param)->ReloadChangedFile(path);
+	for (size_t i = 0; i < paths.size(); ++i)
+		RETURN_STATUS_IF_ERR(static_cast<CParticleManager*>(param)->ReloadChangedFile(paths[i]));
+	return INFO::OK;
 }
 
 CParticleManager::CParticleManager() :
-	m_CurrentTime(0.f)
+	m_CurrentTime(0.f), m_Density(1.f)
 {
 	RegisterFileReloadFunc(ReloadChangedFileCB, this);
 }
@@ -69,14 +71,7 @@ struct EmitterHasNoParticles
 {
 	bool operator()(const CParticleEmitterPtr& emitterPtr)
 	{
-		CParticleEmitter& emitter = *emitterPtr.get();
-		for (size_t i = 0; i < emitter.m_Particles.size(); ++i)
-		{
-			SParticle& p = emitter.m_Particles[i];
-			if (p.age < p.maxAge)
-				return false;
-		}
-		return true;
+		return !emitterPtr->HasLiveParticles();
 	}
 };
 
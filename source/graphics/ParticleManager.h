@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -51,6 +51,13 @@ public:
 
 	float GetCurrentTime() const { return m_CurrentTime; }
 
+	/**
+	 * Fraction of each emitter's particles to actually emit (default 1),
+	 * so the cost of particles can be reduced without disabling them.
+	 */
+	float GetDensity() const { return m_Density; }
+	void SetDensity(float density) { m_Density = density; }
+
 	Status ReloadChangedFile(const VfsPath& path);
 
 	/// Random number generator shared between all particle emitters.
@@ -58,6 +65,7 @@ public:
 
 private:
 	float m_CurrentTime;
+	float m_Density;
 
 	std::list<CParticleEmitterPtr> m_UnattachedEmitters;
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -29,8 +29,11 @@
 
 // dirty flags - used as notification to the renderer that some bit of data
 // need updating
+// (for terrain patches: VERTICES = heights, INDICES = textures, COLOR = lighting,
+// WATER = water level)
 #define RENDERDATA_UPDATE_VERTICES		(1<<1)
 #define RENDERDATA_UPDATE_INDICES		(1<<2)
+#define RENDERDATA_UPDATE_WATER			(1<<3)
 #define RENDERDATA_UPDATE_COLOR			(1<<4)
 
 
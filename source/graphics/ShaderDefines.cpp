@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -83,10 +83,14 @@ struct ItemNameGeq
 	}
 };
 
+// Protects s_InternedItems (for all instantiations), so shader params can be
+// constructed by any thread
+static CMutex g_InternedItemsMutex;
+
 template<typename value_t>
 typename CShaderParams<value_t>::SItems* CShaderParams<value_t>::GetInterned(const SItems& items)
 {
-	ENSURE(ThreadUtil::IsMainThread()); // s_InternedItems is not thread-safe
+	CScopeLock lock(g_InternedItemsMutex);
 
 	typename InternedItems_t::iterator it = s_InternedItems.find(items);
 	if (it != s_InternedItems.end())
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -33,7 +33,8 @@ class CVector4D;
  * Stored as interned vectors of name-value pairs, to support high performance
  * comparison operators.
  *
- * Not thread-safe - must only be used from the main thread.
+ * Instances can be created and modified by any thread, but an individual
+ * instance must not be modified by several threads at once.
  */
 template<typename value_t>
 class CShaderParams
@@ -124,7 +125,8 @@ private:
  * Represents a mapping of name strings to value strings, for use with
  * \#if and \#ifdef and similar conditionals in shaders.
  *
- * Not thread-safe - must only be used from the main thread.
+ * Instances can be created and modified by any thread, but an individual
+ * instance must not be modified by several threads at once.
  */
 class CShaderDefines : public CShaderParams<CStrIntern>
 {
@@ -145,7 +147,8 @@ public:
  * Represents a mapping of name strings to value CVector4Ds, for use with
  * uniforms in shaders.
  *
- * Not thread-safe - must only be used from the main thread.
+ * Instances can be created and modified by any thread, but an individual
+ * instance must not be modified by several threads at once.
  */
 class CShaderUniforms : public CShaderParams<CVector4D>
 {
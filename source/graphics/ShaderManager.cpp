@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -21,6 +21,7 @@
 
 #include "graphics/ShaderTechnique.h"
 #include "lib/timer.h"
+#include "lib/file/io/write_buffer.h"
 #include "lib/utf8.h"
 #include "ps/CLogger.h"
 #include "ps/CStrIntern.h"
@@ -63,9 +64,85 @@ CShaderManager::CShaderManager()
 
 CShaderManager::~CShaderManager()
 {
+	SaveProgramList();
+
 	UnregisterFileReloadFunc(ReloadChangedFileCB, this);
 }
 
+// List of the programs (and defines) that were used in the last session.
+// Each line has the program name followed by space-separated NAME=VALUE defines
+static const wchar_t* PROGRAM_LIST_PATH = L"cache/shaders/programs.txt";
+
+void CShaderManager::PrecompilePrograms()
+{
+	PROFILE2("precompile shaders");
+
+	if (!VfsFileExists(PROGRAM_LIST_PATH))
+		return;
+
+	CVFSFile file;
+	if (file.Load(g_VFS, PROGRAM_LIST_PATH) != PSRETURN_OK)
+		return;
+
+	std::istringstream list(file.GetAsString());
+	std::string line;
+	while (std::getline(list, line))
+	{
+		std::istringstream words(line);
+		std::string name, define;
+		if (!(words >> name))
+			continue;
+
+		CShaderDefines defines;
+		while (words >> define)
+		{
+			size_t sep = define.find('=');
+			if (sep != std::string::npos)
+				defines.Add(define.substr(0, sep).c_str(), define.substr(sep+1).c_str());
+		}
+
+		// Skip programs that have since been deleted, rather than reporting errors
+		if (!VfsFileExists(L"shaders/" + wstring_from_utf8(name) + L".xml"))
+			continue;
+
+		CacheKey key = { name, defines };
+		m_RecordedPrograms.insert(key);
+		LoadProgram(name.c_str(), defines);
+	}
+}
+
+void CShaderManager::SaveProgramList()
+{
+	if (!g_VFS)
+		return;
+
+	std::set<CacheKey> used;
+	for (std::map<CacheKey, CShaderProgramPtr>::iterator it = m_ProgramCache.begin(); it != m_ProgramCache.end(); ++it)
+		if (it->second && it->second->IsValid() && strncmp(it->first.name.c_str(), "fixed:", 6) != 0)
+			used.insert(it->first);
+
+	// Don't bother rewriting the file if nothing new was used
+	bool changed = (used.size() != m_RecordedPrograms.size());
+	for (std::set<CacheKey>::iterator it = used.begin(); !changed && it != used.end(); ++it)
+		changed = (m_RecordedPrograms.count(*it) == 0);
+	if (!changed)
+		return;
+
+	WriteBuffer buffer;
+	for (std::set<CacheKey>::iterator it = used.begin(); it != used.end(); ++it)
+	{
+		std::string line = it->name;
+		std::map<CStrIntern, CStrIntern> defines = it->defines.GetMap();
+		for (std::map<CStrIntern, CStrIntern>::iterator dit = defines.begin(); dit != defines.end(); ++dit)
+			line += " " + dit->first.string() + "=" + dit->second.string();
+		line += "\n";
+		buffer.Append(line.data(), line.length());
+	}
+
+	if (g_VFS->CreateFile(PROGRAM_LIST_PATH, buffer.Data(), buffer.Size()) < 0)
+		LOGWARNING(L"Failed to save list of shader programs");
+}
+
 CShaderProgramPtr CShaderManager::LoadProgram(const char* name, const CShaderDefines& defines)
 {
 	CacheKey key = { name, defines };
@@ -554,25 +631,32 @@ size_t CShaderManager::GetNumEffectsLoaded()
 	return m_EffectCache.size();
 }
 
-/*static*/ Status CShaderManager::ReloadChangedFileCB(void* param, const VfsPath& path)
+/*static*/ Status CShaderManager::ReloadChangedFileCB(void* param, const std::vector<VfsPath>& paths)
 {
-	return static_cast<CShaderManager*>(param)->ReloadChangedFile(path);
+	return static_cast<CShaderManager*>(param)->ReloadChangedFiles(paths);
 }
 
-Status CShaderManager::ReloadChangedFile(const VfsPath& path)
+Status CShaderManager::ReloadChangedFiles(const std::vector<VfsPath>& paths)
 {
-	// Find all shaders using this file
-	HotloadFilesMap::iterator files = m_HotloadFiles.find(path);
-	if (files != m_HotloadFiles.end())
+	// Find all shaders using these files (each only once, since a program's
+	// vertex and fragment shaders often change together)
+	std::set<shared_ptr<CShaderProgram> > programs;
+	for (size_t i = 0; i < paths.size(); ++i)
 	{
-		// Reload all shaders using this file
+		HotloadFilesMap::iterator files = m_HotloadFiles.find(paths[i]);
+		if (files == m_HotloadFiles.end())
+			continue;
+
 		for (std::set<boost::weak_ptr<CShaderProgram> >::iterator it = files->second.begin(); it != files->second.end(); ++it)
 		{
 			if (shared_ptr<CShaderProgram> program = it->lock())
-				program->Reload();
+				programs.insert(program);
 		}
 	}
 
+	for (std::set<shared_ptr<CShaderProgram> >::iterator it = programs.begin(); it != programs.end(); ++it)
+		(*it)->Reload();
+
 	// TODO: hotloading changes to shader XML files and effect XML files would be nice
 
 	return INFO::OK;
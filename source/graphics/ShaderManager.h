@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -72,6 +72,14 @@ public:
 	 */
 	size_t GetNumEffectsLoaded();
 
+	/**
+	 * Load all the programs that were used in previous sessions (as recorded
+	 * when the shader manager is destroyed), so they won't need compiling
+	 * when they're first used. GLSL programs are usually in the binary
+	 * program cache after the first session, so this is fairly quick.
+	 */
+	void PrecompilePrograms();
+
 private:
 
 	struct CacheKey
@@ -93,6 +101,9 @@ private:
 	// TODO: is this cache useful when we already have an effect cache?
 	std::map<CacheKey, CShaderProgramPtr> m_ProgramCache;
 
+	// Programs that were loaded by PrecompilePrograms
+	std::set<CacheKey> m_RecordedPrograms;
+
 	/**
 	 * Key for effect cache lookups.
 	 * This stores two separate CShaderDefines because the renderer typically
@@ -126,10 +137,11 @@ private:
 #endif
 
 	bool NewProgram(const char* name, const CShaderDefines& defines, CShaderProgramPtr& program);
+	void SaveProgramList();
 	bool NewEffect(const char* name, const CShaderDefines& defines, CShaderTechniquePtr& tech);
 
-	static Status ReloadChangedFileCB(void* param, const VfsPath& path);
-	Status ReloadChangedFile(const VfsPath& path);
+	static Status ReloadChangedFileCB(void* param, const std::vector<VfsPath>& paths);
+	Status ReloadChangedFiles(const std::vector<VfsPath>& paths);
 };
 
 #endif // INCLUDED_SHADERMANAGER
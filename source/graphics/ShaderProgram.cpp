@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -21,7 +21,9 @@
 
 #include "graphics/ShaderManager.h"
 #include "graphics/TextureManager.h"
+#include "lib/file/io/write_buffer.h"
 #include "lib/res/graphics/ogl_tex.h"
+#include "maths/MD5.h"
 #include "maths/Matrix3D.h"
 #include "maths/Vector3D.h"
 #include "ps/CLogger.h"
@@ -29,6 +31,8 @@
 #include "ps/Overlay.h"
 #include "ps/PreprocessorWrapper.h"
 
+#include <iomanip>
+
 #if !CONFIG2_GLES
 
 class CShaderProgramARB : public CShaderProgram
@@ -262,6 +266,34 @@ private:
 TIMER_ADD_CLIENT(tc_ShaderGLSLCompile);
 TIMER_ADD_CLIENT(tc_ShaderGLSLLink);
 
+// Linked GLSL programs can be saved in the cache directory with GL_ARB_get_program_binary,
+// because compiling and linking them is very slow on some drivers.
+// Increment this if the file format changes
+static const u32 PROGRAM_BINARY_VERSION = 1;
+
+static bool HaveProgramBinary()
+{
+#if CONFIG2_GLES
+	return false;
+#else
+	static int have = -1;
+	if (have == -1)
+	{
+		have = 0;
+		if (ogl_HaveVersion("4.1") || ogl_HaveExtension("GL_ARB_get_program_binary"))
+		{
+			// Some drivers support the extension but don't have any formats
+			GLint numFormats = 0;
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+			ogl_WarnIfError();
+			if (numFormats > 0)
+				have = 1;
+		}
+	}
+	return have == 1;
+#endif
+}
+
 class CShaderProgramGLSL : public CShaderProgram
 {
 public:
@@ -335,6 +367,11 @@ public:
 		ENSURE(!m_Program);
 		m_Program = pglCreateProgramObjectARB();
 
+#if !CONFIG2_GLES
+		if (HaveProgramBinary())
+			pglProgramParameteri(m_Program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+#endif
+
 		pglAttachObjectARB(m_Program, m_VertexShader);
 		ogl_WarnIfError();
 		pglAttachObjectARB(m_Program, m_FragmentShader);
@@ -375,6 +412,14 @@ public:
 		if (!ok)
 			return false;
 
+		return SetUpUniforms();
+	}
+
+	/**
+	 * Find the uniforms of a linked program, and assign its samplers to texture units.
+	 */
+	bool SetUpUniforms()
+	{
 		m_Uniforms.clear();
 		m_Samplers.clear();
 
@@ -404,11 +449,20 @@ public:
 			 || type == GL_SAMPLER_CUBE
 #if !CONFIG2_GLES
 			 || type == GL_SAMPLER_2D_SHADOW
+			 || type == GL_SAMPLER_2D_ARRAY_EXT
 #endif
 			)
 			{
+				GLenum target = GL_TEXTURE_2D;
+				if (type == GL_SAMPLER_CUBE)
+					target = GL_TEXTURE_CUBE_MAP;
+#if !CONFIG2_GLES
+				else if (type == GL_SAMPLER_2D_ARRAY_EXT)
+					target = GL_TEXTURE_2D_ARRAY_EXT;
+#endif
+
 				int unit = (int)m_Samplers.size();
-				m_Samplers[nameIntern].first = (type == GL_SAMPLER_CUBE ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D);
+				m_Samplers[nameIntern].first = target;
 				m_Samplers[nameIntern].second = unit;
 				pglUniform1iARB(loc, unit); // link uniform to unit
 				ogl_WarnIfError();
@@ -424,6 +478,119 @@ public:
 		return true;
 	}
 
+	/**
+	 * Get the path that the linked program will be cached at. This depends on
+	 * the preprocessed source code (and therefore the defines), the attribute
+	 * bindings and the GL driver, since the binaries are only valid for it.
+	 */
+	VfsPath GetBinaryPath(const CStr& vertexCode, const CStr& fragmentCode) const
+	{
+		MD5 hash;
+		hash.Update((const u8*)vertexCode.data(), vertexCode.length());
+		hash.Update((const u8*)fragmentCode.data(), fragmentCode.length());
+		for (std::map<CStrIntern, int>::const_iterator it = m_VertexAttribs.begin(); it != m_VertexAttribs.end(); ++it)
+		{
+			hash.Update((const u8*)it->first.c_str(), it->first.length() + 1);
+			hash.Update((const u8*)&it->second, sizeof(it->second));
+		}
+
+		const GLenum driverStrings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+		for (size_t i = 0; i < ARRAY_SIZE(driverStrings); ++i)
+		{
+			const char* str = (const char*)glGetString(driverStrings[i]);
+			if (str)
+				hash.Update((const u8*)str, strlen(str));
+		}
+
+		// Use a short prefix of the full hash, converted to hex (like CCacheLoader)
+		u8 digest[MD5::DIGESTSIZE];
+		hash.Final(digest);
+		std::wstringstream digestPrefix;
+		digestPrefix << std::hex;
+		for (size_t i = 0; i < 8; ++i)
+			digestPrefix << std::setfill(L'0') << std::setw(2) << (int)digest[i];
+
+		return VfsPath("cache") / m_VertexFile.ChangeExtension(m_VertexFile.Extension().string() + L"." + digestPrefix.str() + L".progbin");
+	}
+
+	/**
+	 * Try to create the program from a binary saved by SaveBinary.
+	 * @return false if it's not cached or couldn't be loaded (e.g. because
+	 *  the driver was updated), in which case it needs compiling as normal
+	 */
+	bool LoadBinary(const VfsPath& path)
+	{
+#if CONFIG2_GLES
+		UNUSED2(path);
+		return false;
+#else
+		if (!VfsFileExists(path))
+			return false;
+
+		shared_ptr<u8> data;
+		size_t size;
+		if (g_VFS->LoadFile(path, data, size) < 0 || size <= 2*sizeof(u32))
+			return false;
+
+		u32 version, format;
+		memcpy(&version, data.get(), sizeof(u32));
+		memcpy(&format, data.get() + sizeof(u32), sizeof(u32));
+		if (version != PROGRAM_BINARY_VERSION)
+			return false;
+
+		TIMER_ACCRUE(tc_ShaderGLSLLink);
+
+		ENSURE(!m_Program);
+		m_Program = pglCreateProgramObjectARB();
+		pglProgramBinary(m_Program, (GLenum)format, data.get() + 2*sizeof(u32), (GLsizei)(size - 2*sizeof(u32)));
+
+		// Drivers may reject binaries for any reason, and report an error for unknown formats
+		ogl_SquelchError(GL_INVALID_ENUM);
+
+		GLint ok = 0;
+		pglGetProgramiv(m_Program, GL_LINK_STATUS, &ok);
+		if (!ok)
+		{
+			pglDeleteProgram(m_Program);
+			m_Program = 0;
+			return false;
+		}
+
+		return SetUpUniforms();
+#endif
+	}
+
+	/**
+	 * Save the linked program for LoadBinary to use next time.
+	 */
+	void SaveBinary(const VfsPath& path)
+	{
+#if CONFIG2_GLES
+		UNUSED2(path);
+#else
+		GLint length = 0;
+		pglGetProgramiv(m_Program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+			return;
+
+		std::vector<u8> binary(length);
+		GLsizei written = 0;
+		GLenum format = 0;
+		pglGetProgramBinary(m_Program, length, &written, &format, &binary[0]);
+		ogl_WarnIfError();
+		if (written <= 0)
+			return;
+
+		// (These are local cached files, so we don't care about endianness etc)
+		u32 header[2] = { PROGRAM_BINARY_VERSION, (u32)format };
+		WriteBuffer buffer;
+		buffer.Append(header, sizeof(header));
+		buffer.Append(&binary[0], written);
+		if (g_VFS->CreateFile(path, buffer.Data(), buffer.Size()) < 0)
+			LOGWARNING(L"Failed to save shader program binary '%ls'", path.string().c_str());
+#endif
+	}
+
 	virtual void Reload()
 	{
 		Unload();
@@ -462,6 +629,17 @@ public:
 		fragmentCode.Replace("#version 120\r\n", "#version 100\nprecision mediump float;\n");
 #endif
 
+		VfsPath binaryPath;
+		if (HaveProgramBinary())
+		{
+			binaryPath = GetBinaryPath(vertexCode, fragmentCode);
+			if (LoadBinary(binaryPath))
+			{
+				m_IsValid = true;
+				return;
+			}
+		}
+
 		if (!Compile(m_VertexShader, m_VertexFile, vertexCode))
 			return;
 
@@ -471,6 +649,9 @@ public:
 		if (!Link())
 			return;
 
+		if (!binaryPath.empty())
+			SaveBinary(binaryPath);
+
 		m_IsValid = true;
 	}
 
@@ -651,6 +832,25 @@ public:
 		}
 	}
 
+	virtual bool HasVertexAttrib(const char* id)
+	{
+		return m_VertexAttribs.find(CStrIntern(id)) != m_VertexAttribs.end();
+	}
+
+	virtual void VertexAttribDivisor(const char* id, GLuint divisor)
+	{
+		std::map<CStrIntern, int>::iterator it = m_VertexAttribs.find(CStrIntern(id));
+		if (it != m_VertexAttribs.end())
+		{
+#if CONFIG2_GLES
+			UNUSED2(divisor);
+			debug_warn(L"glVertexAttribDivisor not supported on GLES");
+#else
+			pglVertexAttribDivisorARB(it->second, divisor);
+#endif
+		}
+	}
+
 private:
 	VfsPath m_VertexFile;
 	VfsPath m_FragmentFile;
@@ -796,6 +996,16 @@ void CShaderProgram::VertexAttribIPointer(const char* UNUSED(id), GLint UNUSED(s
 	debug_warn("Shader type doesn't support VertexAttribIPointer");
 }
 
+bool CShaderProgram::HasVertexAttrib(const char* UNUSED(id))
+{
+	return false;
+}
+
+void CShaderProgram::VertexAttribDivisor(const char* UNUSED(id), GLuint UNUSED(divisor))
+{
+	debug_warn("Shader type doesn't support VertexAttribDivisor");
+}
+
 #if CONFIG2_GLES
 
 // These should all be overridden by CShaderProgramGLSL
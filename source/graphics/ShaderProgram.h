@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -191,6 +191,17 @@ public:
 	virtual void VertexAttribPointer(const char* id, GLint size, GLenum type, GLboolean normalized, GLsizei stride, void* pointer);
 	virtual void VertexAttribIPointer(const char* id, GLint size, GLenum type, GLsizei stride, void* pointer);
 
+	/**
+	 * Returns whether the shader declares the given generic vertex attribute.
+	 */
+	virtual bool HasVertexAttrib(const char* id);
+
+	/**
+	 * Sets the rate at which the given generic vertex attribute advances during
+	 * instanced rendering (0 = per vertex, 1 = per instance; equivalent to glVertexAttribDivisor).
+	 */
+	virtual void VertexAttribDivisor(const char* id, GLuint divisor);
+
 	/**
 	 * Checks that all the required vertex attributes have been set.
 	 * Call this before calling glDrawArrays/glDrawElements etc to avoid potential crashes.
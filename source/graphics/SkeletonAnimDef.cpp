@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,11 +24,15 @@
 #include "SkeletonAnimDef.h"
 #include "maths/MathUtil.h"
 #include "ps/FileIo.h"
+#include "ps/MemoryStats.h"
 
 
+const float CSkeletonAnimDef::MAX_CONSTANT_ROTATION_ERROR = 0.0005f;
+const float CSkeletonAnimDef::MAX_CONSTANT_TRANSLATION_ERROR = 0.0005f;
+
 ///////////////////////////////////////////////////////////////////////////////////////////
 // CSkeletonAnimDef constructor
-CSkeletonAnimDef::CSkeletonAnimDef() : m_FrameTime(0), m_NumKeys(0), m_NumFrames(0), m_Keys(0)
+CSkeletonAnimDef::CSkeletonAnimDef() : m_FrameTime(0), m_NumKeys(0), m_NumFrames(0)
 {
 }
 
@@ -36,7 +40,130 @@ CSkeletonAnimDef::CSkeletonAnimDef() : m_FrameTime(0), m_NumKeys(0), m_NumFrames
 // CSkeletonAnimDef destructor
 CSkeletonAnimDef::~CSkeletonAnimDef() 
 {
-	delete[] m_Keys;
+	MemoryStats::Add(MEMORY_ANIMATIONS, -(ssize_t)(GetKeysMemorySize() + GetPoseCacheMemorySize()));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+// CompressKey: quantise a key for storage
+CSkeletonAnimDef::CompressedKey CSkeletonAnimDef::CompressKey(const Key& key) const
+{
+	CompressedKey ret;
+	for (int i = 0; i < 3; ++i)
+	{
+		float scale = m_TranslationScale[i];
+		float offset = m_TranslationOffset[i];
+		float value = key.m_Translation[i];
+		int q = (scale == 0.f) ? 0 : (int)floorf((value - offset) / scale + 0.5f);
+		ret.m_Translation[i] = (i16)(clamp(q, 0, 65535) - 32768);
+	}
+
+	const float rotation[4] = { key.m_Rotation.m_V.X, key.m_Rotation.m_V.Y, key.m_Rotation.m_V.Z, key.m_Rotation.m_W };
+	for (int i = 0; i < 4; ++i)
+		ret.m_Rotation[i] = (i16)clamp((int)floorf(rotation[i] * 32767.f + 0.5f), -32767, 32767);
+
+	return ret;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+// DecompressKey: convert a stored key back to floats
+void CSkeletonAnimDef::DecompressKey(const CompressedKey& in, Key& out) const
+{
+	out.m_Translation.X = m_TranslationOffset.X + m_TranslationScale.X * (in.m_Translation[0] + 32768);
+	out.m_Translation.Y = m_TranslationOffset.Y + m_TranslationScale.Y * (in.m_Translation[1] + 32768);
+	out.m_Translation.Z = m_TranslationOffset.Z + m_TranslationScale.Z * (in.m_Translation[2] + 32768);
+
+	out.m_Rotation.m_V.X = in.m_Rotation[0] / 32767.f;
+	out.m_Rotation.m_V.Y = in.m_Rotation[1] / 32767.f;
+	out.m_Rotation.m_V.Z = in.m_Rotation[2] / 32767.f;
+	out.m_Rotation.m_W = in.m_Rotation[3] / 32767.f;
+	out.m_Rotation.Normalize();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+// GetKey: get the key for given bone at given frame
+CSkeletonAnimDef::Key CSkeletonAnimDef::GetKey(size_t frame, size_t bone) const
+{
+	Key key;
+	DecompressKey(GetCompressedKey(frame, bone), key);
+	return key;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+// SetKeys: replace the animation data, quantising every key to 16 bits per component
+// and storing bones that don't move as a single key
+void CSkeletonAnimDef::SetKeys(size_t numFrames, size_t numKeys, const Key* keys)
+{
+	MemoryStats::Add(MEMORY_ANIMATIONS, -(ssize_t)GetKeysMemorySize());
+
+	m_NumFrames = numFrames;
+	m_NumKeys = numKeys;
+	m_Tracks.clear();
+	m_CompressedKeys.clear();
+
+	{
+		CScopeLock lock(m_PoseCacheMutex);
+		MemoryStats::Add(MEMORY_ANIMATIONS, -(ssize_t)GetPoseCacheMemorySize());
+		m_PoseCache.clear();
+		m_PoseCacheKeys.clear();
+	}
+
+	if (numFrames == 0 || numKeys == 0)
+		return;
+
+	// Find the range of translations, so they can be quantised relative to it
+	CVector3D minTranslation = keys[0].m_Translation;
+	CVector3D maxTranslation = keys[0].m_Translation;
+	for (size_t i = 1; i < numFrames*numKeys; ++i)
+	{
+		const CVector3D& t = keys[i].m_Translation;
+		minTranslation = CVector3D(std::min(minTranslation.X, t.X), std::min(minTranslation.Y, t.Y), std::min(minTranslation.Z, t.Z));
+		maxTranslation = CVector3D(std::max(maxTranslation.X, t.X), std::max(maxTranslation.Y, t.Y), std::max(maxTranslation.Z, t.Z));
+	}
+	m_TranslationOffset = minTranslation;
+	m_TranslationScale = (maxTranslation - minTranslation) * (1.f / 65535.f);
+
+	m_Tracks.resize(numKeys);
+	for (size_t bone = 0; bone < numKeys; ++bone)
+	{
+		// If every frame is close enough to the first, only store the first
+		const Key& first = keys[bone];
+		bool constant = true;
+		for (size_t frame = 1; frame < numFrames && constant; ++frame)
+		{
+			const Key& key = keys[frame*numKeys + bone];
+			CVector3D dt = key.m_Translation - first.m_Translation;
+			CQuaternion dr = key.m_Rotation - first.m_Rotation;
+			constant = fabsf(dt.X) <= MAX_CONSTANT_TRANSLATION_ERROR
+				&& fabsf(dt.Y) <= MAX_CONSTANT_TRANSLATION_ERROR
+				&& fabsf(dt.Z) <= MAX_CONSTANT_TRANSLATION_ERROR
+				&& fabsf(dr.m_V.X) <= MAX_CONSTANT_ROTATION_ERROR
+				&& fabsf(dr.m_V.Y) <= MAX_CONSTANT_ROTATION_ERROR
+				&& fabsf(dr.m_V.Z) <= MAX_CONSTANT_ROTATION_ERROR
+				&& fabsf(dr.m_W) <= MAX_CONSTANT_ROTATION_ERROR;
+		}
+
+		Track& track = m_Tracks[bone];
+		track.m_Offset = (u32)m_CompressedKeys.size();
+		track.m_Stride = constant ? 0 : 1;
+		for (size_t frame = 0; frame < (constant ? 1 : numFrames); ++frame)
+			m_CompressedKeys.push_back(CompressKey(keys[frame*numKeys + bone]));
+	}
+
+	MemoryStats::Add(MEMORY_ANIMATIONS, (ssize_t)GetKeysMemorySize());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+// GetKeysMemorySize: return number of bytes used to store the keys
+size_t CSkeletonAnimDef::GetKeysMemorySize() const
+{
+	return m_Tracks.size()*sizeof(Track) + m_CompressedKeys.size()*sizeof(CompressedKey);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+// GetPoseCacheMemorySize: return number of bytes used by the pose cache
+size_t CSkeletonAnimDef::GetPoseCacheMemorySize() const
+{
+	return m_PoseCache.size()*sizeof(CMatrix3D) + m_PoseCacheKeys.size()*sizeof(size_t);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////
@@ -61,7 +188,7 @@ void CSkeletonAnimDef::BuildBoneMatrices(float time, CMatrix3D* matrices, bool l
 		// the animation's final frame with no interpolation.
 		for (size_t i = 0; i < m_NumKeys; i++)
 		{
-			const Key& key = GetKey(startframe, i);
+			Key key = GetKey(startframe, i);
 			matrices[i].SetIdentity();
 			matrices[i].Rotate(key.m_Rotation);
 			matrices[i].Translate(key.m_Translation);
@@ -71,8 +198,8 @@ void CSkeletonAnimDef::BuildBoneMatrices(float time, CMatrix3D* matrices, bool l
 	{
 		for (size_t i = 0; i < m_NumKeys; i++)
 		{
-			const Key& startkey = GetKey(startframe, i);
-			const Key& endkey = GetKey(endframe, i);
+			Key startkey = GetKey(startframe, i);
+			Key endkey = GetKey(endframe, i);
 
 			CVector3D trans = Interpolate(startkey.m_Translation, endkey.m_Translation, deltatime);
 			// TODO: is slerp the best thing to use here?
@@ -85,6 +212,50 @@ void CSkeletonAnimDef::BuildBoneMatrices(float time, CMatrix3D* matrices, bool l
 	}
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////
+// BuildBoneMatricesShared: build matrices for all bones at the given time, rounded to
+// a fraction of a frame, using previously computed poses where possible
+void CSkeletonAnimDef::BuildBoneMatricesShared(float time, CMatrix3D* matrices, bool loop) const
+{
+	if (time < 0.f || m_NumKeys == 0 || m_NumFrames == 0)
+	{
+		BuildBoneMatrices(time, matrices, loop);
+		return;
+	}
+
+	// Round down to a step (rounding up could wrap a non-looping animation back
+	// to its first frame), wrapping around at the end of the animation like
+	// BuildBoneMatrices does so every cycle shares the same poses
+	const size_t numSteps = m_NumFrames * POSE_CACHE_STEPS_PER_FRAME;
+	const size_t step = (size_t)(time / m_FrameTime * POSE_CACHE_STEPS_PER_FRAME) % numSteps;
+	const size_t key = step*2 + (loop ? 1 : 0) + 1;
+	const size_t slot = step % POSE_CACHE_SIZE;
+
+	{
+		CScopeLock lock(m_PoseCacheMutex);
+		if (m_PoseCacheKeys.empty())
+		{
+			m_PoseCacheKeys.resize(POSE_CACHE_SIZE, 0);
+			m_PoseCache.resize(POSE_CACHE_SIZE * m_NumKeys);
+			MemoryStats::Add(MEMORY_ANIMATIONS, (ssize_t)GetPoseCacheMemorySize());
+		}
+
+		if (m_PoseCacheKeys[slot] == key)
+		{
+			std::copy(&m_PoseCache[slot * m_NumKeys], &m_PoseCache[slot * m_NumKeys] + m_NumKeys, matrices);
+			return;
+		}
+	}
+
+	// Don't hold the lock while computing the pose, so other threads can
+	// still use the other cached poses
+	BuildBoneMatrices(step * m_FrameTime / POSE_CACHE_STEPS_PER_FRAME, matrices, loop);
+
+	CScopeLock lock(m_PoseCacheMutex);
+	std::copy(matrices, matrices + m_NumKeys, &m_PoseCache[slot * m_NumKeys]);
+	m_PoseCacheKeys[slot] = key;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////
 // Load: try to load the anim from given file; return a new anim if successful
 CSkeletonAnimDef* CSkeletonAnimDef::Load(const VfsPath& filename)
@@ -103,10 +274,12 @@ CSkeletonAnimDef* CSkeletonAnimDef::Load(const VfsPath& filename)
 		CStr name; // unused - just here to maintain compatibility with the animation files
 		unpacker.UnpackString(name);
 		unpacker.UnpackRaw(&anim->m_FrameTime,sizeof(anim->m_FrameTime));
-		anim->m_NumKeys = unpacker.UnpackSize();
-		anim->m_NumFrames = unpacker.UnpackSize();
-		anim->m_Keys=new Key[anim->m_NumKeys*anim->m_NumFrames];
-		unpacker.UnpackRaw(anim->m_Keys,anim->m_NumKeys*anim->m_NumFrames*sizeof(Key));
+		const size_t numKeys = unpacker.UnpackSize();
+		const size_t numFrames = unpacker.UnpackSize();
+		std::vector<Key> keys(numKeys*numFrames);
+		if (!keys.empty())
+			unpacker.UnpackRaw(&keys[0],keys.size()*sizeof(Key));
+		anim->SetKeys(numFrames, numKeys, keys.empty() ? NULL : &keys[0]);
 	} catch (PSERROR_File&) {
 		delete anim;
 		throw;
@@ -128,7 +301,14 @@ void CSkeletonAnimDef::Save(const VfsPath& pathname,const CSkeletonAnimDef* anim
 	packer.PackSize(numKeys);
 	const size_t numFrames = anim->m_NumFrames;
 	packer.PackSize(numFrames);
-	packer.PackRaw(anim->m_Keys,numKeys*numFrames*sizeof(Key));
+	for (size_t i = 0; i < numFrames; ++i)
+	{
+		for (size_t j = 0; j < numKeys; ++j)
+		{
+			Key key = anim->GetKey(i, j);
+			packer.PackRaw(&key,sizeof(Key));
+		}
+	}
 
 	// now write it
 	packer.Write(pathname);
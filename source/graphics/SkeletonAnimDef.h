@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -25,6 +25,9 @@
 #include "maths/Vector3D.h"
 #include "maths/Quaternion.h"
 #include "lib/file/vfs/vfs_path.h"
+#include "ps/ThreadUtil.h"
+
+#include <vector>
 
 ////////////////////////////////////////////////////////////////////////////////////////
 // CBoneState: structure describing state of a bone at some point
@@ -62,9 +65,15 @@ public:
 	// return the number of keys in this animation
 	size_t GetNumKeys() const { return (size_t)m_NumKeys; }
 
-	// accessors: get a key for given bone at given time
-	Key& GetKey(size_t frame, size_t bone) { return m_Keys[frame*m_NumKeys+bone]; }
-	const Key& GetKey(size_t frame, size_t bone) const { return m_Keys[frame*m_NumKeys+bone]; }	
+	// accessor: get the (decompressed) key for given bone at given frame
+	Key GetKey(size_t frame, size_t bone) const;
+
+	// replace the animation data with numFrames*numKeys keys (frame-major),
+	// compressing them for storage
+	void SetKeys(size_t numFrames, size_t numKeys, const Key* keys);
+
+	// return number of bytes used to store the keys
+	size_t GetKeysMemorySize() const;
 
 	// get duration of this anim, in ms
 	float GetDuration() const { return m_NumFrames*m_FrameTime; }
@@ -77,6 +86,12 @@ public:
 	// build matrices for all bones at the given time (in MS) in this animation
 	void BuildBoneMatrices(float time, CMatrix3D* matrices, bool loop) const;
 
+	// build matrices for all bones at the given time, rounded to a fraction of a
+	// frame, reusing the result when other models have recently sampled this
+	// animation at the same rounded time (e.g. units moving in formation).
+	// Safe to call from multiple threads at once.
+	void BuildBoneMatricesShared(float time, CMatrix3D* matrices, bool loop) const;
+
 	// anim I/O functions
 	static CSkeletonAnimDef* Load(const VfsPath& filename);
 	static void Save(const VfsPath& pathname, const CSkeletonAnimDef* anim);
@@ -88,8 +103,60 @@ public:
 	size_t m_NumKeys;
 	// number of frames in the animation
 	size_t m_NumFrames;
-	// animation data - m_NumKeys*m_NumFrames total keys
-	Key* m_Keys;
+
+private:
+	// maximum per-component error allowed when merging a bone's keys
+	// into a single constant key
+	static const float MAX_CONSTANT_ROTATION_ERROR;
+	static const float MAX_CONSTANT_TRANSLATION_ERROR;
+
+	// CompressedKey: a key with each component quantised to 16 bits.
+	// Rotations are stored in [-1, 1]; translations are stored relative to
+	// the range of translations used by the whole animation.
+	struct CompressedKey
+	{
+		i16 m_Translation[3];
+		i16 m_Rotation[4];
+	};
+
+	// Track: the keys of a single bone, at m_CompressedKeys[m_Offset + frame*m_Stride].
+	// Bones that don't move have a stride of 0, so they only store one key.
+	struct Track
+	{
+		u32 m_Offset;
+		u32 m_Stride;
+	};
+
+	const CompressedKey& GetCompressedKey(size_t frame, size_t bone) const
+	{
+		const Track& track = m_Tracks[bone];
+		return m_CompressedKeys[track.m_Offset + frame*track.m_Stride];
+	}
+
+	CompressedKey CompressKey(const Key& key) const;
+	void DecompressKey(const CompressedKey& in, Key& out) const;
+
+	// animation data - one track per key
+	std::vector<Track> m_Tracks;
+	std::vector<CompressedKey> m_CompressedKeys;
+	// dequantisation of translations: value = m_TranslationOffset + m_TranslationScale*(quantised + 32768)
+	CVector3D m_TranslationOffset;
+	CVector3D m_TranslationScale;
+
+	// number of rounded sample times per frame used by BuildBoneMatricesShared
+	static const size_t POSE_CACHE_STEPS_PER_FRAME = 4;
+	// number of poses remembered by BuildBoneMatricesShared
+	static const size_t POSE_CACHE_SIZE = 16;
+
+	// pose cache: slot i holds the m_NumKeys matrices starting at
+	// m_PoseCache[i*m_NumKeys], for the key in m_PoseCacheKeys[i] (0 if empty).
+	// Poses only depend on the time, so entries never need invalidating.
+	mutable CMutex m_PoseCacheMutex;
+	mutable std::vector<CMatrix3D> m_PoseCache;
+	mutable std::vector<size_t> m_PoseCacheKeys;
+
+	// number of bytes used by the pose cache (must be called with m_PoseCacheMutex locked)
+	size_t GetPoseCacheMemorySize() const;
 };
 
 #endif
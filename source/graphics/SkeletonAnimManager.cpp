@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -63,6 +63,10 @@ CSkeletonAnimDef* CSkeletonAnimManager::GetAnimation(const VfsPath& pathname)
 	// Find the file to load
 	VfsPath psaFilename = m_ColladaManager.GetLoadablePath(name, CColladaManager::PSA);
 
+	// Try again later if it's still being converted
+	if (psaFilename.empty() && m_ColladaManager.IsConversionPending(name))
+		return NULL;
+
 	if (psaFilename.empty())
 	{
 		LOGERROR(L"Could not load animation '%ls'", pathname.string().c_str());
@@ -89,3 +93,18 @@ CSkeletonAnimDef* CSkeletonAnimManager::GetAnimation(const VfsPath& pathname)
 	m_Animations[name] = def; // NULL if failed to load - we won't try loading it again
 	return def;
 }
+
+bool CSkeletonAnimManager::IsAnimationPending(const VfsPath& pathname)
+{
+	return m_ColladaManager.IsConversionPending(pathname.ChangeExtension(L""));
+}
+
+VfsPath CSkeletonAnimManager::GetAnimationFile(const VfsPath& pathname)
+{
+	VfsPath name = pathname.ChangeExtension(L"");
+
+	if (m_Animations.find(name) != m_Animations.end())
+		return VfsPath();
+
+	return m_ColladaManager.GetLoadablePath(name, CColladaManager::PSA);
+}
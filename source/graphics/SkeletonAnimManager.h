@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -46,6 +46,19 @@ public:
 	// refer to valid animation file
 	CSkeletonAnimDef* GetAnimation(const VfsPath& pathname);
 
+	/**
+	 * Returns whether GetAnimation failed because the animation is still
+	 * being converted (see CColladaManager::SetAsyncConversion).
+	 */
+	bool IsAnimationPending(const VfsPath& pathname);
+
+	/**
+	 * Returns the file that GetAnimation would read the animation from, or an
+	 * empty path if it's already loaded or can't be loaded yet. (This is used for
+	 * prefetching, and will start converting the animation if necessary.)
+	 */
+	VfsPath GetAnimationFile(const VfsPath& pathname);
+
 private:
 	// map of all known animations. Value is NULL if it failed to load.
 	boost::unordered_map<VfsPath, CSkeletonAnimDef*> m_Animations;
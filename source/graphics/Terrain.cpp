@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -423,6 +423,20 @@ fixed CTerrain::GetExactGroundLevelFixed(fixed x, fixed z) const
 	// in handling triangulation properly
 }
 
+// (These call the single-point versions, which get inlined here so the
+// heightmap pointer and map size are only loaded once per batch)
+void CTerrain::GetExactGroundLevels(size_t count, const float* x, const float* z, float* heights) const
+{
+	for (size_t n = 0; n < count; ++n)
+		heights[n] = GetExactGroundLevel(x[n], z[n]);
+}
+
+void CTerrain::GetExactGroundLevelsFixed(size_t count, const fixed* x, const fixed* z, fixed* heights) const
+{
+	for (size_t n = 0; n < count; ++n)
+		heights[n] = GetExactGroundLevelFixed(x[n], z[n]);
+}
+
 bool CTerrain::GetTriangulationDir(ssize_t i, ssize_t j) const
 {
 	// Clamp to size-2 so we can use the tiles (i,j)-(i+1,j+1)
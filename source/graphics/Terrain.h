@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -85,6 +85,19 @@ public:
 	fixed GetVertexGroundLevelFixed(ssize_t i, ssize_t j) const;
 	float GetExactGroundLevel(float x, float z) const;
 	fixed GetExactGroundLevelFixed(fixed x, fixed z) const;
+
+	/**
+	 * Computes GetExactGroundLevel for each of the @p count points (x[n], z[n]),
+	 * storing the results in @p heights (which may be the same array as @p x or @p z).
+	 * This gives exactly the same results as separate calls, but is cheaper for
+	 * callers that have many points at once.
+	 */
+	void GetExactGroundLevels(size_t count, const float* x, const float* z, float* heights) const;
+
+	/**
+	 * As GetExactGroundLevels, for GetExactGroundLevelFixed.
+	 */
+	void GetExactGroundLevelsFixed(size_t count, const fixed* x, const fixed* z, fixed* heights) const;
 	float GetFilteredGroundLevel(float x, float z, float radius) const;
 
 	// get the approximate slope (0 = horizontal, 0.5 = 30 degrees, 1.0 = 45 degrees, etc)
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -18,72 +18,187 @@
 #include "precompiled.h"
 #include "TerritoryBoundary.h"
 
-#include <algorithm> // for reverse
+#include <algorithm> // for merge
 
 #include "graphics/Terrain.h"
 #include "simulation2/components/ICmpTerritoryManager.h"
 
-std::vector<STerritoryBoundary> CTerritoryBoundaryCalculator::ComputeBoundaries(const Grid<u8>* territory)
+// Some constants for the border walk
+static const CVector2D edgeOffsets[] = {
+	CVector2D(0.5f, 0.0f),
+	CVector2D(1.0f, 0.5f),
+	CVector2D(0.5f, 1.0f),
+	CVector2D(0.0f, 0.5f)
+};
+
+// syntactic sugar
+static const u8 TILE_BOTTOM = 0;
+static const u8 TILE_RIGHT = 1;
+static const u8 TILE_TOP = 2;
+static const u8 TILE_LEFT = 3;
+
+static const int CURVE_CW = -1;
+static const int CURVE_CCW = 1;
+
+// === Find territory boundaries ===
+// 
+// The territory boundaries delineate areas of tiles that belong to the same player, and that all have the same 
+// connected-to-a-root-influence-entity status (see also STerritoryBoundary for a more wordy definition). Note that the grid 
+// values contain bit-packed information (i.e. not just the owning player ID), so we must be careful to only compare grid 
+// values using the player ID and connected flag bits. The joint mask to select these is referred to as the discriminator mask.
+// 
+// The idea is to scan the (i,j)-grid going up row by row and look for tiles that have a different territory assignment from 
+// the one right underneath it (or, if it's a tile on the first row, they need only have a territory assignment). These tiles 
+// are necessarily edge tiles of a territory, and hence a territory boundary must pass through their bottom edge. Therefore, 
+// we start tracing the outline of the territory starting from said bottom edge, and go CCW around the territory boundary.
+// Tracing continues until the starting point is reached, at which point the boundary is complete.
+// 
+// While tracing a boundary, every tile in which the boundary passes through the bottom edge are marked as 'processed', so that
+// we know not to start a new run from these tiles when scanning continues (when the boundary is complete). This information 
+// is maintained in the grid values themselves by means of the 'processed' bit mask (stressing the importance of using the 
+// discriminator mask to compare only player ID and connected flag).
+// 
+// Thus, we can identify the following conditions for starting a trace from a tile (i,j). Let g(i,j) indicate the 
+// discriminator grid value at position (i,j); then the conditions are:
+//     - g(i,j) != 0; the tile must not be neutral
+//     - j=0 or g(i,j) != g(i,j-1);  the tile directly underneath it must have a different owner and/or connected flag
+//     - the tile must not already be marked as 'processed'
+// 
+// Additionally, there is one more point to be made; the algorithm initially assumes it's tracing CCW around the territory.
+// If it's tracing an inner edge, however, this will actually cause it to trace in the CW direction (because inner edges curve 
+// 'backwards' compared to the outer edges when starting the trace in the same direction). This turns out to actually be 
+// exactly what the renderer needs to render two territory boundaries on the same edge back-to-back (instead of overlapping
+// each other).
+// 
+// In either case, we keep track of the way the outline curves while we're tracing to determine whether we're going CW or CCW.
+// If at some point we ever need to revert the winding order or external code needs to know about it explicitly, then we can
+// do this by looking at a curvature value which we define to start at 0, and which is incremented by 1 for every CCW turn and
+// decremented by 1 for every CW turn. Hence, a negative multiple of 4 means a CW winding order, and a positive one means CCW.
+
+static const int TERRITORY_DISCR_MASK = (ICmpTerritoryManager::TERRITORY_CONNECTED_MASK | ICmpTerritoryManager::TERRITORY_PLAYER_MASK);
+
+/**
+ * Traces the boundary whose bottom-most edge is the bottom edge of tile (i, j),
+ * marking the tiles along it as processed.
+ */
+static void TraceBoundary(Grid<u8>& grid, u16 i, u16 j, STerritoryBoundary& boundary)
 {
-	std::vector<STerritoryBoundary> boundaries;
+	int curvature = 0; // +1 for every CCW 90 degree turn, -1 for every CW 90 degree turn; must be multiple of 4 at the end
 
-	// Copy the territories grid so we can mess with it
-	Grid<u8> grid(*territory);
+	u8 tileState = grid.get(i, j);
+	u8 tileDiscr = (tileState & TERRITORY_DISCR_MASK);
+
+	boundary.owner = (tileState & ICmpTerritoryManager::TERRITORY_PLAYER_MASK);
+	boundary.connected = (tileState & ICmpTerritoryManager::TERRITORY_CONNECTED_MASK) != 0;
+	std::vector<CVector2D>& points = boundary.points;
 
-	// Some constants for the border walk
-	CVector2D edgeOffsets[] = {
-		CVector2D(0.5f, 0.0f),
-		CVector2D(1.0f, 0.5f),
-		CVector2D(0.5f, 1.0f),
-		CVector2D(0.0f, 0.5f)
-	};
-
-	// syntactic sugar
-	const u8 TILE_BOTTOM = 0;
-	const u8 TILE_RIGHT = 1;
-	const u8 TILE_TOP = 2;
-	const u8 TILE_LEFT = 3;
-
-	const int CURVE_CW = -1;
-	const int CURVE_CCW = 1;
-
-	// === Find territory boundaries ===
-	// 
-	// The territory boundaries delineate areas of tiles that belong to the same player, and that all have the same 
-	// connected-to-a-root-influence-entity status (see also STerritoryBoundary for a more wordy definition). Note that the grid 
-	// values contain bit-packed information (i.e. not just the owning player ID), so we must be careful to only compare grid 
-	// values using the player ID and connected flag bits. The joint mask to select these is referred to as the discriminator mask.
-	// 
-	// The idea is to scan the (i,j)-grid going up row by row and look for tiles that have a different territory assignment from 
-	// the one right underneath it (or, if it's a tile on the first row, they need only have a territory assignment). These tiles 
-	// are necessarily edge tiles of a territory, and hence a territory boundary must pass through their bottom edge. Therefore, 
-	// we start tracing the outline of the territory starting from said bottom edge, and go CCW around the territory boundary.
-	// Tracing continues until the starting point is reached, at which point the boundary is complete.
-	// 
-	// While tracing a boundary, every tile in which the boundary passes through the bottom edge are marked as 'processed', so that
-	// we know not to start a new run from these tiles when scanning continues (when the boundary is complete). This information 
-	// is maintained in the grid values themselves by means of the 'processed' bit mask (stressing the importance of using the 
-	// discriminator mask to compare only player ID and connected flag).
-	// 
-	// Thus, we can identify the following conditions for starting a trace from a tile (i,j). Let g(i,j) indicate the 
-	// discriminator grid value at position (i,j); then the conditions are:
-	//     - g(i,j) != 0; the tile must not be neutral
-	//     - j=0 or g(i,j) != g(i,j-1);  the tile directly underneath it must have a different owner and/or connected flag
-	//     - the tile must not already be marked as 'processed'
-	// 
-	// Additionally, there is one more point to be made; the algorithm initially assumes it's tracing CCW around the territory.
-	// If it's tracing an inner edge, however, this will actually cause it to trace in the CW direction (because inner edges curve 
-	// 'backwards' compared to the outer edges when starting the trace in the same direction). This turns out to actually be 
-	// exactly what the renderer needs to render two territory boundaries on the same edge back-to-back (instead of overlapping
-	// each other).
-	// 
-	// In either case, we keep track of the way the outline curves while we're tracing to determine whether we're going CW or CCW.
-	// If at some point we ever need to revert the winding order or external code needs to know about it explicitly, then we can
-	// do this by looking at a curvature value which we define to start at 0, and which is incremented by 1 for every CCW turn and
-	// decremented by 1 for every CW turn. Hence, a negative multiple of 4 means a CW winding order, and a positive one means CCW.
-	
-	const int TERRITORY_DISCR_MASK = (ICmpTerritoryManager::TERRITORY_CONNECTED_MASK | ICmpTerritoryManager::TERRITORY_PLAYER_MASK);
+	u8 dir = TILE_BOTTOM;
+
+	u8 cdir = dir;
+	u16 ci = i, cj = j;
+
+	u16 maxi = (u16)(grid.m_W-1);
+	u16 maxj = (u16)(grid.m_H-1);
+
+	while (true)
+	{
+		points.push_back((CVector2D(ci, cj) + edgeOffsets[cdir]) * TERRAIN_TILE_SIZE);
+		STerritoryBoundary::TileEdge edge = { ci, cj, cdir };
+		boundary.edges.push_back(edge);
+
+		// Given that we're on an edge on a continuous boundary and aiming anticlockwise,
+		// we can either carry on straight or turn left or turn right, so examine each
+		// of the three possible cases (depending on initial direction):
+		switch (cdir)
+		{
+		case TILE_BOTTOM:
+
+			// mark tile as processed so we don't start a new run from it after this one is complete
+			ENSURE(!(grid.get(ci, cj) & ICmpTerritoryManager::TERRITORY_PROCESSED_MASK));
+			grid.set(ci, cj, grid.get(ci, cj) | ICmpTerritoryManager::TERRITORY_PROCESSED_MASK);
+
+			if (ci < maxi && cj > 0 && (grid.get(ci+1, cj-1) & TERRITORY_DISCR_MASK) == tileDiscr)
+			{
+				++ci;
+				--cj;
+				cdir = TILE_LEFT;
+				curvature += CURVE_CW;
+			}
+			else if (ci < maxi && (grid.get(ci+1, cj) & TERRITORY_DISCR_MASK) == tileDiscr)
+				++ci;
+			else
+			{
+				cdir = TILE_RIGHT;
+				curvature += CURVE_CCW;
+			}
+			break;
+
+		case TILE_RIGHT:
+			if (ci < maxi && cj < maxj && (grid.get(ci+1, cj+1) & TERRITORY_DISCR_MASK) == tileDiscr)
+			{
+				++ci;
+				++cj;
+				cdir = TILE_BOTTOM;
+				curvature += CURVE_CW;
+			}
+			else if (cj < maxj && (grid.get(ci, cj+1) & TERRITORY_DISCR_MASK) == tileDiscr)
+				++cj;
+			else
+			{
+				cdir = TILE_TOP;
+				curvature += CURVE_CCW;
+			}
+			break;
+
+		case TILE_TOP:
+			if (ci > 0 && cj < maxj && (grid.get(ci-1, cj+1) & TERRITORY_DISCR_MASK) == tileDiscr)
+			{
+				--ci;
+				++cj;
+				cdir = TILE_RIGHT;
+				curvature += CURVE_CW;
+			}
+			else if (ci > 0 && (grid.get(ci-1, cj) & TERRITORY_DISCR_MASK) == tileDiscr)
+				--ci;
+			else
+			{
+				cdir = TILE_LEFT;
+				curvature += CURVE_CCW;
+			}
+			break;
+
+		case TILE_LEFT:
+			if (ci > 0 && cj > 0 && (grid.get(ci-1, cj-1) & TERRITORY_DISCR_MASK) == tileDiscr)
+			{
+				--ci;
+				--cj;
+				cdir = TILE_TOP;
+				curvature += CURVE_CW;
+			}
+			else if (cj > 0 && (grid.get(ci, cj-1) & TERRITORY_DISCR_MASK) == tileDiscr)
+				--cj;
+			else
+			{
+				cdir = TILE_BOTTOM;
+				curvature += CURVE_CCW;
+			}
+			break;
+		}
+
+		// Stop when we've reached the starting point again
+		if (ci == i && cj == j && cdir == dir)
+			break;
+	}
+
+	ENSURE(curvature != 0 && abs(curvature) % 4 == 0);
+}
 
+/**
+ * Traces every boundary that starts from a tile that's not already processed,
+ * giving them IDs starting from @p nextID.
+ */
+static void TraceBoundaries(Grid<u8>& grid, std::vector<STerritoryBoundary>& boundaries, u32& nextID)
+{
 	// Try to find an assigned tile
 	for (u16 j = 0; j < grid.m_H; ++j)
 	{
@@ -108,112 +223,95 @@ std::vector<STerritoryBoundary> CTerritoryBoundaryCalculator::ComputeBoundaries(
 			// start at the bottom edge of it and chase anticlockwise around the border until
 			// we reach the starting point again
 
-			int curvature = 0; // +1 for every CCW 90 degree turn, -1 for every CW 90 degree turn; must be multiple of 4 at the end
-
 			boundaries.push_back(STerritoryBoundary());
-			boundaries.back().owner = (tileState & ICmpTerritoryManager::TERRITORY_PLAYER_MASK);
-			boundaries.back().connected = (tileState & ICmpTerritoryManager::TERRITORY_CONNECTED_MASK) != 0;
-			std::vector<CVector2D>& points = boundaries.back().points;
+			boundaries.back().id = nextID++;
+			TraceBoundary(grid, i, j, boundaries.back());
+		}
+	}
+}
 
-			u8 dir = TILE_BOTTOM;
+/**
+ * Returns whether a's trace starts before b's in TraceBoundaries's scan order.
+ */
+static bool BoundaryStartsBefore(const STerritoryBoundary& a, const STerritoryBoundary& b)
+{
+	const STerritoryBoundary::TileEdge& ea = a.edges[0];
+	const STerritoryBoundary::TileEdge& eb = b.edges[0];
+	return ea.j < eb.j || (ea.j == eb.j && ea.i < eb.i);
+}
 
-			u8 cdir = dir;
-			u16 ci = i, cj = j;
+std::vector<STerritoryBoundary> CTerritoryBoundaryCalculator::ComputeBoundaries(const Grid<u8>* territory)
+{
+	std::vector<STerritoryBoundary> boundaries;
 
-			u16 maxi = (u16)(grid.m_W-1);
-			u16 maxj = (u16)(grid.m_H-1);
+	// Copy the territories grid so we can mess with it
+	Grid<u8> grid(*territory);
 
-			while (true)
-			{
-				points.push_back((CVector2D(ci, cj) + edgeOffsets[cdir]) * TERRAIN_TILE_SIZE);
-
-				// Given that we're on an edge on a continuous boundary and aiming anticlockwise,
-				// we can either carry on straight or turn left or turn right, so examine each
-				// of the three possible cases (depending on initial direction):
-				switch (cdir)
-				{
-				case TILE_BOTTOM:
-
-					// mark tile as processed so we don't start a new run from it after this one is complete
-					ENSURE(!(grid.get(ci, cj) & ICmpTerritoryManager::TERRITORY_PROCESSED_MASK));
-					grid.set(ci, cj, grid.get(ci, cj) | ICmpTerritoryManager::TERRITORY_PROCESSED_MASK);
-
-					if (ci < maxi && cj > 0 && (grid.get(ci+1, cj-1) & TERRITORY_DISCR_MASK) == tileDiscr)
-					{
-						++ci;
-						--cj;
-						cdir = TILE_LEFT;
-						curvature += CURVE_CW;
-					}
-					else if (ci < maxi && (grid.get(ci+1, cj) & TERRITORY_DISCR_MASK) == tileDiscr)
-						++ci;
-					else
-					{
-						cdir = TILE_RIGHT;
-						curvature += CURVE_CCW;
-					}
-					break;
-
-				case TILE_RIGHT:
-					if (ci < maxi && cj < maxj && (grid.get(ci+1, cj+1) & TERRITORY_DISCR_MASK) == tileDiscr)
-					{
-						++ci;
-						++cj;
-						cdir = TILE_BOTTOM;
-						curvature += CURVE_CW;
-					}
-					else if (cj < maxj && (grid.get(ci, cj+1) & TERRITORY_DISCR_MASK) == tileDiscr)
-						++cj;
-					else
-					{
-						cdir = TILE_TOP;
-						curvature += CURVE_CCW;
-					}
-					break;
-
-				case TILE_TOP:
-					if (ci > 0 && cj < maxj && (grid.get(ci-1, cj+1) & TERRITORY_DISCR_MASK) == tileDiscr)
-					{
-						--ci;
-						++cj;
-						cdir = TILE_RIGHT;
-						curvature += CURVE_CW;
-					}
-					else if (ci > 0 && (grid.get(ci-1, cj) & TERRITORY_DISCR_MASK) == tileDiscr)
-						--ci;
-					else
-					{
-						cdir = TILE_LEFT;
-						curvature += CURVE_CCW;
-					}
-					break;
-
-				case TILE_LEFT:
-					if (ci > 0 && cj > 0 && (grid.get(ci-1, cj-1) & TERRITORY_DISCR_MASK) == tileDiscr)
-					{
-						--ci;
-						--cj;
-						cdir = TILE_TOP;
-						curvature += CURVE_CW;
-					}
-					else if (cj > 0 && (grid.get(ci, cj-1) & TERRITORY_DISCR_MASK) == tileDiscr)
-						--cj;
-					else
-					{
-						cdir = TILE_BOTTOM;
-						curvature += CURVE_CCW;
-					}
-					break;
-				}
-
-				// Stop when we've reached the starting point again
-				if (ci == i && cj == j && cdir == dir)
-					break;
-			}
+	u32 nextID = 0;
+	TraceBoundaries(grid, boundaries, nextID);
+
+	return boundaries;
+}
+
+std::vector<STerritoryBoundary> CTerritoryBoundaryCalculator::UpdateBoundaries(const Grid<u8>* territory,
+	const Grid<u8>* previousTerritory, const std::vector<STerritoryBoundary>& previous, u32& nextID)
+{
+	std::vector<STerritoryBoundary> boundaries;
+
+	// Copy the territories grid so we can mess with it
+	Grid<u8> grid(*territory);
 
-			ENSURE(curvature != 0 && abs(curvature) % 4 == 0);
+	if (!previousTerritory || previousTerritory->m_W != grid.m_W || previousTerritory->m_H != grid.m_H)
+	{
+		TraceBoundaries(grid, boundaries, nextID);
+		return boundaries;
+	}
+
+	// The trace only looks at the tiles next to the ones it passes through, so a boundary
+	// can only have changed if one of those has a different owner or connected flag.
+	// Mark every tile next to a changed one
+	Grid<u8> changed(grid.m_W, grid.m_H);
+	for (u16 j = 0; j < grid.m_H; ++j)
+	{
+		for (u16 i = 0; i < grid.m_W; ++i)
+		{
+			if (!((grid.get(i, j) ^ previousTerritory->get(i, j)) & TERRITORY_DISCR_MASK))
+				continue;
+
+			for (int dj = std::max(j-1, 0); dj <= std::min(j+1, grid.m_H-1); ++dj)
+				for (int di = std::max(i-1, 0); di <= std::min(i+1, grid.m_W-1); ++di)
+					changed.set(di, dj, 1);
 		}
 	}
 
+	// Keep the unchanged boundaries, and mark their tiles as processed so they won't be traced again
+	// (each tile's bottom edge belongs to exactly one boundary, so this doesn't affect any others)
+	std::vector<STerritoryBoundary> kept;
+	for (size_t n = 0; n < previous.size(); ++n)
+	{
+		const std::vector<STerritoryBoundary::TileEdge>& edges = previous[n].edges;
+
+		bool unchanged = !edges.empty();
+		for (size_t k = 0; k < edges.size() && unchanged; ++k)
+			if (changed.get(edges[k].i, edges[k].j))
+				unchanged = false;
+
+		if (!unchanged)
+			continue;
+
+		kept.push_back(previous[n]);
+		for (size_t k = 0; k < edges.size(); ++k)
+			if (edges[k].edge == TILE_BOTTOM)
+				grid.set(edges[k].i, edges[k].j, grid.get(edges[k].i, edges[k].j) | ICmpTerritoryManager::TERRITORY_PROCESSED_MASK);
+	}
+
+	std::vector<STerritoryBoundary> traced;
+	TraceBoundaries(grid, traced, nextID);
+
+	// Return them in the same order as ComputeBoundaries would
+	// (both lists are already in that order)
+	boundaries.resize(kept.size() + traced.size());
+	std::merge(kept.begin(), kept.end(), traced.begin(), traced.end(), boundaries.begin(), BoundaryStartsBefore);
+
 	return boundaries;
 }
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -43,6 +43,19 @@ struct STerritoryBoundary
 	/// Note: if you need a way to explicitly find out which winding order these are in, you can have
 	/// CTerritoryBoundCalculator::ComputeBoundaries set it during computation -- see its implementation for details.
 	std::vector<CVector2D> points;
+
+	/// Identifies the boundary; CTerritoryBoundaryCalculator::UpdateBoundaries keeps the same ID
+	/// for boundaries that haven't changed.
+	u32 id;
+
+	struct TileEdge
+	{
+		u16 i, j;
+		u8 edge; ///< 0 = bottom, 1 = right, 2 = top, 3 = left
+	};
+
+	/// The tile and tile edge that each point was computed from.
+	std::vector<TileEdge> edges;
 };
 
 /**
@@ -61,6 +74,16 @@ public:
 	 * inwards/outwards appropriately).
 	 */
 	static std::vector<STerritoryBoundary> ComputeBoundaries(const Grid<u8>* territories);
+
+	/**
+	 * Returns the same as ComputeBoundaries(territories), except that boundaries from @p previous
+	 * (the result of computing the boundaries of @p previousTerritories) that are not affected by the
+	 * differences between the two maps are copied instead of being traced again, and keep their IDs.
+	 * New boundaries are given IDs starting from @p nextID, which is incremented.
+	 * @p previousTerritories may be NULL, in which case everything is recomputed.
+	 */
+	static std::vector<STerritoryBoundary> UpdateBoundaries(const Grid<u8>* territories,
+		const Grid<u8>* previousTerritories, const std::vector<STerritoryBoundary>& previous, u32& nextID);
 };
 
 #endif // INCLUDED_TERRITORYBOUNDARY
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -32,8 +32,14 @@
 
 // TODO: There's a lot of duplication with CLOSTexture - might be nice to refactor a bit
 
+static const int ALPHA_MAX = 0xC0;
+static const int ALPHA_FALLOFF = 0x20;
+
+// How many texels a boundary's alpha spreads out over in the blur
+static const ssize_t BLUR_RADIUS = ALPHA_MAX / ALPHA_FALLOFF;
+
 CTerritoryTexture::CTerritoryTexture(CSimulation2& simulation) :
-	m_Simulation(simulation), m_DirtyID(0), m_Texture(0), m_MapSize(0), m_TextureSize(0)
+	m_Simulation(simulation), m_DirtyID(0), m_TextureDirtyID(0), m_Texture(0), m_MapSize(0), m_TextureSize(0)
 {
 }
 
@@ -96,6 +102,9 @@ void CTerritoryTexture::ConstructTexture(int unit)
 
 	m_TextureSize = (GLsizei)round_up_to_pow2((size_t)m_MapSize);
 
+	// The new texture has to be filled in completely
+	m_TextureDirtyID = 0;
+
 	glGenTextures(1, &m_Texture);
 	g_Renderer.BindTexture(unit, m_Texture);
 
@@ -145,35 +154,65 @@ void CTerritoryTexture::RecomputeTexture(int unit)
 	if (m_Texture)
 	{
 		CmpPtr<ICmpTerrain> cmpTerrain(m_Simulation, SYSTEM_ENTITY);
-		if (cmpTerrain && m_MapSize != (ssize_t)cmpTerrain->GetVerticesPerSide())
+		if (cmpTerrain && m_MapSize != (ssize_t)cmpTerrain->GetVerticesPerSide() - 1)
 			DeleteTexture();
 	}
 
 	if (!m_Texture)
 		ConstructTexture(unit);
 
-	PROFILE("recompute territory texture");
+	if (!m_Texture)
+		return;
 
-	std::vector<u8> bitmap;
-	bitmap.resize(m_MapSize * m_MapSize * 4);
+	PROFILE("recompute territory texture");
 
 	CmpPtr<ICmpTerritoryManager> cmpTerritoryManager(m_Simulation, SYSTEM_ENTITY);
 	if (!cmpTerritoryManager)
 		return;
 
-	const Grid<u8> territories = cmpTerritoryManager->GetTerritoryGrid();
+	// Only regenerate the part of the texture that might be affected by the
+	// territory changes since the last time
+	u16 i0, j0, i1, j1;
+	bool changed = cmpTerritoryManager->GetChangedTiles(m_TextureDirtyID, i0, j0, i1, j1);
+	m_TextureDirtyID = m_DirtyID;
+	if (!changed)
+		return;
+
+	const Grid<u8>& territories = cmpTerritoryManager->GetTerritoryGrid();
 
-	GenerateBitmap(territories, &bitmap[0], m_MapSize, m_MapSize);
+	// A changed tile can alter the boundary flags of its neighbours, which
+	// are then blurred over BLUR_RADIUS texels
+	ssize_t x0 = std::max((ssize_t)i0 - BLUR_RADIUS - 1, (ssize_t)0);
+	ssize_t z0 = std::max((ssize_t)j0 - BLUR_RADIUS - 1, (ssize_t)0);
+	ssize_t x1 = std::min((ssize_t)i1 + BLUR_RADIUS + 1, m_MapSize - 1);
+	ssize_t z1 = std::min((ssize_t)j1 + BLUR_RADIUS + 1, m_MapSize - 1);
+
+	// The blur needs another BLUR_RADIUS texels around those to give
+	// the same result as regenerating the whole texture
+	ssize_t bx0 = std::max(x0 - BLUR_RADIUS, (ssize_t)0);
+	ssize_t bz0 = std::max(z0 - BLUR_RADIUS, (ssize_t)0);
+	ssize_t bw = std::min(x1 + BLUR_RADIUS, m_MapSize - 1) - bx0 + 1;
+	ssize_t bh = std::min(z1 + BLUR_RADIUS, m_MapSize - 1) - bz0 + 1;
+
+	std::vector<u8> bitmap;
+	bitmap.resize(bw * bh * 4);
+	GenerateBitmap(territories, &bitmap[0], bx0, bz0, bw, bh);
+
+	// Pack the rows that are being uploaded, if they're not the whole bitmap
+	ssize_t w = x1 - x0 + 1;
+	ssize_t h = z1 - z0 + 1;
+	if (w != bw || h != bh)
+	{
+		for (ssize_t j = 0; j < h; ++j)
+			memmove(&bitmap[j*w*4], &bitmap[((z0 - bz0 + j)*bw + (x0 - bx0))*4], w*4);
+	}
 
 	g_Renderer.BindTexture(unit, m_Texture);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_MapSize, m_MapSize, GL_BGRA_EXT, GL_UNSIGNED_BYTE, &bitmap[0]);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x0, z0, w, h, GL_BGRA_EXT, GL_UNSIGNED_BYTE, &bitmap[0]);
 }
 
-void CTerritoryTexture::GenerateBitmap(const Grid<u8>& territories, u8* bitmap, ssize_t w, ssize_t h)
+void CTerritoryTexture::GenerateBitmap(const Grid<u8>& territories, u8* bitmap, ssize_t x0, ssize_t z0, ssize_t w, ssize_t h)
 {
-	int alphaMax = 0xC0;
-	int alphaFalloff = 0x20;
-
 	CmpPtr<ICmpPlayerManager> cmpPlayerManager(m_Simulation, SYSTEM_ENTITY);
 
 	std::vector<CColor> colors;
@@ -187,10 +226,13 @@ void CTerritoryTexture::GenerateBitmap(const Grid<u8>& territories, u8* bitmap,
 		colors.push_back(color);
 	}
 
+	ssize_t mapW = territories.m_W;
+	ssize_t mapH = territories.m_H;
+
 	u8* p = bitmap;
-	for (ssize_t j = 0; j < h; ++j)
+	for (ssize_t j = z0; j < z0 + h; ++j)
 	{
-		for (ssize_t i = 0; i < w; ++i)
+		for (ssize_t i = x0; i < x0 + w; ++i)
 		{
 			u8 val = territories.get(i, j) & ICmpTerritoryManager::TERRITORY_PLAYER_MASK;
 
@@ -205,13 +247,14 @@ void CTerritoryTexture::GenerateBitmap(const Grid<u8>& territories, u8* bitmap,
 			*p++ = (int)(color.g*255.f);
 			*p++ = (int)(color.r*255.f);
 
+			// (Check the neighbours on the whole map, not just in the bitmap)
 			if ((i > 0 && (territories.get(i-1, j) & ICmpTerritoryManager::TERRITORY_PLAYER_MASK) != val)
-			 || (i < w-1 && (territories.get(i+1, j) & ICmpTerritoryManager::TERRITORY_PLAYER_MASK) != val)
+			 || (i < mapW-1 && (territories.get(i+1, j) & ICmpTerritoryManager::TERRITORY_PLAYER_MASK) != val)
 			 || (j > 0 && (territories.get(i, j-1) & ICmpTerritoryManager::TERRITORY_PLAYER_MASK) != val)
-			 || (j < h-1 && (territories.get(i, j+1) & ICmpTerritoryManager::TERRITORY_PLAYER_MASK) != val)
+			 || (j < mapH-1 && (territories.get(i, j+1) & ICmpTerritoryManager::TERRITORY_PLAYER_MASK) != val)
 			)
 			{
-				*p++ = alphaMax;
+				*p++ = ALPHA_MAX;
 			}
 			else
 			{
@@ -229,14 +272,14 @@ void CTerritoryTexture::GenerateBitmap(const Grid<u8>& territories, u8* bitmap,
 		a = 0;
 		for (ssize_t i = 0; i < w; ++i)
 		{
-			a = std::max(a - alphaFalloff, (int)bitmap[(j*w+i)*4 + 3]);
+			a = std::max(a - ALPHA_FALLOFF, (int)bitmap[(j*w+i)*4 + 3]);
 			bitmap[(j*w+i)*4 + 3] = a;
 		}
 
 		a = 0;
 		for (ssize_t i = w-1; i >= 0; --i)
 		{
-			a = std::max(a - alphaFalloff, (int)bitmap[(j*w+i)*4 + 3]);
+			a = std::max(a - ALPHA_FALLOFF, (int)bitmap[(j*w+i)*4 + 3]);
 			bitmap[(j*w+i)*4 + 3] = a;
 		}
 	}
@@ -246,16 +289,16 @@ void CTerritoryTexture::GenerateBitmap(const Grid<u8>& territories, u8* bitmap,
 		int a;
 
 		a = 0;
-		for (ssize_t j = 0; j < w; ++j)
+		for (ssize_t j = 0; j < h; ++j)
 		{
-			a = std::max(a - alphaFalloff, (int)bitmap[(j*w+i)*4 + 3]);
+			a = std::max(a - ALPHA_FALLOFF, (int)bitmap[(j*w+i)*4 + 3]);
 			bitmap[(j*w+i)*4 + 3] = a;
 		}
 
 		a = 0;
-		for (ssize_t j = w-1; j >= 0; --j)
+		for (ssize_t j = h-1; j >= 0; --j)
 		{
-			a = std::max(a - alphaFalloff, (int)bitmap[(j*w+i)*4 + 3]);
+			a = std::max(a - ALPHA_FALLOFF, (int)bitmap[(j*w+i)*4 + 3]);
 			bitmap[(j*w+i)*4 + 3] = a;
 		}
 	}
@@ -265,7 +308,7 @@ void CTerritoryTexture::GenerateBitmap(const Grid<u8>& territories, u8* bitmap,
 	{
 		for (ssize_t i = 0; i < w; ++i)
 		{
-			if (bitmap[(j*w+i)*4 + 3] == alphaMax)
+			if (bitmap[(j*w+i)*4 + 3] == ALPHA_MAX)
 				bitmap[(j*w+i)*4 + 3] = 0;
 		}
 	}
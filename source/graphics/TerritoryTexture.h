@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -73,12 +73,21 @@ private:
 	void ConstructTexture(int unit);
 	void RecomputeTexture(int unit);
 
-	void GenerateBitmap(const Grid<u8>& territories, u8* bitmap, ssize_t w, ssize_t h);
+	/**
+	 * Generates the w*h texels of the texture starting at tile (x0, z0).
+	 * Texels less than BLUR_RADIUS from the edges of that rectangle are only
+	 * correct if those edges are also edges of the map.
+	 */
+	void GenerateBitmap(const Grid<u8>& territories, u8* bitmap, ssize_t x0, ssize_t z0, ssize_t w, ssize_t h);
 
 	CSimulation2& m_Simulation;
 
 	size_t m_DirtyID;
 
+	// The territory manager's dirtyID when the texture was last regenerated,
+	// to find the tiles that changed since then
+	size_t m_TextureDirtyID;
+
 	GLuint m_Texture;
 
 	ssize_t m_MapSize; // tiles per side
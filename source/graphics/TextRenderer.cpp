@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -23,8 +23,113 @@
 #include "lib/res/graphics/unifont.h"
 #include "ps/Font.h"
 
+#include <boost/unordered_map.hpp>
+
 extern int g_xres, g_yres;
 
+struct t2f_v2i
+{
+	t2f_v2i() : u(0), v(0), x(0), y(0) { }
+	float u, v;
+	i16 x, y;
+};
+
+struct t2f_v2f
+{
+	float u, v;
+	float x, y;
+};
+
+/**
+ * Cache of the glyph quads for each (font name, string) that's been rendered,
+ * so that text which is redrawn every frame (which is most of the GUI) doesn't
+ * need to look up every glyph again.
+ * To keep it bounded, it's simply emptied when it gets too big.
+ */
+typedef boost::unordered_map<std::pair<std::wstring, std::wstring>, std::vector<t2f_v2i> > GlyphRunCache;
+static GlyphRunCache g_GlyphRunCache;
+static const size_t MAX_CACHED_GLYPH_RUNS = 4096;
+
+static const std::vector<t2f_v2i>& GetGlyphRun(const CStrW& fontName, const shared_ptr<CFont>& font, const std::wstring& text)
+{
+	std::pair<std::wstring, std::wstring> key(fontName, text);
+	GlyphRunCache::iterator cached = g_GlyphRunCache.find(key);
+	if (cached != g_GlyphRunCache.end())
+		return cached->second;
+
+	if (g_GlyphRunCache.size() >= MAX_CACHED_GLYPH_RUNS)
+		g_GlyphRunCache.clear();
+
+	std::vector<t2f_v2i>& vertexes = g_GlyphRunCache[key];
+	vertexes.reserve(text.size()*4);
+
+	const std::map<u16, UnifontGlyphData>& glyphs = font->GetGlyphs();
+
+	i16 x = 0;
+	for (size_t i = 0; i < text.size(); ++i)
+	{
+		std::map<u16, UnifontGlyphData>::const_iterator it = glyphs.find(text[i]);
+
+		if (it == glyphs.end())
+			it = glyphs.find(0xFFFD); // Use the missing glyph symbol
+
+		if (it == glyphs.end()) // Missing the missing glyph symbol - give up
+			continue;
+
+		const UnifontGlyphData& g = it->second;
+
+		t2f_v2i vertex;
+
+		vertex.u = g.u1;
+		vertex.v = g.v0;
+		vertex.x = g.x1 + x;
+		vertex.y = g.y0;
+		vertexes.push_back(vertex);
+
+		vertex.u = g.u0;
+		vertex.v = g.v0;
+		vertex.x = g.x0 + x;
+		vertex.y = g.y0;
+		vertexes.push_back(vertex);
+
+		vertex.u = g.u0;
+		vertex.v = g.v1;
+		vertex.x = g.x0 + x;
+		vertex.y = g.y1;
+		vertexes.push_back(vertex);
+
+		vertex.u = g.u1;
+		vertex.v = g.v1;
+		vertex.x = g.x1 + x;
+		vertex.y = g.y1;
+		vertexes.push_back(vertex);
+
+		x += g.xadvance;
+	}
+
+	return vertexes;
+}
+
+/**
+ * If @p transform is equal to the transform whose inverse is @p inverse, followed by
+ * a translation in the XY plane, returns true and sets @p dx, @p dy to that translation.
+ */
+static bool GetTranslationOffset(const CMatrix3D& inverse, const CMatrix3D& transform, float& dx, float& dy)
+{
+	CMatrix3D d = inverse * transform;
+
+	const float epsilon = 0.001f;
+	if (fabsf(d._11 - 1.f) > epsilon || fabsf(d._12) > epsilon || fabsf(d._13) > epsilon || fabsf(d._34) > epsilon ||
+		fabsf(d._21) > epsilon || fabsf(d._22 - 1.f) > epsilon || fabsf(d._23) > epsilon ||
+		fabsf(d._31) > epsilon || fabsf(d._32) > epsilon || fabsf(d._33 - 1.f) > epsilon ||
+		fabsf(d._41) > epsilon || fabsf(d._42) > epsilon || fabsf(d._43) > epsilon || fabsf(d._44 - 1.f) > epsilon)
+		return false;
+
+	dx = d._14;
+	dy = d._24;
+	return true;
+}
+
 CTextRenderer::CTextRenderer(const CShaderProgramPtr& shader) :
 	m_Shader(shader)
 {
@@ -77,6 +182,7 @@ void CTextRenderer::Font(const CStrW& font)
 		m_Fonts[font] = shared_ptr<CFont>(new CFont(font));
 
 	m_Font = m_Fonts[font];
+	m_FontName = font;
 }
 
 void CTextRenderer::PrintfAdvance(const wchar_t* fmt, ...)
@@ -124,104 +230,114 @@ void CTextRenderer::Put(float x, float y, const wchar_t* buf)
 	if (buf[0] == 0)
 		return; // empty string; don't bother storing
 
-	CMatrix3D translate;
-	translate.SetTranslation(x, y, 0.0f);
-
 	SBatch batch;
-	batch.transform = m_Transform * translate;
+	batch.transform = m_Transform;
+	batch.x = x;
+	batch.y = y;
 	batch.color = m_Color;
 	batch.font = m_Font;
+	batch.fontName = m_FontName;
 	batch.text = buf;
 	m_Batches.push_back(batch);
 }
 
-struct t2f_v2i
-{
-	t2f_v2i() : u(0), v(0), x(0), y(0) { }
-	float u, v;
-	i16 x, y;
-};
-
 void CTextRenderer::Render()
 {
 	std::vector<u16> indexes;
-	std::vector<t2f_v2i> vertexes;
+	std::vector<t2f_v2f> vertexes;
 
-	for (size_t i = 0; i < m_Batches.size(); ++i)
+	size_t i = 0;
+	while (i < m_Batches.size())
 	{
-		SBatch& batch = m_Batches[i];
+		const SBatch& first = m_Batches[i];
+		CMatrix3D inverse = first.transform.GetInverse();
 
-		if (batch.text.empty()) // avoid zero-length arrays
-			continue;
+		// Collect the vertexes of this batch and any following ones that can be drawn
+		// with the same state, offsetting them into the first batch's coordinates
+		vertexes.clear();
+		size_t end = i;
+		for (; end < m_Batches.size(); ++end)
+		{
+			const SBatch& batch = m_Batches[end];
+			if (batch.font != first.font || batch.color != first.color)
+				break;
+
+			float dx = 0.f, dy = 0.f;
+			if (end != i && !GetTranslationOffset(inverse, batch.transform, dx, dy))
+				break;
+
+			const std::vector<t2f_v2i>& run = GetGlyphRun(batch.fontName, batch.font, batch.text);
+
+			// (Indexes are 16-bit, so very long strings get truncated)
+			size_t count = run.size();
+			if (vertexes.size() + count > 65536)
+			{
+				if (end != i)
+					break;
+				count = 65536;
+			}
+
+			for (size_t j = 0; j < count; ++j)
+			{
+				t2f_v2f vertex;
+				vertex.u = run[j].u;
+				vertex.v = run[j].v;
+				vertex.x = run[j].x + batch.x + dx;
+				vertex.y = run[j].y + batch.y + dy;
+				vertexes.push_back(vertex);
+			}
+		}
 
-		const std::map<u16, UnifontGlyphData>& glyphs = batch.font->GetGlyphs();
+		i = end;
+
+		if (vertexes.empty()) // avoid zero-length arrays
+			continue;
 
-		m_Shader->BindTexture("tex", batch.font->GetTexture());
+		m_Shader->BindTexture("tex", first.font->GetTexture());
 
-		m_Shader->Uniform("transform", batch.transform);
+		m_Shader->Uniform("transform", first.transform);
 
 		// ALPHA-only textures will have .rgb sampled as 0, so we need to
 		// replace it with white (but not affect RGBA textures)
-		if (batch.font->HasRGB())
+		if (first.font->HasRGB())
 			m_Shader->Uniform("colorAdd", CColor(0.0f, 0.0f, 0.0f, 0.0f));
 		else
 			m_Shader->Uniform("colorAdd", CColor(1.0f, 1.0f, 1.0f, 0.0f));
 
-		m_Shader->Uniform("colorMul", batch.color);
+		m_Shader->Uniform("colorMul", first.color);
 
-		vertexes.clear();
-		vertexes.resize(batch.text.size()*4);
-
-		indexes.clear();
-		indexes.resize(batch.text.size()*6);
-
-		i16 x = 0;
-		for (size_t i = 0; i < batch.text.size(); ++i)
+		// Every glyph is a quad, so the indexes are always the same pattern
+		size_t numQuads = vertexes.size() / 4;
+		for (size_t q = indexes.size() / 6; q < numQuads; ++q)
 		{
-			std::map<u16, UnifontGlyphData>::const_iterator it = glyphs.find(batch.text[i]);
-
-			if (it == glyphs.end())
-				it = glyphs.find(0xFFFD); // Use the missing glyph symbol
-
-			if (it == glyphs.end()) // Missing the missing glyph symbol - give up
-				continue;
-
-			const UnifontGlyphData& g = it->second;
-
-			vertexes[i*4].u = g.u1;
-			vertexes[i*4].v = g.v0;
-			vertexes[i*4].x = g.x1 + x;
-			vertexes[i*4].y = g.y0;
-
-			vertexes[i*4+1].u = g.u0;
-			vertexes[i*4+1].v = g.v0;
-			vertexes[i*4+1].x = g.x0 + x;
-			vertexes[i*4+1].y = g.y0;
-
-			vertexes[i*4+2].u = g.u0;
-			vertexes[i*4+2].v = g.v1;
-			vertexes[i*4+2].x = g.x0 + x;
-			vertexes[i*4+2].y = g.y1;
-
-			vertexes[i*4+3].u = g.u1;
-			vertexes[i*4+3].v = g.v1;
-			vertexes[i*4+3].x = g.x1 + x;
-			vertexes[i*4+3].y = g.y1;
+			indexes.push_back(q*4+0);
+			indexes.push_back(q*4+1);
+			indexes.push_back(q*4+2);
+			indexes.push_back(q*4+2);
+			indexes.push_back(q*4+3);
+			indexes.push_back(q*4+0);
+		}
 
-			indexes[i*6+0] = i*4+0;
-			indexes[i*6+1] = i*4+1;
-			indexes[i*6+2] = i*4+2;
-			indexes[i*6+3] = i*4+2;
-			indexes[i*6+4] = i*4+3;
-			indexes[i*6+5] = i*4+0;
+		m_Shader->VertexPointer(2, GL_FLOAT, sizeof(t2f_v2f), &vertexes[0].x);
+		m_Shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, sizeof(t2f_v2f), &vertexes[0].u);
 
-			x += g.xadvance;
+		// Distance field fonts are scaled with linear filtering, and the edges
+		// of the glyphs are where the field crosses 0.5
+#if !CONFIG2_GLES
+		bool distanceField = first.font->IsDistanceField();
+		if (distanceField)
+		{
+			glEnable(GL_ALPHA_TEST);
+			glAlphaFunc(GL_GEQUAL, 0.5f * first.color.a);
 		}
+#endif
 
-		m_Shader->VertexPointer(2, GL_SHORT, sizeof(t2f_v2i), &vertexes[0].x);
-		m_Shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, sizeof(t2f_v2i), &vertexes[0].u);
+		glDrawElements(GL_TRIANGLES, (GLsizei)(numQuads*6), GL_UNSIGNED_SHORT, &indexes[0]);
 
-		glDrawElements(GL_TRIANGLES, indexes.size(), GL_UNSIGNED_SHORT, &indexes[0]);
+#if !CONFIG2_GLES
+		if (distanceField)
+			glDisable(GL_ALPHA_TEST);
+#endif
 	}
 
 	m_Batches.clear();
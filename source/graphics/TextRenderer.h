@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -82,6 +82,8 @@ public:
 
 	/**
 	 * Render all of the previously printed text calls.
+	 * Consecutive calls with the same font and color, whose transforms differ
+	 * only by a translation in the text plane, are drawn together.
 	 */
 	void Render();
 
@@ -89,8 +91,10 @@ private:
 	struct SBatch
 	{
 		CMatrix3D transform;
+		float x, y;
 		CColor color;
 		shared_ptr<CFont> font;
+		CStrW fontName;
 		std::wstring text;
 	};
 
@@ -100,6 +104,7 @@ private:
 
 	CColor m_Color;
 	shared_ptr<CFont> m_Font;
+	CStrW m_FontName;
 
 	std::map<CStrW, shared_ptr<CFont> > m_Fonts;
 
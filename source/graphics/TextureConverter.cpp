@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -21,8 +21,10 @@
 
 #include "lib/regex.h"
 #include "lib/timer.h"
+#include "lib/byte_order.h"
 #include "lib/allocators/shared_ptr.h"
 #include "lib/tex/tex.h"
+#include "lib/tex/tex_etc.h"
 #include "maths/MD5.h"
 #include "ps/CLogger.h"
 #include "ps/CStr.h"
@@ -54,6 +56,91 @@ struct BufferOutputHandler : public nvtt::OutputHandler
 	}
 };
 
+struct CompressETCInfo
+{
+	size_t etc;
+	const u8* end;
+	std::vector<u8>* output;
+	bool ok;
+};
+
+static void CompressETCLevel(size_t UNUSED(level), size_t level_w, size_t level_h, const u8* RESTRICT level_data, size_t level_data_size, void* RESTRICT cbData)
+{
+	CompressETCInfo* info = static_cast<CompressETCInfo*>(cbData);
+	if (level_data + level_data_size > info->end)
+	{
+		info->ok = false;
+		return;
+	}
+
+	const size_t blockSize = etc_block_size(info->etc);
+	u8 rgba[16*4];
+	u8 block[16];
+	for (size_t by = 0; by < level_h; by += 4)
+	{
+		for (size_t bx = 0; bx < level_w; bx += 4)
+		{
+			// (Levels smaller than a block are padded by repeating their edges)
+			for (size_t y = 0; y < 4; ++y)
+				for (size_t x = 0; x < 4; ++x)
+					memcpy(&rgba[(y*4 + x)*4], &level_data[(std::min(by+y, level_h-1)*level_w + std::min(bx+x, level_w-1))*4], 4);
+
+			etc_compress_block(info->etc, rgba, block);
+			info->output->insert(info->output->end(), block, block + blockSize);
+		}
+	}
+}
+
+/**
+ * Compress NVTT's uncompressed RGBA DDS output (including its mipmaps) to ETC,
+ * and update the DDS header to match. (The header fields are as described in
+ * tex_dds.cpp, which is what will load the result.)
+ * WARNING: Used in the worker thread - must be thread-safe.
+ */
+static bool CompressETC(std::vector<u8>& buffer, size_t etc)
+{
+	// Byte offsets of the fields we need, including the "DDS " magic number
+	const size_t OFS_FLAGS = 8;
+	const size_t OFS_HEIGHT = 12;
+	const size_t OFS_WIDTH = 16;
+	const size_t OFS_PITCH_OR_LINEAR_SIZE = 20;
+	const size_t OFS_MIPMAP_COUNT = 28;
+	const size_t OFS_PF_FLAGS = 80;
+	const size_t OFS_PF_FOURCC = 84;
+	const size_t OFS_PF_RGB_BIT_COUNT = 88; // followed by the four masks
+	const size_t HEADER_SIZE = 128;
+
+	const u32 DDSD_PITCH = 0x00000008;
+	const u32 DDSD_LINEARSIZE = 0x00080000;
+	const u32 DDPF_ALPHAPIXELS = 0x00000001;
+	const u32 DDPF_FOURCC = 0x00000004;
+
+	if (buffer.size() < HEADER_SIZE)
+		return false;
+
+	const size_t w = read_le32(&buffer[OFS_WIDTH]);
+	const size_t h = read_le32(&buffer[OFS_HEIGHT]);
+	const bool mipmaps = read_le32(&buffer[OFS_MIPMAP_COUNT]) > 1;
+
+	std::vector<u8> output(buffer.begin(), buffer.begin() + HEADER_SIZE);
+	CompressETCInfo info = { etc, &buffer[0] + buffer.size(), &output, true };
+	tex_util_foreach_mipmap(w, h, 32, &buffer[HEADER_SIZE], mipmaps ? 0 : TEX_BASE_LEVEL_ONLY, 1, CompressETCLevel, &info);
+	if (!info.ok)
+		return false;
+
+	u8* header = &output[0];
+	write_le32(header + OFS_FLAGS, (read_le32(header + OFS_FLAGS) & ~DDSD_PITCH) | DDSD_LINEARSIZE);
+	write_le32(header + OFS_PITCH_OR_LINEAR_SIZE, (u32)(DivideRoundUp(w, (size_t)4) * DivideRoundUp(h, (size_t)4) * etc_block_size(etc)));
+	write_le32(header + OFS_PF_FLAGS, DDPF_FOURCC | (etc == ETC2_EAC ? DDPF_ALPHAPIXELS : 0));
+	// (Stored in file order, like tex_dds.cpp compares them)
+	const u32 fourcc = (etc == ETC2_EAC) ? FOURCC('E','T','C','2') : FOURCC('E','T','C','1');
+	memcpy(header + OFS_PF_FOURCC, &fourcc, sizeof(fourcc));
+	memset(header + OFS_PF_RGB_BIT_COUNT, 0, 5*sizeof(u32));
+
+	buffer.swap(output);
+	return true;
+}
+
 /**
  * Request for worker thread to process.
  */
@@ -64,7 +151,8 @@ struct CTextureConverter::ConversionRequest
 	nvtt::InputOptions inputOptions;
 	nvtt::CompressionOptions compressionOptions;
 	nvtt::OutputOptions outputOptions;
-	bool isDXT1a; // see comment in RunThread
+	bool isDXT1a; // see comment in RunTask
+	size_t etc; // ETC1 or ETC2_EAC if NVTT's RGBA output should be compressed to that, else 0
 };
 
 /**
@@ -148,6 +236,8 @@ CTextureConverter::SettingsFile* CTextureConverter::LoadSettings(const VfsPath&
 						p.settings.format = FMT_DXT5;
 					else if (v == "rgba")
 						p.settings.format = FMT_RGBA;
+					else if (v == "etc2")
+						p.settings.format = FMT_ETC2;
 					else
 						LOGERROR(L"Invalid attribute value <file format='%hs'>", v.c_str());
 				}
@@ -281,43 +371,27 @@ CTextureConverter::CTextureConverter(PIVFS vfs, bool highQuality) :
 	ENSURE(nvtt::version() >= NVTT_VERSION);
 #endif
 
-	// Set up the worker thread:
-
-	int ret;
-
-	// Use SDL semaphores since OS X doesn't implement sem_init
-	m_WorkerSem = SDL_CreateSemaphore(0);
-	ENSURE(m_WorkerSem);
-
-	ret = pthread_mutex_init(&m_WorkerMutex, NULL);
+	// The conversions themselves run as tasks on the shared thread pool
+	int ret = pthread_mutex_init(&m_WorkerMutex, NULL);
 	ENSURE(ret == 0);
-
-	ret = pthread_create(&m_WorkerThread, NULL, &RunThread, this);
-	ENSURE(ret == 0);
-
-	// Maybe we should share some centralised pool of worker threads?
-	// For now we'll just stick with a single thread for this specific use.
 }
 
 CTextureConverter::~CTextureConverter()
 {
-	// Tell the thread to shut down
+	// Tell the tasks to skip any conversions that haven't started yet
 	pthread_mutex_lock(&m_WorkerMutex);
 	m_Shutdown = true;
 	pthread_mutex_unlock(&m_WorkerMutex);
 
-	// Wake it up so it sees the notification
-	SDL_SemPost(m_WorkerSem);
-
-	// Wait for it to shut down cleanly
-	pthread_join(m_WorkerThread, NULL);
+	// Wait for the ones in progress to finish, since they refer to us
+	if (g_ThreadPool)
+		g_ThreadPool->Wait(m_Tasks);
 
 	// Clean up resources
-	SDL_DestroySemaphore(m_WorkerSem);
 	pthread_mutex_destroy(&m_WorkerMutex);
 }
 
-bool CTextureConverter::ConvertTexture(const CTexturePtr& texture, const VfsPath& src, const VfsPath& dest, const Settings& settings)
+bool CTextureConverter::ConvertTexture(const CTexturePtr& texture, const VfsPath& src, const VfsPath& dest, const Settings& settings, bool highPriority)
 {
 	shared_ptr<u8> file;
 	size_t fileSize;
@@ -385,12 +459,18 @@ bool CTextureConverter::ConvertTexture(const CTexturePtr& texture, const VfsPath
 		request->inputOptions.setAlphaMode(nvtt::AlphaMode_None);
 
 	request->isDXT1a = false;
+	request->etc = 0;
 
-	if (settings.format == FMT_RGBA)
+	if (settings.format == FMT_RGBA || settings.format == FMT_ETC2)
 	{
 		request->compressionOptions.setFormat(nvtt::Format_RGBA);
 		// Change the default component order (see tex_dds.cpp decode_pf)
 		request->compressionOptions.setPixelFormat(32, 0xFF, 0xFF00, 0xFF0000, 0xFF000000u);
+
+		// NVTT can't compress to ETC, so we'll do that ourselves after it has
+		// generated the mipmaps
+		if (settings.format == FMT_ETC2)
+			request->etc = hasAlpha ? ETC2_EAC : ETC1;
 	}
 	else if (!hasAlpha)
 	{
@@ -437,11 +517,19 @@ bool CTextureConverter::ConvertTexture(const CTexturePtr& texture, const VfsPath
 	tex_free(&tex);
 
 	pthread_mutex_lock(&m_WorkerMutex);
-	m_RequestQueue.push_back(request);
+	if (highPriority)
+		m_HighPriorityQueue.push_back(request);
+	else
+		m_RequestQueue.push_back(request);
 	pthread_mutex_unlock(&m_WorkerMutex);
 
-	// Wake up the worker thread
-	SDL_SemPost(m_WorkerSem);
+	// Do the conversion on a worker thread if possible. If there's no thread pool
+	// (e.g. when building archives or running tests) just do it now, so Poll will
+	// return the result immediately.
+	if (g_ThreadPool)
+		g_ThreadPool->Submit(&RunTask, this, &m_Tasks);
+	else
+		RunTask(this);
 
 	return true;
 
@@ -451,6 +539,26 @@ bool CTextureConverter::ConvertTexture(const CTexturePtr& texture, const VfsPath
 #endif
 }
 
+bool CTextureConverter::Prioritise(const CTexturePtr& texture)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&m_WorkerMutex);
+	for (std::deque<shared_ptr<ConversionRequest> >::iterator it = m_RequestQueue.begin(); it != m_RequestQueue.end(); ++it)
+	{
+		if ((*it)->texture == texture)
+		{
+			m_HighPriorityQueue.push_back(*it);
+			m_RequestQueue.erase(it);
+			found = true;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&m_WorkerMutex);
+
+	return found;
+}
+
 bool CTextureConverter::Poll(CTexturePtr& texture, VfsPath& dest, bool& ok)
 {
 #if CONFIG2_NVTT
@@ -471,6 +579,9 @@ bool CTextureConverter::Poll(CTexturePtr& texture, VfsPath& dest, bool& ok)
 		return false;
 	}
 
+	texture = result->texture;
+	dest = result->dest;
+
 	if (!result->ret)
 	{
 		// conversion had failed
@@ -491,8 +602,6 @@ bool CTextureConverter::Poll(CTexturePtr& texture, VfsPath& dest, bool& ok)
 	}
 
 	// Succeeded in converting texture
-	texture = result->texture;
-	dest = result->dest;
 	ok = true;
 	return true;
 
@@ -501,75 +610,73 @@ bool CTextureConverter::Poll(CTexturePtr& texture, VfsPath& dest, bool& ok)
 #endif
 }
 
-bool CTextureConverter::IsBusy()
+bool CTextureConverter::IsBusy(bool highPriority)
 {
 	pthread_mutex_lock(&m_WorkerMutex);
-	bool busy = !m_RequestQueue.empty();
+	bool busy = !m_HighPriorityQueue.empty() || (!highPriority && !m_RequestQueue.empty());
 	pthread_mutex_unlock(&m_WorkerMutex);
 
 	return busy;
 }
 
-void* CTextureConverter::RunThread(void* data)
+void CTextureConverter::RunTask(void* data)
 {
-	debug_SetThreadName("TextureConverter");
-	g_Profiler2.RegisterCurrentThread("texconv");
-
 	CTextureConverter* textureConverter = static_cast<CTextureConverter*>(data);
 
 #if CONFIG2_NVTT
 
-	// Wait until the main thread wakes us up
-	while (SDL_SemWait(textureConverter->m_WorkerSem) == 0)
-	{
-		g_Profiler2.RecordSyncMarker();
-		PROFILE2_EVENT("wakeup");
+	// Each task handles one request, though not necessarily the one it was submitted
+	// for, since the tasks might run in any order and high-priority requests go first
+	pthread_mutex_lock(&textureConverter->m_WorkerMutex);
+	std::deque<shared_ptr<ConversionRequest> >& queue = textureConverter->m_HighPriorityQueue.empty()
+		? textureConverter->m_RequestQueue : textureConverter->m_HighPriorityQueue;
+	shared_ptr<ConversionRequest> request = queue.front();
+	queue.pop_front();
+	bool shutdown = textureConverter->m_Shutdown;
+	pthread_mutex_unlock(&textureConverter->m_WorkerMutex);
 
-		pthread_mutex_lock(&textureConverter->m_WorkerMutex);
-		if (textureConverter->m_Shutdown)
-		{
-			pthread_mutex_unlock(&textureConverter->m_WorkerMutex);
-			break;
-		}
-		// If we weren't woken up for shutdown, we must have been woken up for
-		// a new request, so grab it from the queue
-		shared_ptr<ConversionRequest> request = textureConverter->m_RequestQueue.front();
-		textureConverter->m_RequestQueue.pop_front();
-		pthread_mutex_unlock(&textureConverter->m_WorkerMutex);
+	// Don't bother converting anything if nobody's going to read the result
+	if (shutdown)
+		return;
 
-		// Set up the result object
-		shared_ptr<ConversionResult> result(new ConversionResult());
-		result->dest = request->dest;
-		result->texture = request->texture;
+	// Set up the result object
+	shared_ptr<ConversionResult> result(new ConversionResult());
+	result->dest = request->dest;
+	result->texture = request->texture;
 
-		request->outputOptions.setOutputHandler(&result->output);
+	request->outputOptions.setOutputHandler(&result->output);
 
-//		TIMER(L"TextureConverter compress");
+//	TIMER(L"TextureConverter compress");
 
-		{
-			PROFILE2("compress");
+	{
+		PROFILE2("compress");
 
-			// Perform the compression
-			nvtt::Compressor compressor;
-			result->ret = compressor.process(request->inputOptions, request->compressionOptions, request->outputOptions);
-		}
+		// Perform the compression
+		nvtt::Compressor compressor;
+		result->ret = compressor.process(request->inputOptions, request->compressionOptions, request->outputOptions);
+	}
 
-		// Ugly hack: NVTT 2.0 doesn't set DDPF_ALPHAPIXELS for DXT1a, so we can't
-		// distinguish it from DXT1. (It's fixed in trunk by
-		// http://code.google.com/p/nvidia-texture-tools/source/detail?r=924&path=/trunk).
-		// Rather than using a trunk NVTT (unstable, makes packaging harder)
-		// or patching our copy (makes packaging harder), we'll just manually
-		// set the flag here.
-		if (request->isDXT1a && result->ret && result->output.buffer.size() > 80)
-			result->output.buffer[80] |= 1; // DDPF_ALPHAPIXELS in DDS_PIXELFORMAT.dwFlags
-
-		// Push the result onto the queue
-		pthread_mutex_lock(&textureConverter->m_WorkerMutex);
-		textureConverter->m_ResultQueue.push_back(result);
-		pthread_mutex_unlock(&textureConverter->m_WorkerMutex);
+	if (request->etc && result->ret)
+	{
+		PROFILE2("compress ETC");
+		result->ret = CompressETC(result->output.buffer, request->etc);
 	}
 
-#endif
+	// Ugly hack: NVTT 2.0 doesn't set DDPF_ALPHAPIXELS for DXT1a, so we can't
+	// distinguish it from DXT1. (It's fixed in trunk by
+	// http://code.google.com/p/nvidia-texture-tools/source/detail?r=924&path=/trunk).
+	// Rather than using a trunk NVTT (unstable, makes packaging harder)
+	// or patching our copy (makes packaging harder), we'll just manually
+	// set the flag here.
+	if (request->isDXT1a && result->ret && result->output.buffer.size() > 80)
+		result->output.buffer[80] |= 1; // DDPF_ALPHAPIXELS in DDS_PIXELFORMAT.dwFlags
+
+	// Push the result onto the queue
+	pthread_mutex_lock(&textureConverter->m_WorkerMutex);
+	textureConverter->m_ResultQueue.push_back(result);
+	pthread_mutex_unlock(&textureConverter->m_WorkerMutex);
 
-	return NULL;
+#else
+	UNUSED2(textureConverter);
+#endif
 }
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,7 +20,7 @@
 
 #include "lib/file/vfs/vfs.h"
 #include "lib/posix/posix_pthread.h"
-#include "lib/external_libraries/libsdl.h"
+#include "ps/ThreadPool.h"
 
 #include "TextureManager.h"
 
@@ -46,7 +46,9 @@ class MD5;
  * All other attributes are optional. Later elements override attributes from
  * earlier elements.
  *
- * 'format' is 'dxt1', 'dxt3', 'dxt5' or 'rgba'.
+ * 'format' is 'dxt1', 'dxt3', 'dxt5', 'etc2' or 'rgba'. ('etc2' is stored as ETC1
+ * if there's no alpha channel; CTextureManager switches between DXT and ETC
+ * depending on which of them the GPU supports.)
  *
  * 'mipmap' is 'true' or 'false'.
  *
@@ -69,7 +71,8 @@ public:
 		FMT_DXT1,
 		FMT_DXT3,
 		FMT_DXT5,
-		FMT_RGBA
+		FMT_RGBA,
+		FMT_ETC2
 	};
 
 	enum EMipmap
@@ -177,39 +180,51 @@ public:
 	 * Otherwise it will return true and start an asynchronous conversion request,
 	 * whose result will be returned from Poll() (with the texture and dest passed
 	 * into this function).
+	 * High-priority requests (e.g. for textures that are already being drawn)
+	 * are started before any normal-priority ones that are still queued.
 	 */
-	bool ConvertTexture(const CTexturePtr& texture, const VfsPath& src, const VfsPath& dest, const Settings& settings);
+	bool ConvertTexture(const CTexturePtr& texture, const VfsPath& src, const VfsPath& dest, const Settings& settings, bool highPriority = false);
+
+	/**
+	 * Move the queued request for the given texture ahead of the normal-priority
+	 * ones. Returns false if there isn't one (e.g. it's already being converted).
+	 */
+	bool Prioritise(const CTexturePtr& texture);
 
 	/**
 	 * Returns the result of a successful ConvertTexture call.
 	 * If no result is available yet, returns false.
-	 * Otherwise, if the conversion succeeded, it sets ok to true and sets
-	 * texture and dest to the corresponding values passed into ConvertTexture(),
-	 * then returns true.
-	 * If the conversion failed, it sets ok to false and doesn't touch the other arguments,
-	 * then returns true.
+	 * Otherwise it sets texture and dest to the corresponding values passed into
+	 * ConvertTexture(), sets ok to whether the conversion succeeded, then returns true.
 	 */
 	bool Poll(CTexturePtr& texture, VfsPath& dest, bool& ok);
 
 	/**
-	 * Returns whether there is currently a queued request from ConvertTexture().
-	 * (Note this may return false while the worker thread is still converting the last texture.)
+	 * Returns whether a request of the given priority would have to wait behind
+	 * a queued request from ConvertTexture(), i.e. whether there's no point
+	 * submitting another one yet.
+	 * (Note this may return false while worker threads are still converting the last textures.)
 	 */
-	bool IsBusy();
+	bool IsBusy(bool highPriority = false);
 
 private:
-	static void* RunThread(void* data);
+	/**
+	 * Thread pool task that performs the oldest queued conversion request.
+	 */
+	static void RunTask(void* data);
 
 	PIVFS m_VFS;
 	bool m_HighQuality;
 
-	pthread_t m_WorkerThread;
 	pthread_mutex_t m_WorkerMutex;
-	SDL_sem* m_WorkerSem;
+
+	// Conversion tasks submitted to g_ThreadPool, one per queued request
+	CThreadPool::TaskGroup m_Tasks;
 
 	struct ConversionRequest;
 	struct ConversionResult;
 
+	std::deque<shared_ptr<ConversionRequest> > m_HighPriorityQueue; // protected by m_WorkerMutex
 	std::deque<shared_ptr<ConversionRequest> > m_RequestQueue; // protected by m_WorkerMutex
 	std::deque<shared_ptr<ConversionResult> > m_ResultQueue; // protected by m_WorkerMutex
 	bool m_Shutdown; // protected by m_WorkerMutex
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -23,15 +23,21 @@
 #include "lib/allocators/shared_ptr.h"
 #include "lib/res/h_mgr.h"
 #include "lib/file/vfs/vfs_tree.h"
+#include "lib/file/vfs/vfs_util.h"
 #include "lib/res/graphics/ogl_tex.h"
+#include "lib/tex/tex.h"
 #include "lib/timer.h"
 #include "maths/MD5.h"
 #include "ps/CacheLoader.h"
 #include "ps/CLogger.h"
 #include "ps/Filesystem.h"
+#include "ps/MemoryStats.h"
 #include "ps/Profile.h"
+#include "ps/ThreadPool.h"
+#include "ps/ThreadUtil.h"
 
 #include <iomanip>
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/unordered_map.hpp>
 #include <boost/unordered_set.hpp>
 #include <boost/functional/hash.hpp>
@@ -72,6 +78,54 @@ struct TPequal_to
 	}
 };
 
+// Number of frames that a texture counts as being in use for after it was last
+// bound. Streaming textures that are in use get loaded at full resolution, and
+// only textures that aren't in use are reduced to make room for them.
+static const u32 STREAMING_USE_FRAMES = 30;
+
+/**
+ * Estimate the video memory used by the texture, if the given number of
+ * high-resolution levels are left out.
+ */
+static size_t EstimateMemorySize(Handle handle, bool mipmaps, size_t skippedLevels)
+{
+	size_t w = 0, h = 0, bpp = 0;
+	(void)ogl_tex_get_size(handle, &w, &h, &bpp);
+
+	if (!mipmaps)
+		return w * h * bpp / 8;
+
+	size_t size = 0;
+	for (size_t level = 0; ; ++level)
+	{
+		size_t levelW = std::max(w >> level, (size_t)1);
+		size_t levelH = std::max(h >> level, (size_t)1);
+		if (level >= skippedLevels)
+			size += levelW * levelH * bpp / 8;
+		if (levelW == 1 && levelH == 1)
+			break;
+	}
+	return size;
+}
+
+// Maximum number of textures being read and decoded in the background (or waiting
+// to be uploaded) for prefetching and streaming, to limit the memory used by the
+// decoded data. Textures that are needed for rendering don't wait for this.
+static const size_t MAX_BACKGROUND_DECODES = 16;
+
+/**
+ * Read and decode the texture file into @p tex. This is called on worker threads.
+ */
+static bool DecodeTexture(const PIVFS& vfs, const VfsPath& path, Tex& tex)
+{
+	shared_ptr<u8> file;
+	size_t fileSize;
+	if (vfs->LoadFile(path, file, fileSize) < 0)
+		return false;
+
+	return tex_decode(file, fileSize, &tex) >= 0;
+}
+
 
 class CTextureManagerImpl
 {
@@ -79,7 +133,9 @@ class CTextureManagerImpl
 public:
 	CTextureManagerImpl(PIVFS vfs, bool highQuality, bool disableGL) :
 		m_VFS(vfs), m_CacheLoader(vfs, L".dds"), m_DisableGL(disableGL), m_TextureConverter(vfs, highQuality),
-		m_DefaultHandle(0), m_ErrorHandle(0)
+		m_DefaultHandle(0), m_ErrorHandle(0),
+		m_Streaming(false), m_StreamingMinSize(64), m_StreamingBudget(0), m_TextureMemory(0), m_Frame(1),
+		m_UploadBudget(SIZE_MAX), m_UploadedThisFrame(0), m_NextDecodeSerial(1), m_NumPendingDecodes(0), m_Shutdown(false)
 	{
 		// Initialise some textures that will always be available,
 		// without needing to load any files
@@ -132,6 +188,15 @@ public:
 	{
 		UnregisterFileReloadFunc(ReloadChangedFileCB, this);
 
+		// Tell the decoding tasks to skip any textures they haven't started yet,
+		// and wait for the ones in progress to finish, since they refer to us
+		{
+			CScopeLock lock(m_DecodeMutex);
+			m_Shutdown = true;
+		}
+		if (g_ThreadPool)
+			g_ThreadPool->Wait(m_DecodeTasks);
+
 		(void)ogl_tex_free(m_DefaultHandle);
 		(void)ogl_tex_free(m_ErrorHandle);
 	}
@@ -162,25 +227,171 @@ public:
 		return texture;
 	}
 
+	void SetStreaming(bool enabled, size_t minSize, size_t budget)
+	{
+		m_Streaming = enabled;
+		m_StreamingMinSize = minSize;
+		m_StreamingBudget = budget;
+	}
+
+	void SetUploadBudget(size_t budget)
+	{
+		m_UploadBudget = budget;
+	}
+
+	void BeginFrame()
+	{
+		++m_Frame;
+		m_UploadedThisFrame = 0;
+	}
+
 	/**
-	 * Load the given file into the texture object and upload it to OpenGL.
+	 * Start loading the given file into the texture object. The file is read and
+	 * decoded by a worker thread, and then uploaded to OpenGL by MakeProgress.
+	 * (If there's no thread pool, e.g. in tests, the texture is loaded immediately.)
+	 * A texture that isn't loaded yet is in the DECODING state until it's uploaded;
+	 * a texture that's being reloaded (e.g. for streaming) stays LOADED, and keeps
+	 * its current data until then.
 	 * Assumes the file already exists.
+	 * If @p streamed, and the texture can be streamed, only the low-resolution
+	 * mip levels are uploaded.
 	 */
-	void LoadTexture(const CTexturePtr& texture, const VfsPath& path)
+	void LoadTexture(const CTexturePtr& texture, const VfsPath& path, bool streamed)
 	{
-		if (m_DisableGL)
+		if (m_DisableGL || !g_ThreadPool)
+		{
+			texture->m_PendingDecode = 0;
+
+			if (!m_DisableGL)
+			{
+				Tex tex;
+				if (DecodeTexture(m_VFS, path, tex))
+					UploadTexture(texture, path, tex, streamed);
+				else
+					FailedToLoad(texture);
+			}
+
+			texture->m_State = CTexture::LOADED;
 			return;
+		}
+
+		shared_ptr<DecodeRequest> request(new DecodeRequest);
+		request->texture = texture;
+		request->path = path;
+		request->streamed = streamed;
+		request->serial = m_NextDecodeSerial++;
+		request->ok = false;
+
+		// (A newer request replaces any that's still pending)
+		texture->m_PendingDecode = request->serial;
+		if (texture->m_State != CTexture::LOADED)
+			texture->m_State = CTexture::DECODING;
+		++m_NumPendingDecodes;
+
+		{
+			CScopeLock lock(m_DecodeMutex);
+			m_DecodeRequests.push_back(request);
+		}
+		g_ThreadPool->Submit(&RunDecodeTask, this, &m_DecodeTasks);
+	}
+
+	/**
+	 * Thread pool task that reads and decodes the oldest queued texture.
+	 */
+	static void RunDecodeTask(void* data)
+	{
+		CTextureManagerImpl* textureManager = static_cast<CTextureManagerImpl*>(data);
+
+		// Each task handles one request, though not necessarily the one it was submitted
+		// for, since the tasks might run in any order
+		shared_ptr<DecodeRequest> request;
+		{
+			CScopeLock lock(textureManager->m_DecodeMutex);
+			request = textureManager->m_DecodeRequests.front();
+			textureManager->m_DecodeRequests.pop_front();
+			if (textureManager->m_Shutdown)
+				return;
+		}
 
-		PROFILE2("load texture");
+		{
+			PROFILE2("decode texture");
+			request->ok = DecodeTexture(textureManager->m_VFS, request->path, request->tex);
+		}
+
+		if (request->ok)
+		{
+			request->decodedSize = request->tex.dataSize;
+			MemoryStats::Add(MEMORY_TEXTURES_CPU, (ssize_t)request->decodedSize);
+		}
+
+		CScopeLock lock(textureManager->m_DecodeMutex);
+		textureManager->m_DecodeResults.push_back(request);
+	}
+
+	/**
+	 * Uploads the oldest texture that has finished decoding, if there is one
+	 * and this frame's upload budget hasn't been used up.
+	 * Returns whether it did anything.
+	 */
+	bool UploadDecodedTexture()
+	{
+		if (m_UploadedThisFrame >= m_UploadBudget)
+			return false;
+
+		shared_ptr<DecodeRequest> result;
+		{
+			CScopeLock lock(m_DecodeMutex);
+			if (m_DecodeResults.empty())
+				return false;
+			result = m_DecodeResults.front();
+			m_DecodeResults.pop_front();
+		}
+
+		--m_NumPendingDecodes;
+
+		// Ignore it if the texture has been reloaded (or hotloaded) since then
+		const CTexturePtr& texture = result->texture;
+		if (texture->m_PendingDecode != result->serial)
+			return true;
+		texture->m_PendingDecode = 0;
+
+		if (result->ok)
+			UploadTexture(texture, result->path, result->tex, result->streamed);
+		else
+			FailedToLoad(texture);
+
+		texture->m_State = CTexture::LOADED;
+		m_UploadedThisFrame += texture->m_MemorySize;
+		return true;
+	}
+
+	void FailedToLoad(const CTexturePtr& texture)
+	{
+		LOGERROR(L"Texture failed to load; \"%ls\"", texture->m_Properties.m_Path.string().c_str());
+
+		// Replace with error texture to make it obvious
+		texture->m_SkippedLevels = 0;
+		texture->m_Streamable = false;
+		SetTextureMemory(*texture, 0);
+		texture->SetHandle(m_ErrorHandle);
+	}
+
+	/**
+	 * Upload the decoded texture data to OpenGL, and store it in the texture object.
+	 */
+	void UploadTexture(const CTexturePtr& texture, const VfsPath& path, Tex& tex, bool streamed)
+	{
+		PROFILE2("upload texture");
 		PROFILE2_ATTR("name: %ls", path.string().c_str());
 
-		Handle h = ogl_tex_load(m_VFS, path, RES_UNIQUE);
+		texture->m_SkippedLevels = 0;
+		texture->m_Streamable = false;
+		SetTextureMemory(*texture, 0);
+
+		Handle h = ogl_tex_wrap(&tex, m_VFS, path, RES_UNIQUE);
 		if (h <= 0)
 		{
-			LOGERROR(L"Texture failed to load; \"%ls\"", texture->m_Properties.m_Path.string().c_str());
-
-			// Replace with error texture to make it obvious
-			texture->SetHandle(m_ErrorHandle);
+			FailedToLoad(texture);
 			return;
 		}
 
@@ -214,6 +425,23 @@ public:
 		}
 		(void)ogl_tex_set_filter(h, filter);
 
+		// Textures that are drawn with their precomputed mipmaps can be streamed,
+		// by leaving out the levels bigger than m_StreamingMinSize until they're used
+		bool mipmaps = (filter != GL_NEAREST && filter != GL_LINEAR);
+		size_t skippedLevels = 0;
+		if (m_Streaming && mipmaps)
+		{
+			texture->m_Streamable = true;
+			if (streamed)
+			{
+				size_t width = 0, height = 0;
+				(void)ogl_tex_get_size(h, &width, &height, NULL);
+				while ((std::max(width, height) >> skippedLevels) > m_StreamingMinSize)
+					++skippedLevels;
+				(void)ogl_tex_set_levels_to_skip(h, skippedLevels);
+			}
+		}
+
 		// Upload to GL
 		if (!m_DisableGL && ogl_tex_upload(h) < 0)
 		{
@@ -228,6 +456,17 @@ public:
 
 		// Let the texture object take ownership of this handle
 		texture->SetHandle(h, true);
+
+		texture->m_SkippedLevels = skippedLevels;
+		texture->m_LoadedPath = path;
+		SetTextureMemory(*texture, EstimateMemorySize(h, mipmaps, skippedLevels));
+	}
+
+	void SetTextureMemory(CTexture& texture, size_t size)
+	{
+		MemoryStats::Add(MEMORY_TEXTURES_GPU, (ssize_t)size - (ssize_t)texture.m_MemorySize);
+		m_TextureMemory = m_TextureMemory - texture.m_MemorySize + size;
+		texture.m_MemorySize = size;
 	}
 
 	/**
@@ -247,7 +486,7 @@ public:
 
 	/**
 	 * Attempts to load a cached version of a texture.
-	 * If the texture is loaded (or there was an error), returns true.
+	 * If the texture is loaded or being loaded (or there was an error), returns true.
 	 * Otherwise, returns false to indicate the caller should generate the cached version.
 	 */
 	bool TryLoadingCached(const CTexturePtr& texture)
@@ -262,7 +501,7 @@ public:
 		if (ret == INFO::OK)
 		{
 			// Found a cached texture - load it
-			LoadTexture(texture, loadPath);
+			LoadTexture(texture, loadPath, m_Streaming);
 			return true;
 		}
 		else if (ret == INFO::SKIPPED)
@@ -278,6 +517,7 @@ public:
 			// real texture at all - return the error texture instead
 			LOGERROR(L"CCacheLoader failed to find archived or source file for: \"%ls\"", texture->m_Properties.m_Path.string().c_str());
 			texture->SetHandle(m_ErrorHandle);
+			texture->m_State = CTexture::LOADED;
 			return true;
 		}
 	}
@@ -286,7 +526,7 @@ public:
 	 * Initiates an asynchronous conversion process, from the texture's
 	 * source file to the corresponding loose cache file.
 	 */
-	void ConvertTexture(const CTexturePtr& texture)
+	void ConvertTexture(const CTexturePtr& texture, bool highPriority)
 	{
 		VfsPath sourcePath = texture->m_Properties.m_Path;
 
@@ -302,7 +542,79 @@ public:
 
 		CTextureConverter::Settings settings = GetConverterSettings(texture);
 
-		m_TextureConverter.ConvertTexture(texture, sourcePath, looseCachePath, settings);
+		m_TextureConverter.ConvertTexture(texture, sourcePath, looseCachePath, settings, highPriority);
+	}
+
+	/**
+	 * Moves a prefetched texture's queued conversion ahead of the other
+	 * prefetched ones, since it's now needed for rendering.
+	 */
+	void PrioritiseConversion(const CTexturePtr& texture)
+	{
+		if (m_TextureConverter.Prioritise(texture))
+			texture->m_State = CTexture::HIGH_IS_CONVERTING;
+	}
+
+	static Status CollectTextureCB(const VfsPath& pathname, const FileInfo& UNUSED(fileInfo), const uintptr_t cbData)
+	{
+		// (Skip the directories where the engine doesn't use CTextureManager, like CArchiveBuilder)
+		if (tex_is_known_extension(pathname) &&
+			!boost::algorithm::starts_with(pathname.string(), L"art/textures/cursors/") &&
+			!boost::algorithm::starts_with(pathname.string(), L"art/textures/terrain/alphamaps/"))
+			((VfsPaths*)cbData)->push_back(pathname);
+		return INFO::OK;
+	}
+
+	size_t WarmCache(const VfsPath& directory)
+	{
+		VfsPaths pathnames;
+		vfs::ForEachFile(m_VFS, directory.empty() ? VfsPath(L"art/textures/") : directory, CollectTextureCB, (uintptr_t)&pathnames, 0, vfs::DIR_RECURSIVE);
+
+		size_t submitted = 0;
+		size_t finished = 0;
+		size_t converted = 0;
+		for (size_t i = 0; i < pathnames.size(); ++i)
+		{
+			CTexturePtr texture = CreateTexture(CTextureProperties(pathnames[i]));
+
+			MD5 hash;
+			u32 version;
+			PrepareCacheKey(texture, hash, version);
+			VfsPath looseCachePath;
+			if (m_CacheLoader.TryLoadingCached(pathnames[i], hash, version, looseCachePath) != INFO::SKIPPED)
+				continue;
+
+			if (m_TextureConverter.ConvertTexture(texture, pathnames[i], looseCachePath, GetConverterSettings(texture)))
+				++submitted;
+
+			// Keep all the workers busy, but don't decode textures much faster than
+			// they can be compressed, since they'd all have to stay in memory
+			while (m_TextureConverter.IsBusy())
+				WaitForConversion(finished, converted);
+		}
+
+		while (finished < submitted)
+			WaitForConversion(finished, converted);
+
+		return converted;
+	}
+
+	void WaitForConversion(size_t& finished, size_t& converted)
+	{
+		CTexturePtr texture;
+		VfsPath dest;
+		bool ok;
+		if (!m_TextureConverter.Poll(texture, dest, ok))
+		{
+			SDL_Delay(1);
+			return;
+		}
+
+		++finished;
+		if (ok)
+			++converted;
+		else
+			LOGERROR(L"Texture failed to convert: \"%ls\"", texture->m_Properties.m_Path.string().c_str());
 	}
 
 	bool GenerateCachedTexture(const VfsPath& sourcePath, VfsPath& archiveCachePath)
@@ -331,6 +643,10 @@ public:
 
 	bool MakeProgress()
 	{
+		// Upload any textures that have been decoded
+		if (UploadDecodedTexture())
+			return true;
+
 		// Process any completed conversion tasks
 		{
 			CTexturePtr texture;
@@ -340,22 +656,21 @@ public:
 			{
 				if (ok)
 				{
-					LoadTexture(texture, dest);
+					LoadTexture(texture, dest, m_Streaming);
 				}
 				else
 				{
 					LOGERROR(L"Texture failed to convert: \"%ls\"", texture->m_Properties.m_Path.string().c_str());
 					texture->SetHandle(m_ErrorHandle);
+					texture->m_State = CTexture::LOADED;
 				}
-				texture->m_State = CTexture::LOADED;
 				return true;
 			}
 		}
 
-		// We'll only push new conversion requests if it's not already busy
-		bool converterBusy = m_TextureConverter.IsBusy();
-
-		if (!converterBusy)
+		// We'll only push new conversion requests if they wouldn't just wait in
+		// the converter's queue (high-priority ones only wait for each other)
+		if (!m_TextureConverter.IsBusy(true))
 		{
 			// Look for all high-priority textures needing conversion.
 			// (Iterating over all textures isn't optimally efficient, but it
@@ -367,46 +682,96 @@ public:
 				{
 					// Start converting this texture
 					(*it)->m_State = CTexture::HIGH_IS_CONVERTING;
-					ConvertTexture(*it);
+					ConvertTexture(*it, true);
 					return true;
 				}
 			}
 		}
 
 		// Try loading prefetched textures from their cache
-		for (TextureCache::iterator it = m_TextureCache.begin(); it != m_TextureCache.end(); ++it)
+		for (TextureCache::iterator it = m_TextureCache.begin(); it != m_TextureCache.end() && m_NumPendingDecodes < MAX_BACKGROUND_DECODES; ++it)
 		{
 			if ((*it)->m_State == CTexture::PREFETCH_NEEDS_LOADING)
 			{
-				if (TryLoadingCached(*it))
-				{
-					(*it)->m_State = CTexture::LOADED;
-				}
-				else
-				{
+				if (!TryLoadingCached(*it))
 					(*it)->m_State = CTexture::PREFETCH_NEEDS_CONVERTING;
-				}
 				return true;
 			}
 		}
 
 		// If we've got nothing better to do, then start converting prefetched textures.
-		if (!converterBusy)
+		if (!m_TextureConverter.IsBusy())
 		{
 			for (TextureCache::iterator it = m_TextureCache.begin(); it != m_TextureCache.end(); ++it)
 			{
 				if ((*it)->m_State == CTexture::PREFETCH_NEEDS_CONVERTING)
 				{
 					(*it)->m_State = CTexture::PREFETCH_IS_CONVERTING;
-					ConvertTexture(*it);
+					ConvertTexture(*it, false);
 					return true;
 				}
 			}
 		}
 
+		// Finally, load the full resolution of streaming textures that are being used
+		if (m_Streaming && m_NumPendingDecodes < MAX_BACKGROUND_DECODES && StreamTextures())
+			return true;
+
 		return false;
 	}
 
+	bool IsInUse(const CTexture& texture) const
+	{
+		return texture.m_LastUsedFrame != 0 && texture.m_LastUsedFrame + STREAMING_USE_FRAMES >= m_Frame;
+	}
+
+	/**
+	 * Loads the full resolution of the most recently used texture that's still
+	 * streaming, or reduces an unused texture to make room for it.
+	 * Returns false if there's nothing to do (or no room).
+	 */
+	bool StreamTextures()
+	{
+		CTexturePtr next;
+		for (TextureCache::iterator it = m_TextureCache.begin(); it != m_TextureCache.end(); ++it)
+		{
+			const CTexturePtr& texture = *it;
+			if (texture->m_State != CTexture::LOADED || texture->m_PendingDecode || texture->m_SkippedLevels == 0 || !IsInUse(*texture))
+				continue;
+			if (!next || texture->m_LastUsedFrame > next->m_LastUsedFrame)
+				next = texture;
+		}
+
+		if (!next)
+			return false;
+
+		size_t fullSize = EstimateMemorySize(next->m_Handle, true, 0);
+		if (m_TextureMemory - next->m_MemorySize + fullSize > m_StreamingBudget)
+		{
+			// Over budget - reduce the least recently used texture that isn't in use
+			// (one per call, since it has to be reloaded)
+			CTexturePtr victim;
+			for (TextureCache::iterator it = m_TextureCache.begin(); it != m_TextureCache.end(); ++it)
+			{
+				const CTexturePtr& texture = *it;
+				if (texture->m_State != CTexture::LOADED || texture->m_PendingDecode || !texture->m_Streamable || texture->m_SkippedLevels != 0 || IsInUse(*texture))
+					continue;
+				if (!victim || texture->m_LastUsedFrame < victim->m_LastUsedFrame)
+					victim = texture;
+			}
+
+			// If every texture is in use, keep the rest at low resolution
+			if (!victim)
+				return false;
+
+			LoadTexture(victim, victim->m_LoadedPath, true);
+			return true;
+		}
+
+		LoadTexture(next, next->m_LoadedPath, false);
+		return true;
+	}
+
 	/**
 	 * Compute the conversion settings that apply to a given texture, by combining
 	 * the textures.xml files from its directory and all parent directories
@@ -427,7 +792,32 @@ public:
 				files.push_back(f);
 			p = p / GetWstringFromWpath(*it);
 		}
-		return m_TextureConverter.ComputeSettings(GetWstringFromWpath(srcPath.leaf()), files);
+		CTextureConverter::Settings settings = m_TextureConverter.ComputeSettings(GetWstringFromWpath(srcPath.leaf()), files);
+		SelectNativeFormat(settings);
+		return settings;
+	}
+
+	/**
+	 * Switch the settings between DXT and ETC compression to suit the GPU, so
+	 * the textures won't have to be decompressed in software when they're
+	 * uploaded: DXT is used wherever S3TC is supported (desktop drivers with ETC2
+	 * tend to decompress it themselves), and ETC where only that is.
+	 * (Since the format is part of the cache key, each gets its own cached files.)
+	 */
+	void SelectNativeFormat(CTextureConverter::Settings& settings)
+	{
+		// (Without GL, e.g. when building archives, just do what the settings say)
+		if (m_DisableGL)
+			return;
+
+		const bool isDXT = (settings.format == CTextureConverter::FMT_DXT1 ||
+			settings.format == CTextureConverter::FMT_DXT3 ||
+			settings.format == CTextureConverter::FMT_DXT5);
+
+		if (isDXT && !ogl_tex_has_s3tc() && ogl_tex_has_etc1())
+			settings.format = CTextureConverter::FMT_ETC2;
+		else if (settings.format == CTextureConverter::FMT_ETC2 && ogl_tex_has_s3tc())
+			settings.format = CTextureConverter::FMT_DXT5;
 	}
 
 	/**
@@ -453,9 +843,11 @@ public:
 		}
 	}
 
-	static Status ReloadChangedFileCB(void* param, const VfsPath& path)
+	static Status ReloadChangedFileCB(void* param, const std::vector<VfsPath>& paths)
 	{
-		return static_cast<CTextureManagerImpl*>(param)->ReloadChangedFile(path);
+		for (size_t i = 0; i < paths.size(); ++i)
+			RETURN_STATUS_IF_ERR(static_cast<CTextureManagerImpl*>(param)->ReloadChangedFile(paths[i]));
+		return INFO::OK;
 	}
 
 	Status ReloadChangedFile(const VfsPath& path)
@@ -473,7 +865,11 @@ public:
 				if (shared_ptr<CTexture> texture = it->lock())
 				{
 					texture->m_State = CTexture::UNLOADED;
+					texture->m_PendingDecode = 0;
 					texture->SetHandle(m_DefaultHandle);
+					texture->m_SkippedLevels = 0;
+					texture->m_Streamable = false;
+					SetTextureMemory(*texture, 0);
 				}
 			}
 		}
@@ -491,6 +887,55 @@ private:
 	Handle m_ErrorHandle;
 	CTexturePtr m_ErrorTexture;
 
+	// Texture streaming settings (see CTextureManager::SetStreaming)
+	bool m_Streaming;
+	size_t m_StreamingMinSize;
+	size_t m_StreamingBudget;
+
+	// Estimated amount of video memory used by all the loaded textures
+	size_t m_TextureMemory;
+
+	// Incremented by BeginFrame (starting at 1, so 0 can mean 'never used')
+	u32 m_Frame;
+
+	// Maximum number of bytes to upload per frame, and the number uploaded so far
+	// (at least one texture is uploaded per frame, however big it is)
+	size_t m_UploadBudget;
+	size_t m_UploadedThisFrame;
+
+	struct DecodeRequest
+	{
+		DecodeRequest() : decodedSize(0) { }
+
+		~DecodeRequest()
+		{
+			// The decoded data is freed along with the request (after being uploaded, if it was)
+			MemoryStats::Add(MEMORY_TEXTURES_CPU, -(ssize_t)decodedSize);
+		}
+
+		CTexturePtr texture;
+		VfsPath path;
+		bool streamed;
+		u32 serial;
+		Tex tex;
+		bool ok;
+		size_t decodedSize; // size of tex's data, counted in MEMORY_TEXTURES_CPU
+	};
+
+	// Identifies the latest request for each texture, so older ones can be ignored
+	u32 m_NextDecodeSerial;
+
+	// Number of requests that haven't been uploaded yet
+	size_t m_NumPendingDecodes;
+
+	// Decoding tasks submitted to g_ThreadPool, one per queued request
+	CThreadPool::TaskGroup m_DecodeTasks;
+
+	CMutex m_DecodeMutex;
+	std::deque<shared_ptr<DecodeRequest> > m_DecodeRequests; // protected by m_DecodeMutex
+	std::deque<shared_ptr<DecodeRequest> > m_DecodeResults; // protected by m_DecodeMutex
+	bool m_Shutdown; // protected by m_DecodeMutex
+
 	// Cache of all loaded textures
 	typedef boost::unordered_set<CTexturePtr, TPhash, TPequal_to > TextureCache;
 	TextureCache m_TextureCache;
@@ -507,7 +952,8 @@ private:
 };
 
 CTexture::CTexture(Handle handle, const CTextureProperties& props, CTextureManagerImpl* textureManager) :
-	m_Handle(handle), m_BaseColour(0), m_State(UNLOADED), m_Properties(props), m_TextureManager(textureManager)
+	m_Handle(handle), m_BaseColour(0), m_State(UNLOADED), m_Properties(props), m_TextureManager(textureManager),
+	m_SkippedLevels(0), m_Streamable(false), m_MemorySize(0), m_LastUsedFrame(0), m_PendingDecode(0)
 {
 	// Add a reference to the handle (it might be shared by multiple CTextures
 	// so we can't take ownership of it)
@@ -517,6 +963,8 @@ CTexture::CTexture(Handle handle, const CTextureProperties& props, CTextureManag
 
 CTexture::~CTexture()
 {
+	MemoryStats::Add(MEMORY_TEXTURES_GPU, -(ssize_t)m_MemorySize);
+
 	if (m_Handle)
 		ogl_tex_free(m_Handle);
 }
@@ -534,6 +982,8 @@ Handle CTexture::GetHandle()
 
 	TryLoad();
 
+	m_LastUsedFrame = m_TextureManager->m_Frame;
+
 	return m_Handle;
 }
 
@@ -541,16 +991,20 @@ bool CTexture::TryLoad()
 {
 	// If we haven't started loading, then try loading, and if that fails then request conversion.
 	// If we have already tried prefetch loading, and it failed, bump the conversion request to HIGH priority.
+	// (If the cached file is found, it's decoded in the background; see LoadTexture)
 	if (m_State == UNLOADED || m_State == PREFETCH_NEEDS_LOADING || m_State == PREFETCH_NEEDS_CONVERTING)
 	{
 		if (shared_ptr<CTexture> self = m_Self.lock())
 		{
-			if (m_State != PREFETCH_NEEDS_CONVERTING && m_TextureManager->TryLoadingCached(self))
-				m_State = LOADED;
-			else
+			if (m_State == PREFETCH_NEEDS_CONVERTING || !m_TextureManager->TryLoadingCached(self))
 				m_State = HIGH_NEEDS_CONVERTING;
 		}
 	}
+	else if (m_State == PREFETCH_IS_CONVERTING)
+	{
+		if (shared_ptr<CTexture> self = m_Self.lock())
+			m_TextureManager->PrioritiseConversion(self);
+	}
 
 	return (m_State == LOADED);
 }
@@ -571,6 +1025,15 @@ bool CTexture::IsLoaded()
 	return (m_State == LOADED);
 }
 
+bool CTexture::IsFullyLoaded()
+{
+	if (m_State == LOADED && m_SkippedLevels == 0)
+		return true;
+
+	m_LastUsedFrame = m_TextureManager->m_Frame;
+	return false;
+}
+
 void CTexture::SetHandle(Handle handle, bool takeOwnership)
 {
 	if (handle == m_Handle)
@@ -637,7 +1100,27 @@ bool CTextureManager::MakeProgress()
 	return m->MakeProgress();
 }
 
+void CTextureManager::SetStreaming(bool enabled, size_t minSize, size_t budget)
+{
+	m->SetStreaming(enabled, minSize, budget);
+}
+
+void CTextureManager::SetUploadBudget(size_t budget)
+{
+	m->SetUploadBudget(budget);
+}
+
+void CTextureManager::BeginFrame()
+{
+	m->BeginFrame();
+}
+
 bool CTextureManager::GenerateCachedTexture(const VfsPath& path, VfsPath& outputPath)
 {
 	return m->GenerateCachedTexture(path, outputPath);
 }
+
+size_t CTextureManager::WarmCache(const VfsPath& directory)
+{
+	return m->WarmCache(directory);
+}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -101,6 +101,30 @@ public:
 	 */
 	bool MakeProgress();
 
+	/**
+	 * Enables texture streaming: textures with precomputed mipmaps are first
+	 * uploaded with only their mip levels up to @p minSize pixels, and the full
+	 * resolution is loaded by MakeProgress once the texture has been used for
+	 * rendering. When the textures would exceed @p budget bytes of video memory,
+	 * the ones that haven't been used for the longest are reduced back to their
+	 * low-resolution levels.
+	 * Only affects textures loaded after this call.
+	 */
+	void SetStreaming(bool enabled, size_t minSize, size_t budget);
+
+	/**
+	 * Sets the maximum number of bytes of texture data that MakeProgress should
+	 * upload per frame (after they've been decoded in the background). At least one
+	 * texture is uploaded per frame, even if it's bigger than this.
+	 */
+	void SetUploadBudget(size_t budget);
+
+	/**
+	 * Signals the start of a frame, for tracking which textures are in use
+	 * and how much has been uploaded.
+	 */
+	void BeginFrame();
+
 	/**
 	 * Synchronously converts and compresses and saves the texture,
 	 * and returns the output path (minus a "cache/" prefix). This
@@ -109,6 +133,15 @@ public:
 	 */
 	bool GenerateCachedTexture(const VfsPath& path, VfsPath& outputPath);
 
+	/**
+	 * Converts every texture in the given directory (default art/textures/)
+	 * that hasn't got an up-to-date loose cache file yet, using all of the
+	 * thread pool's workers to compress them, and waits until they're saved.
+	 * This is intended for warming the cache after installing new art.
+	 * @return number of textures that were converted
+	 */
+	size_t WarmCache(const VfsPath& directory = VfsPath());
+
 private:
 	CTextureManagerImpl* m;
 };
@@ -249,6 +282,13 @@ public:
 	 */
 	bool IsLoaded();
 
+	/**
+	 * Returns whether the texture data is loaded at its full resolution, i.e. it's
+	 * loaded and isn't still streaming in. If it isn't, this counts as a use of the
+	 * texture, so the full resolution will be loaded soon.
+	 */
+	bool IsFullyLoaded();
+
 	/**
 	 * Activate the prefetching optimisation for this texture.
 	 * Use this if it is likely the texture will be needed in the near future.
@@ -276,11 +316,34 @@ private:
 		PREFETCH_IS_CONVERTING, // was prefetched; currently being processed by the texture converter
 		HIGH_NEEDS_CONVERTING, // high-priority; currently waiting to be sent to the texture converter
 		HIGH_IS_CONVERTING, // high-priority; currently being processed by the texture converter
+		DECODING, // the cached file is being read and decoded in the background, or waiting to be uploaded
 		LOADED // loading has completed (successfully or not)
 	} m_State;
 
 	CTextureManagerImpl* m_TextureManager;
 
+	// Number of high-resolution mip levels left out of the upload
+	// (non-zero while the texture is streaming in)
+	size_t m_SkippedLevels;
+
+	// Whether the texture can be streamed (it has precomputed mipmaps, and
+	// streaming was enabled when it was loaded)
+	bool m_Streamable;
+
+	// Estimated amount of video memory used by the uploaded levels, in bytes
+	size_t m_MemorySize;
+
+	// Cached file that the texture was loaded from, for reloading it at
+	// a different resolution
+	VfsPath m_LoadedPath;
+
+	// Frame in which the texture was last used (see CTextureManager::BeginFrame)
+	u32 m_LastUsedFrame;
+
+	// Identifies the latest request to decode this texture in the background
+	// (0 if there isn't one in progress)
+	u32 m_PendingDecode;
+
 	// Self-reference to let us recover the CTexturePtr for this object.
 	// (weak pointer to avoid cycles)
 	boost::weak_ptr<CTexture> m_Self;
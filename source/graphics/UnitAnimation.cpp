@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -25,6 +25,7 @@
 #include "graphics/SkeletonAnimDef.h"
 #include "graphics/Unit.h"
 #include "lib/rand.h"
+#include "maths/Vector3D.h"
 #include "ps/CStr.h"
 #include "ps/Game.h"
 #include "simulation2/Simulation2.h"
@@ -40,9 +41,26 @@ static float DesyncSpeed(float speed, float desync)
 	return speed * (1.f - desync + 2.f*desync*(rand(0, 256)/255.f));
 }
 
+// Animation LOD settings, shared by all units
+static float g_LODNearDistanceSquared = 0.f;
+static float g_LODFarDistanceSquared = 0.f;
+static CVector3D g_LODCameraPosition;
+
+void CUnitAnimation::SetLODDistances(float nearDistance, float farDistance)
+{
+	g_LODNearDistanceSquared = nearDistance * nearDistance;
+	g_LODFarDistanceSquared = farDistance * farDistance;
+}
+
+void CUnitAnimation::SetLODCameraPosition(const CVector3D& pos)
+{
+	g_LODCameraPosition = pos;
+}
+
 CUnitAnimation::CUnitAnimation(entity_id_t ent, CModel* model, CObjectEntry* object)
 	: m_Entity(ent), m_State("idle"), m_Looping(true),
-	  m_Speed(1.f), m_SyncRepeatTime(0.f), m_OriginalSpeed(1.f), m_Desync(0.f)
+	  m_Speed(1.f), m_SyncRepeatTime(0.f), m_OriginalSpeed(1.f), m_Desync(0.f),
+	  m_PoseUpdateCountdown(0)
 {
 	ReloadUnit(model, object);
 }
@@ -67,6 +85,7 @@ void CUnitAnimation::AddModel(CModel* model, const CObjectEntry* object)
 	state.time = 0.f;
 	state.pastLoadPos = false;
 	state.pastActionPos = false;
+	state.poseDirty = false;
 
 	m_AnimStates.push_back(state);
 
@@ -89,6 +108,9 @@ void CUnitAnimation::ReloadUnit(CModel* model, const CObjectEntry* object)
 
 	m_AnimStates.clear();
 	AddModel(m_Model, m_Object);
+
+	// Make sure the new animations are shown immediately
+	m_PoseUpdateCountdown = 0;
 }
 
 void CUnitAnimation::SetAnimationState(const CStr& name, bool once, float speed, float desync, const CStrW& actionSound)
@@ -141,11 +163,43 @@ void CUnitAnimation::SetAnimationSyncOffset(float actionTime)
 			start += duration;
 
 		it->time = start;
+		it->poseDirty = true;
 	}
 }
 
+size_t CUnitAnimation::GetLODUpdateInterval() const
+{
+	if (g_LODNearDistanceSquared == 0.f && g_LODFarDistanceSquared == 0.f)
+		return 1;
+
+	float distSquared = (m_Model->GetTransform().GetTranslation() - g_LODCameraPosition).LengthSquared();
+
+	if (g_LODFarDistanceSquared != 0.f && distSquared > g_LODFarDistanceSquared)
+		return 4;
+
+	if (g_LODNearDistanceSquared != 0.f && distSquared > g_LODNearDistanceSquared)
+		return 2;
+
+	return 1;
+}
+
 void CUnitAnimation::Update(float time)
 {
+	// Distant units don't need to have their poses (and therefore bone matrices
+	// and skinned vertices) recomputed every frame.
+	// Desynchronise the countdowns so that the units don't all update in the
+	// same frame. (This is graphics-only so it's fine to use non-deterministic randomness.)
+	bool updatePose = (m_PoseUpdateCountdown == 0);
+	if (updatePose)
+	{
+		size_t interval = GetLODUpdateInterval();
+		m_PoseUpdateCountdown = (interval > 1 ? rand(interval/2, interval) : 0);
+	}
+	else
+	{
+		--m_PoseUpdateCountdown;
+	}
+
 	// Advance all of the prop models independently
 	for (std::vector<SModelAnimState>::iterator it = m_AnimStates.begin(); it != m_AnimStates.end(); ++it)
 	{
@@ -197,7 +251,7 @@ void CUnitAnimation::Update(float time)
 		{
 			// If we're still within the current animation, then simply update it
 			it->time += advance;
-			it->model->UpdateTo(it->time);
+			it->poseDirty = true;
 		}
 		else if (m_Looping)
 		{
@@ -214,13 +268,15 @@ void CUnitAnimation::Update(float time)
 				{
 					it->animIdx = newAnimIdx;
 					it->model->SetAnimation(it->anims[it->animIdx], !m_Looping);
+					// (don't let LOD leave the new animation at the old one's time)
+					updatePose = true;
 				}
 			}
 
 			it->pastActionPos = false;
 			it->pastLoadPos = false;
 
-			it->model->UpdateTo(it->time);
+			it->poseDirty = true;
 		}
 		else
 		{
@@ -231,8 +287,14 @@ void CUnitAnimation::Update(float time)
 			if (fabs(it->time - nearlyEnd) > 1.f)
 			{
 				it->time = nearlyEnd;
-				it->model->UpdateTo(it->time);
+				it->poseDirty = true;
 			}
 		}
+
+		if (updatePose && it->poseDirty)
+		{
+			it->model->UpdateTo(it->time);
+			it->poseDirty = false;
+		}
 	}
 }
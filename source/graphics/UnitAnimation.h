@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,6 +24,7 @@
 
 class CUnit;
 class CModel;
+class CVector3D;
 class CSkeletonAnim;
 class CObjectEntry;
 
@@ -91,6 +92,21 @@ public:
 	 */
 	void ReloadUnit(CModel* model, const CObjectEntry* object);
 
+	/**
+	 * Set the distances used for animation level of detail: units further than
+	 * @p nearDistance from the camera only update their model poses every 2nd Update,
+	 * and units further than @p farDistance every 3rd or 4th Update. The animation timing
+	 * and action points (sounds, ammo props) are still updated every time.
+	 * A distance of 0 disables that level.
+	 */
+	static void SetLODDistances(float nearDistance, float farDistance);
+
+	/**
+	 * Set the camera position that the LOD distances are measured from
+	 * (should be called once per frame).
+	 */
+	static void SetLODCameraPosition(const CVector3D& pos);
+
 private:
 	struct SModelAnimState
 	{
@@ -100,8 +116,15 @@ private:
 		float time;
 		bool pastLoadPos;
 		bool pastActionPos;
+		bool poseDirty; // time has changed since the last UpdateTo
 	};
 
+	/**
+	 * Returns how many Updates the model poses should be updated for,
+	 * based on the distance from the camera.
+	 */
+	size_t GetLODUpdateInterval() const;
+
 	std::vector<SModelAnimState> m_AnimStates;
 
 	void AddModel(CModel* model, const CObjectEntry* object);
@@ -116,6 +139,9 @@ private:
 	float m_SyncRepeatTime;
 	float m_Desync;
 	CStrW m_ActionSound;
+
+	// Number of Updates to skip before the next model pose update (for LOD)
+	size_t m_PoseUpdateCountdown;
 };
 
 #endif // INCLUDED_UNITANIMATION
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -92,8 +92,19 @@ CUnit* CUnitManager::CreateUnit(const CStrW& actorName, uint32_t seed, const std
 	if (! m_ObjectManager)
 		return NULL;
 
+	if (m_ObjectManager->DeferUntilPrefetched(actorName))
+		return NULL;
+
 	CUnit* unit = CUnit::Create(actorName, seed, selections, *m_ObjectManager);
 	if (unit)
 		AddUnit(unit);
 	return unit;
 }
+
+///////////////////////////////////////////////////////////////////////////////
+// PrefetchActor: start loading the given actor's files in the background
+void CUnitManager::PrefetchActor(const CStrW& actorName)
+{
+	if (m_ObjectManager)
+		m_ObjectManager->PrefetchObject(actorName);
+}
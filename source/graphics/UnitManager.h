@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -49,9 +49,14 @@ public:
 	// remove and delete all units
 	void DeleteAll();
 
-	// creates a new unit and adds it to the world
+	// creates a new unit and adds it to the world; returns NULL if the actor
+	// is still being prefetched (it'll be hotloaded once that's finished)
 	CUnit* CreateUnit(const CStrW& actorName, uint32_t seed, const std::set<CStr8>& selections);
 
+	// starts loading the files used by the given actor in the background, so
+	// that creating units of it later won't have to wait for them
+	void PrefetchActor(const CStrW& actorName);
+
 	// return the units
 	const std::vector<CUnit*>& GetUnits() const { return m_Units; }
 	
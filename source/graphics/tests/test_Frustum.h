@@ -0,0 +1,82 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "graphics/Camera.h"
+#include "graphics/Frustum.h"
+#include "maths/BoundingBoxAligned.h"
+#include "maths/MathUtil.h"
+
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_real.hpp>
+
+class TestFrustum : public CxxTest::TestSuite
+{
+public:
+	void test_batch_matches_single()
+	{
+		SViewPort vp;
+		vp.m_X = vp.m_Y = 0;
+		vp.m_Width = 1024;
+		vp.m_Height = 768;
+
+		CCamera camera;
+		camera.SetViewPort(vp);
+		camera.SetProjection(2.f, 512.f, DEGTORAD(20.f));
+		camera.m_Orientation.SetXRotation(DEGTORAD(30.f));
+		camera.m_Orientation.Translate(100.f, 200.f, -50.f);
+		camera.UpdateFrustum();
+		const CFrustum& frustum = camera.GetFrustum();
+
+		// An odd number of boxes, so both the SIMD and the remainder paths get tested
+		const size_t count = 1001;
+		std::vector<float> minX(count), minY(count), minZ(count), maxX(count), maxY(count), maxZ(count);
+		std::vector<CBoundingBoxAligned> boxes(count);
+
+		boost::mt19937 rng(1234);
+		boost::uniform_real<float> pos(-500.f, 700.f);
+		boost::uniform_real<float> size(0.f, 40.f);
+		for (size_t i = 0; i < count; ++i)
+		{
+			CVector3D p(pos(rng), pos(rng), pos(rng));
+			CVector3D s(size(rng), size(rng), size(rng));
+			boxes[i] = CBoundingBoxAligned(p, p + s);
+			if (i % 10 == 9)
+				boxes[i].SetEmpty();
+
+			minX[i] = boxes[i][0].X; minY[i] = boxes[i][0].Y; minZ[i] = boxes[i][0].Z;
+			maxX[i] = boxes[i][1].X; maxY[i] = boxes[i][1].Y; maxZ[i] = boxes[i][1].Z;
+		}
+
+		std::vector<u8> visible(count);
+		frustum.AreBoxesVisible(count, &minX[0], &minY[0], &minZ[0], &maxX[0], &maxY[0], &maxZ[0], &visible[0]);
+
+		size_t numVisible = 0;
+		for (size_t i = 0; i < count; ++i)
+		{
+			bool expected = boxes[i].IsEmpty() ? false : frustum.IsBoxVisible(CVector3D(0, 0, 0), boxes[i]);
+			TS_ASSERT_EQUALS(visible[i] != 0, expected);
+			if (visible[i])
+				++numVisible;
+		}
+
+		// Make sure the test isn't trivial
+		TS_ASSERT_LESS_THAN(0u, numVisible);
+		TS_ASSERT_LESS_THAN(numVisible, count);
+	}
+};
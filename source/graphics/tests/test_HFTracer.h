@@ -0,0 +1,116 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "graphics/HFTracer.h"
+#include "graphics/Patch.h"
+#include "graphics/RenderableObject.h"
+#include "graphics/Terrain.h"
+#include "maths/Vector3D.h"
+
+class TestHFTracer : public CxxTest::TestSuite
+{
+	void SetHeights(CTerrain& terrain, ssize_t i0, ssize_t j0, ssize_t i1, ssize_t j1, u16 height)
+	{
+		for (ssize_t j = j0; j < j1; ++j)
+			for (ssize_t i = i0; i < i1; ++i)
+				terrain.GetHeightMap()[j*terrain.GetVerticesPerSide() + i] = height;
+		terrain.MakeDirty(i0, j0, i1, j1, RENDERDATA_UPDATE_VERTICES);
+	}
+
+public:
+	void test_flat()
+	{
+		CTerrain terrain;
+		terrain.Initialize(4, NULL);
+		SetHeights(terrain, 0, 0, terrain.GetVerticesPerSide(), terrain.GetVerticesPerSide(), 1000);
+
+		CHFTracer tracer(&terrain);
+		int x, z;
+		CVector3D ipt;
+
+		// Straight down
+		TS_ASSERT(tracer.RayIntersect(CVector3D(10.5f*TERRAIN_TILE_SIZE, 100.f, 20.5f*TERRAIN_TILE_SIZE), CVector3D(0, -1, 0), x, z, ipt));
+		TS_ASSERT_EQUALS(x, 10);
+		TS_ASSERT_EQUALS(z, 20);
+		TS_ASSERT_DELTA(ipt.Y, 1000.f*HEIGHT_SCALE, 0.001f);
+
+		// At a shallow angle, from well outside the map
+		CVector3D origin(-98.f, 1000.f*HEIGHT_SCALE + 5.f, 31.f);
+		CVector3D dir = CVector3D(40.f, -1.f, 10.f).Normalized();
+		TS_ASSERT(tracer.RayIntersect(origin, dir, x, z, ipt));
+		TS_ASSERT_DELTA(ipt.X, 102.f, 0.01f);
+		TS_ASSERT_DELTA(ipt.Z, 81.f, 0.01f);
+		TS_ASSERT_EQUALS(x, 25);
+		TS_ASSERT_EQUALS(z, 20);
+
+		// Pointing upwards
+		TS_ASSERT(!tracer.RayIntersect(CVector3D(10.f, 100.f, 10.f), CVector3D(0.5f, 0.5f, 0.f).Normalized(), x, z, ipt));
+	}
+
+	void test_update()
+	{
+		CTerrain terrain;
+		terrain.Initialize(4, NULL);
+
+		CHFTracer tracer(&terrain);
+		int x, z;
+		CVector3D ipt;
+
+		// A shallow ray that misses a low wall, and so hits the ground beyond it
+		CVector3D origin(1.5f*TERRAIN_TILE_SIZE, 12.f, 30.5f*TERRAIN_TILE_SIZE);
+		CVector3D dir = CVector3D(1.f, -0.05f, 0.f).Normalized();
+		SetHeights(terrain, 10, 20, 12, 40, 5*HEIGHT_UNITS_PER_METRE);
+		TS_ASSERT(tracer.RayIntersect(origin, dir, x, z, ipt));
+		TS_ASSERT_EQUALS(z, 30);
+		TS_ASSERT_DELTA(ipt.Y, 0.f, 0.001f);
+		TS_ASSERT_DELTA(ipt.X, origin.X + 240.f, 0.01f);
+
+		// Raising the wall should be noticed, even though only part of the terrain changed
+		SetHeights(terrain, 10, 20, 12, 40, 50*HEIGHT_UNITS_PER_METRE);
+		TS_ASSERT(tracer.RayIntersect(origin, dir, x, z, ipt));
+		TS_ASSERT_EQUALS(z, 30);
+		TS_ASSERT_EQUALS(x, 9);
+		TS_ASSERT_LESS_THAN(5.f, ipt.Y);
+	}
+
+	void test_segment_occluded()
+	{
+		CTerrain terrain;
+		terrain.Initialize(4, NULL);
+
+		CHFTracer tracer(&terrain);
+		CVector3D start(1.5f*TERRAIN_TILE_SIZE, 12.f, 30.5f*TERRAIN_TILE_SIZE);
+		CVector3D end(30.f*TERRAIN_TILE_SIZE, 1.f, 30.5f*TERRAIN_TILE_SIZE);
+
+		// Flat ground doesn't occlude anything above it
+		TS_ASSERT(!tracer.IsSegmentOccluded(start, end));
+
+		// A wall in the way does
+		SetHeights(terrain, 10, 20, 12, 40, 50*HEIGHT_UNITS_PER_METRE);
+		TS_ASSERT(tracer.IsSegmentOccluded(start, end));
+		TS_ASSERT(tracer.IsSegmentOccluded(end, start));
+
+		// Unless the segment passes over it, or ends before it
+		TS_ASSERT(!tracer.IsSegmentOccluded(start + CVector3D(0, 50.f, 0), end + CVector3D(0, 50.f, 0)));
+		TS_ASSERT(!tracer.IsSegmentOccluded(start, CVector3D(8.f*TERRAIN_TILE_SIZE, 5.f, 30.5f*TERRAIN_TILE_SIZE)));
+
+		// Or goes beside it
+		TS_ASSERT(!tracer.IsSegmentOccluded(start + CVector3D(0, 0, 15.f*TERRAIN_TILE_SIZE), end + CVector3D(0, 0, 15.f*TERRAIN_TILE_SIZE)));
+	}
+};
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -58,6 +58,39 @@ public:
 		TS_ASSERT_EQUALS(losData[0], 104);
 	}
 
+	void test_region()
+	{
+		CSimulation2 sim(NULL, NULL);
+		CLOSTexture tex(sim);
+
+		const ssize_t size = 20;
+		std::vector<u32> inputDataVec;
+		for (ssize_t n = 0; n < size*size; ++n)
+			inputDataVec.push_back((n*n) % 7 < 3 ? 2 : (n % 5 == 0 ? 1 : 0));
+
+		ICmpRangeManager::CLosQuerier los(ICmpRangeManager::LOS_MASK, inputDataVec, size);
+
+		std::vector<u8> fullData;
+		fullData.resize(tex.GetBitmapSize(size, size));
+		tex.GenerateBitmap(los, &fullData[0], size, size);
+
+		// Recomputing part of the texture must give the same texels as recomputing all of it,
+		// including next to the edges of the map
+		const size_t regions[][4] = { { 0, 0, 20, 20 }, { 5, 4, 3, 6 }, { 0, 0, 1, 1 }, { 0, 10, 20, 2 }, { 15, 17, 5, 3 } };
+		for (size_t r = 0; r < ARRAY_SIZE(regions); ++r)
+		{
+			size_t i0 = regions[r][0], j0 = regions[r][1], w = regions[r][2], h = regions[r][3];
+
+			std::vector<u8> losData;
+			losData.resize(tex.GetBitmapSize(w, h));
+			tex.GenerateBitmap(los, &losData[0], size, size, i0, j0, w, h);
+
+			for (size_t j = 0; j < h; ++j)
+				for (size_t i = 0; i < w; ++i)
+					TS_ASSERT_EQUALS(losData[i + j*(w + 6)], fullData[i0 + i + (j0 + j)*(size + 6)]);
+		}
+	}
+
 	void test_perf_DISABLED()
 	{
 		CSimulation2 sim(NULL, NULL);
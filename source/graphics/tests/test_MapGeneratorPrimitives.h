@@ -0,0 +1,132 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "graphics/MapGeneratorPrimitives.h"
+
+class TestMapGeneratorPrimitives : public CxxTest::TestSuite
+{
+public:
+	void test_grid_size()
+	{
+		TS_ASSERT_EQUALS(MapGenGetGridSize(0), 0u);
+		TS_ASSERT_EQUALS(MapGenGetGridSize(1), 1u);
+		TS_ASSERT_EQUALS(MapGenGetGridSize(256*256), 256u);
+		TS_ASSERT_EQUALS(MapGenGetGridSize(256*255), 0u);
+	}
+
+	void test_clump()
+	{
+		const size_t size = 64;
+		std::vector<u8> allowed(size*size, 1);
+		boost::rand48 rng1(1234), rng2(1234);
+
+		std::vector<u32> a = MapGenClumpArea(32.f, 32.f, 100.f, 0.5f, 0.5f, 0.f, allowed, rng1);
+		std::vector<u32> b = MapGenClumpArea(32.f, 32.f, 100.f, 0.5f, 0.5f, 0.f, allowed, rng2);
+		TS_ASSERT(a == b);
+
+		// Roughly the requested area (up to four times it, with this coherence), around the centre
+		TS_ASSERT_LESS_THAN(50u, a.size());
+		TS_ASSERT_LESS_THAN(a.size(), 400u);
+		for (size_t i = 0; i < a.size(); ++i)
+		{
+			int dx = (int)(a[i] % size) - 32;
+			int dz = (int)(a[i] / size) - 32;
+			TS_ASSERT_LESS_THAN(dx*dx + dz*dz, 20*20);
+		}
+
+		// Disallowed tiles aren't covered, and make the clump fail if there are too many
+		for (size_t z = 0; z < size; ++z)
+			for (size_t x = 0; x < 32; ++x)
+				allowed[z*size + x] = 0;
+		std::vector<u32> c = MapGenClumpArea(32.f, 32.f, 100.f, 0.5f, 0.5f, 10.f, allowed, rng1);
+		TS_ASSERT(!c.empty());
+		for (size_t i = 0; i < c.size(); ++i)
+			TS_ASSERT_LESS_THAN_EQUALS(32u, c[i] % size);
+		TS_ASSERT(MapGenClumpArea(32.f, 32.f, 100.f, 0.5f, 0.5f, 0.f, allowed, rng1).empty());
+	}
+
+	void test_smooth()
+	{
+		const size_t size = 9;
+		std::vector<float> heights(size*size, 10.f);
+		MapGenSmoothHeightmap(heights, 1.f, 3);
+		for (size_t i = 0; i < heights.size(); ++i)
+			TS_ASSERT_DELTA(heights[i], 10.f, 0.0001f);
+
+		heights[4*size + 4] = 90.f;
+		MapGenSmoothHeightmap(heights, 1.f, 1);
+		TS_ASSERT_DELTA(heights[4*size + 4], 10.f, 0.0001f);
+		TS_ASSERT_DELTA(heights[4*size + 5], 20.f, 0.0001f);
+		TS_ASSERT_DELTA(heights[0], 10.f, 0.0001f);
+
+		heights.assign(size*size, 0.f);
+		heights[0] = 30.f;
+		MapGenSmoothHeightmap(heights, 0.5f, 1);
+		TS_ASSERT_DELTA(heights[0], 15.f, 0.0001f);
+		TS_ASSERT_DELTA(heights[1], 3.f, 0.0001f);
+	}
+
+	void test_noise()
+	{
+		std::vector<float> a = MapGenNoiseField(32, 8.f, 3, 1);
+		std::vector<float> b = MapGenNoiseField(32, 8.f, 3, 1);
+		std::vector<float> c = MapGenNoiseField(32, 8.f, 3, 2);
+		TS_ASSERT_EQUALS(a.size(), 32u*32u);
+		TS_ASSERT(a == b);
+		TS_ASSERT(a != c);
+
+		float minValue = 1.f, maxValue = 0.f;
+		for (size_t i = 0; i < a.size(); ++i)
+		{
+			minValue = std::min(minValue, a[i]);
+			maxValue = std::max(maxValue, a[i]);
+		}
+		TS_ASSERT_LESS_THAN_EQUALS(0.f, minValue);
+		TS_ASSERT_LESS_THAN_EQUALS(maxValue, 1.f);
+		TS_ASSERT_LESS_THAN(minValue, maxValue);
+	}
+
+	void test_place()
+	{
+		const size_t size = 64;
+		std::vector<u8> allowed(size*size, 0);
+		for (size_t z = 0; z < size; ++z)
+			for (size_t x = 16; x < 48; ++x)
+				allowed[z*size + x] = 1;
+
+		boost::rand48 rng(5678);
+		std::vector<u32> placed = MapGenPlaceObjects(allowed, 50, 6.f, 10000, rng);
+		TS_ASSERT_LESS_THAN(10u, placed.size());
+		TS_ASSERT_LESS_THAN_EQUALS(placed.size(), 50u);
+
+		for (size_t i = 0; i < placed.size(); ++i)
+		{
+			TS_ASSERT(allowed[placed[i]]);
+			for (size_t j = 0; j < i; ++j)
+			{
+				int dx = (int)(placed[i] % size) - (int)(placed[j] % size);
+				int dz = (int)(placed[i] / size) - (int)(placed[j] / size);
+				TS_ASSERT_LESS_THAN_EQUALS(6*6, dx*dx + dz*dz);
+			}
+		}
+
+		// Stops at the requested count
+		TS_ASSERT_EQUALS(MapGenPlaceObjects(allowed, 3, 0.f, 10000, rng).size(), 3u);
+	}
+};
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -27,6 +27,7 @@
 #include "graphics/ModelDef.h"
 
 #include "ps/CLogger.h"
+#include "ps/ThreadPool.h"
 #include "ps/XML/RelaxNG.h"
 
 static OsPath MOD_PATH(DataDir()/"mods"/"_test.mesh");
@@ -154,6 +155,19 @@ public:
 		if (modeldef1 && modeldef2) TS_ASSERT_EQUALS(modeldef1.get(), modeldef2.get());
 	}
 
+	void test_get_mesh_file()
+	{
+		copyFile(srcPMD, testPMD);
+		copyFile(srcSkeletonDefs, testSkeletonDefs);
+
+		TS_ASSERT_PATH_EQUALS(meshManager->GetMeshFile(testBase), testPMD);
+
+		// Nothing needs to be prefetched once it's loaded
+		CModelDefPtr modeldef = meshManager->GetMesh(testPMD);
+		TS_ASSERT(modeldef);
+		TS_ASSERT(meshManager->GetMeshFile(testPMD).empty());
+	}
+
 	void test_load_dae()
 	{
 		copyFile(srcDAE, testDAE);
@@ -164,6 +178,35 @@ public:
 		if (modeldef) TS_ASSERT_PATH_EQUALS(modeldef->GetName(), testBase);
 	}
 
+	void test_load_dae_async()
+	{
+		copyFile(srcDAE, testDAE);
+		copyFile(srcSkeletonDefs, testSkeletonDefs);
+
+		// (A pool without workers only runs tasks when it's destroyed, so the
+		// conversion happens at a predictable time)
+		g_ThreadPool = new CThreadPool(0);
+		colladaManager->SetAsyncConversion(true);
+
+		TS_ASSERT(!meshManager->GetMesh(testDAE));
+		TS_ASSERT(meshManager->IsMeshPending(testDAE));
+
+		std::vector<VfsPath> finished;
+		colladaManager->GetFinishedConversions(finished);
+		TS_ASSERT(finished.empty());
+
+		SAFE_DELETE(g_ThreadPool);
+
+		TS_ASSERT(!meshManager->IsMeshPending(testDAE));
+		colladaManager->GetFinishedConversions(finished);
+		TS_ASSERT_EQUALS(finished.size(), (size_t)1);
+		if (!finished.empty()) TS_ASSERT_PATH_EQUALS(finished[0], testDAE);
+
+		CModelDefPtr modeldef = meshManager->GetMesh(testDAE);
+		TS_ASSERT(modeldef);
+		if (modeldef) TS_ASSERT_PATH_EQUALS(modeldef->GetName(), testBase);
+	}
+
 	void test_load_dae_caching()
 	{
 		copyFile(srcDAE, testDAE);
@@ -0,0 +1,114 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "lib/self_test.h"
+
+#include "graphics/SkeletonAnimDef.h"
+
+class TestSkeletonAnimDef : public CxxTest::TestSuite
+{
+	void CheckMatrices(const CMatrix3D* a, const CMatrix3D* b, size_t count)
+	{
+		for (size_t i = 0; i < count; ++i)
+			for (size_t j = 0; j < 16; ++j)
+				TS_ASSERT_EQUALS(a[i]._data[j], b[i]._data[j]);
+	}
+
+	// Bone 0 is animated; bone 1 doesn't move; bone 2 moves by less than the
+	// constant key error bound
+	void MakeKeys(size_t numFrames, std::vector<CSkeletonAnimDef::Key>& keys)
+	{
+		keys.resize(numFrames * 3);
+		for (size_t f = 0; f < numFrames; ++f)
+		{
+			keys[f*3 + 0].m_Translation = CVector3D((float)f, 2.f, -0.5f*f);
+			keys[f*3 + 0].m_Rotation.FromEulerAngles(0.1f*f, 0.2f, 0.f);
+			keys[f*3 + 1].m_Translation = CVector3D(1.f, 1.f, 1.f);
+			keys[f*3 + 1].m_Rotation.FromEulerAngles(0.f, 0.4f, 0.3f);
+			keys[f*3 + 2].m_Translation = CVector3D(3.f, 0.0001f*(f%2), 0.f);
+			keys[f*3 + 2].m_Rotation.FromEulerAngles(0.5f, 0.f, 0.f);
+		}
+	}
+
+public:
+	void test_compression()
+	{
+		const size_t numFrames = 50;
+		std::vector<CSkeletonAnimDef::Key> keys;
+		MakeKeys(numFrames, keys);
+
+		CSkeletonAnimDef anim;
+		anim.SetKeys(numFrames, 3, &keys[0]);
+		TS_ASSERT_EQUALS(anim.GetNumFrames(), numFrames);
+		TS_ASSERT_EQUALS(anim.GetNumKeys(), 3u);
+
+		// Only the animated bone stores a key per frame, and the keys are
+		// much smaller than the uncompressed ones
+		TS_ASSERT_LESS_THAN(anim.GetKeysMemorySize(), keys.size() * sizeof(CSkeletonAnimDef::Key) / 5);
+
+		for (size_t f = 0; f < numFrames; ++f)
+		{
+			for (size_t k = 0; k < 3; ++k)
+			{
+				CSkeletonAnimDef::Key key = anim.GetKey(f, k);
+				const CSkeletonAnimDef::Key& expected = keys[f*3 + k];
+				TS_ASSERT_DELTA(key.m_Translation.X, expected.m_Translation.X, 0.001f);
+				TS_ASSERT_DELTA(key.m_Translation.Y, expected.m_Translation.Y, 0.001f);
+				TS_ASSERT_DELTA(key.m_Translation.Z, expected.m_Translation.Z, 0.001f);
+				TS_ASSERT_DELTA(key.m_Rotation.m_V.X, expected.m_Rotation.m_V.X, 0.0001f);
+				TS_ASSERT_DELTA(key.m_Rotation.m_V.Y, expected.m_Rotation.m_V.Y, 0.0001f);
+				TS_ASSERT_DELTA(key.m_Rotation.m_V.Z, expected.m_Rotation.m_V.Z, 0.0001f);
+				TS_ASSERT_DELTA(key.m_Rotation.m_W, expected.m_Rotation.m_W, 0.0001f);
+			}
+		}
+	}
+
+	void test_shared_matches_exact()
+	{
+		std::vector<CSkeletonAnimDef::Key> keys;
+		MakeKeys(5, keys);
+
+		CSkeletonAnimDef anim;
+		anim.m_FrameTime = 100.f;
+		anim.SetKeys(5, 3, &keys[0]);
+
+		CMatrix3D exact[3], shared[3];
+		for (int loop = 0; loop < 2; ++loop)
+		{
+			// Times on a step boundary give exactly the same pose, whether
+			// or not they were already cached
+			for (int pass = 0; pass < 2; ++pass)
+			{
+				for (float t = 0.f; t < anim.GetDuration(); t += 25.f)
+				{
+					anim.BuildBoneMatrices(t, exact, loop != 0);
+					anim.BuildBoneMatricesShared(t, shared, loop != 0);
+					CheckMatrices(exact, shared, anim.m_NumKeys);
+				}
+			}
+
+			// Times between steps are rounded down
+			anim.BuildBoneMatrices(475.f, exact, loop != 0);
+			anim.BuildBoneMatricesShared(490.f, shared, loop != 0);
+			CheckMatrices(exact, shared, anim.m_NumKeys);
+
+			// Later cycles share the first cycle's poses
+			anim.BuildBoneMatrices(125.f, exact, loop != 0);
+			anim.BuildBoneMatricesShared(625.f, shared, loop != 0);
+			CheckMatrices(exact, shared, anim.m_NumKeys);
+		}
+	}
+};
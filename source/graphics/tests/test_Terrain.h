@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -145,6 +145,34 @@ public:
 		}
 	}
 
+	void test_GetExactGroundLevels()
+	{
+		CTerrain terrain;
+		terrain.Initialize(4, NULL);
+		Set45Slope(terrain);
+		SetHighPlateau(terrain, 20);
+
+		// Include points off the edges of the map, which get clamped
+		const size_t count = 200;
+		std::vector<float> x(count), z(count), heights(count);
+		std::vector<fixed> xFixed(count), zFixed(count), heightsFixed(count);
+		for (size_t n = 0; n < count; ++n)
+		{
+			x[n] = (float)((n * 37) % 83) - 8.f;
+			z[n] = (float)((n * 61) % 79) * 0.9f - 6.f;
+			xFixed[n] = fixed::FromFloat(x[n]);
+			zFixed[n] = fixed::FromFloat(z[n]);
+		}
+
+		terrain.GetExactGroundLevels(count, &x[0], &z[0], &heights[0]);
+		terrain.GetExactGroundLevelsFixed(count, &xFixed[0], &zFixed[0], &heightsFixed[0]);
+		for (size_t n = 0; n < count; ++n)
+		{
+			TS_ASSERT_EQUALS(heights[n], terrain.GetExactGroundLevel(x[n], z[n]));
+			TS_ASSERT_EQUALS(heightsFixed[n], terrain.GetExactGroundLevelFixed(xFixed[n], zFixed[n]));
+		}
+	}
+
 	void test_CalcNormal()
 	{
 		CTerrain terrain;
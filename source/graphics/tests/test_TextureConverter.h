@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -23,6 +23,7 @@
 #include "lib/file/vfs/vfs.h"
 #include "lib/res/h_mgr.h"
 #include "lib/tex/tex.h"
+#include "lib/tex/tex_etc.h"
 #include "ps/XML/Xeromyces.h"
 
 class TestTextureConverter : public CxxTest::TestSuite
@@ -98,6 +99,47 @@ public:
 //			printf("%02x ", texdata[i]);
 //		}
 
+		tex_free(&tex);
+	}
+	void test_convert_etc()
+	{
+		VfsPath src = L"art/textures/b/test.png";
+
+		CTextureConverter converter(m_VFS, false);
+		CTextureConverter::Settings settings = converter.ComputeSettings(L"", std::vector<CTextureConverter::SettingsFile*>());
+		settings.format = CTextureConverter::FMT_ETC2;
+		TS_ASSERT(converter.ConvertTexture(CTexturePtr(), src, L"cache/test.png", settings));
+
+		VfsPath dest;
+		for (size_t i = 0; i < 100; ++i)
+		{
+			CTexturePtr texture;
+			bool ok;
+			if (converter.Poll(texture, dest, ok))
+			{
+				TS_ASSERT(ok);
+				break;
+			}
+			SDL_Delay(10);
+		}
+
+		shared_ptr<u8> file;
+		size_t fileSize = 0;
+		TS_ASSERT_OK(m_VFS->LoadFile(dest, file, fileSize));
+
+		Tex tex;
+		TS_ASSERT_OK(tex_decode(file, fileSize, &tex));
+		TS_ASSERT(tex_is_etc(tex.flags));
+		TS_ASSERT(tex.flags & TEX_MIPMAPS);
+
+		TS_ASSERT_OK(tex_transform_to(&tex, (tex.flags | TEX_BGR | TEX_ALPHA) & ~(TEX_DXT | TEX_MIPMAPS)));
+
+		u8* texdata = tex_get_data(&tex);
+
+		// As above, the compressed texture should repeat after 4 pixels
+		TS_ASSERT_EQUALS(texdata[0*4], texdata[4*4]);
+		TS_ASSERT_EQUALS(texdata[8*4], texdata[12*4]);
+
 		tex_free(&tex);
 	}
 };
@@ -39,6 +39,7 @@ CGUI
 #include "CProgressBar.h"
 #include "CTooltip.h"
 #include "MiniMap.h"
+#include "GUIFileCache.h"
 #include "scripting/JSInterface_GUITypes.h"
 
 #include "graphics/ShaderManager.h"
@@ -295,9 +296,36 @@ InReaction CGUI::HandleEvent(const SDL_Event_* ev)
 
 void CGUI::TickObjects()
 {
-	CStr action = "tick";
-	GUI<CStr>::RecurseObject(0, m_BaseObject, 
-							&IGUIObject::ScriptEvent, action);
+	UpdateObjectLists();
+
+	// (Handlers can change the lists, but they'll only be rebuilt on the next call,
+	// so this doesn't make the iterators invalid)
+	static const CStr strTick("tick");
+	for (size_t i = 0; i < m_TickObjects.size(); ++i)
+	{
+		PROFILE3("gui tick");
+		PROFILE2_ATTR("object: %s", m_TickObjects[i]->GetName().c_str());
+		m_TickObjects[i]->ScriptEvent(strTick);
+	}
+
+	static const CStr strTimer("timer");
+	static const CStr strTimerInterval("timer_interval");
+	double time = timer_Time();
+	for (size_t i = 0; i < m_TimerObjects.size(); ++i)
+	{
+		IGUIObject* pObject = m_TimerObjects[i];
+
+		int interval = 0;
+		GUI<int>::GetSetting(pObject, strTimerInterval, interval);
+		if (time - pObject->m_LastTimerTime < interval / 1000.0)
+			continue;
+
+		pObject->m_LastTimerTime = time;
+
+		PROFILE3("gui timer");
+		PROFILE2_ATTR("object: %s", pObject->GetName().c_str());
+		pObject->ScriptEvent(strTimer);
+	}
 
 	// Also update tooltips:
 	m_Tooltip.Update(FindObjectUnderMouse(), m_MousePos, this);
@@ -389,7 +417,7 @@ static JSClass page_global_class = {
 	NULL, NULL, NULL, NULL
 };
 
-CGUI::CGUI() : m_MouseButtons(0), m_FocusedObject(NULL), m_InternalNameNumber(0)
+CGUI::CGUI() : m_MouseButtons(0), m_FocusedObject(NULL), m_ObjectListsDirty(true), m_InternalNameNumber(0), m_FileCache(NULL)
 {
 	m_BaseObject = new CGUIDummyObject;
 	m_BaseObject->SetGUI(this);
@@ -452,16 +480,21 @@ void CGUI::Draw()
 	// drawn on top of everything else
 	glClear(GL_DEPTH_BUFFER_BIT);
 
+	UpdateObjectLists();
+
 	try
 	{
-		// Recurse IGUIObject::Draw() with restriction: hidden
-		//  meaning all hidden objects won't call Draw (nor will it recurse its children)
-		GUI<>::RecurseObject(GUIRR_HIDDEN, m_BaseObject, &IGUIObject::Draw);
+		// Hidden objects (and their children) aren't in the list, so they won't be drawn
+		for (size_t i = 0; i < m_DrawObjects.size(); ++i)
+			m_DrawObjects[i]->Draw();
 	}
 	catch (PSERROR_GUI& e)
 	{
 		LOGERROR(L"GUI draw error: %hs", e.what());
 	}
+
+	// Draw the sprites that are still queued
+	GUIRenderer::Flush();
 }
 
 void CGUI::DrawSprite(const CGUISpriteInstance& Sprite,
@@ -506,6 +539,10 @@ void CGUI::Destroy()
 
 	// Clear all
 	m_pAllObjects.clear();
+	m_DrawObjects.clear();
+	m_TickObjects.clear();
+	m_TimerObjects.clear();
+	InvalidateObjectLists();
 	m_Sprites.clear();
 	m_Icons.clear();
 }
@@ -558,6 +595,44 @@ void CGUI::UpdateObjects()
 
 	// Else actually update the real one
 	m_pAllObjects.swap(AllObjects);
+
+	InvalidateObjectLists();
+}
+
+void CGUI::AddToObjectLists(IGUIObject* pObject)
+{
+	static const CStr strHidden("hidden");
+	static const CStr strTick("tick");
+	static const CStr strTimer("timer");
+
+	bool hidden = true;
+	GUI<bool>::GetSetting(pObject, strHidden, hidden);
+	if (hidden)
+		return;
+
+	m_DrawObjects.push_back(pObject);
+
+	if (pObject->HasScriptHandler(strTick))
+		m_TickObjects.push_back(pObject);
+
+	if (pObject->HasScriptHandler(strTimer))
+		m_TimerObjects.push_back(pObject);
+
+	for (vector_pObjects::iterator it = pObject->ChildrenItBegin(); it != pObject->ChildrenItEnd(); ++it)
+		AddToObjectLists(*it);
+}
+
+void CGUI::UpdateObjectLists()
+{
+	if (!m_ObjectListsDirty)
+		return;
+
+	m_DrawObjects.clear();
+	m_TickObjects.clear();
+	m_TimerObjects.clear();
+	AddToObjectLists(m_BaseObject);
+
+	m_ObjectListsDirty = false;
 }
 
 bool CGUI::ObjectExists(const CStr& Name) const
@@ -941,6 +1016,9 @@ SGUIText CGUI::GenerateText(const CGUIString &string,
 void CGUI::DrawText(SGUIText &Text, const CColor &DefaultColor, 
 					const CPos &pos, const float &z, const CRect &clipping)
 {
+	// Draw the queued sprites first, since the text goes on top of them
+	GUIRenderer::Flush();
+
 	CShaderTechniquePtr tech = g_Renderer.GetShaderManager().LoadEffect("gui_text");
 
 	tech->BeginPass();
@@ -1004,11 +1082,21 @@ void CGUI::LoadXmlFile(const VfsPath& Filename, boost::unordered_set<VfsPath>& P
 {
 	Paths.insert(Filename);
 
-	CXeromyces XeroFile;
-	if (XeroFile.Load(g_VFS, Filename) != PSRETURN_OK)
+	shared_ptr<CXeromyces> xero;
+	if (m_FileCache)
+		xero = m_FileCache->LoadXMB(Filename);
+	else
+	{
+		xero.reset(new CXeromyces);
+		if (xero->Load(g_VFS, Filename) != PSRETURN_OK)
+			xero.reset();
+	}
+
+	if (!xero)
 		// Fail silently
 		return;
 
+	CXeromyces& XeroFile = *xero;
 	XMBElement node = XeroFile.GetRoot();
 
 	// Check root element's (node) name so we know what kind of
@@ -1424,7 +1512,15 @@ void CGUI::Xeromyces_ReadScript(XMBElement Element, CXeromyces* pFile, boost::un
 		Paths.insert(file);
 		try
 		{
-			g_ScriptingHost.RunScript(file, m_ScriptObject);
+			if (m_FileCache)
+			{
+				shared_ptr<utf16string> script = m_FileCache->LoadScript(file);
+				if (!script)
+					throw PSERROR_Scripting_LoadFile_OpenFailed();
+				g_ScriptingHost.RunUCScript(*script, file, m_ScriptObject);
+			}
+			else
+				g_ScriptingHost.RunScript(file, m_ScriptObject);
 		}
 		catch (PSERROR_Scripting& e)
 		{
@@ -88,6 +88,7 @@ class CGUISprite;
 struct SGUIImageEffects;
 struct SGUIScrollBarStyle;
 class GUITooltip;
+class CGUIFileCache;
 
 /**
  * The main object that represents a whole GUI page.
@@ -120,7 +121,9 @@ public:
 	
 	/**
 	 * Performs processing that should happen every frame
-	 * (including sending the "Tick" event to scripts)
+	 * (including sending the "Tick" event to scripts).
+	 * The "Tick" event is sent every frame and the "Timer" event every
+	 * "timer_interval" milliseconds, but only to objects that are visible.
 	 */
 	void TickObjects();
 
@@ -186,6 +189,12 @@ public:
 	 */
 	void LoadXmlFile(const VfsPath& Filename, boost::unordered_set<VfsPath>& Paths);
 
+	/**
+	 * Use the given cache (which must outlive this GUI) to load XML and script
+	 * files, instead of loading them directly.
+	 */
+	void SetFileCache(CGUIFileCache* cache) { m_FileCache = cache; }
+
 	/**
 	 * Checks if object exists and return true or false accordingly
 	 *
@@ -314,6 +323,17 @@ private:
 	 */
 	IGUIObject *ConstructObject(const CStr& str);
 
+	/**
+	 * Rebuilds m_DrawObjects and m_TickObjects from the object tree,
+	 * if they've been invalidated since they were last built.
+	 */
+	void UpdateObjectLists();
+
+	/**
+	 * Adds the object and its visible descendants to the object lists.
+	 */
+	void AddToObjectLists(IGUIObject* pObject);
+
 	/**
 	 * Get Focused Object.
 	 */
@@ -327,6 +347,12 @@ public:
 	 */
 	void SetFocusedObject(IGUIObject* pObject);
 
+	/**
+	 * Must be called when an object's "hidden" setting or its script handlers
+	 * change, so that the lists of objects to draw and tick get rebuilt.
+	 */
+	void InvalidateObjectLists() { m_ObjectListsDirty = true; }
+
 private:
 	//--------------------------------------------------------
 	/** @name XML Reading Xeromyces specific subroutines
@@ -639,6 +665,19 @@ private:
 	 */
 	map_pObjects m_pAllObjects;
 
+	/**
+	 * The objects that are visible (i.e. neither they nor any of their
+	 * ancestors are hidden), in drawing order, and the visible objects that
+	 * have a "tick" or "timer" script handler.
+	 * (This is an optimisation to avoid recursing over the whole GUI tree
+	 * and checking every object's settings each frame, when the visibility
+	 * and handlers rarely change.)
+	 */
+	std::vector<IGUIObject*> m_DrawObjects;
+	std::vector<IGUIObject*> m_TickObjects;
+	std::vector<IGUIObject*> m_TimerObjects;
+	bool m_ObjectListsDirty;
+
 	/**
 	 * Number of object that has been given name automatically.
 	 * the name given will be '__internal(#)', the number (#)
@@ -647,6 +686,9 @@ private:
 	 */
 	int m_InternalNameNumber;
 
+	// Shared cache of the files loaded by GUI pages, or NULL
+	CGUIFileCache* m_FileCache;
+
 	/**
 	 * Function pointers to functions that constructs
 	 * IGUIObjects by name... For instance m_ObjectTypes["button"]
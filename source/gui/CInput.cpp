@@ -1102,6 +1102,9 @@ void CInput::Draw()
 		float h = (float)font.GetHeight();
 		float ls = (float)font.GetLineSpacing();
 
+		// Draw the queued sprites first, since the text goes on top of them
+		GUIRenderer::Flush();
+
 		CShaderTechniquePtr tech = g_Renderer.GetShaderManager().LoadEffect("gui_text");
 		
 		CTextRenderer textRenderer(tech->GetShader());
@@ -0,0 +1,65 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "GUIFileCache.h"
+
+#include "lib/utf8.h"
+#include "ps/Filesystem.h"
+#include "ps/XML/Xeromyces.h"
+
+shared_ptr<CXeromyces> CGUIFileCache::LoadXMB(const VfsPath& path)
+{
+	boost::unordered_map<VfsPath, shared_ptr<CXeromyces> >::iterator it = m_XMBs.find(path);
+	if (it != m_XMBs.end())
+		return it->second;
+
+	shared_ptr<CXeromyces> xero(new CXeromyces);
+	if (xero->Load(g_VFS, path) != PSRETURN_OK)
+		return shared_ptr<CXeromyces>(); // don't cache failures, so they can be fixed by hotloading
+
+	m_XMBs[path] = xero;
+	return xero;
+}
+
+shared_ptr<utf16string> CGUIFileCache::LoadScript(const VfsPath& path)
+{
+	boost::unordered_map<VfsPath, shared_ptr<utf16string> >::iterator it = m_Scripts.find(path);
+	if (it != m_Scripts.end())
+		return it->second;
+
+	shared_ptr<u8> buf;
+	size_t size;
+	if (g_VFS->LoadFile(path, buf, size) != INFO::OK)
+		return shared_ptr<utf16string>();
+
+	std::wstring scriptw = wstring_from_utf8(std::string(buf.get(), buf.get() + size));
+	shared_ptr<utf16string> script(new utf16string(scriptw.begin(), scriptw.end()));
+
+	m_Scripts[path] = script;
+	return script;
+}
+
+void CGUIFileCache::Invalidate(const std::vector<VfsPath>& paths)
+{
+	for (size_t i = 0; i < paths.size(); ++i)
+	{
+		m_XMBs.erase(paths[i]);
+		m_Scripts.erase(paths[i]);
+	}
+}
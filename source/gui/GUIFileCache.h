@@ -0,0 +1,66 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_GUIFILECACHE
+#define INCLUDED_GUIFILECACHE
+
+#include "lib/file/vfs/vfs_path.h"
+#include "ps/utf16string.h"
+
+#include <boost/unordered_map.hpp>
+
+class CXeromyces;
+
+/**
+ * Cache of the parsed XML files and script sources used by GUI pages, shared
+ * by all pages, so that pages which are opened repeatedly (dialogs like the
+ * options page, the summary screen or the in-game menu) don't have to read
+ * and decode their files from the VFS every time.
+ *
+ * (The scripts still have to be compiled each time, since each page runs
+ * them in its own global object.)
+ */
+class CGUIFileCache
+{
+	NONCOPYABLE(CGUIFileCache);
+public:
+	CGUIFileCache() { }
+
+	/**
+	 * Returns the given XML file, loading it if it's not already cached,
+	 * or an empty pointer on error (which Xeromyces will have reported).
+	 */
+	shared_ptr<CXeromyces> LoadXMB(const VfsPath& path);
+
+	/**
+	 * Returns the UTF-16 source of the given script file, loading it if it's not
+	 * already cached, or an empty pointer if the file couldn't be read.
+	 */
+	shared_ptr<utf16string> LoadScript(const VfsPath& path);
+
+	/**
+	 * Forget the cached copies of the given files, so they'll be loaded again
+	 * (for hotloading). Must be called before the pages using them are reloaded.
+	 */
+	void Invalidate(const std::vector<VfsPath>& paths);
+
+private:
+	boost::unordered_map<VfsPath, shared_ptr<CXeromyces> > m_XMBs;
+	boost::unordered_map<VfsPath, shared_ptr<utf16string> > m_Scripts;
+};
+
+#endif // INCLUDED_GUIFILECACHE
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -116,14 +116,16 @@ void CGUIManager::LoadPage(SGUIPage& page)
 	page.inputs.clear();
 	page.gui.reset(new CGUI());
 	page.gui->Initialize();
+	page.gui->SetFileCache(&m_FileCache);
 
 	VfsPath path = VfsPath("gui") / page.name;
 	page.inputs.insert(path);
 
-	CXeromyces xero;
-	if (xero.Load(g_VFS, path) != PSRETURN_OK)
+	shared_ptr<CXeromyces> xeroFile = m_FileCache.LoadXMB(path);
+	if (!xeroFile)
 		// Fail silently (Xeromyces reported the error)
 		return;
+	CXeromyces& xero = *xeroFile;
 
 	int elmt_page = xero.GetElementID("page");
 	int elmt_include = xero.GetElementID("include");
@@ -169,15 +171,21 @@ void CGUIManager::LoadPage(SGUIPage& page)
 	m_CurrentGUI = oldGUI;
 }
 
-Status CGUIManager::ReloadChangedFiles(const VfsPath& path)
+Status CGUIManager::ReloadChangedFiles(const std::vector<VfsPath>& paths)
 {
+	m_FileCache.Invalidate(paths);
+
 	for (PageStackType::iterator it = m_PageStack.begin(); it != m_PageStack.end(); ++it)
 	{
-		if (it->inputs.count(path))
+		for (size_t i = 0; i < paths.size(); ++i)
 		{
-			LOGMESSAGE(L"GUI file '%ls' changed - reloading page '%ls'", path.string().c_str(), it->name.c_str());
-			LoadPage(*it);
-			// TODO: this can crash if LoadPage runs an init script which modifies the page stack and breaks our iterators
+			if (it->inputs.count(paths[i]))
+			{
+				LOGMESSAGE(L"GUI file '%ls' changed - reloading page '%ls'", paths[i].string().c_str(), it->name.c_str());
+				LoadPage(*it);
+				// TODO: this can crash if LoadPage runs an init script which modifies the page stack and breaks our iterators
+				break;
+			}
 		}
 	}
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,6 +20,7 @@
 
 #include <boost/unordered_set.hpp>
 
+#include "gui/GUIFileCache.h"
 #include "lib/input.h"
 #include "lib/file/vfs/vfs_path.h"
 #include "ps/CStr.h"
@@ -80,9 +81,10 @@ public:
 	void DisplayMessageBox(int width, int height, const CStrW& title, const CStrW& message);
 
 	/**
-	 * Call when a file has bee modified, to hotload pages if their .xml files changed.
+	 * Call when files have been modified, to hotload pages if their .xml files changed.
+	 * (Each page is reloaded at most once, however many of its files changed.)
 	 */
-	Status ReloadChangedFiles(const VfsPath& path);
+	Status ReloadChangedFiles(const std::vector<VfsPath>& paths);
 
 	/**
 	 * Pass input events to the currently active GUI page.
@@ -161,6 +163,10 @@ private:
 	shared_ptr<CGUI> m_CurrentGUI; // used to latch state during TickObjects/LoadPage (this is kind of ugly)
 
 	ScriptInterface& m_ScriptInterface;
+
+	// Files loaded by any page, so they don't need loading again when the page
+	// (or another one using them) is opened again
+	CGUIFileCache m_FileCache;
 };
 
 extern CGUIManager* g_GUI;
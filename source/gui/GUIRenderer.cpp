@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -328,15 +328,54 @@ CRect SDrawCall::ComputeTexCoords() const
 	return TexCoords;
 }
 
-void GUIRenderer::Draw(DrawCalls &Calls, float Z)
+/**
+ * Quads that can be drawn with a single draw call.
+ */
+struct SBatch
 {
-	// Called every frame, to draw the object (based on cached calculations)
+	CShaderTechniquePtr m_Shader;
+	bool m_HasTexture;
+	CTexturePtr m_Texture;
+	CColor m_Color;
+	bool m_EnableBlending;
 
-	// TODO: batching by shader/texture/etc would be nice
+	// Interleaved UV (if textured) and XYZ, for GL_TRIANGLES
+	std::vector<float> m_Vertices;
+};
 
-	CMatrix3D matrix = GetDefaultGuiMatrix();
+static SBatch g_Batch;
 
-	glDisable(GL_BLEND);
+/**
+ * Prepares g_Batch for a quad with the given state, drawing the old batch first
+ * if the state differs.
+ */
+static void BeginQuad(const CShaderTechniquePtr& shader, bool hasTexture, const CTexturePtr& texture, const CColor& color, bool enableBlending)
+{
+	if (!g_Batch.m_Vertices.empty() &&
+		g_Batch.m_Shader == shader &&
+		g_Batch.m_HasTexture == hasTexture &&
+		g_Batch.m_Texture == texture &&
+		g_Batch.m_Color == color &&
+		g_Batch.m_EnableBlending == enableBlending)
+	{
+		return;
+	}
+
+	GUIRenderer::Flush();
+
+	g_Batch.m_Shader = shader;
+	g_Batch.m_HasTexture = hasTexture;
+	g_Batch.m_Texture = texture;
+	g_Batch.m_Color = color;
+	g_Batch.m_EnableBlending = enableBlending;
+}
+
+void GUIRenderer::Flush()
+{
+	if (g_Batch.m_Vertices.empty())
+		return;
+
+	CMatrix3D matrix = GetDefaultGuiMatrix();
 
 	// Set LOD bias so mipmapped textures are prettier
 #if CONFIG2_GLES
@@ -345,40 +384,96 @@ void GUIRenderer::Draw(DrawCalls &Calls, float Z)
 	glTexEnvf(GL_TEXTURE_FILTER_CONTROL, GL_TEXTURE_LOD_BIAS, -1.f);
 #endif
 
-	// Iterate through each DrawCall, and execute whatever drawing code is being called
-	for (DrawCalls::const_iterator cit = Calls.begin(); cit != Calls.end(); ++cit)
+	g_Batch.m_Shader->BeginPass();
+	CShaderProgramPtr shader = g_Batch.m_Shader->GetShader();
+	shader->Uniform("transform", matrix);
+	shader->Uniform("color", g_Batch.m_Color);
+
+	if (g_Batch.m_EnableBlending)
+	{
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glEnable(GL_BLEND);
+	}
+
+	std::vector<float>& data = g_Batch.m_Vertices;
+	if (g_Batch.m_HasTexture)
 	{
-		cit->m_Shader->BeginPass();
-		CShaderProgramPtr shader = cit->m_Shader->GetShader();
-		shader->Uniform("transform", matrix);
+		shader->BindTexture("tex", g_Batch.m_Texture);
+		shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, 5*sizeof(float), &data[0]);
+		shader->VertexPointer(3, GL_FLOAT, 5*sizeof(float), &data[2]);
+		glDrawArrays(GL_TRIANGLES, 0, (GLsizei)(data.size() / 5));
+	}
+	else
+	{
+		shader->VertexPointer(3, GL_FLOAT, 3*sizeof(float), &data[0]);
+		glDrawArrays(GL_TRIANGLES, 0, (GLsizei)(data.size() / 3));
+	}
+
+	g_Batch.m_Shader->EndPass();
+
+	glDisable(GL_BLEND);
+
+#if CONFIG2_GLES
+#warning TODO: implement GUI LOD bias for GLES
+#else
+	glTexEnvf(GL_TEXTURE_FILTER_CONTROL, GL_TEXTURE_LOD_BIAS, 0.f);
+#endif
+
+	// Don't keep the texture alive, but keep the capacity of the vertex array
+	g_Batch.m_Vertices.clear();
+	g_Batch.m_Shader.reset();
+	g_Batch.m_Texture.reset();
+}
+
+void GUIRenderer::Draw(DrawCalls &Calls, float Z)
+{
+	// Called every frame, to draw the object (based on cached calculations)
+
+	// Iterate through each DrawCall, and add its quad to the current batch
+	for (DrawCalls::iterator cit = Calls.begin(); cit != Calls.end(); ++cit)
+	{
+		std::vector<float>& data = g_Batch.m_Vertices;
 
 		if (cit->m_HasTexture)
 		{
-			shader->Uniform("color", cit->m_ShaderColorParameter);
-			shader->BindTexture("tex", cit->m_Texture);
-
-			if (cit->m_EnableBlending || cit->m_Texture->HasAlpha()) // (shouldn't call HasAlpha before BindTexture)
+			// (GetHandle starts loading the texture, so call it before HasAlpha)
+			Handle handle = cit->m_Texture->GetHandle();
+
+			// The texture coordinates depend on the texture's size, which is only
+			// known once it's loaded, so recompute the quad whenever that changes
+			size_t texWidth = cit->m_Texture->GetWidth();
+			size_t texHeight = cit->m_Texture->GetHeight();
+			if (handle != cit->m_CachedHandle || texWidth != cit->m_CachedTexWidth || texHeight != cit->m_CachedTexHeight)
 			{
-				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-				glEnable(GL_BLEND);
+				cit->m_CachedHandle = handle;
+				cit->m_CachedTexWidth = texWidth;
+				cit->m_CachedTexHeight = texHeight;
+				cit->m_CachedEnableBlending = (cit->m_EnableBlending || cit->m_Texture->HasAlpha());
+
+				CRect TexCoords = cit->ComputeTexCoords();
+
+				// Ensure the quad has the correct winding order, and update texcoords to match
+				CRect Verts = cit->m_Vertices;
+				if (Verts.right < Verts.left)
+				{
+					std::swap(Verts.right, Verts.left);
+					std::swap(TexCoords.right, TexCoords.left);
+				}
+				if (Verts.bottom < Verts.top)
+				{
+					std::swap(Verts.bottom, Verts.top);
+					std::swap(TexCoords.bottom, TexCoords.top);
+				}
+
+				cit->m_CachedTexCoords = TexCoords;
+				cit->m_CachedVertices = Verts;
 			}
 
-			CRect TexCoords = cit->ComputeTexCoords();
+			BeginQuad(cit->m_Shader, true, cit->m_Texture, cit->m_ShaderColorParameter, cit->m_CachedEnableBlending);
 
-			// Ensure the quad has the correct winding order, and update texcoords to match
-			CRect Verts = cit->m_Vertices;
-			if (Verts.right < Verts.left)
-			{
-				std::swap(Verts.right, Verts.left);
-				std::swap(TexCoords.right, TexCoords.left);
-			}
-			if (Verts.bottom < Verts.top)
-			{
-				std::swap(Verts.bottom, Verts.top);
-				std::swap(TexCoords.bottom, TexCoords.top);
-			}
+			const CRect& TexCoords = cit->m_CachedTexCoords;
+			const CRect& Verts = cit->m_CachedVertices;
 
-			std::vector<float> data;
 #define ADD(u, v, x, y, z) STMT(data.push_back(u); data.push_back(v); data.push_back(x); data.push_back(y); data.push_back(z))
 			ADD(TexCoords.left, TexCoords.bottom, Verts.left, Verts.bottom, Z + cit->m_DeltaZ);
 			ADD(TexCoords.right, TexCoords.bottom, Verts.right, Verts.bottom, Z + cit->m_DeltaZ);
@@ -388,20 +483,10 @@ void GUIRenderer::Draw(DrawCalls &Calls, float Z)
 			ADD(TexCoords.left, TexCoords.top, Verts.left, Verts.top, Z + cit->m_DeltaZ);
 			ADD(TexCoords.left, TexCoords.bottom, Verts.left, Verts.bottom, Z + cit->m_DeltaZ);
 #undef ADD
-
-			shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, 5*sizeof(float), &data[0]);
-			shader->VertexPointer(3, GL_FLOAT, 5*sizeof(float), &data[2]);
-			glDrawArrays(GL_TRIANGLES, 0, 6);
 		}
 		else
 		{
-			shader->Uniform("color", cit->m_BackColor);
-
-			if (cit->m_EnableBlending)
-			{
-				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-				glEnable(GL_BLEND);
-			}
+			BeginQuad(cit->m_Shader, false, CTexturePtr(), cit->m_BackColor, cit->m_EnableBlending);
 
 			// Ensure the quad has the correct winding order
 			CRect Verts = cit->m_Vertices;
@@ -410,7 +495,6 @@ void GUIRenderer::Draw(DrawCalls &Calls, float Z)
 			if (Verts.bottom < Verts.top)
 				std::swap(Verts.bottom, Verts.top);
 
-			std::vector<float> data;
 #define ADD(x, y, z) STMT(data.push_back(x); data.push_back(y); data.push_back(z))
 			ADD(Verts.left, Verts.bottom, Z + cit->m_DeltaZ);
 			ADD(Verts.right, Verts.bottom, Z + cit->m_DeltaZ);
@@ -420,33 +504,32 @@ void GUIRenderer::Draw(DrawCalls &Calls, float Z)
 			ADD(Verts.left, Verts.top, Z + cit->m_DeltaZ);
 			ADD(Verts.left, Verts.bottom, Z + cit->m_DeltaZ);
 
-			shader->VertexPointer(3, GL_FLOAT, 3*sizeof(float), &data[0]);
-			glDrawArrays(GL_TRIANGLES, 0, 6);
-
 			if (cit->m_BorderColor != CColor())
 			{
+				// Borders are drawn as line loops, so they can't be batched
+				CShaderTechniquePtr tech = cit->m_Shader;
+				Flush();
+
+				tech->BeginPass();
+				CShaderProgramPtr shader = tech->GetShader();
+				shader->Uniform("transform", GetDefaultGuiMatrix());
 				shader->Uniform("color", cit->m_BorderColor);
 
-				data.clear();
-				ADD(Verts.left + 0.5f, Verts.top + 0.5f, Z + cit->m_DeltaZ);
-				ADD(Verts.right - 0.5f, Verts.top + 0.5f, Z + cit->m_DeltaZ);
-				ADD(Verts.right - 0.5f, Verts.bottom - 0.5f, Z + cit->m_DeltaZ);
-				ADD(Verts.left + 0.5f, Verts.bottom - 0.5f, Z + cit->m_DeltaZ);
+				std::vector<float> border;
+				border.reserve(12);
+#define ADD_BORDER(x, y, z) STMT(border.push_back(x); border.push_back(y); border.push_back(z))
+				ADD_BORDER(Verts.left + 0.5f, Verts.top + 0.5f, Z + cit->m_DeltaZ);
+				ADD_BORDER(Verts.right - 0.5f, Verts.top + 0.5f, Z + cit->m_DeltaZ);
+				ADD_BORDER(Verts.right - 0.5f, Verts.bottom - 0.5f, Z + cit->m_DeltaZ);
+				ADD_BORDER(Verts.left + 0.5f, Verts.bottom - 0.5f, Z + cit->m_DeltaZ);
+#undef ADD_BORDER
 
-				shader->VertexPointer(3, GL_FLOAT, 3*sizeof(float), &data[0]);
+				shader->VertexPointer(3, GL_FLOAT, 3*sizeof(float), &border[0]);
 				glDrawArrays(GL_LINE_LOOP, 0, 4);
+
+				tech->EndPass();
 			}
 #undef ADD
 		}
-		
-		cit->m_Shader->EndPass();
-
-		glDisable(GL_BLEND);
 	}
-
-#if CONFIG2_GLES
-#warning TODO: implement GUI LOD bias for GLES
-#else
-	glTexEnvf(GL_TEXTURE_FILTER_CONTROL, GL_TEXTURE_LOD_BIAS, 0.f);
-#endif
 }
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -40,7 +40,7 @@ namespace GUIRenderer
 
 	struct SDrawCall
 	{
-		SDrawCall(const SGUIImage* image) : m_Image(image) {}
+		SDrawCall(const SGUIImage* image) : m_Image(image), m_CachedHandle(0), m_CachedTexWidth(SIZE_MAX), m_CachedTexHeight(SIZE_MAX) {}
 		CRect ComputeTexCoords() const;
 
 		const SGUIImage* m_Image;
@@ -61,6 +61,14 @@ namespace GUIRenderer
 
 		CColor m_BorderColor; // == CColor() for no border
 		CColor m_BackColor;
+
+		// Quad for textured calls, computed by Draw and reused every frame until
+		// the texture's handle or size changes (e.g. when it has finished loading)
+		Handle m_CachedHandle;
+		size_t m_CachedTexWidth, m_CachedTexHeight;
+		bool m_CachedEnableBlending;
+		CRect m_CachedTexCoords;
+		CRect m_CachedVertices;
 	};
 
 	class DrawCalls : public std::vector<SDrawCall>
@@ -79,7 +87,18 @@ namespace GUIRenderer
 {
 	void UpdateDrawCallCache(DrawCalls &Calls, const CStr& SpriteName, const CRect& Size, int CellID, std::map<CStr, CGUISprite> &Sprites);
 
+	/**
+	 * Queues the draw calls for rendering. Consecutive quads that share the same
+	 * shader, texture, colour and blending (from the same sprite or not) are
+	 * collected into a single vertex array and drawn together by Flush.
+	 */
 	void Draw(DrawCalls &Calls, float Z);
+
+	/**
+	 * Draws any queued quads. This must be called before anything else is drawn
+	 * on top of them (e.g. text), and at the end of the GUI rendering.
+	 */
+	void Flush();
 }
 
 #endif // GUIRenderer_h
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -398,6 +398,10 @@ PSRETURN GUI<T>::SetSetting(IGUIObject *pObject, const CStr& Setting,
 		// Hiding an object requires us to reset it and all children
 		if (IsBoolTrue(Value))
 			QueryResetting(pObject);
+
+		// The cached list of visible objects has to be rebuilt
+		if (pObject->GetGUI())
+			pObject->GetGUI()->InvalidateObjectLists();
 	}
 
 	if (!SkipMessage)
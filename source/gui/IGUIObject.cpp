@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -43,6 +43,7 @@ extern int g_xres, g_yres;
 IGUIObject::IGUIObject() : 
 	m_pGUI(NULL), 
 	m_pParent(NULL),
+	m_LastTimerTime(0.0),
 	m_MouseHovering(false),
 	m_JSObject(NULL)
 {
@@ -55,13 +56,14 @@ IGUIObject::IGUIObject() :
 	AddSetting(GUIST_bool,			"absolute");
 	AddSetting(GUIST_bool,			"ghost");
 	AddSetting(GUIST_float,			"aspectratio");
+	AddSetting(GUIST_int,			"timer_interval");
 
 	// Setup important defaults
 	GUI<bool>::SetSetting(this, "hidden", false);
 	GUI<bool>::SetSetting(this, "ghost", false);
 	GUI<bool>::SetSetting(this, "enabled", true);
 	GUI<bool>::SetSetting(this, "absolute", true);
-
+	GUI<int>::SetSetting(this, "timer_interval", 100);
 
 	for (int i=0; i<6; i++)
 		m_LastClickTime[i]=0;
@@ -461,6 +463,9 @@ void IGUIObject::SetScriptHandler(const CStr& Action, JSObject* Function)
 		delete m_ScriptHandlers[Action];
 	}
 	m_ScriptHandlers[Action] = obj;
+
+	if (m_pGUI)
+		m_pGUI->InvalidateObjectLists();
 }
 
 InReaction IGUIObject::SendEvent(EGUIMessageType type, const CStr& EventName)
@@ -484,8 +489,8 @@ void IGUIObject::ScriptEvent(const CStr& Action)
 		return;
 
 	// Set up the 'mouse' parameter
-	CScriptVal mouse;
-	g_ScriptingHost.GetScriptInterface().Eval("({})", mouse);
+	// (Created directly rather than by evaluating "({})", since this is called for every tick)
+	CScriptVal mouse = OBJECT_TO_JSVAL(JS_NewObject(g_ScriptingHost.getContext(), NULL, NULL, NULL));
 	g_ScriptingHost.GetScriptInterface().SetProperty(mouse.get(), "x", m_pGUI->m_MousePos.x, false);
 	g_ScriptingHost.GetScriptInterface().SetProperty(mouse.get(), "y", m_pGUI->m_MousePos.y, false);
 	g_ScriptingHost.GetScriptInterface().SetProperty(mouse.get(), "buttons", m_pGUI->m_MouseButtons, false);
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -147,6 +147,7 @@ class IGUIObject
 	// Allow getProperty to access things like GetParent()
 	friend JSBool JSI_IGUIObject::getProperty(JSContext* cx, JSObject* obj, jsid id, jsval* vp);
 	friend JSBool JSI_IGUIObject::setProperty(JSContext* cx, JSObject* obj, jsid id, JSBool strict, jsval* vp);
+	friend JSBool JSI_IGUIObject::setPropertyValue(JSContext* cx, IGUIObject* e, const std::string& propName, jsval* vp, bool skipUnchanged);
 	friend JSBool JSI_IGUIObject::getComputedSize(JSContext* cx, uintN argc, jsval* vp);
 
 public:
@@ -462,6 +463,11 @@ protected:
 
 	void SetScriptHandler(const CStr& Action, JSObject* Function);
 
+	/**
+	 * Returns whether a script has been registered for the action.
+	 */
+	bool HasScriptHandler(const CStr& Action) const { return m_ScriptHandlers.find(Action) != m_ScriptHandlers.end(); }
+
 	/**
 	 * Inputes the object that is currently hovered, this function
 	 * updates this object accordingly (i.e. if it's the object
@@ -521,6 +527,9 @@ protected:
 	//This represents the last click time for each mouse button
 	double m_LastClickTime[6];
 
+	// Time when the "timer" script handler was last run
+	double m_LastTimerTime;
+
 	/**
 	 * This is an array of true or false, each element is associated with
 	 * a string representing a setting. Number of elements is equal to
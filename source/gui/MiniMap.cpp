@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -40,6 +40,7 @@
 #include "scriptinterface/ScriptInterface.h"
 #include "simulation2/Simulation2.h"
 #include "simulation2/components/ICmpMinimap.h"
+#include "simulation2/components/ICmpTerrain.h"
 #include "simulation2/system/ParamNode.h"
 
 bool g_GameRestarted = false;
@@ -53,7 +54,9 @@ static unsigned int ScaleColor(unsigned int color, float x)
 }
 
 CMiniMap::CMiniMap() :
-	m_TerrainTexture(0), m_TerrainData(0), m_MapSize(0), m_Terrain(0), m_TerrainDirty(true), m_MapScale(1.f)
+	m_Terrain(0), m_TerrainTexture(0), m_TerrainData(0), m_TerrainDirty(true),
+	m_TerrainDirtyID(0), m_WaterHeight(0.f), m_UnitsDirtyID(0), m_UnitsPlayer(INVALID_PLAYER), m_UnitsScaleX(0.f), m_UnitsScaleY(0.f),
+	m_MapSize(0), m_MapScale(1.f)
 {
 	AddSetting(GUIST_CColor,	"fov_wedge_color");
 	AddSetting(GUIST_CStrW,		"tooltip");
@@ -250,12 +253,6 @@ void CMiniMap::DrawViewRect()
 	glLineWidth(1.0f);
 }
 
-struct MinimapUnitVertex
-{
-	u8 r, g, b, a;
-	float x, y;
-};
-
 void CMiniMap::DrawTexture(float coordMax, float angle, float x, float y, float x2, float y2, float z)
 {
 	// Rotate the texture coordinates (0,0)-(coordMax,coordMax) around their center point (m,m)
@@ -285,6 +282,9 @@ void CMiniMap::Draw()
 	if(!(GetGUI() && g_Game && g_Game->IsGameStarted()))
 		return;
 
+	// Draw any queued sprites first, since they might be under the minimap
+	GUIRenderer::Flush();
+
 	CSimulation2* sim = g_Game->GetSimulation2();
 	CmpPtr<ICmpRangeManager> cmpRangeManager(*sim, SYSTEM_ENTITY);
 	ENSURE(cmpRangeManager);
@@ -302,9 +302,15 @@ void CMiniMap::Draw()
 		CreateTextures();
 
 
+	// Rebuild the terrain texture if the terrain or water has been edited (e.g. in Atlas)
+	CmpPtr<ICmpTerrain> cmpTerrain(*sim, SYSTEM_ENTITY);
+	if (cmpTerrain && cmpTerrain->NeedUpdate(&m_TerrainDirtyID))
+		m_TerrainDirty = true;
+	if (g_Renderer.GetWaterManager()->m_WaterHeight != m_WaterHeight)
+		m_TerrainDirty = true;
+
 	// only update 2x / second
-	// (note: since units only move a few pixels per second on the minimap,
-	// we can get away with infrequent updates; this is slow)
+	// (note: this is slow, and is repeated while terrain textures are still loading)
 	static double last_time;
 	const double cur_time = timer_Time();
 	if(cur_time - last_time > 0.5)
@@ -451,28 +457,13 @@ void CMiniMap::Draw()
 	float sx = (float)m_Width / ((m_MapSize - 1) * TERRAIN_TILE_SIZE);
 	float sy = (float)m_Height / ((m_MapSize - 1) * TERRAIN_TILE_SIZE);
 
-	CSimulation2::InterfaceList ents = sim->GetEntitiesWithInterface(IID_Minimap);
-
-	std::vector<MinimapUnitVertex> vertexArray;
-	vertexArray.reserve(ents.size());
+	// The markers only depend on the simulation state, so keep drawing the same
+	// ones until something has moved, changed owner or changed visibility
+	if (cmpRangeManager->NeedVisibilityUpdate(&m_UnitsDirtyID) || g_Game->GetPlayerID() != m_UnitsPlayer ||
+		sx != m_UnitsScaleX || sy != m_UnitsScaleY)
+		RebuildUnitVertices(sx, sy);
 
-	for (CSimulation2::InterfaceList::const_iterator it = ents.begin(); it != ents.end(); ++it)
-	{
-		MinimapUnitVertex v;
-		ICmpMinimap* cmpMinimap = static_cast<ICmpMinimap*>(it->second);
-		entity_pos_t posX, posZ;
-		if (cmpMinimap->GetRenderData(v.r, v.g, v.b, posX, posZ))
-		{
-			ICmpRangeManager::ELosVisibility vis = cmpRangeManager->GetLosVisibility(it->first, g_Game->GetPlayerID());
-			if (vis != ICmpRangeManager::VIS_HIDDEN)
-			{
-				v.a = 255;
-				v.x = posX.ToFloat()*sx;
-				v.y = -posZ.ToFloat()*sy;
-				vertexArray.push_back(v);
-			}
-		}
-	}
+	std::vector<MinimapUnitVertex>& vertexArray = m_UnitVertices;
 
 	if (!vertexArray.empty())
 	{
@@ -531,10 +522,49 @@ void CMiniMap::Draw()
 
 #endif // CONFIG2_GLES
 
+void CMiniMap::RebuildUnitVertices(float sx, float sy)
+{
+	PROFILE3("rebuild minimap units");
+
+	CSimulation2* sim = g_Game->GetSimulation2();
+	CmpPtr<ICmpRangeManager> cmpRangeManager(*sim, SYSTEM_ENTITY);
+	player_id_t player = g_Game->GetPlayerID();
+
+	m_UnitsPlayer = player;
+	m_UnitsScaleX = sx;
+	m_UnitsScaleY = sy;
+	m_UnitVertices.clear();
+
+	CSimulation2::InterfaceList ents = sim->GetEntitiesWithInterface(IID_Minimap);
+	m_UnitVertices.reserve(ents.size());
+
+	for (CSimulation2::InterfaceList::const_iterator it = ents.begin(); it != ents.end(); ++it)
+	{
+		MinimapUnitVertex v;
+		ICmpMinimap* cmpMinimap = static_cast<ICmpMinimap*>(it->second);
+		entity_pos_t posX, posZ;
+		if (cmpMinimap->GetRenderData(v.r, v.g, v.b, posX, posZ))
+		{
+			ICmpRangeManager::ELosVisibility vis = cmpRangeManager->GetLosVisibility(it->first, player);
+			if (vis != ICmpRangeManager::VIS_HIDDEN)
+			{
+				v.a = 255;
+				v.x = posX.ToFloat()*sx;
+				v.y = -posZ.ToFloat()*sy;
+				m_UnitVertices.push_back(v);
+			}
+		}
+	}
+}
+
 void CMiniMap::CreateTextures()
 {
 	Destroy();
 
+	// Make sure everything is recomputed for the new game
+	m_UnitsDirtyID = 0;
+	m_TerrainDirtyID = 0;
+
 	// Create terrain texture
 	glGenTextures(1, &m_TerrainTexture);
 	g_Renderer.BindTexture(0, m_TerrainTexture);
@@ -567,6 +597,7 @@ void CMiniMap::RebuildTerrainTexture()
 	float waterHeight = g_Renderer.GetWaterManager()->m_WaterHeight;
 
 	m_TerrainDirty = false;
+	m_WaterHeight = waterHeight;
 
 	for(u32 j = 0; j < h; j++)
 	{
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -19,10 +19,17 @@
 #define INCLUDED_MINIMAP
 
 #include "gui/GUI.h"
+#include "simulation2/helpers/Player.h"
 
 class CCamera;
 class CTerrain;
 
+struct MinimapUnitVertex
+{
+	u8 r, g, b, a;
+	float x, y;
+};
+
 class CMiniMap : public IGUIObject
 {
 	GUI_OBJECT(CMiniMap)
@@ -43,6 +50,9 @@ protected:
 	// rebuild the terrain texture map
 	void RebuildTerrainTexture();
 
+	// recompute the unit markers, with the given world-to-minimap scales
+	void RebuildUnitVertices(float sx, float sy);
+
 	// destroy and free any memory and textures
 	void Destroy();
 
@@ -67,6 +77,16 @@ protected:
 	// whether we need to regenerate the terrain texture
 	bool m_TerrainDirty;
 
+	// ICmpTerrain::NeedUpdate state, and the water height the texture was built with
+	size_t m_TerrainDirtyID;
+	float m_WaterHeight;
+
+	// unit markers, only recomputed when units have moved or changed owner or visibility
+	std::vector<MinimapUnitVertex> m_UnitVertices;
+	size_t m_UnitsDirtyID; // ICmpRangeManager::NeedVisibilityUpdate state
+	player_id_t m_UnitsPlayer;
+	float m_UnitsScaleX, m_UnitsScaleY;
+
 	ssize_t m_Width, m_Height;
 
 	// map size
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -50,6 +50,7 @@ JSFunctionSpec JSI_IGUIObject::JSI_methods[] =
 	{ "focus", JSI_IGUIObject::focus, 0, 0 },
 	{ "blur", JSI_IGUIObject::blur, 0, 0 },
 	{ "getComputedSize", JSI_IGUIObject::getComputedSize, 0, 0 },
+	{ "setProperties", JSI_IGUIObject::setProperties, 1, 0 },
 	{ 0 }
 };
 
@@ -293,20 +294,40 @@ JSBool JSI_IGUIObject::getProperty(JSContext* cx, JSObject* obj, jsid id, jsval*
 	}
 }
 
-JSBool JSI_IGUIObject::setProperty(JSContext* cx, JSObject* obj, jsid id, JSBool UNUSED(strict), jsval* vp)
+// Sets the setting, unless skipUnchanged and it already has the given value
+// (in which case there's no need to send the update message)
+template<typename T>
+static void SetSettingIfChanged(IGUIObject* e, const CStr& propName, const T& value, bool skipUnchanged)
 {
-	IGUIObject* e = (IGUIObject*)JS_GetInstancePrivate(cx, obj, &JSI_IGUIObject::JSI_class, NULL);
-	if (!e)
-		return JS_FALSE;
-
-	jsval idval;
-	if (!JS_IdToValue(cx, id, &idval))
-		return JS_FALSE;
+	if (skipUnchanged)
+	{
+		T oldValue;
+		if (GUI<T>::GetSetting(e, propName, oldValue) == PSRETURN_OK && oldValue == value)
+			return;
+	}
+	GUI<T>::SetSetting(e, propName, value);
+}
 
-	std::string propName;
-	if (!ScriptInterface::FromJSVal(cx, idval, propName))
-		return JS_FALSE;
+template<>
+void SetSettingIfChanged<CClientArea>(IGUIObject* e, const CStr& propName, const CClientArea& value, bool skipUnchanged)
+{
+	if (skipUnchanged)
+	{
+		CClientArea oldValue;
+		if (GUI<CClientArea>::GetSetting(e, propName, oldValue) == PSRETURN_OK &&
+			oldValue.pixel == value.pixel && oldValue.percent == value.percent)
+			return;
+	}
+	GUI<CClientArea>::SetSetting(e, propName, value);
+}
 
+/**
+ * Converts *vp and sets it as the given property of the object.
+ * @param skipUnchanged if true, settings that already have the (converted) value
+ *  aren't set again, so the object doesn't have to handle an update message
+ */
+JSBool JSI_IGUIObject::setPropertyValue(JSContext* cx, IGUIObject* e, const std::string& propName, jsval* vp, bool skipUnchanged)
+{
 	if (propName == "name")
 	{
 		std::string value;
@@ -348,7 +369,7 @@ JSBool JSI_IGUIObject::setProperty(JSContext* cx, JSObject* obj, jsid id, JSBool
 			if (!ScriptInterface::FromJSVal(cx, *vp, value))
 				return JS_FALSE;
 
-			GUI<CStr>::SetSetting(e, propName, value);
+			SetSettingIfChanged<CStr>(e, propName, value, skipUnchanged);
 			break;
 		}
 
@@ -358,7 +379,7 @@ JSBool JSI_IGUIObject::setProperty(JSContext* cx, JSObject* obj, jsid id, JSBool
 			if (!ScriptInterface::FromJSVal(cx, *vp, value))
 				return JS_FALSE;
 
-			GUI<CStrW>::SetSetting(e, propName, value);
+			SetSettingIfChanged<CStrW>(e, propName, value, skipUnchanged);
 			break;
 		}
 
@@ -378,6 +399,13 @@ JSBool JSI_IGUIObject::setProperty(JSContext* cx, JSObject* obj, jsid id, JSBool
 			if (!ScriptInterface::FromJSVal(cx, *vp, value))
 				return JS_FALSE;
 
+			if (skipUnchanged)
+			{
+				CGUIString oldValue;
+				if (GUI<CGUIString>::GetSetting(e, propName, oldValue) == PSRETURN_OK && oldValue.GetOriginalString() == value)
+					break;
+			}
+
 			CGUIString str;
 			str.SetValue(value);
 			GUI<CGUIString>::SetSetting(e, propName, str);
@@ -399,7 +427,7 @@ JSBool JSI_IGUIObject::setProperty(JSContext* cx, JSObject* obj, jsid id, JSBool
 				JS_ReportError(cx, "Invalid alignment (should be 'left', 'right' or 'center')");
 				return JS_FALSE;
 			}
-			GUI<EAlign>::SetSetting(e, propName, a);
+			SetSettingIfChanged(e, propName, a, skipUnchanged);
 			break;
 		}
 
@@ -418,7 +446,7 @@ JSBool JSI_IGUIObject::setProperty(JSContext* cx, JSObject* obj, jsid id, JSBool
 				JS_ReportError(cx, "Invalid alignment (should be 'top', 'bottom' or 'center')");
 				return JS_FALSE;
 			}
-			GUI<EVAlign>::SetSetting(e, propName, a);
+			SetSettingIfChanged(e, propName, a, skipUnchanged);
 			break;
 		}
 
@@ -426,7 +454,7 @@ JSBool JSI_IGUIObject::setProperty(JSContext* cx, JSObject* obj, jsid id, JSBool
 		{
 			int32 value;
 			if (JS_ValueToInt32(cx, *vp, &value) == JS_TRUE)
-				GUI<int>::SetSetting(e, propName, value);
+				SetSettingIfChanged<int>(e, propName, value, skipUnchanged);
 			else
 			{
 				JS_ReportError(cx, "Cannot convert value to int");
@@ -439,7 +467,7 @@ JSBool JSI_IGUIObject::setProperty(JSContext* cx, JSObject* obj, jsid id, JSBool
 		{
 			jsdouble value;
 			if (JS_ValueToNumber(cx, *vp, &value) == JS_TRUE)
-				GUI<float>::SetSetting(e, propName, (float)value);
+				SetSettingIfChanged(e, propName, (float)value, skipUnchanged);
 			else
 			{
 				JS_ReportError(cx, "Cannot convert value to float");
@@ -452,7 +480,7 @@ JSBool JSI_IGUIObject::setProperty(JSContext* cx, JSObject* obj, jsid id, JSBool
 		{
 			JSBool value;
 			if (JS_ValueToBoolean(cx, *vp, &value) == JS_TRUE)
-				GUI<bool>::SetSetting(e, propName, value == JS_TRUE);
+				SetSettingIfChanged(e, propName, value == JS_TRUE, skipUnchanged);
 			else
 			{
 				JS_ReportError(cx, "Cannot convert value to bool");
@@ -492,7 +520,7 @@ JSBool JSI_IGUIObject::setProperty(JSContext* cx, JSObject* obj, jsid id, JSBool
 					P(percent,	bottom,	rbottom);
 				#undef P
 
-				GUI<CClientArea>::SetSetting(e, propName, area);
+				SetSettingIfChanged(e, propName, area, skipUnchanged);
 			}
 			else
 			{
@@ -527,7 +555,7 @@ JSBool JSI_IGUIObject::setProperty(JSContext* cx, JSObject* obj, jsid id, JSBool
 				PROP(r); PROP(g); PROP(b); PROP(a);
 				#undef PROP
 
-				GUI<CColor>::SetSetting(e, propName, colour);
+				SetSettingIfChanged(e, propName, colour, skipUnchanged);
 			}
 			else
 			{
@@ -585,6 +613,65 @@ JSBool JSI_IGUIObject::setProperty(JSContext* cx, JSObject* obj, jsid id, JSBool
 }
 
 
+JSBool JSI_IGUIObject::setProperty(JSContext* cx, JSObject* obj, jsid id, JSBool UNUSED(strict), jsval* vp)
+{
+	IGUIObject* e = (IGUIObject*)JS_GetInstancePrivate(cx, obj, &JSI_IGUIObject::JSI_class, NULL);
+	if (!e)
+		return JS_FALSE;
+
+	jsval idval;
+	if (!JS_IdToValue(cx, id, &idval))
+		return JS_FALSE;
+
+	std::string propName;
+	if (!ScriptInterface::FromJSVal(cx, idval, propName))
+		return JS_FALSE;
+
+	return setPropertyValue(cx, e, propName, vp, false);
+}
+
+/**
+ * Sets all the properties of the given object, e.g.
+ * obj.setProperties({ caption: "...", hidden: false }), in a single call.
+ * Unlike setting them one at a time, settings which already have the given
+ * value are skipped, so scripts can set the whole state of an object every
+ * tick without the cost of updating it when nothing has changed.
+ */
+JSBool JSI_IGUIObject::setProperties(JSContext* cx, uintN argc, jsval* vp)
+{
+	IGUIObject* e = (IGUIObject*)JS_GetInstancePrivate(cx, JS_THIS_OBJECT(cx, vp), &JSI_IGUIObject::JSI_class, NULL);
+	if (!e)
+		return JS_FALSE;
+
+	if (argc < 1 || !JSVAL_IS_OBJECT(JS_ARGV(cx, vp)[0]) || JSVAL_IS_NULL(JS_ARGV(cx, vp)[0]))
+	{
+		JS_ReportError(cx, "setProperties requires an object");
+		return JS_FALSE;
+	}
+
+	JSObject* props = JSVAL_TO_OBJECT(JS_ARGV(cx, vp)[0]);
+	AutoJSIdArray ida (cx, JS_Enumerate(cx, props));
+	if (!ida.get())
+		return JS_FALSE;
+
+	for (size_t i = 0; i < ida.length(); ++i)
+	{
+		jsval idval, value;
+		if (!JS_IdToValue(cx, ida[i], &idval) || !JS_GetPropertyById(cx, props, ida[i], &value))
+			return JS_FALSE;
+
+		std::string propName;
+		if (!ScriptInterface::FromJSVal(cx, idval, propName))
+			return JS_FALSE;
+
+		if (!setPropertyValue(cx, e, propName, &value, true))
+			return JS_FALSE;
+	}
+
+	JS_SET_RVAL(cx, vp, JSVAL_VOID);
+	return JS_TRUE;
+}
+
 JSBool JSI_IGUIObject::construct(JSContext* cx, uintN argc, jsval* vp)
 {
 	if (argc == 0)
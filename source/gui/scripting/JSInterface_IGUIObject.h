@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,6 +20,8 @@
 #ifndef INCLUDED_JSI_IGUIOBJECT
 #define INCLUDED_JSI_IGUIOBJECT
 
+class IGUIObject;
+
 namespace JSI_IGUIObject
 {
 	extern JSClass JSI_class;
@@ -32,6 +34,8 @@ namespace JSI_IGUIObject
 	JSBool focus(JSContext* cx, uintN argc, jsval* vp);
 	JSBool blur(JSContext* cx, uintN argc, jsval* vp);
 	JSBool getComputedSize(JSContext* cx, uintN argc, jsval* vp);
+	JSBool setProperties(JSContext* cx, uintN argc, jsval* vp);
+	JSBool setPropertyValue(JSContext* cx, IGUIObject* e, const std::string& propName, jsval* vp, bool skipUnchanged);
 	void init();
 }
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -21,6 +21,7 @@
 
 #include "graphics/Camera.h"
 #include "graphics/GameView.h"
+#include "graphics/MapGenerator.h"
 #include "graphics/MapReader.h"
 #include "gui/GUIManager.h"
 #include "lib/timer.h"
@@ -222,6 +223,24 @@ void StartGame(void* cbdata, CScriptVal attribs, int playerID)
 	g_Game->StartGame(gameAttribs, "");
 }
 
+void PregenerateRandomMap(void* cbdata, std::wstring scriptFile, CScriptVal settings)
+{
+	CGUIManager* guiManager = static_cast<CGUIManager*> (cbdata);
+
+	// This must match the script path and settings that CMapReader will use
+	// when the game starts, else the map will just be generated again
+	VfsPath scriptPath;
+	if (!scriptFile.empty())
+		scriptPath = L"maps/random/" + scriptFile;
+
+	CMapGenerator::Pregenerate(scriptPath, guiManager->GetScriptInterface().StringifyJSON(settings.get()));
+}
+
+void DiscardPregeneratedMap(void* UNUSED(cbdata))
+{
+	CMapGenerator::DiscardPregenerated(false);
+}
+
 CScriptVal StartSavedGame(void* cbdata, std::wstring name)
 {
 	CGUIManager* guiManager = static_cast<CGUIManager*> (cbdata);
@@ -631,6 +650,8 @@ void GuiScriptingInit(ScriptInterface& scriptInterface)
 	// Network / game setup functions
 	scriptInterface.RegisterFunction<void, &StartNetworkGame>("StartNetworkGame");
 	scriptInterface.RegisterFunction<void, CScriptVal, int, &StartGame>("StartGame");
+	scriptInterface.RegisterFunction<void, std::wstring, CScriptVal, &PregenerateRandomMap>("PregenerateRandomMap");
+	scriptInterface.RegisterFunction<void, &DiscardPregeneratedMap>("DiscardPregeneratedMap");
 	scriptInterface.RegisterFunction<void, std::wstring, &StartNetworkHost>("StartNetworkHost");
 	scriptInterface.RegisterFunction<void, std::wstring, std::string, &StartNetworkJoin>("StartNetworkJoin");
 	scriptInterface.RegisterFunction<void, &DisconnectNetworkGame>("DisconnectNetworkGame");
@@ -1,4 +1,4 @@
-/* Copyright (c) 2011 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -154,6 +154,13 @@ FUNC2(bool, glUnmapBufferARB, glUnmapBuffer, "1.5", (int target))
 FUNC2(void, glGetBufferParameterivARB, glGetBufferParameteriv, "1.5", (int target, int pname, int* params))
 FUNC2(void, glGetBufferPointervARB, glGetBufferPointerv, "1.5", (int target, int pname, void** params))
 
+// GL_ARB_map_buffer_range / GL3.0:
+FUNC2(void*, glMapBufferRange, glMapBufferRange, "3.0", (GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access))
+
+// GL_EXT_texture3D / GL1.2:
+FUNC2(void, glTexImage3DEXT, glTexImage3D, "1.2", (GLenum, GLint, GLint, GLsizei, GLsizei, GLsizei, GLint, GLenum, GLenum, const GLvoid*))
+FUNC2(void, glTexSubImage3DEXT, glTexSubImage3D, "1.2", (GLenum, GLint, GLint, GLint, GLint, GLsizei, GLsizei, GLsizei, GLenum, GLenum, const GLvoid*))
+
 // GL_ARB_texture_compression / GL1.3
 FUNC2(void, glCompressedTexImage3DARB, glCompressedTexImage3D, "1.3", (GLenum, GLint, GLenum, GLsizei, GLsizei, GLsizei, GLint, GLsizei, const GLvoid*))
 FUNC2(void, glCompressedTexImage2DARB, glCompressedTexImage2D, "1.3", (GLenum, GLint, GLenum, GLsizei, GLsizei, GLint, GLsizei, const GLvoid*))
@@ -339,6 +346,12 @@ FUNC2(void, glGetUniformuivEXT, glGetUniformuiv, "3.0", (GLuint program, GLint l
 FUNC2(void, glBindFragDataLocationEXT, glBindFragDataLocation, "3.0", (GLuint program, GLuint colorNumber, const char *name))
 FUNC2(GLint, glGetFragDataLocationEXT, glGetFragDataLocation, "3.0", (GLuint program, const char *name))
 
+// GL_ARB_draw_instanced / GL3.1:
+FUNC2(void, glDrawElementsInstancedARB, glDrawElementsInstanced, "3.1", (GLenum mode, GLsizei count, GLenum type, const GLvoid *indices, GLsizei primcount))
+
+// GL_ARB_instanced_arrays / GL3.3:
+FUNC2(void, glVertexAttribDivisorARB, glVertexAttribDivisor, "3.3", (GLuint index, GLuint divisor))
+
 // GL_ARB_occlusion_query / GL1.5:
 FUNC2(void, glGenQueriesARB, glGenQueries, "1.5", (GLsizei n, GLuint *ids))
 FUNC2(void, glDeleteQueriesARB, glDeleteQueries, "1.5", (GLsizei n, const GLuint *ids))
@@ -356,6 +369,11 @@ FUNC2(void, glGetInteger64v, glGetInteger64v, "3.2", (GLenum pname, GLint64 *par
 FUNC(void, glGetQueryObjecti64vEXT, (GLuint id, GLenum pname, GLint64 *params))
 FUNC(void, glGetQueryObjectui64vEXT, (GLuint id, GLenum pname, GLuint64 *params))
 
+// GL_ARB_get_program_binary / GL4.1:
+FUNC2(void, glGetProgramBinary, glGetProgramBinary, "4.1", (GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, GLvoid *binary))
+FUNC2(void, glProgramBinary, glProgramBinary, "4.1", (GLuint program, GLenum binaryFormat, const GLvoid *binary, GLsizei length))
+FUNC2(void, glProgramParameteri, glProgramParameteri, "4.1", (GLuint program, GLenum pname, GLint value))
+
 // GL_ARB_timer_query / GL3.3:
 FUNC2(void, glQueryCounter, glQueryCounter, "3.3", (GLuint id, GLenum target))
 FUNC2(void, glGetQueryObjecti64v, glGetQueryObjecti64v, "3.3", (GLuint id, GLenum pname, GLint64 *params))
@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -33,9 +33,13 @@
 #include "lib/utf8.h"
 #include "lib/bits.h"
 #include "lib/byte_order.h"
+#include "lib/alignment.h"
 #include "lib/allocators/pool.h"
+#include "lib/posix/posix_mman.h"
+#include "lib/posix/posix_pthread.h"
 #include "lib/sysdep/filesystem.h"
 #include "lib/file/archive/archive.h"
+#include "lib/file/archive/codec_lz4.h"
 #include "lib/file/archive/codec_zlib.h"
 #include "lib/file/archive/stream.h"
 #include "lib/file/file.h"
@@ -101,7 +105,10 @@ static const u32 ecdr_magic = FOURCC_LE('P','K','\5','\6');
 enum ZipMethod
 {
 	ZIP_METHOD_NONE    = 0,
-	ZIP_METHOD_DEFLATE = 8
+	ZIP_METHOD_DEFLATE = 8,
+	// (not part of the Zip specification, so other programs can't extract
+	// these entries; the value is outside the range reserved by PKWARE)
+	ZIP_METHOD_LZ4     = 0x4C34
 };
 
 #pragma pack(push, 1)
@@ -289,6 +296,17 @@ cassert(sizeof(ECDR) == 22);
 // ArchiveFile_Zip
 //-----------------------------------------------------------------------------
 
+// the entries of an archive share its file descriptor, whose position is
+// changed by synchronous reads, so those (and the LFH fixups) must not
+// happen concurrently. decompression is done without holding the lock.
+static pthread_mutex_t archiveReadMutex = PTHREAD_MUTEX_INITIALIZER;
+
+struct ScopedArchiveReadLock
+{
+	ScopedArchiveReadLock() { pthread_mutex_lock(&archiveReadMutex); }
+	~ScopedArchiveReadLock() { pthread_mutex_unlock(&archiveReadMutex); }
+};
+
 class ArchiveFile_Zip : public IArchiveFile
 {
 public:
@@ -316,8 +334,6 @@ public:
 
 	virtual Status Load(const OsPath& UNUSED(name), const shared_ptr<u8>& buf, size_t size) const
 	{
-		AdjustOffset();
-
 		PICodec codec;
 		switch(m_method)
 		{
@@ -327,15 +343,36 @@ public:
 		case ZIP_METHOD_DEFLATE:
 			codec = CreateDecompressor_ZLibDeflate();
 			break;
+		case ZIP_METHOD_LZ4:
+			codec = CreateDecompressor_LZ4();
+			break;
 		default:
 			WARN_RETURN(ERR::ARCHIVE_UNKNOWN_METHOD);
 		}
 
 		Stream stream(codec);
 		stream.SetOutputBuffer(buf.get(), size);
-		io::Operation op(*m_file.get(), 0, m_csize, m_ofs);
-		StreamFeeder streamFeeder(stream);
-		RETURN_STATUS_IF_ERR(io::Run(op, io::Parameters(), streamFeeder));
+		if(m_method == ZIP_METHOD_NONE)
+		{
+			ScopedArchiveReadLock lock;
+			AdjustOffset();
+			io::Operation op(*m_file.get(), 0, m_csize, m_ofs);
+			StreamFeeder streamFeeder(stream);
+			RETURN_STATUS_IF_ERR(io::Run(op, io::Parameters(), streamFeeder));
+		}
+		else
+		{
+			// read the compressed data first, so that other threads can
+			// read from the archive while this one decompresses it.
+			UniqueRange cdata(RVALUE(io::Allocate(size_t(m_csize))));
+			{
+				ScopedArchiveReadLock lock;
+				AdjustOffset();
+				io::Operation op(*m_file.get(), cdata.get(), m_csize, m_ofs);
+				RETURN_STATUS_IF_ERR(io::Run(op));
+			}
+			RETURN_STATUS_IF_ERR(stream.Feed((const u8*)cdata.get(), size_t(m_csize)));
+		}
 		RETURN_STATUS_IF_ERR(stream.Finish());
 #if CODEC_COMPUTE_CHECKSUM
 		ENSURE(m_checksum == stream.Checksum());
@@ -344,7 +381,55 @@ public:
 		return INFO::OK;
 	}
 
+	virtual Status Map(const OsPath& UNUSED(name), shared_ptr<u8>& buf, size_t size) const
+	{
+		// only uncompressed entries can be used directly
+		if(m_method != ZIP_METHOD_NONE || off_t(size) != m_csize)
+			return INFO::SKIPPED;
+
+		{
+			ScopedArchiveReadLock lock;
+			AdjustOffset();
+		}
+
+#if !ARCH_X86_X64
+		// (the data might be read with unaligned accesses otherwise)
+		if(!IsAligned(m_ofs, 8))
+			return INFO::SKIPPED;
+#endif
+
+		// rationale: the view must start at a multiple of the allocation
+		// granularity (64 KiB on Windows); it's copy-on-write since callers
+		// may modify the contents (e.g. when transforming textures).
+		const off_t mapAlignment = 64*KiB;
+		const off_t mapOfs = m_ofs - (m_ofs % mapAlignment);
+		const size_t mapSize = size_t(m_ofs - mapOfs) + size;
+		errno = 0;
+		void* p = mmap(0, mapSize, PROT_READ|PROT_WRITE, MAP_PRIVATE, m_file->Descriptor(), mapOfs);
+		if(p == MAP_FAILED)
+			return INFO::SKIPPED;	// NOWARN (Load will read the file instead)
+
+		buf.reset((u8*)p + (m_ofs - mapOfs), MappingDeleter(p, mapSize));
+		return INFO::OK;
+	}
+
 private:
+	struct MappingDeleter
+	{
+		MappingDeleter(void* p, size_t size)
+			: p(p), size(size)
+		{
+		}
+
+		void operator()(u8* UNUSED(data)) const
+		{
+			(void)munmap(p, size);
+		}
+
+		void* p;
+		size_t size;
+	};
+
 	enum Flags
 	{
 		// indicates m_ofs points to a "local file header" instead of
@@ -397,6 +482,8 @@ private:
 	 * this is called at file-open time instead of while mounting to
 	 * reduce seeks: since reading the file will typically follow, the
 	 * block cache entirely absorbs the IO cost.
+	 *
+	 * must be called while holding the archive read lock.
 	 **/
 	void AdjustOffset() const
 	{
@@ -586,9 +673,9 @@ PIArchiveReader CreateArchiveReader_Zip(const OsPath& archivePathname)
 class ArchiveWriter_Zip : public IArchiveWriter
 {
 public:
-	ArchiveWriter_Zip(const OsPath& archivePathname, bool noDeflate)
+	ArchiveWriter_Zip(const OsPath& archivePathname, bool noDeflate, bool fastCompression)
 		: m_file(new File(archivePathname, O_WRONLY)), m_fileSize(0)
-		, m_numEntries(0), m_noDeflate(noDeflate)
+		, m_numEntries(0), m_noDeflate(noDeflate), m_fastCompression(fastCompression)
 	{
 		THROW_STATUS_IF_ERR(pool_create(&m_cdfhPool, 10*MiB, 0));
 	}
@@ -647,17 +734,19 @@ public:
 		const size_t pathnameLength = pathnameInArchive.string().length();
 
 		// choose method and the corresponding codec
-		ZipMethod method;
+		const ZipMethod method = ChooseMethod(pathnameInArchive);
 		PICodec codec;
-		if(m_noDeflate || IsFileTypeIncompressible(pathnameInArchive))
+		switch(method)
 		{
-			method = ZIP_METHOD_NONE;
+		case ZIP_METHOD_NONE:
 			codec = CreateCodec_ZLibNone();
-		}
-		else
-		{
-			method = ZIP_METHOD_DEFLATE;
+			break;
+		case ZIP_METHOD_LZ4:
+			codec = CreateCompressor_LZ4();
+			break;
+		default:
 			codec = CreateCompressor_ZLibDeflate();
+			break;
 		}
 
 		// allocate memory
@@ -712,6 +801,23 @@ public:
 	}
 
 private:
+	ZipMethod ChooseMethod(const OsPath& pathname) const
+	{
+		if(m_noDeflate || IsFileTypeIncompressible(pathname))
+			return ZIP_METHOD_NONE;
+
+		if(m_fastCompression)
+		{
+			// DDS textures are mostly S3TC blocks, which LZ4 barely shrinks;
+			// storing them allows the reader to map them instead.
+			if(pathname.Extension() == L".dds")
+				return ZIP_METHOD_NONE;
+			return ZIP_METHOD_LZ4;
+		}
+
+		return ZIP_METHOD_DEFLATE;
+	}
+
 	static bool IsFileTypeIncompressible(const OsPath& pathname)
 	{
 		const OsPath extension = pathname.Extension();
@@ -740,13 +846,14 @@ private:
 	size_t m_numEntries;
 
 	bool m_noDeflate;
+	bool m_fastCompression;
 };
 
-PIArchiveWriter CreateArchiveWriter_Zip(const OsPath& archivePathname, bool noDeflate)
+PIArchiveWriter CreateArchiveWriter_Zip(const OsPath& archivePathname, bool noDeflate, bool fastCompression)
 {
 	try
 	{
-		return PIArchiveWriter(new ArchiveWriter_Zip(archivePathname, noDeflate));
+		return PIArchiveWriter(new ArchiveWriter_Zip(archivePathname, noDeflate, fastCompression));
 	}
 	catch(Status)
 	{
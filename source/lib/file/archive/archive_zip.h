@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -35,8 +35,12 @@
 LIB_API PIArchiveReader CreateArchiveReader_Zip(const OsPath& archivePathname);
 
 /**
+ * @param noDeflate store all files uncompressed
+ * @param fastCompression compress with LZ4 instead of Deflate, and store
+ *   DDS textures uncompressed. the resulting archives load faster but
+ *   can only be extracted by CreateArchiveReader_Zip.
  * @return 0 if opening the archive failed (e.g. because an external program is holding on to it)
  **/
-LIB_API PIArchiveWriter CreateArchiveWriter_Zip(const OsPath& archivePathname, bool noDeflate);
+LIB_API PIArchiveWriter CreateArchiveWriter_Zip(const OsPath& archivePathname, bool noDeflate, bool fastCompression = false);
 
 #endif	// #ifndef INCLUDED_ARCHIVE_ZIP
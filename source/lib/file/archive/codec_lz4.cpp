@@ -0,0 +1,290 @@
+/* Copyright (c) 2013 Wildfire Games
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "precompiled.h"
+#include "lib/file/archive/codec_lz4.h"
+
+#include "lib/file/archive/codec.h"
+#include "lib/external_libraries/zlib.h"	// crc32
+
+
+// format (see lz4_format_description.txt in the reference implementation):
+// a block is a series of sequences, each consisting of a token byte
+// (literal length in the upper 4 bits, match length minus MIN_MATCH in
+// the lower 4 bits), optional further literal length bytes, the literals,
+// a 16-bit little-endian match offset and optional further match length
+// bytes. lengths of 15 are continued by bytes that are added to them,
+// until one is less than 255. the last sequence only has literals.
+static const size_t MIN_MATCH = 4;
+static const size_t LAST_LITERALS = 5;	// the last bytes are always literals
+static const size_t MF_LIMIT = 12;		// the last match must start before this many bytes from the end
+static const size_t MAX_OFFSET = 65535;
+
+static const size_t HASH_BITS = 12;
+
+static inline u32 Read32(const u8* p)
+{
+	u32 x;
+	memcpy(&x, p, sizeof(x));
+	return x;
+}
+
+static inline size_t Hash(u32 sequence)
+{
+	return (sequence * 2654435761u) >> (32-HASH_BITS);
+}
+
+static u8* WriteLength(u8* op, size_t length)
+{
+	for(; length >= 255; length -= 255)
+		*op++ = 255;
+	*op++ = (u8)length;
+	return op;
+}
+
+static u8* WriteLiterals(u8* op, const u8* literals, size_t length, u8 matchToken)
+{
+	*op++ = u8((std::min(length, size_t(15)) << 4) | matchToken);
+	if(length >= 15)
+		op = WriteLength(op, length-15);
+	memcpy(op, literals, length);
+	return op + length;
+}
+
+static Status ReadLength(const u8*& ip, const u8* end, size_t& length)
+{
+	u8 b;
+	do
+	{
+		if(ip == end)
+			WARN_RETURN(ERR::CORRUPTED);
+		b = *ip++;
+		length += b;
+	}
+	while(b == 255);
+	return INFO::OK;
+}
+
+
+class Codec_LZ4 : public ICodec
+{
+public:
+	Codec_LZ4()
+	{
+		Reset();
+	}
+
+	virtual Status Reset()
+	{
+		m_input.clear();
+		m_out = 0;
+		m_outSize = 0;
+		return INFO::OK;
+	}
+
+	virtual Status Process(const u8* in, size_t inSize, u8* out, size_t outSize, size_t& inConsumed, size_t& outProduced)
+	{
+		// nothing is produced until Finish, so the output position doesn't change
+		if(m_out)
+			ENSURE(out == m_out);
+		m_out = out;
+		m_outSize = outSize;
+
+		m_input.insert(m_input.end(), in, in+inSize);
+		inConsumed = inSize;
+		outProduced = 0;
+		return INFO::OK;
+	}
+
+	u32 UpdateChecksum(u32 checksum, const u8* in, size_t inSize) const
+	{
+#if CODEC_COMPUTE_CHECKSUM
+		// (CRC32 like Deflate, for consistency with the rest of the archive)
+		return (u32)crc32(checksum, in, (uInt)inSize);
+#else
+		UNUSED2(checksum);
+		UNUSED2(in);
+		UNUSED2(inSize);
+		return 0;
+#endif
+	}
+
+protected:
+	std::vector<u8> m_input;
+	u8* m_out;
+	size_t m_outSize;
+};
+
+
+//-----------------------------------------------------------------------------
+
+class Compressor_LZ4 : public Codec_LZ4
+{
+public:
+	virtual size_t MaxOutputSize(size_t inSize) const
+	{
+		// (incompressible data only needs the extra literal length bytes)
+		return inSize + inSize/255 + 16;
+	}
+
+	virtual Status Finish(u32& checksum, size_t& outProduced)
+	{
+		const u8* const in = m_input.empty()? 0 : &m_input[0];
+		const size_t inSize = m_input.size();
+		checksum = UpdateChecksum(0, in, inSize);
+
+		outProduced = 0;
+		if(!m_out)	// no input
+			return INFO::OK;
+		ENSURE(m_outSize >= MaxOutputSize(inSize));
+
+		u8* op = m_out;
+		size_t anchor = 0;	// start of the pending literals
+		if(inSize > MF_LIMIT)
+		{
+			// positions of the last occurrence of each hashed sequence.
+			// (stale or colliding entries are rejected by comparing the data)
+			memset(m_table, 0, sizeof(m_table));
+
+			const size_t matchLimit = inSize - LAST_LITERALS;
+			size_t ip = 0;
+			while(ip + MF_LIMIT <= inSize)
+			{
+				const u32 sequence = Read32(in+ip);
+				const size_t h = Hash(sequence);
+				const size_t ref = m_table[h];
+				m_table[h] = (u32)ip;
+				if(ref < ip && ip-ref <= MAX_OFFSET && Read32(in+ref) == sequence)
+				{
+					size_t length = MIN_MATCH;
+					while(ip+length < matchLimit && in[ref+length] == in[ip+length])
+						length++;
+
+					const size_t matchLength = length - MIN_MATCH;
+					op = WriteLiterals(op, in+anchor, ip-anchor, u8(std::min(matchLength, size_t(15))));
+					*op++ = u8(ip-ref);
+					*op++ = u8((ip-ref) >> 8);
+					if(matchLength >= 15)
+						op = WriteLength(op, matchLength-15);
+
+					ip += length;
+					anchor = ip;
+				}
+				else
+				{
+					// skip ahead faster in data that doesn't seem to compress
+					ip += 1 + ((ip-anchor) >> 6);
+				}
+			}
+		}
+
+		op = WriteLiterals(op, in+anchor, inSize-anchor, 0);
+		outProduced = size_t(op - m_out);
+		return INFO::OK;
+	}
+
+private:
+	u32 m_table[1u << HASH_BITS];
+};
+
+
+//-----------------------------------------------------------------------------
+
+class Decompressor_LZ4 : public Codec_LZ4
+{
+public:
+	virtual size_t MaxOutputSize(size_t inSize) const
+	{
+		// see the note in Decompressor_ZLib::MaxOutputSize
+		ENSURE(inSize < 1*MiB);
+
+		return inSize*255;	// one extra length byte can add 255 bytes of match
+	}
+
+	virtual Status Finish(u32& checksum, size_t& outProduced)
+	{
+		outProduced = 0;
+		checksum = UpdateChecksum(0, 0, 0);
+		if(m_input.empty())
+			return INFO::OK;
+
+		const u8* ip = &m_input[0];
+		const u8* const inEnd = ip + m_input.size();
+		u8* op = m_out;
+		u8* const outEnd = m_out + m_outSize;
+		for(;;)
+		{
+			if(ip == inEnd)	// (blocks can't end with a match)
+				WARN_RETURN(ERR::CORRUPTED);
+			const u8 token = *ip++;
+
+			size_t literalLength = token >> 4;
+			if(literalLength == 15)
+				RETURN_STATUS_IF_ERR(ReadLength(ip, inEnd, literalLength));
+			if(literalLength > size_t(inEnd-ip) || literalLength > size_t(outEnd-op))
+				WARN_RETURN(ERR::CORRUPTED);
+			memcpy(op, ip, literalLength);
+			ip += literalLength;
+			op += literalLength;
+
+			if(ip == inEnd)	// the last sequence has no match
+				break;
+
+			if(inEnd-ip < 2)
+				WARN_RETURN(ERR::CORRUPTED);
+			const size_t offset = size_t(ip[0]) | (size_t(ip[1]) << 8);
+			ip += 2;
+			if(offset == 0 || offset > size_t(op-m_out))
+				WARN_RETURN(ERR::CORRUPTED);
+
+			size_t matchLength = token & 15;
+			if(matchLength == 15)
+				RETURN_STATUS_IF_ERR(ReadLength(ip, inEnd, matchLength));
+			matchLength += MIN_MATCH;
+			if(matchLength > size_t(outEnd-op))
+				WARN_RETURN(ERR::CORRUPTED);
+
+			// (byte by byte, since the match may overlap the output)
+			const u8* match = op - offset;
+			for(size_t i = 0; i < matchLength; i++)
+				op[i] = match[i];
+			op += matchLength;
+		}
+
+		outProduced = size_t(op - m_out);
+		checksum = UpdateChecksum(0, m_out, outProduced);
+		return INFO::OK;
+	}
+};
+
+
+//-----------------------------------------------------------------------------
+
+PICodec CreateCompressor_LZ4()
+{
+	return PICodec(new Compressor_LZ4);
+}
+
+PICodec CreateDecompressor_LZ4()
+{
+	return PICodec(new Decompressor_LZ4);
+}
@@ -0,0 +1,40 @@
+/* Copyright (c) 2013 Wildfire Games
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef INCLUDED_CODEC_LZ4
+#define INCLUDED_CODEC_LZ4
+
+#include "lib/file/archive/codec.h"
+
+/**
+ * codecs for the LZ4 block format (http://code.google.com/p/lz4/).
+ * compression is considerably faster than Deflate and decompression is
+ * several times faster, at the cost of larger output.
+ *
+ * note: a block is only processed in Finish, so the entire input must be
+ * fed before then and the output buffer must be big enough for all of the
+ * output (the archive stores the uncompressed size, so that's the case).
+ **/
+extern PICodec CreateCompressor_LZ4();
+extern PICodec CreateDecompressor_LZ4();
+
+#endif // INCLUDED_CODEC_LZ4
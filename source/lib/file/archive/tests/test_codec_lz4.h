@@ -0,0 +1,95 @@
+/* Copyright (c) 2013 Wildfire Games
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "lib/self_test.h"
+
+#include "lib/file/archive/codec_lz4.h"
+
+class TestCodecLZ4 : public CxxTest::TestSuite
+{
+	void RoundTrip(const std::vector<u8>& udata, size_t chunkSize)
+	{
+		size_t inConsumed, outProduced;
+		u32 checksum, checksum2;
+
+		// compress (in chunks, like Stream does with file data)
+		PICodec c = CreateCompressor_LZ4();
+		std::vector<u8> cdata(c->MaxOutputSize(udata.size()));
+		for(size_t i = 0; i < udata.size(); i += chunkSize)
+		{
+			const size_t size = std::min(chunkSize, udata.size()-i);
+			TS_ASSERT_OK(c->Process(&udata[i], size, &cdata[0], cdata.size(), inConsumed, outProduced));
+			TS_ASSERT_EQUALS(inConsumed, size);
+		}
+		size_t csize;
+		TS_ASSERT_OK(c->Finish(checksum, csize));
+		TS_ASSERT_LESS_THAN_EQUALS(csize, cdata.size());
+
+		// decompress
+		PICodec d = CreateDecompressor_LZ4();
+		std::vector<u8> ddata(udata.size());
+		TS_ASSERT_OK(d->Process(&cdata[0], csize, &ddata[0], ddata.size(), inConsumed, outProduced));
+		TS_ASSERT_EQUALS(inConsumed, csize);
+		size_t dsize;
+		TS_ASSERT_OK(d->Finish(checksum2, dsize));
+		TS_ASSERT_EQUALS(dsize, udata.size());
+		TS_ASSERT_EQUALS(checksum, checksum2);
+		TS_ASSERT_SAME_DATA(&udata[0], &ddata[0], udata.size());
+	}
+
+public:
+	void test_compress_decompress_compare()
+	{
+		// (limit values to 0..7 so that the data will actually be compressible)
+		std::vector<u8> udata(100000);
+		for(size_t i = 0; i < udata.size(); i++)
+			udata[i] = rand() & 0x07;
+		RoundTrip(udata, 4096);
+		RoundTrip(udata, udata.size());
+
+		// long runs need extra length bytes
+		std::fill(udata.begin(), udata.end(), 42);
+		RoundTrip(udata, 1000);
+
+		for(size_t i = 0; i < udata.size(); i++)
+			udata[i] = (u8)rand();
+		RoundTrip(udata, 65536);
+
+		// blocks too short to contain any matches
+		for(size_t size = 1; size < 20; size++)
+			RoundTrip(std::vector<u8>(size, 'a'), 3);
+	}
+
+	void test_corrupted()
+	{
+		// a match offset pointing before the start of the output
+		const u8 cdata[] = { 0x11, 'a', 0x05, 0x00, 0x50, 'a', 'b', 'c', 'd', 'e' };
+		PICodec d = CreateDecompressor_LZ4();
+		u8 ddata[64];
+		size_t inConsumed, outProduced;
+		u32 checksum;
+		TS_ASSERT_OK(d->Process(cdata, sizeof(cdata), ddata, sizeof(ddata), inConsumed, outProduced));
+		debug_SkipErrors(ERR::CORRUPTED);
+		TS_ASSERT_EQUALS(d->Finish(checksum, outProduced), ERR::CORRUPTED);
+		TS_ASSERT_EQUALS(debug_StopSkippingErrors(), (size_t)1);
+	}
+};
@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -26,3 +26,8 @@
 /*virtual*/ IFileLoader::~IFileLoader()
 {
 }
+
+/*virtual*/ Status IFileLoader::Map(const OsPath& UNUSED(name), shared_ptr<u8>& UNUSED(buf), size_t UNUSED(size)) const
+{
+	return INFO::SKIPPED;
+}
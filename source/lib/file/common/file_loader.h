@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -34,6 +34,16 @@ struct IFileLoader
 	virtual OsPath Path() const = 0;
 
 	virtual Status Load(const OsPath& name, const shared_ptr<u8>& buf, size_t size) const = 0;
+
+	/**
+	 * Provide the file contents without reading them into a new buffer,
+	 * if the loader supports that (e.g. via a memory mapping).
+	 *
+	 * @param buf receives the contents; they may be modified by the caller
+	 * without affecting the file.
+	 * @return INFO::OK, or INFO::SKIPPED if the file must be read via Load.
+	 **/
+	virtual Status Map(const OsPath& name, shared_ptr<u8>& buf, size_t size) const;
 };
 
 typedef shared_ptr<IFileLoader> PIFileLoader;
@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -160,6 +160,26 @@ public:
 	Impl(size_t maxSize)
 		: m_allocator(new Allocator(maxSize))
 	{
+		memset(&m_stats, 0, sizeof(m_stats));
+		m_stats.budget = m_maxSize = maxSize;
+	}
+
+	void SetBudget(size_t budget)
+	{
+		m_stats.budget = std::min(budget, m_maxSize);
+		while(m_stats.size > m_stats.budget && RemoveLeastValuable())
+		{
+		}
+	}
+
+	size_t Budget() const
+	{
+		return m_stats.budget;
+	}
+
+	const Stats& GetStats() const
+	{
+		return m_stats;
 	}
 
 	shared_ptr<u8> Reserve(size_t size)
@@ -171,6 +191,7 @@ public:
 		// of space in a full cache)
 		for(;;)
 		{
+			if(m_stats.size + size <= m_stats.budget)
 			{
 				shared_ptr<u8> data = m_allocator->Allocate(size, m_allocator);
 				if(data)
@@ -178,16 +199,12 @@ public:
 			}
 
 			// remove least valuable entry from cache (if users are holding
-			// references, the contents won't actually be deallocated)
-			{
-				shared_ptr<u8> discardedData; size_t discardedSize;
-				bool removed = m_cache.remove_least_valuable(&discardedData, &discardedSize);
-				// the cache is empty, and allocation still failed.
-				// apparently the cache is full of data that's still
-				// referenced, so we can't reserve any more space.
-				if(!removed)
-					return shared_ptr<u8>();
-			}
+			// references, the contents won't actually be deallocated).
+			// if the cache is empty and allocation still failed,
+			// apparently the cache is full of data that's still
+			// referenced, so we can't reserve any more space.
+			if(!RemoveLeastValuable())
+				return shared_ptr<u8>();
 		}
 	}
 
@@ -197,7 +214,10 @@ public:
 		// allow changes. this will be reverted when deallocating.
 		(void)mprotect((void*)data.get(), size, PROT_READ);
 
-		m_cache.add(pathname, data, size, cost);
+		const CachedFile file(data, Classify(pathname));
+		m_cache.add(pathname, file, size, cost);
+		m_stats.size += size;
+		m_stats.classes[file.fileClass].size += size;
 	}
 
 	bool Retrieve(const VfsPath& pathname, shared_ptr<u8>& data, size_t& size)
@@ -206,22 +226,79 @@ public:
 		// in case of a cache miss; doing so is left to the caller.)
 		stats_buf_ref();
 
-		return m_cache.retrieve(pathname, data, &size);
+		CachedFile file;
+		const bool found = m_cache.retrieve(pathname, file, &size);
+		ClassStats& classStats = m_stats.classes[Classify(pathname)];
+		if(found)
+		{
+			data = file.data;
+			classStats.hits++;
+		}
+		else
+			classStats.misses++;
+		return found;
+	}
+
+	bool Peek(const VfsPath& pathname, shared_ptr<u8>& data, size_t& size)
+	{
+		CachedFile file;
+		if(!m_cache.peek(pathname, file, &size))
+			return false;
+		data = file.data;
+		return true;
 	}
 
 	void Remove(const VfsPath& pathname)
 	{
-		m_cache.remove(pathname);
+		CachedFile file; size_t size;
+		if(m_cache.peek(pathname, file, &size))
+		{
+			m_cache.remove(pathname);
+			m_stats.size -= size;
+			m_stats.classes[file.fileClass].size -= size;
+		}
 
 		// note: we could check if someone is still holding a reference
 		// to the contents, but that currently doesn't matter.
 	}
 
 private:
-	typedef Cache<VfsPath, shared_ptr<u8> > CacheType;
+	struct CachedFile
+	{
+		CachedFile()
+			: fileClass(FILE_CLASS_OTHER)
+		{
+		}
+
+		CachedFile(const shared_ptr<u8>& data, FileClass fileClass)
+			: data(data), fileClass(fileClass)
+		{
+		}
+
+		shared_ptr<u8> data;
+		FileClass fileClass;
+	};
+
+	bool RemoveLeastValuable()
+	{
+		CachedFile discardedFile; size_t discardedSize;
+		if(!m_cache.remove_least_valuable(&discardedFile, &discardedSize))
+			return false;
+
+		m_stats.size -= discardedSize;
+		ClassStats& classStats = m_stats.classes[discardedFile.fileClass];
+		classStats.size -= discardedSize;
+		classStats.evictions++;
+		return true;
+	}
+
+	typedef Cache<VfsPath, CachedFile> CacheType;
 	CacheType m_cache;
 
 	PAllocator m_allocator;
+
+	size_t m_maxSize;
+	Stats m_stats;
 };
 
 
@@ -232,6 +309,48 @@ FileCache::FileCache(size_t size)
 {
 }
 
+void FileCache::SetBudget(size_t budget)
+{
+	impl->SetBudget(budget);
+}
+
+size_t FileCache::Budget() const
+{
+	return impl->Budget();
+}
+
+FileCache::Stats FileCache::GetStats() const
+{
+	return impl->GetStats();
+}
+
+/*static*/ FileCache::FileClass FileCache::Classify(const VfsPath& pathname)
+{
+	const VfsPath extension = pathname.Extension();
+
+	static const wchar_t* textureExtensions[] = { L".dds", L".png", L".tga", L".jpg", L".jpeg", L".bmp" };
+	for(size_t i = 0; i < ARRAY_SIZE(textureExtensions); i++)
+	{
+		if(extension == textureExtensions[i])
+			return FILE_CLASS_TEXTURE;
+	}
+
+	if(extension == L".pmd" || extension == L".psa" || extension == L".dae")
+		return FILE_CLASS_MESH;
+	if(extension == L".js")
+		return FILE_CLASS_SCRIPT;
+	if(extension == L".xml" || extension == L".xmb")
+		return FILE_CLASS_XML;
+	return FILE_CLASS_OTHER;
+}
+
+/*static*/ const char* FileCache::FileClassName(FileClass fileClass)
+{
+	static const char* names[NUM_FILE_CLASSES] = { "textures", "meshes", "scripts", "XML", "other" };
+	ENSURE(fileClass < NUM_FILE_CLASSES);
+	return names[fileClass];
+}
+
 shared_ptr<u8> FileCache::Reserve(size_t size)
 {
 	return impl->Reserve(size);
@@ -251,3 +370,8 @@ bool FileCache::Retrieve(const VfsPath& pathname, shared_ptr<u8>& data, size_t&
 {
 	return impl->Retrieve(pathname, data, size);
 }
+
+bool FileCache::Peek(const VfsPath& pathname, shared_ptr<u8>& data, size_t& size)
+{
+	return impl->Peek(pathname, data, size);
+}
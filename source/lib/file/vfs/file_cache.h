@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -48,12 +48,59 @@
 class FileCache
 {
 public:
+	/**
+	 * files are classified by their extension, so the statistics
+	 * show which kinds of files are using or thrashing the cache.
+	 **/
+	enum FileClass
+	{
+		FILE_CLASS_TEXTURE,
+		FILE_CLASS_MESH,	// (including animations)
+		FILE_CLASS_SCRIPT,
+		FILE_CLASS_XML,	// (including XMB)
+		FILE_CLASS_OTHER,
+		NUM_FILE_CLASSES
+	};
+
+	struct ClassStats
+	{
+		size_t hits;
+		size_t misses;
+		size_t evictions;	// (not counting Remove)
+		size_t size;	// [bytes] currently in the cache
+	};
+
+	struct Stats
+	{
+		size_t budget;	// [bytes] see SetBudget
+		size_t size;	// [bytes] currently in the cache
+		ClassStats classes[NUM_FILE_CLASSES];
+	};
+
 	/**
 	 * @param size maximum amount [bytes] of memory to use for the cache.
 	 * (managed as a virtual memory region that's committed on-demand)
 	 **/
 	FileCache(size_t size);
 
+	/**
+	 * Limit the total size of the cached files, evicting files until
+	 * they fit. (The budget can't exceed the size passed to the
+	 * constructor, which is also the initial budget.)
+	 **/
+	void SetBudget(size_t budget);
+
+	size_t Budget() const;
+
+	Stats GetStats() const;
+
+	static FileClass Classify(const VfsPath& pathname);
+
+	/**
+	 * @return a short name for the file class, e.g. "textures".
+	 **/
+	static const char* FileClassName(FileClass fileClass);
+
 	/**
 	 * Reserve a chunk of the cache's memory region.
 	 *
@@ -100,6 +147,12 @@ public:
 	 **/
 	bool Retrieve(const VfsPath& pathname, shared_ptr<u8>& data, size_t& size);
 
+	/**
+	 * Like Retrieve, but doesn't count as an access of the file (neither
+	 * for the statistics nor when choosing files to evict).
+	 **/
+	bool Peek(const VfsPath& pathname, shared_ptr<u8>& data, size_t& size);
+
 private:
 	class Impl;
 	shared_ptr<Impl> impl;
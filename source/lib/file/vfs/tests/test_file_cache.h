@@ -0,0 +1,91 @@
+/* Copyright (c) 2013 Wildfire Games
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "lib/self_test.h"
+
+#include "lib/file/vfs/file_cache.h"
+
+class TestFileCache : public CxxTest::TestSuite
+{
+	void AddFile(FileCache& cache, const VfsPath& pathname, size_t size)
+	{
+		shared_ptr<u8> data = cache.Reserve(size);
+		TS_ASSERT(data);
+		cache.Add(pathname, data, size);
+	}
+
+public:
+	void test_stats()
+	{
+		FileCache cache(4*MiB);
+		AddFile(cache, L"art/textures/a.dds", 100*KiB);
+		AddFile(cache, L"gui/page.xml", 10*KiB);
+
+		shared_ptr<u8> data; size_t size;
+		TS_ASSERT(cache.Retrieve(L"art/textures/a.dds", data, size));
+		TS_ASSERT_EQUALS(size, (size_t)100*KiB);
+		TS_ASSERT(!cache.Retrieve(L"art/textures/b.png", data, size));
+		TS_ASSERT(!cache.Retrieve(L"maps/random/x.js", data, size));
+		TS_ASSERT(cache.Peek(L"gui/page.xml", data, size));
+
+		FileCache::Stats stats = cache.GetStats();
+		TS_ASSERT_EQUALS(stats.budget, (size_t)4*MiB);
+		TS_ASSERT_EQUALS(stats.size, (size_t)110*KiB);
+		TS_ASSERT_EQUALS(stats.classes[FileCache::FILE_CLASS_TEXTURE].hits, (size_t)1);
+		TS_ASSERT_EQUALS(stats.classes[FileCache::FILE_CLASS_TEXTURE].misses, (size_t)1);
+		TS_ASSERT_EQUALS(stats.classes[FileCache::FILE_CLASS_TEXTURE].size, (size_t)100*KiB);
+		TS_ASSERT_EQUALS(stats.classes[FileCache::FILE_CLASS_SCRIPT].misses, (size_t)1);
+		TS_ASSERT_EQUALS(stats.classes[FileCache::FILE_CLASS_XML].hits, (size_t)0);
+		TS_ASSERT_EQUALS(stats.classes[FileCache::FILE_CLASS_XML].size, (size_t)10*KiB);
+
+		cache.Remove(L"gui/page.xml");
+		stats = cache.GetStats();
+		TS_ASSERT_EQUALS(stats.size, (size_t)100*KiB);
+		TS_ASSERT_EQUALS(stats.classes[FileCache::FILE_CLASS_XML].size, (size_t)0);
+		TS_ASSERT_EQUALS(stats.classes[FileCache::FILE_CLASS_XML].evictions, (size_t)0);
+	}
+
+	void test_budget()
+	{
+		FileCache cache(4*MiB);
+		AddFile(cache, L"art/meshes/a.pmd", 1*MiB);
+		AddFile(cache, L"art/meshes/b.pmd", 1*MiB);
+		AddFile(cache, L"art/animation/c.psa", 1*MiB);
+		TS_ASSERT_EQUALS(cache.GetStats().size, (size_t)3*MiB);
+
+		cache.SetBudget(2*MiB);
+		FileCache::Stats stats = cache.GetStats();
+		TS_ASSERT_EQUALS(stats.budget, (size_t)2*MiB);
+		TS_ASSERT_LESS_THAN_EQUALS(stats.size, (size_t)2*MiB);
+		TS_ASSERT_LESS_THAN_EQUALS((size_t)1, stats.classes[FileCache::FILE_CLASS_MESH].evictions);
+
+		// reserving more space evicts files rather than exceeding the budget
+		AddFile(cache, L"a.ogg", 2*MiB);
+		stats = cache.GetStats();
+		TS_ASSERT_EQUALS(stats.size, (size_t)2*MiB);
+		TS_ASSERT_EQUALS(stats.classes[FileCache::FILE_CLASS_MESH].size, (size_t)0);
+
+		// can't exceed the initial size
+		cache.SetBudget(8*MiB);
+		TS_ASSERT_EQUALS(cache.Budget(), (size_t)4*MiB);
+	}
+};
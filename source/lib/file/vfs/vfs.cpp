@@ -24,6 +24,7 @@
 #include "lib/file/vfs/vfs.h"
 
 #include "lib/allocators/shared_ptr.h"
+#include "lib/posix/posix_mman.h"
 #include "lib/posix/posix_pthread.h"
 #include "lib/file/file_system.h"
 #include "lib/file/common/file_stats.h"
@@ -52,9 +53,9 @@ struct ScopedLock
 class VFS : public IVFS
 {
 public:
-	VFS(size_t cacheSize)
+	VFS(size_t cacheSize, const PITrace& trace)
 		: m_cacheSize(cacheSize), m_fileCache(m_cacheSize)
-		, m_trace(CreateDummyTrace(8*MiB))
+		, m_trace(trace? trace : CreateDummyTrace(8*MiB))
 	{
 	}
 
@@ -180,39 +181,112 @@ public:
 
 	virtual Status LoadFile(const VfsPath& pathname, shared_ptr<u8>& fileContents, size_t& size)
 	{
-		ScopedLock s;
-		const bool isCacheHit = m_fileCache.Retrieve(pathname, fileContents, size);
-		if(!isCacheHit)
+		// the lookup and cache accesses are done while holding the lock,
+		// but the lock is released while the loader reads (and maybe
+		// decompresses) the file, so that several threads can load
+		// files at the same time.
+		PIFileLoader loader;
+		OsPath name;
+		bool addToCache = false;
 		{
+			ScopedLock s;
+			if(m_fileCache.Retrieve(pathname, fileContents, size))
+			{
+				stats_io_user_request(size);
+				stats_cache(CR_HIT, size);
+				m_trace->NotifyLoad(pathname, size);
+				return INFO::OK;
+			}
+
 			VfsDirectory* directory; VfsFile* file;
 			// per 2010-05-01 meeting, this shouldn't raise 'scary error
 			// dialogs', which might fail to display the culprit pathname
 			// instead, callers should log the error, including pathname.
 			RETURN_STATUS_IF_ERR(vfs_Lookup(pathname, &m_rootDirectory, directory, &file));
 
+			// (copied, since the file might be removed from the tree while the lock isn't held)
+			loader = file->Loader();
+			name = file->Name();
 			fileContents = DummySharedPtr((u8*)0);
 			size = file->Size();
 			if(size != 0)	// (the file cache can't handle zero-length allocations)
 			{
-				if(size < m_cacheSize/2)	// (avoid evicting lots of previous data)
-					fileContents = m_fileCache.Reserve(size);
-				if(fileContents)
+				// files that can be mapped (e.g. uncompressed archive entries)
+				// aren't added to the cache, since the OS already caches them
+				if(loader->Map(name, fileContents, size) == INFO::OK)
+					loader.reset();
+				else if(size < m_fileCache.Budget()/2)	// (avoid evicting lots of previous data)
 				{
-					RETURN_STATUS_IF_ERR(file->Loader()->Load(file->Name(), fileContents, file->Size()));
-					m_fileCache.Add(pathname, fileContents, size);
+					fileContents = m_fileCache.Reserve(size);
+					addToCache = (fileContents.get() != 0);
 				}
-				else
+			}
+		}
+
+		if(loader && size != 0)
+		{
+			if(!addToCache)
+				RETURN_STATUS_IF_ERR(AllocateAligned(fileContents, size, maxSectorSize));
+			RETURN_STATUS_IF_ERR(loader->Load(name, fileContents, size));
+		}
+
+		ScopedLock s;
+		if(addToCache)
+		{
+			// (another thread might have loaded the same file in the meantime)
+			shared_ptr<u8> cachedContents; size_t cachedSize;
+			if(m_fileCache.Peek(pathname, cachedContents, cachedSize))
+				fileContents = cachedContents;
+			else
+				m_fileCache.Add(pathname, fileContents, size);
+		}
+
+		stats_io_user_request(size);
+		stats_cache(CR_MISS, size);
+		m_trace->NotifyLoad(pathname, size);
+
+		return INFO::OK;
+	}
+
+	virtual Status MapFile(const VfsPath& pathname, shared_ptr<u8>& fileContents, size_t& size)
+	{
+		OsPath realPathname;
+		{
+			ScopedLock s;
+			if(m_fileCache.Retrieve(pathname, fileContents, size))
+			{
+				stats_io_user_request(size);
+				stats_cache(CR_HIT, size);
+				m_trace->NotifyLoad(pathname, size);
+				return INFO::OK;
+			}
+
+			VfsDirectory* directory; VfsFile* file;
+			RETURN_STATUS_IF_ERR(vfs_Lookup(pathname, &m_rootDirectory, directory, &file));
+
+			// (archive entries are mapped by their loader if possible, and
+			// loose files below; empty files can't be mapped, so they're loaded)
+			size = file->Size();
+			if(size != 0)
+			{
+				if(file->Loader()->Map(file->Name(), fileContents, size) == INFO::OK)
 				{
-					RETURN_STATUS_IF_ERR(AllocateAligned(fileContents, size, maxSectorSize));
-					RETURN_STATUS_IF_ERR(file->Loader()->Load(file->Name(), fileContents, file->Size()));
+					stats_io_user_request(size);
+					stats_cache(CR_MISS, size);
+					m_trace->NotifyLoad(pathname, size);
+					return INFO::OK;
 				}
+				if(file->Loader()->LocationCode() == 'F')
+					realPathname = file->Loader()->Path() / file->Name();
 			}
 		}
 
+		if(realPathname.empty() || MapLooseFile(realPathname, fileContents, size) != INFO::OK)
+			return LoadFile(pathname, fileContents, size);
+
 		stats_io_user_request(size);
-		stats_cache(isCacheHit? CR_HIT : CR_MISS, size);
+		stats_cache(CR_MISS, size);
 		m_trace->NotifyLoad(pathname, size);
-
 		return INFO::OK;
 	}
 
@@ -282,7 +356,47 @@ public:
 		m_rootDirectory.Clear();
 	}
 
+	virtual void SetCacheBudget(size_t size)
+	{
+		ScopedLock s;
+		m_fileCache.SetBudget(size);
+	}
+
+	virtual FileCache::Stats GetCacheStats() const
+	{
+		ScopedLock s;
+		return m_fileCache.GetStats();
+	}
+
 private:
+	struct MappingDeleter
+	{
+		MappingDeleter(size_t size)
+			: size(size)
+		{
+		}
+
+		void operator()(u8* p) const
+		{
+			(void)munmap(p, size);
+		}
+
+		size_t size;
+	};
+
+	static Status MapLooseFile(const OsPath& realPathname, shared_ptr<u8>& fileContents, size_t size)
+	{
+		File file;
+		RETURN_STATUS_IF_ERR(file.Open(realPathname, O_RDONLY));
+		errno = 0;
+		void* p = mmap(0, size, PROT_READ|PROT_WRITE, MAP_PRIVATE, file.Descriptor(), 0);
+		if(p == MAP_FAILED)
+			return INFO::SKIPPED;	// NOWARN (the file will be read instead)
+		// (the mapping remains valid after the file is closed)
+		fileContents.reset((u8*)p, MappingDeleter(size));
+		return INFO::OK;
+	}
+
 	Status FindRealPathR(const OsPath& realPath, const VfsDirectory& directory, const VfsPath& curPath, VfsPath& path)
 	{
 		PRealDirectory realDirectory = directory.AssociatedDirectory();
@@ -313,7 +427,7 @@ private:
 
 //-----------------------------------------------------------------------------
 
-PIVFS CreateVfs(size_t cacheSize)
+PIVFS CreateVfs(size_t cacheSize, const PITrace& trace)
 {
-	return PIVFS(new VFS(cacheSize));
+	return PIVFS(new VFS(cacheSize, trace));
 }
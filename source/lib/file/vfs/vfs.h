@@ -29,6 +29,8 @@
 #define INCLUDED_VFS
 
 #include "lib/file/file_system.h"	// FileInfo
+#include "lib/file/common/trace.h"
+#include "lib/file/vfs/file_cache.h"
 #include "lib/file/vfs/vfs_path.h"
 
 namespace ERR
@@ -162,6 +164,22 @@ struct IVFS
 	 **/
 	virtual Status LoadFile(const VfsPath& pathname, shared_ptr<u8>& fileContents, size_t& size) = 0;
 
+	/**
+	 * Provide the contents of a file via a copy-on-write memory mapping of
+	 * its archive or loose file where possible, instead of reading it into
+	 * a new buffer. Falls back to LoadFile otherwise.
+	 * Mapped files don't occupy the file cache, and pages that are never
+	 * touched are never read.
+	 *
+	 * CAVEAT: only use this for loose files that aren't rewritten or
+	 * truncated in place while they're mapped (e.g. conversion caches
+	 * whose names depend on the source file), and release the buffer
+	 * before overwriting the file; on POSIX, accessing the mapping of a
+	 * truncated file raises SIGBUS, and on Windows, mapped files can't
+	 * be replaced.
+	 **/
+	virtual Status MapFile(const VfsPath& pathname, shared_ptr<u8>& fileContents, size_t& size) = 0;
+
 	/**
 	 * @return a string representation of all files and directories.
 	 **/
@@ -212,6 +230,14 @@ struct IVFS
 	 * NB: open files are not affected.
 	 **/
 	virtual void Clear() = 0;
+
+	/**
+	 * change the amount of memory the file cache may use, evicting files
+	 * if necessary. it can't exceed the cacheSize passed to CreateVfs.
+	 **/
+	virtual void SetCacheBudget(size_t size) = 0;
+
+	virtual FileCache::Stats GetCacheStats() const = 0;
 };
 
 typedef shared_ptr<IVFS> PIVFS;
@@ -222,10 +248,12 @@ typedef shared_ptr<IVFS> PIVFS;
  * @param cacheSize size [bytes] of memory to reserve for a file cache,
  * or zero to disable it. if small enough to fit, file contents are
  * stored here until no references remain and they are evicted.
+ * @param trace records all file loads and stores (e.g. so that
+ * CArchiveBuilder can order archives by access), or null to record nothing.
  *
  * note: there is no limitation to a single instance, it may make sense
  * to create and destroy VFS instances during each unit test.
  **/
-LIB_API PIVFS CreateVfs(size_t cacheSize);
+LIB_API PIVFS CreateVfs(size_t cacheSize, const PITrace& trace = PITrace());
 
 #endif	// #ifndef INCLUDED_VFS
@@ -1,4 +1,4 @@
-/* Copyright (c) 2012 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -55,6 +55,7 @@ class PopulateHelper
 public:
 	PopulateHelper(VfsDirectory* directory, const PRealDirectory& realDirectory)
 		: m_directory(directory), m_realDirectory(realDirectory)
+		, m_archiveDirectory(0)
 	{
 	}
 
@@ -112,11 +113,26 @@ private:
 	{
 		PopulateHelper* this_ = (PopulateHelper*)cbData;
 
-		// (we have to create missing subdirectoryNames because archivers
-		// don't always place directory entries before their files)
-		const size_t flags = VFS_LOOKUP_ADD|VFS_LOOKUP_SKIP_POPULATE;
-		VfsDirectory* directory;
-		WARN_IF_ERR(vfs_Lookup(pathname, this_->m_directory, directory, 0, flags));
+		// entries are usually grouped by directory, so reuse the previous
+		// entry's directory instead of looking up every pathname from the
+		// mount point (this is most of the cost of mounting large archives).
+		const VfsPath parent = pathname.Parent();
+		VfsDirectory* directory = this_->m_archiveDirectory;
+		if(!directory || parent != this_->m_archiveDirectoryPath)
+		{
+			// (we have to create missing subdirectoryNames because archivers
+			// don't always place directory entries before their files)
+			const size_t flags = VFS_LOOKUP_ADD|VFS_LOOKUP_SKIP_POPULATE;
+			const Status ret = vfs_Lookup(pathname, this_->m_directory, directory, 0, flags);
+			WARN_IF_ERR(ret);
+			if(ret == INFO::OK)
+			{
+				this_->m_archiveDirectory = directory;
+				this_->m_archiveDirectoryPath = parent;
+			}
+			else
+				this_->m_archiveDirectory = 0;
+		}
 
 		const VfsPath name = fileInfo.Name();
 		if(name.Extension() == L".DELETED")
@@ -146,7 +162,10 @@ private:
 				// archiveReader == nullptr if file could not be opened (e.g. because
 				// archive is currently open in another program)
 				if(archiveReader)
+				{
+					m_archiveDirectory = 0;
 					RETURN_STATUS_IF_ERR(archiveReader->ReadEntries(AddArchiveFile, (uintptr_t)this));
+				}
 			}
 			else	// regular (non-archive) file
 				AddFile(files[i]);
@@ -172,6 +191,10 @@ private:
 
 	VfsDirectory* const m_directory;
 	PRealDirectory m_realDirectory;
+
+	// directory of the previous archive entry (see AddArchiveFile)
+	mutable VfsDirectory* m_archiveDirectory;
+	mutable VfsPath m_archiveDirectoryPath;
 };
 
 
@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -113,8 +113,12 @@ extern const char* ogl_ExtensionString();
 #endif
 // Also need some more for OS X 10.5:
 #ifndef GL_EXT_texture_array
+# define GL_TEXTURE_2D_ARRAY_EXT 0x8C1A
 # define GL_MAX_ARRAY_TEXTURE_LAYERS_EXT 0x88FF
 #endif
+#ifndef GL_EXT_gpu_shader4
+# define GL_SAMPLER_2D_ARRAY_EXT 0x8DC1
+#endif
 // Also need some types not in old glext.h:
 #ifndef GL_ARB_sync
  typedef int64_t GLint64;
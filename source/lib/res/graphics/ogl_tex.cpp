@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -39,6 +39,17 @@
 #include "lib/res/h_mgr.h"
 #include "lib/fnv_hash.h"
 
+// (not defined by older or non-GLES headers)
+#ifndef GL_ETC1_RGB8_OES
+#define GL_ETC1_RGB8_OES 0x8D64
+#endif
+#ifndef GL_COMPRESSED_RGB8_ETC2
+#define GL_COMPRESSED_RGB8_ETC2 0x9274
+#endif
+#ifndef GL_COMPRESSED_RGBA8_ETC2_EAC
+#define GL_COMPRESSED_RGBA8_ETC2_EAC 0x9278
+#endif
+
 
 //----------------------------------------------------------------------------
 // OpenGL helper routines
@@ -99,7 +110,7 @@ static bool are_mipmaps_needed(size_t width, size_t height, GLint filter)
 }
 
 
-static bool fmt_is_s3tc(GLenum fmt)
+static bool fmt_is_compressed(GLenum fmt)
 {
 	switch(fmt)
 	{
@@ -109,6 +120,9 @@ static bool fmt_is_s3tc(GLenum fmt)
 	case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
 	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
 #endif
+	case GL_ETC1_RGB8_OES:
+	case GL_COMPRESSED_RGB8_ETC2:
+	case GL_COMPRESSED_RGBA8_ETC2_EAC:
 		return true;
 	default:
 		return false;
@@ -124,6 +138,13 @@ static GLint choose_fmt(size_t bpp, size_t flags)
 	const bool grey  = (flags & TEX_GREY ) != 0;
 	const size_t dxt   = flags & TEX_DXT;
 
+	// ETC (ETC1 data is also valid ETC2, which is preferred since only
+	// GLES knows GL_ETC1_RGB8_OES)
+	if(dxt == ETC1)
+		return ogl_tex_has_etc2()? GL_COMPRESSED_RGB8_ETC2 : GL_ETC1_RGB8_OES;
+	if(dxt == ETC2_EAC)
+		return GL_COMPRESSED_RGBA8_ETC2_EAC;
+
 	// S3TC
 	if(dxt != 0)
 	{
@@ -225,11 +246,11 @@ static GLint choose_int_fmt(GLenum fmt, int q_flags)
 	// true => 4 bits per component; otherwise, 8
 	const bool half_bpp = (q_flags & OGL_TEX_HALF_BPP) != 0;
 
-	// early-out for S3TC textures: they don't need an internal format
+	// early-out for S3TC/ETC textures: they don't need an internal format
 	// (because upload is via glCompressedTexImage2DARB), but we must avoid
 	// triggering the default case below. we might as well return a
 	// meaningful value (i.e. int_fmt = fmt).
-	if(fmt_is_s3tc(fmt))
+	if(fmt_is_compressed(fmt))
 		return fmt;
 
 #if CONFIG2_GLES
@@ -420,6 +441,10 @@ struct OglTex
 	// OglTexQualityFlags
 	u8 q_flags;
 
+	// number of high-resolution mip levels to leave out of the upload
+	// (set via ogl_tex_set_levels_to_skip)
+	u8 levels_to_skip;
+
 	// to which Texture Mapping Unit was this bound?
 	u8 tmu;
 
@@ -692,6 +717,22 @@ Status ogl_tex_set_anisotropy(Handle ht, GLfloat anisotropy)
 }
 
 
+// skip the given number of the highest-resolution mip levels when uploading.
+Status ogl_tex_set_levels_to_skip(Handle ht, size_t levels)
+{
+	H_DEREF(ht, OglTex, ot);
+
+	levels = std::min(levels, (size_t)255);	// (stored as u8)
+
+	if(ot->levels_to_skip != levels)
+	{
+		warn_if_uploaded(ht, ot);
+		ot->levels_to_skip = (u8)levels;
+	}
+	return INFO::OK;
+}
+
+
 //----------------------------------------------------------------------------
 // upload
 //----------------------------------------------------------------------------
@@ -704,6 +745,8 @@ Status ogl_tex_set_anisotropy(Handle ht, GLfloat anisotropy)
 // tristate; -1 is undecided
 static int have_auto_mipmap_gen = -1;
 static int have_s3tc = -1;
+static int have_etc1 = -1;
+static int have_etc2 = -1;
 static int have_anistropy = -1;
 
 // override the default decision and force/disallow use of the
@@ -724,6 +767,12 @@ void ogl_tex_override(OglTexOverrides what, OglTexAllow allow)
 	case OGL_TEX_ANISOTROPY:
 		have_anistropy = enable;
 		break;
+	case OGL_TEX_ETC1:
+		have_etc1 = enable;
+		break;
+	case OGL_TEX_ETC2:
+		have_etc2 = enable;
+		break;
 	default:
 		DEBUG_WARN_ERR(ERR::LOGIC);	// invalid <what>
 		break;
@@ -755,6 +804,23 @@ static void detect_gl_upload_caps()
 		// note: we don't bother checking for GL_S3_s3tc - it is incompatible
 		// and irrelevant (was never widespread).
 		have_s3tc = ogl_HaveExtensions(0, "GL_ARB_texture_compression", "GL_EXT_texture_compression_s3tc", NULL) == 0;
+#endif
+	}
+	if(have_etc2 == -1)
+	{
+#if CONFIG2_GLES
+		have_etc2 = ogl_HaveVersion("3.0");
+#else
+		have_etc2 = ogl_HaveVersion("4.3") || ogl_HaveExtension("GL_ARB_ES3_compatibility");
+#endif
+	}
+	if(have_etc1 == -1)
+	{
+#if CONFIG2_GLES
+		have_etc1 = have_etc2 || ogl_HaveExtension("GL_OES_compressed_ETC1_RGB8_texture");
+#else
+		// (desktop GL only accepts ETC1 data as ETC2)
+		have_etc1 = have_etc2;
 #endif
 	}
 	if(have_anistropy == -1)
@@ -780,6 +846,23 @@ static void detect_gl_upload_caps()
 }
 
 
+// is the texture's kind of compression (if any) supported by OpenGL?
+static bool is_compression_supported(size_t flags)
+{
+	switch(flags & TEX_DXT)
+	{
+	case 0:
+		return true;
+	case ETC1:
+		return have_etc1 != 0;
+	case ETC2_EAC:
+		return have_etc2 != 0;
+	default:
+		return have_s3tc != 0;
+	}
+}
+
+
 // take care of mipmaps. if they are called for by <filter>, either
 // arrange for OpenGL to create them, or see to it that the Tex object
 // contains them (if need be, creating them in software).
@@ -787,7 +870,7 @@ static void detect_gl_upload_caps()
 // whether mipmaps are needed and the quality settings).
 // returns 0 to indicate success; otherwise, caller must disable
 // mipmapping by switching filter to e.g. GL_LINEAR.
-static Status get_mipmaps(Tex* t, GLint filter, int q_flags, int* plevels_to_skip)
+static Status get_mipmaps(Tex* t, GLint filter, int q_flags, int extra_levels_to_skip, int* plevels_to_skip)
 {
 	// decisions:
 	// .. does filter call for uploading mipmaps?
@@ -855,6 +938,13 @@ static Status get_mipmaps(Tex* t, GLint filter, int q_flags, int* plevels_to_ski
 		// .. can be expanded to reduce to 1/4, 1/8 by encoding factor in q_flags.
 		if(q_flags & OGL_TEX_HALF_RES)
 			(*plevels_to_skip)++;
+
+		// any explicitly requested reduction (but always keep the 1x1 level)
+		*plevels_to_skip += extra_levels_to_skip;
+		int max_levels_to_skip = 0;
+		for(size_t size = std::max(t->w, t->h); size > 1; size /= 2)
+			max_levels_to_skip++;
+		*plevels_to_skip = std::min(*plevels_to_skip, max_levels_to_skip);
 	}
 
 	return INFO::OK;
@@ -925,8 +1015,8 @@ Status ogl_tex_upload(const Handle ht, GLenum fmt_ovr, int q_flags_ovr, GLint in
 
 	if(ot->flags & OT_TEX_VALID)
 	{
-		// decompress S3TC if that's not supported by OpenGL.
-		if((t->flags & TEX_DXT) && !have_s3tc)
+		// decompress S3TC or ETC if that's not supported by OpenGL.
+		if(!is_compression_supported(t->flags))
 			(void)tex_transform_to(t, t->flags & ~TEX_DXT);
 
 		// determine fmt and int_fmt, allowing for user override.
@@ -943,7 +1033,7 @@ Status ogl_tex_upload(const Handle ht, GLenum fmt_ovr, int q_flags_ovr, GLint in
 			// fail in debug builds if OglTex.id isn't a valid texture name)
 			RETURN_STATUS_IF_ERR(ogl_tex_bind(ht, ot->tmu));
 			int levels_to_skip;
-			if(get_mipmaps(t, ot->state.filter, ot->q_flags, &levels_to_skip) < 0)
+			if(get_mipmaps(t, ot->state.filter, ot->q_flags, ot->levels_to_skip, &levels_to_skip) < 0)
 				// error => disable mipmapping
 				ot->state.filter = GL_LINEAR;
 			// (note: if first time, applies our defaults/previous overrides;
@@ -1119,6 +1209,24 @@ bool ogl_tex_has_s3tc()
 	return (have_s3tc != 0);
 }
 
+// return whether native ETC1 texture compression support is available
+bool ogl_tex_has_etc1()
+{
+	// ogl_tex_upload must be called before this
+	ENSURE(have_etc1 != -1);
+
+	return (have_etc1 != 0);
+}
+
+// return whether native ETC2 texture compression support is available
+bool ogl_tex_has_etc2()
+{
+	// ogl_tex_upload must be called before this
+	ENSURE(have_etc2 != -1);
+
+	return (have_etc2 != 0);
+}
+
 // return whether anisotropic filtering support is available
 bool ogl_tex_has_anisotropy()
 {
@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -309,6 +309,21 @@ extern Status ogl_tex_set_wrap(Handle ht, GLint wrap_s, GLint wrap_t);
 */
 extern Status ogl_tex_set_anisotropy(Handle ht, GLfloat anisotropy);
 
+/**
+* Leave the given number of the highest-resolution mip levels out of the
+* upload, to save memory (e.g. while a texture is being streamed in).
+* Only has an effect on textures that contain mipmaps; the smallest
+* (1x1) level is always uploaded.
+*
+* @param ht Texture handle
+* @param levels Number of levels to skip (in addition to any skipped
+*        due to OGL_TEX_HALF_RES or the implementation's size limit)
+* @return Status
+*
+* Must be called before uploading (raises a warning if called afterwards).
+*/
+extern Status ogl_tex_set_levels_to_skip(Handle ht, size_t levels);
+
 
 //
 // upload
@@ -318,7 +333,9 @@ enum OglTexOverrides
 {
 	OGL_TEX_S3TC,
 	OGL_TEX_AUTO_MIPMAP_GEN,
-	OGL_TEX_ANISOTROPY
+	OGL_TEX_ANISOTROPY,
+	OGL_TEX_ETC1,
+	OGL_TEX_ETC2
 };
 
 enum OglTexAllow
@@ -473,6 +490,28 @@ extern Status ogl_tex_transform_to(Handle ht, size_t new_flags);
  */
 extern bool ogl_tex_has_s3tc();
 
+/**
+ * Return whether native ETC1 texture compression support is available
+ * (either via GL_OES_compressed_ETC1_RGB8_texture or as part of ETC2).
+ * If not, ETC1 textures will be decompressed automatically.
+ *
+ * @return true if native ETC1 supported.
+ *
+ * ogl_tex_upload must be called at least once before this.
+ */
+extern bool ogl_tex_has_etc1();
+
+/**
+ * Return whether native ETC2 (and EAC) texture compression support is
+ * available, i.e. GLES 3 or GL_ARB_ES3_compatibility.
+ * If not, ETC2 textures will be decompressed automatically.
+ *
+ * @return true if native ETC2 supported.
+ *
+ * ogl_tex_upload must be called at least once before this.
+ */
+extern bool ogl_tex_has_etc2();
+
 /**
  * Return whether anisotropic filtering support is available.
  * (The anisotropy might still be disabled or overridden by the driver
@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -24,6 +24,7 @@
 
 #include "lib/tex/tex.h"
 #include "lib/tex/tex_codec.h"
+#include "lib/tex/tex_etc.h"
 #include "lib/allocators/shared_ptr.h"
 
 class TestTex : public CxxTest::TestSuite 
@@ -189,4 +190,109 @@ public:
 
 		tex_codec_unregister_all();
 	}
+
+	// runs the chunks backwards, to check they don't depend on each other
+	static void ReverseParallelFor(size_t count, size_t chunkSize, TexJobCB cb, void* cbData)
+	{
+		for(size_t end = count; end > 0; end -= std::min(end, chunkSize))
+			cb(cbData, end - std::min(end, chunkSize), end);
+	}
+
+	void test_s3tc_decode_parallel()
+	{
+		tex_codec_register_all();
+
+		// DXT5 with mipmaps, large enough to be split up
+		const size_t w = 512, h = 256, bpp = 8;
+		Tex tmp;
+		TS_ASSERT_OK(tex_wrap(w, h, bpp, (TEX_DXT&5)|TEX_MIPMAPS|TEX_ALPHA, shared_ptr<u8>(), 0, &tmp));
+		const size_t size = tex_img_size(&tmp);
+		shared_ptr<u8> img(new u8[size], ArrayDeleter());
+		srand(1);
+		std::generate(img.get(), img.get()+size, rand);
+
+		Tex t1;
+		TS_ASSERT_OK(tex_wrap(w, h, bpp, (TEX_DXT&5)|TEX_MIPMAPS|TEX_ALPHA, img, 0, &t1));
+		TS_ASSERT_OK(tex_transform_to(&t1, TEX_MIPMAPS|TEX_ALPHA));
+
+		Tex t2;
+		tex_set_parallel_for(&ReverseParallelFor);
+		TS_ASSERT_OK(tex_wrap(w, h, bpp, (TEX_DXT&5)|TEX_MIPMAPS|TEX_ALPHA, img, 0, &t2));
+		TS_ASSERT_OK(tex_transform_to(&t2, TEX_MIPMAPS|TEX_ALPHA));
+		tex_set_parallel_for(NULL);
+
+		TS_ASSERT_EQUALS(t1.dataSize, size*4);
+		TS_ASSERT_EQUALS(t2.dataSize, size*4);
+		TS_ASSERT_SAME_DATA(tex_get_data(&t1), tex_get_data(&t2), t1.dataSize);
+
+		tex_free(&t1);
+		tex_free(&t2);
+
+		tex_codec_unregister_all();
+	}
+
+	void test_etc_decode()
+	{
+		tex_codec_register_all();
+
+		const size_t w = 4, h = 4, bpp = 4;
+		const size_t size = w*h/2;
+		shared_ptr<u8> img(new u8[size], ArrayDeleter());
+		// individual mode, white left half and black right half, all with modifier +2
+		// except for the top-left pixel of the right half (+8)
+		memcpy(img.get(), "\xF0\xF0\xF0\x00\x00\x00\x01\x00", 8);
+		const u8 expected[] =
+			"\xFF\xFF\xFF" "\xFF\xFF\xFF" "\x08\x08\x08" "\x02\x02\x02"
+			"\xFF\xFF\xFF" "\xFF\xFF\xFF" "\x02\x02\x02" "\x02\x02\x02"
+			"\xFF\xFF\xFF" "\xFF\xFF\xFF" "\x02\x02\x02" "\x02\x02\x02"
+			"\xFF\xFF\xFF" "\xFF\xFF\xFF" "\x02\x02\x02" "\x02\x02\x02";
+
+		// wrap in Tex
+		Tex t;
+		TS_ASSERT_OK(tex_wrap(w, h, bpp, ETC1, img, 0, &t));
+
+		// decompress ETC
+		TS_ASSERT_OK(tex_transform_to(&t, 0));
+
+		// compare img
+		TS_ASSERT_SAME_DATA(tex_get_data(&t), expected, 48);
+
+		// cleanup
+		tex_free(&t);
+
+		tex_codec_unregister_all();
+	}
+
+	void test_etc_encode_decode()
+	{
+		// left half opaque orange, right half translucent blue
+		u8 rgba[16*4];
+		for(size_t i = 0; i < 16; i++)
+		{
+			const bool left = (i % 4) < 2;
+			rgba[i*4+0] = left? 0xF0 : 0x10;
+			rgba[i*4+1] = left? 0x80 : 0x40;
+			rgba[i*4+2] = left? 0x10 : 0xC0;
+			rgba[i*4+3] = left? 0xFF : 0x60;
+		}
+
+		u8 block[16];
+		TS_ASSERT_EQUALS(etc_block_size(ETC2_EAC), (size_t)16);
+		etc_compress_block(ETC2_EAC, rgba, block);
+
+		u8 out[16*4];
+		etc_decompress_block(ETC2_EAC, block, out);
+		for(size_t i = 0; i < 16*4; i++)
+		{
+			// (alpha only has two values, so it should be exact)
+			if(i % 4 == 3)
+			{
+				TS_ASSERT_EQUALS(out[i], rgba[i]);
+			}
+			else
+			{
+				TS_ASSERT_DELTA(out[i], rgba[i], 8);
+			}
+		}
+	}
 };
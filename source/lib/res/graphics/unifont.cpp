@@ -1,4 +1,4 @@
-/* Copyright (c) 2012 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -43,6 +43,8 @@ struct UniFont
 
 	bool HasRGB; // true if RGBA, false if ALPHA
 
+	bool DistanceField; // true if the alpha channel is a signed distance field
+
 	glyphmap* glyphs;
 
 	int LineSpacing;
@@ -63,7 +65,34 @@ static void UniFont_dtor(UniFont* f)
 	SAFE_DELETE(f->glyphs);
 }
 
-// basename is e.g. "console"; the files are "fonts/console.fnt" and "fonts/console.png"
+// Splits a name like "sans-bold-14" into the typeface ("sans-bold") and the size (14)
+static bool ParseSizedFontName(const VfsPath& basename, VfsPath& typeface, int& size)
+{
+	const std::wstring name = basename.string();
+	const size_t sep = name.find_last_of(L'-');
+	if (sep == std::wstring::npos || sep == 0 || sep+1 == name.length())
+		return false;
+
+	size = 0;
+	for (size_t i = sep+1; i < name.length(); ++i)
+	{
+		if (name[i] < L'0' || name[i] > L'9')
+			return false;
+		size = size*10 + (name[i] - L'0');
+	}
+
+	typeface = VfsPath(name.substr(0, sep));
+	return size > 0;
+}
+
+static i16 ScaleMetric(int value, float scale)
+{
+	return (i16)floorf(value*scale + 0.5f);
+}
+
+// basename is e.g. "console"; the files are "fonts/console.fnt" and "fonts/console.png".
+// If there's no such font but the basename is e.g. "sans-14" and "fonts/sans.fnt"
+// is a distance field font, that is loaded and scaled to 14 pixels instead.
 // [10..70ms]
 static Status UniFont_reload(UniFont* f, const PIVFS& vfs, const VfsPath& basename, Handle UNUSED(h))
 {
@@ -75,9 +104,20 @@ static Status UniFont_reload(UniFont* f, const PIVFS& vfs, const VfsPath& basena
 
 	const VfsPath path(L"fonts/");
 
+	VfsPath fileBasename(basename);
+	int RequestedSize = 0;
+	if (vfs->GetFileInfo(path / basename.ChangeExtension(L".fnt"), NULL) < 0)
+	{
+		VfsPath typeface;
+		if (ParseSizedFontName(basename, typeface, RequestedSize) && vfs->GetFileInfo(path / typeface.ChangeExtension(L".fnt"), NULL) >= 0)
+			fileBasename = typeface;
+		else
+			RequestedSize = 0;
+	}
+
 	// Read font definition file into a stringstream
 	shared_ptr<u8> buf; size_t size;
-	const VfsPath fntName(basename.ChangeExtension(L".fnt"));
+	const VfsPath fntName(fileBasename.ChangeExtension(L".fnt"));
 	RETURN_STATUS_IF_ERR(vfs->LoadFile(path / fntName, buf, size));	// [cumulative for 12: 36ms]
 	std::istringstream FNTStream(std::string((const char*)buf.get(), size));
 
@@ -89,6 +129,8 @@ static Status UniFont_reload(UniFont* f, const PIVFS& vfs, const VfsPath& basena
 	int TextureWidth, TextureHeight;
 	FNTStream >> TextureWidth >> TextureHeight;
 
+	f->DistanceField = false;
+	int DistanceFieldSize = 0;
 	if (Version >= 101)
 	{
 		std::string Format;
@@ -97,17 +139,37 @@ static Status UniFont_reload(UniFont* f, const PIVFS& vfs, const VfsPath& basena
 			f->HasRGB = true;
 		else if (Format == "a")
 			f->HasRGB = false;
+		else if (Format == "sdf")
+		{
+			// followed by the pixel size that the glyph metrics are given for
+			f->HasRGB = false;
+			f->DistanceField = true;
+			FNTStream >> DistanceFieldSize;
+		}
 		else
 			debug_warn(L"Invalid .fnt format string");
 	}
 
+	// Only distance fields can be scaled to other sizes
+	float Scale = 1.0f;
+	if (RequestedSize)
+	{
+		if (!f->DistanceField || DistanceFieldSize <= 0)
+			WARN_RETURN(ERR::FAIL);
+		Scale = (float)RequestedSize / (float)DistanceFieldSize;
+	}
+
 	int NumGlyphs;
 	FNTStream >> NumGlyphs;
 
 	FNTStream >> f->LineSpacing;
+	f->LineSpacing = ScaleMetric(f->LineSpacing, Scale);
 
 	if (Version >= 101)
+	{
 		FNTStream >> f->Height;
+		f->Height = ScaleMetric(f->Height, Scale);
+	}
 	else
 		f->Height = 0;
 
@@ -133,7 +195,9 @@ static Status UniFont_reload(UniFont* f, const PIVFS& vfs, const VfsPath& basena
 		GLfloat w = (GLfloat)Width  / (GLfloat)TextureWidth;
 		GLfloat h = (GLfloat)Height / (GLfloat)TextureHeight;
 
-		UnifontGlyphData g = { u, -v, u+w, -v+h, (i16)OffsetX, (i16)-OffsetY, (i16)(OffsetX+Width), (i16)(-OffsetY+Height), (i16)Advance };
+		UnifontGlyphData g = { u, -v, u+w, -v+h,
+			ScaleMetric(OffsetX, Scale), ScaleMetric(-OffsetY, Scale), ScaleMetric(OffsetX+Width, Scale), ScaleMetric(-OffsetY+Height, Scale),
+			ScaleMetric(Advance, Scale) };
 		(*f->glyphs)[(u16)Codepoint] = g;
 	}
 
@@ -141,10 +205,11 @@ static Status UniFont_reload(UniFont* f, const PIVFS& vfs, const VfsPath& basena
 
 	// Load glyph texture
 	// [cumulative for 12: 20ms]
-	const VfsPath imgName(basename.ChangeExtension(L".png"));
+	// (Every size of a distance field font shares the same texture)
+	const VfsPath imgName(fileBasename.ChangeExtension(L".png"));
 	Handle ht = ogl_tex_load(vfs, path / imgName);
 	RETURN_STATUS_IF_ERR(ht);
-	(void)ogl_tex_set_filter(ht, GL_NEAREST);
+	(void)ogl_tex_set_filter(ht, f->DistanceField ? GL_LINEAR : GL_NEAREST);
 
 	Status err;
 	if (f->HasRGB)
@@ -234,6 +299,15 @@ bool unifont_has_rgb(const Handle h)
 }
 
 
+bool unifont_is_distance_field(const Handle h)
+{
+	UniFont* const f = H_USER_DATA(h, UniFont);
+	if(!f)
+		return false;
+	return f->DistanceField;
+}
+
+
 int unifont_character_width(const Handle h, wchar_t c)
 {
 	H_DEREF(h, UniFont, f);
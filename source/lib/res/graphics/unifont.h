@@ -1,4 +1,4 @@
-/* Copyright (c) 2012 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -36,6 +36,11 @@
 /**
  * Load a font.
  *
+ * If there is no font with the given basename, but it has the form
+ * "typeface-size" and the typeface has a signed distance field font
+ * (a .fnt with the "sdf" format, which also gives the pixel size its
+ * metrics were generated for), that is loaded and scaled to the size.
+ *
  * @param vfs
  * @param pathname path and basename of the font definition file
  *		  (.fnt) and its texture (.png)
@@ -67,6 +72,12 @@ Status unifont_stringsize(const Handle h, const wchar_t* text, int& width, int&
  **/
 bool unifont_has_rgb(const Handle h);
 
+/**
+ * @return whether the font's ALPHA texture is a signed distance field,
+ * which must be drawn with alpha testing (the edge is at 0.5).
+ **/
+bool unifont_is_distance_field(const Handle h);
+
 /**
  * @return height [pixels] of the font.
  **/
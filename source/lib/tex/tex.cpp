@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -81,7 +81,7 @@ Status tex_validate(const Tex* t)
 	// flags
 	// .. DXT value
 	const size_t dxt = t->flags & TEX_DXT;
-	if(dxt != 0 && dxt != 1 && dxt != DXT1A && dxt != 3 && dxt != 5)
+	if(dxt != 0 && dxt != 1 && dxt != DXT1A && dxt != 3 && dxt != 5 && dxt != ETC1 && dxt != ETC2_EAC)
 		WARN_RETURN(ERR::_4);
 	// .. orientation
 	const size_t orientation = t->flags & TEX_ORIENTATION;
@@ -517,6 +517,22 @@ void tex_set_global_orientation(int o)
 }
 
 
+static TexParallelForCB parallel_for = NULL;
+
+void tex_set_parallel_for(TexParallelForCB cb)
+{
+	parallel_for = cb;
+}
+
+void tex_parallel_for(size_t count, size_t chunkSize, TexJobCB cb, void* cbData)
+{
+	if(parallel_for)
+		parallel_for(count, chunkSize, cb, cbData);
+	else
+		cb(cbData, 0, count);
+}
+
+
 static void flip_to_global_orientation(Tex* t)
 {
 	// (can't use normal CHECK_TEX due to void return)
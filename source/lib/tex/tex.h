@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -142,7 +142,8 @@ enum TexFlags
 	/**
 	 * flags & TEX_DXT is a field indicating compression.
 	 * if 0, the texture is uncompressed;
-	 * otherwise, it holds the S3TC type: 1,3,5 or DXT1A.
+	 * otherwise, it holds the S3TC type: 1,3,5 or DXT1A,
+	 * or the ETC type: ETC1 or ETC2_EAC (see tex_etc.h).
 	 * not converted by default - glCompressedTexImage2D receives
 	 * the compressed data.
 	 **/
@@ -155,6 +156,15 @@ enum TexFlags
 	 **/
 	DXT1A = 7,
 
+	/**
+	 * ETC textures are stored in 4x4 blocks like S3TC (so all the block
+	 * size calculations apply to them too): ETC1 is RGB at 4bpp, and
+	 * ETC2_EAC is RGBA at 8bpp.
+	 * the values are arbitrary; do not rely on them!
+	 **/
+	ETC1 = 2,
+	ETC2_EAC = 4,
+
 	/**
 	 * indicates B and R pixel components are exchanged. depending on
 	 * flags & TEX_ALPHA or bpp, this means either BGR or BGRA.
@@ -252,6 +262,25 @@ extern Status tex_validate(const Tex* t);
  **/
 extern void tex_set_global_orientation(int orientation);
 
+/**
+ * callback that processes the items [begin, end) of a job.
+ **/
+typedef void (*TexJobCB)(void* cbData, size_t begin, size_t end);
+
+/**
+ * function that calls cb for the items [0, count), split into chunks of
+ * up to chunkSize items that may be processed by several threads at once,
+ * and only returns once they're all done.
+ **/
+typedef void (*TexParallelForCB)(size_t count, size_t chunkSize, TexJobCB cb, void* cbData);
+
+/**
+ * Allow the slower transforms (e.g. S3TC decompression of large textures)
+ * to split their work across threads, using the given function.
+ * @param parallelFor NULL (the default) does all the work on the calling thread.
+ **/
+extern void tex_set_parallel_for(TexParallelForCB parallelFor);
+
 
 /**
  * Manually register codecs. must be called before first use of a
@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -31,6 +31,7 @@
 #include "lib/timer.h"
 #include "lib/allocators/shared_ptr.h"
 #include "tex_codec.h"
+#include "tex_etc.h"
 
 
 // NOTE: the convention is bottom-up for DDS, but there's no way to tell.
@@ -40,9 +41,12 @@
 // S3TC decompression
 //-----------------------------------------------------------------------------
 
-// note: this code may not be terribly efficient. it's only used to
-// emulate hardware S3TC support - if that isn't available, performance
-// will suffer anyway due to increased video memory usage.
+// this is used to emulate hardware S3TC support (and for ETC textures,
+// which are decompressed by the same code via tex_etc), which makes it
+// a large part of the texture loading time on devices without it.
+// each block is decoded from a small table of its colors, and the rows of
+// blocks of all mipmap levels are split across threads (see
+// tex_set_parallel_for) for large textures.
 
 
 // for efficiency, we precalculate as much as possible about a block
@@ -61,36 +65,68 @@ public:
 		PrecalculateColor(dxt, c_block);
 	}
 
-	void WritePixel(size_t pixel_idx, u8* RESTRICT out) const
+	// write the 4x4 pixels of the block, whose rows are pitch bytes apart.
+	// out_Bpp must be 3 for DXT1 and 4 otherwise.
+	void WriteBlock(u8* RESTRICT out, size_t pitch, size_t out_Bpp) const
 	{
-		ENSURE(pixel_idx < 16);
-
-		// pixel index -> color selector (2 bit) -> color
-		const size_t c_selector = access_bit_tbl(c_selectors, pixel_idx, 2);
-		for(int i = 0; i < 3; i++)
-			out[i] = (u8)c[c_selector][i];
+		// convert the colors just once, rather than for every pixel
+		u8 colors[4][4];
+		for(int i = 0; i < 4; i++)
+		{
+			for(int j = 0; j < 3; j++)
+				colors[i][j] = (u8)c[i][j];
+			colors[i][A] = (u8)c[i][A];
+		}
 
-		// if no alpha, done
-		if(dxt == 1)
-			return;
+		u32 selectors = c_selectors;
+		for(int y = 0; y < 4; y++)
+		{
+			u8* RESTRICT pixel = out + y*pitch;
+			for(int x = 0; x < 4; x++)
+			{
+				// pixel index -> color selector (2 bit) -> color
+				const u8* color = colors[selectors & 3];
+				selectors >>= 2;
+				pixel[R] = color[R];
+				pixel[G] = color[G];
+				pixel[B] = color[B];
+				if(out_Bpp == 4)
+					pixel[A] = color[A];
+				pixel += out_Bpp;
+			}
+		}
 
-		size_t a;
 		if(dxt == 3)
 		{
 			// table of 4-bit alpha entries
-			a = access_bit_tbl(a_bits, pixel_idx, 4);
-			a |= a << 4; // expand to 8 bits (replicate high into low!)
+			u64 alphas = a_bits;
+			for(int y = 0; y < 4; y++)
+			{
+				u8* RESTRICT pixel = out + y*pitch;
+				for(int x = 0; x < 4; x++)
+				{
+					const u8 a = (u8)(alphas & 0xF);
+					alphas >>= 4;
+					pixel[A] = (u8)(a | (a << 4)); // expand to 8 bits (replicate high into low!)
+					pixel += 4;
+				}
+			}
 		}
 		else if(dxt == 5)
 		{
 			// pixel index -> alpha selector (3 bit) -> alpha
-			const size_t a_selector = access_bit_tbl(a_bits, pixel_idx, 3);
-			a = dxt5_a_tbl[a_selector];
+			u64 alphas = a_bits;
+			for(int y = 0; y < 4; y++)
+			{
+				u8* RESTRICT pixel = out + y*pitch;
+				for(int x = 0; x < 4; x++)
+				{
+					pixel[A] = dxt5_a_tbl[alphas & 7];
+					alphas >>= 3;
+					pixel += 4;
+				}
+			}
 		}
-		// (dxt == DXT1A)
-		else
-			a = c[c_selector][A];
-		out[A] = (u8)(a & 0xFF);
 	}
 
 private:
@@ -109,13 +145,6 @@ private:
 		for(int i = 0; i < 3; i++) dst[i] = (c0[i]+c1[i])/2;
 	}
 
-	template<typename T>
-	static inline size_t access_bit_tbl(T tbl, size_t idx, size_t bit_width)
-	{
-		size_t val = (tbl >> (idx*bit_width)) & bit_mask<T>(bit_width);
-		return val;
-	}
-
 	// extract a range of bits and expand to 8 bits (by replicating
 	// MS bits - see http://www.mindcontrol.org/~hplus/graphics/expand-bits.html ;
 	// this is also the algorithm used by graphics cards when decompressing S3TC).
@@ -181,12 +210,15 @@ private:
 		const bool is_dxt1_special_combination = (dxt == 1 || dxt == DXT1A) && rc[0] <= rc[1];
 
 		// c0 and c1 are the values of rc[], converted to 32bpp
+		// (all of the colors are opaque, unless the special combination says otherwise)
 		for(int i = 0; i < 2; i++)
 		{
 			c[i][R] = unpack_to_8(rc[i], 11, 5);
 			c[i][G] = unpack_to_8(rc[i],  5, 6);
 			c[i][B] = unpack_to_8(rc[i],  0, 5);
 		}
+		for(int i = 0; i < 4; i++)
+			c[i][A] = 255;
 
 		// c2 and c3 are combinations of c0 and c1:
 		if(is_dxt1_special_combination)
@@ -218,78 +250,133 @@ private:
 };
 
 
+// a mipmap level's position in the input and output
+struct S3tcLevel
+{
+	size_t blocks_w;
+	size_t blocks_h;
+	const u8* in;
+	u8* out;
+	size_t first_row;	// index of its first row of blocks, counting over all levels
+};
+
 struct S3tcDecompressInfo
 {
 	size_t dxt;
 	size_t s3tc_block_size;
 	size_t out_Bpp;
 	u8* out;
+	std::vector<S3tcLevel> levels;
+	size_t num_rows;
 };
 
-static void s3tc_decompress_level(size_t UNUSED(level), size_t level_w, size_t level_h,
+// records the level's position, so its rows of blocks can be decompressed later
+static void s3tc_add_level(size_t UNUSED(level), size_t level_w, size_t level_h,
 	const u8* RESTRICT level_data, size_t level_data_size, void* RESTRICT cbData)
 {
 	S3tcDecompressInfo* di = (S3tcDecompressInfo*)cbData;
-	const size_t dxt             = di->dxt;
-	const size_t s3tc_block_size = di->s3tc_block_size;
 
 	// note: 1x1 images are legitimate (e.g. in mipmaps). they report their
 	// width as such for glTexImage, but the S3TC data is padded to
 	// 4x4 pixel block boundaries.
-	const size_t blocks_w = DivideRoundUp(level_w, size_t(4));
-	const size_t blocks_h = DivideRoundUp(level_h, size_t(4));
-	const u8* s3tc_data = level_data;
-	ENSURE(level_data_size % s3tc_block_size == 0);
+	S3tcLevel l;
+	l.blocks_w = DivideRoundUp(level_w, size_t(4));
+	l.blocks_h = DivideRoundUp(level_h, size_t(4));
+	l.in = level_data;
+	l.out = di->out;
+	l.first_row = di->num_rows;
+	ENSURE(level_data_size == l.blocks_w*l.blocks_h * di->s3tc_block_size);
+	di->levels.push_back(l);
+
+	di->num_rows += l.blocks_h;
+	di->out += l.blocks_w*l.blocks_h * 16 * di->out_Bpp;
+}
+
+static void s3tc_decompress_row(const S3tcDecompressInfo* di, const S3tcLevel& l, size_t block_y)
+{
+	const size_t dxt = di->dxt;
+	const size_t out_Bpp = di->out_Bpp;
+	const size_t pitch = l.blocks_w*4 * out_Bpp;
+	const u8* s3tc_data = l.in + block_y*l.blocks_w * di->s3tc_block_size;
+	u8* out = l.out + block_y*4 * pitch;
 
-	for(size_t block_y = 0; block_y < blocks_h; block_y++)
+	for(size_t block_x = 0; block_x < l.blocks_w; block_x++)
 	{
-		for(size_t block_x = 0; block_x < blocks_w; block_x++)
+		if(tex_is_etc(dxt))
 		{
-			S3tcBlock block(dxt, s3tc_data);
-			s3tc_data += s3tc_block_size;
+			u8 rgba[16*4];
+			etc_decompress_block(dxt, s3tc_data, rgba);
 
-			size_t pixel_idx = 0;
 			for(int y = 0; y < 4; y++)
 			{
-				// this is ugly, but advancing after x, y and block_y loops
-				// is no better.
-				u8* out = (u8*)di->out + ((block_y*4+y)*blocks_w*4 + block_x*4) * di->out_Bpp;
+				u8* pixel = out + y*pitch;
 				for(int x = 0; x < 4; x++)
 				{
-					block.WritePixel(pixel_idx, out);
-					out += di->out_Bpp;
-					pixel_idx++;
+					memcpy(pixel, rgba + (y*4+x)*4, out_Bpp);
+					pixel += out_Bpp;
 				}
 			}
 		}
+		else
+		{
+			S3tcBlock block(dxt, s3tc_data);
+			block.WriteBlock(out, pitch, out_Bpp);
+		}
+
+		s3tc_data += di->s3tc_block_size;
+		out += 4 * out_Bpp;
 	}
+}
 
-	ENSURE(s3tc_data == level_data + level_data_size);
-	di->out += blocks_w*blocks_h * 16 * di->out_Bpp;
+// decompresses the rows of blocks [begin, end), counting over all levels
+static void s3tc_decompress_rows(void* cbData, size_t begin, size_t end)
+{
+	const S3tcDecompressInfo* di = (const S3tcDecompressInfo*)cbData;
+	for(size_t i = 0; i < di->levels.size(); i++)
+	{
+		const S3tcLevel& l = di->levels[i];
+		const size_t level_begin = std::max(begin, l.first_row);
+		const size_t level_end = std::min(end, l.first_row + l.blocks_h);
+		for(size_t row = level_begin; row < level_end; row++)
+			s3tc_decompress_row(di, l, row - l.first_row);
+	}
 }
 
 
-// decompress the given image (which is known to be stored as DXTn)
+// decompress the given image (which is known to be stored as DXTn or ETC)
 // effectively in-place. updates Tex fields.
 static Status s3tc_decompress(Tex* t)
 {
 	// alloc new image memory
 	// notes:
-	// - dxt == 1 is the only non-alpha case.
+	// - dxt == 1 and ETC1 are the only non-alpha cases.
 	// - adding or stripping alpha channels during transform is not
 	//   our job; we merely output the same pixel format as given
 	//   (tex.cpp's plain transform could cover it, if ever needed).
 	const size_t dxt = t->flags & TEX_DXT;
-	const size_t out_bpp = (dxt != 1)? 32 : 24;
+	const size_t out_bpp = (dxt != 1 && dxt != ETC1)? 32 : 24;
 	const size_t out_size = tex_img_size(t) * out_bpp / t->bpp;
 	shared_ptr<u8> decompressedData;
 	AllocateAligned(decompressedData, out_size, pageSize);
 
-	const size_t s3tc_block_size = (dxt == 3 || dxt == 5)? 16 : 8;
-	S3tcDecompressInfo di = { dxt, s3tc_block_size, out_bpp/8, decompressedData.get() };
+	S3tcDecompressInfo di;
+	di.dxt = dxt;
+	di.s3tc_block_size = tex_is_etc(dxt)? etc_block_size(dxt) : (dxt == 3 || dxt == 5)? 16 : 8;
+	di.out_Bpp = out_bpp/8;
+	di.out = decompressedData.get();
+	di.num_rows = 0;
 	const u8* s3tc_data = tex_get_data(t);
 	const int levels_to_skip = (t->flags & TEX_MIPMAPS)? 0 : TEX_BASE_LEVEL_ONLY;
-	tex_util_foreach_mipmap(t->w, t->h, t->bpp, s3tc_data, levels_to_skip, 4, s3tc_decompress_level, &di);
+	tex_util_foreach_mipmap(t->w, t->h, t->bpp, s3tc_data, levels_to_skip, 4, s3tc_add_level, &di);
+
+	// small textures aren't worth splitting up; otherwise, give each
+	// chunk roughly 16K pixels (based on the widest level's rows)
+	const size_t blocks_w = di.levels.empty()? 1 : di.levels[0].blocks_w;
+	if(di.num_rows * blocks_w < 4096)
+		s3tc_decompress_rows(&di, 0, di.num_rows);
+	else
+		tex_parallel_for(di.num_rows, std::max(size_t(1024) / blocks_w, size_t(1)), s3tc_decompress_rows, &di);
+
 	t->data = decompressedData;
 	t->dataSize = out_size;
 	t->ofs = 0;
@@ -376,6 +463,8 @@ static bool is_valid_dxt(size_t dxt)
 	case DXT1A:
 	case 3:
 	case 5:
+	case ETC1:
+	case ETC2_EAC:
 		return true;
 	default:
 		return false;
@@ -459,6 +548,17 @@ static Status decode_pf(const DDS_PIXELFORMAT* pf, size_t& bpp, size_t& flags)
 			flags |= 5;
 			flags |= TEX_ALPHA;	// see DDPF_ALPHAPIXELS decl
 			break;
+		// (there are no standard FOURCCs for ETC; these are only
+		// written by CTextureConverter, for the texture cache)
+		case FOURCC('E','T','C','1'):
+			bpp = 4;
+			flags |= ETC1;
+			break;
+		case FOURCC('E','T','C','2'):
+			bpp = 8;
+			flags |= ETC2_EAC;
+			flags |= TEX_ALPHA;
+			break;
 
 		default:
 			WARN_RETURN(ERR::TEX_FMT_INVALID);
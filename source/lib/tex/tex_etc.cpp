@@ -0,0 +1,409 @@
+/* Copyright (c) 2013 Wildfire Games
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * ETC1 / ETC2 block compression.
+ */
+
+#include "precompiled.h"
+
+#include "tex_etc.h"
+
+#include <climits>
+
+// bit layouts are as described in the OpenGL ES 3.0 specification (C.1).
+// note: unlike S3TC, blocks are stored big-endian and their pixels are
+// numbered column by column.
+
+// ETC1 intensity modifier tables. each pixel's 2-bit index (stored as
+// separate MSB and LSB bits) selects +a, +b, -a or -b.
+static const int etc1_modifiers[8][2] =
+{
+	{  2,   8 }, {  5,  17 }, {  9,  29 }, { 13,  42 },
+	{ 18,  60 }, { 24,  80 }, { 33, 106 }, { 47, 183 }
+};
+
+// EAC alpha modifier tables (multiplied by the block's multiplier).
+static const int eac_modifiers[16][8] =
+{
+	{ -3, -6,  -9, -15, 2, 5, 8, 14 },
+	{ -3, -7, -10, -13, 2, 6, 9, 12 },
+	{ -2, -5,  -8, -13, 1, 4, 7, 12 },
+	{ -2, -4,  -6, -13, 1, 3, 5, 12 },
+	{ -3, -6,  -8, -12, 2, 5, 7, 11 },
+	{ -3, -7,  -9, -11, 2, 6, 8, 10 },
+	{ -4, -7,  -8, -11, 3, 6, 7, 10 },
+	{ -3, -5,  -8, -11, 2, 4, 7, 10 },
+	{ -2, -6,  -8, -10, 1, 5, 7,  9 },
+	{ -2, -5,  -8, -10, 1, 4, 7,  9 },
+	{ -2, -4,  -8, -10, 1, 3, 7,  9 },
+	{ -2, -5,  -7, -10, 1, 4, 6,  9 },
+	{ -3, -4,  -7, -10, 2, 3, 6,  9 },
+	{ -1, -2,  -3, -10, 0, 1, 2,  9 },
+	{ -4, -6,  -8,  -9, 3, 5, 7,  8 },
+	{ -3, -5,  -7,  -9, 2, 4, 6,  8 }
+};
+
+// (table 13 has a zero modifier, which represents uniform alpha exactly)
+static const size_t EAC_UNIFORM_TABLE = 13;
+static const size_t EAC_UNIFORM_INDEX = 4;
+
+static inline int clamp_255(int x)
+{
+	return Clamp(x, 0, 255);
+}
+
+static inline int etc1_modifier(size_t table, size_t index)
+{
+	const int m = etc1_modifiers[table][index & 1];
+	return (index & 2)? -m : m;
+}
+
+// byte offset of (column-major) pixel i in row-major RGBA data
+static inline size_t pixel_offset(size_t i)
+{
+	const size_t x = i / 4, y = i % 4;
+	return (y*4 + x) * 4;
+}
+
+// which half of the block pixel i belongs to: the left/right 2x4 halves,
+// or the top/bottom 4x2 halves if flipped
+static inline size_t etc1_subblock(bool flip, size_t i)
+{
+	return flip? size_t(i % 4 >= 2) : size_t(i >= 8);
+}
+
+static inline int expand_4(int c)
+{
+	return (c << 4) | c;
+}
+
+static inline int expand_5(int c)
+{
+	return (c << 3) | (c >> 2);
+}
+
+
+//-----------------------------------------------------------------------------
+// ETC1 color blocks
+//-----------------------------------------------------------------------------
+
+// choose the modifier table and pixel indices that best represent one
+// half of the block with the given base color. returns the squared error.
+static int etc1_fit_subblock(const u8* RESTRICT rgba, bool flip, size_t subblock, const int base[3], size_t& table, u32& msbs, u32& lsbs)
+{
+	int best_err = INT_MAX;
+	for(size_t t = 0; t < 8; t++)
+	{
+		int err = 0;
+		u32 t_msbs = 0, t_lsbs = 0;
+		for(size_t i = 0; i < 16 && err < best_err; i++)
+		{
+			if(etc1_subblock(flip, i) != subblock)
+				continue;
+
+			const u8* pixel = rgba + pixel_offset(i);
+			int best_pixel_err = INT_MAX;
+			size_t best_index = 0;
+			for(size_t index = 0; index < 4; index++)
+			{
+				const int m = etc1_modifier(t, index);
+				int pixel_err = 0;
+				for(int c = 0; c < 3; c++)
+				{
+					const int d = clamp_255(base[c] + m) - pixel[c];
+					pixel_err += d*d;
+				}
+				if(pixel_err < best_pixel_err)
+				{
+					best_pixel_err = pixel_err;
+					best_index = index;
+				}
+			}
+
+			err += best_pixel_err;
+			t_msbs |= u32(best_index >> 1) << i;
+			t_lsbs |= u32(best_index & 1) << i;
+		}
+
+		if(err < best_err)
+		{
+			best_err = err;
+			table = t;
+			msbs = t_msbs;
+			lsbs = t_lsbs;
+		}
+	}
+	return best_err;
+}
+
+// try both orientations in both individual (4-bit colors) and differential
+// (5-bit color and 3-bit offset) mode, using each half's average color as
+// its base. this is far from optimal, but fast enough to run on every
+// texture and its mipmaps.
+static void etc1_compress_block(const u8* RESTRICT rgba, u8* RESTRICT block)
+{
+	int best_err = INT_MAX;
+	for(int flip = 0; flip < 2; flip++)
+	{
+		int avg[2][3] = { { 0, 0, 0 }, { 0, 0, 0 } };
+		for(size_t i = 0; i < 16; i++)
+		{
+			const u8* pixel = rgba + pixel_offset(i);
+			const size_t subblock = etc1_subblock(flip != 0, i);
+			for(int c = 0; c < 3; c++)
+				avg[subblock][c] += pixel[c];
+		}
+		for(size_t subblock = 0; subblock < 2; subblock++)
+			for(int c = 0; c < 3; c++)
+				avg[subblock][c] = (avg[subblock][c] + 4) / 8;
+
+		for(int diff = 0; diff < 2; diff++)
+		{
+			int q[2][3];	// quantized base colors
+			int base[2][3];
+			for(int c = 0; c < 3; c++)
+			{
+				if(diff)
+				{
+					// (clamping the offset keeps the second color in range, so
+					// the block can't be mistaken for one of ETC2's extra modes)
+					q[0][c] = (avg[0][c]*31 + 127) / 255;
+					const int delta = Clamp((avg[1][c]*31 + 127) / 255 - q[0][c], -4, 3);
+					q[1][c] = q[0][c] + delta;
+					base[0][c] = expand_5(q[0][c]);
+					base[1][c] = expand_5(q[1][c]);
+				}
+				else
+				{
+					q[0][c] = (avg[0][c]*15 + 127) / 255;
+					q[1][c] = (avg[1][c]*15 + 127) / 255;
+					base[0][c] = expand_4(q[0][c]);
+					base[1][c] = expand_4(q[1][c]);
+				}
+			}
+
+			size_t tables[2];
+			u32 msbs = 0, lsbs = 0;
+			int err = 0;
+			for(size_t subblock = 0; subblock < 2; subblock++)
+			{
+				u32 subblock_msbs = 0, subblock_lsbs = 0;
+				err += etc1_fit_subblock(rgba, flip != 0, subblock, base[subblock], tables[subblock], subblock_msbs, subblock_lsbs);
+				msbs |= subblock_msbs;
+				lsbs |= subblock_lsbs;
+			}
+
+			if(err >= best_err)
+				continue;
+			best_err = err;
+
+			for(int c = 0; c < 3; c++)
+			{
+				if(diff)
+					block[c] = u8((q[0][c] << 3) | ((q[1][c] - q[0][c]) & 7));
+				else
+					block[c] = u8((q[0][c] << 4) | q[1][c]);
+			}
+			block[3] = u8((tables[0] << 5) | (tables[1] << 2) | (diff << 1) | flip);
+			block[4] = u8(msbs >> 8);
+			block[5] = u8(msbs);
+			block[6] = u8(lsbs >> 8);
+			block[7] = u8(lsbs);
+		}
+	}
+}
+
+static void etc1_decompress_block(const u8* RESTRICT block, u8* RESTRICT rgba)
+{
+	const bool diff = (block[3] & 2) != 0;
+	const bool flip = (block[3] & 1) != 0;
+
+	int base[2][3];
+	for(int c = 0; c < 3; c++)
+	{
+		if(diff)
+		{
+			const int q = block[c] >> 3;
+			const int delta = ((block[c] & 7) ^ 4) - 4;	// sign-extend
+			base[0][c] = expand_5(q);
+			base[1][c] = expand_5(q + delta);
+		}
+		else
+		{
+			base[0][c] = expand_4(block[c] >> 4);
+			base[1][c] = expand_4(block[c] & 0xF);
+		}
+	}
+
+	const size_t tables[2] = { size_t(block[3] >> 5), size_t((block[3] >> 2) & 7) };
+	const u32 msbs = (u32(block[4]) << 8) | block[5];
+	const u32 lsbs = (u32(block[6]) << 8) | block[7];
+
+	for(size_t i = 0; i < 16; i++)
+	{
+		const size_t subblock = etc1_subblock(flip, i);
+		const size_t index = (((msbs >> i) & 1) << 1) | ((lsbs >> i) & 1);
+		const int m = etc1_modifier(tables[subblock], index);
+
+		u8* pixel = rgba + pixel_offset(i);
+		for(int c = 0; c < 3; c++)
+			pixel[c] = u8(clamp_255(base[subblock][c] + m));
+		pixel[3] = 255;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// EAC alpha blocks
+//-----------------------------------------------------------------------------
+
+// try every table with the multipliers that make it span the block's alpha
+// range, either centred on that range or aligned with either end of it.
+static void eac_compress_alpha_block(const u8* RESTRICT rgba, u8* RESTRICT block)
+{
+	int a_min = 255, a_max = 0;
+	for(size_t i = 0; i < 16; i++)
+	{
+		const int a = rgba[i*4 + 3];
+		a_min = std::min(a_min, a);
+		a_max = std::max(a_max, a);
+	}
+
+	int best_base = a_min;
+	int best_mult = 1;
+	size_t best_table = EAC_UNIFORM_TABLE;
+	u64 best_indices = 0;
+	for(size_t i = 0; i < 16; i++)
+		best_indices = (best_indices << 3) | EAC_UNIFORM_INDEX;
+
+	if(a_min != a_max)
+	{
+		int best_err = INT_MAX;
+		for(size_t t = 0; t < 16; t++)
+		{
+			const int* mods = eac_modifiers[t];
+			const int m_min = mods[3], m_max = mods[7];
+			const int mult0 = (a_max - a_min) / (m_max - m_min);
+			for(int mult = std::max(mult0, 1); mult <= std::min(mult0 + 1, 15); mult++)
+			{
+				const int bases[3] =
+				{
+					(a_min + a_max - (m_min + m_max)*mult + 1) / 2,
+					a_min - m_min*mult,
+					a_max - m_max*mult
+				};
+				for(size_t b = 0; b < 3; b++)
+				{
+					const int base = clamp_255(bases[b]);
+
+					int err = 0;
+					u64 indices = 0;
+					for(size_t i = 0; i < 16; i++)
+					{
+						const int a = rgba[pixel_offset(i) + 3];
+						int best_pixel_err = INT_MAX;
+						size_t best_index = 0;
+						for(size_t index = 0; index < 8; index++)
+						{
+							const int d = clamp_255(base + mods[index]*mult) - a;
+							if(d*d < best_pixel_err)
+							{
+								best_pixel_err = d*d;
+								best_index = index;
+							}
+						}
+						err += best_pixel_err;
+						indices = (indices << 3) | best_index;
+					}
+
+					if(err < best_err)
+					{
+						best_err = err;
+						best_base = base;
+						best_mult = mult;
+						best_table = t;
+						best_indices = indices;
+					}
+				}
+			}
+		}
+	}
+
+	block[0] = u8(best_base);
+	block[1] = u8((best_mult << 4) | best_table);
+	for(int i = 0; i < 6; i++)
+		block[2+i] = u8(best_indices >> (40 - 8*i));
+}
+
+static void eac_decompress_alpha_block(const u8* RESTRICT block, u8* RESTRICT rgba)
+{
+	const int base = block[0];
+	const int mult = block[1] >> 4;
+	const int* mods = eac_modifiers[block[1] & 0xF];
+
+	u64 indices = 0;
+	for(int i = 0; i < 6; i++)
+		indices = (indices << 8) | block[2+i];
+
+	for(size_t i = 0; i < 16; i++)
+	{
+		const size_t index = size_t(indices >> (45 - 3*i)) & 7;
+		rgba[pixel_offset(i) + 3] = u8(clamp_255(base + mods[index]*mult));
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+
+size_t etc_block_size(size_t etc)
+{
+	ENSURE(etc == ETC1 || etc == ETC2_EAC);
+	return (etc == ETC2_EAC)? 16 : 8;
+}
+
+void etc_compress_block(size_t etc, const u8* RESTRICT rgba, u8* RESTRICT block)
+{
+	ENSURE(etc == ETC1 || etc == ETC2_EAC);
+
+	// (the alpha block comes first, as with DXT3/5)
+	if(etc == ETC2_EAC)
+	{
+		eac_compress_alpha_block(rgba, block);
+		block += 8;
+	}
+
+	etc1_compress_block(rgba, block);
+}
+
+void etc_decompress_block(size_t etc, const u8* RESTRICT block, u8* RESTRICT rgba)
+{
+	ENSURE(etc == ETC1 || etc == ETC2_EAC);
+
+	if(etc == ETC2_EAC)
+	{
+		etc1_decompress_block(block+8, rgba);
+		eac_decompress_alpha_block(block, rgba);
+	}
+	else
+		etc1_decompress_block(block, rgba);
+}
@@ -0,0 +1,76 @@
+/* Copyright (c) 2013 Wildfire Games
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * ETC1 / ETC2 block compression.
+ *
+ * NVTT can't produce these formats, so the texture converter uses this to
+ * encode textures for GPUs without S3TC (i.e. GLES), and the DDS codec
+ * uses it to decompress them if they can't be uploaded as they are.
+ *
+ * Blocks cover 4x4 pixels, like S3TC. ETC1 blocks are 8 bytes of RGB;
+ * ETC2_EAC blocks are 16 bytes: an EAC alpha block followed by a color
+ * block. Only ETC1's color modes are used (which are also valid ETC2) -
+ * the T, H and planar modes added by ETC2 are neither produced nor decoded,
+ * so this can only decompress what it compressed itself.
+ */
+
+#ifndef INCLUDED_TEX_ETC
+#define INCLUDED_TEX_ETC
+
+#include "lib/tex/tex.h"
+
+/**
+ * @param flags TexFlags
+ * @return whether flags & TEX_DXT holds one of the ETC types.
+ **/
+inline bool tex_is_etc(size_t flags)
+{
+	const size_t dxt = flags & TEX_DXT;
+	return dxt == ETC1 || dxt == ETC2_EAC;
+}
+
+/**
+ * @param etc ETC1 or ETC2_EAC
+ * @return size [bytes] of one compressed block.
+ **/
+extern size_t etc_block_size(size_t etc);
+
+/**
+ * compress one 4x4 block.
+ *
+ * @param etc ETC1 or ETC2_EAC (alpha is ignored for ETC1)
+ * @param rgba 16 RGBA pixels, row by row.
+ * @param block receives etc_block_size(etc) bytes.
+ **/
+extern void etc_compress_block(size_t etc, const u8* RESTRICT rgba, u8* RESTRICT block);
+
+/**
+ * decompress one 4x4 block that was produced by etc_compress_block.
+ *
+ * @param etc ETC1 or ETC2_EAC
+ * @param block etc_block_size(etc) bytes.
+ * @param rgba receives 16 RGBA pixels, row by row (alpha is 255 for ETC1).
+ **/
+extern void etc_decompress_block(size_t etc, const u8* RESTRICT block, u8* RESTRICT rgba);
+
+#endif	// #ifndef INCLUDED_TEX_ETC
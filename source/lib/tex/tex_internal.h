@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -30,6 +30,7 @@
 #include "lib/pointer_typedefs.h"
 #include "lib/allocators/dynarray.h"
 #include "lib/file/io/io.h"	// io::Allocate
+#include "tex.h"	// TexJobCB
 
 /**
  * check if the given texture format is acceptable: 8bpp grey,
@@ -58,4 +59,16 @@ extern Status tex_validate_plain_format(size_t bpp, size_t flags);
  **/
 extern bool tex_orientations_match(size_t src_flags, size_t dst_orientation);
 
+
+/**
+ * run a job through the function set by tex_set_parallel_for, if any.
+ *
+ * used by the codecs' transforms.
+ *
+ * @param count number of items
+ * @param chunkSize maximum number of items per call of cb
+ * @param cb called concurrently for the ranges of items
+ **/
+extern void tex_parallel_for(size_t count, size_t chunkSize, TexJobCB cb, void* cbData);
+
 #endif	// #ifndef INCLUDED_TEX_INTERNAL
@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -238,3 +238,35 @@ std::wstring wstring_from_utf8(const std::string& src, Status* err)
 	}
 	return dst;
 }
+
+
+size_t utf16_from_utf8(const char* src, size_t srcSize, u16* dst, Status* err)
+{
+	if(err)
+		*err = INFO::OK;
+
+	u16* dstPos = dst;
+	const UTF8* srcPos = (const UTF8*)src;
+	const UTF8* const srcEnd = srcPos + srcSize;
+	while(srcPos < srcEnd)
+	{
+		const UTF32 u = UTF8Codec::Decode(srcPos, srcEnd, err);
+		*dstPos++ = (u16)ReplaceIfInvalid(u, err);
+	}
+	return dstPos - dst;
+}
+
+
+size_t utf8_from_utf16(const u16* src, size_t srcSize, char* dst, Status* err)
+{
+	if(err)
+		*err = INFO::OK;
+
+	UTF8* dstPos = (UTF8*)dst;
+	for(size_t i = 0; i < srcSize; i++)
+	{
+		const UTF32 u = ReplaceIfInvalid(UTF32(src[i]), err);
+		UTF8Codec::Encode(u, dstPos);
+	}
+	return dstPos - (UTF8*)dst;
+}
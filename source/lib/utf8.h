@@ -1,4 +1,4 @@
-/* Copyright (c) 2010 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -49,4 +49,24 @@ LIB_API std::wstring wstring_from_utf8(const std::string& s, Status* err = 0);
  **/
 LIB_API std::string utf8_from_wstring(const std::wstring& s, Status* err = 0);
 
+/**
+ * convert UTF-8 directly to UTF-16 (e.g. for SpiderMonkey), without
+ * going through a wide string. as with wstring_from_utf8, only the BMP
+ * is supported, so every character is a single code unit.
+ *
+ * @param src, srcSize input (UTF-8)
+ * @param dst receives the output; must have room for srcSize code units.
+ * @param err see wstring_from_utf8
+ * @return number of code units written.
+ **/
+LIB_API size_t utf16_from_utf8(const char* src, size_t srcSize, u16* dst, Status* err = 0);
+
+/**
+ * opposite of utf16_from_utf8
+ *
+ * @param dst must have room for 3*srcSize bytes.
+ * @return number of bytes written.
+ **/
+LIB_API size_t utf8_from_utf16(const u16* src, size_t srcSize, char* dst, Status* err = 0);
+
 #endif	// #ifndef INCLUDED_UTF8
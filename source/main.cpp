@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -39,6 +39,8 @@ that of Atlas depending on commandline parameters.
 #include "lib/ogl.h"
 #include "lib/timer.h"
 #include "lib/external_libraries/libsdl.h"
+#include "lib/sysdep/os_cpu.h"
+#include "lib/tex/tex_codec.h"
 
 #include "ps/ArchiveBuilder.h"
 #include "ps/CConsole.h"
@@ -48,10 +50,14 @@ that of Atlas depending on commandline parameters.
 #include "ps/Globals.h"
 #include "ps/Hotkey.h"
 #include "ps/Loader.h"
+#include "ps/MemoryStats.h"
+#include "ps/PerformanceReport.h"
 #include "ps/Profile.h"
 #include "ps/Profiler2.h"
 #include "ps/Pyrogenesis.h"
 #include "ps/Replay.h"
+#include "ps/SavedGame.h"
+#include "ps/ThreadPool.h"
 #include "ps/TouchInput.h"
 #include "ps/UserReport.h"
 #include "ps/Util.h"
@@ -64,6 +70,8 @@ that of Atlas depending on commandline parameters.
 #include "ps/GameSetup/Paths.h"
 #include "ps/XML/Xeromyces.h"
 #include "network/NetClient.h"
+#include "network/NetHost.h"
+#include "network/NetMessage.h"
 #include "network/NetServer.h"
 #include "network/NetSession.h"
 #include "graphics/Camera.h"
@@ -167,6 +175,14 @@ static InReaction MainInputHandler(const SDL_Event_* ev)
 			g_Profiler2.EnableHTTP();
 			return IN_HANDLED;
 		}
+		else if (hotkey == "profile2.capture")
+		{
+			if (g_Profiler2.IsCapturing())
+				g_Profiler2.DisableCapture();
+			else
+				g_Profiler2.EnableCapture(psLogDir()/"profile2.capture");
+			return IN_HANDLED;
+		}
 		break;
 	}
 
@@ -175,13 +191,16 @@ static InReaction MainInputHandler(const SDL_Event_* ev)
 
 
 // dispatch all pending events to the various receivers.
-static void PumpEvents()
+// returns whether any events were dispatched
+static bool PumpEvents()
 {
 	PROFILE3("dispatch events");
 
+	bool anyEvents = false;
 	SDL_Event_ ev;
 	while (SDL_PollEvent(&ev.ev))
 	{
+		anyEvents = true;
 		PROFILE2("event");
 		if (g_GUI)
 		{
@@ -193,6 +212,8 @@ static void PumpEvents()
 	}
 
 	g_TouchInput.Frame();
+
+	return anyEvents;
 }
 
 
@@ -226,7 +247,8 @@ return false;
 }
 
 
-static int ProgressiveLoad()
+// returns whether a load is in progress
+static bool ProgressiveLoad()
 {
 	PROFILE3("progressive load");
 
@@ -239,7 +261,7 @@ static int ProgressiveLoad()
 		{
 			// no load active => no-op (skip code below)
 		case INFO::OK:
-			return 0;
+			return false;
 			// current task didn't complete. we only care about this insofar as the
 			// load process is therefore not yet finished.
 		case ERR::TIMED_OUT:
@@ -268,7 +290,7 @@ static int ProgressiveLoad()
 	}
 
 	GUI_DisplayLoadProgress(progress_percent, description);
-	return 0;
+	return true;
 }
 
 
@@ -289,6 +311,31 @@ static void RendererIncrementalLoad()
 
 static bool quit = false;	// break out of main loop
 
+// rendering benchmark requested on the command line, if any
+static CRenderBenchmark* g_RenderBenchmark = NULL;
+
+// Waits until at least 1/maxFrameRate seconds have passed since frameStart
+// (without limit if maxFrameRate is 0), still servicing the network meanwhile.
+static void LimitFrameRate(double frameStart, int maxFrameRate)
+{
+	if (maxFrameRate <= 0)
+		return;
+
+	PROFILE3("frame rate limit");
+	const double frameEnd = frameStart + 1.0 / maxFrameRate;
+	double remaining;
+	while ((remaining = frameEnd - timer_Time()) > 0.0)
+	{
+		SDL_Delay((u32)std::min(remaining * 1000.0 + 0.5, 10.0));
+
+		if (g_NetClient)
+		{
+			g_NetClient->Poll();
+			g_NetClient->Flush();
+		}
+	}
+}
+
 static void Frame()
 {
 	g_Profiler2.RecordFrameStart();
@@ -296,6 +343,13 @@ static void Frame()
 	g_Profiler2.IncrementFrameNumber();
 	PROFILE2_ATTR("%d", g_Profiler2.GetFrameNumber());
 
+	// Show the memory churn on the same timeline as the frame's regions
+	static long lastAllocations = CProfileManager::GetMemoryAllocationCount();
+	long allocations = CProfileManager::GetMemoryAllocationCount();
+	PROFILE2_COUNTER("allocations per frame", allocations - lastAllocations);
+	lastAllocations = allocations;
+	MemoryStats::RecordProfilerCounters();
+
 	ogl_WarnIfError();
 
 	// get elapsed time
@@ -322,7 +376,8 @@ static void Frame()
 	// If we are not running a multiplayer game, disable updates when the game is
 	// minimized or out of focus and relinquish the CPU a bit, in order to make 
 	// debugging easier.
-	if(g_PauseOnFocusLoss && !g_NetClient && !g_app_has_focus)
+	// (Benchmarks are left running, since they're usually not being watched.)
+	if(g_PauseOnFocusLoss && !g_NetClient && !g_app_has_focus && !g_RenderBenchmark)
 	{
 		PROFILE3("non-focus delay");
 		need_update = false;
@@ -330,10 +385,6 @@ static void Frame()
 		SDL_Delay(10);
 	}
 
-	// TODO: throttling: limit update and render frequency to the minimum.
-	// this is mostly relevant for "inactive" state, so that other windows
-	// get enough CPU time, but it's always nice for power+thermal management.
-
 	bool is_building_archive = ProgressiveBuildArchive();
 
 	// this scans for changed files/directories and reloads them, thus
@@ -344,11 +395,11 @@ static void Frame()
 	if(!is_building_archive)
 		ReloadChangedFiles();
 
-	ProgressiveLoad();
+	const bool loading = ProgressiveLoad();
 
 	RendererIncrementalLoad();
 
-	PumpEvents();
+	const bool had_input = PumpEvents();
 
 	// if the user quit by closing the window, the GL context will be broken and
 	// may crash when we call Render() on some drivers, so leave this loop
@@ -366,6 +417,10 @@ static void Frame()
 	if (g_NetClient)
 		g_NetClient->Poll();
 
+	SavedGames::Poll();
+
+	PollScreenshots();
+
 	ogl_WarnIfError();
 
 	g_GUI->TickObjects();
@@ -385,8 +440,41 @@ static void Frame()
 
 	g_UserReporter.Update();
 
+	g_PerformanceReporter.RecordFrame();
+
 	g_Console->Update(realTimeSinceLastFrame);
 
+	// Throttling, to leave the CPU and GPU idle where possible (for the sake of
+	// other windows, and the power and thermal management of laptops).
+	// While the game is paused and nothing changes, rendering the same frame
+	// again is pointless, so only do that occasionally (for GUI timers and the like).
+	// (Benchmarks have to run at full speed.)
+	const bool game_started = g_Game && g_Game->IsGameStarted();
+	const bool game_idle = game_started && (g_Game->m_Paused || !need_update);
+	int max_frame_rate = 0;
+	if (!g_RenderBenchmark)
+	{
+		if (!g_app_has_focus || g_app_minimized)
+			max_frame_rate = g_FrameRateLimitBackground;
+		else if ((!game_started && !loading) || game_idle)
+			max_frame_rate = g_FrameRateLimitMenus;
+	}
+
+	if (need_render && game_idle && !g_RenderBenchmark && g_FrameRateLimitPaused > 0)
+	{
+		static double last_render_time = 0.0;
+		static CMatrix3D last_camera;
+		const CMatrix3D& camera = g_Game->GetView()->GetCamera()->GetOrientation();
+		if (!had_input && !g_GameRestarted && camera == last_camera &&
+			time - last_render_time < 1.0 / g_FrameRateLimitPaused)
+			need_render = false;
+		else
+		{
+			last_render_time = time;
+			last_camera = camera;
+		}
+	}
+
 	ogl_WarnIfError();
 	if(need_render)
 	{
@@ -401,9 +489,14 @@ static void Frame()
 	}
 	ogl_WarnIfError();
 
+	if (g_RenderBenchmark && !g_RenderBenchmark->Update())
+		kill_mainloop();
+
 	g_Profiler.Frame();
 
 	g_GameRestarted = false;
+
+	LimitFrameRate(time, max_frame_rate);
 }
 
 
@@ -439,6 +532,116 @@ void restart_mainloop_in_atlas()
 	restart_in_atlas = true;
 }
 
+/**
+ * Dedicated (headless) multiplayer host mode: runs one network server for each
+ * "-dedicated-host=<file>" argument (containing the game setup attributes as JSON),
+ * on consecutive ports, without initialising the graphics, GUI, sound or simulation.
+ * Each game is started once "-dedicated-host-players" players (default 2) have joined,
+ * and this returns once all the games have finished.
+ *
+ * Each "-dedicated-relay=<address>[:<port>]" argument similarly runs a spectator relay
+ * for the game hosted at that address, on the next port, which passes on the game
+ * "-dedicated-relay-delay" seconds (default 0) after it happens.
+ */
+static void RunDedicatedHost(const CmdLineArgs& args)
+{
+	Paths paths(args);
+
+	u16 port = PS_DEFAULT_PORT;
+	if (args.Has("dedicated-host-port"))
+		port = (u16)args.Get("dedicated-host-port").ToUInt();
+
+	int players = 2;
+	if (args.Has("dedicated-host-players"))
+		players = args.Get("dedicated-host-players").ToInt();
+
+	// Name the logs by port, so several hosts can run on the same machine
+	CreateDirectories(paths.Logs(), 0700);
+	std::wstring logName = L"dedicated-host-" + CStrW::FromUInt(port);
+	g_Logger = new CLogger(
+		new std::ofstream(OsString(paths.Logs() / (logName + L"-mainlog.html")).c_str(), std::ofstream::out | std::ofstream::trunc),
+		new std::ofstream(OsString(paths.Logs() / (logName + L"-interestinglog.html")).c_str(), std::ofstream::out | std::ofstream::trunc),
+		true, true, true);
+
+	CNetHost::Initialize();
+
+	std::vector<CNetServer*> servers;
+	std::vector<CStr> setupFiles = args.GetMultiple("dedicated-host");
+	for (size_t i = 0; i < setupFiles.size(); ++i)
+	{
+		std::ifstream file(OsString(OsPath(setupFiles[i])).c_str());
+		std::stringstream attrs;
+		attrs << file.rdbuf();
+		if (!file.good() || attrs.str().empty())
+		{
+			LOGERROR(L"Dedicated host: failed to read game setup file '%hs'", setupFiles[i].c_str());
+			continue;
+		}
+
+		CNetServer* server = new CNetServer(players);
+		server->UpdateGameAttributes(attrs.str());
+		if (!server->SetupConnection(port + i))
+		{
+			LOGERROR(L"Dedicated host: failed to listen on port %u", (unsigned int)(port + i));
+			delete server;
+			continue;
+		}
+
+		debug_printf(L"Hosting '%hs' on port %u\n", setupFiles[i].c_str(), (unsigned int)(port + i));
+		servers.push_back(server);
+	}
+
+	u32 relayDelay = 0;
+	if (args.Has("dedicated-relay-delay"))
+		relayDelay = args.Get("dedicated-relay-delay").ToUInt() * 1000;
+
+	std::vector<CStr> relayHosts = args.GetMultiple("dedicated-relay");
+	for (size_t i = 0; i < relayHosts.size(); ++i)
+	{
+		u16 relayPort = port + setupFiles.size() + i;
+
+		CStr hostAddress = relayHosts[i];
+		u16 hostPort = PS_DEFAULT_PORT;
+		long colon = hostAddress.Find(':');
+		if (colon >= 0)
+		{
+			hostPort = (u16)CStr(hostAddress.substr(colon + 1)).ToUInt();
+			hostAddress = hostAddress.substr(0, colon);
+		}
+
+		CNetServer* server = new CNetServer();
+		if (!server->SetupRelay(hostAddress, hostPort, relayPort, relayDelay))
+		{
+			LOGERROR(L"Dedicated host: failed to relay '%hs' on port %u", relayHosts[i].c_str(), (unsigned int)relayPort);
+			delete server;
+			continue;
+		}
+
+		debug_printf(L"Relaying '%hs' on port %u\n", relayHosts[i].c_str(), (unsigned int)relayPort);
+		servers.push_back(server);
+	}
+
+	// The servers do all their work in their own threads, so just wait for them to finish
+	while (!servers.empty())
+	{
+		SDL_Delay(1000);
+
+		for (size_t i = 0; i < servers.size(); )
+		{
+			if (servers[i]->IsGameFinished())
+			{
+				delete servers[i];
+				servers.erase(servers.begin() + i);
+			}
+			else
+				++i;
+		}
+	}
+
+	CNetHost::Deinitialize();
+	SAFE_DELETE(g_Logger);
+}
+
 // moved into a helper function to ensure args is destroyed before
 // exit(), which may result in a memory leak.
 static void RunGameOrAtlas(int argc, const char* argv[])
@@ -457,8 +660,8 @@ static void RunGameOrAtlas(int argc, const char* argv[])
 	if(ran_atlas)
 		return;
 
-	// run non-visual simulation replay if requested
-	if (args.Has("replay"))
+	// run non-visual simulation replay (or a batch of them, or a benchmark) if requested
+	if (args.Has("replay") || args.Has("replay-batch") || args.Has("bench"))
 	{
 		// TODO: Support mods
 		Paths paths(args);
@@ -466,9 +669,47 @@ static void RunGameOrAtlas(int argc, const char* argv[])
 		g_VFS->Mount(L"cache/", paths.Cache(), VFS_MOUNT_ARCHIVABLE);
 		g_VFS->Mount(L"", paths.RData()/"mods"/"public", VFS_MOUNT_MUST_EXIST);
 
+		if (args.Has("replay-batch"))
+		{
+			size_t jobs = os_cpu_NumProcessors();
+			if (args.Has("replay-jobs"))
+				jobs = args.Get("replay-jobs").ToUInt();
+			OsPath summary = args.Has("replay-summary") ? OsPath(args.Get("replay-summary")) : OsPath("replay_summary.json");
+
+			CReplayBatch batch(OsPath(args.Get("replay-batch")), jobs);
+			batch.Run(summary);
+		}
+		else if (args.Has("bench"))
+		{
+			CSimulationBenchmark bench(args.Get("bench"));
+			if (args.Has("bench-map"))
+				bench.SetMap(args.Get("bench-map").FromUTF8());
+			if (args.Has("bench-turns"))
+				bench.SetTurns(args.Get("bench-turns").ToUInt());
+			if (args.Has("bench-scale"))
+				bench.SetScale(args.Get("bench-scale").ToFloat());
+			if (args.Has("bench-output"))
+				bench.SetOutputPath(OsPath(args.Get("bench-output")));
+			if (!bench.Run())
+			{
+				std::vector<std::string> names = CSimulationBenchmark::GetScenarioNames();
+				debug_printf(L"Available scenarios:\n");
+				for (size_t i = 0; i < names.size(); ++i)
+					debug_printf(L"  %hs\n", names[i].c_str());
+			}
+		}
+		else
 		{
 			CReplayPlayer replay;
 			replay.Load(args.Get("replay"));
+			if (args.Has("replay-keyframes"))
+				replay.SetKeyframeInterval(args.Get("replay-keyframes").ToUInt());
+			if (args.Has("replay-from"))
+				replay.SetStartTurn(args.Get("replay-from").ToUInt());
+			if (args.Has("replay-hashes"))
+				replay.SetHashInterval(args.Get("replay-hashes").ToUInt());
+			if (args.Has("replay-summary"))
+				replay.SetSummaryPath(OsPath(args.Get("replay-summary")));
 			replay.Replay();
 		}
 
@@ -478,6 +719,14 @@ static void RunGameOrAtlas(int argc, const char* argv[])
 		return;
 	}
 
+	// run a headless multiplayer host or relay if requested
+	if (args.Has("dedicated-host") || args.Has("dedicated-relay"))
+	{
+		RunDedicatedHost(args);
+		CXeromyces::Terminate();
+		return;
+	}
+
 	// run in archive-building mode if requested
 	if (args.Has("archivebuild"))
 	{
@@ -491,7 +740,65 @@ static void RunGameOrAtlas(int argc, const char* argv[])
 			zip = mod.Filename().ChangeExtension(L".zip");
 
 		CArchiveBuilder builder(mod, paths.Cache());
-		builder.Build(zip, args.Has("archivebuild-compress"));
+		if (args.Has("archivebuild-trace"))
+			builder.OrderByTrace(OsPath(args.Get("archivebuild-trace")));
+		const bool fastCompression = args.Has("archivebuild-compress-fast");
+		builder.Build(zip, args.Has("archivebuild-compress") || fastCompression, fastCompression);
+
+		CXeromyces::Terminate();
+		return;
+	}
+
+	// convert all the mods' XML files into the XMB cache, and/or their textures into
+	// the texture cache, if requested, e.g. so that packages can be shipped with
+	// (or first runs can start from) a warm cache
+	if (args.Has("xmbcache") || args.Has("texturecache"))
+	{
+		Paths paths(args);
+		g_VFS = CreateVfs(20 * MiB);
+		g_VFS->Mount(L"cache/", paths.Cache(), VFS_MOUNT_ARCHIVABLE);
+		g_VFS->Mount(L"", paths.RData()/"mods"/"public", VFS_MOUNT_MUST_EXIST);
+		std::vector<CStr> mods = args.GetMultiple("mod");
+		for (size_t i = 0; i < mods.size(); ++i)
+			g_VFS->Mount(L"", paths.RData()/"mods"/OsPath(mods[i])/"", VFS_MOUNT_MUST_EXIST, i+1);
+
+		// (The shared thread pool isn't created outside of the normal game init)
+		g_ThreadPool = new CThreadPool(std::max(os_cpu_NumProcessors(), (size_t)1) - 1);
+
+		if (args.Has("xmbcache"))
+		{
+			const size_t converted = CXeromyces::WarmCache(g_VFS, args.Get("xmbcache").FromUTF8());
+			debug_printf(L"Converted %lu XML files\n", (unsigned long)converted);
+		}
+
+		if (args.Has("texturecache"))
+		{
+			tex_codec_register_all();
+			{
+				// (Use the slower high-quality compression, since nobody's waiting to play)
+				CTextureManager textureManager(g_VFS, true, true);
+				const size_t converted = textureManager.WarmCache(args.Get("texturecache").FromUTF8());
+				debug_printf(L"Converted %lu textures\n", (unsigned long)converted);
+			}
+			tex_codec_unregister_all();
+		}
+
+		SAFE_DELETE(g_ThreadPool);
+		g_VFS.reset();
+
+		CXeromyces::Terminate();
+		return;
+	}
+
+	// convert a profiler capture into a trace file if requested
+	if (args.Has("profiler2-convert"))
+	{
+		OsPath capture(args.Get("profiler2-convert"));
+		OsPath output = capture.ChangeExtension(L".json");
+		if (args.Has("profiler2-convert-output"))
+			output = args.Get("profiler2-convert-output");
+
+		CProfiler2::ConvertCapture(capture, output);
 
 		CXeromyces::Terminate();
 		return;
@@ -500,12 +807,23 @@ static void RunGameOrAtlas(int argc, const char* argv[])
 	const double res = timer_Resolution();
 	g_frequencyFilter = CreateFrequencyFilter(res, 30.0);
 
+	// play a cinema path in the autostarted game and record the rendering performance, if requested
+	if (args.Has("benchmark"))
+	{
+		g_RenderBenchmark = new CRenderBenchmark(args.Get("benchmark").FromUTF8());
+		if (args.Has("benchmark-warmup"))
+			g_RenderBenchmark->SetWarmupFrames(args.Get("benchmark-warmup").ToUInt());
+		if (args.Has("benchmark-output"))
+			g_RenderBenchmark->SetOutputPath(OsPath(args.Get("benchmark-output")));
+	}
+
 	// run the game
 	Init(args, 0);
 	InitGraphics(args, 0);
 	MainControllerInit();
 	while(!quit)
 		Frame();
+	SAFE_DELETE(g_RenderBenchmark);
 	Shutdown(0);
 	ScriptingHost::FinalShutdown(); // this can't go in Shutdown() because that could be called multiple times per process, so stick it here instead
 	MainControllerShutdown();
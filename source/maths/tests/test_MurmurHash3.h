@@ -0,0 +1,91 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "maths/MurmurHash3.h"
+
+class TestMurmurHash3 : public CxxTest::TestSuite
+{
+public:
+	std::string decode(u8* digest)
+	{
+		char digeststr[MurmurHash3::DIGESTSIZE*2+1];
+		for (size_t i = 0; i < MurmurHash3::DIGESTSIZE; ++i)
+			sprintf_s(digeststr+2*i, 3, "%02x", (unsigned int)digest[i]);
+		return digeststr;
+	}
+
+	void compare(const char* input, const char* expected)
+	{
+		u8 digest[MurmurHash3::DIGESTSIZE];
+
+		MurmurHash3 m;
+		m.Update((const u8*)input, strlen(input));
+		m.Final(digest);
+
+		TSM_ASSERT_STR_EQUALS(input, decode(digest), expected);
+	}
+
+	void test_reference()
+	{
+		// (Digests are h1 then h2 in little-endian order, matching the
+		// output of the reference MurmurHash3_x64_128 on x86)
+		compare("", "00000000000000000000000000000000");
+		compare("a", "897859f6655555855a890e51483ab5e6");
+		compare("abc", "6778ad3f3f3f96b4522dca264174a23b");
+		compare("The quick brown fox jumps over the lazy dog", "6c1b07bc7bbc4be347939ac4a93c437a");
+		compare("12345678901234567890123456789012345678901234567890123456789012345678901234567890",
+			"ee6a87a47f066391abf5d5a227ca4f77");
+	}
+
+	void test_incremental()
+	{
+		// Splitting the input into pieces of any size must give the same digest
+		std::string input;
+		for (size_t i = 0; i < 1000; ++i)
+			input += (char)('a' + (i * 7) % 26);
+
+		u8 expected[MurmurHash3::DIGESTSIZE];
+		MurmurHash3 m;
+		m.Update((const u8*)input.data(), input.size());
+		m.Final(expected);
+
+		for (size_t step = 1; step < 80; step += 3)
+		{
+			for (size_t i = 0; i < input.size(); i += step)
+				m.Update((const u8*)input.data() + i, std::min(step, input.size() - i));
+			u8 digest[MurmurHash3::DIGESTSIZE];
+			m.Final(digest);
+			TS_ASSERT_SAME_DATA(digest, expected, MurmurHash3::DIGESTSIZE);
+		}
+	}
+
+	void test_align_long()
+	{
+		// Make sure it's not sensitive to alignment
+		// when processing long chunks (where it won't memcpy to an intermediate buffer)
+		std::string a0 (1000, 'a');
+		std::string a1 ("?" + a0);
+		std::string a2 ("??" + a0);
+		std::string a3 ("???" + a0);
+		compare(a0.c_str()+0, "018fc53f1639e8989afcadb41c8f065c");
+		compare(a1.c_str()+1, "018fc53f1639e8989afcadb41c8f065c");
+		compare(a2.c_str()+2, "018fc53f1639e8989afcadb41c8f065c");
+		compare(a3.c_str()+3, "018fc53f1639e8989afcadb41c8f065c");
+	}
+};
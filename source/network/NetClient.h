@@ -165,6 +165,11 @@ public:
 
 	void SendChatMessage(const std::wstring& text);
 
+	/**
+	 * Returns a new random GUID (e.g. to initialise m_GUID).
+	 */
+	static CStr GenerateGUID();
+
 private:
 	// Net message / FSM transition handlers
 	static bool OnConnect(void* context, CFsmEvent* event);
@@ -210,8 +215,6 @@ private:
 
 	/// Globally unique identifier to distinguish users beyond the lifetime of a single network session
 	CStr m_GUID;
-	/// Initialise m_GUID with a random value
-	CStr GenerateGUID();
 
 	/// Queue of messages for GuiPoll
 	std::deque<CScriptValRooted> m_GuiMessageQueue;
@@ -55,6 +55,13 @@ Status CNetFileTransferer::HandleMessageReceive(const CNetMessage* message)
 			return ERR::FAIL;
 		}
 
+		if (!task->OnReceive(dataMessage->m_Data))
+		{
+			LOGERROR(L"Net transfer: Invalid file transfer data (id=%d)", (int)dataMessage->m_RequestID);
+			m_FileReceiveTasks.erase(dataMessage->m_RequestID);
+			return ERR::FAIL;
+		}
+
 		CFileTransferAckMessage ackMessage;
 		ackMessage.m_RequestID = task->m_RequestID;
 		ackMessage.m_NumPackets = 1; // TODO: would be nice to send a single ack for multiple packets at once
@@ -100,6 +107,10 @@ Status CNetFileTransferer::HandleMessageReceive(const CNetMessage* message)
 			return ERR::FAIL;
 		}
 
+		// If the window was full then it was limiting the transfer rate, so let more packets be in flight
+		if (task.packetsInFlight >= task.maxWindowSize)
+			task.maxWindowSize = std::min(task.maxWindowSize + ackMessage->m_NumPackets, MAX_FILE_TRANSFER_WINDOW_SIZE);
+
 		task.packetsInFlight -= ackMessage->m_NumPackets;
 
 		return INFO::OK;
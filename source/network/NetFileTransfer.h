@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -35,6 +35,11 @@ static const size_t DEFAULT_FILE_TRANSFER_PACKET_SIZE = 1024;
 // we can hopefully get windowSize*packetSize*1000/200 = 160KB/s bandwidth
 static const size_t DEFAULT_FILE_TRANSFER_WINDOW_SIZE = 32;
 
+// The window grows by a packet for every ack received while it was full
+// (so it roughly doubles every round-trip) up to this limit, to use more of
+// the bandwidth on fast links. With 200ms latency this allows up to 2.5MB/s
+static const size_t MAX_FILE_TRANSFER_WINDOW_SIZE = 512;
+
 // Some arbitrary limit to make it slightly harder to use up all of someone's RAM
 static const size_t MAX_FILE_TRANSFER_SIZE = 8*MiB;
 
@@ -54,6 +59,13 @@ public:
 	 */
 	virtual void OnComplete() = 0;
 
+	/**
+	 * Called when a packet of data has been received (and appended to m_Buffer),
+	 * so that it can be processed before the whole file arrives.
+	 * @return false if the data is invalid, which aborts the transfer
+	 */
+	virtual bool OnReceive(const std::string& UNUSED(data)) { return true; }
+
 	// TODO: Ought to have an OnFailure, e.g. when the session drops or there's another error
 
 	/**
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -22,6 +22,7 @@
 #include "lib/external_libraries/enet.h"
 #include "network/NetMessage.h"
 #include "ps/CLogger.h"
+#include "ps/Profiler2.h"
 
 bool CNetHost::SendMessage(const CNetMessage* message, ENetPeer* peer, const char* peerName)
 {
@@ -59,6 +60,10 @@ ENetPacket* CNetHost::CreatePacket(const CNetMessage* message)
 	// Save message to internal buffer
 	message->Serialize(&buffer[0]);
 
+	PROFILE2_EVENT("net send");
+	PROFILE2_ATTR("type: %d", (int)message->GetType());
+	PROFILE2_ATTR("bytes: %lu", (unsigned long)size);
+
 	// Create a reliable packet
 	ENetPacket* packet = enet_packet_create(&buffer[0], size, ENET_PACKET_FLAG_RELIABLE);
 	if (!packet)
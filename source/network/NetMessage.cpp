@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -19,6 +19,7 @@
 #include "NetMessage.h"
 
 #include "ps/CLogger.h"
+#include "ps/Profiler2.h"
 
 #include "ps/Game.h"
 #include "simulation2/Simulation2.h"
@@ -101,6 +102,10 @@ CNetMessage* CNetMessageFactory::CreateMessage(const void* pData,
 	// Figure out message type
 	header.Deserialize((const u8*)pData, (const u8*)pData + dataSize);
 
+	PROFILE2_EVENT("net receive");
+	PROFILE2_ATTR("type: %d", (int)header.GetType());
+	PROFILE2_ATTR("bytes: %lu", (unsigned long)dataSize);
+
 	switch (header.GetType())
 	{
 	case NMT_GAME_SETUP:
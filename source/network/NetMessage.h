@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -109,6 +109,14 @@ public:
 /**
  * Special message type for simulation commands.
  * These commands are exposed as arbitrary JS objects, associated with a specific player.
+ * Clients send all their commands for a turn in a single message, with m_Data being
+ * the array of commands.
+ *
+ * Values made of plain objects, arrays, numbers, strings and booleans (i.e. what commands
+ * normally contain) are sent with a compact encoding, in particular for arrays of ints
+ * like entity lists; anything else falls back to the standard script value serialization.
+ * The fields mustn't be modified after the message has been serialized, since the
+ * encoded data is reused.
  */
 class CSimulationMessage : public CNetMessage
 {
@@ -125,7 +133,10 @@ public:
 	u32 m_Turn;
 	CScriptValRooted m_Data;
 private:
+	const std::string& GetEncodedData() const;
+
 	ScriptInterface* m_ScriptInterface;
+	mutable std::string m_EncodedData;
 };
 
 /**
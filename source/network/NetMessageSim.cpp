@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,7 +20,10 @@
 #include "NetMessage.h"
 
 #include "lib/utf8.h"
+#include "ps/CLogger.h"
+#include "ps/utf16string.h"
 #include "scriptinterface/ScriptInterface.h"
+#include "scriptinterface/ScriptExtraHeaders.h" // for JSDOUBLE_IS_INT32
 #include "simulation2/serialization/BinarySerializer.h"
 #include "simulation2/serialization/StdDeserializer.h"
 
@@ -93,6 +96,415 @@ public:
 	}
 };
 
+namespace
+{
+
+// Formats of CSimulationMessage data
+enum
+{
+	SIM_MESSAGE_COMPACT = 0,
+	SIM_MESSAGE_SERIALIZED = 1
+};
+
+// Value types in the compact format
+enum
+{
+	COMPACT_VOID,
+	COMPACT_NULL,
+	COMPACT_FALSE,
+	COMPACT_TRUE,
+	COMPACT_INT,
+	COMPACT_DOUBLE,
+	COMPACT_STRING,
+	COMPACT_OBJECT,
+	COMPACT_ARRAY,
+	COMPACT_INT_ARRAY // array of ints, stored as deltas (e.g. sorted entity IDs are typically one byte each)
+};
+
+// Limit on the nesting of values in the compact format (which also guards against cyclic values)
+const int COMPACT_MAX_DEPTH = 32;
+
+/**
+ * Encodes simple script values compactly, with variable-length integers.
+ * Returns false for values it can't handle, so the caller can fall back to CBinarySerializer.
+ */
+class CCompactScriptValEncoder
+{
+public:
+	CCompactScriptValEncoder(ScriptInterface& scriptInterface, std::string& out) :
+		m_ScriptInterface(scriptInterface), m_Out(out)
+	{
+	}
+
+	void U8(u8 value)
+	{
+		m_Out += (char)value;
+	}
+
+	void VarU32(u32 value)
+	{
+		while (value >= 0x80)
+		{
+			m_Out += (char)((value & 0x7f) | 0x80);
+			value >>= 7;
+		}
+		m_Out += (char)value;
+	}
+
+	void VarI32(i32 value)
+	{
+		// Zigzag encoding, so small negative numbers are short too
+		VarU32(((u32)value << 1) ^ (u32)(value >> 31));
+	}
+
+	bool String(JSString* str)
+	{
+		size_t length;
+		const jschar* chars = JS_GetStringCharsAndLength(m_ScriptInterface.GetContext(), str, &length);
+		if (!chars)
+			return false;
+		VarU32(length);
+		for (size_t i = 0; i < length; ++i)
+			VarU32(chars[i]);
+		return true;
+	}
+
+	bool ScriptVal(jsval val, int depth)
+	{
+		if (depth > COMPACT_MAX_DEPTH)
+			return false;
+
+		JSContext* cx = m_ScriptInterface.GetContext();
+
+		if (JSVAL_IS_VOID(val))
+		{
+			U8(COMPACT_VOID);
+			return true;
+		}
+		if (JSVAL_IS_NULL(val))
+		{
+			U8(COMPACT_NULL);
+			return true;
+		}
+		if (JSVAL_IS_BOOLEAN(val))
+		{
+			U8(JSVAL_TO_BOOLEAN(val) ? COMPACT_TRUE : COMPACT_FALSE);
+			return true;
+		}
+		if (JSVAL_IS_NUMBER(val))
+		{
+			int32_t i;
+			if (GetInt(val, i))
+			{
+				U8(COMPACT_INT);
+				VarI32(i);
+			}
+			else
+			{
+				U8(COMPACT_DOUBLE);
+				jsdouble d = JSVAL_TO_DOUBLE(val);
+				u64 bits;
+				cassert(sizeof(bits) == sizeof(d));
+				memcpy(&bits, &d, sizeof(bits));
+				for (size_t b = 0; b < 8; ++b)
+					U8((u8)(bits >> (b*8)));
+			}
+			return true;
+		}
+		if (JSVAL_IS_STRING(val))
+		{
+			U8(COMPACT_STRING);
+			return String(JSVAL_TO_STRING(val));
+		}
+		if (!JSVAL_IS_OBJECT(val) || JS_TypeOfValue(cx, val) != JSTYPE_OBJECT)
+			return false; // functions, XML, etc
+
+		JSObject* obj = JSVAL_TO_OBJECT(val);
+
+		if (JS_IsArrayObject(cx, obj))
+		{
+			jsuint length;
+			if (!JS_GetArrayLength(cx, obj, &length))
+				return false;
+
+			// Check whether it's an int array first, since those are most common
+			bool ints = true;
+			for (jsuint i = 0; i < length && ints; ++i)
+			{
+				jsval elem;
+				int32_t value;
+				if (!JS_LookupElement(cx, obj, i, &elem))
+					return false;
+				ints = GetInt(elem, value);
+			}
+
+			U8(ints ? COMPACT_INT_ARRAY : COMPACT_ARRAY);
+			VarU32(length);
+
+			i32 prev = 0;
+			for (jsuint i = 0; i < length; ++i)
+			{
+				jsval elem;
+				if (!JS_LookupElement(cx, obj, i, &elem))
+					return false;
+
+				if (ints)
+				{
+					int32_t value;
+					GetInt(elem, value);
+					VarI32((i32)((u32)value - (u32)prev));
+					prev = value;
+				}
+				else if (!ScriptVal(elem, depth+1))
+				{
+					return false;
+				}
+			}
+
+			// Arrays with other properties can't be represented
+			AutoJSIdArray ida(cx, JS_Enumerate(cx, obj));
+			return ida.get() && ida.length() <= length;
+		}
+
+		// Only plain objects are supported, since the class and prototype would be lost
+		JSClass* cls = JS_GET_CLASS(cx, obj);
+		if (!cls || strcmp(cls->name, "Object") != 0)
+			return false;
+
+		AutoJSIdArray ida(cx, JS_Enumerate(cx, obj));
+		if (!ida.get())
+			return false;
+
+		U8(COMPACT_OBJECT);
+		VarU32(ida.length());
+		for (size_t i = 0; i < ida.length(); ++i)
+		{
+			jsval idval, propval;
+			if (!JS_IdToValue(cx, ida[i], &idval))
+				return false;
+			JSString* idstr = JS_ValueToString(cx, idval);
+			if (!idstr || !String(idstr))
+				return false;
+
+			// Use LookupProperty instead of GetProperty to avoid the danger of getters
+			if (!JS_LookupPropertyById(cx, obj, ida[i], &propval))
+				return false;
+			if (!ScriptVal(propval, depth+1))
+				return false;
+		}
+		return true;
+	}
+
+private:
+	static bool GetInt(jsval val, int32_t& out)
+	{
+		if (JSVAL_IS_INT(val))
+		{
+			out = JSVAL_TO_INT(val);
+			return true;
+		}
+		return JSVAL_IS_DOUBLE(val) && JSDOUBLE_IS_INT32(JSVAL_TO_DOUBLE(val), &out);
+	}
+
+	ScriptInterface& m_ScriptInterface;
+	std::string& m_Out;
+};
+
+/**
+ * Decodes the output of CCompactScriptValEncoder. Returns false if the data is invalid.
+ */
+class CCompactScriptValDecoder
+{
+public:
+	CCompactScriptValDecoder(ScriptInterface& scriptInterface, const u8* pos, const u8* end) :
+		m_ScriptInterface(scriptInterface), m_Pos(pos), m_End(end)
+	{
+	}
+
+	bool AtEnd() const
+	{
+		return m_Pos == m_End;
+	}
+
+	bool U8(u8& out)
+	{
+		if (m_Pos >= m_End)
+			return false;
+		out = *m_Pos++;
+		return true;
+	}
+
+	bool VarU32(u32& out)
+	{
+		out = 0;
+		for (int shift = 0; shift < 35; shift += 7)
+		{
+			u8 b;
+			if (!U8(b))
+				return false;
+			out |= (u32)(b & 0x7f) << shift;
+			if (!(b & 0x80))
+				return true;
+		}
+		return false;
+	}
+
+	bool VarI32(i32& out)
+	{
+		u32 value;
+		if (!VarU32(value))
+			return false;
+		out = (i32)((value >> 1) ^ (0 - (value & 1)));
+		return true;
+	}
+
+	bool String(utf16string& out)
+	{
+		u32 length;
+		if (!VarU32(length) || length > (size_t)(m_End - m_Pos))
+			return false;
+		out.resize(length);
+		for (u32 i = 0; i < length; ++i)
+		{
+			u32 c;
+			if (!VarU32(c) || c > 0xffff)
+				return false;
+			out[i] = (utf16string::value_type)c;
+		}
+		return true;
+	}
+
+	bool ScriptVal(jsval& out, int depth)
+	{
+		if (depth > COMPACT_MAX_DEPTH)
+			return false;
+
+		JSContext* cx = m_ScriptInterface.GetContext();
+
+		u8 type;
+		if (!U8(type))
+			return false;
+
+		switch (type)
+		{
+		case COMPACT_VOID:
+			out = JSVAL_VOID;
+			return true;
+		case COMPACT_NULL:
+			out = JSVAL_NULL;
+			return true;
+		case COMPACT_FALSE:
+			out = JSVAL_FALSE;
+			return true;
+		case COMPACT_TRUE:
+			out = JSVAL_TRUE;
+			return true;
+		case COMPACT_INT:
+		{
+			i32 value;
+			if (!VarI32(value))
+				return false;
+			out = ScriptInterface::ToJSVal(cx, value);
+			return true;
+		}
+		case COMPACT_DOUBLE:
+		{
+			u64 bits = 0;
+			for (size_t b = 0; b < 8; ++b)
+			{
+				u8 byte;
+				if (!U8(byte))
+					return false;
+				bits |= (u64)byte << (b*8);
+			}
+			jsdouble d;
+			memcpy(&d, &bits, sizeof(d));
+			return JS_NewNumberValue(cx, d, &out) == JS_TRUE;
+		}
+		case COMPACT_STRING:
+		{
+			utf16string str;
+			if (!String(str))
+				return false;
+			JSString* jsstr = JS_NewUCStringCopyN(cx, (const jschar*)str.data(), str.length());
+			if (!jsstr)
+				return false;
+			out = STRING_TO_JSVAL(jsstr);
+			return true;
+		}
+		case COMPACT_ARRAY:
+		case COMPACT_INT_ARRAY:
+		{
+			u32 length;
+			// (every element takes at least a byte, so the length can be checked before allocating)
+			if (!VarU32(length) || length > (size_t)(m_End - m_Pos))
+				return false;
+			JSObject* obj = JS_NewArrayObject(cx, 0, NULL);
+			if (!obj)
+				return false;
+			CScriptValRooted objRoot(cx, OBJECT_TO_JSVAL(obj));
+
+			i32 value = 0;
+			for (u32 i = 0; i < length; ++i)
+			{
+				jsval elem;
+				if (type == COMPACT_INT_ARRAY)
+				{
+					i32 delta;
+					if (!VarI32(delta))
+						return false;
+					value = (i32)((u32)value + (u32)delta);
+					elem = ScriptInterface::ToJSVal(cx, value);
+				}
+				else if (!ScriptVal(elem, depth+1))
+				{
+					return false;
+				}
+
+				CScriptValRooted elemRoot(cx, elem);
+				if (!JS_SetElement(cx, obj, i, &elem))
+					return false;
+			}
+			out = OBJECT_TO_JSVAL(obj);
+			return true;
+		}
+		case COMPACT_OBJECT:
+		{
+			u32 numProps;
+			if (!VarU32(numProps) || numProps > (size_t)(m_End - m_Pos))
+				return false;
+			JSObject* obj = JS_NewObject(cx, NULL, NULL, NULL);
+			if (!obj)
+				return false;
+			CScriptValRooted objRoot(cx, OBJECT_TO_JSVAL(obj));
+
+			for (u32 i = 0; i < numProps; ++i)
+			{
+				utf16string name;
+				jsval propval;
+				if (!String(name) || !ScriptVal(propval, depth+1))
+					return false;
+
+				CScriptValRooted propvalRoot(cx, propval);
+				if (!JS_SetUCProperty(cx, obj, (const jschar*)name.data(), name.length(), &propval))
+					return false;
+			}
+			out = OBJECT_TO_JSVAL(obj);
+			return true;
+		}
+		default:
+			return false;
+		}
+	}
+
+private:
+	ScriptInterface& m_ScriptInterface;
+	const u8* m_Pos;
+	const u8* m_End;
+};
+
+} // anonymous namespace
+
 CSimulationMessage::CSimulationMessage(ScriptInterface& scriptInterface) :
 	CNetMessage(NMT_SIMULATION_COMMAND), m_ScriptInterface(&scriptInterface)
 {
@@ -104,46 +516,86 @@ CSimulationMessage::CSimulationMessage(ScriptInterface& scriptInterface, u32 cli
 {
 }
 
-u8* CSimulationMessage::Serialize(u8* pBuffer) const
+const std::string& CSimulationMessage::GetEncodedData() const
 {
+	// Encode the data the first time it's needed, since both GetSerializedLength
+	// and Serialize need it (and when relaying a received message, we already have it)
+	if (!m_EncodedData.empty())
+		return m_EncodedData;
+
+	CCompactScriptValEncoder encoder(*m_ScriptInterface, m_EncodedData);
+	encoder.U8(SIM_MESSAGE_COMPACT);
+	encoder.VarU32(m_Client);
+	encoder.VarI32(m_Player);
+	encoder.VarU32(m_Turn);
+	if (encoder.ScriptVal(m_Data.get(), 0))
+		return m_EncodedData;
+
 	// TODO: ought to handle serialization exceptions
-	// TODO: ought to represent common commands more efficiently
 
-	u8* pos = CNetMessage::Serialize(pBuffer);
-	CBufferBinarySerializer serializer(*m_ScriptInterface, pos);
+	m_EncodedData.clear();
+	CLengthBinarySerializer lengthSerializer(*m_ScriptInterface);
+	lengthSerializer.NumberU32_Unbounded("client", m_Client);
+	lengthSerializer.NumberI32_Unbounded("player", m_Player);
+	lengthSerializer.NumberU32_Unbounded("turn", m_Turn);
+	lengthSerializer.ScriptVal("command", m_Data);
+
+	m_EncodedData.resize(1 + lengthSerializer.GetLength());
+	m_EncodedData[0] = (char)SIM_MESSAGE_SERIALIZED;
+	CBufferBinarySerializer serializer(*m_ScriptInterface, (u8*)&m_EncodedData[1]);
 	serializer.NumberU32_Unbounded("client", m_Client);
 	serializer.NumberI32_Unbounded("player", m_Player);
 	serializer.NumberU32_Unbounded("turn", m_Turn);
 	serializer.ScriptVal("command", m_Data);
-	return serializer.GetBuffer();
+	return m_EncodedData;
 }
 
-const u8* CSimulationMessage::Deserialize(const u8* pStart, const u8* pEnd)
+u8* CSimulationMessage::Serialize(u8* pBuffer) const
 {
-	// TODO: ought to handle serialization exceptions
-	// TODO: ought to represent common commands more efficiently
+	u8* pos = CNetMessage::Serialize(pBuffer);
+	const std::string& data = GetEncodedData();
+	memcpy(pos, data.data(), data.size());
+	return pos + data.size();
+}
 
+const u8* CSimulationMessage::Deserialize(const u8* pStart, const u8* pEnd)
+{
 	const u8* pos = CNetMessage::Deserialize(pStart, pEnd);
-	std::istringstream stream(std::string(pos, pEnd));
-	CStdDeserializer deserializer(*m_ScriptInterface, stream);
-	deserializer.NumberU32_Unbounded("client", m_Client);
-	deserializer.NumberI32_Unbounded("player", m_Player);
-	deserializer.NumberU32_Unbounded("turn", m_Turn);
-	deserializer.ScriptVal("command", m_Data);
+	if (!pos || pos == pEnd)
+		return NULL;
+
+	if (*pos == SIM_MESSAGE_COMPACT)
+	{
+		CCompactScriptValDecoder decoder(*m_ScriptInterface, pos + 1, pEnd);
+		jsval data;
+		if (!decoder.VarU32(m_Client) || !decoder.VarI32(m_Player) || !decoder.VarU32(m_Turn) ||
+			!decoder.ScriptVal(data, 0) || !decoder.AtEnd())
+		{
+			LOGERROR(L"CSimulationMessage: Corrupt packet");
+			return NULL;
+		}
+		m_Data = CScriptValRooted(m_ScriptInterface->GetContext(), data);
+	}
+	else
+	{
+		// TODO: ought to handle serialization exceptions
+
+		std::istringstream stream(std::string(pos + 1, pEnd));
+		CStdDeserializer deserializer(*m_ScriptInterface, stream);
+		deserializer.NumberU32_Unbounded("client", m_Client);
+		deserializer.NumberI32_Unbounded("player", m_Player);
+		deserializer.NumberU32_Unbounded("turn", m_Turn);
+		deserializer.ScriptVal("command", m_Data);
+	}
+
+	// Keep the encoded data, in case the message gets sent on again
+	m_EncodedData.assign(pos, pEnd);
 	return pEnd;
 }
 
 size_t CSimulationMessage::GetSerializedLength() const
 {
-	// TODO: serializing twice is stupidly inefficient - we should just
-	// do it once, store the result, and use it here and in Serialize
-
-	CLengthBinarySerializer serializer(*m_ScriptInterface);
-	serializer.NumberU32_Unbounded("client", m_Client);
-	serializer.NumberI32_Unbounded("player", m_Player);
-	serializer.NumberU32_Unbounded("turn", m_Turn);
-	serializer.ScriptVal("command", m_Data);
-	return CNetMessage::GetSerializedLength() + serializer.GetLength();
+	return CNetMessage::GetSerializedLength() + GetEncodedData().size();
 }
 
 CStr CSimulationMessage::ToString() const
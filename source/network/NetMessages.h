@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -28,7 +28,7 @@
 
 #define PS_PROTOCOL_MAGIC				0x5073013f		// 'P', 's', 0x01, '?'
 #define PS_PROTOCOL_MAGIC_RESPONSE		0x50630121		// 'P', 'c', 0x01, '!'
-#define PS_PROTOCOL_VERSION				0x01010005		// Arbitrary protocol
+#define PS_PROTOCOL_VERSION				0x0101000A		// Arbitrary protocol
 #define PS_DEFAULT_PORT					0x5073			// 'P', 's'
 
 // Defines the list of message types. The order of the list must not change.
@@ -73,6 +73,12 @@ enum AuthenticateResultCode
 	ARC_PASSWORD_INVALID,
 };
 
+// Authentication flags, describing the kind of client
+enum AuthenticateFlags
+{
+	AUTH_FLAG_RELAY = 1 << 0, // spectator relay (see CNetServer::SetupRelay), not a player
+};
+
 #endif //	NETMESSAGES_H
 
 #ifdef CREATING_NMT
@@ -105,6 +111,7 @@ START_NMT_CLASS_(Authenticate, NMT_AUTHENTICATE)
 	NMT_FIELD(CStr8, m_GUID)
 	NMT_FIELD(CStrW, m_Name)
 	NMT_FIELD(CStrW, m_Password)
+	NMT_FIELD_INT(m_Flags, u32, 4)
 END_NMT_CLASS()
 
 START_NMT_CLASS_(AuthenticateResult, NMT_AUTHENTICATE_RESULT)
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -25,8 +25,10 @@
 #include "NetStats.h"
 #include "NetTurnManager.h"
 
+#include "lib/timer.h"
 #include "lib/external_libraries/enet.h"
 #include "ps/CLogger.h"
+#include "ps/Profiler2.h"
 #include "scriptinterface/ScriptInterface.h"
 #include "simulation2/Simulation2.h"
 
@@ -109,10 +111,11 @@ private:
  */
 
 CNetServerWorker::CNetServerWorker(int autostartPlayers) :
-	m_AutostartPlayers(autostartPlayers),
-	m_Shutdown(false),
 	m_ScriptInterface(NULL),
-	m_NextHostID(1), m_Host(NULL), m_Stats(NULL)
+	m_AutostartPlayers(autostartPlayers),
+	m_Host(NULL), m_Stats(NULL), m_NextHostID(1),
+	m_UpstreamHost(NULL), m_UpstreamPeer(NULL), m_RelayDelay(0),
+	m_Shutdown(false), m_GameFinished(false)
 {
 	m_State = SERVER_STATE_UNCONNECTED;
 
@@ -151,10 +154,20 @@ CNetServerWorker::~CNetServerWorker()
 		enet_host_destroy(m_Host);
 	}
 
+	for (size_t i = 0; i < m_RelayQueue.size(); ++i)
+		enet_packet_destroy(m_RelayQueue[i].second);
+
+	if (m_UpstreamHost)
+	{
+		if (m_UpstreamPeer)
+			enet_peer_disconnect_now(m_UpstreamPeer, NDR_UNEXPECTED_SHUTDOWN);
+		enet_host_destroy(m_UpstreamHost);
+	}
+
 	delete m_ServerTurnManager;
 }
 
-bool CNetServerWorker::SetupConnection()
+bool CNetServerWorker::SetupConnection(u16 port)
 {
 	ENSURE(m_State == SERVER_STATE_UNCONNECTED);
 	ENSURE(!m_Host);
@@ -162,7 +175,7 @@ bool CNetServerWorker::SetupConnection()
 	// Bind to default host
 	ENetAddress addr;
 	addr.host = ENET_HOST_ANY;
-	addr.port = PS_DEFAULT_PORT;
+	addr.port = port;
 
 	// Create ENet server
 	m_Host = enet_host_create(&addr, MAX_CLIENTS, CHANNEL_COUNT, 0, 0);
@@ -185,6 +198,52 @@ bool CNetServerWorker::SetupConnection()
 	return true;
 }
 
+bool CNetServerWorker::SetupRelay(const CStr& hostAddress, u16 hostPort, u16 port, u32 delay)
+{
+	ENSURE(m_State == SERVER_STATE_UNCONNECTED);
+	ENSURE(!m_UpstreamHost);
+
+	ENetAddress addr;
+	addr.port = hostPort;
+	if (enet_address_set_host(&addr, hostAddress.c_str()) < 0)
+	{
+		LOGERROR(L"Net relay: failed to resolve host address '%hs'", hostAddress.c_str());
+		return false;
+	}
+
+	// Connect to the host like any other client; the handshake is done by the worker thread
+	m_UpstreamHost = enet_host_create(NULL, 1, CHANNEL_COUNT, 0, 0);
+	if (!m_UpstreamHost)
+	{
+		LOGERROR(L"Net relay: enet_host_create failed");
+		return false;
+	}
+
+	m_UpstreamPeer = enet_host_connect(m_UpstreamHost, &addr, CHANNEL_COUNT, 0);
+	if (!m_UpstreamPeer)
+	{
+		LOGERROR(L"Net relay: enet_host_connect failed");
+		enet_host_destroy(m_UpstreamHost);
+		m_UpstreamHost = NULL;
+		return false;
+	}
+
+	m_UpstreamGUID = CNetClient::GenerateGUID();
+	m_RelayDelay = delay;
+
+	// Spectators connect to us in the same way as to the host
+	if (!SetupConnection(port))
+	{
+		enet_peer_reset(m_UpstreamPeer);
+		enet_host_destroy(m_UpstreamHost);
+		m_UpstreamPeer = NULL;
+		m_UpstreamHost = NULL;
+		return false;
+	}
+
+	return true;
+}
+
 bool CNetServerWorker::SendMessage(ENetPeer* peer, const CNetMessage* message)
 {
 	ENSURE(m_Host);
@@ -220,7 +279,12 @@ void* CNetServerWorker::RunThread(void* data)
 {
 	debug_SetThreadName("NetServer");
 
-	static_cast<CNetServerWorker*>(data)->Run();
+	CNetServerWorker* server = static_cast<CNetServerWorker*>(data);
+
+	// There may be several servers in a dedicated host, so give them unique names
+	g_Profiler2.RegisterCurrentThread("net server " + CStr::FromUInt(server->m_Host->address.port));
+
+	server->Run();
 
 	return NULL;
 }
@@ -242,6 +306,9 @@ void CNetServerWorker::Run()
 
 		// Update profiler stats
 		m_Stats->LatchHostState(m_Host);
+		g_Profiler2.RecordSyncMarker();
+		if (IsRelay())
+			PROFILE2_COUNTER("net relay queue", m_RelayQueue.size());
 	}
 
 	// Clear roots before deleting their context
@@ -291,6 +358,15 @@ bool CNetServerWorker::RunStep()
 	for (size_t i = 0; i < m_Sessions.size(); ++i)
 		m_Sessions[i]->GetFileTransferer().Poll();
 
+	if (IsRelay())
+	{
+		PollUpstream();
+
+		// Wait until the spectators have loaded the game before sending them any commands
+		if (m_State == SERVER_STATE_INGAME)
+			ForwardRelayedPackets();
+	}
+
 	// Process network events:
 
 	ENetEvent event;
@@ -352,6 +428,19 @@ bool CNetServerWorker::RunStep()
 
 			delete session;
 			event.peer->data = NULL;
+
+			// Nobody can rejoin once every player has left (since there's no one
+			// to get the game state from; relays don't have it), so the game is over
+			bool playersLeft = false;
+			for (size_t i = 0; i < m_Sessions.size(); ++i)
+				if (!m_Sessions[i]->IsRelay())
+					playersLeft = true;
+
+			if (!playersLeft && (m_State == SERVER_STATE_LOADING || m_State == SERVER_STATE_INGAME))
+			{
+				CScopeLock lock(m_WorkerMutex);
+				m_GameFinished = true;
+			}
 		}
 
 		break;
@@ -415,6 +504,163 @@ void CNetServerWorker::HandleMessageReceive(const CNetMessage* message, CNetServ
 		LOGERROR(L"Net server: Error running FSM update (type=%d state=%d)", (int)message->GetType(), (int)session->GetCurrState());
 }
 
+void CNetServerWorker::PollUpstream()
+{
+	ENetEvent event;
+	while (m_UpstreamPeer && enet_host_service(m_UpstreamHost, &event, 0) > 0)
+	{
+		switch (event.type)
+		{
+		case ENET_EVENT_TYPE_CONNECT:
+			LOGMESSAGE(L"Net relay: Connected to host");
+			break;
+
+		case ENET_EVENT_TYPE_DISCONNECT:
+		{
+			LOGMESSAGE(L"Net relay: Lost connection to host (reason %u)", (unsigned int)event.data);
+			m_UpstreamPeer = NULL;
+
+			// The game can't continue without the host, so send the spectators away
+			for (size_t i = 0; i < m_Sessions.size(); ++i)
+				m_Sessions[i]->Disconnect(NDR_UNEXPECTED_SHUTDOWN);
+
+			CScopeLock lock(m_WorkerMutex);
+			m_GameFinished = true;
+			break;
+		}
+
+		case ENET_EVENT_TYPE_RECEIVE:
+		{
+			bool queued = false;
+
+			CNetMessage* msg = CNetMessageFactory::CreateMessage(event.packet->data, event.packet->dataLength, GetScriptInterface());
+			if (msg)
+			{
+				LOGMESSAGE(L"Net relay: Received message %hs of size %lu from host", msg->ToString().c_str(), (unsigned long)msg->GetSerializedLength());
+
+				queued = HandleUpstreamMessage(msg, event.packet);
+
+				delete msg;
+			}
+
+			if (!queued)
+				enet_packet_destroy(event.packet);
+
+			break;
+		}
+
+		case ENET_EVENT_TYPE_NONE:
+			break;
+		}
+	}
+}
+
+bool CNetServerWorker::HandleUpstreamMessage(const CNetMessage* message, ENetPacket* packet)
+{
+	switch (message->GetType())
+	{
+	case NMT_SERVER_HANDSHAKE:
+	{
+		CCliHandshakeMessage handshake;
+		handshake.m_MagicResponse = PS_PROTOCOL_MAGIC_RESPONSE;
+		handshake.m_ProtocolVersion = PS_PROTOCOL_VERSION;
+		handshake.m_SoftwareVersion = PS_PROTOCOL_VERSION;
+		SendUpstream(&handshake);
+		break;
+	}
+
+	case NMT_SERVER_HANDSHAKE_RESPONSE:
+	{
+		CAuthenticateMessage authenticate;
+		authenticate.m_GUID = m_UpstreamGUID;
+		authenticate.m_Name = m_ServerName;
+		authenticate.m_Password = L"";
+		authenticate.m_Flags = AUTH_FLAG_RELAY;
+		SendUpstream(&authenticate);
+		break;
+	}
+
+	case NMT_AUTHENTICATE_RESULT:
+	{
+		const CAuthenticateResultMessage* result = static_cast<const CAuthenticateResultMessage*>(message);
+		LOGMESSAGE(L"Net relay: Authentication result: host=%u, %ls", result->m_HostID, result->m_Message.c_str());
+		break;
+	}
+
+	case NMT_GAME_SETUP:
+		UpdateGameAttributes(static_cast<const CGameSetupMessage*>(message)->m_Data);
+		break;
+
+	case NMT_PLAYER_ASSIGNMENT:
+	{
+		const CPlayerAssignmentMessage* assignMessage = static_cast<const CPlayerAssignmentMessage*>(message);
+
+		m_UpstreamPlayerAssignments.clear();
+		for (size_t i = 0; i < assignMessage->m_Hosts.size(); ++i)
+		{
+			PlayerAssignment assignment;
+			assignment.m_Enabled = true;
+			assignment.m_Name = assignMessage->m_Hosts[i].m_Name;
+			assignment.m_PlayerID = assignMessage->m_Hosts[i].m_PlayerID;
+			m_UpstreamPlayerAssignments[assignMessage->m_Hosts[i].m_GUID] = assignment;
+		}
+
+		SendPlayerAssignments();
+		break;
+	}
+
+	case NMT_CHAT:
+		Broadcast(message);
+		break;
+
+	case NMT_GAME_START:
+		if (m_State == SERVER_STATE_PREGAME)
+			StartGame();
+		break;
+
+	case NMT_SIMULATION_COMMAND:
+	case NMT_END_COMMAND_BATCH:
+		m_RelayQueue.push_back(std::make_pair(timer_Time(), packet));
+		return true;
+
+	default:
+		// Anything else (e.g. the host's own LoadedGame, which we replace with
+		// one for when our spectators have loaded) isn't needed by the spectators
+		break;
+	}
+
+	return false;
+}
+
+bool CNetServerWorker::SendUpstream(const CNetMessage* message)
+{
+	if (!m_UpstreamPeer)
+		return false;
+
+	return CNetHost::SendMessage(message, m_UpstreamPeer, "[relayed host]");
+}
+
+void CNetServerWorker::ForwardRelayedPackets()
+{
+	double sendBefore = timer_Time() - m_RelayDelay / 1000.0;
+
+	while (!m_RelayQueue.empty() && m_RelayQueue.front().first <= sendBefore)
+	{
+		ENetPacket* packet = m_RelayQueue.front().second;
+		m_RelayQueue.pop_front();
+
+		// Pass it on to the spectators, and to any further relays
+		for (size_t i = 0; i < m_Sessions.size(); ++i)
+			if (m_Sessions[i]->GetCurrState() == NSS_INGAME || (m_Sessions[i]->IsRelay() && m_Sessions[i]->GetCurrState() == NSS_PREGAME))
+				m_Sessions[i]->SendPacket(packet);
+
+		// ENet destroys the packet once it has been sent to every peer,
+		// so we only have to destroy it if no one wanted it
+		if (packet->referenceCount == 0)
+			enet_packet_destroy(packet);
+	}
+}
+
 void CNetServerWorker::SetupSession(CNetServerSession* session)
 {
 	void* context = session;
@@ -456,7 +702,9 @@ bool CNetServerWorker::HandleConnect(CNetServerSession* session)
 
 void CNetServerWorker::OnUserJoin(CNetServerSession* session)
 {
-	AddPlayer(session->GetGUID(), session->GetUserName());
+	// Relays don't control a player, so they don't get an assignment
+	if (!session->IsRelay())
+		AddPlayer(session->GetGUID(), session->GetUserName());
 
 	CGameSetupMessage gameSetupMessage(GetScriptInterface());
 	gameSetupMessage.m_Data = m_GameAttributes;
@@ -469,6 +717,9 @@ void CNetServerWorker::OnUserJoin(CNetServerSession* session)
 
 void CNetServerWorker::OnUserLeave(CNetServerSession* session)
 {
+	if (session->IsRelay())
+		return;
+
 	RemovePlayer(session->GetGUID());
 
 	if (m_ServerTurnManager)
@@ -520,7 +771,8 @@ void CNetServerWorker::AddPlayer(const CStr& guid, const CStrW& name)
 	}
 
 	// Otherwise pick the first free player ID
-	if (!foundPlayerID)
+	// (except that spectators of a relayed game are always observers)
+	if (!foundPlayerID && !IsRelay())
 	{
 		for (playerID = 1; usedIDs.find(playerID) != usedIDs.end(); ++playerID)
 		{
@@ -575,6 +827,15 @@ void CNetServerWorker::ConstructPlayerAssignmentMessage(CPlayerAssignmentMessage
 		h.m_PlayerID = it->second.m_PlayerID;
 		message.m_Hosts.push_back(h);
 	}
+
+	for (PlayerAssignmentMap::iterator it = m_UpstreamPlayerAssignments.begin(); it != m_UpstreamPlayerAssignments.end(); ++it)
+	{
+		CPlayerAssignmentMessage::S_m_Hosts h;
+		h.m_GUID = it->first;
+		h.m_Name = it->second.m_Name;
+		h.m_PlayerID = it->second.m_PlayerID;
+		message.m_Hosts.push_back(h);
+	}
 }
 
 void CNetServerWorker::SendPlayerAssignments()
@@ -629,10 +890,21 @@ bool CNetServerWorker::OnAuthenticate(void* context, CFsmEvent* event)
 
 	CStrW username = server.DeduplicatePlayerName(SanitisePlayerName(message->m_Name));
 
+	bool isRelay = (message->m_Flags & AUTH_FLAG_RELAY) != 0;
+
 	bool isRejoining = false;
 
 	if (server.m_State != SERVER_STATE_PREGAME)
 	{
+		// Relays don't have the game state, so they can't join late
+		// nor send the game state to spectators who want to join late
+		if (isRelay || server.IsRelay())
+		{
+			LOGMESSAGE(L"Refused relayed connection after game start from user \"%ls\"", username.c_str());
+			session->Disconnect(NDR_SERVER_ALREADY_IN_GAME);
+			return true;
+		}
+
 // 		isRejoining = true; // uncomment this to test rejoining even if the player wasn't connected previously
 
 		// Search for an old disconnected player of the same name
@@ -662,6 +934,7 @@ bool CNetServerWorker::OnAuthenticate(void* context, CFsmEvent* event)
 	session->SetUserName(username);
 	session->SetGUID(message->m_GUID);
 	session->SetHostID(newHostID);
+	session->SetRelay(isRelay);
 
 	CAuthenticateResultMessage authenticateResult;
 	authenticateResult.m_Code = isRejoining ? ARC_OK_REJOINING : ARC_OK;
@@ -676,9 +949,18 @@ bool CNetServerWorker::OnAuthenticate(void* context, CFsmEvent* event)
 		// Request a copy of the current game state from an existing player,
 		// so we can send it on to the new player
 
-		// Assume session 0 is most likely the local player, so they're
+		// Assume the first session is most likely the local player, so they're
 		// the most efficient client to request a copy from
+		// (but relays don't have the game state)
 		CNetServerSession* sourceSession = server.m_Sessions.at(0);
+		for (size_t i = 0; i < server.m_Sessions.size(); ++i)
+		{
+			if (!server.m_Sessions[i]->IsRelay())
+			{
+				sourceSession = server.m_Sessions[i];
+				break;
+			}
+		}
 		sourceSession->GetFileTransferer().StartTask(
 			shared_ptr<CNetFileReceiveTask>(new CNetFileReceiveTask_ServerRejoin(server, newHostID))
 		);
@@ -696,6 +978,10 @@ bool CNetServerWorker::OnInGame(void* context, CFsmEvent* event)
 	CNetServerSession* session = (CNetServerSession*)context;
 	CNetServerWorker& server = session->GetServer();
 
+	// A relay isn't running the game, and its spectators can't affect it
+	if (server.IsRelay())
+		return true;
+
 	CNetMessage* message = (CNetMessage*)event->GetParamRef();
 	if (message->GetType() == (uint)NMT_SIMULATION_COMMAND)
 	{
@@ -825,7 +1111,8 @@ void CNetServerWorker::CheckGameLoadStatus(CNetServerSession* changedSession)
 {
 	for (size_t i = 0; i < m_Sessions.size(); ++i)
 	{
-		if (m_Sessions[i] != changedSession && m_Sessions[i]->GetCurrState() != NSS_INGAME)
+		// (Relays aren't running the game, so there's no need to wait for them)
+		if (m_Sessions[i] != changedSession && !m_Sessions[i]->IsRelay() && m_Sessions[i]->GetCurrState() != NSS_INGAME)
 			return;
 	}
 
@@ -838,10 +1125,15 @@ void CNetServerWorker::CheckGameLoadStatus(CNetServerSession* changedSession)
 
 void CNetServerWorker::StartGame()
 {
-	m_ServerTurnManager = new CNetServerTurnManager(*this);
+	// A relay just passes on the host's turns, so it doesn't need to manage them itself
+	if (!IsRelay())
+	{
+		m_ServerTurnManager = new CNetServerTurnManager(*this);
 
-	for (size_t i = 0; i < m_Sessions.size(); ++i)
-		m_ServerTurnManager->InitialiseClient(m_Sessions[i]->GetHostID(), 0); // TODO: only for non-observers
+		for (size_t i = 0; i < m_Sessions.size(); ++i)
+			if (!m_Sessions[i]->IsRelay())
+				m_ServerTurnManager->InitialiseClient(m_Sessions[i]->GetHostID(), 0); // TODO: only for non-observers
+	}
 
 	m_State = SERVER_STATE_LOADING;
 
@@ -851,6 +1143,10 @@ void CNetServerWorker::StartGame()
 
 	CGameStartMessage gameStart;
 	Broadcast(&gameStart);
+
+	// Start forwarding the host's turns immediately if there aren't any spectators to wait for
+	if (IsRelay())
+		CheckGameLoadStatus(NULL);
 }
 
 void CNetServerWorker::UpdateGameAttributes(const CScriptValRooted& attrs)
@@ -927,7 +1223,17 @@ CNetServer::~CNetServer()
 
 bool CNetServer::SetupConnection()
 {
-	return m_Worker->SetupConnection();
+	return m_Worker->SetupConnection(PS_DEFAULT_PORT);
+}
+
+bool CNetServer::SetupConnection(u16 port)
+{
+	return m_Worker->SetupConnection(port);
+}
+
+bool CNetServer::SetupRelay(const CStr& hostAddress, u16 hostPort, u16 port, u32 delay)
+{
+	return m_Worker->SetupRelay(hostAddress, hostPort, port, delay);
 }
 
 void CNetServer::AssignPlayer(int playerID, const CStr& guid)
@@ -946,12 +1252,21 @@ void CNetServer::UpdateGameAttributes(const CScriptVal& attrs, ScriptInterface&
 {
 	// Pass the attributes as JSON, since that's the easiest safe
 	// cross-thread way of passing script data
-	std::string attrsJSON = scriptInterface.StringifyJSON(attrs.get(), false);
+	UpdateGameAttributes(scriptInterface.StringifyJSON(attrs.get(), false));
+}
 
+void CNetServer::UpdateGameAttributes(const std::string& attrsJSON)
+{
 	CScopeLock lock(m_Worker->m_WorkerMutex);
 	m_Worker->m_GameAttributesQueue.push_back(attrsJSON);
 }
 
+bool CNetServer::IsGameFinished()
+{
+	CScopeLock lock(m_Worker->m_WorkerMutex);
+	return m_Worker->m_GameFinished;
+}
+
 void CNetServer::SetTurnLength(u32 msecs)
 {
 	CScopeLock lock(m_Worker->m_WorkerMutex);
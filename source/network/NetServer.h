@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,6 +24,7 @@
 #include "ps/ThreadUtil.h"
 #include "scriptinterface/ScriptVal.h"
 
+#include <deque>
 #include <vector>
 
 class CNetServerSession;
@@ -114,6 +115,28 @@ public:
 	 */
 	bool SetupConnection();
 
+	/**
+	 * Begin listening for network connections on the given port, instead of the default one
+	 * (e.g. to run several servers on one machine).
+	 * @return true on success, false on error (e.g. port already in use)
+	 */
+	bool SetupConnection(u16 port);
+
+	/**
+	 * Begin relaying the game hosted by another server to spectators, so that
+	 * the host only has to send the game to this relay rather than to every spectator.
+	 * Clients connecting to this server (on the given port) join as observers,
+	 * and receive the host's game setup, chat and commands.
+	 * The game starts when the host starts it, and clients can't join after that.
+	 * @param hostAddress IP address or host name of the server hosting the game
+	 * @param hostPort port of the server hosting the game
+	 * @param port port to listen on for spectators
+	 * @param delay time (in msecs) to hold back the game's commands before
+	 *  passing them on, so spectators can't reveal the game to the players as it happens
+	 * @return true on success, false on error (e.g. port already in use)
+	 */
+	bool SetupRelay(const CStr& hostAddress, u16 hostPort, u16 port, u32 delay);
+
 	/**
 	 * Call from the GUI to update the player assignments.
 	 * The given GUID will be (re)assigned to the given player ID.
@@ -135,6 +158,19 @@ public:
 	 */
 	void UpdateGameAttributes(const CScriptVal& attrs, ScriptInterface& scriptInterface);
 
+	/**
+	 * Update the game setup attributes, given as a JSON string
+	 * (e.g. from a file, when there's no GUI).
+	 */
+	void UpdateGameAttributes(const std::string& attrsJSON);
+
+	/**
+	 * Returns whether the game has started and every client has since left
+	 * (or, for a relay, the connection to the host has been lost),
+	 * so the server isn't needed any more.
+	 */
+	bool IsGameFinished();
+
 	/**
 	 * Set the turn length to a fixed value.
 	 * TODO: we should replace this with some adapative lag-dependent computation.
@@ -178,6 +214,7 @@ public:
 private:
 	friend class CNetServer;
 	friend class CNetFileReceiveTask_ServerRejoin;
+	friend class CNetServerTurnManager;
 
 	CNetServerWorker(int autostartPlayers);
 	~CNetServerWorker();
@@ -186,7 +223,18 @@ private:
 	 * Begin listening for network connections.
 	 * @return true on success, false on error (e.g. port already in use)
 	 */
-	bool SetupConnection();
+	bool SetupConnection(u16 port);
+
+	/**
+	 * Begin listening for spectators, and connect to the server hosting the game.
+	 * @return true on success, false on error (e.g. port already in use)
+	 */
+	bool SetupRelay(const CStr& hostAddress, u16 hostPort, u16 port, u32 delay);
+
+	/**
+	 * Whether this server is relaying another server's game (see CNetServer::SetupRelay).
+	 */
+	bool IsRelay() const { return m_UpstreamHost != NULL; }
 
 	/**
 	 * Call from the GUI to update the player assignments.
@@ -254,6 +302,26 @@ private:
 
 	void HandleMessageReceive(const CNetMessage* message, CNetServerSession* session);
 
+	/**
+	 * Process the events from the relayed host's connection.
+	 */
+	void PollUpstream();
+
+	/**
+	 * Handle a message received from the relayed host.
+	 * @return true if the packet has been queued for forwarding (and
+	 *  so mustn't be destroyed yet), false if it's no longer needed
+	 */
+	bool HandleUpstreamMessage(const CNetMessage* message, ENetPacket* packet);
+
+	bool SendUpstream(const CNetMessage* message);
+
+	/**
+	 * Pass the relayed host's queued game commands (that are at least m_RelayDelay old)
+	 * onto the spectators.
+	 */
+	void ForwardRelayedPackets();
+
 
 	/**
 	 * Internal script context for (de)serializing script messages,
@@ -296,6 +364,36 @@ private:
 	 */
 	std::string m_JoinSyncFile;
 
+	/**
+	 * Connection to the server hosting the game, if this is a relay
+	 * (else both are NULL).
+	 */
+	ENetHost* m_UpstreamHost;
+	ENetPeer* m_UpstreamPeer;
+
+	/**
+	 * GUID used to identify ourselves to the relayed host.
+	 */
+	CStr m_UpstreamGUID;
+
+	/**
+	 * The relayed host's latest player assignments, which are sent to the
+	 * spectators along with their own (observer) assignments.
+	 */
+	PlayerAssignmentMap m_UpstreamPlayerAssignments;
+
+	/**
+	 * Time (in msecs) to hold back relayed game commands.
+	 */
+	u32 m_RelayDelay;
+
+	/**
+	 * Game command packets received from the relayed host, with the time
+	 * they were received, that haven't been forwarded to the spectators yet.
+	 * The packets are forwarded as-is, without reserializing them per spectator.
+	 */
+	std::deque<std::pair<double, ENetPacket*> > m_RelayQueue;
+
 private:
 	// Thread-related stuff:
 
@@ -308,6 +406,8 @@ private:
 
 	bool m_Shutdown; // protected by m_WorkerMutex
 
+	bool m_GameFinished; // protected by m_WorkerMutex
+
 	// Queues for messages sent by the game thread:
 	std::vector<std::pair<int, CStr> > m_AssignPlayerQueue; // protected by m_WorkerMutex
 	std::vector<bool> m_StartGameQueue; // protected by m_WorkerMutex
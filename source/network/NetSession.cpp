@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -22,18 +22,34 @@
 #include "NetMessage.h"
 #include "NetStats.h"
 #include "lib/external_libraries/enet.h"
+#include "lib/timer.h"
 #include "ps/CLogger.h"
 #include "scriptinterface/ScriptInterface.h"
 
 static const int CHANNEL_COUNT = 1;
 
+/**
+ * enet_host_service timeout (msecs) in the client's worker thread.
+ * This is also the maximum delay before messages from the main thread
+ * are sent, so it should be small.
+ */
+static const int CLIENT_SERVICE_TIMEOUT = 5;
+
+/**
+ * Minimum interval (in seconds) between updates of the profiler stats table.
+ */
+static const double STATS_LATCH_INTERVAL = 0.1;
+
 CNetClientSession::CNetClientSession(CNetClient& client) :
-	m_Client(client), m_FileTransferer(this), m_Host(NULL), m_Server(NULL), m_Stats(NULL)
+	m_Client(client), m_FileTransferer(this), m_Host(NULL), m_Server(NULL), m_Stats(NULL),
+	m_WorkerRunning(false), m_Shutdown(false)
 {
 }
 
 CNetClientSession::~CNetClientSession()
 {
+	StopThread();
+
 	delete m_Stats;
 
 	if (m_Host && m_Server)
@@ -71,10 +87,18 @@ bool CNetClientSession::Connect(u16 port, const CStr& server)
 	m_Host = host;
 	m_Server = peer;
 
-	m_Stats = new CNetStatsTable(m_Server);
+	// The peer is updated by the worker thread, so let it latch the stats
+	// (like the server does) rather than reading them directly
+	m_Stats = new CNetStatsTable();
 	if (CProfileViewer::IsInitialised())
 		g_ProfileViewer.AddRootTable(m_Stats);
 
+	// Launch the worker thread
+	m_Shutdown = false;
+	int ret = pthread_create(&m_WorkerThread, NULL, &RunThread, this);
+	ENSURE(ret == 0);
+	m_WorkerRunning = true;
+
 	return true;
 }
 
@@ -82,6 +106,8 @@ void CNetClientSession::Disconnect(u32 reason)
 {
 	ENSURE(m_Host && m_Server);
 
+	StopThread();
+
 	// TODO: ought to do reliable async disconnects, probably
 	enet_peer_disconnect_now(m_Server, reason);
 	enet_host_destroy(m_Host);
@@ -92,6 +118,106 @@ void CNetClientSession::Disconnect(u32 reason)
 	SAFE_DELETE(m_Stats);
 }
 
+void CNetClientSession::StopThread()
+{
+	if (m_WorkerRunning)
+	{
+		{
+			CScopeLock lock(m_WorkerMutex);
+			m_Shutdown = true;
+		}
+
+		pthread_join(m_WorkerThread, NULL);
+		m_WorkerRunning = false;
+	}
+
+	// Nothing else will handle the queued packets now
+	for (size_t i = 0; i < m_OutgoingQueue.size(); ++i)
+		enet_packet_destroy(m_OutgoingQueue[i]);
+	m_OutgoingQueue.clear();
+
+	for (size_t i = 0; i < m_IncomingQueue.size(); ++i)
+		if (m_IncomingQueue[i].packet)
+			enet_packet_destroy(m_IncomingQueue[i].packet);
+	m_IncomingQueue.clear();
+}
+
+void* CNetClientSession::RunThread(void* data)
+{
+	debug_SetThreadName("NetClient");
+
+	static_cast<CNetClientSession*>(data)->Run();
+
+	return NULL;
+}
+
+void CNetClientSession::Run()
+{
+	double lastStatsTime = 0.0;
+
+	while (true)
+	{
+		// Get the messages queued by the main thread
+		// (Do as little work as possible while the mutex is held open)
+		std::vector<ENetPacket*> outgoing;
+		{
+			CScopeLock lock(m_WorkerMutex);
+
+			if (m_Shutdown)
+				return;
+
+			outgoing.swap(m_OutgoingQueue);
+		}
+
+		for (size_t i = 0; i < outgoing.size(); ++i)
+		{
+			// (If the send fails, ENet doesn't take ownership of the packet)
+			if (enet_peer_send(m_Server, CNetHost::DEFAULT_CHANNEL, outgoing[i]) < 0)
+				enet_packet_destroy(outgoing[i]);
+		}
+
+		// Process network events, waiting briefly if there aren't any yet
+		std::vector<SIncomingEvent> incoming;
+		bool disconnected = false;
+
+		ENetEvent event;
+		int timeout = CLIENT_SERVICE_TIMEOUT;
+		while (!disconnected && enet_host_service(m_Host, &event, timeout) > 0)
+		{
+			timeout = 0;
+
+			if (event.type == ENET_EVENT_TYPE_NONE)
+				continue;
+
+			SIncomingEvent incomingEvent;
+			incomingEvent.type = event.type;
+			incomingEvent.data = event.data;
+			incomingEvent.packet = (event.type == ENET_EVENT_TYPE_RECEIVE ? event.packet : NULL);
+			incoming.push_back(incomingEvent);
+
+			// The peer is gone now, so stop servicing the host
+			if (event.type == ENET_EVENT_TYPE_DISCONNECT)
+				disconnected = true;
+		}
+
+		double t = timer_Time();
+		if (t > lastStatsTime + STATS_LATCH_INTERVAL)
+		{
+			m_Stats->LatchHostState(m_Host);
+			lastStatsTime = t;
+		}
+
+		if (!incoming.empty())
+		{
+			CScopeLock lock(m_WorkerMutex);
+			m_IncomingQueue.insert(m_IncomingQueue.end(), incoming.begin(), incoming.end());
+		}
+
+		if (disconnected)
+			return;
+	}
+}
+
 void CNetClientSession::Poll()
 {
 	PROFILE3("net client poll");
@@ -100,19 +226,22 @@ void CNetClientSession::Poll()
 
 	m_FileTransferer.Poll();
 
-	ENetEvent event;
-	while (enet_host_service(m_Host, &event, 0) > 0)
+	std::vector<SIncomingEvent> incoming;
 	{
-		switch (event.type)
+		CScopeLock lock(m_WorkerMutex);
+		incoming.swap(m_IncomingQueue);
+	}
+
+	for (size_t i = 0; i < incoming.size(); ++i)
+	{
+		switch (incoming[i].type)
 		{
 		case ENET_EVENT_TYPE_CONNECT:
 		{
-			ENSURE(event.peer == m_Server);
-
 			// Report the server address
 			char hostname[256] = "(error)";
-			enet_address_get_host_ip(&event.peer->address, hostname, ARRAY_SIZE(hostname));
-			LOGMESSAGE(L"Net client: Connected to %hs:%u", hostname, (unsigned int)event.peer->address.port);
+			enet_address_get_host_ip(&m_Server->address, hostname, ARRAY_SIZE(hostname));
+			LOGMESSAGE(L"Net client: Connected to %hs:%u", hostname, (unsigned int)m_Server->address.port);
 
 			m_Client.HandleConnect();
 
@@ -121,16 +250,21 @@ void CNetClientSession::Poll()
 
 		case ENET_EVENT_TYPE_DISCONNECT:
 		{
-			ENSURE(event.peer == m_Server);
+			// This is the last event from the worker thread. The client will delete
+			// this session, so free any remaining packets first
+			for (size_t j = i+1; j < incoming.size(); ++j)
+				if (incoming[j].packet)
+					enet_packet_destroy(incoming[j].packet);
 
 			LOGMESSAGE(L"Net client: Disconnected");
-			m_Client.HandleDisconnect(event.data);
+			m_Client.HandleDisconnect(incoming[i].data);
 			return;
 		}
 
 		case ENET_EVENT_TYPE_RECEIVE:
 		{
-			CNetMessage* msg = CNetMessageFactory::CreateMessage(event.packet->data, event.packet->dataLength, m_Client.GetScriptInterface());
+			ENetPacket* packet = incoming[i].packet;
+			CNetMessage* msg = CNetMessageFactory::CreateMessage(packet->data, packet->dataLength, m_Client.GetScriptInterface());
 			if (msg)
 			{
 				LOGMESSAGE(L"Net client: Received message %hs of size %lu from server", msg->ToString().c_str(), (unsigned long)msg->GetSerializedLength());
@@ -140,38 +274,39 @@ void CNetClientSession::Poll()
 				delete msg;
 			}
 
-			enet_packet_destroy(event.packet);
+			enet_packet_destroy(packet);
 
 			break;
 		}
-
-		case ENET_EVENT_TYPE_NONE:
-			break;
 		}
 	}
-
 }
 
 void CNetClientSession::Flush()
 {
-	PROFILE3("net client flush");
-
 	ENSURE(m_Host && m_Server);
-
-	enet_host_flush(m_Host);
 }
 
 bool CNetClientSession::SendMessage(const CNetMessage* message)
 {
 	ENSURE(m_Host && m_Server);
 
-	return CNetHost::SendMessage(message, m_Server, "server");
+	ENetPacket* packet = CNetHost::CreatePacket(message);
+	if (!packet)
+		return false;
+
+	LOGMESSAGE(L"Net: Sending message %hs of size %lu to server", message->ToString().c_str(), (unsigned long)packet->dataLength);
+
+	// Let the worker thread send it
+	CScopeLock lock(m_WorkerMutex);
+	m_OutgoingQueue.push_back(packet);
+	return true;
 }
 
 
 
 CNetServerSession::CNetServerSession(CNetServerWorker& server, ENetPeer* peer) :
-	m_Server(server), m_FileTransferer(this), m_Peer(peer)
+	m_Server(server), m_FileTransferer(this), m_Peer(peer), m_HostID(0), m_IsRelay(false)
 {
 }
 
@@ -187,7 +322,28 @@ void CNetServerSession::DisconnectNow(u32 reason)
 	enet_peer_disconnect_now(m_Peer, reason);
 }
 
+u32 CNetServerSession::GetMeanRTT() const
+{
+	return m_Peer->roundTripTime;
+}
+
+u32 CNetServerSession::GetRTTVariance() const
+{
+	return m_Peer->roundTripTimeVariance;
+}
+
 bool CNetServerSession::SendMessage(const CNetMessage* message)
 {
 	return m_Server.SendMessage(m_Peer, message);
 }
+
+bool CNetServerSession::SendPacket(ENetPacket* packet)
+{
+	if (enet_peer_send(m_Peer, CNetHost::DEFAULT_CHANNEL, packet) < 0)
+	{
+		LOGERROR(L"Net server: Failed to send packet to peer");
+		return false;
+	}
+
+	return true;
+}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -22,6 +22,7 @@
 #include "network/NetFileTransfer.h"
 #include "network/NetHost.h"
 #include "ps/CStr.h"
+#include "ps/ThreadUtil.h"
 #include "scriptinterface/ScriptVal.h"
 
 class CNetClient;
@@ -51,6 +52,14 @@ public:
 /**
  * The client end of a network session.
  * Provides an abstraction of the network interface, allowing communication with the server.
+ *
+ * Thread-safety:
+ * - Once connected, the ENet host is serviced by a worker thread, so that packets are
+ *   received and acknowledged (and the latency is measured) independently of the
+ *   main thread's frame rate.
+ * - Messages are serialized and deserialized in the main thread, since that needs
+ *   the client's script interface. The worker just passes packets through queues.
+ * - All the public methods must be called from the main thread.
  */
 class CNetClientSession : public INetSession
 {
@@ -69,6 +78,7 @@ public:
 
 	/**
 	 * Flush queued outgoing network messages.
+	 * (The worker thread sends messages as soon as they're queued, so this does nothing.)
 	 */
 	void Flush();
 
@@ -86,6 +96,25 @@ public:
 	CNetFileTransferer& GetFileTransferer() { return m_FileTransferer; }
 
 private:
+	/**
+	 * Network event received by the worker thread, to be handled by Poll.
+	 */
+	struct SIncomingEvent
+	{
+		int type; // ENetEventType
+		u32 data; // disconnection reason
+		ENetPacket* packet; // received packet (owned by the event)
+	};
+
+	static void* RunThread(void* data);
+	void Run();
+
+	/**
+	 * Stops the worker thread (if it's running), and frees any queued packets,
+	 * so that the main thread can use the ENet host again.
+	 */
+	void StopThread();
+
 	CNetClient& m_Client;
 
 	CNetFileTransferer m_FileTransferer;
@@ -93,6 +122,14 @@ private:
 	ENetHost* m_Host;
 	ENetPeer* m_Server;
 	CNetStatsTable* m_Stats;
+
+	pthread_t m_WorkerThread;
+	bool m_WorkerRunning;
+
+	CMutex m_WorkerMutex;
+	bool m_Shutdown; // protected by m_WorkerMutex
+	std::vector<ENetPacket*> m_OutgoingQueue; // protected by m_WorkerMutex
+	std::vector<SIncomingEvent> m_IncomingQueue; // protected by m_WorkerMutex
 };
 
 
@@ -122,6 +159,13 @@ public:
 	u32 GetHostID() const { return m_HostID; }
 	void SetHostID(u32 id) { m_HostID = id; }
 
+	/**
+	 * Whether the client is a spectator relay, which doesn't control a player
+	 * and doesn't take part in the turn synchronisation.
+	 */
+	bool IsRelay() const { return m_IsRelay; }
+	void SetRelay(bool relay) { m_IsRelay = relay; }
+
 	/**
 	 * Sends a disconnection notification to the client,
 	 * and sends a NMT_CONNECTION_LOST message to the session FSM.
@@ -142,8 +186,24 @@ public:
 	 */
 	virtual bool SendMessage(const CNetMessage* message);
 
+	/**
+	 * Send an already-serialized message to the client, e.g. when forwarding
+	 * a packet received from another host. The packet can be shared by many sessions.
+	 */
+	bool SendPacket(ENetPacket* packet);
+
 	CNetFileTransferer& GetFileTransferer() { return m_FileTransferer; }
 
+	/**
+	 * Returns ENet's smoothed round-trip time to the client, in msecs.
+	 */
+	u32 GetMeanRTT() const;
+
+	/**
+	 * Returns ENet's estimate of the variation in the round-trip time, in msecs.
+	 */
+	u32 GetRTTVariance() const;
+
 private:
 	CNetServerWorker& m_Server;
 
@@ -154,6 +214,7 @@ private:
 	CStr m_GUID;
 	CStrW m_UserName;
 	u32 m_HostID;
+	bool m_IsRelay;
 };
 
 #endif	// NETSESSION_H
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -22,11 +22,15 @@
 #include "network/NetServer.h"
 #include "network/NetClient.h"
 #include "network/NetMessage.h"
+#include "network/NetSession.h"
 
 #include "gui/GUIManager.h"
 #include "maths/MathUtil.h"
 #include "ps/CLogger.h"
+#include "ps/Compress.h"
+#include "ps/PerformanceReport.h"
 #include "ps/Profile.h"
+#include "ps/Profiler2.h"
 #include "ps/Pyrogenesis.h"
 #include "ps/Replay.h"
 #include "ps/SavedGame.h"
@@ -40,8 +44,24 @@
 static const int DEFAULT_TURN_LENGTH_MP = 500;
 static const int DEFAULT_TURN_LENGTH_SP = 200;
 
+// Limits and granularity of the adaptive multiplayer turn length
+static const u32 MIN_TURN_LENGTH_MP = DEFAULT_TURN_LENGTH_SP;
+static const u32 MAX_TURN_LENGTH_MP = 1000;
+static const u32 TURN_LENGTH_STEP = 50;
+
+// Extra time allowed for commands to arrive, for processing and frame delays
+// on the clients and server
+static const u32 TURN_LENGTH_MARGIN = 100;
+
+// Number of turns the latency must stay low before the turn length is reduced
+// (it's increased immediately), to avoid changing it all the time
+static const u32 TURN_LENGTH_DECREASE_DELAY = 20;
+
 static const int COMMAND_DELAY = 2;
 
+// Maximum memory used by the compressed time warp snapshots; the oldest are discarded beyond this
+static const size_t TIME_WARP_MAX_SIZE = 128*MiB;
+
 #if 0
 #define NETTURN_LOG(args) debug_printf args
 #else
@@ -58,9 +78,9 @@ static std::wstring Hexify(const std::string& s)
 }
 
 CNetTurnManager::CNetTurnManager(CSimulation2& simulation, u32 defaultTurnLength, int clientId, IReplayLogger& replay) :
-	m_Simulation2(simulation), m_CurrentTurn(0), m_ReadyTurn(1), m_TurnLength(defaultTurnLength), m_DeltaSimTime(0),
-	m_PlayerId(-1), m_ClientId(clientId), m_HasSyncError(false), m_Replay(replay),
-	m_TimeWarpNumTurns(0)
+	m_Simulation2(simulation), m_CurrentTurn(0), m_ReadyTurn(1), m_TurnLength(defaultTurnLength),
+	m_PlayerId(-1), m_ClientId(clientId), m_DeltaSimTime(0), m_TurnWaitStart(0), m_HasSyncError(false), m_Replay(replay),
+	m_TimeWarpNumTurns(0), m_TimeWarpStatesSize(0), m_TimeWarpPending(false)
 {
 	// When we are on turn n, we schedule new commands for n+2.
 	// We know that all other clients have finished scheduling commands for n (else we couldn't have got here).
@@ -71,6 +91,11 @@ CNetTurnManager::CNetTurnManager(CSimulation2& simulation, u32 defaultTurnLength
 	m_QueuedCommands.resize(COMMAND_DELAY + 1);
 }
 
+CNetTurnManager::~CNetTurnManager()
+{
+	FinishTimeWarpCompression();
+}
+
 void CNetTurnManager::ResetState(u32 newCurrentTurn, u32 newReadyTurn)
 {
 	m_CurrentTurn = newCurrentTurn;
@@ -86,6 +111,11 @@ void CNetTurnManager::SetPlayerID(int playerId)
 	m_PlayerId = playerId;
 }
 
+bool CNetTurnManager::IsWaitingForTurn() const
+{
+	return m_DeltaSimTime >= 0 && m_ReadyTurn <= m_CurrentTurn;
+}
+
 bool CNetTurnManager::WillUpdate(float simFrameLength)
 {
 	// Keep this in sync with the return value of Update()
@@ -122,9 +152,20 @@ bool CNetTurnManager::Update(float simFrameLength, size_t maxTurns)
 		// TODO: we should do clever rate adjustment instead of just pausing like this.
 		m_DeltaSimTime = 0;
 
+		if (m_TurnWaitStart == 0)
+			m_TurnWaitStart = timer_Time();
+
 		return false;
 	}
 
+	if (m_TurnWaitStart != 0)
+	{
+		PROFILE2_EVENT("turn wait");
+		PROFILE2_ATTR("turn: %u", m_CurrentTurn + 1);
+		PROFILE2_ATTR("wait: %.1f ms", (timer_Time() - m_TurnWaitStart) * 1000.0);
+		m_TurnWaitStart = 0;
+	}
+
 	maxTurns = std::max((size_t)1, maxTurns); // always do at least one turn
 
 	for (size_t i = 0; i < maxTurns; ++i)
@@ -150,9 +191,20 @@ bool CNetTurnManager::Update(float simFrameLength, size_t maxTurns)
 		if (m_TimeWarpNumTurns && (m_CurrentTurn % m_TimeWarpNumTurns) == 0)
 		{
 			PROFILE3("time warp serialization");
-			std::stringstream stream;
-			m_Simulation2.SerializeState(stream);
-			m_TimeWarpStates.push_back(stream.str());
+			FinishTimeWarpCompression();
+
+			m_TimeWarpPendingState.clear();
+			m_Simulation2.SerializeState(m_TimeWarpPendingState);
+
+			// The states are mostly repetitive, so compressing lets us keep many more of them.
+			// The compression doesn't touch the simulation, so let it overlap this turn
+			// and the following frames if possible
+			m_TimeWarpStates.push_back(std::string());
+			m_TimeWarpPending = true;
+			if (g_ThreadPool)
+				g_ThreadPool->Submit(&CompressTimeWarpTask, this, &m_TimeWarpTask);
+			else
+				CompressTimeWarpTask(this);
 		}
 
 		// Put all the client commands into a single list, in a globally consistent order
@@ -168,7 +220,9 @@ bool CNetTurnManager::Update(float simFrameLength, size_t maxTurns)
 
 		NETTURN_LOG((L"Running %d cmds\n", commands.size()));
 
+		double turnStartTime = timer_Time();
 		m_Simulation2.Update(m_TurnLength, commands);
+		g_PerformanceReporter.RecordTurn(timer_Time() - turnStartTime);
 
 		NotifyFinishedUpdate(m_CurrentTurn);
 
@@ -189,6 +243,9 @@ bool CNetTurnManager::UpdateFastForward()
 	if (m_ReadyTurn <= m_CurrentTurn)
 		return false;
 
+	PROFILE2("fast forward");
+	PROFILE2_ATTR("turns: %u", m_ReadyTurn - m_CurrentTurn);
+
 	while (m_ReadyTurn > m_CurrentTurn)
 	{
 		// TODO: It would be nice to remove some of the duplication with Update()
@@ -232,8 +289,13 @@ void CNetTurnManager::OnSyncError(u32 turn, const std::string& expectedHash)
 	bool ok = m_Simulation2.ComputeStateHash(hash, quick);
 	ENSURE(ok);
 
+	// Start with the per-component hashes, so diffing the dumps from two clients
+	// immediately shows which component types went out of sync
 	OsPath path = psLogDir()/"oos_dump.txt";
 	std::ofstream file (OsString(path).c_str(), std::ofstream::out | std::ofstream::trunc);
+	file << "component hashes (" << (quick ? "quick" : "full") << "):\n";
+	m_Simulation2.DumpStateHashes(file, quick);
+	file << "\n";
 	m_Simulation2.DumpDebugState(file);
 	file.close();
 
@@ -297,21 +359,51 @@ bool CNetTurnManager::TurnNeedsFullHash(u32 turn)
 	return false;
 }
 
+void CNetTurnManager::CompressTimeWarpTask(void* cbdata)
+{
+	CNetTurnManager* turnManager = static_cast<CNetTurnManager*>(cbdata);
+	CompressZLib(turnManager->m_TimeWarpPendingState, turnManager->m_TimeWarpStates.back(), true);
+}
+
+void CNetTurnManager::FinishTimeWarpCompression()
+{
+	if (!m_TimeWarpPending)
+		return;
+
+	if (g_ThreadPool)
+		g_ThreadPool->Wait(m_TimeWarpTask);
+	m_TimeWarpPending = false;
+	m_TimeWarpPendingState.clear();
+	m_TimeWarpStatesSize += m_TimeWarpStates.back().size();
+
+	while (m_TimeWarpStatesSize > TIME_WARP_MAX_SIZE && m_TimeWarpStates.size() > 1)
+	{
+		m_TimeWarpStatesSize -= m_TimeWarpStates.front().size();
+		m_TimeWarpStates.pop_front();
+	}
+}
+
 void CNetTurnManager::EnableTimeWarpRecording(size_t numTurns)
 {
+	FinishTimeWarpCompression();
 	m_TimeWarpStates.clear();
+	m_TimeWarpStatesSize = 0;
 	m_TimeWarpNumTurns = numTurns;
 }
 
 void CNetTurnManager::RewindTimeWarp()
 {
+	FinishTimeWarpCompression();
 	if (m_TimeWarpStates.empty())
 		return;
 
-	std::stringstream stream(m_TimeWarpStates.back());
-	m_Simulation2.DeserializeState(stream);
+	std::string state;
+	DecompressZLib(m_TimeWarpStates.back(), state, true);
+	m_TimeWarpStatesSize -= m_TimeWarpStates.back().size();
 	m_TimeWarpStates.pop_back();
 
+	m_Simulation2.DeserializeState(state);
+
 	// Reset the turn manager state, so we won't execute stray commands and
 	// won't do the next snapshot until the appropriate time.
 	// (Ideally we ought to serialise the turn manager state and restore it
@@ -323,15 +415,15 @@ void CNetTurnManager::QuickSave()
 {
 	TIMER(L"QuickSave");
 	
-	std::stringstream stream;
-	bool ok = m_Simulation2.SerializeState(stream);
+	std::string state;
+	bool ok = m_Simulation2.SerializeState(state);
 	if (!ok)
 	{
 		LOGERROR(L"Failed to quicksave game");
 		return;
 	}
 
-	m_QuickSaveState = stream.str();
+	m_QuickSaveState.swap(state);
 	if (g_GUI)
 		m_QuickSaveMetadata = g_GUI->GetScriptInterface().StringifyJSON(g_GUI->GetSavedGameData().get(), false);
 	else
@@ -351,8 +443,7 @@ void CNetTurnManager::QuickLoad()
 		return;
 	}
 
-	std::stringstream stream(m_QuickSaveState);
-	bool ok = m_Simulation2.DeserializeState(stream);
+	bool ok = m_Simulation2.DeserializeState(m_QuickSaveState);
 	if (!ok)
 	{
 		LOGERROR(L"Failed to quickload game");
@@ -379,9 +470,10 @@ void CNetClientTurnManager::PostCommand(CScriptValRooted data)
 {
 	NETTURN_LOG((L"PostCommand()\n"));
 
-	// Transmit command to server
-	CSimulationMessage msg(m_Simulation2.GetScriptInterface(), m_ClientId, m_PlayerId, m_CurrentTurn + COMMAND_DELAY, data.get());
-	m_NetClient.SendMessage(&msg);
+	// Queue the command to be sent to the server along with the rest of
+	// this turn's commands (this doesn't delay it, since it can't be executed
+	// until the server has got NotifyFinishedOwnCommands for this turn anyway)
+	m_PendingCommands.push_back(data);
 
 	// Add to our local queue
 	//AddCommand(m_ClientId, m_PlayerId, data, m_CurrentTurn + COMMAND_DELAY);
@@ -392,6 +484,13 @@ void CNetClientTurnManager::NotifyFinishedOwnCommands(u32 turn)
 {
 	NETTURN_LOG((L"NotifyFinishedOwnCommands(%d)\n", turn));
 
+	// Send the commands that were posted for this turn
+	if (!m_PendingCommands.empty())
+	{
+		SendPendingCommands(turn, 0, m_PendingCommands.size());
+		m_PendingCommands.clear();
+	}
+
 	// Send message to the server
 	CEndCommandBatchMessage msg;
 	msg.m_TurnLength = DEFAULT_TURN_LENGTH_MP; // TODO: why do we send this?
@@ -399,6 +498,30 @@ void CNetClientTurnManager::NotifyFinishedOwnCommands(u32 turn)
 	m_NetClient.SendMessage(&msg);
 }
 
+void CNetClientTurnManager::SendPendingCommands(u32 turn, size_t begin, size_t end)
+{
+	ScriptInterface& scriptInterface = m_Simulation2.GetScriptInterface();
+
+	CScriptValRooted commands;
+	scriptInterface.Eval("([])", commands);
+	for (size_t i = begin; i < end; ++i)
+		scriptInterface.SetPropertyInt(commands.get(), (int)(i - begin), m_PendingCommands[i]);
+
+	CSimulationMessage msg(scriptInterface, m_ClientId, m_PlayerId, turn, commands.get());
+
+	// Messages have a 16-bit length, so split up huge batches
+	// (a single command that's too large will just fail to be sent)
+	if (msg.GetSerializedLength() > 0xFFFF && end - begin > 1)
+	{
+		size_t mid = begin + (end - begin) / 2;
+		SendPendingCommands(turn, begin, mid);
+		SendPendingCommands(turn, mid, end);
+		return;
+	}
+
+	m_NetClient.SendMessage(&msg);
+}
+
 void CNetClientTurnManager::NotifyFinishedUpdate(u32 turn)
 {
 	bool quick = !TurnNeedsFullHash(turn);
@@ -422,8 +545,23 @@ void CNetClientTurnManager::NotifyFinishedUpdate(u32 turn)
 
 void CNetClientTurnManager::OnSimulationMessage(CSimulationMessage* msg)
 {
-	// Command received from the server - store it for later execution
-	AddCommand(msg->m_Client, msg->m_Player, msg->m_Data, msg->m_Turn);
+	// Commands received from the server - store them for later execution
+
+	ScriptInterface& scriptInterface = m_Simulation2.GetScriptInterface();
+
+	u32 length;
+	if (!scriptInterface.GetProperty(msg->m_Data.get(), "length", length))
+	{
+		LOGERROR(L"Invalid simulation command batch");
+		return;
+	}
+
+	for (u32 i = 0; i < length; ++i)
+	{
+		CScriptValRooted data;
+		scriptInterface.GetPropertyInt(msg->m_Data.get(), i, data);
+		AddCommand(msg->m_Client, msg->m_Player, data, msg->m_Turn);
+	}
 }
 
 
@@ -466,7 +604,8 @@ void CNetLocalTurnManager::OnSimulationMessage(CSimulationMessage* UNUSED(msg))
 
 
 CNetServerTurnManager::CNetServerTurnManager(CNetServerWorker& server) :
-	m_NetServer(server), m_ReadyTurn(1), m_TurnLength(DEFAULT_TURN_LENGTH_MP)
+	m_NetServer(server), m_ReadyTurn(1), m_TurnLength(DEFAULT_TURN_LENGTH_MP),
+	m_AdaptiveTurnLength(true), m_ShorterTurnLengthCount(0)
 {
 	// The first turn we will actually execute is number 2,
 	// so store dummy values into the saved lengths list
@@ -485,6 +624,14 @@ void CNetServerTurnManager::NotifyFinishedClientCommands(int client, u32 turn)
 	ENSURE(turn == m_ClientsReady[client] + 1);
 	m_ClientsReady[client] = turn;
 
+	// Record how long after the first client this one finished the turn's commands
+	double now = timer_Time();
+	std::map<u32, double>::iterator first = m_ClientsFirstReadyTime.insert(std::make_pair(turn, now)).first;
+	PROFILE2_EVENT("client commands");
+	PROFILE2_ATTR("client: %d", client);
+	PROFILE2_ATTR("turn: %u", turn);
+	PROFILE2_ATTR("skew: %.1f ms", (now - first->second) * 1000.0);
+
 	// Check whether this was the final client to become ready
 	CheckClientsReady();
 }
@@ -502,8 +649,13 @@ void CNetServerTurnManager::CheckClientsReady()
 	// Advance the turn
 	++m_ReadyTurn;
 
+	m_ClientsFirstReadyTime.erase(m_ClientsFirstReadyTime.begin(), m_ClientsFirstReadyTime.upper_bound(m_ReadyTurn));
+
 	NETTURN_LOG((L"CheckClientsReady: ready for turn %d\n", m_ReadyTurn));
 
+	if (m_AdaptiveTurnLength)
+		UpdateAdaptiveTurnLength();
+
 	// Tell all clients that the next turn is ready
 	CEndCommandBatchMessage msg;
 	msg.m_TurnLength = m_TurnLength;
@@ -515,6 +667,42 @@ void CNetServerTurnManager::CheckClientsReady()
 	m_SavedTurnLengths.push_back(m_TurnLength);
 }
 
+void CNetServerTurnManager::UpdateAdaptiveTurnLength()
+{
+	// Find the worst latency of the clients in the game
+	u32 latency = 0;
+	for (size_t i = 0; i < m_NetServer.m_Sessions.size(); ++i)
+	{
+		CNetServerSession* session = m_NetServer.m_Sessions[i];
+		if (m_ClientsReady.find(session->GetHostID()) == m_ClientsReady.end())
+			continue;
+
+		latency = std::max(latency, session->GetMeanRTT() + 2*session->GetRTTVariance());
+	}
+
+	// A command is sent when its client starts turn N, and must have reached every other
+	// client (via the server) before they start turn N+COMMAND_DELAY, which takes up to
+	// about one round-trip time
+	u32 turnLength = (latency + TURN_LENGTH_MARGIN) / COMMAND_DELAY;
+	turnLength = (turnLength + TURN_LENGTH_STEP - 1) / TURN_LENGTH_STEP * TURN_LENGTH_STEP;
+	turnLength = clamp(turnLength, MIN_TURN_LENGTH_MP, MAX_TURN_LENGTH_MP);
+
+	if (turnLength >= m_TurnLength)
+	{
+		m_ShorterTurnLengthCount = 0;
+		if (turnLength > m_TurnLength)
+			NETTURN_LOG((L"Increasing turn length to %d (latency %d)\n", turnLength, latency));
+		m_TurnLength = turnLength;
+	}
+	else if (++m_ShorterTurnLengthCount >= TURN_LENGTH_DECREASE_DELAY)
+	{
+		// Reduce it gradually, in case the latency was only low for a short time
+		m_ShorterTurnLengthCount = 0;
+		m_TurnLength -= TURN_LENGTH_STEP;
+		NETTURN_LOG((L"Decreasing turn length to %d (latency %d)\n", m_TurnLength, latency));
+	}
+}
+
 void CNetServerTurnManager::NotifyFinishedClientUpdate(int client, u32 turn, const std::string& hash)
 {
 	// Clients must advance one turn at a time
@@ -587,6 +775,7 @@ void CNetServerTurnManager::UninitialiseClient(int client)
 void CNetServerTurnManager::SetTurnLength(u32 msecs)
 {
 	m_TurnLength = msecs;
+	m_AdaptiveTurnLength = false;
 }
 
 u32 CNetServerTurnManager::GetSavedTurnLength(u32 turn)
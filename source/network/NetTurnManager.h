@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -18,6 +18,7 @@
 #ifndef INCLUDED_NETTURNMANAGER
 #define INCLUDED_NETTURNMANAGER
 
+#include "ps/ThreadPool.h"
 #include "simulation2/helpers/SimulationCommand.h"
 
 #include <list>
@@ -58,7 +59,7 @@ public:
 	 */
 	CNetTurnManager(CSimulation2& simulation, u32 defaultTurnLength, int clientId, IReplayLogger& replay);
 
-	virtual ~CNetTurnManager() { }
+	virtual ~CNetTurnManager();
 
 	void ResetState(u32 newCurrentTurn, u32 newReadyTurn);
 
@@ -90,6 +91,12 @@ public:
 	 */
 	bool WillUpdate(float simFrameLength);
 
+	/**
+	 * Returns whether the next turn is due but can't be processed yet, because
+	 * we're still waiting for commands from the network.
+	 */
+	bool IsWaitingForTurn() const;
+
 	/**
 	 * Advance the graphics by a certain time.
 	 * @param simFrameLength Length of the previous frame, in simulation seconds
@@ -122,6 +129,9 @@ public:
 	 * Enables the recording of state snapshots every @p numTurns,
 	 * which can be jumped back to via RewindTimeWarp().
 	 * If @p numTurns is 0 then recording is disabled.
+	 * The snapshots are stored compressed (in the background, so the
+	 * compression doesn't delay the turn), and the oldest ones are discarded
+	 * once they use too much memory.
 	 */
 	void EnableTimeWarpRecording(size_t numTurns);
 
@@ -178,19 +188,37 @@ protected:
 	/// add elapsed time increments to until we reach 0).
 	float m_DeltaSimTime;
 
+	/// Real time at which we started waiting for the next turn to be ready
+	/// (for profiling network lag), or 0 if we aren't waiting
+	double m_TurnWaitStart;
+
 	bool m_HasSyncError;
 
 	IReplayLogger& m_Replay;
 
 private:
+	/**
+	 * Waits for the latest snapshot to finish compressing (if it's still
+	 * pending), then updates m_TimeWarpStatesSize and discards old snapshots.
+	 */
+	void FinishTimeWarpCompression();
+
+	static void CompressTimeWarpTask(void* cbdata);
+
 	size_t m_TimeWarpNumTurns; // 0 if disabled
-	std::list<std::string> m_TimeWarpStates;
+	std::list<std::string> m_TimeWarpStates; // compressed with CompressZLib
+	size_t m_TimeWarpStatesSize; // total size of m_TimeWarpStates, except for a pending snapshot
+	std::string m_TimeWarpPendingState; // uncompressed latest snapshot, while it's being compressed into m_TimeWarpStates.back()
+	bool m_TimeWarpPending;
+	CThreadPool::TaskGroup m_TimeWarpTask;
 	std::string m_QuickSaveState; // TODO: should implement a proper disk-based quicksave system
 	std::string m_QuickSaveMetadata;
 };
 
 /**
  * Implementation of CNetTurnManager for network clients.
+ * The commands posted during a turn are sent together in a single message
+ * when the client finishes its commands for that turn.
  */
 class CNetClientTurnManager : public CNetTurnManager
 {
@@ -206,7 +234,16 @@ protected:
 
 	virtual void NotifyFinishedUpdate(u32 turn);
 
+	/**
+	 * Sends the commands [begin, end) of m_PendingCommands, split into
+	 * as many messages as needed to fit in the message size limit.
+	 */
+	void SendPendingCommands(u32 turn, size_t begin, size_t end);
+
 	CNetClient& m_NetClient;
+
+	// Commands posted for the next turn we'll finish, which haven't been sent yet
+	std::vector<CScriptValRooted> m_PendingCommands;
 };
 
 /**
@@ -233,6 +270,12 @@ protected:
  * Records the turn state of each client, and sends turn advancement messages
  * when all clients are ready.
  *
+ * The length of each turn is decided here and sent to the clients along with the
+ * turn advancement, so they all agree on it. Unless a fixed length has been set with
+ * SetTurnLength, it's adapted to the clients' network latency: commands are scheduled
+ * COMMAND_DELAY turns ahead, so turns must be long enough for the commands to reach the
+ * server and all the other clients in that time, but any longer just adds input lag.
+ *
  * Thread-safety:
  * - This is constructed and used by CNetServerWorker in the network server thread.
  */
@@ -257,6 +300,9 @@ public:
 	 */
 	void UninitialiseClient(int client);
 
+	/**
+	 * Use a fixed length for all future turns, instead of adapting it to the latency.
+	 */
 	void SetTurnLength(u32 msecs);
 
 	/**
@@ -274,6 +320,11 @@ public:
 protected:
 	void CheckClientsReady();
 
+	/**
+	 * Updates m_TurnLength based on the current latency of the clients.
+	 */
+	void UpdateAdaptiveTurnLength();
+
 	/// The latest turn for which we have received all commands from all clients
 	u32 m_ReadyTurn;
 
@@ -287,9 +338,19 @@ protected:
 	// Map of turn -> {Client ID -> state hash}; old indexes <= min(m_ClientsSimulated) are deleted
 	std::map<u32, std::map<int, std::string> > m_ClientStateHashes;
 
+	// Turn number -> time when the first client finished sending its commands for that turn,
+	// to profile how much later the other clients finish; indexes <= m_ReadyTurn are deleted
+	std::map<u32, double> m_ClientsFirstReadyTime;
+
 	// Current turn length
 	u32 m_TurnLength;
 
+	// Whether m_TurnLength is adapted to the latency, rather than set by SetTurnLength
+	bool m_AdaptiveTurnLength;
+
+	// Number of consecutive turns for which a shorter turn length would have been enough
+	u32 m_ShorterTurnLengthCount;
+
 	// Turn lengths for all previously executed turns
 	std::vector<u32> m_SavedTurnLengths;
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -44,4 +44,34 @@ public:
 		delete msg2;
 		delete[] buf;
 	}
+
+	void roundtrip_sim(ScriptInterface& script, const char* code, size_t maxLength)
+	{
+		CScriptValRooted val;
+		TS_ASSERT(script.Eval(code, val));
+		CSimulationMessage msg(script, 1, -1, 3, val.get());
+
+		size_t len = msg.GetSerializedLength();
+		TS_ASSERT_LESS_THAN_EQUALS(len, maxLength);
+		u8* buf = new u8[len];
+		TS_ASSERT_EQUALS(msg.Serialize(buf) - (buf+len), 0);
+
+		CNetMessage* msg2 = CNetMessageFactory::CreateMessage(buf, len, script);
+		TS_ASSERT_STR_EQUALS(((CSimulationMessage*)msg2)->ToString(), msg.ToString());
+
+		delete msg2;
+		delete[] buf;
+	}
+
+	void test_sim_compact()
+	{
+		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
+
+		// Entity lists should take about a byte per entity
+		roundtrip_sim(script, "[{type: 'walk', entities: [1000, 1001, 1002, 1005, 1003, 999], x: 1.5, z: -200, queued: false}]", 80);
+		roundtrip_sim(script, "[{type: 'x', a: null, b: undefined, c: [1, 'a', [2.5, -3]], d: '\\u1234', e: {}, f: [], g: [-2147483648, 2147483647, -1]}]", 128);
+
+		// Values that can't be encoded compactly are still sent correctly
+		roundtrip_sim(script, "var a = [1, 2]; a.x = 3; [a]", 256);
+	}
 };
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -23,6 +23,7 @@
 #include "graphics/ColladaManager.h"
 #include "lib/tex/tex_codec.h"
 #include "lib/file/archive/archive_zip.h"
+#include "lib/file/common/trace.h"
 #include "lib/file/vfs/vfs_util.h"
 #include "ps/XML/Xeromyces.h"
 
@@ -64,7 +65,62 @@ void CArchiveBuilder::AddBaseMod(const OsPath& mod)
 	m_VFS->Mount(L"", mod/"", VFS_MOUNT_MUST_EXIST);
 }
 
-void CArchiveBuilder::Build(const OsPath& archive, bool compress)
+/**
+ * Returns the file that the traced load came from, since conversions are
+ * loaded from the cache instead of their source files: either as
+ * "cache/<source>.<hash>.<ext>" (loose) or "<source>.cached.<ext>" (archived).
+ */
+static VfsPath TracedSourcePath(const VfsPath& pathname)
+{
+	if (boost::algorithm::starts_with(pathname.string(), L"cache/"))
+		return VfsPath(pathname.string().substr(6)).ChangeExtension(L"").ChangeExtension(L"");
+
+	if (pathname.ChangeExtension(L"").Extension() == L".cached")
+		return pathname.ChangeExtension(L"").ChangeExtension(L"");
+
+	return pathname;
+}
+
+void CArchiveBuilder::OrderByTrace(const OsPath& tracePathname)
+{
+	PITrace trace = CreateTrace(64*MiB);
+	if (trace->Load(tracePathname) != INFO::OK)
+		return;
+
+	// Find when each file was first loaded
+	std::map<VfsPath, size_t> firstLoads;
+	for (size_t i = 0; i < trace->NumEntries(); ++i)
+	{
+		const TraceEntry& entry = trace->Entries()[i];
+		if (entry.Action() == TraceEntry::Load)
+			firstLoads.insert(std::make_pair(TracedSourcePath(entry.Pathname()), firstLoads.size()));
+	}
+
+	// Sort by (first load, directory order), so untraced files keep their order at the end
+	std::vector<std::pair<size_t, size_t> > order(m_Files.size());
+	size_t numTraced = 0;
+	for (size_t i = 0; i < m_Files.size(); ++i)
+	{
+		std::map<VfsPath, size_t>::const_iterator it = firstLoads.find(m_Files[i]);
+		if (it != firstLoads.end())
+		{
+			order[i] = std::make_pair(it->second, i);
+			++numTraced;
+		}
+		else
+			order[i] = std::make_pair(firstLoads.size(), i);
+	}
+	std::sort(order.begin(), order.end());
+
+	std::vector<VfsPath> files(m_Files.size());
+	for (size_t i = 0; i < order.size(); ++i)
+		files[i] = m_Files[order[i].second];
+	m_Files.swap(files);
+
+	debug_printf(L"Ordered %lu of %lu files by trace\n", (unsigned long)numTraced, (unsigned long)m_Files.size());
+}
+
+void CArchiveBuilder::Build(const OsPath& archive, bool compress, bool fastCompression)
 {
 	// By default we disable zip compression because it significantly hurts download
 	// size for releases (which re-compress all files with better compression
@@ -73,7 +129,7 @@ void CArchiveBuilder::Build(const OsPath& archive, bool compress)
 	// (See http://trac.wildfiregames.com/ticket/671)
 	const bool noDeflate = !compress;
 
-	PIArchiveWriter writer = CreateArchiveWriter_Zip(archive, noDeflate);
+	PIArchiveWriter writer = CreateArchiveWriter_Zip(archive, noDeflate, fastCompression);
 
 	// Use CTextureManager instead of CTextureConverter directly,
 	// so it can deal with all the loading of settings.xml files
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -49,12 +49,23 @@ public:
 	 */
 	void AddBaseMod(const OsPath& mod);
 
+	/**
+	 * Store files in the order in which they were first loaded in the given
+	 * trace (recorded with -iotrace), instead of directory order, so that
+	 * loading the same things reads the archive mostly sequentially.
+	 * Files that aren't in the trace are stored after the others.
+	 * @param trace path of the trace file
+	 */
+	void OrderByTrace(const OsPath& trace);
+
 	/**
 	 * Do all the processing and packing of files into the archive.
 	 * @param archive path of .zip file to generate (will be overwritten if it exists)
 	 * @param compress whether to compress the contents of the .zip file
+	 * @param fastCompression if compressing, use LZ4 (which loads faster but produces
+	 *   larger archives that only the engine can read) instead of Deflate
 	 */
-	void Build(const OsPath& archive, bool compress);
+	void Build(const OsPath& archive, bool compress, bool fastCompression = false);
 
 private:
 	static Status CollectFileCB(const VfsPath& pathname, const FileInfo& fileInfo, const uintptr_t cbData);
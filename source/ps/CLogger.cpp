@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -22,6 +22,7 @@
 #include "graphics/ShaderManager.h"
 #include "graphics/TextRenderer.h"
 #include "lib/ogl.h"
+#include "lib/external_libraries/libsdl.h"
 #include "lib/timer.h"
 #include "lib/utf8.h"
 #include "lib/sysdep/sysdep.h"
@@ -47,6 +48,10 @@ static const size_t RENDER_LIMIT = 20; // maximum messages on screen at once
 
 static const size_t BUFFER_SIZE = 1024;
 
+static const int MAX_REPEATS = 4; // identical messages logged in a row before the rest are suppressed
+static const double RATE_LIMIT_PERIOD = 1.0; // seconds
+static const int RATE_LIMIT_LINES = 200; // maximum messages logged per period
+
 // Set up a default logger that throws everything away, because that's
 // better than crashing. (This is particularly useful for unit tests which
 // don't care about any log output.)
@@ -82,16 +87,18 @@ CLogger::CLogger()
 
 	m_OwnsStreams = true;
 	m_UseDebugPrintf = true;
+	m_Async = true;
 
 	Init();
 }
 
-CLogger::CLogger(std::ostream* mainLog, std::ostream* interestingLog, bool takeOwnership, bool useDebugPrintf)
+CLogger::CLogger(std::ostream* mainLog, std::ostream* interestingLog, bool takeOwnership, bool useDebugPrintf, bool async)
 {
 	m_MainLog = mainLog;
 	m_InterestingLog = interestingLog;
 	m_OwnsStreams = takeOwnership;
 	m_UseDebugPrintf = useDebugPrintf;
+	m_Async = async;
 
 	Init();
 }
@@ -105,16 +112,55 @@ void CLogger::Init()
 	m_NumberOfMessages = 0;
 	m_NumberOfErrors = 0;
 	m_NumberOfWarnings = 0;
+
+	m_LastMethod = Normal;
+	m_LastRepeats = 0;
+	m_PeriodStart = 0.0;
+	m_PeriodLines = 0;
+	m_PeriodSuppressed = 0;
+	m_PeriodSuppressedInteresting = false;
 	
 	//Write Headers for the HTML documents
 	*m_MainLog << html_header0 << "Main log" << html_header1;
 
 	//Write Headers for the HTML documents
 	*m_InterestingLog << html_header0 << "Main log (warnings and errors only)" << html_header1;
+
+	m_WriterSem = NULL;
+	m_WriterShutdown = false;
+	if (m_Async)
+	{
+		// Use SDL semaphores since OS X doesn't implement sem_init
+		m_WriterSem = SDL_CreateSemaphore(0);
+		ENSURE(m_WriterSem);
+
+		int ret = pthread_create(&m_WriterThread, NULL, &RunWriterThread, this);
+		ENSURE(ret == 0);
+	}
 }
 
 CLogger::~CLogger()
 {
+	if (m_Async)
+	{
+		{
+			CScopeLock lock(m_Mutex);
+			m_WriterShutdown = true;
+		}
+		SDL_SemPost(m_WriterSem);
+		pthread_join(m_WriterThread, NULL);
+		SDL_DestroySemaphore(m_WriterSem);
+
+		// The thread has written everything that was logged before the shutdown,
+		// so whatever's left can be written directly
+		m_Async = false;
+		*m_MainLog << m_PendingMainLog;
+		*m_InterestingLog << m_PendingInterestingLog;
+	}
+
+	WriteRepeatSummary();
+	WriteSuppressedSummary();
+
 	char buffer[128];
 	sprintf_s(buffer, ARRAY_SIZE(buffer), " with %d message(s), %d error(s) and %d warning(s).", m_NumberOfMessages,m_NumberOfErrors,m_NumberOfWarnings);
 
@@ -149,6 +195,143 @@ static std::string ToHTML(const wchar_t* message)
 	return cmessage;
 }
 
+void* CLogger::RunWriterThread(void* data)
+{
+	debug_SetThreadName("logger");
+
+	static_cast<CLogger*>(data)->RunWriter();
+
+	return NULL;
+}
+
+void CLogger::RunWriter()
+{
+	std::string mainLog, interestingLog;
+
+	while (SDL_SemWait(m_WriterSem) == 0)
+	{
+		// Take all the pending lines at once (leaving our empty but
+		// already-allocated buffers in their place), then write them
+		// without holding the lock
+		bool shutdown;
+		{
+			CScopeLock lock(m_Mutex);
+			mainLog.swap(m_PendingMainLog);
+			interestingLog.swap(m_PendingInterestingLog);
+			shutdown = m_WriterShutdown;
+		}
+
+		if (!mainLog.empty())
+		{
+			*m_MainLog << mainLog;
+			m_MainLog->flush();
+			mainLog.clear();
+		}
+
+		if (!interestingLog.empty())
+		{
+			*m_InterestingLog << interestingLog;
+			m_InterestingLog->flush();
+			interestingLog.clear();
+		}
+
+		if (shutdown)
+			return;
+	}
+}
+
+void CLogger::WriteLine(const std::string& line, bool interesting)
+{
+	if (m_Async)
+	{
+		// Only wake the writer when there wasn't anything for it to do already
+		// (waking it once per message would cost more than the writing)
+		bool wake = m_PendingMainLog.empty() && m_PendingInterestingLog.empty();
+
+		m_PendingMainLog += line;
+		if (interesting)
+			m_PendingInterestingLog += line;
+
+		if (wake)
+			SDL_SemPost(m_WriterSem);
+	}
+	else
+	{
+		if (interesting)
+		{
+			*m_InterestingLog << line;
+			m_InterestingLog->flush();
+		}
+
+		*m_MainLog << line;
+		m_MainLog->flush();
+	}
+}
+
+bool CLogger::ShouldLog(ELogMethod method, const wchar_t* message)
+{
+	UpdateSuppressionPeriod(timer_Time());
+
+	if (method == m_LastMethod && m_LastMessage == message)
+	{
+		if (++m_LastRepeats > MAX_REPEATS)
+			return false;
+	}
+	else
+	{
+		WriteRepeatSummary();
+		m_LastMethod = method;
+		m_LastMessage = message;
+		m_LastRepeats = 0;
+	}
+
+	if (++m_PeriodLines > RATE_LIMIT_LINES)
+	{
+		++m_PeriodSuppressed;
+		if (method != Normal)
+			m_PeriodSuppressedInteresting = true;
+		return false;
+	}
+
+	return true;
+}
+
+void CLogger::UpdateSuppressionPeriod(double now)
+{
+	if (now - m_PeriodStart < RATE_LIMIT_PERIOD)
+		return;
+
+	WriteRepeatSummary();
+	WriteSuppressedSummary();
+
+	m_PeriodStart = now;
+	m_PeriodLines = 0;
+}
+
+void CLogger::WriteRepeatSummary()
+{
+	if (m_LastRepeats <= MAX_REPEATS)
+		return;
+
+	// Keep suppressing the same message if it's still being repeated
+	char buffer[64];
+	sprintf_s(buffer, ARRAY_SIZE(buffer), "<p>(Last message repeated %d more times)</p>\n", m_LastRepeats - MAX_REPEATS);
+	WriteLine(buffer, m_LastMethod != Normal);
+	m_LastRepeats = MAX_REPEATS;
+}
+
+void CLogger::WriteSuppressedSummary()
+{
+	if (m_PeriodSuppressed == 0)
+		return;
+
+	char buffer[64];
+	sprintf_s(buffer, ARRAY_SIZE(buffer), "<p>(%d more messages suppressed)</p>\n", m_PeriodSuppressed);
+	WriteLine(buffer, m_PeriodSuppressedInteresting);
+	m_PeriodSuppressed = 0;
+	m_PeriodSuppressedInteresting = false;
+}
+
 void CLogger::WriteMessage(const wchar_t* message, bool doRender = false)
 {
 	std::string cmessage = ToHTML(message);
@@ -156,11 +339,12 @@ void CLogger::WriteMessage(const wchar_t* message, bool doRender = false)
 	CScopeLock lock(m_Mutex);
 
 	++m_NumberOfMessages;
+	if (!ShouldLog(Normal, message))
+		return;
 //	if (m_UseDebugPrintf)
 //		debug_printf(L"MESSAGE: %ls\n", message);
 
-	*m_MainLog << "<p>" << cmessage << "</p>\n";
-	m_MainLog->flush();
+	WriteLine("<p>" + cmessage + "</p>\n", false);
 	
 	if (doRender)
 	{
@@ -177,15 +361,13 @@ void CLogger::WriteError(const wchar_t* message)
 	CScopeLock lock(m_Mutex);
 
 	++m_NumberOfErrors;
+	if (!ShouldLog(Error, message))
+		return;
 	if (m_UseDebugPrintf)
 		debug_printf(L"ERROR: %ls\n", message);
 
 	if (g_Console) g_Console->InsertMessage(L"ERROR: %ls", message);
-	*m_InterestingLog << "<p class=\"error\">ERROR: " << cmessage << "</p>\n";
-	m_InterestingLog->flush();
-
-	*m_MainLog << "<p class=\"error\">ERROR: " << cmessage << "</p>\n";
-	m_MainLog->flush();
+	WriteLine("<p class=\"error\">ERROR: " + cmessage + "</p>\n", true);
 
 	PushRenderMessage(Error, message);
 }
@@ -197,15 +379,13 @@ void CLogger::WriteWarning(const wchar_t* message)
 	CScopeLock lock(m_Mutex);
 
 	++m_NumberOfWarnings;
+	if (!ShouldLog(Warning, message))
+		return;
 	if (m_UseDebugPrintf)
 		debug_printf(L"WARNING: %ls\n", message);
 
 	if (g_Console) g_Console->InsertMessage(L"WARNING: %ls", message);
-	*m_InterestingLog << "<p class=\"warning\">WARNING: " << cmessage << "</p>\n";
-	m_InterestingLog->flush();
-
-	*m_MainLog << "<p class=\"warning\">WARNING: " << cmessage << "</p>\n";
-	m_MainLog->flush();
+	WriteLine("<p class=\"warning\">WARNING: " + cmessage + "</p>\n", true);
 
 	PushRenderMessage(Warning, message);
 }
@@ -362,11 +542,14 @@ void CLogger::CleanupRenderQueue()
 {
 	CScopeLock lock(m_Mutex);
 
+	double now = timer_Time();
+
+	// Report suppressed messages even if nothing else gets logged
+	UpdateSuppressionPeriod(now);
+
 	if (m_RenderMessages.empty())
 		return;
 
-	double now = timer_Time();
-
 	// Initialise the timer on the first call (since we can't do it in the ctor)
 	if (m_RenderLastEraseTime == -1.0)
 		m_RenderLastEraseTime = now;
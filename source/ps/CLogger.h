@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -28,6 +28,8 @@
 class CLogger;
 extern CLogger* g_Logger;
 
+struct SDL_semaphore;
+
 
 #define LOGMESSAGE g_Logger->LogMessage
 #define LOGMESSAGERENDER g_Logger->LogMessageRender
@@ -37,6 +39,14 @@ extern CLogger* g_Logger;
 /**
  * Error/warning/message logging class.
  *
+ * Runs of identical messages are collapsed, and the number of lines logged per
+ * second is limited, so code that logs every frame or for every entity can't
+ * swamp the logs (and the game); the number of suppressed lines is logged
+ * periodically instead.
+ *
+ * If asynchronous, the log files are written by a background thread, so logging
+ * only has to append to a buffer and never waits for the disk.
+ *
  * Thread-safety:
  * - Expected to be constructed/destructed in the main thread.
  * - The message logging functions may be called from any thread
@@ -53,12 +63,13 @@ public:
 		Warning
 	};
 
-	// Default constructor - outputs to normal log files
+	// Default constructor - outputs to normal log files, asynchronously
 	CLogger();
 
 	// Special constructor (mostly for testing) - outputs to provided streams.
 	// Can take ownership of streams and delete them in the destructor.
-	CLogger(std::ostream* mainLog, std::ostream* interestingLog, bool takeOwnership, bool useDebugPrintf);
+	// If async, the streams mustn't be used by anything else until this is destroyed.
+	CLogger(std::ostream* mainLog, std::ostream* interestingLog, bool takeOwnership, bool useDebugPrintf, bool async = false);
 
 	~CLogger();
 
@@ -82,6 +93,23 @@ private:
 
 	void PushRenderMessage(ELogMethod method, const wchar_t* message);
 
+	// Returns false if the message should be suppressed because it's a repeat
+	// or there have been too many recently. (Requires m_Mutex to be held.)
+	bool ShouldLog(ELogMethod method, const wchar_t* message);
+
+	// Logs the number of suppressed messages, if any, once per rate limiting period.
+	// (Requires m_Mutex to be held.)
+	void UpdateSuppressionPeriod(double now);
+	void WriteRepeatSummary();
+	void WriteSuppressedSummary();
+
+	// Writes an HTML line to the main log, and the interesting log too if requested.
+	// (Requires m_Mutex to be held.)
+	void WriteLine(const std::string& line, bool interesting);
+
+	static void* RunWriterThread(void* data);
+	void RunWriter();
+
 	// Delete old timed-out entries from the list of text to render
 	void CleanupRenderQueue();
 
@@ -94,6 +122,26 @@ private:
 	// or suppressed (for tests that intentionally trigger errors)
 	bool m_UseDebugPrintf;
 
+	// Asynchronous writing: lines waiting for the writer thread, which is woken
+	// by m_WriterSem whenever they become non-empty or it should shut down
+	bool m_Async;
+	pthread_t m_WriterThread;
+	SDL_semaphore* m_WriterSem;
+	bool m_WriterShutdown;
+	std::string m_PendingMainLog;
+	std::string m_PendingInterestingLog;
+
+	// Suppression of repeated messages
+	ELogMethod m_LastMethod;
+	std::wstring m_LastMessage;
+	int m_LastRepeats;
+
+	// Rate limiting: lines logged and suppressed since m_PeriodStart
+	double m_PeriodStart;
+	int m_PeriodLines;
+	int m_PeriodSuppressed;
+	bool m_PeriodSuppressedInteresting;
+
 	// vars to hold message counts
 	int m_NumberOfMessages;
 	int m_NumberOfErrors;
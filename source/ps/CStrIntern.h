@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -32,7 +32,7 @@ class CStrInternInternals;
  * unbounded numbers of strings (e.g. text rendered by gameplay scripts) -
  * it's intended for a small number of short frequently-used strings.
  * 
- * Not thread-safe - only allocate these strings from the main thread.
+ * Thread-safe - strings can be interned from any thread.
  */
 class CStrIntern
 {
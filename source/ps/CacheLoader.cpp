@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -19,11 +19,26 @@
 
 #include "CacheLoader.h"
 
+#include "lib/file/vfs/vfs_util.h"
+#include "lib/sysdep/filesystem.h"
 #include "ps/CLogger.h"
+#include "ps/ThreadUtil.h"
 #include "maths/MD5.h"
 
 #include <iomanip>
 
+// Loose cache files that have been looked up in this session, so that
+// CollectGarbage doesn't delete them.
+// (Protected by a mutex since files can be loaded by other threads too)
+static CMutex g_UsedLooseCacheMutex;
+static std::set<VfsPath> g_UsedLooseCache;
+
+static void MarkLooseCacheUsed(const VfsPath& looseCachePath)
+{
+	CScopeLock lock(g_UsedLooseCacheMutex);
+	g_UsedLooseCache.insert(looseCachePath);
+}
+
 CCacheLoader::CCacheLoader(PIVFS vfs, const std::wstring& fileExtension) :
 	m_VFS(vfs), m_FileExtension(fileExtension)
 {
@@ -54,6 +69,7 @@ Status CCacheLoader::TryLoadingCached(const VfsPath& sourcePath, const MD5& init
 	// Look for loose cache of source file
 
 	VfsPath looseCachePath = LooseCachePath(sourcePath, initialHash, version);
+	MarkLooseCacheUsed(looseCachePath);
 
 	// If the loose cache file exists, use it
 	if (m_VFS->GetFileInfo(looseCachePath, NULL) >= 0)
@@ -148,3 +164,87 @@ VfsPath CCacheLoader::LooseCachePath(const VfsPath& sourcePath, const MD5& initi
 
 	// TODO: we should probably include the mod name, once that's possible (http://trac.wildfiregames.com/ticket/564)
 }
+
+namespace
+{
+struct LooseCacheFile
+{
+	time_t mtime;
+	VfsPath pathname;
+	u64 size;
+
+	bool operator<(const LooseCacheFile& rhs) const
+	{
+		return mtime < rhs.mtime;
+	}
+};
+}
+
+/**
+ * Returns whether the file was named by LooseCachePath, i.e. as
+ * "<name>.<16 hex digits>.<extension>", so that CollectGarbage doesn't
+ * delete anything else that's stored in the cache directory.
+ */
+static bool IsLooseCacheFile(const VfsPath& pathname)
+{
+	const std::wstring hash = pathname.ChangeExtension(L"").Extension().string();
+	if (hash.length() != 17)
+		return false;
+	for (size_t i = 1; i < hash.length(); ++i)
+		if (!iswxdigit(hash[i]))
+			return false;
+	return true;
+}
+
+static Status CollectLooseCacheFileCB(const VfsPath& pathname, const FileInfo& fileInfo, const uintptr_t cbData)
+{
+	if (IsLooseCacheFile(pathname))
+	{
+		std::vector<LooseCacheFile>* files = (std::vector<LooseCacheFile>*)cbData;
+		LooseCacheFile file = { fileInfo.MTime(), pathname, (u64)fileInfo.Size() };
+		files->push_back(file);
+	}
+	return INFO::OK;
+}
+
+u64 CCacheLoader::CollectGarbage(const PIVFS& vfs, u64 maxSize)
+{
+	std::vector<LooseCacheFile> files;
+	if (vfs::ForEachFile(vfs, L"cache/", &CollectLooseCacheFileCB, (uintptr_t)&files, 0, vfs::DIR_RECURSIVE) < 0)
+		return 0;
+
+	u64 totalSize = 0;
+	for (size_t i = 0; i < files.size(); ++i)
+		totalSize += files[i].size;
+	if (totalSize <= maxSize)
+		return 0;
+
+	// Loose cache files are written once and never modified, so their
+	// timestamps say how long ago they were created. (Access times aren't
+	// available on all filesystems, which is why used files are tracked
+	// per session instead.)
+	std::sort(files.begin(), files.end());
+
+	CScopeLock lock(g_UsedLooseCacheMutex);
+
+	u64 freed = 0;
+	size_t numDeleted = 0;
+	for (size_t i = 0; i < files.size() && totalSize - freed > maxSize; ++i)
+	{
+		if (g_UsedLooseCache.count(files[i].pathname))
+			continue;
+
+		OsPath realPath;
+		if (vfs->GetRealPath(files[i].pathname, realPath) != INFO::OK)
+			continue;
+		if (wunlink(realPath) != 0)
+			continue;	// (e.g. it's still being read by another process)
+		(void)vfs->RemoveFile(files[i].pathname);
+
+		freed += files[i].size;
+		++numDeleted;
+	}
+
+	LOGMESSAGE(L"CCacheLoader: Deleted %lu unused cache files (%lu MiB)", (unsigned long)numDeleted, (unsigned long)(freed / MiB));
+	return freed;
+}
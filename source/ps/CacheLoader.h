@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -36,6 +36,10 @@ class MD5;
  * These cache files will typically be packed into an archive for faster loading;
  * if no archive cache is available then the source file will be converted and stored
  * as a loose cache file instead.
+ *
+ * Loose cache files are never modified, so outdated ones accumulate as source
+ * files and conversion settings change; CollectGarbage deletes them once the
+ * loose cache grows beyond a size limit.
  */
 class CCacheLoader
 {
@@ -66,6 +70,15 @@ public:
 	 */
 	VfsPath LooseCachePath(const VfsPath& sourcePath, const MD5& initialHash, u32 version);
 
+	/**
+	 * Delete loose cache files that haven't been looked up by any CCacheLoader
+	 * in this session, oldest first, until the total size of the loose cache is
+	 * at most @p maxSize bytes. Files that are in use are never deleted, so the
+	 * cache may remain larger than that.
+	 * Returns the number of bytes that were freed.
+	 */
+	static u64 CollectGarbage(const PIVFS& vfs, u64 maxSize);
+
 private:
 	PIVFS m_VFS;
 	std::wstring m_FileExtension;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -61,3 +61,64 @@ void DecompressZLib(const std::string& data, std::string& out, bool includeLengt
 
 	// TODO: better error reporting might be nice
 }
+
+CZLibStreamDecompressor::CZLibStreamDecompressor() :
+	m_Stream(new z_stream), m_Complete(false), m_Failed(false)
+{
+	memset(m_Stream, 0, sizeof(*m_Stream));
+	int zok = inflateInit(m_Stream);
+	ENSURE(zok == Z_OK);
+}
+
+CZLibStreamDecompressor::~CZLibStreamDecompressor()
+{
+	inflateEnd(m_Stream);
+	delete m_Stream;
+}
+
+bool CZLibStreamDecompressor::Append(const char* data, size_t length)
+{
+	if (m_Failed)
+		return false;
+
+	// Read the 4-byte uncompressed length header first, so we can allocate the output
+	if (m_Header.size() < 4)
+	{
+		size_t headerLength = std::min(length, 4 - m_Header.size());
+		m_Header.append(data, headerLength);
+		data += headerLength;
+		length -= headerLength;
+
+		if (m_Header.size() < 4)
+			return true;
+
+		m_Output.resize(read_le32(m_Header.c_str()));
+		m_Stream->next_out = (Bytef*)m_Output.c_str();
+		m_Stream->avail_out = m_Output.size();
+	}
+
+	if (length == 0)
+		return true;
+
+	if (m_Complete)
+	{
+		// There shouldn't be anything after the end of the stream
+		m_Failed = true;
+		return false;
+	}
+
+	m_Stream->next_in = (Bytef*)data;
+	m_Stream->avail_in = length;
+	int zok = inflate(m_Stream, Z_NO_FLUSH);
+	if (zok == Z_STREAM_END)
+	{
+		m_Complete = (m_Stream->avail_in == 0 && m_Stream->avail_out == 0);
+		m_Failed = !m_Complete;
+	}
+	else if (zok != Z_OK)
+	{
+		m_Failed = true;
+	}
+
+	return !m_Failed;
+}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,11 +20,49 @@
 
 /**
  * @file
- * Simple (non-streaming) compression functions.
+ * Simple compression functions.
  */
 
+struct z_stream_s;
+
 void CompressZLib(const std::string& data, std::string& out, bool includeLengthHeader);
 
 void DecompressZLib(const std::string& data, std::string& out, bool includeLengthHeader);
 
+/**
+ * Incrementally decompresses the output of CompressZLib (with includeLengthHeader),
+ * so that data can be decompressed while it's still being received.
+ */
+class CZLibStreamDecompressor
+{
+	NONCOPYABLE(CZLibStreamDecompressor);
+public:
+	CZLibStreamDecompressor();
+	~CZLibStreamDecompressor();
+
+	/**
+	 * Decompresses the next part of the compressed data.
+	 * @return false if the data is invalid (in which case later calls will fail too)
+	 */
+	bool Append(const char* data, size_t length);
+
+	/**
+	 * Returns whether the end of the compressed data has been successfully reached.
+	 */
+	bool IsComplete() const { return m_Complete; }
+
+	/**
+	 * Returns the decompressed data. (It's only meaningful once IsComplete is true;
+	 * callers can swap it out to avoid copying.)
+	 */
+	std::string& GetOutput() { return m_Output; }
+
+private:
+	z_stream_s* m_Stream;
+	std::string m_Header;
+	std::string m_Output;
+	bool m_Complete;
+	bool m_Failed;
+};
+
 #endif // INCLUDED_COMPRESS
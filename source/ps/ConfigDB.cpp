@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -32,6 +32,7 @@
 typedef std::map <CStr, CConfigValueSet> TConfigMap;
 TConfigMap CConfigDB::m_Map[CFG_LAST];
 VfsPath CConfigDB::m_ConfigFile[CFG_LAST];
+size_t CConfigDB::m_Revision = 1;
 
 #define GET_NS_PRIVATE(cx, obj) (EConfigNamespace)((intptr_t)JS_GetPrivate(cx, obj) >> 1)
 
@@ -304,6 +305,9 @@ CConfigValue *CConfigDB::CreateValue(EConfigNamespace ns, const CStr& name)
 		return NULL;
 	}
 
+	// The caller is going to change the value
+	++m_Revision;
+
 	TConfigMap::iterator it = m_Map[ns].find(name);
 	if (it != m_Map[ns].end())
 		return &(it->second[0]);
@@ -404,6 +408,7 @@ bool CConfigDB::Reload(EConfigNamespace ns)
 	while (next < filebufend);
 	
 	m_Map[ns].swap(newMap);
+	++m_Revision;
 
 	return true;
 }
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -78,6 +78,7 @@ class CConfigDB: public Singleton<CConfigDB>
 {
 	static std::map <CStr, CConfigValueSet> m_Map[];
 	static VfsPath m_ConfigFile[];
+	static size_t m_Revision;
 
 public:
 	CConfigDB();
@@ -166,6 +167,13 @@ public:
 	 *	false:	if an error occurred
 	 */
 	bool WriteFile(EConfigNamespace ns);
+
+	/**
+	 * Returns a number that changes whenever values might have been changed
+	 * (by CreateValue (including the JS interface) or Reload), so that cached
+	 * copies of values (see CConfigSetting) know when to look them up again.
+	 */
+	static size_t GetRevision() { return m_Revision; }
 };
 
 
@@ -180,4 +188,57 @@ STMT(\
 )
 
 
+/**
+ * Cached copy of a config value, for code that wants to read a setting often
+ * (e.g. every frame) but still pick up changes made from the console or the
+ * options page. The value is looked up like CFG_GET_VAL does, but only when the
+ * config has changed since the last lookup, so Get() is usually just a
+ * comparison and a load.
+ *
+ * T can be bool, int, float, double or CStr.
+ * Values shouldn't be modified through pointers returned by GetValue/GetValues,
+ * since that won't be noticed here. Use CreateValue instead.
+ */
+template<typename T>
+class CConfigSetting
+{
+public:
+	CConfigSetting(const CStr& name, const T& defaultValue) :
+		m_Name(name), m_Default(defaultValue), m_Value(defaultValue), m_Revision(0)
+	{
+	}
+
+	const T& Get() const
+	{
+		if (m_Revision != CConfigDB::GetRevision())
+			Update();
+		return m_Value;
+	}
+
+private:
+	void Update() const
+	{
+		m_Value = m_Default;
+		if (!CConfigDB::IsInitialised())
+			return;
+
+		m_Revision = CConfigDB::GetRevision();
+		CConfigValue* val = g_ConfigDB.GetValue(CFG_USER, m_Name);
+		if (val)
+			GetAs(*val, m_Value);
+	}
+
+	static void GetAs(CConfigValue& val, bool& ret) { val.GetBool(ret); }
+	static void GetAs(CConfigValue& val, int& ret) { val.GetInt(ret); }
+	static void GetAs(CConfigValue& val, float& ret) { val.GetFloat(ret); }
+	static void GetAs(CConfigValue& val, double& ret) { val.GetDouble(ret); }
+	static void GetAs(CConfigValue& val, CStr& ret) { val.GetString(ret); }
+
+	CStr m_Name;
+	T m_Default;
+	mutable T m_Value;
+	mutable size_t m_Revision; // 0 if m_Value has never been looked up
+};
+
+
 #endif
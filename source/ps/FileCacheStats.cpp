@@ -0,0 +1,116 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "precompiled.h"
+
+#include "FileCacheStats.h"
+
+#include "ps/Filesystem.h"
+
+enum
+{
+	Col_Name,
+	Col_Size,
+	Col_Hits,
+	Col_Misses,
+	Col_Evictions,
+	NumberColumns
+};
+
+CFileCacheStatsTable::CFileCacheStatsTable()
+{
+	m_ColumnDescriptions.push_back(ProfileColumn("Name", 150));
+	m_ColumnDescriptions.push_back(ProfileColumn("cached (KiB)", 100));
+	m_ColumnDescriptions.push_back(ProfileColumn("hits", 80));
+	m_ColumnDescriptions.push_back(ProfileColumn("misses", 80));
+	m_ColumnDescriptions.push_back(ProfileColumn("evictions", 80));
+}
+
+CStr CFileCacheStatsTable::GetName()
+{
+	return "filecache";
+}
+
+CStr CFileCacheStatsTable::GetTitle()
+{
+	if (!g_VFS)
+		return "File cache statistics";
+
+	char buf[256];
+	sprintf_s(buf, ARRAY_SIZE(buf), "File cache statistics (budget: %lu MiB)", (unsigned long)(g_VFS->GetCacheStats().budget / MiB));
+	return buf;
+}
+
+size_t CFileCacheStatsTable::GetNumberRows()
+{
+	// one per file class, then the totals
+	return FileCache::NUM_FILE_CLASSES + 1;
+}
+
+const std::vector<ProfileColumn>& CFileCacheStatsTable::GetColumns()
+{
+	return m_ColumnDescriptions;
+}
+
+CStr CFileCacheStatsTable::GetCellText(size_t row, size_t col)
+{
+	if (!g_VFS)
+		return "";
+
+	const FileCache::Stats stats = g_VFS->GetCacheStats();
+
+	FileCache::ClassStats classStats;
+	if (row < FileCache::NUM_FILE_CLASSES)
+	{
+		if (col == Col_Name)
+			return FileCache::FileClassName((FileCache::FileClass)row);
+		classStats = stats.classes[row];
+	}
+	else
+	{
+		if (col == Col_Name)
+			return "total";
+		memset(&classStats, 0, sizeof(classStats));
+		for (size_t i = 0; i < FileCache::NUM_FILE_CLASSES; ++i)
+		{
+			classStats.hits += stats.classes[i].hits;
+			classStats.misses += stats.classes[i].misses;
+			classStats.evictions += stats.classes[i].evictions;
+			classStats.size += stats.classes[i].size;
+		}
+	}
+
+	switch (col)
+	{
+	case Col_Size:
+		return CStr::FromUInt((unsigned int)(classStats.size / KiB));
+	case Col_Hits:
+		return CStr::FromUInt((unsigned int)classStats.hits);
+	case Col_Misses:
+		return CStr::FromUInt((unsigned int)classStats.misses);
+	case Col_Evictions:
+		return CStr::FromUInt((unsigned int)classStats.evictions);
+	default:
+		return "???";
+	}
+}
+
+AbstractProfileTable* CFileCacheStatsTable::GetChild(size_t UNUSED(row))
+{
+	return 0;
+}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -73,28 +73,100 @@ Status ReloadChangedFiles()
 
 	std::vector<DirWatchNotification> notifications;
 	RETURN_STATUS_IF_ERR(dir_watch_Poll(notifications));
-	for(size_t i = 0; i < notifications.size(); i++)
+
+	// Large changes (e.g. version control updates) produce thousands of
+	// notifications, often several per file, so collect the set of changed
+	// files and let each system handle them all at once.
+	// (GetVirtualPath has to search the whole VFS, so only call it once per directory)
+	std::set<VfsPath> changedFiles;
+	std::map<OsPath, VfsPath> directories;
+	std::set<OsPath> unknownDirectories;
+	for (size_t i = 0; i < notifications.size(); i++)
 	{
-		if(!CanIgnore(notifications[i]))
+		if (CanIgnore(notifications[i]))
+			continue;
+
+		const OsPath& realPathname = notifications[i].Pathname();
+		const OsPath realDirectory = realPathname.Parent()/"";
+		std::map<OsPath, VfsPath>::iterator it = directories.find(realDirectory);
+		if (it == directories.end())
 		{
+			// (ignore directories that aren't mounted, or were created since the last populate)
+			if (unknownDirectories.count(realDirectory))
+				continue;
 			VfsPath pathname;
-			RETURN_STATUS_IF_ERR(g_VFS->GetVirtualPath(notifications[i].Pathname(), pathname));
-			RETURN_STATUS_IF_ERR(g_VFS->RemoveFile(pathname));
-			RETURN_STATUS_IF_ERR(g_VFS->RepopulateDirectory(pathname.Parent()/""));
-
-			// Tell each hotloadable system about this file change:
+			if (g_VFS->GetVirtualPath(realPathname, pathname) != INFO::OK)
+			{
+				unknownDirectories.insert(realDirectory);
+				continue;
+			}
+			it = directories.insert(std::make_pair(realDirectory, pathname.Parent()/"")).first;
+		}
 
-			RETURN_STATUS_IF_ERR(g_GUI->ReloadChangedFiles(pathname));
+		changedFiles.insert(it->second / realPathname.Filename());
+	}
 
-			for (size_t j = 0; j < g_ReloadFuncs.size(); ++j)
-				g_ReloadFuncs[j].first(g_ReloadFuncs[j].second, pathname);
+	if (changedFiles.empty())
+		return INFO::OK;
 
-			RETURN_STATUS_IF_ERR(h_reload(g_VFS, pathname));
-		}
+	const std::vector<VfsPath> paths(changedFiles.begin(), changedFiles.end());
+	for (size_t i = 0; i < paths.size(); ++i)
+	{
+		// (new files aren't in the VFS yet)
+		const Status ret = g_VFS->RemoveFile(paths[i]);
+		if (ret != ERR::VFS_FILE_NOT_FOUND)
+			RETURN_STATUS_IF_ERR(ret);
 	}
+	for (std::map<OsPath, VfsPath>::iterator it = directories.begin(); it != directories.end(); ++it)
+		RETURN_STATUS_IF_ERR(g_VFS->RepopulateDirectory(it->second));
+
+	// Tell each hotloadable system about the file changes:
+
+	RETURN_STATUS_IF_ERR(g_GUI->ReloadChangedFiles(paths));
+
+	for (size_t j = 0; j < g_ReloadFuncs.size(); ++j)
+		g_ReloadFuncs[j].first(g_ReloadFuncs[j].second, paths);
+
+	for (size_t i = 0; i < paths.size(); ++i)
+		RETURN_STATUS_IF_ERR(h_reload(g_VFS, paths[i]));
+
 	return INFO::OK;
 }
 
+struct SAsyncFileLoad
+{
+	PIVFS vfs;
+	VfsPath pathname;
+	FileLoadedFunc func;
+	void* cbdata;
+};
+
+static void RunAsyncFileLoad(void* data)
+{
+	SAsyncFileLoad* load = (SAsyncFileLoad*)data;
+
+	shared_ptr<u8> fileContents;
+	size_t size = 0;
+	Status ret = load->vfs->LoadFile(load->pathname, fileContents, size);
+	load->func(load->cbdata, load->pathname, ret, fileContents, size);
+
+	delete load;
+}
+
+void LoadFileAsync(const PIVFS& vfs, const VfsPath& pathname, FileLoadedFunc func, void* cbdata, CThreadPool::TaskGroup* group)
+{
+	SAsyncFileLoad* load = new SAsyncFileLoad;
+	load->vfs = vfs;
+	load->pathname = pathname;
+	load->func = func;
+	load->cbdata = cbdata;
+
+	if (g_ThreadPool)
+		g_ThreadPool->Submit(RunAsyncFileLoad, load, group);
+	else
+		RunAsyncFileLoad(load);
+}
+
 std::wstring GetWstringFromWpath(const fs::wpath& path)
 {
 #if BOOST_FILESYSTEM_VERSION == 3
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -25,15 +25,18 @@
 
 #include "ps/CStr.h"
 #include "ps/Errors.h"
+#include "ps/ThreadPool.h"
 
 extern PIVFS g_VFS;
 
 extern bool VfsFileExists(const VfsPath& pathname);
 
 /**
- * callback function type for file change notifications
+ * callback function type for file change notifications.
+ * paths contains every file that changed since the previous call (sorted,
+ * and each only once), so that systems can rebuild things once per batch.
  */
-typedef Status (*FileReloadFunc)(void* param, const VfsPath& path);
+typedef Status (*FileReloadFunc)(void* param, const std::vector<VfsPath>& paths);
 
 /**
  * register a callback function to be called by ReloadChangedFiles
@@ -54,6 +57,22 @@ void UnregisterFileReloadFunc(FileReloadFunc func, void* obj);
  **/
 extern Status ReloadChangedFiles();
 
+/**
+ * callback function type for LoadFileAsync.
+ * ret is the status returned by IVFS::LoadFile; fileContents and size
+ * are only valid if it succeeded.
+ */
+typedef void (*FileLoadedFunc)(void* cbdata, const VfsPath& pathname, Status ret, const shared_ptr<u8>& fileContents, size_t size);
+
+/**
+ * load a file on one of the thread pool's workers (or immediately, if
+ * there's no thread pool), then call func on that same thread.
+ * the VFS reads and decompresses files without holding its lock, so
+ * several loads can overlap.
+ * @param group if not NULL, the load is added to this group, to allow waiting for it.
+ **/
+void LoadFileAsync(const PIVFS& vfs, const VfsPath& pathname, FileLoadedFunc func, void* cbdata, CThreadPool::TaskGroup* group = NULL);
+
 /**
  * Helper function to handle API differences between Boost Filesystem v2 and v3
  */
@@ -0,0 +1,127 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "FrameArena.h"
+
+#include "lib/alignment.h"
+#include "lib/sysdep/cpu.h"
+#include "lib/sysdep/rtl.h"
+
+CFrameArena g_RenderFrameArena(1*MiB);
+CFrameArena g_SimTurnArena(256*KiB);
+
+struct CFrameArena::ThreadArena
+{
+	ThreadArena(size_t chunkSize, intptr_t generation) :
+		generation(generation), used(0)
+	{
+		AddChunk(chunkSize);
+	}
+
+	~ThreadArena()
+	{
+		for (size_t i = 0; i < chunks.size(); ++i)
+			rtl_FreeAligned(chunks[i]);
+	}
+
+	void AddChunk(size_t size)
+	{
+		chunks.push_back((u8*)rtl_AllocateAligned(size, allocationAlignment));
+		ENSURE(chunks.back());
+		capacity = size;
+		end = 0;
+	}
+
+	void Reset()
+	{
+		// If we needed more than one chunk, replace them all with a single one
+		// that would have been big enough
+		if (chunks.size() > 1)
+		{
+			for (size_t i = 0; i < chunks.size(); ++i)
+				rtl_FreeAligned(chunks[i]);
+			chunks.clear();
+			AddChunk(Align<pageSize>(used));
+		}
+		end = 0;
+		used = 0;
+	}
+
+	intptr_t generation;
+
+	std::vector<u8*> chunks; // we allocate from the last one
+	size_t capacity; // size of the current chunk
+	size_t end; // offset of the free space in the current chunk
+
+	size_t used; // total bytes allocated since the last Reset
+};
+
+CFrameArena::CFrameArena(size_t chunkSize) :
+	m_ChunkSize(chunkSize), m_Generation(0)
+{
+	int ret = pthread_key_create(&m_TLS, NULL);
+	ENSURE(ret == 0);
+}
+
+CFrameArena::~CFrameArena()
+{
+	for (size_t i = 0; i < m_Threads.size(); ++i)
+		delete m_Threads[i];
+
+	pthread_key_delete(m_TLS);
+}
+
+CFrameArena::ThreadArena& CFrameArena::GetThreadArena()
+{
+	ThreadArena* arena = static_cast<ThreadArena*>(pthread_getspecific(m_TLS));
+	if (!arena)
+	{
+		arena = new ThreadArena(m_ChunkSize, m_Generation);
+		pthread_setspecific(m_TLS, arena);
+
+		CScopeLock lock(m_Mutex);
+		m_Threads.push_back(arena);
+	}
+	else if (arena->generation != m_Generation)
+	{
+		// Everything this thread allocated before the last Reset is unused now
+		arena->Reset();
+		arena->generation = m_Generation;
+	}
+	return *arena;
+}
+
+void* CFrameArena::allocate(size_t size)
+{
+	ThreadArena& arena = GetThreadArena();
+
+	size = Align<allocationAlignment>(size);
+	if (arena.end + size > arena.capacity)
+		arena.AddChunk(std::max(size, arena.capacity));
+
+	void* p = arena.chunks.back() + arena.end;
+	arena.end += size;
+	arena.used += size;
+	return p;
+}
+
+void CFrameArena::Reset()
+{
+	cpu_AtomicAdd(&m_Generation, 1);
+}
@@ -0,0 +1,113 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_FRAMEARENA
+#define INCLUDED_FRAMEARENA
+
+#include "lib/allocators/allocator_adapters.h"
+#include "lib/posix/posix_pthread.h"
+#include "ps/ThreadUtil.h"
+
+#include <vector>
+
+/**
+ * Linear allocator for temporary data that doesn't need to outlive the
+ * current frame (or simulation turn), to avoid the cost of lots of small
+ * heap allocations and frees in code that runs every frame.
+ *
+ * Each thread allocates from its own chunk of memory, so there's no locking.
+ * deallocate does nothing; instead, Reset invalidates everything that was
+ * allocated from every thread since the last Reset. (The threads only notice
+ * on their next allocation, so Reset is cheap and doesn't need to wait for them.)
+ * Memory must not be used after the Reset that ends its frame, so this mustn't be
+ * used by tasks that might still be running at that point.
+ *
+ * If a thread runs out of space in its chunk, it allocates more from the heap,
+ * and after the next Reset it replaces its chunk with one that's big enough
+ * for everything, so the heap is only hit in the first few frames.
+ *
+ * This has the allocate/deallocate interface from allocator_adapters.h,
+ * so it can be used with ProxyAllocator (see FrameVector).
+ */
+class CFrameArena
+{
+	NONCOPYABLE(CFrameArena);
+
+public:
+	/**
+	 * @param chunkSize initial size [bytes] of each thread's chunk.
+	 */
+	CFrameArena(size_t chunkSize);
+	~CFrameArena();
+
+	/**
+	 * Returns space for @p size bytes (aligned to allocationAlignment),
+	 * valid until the next Reset.
+	 */
+	void* allocate(size_t size);
+
+	void deallocate(void* UNUSED(p), size_t UNUSED(size))
+	{
+		// ignored
+	}
+
+	/**
+	 * Release everything that has been allocated by any thread.
+	 */
+	void Reset();
+
+private:
+	struct ThreadArena;
+
+	ThreadArena& GetThreadArena();
+
+	size_t m_ChunkSize;
+
+	// Incremented by Reset, so each ThreadArena can tell when it's out of date
+	volatile intptr_t m_Generation;
+
+	pthread_key_t m_TLS;
+
+	// All the ThreadArenas that have been created, so we can free them
+	CMutex m_Mutex;
+	std::vector<ThreadArena*> m_Threads;
+};
+
+/**
+ * std::vector whose storage comes from a CFrameArena.
+ */
+template<typename T>
+class FrameVector : public std::vector<T, ProxyAllocator<T, CFrameArena> >
+{
+public:
+	explicit FrameVector(CFrameArena& arena) :
+		std::vector<T, ProxyAllocator<T, CFrameArena> >(ProxyAllocator<T, CFrameArena>(arena))
+	{
+	}
+};
+
+/**
+ * Reset by CRenderer::EndFrame.
+ */
+extern CFrameArena g_RenderFrameArena;
+
+/**
+ * Reset at the end of each simulation turn.
+ */
+extern CFrameArena g_SimTurnArena;
+
+#endif // INCLUDED_FRAMEARENA
@@ -35,6 +35,7 @@
 #include "ps/Loader.h"
 #include "ps/LoaderThunks.h"
 #include "ps/Overlay.h"
+#include "ps/PerformanceReport.h"
 #include "ps/Profile.h"
 #include "ps/Replay.h"
 #include "ps/World.h"
@@ -46,6 +47,8 @@
 #include "simulation2/Simulation2.h"
 #include "simulation2/components/ICmpPlayer.h"
 #include "simulation2/components/ICmpPlayerManager.h"
+#include "simulation2/components/ICmpTerrain.h"
+#include "simulation2/components/ICmpUnitMotion.h"
 #include "soundmanager/SoundManager.h"
 
 extern bool g_GameRestarted;
@@ -88,6 +91,8 @@ CGame::CGame(bool disableGraphics):
  **/
 CGame::~CGame()
 {
+	g_PerformanceReporter.EndSession();
+
 	// Again, the in-game call tree is going to be different to the main menu one.
 	if (CProfileManager::IsInitialised())
 		g_Profiler.StructuralReset();
@@ -161,6 +166,15 @@ void CGame::RegisterInit(const CScriptValRooted& attribs, const std::string& sav
 	if (m_IsSavedGame)
 		RegMemFun(this, &CGame::LoadInitialState, L"Loading game", 1000);
 
+	// Build the terrain's render data now that the map is loaded, rather than
+	// during the first frame
+	if (m_GameView)
+		RegMemFun(m_GameView, &CGameView::PrepareTerrain, L"Preparing terrain", 200);
+
+	// Now the entities exist, load any other templates they might create during
+	// the game (e.g. trainable units), so that won't cause hitches later
+	RegMemFun(m_Simulation2, &CSimulation2::ProgressiveLoad, L"Loading entity templates", 500);
+
 	LDR_EndRegistering();
 }
 
@@ -172,9 +186,7 @@ int CGame::LoadInitialState()
 	std::string state;
 	m_InitialSavedState.swap(state); // deletes the original to save a bit of memory
 
-	std::stringstream stream(state);
-
-	bool ok = m_Simulation2->DeserializeState(stream);
+	bool ok = m_Simulation2->DeserializeState(state);
 	if (!ok)
 	{
 		CancelLoad(L"Failed to load saved game state. It might have been\nsaved with an incompatible version of the game.");
@@ -206,6 +218,13 @@ PSRETURN CGame::ReallyStartGame()
 	Interpolate(0, 0);
 
 	m_GameStarted=true;
+
+	// Only report on games that are actually being played (not replays etc)
+	if (m_GameView)
+	{
+		CmpPtr<ICmpTerrain> cmpTerrain(*m_Simulation2, SYSTEM_ENTITY);
+		g_PerformanceReporter.StartSession(cmpTerrain ? cmpTerrain->GetTilesPerSide() : 0);
+	}
 	
 	// Render a frame to begin loading assets
 	if (CRenderer::IsInitialised())
@@ -270,6 +289,7 @@ bool CGame::Update(const double deltaRealTime, bool doInterpolate)
 	const double deltaSimTime = deltaRealTime * m_SimRate;
 	
 	bool ok = true;
+	bool turnProcessed = false;
 	if (deltaSimTime)
 	{
 		// To avoid confusing the profiler, we need to trigger the new turn
@@ -285,6 +305,10 @@ bool CGame::Update(const double deltaRealTime, bool doInterpolate)
 
 		if (m_TurnManager->Update(deltaSimTime, maxTurns))
 		{
+			turnProcessed = true;
+
+			g_PerformanceReporter.SetUnitCount(m_Simulation2->GetEntitiesWithInterfaceUnordered(IID_UnitMotion).size());
+
 			{
 				PROFILE3("gui sim update");
 				g_GUI->SendEventToAll("SimulationUpdate");
@@ -306,6 +330,16 @@ bool CGame::Update(const double deltaRealTime, bool doInterpolate)
 #endif
 	}
 
+	// Use the spare time in frames without a simulation turn to collect the
+	// simulation's script garbage, so it's less likely to happen in the middle
+	// of a turn. If we're waiting for the network we can afford a whole frame,
+	// else only use a fraction of one to keep the framerate smooth.
+	if (!turnProcessed)
+	{
+		double budget = deltaRealTime * (m_TurnManager->IsWaitingForTurn() ? 1.0 : 0.25);
+		m_Simulation2->GetScriptInterface().IdleGC(budget);
+	}
+
 	return ok;
 }
 
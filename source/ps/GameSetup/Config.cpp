@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -36,6 +36,10 @@ bool g_NoGLVBO = false;
 
 bool g_PauseOnFocusLoss = false;
 
+int g_FrameRateLimitMenus = 60;
+int g_FrameRateLimitBackground = 10;
+int g_FrameRateLimitPaused = 10;
+
 bool g_Shadows = false;
 bool g_ShadowPCF = false;
 
@@ -88,6 +92,9 @@ static void LoadGlobals()
 	CFG_GET_VAL("noautomipmap", Bool, g_NoGLAutoMipmap);
 	CFG_GET_VAL("novbo", Bool, g_NoGLVBO);
 	CFG_GET_VAL("pauseonfocusloss", Bool, g_PauseOnFocusLoss);
+	CFG_GET_VAL("fpslimit.menus", Int, g_FrameRateLimitMenus);
+	CFG_GET_VAL("fpslimit.background", Int, g_FrameRateLimitBackground);
+	CFG_GET_VAL("fpslimit.paused", Int, g_FrameRateLimitPaused);
 	CFG_GET_VAL("shadows", Bool, g_Shadows);
 	CFG_GET_VAL("shadowpcf", Bool, g_ShadowPCF);
 
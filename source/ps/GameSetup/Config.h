@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -44,6 +44,14 @@ extern bool g_NoGLVBO;
 // flag to pause the game on window focus loss
 extern bool g_PauseOnFocusLoss;
 
+// Maximum frame rates (0 for unlimited) of the main loop while no game is running,
+// and while the window is unfocused or minimized.
+extern int g_FrameRateLimitMenus;
+extern int g_FrameRateLimitBackground;
+// While the game is paused, frames without any input or camera movement are
+// only rendered at this rate (0 to always render them).
+extern int g_FrameRateLimitPaused;
+
 // flag to switch on shadows
 extern bool g_Shadows;
 
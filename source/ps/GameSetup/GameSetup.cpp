@@ -38,6 +38,7 @@
 #include "graphics/CinemaTrack.h"
 #include "graphics/GameView.h"
 #include "graphics/LightEnv.h"
+#include "graphics/MapGenerator.h"
 #include "graphics/MapReader.h"
 #include "graphics/MaterialManager.h"
 #include "graphics/TerrainTextureManager.h"
@@ -51,9 +52,11 @@
 #include "network/NetServer.h"
 #include "network/NetClient.h"
 
+#include "ps/CacheLoader.h"
 #include "ps/CConsole.h"
 #include "ps/CLogger.h"
 #include "ps/ConfigDB.h"
+#include "ps/FileCacheStats.h"
 #include "ps/Filesystem.h"
 #include "ps/Font.h"
 #include "ps/Game.h"
@@ -63,15 +66,19 @@
 #include "ps/GameSetup/Config.h"
 #include "ps/GameSetup/CmdLineArgs.h"
 #include "ps/GameSetup/HWDetect.h"
+#include "ps/XML/Xeromyces.h"
 #include "ps/Globals.h"
 #include "ps/Hotkey.h"
 #include "ps/Joystick.h"
 #include "ps/Loader.h"
+#include "ps/MemoryStatsTable.h"
 #include "ps/Overlay.h"
 #include "ps/Profile.h"
 #include "ps/ProfileViewer.h"
 #include "ps/Profiler2.h"
 #include "ps/Pyrogenesis.h"	// psSetLogDir
+#include "ps/SavedGame.h"
+#include "ps/ThreadPool.h"
 #include "ps/scripting/JSInterface_Console.h"
 #include "ps/TouchInput.h"
 #include "ps/UserReport.h"
@@ -87,6 +94,7 @@
 #include "scriptinterface/DebuggingServer.h"
 #include "scriptinterface/ScriptInterface.h"
 #include "scriptinterface/ScriptStats.h"
+#include "simulation2/scripting/ScriptComponentStats.h"
 #include "simulation2/Simulation2.h"
 #include "soundmanager/SoundManager.h"
 #include "tools/atlas/GameInterface/GameLoop.h"
@@ -114,6 +122,13 @@ bool g_DoRenderGui = true;
 bool g_DoRenderLogger = true;
 bool g_DoRenderCursor = true;
 
+// file access trace (for building archives in load order), if requested with -iotrace
+static PITrace g_IoTrace;
+static OsPath g_IoTracePath;
+
+static CFileCacheStatsTable* g_FileCacheStatsTable = NULL;
+static CMemoryStatsTable* g_MemoryStatsTable = NULL;
+
 static const int SANE_TEX_QUALITY_DEFAULT = 5;	// keep in sync with code
 
 static void SetTextureQuality(int quality)
@@ -440,8 +455,14 @@ static void InitVfs(const CmdLineArgs& args)
 	hooks.display_error = psDisplayError;
 	app_hooks_update(&hooks);
 
+	if (args.Has("iotrace"))
+	{
+		g_IoTrace = CreateTrace(16*MiB);
+		g_IoTracePath = OsPath(args.Get("iotrace"));
+	}
+
 	const size_t cacheSize = ChooseCacheSize();
-	g_VFS = CreateVfs(cacheSize);
+	g_VFS = CreateVfs(cacheSize, g_IoTrace);
 
 	std::vector<CStr> mods = args.GetMultiple("mod");
 	mods.insert(mods.begin(), "public");
@@ -641,6 +662,45 @@ static void InitSDL()
 #endif
 }
 
+// Startup work that doesn't have to be done by the main thread (so it mustn't
+// use GL or scripts) is run on the thread pool while the rest of Init and
+// InitGraphics continues. WaitForStartupTasks must be called before anything
+// that depends on it.
+static CThreadPool::TaskGroup g_StartupTasks;
+
+#if CONFIG2_AUDIO
+static void InitSoundTask(void* UNUSED(cbdata))
+{
+	PROFILE2("init sound");
+	// (Opening the OpenAL device can take a surprisingly long time)
+	CSoundManager::CreateSoundManager();
+}
+#endif
+
+static void WarmXMBCacheTask(void* UNUSED(cbdata))
+{
+	PROFILE2("warm XMB cache");
+	CXeromyces::WarmCache(g_VFS);
+}
+
+static void WaitForStartupTasks()
+{
+	if (!g_ThreadPool)
+		return;
+
+	PROFILE2("wait for startup tasks");
+	g_ThreadPool->Wait(g_StartupTasks);
+}
+
+// Lets lib/tex split up the decompression of large textures
+static void TexParallelFor(size_t count, size_t chunkSize, TexJobCB cb, void* cbData)
+{
+	if (g_ThreadPool)
+		g_ThreadPool->ParallelFor(count, chunkSize, cb, cbData);
+	else
+		cb(cbData, 0, count);
+}
+
 static void ShutdownSDL()
 {
 	SDL_Quit();
@@ -658,8 +718,18 @@ void EndGame()
 
 void Shutdown(int UNUSED(flags))
 {
+	// In case startup failed before they were needed
+	WaitForStartupTasks();
+
 	EndGame();
 
+	// Finish writing any saved games and screenshots before the GUI and VFS are shut down
+	SavedGames::Flush();
+	FlushScreenshots();
+
+	// Wait for any random maps that were being generated in advance
+	CMapGenerator::DiscardPregenerated(true);
+
 	ShutdownPs(); // Must delete g_GUI before g_ScriptingHost
 
 	in_reset_handlers();
@@ -696,6 +766,15 @@ void Shutdown(int UNUSED(flags))
 	delete g_DebuggingServer;
 	TIMER_END(L"shutdown ScriptingHost");
 
+	// Delete outdated conversion results, now that everything this session
+	// used has been looked up
+	TIMER_BEGIN(L"shutdown cache");
+	int maxCacheSize = 2048;
+	CFG_GET_VAL("cachesize", Int, maxCacheSize);
+	if (maxCacheSize > 0)
+		CCacheLoader::CollectGarbage(g_VFS, (u64)maxCacheSize*MiB);
+	TIMER_END(L"shutdown cache");
+
 	TIMER_BEGIN(L"shutdown ConfigDB");
 	delete &g_ConfigDB;
 	TIMER_END(L"shutdown ConfigDB");
@@ -710,6 +789,13 @@ void Shutdown(int UNUSED(flags))
 
 		g_VFS.reset();
 
+		// (appended, so the accesses of several sessions can be combined)
+		if (g_IoTrace)
+		{
+			g_IoTrace->Store(g_IoTracePath);
+			g_IoTrace.reset();
+		}
+
 		// this forcibly frees all open handles (thus preventing real leaks),
 		// and makes further access to h_mgr impossible.
 		h_mgr_shutdown();
@@ -723,7 +809,12 @@ void Shutdown(int UNUSED(flags))
 
 		CNetHost::Deinitialize();
 
+		SAFE_DELETE(g_ThreadPool);
+
 		SAFE_DELETE(g_ScriptStatsTable);
+		SAFE_DELETE(g_ScriptComponentStatsTable);
+		SAFE_DELETE(g_FileCacheStatsTable);
+		SAFE_DELETE(g_MemoryStatsTable);
 
 		// should be last, since the above use them
 		SAFE_DELETE(g_Logger);
@@ -877,19 +968,46 @@ void Init(const CmdLineArgs& args, int UNUSED(flags))
 
 	CNetHost::Initialize();
 
+	// One worker per additional CPU core, for jobs that can be split across threads
+	g_ThreadPool = new CThreadPool(std::max(os_cpu_NumProcessors(), (size_t)1) - 1);
+
 	new CProfileViewer;
 	new CProfileManager;	// before any script code
 
 	g_ScriptStatsTable = new CScriptStatsTable;
 	g_ProfileViewer.AddRootTable(g_ScriptStatsTable);
 
+	g_ScriptComponentStatsTable = new CScriptComponentStatsTable;
+	g_ProfileViewer.AddRootTable(g_ScriptComponentStatsTable);
+
+	g_FileCacheStatsTable = new CFileCacheStatsTable;
+	g_ProfileViewer.AddRootTable(g_FileCacheStatsTable);
+
+	g_MemoryStatsTable = new CMemoryStatsTable;
+	g_ProfileViewer.AddRootTable(g_MemoryStatsTable);
 
 #if CONFIG2_AUDIO
-	CSoundManager::CreateSoundManager();
+	g_ThreadPool->Submit(&InitSoundTask, NULL, &g_StartupTasks);
 #endif
 
 	// g_ConfigDB, command line args, globals
 	CONFIG_Init(args);
+
+	// The file cache was created before the config could be read, so its
+	// budget can only be lowered from the automatically chosen size
+	int fileCacheSize = 0;
+	CFG_GET_VAL("vfscachesize", Int, fileCacheSize);
+	if (fileCacheSize > 0)
+		g_VFS->SetCacheBudget((size_t)fileCacheSize*MiB);
+
+	// Convert all the outdated XML files now, in parallel, rather than one at
+	// a time as they're first loaded (which is slow after a mod update).
+	// Nothing loads XML files until the renderer is initialised, so this can
+	// overlap with the scripting and video mode setup
+	bool warmXMBCache = false;
+	CFG_GET_VAL("xmbcachewarm", Bool, warmXMBCache);
+	if (warmXMBCache)
+		g_ThreadPool->Submit(&WarmXMBCacheTask, NULL, &g_StartupTasks);
 	
 	// before scripting 
 	if (g_JSDebuggerEnabled)
@@ -906,6 +1024,12 @@ void Init(const CmdLineArgs& args, int UNUSED(flags))
 	if (profilerHTTPEnable)
 		g_Profiler2.EnableHTTP();
 
+	// Optionally start streaming the profiler data to a file, for long captures
+	bool profilerCaptureEnable = false;
+	CFG_GET_VAL("profiler2.capture.autoenable", Bool, profilerCaptureEnable);
+	if (profilerCaptureEnable)
+		g_Profiler2.EnableCapture(psLogDir()/"profile2.capture");
+
 	if (!g_Quickstart)
 		g_UserReporter.Initialize(); // after config
 
@@ -931,6 +1055,7 @@ void InitGraphics(const CmdLineArgs& args, int flags)
 	RunHardwareDetection();
 
 	tex_codec_register_all();
+	tex_set_parallel_for(&TexParallelFor);
 
 	const int quality = SANE_TEX_QUALITY_DEFAULT;	// TODO: set value from config file
 	SetTextureQuality(quality);
@@ -951,6 +1076,9 @@ void InitGraphics(const CmdLineArgs& args, int flags)
 		// file output and very rarely needed.
 	}
 
+	// Everything after this might need the sound manager or XML files
+	WaitForStartupTasks();
+
 	if(g_DisableAudio)
 	{
 		// speed up startup by disabling all sound
@@ -1055,11 +1183,47 @@ void RenderCursor(bool RenderingState)
 	g_DoRenderCursor = RenderingState;
 }
 
+/**
+ * Start a single-player game from the given saved game (without the
+ * loading screen, like the other autostart modes).
+ */
+static void AutostartSavedGame(const std::wstring& name)
+{
+	g_Game = new CGame();
+
+	ScriptInterface& scriptInterface = g_Game->GetSimulation2()->GetScriptInterface();
+
+	CScriptValRooted metadata;
+	std::string savedState;
+	if (SavedGames::Load(name, scriptInterface, metadata, savedState) < 0)
+	{
+		LOGERROR(L"Error loading saved game '%ls'", name.c_str());
+		throw PSERROR_Game_World_MapLoadFailed("Error loading saved game.\nCheck application log for details.");
+	}
+
+	CScriptValRooted initAttributes;
+	scriptInterface.GetProperty(metadata.get(), "initAttributes", initAttributes);
+
+	int playerID = 1;
+	scriptInterface.GetProperty(metadata.get(), "player", playerID);
+
+	g_Game->SetPlayerID(playerID);
+	g_Game->StartGame(initAttributes, savedState);
+
+	LDR_NonprogressiveLoad();
+
+	PSRETURN ret = g_Game->ReallyStartGame();
+	ENSURE(ret == PSRETURN_OK);
+
+	InitPs(true, L"page_session.xml", JSVAL_VOID);
+}
+
 bool Autostart(const CmdLineArgs& args)
 {
 	/*
 	 * Handle various command-line options, for quick testing of various features:
 	 * -autostart=name					-- map name for scenario, or rms name for random map
+	 * -autostart-savegame=name			-- load the saved game with this name (without the extension)
 	 * -autostart-ai=1:dummybot			-- adds the dummybot AI to player 1
 	 * -autostart-playername=name		-- multiplayer player name
 	 * -autostart-host					-- multiplayer host mode
@@ -1074,6 +1238,12 @@ bool Autostart(const CmdLineArgs& args)
 	 * -autostart=latium -autostart-random=-1							-- Start single player game on latium random map, random rng seed
 	 */
 
+	if (args.Has("autostart-savegame"))
+	{
+		AutostartSavedGame(args.Get("autostart-savegame").FromUTF8());
+		return true;
+	}
+
 	CStr autoStartName = args.Get("autostart");
 
 #if OS_ANDROID
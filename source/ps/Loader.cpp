@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,9 +24,12 @@
 #include <numeric>
 
 #include "lib/timer.h"
+#include "lib/sysdep/cpu.h"
 #include "CStr.h"
 #include "Loader.h"
 #include "LoaderThunks.h"
+#include "Profiler2.h"
+#include "ThreadPool.h"
 
 
 // set by LDR_EndRegistering; may be 0 during development when
@@ -72,17 +75,46 @@ struct LoadRequest
 
 	int estimated_duration_ms;
 
-	// LDR_Register gets these as parameters; pack everything together.
-	LoadRequest(LoadFunc func_, void* param_, const wchar_t* desc_, int ms_)
+	// true if this runs on the thread pool (i.e. it's an LDR_ANY_THREAD
+	// task and there are worker threads to run it).
+	bool background;
+
+	std::vector<LoadTaskId> dependencies;
+
+	// set once the task has finished (by a worker thread, for background
+	// tasks, after setting status and elapsed_time).
+	volatile intptr_t finished;
+
+	// background tasks only: whether it has been submitted to the thread
+	// pool, and its result and how long it took.
+	bool submitted;
+	int status;
+	double elapsed_time;
+
+	// LDR_RegisterTask gets these as parameters; pack everything together.
+	LoadRequest(LoadFunc func_, void* param_, const wchar_t* desc_, int ms_, bool background_)
 		: func(func_), param(param_), description(desc_),
-		  estimated_duration_ms(ms_)
+		  estimated_duration_ms(ms_), background(background_), finished(0),
+		  submitted(false), status(0), elapsed_time(0.0)
 	{
 	}
 };
 
+// every task registered for the current load, indexed by LoadTaskId.
+// (a deque, so background tasks can safely keep pointers into it.)
 typedef std::deque<LoadRequest> LoadRequests;
 static LoadRequests load_requests;
 
+// main thread tasks that haven't finished yet, in registration order.
+static std::deque<LoadTaskId> main_queue;
+
+// background tasks that haven't been submitted yet, or whose completion
+// hasn't been noticed by the main thread yet.
+static std::vector<LoadTaskId> background_queue;
+
+// all the submitted background tasks.
+static CThreadPool::TaskGroup background_tasks;
+
 // std::accumulate binary op; used by LDR_EndRegistering to sum up all
 // estimated durations (for % progress calculation)
 struct DurationAdder: public std::binary_function<double, const LoadRequest&, double>
@@ -94,6 +126,76 @@ struct DurationAdder: public std::binary_function<double, const LoadRequest&, do
 };
 
 
+static void WaitForBackgroundTasks()
+{
+	if(g_ThreadPool)
+		g_ThreadPool->Wait(background_tasks);
+}
+
+static bool DependenciesFinished(const LoadRequest& lr)
+{
+	for(size_t i = 0; i < lr.dependencies.size(); ++i)
+	{
+		if(!load_requests[lr.dependencies[i]].finished)
+			return false;
+	}
+	return true;
+}
+
+static void RunBackgroundTask(void* cbdata)
+{
+	PROFILE2("background load task");
+
+	LoadRequest* lr = (LoadRequest*)cbdata;
+	const double t0 = timer_Time();
+	lr->status = lr->func(lr->param, 100.0);
+	lr->elapsed_time = timer_Time() - t0;
+	// background tasks can't be resumed later
+	ENSURE(!ldr_was_interrupted(lr->status));
+
+	cpu_AtomicAdd(&lr->finished, 1);
+}
+
+// start the background tasks whose dependencies have just finished.
+static void SubmitReadyTasks()
+{
+	for(size_t i = 0; i < background_queue.size(); ++i)
+	{
+		LoadRequest& lr = load_requests[background_queue[i]];
+		if(!lr.submitted && DependenciesFinished(lr))
+		{
+			lr.submitted = true;
+			g_ThreadPool->Submit(&RunBackgroundTask, &lr, &background_tasks);
+		}
+	}
+}
+
+// handle background tasks that have finished since the last call:
+// bill their estimated duration and dequeue them.
+// returns the first failure, if any.
+static Status CollectFinishedTasks()
+{
+	Status ret = INFO::OK;
+	for(size_t i = 0; i < background_queue.size(); )
+	{
+		LoadRequest& lr = load_requests[background_queue[i]];
+		if(!lr.finished)
+		{
+			++i;
+			continue;
+		}
+
+		debug_printf(L"LOADER| completed %ls in background in %g ms; estimate was %g ms\n", lr.description.c_str(), lr.elapsed_time*1e3, lr.estimated_duration_ms*1.0);
+		estimated_duration_tally += lr.estimated_duration_ms*1e-3;
+		if(lr.status < 0 && ret == INFO::OK)
+			ret = (Status)lr.status;
+
+		background_queue.erase(background_queue.begin() + i);
+	}
+	return ret;
+}
+
+
 // call before starting to register load requests.
 // this routine is provided so we can prevent 2 simultaneous load operations,
 // which is bogus. that can happen by clicking the load button quickly,
@@ -102,8 +204,13 @@ void LDR_BeginRegistering()
 {
 	ENSURE(state == IDLE);
 
+	// (a cancelled load might not have collected all its tasks)
+	WaitForBackgroundTasks();
+
 	state = REGISTERING;
 	load_requests.clear();
+	main_queue.clear();
+	background_queue.clear();
 }
 
 
@@ -117,11 +224,38 @@ void LDR_BeginRegistering()
 //   (reduces timeslice overruns, making the main loop more responsive).
 void LDR_Register(LoadFunc func, void* param, const wchar_t* description,
 	int estimated_duration_ms)
+{
+	LDR_RegisterTask(func, param, description, estimated_duration_ms, LDR_MAIN_THREAD);
+}
+
+
+LoadTaskId LDR_RegisterTask(LoadFunc func, void* param, const wchar_t* description,
+	int estimated_duration_ms, LoadTaskThread thread,
+	const LoadTaskId* dependencies, size_t num_dependencies)
 {
 	ENSURE(state == REGISTERING);	// must be called between LDR_(Begin|End)Register
 
-	const LoadRequest lr(func, param, description, estimated_duration_ms);
-	load_requests.push_back(lr);
+	const LoadTaskId id = load_requests.size();
+
+	// without any worker threads, it'd be pointless to use the thread pool,
+	// so just run everything in registration order
+	// (which also satisfies all the dependencies)
+	const bool background = (thread == LDR_ANY_THREAD && g_ThreadPool && g_ThreadPool->GetNumWorkers() > 0);
+
+	load_requests.push_back(LoadRequest(func, param, description, estimated_duration_ms, background));
+	LoadRequest& lr = load_requests.back();
+	for(size_t i = 0; i < num_dependencies; ++i)
+	{
+		ENSURE(dependencies[i] < id);
+		lr.dependencies.push_back(dependencies[i]);
+	}
+
+	if(background)
+		background_queue.push_back(id);
+	else
+		main_queue.push_back(id);
+
+	return id;
 }
 
 
@@ -136,6 +270,10 @@ void LDR_EndRegistering()
 	estimated_duration_tally = 0.0;
 	task_elapsed_time = 0.0;
 	total_estimated_duration = std::accumulate(load_requests.begin(), load_requests.end(), 0.0, DurationAdder());
+
+	// start the background tasks straight away, rather than waiting for the
+	// first LDR_ProgressiveLoad
+	SubmitReadyTasks();
 }
 
 
@@ -148,6 +286,21 @@ void LDR_Cancel()
 	// next LDR_StartRegistering. for now, it is sufficient to set the
 	// state, so that LDR_ProgressiveLoad is a no-op.
 	state = IDLE;
+
+	// background tasks might be using data that the caller will delete now
+	WaitForBackgroundTasks();
+}
+
+// helper routine for LDR_ProgressiveLoad.
+// returns the fraction of the total estimated duration that has been
+// completed, including <partial_duration> [s] of work on the current task.
+// note: monotonicity is guaranteed since we never add more than a task's
+//   estimated_duration_ms.
+static double CurrentProgress(double partial_duration)
+{
+	if(total_estimated_duration == 0.0)
+		return 0.0;
+	return std::min(1.0, (estimated_duration_tally + partial_duration) / total_estimated_duration);
 }
 
 // helper routine for LDR_ProgressiveLoad.
@@ -212,12 +365,21 @@ Status LDR_ProgressiveLoad(double time_budget, wchar_t* description, size_t max_
 	if(state != LOADING)
 		return INFO::OK;
 
-	while(!load_requests.empty())
+	// (in case we have to return before any task is run)
+	progress = CurrentProgress(0.0);
+
+	while(!main_queue.empty())
 	{
-		// get next task; abort if there's not enough time left for it.
-		const LoadRequest& lr = load_requests.front();
+		ret = CollectFinishedTasks();
+		if(ret < 0)
+			goto done;
+		SubmitReadyTasks();
+
+		// get next task; abort if there's not enough time left for it,
+		// or if it's still waiting for background tasks.
+		LoadRequest& lr = load_requests[main_queue.front()];
 		const double estimated_duration = lr.estimated_duration_ms*1e-3;
-		if(!HaveTimeForNextTask(time_left, time_budget, lr.estimated_duration_ms))
+		if(!HaveTimeForNextTask(time_left, time_budget, lr.estimated_duration_ms) || !DependenciesFinished(lr))
 		{
 			ret = ERR::TIMED_OUT;
 			goto done;
@@ -237,22 +399,12 @@ Status LDR_ProgressiveLoad(double time_budget, wchar_t* description, size_t max_
 			debug_printf(L"LOADER| completed %ls in %g ms; estimate was %g ms\n", lr.description.c_str(), task_elapsed_time*1e3, estimated_duration*1e3);
 			task_elapsed_time = 0.0;
 			estimated_duration_tally += estimated_duration;
-			load_requests.pop_front();
+			lr.finished = 1;
+			main_queue.pop_front();
 		}
 
 		// calculate progress (only possible if estimates have been given)
-		if(total_estimated_duration != 0.0)
-		{
-			double current_estimate = estimated_duration_tally;
-
-			// function interrupted itself; add its estimated progress.
-			// note: monotonicity is guaranteed since we never add more than
-			//   its estimated_duration_ms.
-			if(timed_out)
-				current_estimate += estimated_duration * status/100.0;
-
-			progress = current_estimate / total_estimated_duration;
-		}
+		progress = CurrentProgress(timed_out ? estimated_duration * status/100.0 : 0.0);
 
 		// do we need to continue?
 		// .. function interrupted itself, i.e. timed out; abort.
@@ -280,6 +432,19 @@ Status LDR_ProgressiveLoad(double time_budget, wchar_t* description, size_t max_
 		// .. succeeded; continue and process next queued task.
 	}
 
+	// the main thread's work is done; wait for the remaining background
+	// tasks without blocking the main loop.
+	ret = CollectFinishedTasks();
+	progress = CurrentProgress(0.0);
+	if(ret < 0)
+		goto done;
+	if(!background_queue.empty())
+	{
+		SubmitReadyTasks();
+		ret = ERR::TIMED_OUT;
+		goto done;
+	}
+
 	// queue is empty, we just finished.
 	state = IDLE;
 	ret = INFO::ALL_COMPLETE;
@@ -293,8 +458,10 @@ done:
 	// we want the next task, instead of what just completed:
 	// it will be displayed during the next load phase.
 	const wchar_t* new_description = L"";	// assume finished
-	if(!load_requests.empty())
-		new_description = load_requests.front().description.c_str();
+	if(!main_queue.empty())
+		new_description = load_requests[main_queue.front()].description.c_str();
+	else if(!background_queue.empty())
+		new_description = load_requests[background_queue.front()].description.c_str();
 	wcscpy_s(description, max_chars, new_description);
 
 	debug_printf(L"LOADER| returning; desc=%ls progress=%d\n", description, *progress_percent);
@@ -324,6 +491,9 @@ Status LDR_NonprogressiveLoad()
 		case INFO::ALL_COMPLETE:
 			return INFO::OK;
 		case ERR::TIMED_OUT:
+			// there's no point in spinning while the main thread is waiting
+			// for background tasks
+			WaitForBackgroundTasks();
 			break;			// continue loading
 		default:
 			WARN_RETURN_STATUS_IF_ERR(ret);	// failed; complain
@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -91,10 +91,25 @@ Then in the main loop, call LDR_ProgressiveLoad().
 * RegMemFun from LoaderThunks.h may be used instead; it takes care of
 registering member functions, which would otherwise be messy.
 
+
+Background Tasks
+----------------
+
+Some tasks don't touch OpenGL, scripts or the simulation (e.g. decoding
+data that has been read from a file), so they can safely run on the thread
+pool while the main thread works through the other tasks. These are
+registered with LDR_RegisterTask and LDR_ANY_THREAD, and any task that
+needs their results lists them as dependencies. A background task is
+started as soon as its dependencies have finished; if the main thread
+reaches a task whose dependencies are still running, LDR_ProgressiveLoad
+returns (so the progress display stays responsive) and tries again next
+time. Progress includes the background tasks' estimated durations.
+
 */
 
 
-// NOTE: this module is not thread-safe!
+// NOTE: this module is not thread-safe! Only call it from the main thread
+// (in particular, LDR_ANY_THREAD tasks mustn't call it).
 
 
 // call before starting to register tasks.
@@ -130,6 +145,34 @@ extern void LDR_Register(LoadFunc func, void* param, const wchar_t* description,
 	int estimated_duration_ms);
 
 
+// which thread a task registered with LDR_RegisterTask runs on.
+enum LoadTaskThread
+{
+	// the main thread, in registration order along with all the tasks
+	// registered by LDR_Register. required for anything using OpenGL,
+	// scripts or the simulation.
+	LDR_MAIN_THREAD,
+
+	// any thread (the thread pool, if there is one), in parallel with other
+	// tasks. the task isn't interruptible: its func receives an unlimited
+	// time_left and must either finish or fail. it must be thread-safe.
+	LDR_ANY_THREAD
+};
+
+// identifies a registered task, for use as a dependency of later tasks.
+typedef size_t LoadTaskId;
+
+// register a task that won't start until all of <dependencies> (an array
+// of <num_dependencies> tasks registered earlier in the same load) have
+// finished. the other parameters are as for LDR_Register.
+// main thread tasks always run in registration order, so they only need to
+// list their LDR_ANY_THREAD dependencies.
+// returns the new task's id.
+extern LoadTaskId LDR_RegisterTask(LoadFunc func, void* param, const wchar_t* description,
+	int estimated_duration_ms, LoadTaskThread thread,
+	const LoadTaskId* dependencies = NULL, size_t num_dependencies = 0);
+
+
 // call when finished registering tasks; subsequent calls to
 // LDR_ProgressiveLoad will then work off the queued entries.
 extern void LDR_EndRegistering();
@@ -138,6 +181,7 @@ extern void LDR_EndRegistering();
 // immediately cancel this load; no further tasks will be processed.
 // used to abort loading upon user request or failure.
 // note: no special notification will be returned by LDR_ProgressiveLoad.
+// background tasks that have already started are waited for.
 extern void LDR_Cancel();
 
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -64,11 +64,12 @@ template<class T> static int MemFunThunk(void* param, double UNUSED(time_left))
 	return ret;
 }
 
-template<class T> void RegMemFun(T* this_, int(T::*func)(void),
-	const wchar_t* description, int estimated_duration_ms)
+template<class T> LoadTaskId RegMemFun(T* this_, int(T::*func)(void),
+	const wchar_t* description, int estimated_duration_ms,
+	LoadTaskThread thread = LDR_MAIN_THREAD, const LoadTaskId* dependencies = NULL, size_t num_dependencies = 0)
 {
 	void* param = new MemFun_t<T>(this_, func);
-	LDR_Register(MemFunThunk<T>, param, description, estimated_duration_ms);
+	return LDR_RegisterTask(MemFunThunk<T>, param, description, estimated_duration_ms, thread, dependencies, num_dependencies);
 }
 
 
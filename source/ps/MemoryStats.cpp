@@ -0,0 +1,96 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "MemoryStats.h"
+
+#include "lib/sysdep/cpu.h"
+#include "ps/Filesystem.h"
+#include "ps/Profiler2.h"
+#include "scriptinterface/ScriptStats.h"
+
+static volatile intptr_t g_Counters[MEMORY_NUM_CATEGORIES];
+static size_t g_Peaks[MEMORY_NUM_CATEGORIES];
+
+// (The counter names are stored by Profiler2, so they must be static strings)
+static const struct
+{
+	const char* name;
+	const char* counterName;
+} g_CategoryNames[] = {
+	{ "textures (CPU)", "memory: textures (CPU)" },
+	{ "textures (GPU)", "memory: textures (GPU)" },
+	{ "vertex buffers", "memory: vertex buffers" },
+	{ "meshes", "memory: meshes" },
+	{ "animations", "memory: animations" },
+	{ "VFS cache", "memory: VFS cache" },
+	{ "scripts", "memory: scripts" },
+	{ "components", "memory: components" },
+	{ "pathfinder", "memory: pathfinder" }
+};
+cassert(ARRAY_SIZE(g_CategoryNames) == MEMORY_NUM_CATEGORIES);
+
+const char* MemoryStats::GetCategoryName(MemoryCategory category)
+{
+	ENSURE(category < MEMORY_NUM_CATEGORIES);
+	return g_CategoryNames[category].name;
+}
+
+void MemoryStats::Add(MemoryCategory category, ssize_t bytes)
+{
+	ENSURE(category < MEMORY_NUM_CATEGORIES);
+	if (bytes)
+		cpu_AtomicAdd(&g_Counters[category], (intptr_t)bytes);
+}
+
+size_t MemoryStats::Get(MemoryCategory category)
+{
+	ENSURE(category < MEMORY_NUM_CATEGORIES);
+
+	size_t bytes;
+	switch (category)
+	{
+	case MEMORY_VFS_CACHE:
+		bytes = g_VFS ? g_VFS->GetCacheStats().size : 0;
+		break;
+	case MEMORY_SCRIPTS:
+		bytes = g_ScriptStatsTable ? g_ScriptStatsTable->GetAllocatedBytes() : 0;
+		break;
+	default:
+		bytes = (size_t)g_Counters[category];
+		break;
+	}
+
+	g_Peaks[category] = std::max(g_Peaks[category], bytes);
+	return bytes;
+}
+
+size_t MemoryStats::GetPeak(MemoryCategory category)
+{
+	ENSURE(category < MEMORY_NUM_CATEGORIES);
+	return g_Peaks[category];
+}
+
+void MemoryStats::RecordProfilerCounters()
+{
+	for (size_t i = 0; i < MEMORY_NUM_CATEGORIES; ++i)
+	{
+		MemoryCategory category = (MemoryCategory)i;
+		PROFILE2_COUNTER(g_CategoryNames[category].counterName, Get(category));
+	}
+}
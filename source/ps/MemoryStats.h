@@ -0,0 +1,73 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_MEMORYSTATS
+#define INCLUDED_MEMORYSTATS
+
+/**
+ * Subsystems whose memory usage is accounted for by MemoryStats.
+ */
+enum MemoryCategory
+{
+	MEMORY_TEXTURES_CPU,	// decoded texture data waiting to be uploaded
+	MEMORY_TEXTURES_GPU,	// estimated video memory used by loaded textures
+	MEMORY_VERTEX_BUFFERS,	// vertex and index buffers
+	MEMORY_MESHES,	// CModelDef data
+	MEMORY_ANIMATIONS,	// CSkeletonAnimDef keys and pose caches
+	MEMORY_VFS_CACHE,	// g_VFS's file cache
+	MEMORY_SCRIPTS,	// heaps of all the script runtimes
+	MEMORY_COMPONENTS,	// native simulation components
+	MEMORY_PATHFINDER,	// pathfinder passability grids
+	MEMORY_NUM_CATEGORIES
+};
+
+/**
+ * Accounting of the memory used by each subsystem, to track down leaks and
+ * bloat (shown in the "memory" profiler table, and recorded as Profiler2 counters).
+ *
+ * Most categories are counters that their subsystem adjusts with Add whenever
+ * it allocates or frees the data; the VFS cache and scripts are read
+ * from the statistics that those subsystems already keep.
+ */
+namespace MemoryStats
+{
+	const char* GetCategoryName(MemoryCategory category);
+
+	/**
+	 * Add @p bytes (which may be negative) to the category's counter.
+	 * Can be called from any thread.
+	 */
+	void Add(MemoryCategory category, ssize_t bytes);
+
+	/**
+	 * Returns the number of bytes currently used by the category.
+	 * Must only be called from the main thread.
+	 */
+	size_t Get(MemoryCategory category);
+
+	/**
+	 * Returns the highest value that Get has returned for the category.
+	 */
+	size_t GetPeak(MemoryCategory category);
+
+	/**
+	 * Record every category as a Profiler2 counter. Call once per frame from the main thread.
+	 */
+	void RecordProfilerCounters();
+}
+
+#endif // INCLUDED_MEMORYSTATS
@@ -0,0 +1,101 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "MemoryStatsTable.h"
+
+#include "ps/MemoryStats.h"
+#include "scriptinterface/ScriptStats.h"
+
+enum
+{
+	Col_Name,
+	Col_Size,
+	Col_Peak,
+	NumberColumns
+};
+
+CMemoryStatsTable::CMemoryStatsTable()
+{
+	m_ColumnDescriptions.push_back(ProfileColumn("Name", 200));
+	m_ColumnDescriptions.push_back(ProfileColumn("current (KiB)", 100));
+	m_ColumnDescriptions.push_back(ProfileColumn("peak (KiB)", 100));
+}
+
+CStr CMemoryStatsTable::GetName()
+{
+	return "memory";
+}
+
+CStr CMemoryStatsTable::GetTitle()
+{
+	return "Memory usage";
+}
+
+size_t CMemoryStatsTable::GetNumberRows()
+{
+	// one per category, then the totals
+	return MEMORY_NUM_CATEGORIES + 1;
+}
+
+const std::vector<ProfileColumn>& CMemoryStatsTable::GetColumns()
+{
+	return m_ColumnDescriptions;
+}
+
+CStr CMemoryStatsTable::GetCellText(size_t row, size_t col)
+{
+	size_t size = 0;
+	size_t peak = 0;
+	if (row < MEMORY_NUM_CATEGORIES)
+	{
+		MemoryCategory category = (MemoryCategory)row;
+		if (col == Col_Name)
+			return MemoryStats::GetCategoryName(category);
+		size = MemoryStats::Get(category);
+		peak = MemoryStats::GetPeak(category);
+	}
+	else
+	{
+		if (col == Col_Name)
+			return "total";
+		// (The categories didn't necessarily peak at the same time, so there's no total peak)
+		for (size_t i = 0; i < MEMORY_NUM_CATEGORIES; ++i)
+			size += MemoryStats::Get((MemoryCategory)i);
+		if (col == Col_Peak)
+			return "";
+	}
+
+	switch (col)
+	{
+	case Col_Size:
+		return CStr::FromUInt((unsigned int)(size / KiB));
+	case Col_Peak:
+		return CStr::FromUInt((unsigned int)(peak / KiB));
+	default:
+		return "???";
+	}
+}
+
+AbstractProfileTable* CMemoryStatsTable::GetChild(size_t row)
+{
+	// The script statistics have the breakdown per script runtime
+	if (row == MEMORY_SCRIPTS)
+		return g_ScriptStatsTable;
+	return 0;
+}
@@ -0,0 +1,136 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "PerformanceReport.h"
+
+#include "lib/timer.h"
+#include "ps/UserReport.h"
+
+#include <sstream>
+
+CPerformanceReporter g_PerformanceReporter;
+
+// Upper bounds (in milliseconds) of the time histogram buckets; the last bucket is unbounded
+static const double TIME_BUCKETS[] = { 8, 17, 25, 33, 50, 67, 100, 150, 200, 300, 500, 1000 };
+
+// Lower bounds of the unit count groups
+static const size_t UNIT_BUCKETS[] = { 0, 100, 200, 400, 600, 800, 1000, 1500, 2000, 3000 };
+
+// Increment this when the report format changes
+static const int PERFORMANCE_REPORT_VERSION = 1;
+
+CPerformanceReporter::CPerformanceReporter() :
+	m_Active(false), m_MapSize(0), m_StartTime(0.0), m_LastFrameTime(0.0), m_UnitBucket(0), m_PeakUnits(0)
+{
+}
+
+void CPerformanceReporter::StartSession(int mapSize)
+{
+	m_Active = g_UserReporter.IsReportingEnabled();
+	if (!m_Active)
+		return;
+
+	m_MapSize = mapSize;
+	m_StartTime = timer_Time();
+	m_LastFrameTime = 0.0;
+	m_UnitBucket = 0;
+	m_PeakUnits = 0;
+
+	m_FrameCounts.assign(ARRAY_SIZE(UNIT_BUCKETS), std::vector<u32>(ARRAY_SIZE(TIME_BUCKETS) + 1, 0));
+	m_TurnCounts.assign(ARRAY_SIZE(UNIT_BUCKETS), std::vector<u32>(ARRAY_SIZE(TIME_BUCKETS) + 1, 0));
+}
+
+void CPerformanceReporter::EndSession()
+{
+	if (!m_Active)
+		return;
+
+	m_Active = false;
+
+	std::stringstream data;
+	data << "{\"map_size\": " << m_MapSize;
+	data << ", \"duration\": " << (u32)(timer_Time() - m_StartTime);
+	data << ", \"peak_units\": " << m_PeakUnits;
+
+	data << ", \"time_buckets\": [";
+	for (size_t i = 0; i < ARRAY_SIZE(TIME_BUCKETS); ++i)
+		data << (i ? ", " : "") << TIME_BUCKETS[i];
+	data << "], \"unit_buckets\": [";
+	for (size_t i = 0; i < ARRAY_SIZE(UNIT_BUCKETS); ++i)
+		data << (i ? ", " : "") << UNIT_BUCKETS[i];
+	data << "]";
+
+	const char* names[] = { "frames", "turns" };
+	const std::vector<std::vector<u32> >* counts[] = { &m_FrameCounts, &m_TurnCounts };
+	for (size_t h = 0; h < ARRAY_SIZE(names); ++h)
+	{
+		data << ", \"" << names[h] << "\": [";
+		for (size_t i = 0; i < counts[h]->size(); ++i)
+		{
+			data << (i ? ", " : "") << "[";
+			for (size_t j = 0; j < (*counts[h])[i].size(); ++j)
+				data << (j ? ", " : "") << (*counts[h])[i][j];
+			data << "]";
+		}
+		data << "]";
+	}
+	data << "}";
+
+	g_UserReporter.SubmitReport("performance", PERFORMANCE_REPORT_VERSION, data.str());
+}
+
+void CPerformanceReporter::RecordFrame()
+{
+	if (!m_Active)
+		return;
+
+	double now = timer_Time();
+	if (m_LastFrameTime)
+		++m_FrameCounts[m_UnitBucket][GetTimeBucket(now - m_LastFrameTime)];
+	m_LastFrameTime = now;
+}
+
+void CPerformanceReporter::RecordTurn(double time)
+{
+	if (!m_Active)
+		return;
+
+	++m_TurnCounts[m_UnitBucket][GetTimeBucket(time)];
+}
+
+void CPerformanceReporter::SetUnitCount(size_t units)
+{
+	if (!m_Active)
+		return;
+
+	m_PeakUnits = std::max(m_PeakUnits, units);
+
+	m_UnitBucket = 0;
+	while (m_UnitBucket + 1 < ARRAY_SIZE(UNIT_BUCKETS) && units >= UNIT_BUCKETS[m_UnitBucket + 1])
+		++m_UnitBucket;
+}
+
+size_t CPerformanceReporter::GetTimeBucket(double time) const
+{
+	double ms = time * 1000.0;
+	size_t i = 0;
+	while (i < ARRAY_SIZE(TIME_BUCKETS) && ms > TIME_BUCKETS[i])
+		++i;
+	return i;
+}
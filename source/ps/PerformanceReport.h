@@ -0,0 +1,80 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_PERFORMANCEREPORT
+#define INCLUDED_PERFORMANCEREPORT
+
+#include <vector>
+
+/**
+ * Collects histograms of the frame times and simulation turn times seen during
+ * each game, grouped by the number of units in the world, and submits them
+ * through the UserReport system at the end of the game. This shows how the
+ * game's performance degrades on real players' computers as games get bigger.
+ *
+ * Nothing is collected unless the player has enabled user reporting.
+ */
+class CPerformanceReporter
+{
+public:
+	CPerformanceReporter();
+
+	/**
+	 * Start collecting data for a new game.
+	 * @param mapSize number of tiles per side of the map
+	 */
+	void StartSession(int mapSize);
+
+	/**
+	 * Submit the collected data (if there was an active session) and stop collecting.
+	 */
+	void EndSession();
+
+	/**
+	 * Must be called once per rendered frame; the frame time is measured from the previous call.
+	 */
+	void RecordFrame();
+
+	/**
+	 * Records that a simulation turn took @p time seconds to compute.
+	 */
+	void RecordTurn(double time);
+
+	/**
+	 * Sets the number of units currently in the world, which the following
+	 * frames and turns will be grouped by.
+	 */
+	void SetUnitCount(size_t units);
+
+private:
+	size_t GetTimeBucket(double time) const;
+
+	bool m_Active;
+	int m_MapSize;
+	double m_StartTime;
+	double m_LastFrameTime;
+	size_t m_UnitBucket;
+	size_t m_PeakUnits;
+
+	// Counts indexed by [unit bucket][time bucket]
+	std::vector<std::vector<u32> > m_FrameCounts;
+	std::vector<std::vector<u32> > m_TurnCounts;
+};
+
+extern CPerformanceReporter g_PerformanceReporter;
+
+#endif // INCLUDED_PERFORMANCEREPORT
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -662,12 +662,18 @@ void CProfileManager::Reset()
 	root->Reset();
 }
 
-void CProfileManager::Frame()
+long CProfileManager::GetMemoryAllocationCount()
 {
 	ONCE(alloc_hook_initialize());
 
+	return get_memory_alloc_count();
+}
+
+void CProfileManager::Frame()
+{
+	// (This initialises the allocation counting on the first call)
 	root->time_frame_current += (timer_Time() - root->start);
-	root->mallocs_frame_current += (get_memory_alloc_count() - root->start_mallocs);
+	root->mallocs_frame_current += (GetMemoryAllocationCount() - root->start_mallocs);
 
 	root->Frame();
 
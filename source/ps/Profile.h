@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -138,6 +138,10 @@ public:
 	// Resets absolutely everything, at the end of this frame
 	void StructuralReset();
 
+	// Returns the total number of heap allocations so far, where the platform
+	// supports counting them (otherwise always 0)
+	static long GetMemoryAllocationCount();
+
 	inline const CProfileNode* GetCurrent() { return( current ); }
 	inline const CProfileNode* GetRoot() { return( root ); }
 };
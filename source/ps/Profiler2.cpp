@@ -1,4 +1,4 @@
-/* Copyright (c) 2011 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -25,11 +25,14 @@
 #include "Profiler2.h"
 
 #include "lib/allocators/shared_ptr.h"
+#include "lib/external_libraries/libsdl.h"
+#include "lib/external_libraries/zlib.h"
 #include "ps/CLogger.h"
 #include "ps/CStr.h"
 #include "ps/Profiler2GPU.h"
 #include "third_party/mongoose/mongoose.h"
 
+#include <fstream>
 #include <iomanip>
 
 CProfiler2 g_Profiler2;
@@ -37,8 +40,100 @@ CProfiler2 g_Profiler2;
 // A human-recognisable pattern (for debugging) followed by random bytes (for uniqueness)
 const u8 CProfiler2::RESYNC_MAGIC[8] = {0x11, 0x22, 0x33, 0x44, 0xf4, 0x93, 0xbe, 0x15};
 
+// Capture file format: CAPTURE_MAGIC, then a sequence of records, each starting with
+// a u8 ECaptureRecord type. All numbers are in native byte order.
+static const char CAPTURE_MAGIC[8] = { 'P', 'S', '2', 'C', 'A', 'P', 'T', '1' };
+
+enum ECaptureRecord
+{
+	CAPTURE_THREAD = 1, // u32 thread, u32 length, name: first appearance of a thread
+	CAPTURE_STRING = 2, // u32 id, u32 length, string: first use of a region/event name
+	CAPTURE_EVENT = 3, // u32 thread, double time, u32 string id
+	CAPTURE_ENTER = 4, // u32 thread, double time, u32 string id
+	CAPTURE_LEAVE = 5, // u32 thread, double time, u32 string id
+	CAPTURE_ATTRIBUTE = 6, // u32 thread, u32 length, string: attribute of the thread's previous item
+	CAPTURE_GAP = 7, // u32 thread: some of the thread's items were lost
+	CAPTURE_COUNTER = 8, // u32 thread, double time, u32 string id, double value
+};
+
+// Time between copying the threads' buffers (small enough that busy threads won't fill them)
+static const u32 CAPTURE_INTERVAL_MSECS = 10;
+
+// Time between flushing the compressed output, so that not much is lost if the game crashes
+static const double CAPTURE_FLUSH_INTERVAL = 1.0;
+
+struct CProfiler2::SCapture
+{
+	struct SThread
+	{
+		u32 index;
+		u32 pos; // position in the thread's item stream
+		double lastTime; // as in RunBufferItems
+	};
+
+	gzFile file;
+	pthread_t thread;
+
+	CMutex mutex;
+	bool shutdown; // protected by mutex
+
+	// The remaining members are only used by the capture thread, and by
+	// RemoveThreadStorage; they're protected by the profiler's m_Mutex
+	std::map<ThreadStorage*, SThread> threads;
+	u32 nextThreadIndex;
+	std::map<const char*, u32> strings;
+
+	void WriteU8(u8 value)
+	{
+		gzwrite(file, &value, sizeof(value));
+	}
+
+	void WriteU32(u32 value)
+	{
+		gzwrite(file, &value, sizeof(value));
+	}
+
+	void WriteDouble(double value)
+	{
+		gzwrite(file, &value, sizeof(value));
+	}
+
+	void WriteString(const std::string& str)
+	{
+		WriteU32((u32)str.length());
+		if (!str.empty())
+			gzwrite(file, str.data(), (unsigned)str.length());
+	}
+
+	/**
+	 * Start capturing the thread's items, from its latest item onwards.
+	 */
+	SThread& AddThread(ThreadStorage* storage)
+	{
+		SThread thread = { nextThreadIndex++, storage->GetStreamPosition(), -1.0 };
+		WriteU8(CAPTURE_THREAD);
+		WriteU32(thread.index);
+		WriteString(storage->GetName());
+		return threads.insert(std::make_pair(storage, thread)).first->second;
+	}
+
+	u32 GetStringID(const char* str)
+	{
+		std::map<const char*, u32>::iterator it = strings.find(str);
+		if (it != strings.end())
+			return it->second;
+
+		u32 id = (u32)strings.size();
+		strings[str] = id;
+		WriteU8(CAPTURE_STRING);
+		WriteU32(id);
+		WriteString(str);
+		return id;
+	}
+};
+
 CProfiler2::CProfiler2() :
-	m_Initialised(false), m_FrameNumber(0), m_MgContext(NULL), m_GPU(NULL)
+	m_Initialised(false), m_FrameNumber(0), m_MgContext(NULL), m_GPU(NULL), m_Capture(NULL)
 {
 }
 
@@ -183,12 +278,32 @@ void CProfiler2::ShutdownGPU()
 	SAFE_DELETE(m_GPU);
 }
 
+void CProfiler2::GetGPURegionAverages(std::vector<std::pair<std::string, double> >& averages) const
+{
+	averages.clear();
+	if (m_GPU)
+		m_GPU->GetRegionAverages(averages);
+}
+
+void CProfiler2::ResetGPURegionAverages()
+{
+	if (m_GPU)
+		m_GPU->ResetRegionAverages();
+}
+
+bool CProfiler2::GetGPUFrameTime(double& time) const
+{
+	return m_GPU && m_GPU->GetFrameTime(time);
+}
+
 void CProfiler2::Shutdown()
 {
 	ENSURE(m_Initialised);
 
 	ENSURE(!m_GPU); // must shutdown GPU before profiler
 
+	DisableCapture();
+
 	if (m_MgContext)
 	{
 		mg_stop(m_MgContext);
@@ -264,10 +379,14 @@ void CProfiler2::RemoveThreadStorage(ThreadStorage* storage)
 {
 	CScopeLock lock(m_Mutex);
 	m_Threads.erase(std::find(m_Threads.begin(), m_Threads.end(), storage));
+
+	// (Any of its items that haven't been captured yet will be lost)
+	if (m_Capture)
+		m_Capture->threads.erase(storage);
 }
 
 CProfiler2::ThreadStorage::ThreadStorage(CProfiler2& profiler, const std::string& name) :
-	m_Profiler(profiler), m_Name(name), m_BufferPos0(0), m_BufferPos1(0), m_LastTime(timer_Time())
+	m_Profiler(profiler), m_Name(name), m_LastTime(timer_Time()), m_BufferPos0(0), m_BufferPos1(0), m_StreamPos(0)
 {
 	m_Buffer = new u8[BUFFER_SIZE];
 	memset(m_Buffer, ITEM_NOP, BUFFER_SIZE);
@@ -302,6 +421,52 @@ std::string CProfiler2::ThreadStorage::GetBuffer()
 		return std::string(buffer.get()+pos0, buffer.get()+pos1);
 }
 
+// Maximum size of an item in the buffer (the largest is an attribute)
+static const u32 MAX_ITEM_SIZE = 1 + 4 + CProfiler2::MAX_ATTRIBUTE_LENGTH;
+
+bool CProfiler2::ThreadStorage::GetBufferSince(u32& pos, std::string& data)
+{
+	// Called from an arbitrary thread (not the one writing to the buffer).
+	//
+	// Everything before m_StreamPos has been completely written. While we're copying,
+	// the writer might be in the middle of writing an item (and the padding before
+	// it) just after m_StreamPos, so the copy is only safe if that's still more than
+	// BUFFER_SIZE bytes ahead of the data we copied.
+
+	cassert(((u64)1 << 32) % BUFFER_SIZE == 0); // stream positions must wrap around consistently
+
+	data.clear();
+
+	u32 end = m_StreamPos;
+	COMPILER_FENCE; // must read m_StreamPos before m_Buffer
+
+	if (end - pos > BUFFER_SIZE - 2*MAX_ITEM_SIZE)
+	{
+		pos = end;
+		return false;
+	}
+
+	u32 start = pos % BUFFER_SIZE;
+	u32 len = end - pos;
+	if (start + len <= BUFFER_SIZE)
+		data.assign((const char*)m_Buffer + start, len);
+	else
+		data.assign((const char*)m_Buffer + start, BUFFER_SIZE - start).append((const char*)m_Buffer, len - (BUFFER_SIZE - start));
+
+	COMPILER_FENCE; // must read m_StreamPos after m_Buffer
+	u32 endAfter = m_StreamPos;
+
+	if (endAfter - pos > BUFFER_SIZE - 2*MAX_ITEM_SIZE)
+	{
+		data.clear();
+		pos = endAfter;
+		return false;
+	}
+
+	pos = end;
+	return true;
+}
+
 void CProfiler2::ThreadStorage::RecordAttribute(const char* fmt, va_list argp)
 {
 	char buffer[MAX_ATTRIBUTE_LENGTH + 4] = {0}; // first 4 bytes are used for storing length
@@ -339,39 +504,16 @@ void CProfiler2::ConstructJSONOverview(std::ostream& stream)
 }
 
 /**
- * Given a buffer and a visitor class (with functions OnEvent, OnEnter, OnLeave, OnAttribute),
- * calls the visitor for every item in the buffer.
+ * Given a buffer and a visitor class (with functions OnSync, OnEvent, OnEnter, OnLeave, OnCounter,
+ * OnAttribute), calls the visitor for every item in the buffer from @p pos onwards (which must be the start
+ * of an item). @p lastTime is the absolute time of the previous item, or negative if unknown
+ * (in which case items are skipped until the next sync marker); it's updated to the time of
+ * the last item.
+ * @return false if an invalid item was found
  */
 template<typename V>
-void RunBufferVisitor(const std::string& buffer, V& visitor)
+bool RunBufferItems(const std::string& buffer, u32 pos, double& lastTime, V& visitor)
 {
-	TIMER(L"profile2 visitor");
-
-	// The buffer doesn't necessarily start at the beginning of an item
-	// (we just grabbed it from some arbitrary point in the middle),
-	// so scan forwards until we find a sync marker.
-	// (This is probably pretty inefficient.)
-
-	u32 realStart = (u32)-1; // the start point decided by the scan algorithm
-
-	for (u32 start = 0; start + 1 + sizeof(CProfiler2::RESYNC_MAGIC) <= buffer.length(); ++start)
-	{
-		if (buffer[start] == CProfiler2::ITEM_SYNC
-			&& memcmp(buffer.c_str() + start + 1, &CProfiler2::RESYNC_MAGIC, sizeof(CProfiler2::RESYNC_MAGIC)) == 0)
-		{
-			realStart = start;
-			break;
-		}
-	}
-
-	ENSURE(realStart != (u32)-1); // we should have found a sync point somewhere in the buffer
-
-	u32 pos = realStart; // the position as we step through the buffer
-
-	double lastTime = -1;
-		// set to non-negative by EVENT_SYNC; we ignore all items before that
-		// since we can't compute their absolute times
-
 	while (pos < buffer.length())
 	{
 		u8 type = buffer[pos];
@@ -388,8 +530,11 @@ void RunBufferVisitor(const std::string& buffer, V& visitor)
 		{
 			u8 magic[sizeof(CProfiler2::RESYNC_MAGIC)];
 			double t;
+			if (pos + sizeof(magic) + sizeof(t) > buffer.length())
+				return false;
 			memcpy(magic, buffer.c_str()+pos, ARRAY_SIZE(magic));
-			ENSURE(memcmp(magic, &CProfiler2::RESYNC_MAGIC, sizeof(CProfiler2::RESYNC_MAGIC)) == 0);
+			if (memcmp(magic, &CProfiler2::RESYNC_MAGIC, sizeof(CProfiler2::RESYNC_MAGIC)) != 0)
+				return false;
 			pos += sizeof(CProfiler2::RESYNC_MAGIC);
 			memcpy(&t, buffer.c_str()+pos, sizeof(t));
 			pos += sizeof(t);
@@ -398,46 +543,48 @@ void RunBufferVisitor(const std::string& buffer, V& visitor)
 			break;
 		}
 		case CProfiler2::ITEM_EVENT:
-		{
-			CProfiler2::SItem_dt_id item;
-			memcpy(&item, buffer.c_str()+pos, sizeof(item));
-			pos += sizeof(item);
-			if (lastTime >= 0)
-			{
-				lastTime = lastTime + (double)item.dt;
-				visitor.OnEvent(lastTime, item.id);
-			}
-			break;
-		}
 		case CProfiler2::ITEM_ENTER:
+		case CProfiler2::ITEM_LEAVE:
 		{
 			CProfiler2::SItem_dt_id item;
+			if (pos + sizeof(item) > buffer.length())
+				return false;
 			memcpy(&item, buffer.c_str()+pos, sizeof(item));
 			pos += sizeof(item);
 			if (lastTime >= 0)
 			{
 				lastTime = lastTime + (double)item.dt;
-				visitor.OnEnter(lastTime, item.id);
+				if (type == CProfiler2::ITEM_EVENT)
+					visitor.OnEvent(lastTime, item.id);
+				else if (type == CProfiler2::ITEM_ENTER)
+					visitor.OnEnter(lastTime, item.id);
+				else
+					visitor.OnLeave(lastTime, item.id);
 			}
 			break;
 		}
-		case CProfiler2::ITEM_LEAVE:
+		case CProfiler2::ITEM_COUNTER:
 		{
-			CProfiler2::SItem_dt_id item;
+			CProfiler2::SItem_dt_id_value item;
+			if (pos + sizeof(item) > buffer.length())
+				return false;
 			memcpy(&item, buffer.c_str()+pos, sizeof(item));
 			pos += sizeof(item);
 			if (lastTime >= 0)
 			{
 				lastTime = lastTime + (double)item.dt;
-				visitor.OnLeave(lastTime, item.id);
+				visitor.OnCounter(lastTime, item.id, item.value);
 			}
 			break;
 		}
 		case CProfiler2::ITEM_ATTRIBUTE:
 		{
 			u32 len;
+			if (pos + sizeof(len) > buffer.length())
+				return false;
 			memcpy(&len, buffer.c_str()+pos, sizeof(len));
-			ENSURE(len <= CProfiler2::MAX_ATTRIBUTE_LENGTH);
+			if (len > CProfiler2::MAX_ATTRIBUTE_LENGTH || pos + sizeof(len) + len > buffer.length())
+				return false;
 			pos += sizeof(len);
 			std::string attribute(buffer.c_str()+pos, buffer.c_str()+pos+len);
 			pos += len;
@@ -448,10 +595,47 @@ void RunBufferVisitor(const std::string& buffer, V& visitor)
 			break;
 		}
 		default:
-			debug_warn(L"Invalid profiler item when parsing buffer");
-			return;
+			return false;
 		}
 	}
+
+	return true;
+}
+
+/**
+ * Given a buffer and a visitor class (with functions OnSync, OnEvent, OnEnter, OnLeave, OnCounter,
+ * OnAttribute), calls the visitor for every item in the buffer.
+ */
+template<typename V>
+void RunBufferVisitor(const std::string& buffer, V& visitor)
+{
+	TIMER(L"profile2 visitor");
+
+	// The buffer doesn't necessarily start at the beginning of an item
+	// (we just grabbed it from some arbitrary point in the middle),
+	// so scan forwards until we find a sync marker.
+	// (This is probably pretty inefficient.)
+
+	u32 realStart = (u32)-1; // the start point decided by the scan algorithm
+
+	for (u32 start = 0; start + 1 + sizeof(CProfiler2::RESYNC_MAGIC) <= buffer.length(); ++start)
+	{
+		if (buffer[start] == CProfiler2::ITEM_SYNC
+			&& memcmp(buffer.c_str() + start + 1, &CProfiler2::RESYNC_MAGIC, sizeof(CProfiler2::RESYNC_MAGIC)) == 0)
+		{
+			realStart = start;
+			break;
+		}
+	}
+
+	ENSURE(realStart != (u32)-1); // we should have found a sync point somewhere in the buffer
+
+	double lastTime = -1;
+		// set to non-negative by EVENT_SYNC; we ignore all items before that
+		// since we can't compute their absolute times
+
+	if (!RunBufferItems(buffer, realStart, lastTime, visitor))
+		debug_warn(L"Invalid profiler item when parsing buffer");
 };
 
 /**
@@ -491,6 +675,12 @@ public:
 		m_Stream << ",\"" << CStr(id).EscapeToPrintableASCII() << "\"],\n";
 	}
 
+	void OnCounter(double time, const char* id, double value)
+	{
+		m_Stream << "[5," << std::fixed << std::setprecision(9) << time;
+		m_Stream << ",\"" << CStr(id).EscapeToPrintableASCII() << "\"," << value << "],\n";
+	}
+
 	void OnAttribute(const std::string& attr)
 	{
 		m_Stream << "[4,\"" << CStr(attr).EscapeToPrintableASCII() << "\"],\n";
@@ -562,3 +752,353 @@ void CProfiler2::SaveToFile()
 	}
 	stream << "\n]});\n";
 }
+
+////////////////////////////////////////////////////////////////
+
+/**
+ * Visitor class that writes items to a capture file.
+ */
+struct BufferVisitor_Capture
+{
+	NONCOPYABLE(BufferVisitor_Capture);
+public:
+	BufferVisitor_Capture(CProfiler2::SCapture& capture, u32 thread) : m_Capture(capture), m_Thread(thread)
+	{
+	}
+
+	void OnSync(double UNUSED(time))
+	{
+	}
+
+	void OnEvent(double time, const char* id)
+	{
+		Write(CAPTURE_EVENT, time, id);
+	}
+
+	void OnEnter(double time, const char* id)
+	{
+		Write(CAPTURE_ENTER, time, id);
+	}
+
+	void OnLeave(double time, const char* id)
+	{
+		Write(CAPTURE_LEAVE, time, id);
+	}
+
+	void OnCounter(double time, const char* id, double value)
+	{
+		Write(CAPTURE_COUNTER, time, id);
+		m_Capture.WriteDouble(value);
+	}
+
+	void OnAttribute(const std::string& attr)
+	{
+		m_Capture.WriteU8(CAPTURE_ATTRIBUTE);
+		m_Capture.WriteU32(m_Thread);
+		m_Capture.WriteString(attr);
+	}
+
+private:
+	void Write(ECaptureRecord type, double time, const char* id)
+	{
+		u32 stringID = m_Capture.GetStringID(id);
+		m_Capture.WriteU8(type);
+		m_Capture.WriteU32(m_Thread);
+		m_Capture.WriteDouble(time);
+		m_Capture.WriteU32(stringID);
+	}
+
+	CProfiler2::SCapture& m_Capture;
+	u32 m_Thread;
+};
+
+void CProfiler2::EnableCapture(const OsPath& path)
+{
+	ENSURE(m_Initialised);
+
+	// Ignore multiple enablings
+	if (m_Capture)
+		return;
+
+	gzFile file = gzopen(OsString(path).c_str(), "wb");
+	if (!file)
+	{
+		LOGERROR(L"Failed to open profiler capture file '%ls'", path.string().c_str());
+		return;
+	}
+	gzwrite(file, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+
+	SCapture* capture = new SCapture;
+	capture->file = file;
+	capture->shutdown = false;
+	capture->nextThreadIndex = 0;
+
+	{
+		// Capture everything recorded after this point by the existing threads
+		// (new threads will be added when the capture thread first sees them)
+		CScopeLock lock(m_Mutex);
+		for (size_t i = 0; i < m_Threads.size(); ++i)
+			capture->AddThread(m_Threads[i]);
+		m_Capture = capture;
+	}
+
+	int err = pthread_create(&capture->thread, NULL, &CaptureThread, this);
+	ENSURE(err == 0);
+
+	LOGMESSAGE(L"Started profiler capture to '%ls'", path.string().c_str());
+}
+
+void CProfiler2::DisableCapture()
+{
+	if (!m_Capture)
+		return;
+
+	{
+		CScopeLock lock(m_Capture->mutex);
+		m_Capture->shutdown = true;
+	}
+	pthread_join(m_Capture->thread, NULL);
+
+	gzclose(m_Capture->file);
+
+	CScopeLock lock(m_Mutex);
+	SAFE_DELETE(m_Capture);
+}
+
+void* CProfiler2::CaptureThread(void* data)
+{
+	debug_SetThreadName("profiler2 capture");
+
+	CProfiler2* profiler = static_cast<CProfiler2*>(data);
+	SCapture& capture = *profiler->m_Capture;
+
+	double lastFlush = timer_Time();
+	while (true)
+	{
+		{
+			CScopeLock lock(capture.mutex);
+			if (capture.shutdown)
+				break;
+		}
+
+		profiler->CaptureItems(capture);
+
+		if (timer_Time() - lastFlush > CAPTURE_FLUSH_INTERVAL)
+		{
+			gzflush(capture.file, Z_SYNC_FLUSH);
+			lastFlush = timer_Time();
+		}
+
+		SDL_Delay(CAPTURE_INTERVAL_MSECS);
+	}
+
+	// Get the last few items before finishing
+	profiler->CaptureItems(capture);
+
+	return NULL;
+}
+
+void CProfiler2::CaptureItems(SCapture& capture)
+{
+	CScopeLock lock(m_Mutex); // lock against changes to m_Threads or deletions of ThreadStorage
+
+	std::string data;
+	for (size_t i = 0; i < m_Threads.size(); ++i)
+	{
+		ThreadStorage* storage = m_Threads[i];
+
+		std::map<ThreadStorage*, SCapture::SThread>::iterator it = capture.threads.find(storage);
+		SCapture::SThread& thread = (it == capture.threads.end() ? capture.AddThread(storage) : it->second);
+
+		bool ok = storage->GetBufferSince(thread.pos, data);
+		if (ok && !data.empty())
+		{
+			BufferVisitor_Capture visitor(capture, thread.index);
+			ok = RunBufferItems(data, 0, thread.lastTime, visitor);
+		}
+
+		if (!ok)
+		{
+			// Items were lost, so we can't compute times until the next sync marker
+			thread.lastTime = -1.0;
+			capture.WriteU8(CAPTURE_GAP);
+			capture.WriteU32(thread.index);
+		}
+	}
+}
+
+/**
+ * Chrome trace event for one item, kept until we know it has no more attributes.
+ */
+struct SCaptureTraceEvent
+{
+	SCaptureTraceEvent() : valid(false) { }
+
+	bool valid;
+	char phase;
+	double time;
+	double value; // for counters
+	std::string name;
+	std::vector<std::string> attributes;
+};
+
+static void WriteCaptureTraceEvent(std::ostream& stream, u32 thread, SCaptureTraceEvent& event, bool& first)
+{
+	if (!event.valid)
+		return;
+
+	stream << (first ? "" : ",\n");
+	first = false;
+
+	stream << "{\"name\":\"" << CStr(event.name).EscapeToPrintableASCII() << "\"";
+	stream << ",\"ph\":\"" << event.phase << "\"";
+	if (event.phase == 'i')
+		stream << ",\"s\":\"t\"";
+	stream << ",\"ts\":" << std::fixed << std::setprecision(3) << event.time * 1000000.0;
+	stream << ",\"pid\":1,\"tid\":" << thread;
+	if (event.phase == 'C')
+		stream << ",\"args\":{\"value\":" << event.value << "}";
+	else if (!event.attributes.empty())
+	{
+		stream << ",\"args\":{";
+		for (size_t i = 0; i < event.attributes.size(); ++i)
+			stream << (i ? "," : "") << "\"" << i << "\":\"" << CStr(event.attributes[i]).EscapeToPrintableASCII() << "\"";
+		stream << "}";
+	}
+	stream << "}";
+
+	event.valid = false;
+	event.attributes.clear();
+}
+
+template<typename T>
+static bool ReadCapture(gzFile file, T& value)
+{
+	return gzread(file, &value, sizeof(value)) == (int)sizeof(value);
+}
+
+static bool ReadCaptureString(gzFile file, std::string& str)
+{
+	u32 len;
+	if (!ReadCapture(file, len) || len > 64*KiB)
+		return false;
+	str.resize(len);
+	return len == 0 || gzread(file, &str[0], len) == (int)len;
+}
+
+bool CProfiler2::ConvertCapture(const OsPath& capturePath, const OsPath& outputPath)
+{
+	gzFile file = gzopen(OsString(capturePath).c_str(), "rb");
+	if (!file)
+	{
+		LOGERROR(L"Failed to open profiler capture file '%ls'", capturePath.string().c_str());
+		return false;
+	}
+
+	char magic[sizeof(CAPTURE_MAGIC)];
+	if (gzread(file, magic, sizeof(magic)) != (int)sizeof(magic) || memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) != 0)
+	{
+		LOGERROR(L"'%ls' is not a profiler capture file", capturePath.string().c_str());
+		gzclose(file);
+		return false;
+	}
+
+	std::ofstream stream(OsString(outputPath).c_str(), std::ofstream::out | std::ofstream::trunc);
+	if (!stream.good())
+	{
+		LOGERROR(L"Failed to open '%ls' for writing", outputPath.string().c_str());
+		gzclose(file);
+		return false;
+	}
+
+	stream << "{\"traceEvents\":[\n";
+	bool first = true;
+
+	std::map<u32, std::string> strings;
+	std::map<u32, SCaptureTraceEvent> pending; // latest event of each thread
+
+	// A capture from a crashed game may end in the middle of a record,
+	// so just stop at the first incomplete one
+	u8 type;
+	while (ReadCapture(file, type))
+	{
+		u32 thread = 0;
+		if (type == CAPTURE_STRING)
+		{
+			u32 id;
+			if (!ReadCapture(file, id) || !ReadCaptureString(file, strings[id]))
+				break;
+			continue;
+		}
+
+		if (!ReadCapture(file, thread))
+			break;
+
+		if (type == CAPTURE_ATTRIBUTE)
+		{
+			std::string attribute;
+			if (!ReadCaptureString(file, attribute))
+				break;
+			if (pending[thread].valid)
+				pending[thread].attributes.push_back(attribute);
+			continue;
+		}
+
+		WriteCaptureTraceEvent(stream, thread, pending[thread], first);
+
+		if (type == CAPTURE_THREAD)
+		{
+			std::string name;
+			if (!ReadCaptureString(file, name))
+				break;
+			stream << (first ? "" : ",\n");
+			first = false;
+			stream << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread;
+			stream << ",\"args\":{\"name\":\"" << CStr(name).EscapeToPrintableASCII() << "\"}}";
+		}
+		else if (type == CAPTURE_EVENT || type == CAPTURE_ENTER || type == CAPTURE_LEAVE)
+		{
+			double time;
+			u32 id;
+			if (!ReadCapture(file, time) || !ReadCapture(file, id))
+				break;
+
+			SCaptureTraceEvent& event = pending[thread];
+			event.valid = true;
+			event.phase = (type == CAPTURE_EVENT ? 'i' : type == CAPTURE_ENTER ? 'B' : 'E');
+			event.time = time;
+			event.name = strings[id];
+		}
+		else if (type == CAPTURE_COUNTER)
+		{
+			double time, value;
+			u32 id;
+			if (!ReadCapture(file, time) || !ReadCapture(file, id) || !ReadCapture(file, value))
+				break;
+
+			SCaptureTraceEvent& event = pending[thread];
+			event.valid = true;
+			event.phase = 'C';
+			event.time = time;
+			event.value = value;
+			event.name = strings[id];
+		}
+		else if (type == CAPTURE_GAP)
+		{
+			// Nothing to do; the viewer will just see unbalanced regions
+		}
+		else
+		{
+			LOGERROR(L"Invalid record in profiler capture file '%ls'", capturePath.string().c_str());
+			break;
+		}
+	}
+
+	for (std::map<u32, SCaptureTraceEvent>::iterator it = pending.begin(); it != pending.end(); ++it)
+		WriteCaptureTraceEvent(stream, it->first, it->second, first);
+
+	stream << "\n]}\n";
+
+	gzclose(file);
+	return true;
+}
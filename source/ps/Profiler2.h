@@ -1,4 +1,4 @@
-/* Copyright (c) 2011 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -41,6 +41,9 @@
  * Regions and events can be annotated with arbitrary string attributes,
  * specified with printf-style format strings, using PROFILE2_ATTR
  * (e.g. PROFILE2_ATTR("frame: %d", m_FrameNum) ).
+ * Numeric values that change over time (memory usage, queue lengths, etc)
+ * can be recorded with PROFILE2_COUNTER, so they can be plotted on the same
+ * timeline.
  * 
  * This is designed for relatively coarse-grained profiling, or for rare events.
  * Don't use it for regions that are typically less than ~0.1msecs, or that are
@@ -70,6 +73,12 @@
  * and to simplify the visualisation of the data by doing it externally in an
  * environment with better UI tools (i.e. HTML) instead of within the game engine.
  * 
+ * For longer captures (e.g. whole matches), EnableCapture starts a background
+ * thread that regularly copies the new items from every thread's buffer and streams
+ * them to a compressed file, before the ring buffers overwrite them. ConvertCapture
+ * turns such a file into the standard Chrome trace event JSON format,
+ * which can be viewed with chrome://tracing and other trace viewers.
+ * 
  * The initial setup of g_Profiler2 must happen in the game's main thread.
  * RegisterCurrentThread and the Record functions may be called from any thread.
  * The HTTP server runs its own threads, which may call the ConstructJSON functions.
@@ -78,6 +87,7 @@
 #ifndef INCLUDED_PROFILER2
 #define INCLUDED_PROFILER2
 
+#include "lib/os_path.h"
 #include "lib/timer.h"
 #include "ps/ThreadUtil.h"
 
@@ -104,6 +114,7 @@ public:
 		ITEM_ENTER = 3, // entering a region
 		ITEM_LEAVE = 4, // leaving a region (must be correctly nested)
 		ITEM_ATTRIBUTE = 5, // arbitrary string associated with current region, or latest event (if the previous item was an event)
+		ITEM_COUNTER = 6, // value of a named counter
 	};
 
 	static const size_t MAX_ATTRIBUTE_LENGTH = 256; // includes null terminator, which isn't stored
@@ -120,6 +131,13 @@ public:
 		const char* id;
 	};
 
+	struct SItem_dt_id_value
+	{
+		float dt; // time relative to last event
+		const char* id;
+		double value;
+	};
+
 private:
 	// TODO: what's a good size?
 	// TODO: different threads might want different sizes
@@ -156,6 +174,13 @@ private:
 			m_LastTime = t;
 		}
 
+		void RecordCounter(double t, const char* id, double value)
+		{
+			SItem_dt_id_value item = { (float)(t - m_LastTime), id, value };
+			Write(ITEM_COUNTER, &item, sizeof(item));
+			m_LastTime = t;
+		}
+
 		void RecordFrameStart(double t)
 		{
 			RecordSyncMarker(t);
@@ -189,6 +214,25 @@ private:
 		 */
 		std::string GetBuffer();
 
+		/**
+		 * Returns the position in the item stream just after the latest complete item.
+		 * Positions count every byte ever written (modulo 2^32), including padding.
+		 */
+		u32 GetStreamPosition()
+		{
+			return m_StreamPos;
+		}
+
+		/**
+		 * Copies the items from @p pos (which must be an item boundary, as returned
+		 * by GetStreamPosition) up to the latest complete item into @p data, and
+		 * advances @p pos past them.
+		 * If the writer has already overwritten items since @p pos, returns false
+		 * and skips @p pos forward to the latest item instead.
+		 * May be called by any thread.
+		 */
+		bool GetBufferSince(u32& pos, std::string& data);
+
 	private:
 		/**
 		 * Store an item into the buffer.
@@ -199,6 +243,7 @@ private:
 
 			u32 size = 1 + itemSize;
 			u32 start = m_BufferPos0;
+			u32 padding = 0;
 			if (start + size > BUFFER_SIZE)
 			{
 				// The remainder of the buffer is too small - fill the rest
@@ -209,6 +254,7 @@ private:
 				COMPILER_FENCE; // must write m_BufferPos0 before m_Buffer
 
 				memset(m_Buffer + start, 0, BUFFER_SIZE - start);
+				padding = BUFFER_SIZE - start;
 				start = 0;
 			}
 			else
@@ -220,8 +266,11 @@ private:
 			m_Buffer[start] = (u8)type;
 			memcpy(&m_Buffer[start + 1], item, itemSize);
 			
-			COMPILER_FENCE; // must write m_BufferPos1 after m_Buffer
+			COMPILER_FENCE; // must write m_BufferPos1 and m_StreamPos after m_Buffer
 			m_BufferPos1 = start + size;
+			// (The stream position includes the padding, so it stays equal
+			// to the buffer position modulo BUFFER_SIZE)
+			m_StreamPos += padding + size;
 		}
 
 		CProfiler2& m_Profiler;
@@ -244,6 +293,11 @@ private:
 		// actually work in practice?
 		u32 m_BufferPos0;
 		u32 m_BufferPos1;
+
+		// Total number of bytes written, modulo 2^32 (which is a multiple of BUFFER_SIZE);
+		// updated after writing, like m_BufferPos1. Used by GetBufferSince to work out
+		// what's new and whether anything has been overwritten.
+		u32 m_StreamPos;
 	};
 
 public:
@@ -275,6 +329,48 @@ public:
 	 */
 	void ShutdownGPU();
 
+	/**
+	 * Call in main thread to get the average GPU time per frame (in seconds)
+	 * of each GPU region since the last ResetGPURegionAverages, or nothing
+	 * if GPU profiling isn't enabled.
+	 */
+	void GetGPURegionAverages(std::vector<std::pair<std::string, double> >& averages) const;
+	void ResetGPURegionAverages();
+
+	/**
+	 * Call in main thread to get the GPU time (in seconds) of the most recent
+	 * frame whose GPU timings are available. Returns false if there is none
+	 * (if GPU profiling isn't enabled or supported).
+	 */
+	bool GetGPUFrameTime(double& time) const;
+
+	/**
+	 * Start streaming all the recorded items to the given file, in a compressed
+	 * binary format, until DisableCapture is called (or the profiler is shut down).
+	 * Call in main thread.
+	 */
+	void EnableCapture(const OsPath& path);
+
+	/**
+	 * Stop and close the capture started by EnableCapture, if any.
+	 * Call in main thread.
+	 */
+	void DisableCapture();
+
+	bool IsCapturing()
+	{
+		return m_Capture != NULL;
+	}
+
+	/**
+	 * Convert a file written by EnableCapture into the Chrome trace event JSON format.
+	 * @return false on error
+	 */
+	static bool ConvertCapture(const OsPath& capturePath, const OsPath& outputPath);
+
+	/// State of the capture thread (only used internally)
+	struct SCapture;
+
 	/**
 	 * Call in main thread to shut everything down.
 	 * All other profiled threads should have been terminated already.
@@ -322,6 +418,20 @@ public:
 		GetThreadStorage().Record(ITEM_LEAVE, GetTime(), id);
 	}
 
+	void RecordCounter(const char* id, double value)
+	{
+		GetThreadStorage().RecordCounter(GetTime(), id, value);
+	}
+
+	/**
+	 * Returns whether the current thread has been registered with RegisterCurrentThread
+	 * (for code that might run on unregistered threads, like script runtime callbacks).
+	 */
+	bool IsCurrentThreadRegistered()
+	{
+		return m_Initialised && pthread_getspecific(m_TLS) != NULL;
+	}
+
 	void RecordAttribute(const char* fmt, ...) PRINTF_ARGS(2)
 	{
 		va_list argp;
@@ -375,6 +485,14 @@ public:
 private:
 	void InitialiseGPU();
 
+	static void* CaptureThread(void* data);
+
+	/**
+	 * Writes all the new items from every thread to the capture file.
+	 * Called from the capture thread.
+	 */
+	void CaptureItems(SCapture& capture);
+
 	static void TLSDtor(void* data);
 
 	ThreadStorage& GetThreadStorage()
@@ -394,6 +512,8 @@ private:
 
 	CProfiler2GPU* m_GPU;
 
+	SCapture* m_Capture;
+
 	CMutex m_Mutex;
 	std::vector<ThreadStorage*> m_Threads; // thread-safe; protected by m_Mutex
 };
@@ -460,4 +580,10 @@ private:
  */
 #define PROFILE2_ATTR g_Profiler2.RecordAttribute
 
+/**
+ * Record the current value of the named counter (e.g. memory usage).
+ * @p name should be a constant string literal, like region names.
+ */
+#define PROFILE2_COUNTER(name, value) g_Profiler2.RecordCounter(name, value)
+
 #endif // INCLUDED_PROFILER2
@@ -1,4 +1,4 @@
-/* Copyright (c) 2011 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -27,10 +27,139 @@
 #include "lib/ogl.h"
 #include "lib/allocators/shared_ptr.h"
 #include "ps/ConfigDB.h"
+#include "ps/Profile.h"
+#include "ps/ProfileViewer.h"
 #include "ps/Profiler2.h"
 
 #if !CONFIG2_GLES
 
+/**
+ * Profile table showing the GPU time spent in each region (averaged over
+ * recent frames), for the timer query implementations that can measure it.
+ * Regions are listed in the order they were first seen, indented by their
+ * nesting depth.
+ */
+class CProfiler2GPUTimings : public AbstractProfileTable
+{
+	NONCOPYABLE(CProfiler2GPUTimings);
+
+	struct SRegion
+	{
+		std::string name;
+		size_t depth;
+		double frameTime; // seconds spent in this region in the current frame
+		double totalTime; // seconds spent in this region since the last ResetTotals
+		RingBuf<double, PROFILE_AMORTIZE_FRAMES> times;
+	};
+
+public:
+	CProfiler2GPUTimings() : m_TotalFrames(0), m_LastFrameTime(-1.0)
+	{
+		m_Columns.push_back(ProfileColumn("Name", 230));
+		m_Columns.push_back(ProfileColumn("msec/frame", 100));
+	}
+
+	/**
+	 * Add time spent (in seconds) in one instance of the given region
+	 * during the frame currently being processed.
+	 */
+	void AddRegionTime(const char* id, size_t depth, double time)
+	{
+		std::map<std::string, size_t>::iterator it = m_RegionIndexes.find(id);
+		if (it == m_RegionIndexes.end())
+		{
+			SRegion region;
+			region.name = id;
+			region.depth = depth;
+			region.frameTime = 0.0;
+			region.totalTime = 0.0;
+			m_Regions.push_back(region);
+			it = m_RegionIndexes.insert(std::make_pair(std::string(id), m_Regions.size()-1)).first;
+		}
+		m_Regions[it->second].frameTime += time;
+	}
+
+	/**
+	 * Finish processing a frame, adding its totals to the averages.
+	 */
+	void EndFrame()
+	{
+		std::map<std::string, size_t>::iterator it = m_RegionIndexes.find("frame");
+		if (it != m_RegionIndexes.end())
+			m_LastFrameTime = m_Regions[it->second].frameTime;
+
+		for (size_t i = 0; i < m_Regions.size(); ++i)
+		{
+			m_Regions[i].times.push_back(m_Regions[i].frameTime);
+			m_Regions[i].totalTime += m_Regions[i].frameTime;
+			m_Regions[i].frameTime = 0.0;
+		}
+		++m_TotalFrames;
+	}
+
+	/**
+	 * Get the average time per frame (in seconds) of every region,
+	 * over all the frames processed since the last ResetTotals.
+	 */
+	void GetAverages(std::vector<std::pair<std::string, double> >& averages) const
+	{
+		averages.clear();
+		for (size_t i = 0; i < m_Regions.size(); ++i)
+			averages.push_back(std::make_pair(m_Regions[i].name, m_TotalFrames ? m_Regions[i].totalTime / m_TotalFrames : 0.0));
+	}
+
+	/**
+	 * Get the GPU time (in seconds) of the whole of the most recently
+	 * processed frame. Returns false if no frame has been processed yet.
+	 */
+	bool GetLastFrameTime(double& time) const
+	{
+		if (m_LastFrameTime < 0.0)
+			return false;
+		time = m_LastFrameTime;
+		return true;
+	}
+
+	void ResetTotals()
+	{
+		for (size_t i = 0; i < m_Regions.size(); ++i)
+			m_Regions[i].totalTime = 0.0;
+		m_TotalFrames = 0;
+	}
+
+	// Implementation of AbstractProfileTable interface
+	CStr GetName() { return "gpu"; }
+	CStr GetTitle() { return "GPU timings"; }
+	size_t GetNumberRows() { return m_Regions.size(); }
+	const std::vector<ProfileColumn>& GetColumns() { return m_Columns; }
+	AbstractProfileTable* GetChild(size_t UNUSED(row)) { return NULL; }
+
+	CStr GetCellText(size_t row, size_t col)
+	{
+		const SRegion& region = m_Regions[row];
+		if (col == 0)
+			return std::string(region.depth*2, ' ') + region.name;
+
+		double total = 0.0;
+		for (size_t i = 0; i < region.times.size(); ++i)
+			total += region.times[(int)i];
+		double average = region.times.empty() ? 0.0 : total / region.times.size();
+
+		char buf[256];
+		sprintf_s(buf, sizeof(buf), "%.3f", average * 1000.0);
+		return buf;
+	}
+
+private:
+	std::vector<ProfileColumn> m_Columns;
+	std::vector<SRegion> m_Regions;
+	std::map<std::string, size_t> m_RegionIndexes;
+	size_t m_TotalFrames;
+	double m_LastFrameTime;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
 class CProfiler2GPU_base
 {
 	NONCOPYABLE(CProfiler2GPU_base);
@@ -60,8 +189,8 @@ protected:
 class CProfiler2GPU_timer_query : public CProfiler2GPU_base
 {
 protected:
-	CProfiler2GPU_timer_query(CProfiler2& profiler, const char* name) :
-		CProfiler2GPU_base(profiler, name)
+	CProfiler2GPU_timer_query(CProfiler2& profiler, const char* name, CProfiler2GPUTimings& timings) :
+		CProfiler2GPU_base(profiler, name), m_Timings(timings)
 	{
 	}
 
@@ -88,7 +217,32 @@ protected:
 		return query;
 	}
 
+	// Record the time of an enter/leave event in the frame being processed,
+	// and add the durations of completed regions to m_Timings
+	void RecordRegionTime(const char* id, bool isEnter, double t)
+	{
+		if (isEnter)
+		{
+			m_EnterTimes.push_back(t);
+		}
+		else if (!m_EnterTimes.empty())
+		{
+			double start = m_EnterTimes.back();
+			m_EnterTimes.pop_back();
+			m_Timings.AddRegionTime(id, m_EnterTimes.size(), t - start);
+		}
+	}
+
+	void EndRegionTimes()
+	{
+		m_EnterTimes.clear();
+		m_Timings.EndFrame();
+	}
+
 	std::vector<GLuint> m_FreeQueries; // query objects that are allocated but not currently in used
+
+	CProfiler2GPUTimings& m_Timings;
+	std::vector<double> m_EnterTimes; // stack of enter times of the regions currently being processed
 };
 
 //////////////////////////////////////////////////////////////////////////
@@ -129,8 +283,8 @@ public:
 		return ogl_HaveExtension("GL_ARB_timer_query");
 	}
 
-	CProfiler2GPU_ARB_timer_query(CProfiler2& profiler) :
-		CProfiler2GPU_timer_query(profiler, "gpu_arb")
+	CProfiler2GPU_ARB_timer_query(CProfiler2& profiler, CProfiler2GPUTimings& timings) :
+		CProfiler2GPU_timer_query(profiler, "gpu_arb", timings)
 	{
 		// TODO: maybe we should check QUERY_COUNTER_BITS to ensure it's
 		// high enough (but apparently it might trigger GL errors on ATI)
@@ -251,12 +405,14 @@ private:
 					m_Storage.Record(CProfiler2::ITEM_ENTER, t, frame.events[i].id);
 				else
 					m_Storage.Record(CProfiler2::ITEM_LEAVE, t, frame.events[i].id);
+				RecordRegionTime(frame.events[i].id, frame.events[i].isEnter, t);
 
 				// Associate the frame number with the "frame" region
 				if (i == 0)
 					m_Storage.RecordAttributePrintf("%u", frame.num);
 			}
 
+			EndRegionTimes();
 			PopFrontFrame();
 		}
 	}
@@ -307,8 +463,8 @@ public:
 		return ogl_HaveExtension("GL_EXT_timer_query");
 	}
 
-	CProfiler2GPU_EXT_timer_query(CProfiler2& profiler) :
-		CProfiler2GPU_timer_query(profiler, "gpu_ext")
+	CProfiler2GPU_EXT_timer_query(CProfiler2& profiler, CProfiler2GPUTimings& timings) :
+		CProfiler2GPU_timer_query(profiler, "gpu_ext", timings)
 	{
 	}
 
@@ -403,6 +559,7 @@ private:
 					m_Storage.Record(CProfiler2::ITEM_ENTER, t, frame.events[i].id);
 				else
 					m_Storage.Record(CProfiler2::ITEM_LEAVE, t, frame.events[i].id);
+				RecordRegionTime(frame.events[i].id, frame.events[i].isEnter, t);
 
 				// Associate the frame number with the "frame" region
 				if (i == 0)
@@ -416,6 +573,7 @@ private:
 				t += (double)queryElapsed / 1e9;
 			}
 
+			EndRegionTimes();
 			PopFrontFrame();
 		}
 	}
@@ -771,8 +929,12 @@ private:
 //////////////////////////////////////////////////////////////////////////
 
 CProfiler2GPU::CProfiler2GPU(CProfiler2& profiler) :
-	m_Profiler(profiler), m_ProfilerARB(NULL), m_ProfilerEXT(NULL), m_ProfilerINTEL(NULL)
+	m_Profiler(profiler), m_ProfilerARB(NULL), m_ProfilerEXT(NULL), m_ProfilerINTEL(NULL), m_Timings(NULL)
 {
+	m_Timings = new CProfiler2GPUTimings();
+	if (CProfileViewer::IsInitialised())
+		g_ProfileViewer.AddRootTable(m_Timings);
+
 	bool enabledARB = false;
 	bool enabledEXT = false;
 	bool enabledINTEL = false;
@@ -786,11 +948,11 @@ CProfiler2GPU::CProfiler2GPU(CProfiler2& profiler) :
 	// in CProfiler2GPU_EXT_timer_query::RecordRegion)
 	if (enabledARB && CProfiler2GPU_ARB_timer_query::IsSupported())
 	{
-		m_ProfilerARB = new CProfiler2GPU_ARB_timer_query(m_Profiler);
+		m_ProfilerARB = new CProfiler2GPU_ARB_timer_query(m_Profiler, *m_Timings);
 	}
 	else if (enabledEXT && CProfiler2GPU_EXT_timer_query::IsSupported())
 	{
-		m_ProfilerEXT = new CProfiler2GPU_EXT_timer_query(m_Profiler);
+		m_ProfilerEXT = new CProfiler2GPU_EXT_timer_query(m_Profiler, *m_Timings);
 	}
 
 	// The INTEL mode should be compatible with ARB/EXT (though no current
@@ -807,6 +969,7 @@ CProfiler2GPU::~CProfiler2GPU()
 	SAFE_DELETE(m_ProfilerARB);
 	SAFE_DELETE(m_ProfilerEXT);
 	SAFE_DELETE(m_ProfilerINTEL);
+	SAFE_DELETE(m_Timings);
 }
 
 void CProfiler2GPU::FrameStart()
@@ -857,10 +1020,25 @@ void CProfiler2GPU::RegionLeave(const char* id)
 		m_ProfilerINTEL->RegionLeave(id);
 }
 
+void CProfiler2GPU::GetRegionAverages(std::vector<std::pair<std::string, double> >& averages) const
+{
+	m_Timings->GetAverages(averages);
+}
+
+void CProfiler2GPU::ResetRegionAverages()
+{
+	m_Timings->ResetTotals();
+}
+
+bool CProfiler2GPU::GetFrameTime(double& time) const
+{
+	return m_Timings->GetLastFrameTime(time);
+}
+
 #else // CONFIG2_GLES
 
 CProfiler2GPU::CProfiler2GPU(CProfiler2& profiler) :
-	m_Profiler(profiler), m_ProfilerARB(NULL), m_ProfilerEXT(NULL), m_ProfilerINTEL(NULL)
+	m_Profiler(profiler), m_ProfilerARB(NULL), m_ProfilerEXT(NULL), m_ProfilerINTEL(NULL), m_Timings(NULL)
 {
 }
 
@@ -870,5 +1048,8 @@ void CProfiler2GPU::FrameStart() { }
 void CProfiler2GPU::FrameEnd() { }
 void CProfiler2GPU::RegionEnter(const char* UNUSED(id)) { }
 void CProfiler2GPU::RegionLeave(const char* UNUSED(id)) { }
+void CProfiler2GPU::GetRegionAverages(std::vector<std::pair<std::string, double> >& averages) const { averages.clear(); }
+void CProfiler2GPU::ResetRegionAverages() { }
+bool CProfiler2GPU::GetFrameTime(double& UNUSED(time)) const { return false; }
 
 #endif
@@ -1,4 +1,4 @@
-/* Copyright (c) 2011 Wildfire Games
+/* Copyright (c) 2013 Wildfire Games
  *
  * Permission is hereby granted, free of charge, to any person obtaining
  * a copy of this software and associated documentation files (the
@@ -24,6 +24,7 @@ class CProfiler2;
 class CProfiler2GPU_ARB_timer_query;
 class CProfiler2GPU_EXT_timer_query;
 class CProfiler2GPU_INTEL_performance_queries;
+class CProfiler2GPUTimings;
 
 /**
  * Used by CProfiler2 for GPU profiling support.
@@ -41,10 +42,29 @@ public:
 	void RegionEnter(const char* id);
 	void RegionLeave(const char* id);
 
+	/**
+	 * Get the average GPU time per frame (in seconds) of each region,
+	 * in the order they were first seen, over all the frames whose
+	 * timings have been retrieved since ResetRegionAverages.
+	 */
+	void GetRegionAverages(std::vector<std::pair<std::string, double> >& averages) const;
+	void ResetRegionAverages();
+
+	/**
+	 * Get the GPU time (in seconds) of the most recent frame whose timings
+	 * have been retrieved (typically a few frames behind the current one).
+	 * Returns false if there is no such frame, e.g. if timer queries aren't
+	 * supported.
+	 */
+	bool GetFrameTime(double& time) const;
+
 private:
 	CProfiler2& m_Profiler;
 
 	CProfiler2GPU_ARB_timer_query* m_ProfilerARB;
 	CProfiler2GPU_EXT_timer_query* m_ProfilerEXT;
 	CProfiler2GPU_INTEL_performance_queries* m_ProfilerINTEL;
+
+	// Rolling per-region GPU times, shown in the in-game profiler
+	CProfiler2GPUTimings* m_Timings;
 };
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -19,18 +19,31 @@
 
 #include "Replay.h"
 
+#include "graphics/CinemaTrack.h"
+#include "graphics/GameView.h"
+#include "graphics/Terrain.h"
 #include "graphics/TerrainTextureManager.h"
 #include "lib/timer.h"
 #include "lib/file/file_system.h"
+#include "lib/sysdep/filesystem.h"
+#include "lib/sysdep/sysdep.h"
 #include "lib/res/h_mgr.h"
 #include "lib/tex/tex.h"
+#include "lib/utf8.h"
+#include "ps/CLogger.h"
 #include "ps/Game.h"
 #include "ps/Loader.h"
 #include "ps/Profile.h"
+#include "ps/Profiler2.h"
 #include "ps/ProfileViewer.h"
+#include "renderer/Renderer.h"
 #include "scriptinterface/ScriptInterface.h"
 #include "scriptinterface/ScriptStats.h"
+#include "simulation2/scripting/ScriptComponentStats.h"
 #include "simulation2/Simulation2.h"
+#include "simulation2/components/ICmpOwnership.h"
+#include "simulation2/components/ICmpPosition.h"
+#include "simulation2/components/ICmpTerrain.h"
 #include "simulation2/helpers/SimulationCommand.h"
 
 #include <sstream>
@@ -51,6 +64,18 @@ static std::string Hexify(const std::string& s)
 	return str.str();
 }
 
+static std::string EscapeJSON(const std::string& s)
+{
+	std::string ret;
+	for (size_t i = 0; i < s.size(); ++i)
+	{
+		if (s[i] == '"' || s[i] == '\\')
+			ret += '\\';
+		ret += s[i];
+	}
+	return ret;
+}
+
 CReplayLogger::CReplayLogger(ScriptInterface& scriptInterface) :
 	m_ScriptInterface(scriptInterface)
 {
@@ -102,7 +127,7 @@ void CReplayLogger::Hash(const std::string& hash, bool quick)
 ////////////////////////////////////////////////////////////////
 
 CReplayPlayer::CReplayPlayer() :
-	m_Stream(NULL)
+	m_Stream(NULL), m_KeyframeInterval(0), m_StartTurn(0), m_HashInterval(100)
 {
 }
 
@@ -115,10 +140,54 @@ void CReplayPlayer::Load(const std::string& path)
 {
 	ENSURE(!m_Stream);
 
+	m_Path = OsPath(path);
 	m_Stream = new std::ifstream(path.c_str());
 	ENSURE(m_Stream->good());
 }
 
+void CReplayPlayer::SetKeyframeInterval(u32 turns)
+{
+	m_KeyframeInterval = turns;
+}
+
+void CReplayPlayer::SetStartTurn(u32 turn)
+{
+	m_StartTurn = turn;
+}
+
+void CReplayPlayer::SetHashInterval(u32 turns)
+{
+	m_HashInterval = turns;
+}
+
+void CReplayPlayer::SetSummaryPath(const OsPath& path)
+{
+	m_SummaryPath = path;
+}
+
+OsPath CReplayPlayer::GetKeyframePath(u32 turn) const
+{
+	wchar_t filename[64];
+	swprintf_s(filename, ARRAY_SIZE(filename), L"keyframe-%08u.dat", turn);
+	return m_Path.Parent() / filename;
+}
+
+u32 CReplayPlayer::FindKeyframe(u32 maxTurn) const
+{
+	FileInfos files;
+	if (GetDirectoryEntries(m_Path.Parent(), &files, NULL) != INFO::OK)
+		return 0;
+
+	u32 best = 0;
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		unsigned int turn;
+		if (swscanf_s(files[i].Name().string().c_str(), L"keyframe-%u.dat", &turn) == 1 && turn <= maxTurn && turn > best)
+			best = turn;
+	}
+	return best;
+}
+
 void CReplayPlayer::Replay()
 {
 	ENSURE(m_Stream);
@@ -127,6 +196,8 @@ void CReplayPlayer::Replay()
 	new CProfileManager;
 	g_ScriptStatsTable = new CScriptStatsTable;
 	g_ProfileViewer.AddRootTable(g_ScriptStatsTable);
+	g_ScriptComponentStatsTable = new CScriptComponentStatsTable;
+	g_ProfileViewer.AddRootTable(g_ScriptComponentStatsTable);
 
 	CGame game(true);
 	g_Game = &game;
@@ -144,6 +215,18 @@ void CReplayPlayer::Replay()
 	u32 turn = 0;
 	u32 turnLength = 0;
 
+	// Turns up to the keyframe are skipped entirely, and the ones after it but
+	// before m_StartTurn are simulated as fast as possible (without any output)
+	u32 keyframeTurn = m_StartTurn ? FindKeyframe(m_StartTurn) : 0;
+	bool skipping = false;
+	bool fastForward = false;
+
+	// Results for the summary
+	std::vector<double> turnTimes;
+	u32 hashChecks = 0;
+	u32 firstMismatchTurn = 0;
+	bool mismatch = false;
+
 	std::string type;
 	while ((*m_Stream >> type).good())
 	{
@@ -155,7 +238,17 @@ void CReplayPlayer::Replay()
 			std::getline(*m_Stream, line);
 			CScriptValRooted attribs = game.GetSimulation2()->GetScriptInterface().ParseJSON(line);
 
-			game.StartGame(attribs, "");
+			std::string savedState;
+			if (keyframeTurn)
+			{
+				std::ifstream keyframe(OsString(GetKeyframePath(keyframeTurn)).c_str(), std::ifstream::in | std::ifstream::binary);
+				std::stringstream keyframeData;
+				keyframeData << keyframe.rdbuf();
+				savedState = keyframeData.str();
+				debug_printf(L"Starting from keyframe at turn %u\n", keyframeTurn);
+			}
+
+			game.StartGame(attribs, savedState);
 
 			// TODO: Non progressive load can fail - need a decent way to handle this
 			LDR_NonprogressiveLoad();
@@ -166,7 +259,10 @@ void CReplayPlayer::Replay()
 		else if (type == "turn")
 		{
 			*m_Stream >> turn >> turnLength;
-			debug_printf(L"Turn %u (%u)... ", turn, turnLength);
+			skipping = (turn <= keyframeTurn);
+			fastForward = (turn < m_StartTurn);
+			if (!fastForward)
+				debug_printf(L"Turn %u (%u)... ", turn, turnLength);
 		}
 		else if (type == "cmd")
 		{
@@ -175,6 +271,9 @@ void CReplayPlayer::Replay()
 
 			std::string line;
 			std::getline(*m_Stream, line);
+			if (skipping)
+				continue;
+
 			CScriptValRooted data = game.GetSimulation2()->GetScriptInterface().ParseJSON(line);
 
 			SimulationCommand cmd = { player, data };
@@ -189,30 +288,63 @@ void CReplayPlayer::Replay()
 
 //			if (turn >= 1300)
 //			if (turn >= 0)
-			if (turn % 100 == 0)
+			if (!fastForward && m_HashInterval && turn % m_HashInterval == 0)
 			{
 				std::string hash;
 				bool ok = game.GetSimulation2()->ComputeStateHash(hash, quick);
 				ENSURE(ok);
 				std::string hexHash = Hexify(hash);
+				++hashChecks;
 				if (hexHash == replayHash)
 					debug_printf(L"hash ok (%hs)", hexHash.c_str());
 				else
+				{
 					debug_printf(L"HASH MISMATCH (%hs != %hs)", hexHash.c_str(), replayHash.c_str());
+					if (!mismatch)
+					{
+						mismatch = true;
+						firstMismatchTurn = turn;
+					}
+				}
 			}
 		}
 		else if (type == "end")
 		{
+			if (skipping)
+				continue;
+
+			if (fastForward)
+			{
+				game.GetSimulation2()->Update(turnLength, commands);
+				commands.clear();
+			}
+			else
 			{
 				g_Profiler2.RecordFrameStart();
 				PROFILE2("frame");
 				g_Profiler2.IncrementFrameNumber();
 				PROFILE2_ATTR("%d", g_Profiler2.GetFrameNumber());
 
+				double startTime = timer_Time();
 				game.GetSimulation2()->Update(turnLength, commands);
+				turnTimes.push_back(timer_Time() - startTime);
 				commands.clear();
 			}
 
+			if (m_KeyframeInterval && turn % m_KeyframeInterval == 0)
+			{
+				// (Entities must be flushed before serializing, as in the turn manager)
+				game.GetSimulation2()->FlushDestroyedEntities();
+				std::string state;
+				bool ok = game.GetSimulation2()->SerializeState(state);
+				ENSURE(ok);
+				std::ofstream keyframe(OsString(GetKeyframePath(turn)).c_str(), std::ofstream::out | std::ofstream::trunc | std::ofstream::binary);
+				keyframe.write(state.data(), state.length());
+			}
+
+			if (fastForward)
+				continue;
+
 //			std::string hash;
 //			bool ok = game.GetSimulation2()->ComputeStateHash(hash, true);
 //			ENSURE(ok);
@@ -241,14 +373,598 @@ void CReplayPlayer::Replay()
 	ENSURE(ok);
 	debug_printf(L"# Final state: %hs\n", Hexify(hash).c_str());
 
+	if (!m_SummaryPath.empty())
+	{
+		double totalTime = 0.0;
+		double maxTime = 0.0;
+		for (size_t i = 0; i < turnTimes.size(); ++i)
+		{
+			totalTime += turnTimes[i];
+			maxTime = std::max(maxTime, turnTimes[i]);
+		}
+
+		// Times are in milliseconds
+		std::ofstream summary(OsString(m_SummaryPath).c_str(), std::ofstream::out | std::ofstream::trunc);
+		summary << std::fixed << std::setprecision(3);
+		summary << "{\"replay\": \"" << EscapeJSON(OsString(m_Path)) << "\"";
+		summary << ", \"turns\": " << turn;
+		summary << ", \"final_hash\": \"" << Hexify(hash) << "\"";
+		summary << ", \"hash_checks\": " << hashChecks;
+		if (mismatch)
+			summary << ", \"first_mismatch_turn\": " << firstMismatchTurn;
+		else
+			summary << ", \"first_mismatch_turn\": null";
+		summary << ", \"total_time\": " << totalTime*1000.0;
+		summary << ", \"max_turn_time\": " << maxTime*1000.0;
+		summary << ", \"turn_times\": [";
+		for (size_t i = 0; i < turnTimes.size(); ++i)
+			summary << (i ? ", " : "") << turnTimes[i]*1000.0;
+		summary << "]}\n";
+	}
+
 	timer_DisplayClientTotals();
 
 	// Clean up
 	delete &g_TexMan;
 	tex_codec_unregister_all();
 
+	SAFE_DELETE(g_ScriptComponentStatsTable);
+
+	delete &g_Profiler;
+	delete &g_ProfileViewer;
+
+	g_Game = NULL;
+}
+
+////////////////////////////////////////////////////////////////
+
+CReplayBatch::CReplayBatch(const OsPath& directory, size_t numJobs) :
+	m_Directory(directory), m_NumJobs(std::max(numJobs, (size_t)1)), m_NextJob(0)
+{
+}
+
+size_t CReplayBatch::Run(const OsPath& summaryPath)
+{
+	// Find the logs
+	std::vector<OsPath> logs;
+	if (FileExists(m_Directory / L"commands.txt"))
+		logs.push_back(m_Directory / L"commands.txt");
+
+	DirectoryNames subdirectories;
+	if (GetDirectoryEntries(m_Directory, NULL, &subdirectories) != INFO::OK)
+	{
+		debug_printf(L"Failed to read replay directory %ls\n", m_Directory.string().c_str());
+		return 0;
+	}
+	std::sort(subdirectories.begin(), subdirectories.end());
+	for (size_t i = 0; i < subdirectories.size(); ++i)
+	{
+		OsPath path = m_Directory / subdirectories[i] / L"commands.txt";
+		if (FileExists(path))
+			logs.push_back(path);
+	}
+
+	m_Jobs.resize(logs.size());
+	for (size_t i = 0; i < logs.size(); ++i)
+	{
+		m_Jobs[i].path = logs[i];
+		m_Jobs[i].summaryPath = logs[i].Parent() / L"summary.json";
+		m_Jobs[i].outputPath = logs[i].Parent() / L"replay_output.txt";
+		m_Jobs[i].exitCode = -1;
+
+		// Don't pick up the summary from an earlier run if this one fails
+		if (FileExists(m_Jobs[i].summaryPath))
+			wunlink(m_Jobs[i].summaryPath);
+	}
+
+	debug_printf(L"Running %lu replays with %lu jobs\n", (unsigned long)m_Jobs.size(), (unsigned long)m_NumJobs);
+
+	// The threads just wait for the child processes, so there's no point using the thread pool
+	std::vector<pthread_t> threads(std::min(m_NumJobs, m_Jobs.size()));
+	for (size_t i = 0; i < threads.size(); ++i)
+	{
+		int ret = pthread_create(&threads[i], NULL, &RunThread, this);
+		ENSURE(ret == 0);
+	}
+	for (size_t i = 0; i < threads.size(); ++i)
+		pthread_join(threads[i], NULL);
+
+	// Collect the results
+	size_t failures = 0;
+	std::ofstream summary(OsString(summaryPath).c_str(), std::ofstream::out | std::ofstream::trunc);
+	summary << "{\"replays\": [\n";
+	for (size_t i = 0; i < m_Jobs.size(); ++i)
+	{
+		std::ifstream replaySummary(OsString(m_Jobs[i].summaryPath).c_str());
+		std::string result;
+		std::getline(replaySummary, result);
+
+		if (i)
+			summary << ",\n";
+
+		if (result.empty())
+		{
+			// The replay didn't finish, so it probably crashed
+			++failures;
+			summary << "{\"replay\": \"" << EscapeJSON(OsString(m_Jobs[i].path)) << "\", \"error\": \"exit code " << m_Jobs[i].exitCode << "\"}";
+			debug_printf(L"FAILED %ls (see %ls)\n", m_Jobs[i].path.string().c_str(), m_Jobs[i].outputPath.string().c_str());
+			continue;
+		}
+
+		summary << result;
+		if (result.find("\"first_mismatch_turn\": null") == std::string::npos)
+		{
+			++failures;
+			debug_printf(L"MISMATCH %ls\n", m_Jobs[i].path.string().c_str());
+		}
+		else
+			debug_printf(L"ok %ls\n", m_Jobs[i].path.string().c_str());
+	}
+	summary << "\n], \"failures\": " << failures << "}\n";
+
+	debug_printf(L"%lu of %lu replays failed; summary written to %ls\n", (unsigned long)failures, (unsigned long)m_Jobs.size(), summaryPath.string().c_str());
+	return failures;
+}
+
+void* CReplayBatch::RunThread(void* data)
+{
+	debug_SetThreadName("replay batch");
+
+	CReplayBatch* batch = static_cast<CReplayBatch*>(data);
+	const std::string executable = OsString(sys_ExecutablePathname());
+
+	while (true)
+	{
+		SJob* job;
+		{
+			CScopeLock lock(batch->m_Mutex);
+			if (batch->m_NextJob >= batch->m_Jobs.size())
+				break;
+			job = &batch->m_Jobs[batch->m_NextJob++];
+		}
+
+		std::string command = "\"" + executable + "\""
+			" \"-replay=" + OsString(job->path) + "\""
+			" \"-replay-summary=" + OsString(job->summaryPath) + "\""
+			" -replay-hashes=1"
+			" > \"" + OsString(job->outputPath) + "\" 2>&1";
+#if OS_WIN
+		// cmd.exe strips the outer quotes
+		command = "\"" + command + "\"";
+#endif
+		job->exitCode = system(command.c_str());
+	}
+
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+/**
+ * Creates @p count entities in a square grid centred on (cx, cz), with the given spacing
+ * in metres, and adds their IDs to @p ents.
+ */
+void SpawnGrid(CSimulation2& sim, const std::wstring& templateName, player_id_t owner,
+	entity_pos_t cx, entity_pos_t cz, size_t count, int spacing, std::vector<entity_id_t>& ents)
+{
+	int cols = (int)ceil(sqrt((double)count));
+	entity_pos_t x0 = cx - entity_pos_t::FromInt((cols - 1) * spacing) / 2;
+	entity_pos_t z0 = cz - entity_pos_t::FromInt((cols - 1) * spacing) / 2;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		entity_id_t ent = sim.AddEntity(templateName);
+		if (ent == INVALID_ENTITY)
+		{
+			LOGERROR(L"Benchmark failed to create entity '%ls'", templateName.c_str());
+			return;
+		}
+
+		CmpPtr<ICmpPosition> cmpPosition(sim, ent);
+		if (cmpPosition)
+			cmpPosition->JumpTo(x0 + entity_pos_t::FromInt(((int)i % cols) * spacing), z0 + entity_pos_t::FromInt(((int)i / cols) * spacing));
+
+		CmpPtr<ICmpOwnership> cmpOwnership(sim, ent);
+		if (cmpOwnership)
+			cmpOwnership->SetOwner(owner);
+
+		ents.push_back(ent);
+	}
+}
+
+std::string EntityList(const std::vector<entity_id_t>& ents, size_t begin, size_t end)
+{
+	std::stringstream str;
+	str << "[";
+	for (size_t i = begin; i < end; ++i)
+		str << (i > begin ? "," : "") << ents[i];
+	str << "]";
+	return str.str();
+}
+
+void AddCommand(CSimulation2& sim, player_id_t player, const std::string& json, std::vector<SimulationCommand>& commands)
+{
+	SimulationCommand cmd = { player, sim.GetScriptInterface().ParseJSON(json) };
+	commands.push_back(cmd);
+}
+
+/**
+ * Sets up the scenario's entities around the centre (cx, cz) of the map,
+ * and returns the commands to run on the first turn.
+ */
+typedef void (*BenchmarkSetup)(CSimulation2& sim, entity_pos_t cx, entity_pos_t cz, float scale, std::vector<SimulationCommand>& commands);
+
+// Two large blocks of infantry next to each other; idle units attack nearby enemies
+// by themselves, so this mostly exercises UnitAI, range queries and unit motion
+void SetupBattle(CSimulation2& sim, entity_pos_t cx, entity_pos_t cz, float scale, std::vector<SimulationCommand>& UNUSED(commands))
+{
+	size_t count = (size_t)(2000 * scale);
+	std::vector<entity_id_t> ents;
+	SpawnGrid(sim, L"units/athen_infantry_spearman_b", 1, cx - entity_pos_t::FromInt(50), cz, count, 2, ents);
+	SpawnGrid(sim, L"units/athen_infantry_spearman_b", 2, cx + entity_pos_t::FromInt(50), cz, count, 2, ents);
+}
+
+// Lots of gatherers cutting trees and returning to a civil centre
+void SetupGatherers(CSimulation2& sim, entity_pos_t cx, entity_pos_t cz, float scale, std::vector<SimulationCommand>& commands)
+{
+	std::vector<entity_id_t> centre;
+	SpawnGrid(sim, L"structures/athen_civil_centre", 1, cx, cz, 1, 0, centre);
+
+	std::vector<entity_id_t> trees;
+	SpawnGrid(sim, L"gaia/flora_tree_oak", 0, cx, cz + entity_pos_t::FromInt(60), std::max((size_t)(200 * scale), (size_t)1), 4, trees);
+
+	std::vector<entity_id_t> gatherers;
+	SpawnGrid(sim, L"units/athen_support_female_citizen", 1, cx, cz - entity_pos_t::FromInt(30), (size_t)(500 * scale), 2, gatherers);
+
+	// Send groups of gatherers to each tree
+	const size_t groupSize = 5;
+	for (size_t i = 0; i < gatherers.size(); i += groupSize)
+	{
+		std::stringstream cmd;
+		cmd << "{\"type\": \"gather\", \"entities\": " << EntityList(gatherers, i, std::min(i + groupSize, gatherers.size()))
+			<< ", \"target\": " << trees[(i / groupSize) % trees.size()] << ", \"queued\": false}";
+		AddCommand(sim, 1, cmd.str(), commands);
+	}
+}
+
+// Cavalry pathing back and forth through rows of walls with gaps in them,
+// which mostly exercises the long- and short-range pathfinders
+void SetupWalls(CSimulation2& sim, entity_pos_t cx, entity_pos_t cz, float scale, std::vector<SimulationCommand>& commands)
+{
+	std::vector<entity_id_t> walls;
+	for (int row = -2; row <= 2; ++row)
+	{
+		entity_pos_t z = cz + entity_pos_t::FromInt(row * 20);
+		// Offset alternate rows so there's no straight path through the gaps
+		entity_pos_t x = cx + entity_pos_t::FromInt((row % 2) * 10);
+		SpawnGrid(sim, L"other/palisades_rocks_long", 0, x, z, 1, 0, walls);
+		for (int segment = 1; segment <= 6; ++segment)
+		{
+			SpawnGrid(sim, L"other/palisades_rocks_long", 0, x - entity_pos_t::FromInt(segment * 16), z, 1, 0, walls);
+			SpawnGrid(sim, L"other/palisades_rocks_long", 0, x + entity_pos_t::FromInt(segment * 16), z, 1, 0, walls);
+		}
+	}
+
+	std::vector<entity_id_t> cavalry;
+	SpawnGrid(sim, L"units/athen_cavalry_swordsman_b", 1, cx, cz - entity_pos_t::FromInt(80), (size_t)(300 * scale), 3, cavalry);
+
+	std::stringstream there;
+	there << "{\"type\": \"walk\", \"entities\": " << EntityList(cavalry, 0, cavalry.size())
+		<< ", \"x\": " << cx.ToDouble() << ", \"z\": " << (cz + entity_pos_t::FromInt(80)).ToDouble() << ", \"queued\": false}";
+	AddCommand(sim, 1, there.str(), commands);
+
+	std::stringstream back;
+	back << "{\"type\": \"walk\", \"entities\": " << EntityList(cavalry, 0, cavalry.size())
+		<< ", \"x\": " << cx.ToDouble() << ", \"z\": " << (cz - entity_pos_t::FromInt(80)).ToDouble() << ", \"queued\": true}";
+	AddCommand(sim, 1, back.str(), commands);
+}
+
+struct SBenchmarkScenario
+{
+	const char* name;
+	BenchmarkSetup setup;
+};
+
+const SBenchmarkScenario g_BenchmarkScenarios[] = {
+	{ "battle", SetupBattle },
+	{ "gatherers", SetupGatherers },
+	{ "walls", SetupWalls },
+};
+
+double Percentile(const std::vector<double>& sorted, double p)
+{
+	if (sorted.empty())
+		return 0.0;
+	return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+} // anonymous namespace
+
+CSimulationBenchmark::CSimulationBenchmark(const std::string& scenario) :
+	m_Scenario(scenario), m_Map(L"Median Oasis"), m_Turns(500), m_Scale(1.f), m_OutputPath("benchmark.json")
+{
+}
+
+std::vector<std::string> CSimulationBenchmark::GetScenarioNames()
+{
+	std::vector<std::string> names;
+	for (size_t i = 0; i < ARRAY_SIZE(g_BenchmarkScenarios); ++i)
+		names.push_back(g_BenchmarkScenarios[i].name);
+	return names;
+}
+
+void CSimulationBenchmark::SetMap(const std::wstring& map)
+{
+	m_Map = map;
+}
+
+void CSimulationBenchmark::SetTurns(u32 turns)
+{
+	m_Turns = turns;
+}
+
+void CSimulationBenchmark::SetScale(float scale)
+{
+	m_Scale = scale;
+}
+
+void CSimulationBenchmark::SetOutputPath(const OsPath& path)
+{
+	m_OutputPath = path;
+}
+
+bool CSimulationBenchmark::Run()
+{
+	BenchmarkSetup setup = NULL;
+	for (size_t i = 0; i < ARRAY_SIZE(g_BenchmarkScenarios); ++i)
+		if (m_Scenario == g_BenchmarkScenarios[i].name)
+			setup = g_BenchmarkScenarios[i].setup;
+	if (!setup)
+	{
+		debug_printf(L"Unrecognised benchmark scenario '%hs'\n", m_Scenario.c_str());
+		return false;
+	}
+
+	new CProfileViewer;
+	new CProfileManager;
+	g_ScriptStatsTable = new CScriptStatsTable;
+	g_ProfileViewer.AddRootTable(g_ScriptStatsTable);
+	g_ScriptComponentStatsTable = new CScriptComponentStatsTable;
+	g_ProfileViewer.AddRootTable(g_ScriptComponentStatsTable);
+
+	CGame game(true);
+	g_Game = &game;
+
+	// Need some stuff for terrain movement costs (as in CReplayPlayer::Replay)
+	tex_codec_register_all();
+	new CTerrainTextureManager;
+	g_TexMan.LoadTerrainTextures();
+	h_mgr_init();
+
+	CSimulation2& sim = *game.GetSimulation2();
+	ScriptInterface& scriptInterface = sim.GetScriptInterface();
+
+	CScriptVal attribs;
+	scriptInterface.Eval("({})", attribs);
+	scriptInterface.SetProperty(attribs.get(), "mapType", std::string("scenario"));
+	scriptInterface.SetProperty(attribs.get(), "map", m_Map);
+	game.StartGame(CScriptValRooted(scriptInterface.GetContext(), attribs), "");
+
+	LDR_NonprogressiveLoad();
+
+	PSRETURN ret = game.ReallyStartGame();
+	ENSURE(ret == PSRETURN_OK);
+
+	// Put the scenario in the middle of the map
+	CmpPtr<ICmpTerrain> cmpTerrain(sim, SYSTEM_ENTITY);
+	ENSURE(cmpTerrain);
+	entity_pos_t centre = entity_pos_t::FromInt(cmpTerrain->GetTilesPerSide() * (int)TERRAIN_TILE_SIZE / 2);
+
+	std::vector<SimulationCommand> commands;
+	setup(sim, centre, centre, m_Scale, commands);
+
+	// Only measure the turns themselves
+	g_ScriptComponentStatsTable->Reset();
+
+	const u32 turnLength = 200;
+	std::vector<double> turnTimes;
+	std::vector<long> turnAllocs;
+	for (u32 turn = 0; turn < m_Turns; ++turn)
+	{
+		g_Profiler2.RecordFrameStart();
+		PROFILE2("frame");
+		g_Profiler2.IncrementFrameNumber();
+		PROFILE2_ATTR("%d", g_Profiler2.GetFrameNumber());
+
+		long startAllocs = CProfileManager::GetMemoryAllocationCount();
+		double startTime = timer_Time();
+		sim.Update(turnLength, commands);
+		turnTimes.push_back(timer_Time() - startTime);
+		turnAllocs.push_back(CProfileManager::GetMemoryAllocationCount() - startAllocs);
+		commands.clear();
+
+		g_Profiler.Frame();
+	}
+
+	g_Profiler2.SaveToFile();
+
+	std::string hash;
+	bool ok = sim.ComputeStateHash(hash, false);
+	ENSURE(ok);
+
+	double totalTime = 0.0;
+	long totalAllocs = 0;
+	for (size_t i = 0; i < turnTimes.size(); ++i)
+	{
+		totalTime += turnTimes[i];
+		totalAllocs += turnAllocs[i];
+	}
+	std::vector<double> sortedTimes = turnTimes;
+	std::sort(sortedTimes.begin(), sortedTimes.end());
+
+	// Times are in milliseconds
+	std::ofstream output(OsString(m_OutputPath).c_str(), std::ofstream::out | std::ofstream::trunc);
+	output << std::fixed << std::setprecision(3);
+	output << "{\"scenario\": \"" << EscapeJSON(m_Scenario) << "\"";
+	output << ", \"map\": \"" << EscapeJSON(utf8_from_wstring(m_Map)) << "\"";
+	output << ", \"scale\": " << m_Scale;
+	output << ", \"turns\": " << m_Turns;
+	output << ", \"final_hash\": \"" << Hexify(hash) << "\"";
+	output << ", \"total_time\": " << totalTime*1000.0;
+	output << ", \"turn_time_p50\": " << Percentile(sortedTimes, 0.50)*1000.0;
+	output << ", \"turn_time_p90\": " << Percentile(sortedTimes, 0.90)*1000.0;
+	output << ", \"turn_time_p99\": " << Percentile(sortedTimes, 0.99)*1000.0;
+	output << ", \"turn_time_max\": " << (sortedTimes.empty() ? 0.0 : sortedTimes.back()*1000.0);
+	output << ", \"allocations\": " << totalAllocs;
+	// (Script components only; the C++ components' time is included in the turn times)
+	output << ", \"components\": {";
+	for (size_t i = 0; i < g_ScriptComponentStatsTable->GetNumberRows(); ++i)
+	{
+		output << (i ? ", " : "") << "\"" << EscapeJSON(g_ScriptComponentStatsTable->GetCellText(i, 0)) << "\": {";
+		output << "\"calls\": " << g_ScriptComponentStatsTable->GetCellText(i, 1);
+		output << ", \"time\": " << g_ScriptComponentStatsTable->GetCellText(i, 2) << "}";
+	}
+	output << "}";
+	output << ", \"turn_times\": [";
+	for (size_t i = 0; i < turnTimes.size(); ++i)
+		output << (i ? ", " : "") << turnTimes[i]*1000.0;
+	output << "]";
+	output << ", \"turn_allocations\": [";
+	for (size_t i = 0; i < turnAllocs.size(); ++i)
+		output << (i ? ", " : "") << turnAllocs[i];
+	output << "]}\n";
+
+	debug_printf(L"# Benchmark '%hs': %u turns in %.3f ms\n", m_Scenario.c_str(), m_Turns, totalTime*1000.0);
+
+	// Clean up
+	delete &g_TexMan;
+	tex_codec_unregister_all();
+
+	SAFE_DELETE(g_ScriptComponentStatsTable);
+
 	delete &g_Profiler;
 	delete &g_ProfileViewer;
 
 	g_Game = NULL;
+
+	return true;
+}
+
+CRenderBenchmark::CRenderBenchmark(const std::wstring& path) :
+	m_Path(path), m_WarmupFrames(50), m_OutputPath("render_benchmark.json"),
+	m_Frame(0), m_Playing(false), m_StartTime(0.0), m_LastFrameTime(0.0)
+{
+}
+
+void CRenderBenchmark::SetWarmupFrames(u32 frames)
+{
+	m_WarmupFrames = frames;
+}
+
+void CRenderBenchmark::SetOutputPath(const OsPath& path)
+{
+	m_OutputPath = path;
+}
+
+bool CRenderBenchmark::Update()
+{
+	// The game must have been started synchronously by -autostart or -autostart-savegame
+	// before the first frame, else we'd wait forever
+	if (!g_Game || !g_Game->IsGameStarted() || !g_Game->GetView())
+	{
+		LOGERROR(L"Render benchmark: no single-player game was started (use -autostart or -autostart-savegame)");
+		return false;
+	}
+
+	CCinemaManager* cinema = g_Game->GetView()->GetCinema();
+
+	if (!m_Playing)
+	{
+		if (m_Frame == 0)
+		{
+			if (!cinema->HasTrack(m_Path))
+			{
+				LOGERROR(L"Render benchmark: the map has no cinema path called '%ls'", m_Path.c_str());
+				return false;
+			}
+			g_Profiler2.EnableGPU();
+		}
+
+		if (m_Frame++ < m_WarmupFrames)
+			return true;
+
+		cinema->OverridePath(m_Path);
+		g_Profiler2.ResetGPURegionAverages();
+		m_Playing = true;
+		m_StartTime = m_LastFrameTime = timer_Time();
+		return true;
+	}
+
+	double time = timer_Time();
+	m_FrameTimes.push_back(time - m_LastFrameTime);
+	m_LastFrameTime = time;
+
+	const CRenderer::Stats& stats = g_Renderer.GetStats();
+	m_DrawCalls.push_back(stats.m_DrawCalls);
+	m_Triangles.push_back(stats.m_TerrainTris + stats.m_WaterTris + stats.m_ModelTris + stats.m_OverlayTris);
+
+	if (cinema->IsPlaying())
+		return true;
+
+	WriteResults();
+	return false;
+}
+
+void CRenderBenchmark::WriteResults()
+{
+	std::vector<double> sortedTimes = m_FrameTimes;
+	std::sort(sortedTimes.begin(), sortedTimes.end());
+
+	double totalDrawCalls = 0.0;
+	double totalTriangles = 0.0;
+	for (size_t i = 0; i < m_FrameTimes.size(); ++i)
+	{
+		totalDrawCalls += m_DrawCalls[i];
+		totalTriangles += m_Triangles[i];
+	}
+	const double frames = std::max((double)m_FrameTimes.size(), 1.0);
+
+	std::vector<std::pair<std::string, double> > gpuTimes;
+	g_Profiler2.GetGPURegionAverages(gpuTimes);
+
+	// Times are in milliseconds
+	std::ofstream output(OsString(m_OutputPath).c_str(), std::ofstream::out | std::ofstream::trunc);
+	output << std::fixed << std::setprecision(3);
+	output << "{\"path\": \"" << EscapeJSON(utf8_from_wstring(m_Path)) << "\"";
+	output << ", \"resolution\": [" << g_Renderer.GetWidth() << ", " << g_Renderer.GetHeight() << "]";
+	output << ", \"frames\": " << m_FrameTimes.size();
+	output << ", \"total_time\": " << (m_LastFrameTime - m_StartTime)*1000.0;
+	output << ", \"frame_time_p50\": " << Percentile(sortedTimes, 0.50)*1000.0;
+	output << ", \"frame_time_p90\": " << Percentile(sortedTimes, 0.90)*1000.0;
+	output << ", \"frame_time_p99\": " << Percentile(sortedTimes, 0.99)*1000.0;
+	output << ", \"frame_time_max\": " << (sortedTimes.empty() ? 0.0 : sortedTimes.back()*1000.0);
+	output << ", \"draw_calls\": " << totalDrawCalls / frames;
+	output << ", \"triangles\": " << totalTriangles / frames;
+	// (Empty if the GPU timer queries aren't supported or enabled)
+	output << ", \"gpu\": {";
+	for (size_t i = 0; i < gpuTimes.size(); ++i)
+		output << (i ? ", " : "") << "\"" << EscapeJSON(gpuTimes[i].first) << "\": " << gpuTimes[i].second*1000.0;
+	output << "}";
+	output << ", \"frame_times\": [";
+	for (size_t i = 0; i < m_FrameTimes.size(); ++i)
+		output << (i ? ", " : "") << m_FrameTimes[i]*1000.0;
+	output << "]";
+	output << ", \"frame_draw_calls\": [";
+	for (size_t i = 0; i < m_DrawCalls.size(); ++i)
+		output << (i ? ", " : "") << m_DrawCalls[i];
+	output << "]";
+	output << ", \"frame_triangles\": [";
+	for (size_t i = 0; i < m_Triangles.size(); ++i)
+		output << (i ? ", " : "") << m_Triangles[i];
+	output << "]}\n";
+
+	debug_printf(L"# Render benchmark '%ls': %lu frames in %.3f ms\n", m_Path.c_str(), (unsigned long)m_FrameTimes.size(), (m_LastFrameTime - m_StartTime)*1000.0);
 }
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -18,6 +18,9 @@
 #ifndef INCLUDED_REPLAY
 #define INCLUDED_REPLAY
 
+#include "lib/os_path.h"
+#include "ps/ThreadUtil.h"
+
 class CScriptValRooted;
 struct SimulationCommand;
 class ScriptInterface;
@@ -80,6 +83,10 @@ private:
 
 /**
  * Replay log replayer. Runs the log with no graphics and dumps some info to stdout.
+ *
+ * It can also save keyframes (the serialized simulation state at regular intervals)
+ * next to the log, so that later replays of the same log (with the same version
+ * of the game) can start from any turn without simulating everything before it.
  */
 class CReplayPlayer
 {
@@ -88,10 +95,193 @@ public:
 	~CReplayPlayer();
 
 	void Load(const std::string& path);
+
+	/**
+	 * Save a keyframe every @p turns turns while replaying (0 to disable, the default).
+	 */
+	void SetKeyframeInterval(u32 turns);
+
+	/**
+	 * Start the replay (with its profiling, hash checks, etc) at the given turn.
+	 * The game is loaded from the latest keyframe at or before that turn, if there is one,
+	 * and fast-forwarded from there.
+	 */
+	void SetStartTurn(u32 turn);
+
+	/**
+	 * Compare the state hash against the log every @p turns turns (0 to disable; default 100).
+	 * The log may not contain a hash for every turn, in which case the ones between are skipped.
+	 */
+	void SetHashInterval(u32 turns);
+
+	/**
+	 * Write a JSON summary of the replay (turn timings, hashes, the first mismatching turn)
+	 * to the given file once it has finished.
+	 */
+	void SetSummaryPath(const OsPath& path);
+
 	void Replay();
 
 private:
+	OsPath GetKeyframePath(u32 turn) const;
+
+	/**
+	 * Returns the turn of the latest keyframe at or before @p maxTurn, or 0 if there's none.
+	 */
+	u32 FindKeyframe(u32 maxTurn) const;
+
 	std::istream* m_Stream;
+	OsPath m_Path;
+	OsPath m_SummaryPath;
+	u32 m_KeyframeInterval;
+	u32 m_StartTurn;
+	u32 m_HashInterval;
+};
+
+/**
+ * Verifies a batch of replay logs, running several of them concurrently.
+ *
+ * Each replay is run in a separate process (this executable with the "-replay" option),
+ * since the simulation relies on engine-wide state (g_Game, the VFS, interned strings,
+ * the profilers) that can't be shared between concurrent games. The per-replay summaries
+ * are collected into a single JSON file.
+ */
+class CReplayBatch
+{
+public:
+	/**
+	 * @param directory contains the logs to replay, as commands.txt in it or in any
+	 * of its subdirectories (i.e. like the sim_log directory)
+	 * @param numJobs maximum number of replays to run at once
+	 */
+	CReplayBatch(const OsPath& directory, size_t numJobs);
+
+	/**
+	 * Runs all the replays, and writes their summaries to @p summaryPath.
+	 * @return number of replays that failed (crashed or had mismatching hashes)
+	 */
+	size_t Run(const OsPath& summaryPath);
+
+private:
+	struct SJob
+	{
+		OsPath path;
+		OsPath summaryPath;
+		OsPath outputPath;
+		int exitCode;
+	};
+
+	static void* RunThread(void* data);
+
+	OsPath m_Directory;
+	size_t m_NumJobs;
+
+	std::vector<SJob> m_Jobs;
+	CMutex m_Mutex;
+	size_t m_NextJob; // protected by m_Mutex
+};
+
+/**
+ * Simulation throughput benchmark. Loads a map with no graphics, populates it with
+ * one of a set of canned stress scenarios (a large battle, mass gathering, units
+ * pathing through lots of walls), runs a fixed number of turns and writes the timings
+ * (per-turn percentiles, allocations, time spent in each script component) as JSON,
+ * so that runs from different versions of the game can be compared.
+ */
+class CSimulationBenchmark
+{
+public:
+	/**
+	 * @param scenario name of the scenario (see GetScenarioNames)
+	 */
+	CSimulationBenchmark(const std::string& scenario);
+
+	static std::vector<std::string> GetScenarioNames();
+
+	/**
+	 * Set the scenario map (from maps/scenarios/, without the extension; default "Median Oasis").
+	 * It should have at least two players.
+	 */
+	void SetMap(const std::wstring& map);
+
+	/**
+	 * Set the number of turns to simulate (default 500).
+	 */
+	void SetTurns(u32 turns);
+
+	/**
+	 * Multiply the number of entities the scenario creates by @p scale (default 1).
+	 */
+	void SetScale(float scale);
+
+	/**
+	 * Set the file to write the results to (default benchmark.json).
+	 */
+	void SetOutputPath(const OsPath& path);
+
+	/**
+	 * @return false if the scenario is not recognised
+	 */
+	bool Run();
+
+private:
+	std::string m_Scenario;
+	std::wstring m_Map;
+	u32 m_Turns;
+	float m_Scale;
+	OsPath m_OutputPath;
+};
+
+/**
+ * Rendering benchmark. When the game (started from the command line with a map
+ * or a saved game) has finished loading, it plays one of the map's cinema paths,
+ * recording every frame, and when the path ends writes the frame time percentiles,
+ * the draw calls and triangles per frame (from CRenderer::Stats) and the average
+ * GPU time of each profiled pass (if GPU timer queries are available) as JSON.
+ *
+ * Unlike CSimulationBenchmark it runs inside the normal game loop, which must
+ * call Update once per frame after rendering.
+ */
+class CRenderBenchmark
+{
+public:
+	/**
+	 * @param path name of the cinema path to play
+	 */
+	CRenderBenchmark(const std::wstring& path);
+
+	/**
+	 * Set the number of frames to render after loading before the path starts
+	 * playing (default 50), so that shader compilation and texture loading
+	 * don't show up in the results.
+	 */
+	void SetWarmupFrames(u32 frames);
+
+	/**
+	 * Set the file to write the results to (default render_benchmark.json).
+	 */
+	void SetOutputPath(const OsPath& path);
+
+	/**
+	 * @return false when the benchmark has finished (or failed) and the game should quit
+	 */
+	bool Update();
+
+private:
+	void WriteResults();
+
+	std::wstring m_Path;
+	u32 m_WarmupFrames;
+	OsPath m_OutputPath;
+
+	u32 m_Frame; // number of frames seen since the game started
+	bool m_Playing;
+	double m_StartTime;
+	double m_LastFrameTime;
+
+	std::vector<double> m_FrameTimes;
+	std::vector<size_t> m_DrawCalls;
+	std::vector<size_t> m_Triangles;
 };
 
 #endif // INCLUDED_REPLAY
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -22,15 +22,102 @@
 #include "gui/GUIManager.h"
 #include "lib/allocators/shared_ptr.h"
 #include "lib/file/archive/archive_zip.h"
+#include "lib/file/io/io.h"
+#include "lib/file/io/write_buffer.h"
+#include "lib/sysdep/filesystem.h"
 #include "ps/CLogger.h"
+#include "ps/CStr.h"
 #include "ps/Filesystem.h"
+#include "ps/ThreadPool.h"
 #include "scriptinterface/ScriptInterface.h"
 #include "simulation2/Simulation2.h"
 
-static const int SAVED_GAME_VERSION_MAJOR = 1; // increment on incompatible changes to the format
+static const int SAVED_GAME_VERSION_MAJOR = 4; // increment on incompatible changes to the format
 static const int SAVED_GAME_VERSION_MINOR = 0; // increment on compatible changes to the format
 // TODO: we ought to check version numbers when loading files
 
+/**
+ * Snapshot of a game being saved, which is compressed and written to disk
+ * on a worker thread so that the game doesn't freeze while saving.
+ */
+struct SaveJob
+{
+	VfsPath filename;
+	OsPath tempSaveFileRealPath;
+	time_t time;
+	std::string metadata;
+	std::string simState;
+
+	// Results of the task
+	Status status;
+	WriteBuffer archive;
+
+	CThreadPool::TaskGroup task;
+};
+
+// Saves whose archives are being written, oldest first. (Only used by the main thread)
+static std::deque<shared_ptr<SaveJob> > g_PendingSaves;
+
+// Used to give each pending save its own temporary file
+static size_t g_NextTempSaveNumber = 0;
+
+// Builds the zip archive. This runs on a worker thread, so it mustn't use
+// the VFS or report errors itself (SavedGames::Poll will report them)
+static Status WriteArchive(SaveJob& job)
+{
+	// ArchiveWriter_Zip can only write to OsPaths, not VfsPaths,
+	// but we'd like to handle saved games via VFS.
+	// To avoid potential confusion from writing with non-VFS then
+	// reading the same file with VFS, we'll just write to a temporary
+	// non-VFS path and then load it and (on the main thread) save
+	// again via VFS, which is kind of a hack.
+
+	// Write the saved game as zip file containing the various components
+	PIArchiveWriter archiveWriter = CreateArchiveWriter_Zip(job.tempSaveFileRealPath, false);
+	if (!archiveWriter)
+		return ERR::FAIL;
+
+	RETURN_STATUS_IF_ERR(archiveWriter->AddMemory((const u8*)job.metadata.c_str(), job.metadata.length(), job.time, "metadata.json"));
+	RETURN_STATUS_IF_ERR(archiveWriter->AddMemory((const u8*)job.simState.data(), job.simState.length(), job.time, "simulation.dat"));
+	archiveWriter.reset(); // close the file
+
+	// Free the (possibly large) state as soon as possible
+	std::string().swap(job.simState);
+
+	FileInfo tempSaveFile;
+	RETURN_STATUS_IF_ERR(GetFileInfo(job.tempSaveFileRealPath, &tempSaveFile));
+	job.archive.Reserve(tempSaveFile.Size());
+	RETURN_STATUS_IF_ERR(io::Load(job.tempSaveFileRealPath, job.archive.Data().get(), job.archive.Size()));
+
+	wunlink(job.tempSaveFileRealPath);
+
+	return INFO::OK;
+}
+
+static void RunSaveTask(void* data)
+{
+	SaveJob* job = static_cast<SaveJob*>(data);
+	job->status = WriteArchive(*job);
+}
+
+// Finishes a save whose task has completed
+static void FinishSave(const SaveJob& job)
+{
+	if (job.status < 0 || g_VFS->CreateFile(job.filename, job.archive.Data(), job.archive.Size()) < 0)
+	{
+		LOGERROR(L"Failed to save game to '%ls'", job.filename.string().c_str());
+		return;
+	}
+
+	OsPath realPath;
+	if (g_VFS->GetRealPath(job.filename, realPath) == INFO::OK)
+		LOGMESSAGERENDER(L"Saved game to %ls\n", realPath.string().c_str());
+
+	// Let the GUI know, e.g. to update its list of saved games
+	if (g_GUI)
+		g_GUI->SendEventToAll("SavedGameWritten");
+}
+
 Status SavedGames::Save(const std::wstring& prefix, CSimulation2& simulation, CGUIManager* gui, int playerID)
 {
 	// Determine the filename to save under
@@ -39,34 +126,38 @@ Status SavedGames::Save(const std::wstring& prefix, CSimulation2& simulation, CG
 	VfsPath filename;
 
 	// Don't make this a static global like NextNumberedFilename expects, because
-	// that wouldn't work when 'prefix' changes, and because it's not thread-safe
+	// that wouldn't work when 'prefix' changes, and because it's not thread-safe.
+	// (Skip the names of saves that haven't been written to the VFS yet)
 	size_t nextSaveNumber = 0;
-	vfs::NextNumberedFilename(g_VFS, filenameFormat, nextSaveNumber, filename);
-
-	// ArchiveWriter_Zip can only write to OsPaths, not VfsPaths,
-	// but we'd like to handle saved games via VFS.
-	// To avoid potential confusion from writing with non-VFS then
-	// reading the same file with VFS, we'll just write to a temporary
-	// non-VFS path and then load and save again via VFS,
-	// which is kind of a hack.
+	bool pending;
+	do
+	{
+		vfs::NextNumberedFilename(g_VFS, filenameFormat, nextSaveNumber, filename);
+		pending = false;
+		for (size_t i = 0; i < g_PendingSaves.size(); ++i)
+			if (g_PendingSaves[i]->filename == filename)
+				pending = true;
+	}
+	while (pending);
 
-	OsPath tempSaveFileRealPath;
-	WARN_RETURN_STATUS_IF_ERR(g_VFS->GetDirectoryRealPath("cache/", tempSaveFileRealPath));
-	tempSaveFileRealPath = tempSaveFileRealPath / "temp.0adsave";
+	shared_ptr<SaveJob> job(new SaveJob);
+	job->filename = filename;
+	job->time = time(NULL);
 
-	time_t now = time(NULL);
+	WARN_RETURN_STATUS_IF_ERR(g_VFS->GetDirectoryRealPath("cache/", job->tempSaveFileRealPath));
+	job->tempSaveFileRealPath = job->tempSaveFileRealPath / (L"temp-" + CStrW::FromUInt(g_NextTempSaveNumber++) + L".0adsave");
 
-	// Construct the serialized state to be saved
+	// Construct the serialized state to be saved. This is the only part
+	// that needs the simulation, so it's done synchronously
 
-	std::stringstream simStateStream;
-	if (!simulation.SerializeState(simStateStream))
+	if (!simulation.SerializeState(job->simState))
 		WARN_RETURN(ERR::FAIL);
 
 	CScriptValRooted metadata;
 	simulation.GetScriptInterface().Eval("({})", metadata);
 	simulation.GetScriptInterface().SetProperty(metadata.get(), "version_major", SAVED_GAME_VERSION_MAJOR);
 	simulation.GetScriptInterface().SetProperty(metadata.get(), "version_minor", SAVED_GAME_VERSION_MINOR);
-	simulation.GetScriptInterface().SetProperty(metadata.get(), "time", (double)now);
+	simulation.GetScriptInterface().SetProperty(metadata.get(), "time", (double)job->time);
 	simulation.GetScriptInterface().SetProperty(metadata.get(), "player", playerID);
 	simulation.GetScriptInterface().SetProperty(metadata.get(), "initAttributes", simulation.GetInitAttributes());
 	if (gui)
@@ -74,32 +165,43 @@ Status SavedGames::Save(const std::wstring& prefix, CSimulation2& simulation, CG
 		CScriptVal guiMetadata = simulation.GetScriptInterface().CloneValueFromOtherContext(gui->GetScriptInterface(), gui->GetSavedGameData().get());
 		simulation.GetScriptInterface().SetProperty(metadata.get(), "gui", guiMetadata);
 	}
-	
-	std::string metadataString = simulation.GetScriptInterface().StringifyJSON(metadata.get(), true);
-	
-	// Write the saved game as zip file containing the various components
-	PIArchiveWriter archiveWriter = CreateArchiveWriter_Zip(tempSaveFileRealPath, false);
-	if (!archiveWriter)
-		WARN_RETURN(ERR::FAIL);
 
-	WARN_RETURN_STATUS_IF_ERR(archiveWriter->AddMemory((const u8*)metadataString.c_str(), metadataString.length(), now, "metadata.json"));
-	WARN_RETURN_STATUS_IF_ERR(archiveWriter->AddMemory((const u8*)simStateStream.str().c_str(), simStateStream.str().length(), now, "simulation.dat"));
-	archiveWriter.reset(); // close the file
+	job->metadata = simulation.GetScriptInterface().StringifyJSON(metadata.get(), true);
 
-	WriteBuffer buffer;
-	FileInfo tempSaveFile;
-	WARN_RETURN_STATUS_IF_ERR(GetFileInfo(tempSaveFileRealPath, &tempSaveFile));
-	buffer.Reserve(tempSaveFile.Size());
-	WARN_RETURN_STATUS_IF_ERR(io::Load(tempSaveFileRealPath, buffer.Data().get(), buffer.Size()));
-	WARN_RETURN_STATUS_IF_ERR(g_VFS->CreateFile(filename, buffer.Data(), buffer.Size()));
+	// Compress and write the archive in the background if possible,
+	// else just do it now
+	g_PendingSaves.push_back(job);
+	if (g_ThreadPool)
+		g_ThreadPool->Submit(&RunSaveTask, job.get(), &job->task);
+	else
+		RunSaveTask(job.get());
 
-	OsPath realPath;
-	WARN_RETURN_STATUS_IF_ERR(g_VFS->GetRealPath(filename, realPath));
-	LOGMESSAGERENDER(L"Saved game to %ls\n", realPath.string().c_str());
+	Poll();
 
 	return INFO::OK;
 }
 
+void SavedGames::Poll()
+{
+	// Finish the saves in the order they were started
+	while (!g_PendingSaves.empty() && g_PendingSaves.front()->task.IsDone())
+	{
+		shared_ptr<SaveJob> job = g_PendingSaves.front();
+		g_PendingSaves.pop_front();
+		FinishSave(*job);
+	}
+}
+
+void SavedGames::Flush()
+{
+	while (!g_PendingSaves.empty())
+	{
+		if (g_ThreadPool)
+			g_ThreadPool->Wait(g_PendingSaves.front()->task);
+		Poll();
+	}
+}
+
 /**
  * Helper class for retrieving data from saved game archives
  */
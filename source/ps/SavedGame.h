@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -39,16 +39,30 @@ namespace SavedGames
 {
 
 /**
- * Create new saved game archive with given prefix and simulation data
+ * Create new saved game archive with given prefix and simulation data.
+ * The game state is captured immediately, but the archive is compressed and
+ * written in the background; Poll will send a "SavedGameWritten" event to the
+ * GUI once the file exists.
  *
  * @param prefix Create new numbered file starting with this prefix
  * @param simulation
  * @param gui if not NULL, store some UI-related data with the saved game
  * @param playerID ID of the player who saved this file
- * @return INFO::OK if successfully saved, else an error Status
+ * @return INFO::OK if the state was successfully captured, else an error Status
  */
 Status Save(const std::wstring& prefix, CSimulation2& simulation, CGUIManager* gui, int playerID);
 
+/**
+ * Finishes writing any saved games whose archives have been compressed.
+ * Should be called once per frame.
+ */
+void Poll();
+
+/**
+ * Blocks until all the pending saved games have been written (e.g. before shutdown).
+ */
+void Flush();
+
 /**
  * Load saved game archive with the given name
  *
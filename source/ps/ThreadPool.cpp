@@ -0,0 +1,258 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "precompiled.h"
+
+#include "ThreadPool.h"
+
+#include "lib/sysdep/cpu.h"
+#include "ps/CStr.h"
+#include "ps/Profiler2.h"
+
+CThreadPool* g_ThreadPool = NULL;
+
+bool CThreadPool::TaskGroup::IsDone() const
+{
+	// Use an atomic operation rather than a plain read, so that everything the
+	// tasks wrote is visible to us once we see they've finished
+	return cpu_AtomicAdd(const_cast<volatile intptr_t*>(&m_Pending), 0) == 0;
+}
+
+CThreadPool::CThreadPool(size_t numWorkers) :
+	m_NextQueueIndex(0), m_Shutdown(false)
+{
+	int ret = pthread_key_create(&m_QueueIndexTLS, NULL);
+	ENSURE(ret == 0);
+
+	m_TaskSem = SDL_CreateSemaphore(0);
+	ENSURE(m_TaskSem);
+
+	for (size_t i = 0; i < numWorkers + 1; ++i)
+		m_Queues.push_back(new TaskQueue());
+
+	m_Workers.resize(numWorkers);
+	for (size_t i = 0; i < numWorkers; ++i)
+	{
+		ret = pthread_create(&m_Workers[i], NULL, &RunThread, this);
+		ENSURE(ret == 0);
+	}
+}
+
+CThreadPool::~CThreadPool()
+{
+	// Tell the threads to shut down, and wake them all up so they see the notification
+	m_Shutdown = true;
+	for (size_t i = 0; i < m_Workers.size(); ++i)
+		SDL_SemPost(m_TaskSem);
+
+	// Wait for them to shut down cleanly
+	for (size_t i = 0; i < m_Workers.size(); ++i)
+		pthread_join(m_Workers[i], NULL);
+
+	// Finish off anything that's still queued, since the submitters may be relying on it
+	while (RunQueuedTask(0))
+	{
+	}
+
+	for (size_t i = 0; i < m_Queues.size(); ++i)
+		delete m_Queues[i];
+
+	SDL_DestroySemaphore(m_TaskSem);
+	pthread_key_delete(m_QueueIndexTLS);
+}
+
+void CThreadPool::Submit(TaskFunc func, void* cbdata, TaskGroup* group)
+{
+	Task task = { func, cbdata, group };
+
+	// Count the task before it can possibly finish
+	if (group)
+		cpu_AtomicAdd(&group->m_Pending, 1);
+
+	TaskQueue& queue = *m_Queues[GetCurrentQueue()];
+	{
+		CScopeLock lock(queue.mutex);
+		queue.tasks.push_back(task);
+	}
+
+	SDL_SemPost(m_TaskSem);
+}
+
+void CThreadPool::Wait(TaskGroup& group)
+{
+	size_t own = GetCurrentQueue();
+	while (!group.IsDone())
+	{
+		// Make ourselves useful while waiting; if there's nothing else queued,
+		// our tasks must be running on other threads already
+		if (!RunQueuedTask(own))
+			SDL_Delay(0);
+	}
+}
+
+void CThreadPool::ParallelFor(size_t count, size_t chunkSize, JobFunc func, void* cbdata)
+{
+	if (count == 0)
+		return;
+
+	ENSURE(chunkSize > 0);
+
+	// Only ask for as many helpers as there are chunks for them to take
+	size_t numChunks = (count + chunkSize - 1) / chunkSize;
+	size_t numHelpers = std::min(m_Workers.size(), numChunks - 1);
+	if (numHelpers == 0)
+	{
+		func(cbdata, 0, count);
+		return;
+	}
+
+	ParallelForJob* job = new ParallelForJob;
+	job->func = func;
+	job->cbdata = cbdata;
+	job->count = count;
+	job->chunkSize = chunkSize;
+	job->nextChunk = 0;
+	job->finishedItems = 0;
+	job->refs = numHelpers + 1;
+
+	for (size_t i = 0; i < numHelpers; ++i)
+		Submit(&RunParallelForTask, job);
+
+	// Process chunks on this thread too, then wait for any chunks that other
+	// threads are still working on. (Helpers that don't start until the end
+	// won't find any chunks left, so we don't need to wait for them to run.)
+	// Don't run any unrelated tasks here, since they might take much longer
+	// than the rest of this job.
+	RunParallelForChunks(job);
+	while ((size_t)cpu_AtomicAdd(&job->finishedItems, 0) < count)
+		SDL_Delay(0);
+	ReleaseParallelForJob(job);
+}
+
+void CThreadPool::RunParallelForTask(void* cbdata)
+{
+	ParallelForJob* job = static_cast<ParallelForJob*>(cbdata);
+	RunParallelForChunks(job);
+	ReleaseParallelForJob(job);
+}
+
+void CThreadPool::RunParallelForChunks(ParallelForJob* job)
+{
+	while (true)
+	{
+		size_t begin = (size_t)cpu_AtomicAdd(&job->nextChunk, 1) * job->chunkSize;
+		if (begin >= job->count)
+			break;
+
+		size_t end = std::min(begin + job->chunkSize, job->count);
+		job->func(job->cbdata, begin, end);
+		cpu_AtomicAdd(&job->finishedItems, (intptr_t)(end - begin));
+	}
+}
+
+void CThreadPool::ReleaseParallelForJob(ParallelForJob* job)
+{
+	if (cpu_AtomicAdd(&job->refs, -1) == 1)
+		delete job;
+}
+
+size_t CThreadPool::GetCurrentQueue() const
+{
+	return (size_t)(uintptr_t)pthread_getspecific(m_QueueIndexTLS);
+}
+
+bool CThreadPool::RunQueuedTask(size_t own)
+{
+	Task task;
+	bool found = false;
+
+	// Our own newest task first, since its data is most likely to still be in the cache
+	if (own != 0)
+	{
+		TaskQueue& queue = *m_Queues[own];
+		CScopeLock lock(queue.mutex);
+		if (!queue.tasks.empty())
+		{
+			task = queue.tasks.back();
+			queue.tasks.pop_back();
+			found = true;
+		}
+	}
+
+	// Then the oldest task from the shared queue, or stolen from another worker,
+	// starting from our neighbour so the workers don't all pick on the same victim
+	for (size_t i = 0; i < m_Queues.size() && !found; ++i)
+	{
+		size_t victim = (i == 0 ? 0 : (own + i - 1) % (m_Queues.size() - 1) + 1);
+		if (victim == own && own != 0) // (already checked our own queue above)
+			continue;
+
+		TaskQueue& queue = *m_Queues[victim];
+		CScopeLock lock(queue.mutex);
+		if (!queue.tasks.empty())
+		{
+			task = queue.tasks.front();
+			queue.tasks.pop_front();
+			found = true;
+		}
+	}
+
+	if (!found)
+		return false;
+
+	RunTask(task);
+	return true;
+}
+
+void CThreadPool::RunTask(const Task& task)
+{
+	task.func(task.cbdata);
+
+	if (task.group)
+		cpu_AtomicAdd(&task.group->m_Pending, -1);
+}
+
+void* CThreadPool::RunThread(void* data)
+{
+	CThreadPool* pool = static_cast<CThreadPool*>(data);
+
+	size_t own = (size_t)cpu_AtomicAdd(&pool->m_NextQueueIndex, 1) + 1;
+	int ret = pthread_setspecific(pool->m_QueueIndexTLS, (void*)(uintptr_t)own);
+	ENSURE(ret == 0);
+
+	debug_SetThreadName("ThreadPool");
+	g_Profiler2.RegisterCurrentThread("worker " + CStr::FromInt((int)own));
+
+	// Sleep until there's a task
+	while (SDL_SemWait(pool->m_TaskSem) == 0)
+	{
+		if (pool->m_Shutdown)
+			break;
+
+		g_Profiler2.RecordSyncMarker();
+
+		// Keep going until every queue is empty, so that a task can't get
+		// stuck in a queue we'd already searched while another worker consumed
+		// the wakeup that was meant for it
+		while (pool->RunQueuedTask(own))
+		{
+		}
+	}
+
+	return NULL;
+}
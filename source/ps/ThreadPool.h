@@ -0,0 +1,186 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef INCLUDED_THREADPOOL
+#define INCLUDED_THREADPOOL
+
+#include "lib/posix/posix_pthread.h"
+#include "lib/external_libraries/libsdl.h"
+#include "ps/ThreadUtil.h"
+
+#include <deque>
+
+/**
+ * Work-stealing task scheduler, shared by the whole engine so that subsystems
+ * don't each need to create (and mostly leave idle) their own threads.
+ *
+ * Tasks are short-lived function calls submitted with Submit. Each worker thread
+ * has its own queue: tasks submitted from a worker go onto its own queue and are run
+ * newest-first, to keep their data in that core's cache, and idle workers steal the
+ * oldest tasks from the other queues. Tasks submitted from any other thread go onto
+ * a shared queue.
+ *
+ * Tasks mustn't block waiting for anything other than tasks they've submitted
+ * themselves (with Wait), since they'd be holding up a worker thread.
+ * Long-running threads that spend most of their time blocked (network, sound, etc)
+ * should keep using their own threads.
+ *
+ * ParallelFor and Wait run queued tasks while they're waiting, so they can
+ * safely be called from inside tasks too.
+ */
+class CThreadPool
+{
+	NONCOPYABLE(CThreadPool);
+
+public:
+	/**
+	 * Function run by a task.
+	 */
+	typedef void (*TaskFunc)(void* cbdata);
+
+	/**
+	 * Callback for processing the items [begin, end) of a ParallelFor.
+	 * This will be called concurrently from several threads.
+	 */
+	typedef void (*JobFunc)(void* cbdata, size_t begin, size_t end);
+
+	/**
+	 * Set of submitted tasks that can be waited for together.
+	 * It mustn't be destroyed while any of its tasks are still pending.
+	 */
+	class TaskGroup
+	{
+		NONCOPYABLE(TaskGroup);
+		friend class CThreadPool;
+
+	public:
+		TaskGroup() : m_Pending(0) { }
+		~TaskGroup() { ENSURE(m_Pending == 0); }
+
+		/**
+		 * Returns whether all the tasks in this group have finished.
+		 */
+		bool IsDone() const;
+
+	private:
+		volatile intptr_t m_Pending;
+	};
+
+	/**
+	 * @param numWorkers number of threads to create.
+	 * If zero, tasks only run when something waits for them (or when the pool is destroyed).
+	 */
+	CThreadPool(size_t numWorkers);
+	~CThreadPool();
+
+	size_t GetNumWorkers() const { return m_Workers.size(); }
+
+	/**
+	 * Queues a call to @p func(@p cbdata) on one of the worker threads.
+	 * @param group if not NULL, the task is added to this group, to allow waiting for it.
+	 */
+	void Submit(TaskFunc func, void* cbdata, TaskGroup* group = NULL);
+
+	/**
+	 * Blocks until every task in @p group has finished, running other queued tasks
+	 * on the calling thread in the meantime.
+	 */
+	void Wait(TaskGroup& group);
+
+	/**
+	 * Runs @p func over the items [0, count), split into chunks of up to
+	 * @p chunkSize items, and waits for it to finish.
+	 * The calling thread does its share of the work too, so jobs can safely use
+	 * data on the caller's stack.
+	 */
+	void ParallelFor(size_t count, size_t chunkSize, JobFunc func, void* cbdata);
+
+private:
+	struct Task
+	{
+		TaskFunc func;
+		void* cbdata;
+		TaskGroup* group;
+	};
+
+	struct TaskQueue
+	{
+		CMutex mutex;
+		std::deque<Task> tasks; // protected by mutex
+	};
+
+	// State shared by the threads working on a ParallelFor. This is allocated on the heap,
+	// since helper tasks might only start after ParallelFor has returned, and whichever
+	// thread releases the last reference deletes it
+	struct ParallelForJob
+	{
+		JobFunc func;
+		void* cbdata;
+		size_t count;
+		size_t chunkSize;
+		volatile intptr_t nextChunk;
+		volatile intptr_t finishedItems;
+		volatile intptr_t refs;
+	};
+
+	static void* RunThread(void* data);
+	static void RunParallelForTask(void* cbdata);
+	static void RunParallelForChunks(ParallelForJob* job);
+	static void ReleaseParallelForJob(ParallelForJob* job);
+
+	/**
+	 * Returns the index in m_Queues of the calling thread's own queue
+	 * (i.e. the shared queue if it's not a worker).
+	 */
+	size_t GetCurrentQueue() const;
+
+	/**
+	 * Runs a single queued task, preferring the newest task from queue @p own,
+	 * then the shared queue, then the oldest task from any other queue.
+	 * @return false if there wasn't any queued task
+	 */
+	bool RunQueuedTask(size_t own);
+
+	static void RunTask(const Task& task);
+
+	std::vector<pthread_t> m_Workers;
+
+	// The shared queue at index 0, then one queue per worker
+	std::vector<TaskQueue*> m_Queues;
+
+	// Thread-local index of each worker's queue (0 for non-worker threads)
+	pthread_key_t m_QueueIndexTLS;
+
+	// Posted once for every submitted task, to wake up a sleeping worker.
+	// (Use SDL semaphores since OS X doesn't implement sem_init)
+	SDL_sem* m_TaskSem;
+
+	// Count of workers that have started, to give each one its own queue
+	volatile intptr_t m_NextQueueIndex;
+
+	bool m_Shutdown;
+};
+
+/**
+ * The engine's shared thread pool.
+ * This is NULL if the engine hasn't been initialised (e.g. in tests),
+ * in which case callers should run their work serially.
+ */
+extern CThreadPool* g_ThreadPool;
+
+#endif // INCLUDED_THREADPOOL
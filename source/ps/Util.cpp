@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -40,6 +40,7 @@
 #include "ps/Game.h"
 #include "ps/CLogger.h"
 #include "ps/Filesystem.h"
+#include "ps/ThreadPool.h"
 #include "ps/VideoMode.h"
 #include "renderer/Renderer.h"
 #include "maths/MathUtil.h"
@@ -193,6 +194,136 @@ Status tex_write(Tex* t, const VfsPath& filename)
 
 static size_t s_nextScreenshotNumber;
 
+/**
+ * Screenshot being read back from the GPU (if pbo is non-zero), then encoded
+ * on a worker thread, so that taking screenshots doesn't freeze the game.
+ */
+struct ScreenshotJob
+{
+	ScreenshotJob() : pbo(0), waitedFrame(false), status(INFO::OK) { }
+
+	VfsPath filename;
+	Tex t;
+
+	// Pixel buffer object the image is being read back into. It's mapped once
+	// a frame has passed, by which time the transfer should be complete
+	GLuint pbo;
+	bool waitedFrame;
+
+	// Results of the task
+	Status status;
+	DynArray encoded;
+
+	CThreadPool::TaskGroup task;
+};
+
+// Screenshots waiting to be read back or encoded, oldest first. (Only used by the main thread)
+static std::deque<shared_ptr<ScreenshotJob> > g_PendingScreenshots;
+
+// This runs on a worker thread, so it mustn't use the VFS or report errors itself
+static void RunScreenshotTask(void* data)
+{
+	ScreenshotJob* job = static_cast<ScreenshotJob*>(data);
+	job->status = tex_encode(&job->t, job->filename.Extension(), &job->encoded);
+
+	// Free the uncompressed image as soon as possible
+	tex_free(&job->t);
+}
+
+// Encodes the job's image in the background if possible, else just does it now
+static void StartScreenshotEncoding(ScreenshotJob& job)
+{
+	if (g_ThreadPool)
+		g_ThreadPool->Submit(&RunScreenshotTask, &job, &job.task);
+	else
+		RunScreenshotTask(&job);
+}
+
+#if !CONFIG2_GLES
+// Copies the job's image out of its pixel buffer object, and starts encoding it
+static void FinishScreenshotReadback(ScreenshotJob& job)
+{
+	pglBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB, job.pbo);
+	const void* pixels = pglMapBufferARB(GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY_ARB);
+	if (pixels)
+	{
+		memcpy(tex_get_data(&job.t), pixels, tex_img_size(&job.t));
+		pglUnmapBufferARB(GL_PIXEL_PACK_BUFFER_ARB);
+	}
+	else
+		job.status = ERR::FAIL;
+	pglBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB, 0);
+
+	pglDeleteBuffersARB(1, &job.pbo);
+	job.pbo = 0;
+
+	if (job.status == INFO::OK)
+		StartScreenshotEncoding(job);
+	else
+		tex_free(&job.t);
+}
+#endif
+
+// Writes a screenshot whose encoding task has completed
+static void FinishScreenshot(ScreenshotJob& job)
+{
+	ssize_t bytes_written = 0;
+	if (job.status == INFO::OK)
+	{
+		bytes_written = g_VFS->CreateFile(job.filename, DummySharedPtr(job.encoded.base), job.encoded.pos);
+		(void)da_free(&job.encoded);
+	}
+
+	if (bytes_written <= 0)
+	{
+		LOGERROR(L"Error writing screenshot to '%ls'", job.filename.string().c_str());
+		return;
+	}
+
+	OsPath realPath;
+	g_VFS->GetRealPath(job.filename, realPath);
+	LOGMESSAGERENDER(L"Screenshot written to '%ls'", realPath.string().c_str());
+}
+
+void PollScreenshots()
+{
+#if !CONFIG2_GLES
+	for (size_t i = 0; i < g_PendingScreenshots.size(); ++i)
+	{
+		ScreenshotJob& job = *g_PendingScreenshots[i];
+		if (!job.pbo)
+			continue;
+		if (!job.waitedFrame)
+			job.waitedFrame = true;
+		else
+			FinishScreenshotReadback(job);
+	}
+#endif
+
+	// Finish the screenshots in the order they were taken
+	while (!g_PendingScreenshots.empty() && !g_PendingScreenshots.front()->pbo && g_PendingScreenshots.front()->task.IsDone())
+	{
+		shared_ptr<ScreenshotJob> job = g_PendingScreenshots.front();
+		g_PendingScreenshots.pop_front();
+		FinishScreenshot(*job);
+	}
+}
+
+void FlushScreenshots()
+{
+	while (!g_PendingScreenshots.empty())
+	{
+		ScreenshotJob& job = *g_PendingScreenshots.front();
+#if !CONFIG2_GLES
+		if (job.pbo)
+			FinishScreenshotReadback(job);
+#endif
+		if (g_ThreadPool)
+			g_ThreadPool->Wait(job.task);
+		PollScreenshots();
+	}
+}
+
 // <extension> identifies the file format that is to be written
 // (case-insensitive). examples: "bmp", "png", "jpg".
 // BMP is good for quick output at the expense of large files.
@@ -229,21 +360,29 @@ void WriteScreenshot(const VfsPath& extension)
 	shared_ptr<u8> buf;
 	AllocateAligned(buf, hdr_size+img_size, maxSectorSize);
 	GLvoid* img = buf.get() + hdr_size;
-	Tex t;
-	if(tex_wrap(w, h, bpp, flags, buf, hdr_size, &t) < 0)
+	shared_ptr<ScreenshotJob> job(new ScreenshotJob);
+	job->filename = filename;
+	if(tex_wrap(w, h, bpp, flags, buf, hdr_size, &job->t) < 0)
 		return;
-	glReadPixels(0, 0, (GLsizei)w, (GLsizei)h, fmt, GL_UNSIGNED_BYTE, img);
+	g_PendingScreenshots.push_back(job);
 
-	if (tex_write(&t, filename) == INFO::OK)
+#if !CONFIG2_GLES
+	// Read the pixels into a buffer object, so we don't have to wait for the GPU
+	// to finish rendering and transfer them; PollScreenshots will pick them up later
+	if (ogl_HaveExtension("GL_ARB_pixel_buffer_object"))
 	{
-		OsPath realPath;
-		g_VFS->GetRealPath(filename, realPath);
-		LOGMESSAGERENDER(L"Screenshot written to '%ls'", realPath.string().c_str());
+		pglGenBuffersARB(1, &job->pbo);
+		pglBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB, job->pbo);
+		pglBufferDataARB(GL_PIXEL_PACK_BUFFER_ARB, img_size, NULL, GL_STREAM_READ_ARB);
+		glReadPixels(0, 0, (GLsizei)w, (GLsizei)h, fmt, GL_UNSIGNED_BYTE, 0);
+		pglBindBufferARB(GL_PIXEL_PACK_BUFFER_ARB, 0);
+		return;
 	}
-	else
-		LOGERROR(L"Error writing screenshot to '%ls'", filename.string().c_str());
+#endif
 
-	tex_free(&t);
+	glReadPixels(0, 0, (GLsizei)w, (GLsizei)h, fmt, GL_UNSIGNED_BYTE, img);
+	StartScreenshotEncoding(*job);
+	PollScreenshots();
 }
 
 
@@ -292,9 +431,10 @@ void WriteBigScreenshot(const VfsPath& extension, int tiles)
 	shared_ptr<u8> img_buf;
 	AllocateAligned(img_buf, hdr_size+img_size, maxSectorSize);
 
-	Tex t;
+	shared_ptr<ScreenshotJob> job(new ScreenshotJob);
+	job->filename = filename;
 	GLvoid* img = img_buf.get() + hdr_size;
-	if(tex_wrap(img_w, img_h, bpp, flags, img_buf, hdr_size, &t) < 0)
+	if(tex_wrap(img_w, img_h, bpp, flags, img_buf, hdr_size, &job->t) < 0)
 	{
 		free(tile_data);
 		return;
@@ -369,15 +509,11 @@ void WriteBigScreenshot(const VfsPath& extension, int tiles)
 		g_Game->GetView()->GetCamera()->SetProjectionTile(1, 0, 0);
 	}
 
-	if (tex_write(&t, filename) == INFO::OK)
-	{
-		OsPath realPath;
-		g_VFS->GetRealPath(filename, realPath);
-		LOGMESSAGERENDER(L"Screenshot written to '%ls'", realPath.string().c_str());
-	}
-	else
-		LOGERROR(L"Error writing screenshot to '%ls'", filename.string().c_str());
-
-	tex_free(&t);
 	free(tile_data);
+
+	// The rendering has to be done now, but the (slow, for a huge image) encoding
+	// and writing can happen in the background
+	g_PendingScreenshots.push_back(job);
+	StartScreenshotEncoding(*job);
+	PollScreenshots();
 }
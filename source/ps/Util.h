@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -29,6 +29,12 @@ extern const wchar_t* ErrorString(int err);
 extern void WriteScreenshot(const VfsPath& extension);
 extern void WriteBigScreenshot(const VfsPath& extension, int tiles);
 
+// Screenshots are read back and written to disk asynchronously; this finishes any
+// that are ready, and should be called once per frame.
+extern void PollScreenshots();
+// Waits for all pending screenshots to be written.
+extern void FlushScreenshots();
+
 extern Status tex_write(Tex* t, const VfsPath& filename);
 
 #endif // PS_UTIL_H
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -23,10 +23,14 @@
 #include <stack>
 #include <algorithm>
 
+#include "lib/file/vfs/vfs_util.h"
+#include "lib/sysdep/cpu.h"
+#include "lib/timer.h"
 #include "maths/MD5.h"
 #include "ps/CacheLoader.h"
 #include "ps/CLogger.h"
 #include "ps/Filesystem.h"
+#include "ps/ThreadPool.h"
 #include "Xeromyces.h"
 
 #include <libxml/parser.h>
@@ -45,12 +49,18 @@ static void errorHandler(void* UNUSED(userData), xmlErrorPtr error)
 	// so the caching is less transparent than it should be
 }
 
+// Arbitrary version number - change this if we update the code and
+// need to invalidate old users' caches
+static const u32 XMB_CACHE_VERSION = 1;
+
 static bool g_XeromycesStarted = false;
 void CXeromyces::Startup()
 {
 	ENSURE(!g_XeromycesStarted);
 	xmlInitParser();
 	xmlSetStructuredErrorFunc(NULL, &errorHandler);
+	// (libxml2's error handler is per-thread, so set the default for threads that haven't used it yet too)
+	xmlThrDefSetStructuredErrorFunc(NULL, &errorHandler);
 	g_XeromycesStarted = true;
 }
 
@@ -59,6 +69,7 @@ void CXeromyces::Terminate()
 	ENSURE(g_XeromycesStarted);
 	xmlCleanupParser();
 	xmlSetStructuredErrorFunc(NULL, NULL);
+	xmlThrDefSetStructuredErrorFunc(NULL, NULL);
 	g_XeromycesStarted = false;
 }
 
@@ -68,12 +79,8 @@ PSRETURN CXeromyces::Load(const PIVFS& vfs, const VfsPath& filename)
 
 	CCacheLoader cacheLoader(vfs, L".xmb");
 
-	// Arbitrary version number - change this if we update the code and
-	// need to invalidate old users' caches
-	u32 version = 1;
-
 	VfsPath xmbPath;
-	Status ret = cacheLoader.TryLoadingCached(filename, MD5(), version, xmbPath);
+	Status ret = cacheLoader.TryLoadingCached(filename, MD5(), XMB_CACHE_VERSION, xmbPath);
 
 	if (ret == INFO::OK)
 	{
@@ -110,6 +117,75 @@ bool CXeromyces::GenerateCachedXMB(const PIVFS& vfs, const VfsPath& sourcePath,
 	return (ConvertFile(vfs, sourcePath, VfsPath("cache") / archiveCachePath) == PSRETURN_OK);
 }
 
+namespace
+{
+struct WarmCacheJob
+{
+	PIVFS vfs;
+	VfsPaths sourcePaths;
+	VfsPaths xmbPaths;
+	volatile intptr_t numConverted;
+};
+}
+
+static Status CollectXMLFileCB(const VfsPath& pathname, const FileInfo& UNUSED(fileInfo), const uintptr_t cbData)
+{
+	VfsPaths* pathnames = (VfsPaths*)cbData;
+	pathnames->push_back(pathname);
+	return INFO::OK;
+}
+
+size_t CXeromyces::WarmCache(const PIVFS& vfs, const VfsPath& directory)
+{
+	ENSURE(g_XeromycesStarted);
+
+	TIMER(L"CXeromyces::WarmCache");
+
+	VfsPaths pathnames;
+	(void)vfs::ForEachFile(vfs, directory, &CollectXMLFileCB, (uintptr_t)&pathnames, L"*.xml", vfs::DIR_RECURSIVE);
+
+	// Find the files that Load would have to convert (this only looks at
+	// timestamps and sizes, so it's cheap compared to the conversion)
+	WarmCacheJob job;
+	job.vfs = vfs;
+	job.numConverted = 0;
+	CCacheLoader cacheLoader(vfs, L".xmb");
+	for (size_t i = 0; i < pathnames.size(); ++i)
+	{
+		VfsPath xmbPath;
+		if (cacheLoader.TryLoadingCached(pathnames[i], MD5(), XMB_CACHE_VERSION, xmbPath) == INFO::SKIPPED)
+		{
+			job.sourcePaths.push_back(pathnames[i]);
+			job.xmbPaths.push_back(xmbPath);
+		}
+	}
+
+	if (job.sourcePaths.empty())
+		return 0;
+
+	// (Converting one file takes up to a few milliseconds, so a single file per chunk
+	// is enough to hide the scheduling overhead and balances big files best)
+	if (g_ThreadPool)
+		g_ThreadPool->ParallelFor(job.sourcePaths.size(), 1, &ConvertFilesCB, &job);
+	else
+		ConvertFilesCB(&job, 0, job.sourcePaths.size());
+
+	LOGMESSAGE(L"CXeromyces: Converted %lu of %lu XML files", (unsigned long)job.numConverted, (unsigned long)pathnames.size());
+	return (size_t)job.numConverted;
+}
+
+void CXeromyces::ConvertFilesCB(void* cbdata, size_t begin, size_t end)
+{
+	WarmCacheJob* job = static_cast<WarmCacheJob*>(cbdata);
+	for (size_t i = begin; i < end; ++i)
+	{
+		// (Errors are logged by ConvertFile, and will be logged again when the game tries to load the file)
+		CXeromyces xero;
+		if (xero.ConvertFile(job->vfs, job->sourcePaths[i], job->xmbPaths[i]) == PSRETURN_OK)
+			cpu_AtomicAdd(&job->numConverted, 1);
+	}
+}
+
 PSRETURN CXeromyces::ConvertFile(const PIVFS& vfs, const VfsPath& filename, const VfsPath& xmbPath)
 {
 	CVFSFile input;
@@ -147,19 +223,28 @@ PSRETURN CXeromyces::ConvertFile(const PIVFS& vfs, const VfsPath& filename, cons
 
 bool CXeromyces::ReadXMBFile(const PIVFS& vfs, const VfsPath& filename)
 {
+	// XMBFile reads the data in place, so there's no need to copy it out of
+	// the archive or loose cache file. (Loose XMBs are only overwritten when
+	// they're invalid, and we release the mapping before that below.)
 	size_t size;
-	if(vfs->LoadFile(filename, m_XMBBuffer, size) < 0)
+	if(vfs->MapFile(filename, m_XMBBuffer, size) < 0)
 		return false;
 	// if the game crashes during loading, (e.g. due to driver bugs),
 	// it sometimes leaves empty XMB files in the cache.
 	// reporting failure will cause our caller to re-generate the XMB.
 	if(size == 0)
+	{
+		m_XMBBuffer.reset();
 		return false;
+	}
 	ENSURE(size >= 4); // make sure it's at least got the initial header
 
 	// Set up the XMBFile
 	if(!Initialise((const char*)m_XMBBuffer.get()))
+	{
+		m_XMBBuffer.reset();
 		return false;
+	}
 
 	return true;
 }
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -60,6 +60,14 @@ public:
 	 */
 	bool GenerateCachedXMB(const PIVFS& vfs, const VfsPath& sourcePath, VfsPath& archiveCachePath);
 
+	/**
+	 * Convert every XML file under @p directory that doesn't have an up-to-date
+	 * cached XMB yet, split across the threads of g_ThreadPool (or serially if
+	 * there isn't one), so that later calls to Load only have to read the XMBs.
+	 * Returns the number of files that were converted.
+	 */
+	static size_t WarmCache(const PIVFS& vfs, const VfsPath& directory = VfsPath());
+
 	/**
 	 * Call once when initialising the program, to load libxml2.
 	 * This should be run in the main thread, before any thread uses libxml2.
@@ -78,6 +86,8 @@ private:
 
 	static PSRETURN CreateXMB(const xmlDocPtr doc, WriteBuffer& writeBuffer);
 
+	static void ConvertFilesCB(void* cbdata, size_t begin, size_t end);
+
 	shared_ptr<u8> m_XMBBuffer;
 };
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -19,6 +19,8 @@
 
 #include "ps/CLogger.h"
 #include "ps/XML/Xeromyces.h"
+#include "lib/allocators/shared_ptr.h"
+#include "lib/file/file_system.h"
 #include "lib/file/vfs/vfs.h"
 
 class TestXeromyces : public CxxTest::TestSuite 
@@ -50,4 +52,39 @@ public:
 		CXeromyces xero;
 		TS_ASSERT_EQUALS(xero.LoadString("<test>"), PSRETURN_Xeromyces_XMLParseError);
 	}
+
+	void test_WarmCache()
+	{
+		const OsPath modPath(DataDir()/"mods"/"_test.xero");
+		const OsPath cachePath(DataDir()/"_testcache");
+		DeleteDirectory(modPath);
+		DeleteDirectory(cachePath);
+
+		PIVFS vfs = CreateVfs(20*MiB);
+		TS_ASSERT_OK(vfs->Mount(L"", modPath));
+		TS_ASSERT_OK(vfs->Mount(L"cache/", cachePath));
+
+		const char* valid = "<test><foo>bar</foo></test>";
+		const char* invalid = "<test>";
+		TS_ASSERT_OK(vfs->CreateFile(L"a/test1.xml", DummySharedPtr((u8*)valid), strlen(valid)));
+		TS_ASSERT_OK(vfs->CreateFile(L"a/b/test2.xml", DummySharedPtr((u8*)valid), strlen(valid)));
+		TS_ASSERT_OK(vfs->CreateFile(L"test3.xml", DummySharedPtr((u8*)invalid), strlen(invalid)));
+
+		{
+			TestLogger logger;
+			TS_ASSERT_EQUALS(CXeromyces::WarmCache(vfs), (size_t)2);
+
+			// Only the invalid file still needs converting
+			TS_ASSERT_EQUALS(CXeromyces::WarmCache(vfs), (size_t)0);
+			TS_ASSERT_WSTR_CONTAINS(logger.GetOutput(), L"test3.xml");
+		}
+
+		CXeromyces xero;
+		TS_ASSERT_EQUALS(xero.Load(vfs, L"a/b/test2.xml"), PSRETURN_OK);
+		TS_ASSERT_STR_EQUALS(xero.GetElementString(xero.GetRoot().GetNodeName()), "test");
+
+		vfs.reset();
+		DeleteDirectory(modPath);
+		DeleteDirectory(cachePath);
+	}
 };
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,6 +24,7 @@
 //#include "lib/res/file/archive/vfs_optimizer.h"	// ArchiveBuilderCancel
 #include "scripting/ScriptingHost.h"
 #include "scripting/JSConversions.h"
+#include "scriptinterface/ScriptInterface.h"
 #include "ps/scripting/JSInterface_VFS.h"
 #include "lib/file/vfs/vfs_util.h"
 
@@ -198,7 +199,7 @@ JSBool JSI_VFS::ReadFile(JSContext* cx, uintN argc, jsval* vp)
 	contents.Replace("\r\n", "\n");
 
 	// Decode as UTF-8
-	JS_SET_RVAL(cx, vp, ToJSVal( contents.FromUTF8() ));
+	JS_SET_RVAL(cx, vp, ScriptInterface::ToJSValUTF8(cx, contents));
 	return JS_TRUE;
 }
 
@@ -243,7 +244,7 @@ JSBool JSI_VFS::ReadFileLines(JSContext* cx, uintN argc, jsval* vp)
 	while (std::getline(ss, line))
 	{
 		// Decode each line as UTF-8
-		jsval val = ToJSVal(CStr(line).FromUTF8());
+		jsval val = ScriptInterface::ToJSValUTF8(cx, line);
 		JS_SetElement(cx, line_array, cur_line++, &val);
 	}
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -18,6 +18,7 @@
 #include "lib/self_test.h"
 
 #include "ps/CLogger.h"
+#include "ps/CStr.h"
 
 class TestCLogger : public CxxTest::TestSuite 
 {
@@ -110,6 +111,64 @@ public:
 		TS_ASSERT_EQUALS(lines[0], "Test&lt;a&amp;b>c&lt;d&amp;e>");
 	}
 
+	void test_repeats()
+	{
+		for (int i = 0; i < 10; ++i)
+			logger->LogWarning(L"Repeated");
+		logger->LogMessage(L"Test");
+
+		ParseOutput();
+
+		TS_ASSERT_EQUALS((int)lines.size(), 7);
+		for (int i = 0; i < 5; ++i)
+			TS_ASSERT_EQUALS(lines[i], "WARNING: Repeated");
+		TS_ASSERT_EQUALS(lines[5], "(Last message repeated 5 more times)");
+		TS_ASSERT_EQUALS(lines[6], "Test");
+
+		// The summary goes in the interesting log too
+		TS_ASSERT_DIFFERS(interestinglog->str().find("(Last message repeated 5 more times)"), std::string::npos);
+	}
+
+	void test_rate_limit()
+	{
+		for (int i = 0; i < 1000; ++i)
+			logger->LogMessage(L"Test %d", i);
+
+		ParseOutput();
+
+		// (Assumes this doesn't take longer than the rate limiting period)
+		TS_ASSERT_LESS_THAN((int)lines.size(), 1000);
+		TS_ASSERT_EQUALS(lines[0], "Test 0");
+	}
+
+	void test_async()
+	{
+		std::stringstream asyncMainlog;
+		std::stringstream asyncInterestinglog;
+		CLogger* asyncLogger = new CLogger(&asyncMainlog, &asyncInterestinglog, false, false, true);
+		for (int i = 0; i < 100; ++i)
+		{
+			asyncLogger->LogMessage(L"Test %d", i);
+			asyncLogger->LogError(L"Error %d", i);
+		}
+
+		// Everything is written by the time the logger is destroyed
+		delete asyncLogger;
+
+		std::string s = asyncMainlog.str();
+		size_t pos = 0;
+		for (int i = 0; i < 100; ++i)
+		{
+			pos = s.find("Test " + CStr::FromInt(i) + "<", pos);
+			TS_ASSERT_DIFFERS(pos, std::string::npos);
+			pos = s.find("ERROR: Error " + CStr::FromInt(i) + "<", pos);
+			TS_ASSERT_DIFFERS(pos, std::string::npos);
+		}
+		TS_ASSERT_DIFFERS(s.find("Engine exited successfully"), std::string::npos);
+		TS_ASSERT_DIFFERS(asyncInterestinglog.str().find("ERROR: Error 99<"), std::string::npos);
+		TS_ASSERT_EQUALS(asyncInterestinglog.str().find("Test 0"), std::string::npos);
+	}
+
 	//////////////////////////////////////////////////////////////////////////
 
 	CLogger* logger;
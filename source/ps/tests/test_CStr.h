@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -17,6 +17,7 @@
 
 #include "lib/self_test.h"
 
+#include "lib/utf8.h"
 #include "ps/CStr.h"
 
 class TestCStr : public CxxTest::TestSuite 
@@ -75,6 +76,38 @@ public:
 		}
 	}
 
+	void test_utf8_utf16_direct()
+	{
+		// The direct conversions should match the ones via wstrings
+		const char* tests[] = {
+			"",
+			"abc",
+			"\x12\xc3\xbf\xe1\x88\xb4\xef\xbf\xbd",
+			"a\xef",
+			"c\xef\xbf\x01",
+			"d\xffX\x80Y\x80",
+			"\xed\xa0\x80", // surrogate
+			"\xf0\x90\x80\x80" // outside the BMP
+		};
+		for (size_t i = 0; i < ARRAY_SIZE(tests); ++i)
+		{
+			std::string utf8 = tests[i];
+			Status err;
+			std::wstring wide = wstring_from_utf8(utf8, &err);
+
+			std::vector<u16> utf16(utf8.size()+1);
+			size_t len = utf16_from_utf8(utf8.data(), utf8.size(), &utf16[0], &err);
+			TS_ASSERT_EQUALS(len, wide.length());
+			for (size_t j = 0; j < std::min(len, wide.length()); ++j)
+				TS_ASSERT_EQUALS(utf16[j], (u16)wide[j]);
+
+			std::string utf8b = utf8_from_wstring(wide, &err);
+			std::vector<char> utf8c(3*len+1);
+			size_t len8 = utf8_from_utf16(&utf16[0], len, &utf8c[0], &err);
+			TS_ASSERT_EQUALS(std::string(&utf8c[0], len8), utf8b);
+		}
+	}
+
 	template <typename T>
 	void roundtrip(const T& str)
 	{
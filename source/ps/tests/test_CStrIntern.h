@@ -0,0 +1,72 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "ps/CStrIntern.h"
+#include "ps/ThreadPool.h"
+
+class TestCStrIntern : public CxxTest::TestSuite
+{
+	struct InternData
+	{
+		std::vector<std::string> strings;
+		std::vector<CStrIntern> interned;
+	};
+
+	static void InternItems(void* cbdata, size_t begin, size_t end)
+	{
+		InternData* data = static_cast<InternData*>(cbdata);
+		for (size_t i = begin; i < end; ++i)
+			data->interned[i] = CStrIntern(data->strings[i]);
+	}
+
+public:
+	void test_basic()
+	{
+		CStrIntern a("foo");
+		CStrIntern b(std::string("foo"));
+		CStrIntern c("bar");
+		TS_ASSERT(a == b);
+		TS_ASSERT(!(a == c));
+		TS_ASSERT_EQUALS(a.c_str(), b.c_str());
+		TS_ASSERT_EQUALS(a.string(), "foo");
+		TS_ASSERT_EQUALS(a.length(), 3u);
+		TS_ASSERT_EQUALS(CStrIntern().length(), 0u);
+		TS_ASSERT(CStrIntern() == CStrIntern(""));
+	}
+
+	void test_threads()
+	{
+		CThreadPool pool(4);
+
+		// Every string appears several times, so threads race to intern the same ones
+		InternData data;
+		for (size_t i = 0; i < 4000; ++i)
+			data.strings.push_back("threaded string " + CStr::FromUInt(i % 500));
+		data.interned.resize(data.strings.size());
+
+		pool.ParallelFor(data.strings.size(), 7, &InternItems, &data);
+
+		for (size_t i = 0; i < data.strings.size(); ++i)
+		{
+			TS_ASSERT_EQUALS(data.interned[i].string(), data.strings[i]);
+			TS_ASSERT(data.interned[i] == CStrIntern(data.strings[i]));
+			TS_ASSERT(data.interned[i] == data.interned[i % 500]);
+		}
+	}
+};
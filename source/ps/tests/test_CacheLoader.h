@@ -0,0 +1,84 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "lib/self_test.h"
+
+#include "lib/allocators/shared_ptr.h"
+#include "lib/file/file_system.h"
+#include "maths/MD5.h"
+#include "ps/CacheLoader.h"
+
+class TestCacheLoader : public CxxTest::TestSuite
+{
+	OsPath m_ModPath;
+	OsPath m_CachePath;
+	PIVFS m_VFS;
+
+	void createFile(const VfsPath& pathname, size_t size)
+	{
+		shared_ptr<u8> data;
+		AllocateAligned(data, size);
+		memset(data.get(), 'x', size);
+		TS_ASSERT_OK(m_VFS->CreateFile(pathname, data, size));
+	}
+
+public:
+	void setUp()
+	{
+		m_ModPath = DataDir()/"mods"/"_test.cacheloader";
+		m_CachePath = DataDir()/"_testcache";
+		DeleteDirectory(m_ModPath);
+		DeleteDirectory(m_CachePath);
+
+		m_VFS = CreateVfs(20*MiB);
+		TS_ASSERT_OK(m_VFS->Mount(L"", m_ModPath));
+		TS_ASSERT_OK(m_VFS->Mount(L"cache/", m_CachePath));
+	}
+
+	void tearDown()
+	{
+		m_VFS.reset();
+		DeleteDirectory(m_ModPath);
+		DeleteDirectory(m_CachePath);
+	}
+
+	void test_CollectGarbage()
+	{
+		createFile(L"data/used.xml", 16);
+		createFile(L"data/unused.xml", 16);
+
+		CCacheLoader cacheLoader(m_VFS, L".xmb");
+		VfsPath usedPath, unusedPath;
+		TS_ASSERT_EQUALS(cacheLoader.TryLoadingCached(L"data/used.xml", MD5(), 1, usedPath), INFO::SKIPPED);
+		unusedPath = cacheLoader.LooseCachePath(L"data/unused.xml", MD5(), 1);
+		createFile(usedPath, 1000);
+		createFile(unusedPath, 2000);
+		createFile(L"cache/other.dat", 4000);
+
+		// Nothing is deleted while the cache is within its limit
+		TS_ASSERT_EQUALS(CCacheLoader::CollectGarbage(m_VFS, 10000), (u64)0);
+		TS_ASSERT_OK(m_VFS->GetFileInfo(unusedPath, NULL));
+
+		// Only cache files that weren't looked up are deleted
+		TS_ASSERT_EQUALS(CCacheLoader::CollectGarbage(m_VFS, 0), (u64)2000);
+		TS_ASSERT_OK(m_VFS->GetFileInfo(usedPath, NULL));
+		TS_ASSERT(m_VFS->GetFileInfo(unusedPath, NULL) < 0);
+		TS_ASSERT_OK(m_VFS->GetFileInfo(L"cache/other.dat", NULL));
+		TS_ASSERT(!FileExists(m_CachePath/"data"/unusedPath.Filename()));
+	}
+};
@@ -0,0 +1,83 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "ps/Compress.h"
+
+class TestCompress : public CxxTest::TestSuite
+{
+	std::string GetTestData()
+	{
+		std::string data;
+		for (size_t i = 0; i < 10000; ++i)
+			data += (char)((i * i) % 251);
+		return data;
+	}
+
+public:
+	void test_zlib()
+	{
+		std::string data = GetTestData();
+		std::string compressed, decompressed;
+		CompressZLib(data, compressed, true);
+		TS_ASSERT_LESS_THAN(compressed.size(), data.size());
+		DecompressZLib(compressed, decompressed, true);
+		TS_ASSERT(decompressed == data);
+	}
+
+	void test_stream()
+	{
+		std::string data = GetTestData();
+		std::string compressed;
+		CompressZLib(data, compressed, true);
+
+		// Try various chunk sizes, including ones that split the length header
+		const size_t chunkSizes[] = { 1, 3, 7, 1024, compressed.size() };
+		for (size_t i = 0; i < ARRAY_SIZE(chunkSizes); ++i)
+		{
+			CZLibStreamDecompressor decompressor;
+			for (size_t offset = 0; offset < compressed.size(); offset += chunkSizes[i])
+			{
+				TS_ASSERT(!decompressor.IsComplete());
+				TS_ASSERT(decompressor.Append(compressed.c_str() + offset, std::min(chunkSizes[i], compressed.size() - offset)));
+			}
+			TS_ASSERT(decompressor.IsComplete());
+			TS_ASSERT(decompressor.GetOutput() == data);
+		}
+	}
+
+	void test_stream_invalid()
+	{
+		std::string data = GetTestData();
+		std::string compressed;
+		CompressZLib(data, compressed, true);
+
+		CZLibStreamDecompressor truncated;
+		TS_ASSERT(truncated.Append(compressed.c_str(), compressed.size() / 2));
+		TS_ASSERT(!truncated.IsComplete());
+
+		CZLibStreamDecompressor trailing;
+		TS_ASSERT(!trailing.Append((compressed + "x").c_str(), compressed.size() + 1));
+		TS_ASSERT(!trailing.IsComplete());
+
+		std::string corrupt = compressed;
+		corrupt[4] = ~corrupt[4];
+		CZLibStreamDecompressor corrupted;
+		TS_ASSERT(!corrupted.Append(corrupt.c_str(), corrupt.size()));
+	}
+};
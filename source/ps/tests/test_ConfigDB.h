@@ -0,0 +1,64 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "ps/ConfigDB.h"
+
+class TestConfigDB : public CxxTest::TestSuite
+{
+public:
+	void test_setting_uninitialised()
+	{
+		TS_ASSERT(!CConfigDB::IsInitialised());
+		CConfigSetting<int> setting("test.int", 42);
+		TS_ASSERT_EQUALS(setting.Get(), 42);
+	}
+
+	void test_setting()
+	{
+		new CConfigDB;
+
+		CConfigSetting<int> intSetting("test.int", 42);
+		CConfigSetting<bool> boolSetting("test.bool", false);
+		CConfigSetting<CStr> strSetting("test.str", "default");
+		TS_ASSERT_EQUALS(intSetting.Get(), 42);
+		TS_ASSERT_EQUALS(boolSetting.Get(), false);
+		TS_ASSERT_EQUALS(strSetting.Get(), "default");
+
+		g_ConfigDB.CreateValue(CFG_DEFAULT, "test.int")->m_String = "10";
+		g_ConfigDB.CreateValue(CFG_USER, "test.bool")->m_String = "true";
+		g_ConfigDB.CreateValue(CFG_USER, "test.str")->m_String = "foo";
+		TS_ASSERT_EQUALS(intSetting.Get(), 10);
+		TS_ASSERT_EQUALS(boolSetting.Get(), true);
+		TS_ASSERT_EQUALS(strSetting.Get(), "foo");
+
+		// Higher namespaces override lower ones
+		g_ConfigDB.CreateValue(CFG_COMMAND, "test.int")->m_String = "20";
+		TS_ASSERT_EQUALS(intSetting.Get(), 20);
+
+		// Values that can't be parsed leave the default
+		g_ConfigDB.CreateValue(CFG_COMMAND, "test.int")->m_String = "x";
+		TS_ASSERT_EQUALS(intSetting.Get(), 42);
+
+		// Settings created later see the current value
+		CConfigSetting<CStr> strSetting2("test.str", "default");
+		TS_ASSERT_EQUALS(strSetting2.Get(), "foo");
+
+		delete &g_ConfigDB;
+	}
+};
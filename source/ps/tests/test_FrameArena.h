@@ -0,0 +1,115 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "lib/alignment.h"
+#include "ps/FrameArena.h"
+#include "ps/ThreadPool.h"
+
+class TestFrameArena : public CxxTest::TestSuite
+{
+	struct JobData
+	{
+		CFrameArena* arena;
+		std::vector<u8*> pointers;
+	};
+
+	static void AllocateItems(void* cbdata, size_t begin, size_t end)
+	{
+		JobData* data = static_cast<JobData*>(cbdata);
+		for (size_t i = begin; i < end; ++i)
+		{
+			data->pointers[i] = (u8*)data->arena->allocate(16);
+			memset(data->pointers[i], (int)(i & 0xFF), 16);
+		}
+	}
+
+public:
+	void test_basic()
+	{
+		CFrameArena arena(256);
+
+		u8* a = (u8*)arena.allocate(1);
+		u8* b = (u8*)arena.allocate(40);
+		TS_ASSERT(IsAligned(a, allocationAlignment));
+		TS_ASSERT(IsAligned(b, allocationAlignment));
+		TS_ASSERT_EQUALS(b - a, (ptrdiff_t)allocationAlignment);
+
+		// After a reset, the same memory is reused
+		arena.Reset();
+		TS_ASSERT_EQUALS((u8*)arena.allocate(8), a);
+	}
+
+	void test_overflow()
+	{
+		CFrameArena arena(256);
+
+		// Allocations that don't fit in the chunk must still be usable
+		std::vector<u8*> pointers;
+		for (size_t i = 0; i < 100; ++i)
+		{
+			pointers.push_back((u8*)arena.allocate(32));
+			memset(pointers.back(), (int)i, 32);
+		}
+		u8* big = (u8*)arena.allocate(4096);
+		memset(big, 0xFF, 4096);
+
+		for (size_t i = 0; i < pointers.size(); ++i)
+			for (size_t j = 0; j < 32; ++j)
+				TS_ASSERT_EQUALS(pointers[i][j], (u8)i);
+
+		// After a reset, everything should fit in a single chunk again
+		arena.Reset();
+		u8* first = (u8*)arena.allocate(32);
+		for (size_t i = 1; i < 100; ++i)
+			TS_ASSERT_EQUALS((u8*)arena.allocate(32), first + i*32);
+	}
+
+	void test_vector()
+	{
+		CFrameArena arena(256);
+
+		FrameVector<int> v(arena);
+		for (int i = 0; i < 1000; ++i)
+			v.push_back(i);
+		TS_ASSERT_EQUALS(v.size(), 1000u);
+		for (int i = 0; i < 1000; ++i)
+			TS_ASSERT_EQUALS(v[i], i);
+	}
+
+	void test_threads()
+	{
+		CFrameArena arena(64*KiB);
+		CThreadPool pool(3);
+
+		for (size_t frame = 0; frame < 3; ++frame)
+		{
+			JobData data;
+			data.arena = &arena;
+			data.pointers.resize(10000);
+			pool.ParallelFor(data.pointers.size(), 100, &AllocateItems, &data);
+
+			// Every thread gets its own memory, so nothing should have been overwritten
+			for (size_t i = 0; i < data.pointers.size(); ++i)
+				for (size_t j = 0; j < 16; ++j)
+					TS_ASSERT_EQUALS(data.pointers[i][j], (u8)(i & 0xFF));
+
+			arena.Reset();
+		}
+	}
+};
@@ -0,0 +1,156 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "lib/sysdep/cpu.h"
+#include "ps/Loader.h"
+#include "ps/ThreadPool.h"
+
+class TestLoader : public CxxTest::TestSuite
+{
+	// Records the order tasks finished in
+	struct LoadState
+	{
+		LoadState() : nextOrder(0) { }
+		volatile intptr_t nextOrder;
+		int order[4];
+	};
+
+	struct TaskData
+	{
+		LoadState* state;
+		int index;
+		int result;
+	};
+
+	static int RunTask(void* param, double UNUSED(time_left))
+	{
+		TaskData* data = static_cast<TaskData*>(param);
+		data->state->order[data->index] = (int)cpu_AtomicAdd(&data->state->nextOrder, 1);
+		return data->result;
+	}
+
+	void RunLoad(LoadState& state, TaskData* data, int failingTask = -1)
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			data[i].state = &state;
+			data[i].index = i;
+			data[i].result = (i == failingTask) ? (int)ERR::FAIL : 0;
+		}
+
+		LDR_BeginRegistering();
+		// 0 and 1 can run in parallel with each other and with 2;
+		// 3 needs both of them
+		LoadTaskId background[2];
+		background[0] = LDR_RegisterTask(&RunTask, &data[0], L"background 0", 10, LDR_ANY_THREAD);
+		background[1] = LDR_RegisterTask(&RunTask, &data[1], L"background 1", 10, LDR_ANY_THREAD);
+		LDR_Register(&RunTask, &data[2], L"main 2", 10);
+		LDR_RegisterTask(&RunTask, &data[3], L"main 3", 10, LDR_MAIN_THREAD, background, 2);
+		LDR_EndRegistering();
+	}
+
+	void CheckOrder(const LoadState& state)
+	{
+		TS_ASSERT_EQUALS(state.nextOrder, 4);
+		TS_ASSERT_LESS_THAN(state.order[0], state.order[3]);
+		TS_ASSERT_LESS_THAN(state.order[1], state.order[3]);
+		TS_ASSERT_LESS_THAN(state.order[2], state.order[3]);
+	}
+
+public:
+	void test_serial()
+	{
+		// Without a thread pool everything runs on this thread
+		LoadState state;
+		TaskData data[4];
+		RunLoad(state, data);
+		TS_ASSERT_OK(LDR_NonprogressiveLoad());
+		CheckOrder(state);
+	}
+
+	void test_dependencies()
+	{
+		CThreadPool pool(2);
+		g_ThreadPool = &pool;
+
+		for (int i = 0; i < 20; ++i)
+		{
+			LoadState state;
+			TaskData data[4];
+			RunLoad(state, data);
+			TS_ASSERT_OK(LDR_NonprogressiveLoad());
+			CheckOrder(state);
+		}
+
+		g_ThreadPool = NULL;
+	}
+
+	void test_progressive()
+	{
+		CThreadPool pool(2);
+		g_ThreadPool = &pool;
+
+		LoadState state;
+		TaskData data[4];
+		RunLoad(state, data);
+
+		wchar_t description[100];
+		int progress = 0;
+		int lastProgress = 0;
+		Status ret;
+		while ((ret = LDR_ProgressiveLoad(1.0, description, ARRAY_SIZE(description), &progress)) == ERR::TIMED_OUT)
+		{
+			TS_ASSERT_LESS_THAN_EQUALS(lastProgress, progress);
+			lastProgress = progress;
+		}
+		TS_ASSERT_EQUALS(ret, INFO::ALL_COMPLETE);
+		TS_ASSERT_EQUALS(progress, 100);
+		TS_ASSERT_WSTR_EQUALS(description, L"");
+		CheckOrder(state);
+
+		g_ThreadPool = NULL;
+	}
+
+	void test_background_failure()
+	{
+		CThreadPool pool(2);
+		g_ThreadPool = &pool;
+
+		LoadState state;
+		TaskData data[4];
+		RunLoad(state, data, 1);
+
+		// The failure is reported once, and the remaining tasks still run afterwards
+		wchar_t description[100];
+		int progress = 0;
+		size_t failures = 0;
+		Status ret;
+		while ((ret = LDR_ProgressiveLoad(1.0, description, ARRAY_SIZE(description), &progress)) != INFO::ALL_COMPLETE)
+		{
+			if (ret == ERR::FAIL)
+				++failures;
+			else
+				TS_ASSERT_EQUALS(ret, ERR::TIMED_OUT);
+		}
+		TS_ASSERT_EQUALS(failures, 1u);
+		CheckOrder(state);
+
+		g_ThreadPool = NULL;
+	}
+};
@@ -0,0 +1,51 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "ps/MemoryStats.h"
+
+class TestMemoryStats : public CxxTest::TestSuite
+{
+public:
+	void test_counters()
+	{
+		// Other code might have used the counters already, so only look at the changes
+		size_t before = MemoryStats::Get(MEMORY_MESHES);
+
+		MemoryStats::Add(MEMORY_MESHES, 1000);
+		MemoryStats::Add(MEMORY_MESHES, 24);
+		TS_ASSERT_EQUALS(MemoryStats::Get(MEMORY_MESHES), before + 1024);
+
+		MemoryStats::Add(MEMORY_MESHES, -1024);
+		TS_ASSERT_EQUALS(MemoryStats::Get(MEMORY_MESHES), before);
+		TS_ASSERT_LESS_THAN_EQUALS(before + 1024, MemoryStats::GetPeak(MEMORY_MESHES));
+
+		// Categories are independent
+		size_t animations = MemoryStats::Get(MEMORY_ANIMATIONS);
+		MemoryStats::Add(MEMORY_MESHES, 100);
+		TS_ASSERT_EQUALS(MemoryStats::Get(MEMORY_ANIMATIONS), animations);
+		MemoryStats::Add(MEMORY_MESHES, -100);
+	}
+
+	void test_names()
+	{
+		for (size_t i = 0; i < MEMORY_NUM_CATEGORIES; ++i)
+			TS_ASSERT(strlen(MemoryStats::GetCategoryName((MemoryCategory)i)) > 0);
+		TS_ASSERT_STR_EQUALS(MemoryStats::GetCategoryName(MEMORY_VFS_CACHE), "VFS cache");
+	}
+};
@@ -0,0 +1,71 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "lib/file/file_system.h"
+#include "ps/Filesystem.h"
+#include "ps/Profiler2.h"
+
+#include <fstream>
+
+class TestProfiler2 : public CxxTest::TestSuite
+{
+public:
+	void setUp()
+	{
+		TS_ASSERT_OK(CreateDirectories(DataDir()/"_testcache", 0700));
+	}
+
+	void tearDown()
+	{
+		DeleteDirectory(DataDir()/"_testcache");
+	}
+
+	void test_capture()
+	{
+		OsPath capturePath = DataDir()/"_testcache"/"profile2.capture";
+		OsPath tracePath = DataDir()/"_testcache"/"profile2.json";
+
+		g_Profiler2.EnableCapture(capturePath);
+		TS_ASSERT(g_Profiler2.IsCapturing());
+
+		// Items are only captured after a sync marker (which provides the absolute time)
+		g_Profiler2.RecordSyncMarker();
+		{
+			PROFILE2("test capture region");
+			PROFILE2_ATTR("attribute %d", 123);
+			PROFILE2_EVENT("test capture event");
+			PROFILE2_COUNTER("test capture counter", 42);
+		}
+
+		g_Profiler2.DisableCapture();
+		TS_ASSERT(!g_Profiler2.IsCapturing());
+
+		TS_ASSERT(CProfiler2::ConvertCapture(capturePath, tracePath));
+
+		std::ifstream stream(OsString(tracePath).c_str());
+		std::string trace((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+		TS_ASSERT(trace.find("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"main\"}}") != trace.npos);
+		TS_ASSERT(trace.find("{\"name\":\"test capture region\",\"ph\":\"B\"") != trace.npos);
+		TS_ASSERT(trace.find("\"args\":{\"0\":\"attribute 123\"}") != trace.npos);
+		TS_ASSERT(trace.find("{\"name\":\"test capture event\",\"ph\":\"i\"") != trace.npos);
+		TS_ASSERT(trace.find("{\"name\":\"test capture counter\",\"ph\":\"C\"") != trace.npos);
+		TS_ASSERT(trace.find("\"args\":{\"value\":42.000}") != trace.npos);
+		TS_ASSERT(trace.find("{\"name\":\"test capture region\",\"ph\":\"E\"") != trace.npos);
+	}
+};
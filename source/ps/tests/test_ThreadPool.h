@@ -0,0 +1,112 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "lib/self_test.h"
+
+#include "lib/sysdep/cpu.h"
+#include "ps/ThreadPool.h"
+
+class TestThreadPool : public CxxTest::TestSuite
+{
+	struct JobData
+	{
+		std::vector<int> counts;
+	};
+
+	static void CountItems(void* cbdata, size_t begin, size_t end)
+	{
+		JobData* data = static_cast<JobData*>(cbdata);
+		TS_ASSERT_LESS_THAN(begin, end);
+		TS_ASSERT_LESS_THAN_EQUALS(end, data->counts.size());
+		// Each item belongs to exactly one chunk, so there's no contention here
+		for (size_t i = begin; i < end; ++i)
+			++data->counts[i];
+	}
+
+	void check(CThreadPool& pool, size_t count, size_t chunkSize)
+	{
+		JobData data;
+		data.counts.resize(count, 0);
+
+		pool.ParallelFor(count, chunkSize, &CountItems, &data);
+
+		for (size_t i = 0; i < count; ++i)
+			TS_ASSERT_EQUALS(data.counts[i], 1);
+	}
+
+	struct NestedData
+	{
+		CThreadPool* pool;
+		volatile intptr_t numFinished;
+	};
+
+	static void NestedTask(void* cbdata)
+	{
+		NestedData* data = static_cast<NestedData*>(cbdata);
+
+		JobData job;
+		job.counts.resize(100, 0);
+		data->pool->ParallelFor(job.counts.size(), 3, &CountItems, &job);
+		for (size_t i = 0; i < job.counts.size(); ++i)
+			TS_ASSERT_EQUALS(job.counts[i], 1);
+
+		cpu_AtomicAdd(&data->numFinished, 1);
+	}
+
+	void check_tasks(CThreadPool& pool)
+	{
+		NestedData data = { &pool, 0 };
+		CThreadPool::TaskGroup group;
+		TS_ASSERT(group.IsDone());
+
+		for (size_t i = 0; i < 50; ++i)
+			pool.Submit(&NestedTask, &data, &group);
+		pool.Wait(group);
+
+		TS_ASSERT(group.IsDone());
+		TS_ASSERT_EQUALS(data.numFinished, 50);
+	}
+
+public:
+	void test_serial()
+	{
+		CThreadPool pool(0);
+		TS_ASSERT_EQUALS(pool.GetNumWorkers(), (size_t)0);
+		check(pool, 0, 1);
+		check(pool, 1, 1);
+		check(pool, 100, 7);
+		check_tasks(pool);
+	}
+
+	void test_parallel()
+	{
+		CThreadPool pool(3);
+		TS_ASSERT_EQUALS(pool.GetNumWorkers(), (size_t)3);
+		check(pool, 0, 1);
+		check(pool, 1, 16);
+		check(pool, 5, 1);
+		check(pool, 1000, 1);
+		check(pool, 1000, 64);
+
+		// The pool must be reusable for many jobs in a row
+		for (size_t i = 0; i < 100; ++i)
+			check(pool, 200, 8);
+
+		check_tasks(pool);
+	}
+};
@@ -0,0 +1,112 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "AdaptiveQuality.h"
+
+#include "maths/MathUtil.h"
+
+namespace
+{
+
+// Number of frames averaged before deciding whether to change level
+const size_t EVALUATION_FRAMES = 30;
+
+// Number of frames ignored after a change of level
+const size_t SETTLE_FRAMES = 10;
+
+// Reduce quality when the average is over the budget by this factor, and
+// only increase it again when it's comfortably under (so we don't keep
+// switching back and forth between two levels)
+const double DECREASE_THRESHOLD = 1.05;
+const double INCREASE_THRESHOLD = 0.75;
+
+const CAdaptiveQuality::Settings QUALITY_LEVELS[] = {
+	// scale, particle density, shadow map divisor, water effects
+	{ 1.0f, 1.0f, 1, true },
+	{ 0.9f, 1.0f, 1, true },
+	{ 0.8f, 0.75f, 1, true },
+	{ 0.8f, 0.75f, 2, true },
+	{ 0.7f, 0.5f, 2, true },
+	{ 0.7f, 0.5f, 2, false },
+	{ 0.6f, 0.5f, 4, false },
+	{ 0.5f, 0.25f, 4, false },
+};
+
+} // anonymous namespace
+
+CAdaptiveQuality::CAdaptiveQuality(double targetFrameTime, float minScale) :
+	m_TargetFrameTime(targetFrameTime), m_MinScale(clamp(minScale, 0.1f, 1.0f)), m_Level(0)
+{
+	StartPeriod(0);
+}
+
+size_t CAdaptiveQuality::GetNumLevels()
+{
+	return ARRAY_SIZE(QUALITY_LEVELS);
+}
+
+CAdaptiveQuality::Settings CAdaptiveQuality::GetSettings() const
+{
+	Settings settings = QUALITY_LEVELS[m_Level];
+	settings.m_ResolutionScale = std::max(settings.m_ResolutionScale, m_MinScale);
+	return settings;
+}
+
+void CAdaptiveQuality::Reset()
+{
+	m_Level = 0;
+	StartPeriod(0);
+}
+
+void CAdaptiveQuality::StartPeriod(size_t ignoredFrames)
+{
+	m_IgnoredFrames = ignoredFrames;
+	m_Frames = 0;
+	m_TotalTime = 0.0;
+}
+
+bool CAdaptiveQuality::RecordFrame(double time)
+{
+	if (m_IgnoredFrames)
+	{
+		--m_IgnoredFrames;
+		return false;
+	}
+
+	m_TotalTime += time;
+	if (++m_Frames < EVALUATION_FRAMES)
+		return false;
+
+	double average = m_TotalTime / m_Frames;
+	size_t level = m_Level;
+	if (average > m_TargetFrameTime * DECREASE_THRESHOLD && m_Level + 1 < GetNumLevels())
+		++level;
+	else if (average < m_TargetFrameTime * INCREASE_THRESHOLD && m_Level > 0)
+		--level;
+
+	if (level == m_Level)
+	{
+		StartPeriod(0);
+		return false;
+	}
+
+	m_Level = level;
+	StartPeriod(SETTLE_FRAMES);
+	return true;
+}
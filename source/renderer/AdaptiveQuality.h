@@ -0,0 +1,86 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_ADAPTIVEQUALITY
+#define INCLUDED_ADAPTIVEQUALITY
+
+/**
+ * Adaptive quality controller: given the time taken by each rendered frame,
+ * steps through a fixed ladder of quality levels to keep the average frame
+ * time under a target budget. The first steps only reduce the resolution the
+ * scene is rendered at (it's then upscaled to the screen), and further steps
+ * also reduce secondary settings (particle density, shadow map size, water
+ * reflections and refraction).
+ *
+ * This only decides the settings; CRenderer measures the frames and applies them.
+ */
+class CAdaptiveQuality
+{
+public:
+	struct Settings
+	{
+		// fraction of the screen's width and height to render the scene at
+		float m_ResolutionScale;
+		// fraction of particles to emit
+		float m_ParticleDensity;
+		// the shadow map size is divided by this
+		int m_ShadowMapDivisor;
+		// whether the user's water reflection and refraction settings are allowed
+		bool m_WaterEffects;
+	};
+
+	/**
+	 * @param targetFrameTime frame time budget, in seconds
+	 * @param minScale lowest resolution scale to use
+	 */
+	CAdaptiveQuality(double targetFrameTime, float minScale);
+
+	/**
+	 * Record the time (in seconds) taken by one frame.
+	 * @return true if the quality level changed, so GetSettings must be reapplied
+	 */
+	bool RecordFrame(double time);
+
+	/**
+	 * Return to the full quality level (e.g. when starting a new game).
+	 */
+	void Reset();
+
+	/**
+	 * @return current level, from 0 (full quality) to GetNumLevels()-1
+	 */
+	size_t GetLevel() const { return m_Level; }
+	static size_t GetNumLevels();
+
+	Settings GetSettings() const;
+
+private:
+	void StartPeriod(size_t ignoredFrames);
+
+	double m_TargetFrameTime;
+	float m_MinScale;
+	size_t m_Level;
+
+	// frames to wait for before measuring (the GPU times lag a few frames
+	// behind, so the first ones after a change would be at the old level)
+	size_t m_IgnoredFrames;
+	// frames measured in the current evaluation period, and their total time
+	size_t m_Frames;
+	double m_TotalTime;
+};
+
+#endif // INCLUDED_ADAPTIVEQUALITY
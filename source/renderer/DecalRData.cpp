@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -33,10 +33,10 @@
 #include "simulation2/Simulation2.h"
 #include "simulation2/components/ICmpWaterManager.h"
 
-// TODO: Currently each decal is a separate CDecalRData. We might want to use
+// TODO: Currently each decal is a separate CDecalRData with its own vertex and
+// index arrays, so each one still needs its own draw call. We might want to use
 // lots of decals for special effects like shadows, footprints, etc, in which
-// case we should probably redesign this to batch them all together for more
-// efficient rendering.
+// case we should probably redesign this to share the geometry too.
 
 CDecalRData::CDecalRData(CModelDecal* decal, CSimulation2* simulation)
 	: m_Decal(decal), m_IndexArray(GL_STATIC_DRAW), m_Array(GL_STATIC_DRAW), m_Simulation(simulation)
@@ -70,17 +70,60 @@ void CDecalRData::Update(CSimulation2* simulation)
 	}
 }
 
+/**
+ * Orders decals so that ones whose materials can be rendered with the same
+ * shader state (in practice, the ones using the same texture) are adjacent.
+ */
+struct DecalMaterialLess
+{
+	bool operator()(CDecalRData* a, CDecalRData* b) const
+	{
+		const CMaterial& ma = a->GetDecal()->m_Decal.m_Material;
+		const CMaterial& mb = b->GetDecal()->m_Decal.m_Material;
+
+		if (!(ma.GetShaderEffect() == mb.GetShaderEffect()))
+			return ma.GetShaderEffect() < mb.GetShaderEffect();
+		if (ma.GetShaderDefines() != mb.GetShaderDefines())
+			return ma.GetShaderDefines() < mb.GetShaderDefines();
+
+		const CMaterial::SamplersVector& sa = ma.GetSamplers();
+		const CMaterial::SamplersVector& sb = mb.GetSamplers();
+		if (sa.size() != sb.size())
+			return sa.size() < sb.size();
+		for (size_t i = 0; i < sa.size(); ++i)
+		{
+			if (!(sa[i].Name == sb[i].Name))
+				return sa[i].Name < sb[i].Name;
+			if (sa[i].Sampler != sb[i].Sampler)
+				return sa[i].Sampler < sb[i].Sampler;
+		}
+
+		if (ma.GetStaticUniforms() != mb.GetStaticUniforms())
+			return ma.GetStaticUniforms() < mb.GetStaticUniforms();
+
+		return false;
+	}
+};
+
 void CDecalRData::RenderDecals(std::vector<CDecalRData*>& decals, const CShaderDefines& context, 
 			       ShadowMap* shadow, bool isDummyShader, const CShaderProgramPtr& dummy)
 {
 	CShaderDefines contextDecal = context;
 	contextDecal.Add("DECAL", "1");
 
-	for (size_t i = 0; i < decals.size(); ++i)
+	// Set up the shader, textures and uniforms once for each group of decals with
+	// equivalent materials, then just draw each decal's geometry.
+	// (The sort changes the order that overlapping decals with different materials
+	// get blended in, but that order was arbitrary anyway.)
+	std::stable_sort(decals.begin(), decals.end(), DecalMaterialLess());
+
+	for (size_t groupStart = 0, groupEnd = 0; groupStart < decals.size(); groupStart = groupEnd)
 	{
-		CDecalRData *decal = decals[i];
-		
-		CMaterial &material = decal->m_Decal->m_Decal.m_Material;
+		for (groupEnd = groupStart + 1; groupEnd < decals.size(); ++groupEnd)
+			if (DecalMaterialLess()(decals[groupStart], decals[groupEnd]))
+				break;
+
+		CMaterial &material = decals[groupStart]->m_Decal->m_Decal.m_Material;
 		
 		if (material.GetShaderEffect().length() == 0)
 		{
@@ -121,12 +164,12 @@ void CDecalRData::RenderDecals(std::vector<CDecalRData*>& decals, const CShaderD
 				
 			if (material.GetSamplers().size() != 0)
 			{
-				CMaterial::SamplersVector samplers = material.GetSamplers();
+				const CMaterial::SamplersVector& samplers = material.GetSamplers();
 				size_t samplersNum = samplers.size();
 				
 				for (size_t s = 0; s < samplersNum; ++s)
 				{
-					CMaterial::TextureSampler &samp = samplers[s];
+					const CMaterial::TextureSampler &samp = samplers[s];
 					shader->BindTexture(samp.Name.c_str(), samp.Sampler);
 				}
 				
@@ -143,37 +186,41 @@ void CDecalRData::RenderDecals(std::vector<CDecalRData*>& decals, const CShaderD
 				//	m_Decal->GetBounds().Render();
 				//	glEnable(GL_TEXTURE_2D);
 
-				u8* base = decal->m_Array.Bind();
-				GLsizei stride = (GLsizei)decal->m_Array.GetStride();
+				for (size_t i = groupStart; i < groupEnd; ++i)
+				{
+					CDecalRData *decal = decals[i];
+
+					u8* base = decal->m_Array.Bind();
+					GLsizei stride = (GLsizei)decal->m_Array.GetStride();
 
-				u8* indexBase = decal->m_IndexArray.Bind();
+					u8* indexBase = decal->m_IndexArray.Bind();
 
 #if !CONFIG2_GLES
-				if (isDummyShader)
-				{
-					glColor3fv(decal->m_Decal->GetShadingColor().FloatArray());
-				}
-				else
+					if (isDummyShader)
+					{
+						glColor3fv(decal->m_Decal->GetShadingColor().FloatArray());
+					}
+					else
 #endif
-				{
-					
-					shader->Uniform("shadingColor", decal->m_Decal->GetShadingColor());
-				}
+					{
+						shader->Uniform("shadingColor", decal->m_Decal->GetShadingColor());
+					}
 
-				shader->VertexPointer(3, GL_FLOAT, stride, base + decal->m_Position.offset);
-				shader->ColorPointer(4, GL_UNSIGNED_BYTE, stride, base + decal->m_DiffuseColor.offset);
-				shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, stride, base + decal->m_UV.offset);
+					shader->VertexPointer(3, GL_FLOAT, stride, base + decal->m_Position.offset);
+					shader->ColorPointer(4, GL_UNSIGNED_BYTE, stride, base + decal->m_DiffuseColor.offset);
+					shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, stride, base + decal->m_UV.offset);
 
-				shader->AssertPointersBound();
+					shader->AssertPointersBound();
 
-				if (!g_Renderer.m_SkipSubmit)
-				{
-					glDrawElements(GL_TRIANGLES, (GLsizei)decal->m_IndexArray.GetNumVertices(), GL_UNSIGNED_SHORT, indexBase);
-				}
+					if (!g_Renderer.m_SkipSubmit)
+					{
+						glDrawElements(GL_TRIANGLES, (GLsizei)decal->m_IndexArray.GetNumVertices(), GL_UNSIGNED_SHORT, indexBase);
+					}
 
-				// bump stats
-				g_Renderer.m_Stats.m_DrawCalls++;
-				g_Renderer.m_Stats.m_TerrainTris += decal->m_IndexArray.GetNumVertices() / 3;
+					// bump stats
+					g_Renderer.m_Stats.m_DrawCalls++;
+					g_Renderer.m_Stats.m_TerrainTris += decal->m_IndexArray.GetNumVertices() / 3;
+				}
 
 				CVertexBuffer::Unbind();
 			}
@@ -0,0 +1,114 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_DRAWKEY
+#define INCLUDED_DRAWKEY
+
+/**
+ * @file
+ * Helpers for ordering draw calls by 64-bit sort keys.
+ *
+ * A renderer packs the state that each draw needs (pass, technique, mesh, textures,
+ * uniforms, or depth for blended geometry) into a u64, with the most expensive
+ * state changes in the highest bits, and stores it in a flat array of items with
+ * a 'key' member. RadixSortDrawItems then puts the array into an order that groups
+ * draws sharing the same state. The arrays can be kept between frames, so neither
+ * building nor sorting them allocates memory once they've grown to the needed size.
+ *
+ * Fields that identify objects are only hashes of their addresses, so two different
+ * objects might get the same value. That just makes the batching slightly worse,
+ * since the rendering code still compares the real objects before skipping a state change.
+ */
+
+namespace DrawKey
+{
+
+/**
+ * Returns a @p bits-bit value derived from the pointer, so that
+ * draws using the same object get the same value.
+ */
+inline u64 HashPointer(const void* ptr, int bits)
+{
+	u64 x = (u64)(uintptr_t)ptr;
+	// (finalizer from MurmurHash3, to mix the significant middle bits into the top)
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdull;
+	x ^= x >> 33;
+	return x >> (64 - bits);
+}
+
+/**
+ * Returns a 32-bit value whose unsigned order is the same as the order of the floats.
+ */
+inline u32 SortableFloat(float f)
+{
+	u32 u;
+	memcpy(&u, &f, sizeof(u));
+	return (u & 0x80000000u) ? ~u : (u | 0x80000000u);
+}
+
+} // namespace DrawKey
+
+/**
+ * Sorts @p items by their u64 'key' member, in increasing order.
+ * The sort is stable, so items with equal keys keep their relative order.
+ * @param temp scratch space (reused to avoid allocating each time)
+ */
+template<typename T>
+void RadixSortDrawItems(std::vector<T>& items, std::vector<T>& temp)
+{
+	const size_t n = items.size();
+	if (n < 2)
+		return;
+
+	temp.resize(n);
+
+	// LSD radix sort, one byte per pass
+	bool sortedIntoTemp = false;
+	for (int shift = 0; shift < 64; shift += 8)
+	{
+		const T* src = sortedIntoTemp ? &temp[0] : &items[0];
+		T* dst = sortedIntoTemp ? &items[0] : &temp[0];
+
+		size_t offsets[256] = { 0 };
+		for (size_t i = 0; i < n; ++i)
+			++offsets[(src[i].key >> shift) & 0xff];
+
+		// Skip the pass when all keys share this byte (typically most of them,
+		// since keys have few distinct values in each field)
+		if (offsets[(src[0].key >> shift) & 0xff] == n)
+			continue;
+
+		size_t total = 0;
+		for (size_t b = 0; b < 256; ++b)
+		{
+			size_t count = offsets[b];
+			offsets[b] = total;
+			total += count;
+		}
+
+		for (size_t i = 0; i < n; ++i)
+			dst[offsets[(src[i].key >> shift) & 0xff]++] = src[i];
+
+		sortedIntoTemp = !sortedIntoTemp;
+	}
+
+	if (sortedIntoTemp)
+		items.swap(temp);
+}
+
+#endif // INCLUDED_DRAWKEY
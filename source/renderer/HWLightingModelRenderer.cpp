@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -181,11 +181,13 @@ CModelRData* ShaderModelVertexRenderer::CreateModelData(const void* key, CModel*
 }
 
 
-// Fill in and upload dynamic vertex array
-void ShaderModelVertexRenderer::UpdateModelData(CModel* model, CModelRData* data, int updateflags)
+// Fill in dynamic vertex array (may be called from any thread)
+void ShaderModelVertexRenderer::PrepareModelData(CModel* model, CModelRData* data, int updateflags)
 {
 	ShaderModel* shadermodel = static_cast<ShaderModel*>(data);
-	
+
+	// (The CPU lighting path shares the m->normals scratch space between all
+	// models, so it's done serially in UpdateModelData instead)
 	if (!m->cpuLighting && (updateflags & RENDERDATA_UPDATE_VERTICES))
 	{
 		// build vertices
@@ -193,8 +195,17 @@ void ShaderModelVertexRenderer::UpdateModelData(CModel* model, CModelRData* data
 		VertexArrayIterator<CVector3D> Normal = shadermodel->m_Normal.GetIterator<CVector3D>();
 
 		ModelRenderer::BuildPositionAndNormals(model, Position, Normal);
+	}
+}
 
-		// upload everything to vertex buffer
+// Upload dynamic vertex array
+void ShaderModelVertexRenderer::UpdateModelData(CModel* model, CModelRData* data, int updateflags)
+{
+	ShaderModel* shadermodel = static_cast<ShaderModel*>(data);
+	
+	if (!m->cpuLighting && (updateflags & RENDERDATA_UPDATE_VERTICES))
+	{
+		// upload everything that PrepareModelData built to vertex buffer
 		shadermodel->m_Array.Upload();
 	}
 
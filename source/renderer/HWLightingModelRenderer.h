@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -40,6 +40,7 @@ public:
 
 	// Implementations
 	CModelRData* CreateModelData(const void* key, CModel* model);
+	void PrepareModelData(CModel* model, CModelRData* data, int updateflags);
 	void UpdateModelData(CModel* model, CModelRData* data, int updateflags);
 
 	void BeginPass(int streamflags);
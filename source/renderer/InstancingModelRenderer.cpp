@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -21,11 +21,17 @@
 
 #include "precompiled.h"
 
+#include "lib/bits.h"
 #include "lib/ogl.h"
+#include "maths/MD5.h"
 #include "maths/Vector3D.h"
 #include "maths/Vector4D.h"
 
+#include "ps/CacheLoader.h"
 #include "ps/CLogger.h"
+#include "ps/FileIo.h"
+#include "ps/Filesystem.h"
+#include "ps/Game.h"
 
 #include "graphics/Color.h"
 #include "graphics/LightEnv.h"
@@ -62,14 +68,28 @@ struct IModelDef : public CModelDefRPrivate
 	VertexIndexArray m_IndexArray;
 
 	IModelDef(const CModelDefPtr& mdef, bool gpuSkinning, bool calculateTangents);
+
+private:
+	void BuildWithTangents(const CModelDefPtr& mdef, bool gpuSkinning);
+	void Build(const CModelDefPtr& mdef, bool gpuSkinning);
+
+	/**
+	 * Load the laid-out vertex and index data from the cache, if there's a
+	 * version matching the current layout. Returns false if not.
+	 */
+	bool LoadCached(const VfsPath& cachePath);
+	void SaveCached(const VfsPath& cachePath);
 };
 
+// Version of the cached vertex data format. This should be incremented
+// whenever it (or anything that affects its contents, like the tangent
+// generation or vertex cache optimisation) changes.
+static const u32 VERTEX_DATA_CACHE_VERSION = 1;
+
 
 IModelDef::IModelDef(const CModelDefPtr& mdef, bool gpuSkinning, bool calculateTangents)
 	: m_IndexArray(GL_STATIC_DRAW), m_Array(GL_STATIC_DRAW)
 {
-	size_t numVertices = mdef->GetNumVertices();
-
 	m_Position.type = GL_FLOAT;
 	m_Position.elems = 3;
 	m_Array.AddAttribute(&m_Position);
@@ -99,175 +119,295 @@ IModelDef::IModelDef(const CModelDefPtr& mdef, bool gpuSkinning, bool calculateT
 	
 	if (calculateTangents)
 	{
-		// Generate tangents for the geometry:-
-		
 		m_Tangent.type = GL_FLOAT;
 		m_Tangent.elems = 4;
 		m_Array.AddAttribute(&m_Tangent);
-		
-		// floats per vertex; position + normal + tangent + UV*sets [+ GPUskinning]
-		int numVertexAttrs = 3 + 3 + 4 + 2 * mdef->GetNumUVsPerVertex();
-		if (gpuSkinning)
-		{
-			numVertexAttrs += 8;
-		}
-		
-		// the tangent generation can increase the number of vertices temporarily
-		// so reserve a bit more memory to avoid reallocations in GenTangents (in most cases)
-		std::vector<float> newVertices;
-		newVertices.reserve(numVertexAttrs * numVertices * 2);
-		
-		// Generate the tangents
-		ModelRenderer::GenTangents(mdef, newVertices, gpuSkinning);
-		
-		// how many vertices do we have after generating tangents?
-		int newNumVert = newVertices.size() / numVertexAttrs;
-		
-		std::vector<int> remapTable(newNumVert);
-		std::vector<float> vertexDataOut(newNumVert * numVertexAttrs);
+	}
+
+	// Generating the vertex data (particularly the tangents) and optimising it
+	// is slow, so it's cached as files in the final layout
+	VfsPath cachePath;
+	if (!mdef->GetFilename().empty())
+	{
+		CCacheLoader cacheLoader(g_VFS, L".pmv");
+		MD5 hash;
+		hash.Update((const u8*)&gpuSkinning, sizeof(gpuSkinning));
+		hash.Update((const u8*)&calculateTangents, sizeof(calculateTangents));
+		if (cacheLoader.TryLoadingCached(mdef->GetFilename(), hash, VERTEX_DATA_CACHE_VERSION, cachePath) < 0)
+			cachePath = VfsPath();
+	}
+
+	if (cachePath.empty() || !LoadCached(cachePath))
+	{
+		if (calculateTangents)
+			BuildWithTangents(mdef, gpuSkinning);
+		else
+			Build(mdef, gpuSkinning);
+
+		ModelRenderer::OptimiseVertexCache((u16*)m_IndexArray.GetBackingStore(), m_IndexArray.GetNumVertices(),
+			m_Array.GetBackingStore(), m_Array.GetNumVertices(), m_Array.GetStride());
+
+		if (!cachePath.empty())
+			SaveCached(cachePath);
+	}
+
+	m_Array.Upload();
+	m_Array.FreeBackingStore();
+
+	m_IndexArray.Upload();
+	m_IndexArray.FreeBackingStore();
+}
+
+void IModelDef::BuildWithTangents(const CModelDefPtr& mdef, bool gpuSkinning)
+{
+	size_t numVertices = mdef->GetNumVertices();
+
+	// floats per vertex; position + normal + tangent + UV*sets [+ GPUskinning]
+	int numVertexAttrs = 3 + 3 + 4 + 2 * mdef->GetNumUVsPerVertex();
+	if (gpuSkinning)
+	{
+		numVertexAttrs += 8;
+	}
+	
+	// the tangent generation can increase the number of vertices temporarily
+	// so reserve a bit more memory to avoid reallocations in GenTangents (in most cases)
+	std::vector<float> newVertices;
+	newVertices.reserve(numVertexAttrs * numVertices * 2);
+	
+	// Generate the tangents
+	ModelRenderer::GenTangents(mdef, newVertices, gpuSkinning);
+	
+	// how many vertices do we have after generating tangents?
+	int newNumVert = newVertices.size() / numVertexAttrs;
+	
+	std::vector<int> remapTable(newNumVert);
+	std::vector<float> vertexDataOut(newNumVert * numVertexAttrs);
 
-		// re-weld the mesh to remove duplicated vertices
-		int numVertices2 = WeldMesh(&remapTable[0], &vertexDataOut[0],
-					&newVertices[0], newNumVert, numVertexAttrs);
+	// re-weld the mesh to remove duplicated vertices
+	int numVertices2 = WeldMesh(&remapTable[0], &vertexDataOut[0],
+				&newVertices[0], newNumVert, numVertexAttrs);
 
-		// Copy the model data to graphics memory:-
+	// Copy the model data into the vertex array:-
+	
+	m_Array.SetNumVertices(numVertices2);
+	m_Array.Layout();
+
+	VertexArrayIterator<CVector3D> Position = m_Position.GetIterator<CVector3D>();
+	VertexArrayIterator<CVector3D> Normal = m_Normal.GetIterator<CVector3D>();
+	VertexArrayIterator<CVector4D> Tangent = m_Tangent.GetIterator<CVector4D>();
+	
+	VertexArrayIterator<u8[4]> BlendJoints;
+	VertexArrayIterator<u8[4]> BlendWeights;
+	if (gpuSkinning)
+	{
+		BlendJoints = m_BlendJoints.GetIterator<u8[4]>();
+		BlendWeights = m_BlendWeights.GetIterator<u8[4]>();
+	}
+	
+	// copy everything into the vertex array
+	for (int i = 0; i < numVertices2; i++)
+	{
+		int q = numVertexAttrs * i;
 		
-		m_Array.SetNumVertices(numVertices2);
-		m_Array.Layout();
+		Position[i] = CVector3D(vertexDataOut[q + 0], vertexDataOut[q + 1], vertexDataOut[q + 2]);
+		q += 3;
+		
+		Normal[i] = CVector3D(vertexDataOut[q + 0], vertexDataOut[q + 1], vertexDataOut[q + 2]);
+		q += 3;
 
-		VertexArrayIterator<CVector3D> Position = m_Position.GetIterator<CVector3D>();
-		VertexArrayIterator<CVector3D> Normal = m_Normal.GetIterator<CVector3D>();
-		VertexArrayIterator<CVector4D> Tangent = m_Tangent.GetIterator<CVector4D>();
+		Tangent[i] = CVector4D(vertexDataOut[q + 0], vertexDataOut[q + 1], vertexDataOut[q + 2], 
+				vertexDataOut[q + 3]);
+		q += 4;
 		
-		VertexArrayIterator<u8[4]> BlendJoints;
-		VertexArrayIterator<u8[4]> BlendWeights;
 		if (gpuSkinning)
 		{
-			BlendJoints = m_BlendJoints.GetIterator<u8[4]>();
-			BlendWeights = m_BlendWeights.GetIterator<u8[4]>();
-		}
-		
-		// copy everything into the vertex array
-		for (int i = 0; i < numVertices2; i++)
-		{
-			int q = numVertexAttrs * i;
-			
-			Position[i] = CVector3D(vertexDataOut[q + 0], vertexDataOut[q + 1], vertexDataOut[q + 2]);
-			q += 3;
-			
-			Normal[i] = CVector3D(vertexDataOut[q + 0], vertexDataOut[q + 1], vertexDataOut[q + 2]);
-			q += 3;
-
-			Tangent[i] = CVector4D(vertexDataOut[q + 0], vertexDataOut[q + 1], vertexDataOut[q + 2], 
-					vertexDataOut[q + 3]);
-			q += 4;
-			
-			if (gpuSkinning)
-			{
-				for (size_t j = 0; j < 4; ++j)
-				{
-					BlendJoints[i][j] = (u8)vertexDataOut[q + 0 + 2 * j];
-					BlendWeights[i][j] = (u8)vertexDataOut[q + 1 + 2 * j];
-				}
-				q += 8;
-			}
-			
-			for (size_t j = 0; j < mdef->GetNumUVsPerVertex(); j++)
+			for (size_t j = 0; j < 4; ++j)
 			{
-				VertexArrayIterator<float[2]> UVit = m_UVs[j].GetIterator<float[2]>();
-				UVit[i][0] = vertexDataOut[q + 0 + 2 * j];
-				UVit[i][1] = vertexDataOut[q + 1 + 2 * j];
+				BlendJoints[i][j] = (u8)vertexDataOut[q + 0 + 2 * j];
+				BlendWeights[i][j] = (u8)vertexDataOut[q + 1 + 2 * j];
 			}
+			q += 8;
 		}
-
-		// upload vertex data
-		m_Array.Upload();
-		m_Array.FreeBackingStore();
-
-		m_IndexArray.SetNumVertices(mdef->GetNumFaces() * 3);
-		m_IndexArray.Layout();
-		
-		VertexArrayIterator<u16> Indices = m_IndexArray.GetIterator();
 		
-		size_t idxidx = 0;	
-
-		// reindex geometry and upload index
-		for (size_t j = 0; j < mdef->GetNumFaces(); ++j) 
-		{	
-			Indices[idxidx++] = remapTable[j * 3 + 0];
-			Indices[idxidx++] = remapTable[j * 3 + 1];
-			Indices[idxidx++] = remapTable[j * 3 + 2];
+		for (size_t j = 0; j < mdef->GetNumUVsPerVertex(); j++)
+		{
+			VertexArrayIterator<float[2]> UVit = m_UVs[j].GetIterator<float[2]>();
+			UVit[i][0] = vertexDataOut[q + 0 + 2 * j];
+			UVit[i][1] = vertexDataOut[q + 1 + 2 * j];
 		}
-		
-		m_IndexArray.Upload();
-		m_IndexArray.FreeBackingStore();
 	}
-	else
-	{
-		// Upload model without calculating tangents:-
-		
-		m_Array.SetNumVertices(numVertices);
-		m_Array.Layout();
 
-		VertexArrayIterator<CVector3D> Position = m_Position.GetIterator<CVector3D>();
-		VertexArrayIterator<CVector3D> Normal = m_Normal.GetIterator<CVector3D>();
+	m_IndexArray.SetNumVertices(mdef->GetNumFaces() * 3);
+	m_IndexArray.Layout();
+	
+	VertexArrayIterator<u16> Indices = m_IndexArray.GetIterator();
+	
+	size_t idxidx = 0;	
+
+	// reindex geometry
+	for (size_t j = 0; j < mdef->GetNumFaces(); ++j) 
+	{	
+		Indices[idxidx++] = remapTable[j * 3 + 0];
+		Indices[idxidx++] = remapTable[j * 3 + 1];
+		Indices[idxidx++] = remapTable[j * 3 + 2];
+	}
+}
+
+void IModelDef::Build(const CModelDefPtr& mdef, bool gpuSkinning)
+{
+	size_t numVertices = mdef->GetNumVertices();
 
-		ModelRenderer::CopyPositionAndNormals(mdef, Position, Normal);
+	m_Array.SetNumVertices(numVertices);
+	m_Array.Layout();
 
-		for (size_t i = 0; i < mdef->GetNumUVsPerVertex(); i++)
-		{
-			VertexArrayIterator<float[2]> UVit = m_UVs[i].GetIterator<float[2]>();
-			ModelRenderer::BuildUV(mdef, UVit, i);
-		}
+	VertexArrayIterator<CVector3D> Position = m_Position.GetIterator<CVector3D>();
+	VertexArrayIterator<CVector3D> Normal = m_Normal.GetIterator<CVector3D>();
 
-		if (gpuSkinning)
+	ModelRenderer::CopyPositionAndNormals(mdef, Position, Normal);
+
+	for (size_t i = 0; i < mdef->GetNumUVsPerVertex(); i++)
+	{
+		VertexArrayIterator<float[2]> UVit = m_UVs[i].GetIterator<float[2]>();
+		ModelRenderer::BuildUV(mdef, UVit, i);
+	}
+
+	if (gpuSkinning)
+	{
+		VertexArrayIterator<u8[4]> BlendJoints = m_BlendJoints.GetIterator<u8[4]>();
+		VertexArrayIterator<u8[4]> BlendWeights = m_BlendWeights.GetIterator<u8[4]>();
+		for (size_t i = 0; i < numVertices; ++i)
 		{
-			VertexArrayIterator<u8[4]> BlendJoints = m_BlendJoints.GetIterator<u8[4]>();
-			VertexArrayIterator<u8[4]> BlendWeights = m_BlendWeights.GetIterator<u8[4]>();
-			for (size_t i = 0; i < numVertices; ++i)
+			const SModelVertex& vtx = mdef->GetVertices()[i];
+			for (size_t j = 0; j < 4; ++j)
 			{
-				const SModelVertex& vtx = mdef->GetVertices()[i];
-				for (size_t j = 0; j < 4; ++j)
-				{
-					BlendJoints[i][j] = vtx.m_Blend.m_Bone[j];
-					BlendWeights[i][j] = (u8)(255.f * vtx.m_Blend.m_Weight[j]);
-				}
+				BlendJoints[i][j] = vtx.m_Blend.m_Bone[j];
+				BlendWeights[i][j] = (u8)(255.f * vtx.m_Blend.m_Weight[j]);
 			}
 		}
+	}
 
-		m_Array.Upload();
-		m_Array.FreeBackingStore();
+	m_IndexArray.SetNumVertices(mdef->GetNumFaces()*3);
+	m_IndexArray.Layout();
+	ModelRenderer::BuildIndices(mdef, m_IndexArray.GetIterator());
+}
 
-		m_IndexArray.SetNumVertices(mdef->GetNumFaces()*3);
+bool IModelDef::LoadCached(const VfsPath& cachePath)
+{
+	try
+	{
+		CFileUnpacker unpacker;
+		unpacker.Read(cachePath, "PSMV");
+		if (unpacker.GetVersion() != VERTEX_DATA_CACHE_VERSION)
+			return false;
+
+		size_t numVertices = unpacker.UnpackSize();
+		size_t stride = unpacker.UnpackSize();
+		size_t numIndices = unpacker.UnpackSize();
+
+		m_Array.SetNumVertices(numVertices);
+		m_Array.Layout();
+
+		// The layout depends on the attributes and on VertexArray's alignment
+		// rules, so make sure it still matches before copying the data in
+		if (m_Array.GetStride() != stride)
+			return false;
+
+		m_IndexArray.SetNumVertices(numIndices);
 		m_IndexArray.Layout();
-		ModelRenderer::BuildIndices(mdef, m_IndexArray.GetIterator());
-		m_IndexArray.Upload();
-		m_IndexArray.FreeBackingStore();
+
+		unpacker.UnpackRaw(m_Array.GetBackingStore(), numVertices * stride);
+		unpacker.UnpackRaw(m_IndexArray.GetBackingStore(), numIndices * sizeof(u16));
+		return true;
+	}
+	catch (PSERROR_File&)
+	{
+		LOGERROR(L"Failed to load cached vertex data '%ls'", cachePath.string().c_str());
+		return false;
+	}
+}
+
+void IModelDef::SaveCached(const VfsPath& cachePath)
+{
+	CFilePacker packer(VERTEX_DATA_CACHE_VERSION, "PSMV");
+	packer.PackSize(m_Array.GetNumVertices());
+	packer.PackSize(m_Array.GetStride());
+	packer.PackSize(m_IndexArray.GetNumVertices());
+	packer.PackRaw(m_Array.GetBackingStore(), m_Array.GetNumVertices() * m_Array.GetStride());
+	packer.PackRaw(m_IndexArray.GetBackingStore(), m_IndexArray.GetNumVertices() * sizeof(u16));
+
+	try
+	{
+		packer.Write(cachePath);
+	}
+	catch (PSERROR_File&)
+	{
+		LOGERROR(L"Failed to save cached vertex data '%ls'", cachePath.string().c_str());
 	}
 }
 
 
 struct InstancingModelRendererInternals
 {
+	InstancingModelRendererInternals() : instanceArray(GL_STREAM_DRAW) { }
+
 	bool gpuSkinning;
 	
 	bool calculateTangents;
 
+	bool hwInstancing;
+
 	/// Previously prepared modeldef
 	IModelDef* imodeldef;
 
 	/// Index base for imodeldef
 	u8* imodeldefIndexBase;
+
+	/// Per-instance data for RenderModelsInstanced, reused for every batch
+	VertexArray instanceArray;
+	VertexArray::Attribute instanceTransform[4]; // columns of the model's transform matrix
+	VertexArray::Attribute instanceShadingColor;
+	VertexArray::Attribute instancePlayerColor;
+};
+
+// Names of the per-instance vertex attributes, matching
+// m->instanceTransform, m->instanceShadingColor, m->instancePlayerColor
+static const char* const g_InstanceTransformAttribs[4] = {
+	"a_instancingTransform0", "a_instancingTransform1", "a_instancingTransform2", "a_instancingTransform3"
 };
+static const char* const g_InstanceShadingColorAttrib = "a_instancingShadingColor";
+static const char* const g_InstancePlayerColorAttrib = "a_instancingPlayerColor";
+
+// Minimum number of instances to allocate space for, to avoid reallocating
+// the instance array for every slightly larger batch
+static const size_t MIN_INSTANCE_ARRAY_SIZE = 64;
 
 
 // Construction and Destruction
-InstancingModelRenderer::InstancingModelRenderer(bool gpuSkinning, bool calculateTangents)
+InstancingModelRenderer::InstancingModelRenderer(bool gpuSkinning, bool calculateTangents, bool hwInstancing)
 {
 	m = new InstancingModelRendererInternals;
 	m->gpuSkinning = gpuSkinning;
 	m->calculateTangents = calculateTangents;
+	m->hwInstancing = hwInstancing && !gpuSkinning;
 	m->imodeldef = 0;
+
+	if (m->hwInstancing)
+	{
+		for (size_t i = 0; i < 4; ++i)
+		{
+			m->instanceTransform[i].type = GL_FLOAT;
+			m->instanceTransform[i].elems = 4;
+			m->instanceArray.AddAttribute(&m->instanceTransform[i]);
+		}
+
+		m->instanceShadingColor.type = GL_FLOAT;
+		m->instanceShadingColor.elems = 4;
+		m->instanceArray.AddAttribute(&m->instanceShadingColor);
+
+		m->instancePlayerColor.type = GL_FLOAT;
+		m->instancePlayerColor.elems = 4;
+		m->instanceArray.AddAttribute(&m->instancePlayerColor);
+	}
 }
 
 InstancingModelRenderer::~InstancingModelRenderer()
@@ -389,3 +529,82 @@ void InstancingModelRenderer::RenderModel(const CShaderProgramPtr& shader, int U
 	g_Renderer.m_Stats.m_ModelTris += numFaces;
 
 }
+
+
+bool InstancingModelRenderer::SupportsInstancing(const CShaderProgramPtr& shader)
+{
+	// Only use instancing if the shader was written to read the
+	// per-instance data from vertex attributes
+	return m->hwInstancing && shader->HasVertexAttrib(g_InstanceTransformAttribs[0]);
+}
+
+
+// Render a batch of models sharing the current modeldef with one draw call
+void InstancingModelRenderer::RenderModelsInstanced(const CShaderProgramPtr& shader, int UNUSED(streamflags), CModel** models, size_t numModels)
+{
+	ENSURE(m->hwInstancing);
+
+	if (numModels > m->instanceArray.GetNumVertices())
+	{
+		m->instanceArray.SetNumVertices(round_up_to_pow2(std::max(numModels, MIN_INSTANCE_ARRAY_SIZE)));
+		m->instanceArray.Layout();
+	}
+
+	VertexArrayIterator<CVector4D> transform[4];
+	for (size_t i = 0; i < 4; ++i)
+		transform[i] = m->instanceTransform[i].GetIterator<CVector4D>();
+	VertexArrayIterator<CVector4D> shadingColor = m->instanceShadingColor.GetIterator<CVector4D>();
+	VertexArrayIterator<CVector4D> playerColor = m->instancePlayerColor.GetIterator<CVector4D>();
+
+	for (size_t j = 0; j < numModels; ++j)
+	{
+		const CMatrix3D& mat = models[j]->GetTransform();
+		for (size_t i = 0; i < 4; ++i)
+			*transform[i]++ = CVector4D(mat._data2d[i][0], mat._data2d[i][1], mat._data2d[i][2], mat._data2d[i][3]);
+
+		CColor shading = models[j]->GetShadingColor();
+		*shadingColor++ = CVector4D(shading.r, shading.g, shading.b, shading.a);
+
+		CColor player = g_Game->GetPlayerColour(models[j]->GetPlayerID());
+		*playerColor++ = CVector4D(player.r, player.g, player.b, player.a);
+	}
+
+	m->instanceArray.Upload(numModels);
+
+	u8* base = m->instanceArray.Bind();
+	GLsizei stride = (GLsizei)m->instanceArray.GetStride();
+
+	for (size_t i = 0; i < 4; ++i)
+	{
+		shader->VertexAttribPointer(g_InstanceTransformAttribs[i], 4, GL_FLOAT, GL_FALSE, stride, base + m->instanceTransform[i].offset);
+		shader->VertexAttribDivisor(g_InstanceTransformAttribs[i], 1);
+	}
+	// (The colours are optional; attributes that the shader doesn't declare are ignored)
+	shader->VertexAttribPointer(g_InstanceShadingColorAttrib, 4, GL_FLOAT, GL_FALSE, stride, base + m->instanceShadingColor.offset);
+	shader->VertexAttribDivisor(g_InstanceShadingColorAttrib, 1);
+	shader->VertexAttribPointer(g_InstancePlayerColorAttrib, 4, GL_FLOAT, GL_FALSE, stride, base + m->instancePlayerColor.offset);
+	shader->VertexAttribDivisor(g_InstancePlayerColorAttrib, 1);
+
+	CModelDefPtr mdldef = models[0]->GetModelDef();
+	size_t numFaces = mdldef->GetNumFaces();
+
+	if (!g_Renderer.m_SkipSubmit)
+	{
+#if CONFIG2_GLES
+		debug_warn(L"Instanced rendering not supported on GLES");
+#else
+		pglDrawElementsInstancedARB(GL_TRIANGLES, (GLsizei)numFaces*3, GL_UNSIGNED_SHORT, m->imodeldefIndexBase, (GLsizei)numModels);
+#endif
+	}
+
+	// Reset the divisors, since the attribute indexes may be reused by
+	// other shaders that expect per-vertex data
+	for (size_t i = 0; i < 4; ++i)
+		shader->VertexAttribDivisor(g_InstanceTransformAttribs[i], 0);
+	shader->VertexAttribDivisor(g_InstanceShadingColorAttrib, 0);
+	shader->VertexAttribDivisor(g_InstancePlayerColorAttrib, 0);
+
+	// bump stats
+	g_Renderer.m_Stats.m_DrawCalls++;
+	g_Renderer.m_Stats.m_ModelTris += numFaces*numModels;
+}
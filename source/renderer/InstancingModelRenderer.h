@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -31,11 +31,20 @@ struct InstancingModelRendererInternals;
  * Render non-animated (but potentially moving) models using a ShaderRenderModifier.
  * This computes and binds per-vertex data; the modifier is responsible
  * for setting any shader uniforms etc (including the instancing transform).
+ *
+ * If the shader declares the a_instancingTransform0..3 (and optionally
+ * a_instancingShadingColor and a_instancingPlayerColor) vertex attributes,
+ * batches of identical models can instead be drawn with a single
+ * hardware-instanced draw call, with the per-model data in an instance stream.
  */
 class InstancingModelRenderer : public ModelVertexRenderer
 {
 public:
-	InstancingModelRenderer(bool gpuSkinning, bool calculateTangents);
+	/**
+	 * @param hwInstancing allow drawing batches of models with hardware instancing
+	 * (ignored when gpuSkinning is true, since each model needs its own bone matrices)
+	 */
+	InstancingModelRenderer(bool gpuSkinning, bool calculateTangents, bool hwInstancing);
 	~InstancingModelRenderer();
 
 	// Implementations
@@ -47,6 +56,9 @@ public:
 	void PrepareModelDef(const CShaderProgramPtr& shader, int streamflags, const CModelDef& def);
 	void RenderModel(const CShaderProgramPtr& shader, int streamflags, CModel* model, CModelRData* data);
 
+	bool SupportsInstancing(const CShaderProgramPtr& shader);
+	void RenderModelsInstanced(const CShaderProgramPtr& shader, int streamflags, CModel** models, size_t numModels);
+
 protected:
 	InstancingModelRendererInternals* m;
 };
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -23,6 +23,7 @@
 
 #include "ps/CLogger.h"
 #include "ps/Profile.h"
+#include "ps/ThreadPool.h"
 
 #include "graphics/Color.h"
 #include "graphics/LightEnv.h"
@@ -32,6 +33,7 @@
 #include "graphics/ShaderManager.h"
 #include "graphics/TextureManager.h"
 
+#include "renderer/DrawKey.h"
 #include "renderer/MikktspaceWrap.h"
 #include "renderer/ModelRenderer.h"
 #include "renderer/ModelVertexRenderer.h"
@@ -112,7 +114,7 @@ void ModelRenderer::BuildPositionAndNormals(
 	}
 	else
 	{
-		PROFILE( "software transform" );
+		// (no PROFILE here, since this may be called from worker threads)
 		// just copy regular positions, transform normals to world space
 		const CMatrix3D& transform = model->GetTransform();
 		const CMatrix3D& invtransform = model->GetInvTransform();
@@ -157,6 +159,168 @@ void ModelRenderer::GenTangents(const CModelDefPtr& mdef, std::vector<float>& ne
 }
 
 
+// Number of entries in the simulated post-transform vertex cache. (The real
+// size varies between GPUs, but the algorithm isn't very sensitive to it.)
+static const int VERTEX_CACHE_SIZE = 32;
+
+// Score of a vertex for Forsyth's algorithm, based on its position in the
+// simulated cache (or -1 if it's not in there) and the number of triangles
+// that haven't been added yet that use it
+static float VertexCacheScore(int cachePosition, size_t remainingTris)
+{
+	if (remainingTris == 0)
+		return -1.f;
+
+	float score = 0.f;
+	if (cachePosition < 0)
+	{
+		// Not in the cache, so no bonus
+	}
+	else if (cachePosition < 3)
+	{
+		// Used by the last triangle - give it a fixed score, so we don't
+		// prefer triangles that would form a strip over the rest of the cache
+		score = 0.75f;
+	}
+	else
+	{
+		score = powf(1.f - (cachePosition - 3) / (float)(VERTEX_CACHE_SIZE - 3), 1.5f);
+	}
+
+	// Prefer vertices with few triangles left, to avoid leaving isolated triangles behind
+	score += 2.f / sqrtf((float)remainingTris);
+
+	return score;
+}
+
+void ModelRenderer::OptimiseVertexCache(u16* indices, size_t numIndices, u8* vertexData, size_t numVertices, size_t stride)
+{
+	const size_t numTris = numIndices / 3;
+	if (numTris == 0)
+		return;
+
+	// Find the triangles that use each vertex: vertexTris[firstTri[v]...] are the
+	// ones using vertex v, with the first remainingTris[v] of them not added yet
+	std::vector<size_t> firstTri(numVertices + 1, 0);
+	for (size_t i = 0; i < numIndices; ++i)
+		++firstTri[indices[i] + 1];
+	for (size_t v = 0; v < numVertices; ++v)
+		firstTri[v + 1] += firstTri[v];
+
+	std::vector<size_t> vertexTris(numIndices);
+	std::vector<size_t> remainingTris(numVertices, 0);
+	for (size_t i = 0; i < numIndices; ++i)
+	{
+		u16 v = indices[i];
+		vertexTris[firstTri[v] + remainingTris[v]++] = i / 3;
+	}
+
+	std::vector<int> cachePosition(numVertices, -1);
+	std::vector<float> vertexScore(numVertices);
+	for (size_t v = 0; v < numVertices; ++v)
+		vertexScore[v] = VertexCacheScore(-1, remainingTris[v]);
+
+	std::vector<float> triScore(numTris);
+	std::vector<bool> triAdded(numTris, false);
+	size_t bestTri = 0;
+	for (size_t t = 0; t < numTris; ++t)
+	{
+		triScore[t] = vertexScore[indices[t*3]] + vertexScore[indices[t*3 + 1]] + vertexScore[indices[t*3 + 2]];
+		if (triScore[t] > triScore[bestTri])
+			bestTri = t;
+	}
+
+	std::vector<u16> newIndices;
+	newIndices.reserve(numTris * 3);
+
+	// Most recently used vertex first; it can temporarily grow beyond the cache
+	// size when a triangle is added
+	std::vector<u16> cache;
+	cache.reserve(VERTEX_CACHE_SIZE + 3);
+
+	size_t nextUnadded = 0;
+
+	for (size_t n = 0; n < numTris; ++n)
+	{
+		if (bestTri == numTris)
+		{
+			// None of the cached vertices have any triangles left, so just take
+			// the next one that hasn't been added yet
+			while (triAdded[nextUnadded])
+				++nextUnadded;
+			bestTri = nextUnadded;
+		}
+
+		triAdded[bestTri] = true;
+
+		for (size_t k = 0; k < 3; ++k)
+		{
+			u16 v = indices[bestTri*3 + k];
+			newIndices.push_back(v);
+
+			// Move this triangle past the vertex's remaining ones
+			size_t* tris = &vertexTris[firstTri[v]];
+			size_t* last = tris + --remainingTris[v];
+			std::swap(*std::find(tris, last + 1, bestTri), *last);
+
+			std::vector<u16>::iterator it = std::find(cache.begin(), cache.end(), v);
+			if (it != cache.end())
+				cache.erase(it);
+			cache.insert(cache.begin(), v);
+		}
+
+		for (size_t i = 0; i < cache.size(); ++i)
+		{
+			u16 v = cache[i];
+			cachePosition[v] = (i < (size_t)VERTEX_CACHE_SIZE ? (int)i : -1);
+			vertexScore[v] = VertexCacheScore(cachePosition[v], remainingTris[v]);
+		}
+
+		// Only the triangles using cached vertices can have changed score, and
+		// they're the best candidates for the next one
+		bestTri = numTris;
+		float bestScore = -1.f;
+		for (size_t i = 0; i < cache.size(); ++i)
+		{
+			u16 v = cache[i];
+			for (size_t j = 0; j < remainingTris[v]; ++j)
+			{
+				size_t t = vertexTris[firstTri[v] + j];
+				triScore[t] = vertexScore[indices[t*3]] + vertexScore[indices[t*3 + 1]] + vertexScore[indices[t*3 + 2]];
+				if (triScore[t] > bestScore)
+				{
+					bestScore = triScore[t];
+					bestTri = t;
+				}
+			}
+		}
+
+		if (cache.size() > (size_t)VERTEX_CACHE_SIZE)
+			cache.resize(VERTEX_CACHE_SIZE);
+	}
+
+	// Renumber the vertices in the order they're first used, so they're
+	// fetched from memory sequentially too. (Unused vertices go at the end.)
+	std::vector<int> remap(numVertices, -1);
+	size_t nextVertex = 0;
+	for (size_t i = 0; i < numIndices; ++i)
+	{
+		u16 v = newIndices[i];
+		if (remap[v] == -1)
+			remap[v] = (int)nextVertex++;
+		indices[i] = (u16)remap[v];
+	}
+	for (size_t v = 0; v < numVertices; ++v)
+		if (remap[v] == -1)
+			remap[v] = (int)nextVertex++;
+
+	std::vector<u8> newVertexData(numVertices * stride);
+	for (size_t v = 0; v < numVertices; ++v)
+		memcpy(&newVertexData[remap[v] * stride], vertexData + v * stride, stride);
+	memcpy(vertexData, &newVertexData[0], numVertices * stride);
+}
+
+
 // Copy UV coordinates
 void ModelRenderer::BuildUV(
 		const CModelDefPtr& mdef,
@@ -202,6 +366,27 @@ void ModelRenderer::BuildIndices(
  * Separated into the source file to increase implementation hiding (and to
  * avoid some causes of recompiles).
  */
+/// A distinct material seen in ShaderModelRenderer::Render, and its technique
+struct SMRMaterial
+{
+	CStrIntern effect;
+	CShaderDefines defines;
+	size_t techIdx; // index into ShaderModelRendererInternals::techs
+	bool sortByDistance;
+
+	bool Matches(CStrIntern e, const CShaderDefines& d) const
+	{
+		return effect == e && defines == d;
+	}
+};
+
+/// A model to draw, with its sort key (see SMRMakeOpaqueKey etc)
+struct SMRDrawItem
+{
+	u64 key;
+	CModel* model;
+};
+
 struct ShaderModelRendererInternals
 {
 	ShaderModelRendererInternals(ShaderModelRenderer* r) : m_Renderer(r) { }
@@ -214,6 +399,13 @@ struct ShaderModelRendererInternals
 
 	/// List of submitted models for rendering in this frame
 	std::vector<CModel*> submissions;
+
+	/// Temporary lists used by Render, kept here to avoid reallocating them every time
+	std::vector<SMRMaterial> materials;
+	std::vector<CShaderTechniquePtr> techs;
+	std::vector<SMRDrawItem> drawItems;
+	std::vector<SMRDrawItem> drawItemsTemp;
+	std::vector<CModel*> sortedModels;
 };
 
 
@@ -248,6 +440,23 @@ void ShaderModelRenderer::Submit(CModel* model)
 }
 
 
+struct PrepareModelDataJob
+{
+	ModelVertexRenderer* vertexRenderer;
+	const std::vector<CModel*>* submissions;
+};
+
+static void PrepareModelDataCallback(void* cbdata, size_t begin, size_t end)
+{
+	PrepareModelDataJob* job = static_cast<PrepareModelDataJob*>(cbdata);
+	for (size_t i = begin; i < end; ++i)
+	{
+		CModel* model = (*job->submissions)[i];
+		CModelRData* rdata = static_cast<CModelRData*>(model->GetRenderData());
+		job->vertexRenderer->PrepareModelData(model, rdata, rdata->m_UpdateFlags);
+	}
+}
+
 // Call update for all submitted models and enter the rendering phase
 void ShaderModelRenderer::PrepareModels()
 {
@@ -257,6 +466,33 @@ void ShaderModelRenderer::PrepareModels()
 
  		CModelRData* rdata = static_cast<CModelRData*>(model->GetRenderData());
  		ENSURE(rdata->GetKey() == m->vertexRenderer.get());
+	}
+
+	// Do the CPU-side updates (mainly software skinning, when GPU skinning
+	// is disabled) in parallel. Every model writes into its own vertex array
+	// backing store, so the jobs are independent.
+	// (Model positions and bone matrices were already validated serially when
+	// the models were submitted, since that recurses into parents and props.)
+	{
+		PROFILE3("prepare model data");
+
+		PrepareModelDataJob job = { m->vertexRenderer.get(), &m->submissions };
+
+		// Animated models typically have a few hundred vertices each, so use
+		// chunks that are big enough to amortise the scheduling overhead
+		const size_t chunkSize = 16;
+
+		if (g_ThreadPool)
+			g_ThreadPool->ParallelFor(m->submissions.size(), chunkSize, &PrepareModelDataCallback, &job);
+		else
+			PrepareModelDataCallback(&job, 0, m->submissions.size());
+	}
+
+	// Upload the results, which must be done on the main thread
+	for (size_t i = 0; i < m->submissions.size(); ++i)
+	{
+		CModel* model = m->submissions[i];
+		CModelRData* rdata = static_cast<CModelRData*>(model->GetRenderData());
 
 		m->vertexRenderer->UpdateModelData(model, rdata, rdata->m_UpdateFlags);
 		rdata->m_UpdateFlags = 0;
@@ -271,90 +507,67 @@ void ShaderModelRenderer::EndFrame()
 }
 
 
-// Helper structs for ShaderModelRenderer::Render():
-
-struct SMRSortByDistItem
-{
-	size_t techIdx;
-	CModel* model;
-	float dist;
-};
-
-struct SMRBatchModel
-{
-	bool operator()(CModel* a, CModel* b)
-	{
-		if (a->GetModelDef() < b->GetModelDef())
-			return true;
-		if (b->GetModelDef() < a->GetModelDef())
-			return false;
-
-		if (a->GetMaterial().GetDiffuseTexture() < b->GetMaterial().GetDiffuseTexture())
-			return true;
-		if (b->GetMaterial().GetDiffuseTexture() < a->GetMaterial().GetDiffuseTexture())
-			return false;
+// Helpers for ShaderModelRenderer::Render():
 
-		return a->GetMaterial().GetStaticUniforms() < b->GetMaterial().GetStaticUniforms();
-	}
-};
+/**
+ * Layout of the draw keys (see DrawKey.h), from the most significant bit:
+ *  - 1 bit: 0 for opaque models, 1 for models that must be sorted by distance
+ *    (so those are drawn last, like before)
+ *  - Opaque models: 15 bits technique index, 16 bits modeldef, 16 bits base texture,
+ *    16 bits static uniforms.
+ *  - Distance-sorted models: 32 bits inverted distance (for back-to-front order),
+ *    15 bits technique index, 16 unused bits.
+ */
+static const u64 SMR_KEY_SORT_BY_DIST = 1ull << 63;
+static const size_t SMR_MAX_TECHS = 1 << 15;
 
-struct SMRCompareSortByDistItem
+static u64 SMRMakeOpaqueKey(size_t techIdx, CModel* model)
 {
-	bool operator()(const SMRSortByDistItem& a, const SMRSortByDistItem& b)
-	{
-		// Prefer items with greater distance, so we draw back-to-front
-		return (a.dist > b.dist);
-
-		// (Distances will almost always be distinct, so we don't need to bother
-		// tie-breaking on modeldef/texture/etc)
-	}
-};
+	return ((u64)techIdx << 48)
+		| (DrawKey::HashPointer(model->GetModelDef().get(), 16) << 32)
+		| (DrawKey::HashPointer(model->GetMaterial().GetDiffuseTexture().get(), 16) << 16)
+		| ((u64)model->GetMaterial().GetStaticUniforms().GetHash() & 0xffff);
+}
 
-struct SMRMaterialBucketKey
+static u64 SMRMakeSortByDistKey(size_t techIdx, float dist)
 {
-	SMRMaterialBucketKey(CStrIntern effect, const CShaderDefines& defines)
-		: effect(effect), defines(defines) { }
-
-	CStrIntern effect;
-	CShaderDefines defines;
-
-	bool operator==(const SMRMaterialBucketKey& b) const
-	{
-		return (effect == b.effect && defines == b.defines);
-	}
-
-private:
-	SMRMaterialBucketKey& operator=(const SMRMaterialBucketKey&);
-};
+	return SMR_KEY_SORT_BY_DIST
+		| ((u64)(~DrawKey::SortableFloat(dist)) << 31)
+		| ((u64)techIdx << 16);
+}
 
-struct SMRMaterialBucketKeyHash
+static size_t SMRGetTechIdx(u64 key)
 {
-	size_t operator()(const SMRMaterialBucketKey& key) const
-	{
-		size_t hash = 0;
-		boost::hash_combine(hash, key.effect.GetHash());
-		boost::hash_combine(hash, key.defines.GetHash());
-		return hash;
-	}
-};
+	if (key & SMR_KEY_SORT_BY_DIST)
+		return (size_t)((key >> 16) & (SMR_MAX_TECHS - 1));
+	else
+		return (size_t)((key >> 48) & (SMR_MAX_TECHS - 1));
+}
 
-struct SMRTechBucket
+/**
+ * Returns whether model b can be drawn in the same instanced draw call as a,
+ * i.e. it uses the same mesh and material.
+ * (Render queries and static uniforms come from the material, so they match
+ * if the samplers and uniforms match.)
+ */
+static bool SMRCanBatchInstanced(CModel* a, CModel* b)
 {
-	CShaderTechniquePtr tech;
-	CModel** models;
-	size_t numModels;
-
-	// Model list is stored as pointers, not as a std::vector,
-	// so that sorting lists of this struct is fast
-};
+	if (a->GetModelDef() != b->GetModelDef())
+		return false;
+
+	if (a->GetMaterial().GetStaticUniforms() != b->GetMaterial().GetStaticUniforms())
+		return false;
+
+	const CMaterial::SamplersVector& samplersA = a->GetMaterial().GetSamplers();
+	const CMaterial::SamplersVector& samplersB = b->GetMaterial().GetSamplers();
+	if (samplersA.size() != samplersB.size())
+		return false;
+	for (size_t s = 0; s < samplersA.size(); ++s)
+		if (!(samplersA[s].Name == samplersB[s].Name) || samplersA[s].Sampler != samplersB[s].Sampler)
+			return false;
 
-struct SMRCompareTechBucket
-{
-	bool operator()(const SMRTechBucket& a, const SMRTechBucket& b)
-	{
-		return a.tech < b.tech;
-	}
-};
+	return true;
+}
 
 void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShaderDefines& context, int flags)
 {
@@ -379,10 +592,8 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 	 * For efficient rendering, we need to batch the draw calls to minimise state changes.
 	 * (Uniform and texture changes are assumed to be cheaper than binding new mesh data,
 	 * and shader changes are assumed to be most expensive.)
-	 * First, group all models that share a technique to render them together.
-	 * Within those groups, sub-group by CModelDef.
-	 * Within those sub-groups, sub-sub-group by CTexture.
-	 * Within those sub-sub-groups, sub-sub-sub-group by CShaderUniforms.
+	 * So models are drawn grouped by technique, then by CModelDef, then by CTexture,
+	 * then by CShaderUniforms.
 	 * 
 	 * Alpha-blended models have to be sorted by distance from camera,
 	 * then we can batch as long as the order is preserved.
@@ -394,42 +605,39 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 	 *  - The CModel's material's shader effect name
 	 * 
 	 * There are a smallish number of materials, and a smaller number of techniques.
+	 * To minimise technique lookups, each distinct material (effect plus defines) is
+	 * looked up once, in 'materials', which gives an index into the list of distinct
+	 * techniques 'techs'.
 	 * 
-	 * To minimise technique lookups, we first group models by material,
-	 * in 'materialBuckets' (a hash table).
-	 * 
-	 * For each material bucket we then look up the appropriate shader technique.
-	 * If the technique requires sort-by-distance, the model is added to the
-	 * 'sortByDistItems' list with its computed distance.
-	 * Otherwise, the bucket's list of models is sorted by modeldef+texture+uniforms,
-	 * then the technique and model list is added to 'techBuckets'.
-	 * 
-	 * 'techBuckets' is then sorted by technique, to improve batching when multiple
-	 * materials map onto the same technique.
+	 * Each model then gets a 64-bit key that combines its technique index with either
+	 * its modeldef+texture+uniforms or (if the technique requires sort-by-distance)
+	 * its distance, and the whole list is radix-sorted by that key.
+	 * Finally we render by looping over each run of models with the same technique,
+	 * rebinding the GL state whenever it changes.
 	 * 
-	 * (Note that this isn't perfect batching: we don't sort across models in
-	 * multiple buckets that share a technique. In practice that shouldn't reduce
-	 * batching much (we rarely have one mesh used with multiple materials),
-	 * and it saves on copying and lets us sort smaller lists.)
-	 * 
-	 * Extra tech buckets are added for the sorted-by-distance models without reordering.
-	 * Finally we render by looping over each tech bucket, then looping over the model
-	 * list in each, rebinding the GL state whenever it changes.
+	 * All the lists are kept in 'm' between calls, so this doesn't allocate memory
+	 * once they're big enough.
 	 */
 
- 	typedef boost::unordered_map<SMRMaterialBucketKey, std::vector<CModel*>, SMRMaterialBucketKeyHash> MaterialBuckets_t;
-	MaterialBuckets_t materialBuckets;
+	std::vector<SMRMaterial>& materials = m->materials;
+	std::vector<CShaderTechniquePtr>& techs = m->techs;
+	std::vector<SMRDrawItem>& drawItems = m->drawItems;
 
 	{
-		PROFILE3("bucketing by material");
+		PROFILE3("building draw keys");
+
+		size_t lastMaterial = 0;
 
 		for (size_t i = 0; i < m->submissions.size(); ++i)
 		{
 			CModel* model = m->submissions[i];
-			
+
+			if (flags && !(model->GetFlags() & flags))
+				continue;
+
 			CShaderDefines defs = model->GetMaterial().GetShaderDefines();
 			CShaderConditionalDefines condefs = model->GetMaterial().GetConditionalDefines();
-			
+
 			for (size_t j = 0; j < condefs.GetSize(); ++j)
 			{
 				CShaderConditionalDefines::CondDefine &item = condefs.GetItem(j);
@@ -440,136 +648,82 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 					{
 						CVector3D modelpos = model->GetTransform().GetTranslation();
 						float dist = worldToCam.Transform(modelpos).Z;
-						
+
 						float dmin = item.m_CondArgs[0];
 						float dmax = item.m_CondArgs[1];
-						
+
 						if ((dmin < 0 || dist >= dmin) && (dmax < 0 || dist < dmax))
 							defs.Add(item.m_DefName.c_str(), item.m_DefValue.c_str());
-						
+
 						break;
 					}
 				}
 			}
 
-			SMRMaterialBucketKey key(model->GetMaterial().GetShaderEffect(), defs);
-			std::vector<CModel*>& bucketItems = materialBuckets[key];
-			bucketItems.push_back(model);
-		}
-	}
+			CStrIntern effect = model->GetMaterial().GetShaderEffect();
+
+			// Find the material's technique (usually the same as the previous model's)
+			if (lastMaterial >= materials.size() || !materials[lastMaterial].Matches(effect, defs))
+			{
+				for (lastMaterial = 0; lastMaterial < materials.size(); ++lastMaterial)
+					if (materials[lastMaterial].Matches(effect, defs))
+						break;
 
-	std::vector<SMRSortByDistItem> sortByDistItems;
+				if (lastMaterial == materials.size())
+				{
+					SMRMaterial material = { effect, defs, SMR_MAX_TECHS, false };
 
-	std::vector<CShaderTechniquePtr> sortByDistTechs;
-		// indexed by sortByDistItems[i].techIdx
-		// (which stores indexes instead of CShaderTechniquePtr directly
-		// to avoid the shared_ptr copy cost when sorting; maybe it'd be better
-		// if we just stored raw CShaderTechnique* and assumed the shader manager
-		// will keep it alive long enough)
+					CShaderTechniquePtr tech = g_Renderer.GetShaderManager().LoadEffect(effect, context, defs);
 
-	std::vector<SMRTechBucket> techBuckets;
+					// Invalid techniques (e.g. from data file errors) keep SMR_MAX_TECHS, so their models are skipped
+					if (tech)
+					{
+						material.techIdx = std::find(techs.begin(), techs.end(), tech) - techs.begin();
+						if (material.techIdx == techs.size())
+							techs.push_back(tech);
+						ENSURE(techs.size() <= SMR_MAX_TECHS);
+						material.sortByDistance = tech->GetSortByDistance();
+					}
 
-	{
-		PROFILE3("processing material buckets");
-		for (MaterialBuckets_t::iterator it = materialBuckets.begin(); it != materialBuckets.end(); ++it)
-		{
-			CShaderTechniquePtr tech = g_Renderer.GetShaderManager().LoadEffect(it->first.effect, context, it->first.defines);
+					materials.push_back(material);
+				}
+			}
 
-			// Skip invalid techniques (e.g. from data file errors)
-			if (!tech)
+			const SMRMaterial& material = materials[lastMaterial];
+			if (material.techIdx == SMR_MAX_TECHS)
 				continue;
 
-			if (tech->GetSortByDistance())
+			SMRDrawItem item;
+			item.model = model;
+			if (material.sortByDistance)
 			{
-				// Add the tech into a vector so we can index it
-				// (There might be duplicates in this list, but that doesn't really matter)
-				if (sortByDistTechs.empty() || sortByDistTechs.back() != tech)
-					sortByDistTechs.push_back(tech);
-				size_t techIdx = sortByDistTechs.size()-1;
-
-				// Add each model into sortByDistItems
-				for (size_t i = 0; i < it->second.size(); ++i)
-				{
-					SMRSortByDistItem itemWithDist;
-					itemWithDist.techIdx = techIdx;
-
-					CModel* model = it->second[i];
-					itemWithDist.model = model;
-
-					CVector3D modelpos = model->GetTransform().GetTranslation();
-					itemWithDist.dist = worldToCam.Transform(modelpos).Z;
-
-					sortByDistItems.push_back(itemWithDist);
-				}
+				CVector3D modelpos = model->GetTransform().GetTranslation();
+				item.key = SMRMakeSortByDistKey(material.techIdx, worldToCam.Transform(modelpos).Z);
 			}
 			else
 			{
-				// Sort model list by modeldef+texture, for batching
 				// TODO: This only sorts by base texture. While this is an OK approximation
 				// for most cases (as related samplers are usually used together), it would be better
 				// to take all the samplers into account when sorting here.
-				std::sort(it->second.begin(), it->second.end(), SMRBatchModel());
-
-				// Add a tech bucket pointing at this model list
-				SMRTechBucket techBucket = { tech, &it->second[0], it->second.size() };
-				techBuckets.push_back(techBucket);
+				item.key = SMRMakeOpaqueKey(material.techIdx, model);
 			}
+			drawItems.push_back(item);
 		}
 	}
 
 	{
-		PROFILE3("sorting tech buckets");
-		// Sort by technique, for better batching
-		std::sort(techBuckets.begin(), techBuckets.end(), SMRCompareTechBucket());
+		PROFILE3("sorting draw keys");
+		RadixSortDrawItems(drawItems, m->drawItemsTemp);
 	}
 
-	// List of models corresponding to sortByDistItems[i].model
-	// (This exists primarily because techBuckets wants a CModel**;
-	// we could avoid the cost of copying into this list by adding
-	// a stride length into techBuckets and not requiring contiguous CModel*s)
-	std::vector<CModel*> sortByDistModels;
-
-	if (!sortByDistItems.empty())
-	{
-		{
-			PROFILE3("sorting items by dist");
-			std::sort(sortByDistItems.begin(), sortByDistItems.end(), SMRCompareSortByDistItem());
-		}
-
-		{
-			PROFILE3("batching dist-sorted items");
-
-			sortByDistModels.reserve(sortByDistItems.size());
-
-			// Find runs of distance-sorted models that share a technique,
-			// and create a new tech bucket for each run
-
-			size_t start = 0; // start of current run
-			size_t currentTechIdx = sortByDistItems[start].techIdx;
-
-			for (size_t end = 0; end < sortByDistItems.size(); ++end)
-			{
-				sortByDistModels.push_back(sortByDistItems[end].model);
-
-				size_t techIdx = sortByDistItems[end].techIdx;
-				if (techIdx != currentTechIdx)
-				{
-					// Start of a new run - push the old run into a new tech bucket
-					SMRTechBucket techBucket = { sortByDistTechs[currentTechIdx], &sortByDistModels[start], end-start };
-					techBuckets.push_back(techBucket);
-					start = end;
-					currentTechIdx = techIdx;
-				}
-			}
-
-			// Add the tech bucket for the final run
-			SMRTechBucket techBucket = { sortByDistTechs[currentTechIdx], &sortByDistModels[start], sortByDistItems.size()-start };
-			techBuckets.push_back(techBucket);
-		}
-	}
+	// The vertex renderer wants contiguous lists of CModel*
+	std::vector<CModel*>& sortedModels = m->sortedModels;
+	sortedModels.resize(drawItems.size());
+	for (size_t i = 0; i < drawItems.size(); ++i)
+		sortedModels[i] = drawItems[i].model;
 
 	{
-		PROFILE3("rendering bucketed submissions");
+		PROFILE3("rendering sorted submissions");
 
 		size_t idxTechStart = 0;
 		
@@ -587,15 +741,16 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 		std::vector<CStrIntern> texBindingNames;
 		texBindingNames.reserve(64);
 
-		while (idxTechStart < techBuckets.size())
+		while (idxTechStart < drawItems.size())
 		{
-			CShaderTechniquePtr currentTech = techBuckets[idxTechStart].tech;
+			size_t currentTechIdx = SMRGetTechIdx(drawItems[idxTechStart].key);
+			const CShaderTechniquePtr& currentTech = techs[currentTechIdx];
 
-			// Find runs [idxTechStart, idxTechEnd) in techBuckets of the same technique
+			// Find runs [idxTechStart, idxTechEnd) in drawItems of the same technique
 			size_t idxTechEnd;
-			for (idxTechEnd = idxTechStart + 1; idxTechEnd < techBuckets.size(); ++idxTechEnd)
+			for (idxTechEnd = idxTechStart + 1; idxTechEnd < drawItems.size(); ++idxTechEnd)
 			{
-				if (techBuckets[idxTechEnd].tech != currentTech)
+				if (SMRGetTechIdx(drawItems[idxTechEnd].key) != currentTechIdx)
 					break;
 			}
 
@@ -610,6 +765,10 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 				modifier->BeginPass(shader);
 
 				m->vertexRenderer->BeginPass(streamflags);
+
+				// Draw runs of models with the same mesh and material in a single
+				// call, if the shader supports it
+				bool instancing = m->vertexRenderer->SupportsInstancing(shader);
 				
 				// When the shader technique changes, textures need to be
 				// rebound, so ensure there are no remnants from the last pass.
@@ -621,114 +780,125 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 				CModelDef* currentModeldef = NULL;
 				CShaderUniforms currentStaticUniforms;
 
-				for (size_t idx = idxTechStart; idx < idxTechEnd; ++idx)
+				CModel** models = &sortedModels[idxTechStart];
+				size_t numModels = idxTechEnd - idxTechStart;
+				for (size_t i = 0; i < numModels; ++i)
 				{
-					CModel** models = techBuckets[idx].models;
-					size_t numModels = techBuckets[idx].numModels;
-					for (size_t i = 0; i < numModels; ++i)
-					{
-						CModel* model = models[i];
+					CModel* model = models[i];
 
-						if (flags && !(model->GetFlags() & flags))
-							continue;
+					size_t batchSize = 1;
+					if (instancing)
+					{
+						while (i + batchSize < numModels && SMRCanBatchInstanced(model, models[i + batchSize]))
+							++batchSize;
+					}
 
-						CMaterial::SamplersVector samplers = model->GetMaterial().GetSamplers();
-						size_t samplersNum = samplers.size();
+					CMaterial::SamplersVector samplers = model->GetMaterial().GetSamplers();
+					size_t samplersNum = samplers.size();
+					
+					// make sure the vectors are the right virtual sizes, and also
+					// reallocate if there are more samplers than expected.
+					if (currentTexs.size() != samplersNum)
+					{
+						currentTexs.resize(samplersNum, NULL);
+						texBindings.resize(samplersNum, CShaderProgram::Binding());
+						texBindingNames.resize(samplersNum, CStrIntern());
 						
-						// make sure the vectors are the right virtual sizes, and also
-						// reallocate if there are more samplers than expected.
-						if (currentTexs.size() != samplersNum)
-						{
-							currentTexs.resize(samplersNum, NULL);
-							texBindings.resize(samplersNum, CShaderProgram::Binding());
-							texBindingNames.resize(samplersNum, CStrIntern());
-							
-							// ensure they are definitely empty
-							std::fill(texBindings.begin(), texBindings.end(), CShaderProgram::Binding());
-							std::fill(currentTexs.begin(), currentTexs.end(), (CTexture*)NULL);
-							std::fill(texBindingNames.begin(), texBindingNames.end(), CStrIntern());
-						}
+						// ensure they are definitely empty
+						std::fill(texBindings.begin(), texBindings.end(), CShaderProgram::Binding());
+						std::fill(currentTexs.begin(), currentTexs.end(), (CTexture*)NULL);
+						std::fill(texBindingNames.begin(), texBindingNames.end(), CStrIntern());
+					}
+					
+					// bind the samplers to the shader
+					for (size_t s = 0; s < samplersNum; ++s)
+					{
+						CMaterial::TextureSampler &samp = samplers[s];
 						
-						// bind the samplers to the shader
-						for (size_t s = 0; s < samplersNum; ++s)
+						CShaderProgram::Binding bind = texBindings[s];
+						// check that the handles are current
+						// and reevaluate them if necessary
+						if (texBindingNames[s] == samp.Name && bind.Active())
 						{
-							CMaterial::TextureSampler &samp = samplers[s];
-							
-							CShaderProgram::Binding bind = texBindings[s];
-							// check that the handles are current
-							// and reevaluate them if necessary
-							if (texBindingNames[s] == samp.Name && bind.Active())
-							{
-								bind = texBindings[s];
-							}
-							else
-							{
-								bind = shader->GetTextureBinding(samp.Name.c_str());		
-								texBindings[s] = bind;
-								texBindingNames[s] = samp.Name;
-							}
-
-							// same with the actual sampler bindings
-							CTexture* newTex = samp.Sampler.get();
-							if (bind.Active() && newTex != currentTexs[s])
-							{
-								shader->BindTexture(bind, samp.Sampler->GetHandle());
-								currentTexs[s] = newTex;
-							}
+							bind = texBindings[s];
 						}
-						
-						// Bind modeldef when it changes
-						CModelDef* newModeldef = model->GetModelDef().get();
-						if (newModeldef != currentModeldef)
+						else
 						{
-							currentModeldef = newModeldef;
-							m->vertexRenderer->PrepareModelDef(shader, streamflags, *currentModeldef);
+							bind = shader->GetTextureBinding(samp.Name.c_str());		
+							texBindings[s] = bind;
+							texBindingNames[s] = samp.Name;
 						}
 
-						// Bind all uniforms when any change
-						CShaderUniforms newStaticUniforms = model->GetMaterial().GetStaticUniforms();
-						if (newStaticUniforms != currentStaticUniforms)
+						// same with the actual sampler bindings
+						CTexture* newTex = samp.Sampler.get();
+						if (bind.Active() && newTex != currentTexs[s])
 						{
-							currentStaticUniforms = newStaticUniforms;
-							currentStaticUniforms.BindUniforms(shader);
+							shader->BindTexture(bind, samp.Sampler->GetHandle());
+							currentTexs[s] = newTex;
 						}
-						
-						CShaderRenderQueries renderQueries = model->GetMaterial().GetRenderQueries();
-						
-						for (size_t q = 0; q < renderQueries.GetSize(); q++)
+					}
+					
+					// Bind modeldef when it changes
+					CModelDef* newModeldef = model->GetModelDef().get();
+					if (newModeldef != currentModeldef)
+					{
+						currentModeldef = newModeldef;
+						m->vertexRenderer->PrepareModelDef(shader, streamflags, *currentModeldef);
+					}
+
+					// Bind all uniforms when any change
+					CShaderUniforms newStaticUniforms = model->GetMaterial().GetStaticUniforms();
+					if (newStaticUniforms != currentStaticUniforms)
+					{
+						currentStaticUniforms = newStaticUniforms;
+						currentStaticUniforms.BindUniforms(shader);
+					}
+					
+					CShaderRenderQueries renderQueries = model->GetMaterial().GetRenderQueries();
+					
+					for (size_t q = 0; q < renderQueries.GetSize(); q++)
+					{
+						CShaderRenderQueries::RenderQuery rq = renderQueries.GetItem(q);
+						if (rq.first == RQUERY_TIME)
 						{
-							CShaderRenderQueries::RenderQuery rq = renderQueries.GetItem(q);
-							if (rq.first == RQUERY_TIME)
-							{
-								CShaderProgram::Binding binding = shader->GetUniformBinding(rq.second);
-								if (binding.Active())
-								{
-									double time = g_Renderer.GetTimeManager().GetGlobalTime();
-									shader->Uniform(binding, time, 0,0,0);
-								}
-							}
-							else if (rq.first == RQUERY_WATER_TEX)
-							{
-								WaterManager* WaterMgr = g_Renderer.GetWaterManager();
-								double time = WaterMgr->m_WaterTexTimer;
-								double period = 1.6;
-								int curTex = (int)(time*60/period) % 60;
-								
-								if (WaterMgr->m_RenderWater && WaterMgr->WillRenderFancyWater())
-									shader->BindTexture("waterTex", WaterMgr->m_NormalMap[curTex]);
-								else
-									shader->BindTexture("waterTex", g_Renderer.GetTextureManager().GetErrorTexture());
-							}
-							else if (rq.first == RQUERY_SKY_CUBE)
+							CShaderProgram::Binding binding = shader->GetUniformBinding(rq.second);
+							if (binding.Active())
 							{
-								shader->BindTexture("skyCube", g_Renderer.GetSkyManager()->GetSkyCube());
+								double time = g_Renderer.GetTimeManager().GetGlobalTime();
+								shader->Uniform(binding, time, 0,0,0);
 							}
 						}
+						else if (rq.first == RQUERY_WATER_TEX)
+						{
+							WaterManager* WaterMgr = g_Renderer.GetWaterManager();
+							double time = WaterMgr->m_WaterTexTimer;
+							double period = 1.6;
+							int curTex = (int)(time*60/period) % 60;
+							
+							if (WaterMgr->m_RenderWater && WaterMgr->WillRenderFancyWater())
+								shader->BindTexture("waterTex", WaterMgr->m_NormalMap[curTex]);
+							else
+								shader->BindTexture("waterTex", g_Renderer.GetTextureManager().GetErrorTexture());
+						}
+						else if (rq.first == RQUERY_SKY_CUBE)
+						{
+							shader->BindTexture("skyCube", g_Renderer.GetSkyManager()->GetSkyCube());
+						}
+					}
 
-						modifier->PrepareModel(shader, model);
+					CModelRData* rdata = static_cast<CModelRData*>(model->GetRenderData());
+					ENSURE(rdata->GetKey() == m->vertexRenderer.get());
 
-						CModelRData* rdata = static_cast<CModelRData*>(model->GetRenderData());
-						ENSURE(rdata->GetKey() == m->vertexRenderer.get());
+					if (instancing)
+					{
+						// The per-model data is passed as instance attributes
+						// instead of via the modifier
+						m->vertexRenderer->RenderModelsInstanced(shader, streamflags, &models[i], batchSize);
+						i += batchSize - 1;
+					}
+					else
+					{
+						modifier->PrepareModel(shader, model);
 
 						m->vertexRenderer->RenderModel(shader, streamflags, model, rdata);
 					}
@@ -742,6 +912,12 @@ void ShaderModelRenderer::Render(const RenderModifierPtr& modifier, const CShade
 			idxTechStart = idxTechEnd;
 		}
 	}
+
+	// Empty the lists (keeping their memory), and release the techniques
+	materials.clear();
+	techs.clear();
+	drawItems.clear();
+	sortedModels.clear();
 }
 
 void ShaderModelRenderer::Filter(CModelFilter& filter, int passed, int flags)
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -263,6 +263,18 @@ public:
 	 * The new vertices cannot be used with existing face index and must be welded/reindexed.
 	 */
 	static void GenTangents(const CModelDefPtr& mdef, std::vector<float>& newVertices, bool gpuSkinning);
+
+	/**
+	 * OptimiseVertexCache: Reorder triangles to make good use of the GPU's
+	 * post-transform vertex cache (using Tom Forsyth's linear-speed algorithm,
+	 * <http://home.comcast.net/~tom_forsyth/papers/fast_vert_cache_opt.html>),
+	 * then reorder the vertices into the order they're first used.
+	 *
+	 * @param indices Triangle list, which will be replaced by the optimised one.
+	 * @param vertexData Interleaved vertex data, stride bytes per vertex,
+	 * which will be reordered to match the new indices.
+	 */
+	static void OptimiseVertexCache(u16* indices, size_t numIndices, u8* vertexData, size_t numVertices, size_t stride);
 };
 
 
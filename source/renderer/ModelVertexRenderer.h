@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -85,6 +85,23 @@ public:
 	virtual void UpdateModelData(CModel* model, CModelRData* data, int updateflags) = 0;
 
 
+	/**
+	 * PrepareModelData: Do the CPU-only part of UpdateModelData
+	 * (e.g. software skinning into the model's vertex array backing store).
+	 *
+	 * ModelRenderer implementations must call this before UpdateModelData
+	 * with the same updateflags. Unlike UpdateModelData it does not touch
+	 * any OpenGL or other global state, so it may be called concurrently
+	 * from several threads for different models.
+	 *
+	 * @param model The model.
+	 * @param data Private data as returned by CreateModelData.
+	 * @param updateflags Flags indicating which data has changed during
+	 * the frame.
+	 */
+	virtual void PrepareModelData(CModel* UNUSED(model), CModelRData* UNUSED(data), int UNUSED(updateflags)) { }
+
+
 	/**
 	 * BeginPass: Setup global OpenGL state for this ModelVertexRenderer.
 	 *
@@ -154,6 +171,36 @@ public:
 	 * succeed.
 	 */
 	virtual void RenderModel(const CShaderProgramPtr& shader, int streamflags, CModel* model, CModelRData* data) = 0;
+
+
+	/**
+	 * SupportsInstancing: Whether RenderModelsInstanced can be used with
+	 * the given shader (which must be the one passed to the following
+	 * PrepareModelDef/RenderModelsInstanced calls).
+	 */
+	virtual bool SupportsInstancing(const CShaderProgramPtr& UNUSED(shader)) { return false; }
+
+
+	/**
+	 * RenderModelsInstanced: Render several models with a single instanced
+	 * draw call. The per-model data that RenderModifiers normally set as
+	 * uniforms (transform, shading colour, player colour) is passed to the
+	 * shader as per-instance vertex attributes instead.
+	 *
+	 * Only valid if SupportsInstancing(shader) returned true.
+	 *
+	 * preconditions  : The most recent call to PrepareModelDef since
+	 * BeginPass has been for the models' CModelDef, and all the models
+	 * use the same CModelDef and material.
+	 *
+	 * @param streamflags Vertex streams required by the fragment stage.
+	 * @param models Array of models to render.
+	 * @param numModels Number of models in the array.
+	 */
+	virtual void RenderModelsInstanced(const CShaderProgramPtr& UNUSED(shader), int UNUSED(streamflags), CModel** UNUSED(models), size_t UNUSED(numModels))
+	{
+		debug_warn(L"RenderModelsInstanced not supported by this ModelVertexRenderer");
+	}
 };
 
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,10 +20,12 @@
 #include "OverlayRenderer.h"
 
 #include <boost/unordered_map.hpp>
+#include <map>
 #include "graphics/LOSTexture.h"
 #include "graphics/Overlay.h"
 #include "graphics/Terrain.h"
 #include "graphics/TextureManager.h"
+#include "lib/bits.h"
 #include "lib/ogl.h"
 #include "maths/MathUtil.h"
 #include "maths/Quaternion.h"
@@ -39,47 +41,51 @@
 #include "simulation2/system/SimContext.h"
 
 /**
- * Key used to group quads into batches for more efficient rendering. Currently groups by the combination
- * of the main texture and the texture mask, to minimize texture swapping during rendering.
+ * Key used to group textured lines and quads into batches for more efficient rendering. Groups by
+ * the combination of the main texture and the texture mask, to minimize texture swapping during
+ * rendering, and by whether they're visible through the LOS (which needs a different shader).
  */
-struct QuadBatchKey
+struct OverlayBatchKey
 {
-	QuadBatchKey (const CTexturePtr& texture, const CTexturePtr& textureMask)
-		: m_Texture(texture), m_TextureMask(textureMask)
+	OverlayBatchKey (const CTexturePtr& texture, const CTexturePtr& textureMask, bool alwaysVisible)
+		: m_Texture(texture), m_TextureMask(textureMask), m_AlwaysVisible(alwaysVisible)
 	{ }
 
-	bool operator==(const QuadBatchKey& other) const
+	bool operator==(const OverlayBatchKey& other) const
 	{
-		return (m_Texture == other.m_Texture && m_TextureMask == other.m_TextureMask);
+		return (m_Texture == other.m_Texture && m_TextureMask == other.m_TextureMask && m_AlwaysVisible == other.m_AlwaysVisible);
 	}
 
 	CTexturePtr m_Texture;
 	CTexturePtr m_TextureMask;
+	bool m_AlwaysVisible;
 };
 
 /**
- * Holds information about a single quad rendering batch.
+ * Holds the overlays requested to be rendered in a single batch. Must be cleared after each frame.
  */
-class QuadBatchData : public CRenderData
+struct OverlayBatchData
 {
-public:
-	QuadBatchData() : m_IndicesBase(0), m_NumRenderQuads(0) { }
-
-	/// Holds the quad overlay structures requested to be rendered in this batch. Must be cleared
-	/// after each frame.
+	std::vector<SOverlayTexturedLine*> m_Lines;
 	std::vector<SOverlayQuad*> m_Quads;
+};
 
-	/// Start index of this batch into the dedicated quad indices VertexArray (see OverlayInternals).
+/**
+ * A range of the batch index array drawn with a single draw call.
+ */
+struct OverlayDrawRange
+{
+	const OverlayBatchKey* m_Key;
+	/// Index of the first vertex that the indices are relative to (since they're only 16-bit,
+	/// the vertex array is split into segments of up to 64K vertices)
+	size_t m_VertexBase;
 	size_t m_IndicesBase;
-	/// Amount of quads to actually render in this batch. Potentially (although unlikely to be)
-	/// different from m_Quads.size() due to restrictions on the total amount of quads that can be
-	/// rendered. Must be reset after each frame.
-	size_t m_NumRenderQuads;
+	size_t m_NumIndices;
 };
 
 struct OverlayRendererInternals
 {
-	typedef boost::unordered_map<QuadBatchKey, QuadBatchData> QuadBatchMap;
+	typedef boost::unordered_map<OverlayBatchKey, OverlayBatchData> BatchMap;
 
 	OverlayRendererInternals();
 	~OverlayRendererInternals(){ }
@@ -89,94 +95,97 @@ struct OverlayRendererInternals
 	std::vector<SOverlaySprite*> sprites;
 	std::vector<SOverlayQuad*> quads;
 
-	QuadBatchMap quadBatchMap;
+	BatchMap batchMap;
+	std::vector<OverlayDrawRange> drawRanges;
 
-	// Dedicated vertex/index buffers for rendering all quads (to within the limits set by
-	// MAX_QUAD_OVERLAYS).
-	VertexArray quadVertices;
-	VertexArray::Attribute quadAttributePos;
-	VertexArray::Attribute quadAttributeColor;
-	VertexArray::Attribute quadAttributeUV;
-	VertexIndexArray quadIndices;
+	// Streaming vertex/index buffers holding all the textured lines and quads of the current
+	// frame (grown as necessary)
+	VertexArray batchVertices;
+	VertexArray::Attribute batchAttributePos;
+	VertexArray::Attribute batchAttributeColor;
+	VertexArray::Attribute batchAttributeUV;
+	VertexIndexArray batchIndices;
 
-	/// Maximum amount of quad overlays we support for rendering. This limit is set to be able to 
-	/// render all quads from a single dedicated VB without having to reallocate it, which is much
-	/// faster in the typical case of rendering only a handful of quads. When modifying this value,
-	/// you must take care for the new amount of quads to fit in a single VBO (which is not likely
-	/// to be a problem).
-	static const size_t MAX_QUAD_OVERLAYS = 1024;
+	// Number of vertices and indices written to the batch arrays so far in this frame
+	size_t batchNumVertices;
+	size_t batchNumIndices;
+	// First vertex of the current 64K-vertex segment
+	size_t batchVertexBase;
+
+	// Untextured line vertices (as interleaved RGBA and XYZ, for GL_LINES), grouped by thickness
+	std::map<u8, std::vector<float> > lineVertices;
+
+	// Sprite vertices (as interleaved XYZ and UV), rebuilt for each camera
+	std::vector<float> spriteVertices;
 
 	// Sets of commonly-(re)used shader defines.
-	CShaderDefines defsOverlayLineNormal;
-	CShaderDefines defsOverlayLineAlwaysVisible;
-	CShaderDefines defsQuadOverlay;
+	CShaderDefines defsOverlayNormal;
+	CShaderDefines defsOverlayAlwaysVisible;
 
 	/// Performs one-time setup. Called from CRenderer::Open, after graphics capabilities have
 	/// been detected. Note that no VBOs must be created before this is called, since the shader
 	/// path and graphics capabilities are not guaranteed to be stable before this point.
 	void Initialize();
+
+	/// Prepares to add geometry with the given number of vertices to the batch with the given key,
+	/// starting a new draw range if necessary. Returns the index of the first of the new vertices,
+	/// relative to the current segment.
+	size_t BeginBatchGeometry(const OverlayBatchKey& key, size_t numVertices);
 };
 
 const float OverlayRenderer::OVERLAY_VOFFSET = 0.2f;
 
 OverlayRendererInternals::OverlayRendererInternals()
-	: quadVertices(GL_DYNAMIC_DRAW), quadIndices(GL_DYNAMIC_DRAW)
+	: batchVertices(GL_STREAM_DRAW), batchIndices(GL_DYNAMIC_DRAW),
+	batchNumVertices(0), batchNumIndices(0), batchVertexBase(0)
 {
-	quadAttributePos.elems = 3;
-	quadAttributePos.type = GL_FLOAT;
-	quadVertices.AddAttribute(&quadAttributePos);
-
-	quadAttributeColor.elems = 4;
-	quadAttributeColor.type = GL_FLOAT;
-	quadVertices.AddAttribute(&quadAttributeColor);
-
-	quadAttributeUV.elems = 2;
-	quadAttributeUV.type = GL_SHORT; // don't use GL_UNSIGNED_SHORT here, TexCoordPointer won't accept it
-	quadVertices.AddAttribute(&quadAttributeUV);
-
-	// Note that we're reusing the textured overlay line shader for the quad overlay rendering. This
-	// is because their code is almost identical; the only difference is that for the quad overlays
-	// we want to use a vertex color stream as opposed to an objectColor uniform. To this end, the
-	// shader has been set up to switch between the two behaviours based on the USE_OBJECTCOLOR define.
-	defsOverlayLineNormal.Add("USE_OBJECTCOLOR", "1");
-	defsOverlayLineAlwaysVisible.Add("USE_OBJECTCOLOR", "1");
-	defsOverlayLineAlwaysVisible.Add("IGNORE_LOS", "1");
+	batchAttributePos.elems = 3;
+	batchAttributePos.type = GL_FLOAT;
+	batchVertices.AddAttribute(&batchAttributePos);
+
+	batchAttributeColor.elems = 4;
+	batchAttributeColor.type = GL_FLOAT;
+	batchVertices.AddAttribute(&batchAttributeColor);
+
+	batchAttributeUV.elems = 2;
+	batchAttributeUV.type = GL_FLOAT;
+	batchVertices.AddAttribute(&batchAttributeUV);
+
+	// Note that we're using the textured overlay line shader for both the lines and the quads,
+	// with a vertex color stream rather than an objectColor uniform (so lines of different
+	// colors can be drawn together). The shader switches between the two behaviours based on
+	// the USE_OBJECTCOLOR define.
+	defsOverlayAlwaysVisible.Add("IGNORE_LOS", "1");
 }
 
 void OverlayRendererInternals::Initialize()
 {
-	// Perform any initialization after graphics capabilities have been detected. Notably,
-	// only at this point can we safely allocate VBOs (in contrast to e.g. in the constructor),
-	// because their creation depends on the shader path, which is not reliably set before this point.
-	
-	quadVertices.SetNumVertices(MAX_QUAD_OVERLAYS * 4);
-	quadVertices.Layout(); // allocate backing store
+	// Perform any initialization after graphics capabilities have been detected.
+	// (Nothing needs it at the moment: the batch arrays aren't laid out until
+	// there are some overlays to draw, which is always after this point.)
+}
 
-	quadIndices.SetNumVertices(MAX_QUAD_OVERLAYS * 6);
-	quadIndices.Layout(); // allocate backing store
+size_t OverlayRendererInternals::BeginBatchGeometry(const OverlayBatchKey& key, size_t numVertices)
+{
+	// Start a new segment if the indices wouldn't fit in 16 bits
+	if (batchNumVertices + numVertices - batchVertexBase > 65536)
+		batchVertexBase = batchNumVertices;
 
-	// Since the quads in the vertex array are independent and always consist of exactly 4 vertices per quad, the
-	// indices are always the same; we can therefore fill in all the indices once and pretty much forget about
-	// them. We then also no longer need its backing store, since we never change any indices afterwards.
-	VertexArrayIterator<u16> index = quadIndices.GetIterator();
-	for (size_t i = 0; i < MAX_QUAD_OVERLAYS; ++i)
+	if (drawRanges.empty() || drawRanges.back().m_Key != &key || drawRanges.back().m_VertexBase != batchVertexBase)
 	{
-		*index++ = i*4 + 0;
-		*index++ = i*4 + 1;
-		*index++ = i*4 + 2;
-		*index++ = i*4 + 2;
-		*index++ = i*4 + 3;
-		*index++ = i*4 + 0;
+		OverlayDrawRange range = { &key, batchVertexBase, batchNumIndices, 0 };
+		drawRanges.push_back(range);
 	}
-	quadIndices.Upload();
-	quadIndices.FreeBackingStore();
+
+	return batchNumVertices - batchVertexBase;
 }
 
-static size_t hash_value(const QuadBatchKey& d)
+static size_t hash_value(const OverlayBatchKey& d)
 {
 	size_t seed = 0;
 	boost::hash_combine(seed, d.m_Texture);
 	boost::hash_combine(seed, d.m_TextureMask);
+	boost::hash_combine(seed, d.m_AlwaysVisible);
 	return seed;
 }
 
@@ -231,23 +240,27 @@ void OverlayRenderer::EndFrame()
 	m->quads.clear();
 	// this should leave the capacity unchanged, which is okay since it
 	// won't be very large or very variable
-	
+
 	// Empty the batch rendering data structures, but keep their key mappings around for the next frames
-	for (OverlayRendererInternals::QuadBatchMap::iterator it = m->quadBatchMap.begin(); it != m->quadBatchMap.end(); it++)
+	for (OverlayRendererInternals::BatchMap::iterator it = m->batchMap.begin(); it != m->batchMap.end(); ++it)
 	{
-		QuadBatchData& quadBatchData = (it->second);
-		quadBatchData.m_Quads.clear();
-		quadBatchData.m_NumRenderQuads = 0;
-		quadBatchData.m_IndicesBase = 0;
+		it->second.m_Lines.clear();
+		it->second.m_Quads.clear();
 	}
+	m->drawRanges.clear();
+	m->batchNumVertices = 0;
+	m->batchNumIndices = 0;
+	m->batchVertexBase = 0;
 }
 
 void OverlayRenderer::PrepareForRendering()
 {
 	PROFILE3("prepare overlays");
 
-	// This is where we should do something like sort the overlays by
-	// colour/sprite/etc for more efficient rendering
+	// Group textured lines and quads by their texture/mask combination (and visibility),
+	// counting how much space they'll need in the batch arrays
+	size_t numVertices = 0;
+	size_t numIndices = 0;
 
 	for (size_t i = 0; i < m->texlines.size(); ++i)
 	{
@@ -261,83 +274,145 @@ void OverlayRenderer::PrepareForRendering()
 			// call Update again. Also we assume the caller won't change
 			// any of the parameters after first submitting the line.
 		}
+
+		size_t lineVertices = line->m_RenderData->GetVertices().size();
+		if (lineVertices == 0 || lineVertices > 65536)
+			continue;
+
+		OverlayBatchKey key(line->m_TextureBase, line->m_TextureMask, line->m_AlwaysVisible);
+		m->batchMap[key].m_Lines.push_back(line); // will create entry if it doesn't already exist
+
+		numVertices += lineVertices;
+		numIndices += line->m_RenderData->GetIndices().size();
 	}
 
-	// Group quad overlays by their texture/mask combination for efficient rendering
-	// TODO: consider doing this directly in Submit()
 	for (size_t i = 0; i < m->quads.size(); ++i)
 	{
 		SOverlayQuad* const quad = m->quads[i];
 
-		QuadBatchKey textures(quad->m_Texture, quad->m_TextureMask);
-		QuadBatchData& batchRenderData = m->quadBatchMap[textures]; // will create entry if it doesn't already exist
+		OverlayBatchKey key(quad->m_Texture, quad->m_TextureMask, false);
+		m->batchMap[key].m_Quads.push_back(quad);
 
-		// add overlay to list of quads
-		batchRenderData.m_Quads.push_back(quad);
+		numVertices += 4;
+		numIndices += 6;
 	}
 
-	const CVector3D vOffset(0, OverlayRenderer::OVERLAY_VOFFSET, 0);
+	if (numVertices)
+	{
+		// Grow the arrays in powers of two, so they're rarely reallocated
+		if (numVertices > m->batchVertices.GetNumVertices())
+		{
+			m->batchVertices.SetNumVertices(round_up_to_pow2((unsigned)numVertices));
+			m->batchVertices.Layout(); // allocate backing store
+		}
+
+		if (numIndices > m->batchIndices.GetNumVertices())
+		{
+			m->batchIndices.SetNumVertices(round_up_to_pow2((unsigned)numIndices));
+			m->batchIndices.Layout();
+		}
 
-	// Write quad overlay vertices/indices to VA backing store
-	VertexArrayIterator<CVector3D> vertexPos = m->quadAttributePos.GetIterator<CVector3D>();
-	VertexArrayIterator<CVector4D> vertexColor = m->quadAttributeColor.GetIterator<CVector4D>();
-	VertexArrayIterator<short[2]> vertexUV = m->quadAttributeUV.GetIterator<short[2]>();
+		WriteBatches();
 
-	size_t indicesIdx = 0;
-	size_t totalNumQuads = 0;
+		m->batchVertices.Upload(m->batchNumVertices);
+		m->batchIndices.Upload(m->batchNumIndices);
+		// don't free the backing stores! we'll overwrite them on the next frame to save a reallocation.
+	}
+
+	// Convert the untextured lines into GL_LINES, grouped by thickness
+	for (std::map<u8, std::vector<float> >::iterator it = m->lineVertices.begin(); it != m->lineVertices.end(); ++it)
+		it->second.clear();
 
-	for (OverlayRendererInternals::QuadBatchMap::iterator it = m->quadBatchMap.begin(); it != m->quadBatchMap.end(); ++it)
+	for (size_t i = 0; i < m->lines.size(); ++i)
 	{
-		QuadBatchData& batchRenderData = (it->second);
-		batchRenderData.m_NumRenderQuads = 0;
+		SOverlayLine* line = m->lines[i];
+		ENSURE(line->m_Coords.size() % 3 == 0);
 
-		if (batchRenderData.m_Quads.empty())
-			continue;
+		std::vector<float>& vertices = m->lineVertices[line->m_Thickness];
+		const float* color = line->m_Color.FloatArray();
+		for (size_t j = 3; j < line->m_Coords.size(); j += 3)
+		{
+			for (size_t k = j - 3; k <= j; k += 3)
+			{
+				vertices.insert(vertices.end(), color, color + 4);
+				vertices.insert(vertices.end(), &line->m_Coords[k], &line->m_Coords[k] + 3);
+			}
+		}
+	}
+}
+
+void OverlayRenderer::WriteBatches()
+{
+	const CVector3D vOffset(0, OverlayRenderer::OVERLAY_VOFFSET, 0);
 
-		// Remember the current index into the (entire) indices array as our base offset for this batch
-		batchRenderData.m_IndicesBase = indicesIdx;
+	VertexArrayIterator<CVector3D> vertexPos = m->batchAttributePos.GetIterator<CVector3D>();
+	VertexArrayIterator<CVector4D> vertexColor = m->batchAttributeColor.GetIterator<CVector4D>();
+	VertexArrayIterator<float[2]> vertexUV = m->batchAttributeUV.GetIterator<float[2]>();
+	VertexArrayIterator<u16> index = m->batchIndices.GetIterator();
 
-		// points to the index where each iteration's vertices will be appended
-		for (size_t i = 0; i < batchRenderData.m_Quads.size() && totalNumQuads < OverlayRendererInternals::MAX_QUAD_OVERLAYS; i++)
+	for (OverlayRendererInternals::BatchMap::iterator it = m->batchMap.begin(); it != m->batchMap.end(); ++it)
+	{
+		const OverlayBatchKey& key = it->first;
+		OverlayBatchData& batch = it->second;
+
+		for (size_t i = 0; i < batch.m_Lines.size(); ++i)
 		{
-			const SOverlayQuad* quad = batchRenderData.m_Quads[i];
+			const SOverlayTexturedLine* line = batch.m_Lines[i];
+			const std::vector<CTexturedLineRData::SVertex>& vertices = line->m_RenderData->GetVertices();
+			const std::vector<u16>& indices = line->m_RenderData->GetIndices();
+
+			size_t base = m->BeginBatchGeometry(key, vertices.size());
+
+			const CVector4D lineColor(line->m_Color.r, line->m_Color.g, line->m_Color.b, line->m_Color.a);
+			for (size_t j = 0; j < vertices.size(); ++j)
+			{
+				*vertexPos++ = vertices[j].m_Position;
+				*vertexColor++ = lineColor;
+				(*vertexUV)[0] = vertices[j].m_UVs[0];
+				(*vertexUV)[1] = vertices[j].m_UVs[1];
+				++vertexUV;
+			}
+
+			for (size_t j = 0; j < indices.size(); ++j)
+				*index++ = (u16)(base + indices[j]);
+
+			m->batchNumVertices += vertices.size();
+			m->batchNumIndices += indices.size();
+			m->drawRanges.back().m_NumIndices += indices.size();
+		}
+
+		for (size_t i = 0; i < batch.m_Quads.size(); ++i)
+		{
+			const SOverlayQuad* quad = batch.m_Quads[i];
+
+			size_t base = m->BeginBatchGeometry(key, 4);
 
 			// TODO: this is kind of ugly, the iterator should use a type that can have quad->m_Color assigned
 			// to it directly
 			const CVector4D quadColor(quad->m_Color.r, quad->m_Color.g, quad->m_Color.b, quad->m_Color.a);
 
-			*vertexPos++ = quad->m_Corners[0] + vOffset;
-			*vertexPos++ = quad->m_Corners[1] + vOffset;
-			*vertexPos++ = quad->m_Corners[2] + vOffset;
-			*vertexPos++ = quad->m_Corners[3] + vOffset;
-			
-			(*vertexUV)[0] = 0;
-			(*vertexUV)[1] = 0;
-			++vertexUV;
-			(*vertexUV)[0] = 0;
-			(*vertexUV)[1] = 1;
-			++vertexUV;
-			(*vertexUV)[0] = 1;
-			(*vertexUV)[1] = 1;
-			++vertexUV;
-			(*vertexUV)[0] = 1;
-			(*vertexUV)[1] = 0;
-			++vertexUV;
-
-			*vertexColor++ = quadColor;
-			*vertexColor++ = quadColor;
-			*vertexColor++ = quadColor;
-			*vertexColor++ = quadColor;
-
-			indicesIdx += 6;
-
-			totalNumQuads++;
-			batchRenderData.m_NumRenderQuads++;
+			static const float uvs[4][2] = { { 0, 0 }, { 0, 1 }, { 1, 1 }, { 1, 0 } };
+			for (size_t j = 0; j < 4; ++j)
+			{
+				*vertexPos++ = quad->m_Corners[j] + vOffset;
+				*vertexColor++ = quadColor;
+				(*vertexUV)[0] = uvs[j][0];
+				(*vertexUV)[1] = uvs[j][1];
+				++vertexUV;
+			}
+
+			*index++ = (u16)(base + 0);
+			*index++ = (u16)(base + 1);
+			*index++ = (u16)(base + 2);
+			*index++ = (u16)(base + 2);
+			*index++ = (u16)(base + 3);
+			*index++ = (u16)(base + 0);
+
+			m->batchNumVertices += 4;
+			m->batchNumIndices += 6;
+			m->drawRanges.back().m_NumIndices += 6;
 		}
 	}
-
-	m->quadVertices.Upload();
-	// don't free the backing store! we'll overwrite it on the next frame to save a reallocation.
 }
 
 void OverlayRenderer::RenderOverlaysBeforeWater()
@@ -355,22 +430,26 @@ void OverlayRenderer::RenderOverlaysBeforeWater()
 	// since we still want to write to the z buffer)
 	glDepthFunc(GL_ALWAYS);
 
-	for (size_t i = 0; i < m->lines.size(); ++i)
+	// (One draw call per line thickness, since that's GL state)
+	for (std::map<u8, std::vector<float> >::iterator it = m->lineVertices.begin(); it != m->lineVertices.end(); ++it)
 	{
-		SOverlayLine* line = m->lines[i];
-		if (line->m_Coords.empty())
+		const std::vector<float>& vertices = it->second;
+		if (vertices.empty())
 			continue;
 
-		ENSURE(line->m_Coords.size() % 3 == 0);
+		glLineWidth((float)it->first);
 
-		glColor4fv(line->m_Color.FloatArray());
-		glLineWidth((float)line->m_Thickness);
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_COLOR_ARRAY);
+		glColorPointer(4, GL_FLOAT, sizeof(float)*7, &vertices[0]);
+		glVertexPointer(3, GL_FLOAT, sizeof(float)*7, &vertices[4]);
+		glDrawArrays(GL_LINES, 0, (GLsizei)(vertices.size() / 7));
 
-		glInterleavedArrays(GL_V3F, sizeof(float)*3, &line->m_Coords[0]);
-		glDrawArrays(GL_LINE_STRIP, 0, (GLsizei)line->m_Coords.size()/3);
+		g_Renderer.GetStats().m_DrawCalls++;
 	}
 
 	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_COLOR_ARRAY);
 
 	glLineWidth(1.f);
 	glDepthFunc(GL_LEQUAL);
@@ -382,17 +461,16 @@ void OverlayRenderer::RenderOverlaysAfterWater()
 {
 	PROFILE3_GPU("overlays (after)");
 
-	RenderTexturedOverlayLines();
-	RenderQuadOverlays();
+	RenderBatchedOverlays();
 }
 
-void OverlayRenderer::RenderTexturedOverlayLines()
+void OverlayRenderer::RenderBatchedOverlays()
 {
 #if CONFIG2_GLES
-#warning TODO: implement OverlayRenderer::RenderTexturedOverlayLines for GLES
+#warning TODO: implement OverlayRenderer::RenderBatchedOverlays for GLES
 	return;
 #endif
-	if (m->texlines.empty())
+	if (m->drawRanges.empty())
 		return;
 
 	ogl_WarnIfError();
@@ -410,141 +488,75 @@ void OverlayRenderer::RenderTexturedOverlayLines()
 	CLOSTexture& los = g_Renderer.GetScene().GetLOSTexture();
 
 	CShaderManager& shaderManager = g_Renderer.GetShaderManager();
-	CShaderProgramPtr shaderTexLineNormal(shaderManager.LoadProgram(shaderName, m->defsOverlayLineNormal));
-	CShaderProgramPtr shaderTexLineAlwaysVisible(shaderManager.LoadProgram(shaderName, m->defsOverlayLineAlwaysVisible));
 
-	// ----------------------------------------------------------------------------------------
+	// Base offsets (in bytes) of the two backing stores relative to their owner VBO
+	u8* indexBase = m->batchIndices.Bind();
+	u8* vertexBase = m->batchVertices.Bind();
+	GLsizei indexStride = m->batchIndices.GetStride();
+	GLsizei vertexStride = m->batchVertices.GetStride();
 
-	if (shaderTexLineNormal)
+	// Draw everything affected by the LOS first, then everything that isn't
+	for (int alwaysVisible = 0; alwaysVisible < 2; ++alwaysVisible)
 	{
-		shaderTexLineNormal->Bind();
-		shaderTexLineNormal->BindTexture("losTex", los.GetTexture());
-		shaderTexLineNormal->Uniform("losTransform", los.GetTextureMatrix()[0], los.GetTextureMatrix()[12], 0.f, 0.f);
-
-		// batch render only the non-always-visible overlay lines using the normal shader
-		RenderTexturedOverlayLines(shaderTexLineNormal, false);
-
-		shaderTexLineNormal->Unbind();
-	}
-
-	// ----------------------------------------------------------------------------------------
-
-	if (shaderTexLineAlwaysVisible)
-	{
-		shaderTexLineAlwaysVisible->Bind();
-		// TODO: losTex and losTransform are unused in the always visible shader; see if these can be safely omitted
-		shaderTexLineAlwaysVisible->BindTexture("losTex", los.GetTexture());
-		shaderTexLineAlwaysVisible->Uniform("losTransform", los.GetTextureMatrix()[0], los.GetTextureMatrix()[12], 0.f, 0.f);
-
-		// batch render only the always-visible overlay lines using the LoS-ignored shader
-		RenderTexturedOverlayLines(shaderTexLineAlwaysVisible, true);
-
-		shaderTexLineAlwaysVisible->Unbind();
-	}
-
-	// ----------------------------------------------------------------------------------------
-
-	// TODO: the shaders should probably be responsible for unbinding their textures
-	g_Renderer.BindTexture(1, 0);
-	g_Renderer.BindTexture(0, 0);
-
-	CVertexBuffer::Unbind();
-
-	glDepthMask(1);
-	glDisable(GL_BLEND);
-}
-
-void OverlayRenderer::RenderTexturedOverlayLines(CShaderProgramPtr shader, bool alwaysVisible)
-{
-	for (size_t i = 0; i < m->texlines.size(); ++i)
-	{
-		SOverlayTexturedLine* line = m->texlines[i];
-
-		// render only those lines matching the requested alwaysVisible status
-		if (!line->m_RenderData || line->m_AlwaysVisible != alwaysVisible)
+		CShaderProgramPtr shader(shaderManager.LoadProgram(shaderName,
+			alwaysVisible ? m->defsOverlayAlwaysVisible : m->defsOverlayNormal));
+		if (!shader)
 			continue;
 
-		ENSURE(line->m_RenderData);
-		line->m_RenderData->Render(*line, shader);
-	}
-}
-
-void OverlayRenderer::RenderQuadOverlays()
-{
-	if (m->quadBatchMap.empty())
-		return;
-
-	ogl_WarnIfError();
-
-	glEnable(GL_TEXTURE_2D);
-	glEnable(GL_BLEND);
-	glDepthMask(0);
-
-	const char* shaderName;
-	if (g_Renderer.GetRenderPath() == CRenderer::RP_SHADER)
-		shaderName = "arb/overlayline";
-	else
-		shaderName = "fixed:overlayline";
-
-	CLOSTexture& los = g_Renderer.GetScene().GetLOSTexture();
-
-	CShaderManager& shaderManager = g_Renderer.GetShaderManager();
-	CShaderProgramPtr shader(shaderManager.LoadProgram(shaderName, m->defsQuadOverlay));
-
-	// ----------------------------------------------------------------------------------------
-
-	if (shader)
-	{
 		shader->Bind();
+		// TODO: losTex and losTransform are unused in the always visible shader; see if these can be safely omitted
 		shader->BindTexture("losTex", los.GetTexture());
 		shader->Uniform("losTransform", los.GetTextureMatrix()[0], los.GetTextureMatrix()[12], 0.f, 0.f);
 
-		// Base offsets (in bytes) of the two backing stores relative to their owner VBO
-		u8* indexBase = m->quadIndices.Bind();
-		u8* vertexBase = m->quadVertices.Bind();
-		GLsizei indexStride = m->quadIndices.GetStride();
-		GLsizei vertexStride = m->quadVertices.GetStride();
+		int streamflags = shader->GetStreamFlags();
+
+		const OverlayBatchKey* boundKey = NULL;
+		size_t boundVertexBase = (size_t)-1;
 
-		for (OverlayRendererInternals::QuadBatchMap::iterator it = m->quadBatchMap.begin(); it != m->quadBatchMap.end(); it++)
+		for (size_t i = 0; i < m->drawRanges.size(); ++i)
 		{
-			QuadBatchData& batchRenderData = it->second;
-			const size_t batchNumQuads = batchRenderData.m_NumRenderQuads;
+			const OverlayDrawRange& range = m->drawRanges[i];
 
 			// Careful; some drivers don't like drawing calls with 0 stuff to draw.
-			if (batchNumQuads == 0)
+			if (range.m_Key->m_AlwaysVisible != (alwaysVisible != 0) || range.m_NumIndices == 0)
 				continue;
 
-			const QuadBatchKey& maskPair = it->first;
+			if (range.m_Key != boundKey)
+			{
+				shader->BindTexture("baseTex", range.m_Key->m_Texture->GetHandle());
+				shader->BindTexture("maskTex", range.m_Key->m_TextureMask->GetHandle());
+				boundKey = range.m_Key;
+			}
+
+			if (range.m_VertexBase != boundVertexBase)
+			{
+				u8* base = vertexBase + vertexStride * range.m_VertexBase;
+
+				if (streamflags & STREAM_POS)
+					shader->VertexPointer(m->batchAttributePos.elems, m->batchAttributePos.type, vertexStride, base + m->batchAttributePos.offset);
 
-			shader->BindTexture("baseTex", maskPair.m_Texture->GetHandle());
-			shader->BindTexture("maskTex", maskPair.m_TextureMask->GetHandle());
+				if (streamflags & STREAM_UV0)
+					shader->TexCoordPointer(GL_TEXTURE0, m->batchAttributeUV.elems, m->batchAttributeUV.type, vertexStride, base + m->batchAttributeUV.offset);
 
-			int streamflags = shader->GetStreamFlags();
+				if (streamflags & STREAM_UV1)
+					shader->TexCoordPointer(GL_TEXTURE1, m->batchAttributeUV.elems, m->batchAttributeUV.type, vertexStride, base + m->batchAttributeUV.offset);
 
-			if (streamflags & STREAM_POS)
-				shader->VertexPointer(m->quadAttributePos.elems, m->quadAttributePos.type, vertexStride, vertexBase + m->quadAttributePos.offset);
+				if (streamflags & STREAM_COLOR)
+					shader->ColorPointer(m->batchAttributeColor.elems, m->batchAttributeColor.type, vertexStride, base + m->batchAttributeColor.offset);
 
-			if (streamflags & STREAM_UV0)
-				shader->TexCoordPointer(GL_TEXTURE0, m->quadAttributeUV.elems, m->quadAttributeUV.type, vertexStride, vertexBase + m->quadAttributeUV.offset);
+				boundVertexBase = range.m_VertexBase;
+			}
 
-			if (streamflags & STREAM_UV1)
-				shader->TexCoordPointer(GL_TEXTURE1, m->quadAttributeUV.elems, m->quadAttributeUV.type, vertexStride, vertexBase + m->quadAttributeUV.offset);
-			
-			if (streamflags & STREAM_COLOR)
-				shader->ColorPointer(m->quadAttributeColor.elems, m->quadAttributeColor.type, vertexStride, vertexBase + m->quadAttributeColor.offset);
-			
 			shader->AssertPointersBound();
-			glDrawElements(GL_TRIANGLES, (GLsizei)(batchNumQuads * 6), GL_UNSIGNED_SHORT, indexBase + indexStride * batchRenderData.m_IndicesBase);
+			glDrawElements(GL_TRIANGLES, (GLsizei)range.m_NumIndices, GL_UNSIGNED_SHORT, indexBase + indexStride * range.m_IndicesBase);
 
 			g_Renderer.GetStats().m_DrawCalls++;
-			g_Renderer.GetStats().m_OverlayTris += batchNumQuads*2;
+			g_Renderer.GetStats().m_OverlayTris += range.m_NumIndices/3;
 		}
 
 		shader->Unbind();
 	}
 
-	// ----------------------------------------------------------------------------------------
-
 	// TODO: the shader should probably be responsible for unbinding its textures
 	g_Renderer.BindTexture(1, 0);
 	g_Renderer.BindTexture(0, 0);
@@ -555,6 +567,14 @@ void OverlayRenderer::RenderQuadOverlays()
 	glDisable(GL_BLEND);
 }
 
+struct SortSpritesByTexture
+{
+	bool operator()(const SOverlaySprite* a, const SOverlaySprite* b) const
+	{
+		return a->m_Texture.get() < b->m_Texture.get();
+	}
+};
+
 void OverlayRenderer::RenderForegroundOverlays(const CCamera& viewCamera)
 {
 	PROFILE3_GPU("overlays (fg)");
@@ -584,21 +604,16 @@ void OverlayRenderer::RenderForegroundOverlays(const CCamera& viewCamera)
 		shader = tech->GetShader();
 	}
 
-	float uvs[8] = { 0,0, 1,0, 1,1, 0,1 };
-	
-	if (g_Renderer.GetRenderPath() == CRenderer::RP_SHADER)
-		shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, sizeof(float)*2, &uvs[0]);
-	else
-		glTexCoordPointer(2, GL_FLOAT, sizeof(float)*2, &uvs);
+	// Sort the sprites by texture, and put all their vertices in one array,
+	// so each texture needs just one draw call
+	std::vector<SOverlaySprite*> sprites = m->sprites;
+	std::stable_sort(sprites.begin(), sprites.end(), SortSpritesByTexture());
 
-	for (size_t i = 0; i < m->sprites.size(); ++i)
+	std::vector<float>& vertices = m->spriteVertices;
+	vertices.clear();
+	for (size_t i = 0; i < sprites.size(); ++i)
 	{
-		SOverlaySprite* sprite = m->sprites[i];
-		
-		if (g_Renderer.GetRenderPath() == CRenderer::RP_SHADER)
-			shader->BindTexture("baseTex", sprite->m_Texture);
-		else
-			sprite->m_Texture->Bind();
+		SOverlaySprite* sprite = sprites[i];
 
 		CVector3D pos[4] = {
 			sprite->m_Position + right*sprite->m_X0 + up*sprite->m_Y0,
@@ -606,16 +621,51 @@ void OverlayRenderer::RenderForegroundOverlays(const CCamera& viewCamera)
 			sprite->m_Position + right*sprite->m_X1 + up*sprite->m_Y1,
 			sprite->m_Position + right*sprite->m_X0 + up*sprite->m_Y1
 		};
+		static const float uvs[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+
+		for (size_t j = 0; j < 4; ++j)
+		{
+			vertices.push_back(pos[j].X);
+			vertices.push_back(pos[j].Y);
+			vertices.push_back(pos[j].Z);
+			vertices.push_back(uvs[j][0]);
+			vertices.push_back(uvs[j][1]);
+		}
+	}
+
+	if (!vertices.empty())
+	{
+		GLsizei stride = sizeof(float)*5;
+		if (g_Renderer.GetRenderPath() == CRenderer::RP_SHADER)
+		{
+			shader->VertexPointer(3, GL_FLOAT, stride, &vertices[0]);
+			shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, stride, &vertices[3]);
+		}
+		else
+		{
+			glVertexPointer(3, GL_FLOAT, stride, &vertices[0]);
+			glTexCoordPointer(2, GL_FLOAT, stride, &vertices[3]);
+		}
+	}
+
+	for (size_t i = 0; i < sprites.size(); )
+	{
+		// Find the run of sprites with the same texture
+		size_t end = i + 1;
+		while (end < sprites.size() && sprites[end]->m_Texture == sprites[i]->m_Texture)
+			++end;
 
 		if (g_Renderer.GetRenderPath() == CRenderer::RP_SHADER)
-			shader->VertexPointer(3, GL_FLOAT, sizeof(float)*3, &pos[0].X);
+			shader->BindTexture("baseTex", sprites[i]->m_Texture);
 		else
-			glVertexPointer(3, GL_FLOAT, sizeof(float)*3, &pos[0].X);
-		
-		glDrawArrays(GL_QUADS, 0, (GLsizei)4);
+			sprites[i]->m_Texture->Bind();
+
+		glDrawArrays(GL_QUADS, (GLint)(i*4), (GLsizei)((end - i)*4));
 
 		g_Renderer.GetStats().m_DrawCalls++;
-		g_Renderer.GetStats().m_OverlayTris += 2;
+		g_Renderer.GetStats().m_OverlayTris += (end - i)*2;
+
+		i = end;
 	}
 	
 	if (g_Renderer.GetRenderPath() == CRenderer::RP_SHADER)
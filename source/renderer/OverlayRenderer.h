@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -111,24 +111,17 @@ public:
 private:
 	
 	/**
-	 * Helper method; renders all overlay lines currently registered in the internals. Batch-
-	 * renders textured overlay lines batched according to their visibility status by delegating
-	 * to RenderTexturedOverlayLines(CShaderProgramPtr, bool).
+	 * Helper method; writes the vertices and indices of all the textured lines and quads
+	 * into the batch arrays, grouped by their textures and visibility, and records the
+	 * ranges to draw.
 	 */
-	void RenderTexturedOverlayLines();
+	void WriteBatches();
 
 	/**
-	 * Helper method; renders those overlay lines currently registered in the internals (i.e.
-	 * in m->texlines) for which the 'always visible' flag equals @p alwaysVisible. Used for
-	 * batch rendering the overlay lines according to their alwaysVisible status, as this
-	 * requires a separate shader to be used.
+	 * Helper method; renders all the textured lines and quads, with one draw call per
+	 * combination of textures (per shader) where possible.
 	 */
-	void RenderTexturedOverlayLines(CShaderProgramPtr shader, bool alwaysVisible);
-
-	/**
-	 * Helper method; batch-renders all registered quad overlays, batched by their texture for effiency.
-	 */
-	void RenderQuadOverlays();
+	void RenderBatchedOverlays();
 
 private:
 	OverlayRendererInternals* m;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -29,6 +29,11 @@ struct ParticleRendererInternals
 {
 	CShaderTechniquePtr shader;
 	CShaderTechniquePtr shaderSolid;
+
+	// shaders for emitters simulated on the GPU (NULL if that's disabled)
+	CShaderTechniquePtr shaderGPU;
+	CShaderTechniquePtr shaderGPUSolid;
+
 	std::vector<CParticleEmitter*> emitters;
 };
 
@@ -88,15 +93,30 @@ void ParticleRenderer::PrepareForRendering(const CShaderDefines& context)
 		{
 			m->shader = g_Renderer.GetShaderManager().LoadEffect(CStrIntern("particle"), context, CShaderDefines());
 			m->shaderSolid = g_Renderer.GetShaderManager().LoadEffect(CStrIntern("particle_solid"), context, CShaderDefines());
+
+			if (g_Renderer.m_Options.m_GPUParticles)
+			{
+				m->shaderGPU = g_Renderer.GetShaderManager().LoadEffect(CStrIntern("particle_gpu"), context, CShaderDefines());
+				m->shaderGPUSolid = g_Renderer.GetShaderManager().LoadEffect(CStrIntern("particle_gpu_solid"), context, CShaderDefines());
+
+				// Keep simulating everything on the CPU if the shaders aren't usable
+				if (!m->shaderGPU || !m->shaderGPU->GetShader()->IsValid() ||
+					!m->shaderGPUSolid || !m->shaderGPUSolid->GetShader()->IsValid())
+				{
+					m->shaderGPU.reset();
+					m->shaderGPUSolid.reset();
+				}
+			}
 		}
 	}
 
 	{
 		PROFILE("update emitters");
+		bool allowGPUSimulation = (m->shaderGPU != NULL);
 		for (size_t i = 0; i < m->emitters.size(); ++i)
 		{
 			CParticleEmitter* emitter = m->emitters[i];
-			emitter->UpdateArrayData();
+			emitter->UpdateArrayData(allowGPUSimulation);
 		}
 	}
 
@@ -113,24 +133,37 @@ void ParticleRenderer::PrepareForRendering(const CShaderDefines& context)
 
 void ParticleRenderer::RenderParticles(bool solidColor)
 {
-	CShaderTechniquePtr shader = solidColor ? m->shaderSolid : m->shader;
-
-	shader->BeginPass();
-
-	shader->GetShader()->Uniform("transform", g_Renderer.GetViewCamera().GetViewProjection());
-
-	if (!solidColor)
-		glEnable(GL_BLEND);
-	glDepthMask(0);
+	CShaderTechniquePtr shaderCPU = solidColor ? m->shaderSolid : m->shader;
+	CShaderTechniquePtr shaderGPU = solidColor ? m->shaderGPUSolid : m->shaderGPU;
 
+	// The emitters are sorted by distance, so switch between the CPU and GPU
+	// shaders whenever the next emitter needs the other one
+	CShaderTechniquePtr shader;
 	for (size_t i = 0; i < m->emitters.size(); ++i)
 	{
 		CParticleEmitter* emitter = m->emitters[i];
 
+		CShaderTechniquePtr emitterShader = emitter->IsGPUSimulated() ? shaderGPU : shaderCPU;
+		if (emitterShader != shader)
+		{
+			if (shader)
+				shader->EndPass();
+			shader = emitterShader;
+			shader->BeginPass();
+			shader->GetShader()->Uniform("transform", g_Renderer.GetViewCamera().GetViewProjection());
+
+			if (!solidColor)
+				glEnable(GL_BLEND);
+			glDepthMask(0);
+		}
+
 		emitter->Bind(shader->GetShader());
 		emitter->RenderArray(shader->GetShader());
 	}
 
+	if (shader)
+		shader->EndPass();
+
 	CVertexBuffer::Unbind();
 
 	pglBlendEquationEXT(GL_FUNC_ADD);
@@ -138,8 +171,6 @@ void ParticleRenderer::RenderParticles(bool solidColor)
 
 	glDisable(GL_BLEND);
 	glDepthMask(1);
-
-	shader->EndPass();
 }
 
 void ParticleRenderer::RenderBounds(CShaderProgramPtr& shader)
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -29,17 +29,19 @@
 #include "graphics/Terrain.h"
 #include "graphics/TextRenderer.h"
 #include "lib/alignment.h"
-#include "lib/allocators/arena.h"
 #include "maths/MathUtil.h"
 #include "ps/CLogger.h"
+#include "ps/FrameArena.h"
 #include "ps/Game.h"
 #include "ps/Profile.h"
 #include "ps/Pyrogenesis.h"
+#include "ps/ThreadPool.h"
 #include "ps/World.h"
 #include "ps/GameSetup/Config.h"
 #include "renderer/AlphaMapCalculator.h"
 #include "renderer/PatchRData.h"
 #include "renderer/TerrainRenderer.h"
+#include "renderer/TerrainTextureArray.h"
 #include "renderer/Renderer.h"
 #include "renderer/WaterManager.h"
 #include "simulation2/Simulation2.h"
@@ -60,14 +62,20 @@ const ssize_t BlendOffsets[9][2] = {
 ///////////////////////////////////////////////////////////////////
 // CPatchRData constructor
 CPatchRData::CPatchRData(CPatch* patch, CSimulation2* simulation) :
-	m_Patch(patch), m_VBSides(0),
+	m_Patch(patch), m_LOD(0), m_VBSides(0),
 	m_VBBase(0), m_VBBaseIndices(0),
 	m_VBBlends(0), m_VBBlendIndices(0),
+	m_UsesTextureArray(false), m_ArrayAlphaMap(0),
+	m_VBArray(0), m_VBArrayIndices(0),
 	m_VBWater(0), m_VBWaterIndices(0),
-	m_Simulation(simulation)
+	m_Simulation(simulation), m_Pending(NULL)
 {
 	ENSURE(patch);
-	Build();
+	for (size_t e = 0; e < 4; ++e)
+		m_EdgeLOD[e] = 0;
+
+	// Everything will be built by the first Update (or by BuildAll)
+	m_UpdateFlags = RENDERDATA_UPDATE_VERTICES | RENDERDATA_UPDATE_INDICES | RENDERDATA_UPDATE_WATER | RENDERDATA_UPDATE_COLOR;
 }
 
 ///////////////////////////////////////////////////////////////////
@@ -80,8 +88,12 @@ CPatchRData::~CPatchRData()
 	if (m_VBBaseIndices) g_VBMan.Release(m_VBBaseIndices);
 	if (m_VBBlends) g_VBMan.Release(m_VBBlends);
 	if (m_VBBlendIndices) g_VBMan.Release(m_VBBlendIndices);
+	if (m_VBArray) g_VBMan.Release(m_VBArray);
+	if (m_VBArrayIndices) g_VBMan.Release(m_VBArrayIndices);
 	if (m_VBWater) g_VBMan.Release(m_VBWater);
 	if (m_VBWaterIndices) g_VBMan.Release(m_VBWaterIndices);
+
+	delete m_Pending;
 }
 
 /**
@@ -140,17 +152,20 @@ struct SBlendLayer
 	std::vector<Tile> m_Tiles;
 };
 
-void CPatchRData::BuildBlends()
+void CPatchRData::BuildBlends(SPendingGeometry& geometry)
 {
 	PROFILE3("build blends");
 
 	m_BlendSplats.clear();
 
-	std::vector<SBlendVertex> blendVertices;
-	std::vector<u16> blendIndices;
+	std::vector<SBlendVertex>& blendVertices = geometry.blendVertices;
+	std::vector<u16>& blendIndices = geometry.blendIndices;
 
 	CTerrain* terrain = m_Patch->m_Parent;
 
+	LODHeights heights;
+	CalcLODHeights(heights);
+
 	std::vector<STileBlendStack> blendStacks;
 	blendStacks.reserve(PATCH_SIZE*PATCH_SIZE);
 
@@ -209,6 +224,36 @@ void CPatchRData::BuildBlends()
 		}
 	}
 
+	// Take the tiles that can be drawn in a single pass from the texture array
+	// out of the stacks, so they don't get splats
+	std::vector<SArrayVertex>& arrayVertices = geometry.arrayVertices;
+	std::vector<u16>& arrayIndices = geometry.arrayIndices;
+	memset(m_ArrayTiles, 0, sizeof(m_ArrayTiles));
+	m_ArrayAlphaMap = 0;
+	m_UsesTextureArray = g_Renderer.GetTerrainTextureArray().IsEnabled();
+	if (m_UsesTextureArray)
+	{
+		std::vector<std::pair<CTerrainTextureEntry*, u8> > tileBlends;
+		for (size_t k = 0; k < blendStacks.size(); ++k)
+		{
+			// (Tiles without blends are drawn more cheaply by the base splats)
+			STileBlendStack& blendStack = blendStacks[k];
+			if (blendStack.blends.empty())
+				continue;
+
+			// Blends are drawn from the back of the stack, as with the splats
+			tileBlends.clear();
+			for (size_t b = blendStack.blends.size(); b-- > 0; )
+				tileBlends.push_back(std::make_pair(blendStack.blends[b].m_Texture, (u8)blendStack.blends[b].m_TileMask));
+
+			if (AddArrayTile(arrayVertices, arrayIndices, blendStack.i, blendStack.j, tileBlends, heights))
+			{
+				m_ArrayTiles[blendStack.j][blendStack.i] = true;
+				blendStack.blends.clear();
+			}
+		}
+	}
+
 	// Given the blend stack per tile, we want to batch together as many blends as possible.
 	// Group them into a series of layers (each of which has a single texture):
 	// (This is effectively a topological sort / linearisation of the partial order induced
@@ -276,49 +321,42 @@ void CPatchRData::BuildBlends()
 		for (size_t t = 0; t < blendLayers[k].m_Tiles.size(); ++t)
 		{
 			SBlendLayer::Tile& tile = blendLayers[k].m_Tiles[t];
-			AddBlend(blendVertices, blendIndices, tile.i, tile.j, tile.shape, splat.m_Texture);
+			AddBlend(blendVertices, blendIndices, tile.i, tile.j, tile.shape, splat.m_Texture, heights);
 		}
 
 		splat.m_IndexCount = blendIndices.size() - splat.m_IndexStart;
 	}
+}
 
-	// Release existing vertex buffer chunks
-	if (m_VBBlends)
+// Adds the two triangles of a tile whose corners are the four vertices from
+// 'index' (in the order (0,0), (1,0), (1,1), (0,1)), split along the diagonal
+// given by CTerrain::GetTriangulationDir
+static void AddQuadIndices(std::vector<u16>& indices, size_t index, bool dir)
+{
+	if (dir)
 	{
-		g_VBMan.Release(m_VBBlends);
-		m_VBBlends = 0;
-	}
+		indices.push_back(index+0);
+		indices.push_back(index+1);
+		indices.push_back(index+3);
 
-	if (m_VBBlendIndices)
-	{
-		g_VBMan.Release(m_VBBlendIndices);
-		m_VBBlendIndices = 0;
+		indices.push_back(index+1);
+		indices.push_back(index+2);
+		indices.push_back(index+3);
 	}
-
-	if (blendVertices.size())
+	else
 	{
-		// Construct vertex buffer
-
-		m_VBBlends = g_VBMan.Allocate(sizeof(SBlendVertex), blendVertices.size(), GL_STATIC_DRAW, GL_ARRAY_BUFFER);
-		m_VBBlends->m_Owner->UpdateChunkVertices(m_VBBlends, &blendVertices[0]);
-
-		// Update the indices to include the base offset of the vertex data
-		for (size_t k = 0; k < blendIndices.size(); ++k)
-			blendIndices[k] += m_VBBlends->m_Index;
+		indices.push_back(index+0);
+		indices.push_back(index+1);
+		indices.push_back(index+2);
 
-		m_VBBlendIndices = g_VBMan.Allocate(sizeof(u16), blendIndices.size(), GL_STATIC_DRAW, GL_ELEMENT_ARRAY_BUFFER);
-		m_VBBlendIndices->m_Owner->UpdateChunkVertices(m_VBBlendIndices, &blendIndices[0]);
+		indices.push_back(index+2);
+		indices.push_back(index+3);
+		indices.push_back(index+0);
 	}
 }
 
-void CPatchRData::AddBlend(std::vector<SBlendVertex>& blendVertices, std::vector<u16>& blendIndices, 
-			   u16 i, u16 j, u8 shape, CTerrainTextureEntry* texture)
+bool CPatchRData::CalcBlendUVs(u8 shape, CTerrainTextureEntry* texture, float uvs[4][2])
 {
-	CTerrain* terrain = m_Patch->m_Parent;
-
-	ssize_t gx = m_Patch->m_X * PATCH_SIZE + i;
-	ssize_t gz = m_Patch->m_Z * PATCH_SIZE + j;
-
 	// uses the current neighbour texture
 	BlendShape8 shape8;
 	for (size_t m = 0; m < 8; ++m)
@@ -330,7 +368,7 @@ void CPatchRData::AddBlend(std::vector<SBlendVertex>& blendVertices, std::vector
 
 	// now actually render the blend tile (if we need one)
 	if (alphamap == -1)
-		return;
+		return false;
 	
 	float u0 = texture->m_TerrainAlpha->second.m_AlphaMapCoords[alphamap].u0;
 	float u1 = texture->m_TerrainAlpha->second.m_AlphaMapCoords[alphamap].u1;
@@ -351,15 +389,126 @@ void CPatchRData::AddBlend(std::vector<SBlendVertex>& blendVertices, std::vector
 	else if (alphamapflags & BLENDMAP_ROTATE270)
 		base = 3;
 
-	SBlendVertex vtx[4];
-	vtx[(base + 0) % 4].m_AlphaUVs[0] = u0;
-	vtx[(base + 0) % 4].m_AlphaUVs[1] = v0;
-	vtx[(base + 1) % 4].m_AlphaUVs[0] = u1;
-	vtx[(base + 1) % 4].m_AlphaUVs[1] = v0;
-	vtx[(base + 2) % 4].m_AlphaUVs[0] = u1;
-	vtx[(base + 2) % 4].m_AlphaUVs[1] = v1;
-	vtx[(base + 3) % 4].m_AlphaUVs[0] = u0;
-	vtx[(base + 3) % 4].m_AlphaUVs[1] = v1;
+	uvs[(base + 0) % 4][0] = u0;
+	uvs[(base + 0) % 4][1] = v0;
+	uvs[(base + 1) % 4][0] = u1;
+	uvs[(base + 1) % 4][1] = v0;
+	uvs[(base + 2) % 4][0] = u1;
+	uvs[(base + 2) % 4][1] = v1;
+	uvs[(base + 3) % 4][0] = u0;
+	uvs[(base + 3) % 4][1] = v1;
+	return true;
+}
+
+bool CPatchRData::AddArrayTile(std::vector<SArrayVertex>& arrayVertices, std::vector<u16>& arrayIndices,
+			   u16 i, u16 j, const std::vector<std::pair<CTerrainTextureEntry*, u8> >& blends, const LODHeights& heights)
+{
+	CTerrainTextureArray& textureArray = g_Renderer.GetTerrainTextureArray();
+	CTerrain* terrain = m_Patch->m_Parent;
+
+	CTerrainTextureEntry* textures[1 + MAX_ARRAY_BLENDS];
+	int layers[1 + MAX_ARRAY_BLENDS];
+	float alphaUVs[MAX_ARRAY_BLENDS][4][2];
+
+	textures[0] = m_Patch->m_MiniPatches[j][i].GetTextureEntry();
+	layers[0] = textureArray.GetLayer(textures[0]);
+	if (layers[0] == -1)
+		return false;
+
+	// All the array tiles in a patch must use the same alpha map texture,
+	// since they're drawn together
+	Handle alphaMap = m_ArrayAlphaMap;
+
+	size_t numBlends = 0;
+	for (size_t b = 0; b < blends.size(); ++b)
+	{
+		CTerrainTextureEntry* texture = blends[b].first;
+		float uvs[4][2];
+		if (!CalcBlendUVs(blends[b].second, texture, uvs))
+			continue;
+
+		if (numBlends == MAX_ARRAY_BLENDS)
+			return false;
+
+		if (alphaMap && alphaMap != texture->m_TerrainAlpha->second.m_hCompositeAlphaMap)
+			return false;
+		alphaMap = texture->m_TerrainAlpha->second.m_hCompositeAlphaMap;
+
+		memcpy(alphaUVs[numBlends], uvs, sizeof(uvs));
+		textures[1 + numBlends] = texture;
+		layers[1 + numBlends] = textureArray.GetLayer(texture);
+		if (layers[1 + numBlends] == -1)
+			return false;
+
+		++numBlends;
+	}
+
+	// If none of the blends are visible, the base splat is enough
+	if (numBlends == 0)
+		return false;
+
+	for (size_t b = numBlends; b < MAX_ARRAY_BLENDS; ++b)
+	{
+		textures[1 + b] = textures[0];
+		layers[1 + b] = layers[0];
+		memset(alphaUVs[b], 0, sizeof(alphaUVs[b]));
+	}
+
+	m_ArrayAlphaMap = alphaMap;
+
+	const CLightEnv& lightEnv = g_Renderer.GetLightEnv();
+
+	ssize_t gx = m_Patch->m_X * PATCH_SIZE + i;
+	ssize_t gz = m_Patch->m_Z * PATCH_SIZE + j;
+
+	static const ssize_t corners[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+
+	size_t index = arrayVertices.size();
+
+	for (size_t c = 0; c < 4; ++c)
+	{
+		SArrayVertex vertex;
+		terrain->CalcPosition(gx + corners[c][0], gz + corners[c][1], vertex.m_Position);
+		vertex.m_Position.Y = heights[j + corners[c][1]][i + corners[c][0]];
+		terrain->CalcNormal(gx + corners[c][0], gz + corners[c][1], vertex.m_Normal);
+		// (The texture array is only used by shaders, so the lighting is never done on the CPU)
+		vertex.m_DiffuseColor = lightEnv.EvaluateTerrainDiffuseFactor(vertex.m_Normal);
+
+		for (size_t l = 0; l < 1 + MAX_ARRAY_BLENDS; ++l)
+		{
+			vertex.m_Layers[l] = (u8)layers[l];
+
+			// Apply the transform that the normal shaders get from textureTransform
+			const float* m = textures[l]->GetTextureMatrix();
+			vertex.m_LayerUVs[l][0] = m[0] * vertex.m_Position.X + m[8] * vertex.m_Position.Z;
+			vertex.m_LayerUVs[l][1] = m[1] * vertex.m_Position.X + m[9] * vertex.m_Position.Z;
+		}
+
+		for (size_t b = 0; b < MAX_ARRAY_BLENDS; ++b)
+		{
+			vertex.m_AlphaUVs[b][0] = alphaUVs[b][c][0];
+			vertex.m_AlphaUVs[b][1] = alphaUVs[b][c][1];
+		}
+
+		arrayVertices.push_back(vertex);
+	}
+
+	AddQuadIndices(arrayIndices, index, terrain->GetTriangulationDir(gx, gz));
+
+	return true;
+}
+
+void CPatchRData::AddBlend(std::vector<SBlendVertex>& blendVertices, std::vector<u16>& blendIndices, 
+			   u16 i, u16 j, u8 shape, CTerrainTextureEntry* texture, const LODHeights& heights)
+{
+	CTerrain* terrain = m_Patch->m_Parent;
+
+	ssize_t gx = m_Patch->m_X * PATCH_SIZE + i;
+	ssize_t gz = m_Patch->m_Z * PATCH_SIZE + j;
+
+	float uvs[4][2];
+	if (!CalcBlendUVs(shape, texture, uvs))
+		return;
 
 	SBlendVertex dst;
 
@@ -371,61 +520,45 @@ void CPatchRData::AddBlend(std::vector<SBlendVertex>& blendVertices, std::vector
 	size_t index = blendVertices.size();
 
 	terrain->CalcPosition(gx, gz, dst.m_Position);
+	dst.m_Position.Y = heights[j][i];
 	terrain->CalcNormal(gx, gz, normal);
 	dst.m_Normal = normal;
 	dst.m_DiffuseColor = cpuLighting ? lightEnv.EvaluateTerrainDiffuseScaled(normal) : lightEnv.EvaluateTerrainDiffuseFactor(normal);
-	dst.m_AlphaUVs[0] = vtx[0].m_AlphaUVs[0];
-	dst.m_AlphaUVs[1] = vtx[0].m_AlphaUVs[1];
+	dst.m_AlphaUVs[0] = uvs[0][0];
+	dst.m_AlphaUVs[1] = uvs[0][1];
 	blendVertices.push_back(dst);
 
 	terrain->CalcPosition(gx + 1, gz, dst.m_Position);
+	dst.m_Position.Y = heights[j][i + 1];
 	terrain->CalcNormal(gx + 1, gz, normal);
 	dst.m_Normal = normal;
 	dst.m_DiffuseColor = cpuLighting ? lightEnv.EvaluateTerrainDiffuseScaled(normal) : lightEnv.EvaluateTerrainDiffuseFactor(normal);
-	dst.m_AlphaUVs[0] = vtx[1].m_AlphaUVs[0];
-	dst.m_AlphaUVs[1] = vtx[1].m_AlphaUVs[1];
+	dst.m_AlphaUVs[0] = uvs[1][0];
+	dst.m_AlphaUVs[1] = uvs[1][1];
 	blendVertices.push_back(dst);
 
 	terrain->CalcPosition(gx + 1, gz + 1, dst.m_Position);
+	dst.m_Position.Y = heights[j + 1][i + 1];
 	terrain->CalcNormal(gx + 1, gz + 1, normal);
 	dst.m_Normal = normal;
 	dst.m_DiffuseColor = cpuLighting ? lightEnv.EvaluateTerrainDiffuseScaled(normal) : lightEnv.EvaluateTerrainDiffuseFactor(normal);
-	dst.m_AlphaUVs[0] = vtx[2].m_AlphaUVs[0];
-	dst.m_AlphaUVs[1] = vtx[2].m_AlphaUVs[1];
+	dst.m_AlphaUVs[0] = uvs[2][0];
+	dst.m_AlphaUVs[1] = uvs[2][1];
 	blendVertices.push_back(dst);
 
 	terrain->CalcPosition(gx, gz + 1, dst.m_Position);
+	dst.m_Position.Y = heights[j + 1][i];
 	terrain->CalcNormal(gx, gz + 1, normal);
 	dst.m_Normal = normal;
 	dst.m_DiffuseColor = cpuLighting ? lightEnv.EvaluateTerrainDiffuseScaled(normal) : lightEnv.EvaluateTerrainDiffuseFactor(normal);
-	dst.m_AlphaUVs[0] = vtx[3].m_AlphaUVs[0];
-	dst.m_AlphaUVs[1] = vtx[3].m_AlphaUVs[1];
+	dst.m_AlphaUVs[0] = uvs[3][0];
+	dst.m_AlphaUVs[1] = uvs[3][1];
 	blendVertices.push_back(dst);
 
-	bool dir = terrain->GetTriangulationDir(gx, gz);
-	if (dir)
-	{
-		blendIndices.push_back(index+0);
-		blendIndices.push_back(index+1);
-		blendIndices.push_back(index+3);
-
-		blendIndices.push_back(index+1);
-		blendIndices.push_back(index+2);
-		blendIndices.push_back(index+3);
-	}
-	else
-	{
-		blendIndices.push_back(index+0);
-		blendIndices.push_back(index+1);
-		blendIndices.push_back(index+2);
-
-		blendIndices.push_back(index+2);
-		blendIndices.push_back(index+3);
-		blendIndices.push_back(index+0);
-	}
+	AddQuadIndices(blendIndices, index, terrain->GetTriangulationDir(gx, gz));
 }
 
-void CPatchRData::BuildIndices()
+void CPatchRData::BuildIndices(std::vector<u16>& indices)
 {
 	PROFILE3("build indices");
 
@@ -434,13 +567,9 @@ void CPatchRData::BuildIndices()
 	ssize_t px = m_Patch->m_X * PATCH_SIZE;
 	ssize_t pz = m_Patch->m_Z * PATCH_SIZE;
 
-	// must have allocated some vertices before trying to build corresponding indices
-	ENSURE(m_VBBase);
-
 	// number of vertices in each direction in each patch
 	ssize_t vsize=PATCH_SIZE+1;
 
-	std::vector<unsigned short> indices;
 	indices.reserve(PATCH_SIZE * PATCH_SIZE * 4);
 
 	// release existing splats
@@ -459,11 +588,43 @@ void CPatchRData::BuildIndices()
 		}
 	}
 
+	// At lower levels of detail, find the blocks of tiles that can be drawn as
+	// just two triangles: they mustn't be on the edge of the map (whose vertices
+	// aren't moved onto the coarse grid), and they and their neighbouring tiles
+	// must have the same texture, so that no blends are drawn on them
+	ssize_t lodSize = (ssize_t)1 << m_LOD;
+	ssize_t numBlocks = PATCH_SIZE / lodSize;
+	LODHeights heights;
+	bool mergedBlocks[PATCH_SIZE][PATCH_SIZE] = {};
+	if (m_LOD > 0)
+	{
+		CalcLODHeights(heights);
+
+		for (ssize_t bj = 0; bj < numBlocks; ++bj)
+		{
+			for (ssize_t bi = 0; bi < numBlocks; ++bi)
+			{
+				CTerrainTextureEntry* tex = texgrid[bj*lodSize][bi*lodSize];
+				bool merge = true;
+				for (ssize_t j = bj*lodSize - 1; merge && j <= (bj+1)*lodSize; ++j)
+				{
+					for (ssize_t i = bi*lodSize - 1; merge && i <= (bi+1)*lodSize; ++i)
+					{
+						CMiniPatch* tile = terrain->GetTile(px+i, pz+j);
+						if (!tile || tile->GetTextureEntry() != tex)
+							merge = false;
+					}
+				}
+				mergedBlocks[bj][bi] = merge;
+			}
+		}
+	}
+
 	// now build base splats from interior textures
 	m_Splats.resize(textures.size());
 	// build indices for base splats
-	size_t base=m_VBBase->m_Index;
-	ENSURE(base + vsize*vsize < 65536); // mustn't overflow u16 indexes
+	// (relative to the first vertex; Upload adds the vertices' offset in their buffer)
+	size_t base=0;
 	for (size_t i=0;i<m_Splats.size();i++) {
 		CTerrainTextureEntry* tex=textures[i];
 
@@ -471,55 +632,97 @@ void CPatchRData::BuildIndices()
 		splat.m_Texture=tex;
 		splat.m_IndexStart=indices.size();
 
-		for (ssize_t j = 0; j < PATCH_SIZE; j++)
+		// Merged blocks of this texture
+		for (ssize_t bj = 0; bj < numBlocks && m_LOD > 0; bj++)
 		{
-			for (ssize_t i = 0; i < PATCH_SIZE; i++)
+			for (ssize_t bi = 0; bi < numBlocks; bi++)
 			{
-				if (texgrid[j][i] == tex)
+				ssize_t i0 = bi*lodSize, j0 = bj*lodSize;
+				ssize_t i1 = i0+lodSize, j1 = j0+lodSize;
+				if (mergedBlocks[bj][bi] && texgrid[j0][i0] == tex)
 				{
-					bool dir = terrain->GetTriangulationDir(px+i, pz+j);
-					if (dir)
+					if (GetLODBlockDir(heights, i0, j0, lodSize))
 					{
-						indices.push_back(u16(((j+0)*vsize+(i+0))+base));
-						indices.push_back(u16(((j+0)*vsize+(i+1))+base));
-						indices.push_back(u16(((j+1)*vsize+(i+0))+base));
+						indices.push_back(u16((j0*vsize+i0)+base));
+						indices.push_back(u16((j0*vsize+i1)+base));
+						indices.push_back(u16((j1*vsize+i0)+base));
 
-						indices.push_back(u16(((j+0)*vsize+(i+1))+base));
-						indices.push_back(u16(((j+1)*vsize+(i+1))+base));
-						indices.push_back(u16(((j+1)*vsize+(i+0))+base));
+						indices.push_back(u16((j0*vsize+i1)+base));
+						indices.push_back(u16((j1*vsize+i1)+base));
+						indices.push_back(u16((j1*vsize+i0)+base));
 					}
 					else
 					{
-						indices.push_back(u16(((j+0)*vsize+(i+0))+base));
-						indices.push_back(u16(((j+0)*vsize+(i+1))+base));
-						indices.push_back(u16(((j+1)*vsize+(i+1))+base));
+						indices.push_back(u16((j0*vsize+i0)+base));
+						indices.push_back(u16((j0*vsize+i1)+base));
+						indices.push_back(u16((j1*vsize+i1)+base));
 
-						indices.push_back(u16(((j+1)*vsize+(i+1))+base));
-						indices.push_back(u16(((j+1)*vsize+(i+0))+base));
-						indices.push_back(u16(((j+0)*vsize+(i+0))+base));
+						indices.push_back(u16((j1*vsize+i1)+base));
+						indices.push_back(u16((j1*vsize+i0)+base));
+						indices.push_back(u16((j0*vsize+i0)+base));
 					}
 				}
 			}
 		}
+
+		// Individual tiles of this texture
+		for (ssize_t j = 0; j < PATCH_SIZE; j++)
+		{
+			for (ssize_t i = 0; i < PATCH_SIZE; i++)
+			{
+				if (texgrid[j][i] == tex && !mergedBlocks[j/lodSize][i/lodSize] && !m_ArrayTiles[j][i])
+					AddTileIndices(indices, i, j, base);
+			}
+		}
 		splat.m_IndexCount=indices.size()-splat.m_IndexStart;
 	}
 
-	// Release existing vertex buffer chunk
-	if (m_VBBaseIndices)
+	// Tiles drawn from the texture array go after all the splats, so they're
+	// only drawn by RenderStreams
+	for (ssize_t j = 0; j < PATCH_SIZE; j++)
 	{
-		g_VBMan.Release(m_VBBaseIndices);
-		m_VBBaseIndices = 0;
+		for (ssize_t i = 0; i < PATCH_SIZE; i++)
+		{
+			if (m_ArrayTiles[j][i])
+				AddTileIndices(indices, i, j, base);
+		}
 	}
 
 	ENSURE(indices.size());
+}
 
-	// Construct vertex buffer
-	m_VBBaseIndices = g_VBMan.Allocate(sizeof(u16), indices.size(), GL_STATIC_DRAW, GL_ELEMENT_ARRAY_BUFFER);
-	m_VBBaseIndices->m_Owner->UpdateChunkVertices(m_VBBaseIndices, &indices[0]);
+void CPatchRData::AddTileIndices(std::vector<u16>& indices, ssize_t i, ssize_t j, size_t base)
+{
+	CTerrain* terrain = m_Patch->m_Parent;
+
+	// number of vertices in each direction in each patch
+	ssize_t vsize = PATCH_SIZE+1;
+
+	bool dir = terrain->GetTriangulationDir(m_Patch->m_X*PATCH_SIZE + i, m_Patch->m_Z*PATCH_SIZE + j);
+	if (dir)
+	{
+		indices.push_back(u16(((j+0)*vsize+(i+0))+base));
+		indices.push_back(u16(((j+0)*vsize+(i+1))+base));
+		indices.push_back(u16(((j+1)*vsize+(i+0))+base));
+
+		indices.push_back(u16(((j+0)*vsize+(i+1))+base));
+		indices.push_back(u16(((j+1)*vsize+(i+1))+base));
+		indices.push_back(u16(((j+1)*vsize+(i+0))+base));
+	}
+	else
+	{
+		indices.push_back(u16(((j+0)*vsize+(i+0))+base));
+		indices.push_back(u16(((j+0)*vsize+(i+1))+base));
+		indices.push_back(u16(((j+1)*vsize+(i+1))+base));
+
+		indices.push_back(u16(((j+1)*vsize+(i+1))+base));
+		indices.push_back(u16(((j+1)*vsize+(i+0))+base));
+		indices.push_back(u16(((j+0)*vsize+(i+0))+base));
+	}
 }
 
 
-void CPatchRData::BuildVertices()
+void CPatchRData::BuildVertices(std::vector<SBaseVertex>& vertices)
 {
 	PROFILE3("build vertices");
 
@@ -528,7 +731,6 @@ void CPatchRData::BuildVertices()
 	// number of vertices in each direction in each patch
 	ssize_t vsize=PATCH_SIZE+1;
 
-	std::vector<SBaseVertex> vertices;
 	vertices.resize(vsize*vsize);
 
 	// get index of this patch
@@ -540,6 +742,9 @@ void CPatchRData::BuildVertices()
 
 	bool cpuLighting = (g_Renderer.GetRenderPath() == CRenderer::RP_FIXED);
 
+	LODHeights heights;
+	CalcLODHeights(heights);
+
 	// build vertices
 	for (ssize_t j=0;j<vsize;j++) {
 		for (ssize_t i=0;i<vsize;i++) {
@@ -549,6 +754,7 @@ void CPatchRData::BuildVertices()
 
 			// calculate vertex data
 			terrain->CalcPosition(ix,iz,vertices[v].m_Position);
+			vertices[v].m_Position.Y = heights[j][i];
 
 			// Calculate diffuse lighting for this vertex
 			// Ambient is added by the lighting pass (since ambient is the same
@@ -561,12 +767,6 @@ void CPatchRData::BuildVertices()
 			vertices[v].m_DiffuseColor = cpuLighting ? lightEnv.EvaluateTerrainDiffuseScaled(normal) : lightEnv.EvaluateTerrainDiffuseFactor(normal);
 		}
 	}
-
-	// upload to vertex buffer
-	if (!m_VBBase)
-		m_VBBase = g_VBMan.Allocate(sizeof(SBaseVertex), vsize * vsize, GL_STATIC_DRAW, GL_ARRAY_BUFFER);
-
-	m_VBBase->m_Owner->UpdateChunkVertices(m_VBBase, &vertices[0]);
 }
 
 void CPatchRData::BuildSide(std::vector<SSideVertex>& vertices, CPatchSideFlags side)
@@ -650,46 +850,345 @@ void CPatchRData::BuildSides()
 	m_VBSides->m_Owner->UpdateChunkVertices(m_VBSides, &sideVertices[0]);
 }
 
-void CPatchRData::Build()
+void CPatchRData::Update(CSimulation2* simulation)
 {
-	BuildVertices();
-	BuildSides();
-	BuildIndices();
-	BuildBlends();
-	BuildWater();
+	m_Simulation = simulation;
+
+	Prepare();
+	Upload();
 }
 
-void CPatchRData::Update(CSimulation2* simulation)
+void CPatchRData::Prepare()
 {
-	m_Simulation = simulation;
-	if (m_UpdateFlags!=0) {
-		// TODO,RC 11/04/04 - need to only rebuild necessary bits of renderdata rather
-		// than everything; it's complicated slightly because the blends are dependent
-		// on both vertex and index data
-		BuildVertices();
+	ENSURE(!m_Pending);
+
+	bool lodChanged = UpdateLOD();
+
+	// The texture array changes which tiles are drawn by the splats
+	if (m_UsesTextureArray != g_Renderer.GetTerrainTextureArray().IsEnabled())
+		m_UpdateFlags |= RENDERDATA_UPDATE_INDICES;
+
+	if (m_UpdateFlags == 0 && !lodChanged)
+		return;
+
+	// Only rebuild the parts that depend on what has changed:
+	// - heights affect everything (including the indices, through the triangulation
+	//   direction and the merged LOD blocks);
+	// - lighting affects the base and blend vertex colors;
+	// - textures affect the blends and the base splats;
+	// - the water level affects the water and the sides (which stop at the water surface);
+	// - the LOD affects the base and blend vertices and the indices.
+	bool heights = (m_UpdateFlags & RENDERDATA_UPDATE_VERTICES) != 0;
+	bool colors = (m_UpdateFlags & RENDERDATA_UPDATE_COLOR) != 0;
+	bool textures = (m_UpdateFlags & RENDERDATA_UPDATE_INDICES) != 0;
+	bool water = (m_UpdateFlags & RENDERDATA_UPDATE_WATER) != 0;
+
+	m_Pending = new SPendingGeometry();
+	m_Pending->vertices = heights || colors || lodChanged;
+	m_Pending->blends = heights || colors || textures || lodChanged;
+	m_Pending->indices = heights || textures || lodChanged;
+	m_Pending->sidesAndWater = heights || water;
+
+	if (m_Pending->vertices)
+		BuildVertices(m_Pending->baseVertices);
+	// (BuildBlends decides which tiles BuildIndices leaves to the texture array,
+	// so it must be called first)
+	if (m_Pending->blends)
+		BuildBlends(*m_Pending);
+	if (m_Pending->indices)
+		BuildIndices(m_Pending->baseIndices);
+
+	m_UpdateFlags = 0;
+}
+
+// Replaces the chunks with new ones containing the given vertices and indices (or
+// with NULL if there are none). The indices are relative to the first vertex, and
+// are offset to match the vertices' position in their buffer.
+template<typename T>
+static void UploadGeometry(CVertexBuffer::VBChunk*& vertexChunk, CVertexBuffer::VBChunk*& indexChunk,
+	const std::vector<T>& vertices, std::vector<u16>& indices)
+{
+	if (vertexChunk)
+	{
+		g_VBMan.Release(vertexChunk);
+		vertexChunk = 0;
+	}
+
+	if (indexChunk)
+	{
+		g_VBMan.Release(indexChunk);
+		indexChunk = 0;
+	}
+
+	if (vertices.empty())
+		return;
+
+	vertexChunk = g_VBMan.Allocate(sizeof(T), vertices.size(), GL_STATIC_DRAW, GL_ARRAY_BUFFER);
+	vertexChunk->m_Owner->UpdateChunkVertices(vertexChunk, const_cast<T*>(&vertices[0]));
+
+	ENSURE(vertexChunk->m_Index + vertices.size() <= 65536); // mustn't overflow u16 indexes
+	for (size_t k = 0; k < indices.size(); ++k)
+		indices[k] += vertexChunk->m_Index;
+
+	indexChunk = g_VBMan.Allocate(sizeof(u16), indices.size(), GL_STATIC_DRAW, GL_ELEMENT_ARRAY_BUFFER);
+	indexChunk->m_Owner->UpdateChunkVertices(indexChunk, &indices[0]);
+}
+
+void CPatchRData::Upload()
+{
+	if (!m_Pending)
+		return;
+
+	if (m_Pending->vertices)
+	{
+		if (!m_VBBase)
+			m_VBBase = g_VBMan.Allocate(sizeof(SBaseVertex), m_Pending->baseVertices.size(), GL_STATIC_DRAW, GL_ARRAY_BUFFER);
+		m_VBBase->m_Owner->UpdateChunkVertices(m_VBBase, &m_Pending->baseVertices[0]);
+	}
+
+	if (m_Pending->blends)
+	{
+		UploadGeometry(m_VBBlends, m_VBBlendIndices, m_Pending->blendVertices, m_Pending->blendIndices);
+		UploadGeometry(m_VBArray, m_VBArrayIndices, m_Pending->arrayVertices, m_Pending->arrayIndices);
+	}
+
+	if (m_Pending->indices)
+	{
+		// must have allocated some vertices before trying to build corresponding indices
+		ENSURE(m_VBBase);
+
+		size_t base = m_VBBase->m_Index;
+		ENSURE(base + (PATCH_SIZE+1)*(PATCH_SIZE+1) <= 65536); // mustn't overflow u16 indexes
+
+		std::vector<u16>& indices = m_Pending->baseIndices;
+		for (size_t k = 0; k < indices.size(); ++k)
+			indices[k] += base;
+
+		if (m_VBBaseIndices)
+			g_VBMan.Release(m_VBBaseIndices);
+		m_VBBaseIndices = g_VBMan.Allocate(sizeof(u16), indices.size(), GL_STATIC_DRAW, GL_ELEMENT_ARRAY_BUFFER);
+		m_VBBaseIndices->m_Owner->UpdateChunkVertices(m_VBBaseIndices, &indices[0]);
+	}
+
+	// The sides and water need the simulation's water manager, so they're
+	// built here rather than in Prepare
+	if (m_Pending->sidesAndWater)
+	{
 		BuildSides();
-		BuildIndices();
-		BuildBlends();
 		BuildWater();
+	}
+
+	delete m_Pending;
+	m_Pending = NULL;
+}
+
+static void PreparePatchesCB(void* cbdata, size_t begin, size_t end)
+{
+	std::vector<CPatchRData*>& patches = *static_cast<std::vector<CPatchRData*>*>(cbdata);
+	for (size_t i = begin; i < end; ++i)
+		patches[i]->Prepare();
+}
+
+void CPatchRData::BuildAll(CTerrain* terrain, CSimulation2* simulation)
+{
+	PROFILE3("build all patches");
+
+	// (The first call might load the texture array's shader, which must be
+	// done on this thread, before the workers start calling it)
+	g_Renderer.GetTerrainTextureArray().IsEnabled();
+
+	std::vector<CPatchRData*> patches;
+	ssize_t patchesPerSide = terrain->GetPatchesPerSide();
+	for (ssize_t j = 0; j < patchesPerSide; ++j)
+	{
+		for (ssize_t i = 0; i < patchesPerSide; ++i)
+		{
+			CPatch* patch = terrain->GetPatch(i, j);
+
+			// (Prepare reads the bounds of this patch and its neighbours to pick
+			// the LOD, so compute them here rather than lazily on the workers)
+			patch->GetWorldBounds();
+
+			if (patch->GetRenderData())
+				continue;
+
+			CPatchRData* data = new CPatchRData(patch, simulation);
+			patch->SetRenderData(data);
+			patches.push_back(data);
+		}
+	}
+
+	if (patches.empty())
+		return;
+
+	// Compute the geometry on the worker threads, then do the GL uploads here
+	if (g_ThreadPool)
+		g_ThreadPool->ParallelFor(patches.size(), 4, PreparePatchesCB, &patches);
+	else
+		PreparePatchesCB(&patches, 0, patches.size());
+
+	for (size_t i = 0; i < patches.size(); ++i)
+		patches[i]->Upload();
+}
+
+int CPatchRData::CalcLOD(CPatch* patch)
+{
+	if (!patch)
+		return -1;
+
+	float lodDistance = g_Renderer.m_Options.m_TerrainLODDistance;
+	if (lodDistance <= 0.f)
+		return 0;
+
+	CVector3D centre;
+	patch->GetWorldBounds().GetCentre(centre);
+	float dist = (centre - g_Renderer.GetViewCamera().GetOrientation().GetTranslation()).Length();
+
+	// Each level starts at twice the distance of the previous one
+	int lod = 0;
+	while (lod < MAX_LOD && dist >= lodDistance * (1 << lod))
+		++lod;
+	return lod;
+}
+
+bool CPatchRData::UpdateLOD()
+{
+	CTerrain* terrain = m_Patch->m_Parent;
+	ssize_t px = m_Patch->m_X;
+	ssize_t pz = m_Patch->m_Z;
+
+	int lod = CalcLOD(m_Patch);
+	int edgeLOD[4] = {
+		CalcLOD(terrain->GetPatch(px-1, pz)),
+		CalcLOD(terrain->GetPatch(px+1, pz)),
+		CalcLOD(terrain->GetPatch(px, pz-1)),
+		CalcLOD(terrain->GetPatch(px, pz+1))
+	};
+
+	bool changed = (lod != m_LOD);
+	m_LOD = lod;
+	for (size_t e = 0; e < 4; ++e)
+	{
+		// Only the coarser of the two LODs matters for the vertices on a shared edge
+		int effectiveLOD = (edgeLOD[e] < 0 ? -1 : std::max(edgeLOD[e], lod));
+		if (effectiveLOD != m_EdgeLOD[e])
+			changed = true;
+		m_EdgeLOD[e] = effectiveLOD;
+	}
+	return changed;
+}
+
+bool CPatchRData::GetLODBlockDir(const LODHeights& heights, ssize_t i, ssize_t j, ssize_t size)
+{
+	// (same rule as CTerrain::GetTriangulationDir)
+	return heights[j][i] + heights[j+size][i+size] < heights[j+size][i] + heights[j][i+size];
+}
+
+void CPatchRData::CalcLODHeights(LODHeights& heights)
+{
+	CTerrain* terrain = m_Patch->m_Parent;
+	ssize_t px = m_Patch->m_X * PATCH_SIZE;
+	ssize_t pz = m_Patch->m_Z * PATCH_SIZE;
+
+	for (ssize_t j = 0; j <= PATCH_SIZE; ++j)
+	{
+		for (ssize_t i = 0; i <= PATCH_SIZE; ++i)
+		{
+			CVector3D pos;
+			terrain->CalcPosition(px+i, pz+j, pos);
+			heights[j][i] = pos.Y;
+		}
+	}
+
+	if (m_LOD == 0 && m_EdgeLOD[0] <= 0 && m_EdgeLOD[1] <= 0 && m_EdgeLOD[2] <= 0 && m_EdgeLOD[3] <= 0)
+		return;
+
+	// Vertices whose heights have been fixed by the edge processing
+	bool fixed[PATCH_SIZE+1][PATCH_SIZE+1] = {};
+
+	// Move the vertices of each edge onto a straight line between the vertices
+	// of the edge's coarser grid, so they match the neighbouring patch
+	for (size_t e = 0; e < 4; ++e)
+	{
+		ssize_t step = (m_EdgeLOD[e] < 0 ? 1 : (ssize_t)1 << m_EdgeLOD[e]);
+		for (ssize_t k = 0; k <= PATCH_SIZE; ++k)
+		{
+			ssize_t i = (e == 0 ? 0 : e == 1 ? PATCH_SIZE : k);
+			ssize_t j = (e == 2 ? 0 : e == 3 ? PATCH_SIZE : k);
+			fixed[j][i] = true;
+
+			ssize_t offset = k % step;
+			if (offset == 0)
+				continue;
+
+			ssize_t k0 = k - offset;
+			ssize_t k1 = k0 + step;
+			float h0 = (e <= 1 ? heights[k0][i] : heights[j][k0]);
+			float h1 = (e <= 1 ? heights[k1][i] : heights[j][k1]);
+			heights[j][i] = h0 + (h1 - h0) * offset / step;
+		}
+	}
+
+	if (m_LOD == 0)
+		return;
+
+	// Move the other vertices onto the plane of the coarse-grid triangle they lie in
+	ssize_t size = (ssize_t)1 << m_LOD;
+	for (ssize_t j0 = 0; j0 < PATCH_SIZE; j0 += size)
+	{
+		for (ssize_t i0 = 0; i0 < PATCH_SIZE; i0 += size)
+		{
+			float h00 = heights[j0][i0];
+			float h10 = heights[j0][i0+size];
+			float h01 = heights[j0+size][i0];
+			float h11 = heights[j0+size][i0+size];
+			bool dir = GetLODBlockDir(heights, i0, j0, size);
+
+			for (ssize_t j = j0; j <= j0+size; ++j)
+			{
+				for (ssize_t i = i0; i <= i0+size; ++i)
+				{
+					if (fixed[j][i] || ((i-i0) % size == 0 && (j-j0) % size == 0))
+						continue;
 
-		m_UpdateFlags=0;
+					float xf = (i-i0) / (float)size;
+					float zf = (j-j0) / (float)size;
+
+					// (same as CTerrain::GetExactGroundLevel)
+					if (dir)
+					{
+						if (xf + zf <= 1.f)
+							heights[j][i] = h00 + (h10-h00)*xf + (h01-h00)*zf;
+						else
+							heights[j][i] = h11 + (h01-h11)*(1-xf) + (h10-h11)*(1-zf);
+					}
+					else
+					{
+						if (xf <= zf)
+							heights[j][i] = h00 + (h11-h01)*xf + (h01-h00)*zf;
+						else
+							heights[j][i] = h00 + (h10-h00)*xf + (h11-h10)*zf;
+					}
+				}
+			}
+		}
 	}
 }
 
 // Types used for glMultiDrawElements batching:
 
 // To minimise the cost of memory allocations, everything used for computing
-// batches uses a arena allocator. (All allocations are short-lived so we can
-// just throw away the whole arena at the end of each frame.)
+// batches uses the renderer's frame arena. (All allocations are short-lived so
+// they can be thrown away at the end of each frame.)
 
 // std::map types with appropriate arena allocators and default comparison operator
 #define POOLED_BATCH_MAP(Key, Value) \
-	std::map<Key, Value, std::less<Key>, ProxyAllocator<std::pair<Key const, Value>, Allocators::Arena<> > >
+	std::map<Key, Value, std::less<Key>, ProxyAllocator<std::pair<Key const, Value>, CFrameArena > >
 
 // Equivalent to "m[k]", when it returns a arena-allocated std::map (since we can't
 // use the default constructor in that case)
 template<typename M>
-typename M::mapped_type& PooledMapGet(M& m, const typename M::key_type& k, Allocators::Arena<>& arena)
+typename M::mapped_type& PooledMapGet(M& m, const typename M::key_type& k, CFrameArena& arena)
 {
 	return m.insert(std::make_pair(k,
 		typename M::mapped_type(typename M::mapped_type::key_compare(), typename M::mapped_type::allocator_type(arena))
@@ -698,7 +1197,7 @@ typename M::mapped_type& PooledMapGet(M& m, const typename M::key_type& k, Alloc
 
 // Equivalent to "m[k]", when it returns a std::pair of arena-allocated std::vectors
 template<typename M>
-typename M::mapped_type& PooledPairGet(M& m, const typename M::key_type& k, Allocators::Arena<>& arena)
+typename M::mapped_type& PooledPairGet(M& m, const typename M::key_type& k, CFrameArena& arena)
 {
 	return m.insert(std::make_pair(k, std::make_pair(
 			typename M::mapped_type::first_type(typename M::mapped_type::first_type::allocator_type(arena)),
@@ -706,10 +1205,8 @@ typename M::mapped_type& PooledPairGet(M& m, const typename M::key_type& k, Allo
 	))).first->second;
 }
 
-static const size_t ARENA_SIZE = 4*MiB; // this should be enough for fairly huge maps
-
 // Each multidraw batch has a list of index counts, and a list of pointers-to-first-indexes
-typedef std::pair<std::vector<GLint, ProxyAllocator<GLint, Allocators::Arena<> > >, std::vector<void*, ProxyAllocator<void*, Allocators::Arena<> > > > BatchElements;
+typedef std::pair<std::vector<GLint, ProxyAllocator<GLint, CFrameArena > >, std::vector<void*, ProxyAllocator<void*, CFrameArena > > > BatchElements;
 
 // Group batches by index buffer
 typedef POOLED_BATCH_MAP(CVertexBuffer*, BatchElements) IndexBufferBatches;
@@ -720,10 +1217,13 @@ typedef POOLED_BATCH_MAP(CVertexBuffer*, IndexBufferBatches) VertexBufferBatches
 // Group batches by texture
 typedef POOLED_BATCH_MAP(CTerrainTextureEntry*, VertexBufferBatches) TextureBatches;
 
+// Group batches by alpha map texture
+typedef POOLED_BATCH_MAP(Handle, VertexBufferBatches) AlphaMapBatches;
+
 void CPatchRData::RenderBases(const std::vector<CPatchRData*>& patches, const CShaderDefines& context, 
 			      ShadowMap* shadow, bool isDummyShader, const CShaderProgramPtr& dummy)
 {
-	Allocators::Arena<> arena(ARENA_SIZE);
+	CFrameArena& arena = g_RenderFrameArena;
 
 	TextureBatches batches (TextureBatches::key_compare(), (TextureBatches::allocator_type(arena)));
 
@@ -871,7 +1371,7 @@ void CPatchRData::RenderBases(const std::vector<CPatchRData*>& patches, const CS
  */
 struct SBlendBatch
 {
-	SBlendBatch(Allocators::Arena<>& arena) :
+	SBlendBatch(CFrameArena& arena) :
 		m_Batches(VertexBufferBatches::key_compare(), VertexBufferBatches::allocator_type(arena))
 	{
 	}
@@ -886,12 +1386,12 @@ struct SBlendBatch
 struct SBlendStackItem
 {
 	SBlendStackItem(CVertexBuffer::VBChunk* v, CVertexBuffer::VBChunk* i,
-			const std::vector<CPatchRData::SSplat>& s, Allocators::Arena<>& arena) :
+			const std::vector<CPatchRData::SSplat>& s, CFrameArena& arena) :
 		vertices(v), indices(i), splats(s.begin(), s.end(), SplatStack::allocator_type(arena))
 	{
 	}
 
-	typedef std::vector<CPatchRData::SSplat, ProxyAllocator<CPatchRData::SSplat, Allocators::Arena<> > > SplatStack;
+	typedef std::vector<CPatchRData::SSplat, ProxyAllocator<CPatchRData::SSplat, CFrameArena > > SplatStack;
 	CVertexBuffer::VBChunk* vertices;
 	CVertexBuffer::VBChunk* indices;
 	SplatStack splats;
@@ -900,9 +1400,9 @@ struct SBlendStackItem
 void CPatchRData::RenderBlends(const std::vector<CPatchRData*>& patches, const CShaderDefines& context, 
 			      ShadowMap* shadow, bool isDummyShader, const CShaderProgramPtr& dummy)
 {
-	Allocators::Arena<> arena(ARENA_SIZE);
+	CFrameArena& arena = g_RenderFrameArena;
 
-	typedef std::vector<SBlendBatch, ProxyAllocator<SBlendBatch, Allocators::Arena<> > > BatchesStack;
+	typedef std::vector<SBlendBatch, ProxyAllocator<SBlendBatch, CFrameArena > > BatchesStack;
 	BatchesStack batches((BatchesStack::allocator_type(arena)));
 	
 	CShaderDefines contextBlend = context;
@@ -914,7 +1414,7 @@ void CPatchRData::RenderBlends(const std::vector<CPatchRData*>& patches, const C
  	// to avoid heavy reallocations
  	batches.reserve(256);
 
-	typedef std::vector<SBlendStackItem, ProxyAllocator<SBlendStackItem, Allocators::Arena<> > > BlendStacks;
+	typedef std::vector<SBlendStackItem, ProxyAllocator<SBlendStackItem, CFrameArena > > BlendStacks;
 	BlendStacks blendStacks((BlendStacks::allocator_type(arena)));
 	blendStacks.reserve(patches.size());
 
@@ -1109,6 +1609,102 @@ void CPatchRData::RenderBlends(const std::vector<CPatchRData*>& patches, const C
 	CVertexBuffer::Unbind();
 }
 
+void CPatchRData::RenderArrayTiles(const std::vector<CPatchRData*>& patches, const CShaderDefines& context, ShadowMap* shadow)
+{
+	CTerrainTextureArray& textureArray = g_Renderer.GetTerrainTextureArray();
+	if (!textureArray.IsEnabled())
+		return;
+
+	CFrameArena& arena = g_RenderFrameArena;
+
+	AlphaMapBatches batches (AlphaMapBatches::key_compare(), (AlphaMapBatches::allocator_type(arena)));
+
+	PROFILE_START("compute batches");
+
+	for (size_t i = 0; i < patches.size(); ++i)
+	{
+		CPatchRData* patch = patches[i];
+		if (!patch->m_VBArrayIndices)
+			continue;
+
+		BatchElements& batch = PooledPairGet(
+			PooledMapGet(
+				PooledMapGet(batches, patch->m_ArrayAlphaMap, arena),
+				patch->m_VBArray->m_Owner, arena
+			),
+			patch->m_VBArrayIndices->m_Owner, arena
+		);
+
+		batch.first.push_back(patch->m_VBArrayIndices->m_Count);
+
+		u8* indexBase = patch->m_VBArrayIndices->m_Owner->GetBindAddress();
+		batch.second.push_back(indexBase + sizeof(u16)*(patch->m_VBArrayIndices->m_Index));
+	}
+
+	PROFILE_END("compute batches");
+
+	if (batches.empty())
+		return;
+
+	GLuint texture = textureArray.GetTexture();
+
+	CShaderTechniquePtr tech = g_Renderer.GetShaderManager().LoadEffect(CStrIntern("terrain_array"), context, CShaderDefines());
+	if (!tech)
+		return;
+
+	for (int pass = 0; pass < tech->GetNumPasses(); ++pass)
+	{
+		tech->BeginPass(pass);
+		const CShaderProgramPtr& shader = tech->GetShader(pass);
+		TerrainRenderer::PrepareShader(shader, shadow);
+
+		shader->BindTexture("baseTex", texture);
+
+		for (AlphaMapBatches::iterator ita = batches.begin(); ita != batches.end(); ++ita)
+		{
+			shader->BindTexture("blendTex", ita->first);
+
+			for (VertexBufferBatches::iterator itv = ita->second.begin(); itv != ita->second.end(); ++itv)
+			{
+				GLsizei stride = sizeof(SArrayVertex);
+				SArrayVertex *base = (SArrayVertex *)itv->first->Bind();
+
+				shader->VertexPointer(3, GL_FLOAT, stride, &base->m_Position[0]);
+				shader->ColorPointer(4, GL_UNSIGNED_BYTE, stride, &base->m_DiffuseColor);
+				shader->NormalPointer(GL_FLOAT, stride, &base->m_Normal[0]);
+				shader->VertexAttribPointer("a_layers", 4, GL_UNSIGNED_BYTE, GL_FALSE, stride, &base->m_Layers[0]);
+				// (The four layers' uvs and three blends' uvs are split over four texcoords)
+				shader->TexCoordPointer(GL_TEXTURE0, 4, GL_FLOAT, stride, &base->m_LayerUVs[0][0]);
+				shader->TexCoordPointer(GL_TEXTURE1, 4, GL_FLOAT, stride, &base->m_LayerUVs[2][0]);
+				shader->TexCoordPointer(GL_TEXTURE2, 4, GL_FLOAT, stride, &base->m_AlphaUVs[0][0]);
+				shader->TexCoordPointer(GL_TEXTURE3, 2, GL_FLOAT, stride, &base->m_AlphaUVs[2][0]);
+
+				shader->AssertPointersBound();
+
+				for (IndexBufferBatches::iterator it = itv->second.begin(); it != itv->second.end(); ++it)
+				{
+					it->first->Bind();
+
+					BatchElements& batch = it->second;
+
+					if (!g_Renderer.m_SkipSubmit)
+					{
+						for (size_t i = 0; i < batch.first.size(); ++i)
+							glDrawElements(GL_TRIANGLES, batch.first[i], GL_UNSIGNED_SHORT, batch.second[i]);
+					}
+
+					g_Renderer.m_Stats.m_DrawCalls++;
+					g_Renderer.m_Stats.m_TerrainTris += std::accumulate(batch.first.begin(), batch.first.end(), 0) / 3;
+				}
+			}
+		}
+
+		tech->EndPass(pass);
+	}
+
+	CVertexBuffer::Unbind();
+}
+
 void CPatchRData::RenderStreams(const std::vector<CPatchRData*>& patches, const CShaderProgramPtr& shader, int streamflags)
 {
 	// Each batch has a list of index counts, and a list of pointers-to-first-indexes
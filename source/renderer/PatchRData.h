@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,10 +24,12 @@
 #include "graphics/RenderableObject.h"
 #include "graphics/ShaderProgram.h"
 #include "renderer/ShadowMap.h"
+#include "lib/res/handle.h"
 #include "VertexBufferManager.h"
 
 class CPatch;
 class CSimulation2;
+class CTerrain;
 class CTerrainTextureEntry;
 class CTextRenderer;
 
@@ -40,7 +42,31 @@ public:
 	CPatchRData(CPatch* patch, CSimulation2* simulation);
 	~CPatchRData();
 
+	/**
+	 * Rebuilds whatever parts of the render data are out of date.
+	 * Equivalent to Prepare followed by Upload.
+	 */
 	void Update(CSimulation2* simulation);
+
+	/**
+	 * Computes the new geometry for the out-of-date parts of the patch, without
+	 * touching GL or the simulation, so it can be called from a worker thread
+	 * (as long as nothing else is using this patch at the same time).
+	 */
+	void Prepare();
+
+	/**
+	 * Uploads the geometry computed by Prepare to the vertex buffers, and rebuilds
+	 * the sides and water. Must be called from the main thread.
+	 */
+	void Upload();
+
+	/**
+	 * Creates the render data for every patch of the terrain that doesn't have any yet,
+	 * preparing it on the thread pool. Used while loading the map, so the first
+	 * frame doesn't have to build all the patches itself.
+	 */
+	static void BuildAll(CTerrain* terrain, CSimulation2* simulation);
 	void RenderOutline();
 	void RenderSides(CShaderProgramPtr& shader);
 	void RenderPriorities(CTextRenderer& textRenderer);
@@ -51,6 +77,7 @@ public:
 			      ShadowMap* shadow, bool isDummyShader=false, const CShaderProgramPtr& dummy=CShaderProgramPtr());
 	static void RenderBlends(const std::vector<CPatchRData*>& patches, const CShaderDefines& context, 
 			      ShadowMap* shadow, bool isDummyShader=false, const CShaderProgramPtr& dummy=CShaderProgramPtr());
+	static void RenderArrayTiles(const std::vector<CPatchRData*>& patches, const CShaderDefines& context, ShadowMap* shadow);
 	static void RenderStreams(const std::vector<CPatchRData*>& patches, const CShaderProgramPtr& shader, int streamflags);
 
 	CPatch* GetPatch() { return m_Patch; }
@@ -101,6 +128,26 @@ private:
 	};
 	cassert(sizeof(SBlendVertex) == 36);
 
+	// Maximum number of blends on a tile drawn from the terrain texture array
+	static const size_t MAX_ARRAY_BLENDS = 3;
+
+	// Vertex of a tile drawn in a single pass from the terrain texture array
+	struct SArrayVertex {
+		// vertex position
+		CVector3D m_Position;
+		// diffuse color from sunlight
+		SColor4ub m_DiffuseColor;
+		CVector3D m_Normal;
+		// texture array layers: the base texture, then the blends from the bottom up
+		// (unused blends repeat the base layer, so they don't change anything)
+		u8 m_Layers[1 + MAX_ARRAY_BLENDS];
+		// uvs for each layer (since each texture can have its own scale and rotation)
+		float m_LayerUVs[1 + MAX_ARRAY_BLENDS][2];
+		// uvs for the alpha texture of each blend
+		float m_AlphaUVs[MAX_ARRAY_BLENDS][2];
+	};
+	cassert(sizeof(SArrayVertex) == 88);
+
 	// Mixed Fancy/Simple water vertex description data structure
 	struct SWaterVertex {
 		// vertex position
@@ -112,22 +159,78 @@ private:
 	};
 	cassert(sizeof(SWaterVertex) == 16);
 
-	// build this renderdata object
-	void Build();
+	// heights of this patch's vertices, after applying the level of detail
+	typedef float LODHeights[PATCH_SIZE+1][PATCH_SIZE+1];
+
+	// geometry computed by Prepare and not uploaded yet
+	struct SPendingGeometry
+	{
+		// which parts need to be rebuilt
+		bool vertices;
+		bool blends;
+		bool indices;
+		bool sidesAndWater;
+
+		// (indices are relative to the first vertex in the corresponding vector)
+		std::vector<SBaseVertex> baseVertices;
+		std::vector<u16> baseIndices;
+		std::vector<SBlendVertex> blendVertices;
+		std::vector<u16> blendIndices;
+		std::vector<SArrayVertex> arrayVertices;
+		std::vector<u16> arrayIndices;
+	};
 
 	void AddBlend(std::vector<SBlendVertex>& blendVertices, std::vector<u16>& blendIndices, 
-			   u16 i, u16 j, u8 shape, CTerrainTextureEntry* texture);
+			   u16 i, u16 j, u8 shape, CTerrainTextureEntry* texture, const LODHeights& heights);
+
+	// computes the alpha texture uvs of the corners of a blend with the given shape;
+	// returns false if the shape doesn't need a blend
+	static bool CalcBlendUVs(u8 shape, CTerrainTextureEntry* texture, float uvs[4][2]);
 
-	void BuildBlends();
-	void BuildIndices();
-	void BuildVertices();
+	// adds tile (i,j) with the given blend stack (from the bottom up) to the
+	// array tile vertices; returns false if it can't be drawn from the texture array
+	bool AddArrayTile(std::vector<SArrayVertex>& arrayVertices, std::vector<u16>& arrayIndices,
+			   u16 i, u16 j, const std::vector<std::pair<CTerrainTextureEntry*, u8> >& blends, const LODHeights& heights);
+
+	void AddTileIndices(std::vector<u16>& indices, ssize_t i, ssize_t j, size_t base);
+
+	void BuildBlends(SPendingGeometry& geometry);
+	void BuildIndices(std::vector<u16>& indices);
+	void BuildVertices(std::vector<SBaseVertex>& vertices);
 	void BuildSides();
 
 	void BuildSide(std::vector<SSideVertex>& vertices, CPatchSideFlags side);
 
+	// Level of detail:
+	// At LOD n, the vertices are moved onto the surface of a coarser grid of
+	// (1 << n) by (1 << n) tile blocks (so the shape matches the coarse grid), and
+	// blocks where no blending is needed are drawn as just two triangles instead of
+	// two per tile. Vertices on edges shared with a coarser patch are moved onto that
+	// patch's grid, so there are no cracks. Vertices on the edge of the map aren't
+	// moved, so they still match the sides.
+	static const int MAX_LOD = 2;
+
+	// returns the LOD a patch should be drawn at from the current camera (or -1 if it's NULL)
+	static int CalcLOD(CPatch* patch);
+
+	// updates m_LOD and m_EdgeLOD; returns true if they changed
+	bool UpdateLOD();
+
+	void CalcLODHeights(LODHeights& heights);
+
+	// returns the triangulation direction (as in CTerrain::GetTriangulationDir) of the
+	// LOD block with the given minimum corner and size
+	static bool GetLODBlockDir(const LODHeights& heights, ssize_t i, ssize_t j, ssize_t size);
+
 	// owner patch
 	CPatch* m_Patch;
 
+	// level of detail the geometry was built for
+	int m_LOD;
+
+	// LOD of the neighbouring patches, in the order -X, +X, -Z, +Z (-1 at the edge of the map)
+	int m_EdgeLOD[4];
+
 	// vertex buffer handle for side vertices
 	CVertexBuffer::VBChunk* m_VBSides;
 
@@ -149,6 +252,27 @@ private:
 	// splats used in blend pass
 	std::vector<SSplat> m_BlendSplats;
 
+	// Texture array path:
+	// Tiles with blends can be drawn in a single pass, sampling the base and blend
+	// textures from CTerrainTextureArray, instead of by the base and blend splats.
+	// They're still included at the end of the base indices (after all the base
+	// splats), so they're drawn by RenderStreams.
+
+	// whether the geometry was built for the texture array path
+	bool m_UsesTextureArray;
+
+	// which tiles are drawn from the texture array
+	bool m_ArrayTiles[PATCH_SIZE][PATCH_SIZE];
+
+	// composite alpha map shared by all the blends of array tiles
+	Handle m_ArrayAlphaMap;
+
+	// vertex buffer handle for array tile vertices
+	CVertexBuffer::VBChunk* m_VBArray;
+
+	// vertex buffer handle for array tile vertex indices
+	CVertexBuffer::VBChunk* m_VBArrayIndices;
+
 	// boundary of water in this patch
 	CBoundingBoxAligned m_WaterBounds;
 
@@ -160,6 +284,9 @@ private:
 
 	CSimulation2* m_Simulation;
 
+	// non-NULL between Prepare and Upload when something needs rebuilding
+	SPendingGeometry* m_Pending;
+
 	// Build water vertices and indices (vertex buffer and data vector)
 	void BuildWater();
 
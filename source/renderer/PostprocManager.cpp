@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,6 +24,7 @@
 #include "lib/bits.h"
 #include "ps/CLogger.h"
 #include "ps/Filesystem.h"
+#include "ps/Profile.h"
 #include "ps/Game.h"
 #include "ps/World.h"
 
@@ -38,7 +39,7 @@
 CPostprocManager::CPostprocManager()
 	: m_IsInitialised(false), m_PingFbo(0), m_PongFbo(0), m_PostProcEffect(L"default"), m_ColourTex1(0), m_ColourTex2(0), 
 	  m_DepthTex(0), m_BloomFbo(0), m_BlurTex2a(0), m_BlurTex2b(0), m_BlurTex4a(0), m_BlurTex4b(0),
-	  m_BlurTex8a(0), m_BlurTex8b(0), m_WhichBuffer(true)
+	  m_BlurTex8a(0), m_BlurTex8b(0), m_WhichBuffer(true), m_FinalPassOnScreen(false), m_Width(0), m_Height(0), m_Scale(1.f)
 {
 }
 
@@ -83,8 +84,8 @@ void CPostprocManager::RecreateBuffers()
 {
 	Cleanup();
 	
-	m_Width = g_Renderer.GetWidth();
-	m_Height = g_Renderer.GetHeight();
+	m_Width = std::max((int)(g_Renderer.GetWidth() * m_Scale), 1);
+	m_Height = std::max((int)(g_Renderer.GetHeight() * m_Scale), 1);
 	
 	#define GEN_BUFFER_RGBA(name, w, h) \
 		glGenTextures(1, (GLuint*)&name); \
@@ -184,11 +185,12 @@ void CPostprocManager::ApplyBlurDownscale2x(GLuint inTex, GLuint outTex, int inW
 	
 	GLuint renderedTex = inTex;
 	
-	// Cheat by creating high quality mipmaps for inTex, so the copying operation actually
-	// produces good scaling due to hardware filtering.
+	// Each output texel's centre lies on the corner shared by four input texels, so
+	// plain bilinear filtering averages all of them. That's the same result as sampling
+	// a 2x2 box-filtered mipmap, without having to generate a whole mipmap chain
+	// for the full-resolution input every frame.
 	glBindTexture(GL_TEXTURE_2D, renderedTex);
-	pglGenerateMipmapEXT(GL_TEXTURE_2D);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glBindTexture(GL_TEXTURE_2D, 0);
 	
@@ -319,7 +321,6 @@ void CPostprocManager::CaptureRenderOutput()
 void CPostprocManager::ReleaseRenderOutput()
 {
 	pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 	
 	// we blit to screen from the previous active buffer
 	if (m_WhichBuffer)
@@ -328,14 +329,49 @@ void CPostprocManager::ReleaseRenderOutput()
 		pglBindFramebufferEXT(GL_READ_FRAMEBUFFER_EXT, m_PongFbo);
 	
 	pglBindFramebufferEXT(GL_DRAW_FRAMEBUFFER_EXT, 0);
-	pglBlitFramebufferEXT(0, 0, m_Width, m_Height, 0, 0, m_Width, m_Height, 
-			      GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+	const int screenWidth = g_Renderer.GetWidth(), screenHeight = g_Renderer.GetHeight();
+	if (m_FinalPassOnScreen)
+	{
+		// The last effect pass already wrote the colour to the screen, so only the
+		// depth/stencil needed for the silhouettes is left to copy
+		pglBlitFramebufferEXT(0, 0, m_Width, m_Height, 0, 0, screenWidth, screenHeight, 
+				      GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+		m_FinalPassOnScreen = false;
+	}
+	else if (m_Width == screenWidth && m_Height == screenHeight)
+	{
+		pglBlitFramebufferEXT(0, 0, m_Width, m_Height, 0, 0, m_Width, m_Height, 
+				      GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+	}
+	else
+	{
+		// Upscale the colour smoothly; depth/stencil can only be copied with
+		// GL_NEAREST, but is only needed for the silhouettes
+		pglBlitFramebufferEXT(0, 0, m_Width, m_Height, 0, 0, screenWidth, screenHeight, 
+				      GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		pglBlitFramebufferEXT(0, 0, m_Width, m_Height, 0, 0, screenWidth, screenHeight, 
+				      GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+	}
 	pglBindFramebufferEXT(GL_READ_FRAMEBUFFER_EXT, 0);
 	
 	pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
 }
 
 
+void CPostprocManager::SetRenderScale(float scale)
+{
+	scale = clamp(scale, 0.1f, 1.f);
+	if (scale == m_Scale)
+		return;
+	
+	m_Scale = scale;
+	if (m_IsInitialised)
+		RecreateBuffers();
+	else if (m_Scale < 1.f)
+		Initialize();
+}
+
+
 void CPostprocManager::LoadEffect(CStrW &name)
 {
 	if (!m_IsInitialised) 
@@ -351,10 +387,17 @@ void CPostprocManager::LoadEffect(CStrW &name)
 }
 
 
-void CPostprocManager::ApplyEffect(CShaderTechniquePtr &shaderTech1, int pass)
+void CPostprocManager::ApplyEffect(CShaderTechniquePtr &shaderTech1, int pass, bool toScreen)
 {
-	// select the other FBO for rendering
-	if (!m_WhichBuffer)
+	// select the other FBO for rendering, or the system framebuffer
+	// (at the screen's size) for the final pass
+	glPushAttrib(GL_VIEWPORT_BIT);
+	if (toScreen)
+	{
+		pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+		glViewport(0, 0, g_Renderer.GetWidth(), g_Renderer.GetHeight());
+	}
+	else if (!m_WhichBuffer)
 		pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, m_PingFbo);
 	else
 		pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, m_PongFbo);
@@ -406,11 +449,20 @@ void CPostprocManager::ApplyEffect(CShaderTechniquePtr &shaderTech1, int pass)
 	glDepthMask(GL_TRUE);
 	glEnable(GL_DEPTH_TEST);
 	
-	m_WhichBuffer = !m_WhichBuffer;
+	glPopAttrib();
+	
+	// The screen isn't one of the ping-pong buffers, so the last one
+	// written to is still the one to read the depth/stencil from
+	if (toScreen)
+		m_FinalPassOnScreen = true;
+	else
+		m_WhichBuffer = !m_WhichBuffer;
 }
 
 void CPostprocManager::ApplyPostproc()
 {
+	PROFILE3_GPU("postproc");
+
 	if (!m_IsInitialised) 
 		return;
 	
@@ -438,11 +490,26 @@ void CPostprocManager::ApplyPostproc()
 	
 	// First render blur textures. Note that this only happens ONLY ONCE, before any effects are applied!
 	// (This may need to change depending on future usage, however that will have a fps hit)
-	ApplyBlur(); 
+	// Effects that don't sample any of them (e.g. a single tonemapping pass) skip the
+	// whole downscale/blur chain.
+	const int numPasses = m_PostProcTech->GetNumPasses();
+	bool needBlur = false;
+	for (int pass = 0; pass < numPasses && !needBlur; ++pass)
+	{
+		const CShaderProgramPtr& shader = m_PostProcTech->GetShader(pass);
+		needBlur = shader->GetTextureBinding("blurTex2").Active() ||
+			shader->GetTextureBinding("blurTex4").Active() ||
+			shader->GetTextureBinding("blurTex8").Active();
+	}
+	if (needBlur)
+		ApplyBlur(); 
 
-	for (int pass = 0; pass < m_PostProcTech->GetNumPasses(); ++pass)
+	// The last pass is drawn straight into the system framebuffer, which saves
+	// writing the result to a buffer and then blitting it to the screen
+	// (and does the upscaling for free when the render scale is less than 1).
+	for (int pass = 0; pass < numPasses; ++pass)
 	{
-		ApplyEffect(m_PostProcTech, pass);
+		ApplyEffect(m_PostProcTech, pass, pass == numPasses - 1);
 	}
 	
 	pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, m_PongFbo);
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -40,14 +40,21 @@ private:
 	// Indicates which of the ping-pong buffers is used for reading and which for drawing.
 	bool m_WhichBuffer;
 	
+	// Whether the last effect pass drew directly into the system framebuffer, so that
+	// ReleaseRenderOutput only has to copy the depth/stencil.
+	bool m_FinalPassOnScreen;
+	
 	// The name and shader technique we are using. "default" name means no technique is used
 	// (i.e. while we do allocate the buffers, no effects are rendered).
 	CStrW m_PostProcEffect;
 	CShaderTechniquePtr m_PostProcTech;
 	
-	// The current screen dimensions in pixels.
+	// The dimensions of the buffers in pixels (the screen's dimensions times m_Scale).
 	int m_Width, m_Height;
 	
+	// Fraction of the screen's width and height the scene is rendered at.
+	float m_Scale;
+	
 	// Is the postproc manager initialised? Buffers created? Default effect loaded?
 	bool m_IsInitialised;
 	
@@ -67,7 +74,8 @@ private:
 	// provided with a number of general-purpose variables, including the rendered screen so far,
 	// the depth buffer, a number of blur textures, the screen size, the zNear/zFar planes and
 	// some other parameters used by the optional bloom/HDR pass.
-	void ApplyEffect(CShaderTechniquePtr &shaderTech1, int pass);
+	// If toScreen is true the pass is drawn into the system framebuffer instead.
+	void ApplyEffect(CShaderTechniquePtr &shaderTech1, int pass, bool toScreen);
 	
 public:
 	CPostprocManager();
@@ -102,13 +110,41 @@ public:
 	// to our textures instead of directly to the system framebuffer. 
 	void CaptureRenderOutput();
 	
-	// First renders blur textures, then calls ApplyEffect for each effect pass, 
-	// ping-ponging the buffers at each step.
+	// First renders blur textures (if the effect uses them), then calls ApplyEffect for
+	// each effect pass, ping-ponging the buffers at each step. The final pass is
+	// drawn directly to the system framebuffer.
 	void ApplyPostproc();
 	
-	// Blits the final postprocessed texture to the system framebuffer. The system framebuffer
-	// is selected as the output buffer. Should be called before silhouette rendering.
+	// Blits the final postprocessed texture to the system framebuffer (upscaling it if
+	// the render scale is less than 1). The system framebuffer is selected as the
+	// output buffer. Should be called before silhouette rendering.
 	void ReleaseRenderOutput();
+	
+	// Sets the fraction of the screen's width and height to render into the buffers at,
+	// recreating them if needed. The renderer uses the buffers when the scale is less
+	// than 1 even if postprocessing is disabled, so this initialises them if necessary.
+	void SetRenderScale(float scale);
+	
+	inline float GetRenderScale() const
+	{
+		return m_Scale;
+	}
+	
+	// The dimensions of the buffers in pixels.
+	inline int GetWidth() const
+	{
+		return m_Width;
+	}
+	
+	inline int GetHeight() const
+	{
+		return m_Height;
+	}
+	
+	inline bool IsInitialised() const
+	{
+		return m_IsInitialised;
+	}
 };
 
 
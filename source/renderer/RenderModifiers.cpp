@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -83,6 +83,14 @@ void ShaderRenderModifier::BeginPass(const CShaderProgramPtr& shader)
 		int width = GetShadowMap()->GetWidth();
 		int height = GetShadowMap()->GetHeight();
 		shader->Uniform("shadowScale", width, height, 1.0f / width, 1.0f / height); 
+
+		if (GetShadowMap()->GetNumCascades() > 1)
+		{
+			float split0, split1, split2, split3;
+			GetShadowMap()->GetCascadeSplits(split0, split1, split2, split3);
+			shader->Uniform("shadowTransforms", GetShadowMap()->GetNumCascades(), GetShadowMap()->GetTextureMatrices());
+			shader->Uniform("shadowCascadeSplits", split0, split1, split2, split3);
+		}
 	}
 
 	if (GetLightEnv())
@@ -32,19 +32,23 @@
 
 #include "lib/bits.h"	// is_pow2
 #include "lib/res/graphics/ogl_tex.h"
+#include "lib/timer.h"
 #include "lib/allocators/shared_ptr.h"
 #include "maths/Matrix3D.h"
 #include "maths/MathUtil.h"
 #include "ps/CLogger.h"
+#include "ps/FrameArena.h"
 #include "ps/ConfigDB.h"
 #include "ps/Game.h"
 #include "ps/Profile.h"
+#include "ps/Profiler2.h"
 #include "ps/Filesystem.h"
 #include "ps/World.h"
 #include "ps/Loader.h"
 #include "ps/ProfileViewer.h"
 #include "graphics/Camera.h"
 #include "graphics/GameView.h"
+#include "graphics/HFTracer.h"
 #include "graphics/LightEnv.h"
 #include "graphics/LOSTexture.h"
 #include "graphics/MaterialManager.h"
@@ -55,6 +59,7 @@
 #include "graphics/Terrain.h"
 #include "graphics/Texture.h"
 #include "graphics/TextureManager.h"
+#include "renderer/AdaptiveQuality.h"
 #include "renderer/HWLightingModelRenderer.h"
 #include "renderer/InstancingModelRenderer.h"
 #include "renderer/ModelRenderer.h"
@@ -65,6 +70,7 @@
 #include "renderer/SkyManager.h"
 #include "renderer/TerrainOverlay.h"
 #include "renderer/TerrainRenderer.h"
+#include "renderer/TerrainTextureArray.h"
 #include "renderer/TimeManager.h"
 #include "renderer/VertexBufferManager.h"
 #include "renderer/WaterManager.h"
@@ -112,6 +118,10 @@ private:
 		Row_Particles,
 		Row_VBReserved,
 		Row_VBAllocated,
+		Row_VBStatic,
+		Row_VBDynamic,
+		Row_VBStream,
+		Row_VBBuffers,
 		Row_ShadersLoaded,
 
 		// Must be last to count number of rows
@@ -208,6 +218,30 @@ CStr CRendererStatsTable::GetCellText(size_t row, size_t col)
 		sprintf_s(buf, sizeof(buf), "%lu", (unsigned long)g_VBMan.GetBytesAllocated());
 		return buf;
 
+	case Row_VBStatic:
+		if (col == 0)
+			return "VB static bytes (alloc / reserved)";
+		sprintf_s(buf, sizeof(buf), "%lu / %lu", (unsigned long)g_VBMan.GetBytesAllocated(GL_STATIC_DRAW), (unsigned long)g_VBMan.GetBytesReserved(GL_STATIC_DRAW));
+		return buf;
+
+	case Row_VBDynamic:
+		if (col == 0)
+			return "VB dynamic bytes (alloc / reserved)";
+		sprintf_s(buf, sizeof(buf), "%lu / %lu", (unsigned long)g_VBMan.GetBytesAllocated(GL_DYNAMIC_DRAW), (unsigned long)g_VBMan.GetBytesReserved(GL_DYNAMIC_DRAW));
+		return buf;
+
+	case Row_VBStream:
+		if (col == 0)
+			return "VB stream bytes (used / reserved)";
+		sprintf_s(buf, sizeof(buf), "%lu / %lu", (unsigned long)g_VBMan.GetBytesAllocated(GL_STREAM_DRAW), (unsigned long)g_VBMan.GetBytesReserved(GL_STREAM_DRAW));
+		return buf;
+
+	case Row_VBBuffers:
+		if (col == 0)
+			return "# VBs (free chunks)";
+		sprintf_s(buf, sizeof(buf), "%lu (%lu)", (unsigned long)g_VBMan.GetNumBuffers(), (unsigned long)g_VBMan.GetNumFreeChunks());
+		return buf;
+
 	case Row_ShadersLoaded:
 		if (col == 0)
 			return "shader effects loaded";
@@ -260,6 +294,10 @@ public:
 	/// Terrain renderer
 	TerrainRenderer terrainRenderer;
 
+	/// Terrain textures for single-pass terrain rendering
+	/// (after textureManager, since it holds references to its textures)
+	CTerrainTextureArray terrainTextureArray;
+
 	/// Overlay renderer
 	OverlayRenderer overlayRenderer;
 
@@ -281,6 +319,15 @@ public:
 	/// Postprocessing effect manager
 	CPostprocManager postprocManager;
 
+	/// Adaptive quality controller, and the time the previous scene was rendered at
+	CAdaptiveQuality adaptiveQuality;
+	double lastSceneTime;
+
+	/// Whether the adaptive quality controller currently allows water reflections
+	/// and refraction, and the user's settings to restore when it does again
+	bool waterEffectsAllowed;
+	bool savedWaterReflection, savedWaterRefraction;
+
 	/// Various model renderers
 	struct Models
 	{
@@ -306,6 +353,11 @@ public:
 		ModelRendererPtr TranspSkinned;
 		ModelRendererPtr TranspUnskinned; // == TranspSkinned if unskinned shader instancing not supported
 
+		// Models that aren't visible themselves but may cast shadows into the view,
+		// which are only rendered into the shadow map
+		ModelRendererPtr ShadowCasterSkinned;
+		ModelRendererPtr ShadowCasterUnskinned; // == ShadowCasterSkinned if unskinned shader instancing not supported
+
 		ModelVertexRendererPtr VertexRendererShader;
 		ModelVertexRendererPtr VertexInstancingShader;
 		ModelVertexRendererPtr VertexGPUSkinningShader;
@@ -316,7 +368,9 @@ public:
 	CShaderDefines globalContext;
 
 	CRendererInternals() :
-		IsOpen(false), ShadersDirty(true), profileTable(g_Renderer.m_Stats), textureManager(g_VFS, false, false)
+		IsOpen(false), ShadersDirty(true), profileTable(g_Renderer.m_Stats), textureManager(g_VFS, false, false),
+		adaptiveQuality(1.0 / 30.0, 0.5f), lastSceneTime(0.0),
+		waterEffectsAllowed(true), savedWaterReflection(false), savedWaterRefraction(false)
 	{
 	}
 
@@ -355,12 +409,18 @@ public:
 			contextSkinned.Add("USE_INSTANCING", "1");
 			contextSkinned.Add("USE_GPU_SKINNING", "1");
 		}
-		Model.NormalSkinned->Render(Model.ModShader, contextSkinned, flags);
+		{
+			PROFILE3_GPU("skinned models");
+			Model.NormalSkinned->Render(Model.ModShader, contextSkinned, flags);
+		}
 
 		if (Model.NormalUnskinned != Model.NormalSkinned)
 		{
+			PROFILE3_GPU("unskinned models");
 			CShaderDefines contextUnskinned = context;
 			contextUnskinned.Add("USE_INSTANCING", "1");
+			if (g_Renderer.IsHWInstancingEnabled())
+				contextUnskinned.Add("USE_HW_INSTANCING", "1");
 			Model.NormalUnskinned->Render(Model.ModShader, contextUnskinned, flags);
 		}
 	}
@@ -376,16 +436,45 @@ public:
 			contextSkinned.Add("USE_INSTANCING", "1");
 			contextSkinned.Add("USE_GPU_SKINNING", "1");
 		}
-		Model.TranspSkinned->Render(Model.ModShader, contextSkinned, flags);
+		{
+			PROFILE3_GPU("transparent skinned models");
+			Model.TranspSkinned->Render(Model.ModShader, contextSkinned, flags);
+		}
 
 		if (Model.TranspUnskinned != Model.TranspSkinned)
 		{
+			PROFILE3_GPU("transparent unskinned models");
 			CShaderDefines contextUnskinned = context;
 			contextUnskinned.Add("USE_INSTANCING", "1");
+			if (g_Renderer.IsHWInstancingEnabled())
+				contextUnskinned.Add("USE_HW_INSTANCING", "1");
 			Model.TranspUnskinned->Render(Model.ModShader, contextUnskinned, flags);
 		}
 	}
 
+	/**
+	 * Renders all models that are only shadow casters with the given context.
+	 */
+	void CallShadowCasterRenderers(const CShaderDefines& context, int flags)
+	{
+		CShaderDefines contextSkinned = context;
+		if (g_Renderer.m_Options.m_GPUSkinning)
+		{
+			contextSkinned.Add("USE_INSTANCING", "1");
+			contextSkinned.Add("USE_GPU_SKINNING", "1");
+		}
+		Model.ShadowCasterSkinned->Render(Model.ModShader, contextSkinned, flags);
+
+		if (Model.ShadowCasterUnskinned != Model.ShadowCasterSkinned)
+		{
+			CShaderDefines contextUnskinned = context;
+			contextUnskinned.Add("USE_INSTANCING", "1");
+			if (g_Renderer.IsHWInstancingEnabled())
+				contextUnskinned.Add("USE_HW_INSTANCING", "1");
+			Model.ShadowCasterUnskinned->Render(Model.ModShader, contextUnskinned, flags);
+		}
+	}
+
 	/**
 	 * Filters all non-alpha-blended models.
 	 */
@@ -405,6 +494,16 @@ public:
 		if (Model.TranspUnskinned != Model.TranspSkinned)
 			Model.TranspUnskinned->Filter(filter, passed, flags);
 	}
+
+	/**
+	 * Filters all models that are only shadow casters.
+	 */
+	void FilterShadowCasterModels(CModelFilter& filter, int passed, int flags = 0)
+	{
+		Model.ShadowCasterSkinned->Filter(filter, passed, flags);
+		if (Model.ShadowCasterUnskinned != Model.ShadowCasterSkinned)
+			Model.ShadowCasterUnskinned->Filter(filter, passed, flags);
+	}
 };
 
 ///////////////////////////////////////////////////////////////////////////////////
@@ -419,6 +518,8 @@ CRenderer::CRenderer()
 
 	m_Width = 0;
 	m_Height = 0;
+	m_SceneWidth = 0;
+	m_SceneHeight = 0;
 	m_TerrainRenderMode = SOLID;
 	m_ModelRenderMode = SOLID;
 	m_ClearColor[0] = m_ClearColor[1] = m_ClearColor[2] = m_ClearColor[3] = 0;
@@ -438,18 +539,36 @@ CRenderer::CRenderer()
 	m_Options.m_PreferGLSL = false;
 	m_Options.m_ForceAlphaTest = false;
 	m_Options.m_GPUSkinning = false;
+	m_Options.m_HWInstancing = true;
 	m_Options.m_GenTangents = false;
 	m_Options.m_SmoothLOS = false;
 	m_Options.m_Postproc = false;
 	m_Options.m_ShowSky = false;
+	m_Options.m_TerrainLODDistance = 512.f;
+	m_Options.m_TerrainTextureArrays = false;
+	m_Options.m_GPUParticles = false;
+	m_Options.m_OcclusionCulling = true;
+	m_Options.m_AdaptiveQuality = false;
 
 	// TODO: be more consistent in use of the config system
 	CFG_GET_VAL("preferglsl", Bool, m_Options.m_PreferGLSL);
 	CFG_GET_VAL("forcealphatest", Bool, m_Options.m_ForceAlphaTest);
 	CFG_GET_VAL("gpuskinning", Bool, m_Options.m_GPUSkinning);
+	CFG_GET_VAL("hwinstancing", Bool, m_Options.m_HWInstancing);
 	CFG_GET_VAL("gentangents", Bool, m_Options.m_GenTangents);
 	CFG_GET_VAL("smoothlos", Bool, m_Options.m_SmoothLOS);
 	CFG_GET_VAL("postproc", Bool, m_Options.m_Postproc);
+	CFG_GET_VAL("terrainloddistance", Float, m_Options.m_TerrainLODDistance);
+	CFG_GET_VAL("terraintexturearrays", Bool, m_Options.m_TerrainTextureArrays);
+	CFG_GET_VAL("gpuparticles", Bool, m_Options.m_GPUParticles);
+	CFG_GET_VAL("occlusionculling", Bool, m_Options.m_OcclusionCulling);
+	CFG_GET_VAL("adaptivequality", Bool, m_Options.m_AdaptiveQuality);
+
+	float adaptiveQualityFrameTime = 33.3f; // in msec
+	float adaptiveQualityMinScale = 0.5f;
+	CFG_GET_VAL("adaptivequality.frametime", Float, adaptiveQualityFrameTime);
+	CFG_GET_VAL("adaptivequality.minscale", Float, adaptiveQualityMinScale);
+	m->adaptiveQuality = CAdaptiveQuality(std::max(adaptiveQualityFrameTime, 1.f) / 1000.0, adaptiveQualityMinScale);
 
 	CStr skystring = "0 0 0";
 	CColor skycolor;
@@ -465,6 +584,25 @@ CRenderer::CRenderer()
 	m_ShadowZBias = 0.02f;
 	m_ShadowMapSize = 0;
 
+	int shadowCascades = 1;
+	float shadowCascadeDistance = 0.0f;
+	CFG_GET_VAL("shadowcascades", Int, shadowCascades);
+	CFG_GET_VAL("shadowcascadedistance", Float, shadowCascadeDistance);
+	m->shadow.SetCascades((size_t)std::max(shadowCascades, 1), shadowCascadeDistance);
+
+	bool textureStreaming = false;
+	int textureStreamingMinSize = 64;
+	int textureStreamingBudget = 512; // in MiB
+	CFG_GET_VAL("texturestreaming", Bool, textureStreaming);
+	CFG_GET_VAL("texturestreamingminsize", Int, textureStreamingMinSize);
+	CFG_GET_VAL("texturestreamingbudget", Int, textureStreamingBudget);
+	m->textureManager.SetStreaming(textureStreaming, (size_t)std::max(textureStreamingMinSize, 1),
+		(size_t)std::max(textureStreamingBudget, 0) * MiB);
+
+	int textureUploadBudget = 4096; // in KiB per frame
+	CFG_GET_VAL("textureuploadbudget", Int, textureUploadBudget);
+	m->textureManager.SetUploadBudget((size_t)std::max(textureUploadBudget, 1) * KiB);
+
 	m_LightEnv = NULL;
 
 	m_CurrentScene = NULL;
@@ -519,6 +657,9 @@ void CRenderer::EnumCaps()
 	m_Caps.m_VertexShader = false;
 	m_Caps.m_FragmentShader = false;
 	m_Caps.m_Shadows = false;
+	m_Caps.m_Instancing = false;
+	m_Caps.m_MapBufferRange = false;
+	m_Caps.m_TextureArrays = false;
 
 	// now start querying extensions
 	if (!m_Options.m_NoVBO) {
@@ -542,6 +683,18 @@ void CRenderer::EnumCaps()
 			m_Caps.m_FragmentShader = true;
 	}
 
+#if !CONFIG2_GLES
+	if (0 == ogl_HaveExtensions(0, "GL_ARB_draw_instanced", "GL_ARB_instanced_arrays", NULL))
+		m_Caps.m_Instancing = true;
+
+	if (m_Caps.m_VBO && ogl_HaveExtension("GL_ARB_map_buffer_range"))
+		m_Caps.m_MapBufferRange = true;
+
+	// (framebuffer_object is needed for glGenerateMipmap)
+	if (0 == ogl_HaveExtensions(0, "GL_EXT_texture_array", "GL_EXT_framebuffer_object", NULL))
+		m_Caps.m_TextureArrays = true;
+#endif
+
 #if CONFIG2_GLES
 	m_Caps.m_Shadows = true;
 #else
@@ -582,6 +735,8 @@ void CRenderer::ReloadShaders()
 			m->globalContext.Add("USE_FP_SHADOW", "1");
 		if (m_Options.m_ShadowPCF)
 			m->globalContext.Add("USE_SHADOW_PCF", "1");
+		if (m->shadow.GetNumCascades() > 1)
+			m->globalContext.Add("SHADOW_CASCADES", CStr::FromUInt((unsigned)m->shadow.GetNumCascades()).c_str());
 #if !CONFIG2_GLES
 		m->globalContext.Add("USE_SHADOW_SAMPLER", "1");
 #endif
@@ -594,19 +749,21 @@ void CRenderer::ReloadShaders()
 
 	bool cpuLighting = (GetRenderPath() == RP_FIXED);
 	m->Model.VertexRendererShader = ModelVertexRendererPtr(new ShaderModelVertexRenderer(cpuLighting));
-	m->Model.VertexInstancingShader = ModelVertexRendererPtr(new InstancingModelRenderer(false, m_Options.m_GenTangents));
+	m->Model.VertexInstancingShader = ModelVertexRendererPtr(new InstancingModelRenderer(false, m_Options.m_GenTangents, IsHWInstancingEnabled()));
 
 	if (GetRenderPath() == RP_SHADER && m_Options.m_GPUSkinning) // TODO: should check caps and GLSL etc too
 	{
-		m->Model.VertexGPUSkinningShader = ModelVertexRendererPtr(new InstancingModelRenderer(true, m_Options.m_GenTangents));
+		m->Model.VertexGPUSkinningShader = ModelVertexRendererPtr(new InstancingModelRenderer(true, m_Options.m_GenTangents, false));
 		m->Model.NormalSkinned = ModelRendererPtr(new ShaderModelRenderer(m->Model.VertexGPUSkinningShader));
 		m->Model.TranspSkinned = ModelRendererPtr(new ShaderModelRenderer(m->Model.VertexGPUSkinningShader));
+		m->Model.ShadowCasterSkinned = ModelRendererPtr(new ShaderModelRenderer(m->Model.VertexGPUSkinningShader));
 	}
 	else
 	{
 		m->Model.VertexGPUSkinningShader.reset();
 		m->Model.NormalSkinned = ModelRendererPtr(new ShaderModelRenderer(m->Model.VertexRendererShader));
 		m->Model.TranspSkinned = ModelRendererPtr(new ShaderModelRenderer(m->Model.VertexRendererShader));
+		m->Model.ShadowCasterSkinned = ModelRendererPtr(new ShaderModelRenderer(m->Model.VertexRendererShader));
 	}
 
 	// Use instancing renderers in shader mode
@@ -614,11 +771,13 @@ void CRenderer::ReloadShaders()
 	{
 		m->Model.NormalUnskinned = ModelRendererPtr(new ShaderModelRenderer(m->Model.VertexInstancingShader));
 		m->Model.TranspUnskinned = ModelRendererPtr(new ShaderModelRenderer(m->Model.VertexInstancingShader));
+		m->Model.ShadowCasterUnskinned = ModelRendererPtr(new ShaderModelRenderer(m->Model.VertexInstancingShader));
 	}
 	else
 	{
 		m->Model.NormalUnskinned = m->Model.NormalSkinned;
 		m->Model.TranspUnskinned = m->Model.TranspSkinned;
+		m->Model.ShadowCasterUnskinned = m->Model.ShadowCasterSkinned;
 	}
 
 	m->ShadersDirty = false;
@@ -633,8 +792,8 @@ bool CRenderer::Open(int width, int height)
 	EnumCaps();
 
 	// Dimensions
-	m_Width = width;
-	m_Height = height;
+	m_Width = m_SceneWidth = width;
+	m_Height = m_SceneHeight = height;
 
 	// set packing parameters
 	glPixelStorei(GL_PACK_ALIGNMENT,1);
@@ -665,6 +824,14 @@ bool CRenderer::Open(int width, int height)
 	if (m_Options.m_Postproc)
 		m->postprocManager.Initialize();
 
+	// The adaptive quality controller works best with GPU frame times
+	// (if timer queries are supported and enabled in the profiler config)
+	if (m_Options.m_AdaptiveQuality)
+		g_Profiler2.EnableGPU();
+
+	// Compile the shaders we'll probably need now, rather than when they're first used
+	m->shaderManager.PrecompilePrograms();
+
 	return true;
 }
 
@@ -674,10 +841,10 @@ void CRenderer::Resize(int width,int height)
 	// need to recreate the shadow map object to resize the shadow texture
 	m->shadow.RecreateTexture();
 
-	m_Width = width;
-	m_Height = height;
+	m_Width = m_SceneWidth = width;
+	m_Height = m_SceneHeight = height;
 	
-	if (m_Options.m_Postproc)
+	if (m->postprocManager.IsInitialised())
 		m->postprocManager.RecreateBuffers();
 }
 
@@ -846,6 +1013,12 @@ void CRenderer::BeginFrame()
 	// zero out all the per-frame stats
 	m_Stats.Reset();
 
+	// discard last frame's streamed vertex data
+	g_VBMan.BeginFrame();
+
+	// start tracking which textures are used in this frame
+	m->textureManager.BeginFrame();
+
 	// choose model renderers for this frame
 
 	if (m->ShadersDirty)
@@ -871,34 +1044,80 @@ void CRenderer::SetClearColor(SColor4ub color)
 	m_ClearColor[3] = float(color.A) / 255.0f;
 }
 
+/**
+ * Selects the shadow casters that need rendering into one cascade of the shadow map.
+ */
+class CShadowCascadeCuller : public CModelFilter
+{
+public:
+	CShadowCascadeCuller(const ShadowMap& shadow, size_t cascade) : m_Shadow(shadow), m_Cascade(cascade) { }
+
+	bool Filter(CModel *model)
+	{
+		return (model->GetFlags() & MODELFLAG_CASTSHADOWS) && m_Shadow.IsCasterInCascade(model->GetWorldBounds(), m_Cascade);
+	}
+
+private:
+	const ShadowMap& m_Shadow;
+	size_t m_Cascade;
+};
+
 void CRenderer::RenderShadowMap(const CShaderDefines& context)
 {
 	PROFILE3_GPU("shadow map");
 
 	m->shadow.BeginRender();
 
-	{
-		PROFILE("render patches");
-		glCullFace(GL_FRONT);
-		glEnable(GL_CULL_FACE);
-		m->terrainRenderer.RenderPatches();
-		glCullFace(GL_BACK);
-	}
-
 	CShaderDefines contextCast = context;
 	contextCast.Add("MODE_SHADOWCAST", "1");
 
+	size_t numCascades = m->shadow.GetNumCascades();
+	for (size_t cascade = 0; cascade < numCascades; ++cascade)
 	{
-		PROFILE("render models");
-		m->CallModelRenderers(contextCast, MODELFLAG_CASTSHADOWS);
-	}
+		m->shadow.SetCascade(cascade);
 
-	{
-		PROFILE("render transparent models");
-		// disable face-culling for two-sided models
-		glDisable(GL_CULL_FACE);
-		m->CallTranspModelRenderers(contextCast, MODELFLAG_CASTSHADOWS);
-		glEnable(GL_CULL_FACE);
+		// With a single cascade every caster is needed, else only render the ones
+		// that can cast shadows into this cascade
+		int flags = MODELFLAG_CASTSHADOWS;
+		if (numCascades > 1)
+		{
+			PROFILE("cull casters");
+			flags = MODELFLAG_FILTERED;
+			CShadowCascadeCuller culler(m->shadow, cascade);
+			m->FilterModels(culler, flags);
+			m->FilterTranspModels(culler, flags);
+			m->FilterShadowCasterModels(culler, flags);
+		}
+
+		{
+			PROFILE("render patches");
+			glCullFace(GL_FRONT);
+			glEnable(GL_CULL_FACE);
+			m->terrainRenderer.RenderPatches();
+			glCullFace(GL_BACK);
+		}
+
+		{
+			PROFILE("render models");
+			m->CallModelRenderers(contextCast, flags);
+		}
+
+		{
+			PROFILE("render transparent models");
+			// disable face-culling for two-sided models
+			glDisable(GL_CULL_FACE);
+			m->CallTranspModelRenderers(contextCast, flags);
+			glEnable(GL_CULL_FACE);
+		}
+
+		{
+			PROFILE("render shadow casters");
+			// these can't be seen themselves, so we can disable face-culling
+			// to handle the two-sided ones without caring about self-shadowing
+			glDisable(GL_CULL_FACE);
+			m->CallShadowCasterRenderers(contextCast, flags);
+			glEnable(GL_CULL_FACE);
+		}
 	}
 
 	m->shadow.EndRender();
@@ -1133,6 +1352,15 @@ SScreenRect CRenderer::RenderReflections(const CShaderDefines& context, const CB
 
 	WaterManager& wm = m->waterManager;
 
+	// If the camera and water haven't moved, the texture from the previous
+	// frame is still (nearly) right, so skip rendering it again
+	if (wm.CanReuseReflection(m_ViewCamera.GetViewProjection(), scissor))
+	{
+		SScreenRect emptyScissor = { 0, 0, 0, 0 };
+		return emptyScissor;
+	}
+	wm.SetReflectionRendered(m_ViewCamera.GetViewProjection(), scissor);
+
 	// Remember old camera
 	CCamera normalCamera = m_ViewCamera;
 
@@ -1180,14 +1408,21 @@ SScreenRect CRenderer::RenderReflections(const CShaderDefines& context, const CB
 
 		glFrontFace(GL_CW);
 
+		// Only models near the water surface are reflected, if there's a limit
+		// (the terrain is still drawn, so there are no holes in the reflection)
+		CFrustum modelFrustum = m_ViewCamera.GetFrustum();
+		float cullHeight = wm.m_ReflectionCullHeight.Get();
+		if (cullHeight > 0.f)
+			modelFrustum.AddPlane(CVector4D(0, -1, 0, wm.m_WaterHeight + cullHeight));
+
 		// Render sky, terrain and models
 		m->skyManager.RenderSky();
 		ogl_WarnIfError();
 		RenderPatches(context, &m_ViewCamera.GetFrustum());
 		ogl_WarnIfError();
-		RenderModels(context, &m_ViewCamera.GetFrustum());
+		RenderModels(context, &modelFrustum);
 		ogl_WarnIfError();
-		RenderTransparentModels(context, TRANSPARENT_BLEND, &m_ViewCamera.GetFrustum());
+		RenderTransparentModels(context, TRANSPARENT_BLEND, &modelFrustum);
 		ogl_WarnIfError();
 
 		glFrontFace(GL_CCW);
@@ -1435,9 +1670,26 @@ void CRenderer::RenderSubmissions()
 	
 	GetScene().GetLOSTexture().InterpolateLOS();
 	
-	if (m_Options.m_Postproc)
+	// Render into the postproc buffers also when they're needed to reduce the resolution
+	const bool postproc = m_Options.m_Postproc || m->postprocManager.GetRenderScale() < 1.f;
+	const SViewPort screenViewPort = m_ViewCamera.GetViewPort();
+	if (postproc)
+	{
 		m->postprocManager.CaptureRenderOutput();
 
+		m_SceneWidth = m->postprocManager.GetWidth();
+		m_SceneHeight = m->postprocManager.GetHeight();
+		if (m_SceneWidth != m_Width || m_SceneHeight != m_Height)
+		{
+			SViewPort vp = screenViewPort;
+			vp.m_X = vp.m_X * m_SceneWidth / m_Width;
+			vp.m_Y = vp.m_Y * m_SceneHeight / m_Height;
+			vp.m_Width = vp.m_Width * m_SceneWidth / m_Width;
+			vp.m_Height = vp.m_Height * m_SceneHeight / m_Height;
+			m_ViewCamera.SetViewPort(vp);
+		}
+	}
+
 	CShaderDefines context = m->globalContext;
 
 	ogl_WarnIfError();
@@ -1454,6 +1706,9 @@ void CRenderer::RenderSubmissions()
 		m->Model.NormalUnskinned->PrepareModels();
 	if (m->Model.TranspUnskinned != m->Model.TranspSkinned)
 		m->Model.TranspUnskinned->PrepareModels();
+	m->Model.ShadowCasterSkinned->PrepareModels();
+	if (m->Model.ShadowCasterUnskinned != m->Model.ShadowCasterSkinned)
+		m->Model.ShadowCasterUnskinned->PrepareModels();
 	}
 
 	m->terrainRenderer.PrepareForRendering();
@@ -1575,10 +1830,17 @@ void CRenderer::RenderSubmissions()
 		ogl_WarnIfError();
 	}
 	
-	if (m_Options.m_Postproc)
+	if (postproc)
 	{
-		m->postprocManager.ApplyPostproc();
+		if (m_Options.m_Postproc)
+			m->postprocManager.ApplyPostproc();
 		m->postprocManager.ReleaseRenderOutput();
+
+		// Everything after this is drawn straight to the screen
+		m_SceneWidth = m_Width;
+		m_SceneHeight = m_Height;
+		m_ViewCamera.SetViewPort(screenViewPort);
+		m->SetOpenGLCamera(m_ViewCamera);
 	}
 
 	if (m_Options.m_Silhouettes)
@@ -1625,9 +1887,15 @@ void CRenderer::EndFrame()
 		m->Model.NormalUnskinned->EndFrame();
 	if (m->Model.TranspUnskinned != m->Model.TranspSkinned)
 		m->Model.TranspUnskinned->EndFrame();
+	m->Model.ShadowCasterSkinned->EndFrame();
+	if (m->Model.ShadowCasterUnskinned != m->Model.ShadowCasterSkinned)
+		m->Model.ShadowCasterUnskinned->EndFrame();
 
 	ogl_tex_bind(0, 0);
 
+	// Release all the temporary data used while rendering this frame
+	g_RenderFrameArena.Reset();
+
 	{
 		PROFILE3("error check");
 		if (glGetError())
@@ -1735,6 +2003,9 @@ void CRenderer::Submit(CParticleEmitter* emitter)
 
 void CRenderer::SubmitNonRecursive(CModel* model)
 {
+	// Pick the mesh now, so that every pass (including shadows) renders the same one
+	model->SelectLOD(m_ViewCamera);
+
 	if (model->GetFlags() & MODELFLAG_CASTSHADOWS)
 	{
 		m->shadow.AddShadowedBound(model->GetWorldBounds());
@@ -1762,10 +2033,70 @@ void CRenderer::SubmitNonRecursive(CModel* model)
 }
 
 
+const CFrustum* CRenderer::GetShadowCasterFrustum()
+{
+	if (m_Caps.m_Shadows && m_Options.m_Shadows && GetRenderPath() == RP_SHADER)
+		return &m->shadow.GetShadowCasterFrustum();
+	return NULL;
+}
+
+bool CRenderer::IsOccluded(const CBoundingBoxAligned& bounds)
+{
+	if (!m_Options.m_OcclusionCulling || !g_Game || bounds.IsEmpty())
+		return false;
+
+	// Only the terrain is used as an occluder. The camera is normally looking
+	// down on things, so if the lines from it to the corners and centre of the
+	// top of the box are all blocked, the rest of the box is hidden too.
+	// (That's not guaranteed, since something could peek through a narrow gap
+	// between the lines, but that's rare enough not to be noticeable.)
+	const CVector3D eye = m_CullCamera.GetOrientation().GetTranslation();
+	if (eye.Y <= bounds[1].Y)
+		return false;
+
+	CHFTracer tracer(g_Game->GetWorld()->GetTerrain());
+	const float y = bounds[1].Y;
+	const CVector3D points[] = {
+		CVector3D((bounds[0].X + bounds[1].X) * 0.5f, y, (bounds[0].Z + bounds[1].Z) * 0.5f),
+		CVector3D(bounds[0].X, y, bounds[0].Z),
+		CVector3D(bounds[1].X, y, bounds[0].Z),
+		CVector3D(bounds[0].X, y, bounds[1].Z),
+		CVector3D(bounds[1].X, y, bounds[1].Z)
+	};
+	for (size_t i = 0; i < ARRAY_SIZE(points); ++i)
+		if (!tracer.IsSegmentOccluded(eye, points[i]))
+			return false;
+
+	return true;
+}
+
+void CRenderer::SubmitShadowCasterNonRecursive(CModel* model)
+{
+	if (!(model->GetFlags() & MODELFLAG_CASTSHADOWS))
+		return;
+
+	model->SelectLOD(m_ViewCamera);
+
+	// Extend the shadow bounds so the light projection doesn't clip the caster
+	m->shadow.AddShadowedBound(model->GetWorldBounds());
+
+	// Tricky: The call to GetWorldBounds() above can invalidate the position
+	model->ValidatePosition();
+
+	if (model->GetModelDef()->GetNumBones() != 0)
+		m->Model.ShadowCasterSkinned->Submit(model);
+	else
+		m->Model.ShadowCasterUnskinned->Submit(model);
+}
+
+
 ///////////////////////////////////////////////////////////
 // Render the given scene
 void CRenderer::RenderScene(Scene& scene)
 {
+	if (m_Options.m_AdaptiveQuality)
+		UpdateAdaptiveQuality();
+
 	m_CurrentScene = &scene;
 
 	CFrustum frustum = m_CullCamera.GetFrustum();
@@ -1781,6 +2112,47 @@ void CRenderer::RenderScene(Scene& scene)
 	m_CurrentScene = NULL;
 }
 
+void CRenderer::UpdateAdaptiveQuality()
+{
+	// The resolution mostly affects the GPU's time, so use that if the profiler
+	// can measure it, else fall back to the time since the previous scene
+	const double now = timer_Time();
+	double frameTime = now - m->lastSceneTime;
+	const bool firstFrame = (m->lastSceneTime == 0.0);
+	m->lastSceneTime = now;
+	if (firstFrame)
+		return;
+
+	double gpuTime;
+	if (g_Profiler2.GetGPUFrameTime(gpuTime))
+		frameTime = gpuTime;
+
+	if (!m->adaptiveQuality.RecordFrame(frameTime))
+		return;
+
+	CAdaptiveQuality::Settings settings = m->adaptiveQuality.GetSettings();
+	m->postprocManager.SetRenderScale(settings.m_ResolutionScale);
+	m->particleManager.SetDensity(settings.m_ParticleDensity);
+	m->shadow.SetSizeDivisor(settings.m_ShadowMapDivisor);
+
+	if (settings.m_WaterEffects != m->waterEffectsAllowed)
+	{
+		if (settings.m_WaterEffects)
+		{
+			SetOptionBool(OPT_WATERREFLECTION, m->savedWaterReflection);
+			SetOptionBool(OPT_WATERREFRACTION, m->savedWaterRefraction);
+		}
+		else
+		{
+			m->savedWaterReflection = m_Options.m_WaterReflection;
+			m->savedWaterRefraction = m_Options.m_WaterRefraction;
+			SetOptionBool(OPT_WATERREFLECTION, false);
+			SetOptionBool(OPT_WATERREFRACTION, false);
+		}
+		m->waterEffectsAllowed = settings.m_WaterEffects;
+	}
+}
+
 Scene& CRenderer::GetScene()
 {
 	ENSURE(m_CurrentScene);
@@ -1961,17 +2333,22 @@ void CRenderer::UnloadAlphaMaps()
 
 
 
-Status CRenderer::ReloadChangedFileCB(void* param, const VfsPath& path)
+Status CRenderer::ReloadChangedFileCB(void* param, const std::vector<VfsPath>& paths)
 {
 	CRenderer* renderer = static_cast<CRenderer*>(param);
 
 	// If an alpha map changed, and we already loaded them, then reload them
-	if (boost::algorithm::starts_with(path.string(), L"art/textures/terrain/alphamaps/"))
+	// (once, since they're all packed into one texture)
+	for (size_t i = 0; i < paths.size(); ++i)
 	{
-		if (renderer->m_hCompositeAlphaMap)
+		if (boost::algorithm::starts_with(paths[i].string(), L"art/textures/terrain/alphamaps/"))
 		{
-			renderer->UnloadAlphaMaps();
-			renderer->LoadAlphaMaps();
+			if (renderer->m_hCompositeAlphaMap)
+			{
+				renderer->UnloadAlphaMaps();
+				renderer->LoadAlphaMaps();
+			}
+			break;
 		}
 	}
 
@@ -2107,6 +2484,11 @@ CParticleManager& CRenderer::GetParticleManager()
 	return m->particleManager;
 }
 
+CTerrainTextureArray& CRenderer::GetTerrainTextureArray()
+{
+	return m->terrainTextureArray;
+}
+
 TerrainRenderer& CRenderer::GetTerrainRenderer()
 {
 	return m->terrainRenderer;
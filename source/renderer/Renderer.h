@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -44,6 +44,7 @@ class CPatch;
 class CShaderDefines;
 class CShaderManager;
 class CSimulation2;
+class CTerrainTextureArray;
 class CTextureManager;
 class CTimeManager;
 class RenderPathVertexShader;
@@ -146,11 +147,22 @@ public:
 		bool m_PreferGLSL;
 		bool m_ForceAlphaTest;
 		bool m_GPUSkinning;
+		bool m_HWInstancing;
 		bool m_Silhouettes;
 		bool m_GenTangents;
 		bool m_SmoothLOS;
 		bool m_ShowSky;
 		bool m_Postproc;
+		// distance from the camera at which terrain patches start using lower
+		// levels of detail (doubling for each further level), or 0 to disable
+		float m_TerrainLODDistance;
+		bool m_TerrainTextureArrays;
+		// simulate particles in a vertex shader, for emitter types that allow it
+		bool m_GPUParticles;
+		// skip models that the terrain hides from the camera
+		bool m_OcclusionCulling;
+		// reduce the resolution and other settings while frames take longer than a target time
+		bool m_AdaptiveQuality;
 	} m_Options;
 
 	struct Caps {
@@ -160,6 +172,9 @@ public:
 		bool m_VertexShader;
 		bool m_FragmentShader;
 		bool m_Shadows;
+		bool m_Instancing;
+		bool m_MapBufferRange;
+		bool m_TextureArrays;
 	};
 
 public:
@@ -181,12 +196,22 @@ public:
 	static CStr GetRenderPathName(RenderPath rp);
 	static RenderPath GetRenderPathByName(const CStr& name);
 
+	// whether unskinned models may be drawn in batches with hardware instancing
+	bool IsHWInstancingEnabled() const { return GetRenderPath() == RP_SHADER && m_Caps.m_Instancing && m_Options.m_HWInstancing; }
+
+	// whether terrain tiles with blends may be drawn in a single pass from a texture array
+	bool IsTerrainTextureArrayEnabled() const { return GetRenderPath() == RP_SHADER && m_Options.m_PreferGLSL && m_Caps.m_TextureArrays && m_Options.m_TerrainTextureArrays; }
+
 	// return view width
 	int GetWidth() const { return m_Width; }
 	// return view height
 	int GetHeight() const { return m_Height; }
 	// return view aspect ratio
 	float GetAspect() const { return float(m_Width)/float(m_Height); }
+	// return the size of the buffer the scene is being rendered into (less than the
+	// view size while the adaptive quality controller has reduced the resolution)
+	int GetSceneWidth() const { return m_SceneWidth; }
+	int GetSceneHeight() const { return m_SceneHeight; }
 
 	// signal frame start
 	void BeginFrame();
@@ -302,6 +327,8 @@ public:
 
 	TerrainRenderer& GetTerrainRenderer();
 
+	CTerrainTextureArray& GetTerrainTextureArray();
+
 	CMaterialManager& GetMaterialManager();
 
 	CShaderDefines GetSystemShaderDefines();
@@ -362,11 +389,17 @@ protected:
 	void Submit(CModelDecal* decal);
 	void Submit(CParticleEmitter* emitter);
 	void SubmitNonRecursive(CModel* model);
+	const CFrustum* GetShadowCasterFrustum();
+	bool IsOccluded(const CBoundingBoxAligned& bounds);
+	void SubmitShadowCasterNonRecursive(CModel* model);
 	//END: Implementation of SceneCollector
 
 	// render any batched objects
 	void RenderSubmissions();
 
+	// measure the last frame and apply the adaptive quality controller's settings if they changed
+	void UpdateAdaptiveQuality();
+
 	// patch rendering stuff
 	void RenderPatches(const CShaderDefines& context, const CFrustum* frustum = 0);
 
@@ -394,7 +427,7 @@ protected:
 	void ReloadShaders();
 
 	// hotloading
-	static Status ReloadChangedFileCB(void* param, const VfsPath& path);
+	static Status ReloadChangedFileCB(void* param, const std::vector<VfsPath>& paths);
 
 	// RENDERER DATA:
 	/// Private data that is not needed by inline functions
@@ -403,6 +436,8 @@ protected:
 	int m_Width;
 	// view height
 	int m_Height;
+	// size of the buffer the scene is currently rendered into
+	int m_SceneWidth, m_SceneHeight;
 	// current terrain rendering mode
 	ERenderMode m_TerrainRenderMode;
 	// current model rendering mode
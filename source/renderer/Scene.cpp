@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -58,3 +58,20 @@ void SceneCollector::SubmitRecursive(CModelAbstract* model)
 	else
 		debug_warn(L"unknown model type");
 }
+
+///////////////////////////////////////////////////////////
+// Only models can cast shadows, so the others are ignored
+void SceneCollector::SubmitShadowCasterRecursive(CModelAbstract* model)
+{
+	if (model->ToCModel())
+	{
+		SubmitShadowCasterNonRecursive(model->ToCModel());
+
+		const std::vector<CModel::Prop>& props = model->ToCModel()->GetProps();
+		for (size_t i = 0; i < props.size(); i++)
+		{
+			if (!props[i].m_Hidden)
+				SubmitShadowCasterRecursive(props[i].m_Model);
+		}
+	}
+}
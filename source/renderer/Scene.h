@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -28,6 +28,7 @@
 #ifndef INCLUDED_SCENE
 #define INCLUDED_SCENE
 
+class CBoundingBoxAligned;
 class CFrustum;
 class CModel;
 class CModelAbstract;
@@ -133,6 +134,36 @@ public:
 	 * so you shouldn't have to reimplement it.
 	 */
 	virtual void SubmitRecursive(CModelAbstract* model);
+
+	/**
+	 * Return the volume containing the objects that aren't visible themselves
+	 * but may cast shadows into the visible part of the scene, or NULL if
+	 * the collector doesn't render shadows.
+	 */
+	virtual const CFrustum* GetShadowCasterFrustum() { return NULL; }
+
+	/**
+	 * Return whether objects inside the given world-space bounds are definitely
+	 * hidden from the viewer (e.g. behind a hill), so they needn't be submitted
+	 * even though they're inside the frustum. May be called from multiple
+	 * threads at once.
+	 */
+	virtual bool IsOccluded(const CBoundingBoxAligned& UNUSED(bounds)) { return false; }
+
+	/**
+	 * Submit a model that isn't visible itself but may cast a shadow into the scene,
+	 * without submitting attached models.
+	 */
+	virtual void SubmitShadowCasterNonRecursive(CModel* UNUSED(model)) { }
+
+	/**
+	 * Submit a model that isn't visible itself but may cast a shadow into the scene,
+	 * including attached sub-models.
+	 *
+	 * @note This function is implemented using SubmitShadowCasterNonRecursive,
+	 * so you shouldn't have to reimplement it.
+	 */
+	virtual void SubmitShadowCasterRecursive(CModelAbstract* model);
 };
 
 
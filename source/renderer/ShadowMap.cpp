@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -27,6 +27,7 @@
 #include "ps/CLogger.h"
 #include "ps/Profile.h"
 
+#include "graphics/Frustum.h"
 #include "graphics/LightEnv.h"
 #include "graphics/ShaderManager.h"
 
@@ -54,25 +55,37 @@ struct ShadowMapInternals
 	GLuint Texture;
 	// width, height of shadow map
 	int Width, Height;
-	// used width, height of shadow map
+	// width, height of the tile of each cascade in the shadow map
 	int EffectiveWidth, EffectiveHeight;
-	// transform light space into projected light space
+	// number of cascades, and the distance covered by all but the last one
+	size_t NumCascades;
+	float CascadeDistance;
+	// the texture size is divided by this
+	int SizeDivisor;
+	// transform light space into projected light space, per cascade
 	// in projected light space, the shadowbound box occupies the [-1..1] cube
 	// calculated on BeginRender, after the final shadow bounds are known
-	CMatrix3D LightProjection;
+	CMatrix3D LightProjection[ShadowMap::MAX_CASCADES];
 	// Transform world space into light space; calculated on SetupFrame
 	CMatrix3D LightTransform;
-	// Transform world space into texture space of the shadow map;
+	// Transform world space into texture space of each cascade's tile of the shadow map;
 	// calculated on BeginRender, after the final shadow bounds are known
-	CMatrix3D TextureMatrix;
+	CMatrix3D TextureMatrix[ShadowMap::MAX_CASCADES];
 
 	// transform light space into world space
 	CMatrix3D InvLightTransform;
-	// bounding box of shadowed objects in light space
-	CBoundingBoxAligned ShadowBound;
+	// bounding box of shadowed objects in light space, per cascade
+	CBoundingBoxAligned ShadowBound[ShadowMap::MAX_CASCADES];
 
-	// Camera transformed into light space
-	CCamera LightspaceCamera;
+	// Camera transformed into light space, with its frustum cut to each cascade's slice
+	CCamera LightspaceCamera[ShadowMap::MAX_CASCADES];
+	// light space bounding box of each cascade's slice of the view frustum
+	CBoundingBoxAligned SliceBound[ShadowMap::MAX_CASCADES];
+	// view space distance of the far end of each cascade's slice
+	float SplitDistance[ShadowMap::MAX_CASCADES];
+
+	// world space volume of objects that can cast shadows into the view; calculated on SetupFrame
+	CFrustum ShadowCasterFrustum;
 
 	// Some drivers (at least some Intel Mesa ones) appear to handle alpha testing
 	// incorrectly when the FBO has only a depth attachment.
@@ -88,8 +101,13 @@ struct ShadowMapInternals
 	GLint SavedViewFBO;
 
 	// Helper functions
-	void CalcShadowMatrices();
+	void CalcShadowMatrices(size_t cascade);
+	void CalcShadowCasterFrustum(const CCamera& camera, const CVector3D& lightdir);
 	void CreateTexture();
+
+	// Offset of a cascade's tile in the shadow map, in texels
+	int GetTileX(size_t cascade) const { return (int)(cascade % 2) * EffectiveWidth; }
+	int GetTileY(size_t cascade) const { return (int)(cascade / 2) * EffectiveHeight; }
 };
 
 
@@ -106,6 +124,9 @@ ShadowMap::ShadowMap()
 	m->EffectiveWidth = 0;
 	m->EffectiveHeight = 0;
 	m->DepthTextureBits = 0;
+	m->NumCascades = 1;
+	m->CascadeDistance = 0.0f;
+	m->SizeDivisor = 1;
 	// DepthTextureBits: 24/32 are very much faster than 16, on GeForce 4 and FX;
 	// but they're very much slower on Radeon 9800.
 	// In both cases, the default (no specified depth) is fast, so we just use
@@ -198,12 +219,148 @@ void ShadowMap::SetupFrame(const CCamera& camera, const CVector3D& lightdir)
 	m->LightTransform._44 = 1.0;
 
 	m->LightTransform.GetInverse(m->InvLightTransform);
-	m->ShadowBound.SetEmpty();
 
-	//
-	m->LightspaceCamera = camera;
-	m->LightspaceCamera.m_Orientation = m->LightTransform * camera.m_Orientation;
-	m->LightspaceCamera.UpdateFrustum();
+	m->CalcShadowCasterFrustum(camera, z);
+
+	if (m->NumCascades == 1)
+	{
+		m->ShadowBound[0].SetEmpty();
+		m->SplitDistance[0] = camera.GetFarPlane();
+
+		m->LightspaceCamera[0] = camera;
+		m->LightspaceCamera[0].m_Orientation = m->LightTransform * camera.m_Orientation;
+		m->LightspaceCamera[0].UpdateFrustum();
+		return;
+	}
+
+	// Split the view frustum into slices, using a blend of logarithmic splits (which
+	// give each cascade a constant ratio of texels per screen pixel) and uniform splits
+	// (which stop the nearest cascade becoming uselessly small)
+	const float splitWeight = 0.75f;
+	float nearPlane = camera.GetNearPlane();
+	float farPlane = camera.GetFarPlane();
+	float splitRange = farPlane;
+	if (m->CascadeDistance > nearPlane)
+		splitRange = std::min(farPlane, m->CascadeDistance);
+
+	CMatrix3D cameraToLight = m->LightTransform * camera.m_Orientation;
+
+	float sliceNear = nearPlane;
+	for (size_t i = 0; i < m->NumCascades; ++i)
+	{
+		float sliceFar = farPlane;
+		if (i + 1 < m->NumCascades)
+		{
+			float t = (float)(i + 1) / (float)m->NumCascades;
+			float logSplit = nearPlane * powf(splitRange / nearPlane, t);
+			float uniformSplit = nearPlane + (splitRange - nearPlane) * t;
+			sliceFar = splitWeight * logSplit + (1.0f - splitWeight) * uniformSplit;
+		}
+
+		m->ShadowBound[i].SetEmpty();
+		m->SplitDistance[i] = sliceFar;
+
+		m->LightspaceCamera[i] = camera;
+		m->LightspaceCamera[i].SetProjection(sliceNear, sliceFar, camera.GetFOV());
+		m->LightspaceCamera[i].m_Orientation = cameraToLight;
+		m->LightspaceCamera[i].UpdateFrustum();
+
+		CVector3D nearPts[4], farPts[4];
+		camera.GetCameraPlanePoints(sliceNear, nearPts);
+		camera.GetCameraPlanePoints(sliceFar, farPts);
+		m->SliceBound[i].SetEmpty();
+		for (size_t j = 0; j < 4; ++j)
+		{
+			m->SliceBound[i] += cameraToLight.Transform(nearPts[j]);
+			m->SliceBound[i] += cameraToLight.Transform(farPts[j]);
+		}
+
+		sliceNear = sliceFar;
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////////
+// CalcShadowCasterFrustum: calculate the volume swept by the camera frustum
+// when moving it towards the light, which contains everything that can cast
+// a shadow into the view
+void ShadowMapInternals::CalcShadowCasterFrustum(const CCamera& camera, const CVector3D& lightdir)
+{
+	// Corners of the frustum: 0-3 on the near plane, 4-7 on the far plane,
+	// in the order returned by GetCameraPlanePoints
+	static const size_t faces[6][3] = {
+		{ 0, 1, 2 }, // near
+		{ 4, 5, 6 }, // far
+		{ 0, 3, 7 }, // left
+		{ 1, 2, 6 }, // right
+		{ 0, 1, 5 }, // bottom
+		{ 3, 2, 6 }, // top
+	};
+	// Edges between two corners, and the two faces they join
+	static const size_t edges[12][4] = {
+		{ 0, 1, 0, 4 }, { 1, 2, 0, 3 }, { 2, 3, 0, 5 }, { 3, 0, 0, 2 },
+		{ 4, 5, 1, 4 }, { 5, 6, 1, 3 }, { 6, 7, 1, 5 }, { 7, 4, 1, 2 },
+		{ 0, 4, 2, 4 }, { 1, 5, 4, 3 }, { 2, 6, 3, 5 }, { 3, 7, 5, 2 },
+	};
+
+	CVector3D corners[8];
+	camera.GetCameraPlanePoints(camera.GetNearPlane(), &corners[0]);
+	camera.GetCameraPlanePoints(camera.GetFarPlane(), &corners[4]);
+	CVector3D centre;
+	for (size_t i = 0; i < 8; ++i)
+	{
+		corners[i] = camera.m_Orientation.Transform(corners[i]);
+		centre += corners[i] * 0.125f;
+	}
+
+	CVector3D toLight = -lightdir;
+
+	// Keep the faces that don't face the light, since sweeping the frustum
+	// towards the light never crosses them
+	CPlane planes[6+12];
+	size_t numPlanes = 0;
+	bool facesLight[6];
+	for (size_t i = 0; i < 6; ++i)
+	{
+		CPlane plane;
+		plane.Set(corners[faces[i][0]], corners[faces[i][1]], corners[faces[i][2]]);
+		if (plane.DistanceToPlane(centre) < 0.0f)
+			plane = CPlane(CVector4D(-plane.m_Norm.X, -plane.m_Norm.Y, -plane.m_Norm.Z, -plane.m_Dist));
+
+		facesLight[i] = (plane.m_Norm.Dot(toLight) < 0.0f);
+		if (!facesLight[i])
+			planes[numPlanes++] = plane;
+	}
+	size_t numFacePlanes = numPlanes;
+
+	// The frustum's silhouette edges (as seen from the light) are swept into
+	// the remaining sides of the volume
+	for (size_t i = 0; i < 12; ++i)
+	{
+		if (facesLight[edges[i][2]] == facesLight[edges[i][3]])
+			continue;
+
+		const CVector3D& a = corners[edges[i][0]];
+		const CVector3D& b = corners[edges[i][1]];
+		CVector3D norm = (b - a).Cross(toLight);
+		if (norm.LengthSquared() < 0.0001f)
+			continue; // edge is parallel to the light; the neighbouring planes are enough
+
+		CPlane plane;
+		plane.Set(norm, a);
+		if (plane.DistanceToPlane(centre) < 0.0f)
+			plane = CPlane(CVector4D(-norm.X, -norm.Y, -norm.Z, -plane.m_Dist));
+		planes[numPlanes++] = plane;
+	}
+
+	// If there are too many planes, drop the silhouette ones; that just makes the
+	// volume larger than necessary
+	if (numPlanes > MAX_NUM_FRUSTUM_PLANES)
+		numPlanes = numFacePlanes;
+
+	ShadowCasterFrustum.SetNumPlanes(0);
+	for (size_t i = 0; i < numPlanes; ++i)
+		ShadowCasterFrustum.AddPlane(planes[i]);
 }
 
 
@@ -215,44 +372,79 @@ void ShadowMap::AddShadowedBound(const CBoundingBoxAligned& bounds)
 	CBoundingBoxAligned lightspacebounds;
 
 	bounds.Transform(m->LightTransform, lightspacebounds);
-	m->ShadowBound += lightspacebounds;
+
+	if (m->NumCascades == 1)
+	{
+		m->ShadowBound[0] += lightspacebounds;
+		return;
+	}
+
+	// Objects can only cast shadows into a slice if they overlap it when seen from
+	// the light, and aren't entirely behind it
+	for (size_t i = 0; i < m->NumCascades; ++i)
+	{
+		const CBoundingBoxAligned& slice = m->SliceBound[i];
+		if (lightspacebounds[0].X <= slice[1].X && lightspacebounds[1].X >= slice[0].X &&
+			lightspacebounds[0].Y <= slice[1].Y && lightspacebounds[1].Y >= slice[0].Y &&
+			lightspacebounds[0].Z <= slice[1].Z)
+		{
+			m->ShadowBound[i] += lightspacebounds;
+		}
+	}
+}
+
+bool ShadowMap::IsCasterInCascade(const CBoundingBoxAligned& bounds, size_t cascade) const
+{
+	const CBoundingBoxAligned& shadowBound = m->ShadowBound[cascade];
+	if (shadowBound.IsEmpty())
+		return false;
+
+	CBoundingBoxAligned lightspacebounds;
+	bounds.Transform(m->LightTransform, lightspacebounds);
+
+	return lightspacebounds[0].X <= shadowBound[1].X && lightspacebounds[1].X >= shadowBound[0].X &&
+		lightspacebounds[0].Y <= shadowBound[1].Y && lightspacebounds[1].Y >= shadowBound[0].Y &&
+		lightspacebounds[0].Z <= shadowBound[1].Z;
 }
 
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // CalcShadowMatrices: calculate required matrices for shadow map generation - the light's
 // projection and transformation matrices
-void ShadowMapInternals::CalcShadowMatrices()
+void ShadowMapInternals::CalcShadowMatrices(size_t cascade)
 {
-	float minZ = ShadowBound[0].Z;
+	CBoundingBoxAligned& shadowBound = ShadowBound[cascade];
+	CMatrix3D& lightProjection = LightProjection[cascade];
+
+	float minZ = shadowBound[0].Z;
 
-	ShadowBound.IntersectFrustumConservative(LightspaceCamera.GetFrustum());
+	shadowBound.IntersectFrustumConservative(LightspaceCamera[cascade].GetFrustum());
 
 	// ShadowBound might have been empty to begin with, producing an empty result
-	if (ShadowBound.IsEmpty())
+	if (shadowBound.IsEmpty())
 	{
 		// no-op
-		LightProjection.SetIdentity();
-		TextureMatrix = LightTransform;
+		lightProjection.SetIdentity();
+		TextureMatrix[cascade] = LightTransform;
 		return;
 	}
 
 	// round off the shadow boundaries to sane increments to help reduce swim effect
 	float boundInc = 16.0f;
-	ShadowBound[0].X = floor(ShadowBound[0].X / boundInc) * boundInc;
-	ShadowBound[0].Y = floor(ShadowBound[0].Y / boundInc) * boundInc;
-	ShadowBound[1].X = ceil(ShadowBound[1].X / boundInc) * boundInc;
-	ShadowBound[1].Y = ceil(ShadowBound[1].Y / boundInc) * boundInc;
+	shadowBound[0].X = floor(shadowBound[0].X / boundInc) * boundInc;
+	shadowBound[0].Y = floor(shadowBound[0].Y / boundInc) * boundInc;
+	shadowBound[1].X = ceil(shadowBound[1].X / boundInc) * boundInc;
+	shadowBound[1].Y = ceil(shadowBound[1].Y / boundInc) * boundInc;
 
 	// minimum Z bound must not be clipped too much, because objects that lie outside
 	// the shadow bounds cannot cast shadows either
 	// the 2.0 is rather arbitrary: it should be big enough so that we won't accidentally miss
 	// a shadow generator, and small enough not to affect Z precision
-	ShadowBound[0].Z = minZ - 2.0;
+	shadowBound[0].Z = minZ - 2.0;
 
 	// Setup orthogonal projection (lightspace -> clip space) for shadowmap rendering
-	CVector3D scale = ShadowBound[1] - ShadowBound[0];
-	CVector3D shift = (ShadowBound[1] + ShadowBound[0]) * -0.5;
+	CVector3D scale = shadowBound[1] - shadowBound[0];
+	CVector3D shift = (shadowBound[1] + shadowBound[0]) * -0.5;
 
 	if (scale.X < 1.0)
 		scale.X = 1.0;
@@ -266,17 +458,17 @@ void ShadowMapInternals::CalcShadowMatrices()
 	scale.Z = 2.0 / scale.Z;
 
 	// make sure a given world position falls on a consistent shadowmap texel fractional offset
-	float offsetX = fmod(ShadowBound[0].X - LightTransform._14, 2.0f/(scale.X*EffectiveWidth));
-	float offsetY = fmod(ShadowBound[0].Y - LightTransform._24, 2.0f/(scale.Y*EffectiveHeight));
-
-	LightProjection.SetZero();
-	LightProjection._11 = scale.X;
-	LightProjection._14 = (shift.X + offsetX) * scale.X;
-	LightProjection._22 = scale.Y;
-	LightProjection._24 = (shift.Y + offsetY) * scale.Y;
-	LightProjection._33 = scale.Z;
-	LightProjection._34 = shift.Z * scale.Z;
-	LightProjection._44 = 1.0;
+	float offsetX = fmod(shadowBound[0].X - LightTransform._14, 2.0f/(scale.X*EffectiveWidth));
+	float offsetY = fmod(shadowBound[0].Y - LightTransform._24, 2.0f/(scale.Y*EffectiveHeight));
+
+	lightProjection.SetZero();
+	lightProjection._11 = scale.X;
+	lightProjection._14 = (shift.X + offsetX) * scale.X;
+	lightProjection._22 = scale.Y;
+	lightProjection._24 = (shift.Y + offsetY) * scale.Y;
+	lightProjection._33 = scale.Z;
+	lightProjection._34 = shift.Z * scale.Z;
+	lightProjection._44 = 1.0;
 
 	// Calculate texture matrix by creating the clip space to texture coordinate matrix
 	// and then concatenating all matrices that have been calculated so far
@@ -288,14 +480,14 @@ void ShadowMapInternals::CalcShadowMatrices()
 	CMatrix3D lightToTex;
 	lightToTex.SetZero();
 	lightToTex._11 = texscalex;
-	lightToTex._14 = (offsetX - ShadowBound[0].X) * texscalex;
+	lightToTex._14 = (offsetX - shadowBound[0].X) * texscalex + (float)GetTileX(cascade) / (float)Width;
 	lightToTex._22 = texscaley;
-	lightToTex._24 = (offsetY - ShadowBound[0].Y) * texscaley;
+	lightToTex._24 = (offsetY - shadowBound[0].Y) * texscaley + (float)GetTileY(cascade) / (float)Height;
 	lightToTex._33 = texscalez;
-	lightToTex._34 = -ShadowBound[0].Z * texscalez;
+	lightToTex._34 = -shadowBound[0].Z * texscalez;
 	lightToTex._44 = 1.0;
 
-	TextureMatrix = lightToTex * LightTransform;
+	TextureMatrix[cascade] = lightToTex * LightTransform;
 }
 
 
@@ -326,23 +518,30 @@ void ShadowMapInternals::CreateTexture()
 
 	pglGenFramebuffersEXT(1, &Framebuffer);
 
+	int size;
 	if (g_Renderer.m_ShadowMapSize != 0)
 	{
 		// non-default option to override the size
-		Width = Height = g_Renderer.m_ShadowMapSize;
+		size = g_Renderer.m_ShadowMapSize;
 	}
 	else
 	{
 		// get shadow map size as next power of two up from view width/height
-		Width = Height = (int)round_up_to_pow2((unsigned)std::max(g_Renderer.GetWidth(), g_Renderer.GetHeight()));
+		size = (int)round_up_to_pow2((unsigned)std::max(g_Renderer.GetWidth(), g_Renderer.GetHeight()));
 	}
-	// Clamp to the maximum texture size
-	Width = std::min(Width, (int)ogl_max_tex_size);
-	Height = std::min(Height, (int)ogl_max_tex_size);
+	// (but don't make it uselessly small)
+	size = std::max(size / SizeDivisor, std::min(size, 256));
+
+	// Each cascade gets a tile of that size, in rows of two; clamp the whole
+	// texture to the maximum texture size
+	int tilesX = (NumCascades > 1) ? 2 : 1;
+	int tilesY = (int)(NumCascades + 1) / 2;
+	EffectiveWidth = std::min(size, (int)ogl_max_tex_size / tilesX);
+	EffectiveHeight = std::min(size, (int)ogl_max_tex_size / tilesY);
 
 	// Since we're using a framebuffer object, the whole texture is available
-	EffectiveWidth = Width;
-	EffectiveHeight = Height;
+	Width = EffectiveWidth * tilesX;
+	Height = EffectiveHeight * tilesY;
 
 	const char* formatname;
 
@@ -354,8 +553,8 @@ void ShadowMapInternals::CreateTexture()
 	default: formatname = "DEPTH_COMPONENT"; break;
 	}
 
-	LOGMESSAGE(L"Creating shadow texture (size %dx%d) (format = %hs)",
-		Width, Height, formatname);
+	LOGMESSAGE(L"Creating shadow texture (size %dx%d) (format = %hs) (cascades = %d)",
+		Width, Height, formatname, (int)NumCascades);
 
 
 	if (g_Renderer.m_Options.m_ShadowAlphaFix)
@@ -460,7 +659,8 @@ void ShadowMap::BeginRender()
 	glGetIntegerv(GL_FRAMEBUFFER_BINDING_EXT, &m->SavedViewFBO);
 
 	// Calc remaining shadow matrices
-	m->CalcShadowMatrices();
+	for (size_t i = 0; i < m->NumCascades; ++i)
+		m->CalcShadowMatrices(i);
 
 	{
 		PROFILE("bind framebuffer");
@@ -478,25 +678,37 @@ void ShadowMap::BeginRender()
 		glColorMask(0,0,0,0);
 	}
 
-	// setup viewport
-	glViewport(0, 0, m->EffectiveWidth, m->EffectiveHeight);
-
 	m->SavedViewCamera = g_Renderer.GetViewCamera();
 
+	glEnable(GL_SCISSOR_TEST);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Set up to render into one cascade's tile of the shadow map texture
+void ShadowMap::SetCascade(size_t cascade)
+{
+	ENSURE(cascade < m->NumCascades);
+
+	// setup viewport
+	int x = m->GetTileX(cascade);
+	int y = m->GetTileY(cascade);
+	glViewport(x, y, m->EffectiveWidth, m->EffectiveHeight);
+
 	CCamera c = m->SavedViewCamera;
-	c.SetProjection(m->LightProjection);
+	c.SetProjection(m->LightProjection[cascade]);
 	c.GetOrientation() = m->InvLightTransform;
 	g_Renderer.SetViewCamera(c);
 
 #if !CONFIG2_GLES
 	glMatrixMode(GL_PROJECTION);
-	glLoadMatrixf(&m->LightProjection._11);
+	glLoadMatrixf(&m->LightProjection[cascade]._11);
 	glMatrixMode(GL_MODELVIEW);
 	glLoadMatrixf(&m->LightTransform._11);
 #endif
 
-	glEnable(GL_SCISSOR_TEST);
-	glScissor(1,1, m->EffectiveWidth-2, m->EffectiveHeight-2);
+	// leave a border around each tile, so lookups clamped to its edge aren't shadowed
+	glScissor(x+1, y+1, m->EffectiveWidth-2, m->EffectiveHeight-2);
 }
 
 
@@ -513,7 +725,7 @@ void ShadowMap::EndRender()
 		pglBindFramebufferEXT(GL_FRAMEBUFFER_EXT, m->SavedViewFBO);
 	}
 
-	glViewport(0, 0, g_Renderer.GetWidth(), g_Renderer.GetHeight());
+	glViewport(0, 0, g_Renderer.GetSceneWidth(), g_Renderer.GetSceneHeight());
 
 	glColorMask(1,1,1,1);
 }
@@ -527,10 +739,29 @@ GLuint ShadowMap::GetTexture() const
 }
 
 const CMatrix3D& ShadowMap::GetTextureMatrix() const
+{
+	return m->TextureMatrix[0];
+}
+
+const CFrustum& ShadowMap::GetShadowCasterFrustum() const
+{
+	return m->ShadowCasterFrustum;
+}
+
+const CMatrix3D* ShadowMap::GetTextureMatrices() const
 {
 	return m->TextureMatrix;
 }
 
+void ShadowMap::GetCascadeSplits(float& split0, float& split1, float& split2, float& split3) const
+{
+	size_t last = m->NumCascades - 1;
+	split0 = m->SplitDistance[0];
+	split1 = m->SplitDistance[std::min((size_t)1, last)];
+	split2 = m->SplitDistance[std::min((size_t)2, last)];
+	split3 = m->SplitDistance[std::min((size_t)3, last)];
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // Depth texture bits
@@ -566,6 +797,34 @@ int ShadowMap::GetHeight() const
 	return m->Height;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Cascades
+void ShadowMap::SetCascades(size_t count, float distance)
+{
+	count = clamp(count, (size_t)1, MAX_CASCADES);
+	if (count != m->NumCascades)
+	{
+		RecreateTexture();
+		m->NumCascades = count;
+	}
+	m->CascadeDistance = distance;
+}
+
+size_t ShadowMap::GetNumCascades() const
+{
+	return m->NumCascades;
+}
+
+void ShadowMap::SetSizeDivisor(int divisor)
+{
+	divisor = std::max(divisor, 1);
+	if (divisor != m->SizeDivisor)
+	{
+		RecreateTexture();
+		m->SizeDivisor = divisor;
+	}
+}
+
 //////////////////////////////////////////////////////////////////////////////
 
 void ShadowMap::RenderDebugBounds()
@@ -580,14 +839,20 @@ void ShadowMap::RenderDebugBounds()
 	// Render shadow bound
 	shader->Uniform("transform", g_Renderer.GetViewCamera().GetViewProjection() * m->InvLightTransform);
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	shader->Uniform("color", 0.0f, 0.0f, 1.0f, 0.25f);
-	m->ShadowBound.Render(shader);
-	glDisable(GL_BLEND);
+	for (size_t i = 0; i < m->NumCascades; ++i)
+	{
+		// fade out the more distant cascades
+		float c = 1.0f - 0.2f * i;
+
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		shader->Uniform("color", 0.0f, 0.0f, c, 0.25f);
+		m->ShadowBound[i].Render(shader);
+		glDisable(GL_BLEND);
 
-	shader->Uniform("color", 0.0f, 0.0f, 1.0f, 1.0f);
-	m->ShadowBound.RenderOutline(shader);
+		shader->Uniform("color", 0.0f, 0.0f, c, 1.0f);
+		m->ShadowBound[i].RenderOutline(shader);
+	}
 
 	// Draw a funny line/triangle direction indicator thing for unknown reasons
 	float shadowLineVerts[] = {
@@ -612,7 +877,7 @@ void ShadowMap::RenderDebugBounds()
 #if 0
 	CMatrix3D InvTexTransform;
 
-	m->TextureMatrix.GetInverse(InvTexTransform);
+	m->TextureMatrix[0].GetInverse(InvTexTransform);
 
 	// Render representative texture rectangle
 	glPushMatrix();
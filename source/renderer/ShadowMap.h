@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -25,6 +25,7 @@
 #include "lib/ogl.h"
 
 class CBoundingBoxAligned;
+class CFrustum;
 class CMatrix3D;
 
 struct ShadowMapInternals;
@@ -35,10 +36,17 @@ struct ShadowMapInternals;
  *
  * The class will automatically generate a texture the first time the shadow map is rendered into.
  * The texture will not be resized afterwards.
+ *
+ * The view frustum can be split by distance into several cascades, which are packed
+ * as tiles into the same texture, so nearby objects get a higher shadow resolution
+ * than distant ones. Each cascade has its own light projection and texture matrix.
  */
 class ShadowMap
 {
 public:
+	/// maximum number of shadow cascades (so the split distances fit in a vec4)
+	static const size_t MAX_CASCADES = 4;
+
 	ShadowMap();
 	~ShadowMap();
 
@@ -79,6 +87,30 @@ public:
 	 */
 	int GetHeight() const;
 
+	/**
+	 * SetCascades: Set the number of cascades the view frustum is split into.
+	 * The texture will be recreated if the number changes.
+	 *
+	 * @param count number of cascades, between 1 and MAX_CASCADES
+	 * @param distance view distance covered by all but the last cascade (which
+	 * always extends to the camera's far plane)
+	 */
+	void SetCascades(size_t count, float distance);
+
+	/**
+	 * GetNumCascades: Return the number of cascades.
+	 */
+	size_t GetNumCascades() const;
+
+	/**
+	 * SetSizeDivisor: Divide the size the texture would otherwise have by the
+	 * given power of two, to trade shadow quality for speed.
+	 * The texture will be recreated if the divisor changes.
+	 *
+	 * @param divisor 1 for the normal size
+	 */
+	void SetSizeDivisor(int divisor);
+
 	/**
 	 * SetupFrame: Configure light space for the given camera and light direction,
 	 * create the shadow texture if necessary, etc.
@@ -88,21 +120,47 @@ public:
 	 */
 	void SetupFrame(const CCamera& camera, const CVector3D& lightdir);
 
+	/**
+	 * GetShadowCasterFrustum: Return the volume containing every object that can
+	 * cast a shadow into the camera's view, i.e. the camera frustum extended
+	 * towards the light. Only valid after SetupFrame.
+	 */
+	const CFrustum& GetShadowCasterFrustum() const;
+
 	/**
 	 * AddShadowedBound: Add the bounding box of an object that has to be shadowed.
-	 * This is used to calculate the bounds for the shadow map.
+	 * This is used to calculate the bounds for the shadow map. The box only
+	 * extends the bounds of the cascades whose part of the view frustum it can
+	 * cast shadows into.
 	 *
 	 * @param bounds world space bounding box
 	 */
 	void AddShadowedBound(const CBoundingBoxAligned& bounds);
 
 	/**
-	 * BeginRender: Set OpenGL state for rendering into the shadow map texture.
+	 * BeginRender: Set OpenGL state for rendering into the shadow map texture,
+	 * and calculate the final matrices of every cascade. SetCascade must be
+	 * called before rendering anything.
 	 *
 	 * @todo this depends in non-obvious ways on the behaviour of the call-site
 	 */
 	void BeginRender();
 
+	/**
+	 * SetCascade: Set the viewport and camera for rendering into the given
+	 * cascade's tile of the shadow map. Must be called between BeginRender and EndRender.
+	 */
+	void SetCascade(size_t cascade);
+
+	/**
+	 * IsCasterInCascade: Return whether an object with the given bounds can cast
+	 * shadows into the given cascade, i.e. whether it needs rendering into it.
+	 * Only valid after BeginRender.
+	 *
+	 * @param bounds world space bounding box
+	 */
+	bool IsCasterInCascade(const CBoundingBoxAligned& bounds, size_t cascade) const;
+
 	/**
 	 * EndRender: Finish rendering into the shadow map.
 	 *
@@ -121,11 +179,25 @@ public:
 	 * GetTextureMatrix: Retrieve the world-space to shadow map texture coordinates
 	 * transformation matrix.
 	 *
+	 * If there are several cascades, this is the matrix of the first one.
+	 *
 	 * @return the matrix that transforms world-space coordinates into homogenous
 	 * shadow map texture coordinates
 	 */
 	const CMatrix3D& GetTextureMatrix() const;
 
+	/**
+	 * GetTextureMatrices: Retrieve the texture matrices of all cascades
+	 * (GetNumCascades() of them), for shaders that support cascades.
+	 */
+	const CMatrix3D* GetTextureMatrices() const;
+
+	/**
+	 * GetCascadeSplits: Retrieve the view-space distance at which each cascade ends.
+	 * Unused entries are set to the last cascade's distance.
+	 */
+	void GetCascadeSplits(float& split0, float& split1, float& split2, float& split3) const;
+
 	/**
 	 * Visualize shadow mapping calculations to help in
 	 * debugging and optimal shadow map usage.
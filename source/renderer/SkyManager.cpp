@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -33,6 +33,7 @@
 #include "ps/CLogger.h"
 #include "ps/Loader.h"
 #include "ps/Filesystem.h"
+#include "ps/Profile.h"
 
 #include "renderer/SkyManager.h"
 #include "renderer/Renderer.h"
@@ -219,6 +220,8 @@ std::vector<CStrW> SkyManager::GetSkySets() const
 // Render sky
 void SkyManager::RenderSky()
 {
+	PROFILE3_GPU("sky");
+
 #if CONFIG2_GLES
 #warning TODO: implement SkyManager::RenderSky for GLES
 #else
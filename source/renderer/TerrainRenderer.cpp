@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -479,6 +479,14 @@ void TerrainRenderer::PrepareShader(const CShaderProgramPtr& shader, ShadowMap*
 		int width = shadow->GetWidth();
 		int height = shadow->GetHeight();
 		shader->Uniform("shadowScale", width, height, 1.0f / width, 1.0f / height);
+
+		if (shadow->GetNumCascades() > 1)
+		{
+			float split0, split1, split2, split3;
+			shadow->GetCascadeSplits(split0, split1, split2, split3);
+			shader->Uniform("shadowTransforms", shadow->GetNumCascades(), shadow->GetTextureMatrices());
+			shader->Uniform("shadowCascadeSplits", split0, split1, split2, split3);
+		}
 	}
 
 	CLOSTexture& los = g_Renderer.GetScene().GetLOSTexture();
@@ -516,21 +524,30 @@ void TerrainRenderer::RenderTerrainShader(const CShaderDefines& context, ShadowM
 
 	techSolid->EndPass();
 
-	PROFILE_START("render terrain base");
-	CPatchRData::RenderBases(visiblePatches, context, shadow);
-	PROFILE_END("render terrain base");
+	{
+		PROFILE3_GPU("render terrain base");
+		CPatchRData::RenderBases(visiblePatches, context, shadow);
+	}
+
+	// render the tiles that have both base and blends drawn from the texture array
+	{
+		PROFILE3_GPU("render terrain array tiles");
+		CPatchRData::RenderArrayTiles(visiblePatches, context, shadow);
+	}
 
 	// no need to write to the depth buffer a second time
 	glDepthMask(0);
 
 	// render blend passes for each patch
-	PROFILE_START("render terrain blends");
-	CPatchRData::RenderBlends(visiblePatches, context, shadow, false);
-	PROFILE_END("render terrain blends");
+	{
+		PROFILE3_GPU("render terrain blends");
+		CPatchRData::RenderBlends(visiblePatches, context, shadow, false);
+	}
 
-	PROFILE_START("render terrain decals");
-	CDecalRData::RenderDecals(visibleDecals, context, shadow, false);
-	PROFILE_END("render terrain decals");
+	{
+		PROFILE3_GPU("render terrain decals");
+		CDecalRData::RenderDecals(visibleDecals, context, shadow, false);
+	}
 
 	// restore OpenGL state
 	g_Renderer.BindTexture(1, 0);
@@ -717,7 +734,7 @@ bool TerrainRenderer::RenderFancyWater(const CShaderDefines& context, ShadowMap*
 			glGenTextures(1, (GLuint*)&depthTex);
 			WaterMgr->m_depthTT = depthTex;
 			glBindTexture(GL_TEXTURE_2D, WaterMgr->m_depthTT);
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, g_Renderer.GetWidth(), g_Renderer.GetHeight(),
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, g_Renderer.GetSceneWidth(), g_Renderer.GetSceneHeight(),
 						 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_BYTE,NULL);
 		}
 		glBindTexture(GL_TEXTURE_2D, WaterMgr->m_depthTT);
@@ -727,7 +744,7 @@ bool TerrainRenderer::RenderFancyWater(const CShaderDefines& context, ShadowMap*
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
 		
-		glCopyTexImage2D(GL_TEXTURE_2D,0,GL_DEPTH_COMPONENT, 0, 0, g_Renderer.GetWidth(), g_Renderer.GetHeight(), 0);
+		glCopyTexImage2D(GL_TEXTURE_2D,0,GL_DEPTH_COMPONENT, 0, 0, g_Renderer.GetSceneWidth(), g_Renderer.GetSceneHeight(), 0);
 		
 		glBindTexture(GL_TEXTURE_2D, 0);
 	}
@@ -762,15 +779,18 @@ bool TerrainRenderer::RenderFancyWater(const CShaderDefines& context, ShadowMap*
 		{
 			glGenTextures(1, &renderedTexture);
 			WaterMgr->m_waveTT = renderedTexture;
-			
-			glBindTexture(GL_TEXTURE_2D, WaterMgr->m_waveTT);
-			int size = (int)round_up_to_pow2((unsigned)g_Renderer.GetHeight());
-			if(size > g_Renderer.GetHeight()) size /= 2;
-			
-			glTexImage2D(GL_TEXTURE_2D, 0,GL_RGBA, (float)g_Renderer.GetWidth(), (float)g_Renderer.GetHeight(), 0,GL_RGBA, GL_UNSIGNED_BYTE, 0);
-
+			WaterMgr->m_WaveTexWidth = WaterMgr->m_WaveTexHeight = 0;
 		}
 		glBindTexture(GL_TEXTURE_2D, WaterMgr->m_waveTT);
+
+		// It's sampled per screen pixel, so it must match the size the scene
+		// is rendered at (which changes with the adaptive quality level)
+		if (WaterMgr->m_WaveTexWidth != g_Renderer.GetSceneWidth() || WaterMgr->m_WaveTexHeight != g_Renderer.GetSceneHeight())
+		{
+			WaterMgr->m_WaveTexWidth = g_Renderer.GetSceneWidth();
+			WaterMgr->m_WaveTexHeight = g_Renderer.GetSceneHeight();
+			glTexImage2D(GL_TEXTURE_2D, 0,GL_RGBA, WaterMgr->m_WaveTexWidth, WaterMgr->m_WaveTexHeight, 0,GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		}
 		
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -861,7 +881,7 @@ bool TerrainRenderer::RenderFancyWater(const CShaderDefines& context, ShadowMap*
 	m->fancyWaterShader->Uniform("fogColor", lightEnv.m_FogColor);
 	m->fancyWaterShader->Uniform("fogParams", lightEnv.m_FogFactor, lightEnv.m_FogMax, 0.f, 0.f);
 	m->fancyWaterShader->Uniform("time", (float)time);
-	m->fancyWaterShader->Uniform("screenSize", (float)g_Renderer.GetWidth(), (float)g_Renderer.GetHeight(), 0.0f, 0.0f);
+	m->fancyWaterShader->Uniform("screenSize", (float)g_Renderer.GetSceneWidth(), (float)g_Renderer.GetSceneHeight(), 0.0f, 0.0f);
 	
 	if (shadow && WaterMgr->m_WaterShadows)
 	{
@@ -870,6 +890,14 @@ bool TerrainRenderer::RenderFancyWater(const CShaderDefines& context, ShadowMap*
 		int width = shadow->GetWidth();
 		int height = shadow->GetHeight();
 		m->fancyWaterShader->Uniform("shadowScale", width, height, 1.0f / width, 1.0f / height);
+
+		if (shadow->GetNumCascades() > 1)
+		{
+			float split0, split1, split2, split3;
+			shadow->GetCascadeSplits(split0, split1, split2, split3);
+			m->fancyWaterShader->Uniform("shadowTransforms", shadow->GetNumCascades(), shadow->GetTextureMatrices());
+			m->fancyWaterShader->Uniform("shadowCascadeSplits", split0, split1, split2, split3);
+		}
 	}
 
 	for (size_t i = 0; i < m->visiblePatches.size(); ++i)
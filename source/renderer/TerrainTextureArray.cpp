@@ -0,0 +1,269 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "TerrainTextureArray.h"
+
+#include "graphics/ShaderManager.h"
+#include "graphics/TerrainTextureEntry.h"
+#include "graphics/TextureManager.h"
+#include "lib/bits.h"
+#include "lib/res/graphics/ogl_tex.h"
+#include "maths/MathUtil.h"
+#include "ps/CLogger.h"
+#include "ps/Profile.h"
+#include "ps/ConfigDB.h"
+#include "renderer/Renderer.h"
+
+// Initial number of layers; the array is reallocated with twice as many when it fills up
+static const size_t INITIAL_CAPACITY = 8;
+
+// Layer indexes are stored as u8 in the vertex data
+static const size_t MAX_LAYER_INDEXES = 255;
+
+CTerrainTextureArray::CTerrainTextureArray() :
+	m_Texture(0), m_Capacity(0), m_LayerSize(512), m_MaxLayers(0), m_Dirty(false), m_EffectLoaded(-1)
+{
+	int layerSize = (int)m_LayerSize;
+	CFG_GET_VAL("terraintexturearraysize", Int, layerSize);
+	m_LayerSize = round_up_to_pow2((size_t)clamp(layerSize, 16, 4096));
+}
+
+CTerrainTextureArray::~CTerrainTextureArray()
+{
+	if (m_Texture)
+		glDeleteTextures(1, &m_Texture);
+}
+
+bool CTerrainTextureArray::IsEnabled()
+{
+	if (!g_Renderer.IsTerrainTextureArrayEnabled())
+		return false;
+
+	if (m_EffectLoaded == -1)
+	{
+		// If the shader isn't available, fall back to the normal splats
+		// rather than failing to draw the tiles
+		CShaderTechniquePtr tech = g_Renderer.GetShaderManager().LoadEffect("terrain_array");
+		m_EffectLoaded = (tech && tech->GetShader()->IsValid()) ? 1 : 0;
+
+#if !CONFIG2_GLES
+		// (Queried here since GetLayer might be called without a GL context)
+		GLint maxLayers = 0;
+		glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS_EXT, &maxLayers);
+		m_MaxLayers = std::min((size_t)std::max(maxLayers, 1), MAX_LAYER_INDEXES);
+#endif
+	}
+
+	return m_EffectLoaded == 1;
+}
+
+int CTerrainTextureArray::GetLayer(CTerrainTextureEntry* texture)
+{
+#if CONFIG2_GLES
+	UNUSED2(texture);
+	return -1;
+#else
+	if (!texture)
+		return -1;
+
+	// The array only has the base textures, so materials that sample anything
+	// else have to be drawn with their own shaders
+	const CMaterial::SamplersVector& samplers = texture->GetMaterial().GetSamplers();
+	if (samplers.size() != 1 || !(samplers[0].Name == CStrIntern("baseTex")))
+		return -1;
+
+	CScopeLock lock(m_LayersMutex);
+
+	CTexture* tex = samplers[0].Sampler.get();
+	std::map<CTexture*, size_t>::iterator it = m_LayerIndexes.find(tex);
+	if (it != m_LayerIndexes.end())
+		return (int)it->second;
+
+	if (m_Layers.size() >= m_MaxLayers)
+		return -1;
+
+	SLayer layer;
+	layer.m_Texture = samplers[0].Sampler;
+	layer.m_Uploaded = false;
+	m_Layers.push_back(layer);
+	m_LayerIndexes[tex] = m_Layers.size() - 1;
+	m_Dirty = true;
+
+	return (int)(m_Layers.size() - 1);
+#endif
+}
+
+GLuint CTerrainTextureArray::GetTexture()
+{
+#if !CONFIG2_GLES
+	CScopeLock lock(m_LayersMutex);
+
+	if (!m_Dirty)
+		return m_Texture;
+
+	PROFILE3("upload terrain texture array");
+
+	if (m_Layers.size() > m_Capacity)
+	{
+		size_t capacity = std::max(m_Capacity, INITIAL_CAPACITY);
+		while (capacity < m_Layers.size())
+			capacity *= 2;
+		Resize(std::min(capacity, m_MaxLayers));
+	}
+
+	bool changed = false;
+	bool pending = false;
+	for (size_t i = 0; i < m_Layers.size(); ++i)
+	{
+		if (m_Layers[i].m_Uploaded)
+			continue;
+
+		if (UploadLayer(i))
+		{
+			m_Layers[i].m_Uploaded = true;
+			changed = true;
+		}
+		else
+		{
+			pending = true;
+		}
+	}
+
+	if (changed)
+	{
+		pglActiveTextureARB(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D_ARRAY_EXT, m_Texture);
+		pglGenerateMipmapEXT(GL_TEXTURE_2D_ARRAY_EXT);
+		glBindTexture(GL_TEXTURE_2D_ARRAY_EXT, 0);
+		ogl_WarnIfError();
+	}
+
+	m_Dirty = pending;
+#endif
+	return m_Texture;
+}
+
+void CTerrainTextureArray::Resize(size_t capacity)
+{
+#if CONFIG2_GLES
+	UNUSED2(capacity);
+#else
+	if (m_Texture)
+		glDeleteTextures(1, &m_Texture);
+
+	glGenTextures(1, &m_Texture);
+
+	pglActiveTextureARB(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY_EXT, m_Texture);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY_EXT, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	pglTexImage3DEXT(GL_TEXTURE_2D_ARRAY_EXT, 0, GL_RGBA8, (GLsizei)m_LayerSize, (GLsizei)m_LayerSize, (GLsizei)capacity,
+		0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glBindTexture(GL_TEXTURE_2D_ARRAY_EXT, 0);
+	ogl_WarnIfError();
+
+	m_Capacity = capacity;
+
+	// The old contents are lost, so every layer has to be copied again
+	for (size_t i = 0; i < m_Layers.size(); ++i)
+		m_Layers[i].m_Uploaded = false;
+#endif
+}
+
+bool CTerrainTextureArray::UploadLayer(size_t layer)
+{
+#if CONFIG2_GLES
+	UNUSED2(layer);
+	return true;
+#else
+	if (layer >= m_Capacity)
+		return true; // the array couldn't grow enough; give up on this layer
+
+	// (Wait for the full resolution if the texture is streaming, since
+	// the layer is only copied once)
+	CTexturePtr& texture = m_Layers[layer].m_Texture;
+	if (!texture->TryLoad() || !texture->IsFullyLoaded())
+		return false;
+
+	GLuint id;
+	if (ogl_tex_get_texture_id(texture->GetHandle(), &id) < 0)
+		return true;
+
+	pglActiveTextureARB(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, id);
+
+	// Find the smallest mipmap level that's at least as big as a layer (if the
+	// texture has mipmaps), so the downscaling below is usually a no-op
+	GLint level = 0;
+	GLint w = 0, h = 0;
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
+	while ((size_t)w > m_LayerSize && (size_t)h > m_LayerSize)
+	{
+		GLint nextW = 0, nextH = 0;
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, level+1, GL_TEXTURE_WIDTH, &nextW);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, level+1, GL_TEXTURE_HEIGHT, &nextH);
+		if ((size_t)nextW < m_LayerSize || (size_t)nextH < m_LayerSize)
+			break;
+		++level;
+		w = nextW;
+		h = nextH;
+	}
+
+	if (w <= 0 || h <= 0)
+	{
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return true;
+	}
+
+	// (This decompresses S3TC textures)
+	std::vector<u8> pixels(w * h * 4);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glGetTexImage(GL_TEXTURE_2D, level, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// Resample (with point sampling) if the texture isn't a square power of two of the right size
+	if ((size_t)w != m_LayerSize || (size_t)h != m_LayerSize)
+	{
+		LOGMESSAGE(L"Terrain texture array: scaling %dx%d texture to %dx%d", w, h, (int)m_LayerSize, (int)m_LayerSize);
+
+		std::vector<u8> scaled(m_LayerSize * m_LayerSize * 4);
+		for (size_t y = 0; y < m_LayerSize; ++y)
+		{
+			size_t sy = y * h / m_LayerSize;
+			for (size_t x = 0; x < m_LayerSize; ++x)
+			{
+				size_t sx = x * w / m_LayerSize;
+				memcpy(&scaled[(y*m_LayerSize + x)*4], &pixels[(sy*w + sx)*4], 4);
+			}
+		}
+		pixels.swap(scaled);
+	}
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY_EXT, m_Texture);
+	pglTexSubImage3DEXT(GL_TEXTURE_2D_ARRAY_EXT, 0, 0, 0, (GLint)layer, (GLsizei)m_LayerSize, (GLsizei)m_LayerSize, 1,
+		GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+	glBindTexture(GL_TEXTURE_2D_ARRAY_EXT, 0);
+	ogl_WarnIfError();
+
+	return true;
+#endif
+}
@@ -0,0 +1,107 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_TERRAINTEXTUREARRAY
+#define INCLUDED_TERRAINTEXTUREARRAY
+
+#include "graphics/Texture.h"
+#include "lib/ogl.h"
+#include "ps/ThreadUtil.h"
+
+#include <map>
+
+class CTerrainTextureEntry;
+
+/**
+ * Copies of the terrain base textures, packed into the layers of a
+ * GL_TEXTURE_2D_ARRAY so that the "terrain_array" shader can draw a tile's
+ * base texture and all its blends in a single pass.
+ *
+ * Every layer is a square RGBA texture of the same size (the
+ * "terraintexturearraysize" config option). The pixels are read back from the
+ * normal GL textures once they've finished loading, using the mipmap level
+ * closest to the layer size, so the textures don't have to be loaded twice.
+ * Layers are assigned when first requested and never reused, so the indexes
+ * stay valid for the lifetime of the array.
+ */
+class CTerrainTextureArray
+{
+	NONCOPYABLE(CTerrainTextureArray);
+
+public:
+	CTerrainTextureArray();
+	~CTerrainTextureArray();
+
+	/**
+	 * Returns whether terrain should currently be built for the texture array path:
+	 * the renderer must allow it (see CRenderer::IsTerrainTextureArrayEnabled)
+	 * and the terrain_array effect must have loaded.
+	 */
+	bool IsEnabled();
+
+	/**
+	 * Returns the array layer containing the base texture of the given terrain
+	 * texture, allocating it if necessary. Returns -1 if the texture can't be
+	 * drawn from the array (because its material uses other samplers, like normal
+	 * maps, or because the array is full).
+	 * Thread-safe, once IsEnabled has returned true on the main thread.
+	 */
+	int GetLayer(CTerrainTextureEntry* texture);
+
+	/**
+	 * Copies any textures that have finished loading into their layers, and
+	 * returns the GL texture (or 0 if there are no layers yet).
+	 */
+	GLuint GetTexture();
+
+private:
+	struct SLayer
+	{
+		CTexturePtr m_Texture;
+		bool m_Uploaded;
+	};
+
+	void Resize(size_t capacity);
+	bool UploadLayer(size_t layer);
+
+	std::vector<SLayer> m_Layers;
+	std::map<CTexture*, size_t> m_LayerIndexes;
+
+	GLuint m_Texture;
+
+	// number of layers allocated in m_Texture
+	size_t m_Capacity;
+
+	// width and height of each layer
+	size_t m_LayerSize;
+
+	// maximum number of layers (limited by the GL implementation, and by
+	// the u8 layer indexes in the vertex data); 0 until queried by IsEnabled
+	size_t m_MaxLayers;
+
+	// protects m_Layers, m_LayerIndexes and m_Dirty, since GetLayer is called
+	// by CPatchRData::Prepare on worker threads
+	CMutex m_LayersMutex;
+
+	// whether some layers haven't been uploaded yet
+	bool m_Dirty;
+
+	// whether the terrain_array effect has been loaded (-1 if not tried yet)
+	int m_EffectLoaded;
+};
+
+#endif // INCLUDED_TERRAINTEXTUREARRAY
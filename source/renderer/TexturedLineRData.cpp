@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -28,56 +28,10 @@
 #include "simulation2/system/SimContext.h"
 #include "simulation2/components/ICmpWaterManager.h"
 
-/* Note: this implementation uses g_VBMan directly rather than access it through the nicer VertexArray interface,
- * because it allows you to work with variable amounts of vertices and indices more easily. New code should prefer
- * to use VertexArray where possible, though. */
-
-void CTexturedLineRData::Render(const SOverlayTexturedLine& line, const CShaderProgramPtr& shader)
-{
-	if (!m_VB || !m_VBIndices)
-		return; // might have failed to allocate
-
-	// -- render main line quad strip ----------------------
-
-	const int streamFlags = shader->GetStreamFlags();
-
-	shader->BindTexture("baseTex", line.m_TextureBase->GetHandle());
-	shader->BindTexture("maskTex", line.m_TextureMask->GetHandle());
-	shader->Uniform("objectColor", line.m_Color);
-
-	GLsizei stride = sizeof(CTexturedLineRData::SVertex);
-	CTexturedLineRData::SVertex* vertexBase = reinterpret_cast<CTexturedLineRData::SVertex*>(m_VB->m_Owner->Bind());
-
-	if (streamFlags & STREAM_POS)
-		shader->VertexPointer(3, GL_FLOAT, stride, &vertexBase->m_Position[0]);
-
-	if (streamFlags & STREAM_UV0)
-		shader->TexCoordPointer(GL_TEXTURE0, 2, GL_FLOAT, stride, &vertexBase->m_UVs[0]);
-
-	if (streamFlags & STREAM_UV1)
-		shader->TexCoordPointer(GL_TEXTURE1, 2, GL_FLOAT, stride, &vertexBase->m_UVs[0]);
-
-	u8* indexBase = m_VBIndices->m_Owner->Bind();
-
-	shader->AssertPointersBound();
-	glDrawElements(GL_TRIANGLES, m_VBIndices->m_Count, GL_UNSIGNED_SHORT, indexBase + sizeof(u16)*m_VBIndices->m_Index); 
-
-	g_Renderer.GetStats().m_DrawCalls++;
-	g_Renderer.GetStats().m_OverlayTris += m_VBIndices->m_Count/3; 
-}
-
 void CTexturedLineRData::Update(const SOverlayTexturedLine& line)
 {
-	if (m_VB)
-	{
-		g_VBMan.Release(m_VB);
-		m_VB = NULL;
-	}
-	if (m_VBIndices)
-	{
-		g_VBMan.Release(m_VBIndices);
-		m_VBIndices = NULL;
-	}
+	m_Vertices.clear();
+	m_Indices.clear();
 
 	if (!line.m_SimContext)
 	{
@@ -284,19 +238,10 @@ void CTexturedLineRData::Update(const SOverlayTexturedLine& line)
 
 	ENSURE(indices.size() % 3 == 0); // GL_TRIANGLES indices, so must be multiple of 3
 
-	m_VB = g_VBMan.Allocate(sizeof(SVertex), vertices.size(), GL_STATIC_DRAW, GL_ARRAY_BUFFER);
-	if (m_VB) // allocation might fail (e.g. due to too many vertices)
-	{
-		m_VB->m_Owner->UpdateChunkVertices(m_VB, &vertices[0]); // copy data into VBO
-
-		for (size_t k = 0; k < indices.size(); ++k)
-			indices[k] += m_VB->m_Index;
-
-		m_VBIndices = g_VBMan.Allocate(sizeof(u16), indices.size(), GL_STATIC_DRAW, GL_ELEMENT_ARRAY_BUFFER);
-		if (m_VBIndices)
-			m_VBIndices->m_Owner->UpdateChunkVertices(m_VBIndices, &indices[0]);
-	}
-
+	// Keep the geometry in system memory; the overlay renderer copies it into its
+	// per-frame vertex buffer, so lines with the same textures can be drawn together
+	m_Vertices.swap(vertices);
+	m_Indices.swap(indices);
 }
 
 void CTexturedLineRData::CreateLineCap(const SOverlayTexturedLine& line, const CVector3D& corner1, const CVector3D& corner2,
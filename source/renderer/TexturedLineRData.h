@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,9 +20,7 @@
 
 #include "graphics/Overlay.h"
 #include "graphics/RenderableObject.h"
-#include "graphics/ShaderProgram.h"
 #include "graphics/TextureManager.h"
-#include "renderer/VertexBufferManager.h"
 
 /**
  * Rendering data for an STexturedOverlayLine.
@@ -38,26 +36,13 @@
  */
 class CTexturedLineRData : public CRenderData
 {
-	// we hold raw pointers to vertex buffer chunks that are handed out by the vertex buffer manager
-	// and can not be safely duplicated by us.
 	NONCOPYABLE(CTexturedLineRData);
 
 public:
 
-	CTexturedLineRData() : m_VB(NULL), m_VBIndices(NULL) { }
-
-	~CTexturedLineRData()
-	{
-		if (m_VB)
-			g_VBMan.Release(m_VB);
-		if (m_VBIndices)
-			g_VBMan.Release(m_VBIndices);
-	}
+	CTexturedLineRData() { }
 
 	void Update(const SOverlayTexturedLine& line);
-	void Render(const SOverlayTexturedLine& line, const CShaderProgramPtr& shader);
-
-protected:
 
 	struct SVertex
 	{
@@ -68,6 +53,14 @@ protected:
 	};
 	cassert(sizeof(SVertex) == 32);
 
+	/// Returns the vertices of the line, which the overlay renderer copies into its batches.
+	const std::vector<SVertex>& GetVertices() const { return m_Vertices; }
+
+	/// Returns the GL_TRIANGLES indices of the line, relative to the first of its vertices.
+	const std::vector<u16>& GetIndices() const { return m_Indices; }
+
+protected:
+
 	/**
 	 * Creates a line cap of the specified type @p endCapType at the end of the segment going in direction @p normal, and appends
 	 * the vertices to @p verticesOut in GL_TRIANGLES order.
@@ -88,8 +81,8 @@ protected:
 		return (v1.m_Position + v2.m_Position) * 0.5;
 	}
 
-	CVertexBuffer::VBChunk* m_VB;
-	CVertexBuffer::VBChunk* m_VBIndices;
+	std::vector<SVertex> m_Vertices;
+	std::vector<u16> m_Indices;
 };
 
 #endif // INCLUDED_TEXTUREDLINERDATA
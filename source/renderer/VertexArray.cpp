@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -289,6 +289,35 @@ void VertexArray::Upload()
 	m_VB->m_Owner->UpdateChunkVertices(m_VB, m_BackingStore);
 }
 
+void VertexArray::Upload(size_t numVertices)
+{
+	ENSURE(m_BackingStore);
+	ENSURE(numVertices <= m_NumVertices);
+
+	if (!m_VB)
+		m_VB = g_VBMan.Allocate(m_Stride, m_NumVertices, m_Usage, m_Target);
+
+	if (!m_VB) // failed to allocate VBO
+		return;
+
+	m_VB->m_Owner->UpdateChunkVertices(m_VB, m_BackingStore, numVertices);
+}
+
+void VertexArray::UploadRange(size_t first, size_t count)
+{
+	ENSURE(m_BackingStore);
+	ENSURE(first + count <= m_NumVertices);
+
+	if (!m_VB)
+	{
+		// The rest of the VBO must have defined contents too, so upload everything
+		Upload();
+		return;
+	}
+
+	m_VB->m_Owner->UpdateChunkVertexRange(m_VB, m_BackingStore + first*m_Stride, first, count);
+}
+
 
 // Bind this array, returns the base address for calls to glVertexPointer etc.
 u8* VertexArray::Bind()
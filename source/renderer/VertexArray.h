@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -167,6 +167,9 @@ public:
 
 	size_t GetNumVertices() const { return m_NumVertices; }
 	size_t GetStride() const { return m_Stride; }
+	// Get the backing store (GetNumVertices() * GetStride() bytes, valid from
+	// Layout() until FreeBackingStore()), to copy whole vertices at once
+	u8* GetBackingStore() const { return (u8*)m_BackingStore; }
 	
 	// Layout the vertex array format and create backing buffer in RAM.
 	// You must call Layout() after changing the number of vertices or
@@ -176,6 +179,12 @@ public:
 	// (Re-)Upload the attributes of the vertex array from the backing store to
 	// the underlying VBO object.
 	void Upload();
+	// Upload only the first numVertices vertices (e.g. when the array is
+	// reused for varying amounts of dynamic data).
+	void Upload(size_t numVertices);
+	// Upload only the vertices [first, first+count), leaving the rest of the
+	// VBO unchanged. (Not supported for GL_STREAM_DRAW arrays.)
+	void UploadRange(size_t first, size_t count);
 	// Bind this array, returns the base address for calls to glVertexPointer etc.
 	u8* Bind();
 
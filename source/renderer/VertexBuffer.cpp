@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -27,11 +27,28 @@
 #include "VertexBuffer.h"
 #include "VertexBufferManager.h"
 #include "ps/CLogger.h"
+#include "ps/MemoryStats.h"
 
-CVertexBuffer::CVertexBuffer(size_t vertexSize, GLenum usage, GLenum target)
-	: m_VertexSize(vertexSize), m_Handle(0), m_SysMem(0), m_Usage(usage), m_Target(target)
+// Maximum allocation size (in bytes) of each size class
+static const size_t g_SizeClassMaxBytes[NUM_VB_SIZE_CLASSES - 1] = { 4*1024, 32*1024, 256*1024 };
+
+// Size of the buffers for each size class
+static const size_t g_SizeClassBufferBytes[NUM_VB_SIZE_CLASSES] = { 256*1024, 1024*1024, MAX_VB_SIZE_BYTES, MAX_VB_SIZE_BYTES };
+
+size_t CVertexBuffer::GetSizeClass(size_t bytes)
+{
+	for (size_t i = 0; i < NUM_VB_SIZE_CLASSES - 1; ++i)
+		if (bytes <= g_SizeClassMaxBytes[i])
+			return i;
+	return NUM_VB_SIZE_CLASSES - 1;
+}
+
+CVertexBuffer::CVertexBuffer(size_t vertexSize, GLenum usage, GLenum target, size_t sizeClass)
+	: m_VertexSize(vertexSize), m_Handle(0), m_SysMem(0), m_Usage(usage), m_Target(target),
+	  m_Streaming(false), m_StreamPos(0), m_SizeClass(sizeClass), m_EmptyFrames(0)
 {
-	size_t size = MAX_VB_SIZE_BYTES;
+	ENSURE(sizeClass < NUM_VB_SIZE_CLASSES);
+	size_t size = g_SizeClassBufferBytes[sizeClass];
 
 	if (target == GL_ARRAY_BUFFER) // vertex data buffer
 	{
@@ -48,6 +65,8 @@ CVertexBuffer::CVertexBuffer(size_t vertexSize, GLenum usage, GLenum target)
 		pglBindBufferARB(m_Target, m_Handle);
 		pglBufferDataARB(m_Target, size, 0, m_Usage);
 		pglBindBufferARB(m_Target, 0);
+
+		m_Streaming = (m_Usage == GL_STREAM_DRAW);
 	}
 	else
 	{
@@ -56,6 +75,7 @@ CVertexBuffer::CVertexBuffer(size_t vertexSize, GLenum usage, GLenum target)
 
 	// store max/free vertex counts
 	m_MaxVertices = m_FreeVertices = size/vertexSize;
+	MemoryStats::Add(MEMORY_VERTEX_BUFFERS, (ssize_t)GetBytesReserved());
 	
 	// create sole free chunk
 	VBChunk* chunk = new VBChunk;
@@ -67,6 +87,8 @@ CVertexBuffer::CVertexBuffer(size_t vertexSize, GLenum usage, GLenum target)
 
 CVertexBuffer::~CVertexBuffer()
 {
+	MemoryStats::Add(MEMORY_VERTEX_BUFFERS, -(ssize_t)GetBytesReserved());
+
 	if (m_Handle)
 		pglDeleteBuffersARB(1, &m_Handle);
 
@@ -96,29 +118,50 @@ CVertexBuffer::VBChunk* CVertexBuffer::Allocate(size_t vertexSize, size_t numVer
 	if (!CompatibleVertexType(vertexSize, usage, target))
 		return 0;
 
+	// streaming chunks don't own any space in the buffer, they just get
+	// some more each time they're uploaded
+	if (m_Streaming)
+	{
+		if (numVertices > m_MaxVertices)
+			return 0;
+
+		VBChunk* chunk = new VBChunk;
+		chunk->m_Owner = this;
+		chunk->m_Count = numVertices;
+		chunk->m_Index = 0;
+		return chunk;
+	}
+
+	if (GetSizeClass(numVertices * vertexSize) != m_SizeClass)
+		return 0;
+
 	// quick check there's enough vertices spare to allocate
 	if (numVertices > m_FreeVertices)
 		return 0;
 
-	// trawl free list looking for first free chunk with enough space
-	VBChunk* chunk = 0;
+	// trawl free list looking for the smallest free chunk with enough space,
+	// to keep the large ones for large allocations
 	typedef std::list<VBChunk*>::iterator Iter;
+	Iter best = m_FreeList.end();
 	for (Iter iter = m_FreeList.begin(); iter != m_FreeList.end(); ++iter) {
-		if (numVertices <= (*iter)->m_Count) {
-			chunk = *iter;
-			// remove this chunk from the free list
-			m_FreeList.erase(iter);
-			m_FreeVertices -= chunk->m_Count;
-			// no need to search further ..
-			break;
+		if (numVertices <= (*iter)->m_Count && (best == m_FreeList.end() || (*iter)->m_Count < (*best)->m_Count)) {
+			best = iter;
+			// can't do better than an exact fit
+			if ((*best)->m_Count == numVertices)
+				break;
 		}
 	}
 
-	if (!chunk) {
+	if (best == m_FreeList.end()) {
 		// no big enough spare chunk available
 		return 0;
 	}
 
+	// remove this chunk from the free list
+	VBChunk* chunk = *best;
+	m_FreeList.erase(best);
+	m_FreeVertices -= chunk->m_Count;
+
 	// split chunk into two; - allocate a new chunk using all unused vertices in the 
 	// found chunk, and add it to the free list
 	if (chunk->m_Count > numVertices)
@@ -142,6 +185,12 @@ CVertexBuffer::VBChunk* CVertexBuffer::Allocate(size_t vertexSize, size_t numVer
 // Release: return given chunk to this buffer
 void CVertexBuffer::Release(VBChunk* chunk)
 {
+	if (m_Streaming)
+	{
+		delete chunk;
+		return;
+	}
+
 	// Update total free count before potentially modifying this chunk's count
 	m_FreeVertices += chunk->m_Count;
 
@@ -176,20 +225,104 @@ void CVertexBuffer::Release(VBChunk* chunk)
 // UpdateChunkVertices: update vertex data for given chunk
 void CVertexBuffer::UpdateChunkVertices(VBChunk* chunk, void* data)
 {
+	UpdateChunkVertices(chunk, data, chunk->m_Count);
+}
+
+void CVertexBuffer::UpdateChunkVertices(VBChunk* chunk, void* data, size_t count)
+{
+	ENSURE(count <= chunk->m_Count);
+
+	if (m_Streaming)
+	{
+		// append to whichever buffer still has space in this frame
+		CVertexBuffer* buffer = this;
+		if (!HasStreamSpace(count))
+			buffer = g_VBMan.GetStreamBuffer(m_VertexSize, count, m_Target);
+		if (buffer)
+			buffer->UploadStream(chunk, data, count);
+		return;
+	}
+
 	if (g_Renderer.m_Caps.m_VBO)
 	{
 		ENSURE(m_Handle);
 		pglBindBufferARB(m_Target, m_Handle);
-		pglBufferSubDataARB(m_Target, chunk->m_Index * m_VertexSize, chunk->m_Count * m_VertexSize, data);
+		pglBufferSubDataARB(m_Target, chunk->m_Index * m_VertexSize, count * m_VertexSize, data);
 		pglBindBufferARB(m_Target, 0);
 	}
 	else
 	{
 		ENSURE(m_SysMem);
-		memcpy(m_SysMem + chunk->m_Index * m_VertexSize, data, chunk->m_Count * m_VertexSize);
+		memcpy(m_SysMem + chunk->m_Index * m_VertexSize, data, count * m_VertexSize);
 	}
 }
 
+void CVertexBuffer::UpdateChunkVertexRange(VBChunk* chunk, void* data, size_t first, size_t count)
+{
+	ENSURE(first + count <= chunk->m_Count);
+	ENSURE(!m_Streaming);
+
+	if (g_Renderer.m_Caps.m_VBO)
+	{
+		ENSURE(m_Handle);
+		pglBindBufferARB(m_Target, m_Handle);
+		pglBufferSubDataARB(m_Target, (chunk->m_Index + first) * m_VertexSize, count * m_VertexSize, data);
+		pglBindBufferARB(m_Target, 0);
+	}
+	else
+	{
+		ENSURE(m_SysMem);
+		memcpy(m_SysMem + (chunk->m_Index + first) * m_VertexSize, data, count * m_VertexSize);
+	}
+}
+
+void CVertexBuffer::UploadStream(VBChunk* chunk, void* data, size_t count)
+{
+	ENSURE(m_Streaming && m_Handle && HasStreamSpace(count));
+
+	size_t offset = m_StreamPos * m_VertexSize;
+	size_t size = count * m_VertexSize;
+
+	pglBindBufferARB(m_Target, m_Handle);
+
+	// Nothing has been drawn from this range since the buffer was orphaned,
+	// so the driver doesn't have to synchronise with the GPU
+	bool uploaded = false;
+#if !CONFIG2_GLES
+	if (g_Renderer.m_Caps.m_MapBufferRange)
+	{
+		void* ptr = pglMapBufferRange(m_Target, offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		if (ptr)
+		{
+			memcpy(ptr, data, size);
+			uploaded = pglUnmapBufferARB(m_Target);
+		}
+	}
+#endif
+	if (!uploaded)
+		pglBufferSubDataARB(m_Target, offset, size, data);
+
+	pglBindBufferARB(m_Target, 0);
+
+	chunk->m_Owner = this;
+	chunk->m_Index = m_StreamPos;
+	m_StreamPos += count;
+}
+
+void CVertexBuffer::ResetStream()
+{
+	if (!m_Streaming || m_StreamPos == 0)
+		return;
+
+	// Orphan the old storage (the GPU can keep using it for any draw calls that are
+	// still pending) and get a new one for this frame's uploads
+	pglBindBufferARB(m_Target, m_Handle);
+	pglBufferDataARB(m_Target, m_MaxVertices * m_VertexSize, 0, m_Usage);
+	pglBindBufferARB(m_Target, 0);
+
+	m_StreamPos = 0;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Bind: bind to this buffer; return pointer to address required as parameter
 // to glVertexPointer ( + etc) calls
@@ -225,11 +358,14 @@ void CVertexBuffer::Unbind()
 
 size_t CVertexBuffer::GetBytesReserved() const
 {
-	return MAX_VB_SIZE_BYTES;
+	return m_MaxVertices * m_VertexSize;
 }
 
 size_t CVertexBuffer::GetBytesAllocated() const
 {
+	if (m_Streaming)
+		return m_StreamPos * m_VertexSize;
+
 	return (m_MaxVertices - m_FreeVertices) * m_VertexSize;
 }
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -33,9 +33,23 @@
 // TODO: measure what influence this has on performance
 #define MAX_VB_SIZE_BYTES		(4*1024*1024)
 
+// Allocations are sorted into size classes by their size in bytes, and each buffer
+// only holds chunks of a single class, so that small short-lived allocations
+// (decals, overlays etc) don't fragment the buffers that hold large ones.
+// Buffers for the smaller classes are smaller too, to limit the unused space.
+#define NUM_VB_SIZE_CLASSES		4
+
 /**
  * CVertexBuffer: encapsulation of ARB_vertex_buffer_object, also supplying 
  * some additional functionality for sharing buffers between multiple objects
+ *
+ * Buffers with GL_STREAM_DRAW usage are treated specially (when VBOs are supported):
+ * rather than giving each chunk a fixed portion of the buffer, every upload is
+ * appended to the data uploaded so far this frame, and the whole buffer is orphaned
+ * at the start of the next frame. Uploads therefore always write to storage the GPU
+ * isn't using, and never have to wait for it. The downside is that the data of
+ * these chunks is only valid in the frame it was uploaded in; they must be uploaded
+ * again before being drawn in a later frame.
  */
 class CVertexBuffer
 {
@@ -47,6 +61,7 @@ public:
 		/// Owning (parent) vertex buffer
 		CVertexBuffer* m_Owner;
 		/// Start index of this chunk in owner
+		/// (for streaming chunks, this changes with every upload)
 		size_t m_Index;
 		/// Number of vertices used by chunk
 		size_t m_Count;
@@ -61,9 +76,12 @@ public:
 
 public:
 	// constructor, destructor
-	CVertexBuffer(size_t vertexSize, GLenum usage, GLenum target);
+	CVertexBuffer(size_t vertexSize, GLenum usage, GLenum target, size_t sizeClass);
 	~CVertexBuffer();
 
+	/// Returns the size class of an allocation of the given number of bytes
+	static size_t GetSizeClass(size_t bytes);
+
 	/// Bind to this buffer; return pointer to address required as parameter
 	/// to glVertexPointer ( + etc) calls
 	u8* Bind();
@@ -77,9 +95,20 @@ public:
 	/// Update vertex data for given chunk. Transfers the provided data to the actual OpenGL vertex buffer.
 	void UpdateChunkVertices(VBChunk* chunk, void* data);
 
+	/// Update the first count vertices of the given chunk.
+	void UpdateChunkVertices(VBChunk* chunk, void* data, size_t count);
+
+	/// Update count vertices of the given chunk, starting at vertex first (relative to
+	/// the start of the chunk). data points to the first of those vertices.
+	/// Not supported by streaming buffers, since they don't keep their contents.
+	void UpdateChunkVertexRange(VBChunk* chunk, void* data, size_t first, size_t count);
+
 	size_t GetVertexSize() const { return m_VertexSize; }
+	GLenum GetUsage() const { return m_Usage; }
 	size_t GetBytesReserved() const;
 	size_t GetBytesAllocated() const;
+	/// Returns the number of separate free ranges (a measure of fragmentation)
+	size_t GetNumFreeChunks() const { return m_FreeList.size(); }
 
 	/// Returns true if this vertex buffer is compatible with the specified vertex type and intended usage.
 	bool CompatibleVertexType(size_t vertexSize, GLenum usage, GLenum target);
@@ -94,9 +123,20 @@ protected:
 	VBChunk* Allocate(size_t vertexSize, size_t numVertices, GLenum usage, GLenum target);
 	/// Return given chunk to this buffer
 	void Release(VBChunk* chunk);
-	
-	
-private:	
+
+	/// Discard the contents of a streaming buffer, so it can be filled again from the start
+	void ResetStream();
+
+	/// Returns true if a streaming buffer has space for numVertices more vertices in this frame
+	bool HasStreamSpace(size_t numVertices) const { return m_StreamPos + numVertices <= m_MaxVertices; }
+
+	/// Returns true if no chunks are allocated from this (non-streaming) buffer
+	bool IsEmpty() const { return !m_Streaming && m_FreeVertices == m_MaxVertices; }
+
+private:
+	/// Append the data of a streaming chunk to this buffer, and point the chunk at it
+	void UploadStream(VBChunk* chunk, void* data, size_t count);
+
 	/// Vertex size of this vertex buffer
 	size_t m_VertexSize;
 	/// Number of vertices of above size in this buffer
@@ -113,6 +153,14 @@ private:
 	GLenum m_Usage;
 	/// Buffer target (GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER)
 	GLenum m_Target;
+	/// Whether chunks are streamed (see class comment) rather than stored in the free list
+	bool m_Streaming;
+	/// Number of vertices streamed into this buffer since the last ResetStream
+	size_t m_StreamPos;
+	/// Size class of the chunks allocated from this buffer
+	size_t m_SizeClass;
+	/// Number of frames this buffer has been empty for (maintained by CVertexBufferManager)
+	size_t m_EmptyFrames;
 };
 
 #endif
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -28,8 +28,21 @@
 
 #define DUMP_VB_STATS 0 // for debugging
 
+// Number of frames a buffer must stay empty before it's deleted (so that buffers
+// aren't repeatedly destroyed and recreated when things come and go)
+static const size_t MAX_EMPTY_FRAMES = 300;
+
 CVertexBufferManager g_VBMan;
 
+// Order buffers from most to least used
+struct SortBuffersByBytesAllocated
+{
+	bool operator()(const CVertexBuffer* a, const CVertexBuffer* b) const
+	{
+		return a->GetBytesAllocated() > b->GetBytesAllocated();
+	}
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 // Explicit shutdown of the vertex buffer subsystem.
 // This avoids the ordering issues that arise when using destructors of
@@ -71,17 +84,26 @@ CVertexBuffer::VBChunk* CVertexBufferManager::Allocate(size_t vertexSize, size_t
 	}
 #endif
 
-	// iterate through all existing buffers testing for one that'll 
-	// satisfy the allocation
+	// Find all existing buffers that might satisfy the allocation, and try the
+	// fullest first, so that sparsely used buffers gradually empty out and can
+	// be freed instead of staying fragmented
+	size_t sizeClass = (usage == GL_STREAM_DRAW ? NUM_VB_SIZE_CLASSES - 1 : CVertexBuffer::GetSizeClass(vertexSize * numVertices));
+	std::vector<CVertexBuffer*> candidates;
 	for (Iter iter = m_Buffers.begin(); iter != m_Buffers.end(); ++iter) {
 		CVertexBuffer* buffer = *iter;
-		result = buffer->Allocate(vertexSize, numVertices, usage, target);
+		if (buffer->CompatibleVertexType(vertexSize, usage, target) && (buffer->m_Streaming || buffer->m_SizeClass == sizeClass))
+			candidates.push_back(buffer);
+	}
+	std::sort(candidates.begin(), candidates.end(), SortBuffersByBytesAllocated());
+
+	for (size_t i = 0; i < candidates.size(); ++i) {
+		result = candidates[i]->Allocate(vertexSize, numVertices, usage, target);
 		if (result)
 			return result;
 	}
 
 	// got this far; need to allocate a new buffer
-	CVertexBuffer* buffer = new CVertexBuffer(vertexSize, usage, target);
+	CVertexBuffer* buffer = new CVertexBuffer(vertexSize, usage, target, sizeClass);
 	m_Buffers.push_front(buffer);
 	result = buffer->Allocate(vertexSize, numVertices, usage, target);
 	
@@ -105,6 +127,56 @@ void CVertexBufferManager::Release(CVertexBuffer::VBChunk* chunk)
 }
 
 
+void CVertexBufferManager::BeginFrame()
+{
+	typedef std::list<CVertexBuffer*>::iterator Iter;
+	for (Iter iter = m_Buffers.begin(); iter != m_Buffers.end(); )
+	{
+		CVertexBuffer* buffer = *iter;
+		buffer->ResetStream();
+
+		// Free the memory of buffers that have been empty for a while
+		// (nothing can be referring to them, since they have no chunks)
+		if (buffer->IsEmpty())
+		{
+			if (++buffer->m_EmptyFrames > MAX_EMPTY_FRAMES)
+			{
+				delete buffer;
+				iter = m_Buffers.erase(iter);
+				continue;
+			}
+		}
+		else
+		{
+			buffer->m_EmptyFrames = 0;
+		}
+
+		++iter;
+	}
+}
+
+CVertexBuffer* CVertexBufferManager::GetStreamBuffer(size_t vertexSize, size_t numVertices, GLenum target)
+{
+	typedef std::list<CVertexBuffer*>::iterator Iter;
+	for (Iter iter = m_Buffers.begin(); iter != m_Buffers.end(); ++iter)
+	{
+		CVertexBuffer* buffer = *iter;
+		if (buffer->m_Streaming && buffer->CompatibleVertexType(vertexSize, GL_STREAM_DRAW, target) && buffer->HasStreamSpace(numVertices))
+			return buffer;
+	}
+
+	CVertexBuffer* buffer = new CVertexBuffer(vertexSize, GL_STREAM_DRAW, target, NUM_VB_SIZE_CLASSES - 1);
+	m_Buffers.push_front(buffer);
+
+	if (!buffer->m_Streaming || !buffer->HasStreamSpace(numVertices))
+	{
+		LOGERROR(L"Failed to create streaming VBO (%lu*%lu)", (unsigned long)vertexSize, (unsigned long)numVertices);
+		return NULL;
+	}
+
+	return buffer;
+}
+
 size_t CVertexBufferManager::GetBytesReserved()
 {
 	size_t total = 0;
@@ -126,3 +198,38 @@ size_t CVertexBufferManager::GetBytesAllocated()
 
 	return total;
 }
+
+size_t CVertexBufferManager::GetBytesReserved(GLenum usage)
+{
+	size_t total = 0;
+
+	typedef std::list<CVertexBuffer*>::iterator Iter;
+	for (Iter iter = m_Buffers.begin(); iter != m_Buffers.end(); ++iter)
+		if ((*iter)->GetUsage() == usage)
+			total += (*iter)->GetBytesReserved();
+
+	return total;
+}
+
+size_t CVertexBufferManager::GetBytesAllocated(GLenum usage)
+{
+	size_t total = 0;
+
+	typedef std::list<CVertexBuffer*>::iterator Iter;
+	for (Iter iter = m_Buffers.begin(); iter != m_Buffers.end(); ++iter)
+		if ((*iter)->GetUsage() == usage)
+			total += (*iter)->GetBytesAllocated();
+
+	return total;
+}
+
+size_t CVertexBufferManager::GetNumFreeChunks()
+{
+	size_t total = 0;
+
+	typedef std::list<CVertexBuffer*>::iterator Iter;
+	for (Iter iter = m_Buffers.begin(); iter != m_Buffers.end(); ++iter)
+		total += (*iter)->GetNumFreeChunks();
+
+	return total;
+}
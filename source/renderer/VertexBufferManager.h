@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -36,7 +36,8 @@ public:
 	 *
 	 * @param vertexSize size of each vertex in the buffer
 	 * @param numVertices number of vertices in the buffer
-	 * @param usage typically GL_STATIC_DRAW or GL_DYNAMIC_DRAW
+	 * @param usage typically GL_STATIC_DRAW or GL_DYNAMIC_DRAW, or GL_STREAM_DRAW for
+	 *  data that's uploaded every frame (see CVertexBuffer)
 	 * @param target typically GL_ARRAY_BUFFER or GL_ELEMENT_ARRAY_BUFFER
 	 * @return chunk, or NULL if no free chunks available
 	 */
@@ -45,12 +46,35 @@ public:
 	/// Returns the given @p chunk to its owning buffer
 	void Release(CVertexBuffer::VBChunk* chunk);
 
+	/**
+	 * Start a new frame: discards the contents of all GL_STREAM_DRAW chunks,
+	 * which must be uploaded again before they're next drawn, and frees
+	 * buffers that have been empty for a while.
+	 */
+	void BeginFrame();
+
+	/**
+	 * Returns a GL_STREAM_DRAW buffer of the given type that has space for
+	 * @p numVertices more vertices in this frame, creating a new one if necessary.
+	 * (Used by CVertexBuffer when its own space runs out.)
+	 * @return buffer, or NULL if @p numVertices is too large for any buffer
+	 */
+	CVertexBuffer* GetStreamBuffer(size_t vertexSize, size_t numVertices, GLenum target);
+
 	/// Returns a list of all buffers
 	const std::list<CVertexBuffer*>& GetBufferList() const { return m_Buffers; }
 
 	size_t GetBytesReserved();
 	size_t GetBytesAllocated();
 
+	/// Statistics for buffers of a single usage type (GL_STATIC_DRAW etc)
+	size_t GetBytesReserved(GLenum usage);
+	size_t GetBytesAllocated(GLenum usage);
+
+	size_t GetNumBuffers() const { return m_Buffers.size(); }
+	/// Returns the total number of free ranges in all buffers (a measure of fragmentation)
+	size_t GetNumFreeChunks();
+
 	/// Returns the maximum possible size of a single vertex buffer
 	size_t GetMaxBufferSize() const { return MAX_VB_SIZE_BYTES; }
 
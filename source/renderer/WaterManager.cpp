@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -32,6 +32,7 @@
 #include "maths/MathUtil.h"
 #include "maths/Vector2D.h"
 
+#include "ps/ConfigDB.h"
 #include "ps/Game.h"
 #include "ps/World.h"
 
@@ -45,7 +46,9 @@
 
 ///////////////////////////////////////////////////////////////////
 // Construction/Destruction
-WaterManager::WaterManager()
+WaterManager::WaterManager() :
+	m_ReflectionCullHeight("waterreflectioncullheight", 0.0f),
+	m_ReflectionReuseFrames("waterreflectionreuse", 0)
 {
 	// water
 	m_RenderWater = false; // disabled until textures are successfully loaded
@@ -65,6 +68,9 @@ WaterManager::WaterManager()
 	m_RefractionTexture = 0;
 	m_ReflectionTextureSize = 0;
 	m_RefractionTextureSize = 0;
+	m_ReflectionValid = false;
+	m_ReflectionReusedFrames = 0;
+	m_ReflectionWaterHeight = 0.0f;
 	m_WaterTexTimer = 0.0;
 	m_Shininess = 150.0f;
 	m_SpecularStrength = 0.6f;
@@ -96,6 +102,7 @@ WaterManager::WaterManager()
 
 	m_depthTT = 0;
 	m_waveTT = 0;
+	m_WaveTexWidth = m_WaveTexHeight = 0;
 
 }
 
@@ -115,6 +122,21 @@ WaterManager::~WaterManager()
 }
 
 
+// Returns the size set by the given config option, rounded down to a power of two
+// and limited to maxSize (which is also used if the option isn't set)
+static size_t GetConfiguredTextureSize(const char* option, int maxSize)
+{
+	int size = 0;
+	CFG_GET_VAL(option, Int, size);
+	if (size <= 0 || size >= maxSize)
+		return maxSize;
+
+	size_t pow2 = round_up_to_pow2((unsigned)size);
+	if (pow2 > (size_t)size)
+		pow2 /= 2;
+	return std::max(pow2, (size_t)64);
+}
+
 ///////////////////////////////////////////////////////////////////
 // Progressive load of water textures
 int WaterManager::LoadWaterTextures()
@@ -175,8 +197,11 @@ int WaterManager::LoadWaterTextures()
 	// the reflection/refraction textures to be that large?)
 	int size = (int)round_up_to_pow2((unsigned)g_Renderer.GetHeight());
 	if(size > g_Renderer.GetHeight()) size /= 2;
-	m_ReflectionTextureSize = size;
-	m_RefractionTextureSize = size;
+	m_ReflectionTextureSize = GetConfiguredTextureSize("waterreflectionsize", size);
+	m_RefractionTextureSize = GetConfiguredTextureSize("waterrefractionsize", size);
+
+	// The new texture has no contents yet
+	m_ReflectionValid = false;
 
 	// Create reflection texture
 	glGenTextures(1, &m_ReflectionTexture);
@@ -578,6 +603,28 @@ void WaterManager::updateQuality()
 	}
 }
 
+bool WaterManager::CanReuseReflection(const CMatrix3D& viewProjection, const CBoundingBoxAligned& scissor)
+{
+	if (!m_ReflectionValid || m_ReflectionReusedFrames >= m_ReflectionReuseFrames.Get())
+		return false;
+
+	if (!(viewProjection == m_ReflectionViewProjection) || m_WaterHeight != m_ReflectionWaterHeight ||
+		scissor[0] != m_ReflectionScissor[0] || scissor[1] != m_ReflectionScissor[1])
+		return false;
+
+	++m_ReflectionReusedFrames;
+	return true;
+}
+
+void WaterManager::SetReflectionRendered(const CMatrix3D& viewProjection, const CBoundingBoxAligned& scissor)
+{
+	m_ReflectionValid = true;
+	m_ReflectionReusedFrames = 0;
+	m_ReflectionViewProjection = viewProjection;
+	m_ReflectionScissor = scissor;
+	m_ReflectionWaterHeight = m_WaterHeight;
+}
+
 bool WaterManager::WillRenderFancyWater()
 {
 	if (!g_Renderer.GetCapabilities().m_FragmentShader)
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,7 +24,9 @@
 
 #include "graphics/Texture.h"
 #include "lib/ogl.h"
+#include "maths/BoundingBoxAligned.h"
 #include "maths/Matrix3D.h"
+#include "ps/ConfigDB.h"
 #include "ps/Overlay.h"
 #include "renderer/VertexBufferManager.h"
 
@@ -60,6 +62,7 @@ public:
 
 	GLuint m_depthTT;
 	GLuint m_waveTT;
+	int m_WaveTexWidth, m_WaveTexHeight; // size m_waveTT was allocated with
 
 	
 	int m_WaterCurrentTex;
@@ -101,6 +104,22 @@ public:
 	size_t m_ReflectionTextureSize;
 	size_t m_RefractionTextureSize;
 
+	// Models entirely higher than this above the water aren't drawn into the
+	// reflection texture (0 = no limit)
+	CConfigSetting<float> m_ReflectionCullHeight;
+
+	// Maximum number of consecutive frames the reflection texture can be reused
+	// for, while the camera and water haven't moved (0 = never reuse it)
+	CConfigSetting<int> m_ReflectionReuseFrames;
+
+	// State of the last reflection rendered into m_ReflectionTexture, to detect
+	// when it can be reused
+	bool m_ReflectionValid;
+	int m_ReflectionReusedFrames;
+	CMatrix3D m_ReflectionViewProjection;
+	CBoundingBoxAligned m_ReflectionScissor;
+	float m_ReflectionWaterHeight;
+
 	// Model-view-projection matrices for reflected & refracted cameras
 	// (used to let the vertex shader do projective texturing)
 	CMatrix3D m_ReflectionMatrix;
@@ -150,6 +169,19 @@ public:
 	 */
 	void updateQuality();
 	
+	/**
+	 * Returns true if the reflection texture rendered for the last frame can be
+	 * used again for a camera with the given view-projection matrix and water
+	 * scissor, instead of rendering a new one. Each reuse counts towards the
+	 * m_ReflectionReuseFrames limit, so moving units still get updated regularly.
+	 */
+	bool CanReuseReflection(const CMatrix3D& viewProjection, const CBoundingBoxAligned& scissor);
+
+	/**
+	 * Records the camera and scissor that the reflection texture has just been rendered with.
+	 */
+	void SetReflectionRendered(const CMatrix3D& viewProjection, const CBoundingBoxAligned& scissor);
+
 	/**
 	 * Returns true if fancy water shaders will be used (i.e. the hardware is capable
 	 * and it hasn't been configured off)
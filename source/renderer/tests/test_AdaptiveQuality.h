@@ -0,0 +1,85 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "renderer/AdaptiveQuality.h"
+
+class TestAdaptiveQuality : public CxxTest::TestSuite
+{
+	// Record frames until the level changes, or give up after many frames
+	static size_t RunUntilChange(CAdaptiveQuality& quality, double time)
+	{
+		for (size_t i = 0; i < 1000; ++i)
+			if (quality.RecordFrame(time))
+				return i + 1;
+		return 0;
+	}
+
+public:
+	void test_full_quality()
+	{
+		CAdaptiveQuality quality(0.030, 0.5f);
+		TS_ASSERT_EQUALS(quality.GetLevel(), 0u);
+		CAdaptiveQuality::Settings settings = quality.GetSettings();
+		TS_ASSERT_EQUALS(settings.m_ResolutionScale, 1.f);
+		TS_ASSERT_EQUALS(settings.m_ParticleDensity, 1.f);
+		TS_ASSERT_EQUALS(settings.m_ShadowMapDivisor, 1);
+		TS_ASSERT(settings.m_WaterEffects);
+
+		// Frames within the budget never change anything
+		TS_ASSERT_EQUALS(RunUntilChange(quality, 0.020), 0u);
+		TS_ASSERT_EQUALS(quality.GetLevel(), 0u);
+	}
+
+	void test_decrease_and_recover()
+	{
+		CAdaptiveQuality quality(0.030, 0.5f);
+
+		// Slow frames lower the quality one step at a time, down to the last level
+		float lastScale = 1.f;
+		for (size_t level = 1; level < CAdaptiveQuality::GetNumLevels(); ++level)
+		{
+			TS_ASSERT_DIFFERS(RunUntilChange(quality, 0.050), 0u);
+			TS_ASSERT_EQUALS(quality.GetLevel(), level);
+			TS_ASSERT_LESS_THAN_EQUALS(quality.GetSettings().m_ResolutionScale, lastScale);
+			lastScale = quality.GetSettings().m_ResolutionScale;
+		}
+		TS_ASSERT_EQUALS(RunUntilChange(quality, 0.050), 0u);
+		TS_ASSERT_EQUALS(quality.GetSettings().m_ResolutionScale, 0.5f);
+		TS_ASSERT(!quality.GetSettings().m_WaterEffects);
+
+		// Frames only slightly under the budget don't raise it again
+		TS_ASSERT_EQUALS(RunUntilChange(quality, 0.028), 0u);
+
+		// Fast frames do
+		TS_ASSERT_DIFFERS(RunUntilChange(quality, 0.010), 0u);
+		TS_ASSERT_EQUALS(quality.GetLevel(), CAdaptiveQuality::GetNumLevels() - 2);
+
+		quality.Reset();
+		TS_ASSERT_EQUALS(quality.GetLevel(), 0u);
+	}
+
+	void test_min_scale()
+	{
+		CAdaptiveQuality quality(0.030, 0.75f);
+		while (RunUntilChange(quality, 0.100))
+			;
+		TS_ASSERT_EQUALS(quality.GetLevel(), CAdaptiveQuality::GetNumLevels() - 1);
+		TS_ASSERT_EQUALS(quality.GetSettings().m_ResolutionScale, 0.75f);
+	}
+};
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -91,6 +91,15 @@ void ScriptingHost::RunScript(const VfsPath& pathname, JSObject* globalObject)
 	std::wstring scriptw = wstring_from_utf8(std::string(buf.get(), buf.get() + size));
 	utf16string script(scriptw.begin(), scriptw.end());
 
+	RunUCScript(script, pathname, globalObject);
+}
+
+// globalObject defaults to 0 (in which case we use our m_GlobalObject).
+void ScriptingHost::RunUCScript(const utf16string& script, const VfsPath& pathname, JSObject* globalObject)
+{
+	if(!globalObject)
+		globalObject = m_GlobalObject;
+
 	jsval rval;
 	JSBool ok = JS_EvaluateUCScript(m_Context, globalObject,
 		reinterpret_cast<const jschar*>(script.c_str()), (uintN)script.size(),
@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -48,6 +48,7 @@ ERROR_TYPE(Scripting_DefineType, CreationFailed);
 
 #include "ps/Singleton.h"
 #include "ps/CStr.h"
+#include "ps/utf16string.h"
 
 class ScriptInterface;
 
@@ -95,6 +96,7 @@ public:
 
 	void RunMemScript(const char* script, size_t size, const char* filename = 0, int line = 0, JSObject* globalObject = 0);
 	void RunScript(const VfsPath& filename, JSObject* globalObject = 0);
+	void RunUCScript(const utf16string& script, const VfsPath& filename, JSObject* globalObject = 0);
 
 
 	jsval ExecuteScript(const CStrW& script, const CStrW& calledFrom = L"Console", JSObject* contextObject = NULL );
@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -18,6 +18,97 @@
 
 // (NativeWrapperDecls.h set up a lot of the macros we use here)
 
+// ScriptInterface_NativeConversion<T> converts the arguments and return values of wrapped
+// functions. The generic conversions are defined out of line (in ScriptConversions.cpp etc),
+// so the common primitive types (including entity IDs, which are u32) get inline fast paths
+// for values that already have the expected JS type. Anything else (in particular implicit
+// conversions, which should still warn) goes through the generic conversions.
+
+template <typename T>
+struct ScriptInterface_NativeConversion {
+	static bool FromJSVal(JSContext* cx, jsval v, T& out) {
+		return ScriptInterface::FromJSVal<T>(cx, v, out);
+	}
+
+	static jsval ToJSVal(JSContext* cx, const T& val) {
+		return ScriptInterface::ToJSVal<T>(cx, val);
+	}
+};
+
+// The fast paths below fall back to these, so declare the specialisations
+// before they're used (they're defined in ScriptConversions.cpp)
+#define DECLARE_CONVERSIONS(T) \
+	template <> bool ScriptInterface::FromJSVal<T>(JSContext* cx, jsval v, T& out); \
+	template <> jsval ScriptInterface::ToJSVal<T>(JSContext* cx, const T& val);
+DECLARE_CONVERSIONS(i32)
+DECLARE_CONVERSIONS(u32)
+DECLARE_CONVERSIONS(u16)
+DECLARE_CONVERSIONS(u8)
+DECLARE_CONVERSIONS(float)
+DECLARE_CONVERSIONS(double)
+DECLARE_CONVERSIONS(bool)
+#undef DECLARE_CONVERSIONS
+
+// (These match the ECMA integer conversions the generic ones do, for int values)
+#define INTEGER_CONVERSION(T) \
+	template <> \
+	struct ScriptInterface_NativeConversion<T> { \
+		static bool FromJSVal(JSContext* cx, jsval v, T& out) { \
+			if (JSVAL_IS_INT(v)) { \
+				out = (T)JSVAL_TO_INT(v); \
+				return true; \
+			} \
+			return ScriptInterface::FromJSVal<T>(cx, v, out); \
+		} \
+		static jsval ToJSVal(JSContext* cx, const T& val) { \
+			if (!std::numeric_limits<T>::is_signed && (u32)val > (u32)JSVAL_INT_MAX) \
+				return ScriptInterface::ToJSVal<T>(cx, val); /* needs a double */ \
+			return INT_TO_JSVAL((i32)val); \
+		} \
+	};
+INTEGER_CONVERSION(i32)
+INTEGER_CONVERSION(u32) // includes entity_id_t
+INTEGER_CONVERSION(u16)
+INTEGER_CONVERSION(u8)
+#undef INTEGER_CONVERSION
+
+#define FLOAT_CONVERSION(T) \
+	template <> \
+	struct ScriptInterface_NativeConversion<T> { \
+		static bool FromJSVal(JSContext* cx, jsval v, T& out) { \
+			if (JSVAL_IS_INT(v)) { \
+				out = (T)JSVAL_TO_INT(v); \
+				return true; \
+			} \
+			if (JSVAL_IS_DOUBLE(v)) { \
+				out = (T)JSVAL_TO_DOUBLE(v); \
+				return true; \
+			} \
+			return ScriptInterface::FromJSVal<T>(cx, v, out); \
+		} \
+		static jsval ToJSVal(JSContext* cx, const T& val) { \
+			return ScriptInterface::ToJSVal<T>(cx, val); \
+		} \
+	};
+FLOAT_CONVERSION(float)
+FLOAT_CONVERSION(double)
+#undef FLOAT_CONVERSION
+
+template <>
+struct ScriptInterface_NativeConversion<bool> {
+	static bool FromJSVal(JSContext* cx, jsval v, bool& out) {
+		if (JSVAL_IS_BOOLEAN(v)) {
+			out = (JSVAL_TO_BOOLEAN(v) ? true : false);
+			return true;
+		}
+		return ScriptInterface::FromJSVal<bool>(cx, v, out);
+	}
+
+	static jsval ToJSVal(JSContext* UNUSED(cx), const bool& val) {
+		return val ? JSVAL_TRUE : JSVAL_FALSE;
+	}
+};
+
 // ScriptInterface_NativeWrapper<T>::call(cx, rval, fptr, args...) will call fptr(cbdata, args...),
 // and if T != void then it will store the result in rval:
 
@@ -27,7 +118,7 @@ struct ScriptInterface_NativeWrapper {
 	#define OVERLOADS(z, i, data) \
 		template<TYPENAME_T0_HEAD(z,i)  typename F> \
 		static void call(JSContext* cx, jsval& rval, F fptr  T0_A0(z,i)) { \
-			rval = ScriptInterface::ToJSVal<R>(cx, fptr(ScriptInterface::GetCallbackData(cx)  A0_TAIL(z,i))); \
+			rval = ScriptInterface_NativeConversion<R>::ToJSVal(cx, fptr(ScriptInterface::GetCallbackData(cx)  A0_TAIL(z,i))); \
 		}
 
 	BOOST_PP_REPEAT(SCRIPT_INTERFACE_MAX_ARGS, OVERLOADS, ~)
@@ -53,7 +144,7 @@ struct ScriptInterface_NativeMethodWrapper {
 	#define OVERLOADS(z, i, data) \
 		template<TYPENAME_T0_HEAD(z,i)  typename F> \
 		static void call(JSContext* cx, jsval& rval, TC* c, F fptr  T0_A0(z,i)) { \
-			rval = ScriptInterface::ToJSVal<R>(cx, (c->*fptr)( A0(z,i) )); \
+			rval = ScriptInterface_NativeConversion<R>::ToJSVal(cx, (c->*fptr)( A0(z,i) )); \
 		}
 
 	BOOST_PP_REPEAT(SCRIPT_INTERFACE_MAX_ARGS, OVERLOADS, ~)
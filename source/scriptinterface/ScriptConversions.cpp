@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,6 +20,7 @@
 #include "ScriptInterface.h"
 
 #include "graphics/Entity.h"
+#include "lib/utf8.h"
 #include "ps/utf16string.h"
 #include "ps/CLogger.h"
 #include "ps/CStr.h"
@@ -150,6 +151,25 @@ template<> bool ScriptInterface::FromJSVal<std::string>(JSContext* cx, jsval v,
 	return true;
 }
 
+bool ScriptInterface::FromJSValUTF8(JSContext* cx, jsval v, std::string& out)
+{
+	WARN_IF_NOT(JSVAL_IS_STRING(v) || JSVAL_IS_NUMBER(v), v); // allow implicit number conversions
+	JSString* ret = JS_ValueToString(cx, v);
+	if (!ret)
+		FAIL("Argument must be convertible to a string");
+	size_t length;
+	const jschar* ch = JS_GetStringCharsAndLength(cx, ret, &length);
+	if (!ch)
+		FAIL("JS_GetStringsCharsAndLength failed"); // out of memory
+	out.resize(length*3);
+	if (length)
+	{
+		Status err; // replace invalid characters silently, like the wstring conversions do
+		out.resize(utf8_from_utf16(reinterpret_cast<const u16*>(ch), length, &out[0], &err));
+	}
+	return true;
+}
+
 template<> bool ScriptInterface::FromJSVal<Entity>(JSContext* cx, jsval v, Entity& out)
 {
 	JSObject* obj;
@@ -231,15 +251,39 @@ template<> jsval ScriptInterface::ToJSVal<CScriptValRooted>(JSContext* UNUSED(cx
 	return val.get();
 }
 
-template<> jsval ScriptInterface::ToJSVal<std::wstring>(JSContext* cx, const std::wstring& val)
+// Returns a string that takes ownership of chars (allocated with JS_malloc,
+// with room for a terminating 0 after length characters), to avoid copying
+// the converted string again
+static jsval AdoptUCString(JSContext* cx, jschar* chars, size_t length)
 {
-	utf16string utf16(val.begin(), val.end());
-	JSString* str = JS_NewUCStringCopyN(cx, reinterpret_cast<const jschar*> (utf16.c_str()), utf16.length());
+	chars[length] = 0;
+	JSString* str = JS_NewUCString(cx, chars, length);
 	if (str)
 		return STRING_TO_JSVAL(str);
+	JS_free(cx, chars);
 	return JSVAL_VOID;
 }
 
+template<> jsval ScriptInterface::ToJSVal<std::wstring>(JSContext* cx, const std::wstring& val)
+{
+	jschar* chars = (jschar*)JS_malloc(cx, (val.length()+1)*sizeof(jschar));
+	if (!chars)
+		return JSVAL_VOID;
+	std::copy(val.begin(), val.end(), chars);
+	return AdoptUCString(cx, chars, val.length());
+}
+
+jsval ScriptInterface::ToJSValUTF8(JSContext* cx, const std::string& val)
+{
+	// (every UTF-8 sequence decodes to a single UTF-16 code unit)
+	jschar* chars = (jschar*)JS_malloc(cx, (val.length()+1)*sizeof(jschar));
+	if (!chars)
+		return JSVAL_VOID;
+	Status err; // replace invalid characters silently, like the wstring conversions do
+	size_t length = utf16_from_utf8(val.data(), val.length(), reinterpret_cast<u16*>(chars), &err);
+	return AdoptUCString(cx, chars, length);
+}
+
 template<> jsval ScriptInterface::ToJSVal<Path>(JSContext* cx, const Path& val)
 {
 	return ToJSVal(cx, val.string());
@@ -314,6 +358,59 @@ template<typename T> static bool FromJSVal_vector(JSContext* cx, jsval v, std::v
 	return true;
 }
 
+// Numbers aren't GC things, so vectors of numbers can be converted into a temporary
+// buffer of jsvals (without rooting them) and copied into a new dense array in one go,
+// instead of setting each element separately
+template<typename T> static jsval ToJSVal_numberVector(JSContext* cx, const std::vector<T>& val)
+{
+	std::vector<jsval> elements(val.size());
+	for (size_t i = 0; i < val.size(); ++i)
+		elements[i] = ScriptInterface::ToJSVal<T>(cx, val[i]);
+	JSObject* obj = JS_NewArrayObject(cx, (jsint)elements.size(), elements.empty() ? NULL : &elements[0]);
+	if (!obj)
+		return JSVAL_VOID;
+	return OBJECT_TO_JSVAL(obj);
+}
+
+template<typename S, typename T> static void CopyTypedArray(const js::TypedArray* array, std::vector<T>& out)
+{
+	const S* data = static_cast<const S*>(array->data);
+	out.insert(out.end(), data, data + array->length);
+}
+
+// Typed arrays of integers can be copied directly from their buffer, instead of
+// reading and converting each element through the generic JS API
+template<typename T> static bool FromJSVal_numberVector(JSContext* cx, jsval v, std::vector<T>& out)
+{
+	if (JSVAL_IS_OBJECT(v) && !JSVAL_IS_NULL(v) && js_IsTypedArray(JSVAL_TO_OBJECT(v)))
+	{
+		const js::TypedArray* array = js::TypedArray::fromJSObject(JSVAL_TO_OBJECT(v));
+		switch (array->type)
+		{
+		case js::TypedArray::TYPE_INT8: CopyTypedArray<i8>(array, out); return true;
+		case js::TypedArray::TYPE_UINT8:
+		case js::TypedArray::TYPE_UINT8_CLAMPED: CopyTypedArray<u8>(array, out); return true;
+		case js::TypedArray::TYPE_INT16: CopyTypedArray<i16>(array, out); return true;
+		case js::TypedArray::TYPE_UINT16: CopyTypedArray<u16>(array, out); return true;
+		case js::TypedArray::TYPE_INT32: CopyTypedArray<i32>(array, out); return true;
+		case js::TypedArray::TYPE_UINT32: CopyTypedArray<u32>(array, out); return true;
+		case js::TypedArray::TYPE_FLOAT32:
+		case js::TypedArray::TYPE_FLOAT64:
+			// (floats can only be copied into floating-point vectors;
+			// converting them to integers needs the normal conversion rules)
+			if (std::numeric_limits<T>::is_integer)
+				break;
+			if (array->type == js::TypedArray::TYPE_FLOAT32)
+				CopyTypedArray<float>(array, out);
+			else
+				CopyTypedArray<double>(array, out);
+			return true;
+		default: break;
+		}
+	}
+	return FromJSVal_vector(cx, v, out);
+}
+
 // Instantiate various vector types:
 
 #define VECTOR(T) \
@@ -326,9 +423,21 @@ template<typename T> static bool FromJSVal_vector(JSContext* cx, jsval v, std::v
 		return FromJSVal_vector(cx, v, out); \
 	}
 
-VECTOR(int)
-VECTOR(u32)
-VECTOR(u16)
+#define NUMBER_VECTOR(T) \
+	template<> jsval ScriptInterface::ToJSVal<std::vector<T> >(JSContext* cx, const std::vector<T>& val) \
+	{ \
+		return ToJSVal_numberVector(cx, val); \
+	} \
+	template<> bool ScriptInterface::FromJSVal<std::vector<T> >(JSContext* cx, jsval v, std::vector<T>& out) \
+	{ \
+		return FromJSVal_numberVector(cx, v, out); \
+	}
+
+NUMBER_VECTOR(int)
+NUMBER_VECTOR(u32) // includes std::vector<entity_id_t>
+NUMBER_VECTOR(u16)
+NUMBER_VECTOR(u8)
+NUMBER_VECTOR(float)
 VECTOR(std::string)
 VECTOR(std::wstring)
 VECTOR(CScriptValRooted)
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -18,7 +18,7 @@
 #ifndef INCLUDED_SCRIPTEXTRAHEADERS
 #define INCLUDED_SCRIPTEXTRAHEADERS
 
-// Includes occasionally-used SpiderMonkey headers for typed arrays and debug API,
+// Includes occasionally-used SpiderMonkey headers for typed arrays, XDR and debug API,
 // with appropriate tweaks to fix warnings and build errors. (Most code should
 // just include ScriptTypes.h directly to get the standard jsapi.h.)
 
@@ -42,6 +42,7 @@
 
 #include "js/jstypedarray.h"
 #include "js/jsdbgapi.h"
+#include "js/jsxdrapi.h"
 
 #undef signbit
 
@@ -21,12 +21,19 @@
 #include "DebuggingServer.h"
 #include "ScriptStats.h"
 #include "AutoRooters.h"
+#include "ScriptExtraHeaders.h" // for XDR
 
 #include "lib/debug.h"
+#include "lib/timer.h"
 #include "lib/utf8.h"
+#include "lib/allocators/shared_ptr.h"
+#include "maths/MD5.h"
+#include "ps/CacheLoader.h"
 #include "ps/CLogger.h"
 #include "ps/Filesystem.h"
 #include "ps/Profile.h"
+#include "ps/Profiler2.h"
+#include "ps/ThreadUtil.h"
 #include "ps/utf16string.h"
 
 #include <cassert>
@@ -69,11 +76,14 @@ class ScriptRuntime
 {
 public:
 	ScriptRuntime(int runtimeSize) :
-		m_rooter(NULL), m_compartmentGlobal(NULL)
+		m_rooter(NULL), m_compartmentGlobal(NULL), m_GCStartTime(0.0)
 	{
 		m_rt = JS_NewRuntime(runtimeSize);
 		ENSURE(m_rt); // TODO: error handling
 
+		JS_SetRuntimePrivate(m_rt, this);
+		JS_SetGCCallbackRT(m_rt, jshook_gc);
+
 		if (g_ScriptProfilingEnabled)
 		{
 			// Profiler isn't thread-safe, so only enable this on the main thread
@@ -100,8 +110,49 @@ public:
 
 	JSObject* m_compartmentGlobal;
 
+	ScriptInterface::GCStats m_GCStats;
+	double m_GCStartTime;
+
 private:
 
+	static JSBool jshook_gc(JSContext* cx, JSGCStatus status)
+	{
+		ScriptRuntime* m = static_cast<ScriptRuntime*>(JS_GetRuntimePrivate(JS_GetRuntime(cx)));
+		ScriptInterface::GCStats& stats = m->m_GCStats;
+
+		// Runtimes may be used on threads that aren't known to the profiler
+		bool profile = g_Profiler2.IsCurrentThreadRegistered();
+
+		if (status == JSGC_BEGIN)
+		{
+			m->m_GCStartTime = timer_Time();
+			stats.bytesBeforeLastGC = JS_GetGCParameter(m->m_rt, JSGC_BYTES);
+
+			if (profile)
+			{
+				PROFILE2_COUNTER("script heap bytes", stats.bytesBeforeLastGC);
+				g_Profiler2.RecordRegionEnter("script gc");
+			}
+		}
+		else if (status == JSGC_END)
+		{
+			double t = timer_Time() - m->m_GCStartTime;
+			stats.lastTime = t;
+			stats.maxTime = std::max(stats.maxTime, t);
+			stats.totalTime += t;
+			stats.bytesAfterLastGC = JS_GetGCParameter(m->m_rt, JSGC_BYTES);
+
+			if (profile)
+			{
+				PROFILE2_ATTR("freed %u bytes", (unsigned)(stats.bytesBeforeLastGC - std::min(stats.bytesBeforeLastGC, stats.bytesAfterLastGC)));
+				g_Profiler2.RecordRegionLeave("script gc");
+				PROFILE2_COUNTER("script heap bytes", stats.bytesAfterLastGC);
+			}
+		}
+
+		return JS_TRUE;
+	}
+
 
 	static void* jshook_script(JSContext* UNUSED(cx), JSStackFrame* UNUSED(fp), JSBool before, JSBool* UNUSED(ok), void* closure)
 	{
@@ -912,12 +963,31 @@ bool ScriptInterface::FreezeObject(jsval obj, bool deep)
 		return JS_FreezeObject(m->m_cx, JSVAL_TO_OBJECT(obj)) ? true : false;
 }
 
+/**
+ * Convert UTF-8 source code straight to UTF-16 in a single pass (rather than
+ * via a wide string), surrounded by the given ASCII prefix and suffix.
+ */
+static utf16string ConvertScriptSource(const char* prefix, const std::string& code, const char* suffix)
+{
+	const size_t prefixLength = strlen(prefix);
+	const size_t suffixLength = strlen(suffix);
+
+	// (every UTF-8 sequence decodes to a single UTF-16 code unit)
+	utf16string ret(prefixLength + code.length() + suffixLength, 0);
+	std::copy(prefix, prefix + prefixLength, ret.begin());
+	size_t codeLength = 0;
+	if (!code.empty())
+		codeLength = utf16_from_utf8(code.data(), code.length(), &ret[prefixLength]);
+	std::copy(suffix, suffix + suffixLength, ret.begin() + prefixLength + codeLength);
+	ret.resize(prefixLength + codeLength + suffixLength);
+	return ret;
+}
+
 bool ScriptInterface::LoadScript(const VfsPath& filename, const std::string& code)
 {
 	// Compile the code in strict mode, to encourage better coding practices and
 	// to possibly help SpiderMonkey with optimisations
-	std::wstring codeStrict = L"\"use strict\";\n" + wstring_from_utf8(code);
-	utf16string codeUtf16(codeStrict.begin(), codeStrict.end());
+	utf16string codeUtf16 = ConvertScriptSource("\"use strict\";\n", code, "");
 	uintN lineNo = 0; // put the automatic 'use strict' on line 0, so the real code starts at line 1
 
 	JSFunction* func = JS_CompileUCFunction(m->m_cx, NULL, NULL, 0, NULL,
@@ -937,8 +1007,7 @@ bool ScriptInterface::LoadGlobalScript(const VfsPath& filename, const std::strin
 {
 	// Compile the code in strict mode, to encourage better coding practices and
 	// to possibly help SpiderMonkey with optimisations
-	std::wstring codeStrict = L"\"use strict\";\n" + wstring_from_utf8(code);
-	utf16string codeUtf16(codeStrict.begin(), codeStrict.end());
+	utf16string codeUtf16 = ConvertScriptSource("\"use strict\";\n", code, "");
 	uintN lineNo = 0; // put the automatic 'use strict' on line 0, so the real code starts at line 1
 
 	jsval rval;
@@ -949,7 +1018,17 @@ bool ScriptInterface::LoadGlobalScript(const VfsPath& filename, const std::strin
 	return ok ? true : false;
 }
 
+bool ScriptInterface::LoadScriptFile(const VfsPath& path)
+{
+	return LoadScriptFile_(path, false);
+}
+
 bool ScriptInterface::LoadGlobalScriptFile(const VfsPath& path)
+{
+	return LoadScriptFile_(path, true);
+}
+
+bool ScriptInterface::LoadScriptFile_(const VfsPath& path, bool globalScope)
 {
 	if (!VfsFileExists(path))
 	{
@@ -967,20 +1046,113 @@ bool ScriptInterface::LoadGlobalScriptFile(const VfsPath& path)
 		return false;
 	}
 
-	std::wstring code = wstring_from_utf8(file.DecodeUTF8()); // assume it's UTF-8
+	JSObject* scriptObj = CompileScriptFile(path, file.DecodeUTF8(), globalScope); // assume it's UTF-8
+	if (!scriptObj)
+		return false;
+
+	jsval rval;
+	JSBool ok = JS_ExecuteScript(m->m_cx, m->m_glob, scriptObj, &rval);
+
+	return ok ? true : false;
+}
+
+// Scripts may be loaded by several threads (e.g. the AI players) at once,
+// so only let one at a time read or write the cache files
+static CMutex g_ScriptCacheMutex;
+
+JSObject* ScriptInterface::CompileScriptFile(const VfsPath& path, const std::string& code, bool globalScope)
+{
+	// Arbitrary version number - change this if we change how the code is compiled
+	// and need to invalidate old users' caches (the XDR bytecode version is
+	// included in the hash, so SpiderMonkey upgrades are handled automatically)
+	u32 version = 1;
+
+	MD5 hash;
+	hash.Update((const u8*)code.data(), code.size());
+	u32 bytecodeVersion = JSXDR_BYTECODE_VERSION;
+	hash.Update((const u8*)&bytecodeVersion, sizeof(bytecodeVersion));
+	u8 scope = globalScope ? 1 : 0;
+	hash.Update(&scope, sizeof(scope));
+
+	CCacheLoader cacheLoader(g_VFS, L".jsc");
+	VfsPath cachePath;
+	Status cacheRet;
+
+	{
+		CScopeLock lock(g_ScriptCacheMutex);
+
+		cacheRet = cacheLoader.TryLoadingCached(path, hash, version, cachePath);
+		if (cacheRet == INFO::OK)
+		{
+			shared_ptr<u8> buf;
+			size_t size;
+			if (g_VFS->LoadFile(cachePath, buf, size) >= 0 && size > 0)
+			{
+				JSXDRState* xdr = JS_XDRNewMem(m->m_cx, JSXDR_DECODE);
+				if (xdr)
+				{
+					JS_XDRMemSetData(xdr, buf.get(), (uint32)size);
+					JSObject* scriptObj = NULL;
+					JSBool ok = JS_XDRScriptObject(xdr, &scriptObj);
+					// Stop the XDR state from freeing our buffer
+					JS_XDRMemSetData(xdr, NULL, 0);
+					JS_XDRDestroy(xdr);
+
+					if (ok && scriptObj)
+						return scriptObj;
+				}
+			}
+			// If this fails then we'll continue and recreate the loose cache -
+			// e.g. the file might have been only partially written
+			JS_ClearPendingException(m->m_cx);
+		}
+	}
 
 	// Compile the code in strict mode, to encourage better coding practices and
-	// to possibly help SpiderMonkey with optimisations
-	std::wstring codeStrict = L"\"use strict\";\n" + code;
-	utf16string codeUtf16(codeStrict.begin(), codeStrict.end());
-	uintN lineNo = 0; // put the automatic 'use strict' on line 0, so the real code starts at line 1
+	// to possibly help SpiderMonkey with optimisations.
+	// Put the automatic 'use strict' (and the function wrapper) on line 0,
+	// so the real code starts at line 1
+	utf16string codeUtf16;
+	if (globalScope)
+		codeUtf16 = ConvertScriptSource("\"use strict\";\n", code, "");
+	else
+		codeUtf16 = ConvertScriptSource("\"use strict\";(function() {\n", code, "\n}).call(this);");
+	uintN lineNo = 0;
 
-	jsval rval;
-	JSBool ok = JS_EvaluateUCScript(m->m_cx, m->m_glob,
+	JSObject* scriptObj = JS_CompileUCScript(m->m_cx, m->m_glob,
 			reinterpret_cast<const jschar*> (codeUtf16.c_str()), (uintN)(codeUtf16.length()),
-			utf8_from_wstring(path.string()).c_str(), lineNo, &rval);
+			utf8_from_wstring(path.string()).c_str(), lineNo);
 
-	return ok ? true : false;
+	if (!scriptObj)
+		return NULL;
+
+	// Save the bytecode, so it can be loaded quickly next time
+	if (cacheRet >= 0)
+	{
+		JSXDRState* xdr = JS_XDRNewMem(m->m_cx, JSXDR_ENCODE);
+		if (xdr)
+		{
+			if (JS_XDRScriptObject(xdr, &scriptObj))
+			{
+				uint32 size;
+				void* data = JS_XDRMemGetData(xdr, &size);
+
+				shared_ptr<u8> buf;
+				AllocateAligned(buf, size, maxSectorSize);
+				memcpy(buf.get(), data, size);
+
+				CScopeLock lock(g_ScriptCacheMutex);
+				g_VFS->CreateFile(cachePath, buf, size);
+			}
+			else
+			{
+				JS_ClearPendingException(m->m_cx);
+			}
+			JS_XDRDestroy(xdr);
+		}
+	}
+
+	return scriptObj;
 }
 
 
@@ -1008,8 +1180,7 @@ bool ScriptInterface::Eval_(const wchar_t* code, jsval& rval)
 
 CScriptValRooted ScriptInterface::ParseJSON(const std::string& string_utf8)
 {
-	std::wstring attrsW = wstring_from_utf8(string_utf8);
-	utf16string string(attrsW.begin(), attrsW.end());
+	utf16string string = ConvertScriptSource("", string_utf8, "");
 
 	jsval vp;
 	JSONParser* parser = JS_BeginJSONParse(m->m_cx, &vp);
@@ -1061,11 +1232,13 @@ struct Stringifier
 {
 	static JSBool callback(const jschar* buf, uint32 len, void* data)
 	{
-		utf16string str(buf, buf+len);
-		std::wstring strw(str.begin(), str.end());
+		if (!len)
+			return JS_TRUE;
 
+		std::string str(len*3, '\0');
 		Status err; // ignore Unicode errors
-		static_cast<Stringifier*>(data)->stream << utf8_from_wstring(strw, &err);
+		str.resize(utf8_from_utf16(reinterpret_cast<const u16*>(buf), len, &str[0], &err));
+		static_cast<Stringifier*>(data)->stream << str;
 		return JS_TRUE;
 	}
 
@@ -1179,6 +1352,40 @@ void ScriptInterface::MaybeGC()
 	JS_MaybeGC(m->m_cx);
 }
 
+// Heap growth (relative to the size after the last GC, and absolute) needed
+// before IdleGC will bother running a GC
+static const double IDLE_GC_MIN_GROWTH_RATIO = 0.25;
+static const u32 IDLE_GC_MIN_GROWTH_BYTES = 1024*1024;
+
+bool ScriptInterface::IdleGC(double timeBudget)
+{
+	GCStats& stats = m->m_runtime->m_GCStats;
+	u32 bytes = JS_GetGCParameter(GetRuntime(), JSGC_BYTES);
+
+	u32 growth = bytes > stats.bytesAfterLastGC ? bytes - stats.bytesAfterLastGC : 0;
+	if (growth < IDLE_GC_MIN_GROWTH_BYTES || growth < stats.bytesAfterLastGC * IDLE_GC_MIN_GROWTH_RATIO)
+		return false;
+
+	// The GC time is roughly proportional to the heap size, so estimate it
+	// from the previous GC
+	if (stats.bytesBeforeLastGC)
+	{
+		double estimate = stats.lastTime * bytes / stats.bytesBeforeLastGC;
+		if (estimate > timeBudget)
+			return false;
+	}
+
+	PROFILE3("idle GC");
+	JS_GC(m->m_cx);
+	++stats.idleCount;
+	return true;
+}
+
+ScriptInterface::GCStats ScriptInterface::GetGCStats() const
+{
+	return m->m_runtime->m_GCStats;
+}
+
 class ValueCloner
 {
 public:
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -170,6 +170,18 @@ public:
 	template<typename T0, typename T1, typename T2, typename T3, typename R>
 	bool CallFunction(jsval val, const char* name, const T0& a0, const T1& a1, const T2& a2, const T3& a3, R& ret);
 
+	/**
+	 * Call the named property on the given object, with return type R and 5 arguments
+	 */
+	template<typename T0, typename T1, typename T2, typename T3, typename T4, typename R>
+	bool CallFunction(jsval val, const char* name, const T0& a0, const T1& a1, const T2& a2, const T3& a3, const T4& a4, R& ret);
+
+	/**
+	 * Call the named property on the given object, with return type R and 6 arguments
+	 */
+	template<typename T0, typename T1, typename T2, typename T3, typename T4, typename T5, typename R>
+	bool CallFunction(jsval val, const char* name, const T0& a0, const T1& a1, const T2& a2, const T3& a3, const T4& a4, const T5& a5, R& ret);
+
 	jsval GetGlobalObject();
 
 	JSClass* GetGlobalClass();
@@ -263,8 +275,16 @@ public:
 	 */
 	bool LoadGlobalScript(const VfsPath& filename, const std::string& code);
 
+	/**
+	 * Load and execute the given script file in a new function scope.
+	 * The compiled bytecode is cached (see CompileScriptFile).
+	 * @return true on successful compilation and execution; false otherwise
+	 */
+	bool LoadScriptFile(const VfsPath& path);
+
 	/**
 	 * Load and execute the given script in the global scope.
+	 * The compiled bytecode is cached (see CompileScriptFile).
 	 * @return true on successful compilation and execution; false otherwise
 	 */
 	bool LoadGlobalScriptFile(const VfsPath& path);
@@ -288,6 +308,14 @@ public:
 	 */
 	template<typename T> static jsval ToJSVal(JSContext* cx, T const& val);
 
+	/**
+	 * Convert between UTF-8 strings and JS strings directly, without going
+	 * through wide strings. (The std::string specialisations of FromJSVal and
+	 * ToJSVal treat each byte as a separate character instead.)
+	 */
+	static bool FromJSValUTF8(JSContext* cx, jsval val, std::string& ret);
+	static jsval ToJSValUTF8(JSContext* cx, const std::string& val);
+
 	AutoGCRooter* ReplaceAutoGCRooter(AutoGCRooter* rooter);
 
 	/**
@@ -300,6 +328,37 @@ public:
 	 */
 	void MaybeGC();
 
+	/**
+	 * Runs a full GC if the heap has grown enough since the last GC, and the
+	 * GC is estimated (from the previous one) to take no more than timeBudget seconds.
+	 * This is intended to be called when there's some spare time (e.g. in frames
+	 * without a simulation turn), so that GCs are less likely to be triggered
+	 * in the middle of expensive script calls.
+	 * @return true if a GC was run
+	 */
+	bool IdleGC(double timeBudget);
+
+	/**
+	 * Statistics about the GCs in this ScriptInterface's runtime.
+	 */
+	struct GCStats
+	{
+		GCStats() :
+			totalTime(0.0), lastTime(0.0), maxTime(0.0), idleCount(0),
+			bytesBeforeLastGC(0), bytesAfterLastGC(0)
+		{
+		}
+
+		double totalTime; // seconds
+		double lastTime; // seconds
+		double maxTime; // seconds
+		u32 idleCount; // number of GCs run by IdleGC
+		u32 bytesBeforeLastGC;
+		u32 bytesAfterLastGC;
+	};
+
+	GCStats GetGCStats() const;
+
 	/**
 	 * Structured clones are a way to serialize 'simple' JS values into a buffer
 	 * that can safely be passed between contexts and runtimes and threads.
@@ -325,6 +384,16 @@ private:
 	bool CallFunction_(jsval val, const char* name, size_t argc, jsval* argv, jsval& ret);
 	bool Eval_(const char* code, jsval& ret);
 	bool Eval_(const wchar_t* code, jsval& ret);
+	bool LoadScriptFile_(const VfsPath& path, bool globalScope);
+
+	/**
+	 * Compiles the given file's code into a script object. The XDR-encoded bytecode
+	 * is saved in the VFS cache (via CCacheLoader, keyed by the source code and the
+	 * bytecode format), so later loads of the same file can skip the compilation.
+	 * @param globalScope if false, the code is wrapped in a function (like LoadScript)
+	 * @return NULL on failure
+	 */
+	JSObject* CompileScriptFile(const VfsPath& path, const std::string& code, bool globalScope);
 	bool SetGlobal_(const char* name, jsval value, bool replace);
 	bool SetProperty_(jsval obj, const char* name, jsval value, bool readonly, bool enumerate);
 	bool SetPropertyInt_(jsval obj, int name, jsval value, bool readonly, bool enumerate);
@@ -452,6 +521,39 @@ bool ScriptInterface::CallFunction(jsval val, const char* name, const T0& a0, co
 	return FromJSVal(GetContext(), jsRet, ret);
 }
 
+template<typename T0, typename T1, typename T2, typename T3, typename T4, typename R>
+bool ScriptInterface::CallFunction(jsval val, const char* name, const T0& a0, const T1& a1, const T2& a2, const T3& a3, const T4& a4, R& ret)
+{
+	jsval jsRet;
+	jsval argv[5];
+	argv[0] = ToJSVal(GetContext(), a0);
+	argv[1] = ToJSVal(GetContext(), a1);
+	argv[2] = ToJSVal(GetContext(), a2);
+	argv[3] = ToJSVal(GetContext(), a3);
+	argv[4] = ToJSVal(GetContext(), a4);
+	bool ok = CallFunction_(val, name, 5, argv, jsRet);
+	if (!ok)
+		return false;
+	return FromJSVal(GetContext(), jsRet, ret);
+}
+
+template<typename T0, typename T1, typename T2, typename T3, typename T4, typename T5, typename R>
+bool ScriptInterface::CallFunction(jsval val, const char* name, const T0& a0, const T1& a1, const T2& a2, const T3& a3, const T4& a4, const T5& a5, R& ret)
+{
+	jsval jsRet;
+	jsval argv[6];
+	argv[0] = ToJSVal(GetContext(), a0);
+	argv[1] = ToJSVal(GetContext(), a1);
+	argv[2] = ToJSVal(GetContext(), a2);
+	argv[3] = ToJSVal(GetContext(), a3);
+	argv[4] = ToJSVal(GetContext(), a4);
+	argv[5] = ToJSVal(GetContext(), a5);
+	bool ok = CallFunction_(val, name, 6, argv, jsRet);
+	if (!ok)
+		return false;
+	return FromJSVal(GetContext(), jsRet, ret);
+}
+
 template<typename T>
 bool ScriptInterface::SetGlobal(const char* name, const T& value, bool replace)
 {
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -23,6 +23,8 @@
 
 #include "js/jsapi.h"
 
+#include <set>
+
 CScriptStatsTable* g_ScriptStatsTable;
 
 enum
@@ -31,6 +33,10 @@ enum
 	Row_MaxMallocBytes,
 	Row_Bytes,
 	Row_NumberGC,
+	Row_NumberIdleGC,
+	Row_GCTotalTime,
+	Row_GCLastTime,
+	Row_GCMaxTime,
 	NumberRows
 };
 
@@ -54,6 +60,19 @@ void CScriptStatsTable::Remove(const ScriptInterface* scriptInterface)
 	}
 }
 
+size_t CScriptStatsTable::GetAllocatedBytes()
+{
+	std::set<JSRuntime*> runtimes;
+	size_t bytes = 0;
+	for (size_t i = 0; i < m_ScriptInterfaces.size(); ++i)
+	{
+		JSRuntime* rt = m_ScriptInterfaces[i].first->GetRuntime();
+		if (runtimes.insert(rt).second)
+			bytes += JS_GetGCParameter(rt, JSGC_BYTES);
+	}
+	return bytes;
+}
+
 CStr CScriptStatsTable::GetName()
 {
 	return "script";
@@ -110,6 +129,30 @@ CStr CScriptStatsTable::GetCellText(size_t row, size_t col)
 		uint32_t n = JS_GetGCParameter(m_ScriptInterfaces.at(col-1).first->GetRuntime(), JSGC_NUMBER);
 		return CStr::FromUInt(n);
 	}
+	case Row_NumberIdleGC:
+	{
+		if (col == 0)
+			return "number of idle GCs";
+		return CStr::FromUInt(m_ScriptInterfaces.at(col-1).first->GetGCStats().idleCount);
+	}
+	case Row_GCTotalTime:
+	{
+		if (col == 0)
+			return "total GC time (ms)";
+		return CStr::FromDouble(m_ScriptInterfaces.at(col-1).first->GetGCStats().totalTime * 1000.0);
+	}
+	case Row_GCLastTime:
+	{
+		if (col == 0)
+			return "last GC time (ms)";
+		return CStr::FromDouble(m_ScriptInterfaces.at(col-1).first->GetGCStats().lastTime * 1000.0);
+	}
+	case Row_GCMaxTime:
+	{
+		if (col == 0)
+			return "max GC time (ms)";
+		return CStr::FromDouble(m_ScriptInterfaces.at(col-1).first->GetGCStats().maxTime * 1000.0);
+	}
 	default:
 		return "???";
 	}
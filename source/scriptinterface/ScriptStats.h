@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -31,6 +31,12 @@ public:
 	void Add(const ScriptInterface* scriptInterface, const std::string& title);
 	void Remove(const ScriptInterface* scriptInterface);
 
+	/**
+	 * Returns the total size of the heaps of all the script runtimes
+	 * (counting runtimes shared by several script interfaces once).
+	 */
+	size_t GetAllocatedBytes();
+
 	virtual CStr GetName();
 	virtual CStr GetTitle();
 	virtual size_t GetNumberRows();
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -152,7 +152,51 @@ public:
 		TS_ASSERT(isnan(f));
 	}
 
-	// TODO: test vectors
+	void test_vectors()
+	{
+		std::vector<u32> v1;
+		roundtrip<std::vector<u32> >(v1, "[]");
+		v1.push_back(1);
+		v1.push_back(1073741823);
+		v1.push_back(2);
+		roundtrip<std::vector<u32> >(v1, "[1, 1073741823, 2]");
+
+		std::vector<int> v2;
+		v2.push_back(-1);
+		v2.push_back(3);
+		roundtrip<std::vector<int> >(v2, "[-1, 3]");
+
+		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
+		JSContext* cx = script.GetContext();
+
+		// The arrays should be normal dense arrays
+		CScriptVal arr = ScriptInterface::ToJSVal(cx, v1);
+		CScriptVal mapped;
+		TS_ASSERT(script.Eval("(function(a) { return a.map(function(x) { return x+1; }).join(); })", mapped));
+		jsval rval;
+		jsval argv[] = { arr.get() };
+		TS_ASSERT(JS_CallFunctionValue(cx, NULL, mapped.get(), 1, argv, &rval));
+		std::string str;
+		TS_ASSERT(ScriptInterface::FromJSVal(cx, rval, str));
+		TS_ASSERT_STR_EQUALS(str, "2,1073741824,3");
+
+		// Typed arrays can be converted to vectors too
+		CScriptVal typed;
+		TS_ASSERT(script.Eval("var a = new Uint32Array(3); a[0] = 5; a[1] = 4000000000; a[2] = 7; a", typed));
+		std::vector<u32> v3;
+		TS_ASSERT(ScriptInterface::FromJSVal(cx, typed.get(), v3));
+		TS_ASSERT_EQUALS(v3.size(), (size_t)3);
+		TS_ASSERT_EQUALS(v3[0], 5u);
+		TS_ASSERT_EQUALS(v3[1], 4000000000u);
+		TS_ASSERT_EQUALS(v3[2], 7u);
+
+		TS_ASSERT(script.Eval("var a = new Int16Array(2); a[0] = -5; a[1] = 6; a", typed));
+		std::vector<int> v4;
+		TS_ASSERT(ScriptInterface::FromJSVal(cx, typed.get(), v4));
+		TS_ASSERT_EQUALS(v4.size(), (size_t)2);
+		TS_ASSERT_EQUALS(v4[0], -5);
+		TS_ASSERT_EQUALS(v4[1], 6);
+	}
 
 	void test_fixed()
 	{
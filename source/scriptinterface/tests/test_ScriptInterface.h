@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -19,12 +19,28 @@
 
 #include "scriptinterface/ScriptInterface.h"
 
+#include "lib/timer.h"
 #include "ps/CLogger.h"
 
 #include <boost/random/linear_congruential.hpp>
 
 class TestScriptInterface : public CxxTest::TestSuite
 {
+	static u32 NativeAdd(void* UNUSED(cbdata), u32 a, i32 b)
+	{
+		return a + b;
+	}
+
+	static double NativeScale(void* UNUSED(cbdata), double x, float y, bool negate)
+	{
+		return negate ? -x*y : x*y;
+	}
+
+	static u8 NativeLowByte(void* UNUSED(cbdata), u16 x)
+	{
+		return (u8)x;
+	}
+
 public:
 	void test_loadscript_basic()
 	{
@@ -140,4 +156,73 @@ public:
 		val = script.ParseJSON(stringified);
 		TS_ASSERT_WSTR_EQUALS(script.ToString(val.get()), L"({x:1, z:[2, \"3\\u263A\\uFFFD\"], y:true})");
 	}
+
+	void test_native_conversions()
+	{
+		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
+		script.RegisterFunction<u32, u32, i32, NativeAdd>("NativeAdd");
+		script.RegisterFunction<double, double, float, bool, NativeScale>("NativeScale");
+		script.RegisterFunction<u8, u16, NativeLowByte>("NativeLowByte");
+
+		u32 u;
+		TS_ASSERT(script.Eval("NativeAdd(1, 2)", u));
+		TS_ASSERT_EQUALS(u, 3u);
+		// Integers wrap around like the ECMA conversions
+		TS_ASSERT(script.Eval("NativeAdd(-1, 0)", u));
+		TS_ASSERT_EQUALS(u, 0xFFFFFFFFu);
+		// Returns that don't fit in an int are doubles
+		double d;
+		TS_ASSERT(script.Eval("NativeAdd(0x7FFFFFFF, 1)", d));
+		TS_ASSERT_EQUALS(d, 2147483648.0);
+		// Doubles go through the generic conversion
+		TS_ASSERT(script.Eval("NativeAdd(4294967295.0, 0)", u));
+		TS_ASSERT_EQUALS(u, 0xFFFFFFFFu);
+
+		TS_ASSERT(script.Eval("NativeScale(1.5, 2, false)", d));
+		TS_ASSERT_EQUALS(d, 3.0);
+		TS_ASSERT(script.Eval("NativeScale(3, 0.5, true)", d));
+		TS_ASSERT_EQUALS(d, -1.5);
+
+		int i;
+		TS_ASSERT(script.Eval("NativeLowByte(0x1234)", i));
+		TS_ASSERT_EQUALS(i, 0x34);
+		TS_ASSERT(script.Eval("NativeLowByte(-1)", i));
+		TS_ASSERT_EQUALS(i, 0xFF);
+	}
+
+	void test_native_call_performance_DISABLED()
+	{
+		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
+		script.RegisterFunction<u32, u32, i32, NativeAdd>("NativeAdd");
+		script.RegisterFunction<double, double, float, bool, NativeScale>("NativeScale");
+
+		const int n = 1000000;
+		double t = timer_Time();
+		TS_ASSERT(script.Eval("var x = 0; for (var i = 0; i < 1000000; ++i) x = NativeAdd(i, 1);"));
+		double tInt = timer_Time() - t;
+
+		t = timer_Time();
+		TS_ASSERT(script.Eval("var y = 0; for (var i = 0; i < 1000000; ++i) y = NativeScale(i, 0.5, false);"));
+		double tDouble = timer_Time() - t;
+
+		printf("\nNative calls: ints %f us, doubles %f us per call\n", tInt * 1e6 / n, tDouble * 1e6 / n);
+	}
+
+	void test_idle_gc()
+	{
+		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
+
+		// Generate enough garbage for IdleGC to think it's worth collecting
+		TS_ASSERT(script.Eval("for (var i = 0; i < 100000; ++i) ({ x: [i, i+1, i+2] }); var x = 1;"));
+
+		TS_ASSERT(script.IdleGC(1000.0));
+		ScriptInterface::GCStats stats = script.GetGCStats();
+		TS_ASSERT_EQUALS(stats.idleCount, 1u);
+		TS_ASSERT_LESS_THAN(stats.bytesAfterLastGC, stats.bytesBeforeLastGC);
+		TS_ASSERT_LESS_THAN_EQUALS(stats.lastTime, stats.totalTime);
+
+		// Nothing more to collect
+		TS_ASSERT(!script.IdleGC(1000.0));
+		TS_ASSERT_EQUALS(script.GetGCStats().idleCount, 1u);
+	}
 };
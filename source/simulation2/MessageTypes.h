@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -34,6 +34,10 @@
 	virtual jsval ToJSVal(ScriptInterface& scriptInterface) const; \
 	static CMessage* FromJSVal(ScriptInterface&, jsval val);
 
+// For the message types that are sent very frequently to scripts
+#define REUSABLE_MESSAGE_IMPL() \
+	virtual bool UpdateJSVal(ScriptInterface& scriptInterface, jsval val) const;
+
 class SceneCollector;
 class CFrustum;
 
@@ -58,6 +62,7 @@ class CMessageUpdate : public CMessage
 {
 public:
 	DEFAULT_MESSAGE_IMPL(Update)
+	REUSABLE_MESSAGE_IMPL()
 
 	CMessageUpdate(fixed turnLength) :
 		turnLength(turnLength)
@@ -75,6 +80,7 @@ class CMessageUpdate_MotionFormation : public CMessage
 {
 public:
 	DEFAULT_MESSAGE_IMPL(Update_MotionFormation)
+	REUSABLE_MESSAGE_IMPL()
 
 	CMessageUpdate_MotionFormation(fixed turnLength) :
 		turnLength(turnLength)
@@ -91,6 +97,7 @@ class CMessageUpdate_MotionUnit : public CMessage
 {
 public:
 	DEFAULT_MESSAGE_IMPL(Update_MotionUnit)
+	REUSABLE_MESSAGE_IMPL()
 
 	CMessageUpdate_MotionUnit(fixed turnLength) :
 		turnLength(turnLength)
@@ -107,6 +114,7 @@ class CMessageUpdate_Final : public CMessage
 {
 public:
 	DEFAULT_MESSAGE_IMPL(Update_Final)
+	REUSABLE_MESSAGE_IMPL()
 
 	CMessageUpdate_Final(fixed turnLength) :
 		turnLength(turnLength)
@@ -123,6 +131,7 @@ class CMessageInterpolate : public CMessage
 {
 public:
 	DEFAULT_MESSAGE_IMPL(Interpolate)
+	REUSABLE_MESSAGE_IMPL()
 
 	CMessageInterpolate(float deltaSimTime, float offset, float deltaRealTime) :
 		deltaSimTime(deltaSimTime), offset(offset), deltaRealTime(deltaRealTime)
@@ -138,6 +147,33 @@ public:
 	float deltaRealTime;
 };
 
+/**
+ * Sent after CMessageInterpolate, for the parts of interpolation that don't depend on
+ * any other components (e.g. computing a model's bone matrices).
+ * This is sent with CComponentManager::BroadcastMessageParallel, so HandleMessage
+ * will be called concurrently from several threads: components must only modify
+ * their own state, and must not call anything that isn't thread-safe (including
+ * other components, the old profiler and the script interface).
+ * Only native components may subscribe to this, and it isn't sent to global subscribers.
+ */
+class CMessageInterpolateParallel : public CMessage
+{
+public:
+	DEFAULT_MESSAGE_IMPL(InterpolateParallel)
+
+	CMessageInterpolateParallel(float deltaSimTime, float offset, float deltaRealTime) :
+		deltaSimTime(deltaSimTime), offset(offset), deltaRealTime(deltaRealTime)
+	{
+	}
+
+	/// Same as CMessageInterpolate::deltaSimTime.
+	float deltaSimTime;
+	/// Same as CMessageInterpolate::offset.
+	float offset;
+	/// Same as CMessageInterpolate::deltaRealTime.
+	float deltaRealTime;
+};
+
 /**
  * Add renderable objects to the scene collector.
  * Called after CMessageInterpolate.
@@ -225,6 +261,7 @@ class CMessageOwnershipChanged : public CMessage
 {
 public:
 	DEFAULT_MESSAGE_IMPL(OwnershipChanged)
+	REUSABLE_MESSAGE_IMPL()
 
 	CMessageOwnershipChanged(entity_id_t entity, player_id_t from, player_id_t to) :
 		entity(entity), from(from), to(to)
@@ -246,6 +283,7 @@ class CMessagePositionChanged : public CMessage
 {
 public:
 	DEFAULT_MESSAGE_IMPL(PositionChanged)
+	REUSABLE_MESSAGE_IMPL()
 
 	CMessagePositionChanged(entity_id_t entity, bool inWorld, entity_pos_t x, entity_pos_t z, entity_angle_t a) :
 		entity(entity), inWorld(inWorld), x(x), z(z), a(a)
@@ -258,6 +296,39 @@ public:
 	entity_angle_t a;
 };
 
+/**
+ * Sent by CComponentManager::FlushPositionChanges, with the latest position of
+ * every (non-local) entity that has moved since the previous flush.
+ * Each entity appears at most once, in the order it first moved, so components that
+ * only care about the final position can apply all the changes in one go instead
+ * of handling every individual MT_PositionChanged.
+ *
+ * This is only an optimisation for native components; scripts should use MT_PositionChanged.
+ */
+class CMessagePositionChangedBatch : public CMessage
+{
+public:
+	DEFAULT_MESSAGE_IMPL(PositionChangedBatch)
+
+	/**
+	 * Same meaning as the fields of CMessagePositionChanged.
+	 */
+	struct Change
+	{
+		entity_id_t entity;
+		bool inWorld;
+		entity_pos_t x, z;
+		entity_angle_t a;
+	};
+
+	CMessagePositionChangedBatch(const std::vector<Change>& changes) :
+		changes(changes)
+	{
+	}
+
+	const std::vector<Change>& changes;
+};
+
 /**
  * Sent by CCmpUnitMotion during Update, whenever the motion status has changed
  * since the previous update.
@@ -266,6 +337,7 @@ class CMessageMotionChanged : public CMessage
 {
 public:
 	DEFAULT_MESSAGE_IMPL(MotionChanged)
+	REUSABLE_MESSAGE_IMPL()
 
 	CMessageMotionChanged(bool starting, bool error) :
 		starting(starting), error(error)
@@ -313,6 +385,7 @@ class CMessageRangeUpdate : public CMessage
 {
 public:
 	DEFAULT_MESSAGE_IMPL(RangeUpdate)
+	REUSABLE_MESSAGE_IMPL()
 
 	CMessageRangeUpdate(u32 tag, const std::vector<entity_id_t>& added, const std::vector<entity_id_t>& removed) :
 		tag(tag), added(added), removed(removed)
@@ -33,6 +33,7 @@
 #include "lib/file/vfs/vfs_util.h"
 #include "maths/MathUtil.h"
 #include "ps/CLogger.h"
+#include "ps/FrameArena.h"
 #include "ps/ConfigDB.h"
 #include "ps/Filesystem.h"
 #include "ps/Loader.h"
@@ -107,8 +108,11 @@ public:
 		componentManager.AddComponent(SYSTEM_ENTITY, CID_ProjectileManager, noParam);
 		componentManager.AddComponent(SYSTEM_ENTITY, CID_RangeManager, noParam);
 		componentManager.AddComponent(SYSTEM_ENTITY, CID_SoundManager, noParam);
+		componentManager.AddComponent(SYSTEM_ENTITY, CID_TechnologyModificationCache, noParam);
 		componentManager.AddComponent(SYSTEM_ENTITY, CID_Terrain, noParam);
 		componentManager.AddComponent(SYSTEM_ENTITY, CID_TerritoryManager, noParam);
+		componentManager.AddComponent(SYSTEM_ENTITY, CID_Timer, noParam);
+		componentManager.AddComponent(SYSTEM_ENTITY, CID_UnitRenderer, noParam);
 		componentManager.AddComponent(SYSTEM_ENTITY, CID_WaterManager, noParam);
 
 		// Add scripted system components:
@@ -126,7 +130,6 @@ public:
 			LOAD_SCRIPTED_COMPONENT("GuiInterface");
 			LOAD_SCRIPTED_COMPONENT("PlayerManager");
 			LOAD_SCRIPTED_COMPONENT("TechnologyTemplateManager");
-			LOAD_SCRIPTED_COMPONENT("Timer");
 
 #undef LOAD_SCRIPTED_COMPONENT
 
@@ -142,9 +145,17 @@ public:
 	static bool LoadScripts(CComponentManager& componentManager, std::set<VfsPath>* loadedScripts, const VfsPath& path);
 	Status ReloadChangedFile(const VfsPath& path);
 
-	static Status ReloadChangedFileCB(void* param, const VfsPath& path)
+	static Status ReloadChangedFileCB(void* param, const std::vector<VfsPath>& paths)
 	{
-		return static_cast<CSimulation2Impl*>(param)->ReloadChangedFile(path);
+		// (keep going after errors, so one broken script doesn't prevent reloading the others)
+		Status ret = INFO::OK;
+		for (size_t i = 0; i < paths.size(); ++i)
+		{
+			Status err = static_cast<CSimulation2Impl*>(param)->ReloadChangedFile(paths[i]);
+			if (err < 0)
+				ret = err;
+		}
+		return ret;
 	}
 
 	int ProgressiveLoad();
@@ -445,9 +456,9 @@ void CSimulation2Impl::Update(int turnLength, const std::vector<SimulationComman
 //	if (m_TurnNumber == 0)
 //		m_ComponentManager.GetScriptInterface().DumpHeap();
 
-	// Run the GC occasionally
-	// (TODO: we ought to schedule this for a frame where we're not
-	// running the sim update, to spread the load)
+	// Run the GC occasionally, if it's needed
+	// (Most GCs should happen between turns, in CGame::Update's IdleGC;
+	// this is a fallback for when there's no spare time)
 	if (m_TurnNumber % 10 == 0)
 		m_ComponentManager.GetScriptInterface().MaybeGC();
 
@@ -516,8 +527,14 @@ void CSimulation2Impl::UpdateComponents(CSimContext& simContext, fixed turnLengt
 	if (cmpPathfinder)
 		cmpPathfinder->ProcessSameTurnMoves();
 
+	// Deliver the remaining batched position changes, so none are left pending between turns
+	componentManager.FlushPositionChanges();
+
 	// Clean up any entities destroyed during the simulation update
 	componentManager.FlushDestroyedComponents();
+
+	// Nothing that was allocated temporarily during this turn is needed any more
+	g_SimTurnArena.Reset();
 }
 
 void CSimulation2Impl::Interpolate(float simFrameLength, float frameOffset, float realFrameLength)
@@ -529,6 +546,13 @@ void CSimulation2Impl::Interpolate(float simFrameLength, float frameOffset, floa
 	CMessageInterpolate msg(simFrameLength, frameOffset, realFrameLength);
 	m_ComponentManager.BroadcastMessage(msg);
 
+	// Then do the self-contained parts of the interpolation on all the worker threads
+	{
+		PROFILE3("sim interpolate parallel");
+		CMessageInterpolateParallel msgParallel(simFrameLength, frameOffset, realFrameLength);
+		m_ComponentManager.BroadcastMessageParallel(msgParallel);
+	}
+
 	// Clean up any entities destroyed during interpolate (e.g. local corpses)
 	m_ComponentManager.FlushDestroyedComponents();
 }
@@ -594,6 +618,13 @@ entity_id_t CSimulation2::AddEntity(const std::wstring& templateName, entity_id_
 	return m->m_ComponentManager.AddEntity(templateName, m->m_ComponentManager.AllocateNewEntity(preferredId));
 }
 
+void CSimulation2::AddEntities(const std::wstring& templateName, std::vector<entity_id_t>& ents)
+{
+	for (size_t i = 0; i < ents.size(); ++i)
+		ents[i] = m->m_ComponentManager.AllocateNewEntity(ents[i]);
+	m->m_ComponentManager.AddEntities(templateName, ents);
+}
+
 entity_id_t CSimulation2::AddLocalEntity(const std::wstring& templateName)
 {
 	return m->m_ComponentManager.AddEntity(templateName, m->m_ComponentManager.AllocateNewLocalEntity());
@@ -762,6 +793,18 @@ bool CSimulation2::ComputeStateHash(std::string& outHash, bool quick)
 	return m->m_ComponentManager.ComputeStateHash(outHash, quick);
 }
 
+bool CSimulation2::DumpStateHashes(std::ostream& stream, bool quick)
+{
+	std::vector<std::pair<CComponentManager::ComponentTypeId, std::string> > hashes;
+	if (!m->m_ComponentManager.ComputeComponentStateHashes(hashes, quick))
+		return false;
+
+	for (size_t i = 0; i < hashes.size(); ++i)
+		stream << Hexify(hashes[i].second) << " " << m->m_ComponentManager.LookupComponentTypeName(hashes[i].first) << "\n";
+
+	return true;
+}
+
 bool CSimulation2::DumpDebugState(std::ostream& stream)
 {
 	return m->m_ComponentManager.DumpDebugState(stream, true);
@@ -772,12 +815,22 @@ bool CSimulation2::SerializeState(std::ostream& stream)
 	return m->m_ComponentManager.SerializeState(stream);
 }
 
+bool CSimulation2::SerializeState(std::string& buffer)
+{
+	return m->m_ComponentManager.SerializeState(buffer);
+}
+
 bool CSimulation2::DeserializeState(std::istream& stream)
 {
 	// TODO: need to make sure the required SYSTEM_ENTITY components get constructed
 	return m->m_ComponentManager.DeserializeState(stream);
 }
 
+bool CSimulation2::DeserializeState(const std::string& buffer)
+{
+	return m->m_ComponentManager.DeserializeState(buffer);
+}
+
 std::string CSimulation2::GenerateSchema()
 {
 	return m->m_ComponentManager.GenerateSchema();
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,13 +20,12 @@
 
 #include "simulation2/system/CmpPtr.h"
 #include "simulation2/system/Components.h"
+#include "simulation2/helpers/EntityMap.h"
 #include "simulation2/helpers/SimulationCommand.h"
 #include "scriptinterface/ScriptVal.h"
 
 #include "lib/file/vfs/vfs_path.h"
 
-#include <boost/unordered_map.hpp>
-
 #include <map>
 
 class CSimulation2Impl;
@@ -173,6 +172,14 @@ public:
 	entity_id_t AddEntity(const std::wstring& templateName, entity_id_t preferredId);
 	entity_id_t AddLocalEntity(const std::wstring& templateName);
 
+	/**
+	 * Construct several new entities with the same template (faster than calling
+	 * AddEntity for each one).
+	 * @param ents preferred IDs of the new entities; on return, the IDs they were
+	 * given, or INVALID_ENTITY for any that failed
+	 */
+	void AddEntities(const std::wstring& templateName, std::vector<entity_id_t>& ents);
+
 	/**
 	 * Destroys the specified entity, once FlushDestroyedEntities is called.
 	 * Has no effect if the entity does not exist, or has already been added to the destruction queue.
@@ -192,7 +199,7 @@ public:
 	void BroadcastMessage(const CMessage& msg) const;
 
 	typedef std::vector<std::pair<entity_id_t, IComponent*> > InterfaceList;
-	typedef boost::unordered_map<entity_id_t, IComponent*> InterfaceListUnordered;
+	typedef EntityMap<IComponent*> InterfaceListUnordered;
 
 	/**
 	 * Returns a list of components implementing the given interface, and their
@@ -202,7 +209,8 @@ public:
 
 	/**
 	 * Returns a list of components implementing the given interface, and their
-	 * associated entities, as an unordered map.
+	 * associated entities, without copying them. (This is also sorted by entity ID,
+	 * but must not be held across anything that might add or destroy components.)
 	 */
 	const InterfaceListUnordered& GetEntitiesWithInterfaceUnordered(int iid);
 
@@ -210,9 +218,19 @@ public:
 	ScriptInterface& GetScriptInterface() const;
 
 	bool ComputeStateHash(std::string& outHash, bool quick);
+
+	/**
+	 * Writes the hash of each component type's state (which ComputeStateHash combines)
+	 * as one line of text per type, so the output from two out-of-sync simulations can
+	 * be compared to see which component diverged.
+	 */
+	bool DumpStateHashes(std::ostream& stream, bool quick);
+
 	bool DumpDebugState(std::ostream& stream);
 	bool SerializeState(std::ostream& stream);
+	bool SerializeState(std::string& buffer); // appends to buffer; faster when the state is wanted in memory
 	bool DeserializeState(std::istream& stream);
+	bool DeserializeState(const std::string& buffer); // faster when the state is already in memory
 
 	std::string GenerateSchema();
 
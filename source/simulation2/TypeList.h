@@ -36,12 +36,14 @@ MESSAGE(Update_MotionFormation)
 MESSAGE(Update_MotionUnit)
 MESSAGE(Update_Final)
 MESSAGE(Interpolate) // non-deterministic (use with caution)
+MESSAGE(InterpolateParallel) // non-deterministic, and handled concurrently on worker threads
 MESSAGE(RenderSubmit) // non-deterministic (use with caution)
 MESSAGE(ProgressiveLoad) // non-deterministic (use with caution)
 MESSAGE(Create)
 MESSAGE(Destroy)
 MESSAGE(OwnershipChanged)
 MESSAGE(PositionChanged)
+MESSAGE(PositionChangedBatch)
 MESSAGE(MotionChanged)
 MESSAGE(RangeUpdate)
 MESSAGE(TerrainChanged)
@@ -141,6 +143,11 @@ COMPONENT(SoundManager)
 INTERFACE(TechnologyManager)
 COMPONENT(TechnologyManagerScripted)
 
+// Must come before Vision and TerritoryManager, so it discards old results
+// before they handle MT_TechnologyModification
+INTERFACE(TechnologyModificationCache)
+COMPONENT(TechnologyModificationCache)
+
 INTERFACE(TechnologyTemplateManager)
 COMPONENT(TechnologyTemplateManagerScripted)
 
@@ -153,10 +160,22 @@ COMPONENT(TerritoryInfluence)
 INTERFACE(TerritoryManager)
 COMPONENT(TerritoryManager)
 
+INTERFACE(Timer)
+COMPONENT(Timer)
+COMPONENT(TimerScripted)
+
 INTERFACE(UnitMotion)
 COMPONENT(UnitMotion) // must be after Obstruction
 COMPONENT(UnitMotionScripted)
 
+// Must come after UnitMotion, so formation controllers have moved before
+// their members' targets are computed in MT_Update_MotionFormation
+INTERFACE(FormationController)
+COMPONENT(FormationController)
+
+INTERFACE(UnitRenderer)
+COMPONENT(UnitRenderer)
+
 INTERFACE(Vision)
 COMPONENT(Vision)
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -26,9 +26,14 @@
 #include "lib/timer.h"
 #include "lib/tex/tex.h"
 #include "lib/allocators/shared_ptr.h"
+#include "lib/external_libraries/libsdl.h"
+#include "lib/posix/posix_pthread.h"
+#include "maths/MathUtil.h"
 #include "ps/CLogger.h"
 #include "ps/Filesystem.h"
+#include "ps/Profiler2.h"
 #include "ps/Util.h"
+#include "scriptinterface/ScriptExtraHeaders.h" // for typed arrays
 #include "simulation2/components/ICmpAIInterface.h"
 #include "simulation2/components/ICmpCommandQueue.h"
 #include "simulation2/components/ICmpObstructionManager.h"
@@ -36,22 +41,27 @@
 #include "simulation2/components/ICmpTemplateManager.h"
 #include "simulation2/components/ICmpTechnologyTemplateManager.h"
 #include "simulation2/components/ICmpTerritoryManager.h"
+#include "simulation2/helpers/EntityIndex.h"
 #include "simulation2/helpers/Grid.h"
+#include "simulation2/helpers/GridAlgorithms.h"
+#include "simulation2/scripting/ScriptDelta.h"
 #include "simulation2/serialization/DebugSerializer.h"
 #include "simulation2/serialization/StdDeserializer.h"
 #include "simulation2/serialization/StdSerializer.h"
 #include "simulation2/serialization/SerializeTemplates.h"
 
+#include <deque>
+
 /**
  * @file
  * Player AI interface.
  * AI is primarily scripted, and the CCmpAIManager component defined here
  * takes care of managing all the scripts.
  *
- * To avoid slow AI scripts causing jerky rendering, they are run in a background
- * thread (maintained by CAIWorker) so that it's okay if they take a whole simulation
- * turn before returning their results (though preferably they shouldn't use nearly
- * that much CPU).
+ * To avoid slow AI scripts causing jerky rendering, they are run in background
+ * threads (one per AI player, maintained by CAIWorker) so that it's okay if they
+ * take a whole simulation turn before returning their results (though preferably
+ * they shouldn't use nearly that much CPU).
  *
  * CCmpAIManager grabs the world state after each turn (making use of AIInterface.js
  * and AIProxy.js to decide what data to include) then passes it to CAIWorker.
@@ -60,15 +70,20 @@
  * will block until it's actually completed, so the rest of the engine should avoid
  * reading it for as long as possible.
  *
+ * Each AI player has its own script runtime, which is only ever used by that player's
+ * thread (to avoid the need for JS_SetContextThread), so the players can all run
+ * in parallel. If they use the shared component, each player has its own copy of it.
  * JS values are passed between the game and AI threads using ScriptInterface::StructuredClone.
+ * The game state and other shared inputs are only read by the AI threads, and are
+ * never modified while the players are computing.
  *
- * TODO: actually the thread isn't implemented yet, because performance hasn't been
- * sufficiently problematic to justify the complexity yet, but the CAIWorker interface
- * is designed to hopefully support threading when we want it.
+ * The game state is mostly unchanged between turns, so instead of cloning the whole
+ * state every turn, CCmpAIManager only sends the changes (see CScriptDeltaEncoder),
+ * and each player updates its own persistent copy of the state.
  */
 
 /**
- * Implements worker thread for CCmpAIManager.
+ * Implements worker threads for CCmpAIManager.
  */
 class CAIWorker
 {
@@ -77,28 +92,68 @@ private:
 	{
 		NONCOPYABLE(CAIPlayer);
 	public:
-		CAIPlayer(CAIWorker& worker, const std::wstring& aiName, player_id_t player,
-				const shared_ptr<ScriptRuntime>& runtime, boost::rand48& rng) :
-			m_Worker(worker), m_AIName(aiName), m_Player(player), m_ScriptInterface("Engine", "AI", runtime)
+		/**
+		 * Function run by a task on the player's thread.
+		 */
+		typedef void (*TaskFunc)(CAIPlayer& self);
+
+		CAIPlayer(CAIWorker& worker, const std::wstring& aiName, player_id_t player) :
+			m_Worker(worker), m_AIName(aiName), m_Player(player),
+			m_UseSharedComponent(false), m_HasSharedComponent(false),
+			m_ScriptInterface(NULL), m_PassabilityMapDirtyID(0), m_TerritoryMapVersion(0),
+			m_GameStateFailed(false),
+			m_CallConstructor(false), m_HasTechs(false), m_TaskResult(false),
+			m_Task(NULL), m_TaskPending(false)
 		{
-			m_ScriptInterface.SetCallbackData(static_cast<void*> (this));
+			// (Use SDL semaphores since OS X doesn't implement sem_init)
+			m_TaskSem = SDL_CreateSemaphore(0);
+			m_DoneSem = SDL_CreateSemaphore(0);
 
-			m_ScriptInterface.ReplaceNondeterministicRNG(rng);
-			m_ScriptInterface.LoadGlobalScripts();
+			int ret = pthread_create(&m_Thread, NULL, &RunThread, this);
+			ENSURE(ret == 0);
+		}
+
+		~CAIPlayer()
+		{
+			WaitForTask();
 
-			m_ScriptInterface.RegisterFunction<void, std::wstring, CAIPlayer::IncludeModule>("IncludeModule");
-			m_ScriptInterface.RegisterFunction<void, CAIPlayer::DumpHeap>("DumpHeap");
-			m_ScriptInterface.RegisterFunction<void, CAIPlayer::ForceGC>("ForceGC");
-			m_ScriptInterface.RegisterFunction<void, CScriptValRooted, CAIPlayer::PostCommand>("PostCommand");
+			// A NULL task tells the thread to clean up its script objects and stop
+			m_Task = NULL;
+			SDL_SemPost(m_TaskSem);
+			pthread_join(m_Thread, NULL);
 
-			m_ScriptInterface.RegisterFunction<void, std::wstring, std::vector<u32>, u32, u32, u32, CAIPlayer::DumpImage>("DumpImage");
+			SDL_DestroySemaphore(m_DoneSem);
+			SDL_DestroySemaphore(m_TaskSem);
 		}
 
-		~CAIPlayer()
+		/**
+		 * Starts running func on the player's thread. The task's arguments and results
+		 * are passed in member variables, which mustn't be touched by any other thread
+		 * until WaitForTask has returned.
+		 */
+		void StartTask(TaskFunc func)
 		{
-			// Clean up rooted objects before destroying their script context
-			m_Obj = CScriptValRooted();
-			m_Commands.clear();
+			ENSURE(func && !m_TaskPending);
+			m_Task = func;
+			m_TaskPending = true;
+			SDL_SemPost(m_TaskSem);
+		}
+
+		/**
+		 * Waits for the task started by StartTask (if any) to finish.
+		 */
+		void WaitForTask()
+		{
+			if (!m_TaskPending)
+				return;
+			SDL_SemWait(m_DoneSem);
+			m_TaskPending = false;
+		}
+
+		void RunTask(TaskFunc func)
+		{
+			StartTask(func);
+			WaitForTask();
 		}
 
 		static void IncludeModule(void* cbdata, std::wstring name)
@@ -110,21 +165,22 @@ private:
 		static void DumpHeap(void* cbdata)
 		{
 			CAIPlayer* self = static_cast<CAIPlayer*> (cbdata);
-			
-			//std::cout << JS_GetGCParameter(self->m_ScriptInterface.GetRuntime(), JSGC_BYTES) << std::endl;
-			self->m_ScriptInterface.DumpHeap();
+
+			//std::cout << JS_GetGCParameter(self->m_ScriptInterface->GetRuntime(), JSGC_BYTES) << std::endl;
+			self->m_ScriptInterface->DumpHeap();
 		}
 		static void ForceGC(void* cbdata)
 		{
 			CAIPlayer* self = static_cast<CAIPlayer*> (cbdata);
-			
-			JS_GC(self->m_ScriptInterface.GetContext());
-		}		
+
+			PROFILE2("AI compute GC");
+			JS_GC(self->m_ScriptInterface->GetContext());
+		}
 		static void PostCommand(void* cbdata, CScriptValRooted cmd)
 		{
 			CAIPlayer* self = static_cast<CAIPlayer*> (cbdata);
 
-			self->m_Commands.push_back(self->m_ScriptInterface.WriteStructuredClone(cmd.get()));
+			self->m_Commands.push_back(self->m_ScriptInterface->WriteStructuredClone(cmd.get()));
 		}
 
 		/**
@@ -167,6 +223,173 @@ private:
 			tex_free(&t);
 		}
 
+		/**
+		 * Returns the labels of the connected regions of the passability map for the
+		 * given class mask (see GridAlgorithms::LabelRegions), in the same format as
+		 * the passability map.
+		 */
+		static CScriptVal GetRegionMap(void* cbdata, u16 passClass)
+		{
+			CAIPlayer* self = static_cast<CAIPlayer*> (cbdata);
+
+			PROFILE2("AI region map");
+			Grid<u16> labels;
+			GridAlgorithms::LabelRegions(self->m_Worker.m_PassabilityMap, passClass, labels);
+			return CScriptVal(ScriptInterface::ToJSVal(self->m_ScriptInterface->GetContext(), labels));
+		}
+
+		/**
+		 * Returns each tile's distance (in tiles) from the nearest tile that's
+		 * impassable for the given class mask (see GridAlgorithms::DistanceTransform).
+		 */
+		static CScriptVal GetDistanceMap(void* cbdata, u16 passClass)
+		{
+			CAIPlayer* self = static_cast<CAIPlayer*> (cbdata);
+
+			return CScriptVal(ScriptInterface::ToJSVal(self->m_ScriptInterface->GetContext(), self->GetDistanceGrid(passClass)));
+		}
+
+		/**
+		 * Finds the point nearest to (x, z), within maxDistance, that's in this
+		 * player's territory and at least clearance from anything impassable for
+		 * the given class mask (which can include the construction obstruction bit).
+		 * Returns the center of the chosen tile as [x, z], or [] if there isn't one.
+		 */
+		static std::vector<float> FindPlacement(void* cbdata, u16 passClass, float x, float z, float clearance, float maxDistance)
+		{
+			CAIPlayer* self = static_cast<CAIPlayer*> (cbdata);
+
+			PROFILE2("AI find placement");
+			std::vector<float> ret;
+			const Grid<u16>& distances = self->GetDistanceGrid(passClass);
+			if (!distances.m_W || !distances.m_H)
+				return ret;
+
+			u16 i0, j0, i, j;
+			self->WorldToTile(x, z, i0, j0);
+			u16 tileClearance = (u16)clamp((int)ceilf(clearance / TERRAIN_TILE_SIZE), 0, 0xFFFF);
+			u16 tileMaxDistance = (u16)clamp((int)(maxDistance / TERRAIN_TILE_SIZE), 0, 0xFFFF);
+			if (GridAlgorithms::FindPlacement(distances, self->m_Worker.m_TerritoryMap, self->m_Player,
+				i0, j0, tileClearance, tileMaxDistance, i, j))
+			{
+				ret.push_back((i + 0.5f) * TERRAIN_TILE_SIZE);
+				ret.push_back((j + 0.5f) * TERRAIN_TILE_SIZE);
+			}
+			return ret;
+		}
+
+		/**
+		 * Finds a path from (x0, z0) to (x1, z1) for the given class mask, with
+		 * the same movement rules as the long-range pathfinder, giving up if it would
+		 * be longer than maxLength. Returns the waypoints (the tile centers where it
+		 * changes direction, ending at the goal) as [x0, z0, x1, z1, ...],
+		 * or [] if there's no short enough path.
+		 */
+		static std::vector<float> FindPath(void* cbdata, u16 passClass, float x0, float z0, float x1, float z1, float maxLength)
+		{
+			CAIPlayer* self = static_cast<CAIPlayer*> (cbdata);
+
+			PROFILE2("AI find path");
+			std::vector<float> ret;
+			const Grid<u16>& grid = self->m_Worker.m_PassabilityMap;
+			if (!grid.m_W || !grid.m_H)
+				return ret;
+
+			u16 i0, j0, i1, j1;
+			self->WorldToTile(x0, z0, i0, j0);
+			self->WorldToTile(x1, z1, i1, j1);
+			u32 maxCost = (u32)clamp(maxLength / TERRAIN_TILE_SIZE * GridAlgorithms::COST_STRAIGHT, 0.f, 4.e9f);
+
+			std::vector<std::pair<u16, u16> > path;
+			if (!GridAlgorithms::FindPath(grid, passClass, i0, j0, i1, j1, maxCost, path))
+				return ret;
+
+			// The unit is already on the start tile
+			for (size_t n = 1; n < path.size(); ++n)
+			{
+				ret.push_back((path[n].first + 0.5f) * TERRAIN_TILE_SIZE);
+				ret.push_back((path[n].second + 0.5f) * TERRAIN_TILE_SIZE);
+			}
+			return ret;
+		}
+
+		/**
+		 * Returns the IDs of the entities in the game state that match the given filter
+		 * (an object with any of the properties owner, template, class, and position
+		 * [x, z] with range), as a Uint32Array in increasing order.
+		 */
+		static CScriptVal QueryEntities(void* cbdata, CScriptVal filterVal)
+		{
+			CAIPlayer* self = static_cast<CAIPlayer*> (cbdata);
+			ScriptInterface& scriptInterface = *self->m_ScriptInterface;
+			JSContext* cx = scriptInterface.GetContext();
+
+			EntityIndex::Filter filter;
+			if (!filterVal.undefined())
+			{
+				jsval val = filterVal.get();
+				if (scriptInterface.HasProperty(val, "owner"))
+					filter.hasOwner = scriptInterface.GetProperty(val, "owner", filter.owner);
+				if (scriptInterface.HasProperty(val, "template"))
+					scriptInterface.GetProperty(val, "template", filter.templateName);
+				if (scriptInterface.HasProperty(val, "class"))
+					scriptInterface.GetProperty(val, "class", filter.className);
+				if (scriptInterface.HasProperty(val, "position") || scriptInterface.HasProperty(val, "range"))
+				{
+					std::vector<float> pos;
+					float range;
+					if (!scriptInterface.GetProperty(val, "position", pos) || pos.size() != 2
+						|| !scriptInterface.GetProperty(val, "range", range))
+					{
+						LOGERROR(L"QueryEntities: filter needs both 'position' [x, z] and 'range'");
+						return CScriptVal();
+					}
+					filter.hasRange = true;
+					filter.position = CFixedVector2D(entity_pos_t::FromFloat(pos[0]), entity_pos_t::FromFloat(pos[1]));
+					filter.range = entity_pos_t::FromFloat(range);
+				}
+			}
+
+			std::vector<entity_id_t> ents;
+			{
+				PROFILE2("AI query entities");
+				self->m_Worker.m_EntityIndex.Query(filter, ents);
+			}
+
+			JSObject* array = js_CreateTypedArray(cx, js::TypedArray::TYPE_UINT32, (jsuint)ents.size());
+			if (!array)
+				return CScriptVal();
+			if (!ents.empty())
+				memcpy(js::TypedArray::fromJSObject(array)->data, &ents[0], ents.size()*sizeof(entity_id_t));
+			return CScriptVal(OBJECT_TO_JSVAL(array));
+		}
+
+		void WorldToTile(float x, float z, u16& i, u16& j)
+		{
+			const Grid<u16>& grid = m_Worker.m_PassabilityMap;
+			i = (u16)clamp((int)floorf(x / TERRAIN_TILE_SIZE), 0, (int)grid.m_W - 1);
+			j = (u16)clamp((int)floorf(z / TERRAIN_TILE_SIZE), 0, (int)grid.m_H - 1);
+		}
+
+		/**
+		 * Returns the distance transform of the worker's passability map for the
+		 * given class mask, reusing the previous result until the map changes
+		 * (since the scripts will typically search for many placements per turn).
+		 */
+		const Grid<u16>& GetDistanceGrid(u16 passClass)
+		{
+			const Grid<u16>& grid = m_Worker.m_PassabilityMap;
+			CachedDistances& cached = m_DistanceMaps[passClass];
+			if (!cached.valid || cached.dirtyID != grid.m_DirtyID || cached.distances.m_W != grid.m_W || cached.distances.m_H != grid.m_H)
+			{
+				PROFILE2("AI distance map");
+				GridAlgorithms::DistanceTransform(grid, passClass, cached.distances);
+				cached.dirtyID = grid.m_DirtyID;
+				cached.valid = true;
+			}
+			return cached.distances;
+		}
+
 		bool LoadScripts(const std::wstring& moduleName)
 		{
 			// Ignore modules that are already loaded
@@ -181,7 +404,7 @@ private:
 			vfs::GetPathnames(g_VFS, L"simulation/ai/" + moduleName + L"/", L"*.js", pathnames);
 			for (VfsPaths::iterator it = pathnames.begin(); it != pathnames.end(); ++it)
 			{
-				if (!m_ScriptInterface.LoadGlobalScriptFile(*it))
+				if (!m_ScriptInterface->LoadGlobalScriptFile(*it))
 				{
 					LOGERROR(L"Failed to load script %ls", it->string().c_str());
 					return false;
@@ -193,11 +416,41 @@ private:
 
 		bool Initialise(bool callConstructor)
 		{
+			// TODO: Passing a 32 MB argument to CreateRuntime() is a temporary fix
+			// to prevent frequent AI out-of-memory crashes. The argument should be
+			// removed as soon whenever the new pathfinder is committed
+			// And the AIs can stop relying on their own little hands.
+			m_ScriptInterface = new ScriptInterface("Engine", "AI", ScriptInterface::CreateRuntime(33554432));
+			m_ScriptInterface->SetCallbackData(static_cast<void*> (this));
+
+			m_ScriptInterface->ReplaceNondeterministicRNG(m_RNG);
+			m_ScriptInterface->LoadGlobalScripts();
+
+			m_ScriptInterface->RegisterFunction<void, std::wstring, CAIPlayer::IncludeModule>("IncludeModule");
+			m_ScriptInterface->RegisterFunction<void, CAIPlayer::DumpHeap>("DumpHeap");
+			m_ScriptInterface->RegisterFunction<void, CAIPlayer::ForceGC>("ForceGC");
+			m_ScriptInterface->RegisterFunction<void, CScriptValRooted, CAIPlayer::PostCommand>("PostCommand");
+
+			m_ScriptInterface->RegisterFunction<void, std::wstring, std::vector<u32>, u32, u32, u32, CAIPlayer::DumpImage>("DumpImage");
+
+			m_ScriptInterface->RegisterFunction<CScriptVal, u16, CAIPlayer::GetRegionMap>("GetRegionMap");
+			m_ScriptInterface->RegisterFunction<CScriptVal, u16, CAIPlayer::GetDistanceMap>("GetDistanceMap");
+			m_ScriptInterface->RegisterFunction<std::vector<float>, u16, float, float, float, float, CAIPlayer::FindPlacement>("FindPlacement");
+			m_ScriptInterface->RegisterFunction<std::vector<float>, u16, float, float, float, float, float, CAIPlayer::FindPath>("FindPath");
+			m_ScriptInterface->RegisterFunction<CScriptVal, CScriptVal, CAIPlayer::QueryEntities>("QueryEntities");
+
+			// Since the template data is shared between AI players, freeze it
+			// to stop any of them changing it and expecting the others to notice
+			ENSURE(m_Worker.m_HasLoadedEntityTemplates);
+			JSContext* cx = m_ScriptInterface->GetContext();
+			m_EntityTemplates = CScriptValRooted(cx, m_ScriptInterface->ReadStructuredClone(m_Worker.m_EntityTemplates));
+			m_ScriptInterface->FreezeObject(m_EntityTemplates.get(), true);
+
 			if (!LoadScripts(m_AIName))
 				return false;
 
 			OsPath path = L"simulation/ai/" + m_AIName + L"/data.json";
-			CScriptValRooted metadata = m_Worker.LoadMetadata(path);
+			CScriptValRooted metadata = m_ScriptInterface->ReadJSONFile(path);
 			if (metadata.uninitialised())
 			{
 				LOGERROR(L"Failed to create AI player: can't find %ls", path.string().c_str());
@@ -206,7 +459,7 @@ private:
 
 			// Get the constructor name from the metadata
 			std::string constructor;
-			if (!m_ScriptInterface.GetProperty(metadata.get(), "constructor", constructor))
+			if (!m_ScriptInterface->GetProperty(metadata.get(), "constructor", constructor))
 			{
 				LOGERROR(L"Failed to create AI player: %ls: missing 'constructor'", path.string().c_str());
 				return false;
@@ -214,34 +467,33 @@ private:
 
 			// Get the constructor function from the loaded scripts
 			CScriptVal ctor;
-			if (!m_ScriptInterface.GetProperty(m_ScriptInterface.GetGlobalObject(), constructor.c_str(), ctor)
+			if (!m_ScriptInterface->GetProperty(m_ScriptInterface->GetGlobalObject(), constructor.c_str(), ctor)
 				|| ctor.undefined())
 			{
 				LOGERROR(L"Failed to create AI player: %ls: can't find constructor '%hs'", path.string().c_str(), constructor.c_str());
 				return false;
 			}
 
-			m_ScriptInterface.GetProperty(metadata.get(), "useShared", m_UseSharedComponent);
-			
+			m_ScriptInterface->GetProperty(metadata.get(), "useShared", m_UseSharedComponent);
+
 			CScriptVal obj;
 
 			if (callConstructor)
 			{
 				// Set up the data to pass as the constructor argument
 				CScriptVal settings;
-				m_ScriptInterface.Eval(L"({})", settings);
-				m_ScriptInterface.SetProperty(settings.get(), "player", m_Player, false);
-				ENSURE(m_Worker.m_HasLoadedEntityTemplates);
-				m_ScriptInterface.SetProperty(settings.get(), "templates", m_Worker.m_EntityTemplates, false);
+				m_ScriptInterface->Eval(L"({})", settings);
+				m_ScriptInterface->SetProperty(settings.get(), "player", m_Player, false);
+				m_ScriptInterface->SetProperty(settings.get(), "templates", m_EntityTemplates, false);
 
-				obj = m_ScriptInterface.CallConstructor(ctor.get(), settings.get());
+				obj = m_ScriptInterface->CallConstructor(ctor.get(), settings.get());
 			}
 			else
 			{
 				// For deserialization, we want to create the object with the correct prototype
 				// but don't want to actually run the constructor again
 				// XXX: actually we don't currently use this path for deserialization - maybe delete it?
-				obj = m_ScriptInterface.NewObjectFromConstructor(ctor.get());
+				obj = m_ScriptInterface->NewObjectFromConstructor(ctor.get());
 			}
 
 			if (obj.undefined())
@@ -250,37 +502,318 @@ private:
 				return false;
 			}
 
-			m_Obj = CScriptValRooted(m_ScriptInterface.GetContext(), obj);
+			m_Obj = CScriptValRooted(m_ScriptInterface->GetContext(), obj);
+
+			m_ScriptInterface->MaybeGC();
+
+			return true;
+		}
+
+		bool LoadSharedComponent(bool hasTechs)
+		{
+			VfsPaths sharedPathnames;
+			// Check for "shared" module.
+			vfs::GetPathnames(g_VFS, L"simulation/ai/common-api-v3/", L"*.js", sharedPathnames);
+			if (sharedPathnames.empty())
+				return false;
+			for (VfsPaths::iterator it = sharedPathnames.begin(); it != sharedPathnames.end(); ++it)
+			{
+				if (!m_ScriptInterface->LoadGlobalScriptFile(*it))
+				{
+					LOGERROR(L"Failed to load shared script %ls", it->string().c_str());
+					return false;
+				}
+			}
+
+			// mainly here for the error messages
+			OsPath path = L"simulation/ai/common-api-v2/";
+
+			// Constructor name is SharedScript
+			CScriptVal ctor;
+			if (!m_ScriptInterface->GetProperty(m_ScriptInterface->GetGlobalObject(), "SharedScript", ctor)
+				|| ctor.undefined())
+			{
+				LOGERROR(L"Failed to create shared AI component: %ls: can't find constructor '%hs'", path.string().c_str(), "SharedScript");
+				return false;
+			}
+
+			// Set up the data to pass as the constructor argument
+			CScriptVal settings;
+			m_ScriptInterface->Eval(L"({})", settings);
+			CScriptVal playersID;
+			m_ScriptInterface->Eval(L"({})", playersID);
+
+			for (size_t i = 0; i < m_Worker.m_PlayerIDs.size(); ++i)
+			{
+				jsval val = m_ScriptInterface->ToJSVal(m_ScriptInterface->GetContext(), m_Worker.m_PlayerIDs[i]);
+				m_ScriptInterface->SetPropertyInt(playersID.get(), i, CScriptVal(val), true);
+			}
+
+			m_ScriptInterface->SetProperty(settings.get(), "players", playersID);
+			m_ScriptInterface->SetProperty(settings.get(), "templates", m_EntityTemplates, false);
+
+			if (hasTechs)
+			{
+				CScriptVal techTemplates = m_ScriptInterface->ReadStructuredClone(m_Worker.m_TechTemplates);
+				m_ScriptInterface->SetProperty(settings.get(), "techTemplates", techTemplates, false);
+			}
+			else
+			{
+				// won't get the tech templates directly.
+				CScriptVal fakeTech;
+				m_ScriptInterface->Eval("({})", fakeTech);
+				m_ScriptInterface->SetProperty(settings.get(), "techTemplates", fakeTech, false);
+			}
+
+			m_SharedAIObj = CScriptValRooted(m_ScriptInterface->GetContext(), m_ScriptInterface->CallConstructor(ctor.get(), settings.get()));
+
+			if (m_SharedAIObj.undefined())
+			{
+				LOGERROR(L"Failed to create shared AI component: %ls: error calling constructor '%hs'", path.string().c_str(), "SharedScript");
+				return false;
+			}
+
+			return true;
+		}
+
+		/**
+		 * Copies the tiles of the worker's passability map in the given region into
+		 * the existing JS value.
+		 * @return false if the JS value doesn't have the expected format (e.g. because
+		 *   it was modified by a script), in which case it needs to be regenerated
+		 */
+		bool PatchPassabilityMap(const GridDirtyRegion& region)
+		{
+			JSContext* cx = m_ScriptInterface->GetContext();
+			const Grid<u16>& grid = m_Worker.m_PassabilityMap;
+
+			jsval val = m_PassabilityMapVal.get();
+			jsval data;
+			if (!JSVAL_IS_OBJECT(val) || JSVAL_IS_NULL(val) || !JS_GetProperty(cx, JSVAL_TO_OBJECT(val), "data", &data))
+				return false;
+			if (!JSVAL_IS_OBJECT(data) || JSVAL_IS_NULL(data) || !js_IsTypedArray(JSVAL_TO_OBJECT(data)))
+				return false;
+
+			js::TypedArray* tdest = js::TypedArray::fromJSObject(JSVAL_TO_OBJECT(data));
+			if (tdest->type != js::TypedArray::TYPE_UINT16 || tdest->byteLength != grid.m_W*grid.m_H*sizeof(u16))
+				return false;
+
+			if (region.IsEmpty())
+				return true;
+
+			u16* dest = static_cast<u16*>(tdest->data);
+			u16 i0 = region.i0;
+			u16 i1 = std::min(region.i1, (u16)(grid.m_W-1));
+			u16 j1 = std::min(region.j1, (u16)(grid.m_H-1));
+			for (u16 j = region.j0; j <= j1; ++j)
+				memcpy(&dest[j*grid.m_W + i0], &grid.m_Data[j*grid.m_W + i0], (i1-i0+1)*sizeof(u16));
+
 			return true;
 		}
 
-		void Run(CScriptVal state)
+		/**
+		 * Sets the passability/territory maps from the worker on the given game state
+		 * (they're only converted to new JS values when they've changed).
+		 */
+		void SetGameStateMaps(CScriptVal state)
+		{
+			JSContext* cx = m_ScriptInterface->GetContext();
+
+			if (m_PassabilityMapVal.uninitialised() || m_PassabilityMapDirtyID != m_Worker.m_PassabilityMap.m_DirtyID)
+			{
+				// If only part of the map changed since our copy, patch the existing
+				// typed array (so the scripts will see the same object, with updated
+				// contents), else regenerate the whole JS value
+				bool patched = false;
+				if (!m_PassabilityMapVal.uninitialised() && m_Worker.m_PassabilityMapPartial
+					&& m_PassabilityMapDirtyID == m_Worker.m_PassabilityMapPreviousDirtyID)
+				{
+					PROFILE2("AI patch passability map");
+					patched = PatchPassabilityMap(m_Worker.m_PassabilityMapChanges);
+				}
+
+				if (!patched)
+					m_PassabilityMapVal = CScriptValRooted(cx, ScriptInterface::ToJSVal(cx, m_Worker.m_PassabilityMap));
+				m_PassabilityMapDirtyID = m_Worker.m_PassabilityMap.m_DirtyID;
+			}
+
+			if (m_TerritoryMapVal.uninitialised() || m_TerritoryMapVersion != m_Worker.m_TerritoryMapVersion)
+			{
+				m_TerritoryMapVal = CScriptValRooted(cx, ScriptInterface::ToJSVal(cx, m_Worker.m_TerritoryMap));
+				m_TerritoryMapVersion = m_Worker.m_TerritoryMapVersion;
+			}
+
+			m_ScriptInterface->SetProperty(state.get(), "passabilityMap", m_PassabilityMapVal, true);
+			m_ScriptInterface->SetProperty(state.get(), "territoryMap", m_TerritoryMapVal, true);
+		}
+
+		// Tasks:
+
+		static void TaskInitialise(CAIPlayer& self)
 		{
-			m_Commands.clear();
-			m_ScriptInterface.CallFunctionVoid(m_Obj.get(), "HandleMessage", state);
+			self.m_TaskResult = self.Initialise(self.m_CallConstructor);
 		}
-		// overloaded with a sharedAI part.
-		// javascript can handle both natively on the same function.
-		void Run(CScriptVal state, CScriptValRooted SharedAI)
+
+		static void TaskLoadSharedComponent(CAIPlayer& self)
 		{
-			m_Commands.clear();
-			m_ScriptInterface.CallFunctionVoid(m_Obj.get(), "HandleMessage", state, SharedAI);
+			self.m_HasSharedComponent = self.LoadSharedComponent(self.m_HasTechs);
 		}
-		void InitWithSharedScript(CScriptVal state, CScriptValRooted SharedAI)
+
+		static void TaskGamestateInit(CAIPlayer& self)
 		{
-			m_Commands.clear();
-			m_ScriptInterface.CallFunctionVoid(m_Obj.get(), "InitWithSharedScript", state, SharedAI);
+			if (!self.m_HasSharedComponent)
+				return;
+
+			CScriptVal state = self.m_ScriptInterface->ReadStructuredClone(self.m_Worker.m_GameState);
+			self.SetGameStateMaps(state);
+
+			self.m_ScriptInterface->CallFunctionVoid(self.m_SharedAIObj.get(), "initWithState", state);
+			self.m_ScriptInterface->MaybeGC();
+
+			self.m_Commands.clear();
+			self.m_ScriptInterface->CallFunctionVoid(self.m_Obj.get(), "InitWithSharedScript", state, self.m_SharedAIObj);
+		}
+
+		static void TaskRun(CAIPlayer& self)
+		{
+			PROFILE2("AI script");
+			PROFILE2_ATTR("player: %d", self.m_Player);
+			PROFILE2_ATTR("script: %ls", self.m_AIName.c_str());
+
+			// Update this player's copy of the game state, to pass to the AI's HandleMessage
+			CScriptVal state;
+			{
+				PROFILE2("AI compute read state");
+				CScriptVal delta = self.m_ScriptInterface->ReadStructuredClone(self.m_Worker.m_GameStateDelta);
+				if (!self.m_GameState.Apply(*self.m_ScriptInterface, delta))
+				{
+					// Ask for the whole state next turn
+					self.m_GameState.Reset();
+					self.m_GameStateFailed = true;
+					return;
+				}
+				state = self.m_GameState.GetValue();
+				self.SetGameStateMaps(state);
+			}
+
+			// The state is only used by this player (and its own copy of the shared
+			// component), but it persists between turns so the scripts mustn't modify it
+
+			self.m_Commands.clear();
+
+			if (self.m_HasSharedComponent)
+			{
+				{
+					PROFILE2("AI run shared component");
+					self.m_ScriptInterface->CallFunctionVoid(self.m_SharedAIObj.get(), "onUpdate", state);
+				}
+				// javascript can handle both natively on the same function.
+				self.m_ScriptInterface->CallFunctionVoid(self.m_Obj.get(), "HandleMessage", state, self.m_SharedAIObj);
+			}
+			else
+			{
+				self.m_ScriptInterface->CallFunctionVoid(self.m_Obj.get(), "HandleMessage", state);
+			}
+
+			// Run GC if we are about to overflow
+			if (JS_GetGCParameter(self.m_ScriptInterface->GetRuntime(), JSGC_BYTES) > 33000000)
+			{
+				PROFILE2("AI compute GC");
+
+				JS_GC(self.m_ScriptInterface->GetContext());
+			}
+		}
+
+		static void TaskSerialize(CAIPlayer& self)
+		{
+			CScriptVal scriptData;
+			if (!self.m_ScriptInterface->CallFunction(self.m_Obj.get(), "Serialize", scriptData))
+				LOGERROR(L"AI script Serialize call failed");
+			self.m_SerializedData = self.m_ScriptInterface->WriteStructuredClone(scriptData.get());
+		}
+
+		static void TaskDeserialize(CAIPlayer& self)
+		{
+			self.m_Commands.clear();
+
+			CScriptVal scriptData = self.m_ScriptInterface->ReadStructuredClone(self.m_SerializedData);
+			if (!self.m_ScriptInterface->CallFunctionVoid(self.m_Obj.get(), "Deserialize", scriptData))
+				LOGERROR(L"AI script Deserialize call failed");
+		}
+
+		static void* RunThread(void* data)
+		{
+			debug_SetThreadName("AI player");
+
+			CAIPlayer* self = static_cast<CAIPlayer*>(data);
+			g_Profiler2.RegisterCurrentThread("AI player " + CStr::FromInt(self->m_Player));
+
+			while (SDL_SemWait(self->m_TaskSem) == 0 && self->m_Task)
+			{
+				self->m_Task(*self);
+				SDL_SemPost(self->m_DoneSem);
+			}
+
+			// Clean up rooted objects before destroying their script context
+			self->m_Obj = CScriptValRooted();
+			self->m_SharedAIObj = CScriptValRooted();
+			self->m_EntityTemplates = CScriptValRooted();
+			self->m_PassabilityMapVal = CScriptValRooted();
+			self->m_TerritoryMapVal = CScriptValRooted();
+			self->m_GameState.Reset();
+			self->m_Commands.clear();
+			self->m_SerializedData.reset();
+			SAFE_DELETE(self->m_ScriptInterface);
+
+			return NULL;
 		}
 
 		CAIWorker& m_Worker;
 		std::wstring m_AIName;
 		player_id_t m_Player;
 		bool m_UseSharedComponent;
-		
-		ScriptInterface m_ScriptInterface;
+		bool m_HasSharedComponent; // whether this player's copy of the shared component was loaded successfully
+		boost::rand48 m_RNG;
+
+		// Only used by the player's thread:
+		ScriptInterface* m_ScriptInterface;
 		CScriptValRooted m_Obj;
-		std::vector<shared_ptr<ScriptInterface::StructuredClone> > m_Commands;
+		CScriptValRooted m_SharedAIObj;
+		CScriptValRooted m_EntityTemplates;
+		CScriptValRooted m_PassabilityMapVal;
+		size_t m_PassabilityMapDirtyID;
+		CScriptValRooted m_TerritoryMapVal;
+		u32 m_TerritoryMapVersion;
+		CScriptDeltaDecoder m_GameState;
 		std::set<std::wstring> m_LoadedModules;
+
+		struct CachedDistances
+		{
+			CachedDistances() : valid(false), dirtyID(0) { }
+			bool valid;
+			size_t dirtyID;
+			Grid<u16> distances;
+		};
+		std::map<u16, CachedDistances> m_DistanceMaps; // indexed by passability class mask
+
+		// Set by TaskRun if the game state delta couldn't be applied
+		bool m_GameStateFailed;
+
+		// Results of the last Run (created in this player's runtime); may be read by
+		// the main thread while no task is running
+		std::vector<shared_ptr<ScriptInterface::StructuredClone> > m_Commands;
+
+		// Task arguments and results:
+		bool m_CallConstructor;
+		bool m_HasTechs;
+		bool m_TaskResult;
+		shared_ptr<ScriptInterface::StructuredClone> m_SerializedData;
+
+		pthread_t m_Thread;
+		SDL_sem* m_TaskSem;
+		SDL_sem* m_DoneSem;
+		TaskFunc m_Task;
+		bool m_TaskPending; // only used by the main thread
 	};
 
 public:
@@ -290,281 +823,281 @@ public:
 		std::vector<shared_ptr<ScriptInterface::StructuredClone> > commands;
 	};
 
+	/**
+	 * Commands computed by the players (copied into the worker's runtime),
+	 * waiting to be pushed at the start of the given turn.
+	 */
+	struct SPendingCommands
+	{
+		u32 turn;
+		std::vector<SCommandSets> sets;
+	};
+
 	CAIWorker() :
-		// TODO: Passing a 32 MB argument to CreateRuntime() is a temporary fix
-		// to prevent frequent AI out-of-memory crashes. The argument should be
-		// removed as soon whenever the new pathfinder is committed
-		// And the AIs can stop relying on their own little hands.
-		m_ScriptRuntime(ScriptInterface::CreateRuntime(33554432)),
+		// This is only used on the main thread, for converting data to and from
+		// the AI players' runtimes; the AI scripts run in their own runtimes
+		m_ScriptRuntime(ScriptInterface::CreateRuntime()),
 		m_ScriptInterface("Engine", "AI", m_ScriptRuntime),
 		m_TurnNum(0),
+		m_ComputeInterval(1),
+		m_Pipelined(false),
+		m_ComputationTurn(0),
 		m_CommandsComputed(true),
 		m_HasLoadedEntityTemplates(false),
-		m_HasSharedComponent(false)
+		m_PassabilityMapPartial(false),
+		m_PassabilityMapPreviousDirtyID(0),
+		m_TerritoryMapVersion(0)
 	{
-
-		// TODO: ought to seed the RNG (in a network-synchronised way) before we use it
-		m_ScriptInterface.ReplaceNondeterministicRNG(m_RNG);
-		m_ScriptInterface.LoadGlobalScripts();
-
-		m_ScriptInterface.SetCallbackData(NULL);
-
-		m_ScriptInterface.RegisterFunction<void, CScriptValRooted, CAIWorker::PostCommand>("PostCommand");
-		m_ScriptInterface.RegisterFunction<void, CAIWorker::DumpHeap>("DumpHeap");
-		m_ScriptInterface.RegisterFunction<void, CAIWorker::ForceGC>("ForceGC");
-
 	}
 
 	~CAIWorker()
 	{
-		// Clear rooted script values before destructing the script interface
-		m_EntityTemplates = CScriptValRooted();
-		m_PlayerMetadata.clear();
+		// Stop the players' threads before destroying the data they use
 		m_Players.clear();
 		m_GameState.reset();
-		m_PassabilityMapVal = CScriptValRooted();
-		m_TerritoryMapVal = CScriptValRooted();
-	}
-
-	// This is called by AIs if they use the v3 API.
-	// If the AIs originate the call, cbdata is not NULL.
-	// If the shared component does, it is, so it must not be taken into account.
-	static void PostCommand(void* cbdata, CScriptValRooted cmd)
-	{
-		if (cbdata == NULL) {
-			debug_warn(L"Warning: the shared component has tried to push an engine command. Ignoring.");
-			return;
-		}
-		CAIPlayer* self = static_cast<CAIPlayer*> (cbdata);
-		self->m_Commands.push_back(self->m_ScriptInterface.WriteStructuredClone(cmd.get()));
-	}
-	// The next two ought to be implmeneted someday but for now as it returns "null" it can't
-	static void DumpHeap(void* cbdata)
-	{
-		if (cbdata == NULL) {
-			debug_warn(L"Warning: the shared component has asked for DumpHeap. Ignoring.");
-			return;
-		}
-		CAIWorker* self = static_cast<CAIWorker*> (cbdata);
-		self->m_ScriptInterface.DumpHeap();
-	}
-	static void ForceGC(void* cbdata)
-	{
-		if (cbdata == NULL) {
-			debug_warn(L"Warning: the shared component has asked for ForceGC. Ignoring.");
-			return;
-		}
-		CAIWorker* self = static_cast<CAIWorker*> (cbdata);
-		PROFILE3("AI compute GC");
-		JS_GC(self->m_ScriptInterface.GetContext());
+		m_GameStateDelta.reset();
+		m_EntityTemplates.reset();
+		m_TechTemplates.reset();
+		m_PendingCommands.clear();
 	}
 
 	bool TryLoadSharedComponent(bool hasTechs)
 	{
-		// only load if there are AI players.
-		if (m_Players.size() == 0)
-			return false;
-		// we don't need to load it.
-		if (!m_HasSharedComponent)
-			return false;
-		
-		// reset the value so it can be used to determine if we actually initialized it.
-		m_HasSharedComponent = false;
-				
-		VfsPaths sharedPathnames;
-		// Check for "shared" module.
-		vfs::GetPathnames(g_VFS, L"simulation/ai/common-api-v3/", L"*.js", sharedPathnames);
-		for (VfsPaths::iterator it = sharedPathnames.begin(); it != sharedPathnames.end(); ++it)
+		// Each player that uses the shared component gets its own copy, in its own runtime
+		bool loaded = false;
+		for (size_t i = 0; i < m_Players.size(); ++i)
 		{
-			if (!m_ScriptInterface.LoadGlobalScriptFile(*it))
-			{
-				LOGERROR(L"Failed to load shared script %ls", it->string().c_str());
-				return false;
-			}
-			m_HasSharedComponent = true;
+			if (!m_Players[i]->m_UseSharedComponent)
+				continue;
+			m_Players[i]->m_HasTechs = hasTechs;
+			m_Players[i]->StartTask(CAIPlayer::TaskLoadSharedComponent);
 		}
-		if (!m_HasSharedComponent)
-			return false;
-		
-		// mainly here for the error messages
-		OsPath path = L"simulation/ai/common-api-v2/";
-		
-		// Constructor name is SharedScript
-		CScriptVal ctor;
-		if (!m_ScriptInterface.GetProperty(m_ScriptInterface.GetGlobalObject(), "SharedScript", ctor)
-			|| ctor.undefined())
+		for (size_t i = 0; i < m_Players.size(); ++i)
 		{
-			LOGERROR(L"Failed to create shared AI component: %ls: can't find constructor '%hs'", path.string().c_str(), "SharedScript");
-			return false;
+			m_Players[i]->WaitForTask();
+			loaded = loaded || m_Players[i]->m_HasSharedComponent;
 		}
-		
-		if (hasTechs)
-		{
-			// Set up the data to pass as the constructor argument
-			CScriptVal settings;
-			m_ScriptInterface.Eval(L"({})", settings);
-			CScriptVal playersID;
-			m_ScriptInterface.Eval(L"({})", playersID);
-			
-			for (size_t i = 0; i < m_Players.size(); ++i)
-			{
-				jsval val = m_ScriptInterface.ToJSVal(m_ScriptInterface.GetContext(), m_Players[i]->m_Player);
-				m_ScriptInterface.SetPropertyInt(playersID.get(), i, CScriptVal(val), true);
-			}
-			
-			m_ScriptInterface.SetProperty(settings.get(), "players", playersID);
-			
-			ENSURE(m_HasLoadedEntityTemplates);
-			m_ScriptInterface.SetProperty(settings.get(), "templates", m_EntityTemplates, false);
-		
-			m_ScriptInterface.SetProperty(settings.get(), "techTemplates", m_TechTemplates, false);
+		return loaded;
+	}
 
-			m_SharedAIObj = CScriptValRooted(m_ScriptInterface.GetContext(),m_ScriptInterface.CallConstructor(ctor.get(), settings.get()));
-		}
-		else
-		{
-			// won't get the tech templates directly.
-			// Set up the data to pass as the constructor argument
-			CScriptVal settings;
-			m_ScriptInterface.Eval(L"({})", settings);
-			CScriptVal playersID;
-			m_ScriptInterface.Eval(L"({})", playersID);
-			for (size_t i = 0; i < m_Players.size(); ++i)
-			{
-				jsval val = m_ScriptInterface.ToJSVal(m_ScriptInterface.GetContext(), m_Players[i]->m_Player);
-				m_ScriptInterface.SetPropertyInt(playersID.get(), i, CScriptVal(val), true);
-			}
-			
-			m_ScriptInterface.SetProperty(settings.get(), "players", playersID);
-			
-			CScriptVal m_fakeTech;
-			m_ScriptInterface.Eval("({})", m_fakeTech);
-			m_ScriptInterface.SetProperty(settings.get(), "techTemplates", m_fakeTech, false);
-
-			ENSURE(m_HasLoadedEntityTemplates);
-			m_ScriptInterface.SetProperty(settings.get(), "templates", m_EntityTemplates, false);
-			m_SharedAIObj = CScriptValRooted(m_ScriptInterface.GetContext(),m_ScriptInterface.CallConstructor(ctor.get(), settings.get()));
-		}
-		
-		if (m_SharedAIObj.undefined())
+	bool AddPlayer(const std::wstring& aiName, player_id_t player, bool callConstructor, const std::string& rngState = std::string())
+	{
+		ENSURE(m_CommandsComputed);
+
+		shared_ptr<CAIPlayer> ai(new CAIPlayer(*this, aiName, player));
+		if (!rngState.empty())
 		{
-			LOGERROR(L"Failed to create shared AI component: %ls: error calling constructor '%hs'", path.string().c_str(), "SharedScript");
-			return false;
+			std::stringstream rngStream(rngState);
+			rngStream >> ai->m_RNG;
 		}
-		
-		return true;
-	}
 
-	bool AddPlayer(const std::wstring& aiName, player_id_t player, bool callConstructor)
-	{
-		shared_ptr<CAIPlayer> ai(new CAIPlayer(*this, aiName, player, m_ScriptRuntime, m_RNG));
-		if (!ai->Initialise(callConstructor))
+		// Initialise the players one at a time, so their scripts are loaded
+		// in a deterministic order
+		ai->m_CallConstructor = callConstructor;
+		ai->RunTask(CAIPlayer::TaskInitialise);
+		if (!ai->m_TaskResult)
 			return false;
-		
-		// this will be set to true if we need to load the shared Component.
-		if (!m_HasSharedComponent)
-			m_HasSharedComponent = ai->m_UseSharedComponent;
-
-		m_ScriptInterface.MaybeGC();
 
 		m_Players.push_back(ai);
+		m_PlayerIDs.push_back(player);
 
 		return true;
 	}
 
 	bool RunGamestateInit(const shared_ptr<ScriptInterface::StructuredClone>& gameState, const Grid<u16>& passabilityMap, const Grid<u8>& territoryMap)
 	{
+		ENSURE(m_CommandsComputed);
+
 		// this will be run last by InitGame.Js, passing the full game representation.
 		// For now it will run for the shared Component.
-		CScriptVal state = m_ScriptInterface.ReadStructuredClone(gameState);
-		JSContext* cx = m_ScriptInterface.GetContext();
+		m_GameState = gameState;
+		m_PassabilityMap = passabilityMap;
+		m_PassabilityMapPartial = false;
+		m_TerritoryMap = territoryMap;
+		++m_TerritoryMapVersion;
 
-		m_PassabilityMapVal = CScriptValRooted(cx, ScriptInterface::ToJSVal(cx, passabilityMap));
-		m_TerritoryMapVal = CScriptValRooted(cx, ScriptInterface::ToJSVal(cx, territoryMap));
-		if (m_HasSharedComponent)
-		{
-			m_ScriptInterface.SetProperty(state.get(), "passabilityMap", m_PassabilityMapVal, true);
-			m_ScriptInterface.SetProperty(state.get(), "territoryMap", m_TerritoryMapVal, true);
+		for (size_t i = 0; i < m_Players.size(); ++i)
+			m_Players[i]->StartTask(CAIPlayer::TaskGamestateInit);
+		for (size_t i = 0; i < m_Players.size(); ++i)
+			m_Players[i]->WaitForTask();
 
-			m_ScriptInterface.CallFunctionVoid(m_SharedAIObj.get(), "initWithState", state);
-			m_ScriptInterface.MaybeGC();
-			
-			for (size_t i = 0; i < m_Players.size(); ++i)
-			{
-				if (m_HasSharedComponent && m_Players[i]->m_UseSharedComponent)
-					m_Players[i]->InitWithSharedScript(state,m_SharedAIObj);
-			}
-		}
-		
 		return true;
 	}
-	void StartComputation(const shared_ptr<ScriptInterface::StructuredClone>& gameState, const Grid<u16>& passabilityMap, const Grid<u8>& territoryMap, bool territoryMapDirty)
+	/**
+	 * @param gameStateDelta changes to the game state since the previous call
+	 *   (from a CScriptDeltaEncoder that was reset whenever NeedsFullGameState() returned true)
+	 * @param passabilityChanges if non-NULL, the only part of passabilityMap that
+	 *   has changed since the copy identified by GetPassabilityMapDirtyID()
+	 */
+	void StartComputation(const shared_ptr<ScriptInterface::StructuredClone>& gameStateDelta, const Grid<u16>& passabilityMap, const GridDirtyRegion* passabilityChanges, const Grid<u8>& territoryMap, bool territoryMapDirty)
 	{
 		ENSURE(m_CommandsComputed);
 
-		m_GameState = gameState;
+		m_GameStateDelta = gameStateDelta;
 
 		if (passabilityMap.m_DirtyID != m_PassabilityMap.m_DirtyID)
 		{
-			m_PassabilityMap = passabilityMap;
+			m_PassabilityMapPreviousDirtyID = m_PassabilityMap.m_DirtyID;
+			m_PassabilityMapPartial = false;
+
+			if (passabilityChanges && passabilityMap.m_W == m_PassabilityMap.m_W && passabilityMap.m_H == m_PassabilityMap.m_H)
+			{
+				// Remember the changes so the players can patch their script copies too
+				m_PassabilityMapChanges = *passabilityChanges;
+				m_PassabilityMapPartial = true;
 
-			JSContext* cx = m_ScriptInterface.GetContext();
-			m_PassabilityMapVal = CScriptValRooted(cx, ScriptInterface::ToJSVal(cx, m_PassabilityMap));
+				// Only copy the tiles that changed
+				if (!passabilityChanges->IsEmpty())
+				{
+					u16 i0 = passabilityChanges->i0;
+					u16 i1 = std::min(passabilityChanges->i1, (u16)(passabilityMap.m_W-1));
+					u16 j1 = std::min(passabilityChanges->j1, (u16)(passabilityMap.m_H-1));
+					for (u16 j = passabilityChanges->j0; j <= j1; ++j)
+						memcpy(&m_PassabilityMap.m_Data[j*m_PassabilityMap.m_W + i0], &passabilityMap.m_Data[j*passabilityMap.m_W + i0], (i1-i0+1)*sizeof(u16));
+				}
+				m_PassabilityMap.m_DirtyID = passabilityMap.m_DirtyID;
+			}
+			else
+			{
+				m_PassabilityMap = passabilityMap;
+			}
 		}
 
 		if (territoryMapDirty)
 		{
 			m_TerritoryMap = territoryMap;
-
-			JSContext* cx = m_ScriptInterface.GetContext();
-			m_TerritoryMapVal = CScriptValRooted(cx, ScriptInterface::ToJSVal(cx, m_TerritoryMap));
+			++m_TerritoryMapVersion;
 		}
 
+		// Commands computed from the state at the end of this turn are normally
+		// pushed at the start of the next; if pipelined, the players get a whole
+		// extra turn to compute them
+		m_ComputationTurn = m_TurnNum + (m_Pipelined ? 2 : 1);
+
+		// The players only read the data above, and it won't change until they've
+		// all finished, so they can all run in parallel
+		for (size_t i = 0; i < m_Players.size(); ++i)
+			m_Players[i]->StartTask(CAIPlayer::TaskRun);
+
 		m_CommandsComputed = false;
 	}
 
+	/**
+	 * Waits for the current computation (if any) to finish, and queues its
+	 * commands until the turn they're due.
+	 */
 	void WaitToFinishComputation()
 	{
-		if (!m_CommandsComputed)
+		if (m_CommandsComputed)
+			return;
+
 		{
-			PerformComputation();
-			m_CommandsComputed = true;
+			PROFILE3("AI wait");
+			for (size_t i = 0; i < m_Players.size(); ++i)
+				m_Players[i]->WaitForTask();
 		}
+		m_CommandsComputed = true;
+
+		// Copy the commands out of the players' runtimes, since those clones
+		// must be released before the players run again
+		SPendingCommands pending;
+		pending.turn = m_ComputationTurn;
+		pending.sets.resize(m_Players.size());
+		for (size_t i = 0; i < m_Players.size(); ++i)
+		{
+			pending.sets[i].player = m_Players[i]->m_Player;
+			for (size_t j = 0; j < m_Players[i]->m_Commands.size(); ++j)
+			{
+				CScriptVal val = m_ScriptInterface.ReadStructuredClone(m_Players[i]->m_Commands[j]);
+				pending.sets[i].commands.push_back(m_ScriptInterface.WriteStructuredClone(val.get()));
+			}
+			m_Players[i]->m_Commands.clear();
+		}
+		m_PendingCommands.push_back(pending);
 	}
 
+	/**
+	 * Starts a new turn, and returns the commands that are due at its start
+	 * (each computation's commands in the order the players were added),
+	 * waiting for them to be computed if necessary.
+	 */
 	void GetCommands(std::vector<SCommandSets>& commands)
 	{
- 		WaitToFinishComputation();
-		
+		++m_TurnNum;
+
+		if (!m_CommandsComputed && m_ComputationTurn <= m_TurnNum)
+			WaitToFinishComputation();
+
 		commands.clear();
-		commands.resize(m_Players.size());
-		for (size_t i = 0; i < m_Players.size(); ++i)
+		while (!m_PendingCommands.empty() && m_PendingCommands.front().turn <= m_TurnNum)
 		{
-			commands[i].player = m_Players[i]->m_Player;
-			commands[i].commands = m_Players[i]->m_Commands;
+			commands.insert(commands.end(), m_PendingCommands.front().sets.begin(), m_PendingCommands.front().sets.end());
+			m_PendingCommands.pop_front();
 		}
 	}
 
+	/**
+	 * Sets how often the players compute new commands (every @p interval turns)
+	 * and whether the commands are pipelined, i.e. pushed two turns after the
+	 * state they were computed from instead of one, so the simulation doesn't
+	 * have to wait for slow players. This must be the same on every client.
+	 */
+	void SetComputeSchedule(u32 interval, bool pipelined)
+	{
+		m_ComputeInterval = std::max(interval, (u32)1);
+		m_Pipelined = pipelined;
+	}
+
+	/**
+	 * Returns whether the players should compute at the end of this turn.
+	 */
+	bool IsComputeTurn() const
+	{
+		return m_TurnNum % m_ComputeInterval == 0;
+	}
+
 	void RegisterTechTemplates(const shared_ptr<ScriptInterface::StructuredClone>& techTemplates) {
-		JSContext* cx = m_ScriptInterface.GetContext();
-		m_TechTemplates = CScriptValRooted(cx, m_ScriptInterface.ReadStructuredClone(techTemplates));
+		m_TechTemplates = techTemplates;
 	}
-	
+
 	void LoadEntityTemplates(const std::vector<std::pair<std::string, const CParamNode*> >& templates)
 	{
 		m_HasLoadedEntityTemplates = true;
 
-		m_ScriptInterface.Eval("({})", m_EntityTemplates);
+		CScriptVal entityTemplates;
+		m_ScriptInterface.Eval("({})", entityTemplates);
 
 		for (size_t i = 0; i < templates.size(); ++i)
 		{
 			jsval val = templates[i].second->ToJSVal(m_ScriptInterface.GetContext(), false);
-			m_ScriptInterface.SetProperty(m_EntityTemplates.get(), templates[i].first.c_str(), CScriptVal(val), true);
+			m_ScriptInterface.SetProperty(entityTemplates.get(), templates[i].first.c_str(), CScriptVal(val), true);
 		}
 
-		// Since the template data is shared between AI players, freeze it
-		// to stop any of them changing it and confusing the other players
-		m_ScriptInterface.FreezeObject(m_EntityTemplates.get(), true);
+		// Each player reads its own copy of this
+		m_EntityTemplates = m_ScriptInterface.WriteStructuredClone(entityTemplates.get());
+
+		std::map<std::string, std::vector<std::string> > classes;
+		for (size_t i = 0; i < templates.size(); ++i)
+		{
+			std::stringstream classList(templates[i].second->GetChild("Identity").GetChild("Classes").ToUTF8());
+			std::vector<std::string>& templateClasses = classes[templates[i].first];
+			std::string className;
+			while (classList >> className)
+				templateClasses.push_back(className);
+		}
+		m_EntityIndex.Reset(entity_pos_t::Zero());
+		m_EntityIndex.SetTemplateClasses(classes);
+	}
+
+	/**
+	 * Returns the index of the game state's entities, which the caller can update
+	 * (with the same changes that are being sent in the next game state delta)
+	 * while the players aren't computing.
+	 */
+	EntityIndex& GetEntityIndex()
+	{
+		ENSURE(m_CommandsComputed);
+		return m_EntityIndex;
 	}
 
 	void Serialize(std::ostream& stream, bool isDebug)
@@ -586,29 +1119,46 @@ public:
 
 	void SerializeState(ISerializer& serializer)
 	{
-		std::stringstream rngStream;
-		rngStream << m_RNG;
-		serializer.StringASCII("rng", rngStream.str(), 0, 32);
-
 		serializer.NumberU32_Unbounded("turn", m_TurnNum);
+		serializer.NumberU32_Unbounded("compute interval", m_ComputeInterval);
+		serializer.Bool("pipelined", m_Pipelined);
+
+		serializer.NumberU32_Unbounded("num pending", (u32)m_PendingCommands.size());
+		for (std::deque<SPendingCommands>::iterator it = m_PendingCommands.begin(); it != m_PendingCommands.end(); ++it)
+		{
+			serializer.NumberU32_Unbounded("commands turn", it->turn);
+			serializer.NumberU32_Unbounded("num sets", (u32)it->sets.size());
+			for (size_t i = 0; i < it->sets.size(); ++i)
+			{
+				serializer.NumberI32_Unbounded("player", it->sets[i].player);
+				serializer.NumberU32_Unbounded("num commands", (u32)it->sets[i].commands.size());
+				for (size_t j = 0; j < it->sets[i].commands.size(); ++j)
+				{
+					CScriptVal val = m_ScriptInterface.ReadStructuredClone(it->sets[i].commands[j]);
+					serializer.ScriptVal("command", val);
+				}
+			}
+		}
 
 		serializer.NumberU32_Unbounded("num ais", (u32)m_Players.size());
 
+		// Get all the players' script data in parallel
+		for (size_t i = 0; i < m_Players.size(); ++i)
+			m_Players[i]->StartTask(CAIPlayer::TaskSerialize);
+		for (size_t i = 0; i < m_Players.size(); ++i)
+			m_Players[i]->WaitForTask();
+
 		for (size_t i = 0; i < m_Players.size(); ++i)
 		{
 			serializer.String("name", m_Players[i]->m_AIName, 1, 256);
 			serializer.NumberI32_Unbounded("player", m_Players[i]->m_Player);
 
-			serializer.NumberU32_Unbounded("num commands", (u32)m_Players[i]->m_Commands.size());
-			for (size_t j = 0; j < m_Players[i]->m_Commands.size(); ++j)
-			{
-				CScriptVal val = m_ScriptInterface.ReadStructuredClone(m_Players[i]->m_Commands[j]);
-				serializer.ScriptVal("command", val);
-			}
+			std::stringstream rngStream;
+			rngStream << m_Players[i]->m_RNG;
+			serializer.StringASCII("rng", rngStream.str(), 0, 32);
 
-			CScriptVal scriptData;
-			if (!m_ScriptInterface.CallFunction(m_Players[i]->m_Obj.get(), "Serialize", scriptData))
-				LOGERROR(L"AI script Serialize call failed");
+			CScriptVal scriptData = m_ScriptInterface.ReadStructuredClone(m_Players[i]->m_SerializedData);
+			m_Players[i]->m_SerializedData.reset();
 			serializer.ScriptVal("data", scriptData);
 		}
 	}
@@ -619,16 +1169,39 @@ public:
 
 		CStdDeserializer deserializer(m_ScriptInterface, stream);
 
-		m_PlayerMetadata.clear();
 		m_Players.clear();
-
-		std::string rngString;
-		std::stringstream rngStream;
-		deserializer.StringASCII("rng", rngString, 0, 32);
-		rngStream << rngString;
-		rngStream >> m_RNG;
+		m_PlayerIDs.clear();
+		m_PendingCommands.clear();
 
 		deserializer.NumberU32_Unbounded("turn", m_TurnNum);
+		deserializer.NumberU32_Unbounded("compute interval", m_ComputeInterval);
+		deserializer.Bool("pipelined", m_Pipelined);
+
+		uint32_t numPending;
+		deserializer.NumberU32_Unbounded("num pending", numPending);
+		for (size_t n = 0; n < numPending; ++n)
+		{
+			SPendingCommands pending;
+			deserializer.NumberU32_Unbounded("commands turn", pending.turn);
+
+			uint32_t numSets;
+			deserializer.NumberU32_Unbounded("num sets", numSets);
+			pending.sets.resize(numSets);
+			for (size_t i = 0; i < numSets; ++i)
+			{
+				deserializer.NumberI32_Unbounded("player", pending.sets[i].player);
+
+				uint32_t numCommands;
+				deserializer.NumberU32_Unbounded("num commands", numCommands);
+				for (size_t j = 0; j < numCommands; ++j)
+				{
+					CScriptVal val;
+					deserializer.ScriptVal("command", val);
+					pending.sets[i].commands.push_back(m_ScriptInterface.WriteStructuredClone(val.get()));
+				}
+			}
+			m_PendingCommands.push_back(pending);
+		}
 
 		uint32_t numAis;
 		deserializer.NumberU32_Unbounded("num ais", numAis);
@@ -637,133 +1210,83 @@ public:
 		{
 			std::wstring name;
 			player_id_t player;
+			std::string rngString;
 			deserializer.String("name", name, 1, 256);
 			deserializer.NumberI32_Unbounded("player", player);
-			if (!AddPlayer(name, player, true))
+			deserializer.StringASCII("rng", rngString, 0, 32);
+			if (!AddPlayer(name, player, true, rngString))
 				throw PSERROR_Deserialize_ScriptError();
 
-			uint32_t numCommands;
-			deserializer.NumberU32_Unbounded("num commands", numCommands);
-			m_Players.back()->m_Commands.reserve(numCommands);
-			for (size_t j = 0; j < numCommands; ++j)
-			{
-				CScriptVal val;
-				deserializer.ScriptVal("command", val);
-				m_Players.back()->m_Commands.push_back(m_ScriptInterface.WriteStructuredClone(val.get()));
-			}
-			
+			CAIPlayer& ai = *m_Players.back();
+
 			CScriptVal scriptData;
 			deserializer.ScriptVal("data", scriptData);
-			if (!m_ScriptInterface.CallFunctionVoid(m_Players.back()->m_Obj.get(), "Deserialize", scriptData))
-				LOGERROR(L"AI script Deserialize call failed");
-		}
-		TryLoadSharedComponent(false);
-	}
-	
-	int getPlayerSize()
-	{
-		return m_Players.size();
-	}
+			ai.m_SerializedData = m_ScriptInterface.WriteStructuredClone(scriptData.get());
 
-private:
-	CScriptValRooted LoadMetadata(const VfsPath& path)
-	{
-		if (m_PlayerMetadata.find(path) == m_PlayerMetadata.end())
-		{
-			// Load and cache the AI player metadata
-			m_PlayerMetadata[path] = m_ScriptInterface.ReadJSONFile(path);
-		}
+			ai.RunTask(CAIPlayer::TaskDeserialize);
 
-		return m_PlayerMetadata[path];
+			// The player has copied this into its own runtime
+			ai.m_SerializedData.reset();
+		}
+		TryLoadSharedComponent(false);
 	}
 
-	void PerformComputation()
+	/**
+	 * Returns whether a player failed to apply the last game state delta
+	 * (and clears the failure), in which case the next delta must contain the whole state.
+	 */
+	bool NeedsFullGameState()
 	{
-		if (m_Players.size() == 0)
-		{
-			// Run the GC every so often.
-			// (This isn't particularly necessary, but it makes profiling clearer
-			// since it avoids random GC delays while running other scripts)
-			if (m_TurnNum++ % 50 == 0)
-			{
-				PROFILE3("AI compute GC");
-				m_ScriptInterface.MaybeGC();
-			}
-			return;
-		}
-				
-		// Deserialize the game state, to pass to the AI's HandleMessage
-		CScriptVal state;
-		{
-			PROFILE3("AI compute read state");
-			state = m_ScriptInterface.ReadStructuredClone(m_GameState);
-			m_ScriptInterface.SetProperty(state.get(), "passabilityMap", m_PassabilityMapVal, true);
-			m_ScriptInterface.SetProperty(state.get(), "territoryMap", m_TerritoryMapVal, true);
-		}
-
-		// It would be nice to do
-		//   m_ScriptInterface.FreezeObject(state.get(), true);
-		// to prevent AI scripts accidentally modifying the state and
-		// affecting other AI scripts they share it with. But the performance
-		// cost is far too high, so we won't do that.
-		// If there is a shared component, run it
+		ENSURE(m_CommandsComputed);
 
-		if (m_HasSharedComponent)
-		{
-			PROFILE3("AI run shared component");
-			m_ScriptInterface.CallFunctionVoid(m_SharedAIObj.get(), "onUpdate", state);
-		}
-		
+		bool ret = false;
 		for (size_t i = 0; i < m_Players.size(); ++i)
 		{
-			PROFILE3("AI script");
-			PROFILE2_ATTR("player: %d", m_Players[i]->m_Player);
-			PROFILE2_ATTR("script: %ls", m_Players[i]->m_AIName.c_str());
-			if (m_HasSharedComponent && m_Players[i]->m_UseSharedComponent)
-				m_Players[i]->Run(state,m_SharedAIObj);
-			else
-				m_Players[i]->Run(state);
+			ret = ret || m_Players[i]->m_GameStateFailed;
+			m_Players[i]->m_GameStateFailed = false;
 		}
+		return ret;
+	}
 
-		// Run GC if we are about to overflow
-		if (JS_GetGCParameter(m_ScriptInterface.GetRuntime(), JSGC_BYTES) > 33000000)
-		{
-			PROFILE3("AI compute GC");
+	int getPlayerSize()
+	{
+		return m_Players.size();
+	}
 
-			JS_GC(m_ScriptInterface.GetContext());
-		}
-		
-		// Run the GC every so often.
-		// (This isn't particularly necessary, but it makes profiling clearer
-		// since it avoids random GC delays while running other scripts)
-		/*if (m_TurnNum++ % 20 == 0)
-		{
-			PROFILE3("AI compute GC");
-			m_ScriptInterface.MaybeGC();
-		}*/
+	size_t GetPassabilityMapDirtyID() const
+	{
+		return m_PassabilityMap.m_DirtyID;
 	}
 
+private:
 	shared_ptr<ScriptRuntime> m_ScriptRuntime;
 	ScriptInterface m_ScriptInterface;
-	boost::rand48 m_RNG;
-	u32 m_TurnNum;
+	u32 m_TurnNum; // the current simulation turn
 
-	CScriptValRooted m_EntityTemplates;
-	bool m_HasLoadedEntityTemplates;
-	CScriptValRooted m_TechTemplates;
+	u32 m_ComputeInterval;
+	bool m_Pipelined;
+	u32 m_ComputationTurn; // the turn that the current computation's commands are due
+	std::deque<SPendingCommands> m_PendingCommands; // in order of turn
 
-	std::map<VfsPath, CScriptValRooted> m_PlayerMetadata;
 	std::vector<shared_ptr<CAIPlayer> > m_Players; // use shared_ptr just to avoid copying
 
-	bool m_HasSharedComponent;
-	CScriptValRooted m_SharedAIObj;
-	std::vector<SCommandSets> m_Commands;
-	
-	shared_ptr<ScriptInterface::StructuredClone> m_GameState;
+	// Inputs to the players, which mustn't be modified while they're computing:
+
+	std::vector<player_id_t> m_PlayerIDs;
+	shared_ptr<ScriptInterface::StructuredClone> m_EntityTemplates;
+	bool m_HasLoadedEntityTemplates;
+	shared_ptr<ScriptInterface::StructuredClone> m_TechTemplates;
+	shared_ptr<ScriptInterface::StructuredClone> m_GameState; // full state, for RunGamestateInit
+	shared_ptr<ScriptInterface::StructuredClone> m_GameStateDelta; // for StartComputation
 	Grid<u16> m_PassabilityMap;
-	CScriptValRooted m_PassabilityMapVal;
+	// If m_PassabilityMapPartial, the map only differs from the version with
+	// m_PassabilityMapPreviousDirtyID in m_PassabilityMapChanges
+	bool m_PassabilityMapPartial;
+	size_t m_PassabilityMapPreviousDirtyID;
+	GridDirtyRegion m_PassabilityMapChanges;
 	Grid<u8> m_TerritoryMap;
-	CScriptValRooted m_TerritoryMapVal;
+	u32 m_TerritoryMapVersion; // incremented whenever m_TerritoryMap changes
+	EntityIndex m_EntityIndex;
 
 	bool m_CommandsComputed;
 };
@@ -787,10 +1310,20 @@ public:
 		return "<a:component type='system'/><empty/>";
 	}
 
+	CCmpAIManager() :
+		// Compare state / entities / entity / property, so only the changed entity
+		// properties are sent each turn
+		m_GameStateEncoder(3)
+	{
+	}
+
 	virtual void Init(const CParamNode& UNUSED(paramNode))
 	{
 		m_TerritoriesDirtyID = 0;
 
+		// The players (if any) will be recreated, without any copy of the game state
+		m_GameStateEncoder.Reset();
+
 		StartLoadEntityTemplates();
 	}
 
@@ -844,6 +1377,9 @@ public:
 	{
 		m_Worker.AddPlayer(id, player, true);
 
+		// The new player needs the whole game state
+		m_GameStateEncoder.Reset();
+
 		// AI players can cheat and see through FoW/SoD, since that greatly simplifies
 		// their implementation.
 		// (TODO: maybe cleverer AIs should be able to optionally retain FoW/SoD)
@@ -897,6 +1433,9 @@ public:
 		
 		LoadPathfinderClasses(state);
 
+		// There's no delta, so index all the entities
+		UpdateEntityIndex(state, CScriptVal(), *passabilityMap);
+
 		m_Worker.RunGamestateInit(scriptInterface.WriteStructuredClone(state.get()), *passabilityMap, *territoryMap);
 	}
 
@@ -910,6 +1449,13 @@ public:
 
 		if (m_Worker.getPlayerSize() == 0)
 			return;
+
+		// Collect the previous computation's commands (if it hasn't been
+		// waited for already), so the players are free to start again
+		m_Worker.WaitToFinishComputation();
+
+		if (!m_Worker.IsComputeTurn())
+			return;
 		
 		CmpPtr<ICmpAIInterface> cmpAIInterface(GetSimContext(), SYSTEM_ENTITY);
 		ENSURE(cmpAIInterface);
@@ -921,8 +1467,15 @@ public:
 		Grid<u16> dummyGrid;
 		const Grid<u16>* passabilityMap = &dummyGrid;
 		CmpPtr<ICmpPathfinder> cmpPathfinder(GetSimContext(), SYSTEM_ENTITY);
+		GridDirtyRegion changedRegion;
+		const GridDirtyRegion* passabilityChanges = NULL;
 		if (cmpPathfinder)
+		{
 			passabilityMap = &cmpPathfinder->GetPassabilityGrid();
+			// Let the worker update its copy incrementally, if it's recent enough
+			if (cmpPathfinder->GetPassabilityGridChanges(m_Worker.GetPassabilityMapDirtyID(), changedRegion))
+				passabilityChanges = &changedRegion;
+		}
 
 		// Get the territory data
 		//	Since getting the territory grid can trigger a recalculation, we check NeedUpdate first
@@ -938,7 +1491,28 @@ public:
 
 		LoadPathfinderClasses(state);
 
-		m_Worker.StartComputation(scriptInterface.WriteStructuredClone(state.get()), *passabilityMap, *territoryMap, territoryMapDirty);
+		if (m_Worker.NeedsFullGameState())
+			m_GameStateEncoder.Reset();
+
+		CScriptVal stateDelta;
+		{
+			PROFILE("AI encode state");
+			stateDelta = m_GameStateEncoder.Encode(scriptInterface, state);
+		}
+
+		UpdateEntityIndex(state, stateDelta, *passabilityMap);
+
+		m_Worker.StartComputation(scriptInterface.WriteStructuredClone(stateDelta.get()), *passabilityMap, passabilityChanges, *territoryMap, territoryMapDirty);
+	}
+
+	virtual void SetComputeSchedule(u32 interval, bool pipelined)
+	{
+		if (interval == 0)
+		{
+			LOGWARNING(L"AI compute interval must be at least 1 turn");
+			interval = 1;
+		}
+		m_Worker.SetComputeSchedule(interval, pipelined);
 	}
 
 	virtual void PushCommands()
@@ -968,6 +1542,9 @@ private:
 	std::vector<std::pair<std::string, const CParamNode*> > m_Templates;
 	size_t m_TerritoriesDirtyID;
 
+	// Not serialized, since it's reset whenever the players are recreated
+	CScriptDeltaEncoder m_GameStateEncoder;
+
 	void StartLoadEntityTemplates()
 	{
 		CmpPtr<ICmpTemplateManager> cmpTemplateManager(GetSimContext(), SYSTEM_ENTITY);
@@ -1007,6 +1584,64 @@ private:
 		}
 	}
 
+	/**
+	 * Updates the worker's entity index for the entities that the game state delta
+	 * changes (or for all the entities, if the delta replaces them all).
+	 */
+	void UpdateEntityIndex(CScriptVal state, CScriptVal stateDelta, const Grid<u16>& passabilityMap)
+	{
+		PROFILE("AI update entity index");
+
+		ScriptInterface& scriptInterface = GetSimContext().GetScriptInterface();
+		EntityIndex& index = m_Worker.GetEntityIndex();
+
+		CScriptVal entities;
+		if (!scriptInterface.GetProperty(state.get(), "entities", entities) || entities.undefined())
+		{
+			index.Reset(entity_pos_t::Zero());
+			return;
+		}
+
+		std::vector<std::wstring> changed;
+		if (!CScriptDeltaDecoder::GetChangedProperties(scriptInterface, stateDelta, L"entities", changed))
+		{
+			index.Reset(entity_pos_t::FromInt(passabilityMap.m_W * (int)TERRAIN_TILE_SIZE));
+
+			std::vector<std::string> names;
+			scriptInterface.EnumeratePropertyNamesWithPrefix(entities.get(), "", names);
+			changed.reserve(names.size());
+			for (size_t i = 0; i < names.size(); ++i)
+				changed.push_back(CStr(names[i]).FromUTF8());
+		}
+
+		for (size_t i = 0; i < changed.size(); ++i)
+		{
+			std::string name = CStrW(changed[i]).ToUTF8();
+			entity_id_t ent = CStr(name).ToUInt();
+
+			CScriptVal entity;
+			if (!scriptInterface.GetProperty(entities.get(), name.c_str(), entity) || entity.undefined())
+			{
+				index.Remove(ent);
+				continue;
+			}
+
+			std::string templateName;
+			player_id_t owner = INVALID_PLAYER;
+			scriptInterface.GetProperty(entity.get(), "template", templateName);
+			scriptInterface.GetProperty(entity.get(), "owner", owner);
+
+			CScriptVal positionVal;
+			std::vector<float> position;
+			bool inWorld = scriptInterface.GetProperty(entity.get(), "position", positionVal)
+				&& JSVAL_IS_OBJECT(positionVal.get()) && !JSVAL_IS_NULL(positionVal.get())
+				&& ScriptInterface::FromJSVal(scriptInterface.GetContext(), positionVal.get(), position) && position.size() == 2;
+
+			index.Update(ent, templateName, owner, inWorld, inWorld ?
+				CFixedVector2D(entity_pos_t::FromFloat(position[0]), entity_pos_t::FromFloat(position[1])) : CFixedVector2D());
+		}
+	}
+
 	void LoadPathfinderClasses(CScriptVal state)
 	{
 		CmpPtr<ICmpPathfinder> cmpPathfinder(GetSimContext(), SYSTEM_ENTITY);
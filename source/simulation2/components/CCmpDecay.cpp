@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -34,8 +34,7 @@
  *
  * This currently doesn't work with entities whose ICmpPosition has an initial Y offset.
  *
- * This isn't very efficient (we'll store data and iterate every frame for every entity,
- * not just for corpse entities) - it could be designed more optimally if that's a real problem.
+ * Inactive decay components sleep, so only the corpse entities are iterated every frame.
  *
  * Eventually we might want to adjust the decay rate based on user configuration (low-spec
  * machines could have fewer corpses), number of corpses, etc.
@@ -95,6 +94,9 @@ public:
 			debug_warn(L"CCmpDecay must not be used on non-local (network-synchronised) entities");
 			m_Active = false;
 		}
+
+		// Inactive components never do anything on MT_Interpolate
+		GetSimContext().GetComponentManager().SetSleeping(this, !m_Active);
 	}
 
 	virtual void Deinit()
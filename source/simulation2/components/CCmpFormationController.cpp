@@ -0,0 +1,207 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "simulation2/system/Component.h"
+#include "ICmpFormationController.h"
+
+#include "simulation2/MessageTypes.h"
+#include "simulation2/components/ICmpPosition.h"
+#include "simulation2/components/ICmpUnitMotion.h"
+#include "simulation2/serialization/SerializeTemplates.h"
+
+/**
+ * Formation member, with its offset relative to the controller.
+ */
+struct SFormationMember
+{
+	entity_id_t ent;
+	CFixedVector2D offset;
+};
+
+struct SerializeFormationMember
+{
+	template<typename S>
+	void operator()(S& serialize, const char* UNUSED(name), SFormationMember& value)
+	{
+		serialize.NumberU32_Unbounded("entity", value.ent);
+		serialize.NumberFixed_Unbounded("offset x", value.offset.X);
+		serialize.NumberFixed_Unbounded("offset y", value.offset.Y);
+	}
+};
+
+/**
+ * Native formation controller. The controller's own UnitMotion moves first,
+ * during MT_Update_MotionFormation; then this computes all the members' target
+ * points (with a single sin/cos for the whole formation) and passes them on,
+ * before the members move during MT_Update_MotionUnit.
+ *
+ * Controllers without any members sleep.
+ */
+class CCmpFormationController : public ICmpFormationController
+{
+public:
+	static void ClassInit(CComponentManager& componentManager)
+	{
+		componentManager.SubscribeToMessageType(MT_Update_MotionFormation);
+	}
+
+	DEFAULT_COMPONENT_ALLOCATOR(FormationController)
+
+	std::vector<SFormationMember> m_Members;
+
+	static std::string GetSchema()
+	{
+		return
+			"<a:help>Moves the members of a formation along with this formation controller entity.</a:help>"
+			"<a:example/>"
+			"<empty/>";
+	}
+
+	virtual void Init(const CParamNode& UNUSED(paramNode))
+	{
+		UpdateSleeping();
+	}
+
+	virtual void Deinit()
+	{
+	}
+
+	virtual void Serialize(ISerializer& serialize)
+	{
+		SerializeVector<SerializeFormationMember>()(serialize, "members", m_Members);
+	}
+
+	virtual void Deserialize(const CParamNode& paramNode, IDeserializer& deserialize)
+	{
+		Init(paramNode);
+
+		SerializeVector<SerializeFormationMember>()(deserialize, "members", m_Members);
+
+		UpdateSleeping();
+	}
+
+	virtual void HandleMessage(const CMessage& msg, bool UNUSED(global))
+	{
+		switch (msg.GetType())
+		{
+		case MT_Update_MotionFormation:
+		{
+			UpdateMembers();
+			break;
+		}
+		}
+	}
+
+	virtual void SetMemberOffset(entity_id_t ent, entity_pos_t x, entity_pos_t z)
+	{
+		SFormationMember* member = FindMember(ent);
+		if (!member)
+		{
+			SFormationMember newMember;
+			newMember.ent = ent;
+			m_Members.push_back(newMember);
+			member = &m_Members.back();
+			UpdateSleeping();
+		}
+		member->offset = CFixedVector2D(x, z);
+
+		CmpPtr<ICmpUnitMotion> cmpUnitMotion(GetSimContext(), ent);
+		if (cmpUnitMotion)
+			cmpUnitMotion->MoveToFormationOffset(GetEntityId(), x, z);
+	}
+
+	virtual void RemoveMember(entity_id_t ent)
+	{
+		for (size_t i = 0; i < m_Members.size(); ++i)
+		{
+			if (m_Members[i].ent == ent)
+			{
+				m_Members.erase(m_Members.begin() + i);
+				break;
+			}
+		}
+		UpdateSleeping();
+	}
+
+	virtual void RemoveAllMembers()
+	{
+		m_Members.clear();
+		UpdateSleeping();
+	}
+
+	virtual std::vector<entity_id_t> GetMembers()
+	{
+		std::vector<entity_id_t> ret;
+		ret.reserve(m_Members.size());
+		for (size_t i = 0; i < m_Members.size(); ++i)
+			ret.push_back(m_Members[i].ent);
+		return ret;
+	}
+
+	virtual CFixedVector2D GetMemberOffset(entity_id_t ent)
+	{
+		SFormationMember* member = FindMember(ent);
+		if (!member)
+			return CFixedVector2D();
+		return member->offset;
+	}
+
+private:
+	SFormationMember* FindMember(entity_id_t ent)
+	{
+		for (size_t i = 0; i < m_Members.size(); ++i)
+			if (m_Members[i].ent == ent)
+				return &m_Members[i];
+		return NULL;
+	}
+
+	void UpdateSleeping()
+	{
+		GetSimContext().GetComponentManager().SetSleeping(this, m_Members.empty());
+	}
+
+	void UpdateMembers()
+	{
+		CmpPtr<ICmpPosition> cmpPosition(GetSimContext(), GetEntityId());
+		if (!cmpPosition || !cmpPosition->IsInWorld())
+			return;
+
+		CFixedVector2D pos = cmpPosition->GetPosition2D();
+
+		// This must match how CCmpUnitMotion::ComputeTargetPosition rotates
+		// the offset, so the members move the same way as when they compute
+		// their targets themselves
+		fixed s, c;
+		sincos_approx(cmpPosition->GetRotation().Y, s, c);
+
+		for (size_t i = 0; i < m_Members.size(); ++i)
+		{
+			const CFixedVector2D& offset = m_Members[i].offset;
+			CFixedVector2D target = pos;
+			if (!offset.IsZero())
+				target += CFixedVector2D(offset.X.Multiply(c) + offset.Y.Multiply(s), offset.Y.Multiply(c) - offset.X.Multiply(s));
+
+			CmpPtr<ICmpUnitMotion> cmpUnitMotion(GetSimContext(), m_Members[i].ent);
+			if (cmpUnitMotion)
+				cmpUnitMotion->SetFormationTarget(GetEntityId(), target.X, target.Y);
+		}
+	}
+};
+
+REGISTER_COMPONENT_TYPE(FormationController)
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -29,8 +29,10 @@
 #include "graphics/Overlay.h"
 #include "graphics/Terrain.h"
 #include "maths/MathUtil.h"
+#include "ps/FrameArena.h"
 #include "ps/Overlay.h"
 #include "ps/Profile.h"
+#include "ps/ThreadPool.h"
 #include "renderer/Scene.h"
 #include "ps/CLogger.h"
 
@@ -125,7 +127,18 @@ public:
 	std::vector<SOverlayLine> m_DebugOverlayLines;
 
 	SpatialSubdivision<u32> m_UnitSubdivision;
-	SpatialSubdivision<u32> m_StaticSubdivision;
+
+	// Static shapes almost never move, so they're stored in a subdivision that's
+	// rebuilt from m_StaticShapes (in id order) when first queried after any change.
+	// (It's not part of the component's state, since it's derived entirely from m_StaticShapes.)
+	StaticSpatialSubdivision<u32> m_StaticSubdivision;
+	bool m_StaticSubdivisionDirty;
+
+	// Scratch space for subdivision queries, to avoid reallocating it every time
+	// (not part of the component's state).
+	// (The unit subdivision is serialized with the order of items in each division, so
+	// its query results are in the same order on every machine.)
+	std::vector<u32> m_QueryShapes;
 
 	// TODO: using std::map is a bit inefficient; is there a better way to store these?
 	std::map<u32, UnitShape> m_UnitShapes;
@@ -154,6 +167,8 @@ public:
 		m_StaticShapeNext = 1;
 
 		m_DirtyID = 1; // init to 1 so default-initialised grids are considered dirty
+		m_DirtyAllID = 1;
+		m_DirtyAreas.clear();
 
 		m_PassabilityCircular = false;
 
@@ -172,7 +187,6 @@ public:
 	void SerializeCommon(S& serialize)
 	{
 		SerializeSpatialSubdivision<SerializeU32_Unbounded>()(serialize, "unit subdiv", m_UnitSubdivision);
-		SerializeSpatialSubdivision<SerializeU32_Unbounded>()(serialize, "static subdiv", m_StaticSubdivision);
 
 		SerializeMap<SerializeU32_Unbounded, SerializeUnitShape>()(serialize, "unit shapes", m_UnitShapes);
 		SerializeMap<SerializeU32_Unbounded, SerializeStaticShape>()(serialize, "static shapes", m_StaticShapes);
@@ -200,6 +214,12 @@ public:
 		Init(paramNode);
 
 		SerializeCommon(deserialize);
+
+		// The static subdivision isn't serialized, so just restore its bounds
+		// (it'll be filled in when it's first used)
+		if (!m_WorldX1.IsZero() && !m_WorldZ1.IsZero())
+			m_StaticSubdivision.Reset(m_WorldX1, m_WorldZ1, entity_pos_t::FromInt(8*TERRAIN_TILE_SIZE));
+		m_StaticSubdivisionDirty = true;
 	}
 
 	virtual void HandleMessage(const CMessage& msg, bool UNUSED(global))
@@ -234,6 +254,7 @@ public:
 		// (TODO: find the optimal number instead of blindly guessing)
 		m_UnitSubdivision.Reset(x1, z1, entity_pos_t::FromInt(8*TERRAIN_TILE_SIZE));
 		m_StaticSubdivision.Reset(x1, z1, entity_pos_t::FromInt(8*TERRAIN_TILE_SIZE));
+		m_StaticSubdivisionDirty = true;
 
 		for (std::map<u32, UnitShape>::iterator it = m_UnitShapes.begin(); it != m_UnitShapes.end(); ++it)
 		{
@@ -241,13 +262,28 @@ public:
 			CFixedVector2D halfSize(it->second.r, it->second.r);
 			m_UnitSubdivision.Add(it->first, center - halfSize, center + halfSize);
 		}
+	}
+
+	/**
+	 * Rebuild m_StaticSubdivision if any static shapes have changed since it was last built.
+	 */
+	void UpdateStaticSubdivision()
+	{
+		if (!m_StaticSubdivisionDirty)
+			return;
 
+		PROFILE("UpdateStaticSubdivision");
+
+		m_StaticSubdivision.Clear();
 		for (std::map<u32, StaticShape>::iterator it = m_StaticShapes.begin(); it != m_StaticShapes.end(); ++it)
 		{
 			CFixedVector2D center(it->second.x, it->second.z);
 			CFixedVector2D bbHalfSize = Geometry::GetHalfBoundingBox(it->second.u, it->second.v, CFixedVector2D(it->second.hw, it->second.hh));
 			m_StaticSubdivision.Add(it->first, center - bbHalfSize, center + bbHalfSize);
 		}
+		m_StaticSubdivision.Build();
+
+		m_StaticSubdivisionDirty = false;
 	}
 
 	virtual tag_t AddUnitShape(entity_id_t ent, entity_pos_t x, entity_pos_t z, entity_pos_t r, flags_t flags, entity_id_t group)
@@ -255,7 +291,7 @@ public:
 		UnitShape shape = { ent, x, z, r, flags, group };
 		u32 id = m_UnitShapeNext++;
 		m_UnitShapes[id] = shape;
-		MakeDirtyUnit(flags);
+		MakeDirtyUnit(shape);
 
 		m_UnitSubdivision.Add(id, CFixedVector2D(x - r, z - r), CFixedVector2D(x + r, z + r));
 
@@ -272,11 +308,9 @@ public:
 		StaticShape shape = { ent, x, z, u, v, w/2, h/2, flags, group, group2 };
 		u32 id = m_StaticShapeNext++;
 		m_StaticShapes[id] = shape;
-		MakeDirtyStatic(flags);
+		MakeDirtyStatic(shape);
 
-		CFixedVector2D center(x, z);
-		CFixedVector2D bbHalfSize = Geometry::GetHalfBoundingBox(u, v, CFixedVector2D(w/2, h/2));
-		m_StaticSubdivision.Add(id, center - bbHalfSize, center + bbHalfSize);
+		m_StaticSubdivisionDirty = true;
 
 		return STATIC_INDEX_TO_TAG(id);
 	}
@@ -308,6 +342,9 @@ public:
 		{
 			UnitShape& shape = m_UnitShapes[TAG_TO_INDEX(tag)];
 
+			// The tiles at both the old and new positions will need updating
+			MakeDirtyUnit(shape);
+
 			m_UnitSubdivision.Move(TAG_TO_INDEX(tag),
 				CFixedVector2D(shape.x - shape.r, shape.z - shape.r),
 				CFixedVector2D(shape.x + shape.r, shape.z + shape.r),
@@ -317,7 +354,7 @@ public:
 			shape.x = x;
 			shape.z = z;
 
-			MakeDirtyUnit(shape.flags);
+			MakeDirtyUnit(shape);
 		}
 		else
 		{
@@ -328,20 +365,16 @@ public:
 
 			StaticShape& shape = m_StaticShapes[TAG_TO_INDEX(tag)];
 
-			CFixedVector2D fromBbHalfSize = Geometry::GetHalfBoundingBox(shape.u, shape.v, CFixedVector2D(shape.hw, shape.hh));
-			CFixedVector2D toBbHalfSize = Geometry::GetHalfBoundingBox(u, v, CFixedVector2D(shape.hw, shape.hh));
-			m_StaticSubdivision.Move(TAG_TO_INDEX(tag),
-				CFixedVector2D(shape.x, shape.z) - fromBbHalfSize,
-				CFixedVector2D(shape.x, shape.z) + fromBbHalfSize,
-				CFixedVector2D(x, z) - toBbHalfSize,
-				CFixedVector2D(x, z) + toBbHalfSize);
+			MakeDirtyStatic(shape);
+
+			m_StaticSubdivisionDirty = true;
 
 			shape.x = x;
 			shape.z = z;
 			shape.u = u;
 			shape.v = v;
 
-			MakeDirtyStatic(shape.flags);
+			MakeDirtyStatic(shape);
 		}
 	}
 
@@ -395,18 +428,16 @@ public:
 				CFixedVector2D(shape.x - shape.r, shape.z - shape.r),
 				CFixedVector2D(shape.x + shape.r, shape.z + shape.r));
 
-			MakeDirtyUnit(shape.flags);
+			MakeDirtyUnit(shape);
 			m_UnitShapes.erase(TAG_TO_INDEX(tag));
 		}
 		else
 		{
 			StaticShape& shape = m_StaticShapes[TAG_TO_INDEX(tag)];
 
-			CFixedVector2D center(shape.x, shape.z);
-			CFixedVector2D bbHalfSize = Geometry::GetHalfBoundingBox(shape.u, shape.v, CFixedVector2D(shape.hw, shape.hh));
-			m_StaticSubdivision.Remove(TAG_TO_INDEX(tag), center - bbHalfSize, center + bbHalfSize);
+			m_StaticSubdivisionDirty = true;
 
-			MakeDirtyStatic(shape.flags);
+			MakeDirtyStatic(shape);
 			m_StaticShapes.erase(TAG_TO_INDEX(tag));
 		}
 	}
@@ -435,7 +466,7 @@ public:
 	virtual bool TestStaticShape(const IObstructionTestFilter& filter, entity_pos_t x, entity_pos_t z, entity_pos_t a, entity_pos_t w, entity_pos_t h, std::vector<entity_id_t>* out);
 	virtual bool TestUnitShape(const IObstructionTestFilter& filter, entity_pos_t x, entity_pos_t z, entity_pos_t r, std::vector<entity_id_t>* out);
 
-	virtual bool Rasterise(Grid<u8>& grid);
+	virtual bool Rasterise(Grid<u8>& grid, GridDirtyRegion* dirtyRegion);
 	virtual void GetObstructionsInRange(const IObstructionTestFilter& filter, entity_pos_t x0, entity_pos_t z0, entity_pos_t x1, entity_pos_t z1, std::vector<ObstructionSquare>& squares);
 	virtual bool FindMostImportantObstruction(const IObstructionTestFilter& filter, entity_pos_t x, entity_pos_t z, entity_pos_t r, ObstructionSquare& square);
 
@@ -462,6 +493,24 @@ private:
 
 	size_t m_DirtyID;
 
+	// To support incremental updates, we also remember the world-space area
+	// affected by each recent change. Grids whose DirtyID is at least m_DirtyAllID
+	// only need to update the tiles covered by the areas with a higher ID;
+	// older grids need to be completely rasterised.
+
+	struct DirtyArea
+	{
+		size_t id; // value of m_DirtyID after the change
+		entity_pos_t x0, z0, x1, z1;
+	};
+
+	std::deque<DirtyArea> m_DirtyAreas;
+	size_t m_DirtyAllID;
+
+	// Limit on the length of m_DirtyAreas (grids that have missed more changes
+	// than this will just be rasterised from scratch)
+	static const size_t MAX_DIRTY_AREAS = 128;
+
 	/**
 	 * Mark all previous Rasterise()d grids as dirty, and the debug display.
 	 * Call this when the world bounds have changed.
@@ -469,6 +518,8 @@ private:
 	void MakeDirtyAll()
 	{
 		++m_DirtyID;
+		m_DirtyAllID = m_DirtyID;
+		m_DirtyAreas.clear();
 		m_DebugOverlayDirty = true;
 	}
 
@@ -481,30 +532,56 @@ private:
 		m_DebugOverlayDirty = true;
 	}
 
+	/**
+	 * Mark the given area of all previous Rasterise()d grids as dirty.
+	 */
+	void MakeDirtyArea(entity_pos_t x0, entity_pos_t z0, entity_pos_t x1, entity_pos_t z1)
+	{
+		++m_DirtyID;
+
+		DirtyArea area = { m_DirtyID, x0, z0, x1, z1 };
+		m_DirtyAreas.push_back(area);
+
+		if (m_DirtyAreas.size() > MAX_DIRTY_AREAS)
+		{
+			m_DirtyAllID = m_DirtyAreas.front().id;
+			m_DirtyAreas.pop_front();
+		}
+	}
+
 	/**
 	 * Mark all previous Rasterise()d grids as dirty, if they depend on this shape.
-	 * Call this when a static shape has changed.
+	 * Call this when a static shape has changed (with both its old and new state, if it moved).
 	 */
-	void MakeDirtyStatic(flags_t flags)
+	void MakeDirtyStatic(const StaticShape& shape)
 	{
-		if (flags & (FLAG_BLOCK_PATHFINDING|FLAG_BLOCK_FOUNDATION))
-			++m_DirtyID;
+		if (shape.flags & (FLAG_BLOCK_PATHFINDING|FLAG_BLOCK_FOUNDATION))
+		{
+			CFixedVector2D bbHalfSize = Geometry::GetHalfBoundingBox(shape.u, shape.v, CFixedVector2D(shape.hw, shape.hh));
+			MakeDirtyArea(shape.x - bbHalfSize.X, shape.z - bbHalfSize.Y, shape.x + bbHalfSize.X, shape.z + bbHalfSize.Y);
+		}
 
 		m_DebugOverlayDirty = true;
 	}
 
 	/**
 	 * Mark all previous Rasterise()d grids as dirty, if they depend on this shape.
-	 * Call this when a unit shape has changed.
+	 * Call this when a unit shape has changed (with both its old and new state, if it moved).
 	 */
-	void MakeDirtyUnit(flags_t flags)
+	void MakeDirtyUnit(const UnitShape& shape)
 	{
-		if (flags & (FLAG_BLOCK_PATHFINDING|FLAG_BLOCK_FOUNDATION))
-			++m_DirtyID;
+		if (shape.flags & (FLAG_BLOCK_PATHFINDING|FLAG_BLOCK_FOUNDATION))
+			MakeDirtyArea(shape.x - shape.r, shape.z - shape.r, shape.x + shape.r, shape.z + shape.r);
 
 		m_DebugOverlayDirty = true;
 	}
 
+	/**
+	 * Rasterises the tiles of the given region, which must be non-empty.
+	 * @param full whether the region is the entire grid
+	 */
+	void RasteriseRegion(Grid<u8>& grid, const GridDirtyRegion& region, bool full);
+
 	/**
 	 * Test whether a Rasterise()d grid is dirty and needs updating
 	 */
@@ -544,10 +621,11 @@ bool CCmpObstructionManager::TestLine(const IObstructionTestFilter& filter, enti
 	CFixedVector2D posMin (std::min(x0, x1) - r, std::min(z0, z1) - r);
 	CFixedVector2D posMax (std::max(x0, x1) + r, std::max(z0, z1) + r);
 
-	std::vector<u32> unitShapes = m_UnitSubdivision.GetInRange(posMin, posMax);
-	for (size_t i = 0; i < unitShapes.size(); ++i)
+	m_QueryShapes.clear();
+	m_UnitSubdivision.GetInRange(m_QueryShapes, posMin, posMax);
+	for (size_t i = 0; i < m_QueryShapes.size(); ++i)
 	{
-		std::map<u32, UnitShape>::iterator it = m_UnitShapes.find(unitShapes[i]);
+		std::map<u32, UnitShape>::iterator it = m_UnitShapes.find(m_QueryShapes[i]);
 		ENSURE(it != m_UnitShapes.end());
 
 		if (!filter.TestShape(UNIT_INDEX_TO_TAG(it->first), it->second.flags, it->second.group, INVALID_ENTITY))
@@ -559,10 +637,12 @@ bool CCmpObstructionManager::TestLine(const IObstructionTestFilter& filter, enti
 			return true;
 	}
 
-	std::vector<u32> staticShapes = m_StaticSubdivision.GetInRange(posMin, posMax);
-	for (size_t i = 0; i < staticShapes.size(); ++i)
+	UpdateStaticSubdivision();
+	m_QueryShapes.clear();
+	m_StaticSubdivision.GetInRange(m_QueryShapes, posMin, posMax);
+	for (size_t i = 0; i < m_QueryShapes.size(); ++i)
 	{
-		std::map<u32, StaticShape>::iterator it = m_StaticShapes.find(staticShapes[i]);
+		std::map<u32, StaticShape>::iterator it = m_StaticShapes.find(m_QueryShapes[i]);
 		ENSURE(it != m_StaticShapes.end());
 
 		if (!filter.TestShape(STATIC_INDEX_TO_TAG(it->first), it->second.flags, it->second.group, it->second.group2))
@@ -583,8 +663,6 @@ bool CCmpObstructionManager::TestStaticShape(const IObstructionTestFilter& filte
 {
 	PROFILE("TestStaticShape");
 
-	// TODO: should use the subdivision stuff here, if performance is non-negligible
-
 	if (out)
 		out->clear();
 
@@ -623,8 +701,20 @@ bool CCmpObstructionManager::TestStaticShape(const IObstructionTestFilter& filte
 		}
 	}
 
-	for (std::map<u32, StaticShape>::iterator it = m_StaticShapes.begin(); it != m_StaticShapes.end(); ++it)
+	// Only static shapes whose bounding boxes overlap this shape's can collide with it.
+	// (Units are still all tested, since their squares are expanded along this shape's
+	// axes and could be outside its bounding box.)
+	// The candidates are sorted so the output is in the same order as testing every shape.
+	CFixedVector2D bbHalfSize = Geometry::GetHalfBoundingBox(u, v, halfSize);
+	UpdateStaticSubdivision();
+	m_QueryShapes.clear();
+	m_StaticSubdivision.GetInRange(m_QueryShapes, center - bbHalfSize, center + bbHalfSize);
+	std::sort(m_QueryShapes.begin(), m_QueryShapes.end());
+	for (size_t i = 0; i < m_QueryShapes.size(); ++i)
 	{
+		std::map<u32, StaticShape>::iterator it = m_StaticShapes.find(m_QueryShapes[i]);
+		ENSURE(it != m_StaticShapes.end());
+
 		if (!filter.TestShape(STATIC_INDEX_TO_TAG(it->first), it->second.flags, it->second.group, it->second.group2))
 			continue;
 
@@ -651,8 +741,6 @@ bool CCmpObstructionManager::TestUnitShape(const IObstructionTestFilter& filter,
 {
 	PROFILE("TestUnitShape");
 
-	// TODO: should use the subdivision stuff here, if performance is non-negligible
-
 	// Check that the shape is within the world
 	if (!IsInWorld(x, z, r))
 	{
@@ -664,8 +752,16 @@ bool CCmpObstructionManager::TestUnitShape(const IObstructionTestFilter& filter,
 
 	CFixedVector2D center(x, z);
 
-	for (std::map<u32, UnitShape>::iterator it = m_UnitShapes.begin(); it != m_UnitShapes.end(); ++it)
+	// The candidates from the subdivisions are sorted so the output is in the
+	// same order as testing every shape
+	m_QueryShapes.clear();
+	m_UnitSubdivision.GetInRange(m_QueryShapes, center - CFixedVector2D(r, r), center + CFixedVector2D(r, r));
+	std::sort(m_QueryShapes.begin(), m_QueryShapes.end());
+	for (size_t i = 0; i < m_QueryShapes.size(); ++i)
 	{
+		std::map<u32, UnitShape>::iterator it = m_UnitShapes.find(m_QueryShapes[i]);
+		ENSURE(it != m_UnitShapes.end());
+
 		if (!filter.TestShape(UNIT_INDEX_TO_TAG(it->first), it->second.flags, it->second.group, INVALID_ENTITY))
 			continue;
 
@@ -680,8 +776,17 @@ bool CCmpObstructionManager::TestUnitShape(const IObstructionTestFilter& filter,
 		}
 	}
 
-	for (std::map<u32, StaticShape>::iterator it = m_StaticShapes.begin(); it != m_StaticShapes.end(); ++it)
+	// The static shape's square is expanded by r along its own axes, so it might reach
+	// up to r*sqrt(2) outside its bounding box; search twice as far to be safe
+	UpdateStaticSubdivision();
+	m_QueryShapes.clear();
+	m_StaticSubdivision.GetInRange(m_QueryShapes, center - CFixedVector2D(r*2, r*2), center + CFixedVector2D(r*2, r*2));
+	std::sort(m_QueryShapes.begin(), m_QueryShapes.end());
+	for (size_t i = 0; i < m_QueryShapes.size(); ++i)
 	{
+		std::map<u32, StaticShape>::iterator it = m_StaticShapes.find(m_QueryShapes[i]);
+		ENSURE(it != m_StaticShapes.end());
+
 		if (!filter.TestShape(STATIC_INDEX_TO_TAG(it->first), it->second.flags, it->second.group, it->second.group2))
 			continue;
 
@@ -720,20 +825,195 @@ static void TileCenter(u16 i, u16 j, entity_pos_t& x, entity_pos_t& z)
 	z = entity_pos_t::FromInt(j*(int)TERRAIN_TILE_SIZE + (int)TERRAIN_TILE_SIZE/2);
 }
 
-bool CCmpObstructionManager::Rasterise(Grid<u8>& grid)
+/**
+ * Number of grid rows rasterised by each task in RasteriseRegion.
+ */
+static const u16 RASTERISE_BAND_ROWS = 16;
+
+namespace
+{
+/**
+ * A shape to be drawn onto the grid by RasteriseItem, with the bounds of the tiles
+ * it might cover.
+ */
+struct RasteriseShape
+{
+	CFixedVector2D center;
+	CFixedVector2D u, v, halfSize; // only used for squares
+	u16 i0, j0, i1, j1;
+	u8 flag;
+	bool square; // else every tile in the bounds is covered
+};
+
+/**
+ * Arrays used by RasteriseItem, reused for every square.
+ * (These aren't allocated from the frame arena, since each thread needs its own.)
+ */
+struct RasteriseScratch
+{
+	std::vector<entity_pos_t> x;
+	std::vector<entity_pos_t> z;
+	std::vector<u8> inside;
+};
+
+struct RasteriseJob
+{
+	Grid<u8>* grid;
+	const GridDirtyRegion* region;
+	const std::vector<RasteriseShape>* shapes;
+};
+}
+
+static void AddRasteriseSquare(std::vector<RasteriseShape>& shapes, const Grid<u8>& grid,
+	CFixedVector2D center, CFixedVector2D u, CFixedVector2D v, CFixedVector2D halfSize, u8 flag)
+{
+	CFixedVector2D halfBound = Geometry::GetHalfBoundingBox(u, v, halfSize);
+
+	RasteriseShape shape;
+	shape.center = center;
+	shape.u = u;
+	shape.v = v;
+	shape.halfSize = halfSize;
+	NearestTile(center.X - halfBound.X, center.Y - halfBound.Y, shape.i0, shape.j0, grid.m_W, grid.m_H);
+	NearestTile(center.X + halfBound.X, center.Y + halfBound.Y, shape.i1, shape.j1, grid.m_W, grid.m_H);
+	shape.flag = flag;
+	shape.square = true;
+	shapes.push_back(shape);
+}
+
+static void AddRasteriseBox(std::vector<RasteriseShape>& shapes, const Grid<u8>& grid,
+	CFixedVector2D center, entity_pos_t r, u8 flag)
+{
+	RasteriseShape shape;
+	shape.center = center;
+	NearestTile(center.X - r, center.Y - r, shape.i0, shape.j0, grid.m_W, grid.m_H);
+	NearestTile(center.X + r, center.Y + r, shape.i1, shape.j1, grid.m_W, grid.m_H);
+	shape.flag = flag;
+	shape.square = false;
+	shapes.push_back(shape);
+}
+
+/**
+ * Sets the shape's flag on every tile in @p region that it covers. For squares,
+ * that's the tiles whose centers are inside the square, testing a row of tiles at a time.
+ */
+static void RasteriseItem(Grid<u8>& grid, const GridDirtyRegion& region, const RasteriseShape& shape,
+	RasteriseScratch& scratch)
+{
+	u16 i0 = std::max(shape.i0, region.i0);
+	u16 i1 = std::min(shape.i1, region.i1);
+	u16 j0 = std::max(shape.j0, region.j0);
+	u16 j1 = std::min(shape.j1, region.j1);
+	if (i0 > i1 || j0 > j1)
+		return;
+
+	if (!shape.square)
+	{
+		for (u16 j = j0; j <= j1; ++j)
+			for (u16 i = i0; i <= i1; ++i)
+				grid.set(i, j, grid.get(i, j) | shape.flag);
+		return;
+	}
+
+	// Every row has the same tile X coordinates
+	size_t count = i1 - i0 + 1;
+	scratch.x.resize(count);
+	scratch.z.resize(count);
+	scratch.inside.resize(count);
+	for (size_t k = 0; k < count; ++k)
+	{
+		entity_pos_t x, z;
+		TileCenter((u16)(i0 + k), 0, x, z);
+		scratch.x[k] = x - shape.center.X;
+	}
+
+	for (u16 j = j0; j <= j1; ++j)
+	{
+		entity_pos_t x, z;
+		TileCenter(0, j, x, z);
+		std::fill(scratch.z.begin(), scratch.z.end(), z - shape.center.Y);
+
+		Geometry::PointsAreInSquare(count, &scratch.x[0], &scratch.z[0], shape.u, shape.v, shape.halfSize, &scratch.inside[0]);
+		for (size_t k = 0; k < count; ++k)
+			if (scratch.inside[k])
+				grid.set((u16)(i0 + k), j, grid.get((u16)(i0 + k), j) | shape.flag);
+	}
+}
+
+/**
+ * Rasterises every shape onto the bands of rows [begin, end) of the job's region.
+ * Each band only writes to its own rows, so bands can be done in parallel, and since
+ * the shapes just set flags the result doesn't depend on the order.
+ */
+static void RasteriseCallback(void* cbdata, size_t begin, size_t end)
+{
+	RasteriseJob* job = static_cast<RasteriseJob*>(cbdata);
+	const std::vector<RasteriseShape>& shapes = *job->shapes;
+
+	RasteriseScratch scratch;
+	for (size_t n = begin; n < end; ++n)
+	{
+		GridDirtyRegion band = *job->region;
+		band.j0 = (u16)(job->region->j0 + n * RASTERISE_BAND_ROWS);
+		band.j1 = (u16)std::min((size_t)job->region->j1, (size_t)band.j0 + RASTERISE_BAND_ROWS - 1);
+
+		for (size_t k = 0; k < shapes.size(); ++k)
+			RasteriseItem(*job->grid, band, shapes[k], scratch);
+	}
+}
+
+bool CCmpObstructionManager::Rasterise(Grid<u8>& grid, GridDirtyRegion* dirtyRegion)
 {
 	if (!IsDirty(grid))
 		return false;
 
 	PROFILE("Rasterise");
 
+	// Work out which tiles might have changed since the grid was last rasterised
+	GridDirtyRegion region;
+	bool full = (grid.m_DirtyID < m_DirtyAllID);
+	if (full)
+	{
+		region.SetAll(grid.m_W, grid.m_H);
+	}
+	else
+	{
+		// Expand the areas to cover the foundation expansion in RasteriseRegion, and rounding
+		entity_pos_t margin = entity_pos_t::FromInt(TERRAIN_TILE_SIZE * 2);
+
+		for (std::deque<DirtyArea>::reverse_iterator it = m_DirtyAreas.rbegin(); it != m_DirtyAreas.rend() && it->id > grid.m_DirtyID; ++it)
+		{
+			u16 i0, j0, i1, j1;
+			NearestTile(it->x0 - margin, it->z0 - margin, i0, j0, grid.m_W, grid.m_H);
+			NearestTile(it->x1 + margin, it->z1 + margin, i1, j1, grid.m_W, grid.m_H);
+			region.Add(i0, j0);
+			region.Add(i1, j1);
+		}
+	}
+
 	grid.m_DirtyID = m_DirtyID;
 
-	// TODO: this is all hopelessly inefficient
-	// What we should perhaps do is have some kind of quadtree storing Shapes so it's
-	// quick to invalidate and update small numbers of tiles
+	if (!region.IsEmpty())
+		RasteriseRegion(grid, region, full);
 
-	grid.reset();
+	if (dirtyRegion)
+		*dirtyRegion = region;
+
+	return true;
+}
+
+void CCmpObstructionManager::RasteriseRegion(Grid<u8>& grid, const GridDirtyRegion& region, bool full)
+{
+	if (full)
+	{
+		grid.reset();
+	}
+	else
+	{
+		for (u16 j = region.j0; j <= region.j1; ++j)
+			for (u16 i = region.i0; i <= region.i1; ++i)
+				grid.set(i, j, 0);
+	}
 
 	// For tile-based pathfinding:
 	// Since we only count tiles whose centers are inside the square,
@@ -750,92 +1030,82 @@ bool CCmpObstructionManager::Rasterise(Grid<u8>& grid)
 	// so we need to expand by at least 1/sqrt(2) of a tile
 	entity_pos_t expandFoundation = (entity_pos_t::FromInt(TERRAIN_TILE_SIZE) * 3) / 4;
 
-	for (std::map<u32, StaticShape>::iterator it = m_StaticShapes.begin(); it != m_StaticShapes.end(); ++it)
+	// Find the shapes that might overlap the region (using the subdivisions unless
+	// we're going to look at everything anyway)
+	FrameVector<u32> staticShapes(g_SimTurnArena);
+	FrameVector<u32> unitShapes(g_SimTurnArena);
+	if (full)
 	{
-		CFixedVector2D center(it->second.x, it->second.z);
+		for (std::map<u32, StaticShape>::iterator it = m_StaticShapes.begin(); it != m_StaticShapes.end(); ++it)
+			staticShapes.push_back(it->first);
+		for (std::map<u32, UnitShape>::iterator it = m_UnitShapes.begin(); it != m_UnitShapes.end(); ++it)
+			unitShapes.push_back(it->first);
+	}
+	else
+	{
+		entity_pos_t margin = entity_pos_t::FromInt(TERRAIN_TILE_SIZE);
+		CFixedVector2D posMin(entity_pos_t::FromInt(region.i0 * (int)TERRAIN_TILE_SIZE) - margin,
+			entity_pos_t::FromInt(region.j0 * (int)TERRAIN_TILE_SIZE) - margin);
+		CFixedVector2D posMax(entity_pos_t::FromInt((region.i1 + 1) * (int)TERRAIN_TILE_SIZE) + margin,
+			entity_pos_t::FromInt((region.j1 + 1) * (int)TERRAIN_TILE_SIZE) + margin);
+		UpdateStaticSubdivision();
+		m_StaticSubdivision.GetInRange(staticShapes, posMin, posMax);
+		m_UnitSubdivision.GetInRange(unitShapes, posMin, posMax);
+	}
 
-		if (it->second.flags & FLAG_BLOCK_PATHFINDING)
-		{
-			CFixedVector2D halfSize(it->second.hw + expandPathfinding, it->second.hh + expandPathfinding);
-			CFixedVector2D halfBound = Geometry::GetHalfBoundingBox(it->second.u, it->second.v, halfSize);
+	// Work out what to draw, one entry per flag set by each shape
+	std::vector<RasteriseShape> shapes;
+	shapes.reserve(2 * (staticShapes.size() + unitShapes.size()));
+	for (size_t n = 0; n < staticShapes.size(); ++n)
+	{
+		const StaticShape& shape = m_StaticShapes[staticShapes[n]];
+		CFixedVector2D center(shape.x, shape.z);
 
-			u16 i0, j0, i1, j1;
-			NearestTile(center.X - halfBound.X, center.Y - halfBound.Y, i0, j0, grid.m_W, grid.m_H);
-			NearestTile(center.X + halfBound.X, center.Y + halfBound.Y, i1, j1, grid.m_W, grid.m_H);
-			for (u16 j = j0; j <= j1; ++j)
-			{
-				for (u16 i = i0; i <= i1; ++i)
-				{
-					entity_pos_t x, z;
-					TileCenter(i, j, x, z);
-					if (Geometry::PointIsInSquare(CFixedVector2D(x, z) - center, it->second.u, it->second.v, halfSize))
-						grid.set(i, j, grid.get(i, j) | TILE_OBSTRUCTED_PATHFINDING);
-				}
-			}
+		if (shape.flags & FLAG_BLOCK_PATHFINDING)
+		{
+			CFixedVector2D halfSize(shape.hw + expandPathfinding, shape.hh + expandPathfinding);
+			AddRasteriseSquare(shapes, grid, center, shape.u, shape.v, halfSize, TILE_OBSTRUCTED_PATHFINDING);
 		}
 
-		if (it->second.flags & FLAG_BLOCK_FOUNDATION)
+		if (shape.flags & FLAG_BLOCK_FOUNDATION)
 		{
-			CFixedVector2D halfSize(it->second.hw + expandFoundation, it->second.hh + expandFoundation);
-			CFixedVector2D halfBound = Geometry::GetHalfBoundingBox(it->second.u, it->second.v, halfSize);
-
-			u16 i0, j0, i1, j1;
-			NearestTile(center.X - halfBound.X, center.Y - halfBound.Y, i0, j0, grid.m_W, grid.m_H);
-			NearestTile(center.X + halfBound.X, center.Y + halfBound.Y, i1, j1, grid.m_W, grid.m_H);
-			for (u16 j = j0; j <= j1; ++j)
-			{
-				for (u16 i = i0; i <= i1; ++i)
-				{
-					entity_pos_t x, z;
-					TileCenter(i, j, x, z);
-					if (Geometry::PointIsInSquare(CFixedVector2D(x, z) - center, it->second.u, it->second.v, halfSize))
-						grid.set(i, j, grid.get(i, j) | TILE_OBSTRUCTED_FOUNDATION);
-				}
-			}
+			CFixedVector2D halfSize(shape.hw + expandFoundation, shape.hh + expandFoundation);
+			AddRasteriseSquare(shapes, grid, center, shape.u, shape.v, halfSize, TILE_OBSTRUCTED_FOUNDATION);
 		}
 	}
 
-	for (std::map<u32, UnitShape>::iterator it = m_UnitShapes.begin(); it != m_UnitShapes.end(); ++it)
+	for (size_t n = 0; n < unitShapes.size(); ++n)
 	{
-		CFixedVector2D center(it->second.x, it->second.z);
-
-		if (it->second.flags & FLAG_BLOCK_PATHFINDING)
-		{
-			entity_pos_t r = it->second.r + expandPathfinding;
+		const UnitShape& shape = m_UnitShapes[unitShapes[n]];
+		CFixedVector2D center(shape.x, shape.z);
 
-			u16 i0, j0, i1, j1;
-			NearestTile(center.X - r, center.Y - r, i0, j0, grid.m_W, grid.m_H);
-			NearestTile(center.X + r, center.Y + r, i1, j1, grid.m_W, grid.m_H);
-			for (u16 j = j0; j <= j1; ++j)
-				for (u16 i = i0; i <= i1; ++i)
-					grid.set(i, j, grid.get(i, j) | TILE_OBSTRUCTED_PATHFINDING);
-		}
+		if (shape.flags & FLAG_BLOCK_PATHFINDING)
+			AddRasteriseBox(shapes, grid, center, shape.r + expandPathfinding, TILE_OBSTRUCTED_PATHFINDING);
 
-		if (it->second.flags & FLAG_BLOCK_FOUNDATION)
-		{
-			entity_pos_t r = it->second.r + expandFoundation;
-
-			u16 i0, j0, i1, j1;
-			NearestTile(center.X - r, center.Y - r, i0, j0, grid.m_W, grid.m_H);
-			NearestTile(center.X + r, center.Y + r, i1, j1, grid.m_W, grid.m_H);
-			for (u16 j = j0; j <= j1; ++j)
-				for (u16 i = i0; i <= i1; ++i)
-					grid.set(i, j, grid.get(i, j) | TILE_OBSTRUCTED_FOUNDATION);
-		}
+		if (shape.flags & FLAG_BLOCK_FOUNDATION)
+			AddRasteriseBox(shapes, grid, center, shape.r + expandFoundation, TILE_OBSTRUCTED_FOUNDATION);
 	}
 
+	// Draw them onto bands of rows in parallel
+	RasteriseJob job = { &grid, &region, &shapes };
+	size_t numBands = (region.j1 - region.j0) / RASTERISE_BAND_ROWS + 1;
+	if (g_ThreadPool && numBands > 1)
+		g_ThreadPool->ParallelFor(numBands, 1, &RasteriseCallback, &job);
+	else
+		RasteriseCallback(&job, 0, numBands);
+
 	// Any tiles outside or very near the edge of the map are impassable
 
 	// WARNING: CCmpRangeManager::LosIsOffWorld needs to be kept in sync with this
-	const u16 edgeSize = 3; // number of tiles around the edge that will be off-world
+	const int edgeSize = 3; // number of tiles around the edge that will be off-world
 
 	u8 edgeFlags = TILE_OBSTRUCTED_PATHFINDING | TILE_OBSTRUCTED_FOUNDATION | TILE_OUTOFBOUNDS;
 
 	if (m_PassabilityCircular)
 	{
-		for (u16 j = 0; j < grid.m_H; ++j)
+		for (u16 j = region.j0; j <= region.j1; ++j)
 		{
-			for (u16 i = 0; i < grid.m_W; ++i)
+			for (u16 i = region.i0; i <= region.i1; ++i)
 			{
 				// Based on CCmpRangeManager::LosIsOffWorld
 				// but tweaked since it's tile-based instead.
@@ -857,21 +1127,15 @@ bool CCmpObstructionManager::Rasterise(Grid<u8>& grid)
 		NearestTile(m_WorldX0, m_WorldZ0, i0, j0, grid.m_W, grid.m_H);
 		NearestTile(m_WorldX1, m_WorldZ1, i1, j1, grid.m_W, grid.m_H);
 
-		for (u16 j = 0; j < grid.m_H; ++j)
-			for (u16 i = 0; i < i0+edgeSize; ++i)
-				grid.set(i, j, edgeFlags);
-		for (u16 j = 0; j < grid.m_H; ++j)
-			for (u16 i = (u16)(i1-edgeSize+1); i < grid.m_W; ++i)
-				grid.set(i, j, edgeFlags);
-		for (u16 j = 0; j < j0+edgeSize; ++j)
-			for (u16 i = (u16)(i0+edgeSize); i < i1-edgeSize+1; ++i)
-				grid.set(i, j, edgeFlags);
-		for (u16 j = (u16)(j1-edgeSize+1); j < grid.m_H; ++j)
-			for (u16 i = (u16)(i0+edgeSize); i < i1-edgeSize+1; ++i)
-				grid.set(i, j, edgeFlags);
+		for (u16 j = region.j0; j <= region.j1; ++j)
+		{
+			for (u16 i = region.i0; i <= region.i1; ++i)
+			{
+				if (i < i0 + edgeSize || i > i1 - edgeSize || j < j0 + edgeSize || j > j1 - edgeSize)
+					grid.set(i, j, edgeFlags);
+			}
+		}
 	}
-
-	return true;
 }
 
 void CCmpObstructionManager::GetObstructionsInRange(const IObstructionTestFilter& filter, entity_pos_t x0, entity_pos_t z0, entity_pos_t x1, entity_pos_t z1, std::vector<ObstructionSquare>& squares)
@@ -880,10 +1144,11 @@ void CCmpObstructionManager::GetObstructionsInRange(const IObstructionTestFilter
 
 	ENSURE(x0 <= x1 && z0 <= z1);
 
-	std::vector<u32> unitShapes = m_UnitSubdivision.GetInRange(CFixedVector2D(x0, z0), CFixedVector2D(x1, z1));
-	for (size_t i = 0; i < unitShapes.size(); ++i)
+	m_QueryShapes.clear();
+	m_UnitSubdivision.GetInRange(m_QueryShapes, CFixedVector2D(x0, z0), CFixedVector2D(x1, z1));
+	for (size_t i = 0; i < m_QueryShapes.size(); ++i)
 	{
-		std::map<u32, UnitShape>::iterator it = m_UnitShapes.find(unitShapes[i]);
+		std::map<u32, UnitShape>::iterator it = m_UnitShapes.find(m_QueryShapes[i]);
 		ENSURE(it != m_UnitShapes.end());
 
 		if (!filter.TestShape(UNIT_INDEX_TO_TAG(it->first), it->second.flags, it->second.group, INVALID_ENTITY))
@@ -901,10 +1166,12 @@ void CCmpObstructionManager::GetObstructionsInRange(const IObstructionTestFilter
 		squares.push_back(s);
 	}
 
-	std::vector<u32> staticShapes = m_StaticSubdivision.GetInRange(CFixedVector2D(x0, z0), CFixedVector2D(x1, z1));
-	for (size_t i = 0; i < staticShapes.size(); ++i)
+	UpdateStaticSubdivision();
+	m_QueryShapes.clear();
+	m_StaticSubdivision.GetInRange(m_QueryShapes, CFixedVector2D(x0, z0), CFixedVector2D(x1, z1));
+	for (size_t i = 0; i < m_QueryShapes.size(); ++i)
 	{
-		std::map<u32, StaticShape>::iterator it = m_StaticShapes.find(staticShapes[i]);
+		std::map<u32, StaticShape>::iterator it = m_StaticShapes.find(m_QueryShapes[i]);
 		ENSURE(it != m_StaticShapes.end());
 
 		if (!filter.TestShape(STATIC_INDEX_TO_TAG(it->first), it->second.flags, it->second.group, it->second.group2))
@@ -26,7 +26,9 @@
 
 #include "ps/CLogger.h"
 #include "ps/CStr.h"
+#include "ps/MemoryStats.h"
 #include "ps/Profile.h"
+#include "ps/ThreadPool.h"
 #include "renderer/Scene.h"
 #include "simulation2/MessageTypes.h"
 #include "simulation2/components/ICmpObstruction.h"
@@ -42,12 +44,22 @@ const int DEFAULT_MOVE_COST = 256;
 
 REGISTER_COMPONENT_TYPE(Pathfinder)
 
+/**
+ * Number of bytes used by the passability and obstruction grids for the given map size.
+ */
+static ssize_t GridsMemorySize(u16 mapSize)
+{
+	return (ssize_t)mapSize * mapSize * (sizeof(TerrainTile) + sizeof(u8));
+}
+
 void CCmpPathfinder::Init(const CParamNode& UNUSED(paramNode))
 {
 	m_MapSize = 0;
 	m_Grid = NULL;
 	m_ObstructionGrid = NULL;
 	m_TerrainDirty = true;
+	m_TerrainEdgeCache.Reset();
+	m_TerrainEdgeCache.m_DirtyID = 0;
 	m_NextAsyncTicket = 1;
 
 	m_DebugOverlay = NULL;
@@ -55,6 +67,8 @@ void CCmpPathfinder::Init(const CParamNode& UNUSED(paramNode))
 	m_DebugPath = NULL;
 
 	m_SameTurnMovesCount = 0;
+	m_TurnPathSteps = 0;
+	m_DeferredTicketLimit = 0;
 
 	// Since this is used as a system component (not loaded from an entity template),
 	// we can't use the real paramNode (it won't get handled properly when deserializing),
@@ -77,6 +91,10 @@ void CCmpPathfinder::Init(const CParamNode& UNUSED(paramNode))
     // currently.  The thinking is that this will eventually 
     // happen in another thread.  Either way this probably 
     // will require some adjustment and rethinking.
+    //
+    // Independently of the number of moves, the long paths
+    // computed in a turn are limited by MAX_LONG_PATH_STEPS_PER_TURN
+    // and the rest are deferred to later turns.
 	const CParamNode pathingSettings = externalParamNode.GetChild("Pathfinder");
 	m_MaxSameTurnMoves = (u16)pathingSettings.GetChild("MaxSameTurnMoves").ToInt();
 
@@ -84,7 +102,7 @@ void CCmpPathfinder::Init(const CParamNode& UNUSED(paramNode))
 	const CParamNode::ChildrenMap& passClasses = externalParamNode.GetChild("Pathfinder").GetChild("PassabilityClasses").GetChildren();
 	for (CParamNode::ChildrenMap::const_iterator it = passClasses.begin(); it != passClasses.end(); ++it)
 	{
-		std::string name = it->first;
+		std::string name = it->first.string();
 		ENSURE((int)m_PassClasses.size() <= PASS_CLASS_BITS);
 		pass_class_t mask = (pass_class_t)(1u << (m_PassClasses.size() + 2));
 		m_PassClasses.push_back(PathfinderPassability(mask, it->second));
@@ -103,13 +121,13 @@ void CCmpPathfinder::Init(const CParamNode& UNUSED(paramNode))
 		size_t i = 0;
 		for (CParamNode::ChildrenMap::const_iterator it = moveClasses.begin(); it != moveClasses.end(); ++it)
 		{
-			std::string terrainClassName = it->first;
+			std::string terrainClassName = it->first.string();
 			m_TerrainCostClassTags[terrainClassName] = (cost_class_t)i;
 			++i;
 
 			const CParamNode::ChildrenMap& unitClasses = it->second.GetChild("UnitClasses").GetChildren();
 			for (CParamNode::ChildrenMap::const_iterator uit = unitClasses.begin(); uit != unitClasses.end(); ++uit)
-				unitClassNames.insert(uit->first);
+				unitClassNames.insert(uit->first.string());
 		}
 	}
 
@@ -152,6 +170,8 @@ void CCmpPathfinder::Deinit()
 	SetDebugOverlay(false); // cleans up memory
 	ResetDebugPath();
 
+	if (m_Grid)
+		MemoryStats::Add(MEMORY_PATHFINDER, -GridsMemorySize(m_MapSize));
 	delete m_Grid;
 	delete m_ObstructionGrid;
 }
@@ -195,6 +215,8 @@ void CCmpPathfinder::Serialize(ISerializer& serialize)
 	SerializeVector<SerializeShortRequest>()(serialize, "short requests", m_AsyncShortPathRequests);
 	serialize.NumberU32_Unbounded("next ticket", m_NextAsyncTicket);
 	serialize.NumberU16_Unbounded("same turn moves count", m_SameTurnMovesCount);
+	serialize.NumberU32_Unbounded("turn path steps", m_TurnPathSteps);
+	serialize.NumberU32_Unbounded("deferred ticket limit", m_DeferredTicketLimit);
 }
 
 void CCmpPathfinder::Deserialize(const CParamNode& paramNode, IDeserializer& deserialize)
@@ -205,6 +227,8 @@ void CCmpPathfinder::Deserialize(const CParamNode& paramNode, IDeserializer& des
 	SerializeVector<SerializeShortRequest>()(deserialize, "short requests", m_AsyncShortPathRequests);
 	deserialize.NumberU32_Unbounded("next ticket", m_NextAsyncTicket);
 	deserialize.NumberU16_Unbounded("same turn moves count", m_SameTurnMovesCount);
+	deserialize.NumberU32_Unbounded("turn path steps", m_TurnPathSteps);
+	deserialize.NumberU32_Unbounded("deferred ticket limit", m_DeferredTicketLimit);
 }
 
 void CCmpPathfinder::HandleMessage(const CMessage& msg, bool UNUSED(global))
@@ -304,6 +328,59 @@ const Grid<u16>& CCmpPathfinder::GetPassabilityGrid()
 	return *m_Grid;
 }
 
+bool CCmpPathfinder::GetPassabilityGridChanges(size_t dirtyID, GridDirtyRegion& region)
+{
+	UpdateGrid();
+
+	region = GridDirtyRegion();
+
+	if (!m_Grid || dirtyID > m_Grid->m_DirtyID)
+		return false;
+
+	if (dirtyID == m_Grid->m_DirtyID)
+		return true;
+
+	// Each partial update is recorded with consecutive IDs, so check we still
+	// know about every one since the requested ID
+	if (m_GridChanges.empty() || m_GridChanges.front().first > dirtyID + 1)
+		return false;
+
+	for (std::deque<std::pair<size_t, GridDirtyRegion> >::const_iterator it = m_GridChanges.begin(); it != m_GridChanges.end(); ++it)
+	{
+		if (it->first > dirtyID)
+			region.Add(it->second);
+	}
+
+	return true;
+}
+
+u32 CCmpPathfinder::GetConnectivityRegion(entity_pos_t x, entity_pos_t z, pass_class_t passClass)
+{
+	UpdateGrid();
+
+	if (!m_Grid || !m_Hierarchical.HasPassClass(passClass))
+		return 0;
+
+	u16 i, j;
+	NearestTile(x, z, i, j);
+	return m_Hierarchical.GetGlobalRegion(i, j, passClass);
+}
+
+bool CCmpPathfinder::IsReachable(entity_pos_t x0, entity_pos_t z0, entity_pos_t x1, entity_pos_t z1, pass_class_t passClass)
+{
+	UpdateGrid();
+
+	// Without any connectivity data we can't rule anything out
+	if (!m_Grid || !m_Hierarchical.HasPassClass(passClass))
+		return true;
+
+	u16 i0, j0, i1, j1;
+	NearestTile(x0, z0, i0, j0);
+	NearestTile(x1, z1, i1, j1);
+	u32 region = m_Hierarchical.GetGlobalRegion(i0, j0, passClass);
+	return region != 0 && region == m_Hierarchical.GetGlobalRegion(i1, j1, passClass);
+}
+
 void CCmpPathfinder::UpdateGrid()
 {
 	CmpPtr<ICmpTerrain> cmpTerrain(GetSimContext(), SYSTEM_ENTITY);
@@ -311,8 +388,12 @@ void CCmpPathfinder::UpdateGrid()
 		return; // error
 
 	// If the terrain was resized then delete the old grid data
+	// (but keep counting up its DirtyID, so users of the old grid notice it changed)
+	size_t gridDirtyID = 0;
 	if (m_Grid && m_MapSize != cmpTerrain->GetTilesPerSide())
 	{
+		gridDirtyID = m_Grid->m_DirtyID;
+		MemoryStats::Add(MEMORY_PATHFINDER, -GridsMemorySize(m_MapSize));
 		SAFE_DELETE(m_Grid);
 		SAFE_DELETE(m_ObstructionGrid);
 		m_TerrainDirty = true;
@@ -323,12 +404,15 @@ void CCmpPathfinder::UpdateGrid()
 	{
 		m_MapSize = cmpTerrain->GetTilesPerSide();
 		m_Grid = new Grid<TerrainTile>(m_MapSize, m_MapSize);
+		m_Grid->m_DirtyID = gridDirtyID;
 		m_ObstructionGrid = new Grid<u8>(m_MapSize, m_MapSize);
+		MemoryStats::Add(MEMORY_PATHFINDER, GridsMemorySize(m_MapSize));
 	}
 
 	CmpPtr<ICmpObstructionManager> cmpObstructionManager(GetSimContext(), SYSTEM_ENTITY);
 
-	bool obstructionsDirty = cmpObstructionManager->Rasterise(*m_ObstructionGrid);
+	GridDirtyRegion obstructionChanges;
+	bool obstructionsDirty = cmpObstructionManager->Rasterise(*m_ObstructionGrid, &obstructionChanges);
 
 	if (obstructionsDirty && !m_TerrainDirty)
 	{
@@ -343,11 +427,18 @@ void CCmpPathfinder::UpdateGrid()
 		// then TILE_OUTOFBOUNDS will change and we can't use this fast path, but
 		// currently it'll just set obstructionsDirty and we won't notice
 
-		for (u16 j = 0; j < m_MapSize; ++j)
+		// Only tiles inside obstructionChanges can have changed. Keep track of
+		// the ones that really did, so that the hierarchical data and any copies
+		// of the grid only need to be updated there
+		GridDirtyRegion changes;
+		GridDirtyRegion pathfindingChanges;
+
+		for (u16 j = obstructionChanges.j0; j <= obstructionChanges.j1; ++j)
 		{
-			for (u16 i = 0; i < m_MapSize; ++i)
+			for (u16 i = obstructionChanges.i0; i <= obstructionChanges.i1; ++i)
 			{
 				TerrainTile& t = m_Grid->get(i, j);
+				TerrainTile old = t;
 
 				u8 obstruct = m_ObstructionGrid->get(i, j);
 
@@ -360,17 +451,31 @@ void CCmpPathfinder::UpdateGrid()
 					t |= 2;
 				else
 					t &= (TerrainTile)~2;
+
+				if (t != old)
+					changes.Add(i, j);
+				if ((t ^ old) & 1)
+					pathfindingChanges.Add(i, j);
 			}
 		}
 
-		++m_Grid->m_DirtyID;
+		if (!pathfindingChanges.IsEmpty())
+			m_Hierarchical.Update(*m_Grid, pathfindingChanges);
+
+		if (!changes.IsEmpty())
+		{
+			++m_Grid->m_DirtyID;
+
+			m_GridChanges.push_back(std::make_pair(m_Grid->m_DirtyID, changes));
+			if (m_GridChanges.size() > MAX_GRID_CHANGES)
+				m_GridChanges.pop_front();
+		}
 	}
 	else if (obstructionsDirty || m_TerrainDirty)
 	{
 		PROFILE("UpdateGrid full");
 
 		// Obstructions or terrain changed - we need to recompute passability
-		// TODO: only bother recomputing the region that has actually changed
 
 		CmpPtr<ICmpWaterManager> cmpWaterManager(GetSimContext(), SYSTEM_ENTITY);
 
@@ -532,9 +637,17 @@ void CCmpPathfinder::UpdateGrid()
 			}
 		}
 
+		std::vector<pass_class_t> passClasses;
+		for (size_t n = 0; n < m_PassClasses.size(); ++n)
+			passClasses.push_back(m_PassClasses[n].m_Mask);
+		m_Hierarchical.Recompute(*m_Grid, passClasses);
+
 		m_TerrainDirty = false;
 
 		++m_Grid->m_DirtyID;
+
+		// Everything has changed, so forget about the previous partial changes
+		m_GridChanges.clear();
 	}
 }
 
@@ -556,6 +669,24 @@ u32 CCmpPathfinder::ComputeShortPathAsync(entity_pos_t x0, entity_pos_t z0, enti
 	return req.ticket;
 }
 
+namespace
+{
+/**
+ * Maximum number of long path search steps (tile expansions) to compute per turn.
+ * Once a turn has used this many, the remaining long requests are deferred
+ * to later turns, so that mass orders don't produce one huge turn.
+ * This counts steps rather than time so that it's deterministic.
+ */
+const u32 MAX_LONG_PATH_STEPS_PER_TURN = 120000;
+
+/**
+ * Number of request groups to compute between each check of the step budget.
+ * This is independent of the number of threads, so the set of paths computed
+ * each turn is deterministic.
+ */
+const size_t LONG_PATH_BATCH_SIZE = 16;
+}
+
 void CCmpPathfinder::FinishAsyncRequests()
 {
 	// Save the request queue in case it gets modified while iterating
@@ -568,22 +699,238 @@ void CCmpPathfinder::FinishAsyncRequests()
 	// TODO: we should only compute one path per entity per turn
 
 	// TODO: this computation should be done incrementally, spread
-	// across multiple frames (or even multiple turns)
+	// across multiple frames
+
+	// Long paths are computed in parallel on the thread pool; short paths
+	// still run serially since they query the obstruction manager (which uses
+	// the main-thread-only profiler) and write the debug overlay lines
 
-	ProcessLongRequests(longRequests);
+	m_TurnPathSteps = 0;
+
+	std::vector<AsyncLongPathRequest> deferred;
+	m_TurnPathSteps += ProcessLongRequests(longRequests, MAX_LONG_PATH_STEPS_PER_TURN, deferred);
 	ProcessShortRequests(shortRequests);
+
+	DeferLongRequests(deferred);
+}
+
+void CCmpPathfinder::DeferLongRequests(const std::vector<AsyncLongPathRequest>& deferred)
+{
+	if (deferred.empty())
+		return;
+
+	// The deferred requests have older tickets than any made while the results
+	// were being posted, so put them back at the front of the queue
+	m_AsyncLongPathRequests.insert(m_AsyncLongPathRequests.begin(), deferred.begin(), deferred.end());
+	m_DeferredTicketLimit = std::max(m_DeferredTicketLimit, deferred.back().ticket + 1);
+}
+
+bool CCmpPathfinder::IsPathRequestDeferred(u32 ticket)
+{
+	return ticket != 0 && ticket < m_DeferredTicketLimit;
+}
+
+namespace
+{
+/**
+ * Groups of at least this many long path requests with the same goal and
+ * classes are computed together with a single search (see ComputeGroupPathsOnGrid).
+ * Smaller groups are cheaper to compute one at a time.
+ */
+const size_t MIN_SHARED_PATH_REQUESTS = 4;
+
+struct LongPathGroupKey
+{
+	ICmpPathfinder::Goal goal;
+	ICmpPathfinder::pass_class_t passClass;
+	ICmpPathfinder::cost_class_t costClass;
+
+	bool operator<(const LongPathGroupKey& b) const
+	{
+		if (passClass != b.passClass) return passClass < b.passClass;
+		if (costClass != b.costClass) return costClass < b.costClass;
+		if (goal.type != b.goal.type) return goal.type < b.goal.type;
+		if (goal.x != b.goal.x) return goal.x < b.goal.x;
+		if (goal.z != b.goal.z) return goal.z < b.goal.z;
+		if (goal.hw != b.goal.hw) return goal.hw < b.goal.hw;
+		if (goal.hh != b.goal.hh) return goal.hh < b.goal.hh;
+		if (goal.u.X != b.goal.u.X) return goal.u.X < b.goal.u.X;
+		if (goal.u.Y != b.goal.u.Y) return goal.u.Y < b.goal.u.Y;
+		if (goal.v.X != b.goal.v.X) return goal.v.X < b.goal.v.X;
+		return goal.v.Y < b.goal.v.Y;
+	}
+};
+
+struct LongPathResult
+{
+	ICmpPathfinder::Path path;
+	PathfindTileGrid* tiles;
+	u32 steps;
+};
+
+struct LongPathJob
+{
+	const CCmpPathfinder* pathfinder;
+	const std::vector<AsyncLongPathRequest>* requests;
+	const std::vector<std::vector<size_t> >* groups; // indexes into requests that should be computed together
+	std::vector<LongPathResult>* results; // indexed like requests
+	std::vector<u32>* groupSteps; // number of search steps computed for each group
+	size_t firstGroup; // offset of the groups handled by the current batch
+	bool keepDebugGrids;
+};
+
+struct LongPathGroupOrder
+{
+	bool operator()(const std::vector<size_t>& a, const std::vector<size_t>& b) const
+	{
+		return a[0] < b[0];
+	}
+};
+
+void LongPathCallback(void* cbdata, size_t begin, size_t end)
+{
+	LongPathJob* job = static_cast<LongPathJob*>(cbdata);
+	for (size_t g = job->firstGroup + begin; g < job->firstGroup + end; ++g)
+	{
+		const std::vector<size_t>& group = (*job->groups)[g];
+		u32& groupSteps = (*job->groupSteps)[g];
+
+		std::vector<bool> found(group.size(), false);
+
+		if (group.size() > 1)
+		{
+			const AsyncLongPathRequest& first = (*job->requests)[group[0]];
+
+			std::vector<CFixedVector2D> starts;
+			for (size_t n = 0; n < group.size(); ++n)
+				starts.push_back(CFixedVector2D((*job->requests)[group[n]].x0, (*job->requests)[group[n]].z0));
+
+			std::vector<ICmpPathfinder::Path> paths(group.size());
+			LongPathResult& firstResult = (*job->results)[group[0]];
+			firstResult.tiles = job->pathfinder->ComputeGroupPathsOnGrid(starts, first.goal, first.passClass, first.costClass, paths, found, firstResult.steps);
+			groupSteps += firstResult.steps;
+			if (!job->keepDebugGrids)
+			{
+				CCmpPathfinder::DeletePathfindTileGrid(firstResult.tiles);
+				firstResult.tiles = NULL;
+			}
+
+			for (size_t n = 0; n < group.size(); ++n)
+				(*job->results)[group[n]].path.m_Waypoints.swap(paths[n].m_Waypoints);
+		}
+
+		// Compute any remaining paths individually
+		for (size_t n = 0; n < group.size(); ++n)
+		{
+			if (found[n])
+				continue;
+
+			const AsyncLongPathRequest& req = (*job->requests)[group[n]];
+			LongPathResult& result = (*job->results)[group[n]];
+			u32 steps;
+			PathfindTileGrid* tiles = job->pathfinder->ComputePathOnGrid(req.x0, req.z0, req.goal, req.passClass, req.costClass, result.path, steps);
+			groupSteps += steps;
+			if (job->keepDebugGrids && !result.tiles)
+			{
+				result.tiles = tiles;
+				result.steps = steps;
+			}
+			else
+			{
+				CCmpPathfinder::DeletePathfindTileGrid(tiles);
+			}
+		}
+	}
+}
 }
 
-void CCmpPathfinder::ProcessLongRequests(const std::vector<AsyncLongPathRequest>& longRequests)
+u32 CCmpPathfinder::ProcessLongRequests(const std::vector<AsyncLongPathRequest>& longRequests, u32 maxSteps, std::vector<AsyncLongPathRequest>& deferred)
 {
+	if (longRequests.empty())
+		return 0;
+
+	PROFILE3("process long requests");
+
+	// The requests only read the grid, so update it here and then
+	// compute all the paths in parallel
+	UpdateGrid();
+
+	// When many units are ordered to the same place at once, they'll all request
+	// paths to the same goal, so share the work between them
+	std::map<LongPathGroupKey, std::vector<size_t> > requestsByGoal;
+	for (size_t i = 0; i < longRequests.size(); ++i)
+	{
+		LongPathGroupKey key = { longRequests[i].goal, longRequests[i].passClass, longRequests[i].costClass };
+		requestsByGoal[key].push_back(i);
+	}
+
+	std::vector<std::vector<size_t> > groups;
+	for (std::map<LongPathGroupKey, std::vector<size_t> >::iterator it = requestsByGoal.begin(); it != requestsByGoal.end(); ++it)
+	{
+		if (it->second.size() >= MIN_SHARED_PATH_REQUESTS)
+		{
+			groups.push_back(std::vector<size_t>());
+			groups.back().swap(it->second);
+		}
+		else
+		{
+			for (size_t n = 0; n < it->second.size(); ++n)
+				groups.push_back(std::vector<size_t>(1, it->second[n]));
+		}
+	}
+
+	// Compute the oldest requests first, so deferred requests can't be starved
+	std::sort(groups.begin(), groups.end(), LongPathGroupOrder());
+
+	std::vector<LongPathResult> results(longRequests.size());
+	for (size_t i = 0; i < results.size(); ++i)
+		results[i].tiles = NULL;
+
+	std::vector<u32> groupSteps(groups.size(), 0);
+
+	// Compute batches of groups until the budget is used up (but always
+	// compute at least one batch, so every request eventually completes)
+	LongPathJob job = { this, &longRequests, &groups, &results, &groupSteps, 0, m_DebugOverlay != NULL };
+	u32 totalSteps = 0;
+	while (job.firstGroup < groups.size() && (job.firstGroup == 0 || totalSteps < maxSteps))
+	{
+		size_t count = std::min(LONG_PATH_BATCH_SIZE, groups.size() - job.firstGroup);
+		if (g_ThreadPool)
+			g_ThreadPool->ParallelFor(count, 1, &LongPathCallback, &job);
+		else
+			LongPathCallback(&job, 0, count);
+
+		for (size_t g = job.firstGroup; g < job.firstGroup + count; ++g)
+			totalSteps += groupSteps[g];
+		job.firstGroup += count;
+	}
+
+	std::vector<bool> computed(longRequests.size(), false);
+	for (size_t g = 0; g < job.firstGroup; ++g)
+		for (size_t n = 0; n < groups[g].size(); ++n)
+			computed[groups[g][n]] = true;
+
+	// Requests are queued in ticket order, so posting the results in the same order
+	// keeps the message delivery deterministic regardless of which thread computed them
 	for (size_t i = 0; i < longRequests.size(); ++i)
 	{
 		const AsyncLongPathRequest& req = longRequests[i];
-		Path path;
-		ComputePath(req.x0, req.z0, req.goal, req.passClass, req.costClass, path);
-		CMessagePathResult msg(req.ticket, path);
+
+		if (!computed[i])
+		{
+			deferred.push_back(req);
+			continue;
+		}
+
+		// Keep the last search grid for debug display, like ComputePath
+		if (results[i].tiles)
+			SetDebugGrid(results[i].tiles, results[i].steps);
+
+		CMessagePathResult msg(req.ticket, results[i].path);
 		GetSimContext().GetComponentManager().PostMessage(req.notify, msg);
 	}
+
+	return totalSteps;
 }
 
 void CCmpPathfinder::ProcessShortRequests(const std::vector<AsyncShortPathRequest>& shortRequests)
@@ -601,7 +948,8 @@ void CCmpPathfinder::ProcessShortRequests(const std::vector<AsyncShortPathReques
 
 void CCmpPathfinder::ProcessSameTurnMoves()
 {
-	if (!m_AsyncLongPathRequests.empty())
+	// (Long requests are left for a later turn if this turn's budget has been used up)
+	if (!m_AsyncLongPathRequests.empty() && m_TurnPathSteps < MAX_LONG_PATH_STEPS_PER_TURN)
 	{
 		// Figure out how many moves we can do this time
 		i32 moveCount = m_MaxSameTurnMoves - m_SameTurnMovesCount;
@@ -623,9 +971,11 @@ void CCmpPathfinder::ProcessSameTurnMoves()
 			m_AsyncLongPathRequests.erase(m_AsyncLongPathRequests.begin(), m_AsyncLongPathRequests.begin() + moveCount);
 		}
 
-		ProcessLongRequests(longRequests);
+		std::vector<AsyncLongPathRequest> deferred;
+		m_TurnPathSteps += ProcessLongRequests(longRequests, MAX_LONG_PATH_STEPS_PER_TURN - m_TurnPathSteps, deferred);
+		DeferLongRequests(deferred);
 
-		m_SameTurnMovesCount = (u16)(m_SameTurnMovesCount + moveCount);
+		m_SameTurnMovesCount = (u16)(m_SameTurnMovesCount + moveCount - (i32)deferred.size());
 	}
 	
 	if (!m_AsyncShortPathRequests.empty())
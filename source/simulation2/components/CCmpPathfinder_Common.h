@@ -36,6 +36,7 @@
 #include "maths/MathUtil.h"
 #include "simulation2/helpers/Geometry.h"
 #include "simulation2/helpers/Grid.h"
+#include "simulation2/helpers/HierarchicalPathfinder.h"
 
 class PathfinderOverlay;
 class SceneCollector;
@@ -73,8 +74,9 @@ struct PathfindTile;
  * We could have one passability bitmap per class, and another array for cost classes,
  * but instead (for no particular reason) we'll pack them all into a single u16 array.
  *
- * We handle dynamic updates currently by recomputing the entire array, which is stupid;
- * it should only bother updating the region that has changed.
+ * When only obstructions have changed, we just update the obstruction bits in the
+ * region that ICmpObstructionManager::Rasterise reports as changed; terrain changes
+ * still recompute the entire array.
  */
 class PathfinderPassability
 {
@@ -138,6 +140,71 @@ const int COST_CLASS_BITS = 16 - (PASS_CLASS_BITS + 2);
 
 typedef SparseGrid<PathfindTile> PathfindTileGrid;
 
+/**
+ * Cache of the tile edges between passable and impassable terrain for each passability
+ * class, which the vertex pathfinder turns into collision edges and search vertexes.
+ * Tiles are scanned in square blocks when they're first needed, and blocks are rescanned
+ * when the passability grid changes near them, so that short path requests and movement
+ * checks in the same area can share the work.
+ * (Implemented in CCmpPathfinder_Vertex.cpp.)
+ */
+class VertexTerrainEdgeCache
+{
+public:
+	enum
+	{
+		EDGE_BOTTOM = 1,
+		EDGE_TOP = 2,
+		EDGE_LEFT = 4,
+		EDGE_RIGHT = 8
+	};
+
+	/// An impassable tile and which of its neighbours are passable
+	struct TileEdges
+	{
+		u16 i, j;
+		u8 edges; // EDGE_* flags
+	};
+
+	VertexTerrainEdgeCache() : m_DirtyID(0) { }
+
+	/**
+	 * Forget all the cached edges.
+	 */
+	void Reset();
+
+	/**
+	 * Forget the cached edges of tiles that might be affected by changes inside the given
+	 * region of the passability grid (i.e. tiles inside it or adjacent to it).
+	 */
+	void Invalidate(const GridDirtyRegion& region);
+
+	/**
+	 * Appends to @p out every tile in the given inclusive range that has any edges for
+	 * the given passability class, in row-major order (from j0 to j1, then from i0 to i1).
+	 */
+	void GetTileEdges(std::vector<TileEdges>& out, u16 i0, u16 j0, u16 i1, u16 j1,
+		ICmpPathfinder::pass_class_t passClass, const Grid<TerrainTile>& terrain);
+
+	/// DirtyID of the passability grid that the cached edges were computed from
+	size_t m_DirtyID;
+
+private:
+	static const u16 BLOCK_SIZE = 16;
+
+	struct Block
+	{
+		bool valid;
+		std::vector<TileEdges> tiles; // sorted by (j, i)
+		u16 rows[BLOCK_SIZE+1]; // index in tiles of the first tile in each row of the block, plus the total count
+	};
+
+	void ComputeBlock(Block& block, u16 bi, u16 bj, ICmpPathfinder::pass_class_t passClass, const Grid<TerrainTile>& terrain);
+
+	std::map<ICmpPathfinder::pass_class_t, std::vector<Block> > m_Blocks;
+	u16 m_BlocksW, m_BlocksH;
+};
+
 struct AsyncLongPathRequest
 {
 	u32 ticket;
@@ -195,6 +262,8 @@ public:
 	std::vector<AsyncShortPathRequest> m_AsyncShortPathRequests;
 	u32 m_NextAsyncTicket; // unique IDs for asynchronous path requests
 	u16 m_SameTurnMovesCount; // current number of same turn moves we have processed this turn
+	u32 m_TurnPathSteps; // number of long path search steps computed so far this turn
+	u32 m_DeferredTicketLimit; // the long requests with tickets below this that are still queued were deferred to a later turn
 
 	// Lazily-constructed dynamic state (not serialized):
 
@@ -202,6 +271,13 @@ public:
 	Grid<TerrainTile>* m_Grid; // terrain/passability information
 	Grid<u8>* m_ObstructionGrid; // cached obstruction information (TODO: we shouldn't bother storing this, it's redundant with LSBs of m_Grid)
 	bool m_TerrainDirty; // indicates if m_Grid has been updated since terrain changed
+	HierarchicalPathfinder m_Hierarchical; // coarse connectivity information derived from m_Grid
+	VertexTerrainEdgeCache m_TerrainEdgeCache; // terrain edges for the vertex pathfinder, derived from m_Grid
+
+	// Regions of m_Grid that were changed by recent partial updates, with the
+	// grid's DirtyID after each update (for GetPassabilityGridChanges)
+	std::deque<std::pair<size_t, GridDirtyRegion> > m_GridChanges;
+	static const size_t MAX_GRID_CHANGES = 32;
 	
 	// For responsiveness we will process some moves in the same turn they were generated in
 	
@@ -240,8 +316,72 @@ public:
 
 	virtual const Grid<u16>& GetPassabilityGrid();
 
+	virtual bool GetPassabilityGridChanges(size_t dirtyID, GridDirtyRegion& region);
+
+	virtual u32 GetConnectivityRegion(entity_pos_t x, entity_pos_t z, pass_class_t passClass);
+
+	virtual bool IsReachable(entity_pos_t x0, entity_pos_t z0, entity_pos_t x1, entity_pos_t z1, pass_class_t passClass);
+
 	virtual void ComputePath(entity_pos_t x0, entity_pos_t z0, const Goal& goal, pass_class_t passClass, cost_class_t costClass, Path& ret);
 
+	/**
+	 * Computes a long path like ComputePath, but without updating the grid or the
+	 * debug output, so it only reads from the component and can be called from
+	 * several threads at once. UpdateGrid must have been called beforehand.
+	 * @param steps receives the number of search steps, for debug display
+	 * @return the search grid (which the caller must delete), or NULL if no search was needed
+	 */
+	PathfindTileGrid* ComputePathOnGrid(entity_pos_t x0, entity_pos_t z0, const Goal& goal, pass_class_t passClass, cost_class_t costClass, Path& ret, u32& steps) const;
+
+	/**
+	 * Computes long paths from several start points to the same goal, with a single
+	 * search outwards from the goal whose tree is shared by all the paths.
+	 * Like ComputePathOnGrid this is safe to call from several threads at once.
+	 * Start points that this can't handle (e.g. if they're on impassable tiles, or
+	 * the goal isn't reachable from them) are left with found[n] = false and an
+	 * empty path, and should be computed with ComputePathOnGrid instead.
+	 * @param paths, found must have the same size as starts
+	 * @return the search grid (which the caller must delete), or NULL if no search was needed
+	 */
+	PathfindTileGrid* ComputeGroupPathsOnGrid(const std::vector<CFixedVector2D>& starts, const Goal& goal, pass_class_t passClass, cost_class_t costClass,
+		std::vector<Path>& paths, std::vector<bool>& found, u32& steps) const;
+
+	/**
+	 * Deletes a search grid returned by ComputePathOnGrid or ComputeGroupPathsOnGrid.
+	 * (PathfindTile is only defined in CCmpPathfinder_Tile.cpp, so other files can't delete the grids themselves.)
+	 */
+	static void DeletePathfindTileGrid(PathfindTileGrid* tiles);
+
+	/**
+	 * Replaces the search grid that's saved for debug display.
+	 */
+	void SetDebugGrid(PathfindTileGrid* tiles, u32 steps);
+
+	/**
+	 * Removes waypoints from a long path (as returned by the tile search, with one waypoint
+	 * per tile) wherever the straight line between its neighbours only crosses passable
+	 * tiles, so the path is made of fewer, longer segments. The segments are kept short
+	 * enough for the unit motion's short path requests to reach each waypoint.
+	 * Like ComputePathOnGrid this only reads from the component.
+	 * @param i0, j0 tile the path starts from (which isn't included in its waypoints)
+	 */
+	void CompressPath(Path& path, u16 i0, u16 j0, pass_class_t passClass) const;
+
+	/**
+	 * Returns whether every tile touched by the straight line between the centers of the
+	 * two tiles is passable (including the tiles on both sides of any corner it passes through).
+	 */
+	bool CheckLineOfPassability(u16 i0, u16 j0, u16 i1, u16 j1, pass_class_t passClass) const;
+
+	/**
+	 * If every terrain class has the same movement cost for the given cost class (as for
+	 * ships on water), and there's a clear straight line between the tiles, sets the path
+	 * to that line (split into segments like CompressPath) and returns true, since no
+	 * tile search could find anything better.
+	 * Like ComputePathOnGrid this only reads from the component.
+	 */
+	bool ComputeStraightPath(u16 i0, u16 j0, u16 i1, u16 j1, pass_class_t passClass, cost_class_t costClass, Path& path) const;
+
 	virtual u32 ComputePathAsync(entity_pos_t x0, entity_pos_t z0, const Goal& goal, pass_class_t passClass, cost_class_t costClass, entity_id_t notify);
 
 	virtual void ComputeShortPath(const IObstructionTestFilter& filter, entity_pos_t x0, entity_pos_t z0, entity_pos_t r, entity_pos_t range, const Goal& goal, pass_class_t passClass, Path& ret);
@@ -266,7 +406,20 @@ public:
 
 	virtual void FinishAsyncRequests();
 
-	void ProcessLongRequests(const std::vector<AsyncLongPathRequest>& longRequests);
+	virtual bool IsPathRequestDeferred(u32 ticket);
+
+	/**
+	 * Computes the long requests and posts their results, in ticket order, until about
+	 * maxSteps search steps have been computed. Requests that didn't fit are appended
+	 * to deferred (still in ticket order).
+	 * @return number of search steps computed
+	 */
+	u32 ProcessLongRequests(const std::vector<AsyncLongPathRequest>& longRequests, u32 maxSteps, std::vector<AsyncLongPathRequest>& deferred);
+
+	/**
+	 * Puts deferred long requests back at the front of the queue, to be computed in a later turn.
+	 */
+	void DeferLongRequests(const std::vector<AsyncLongPathRequest>& deferred);
 	
 	void ProcessShortRequests(const std::vector<AsyncShortPathRequest>& shortRequests);
 
@@ -275,7 +428,7 @@ public:
 	/**
 	 * Returns the tile containing the given position
 	 */
-	void NearestTile(entity_pos_t x, entity_pos_t z, u16& i, u16& j)
+	void NearestTile(entity_pos_t x, entity_pos_t z, u16& i, u16& j) const
 	{
 		i = (u16)clamp((x / (int)TERRAIN_TILE_SIZE).ToInt_RoundToZero(), 0, m_MapSize-1);
 		j = (u16)clamp((z / (int)TERRAIN_TILE_SIZE).ToInt_RoundToZero(), 0, m_MapSize-1);
@@ -297,6 +450,11 @@ public:
 	 */
 	void UpdateGrid();
 
+	/**
+	 * Brings m_TerrainEdgeCache up to date with m_Grid. UpdateGrid must have been called beforehand.
+	 */
+	void UpdateTerrainEdgeCache();
+
 	void RenderSubmit(SceneCollector& collector);
 };
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -30,7 +30,7 @@
 #include "renderer/TerrainOverlay.h"
 #include "simulation2/helpers/PriorityQueue.h"
 
-typedef PriorityQueueHeap<std::pair<u16, u16>, u32> PriorityQueue;
+typedef PriorityQueueIndexedHeap<std::pair<u16, u16>, u32, TileIDIndexer> PriorityQueue;
 
 #define PATHFIND_STATS 0
 
@@ -202,6 +202,10 @@ struct PathfinderState
 
 	bool ignoreImpassable; // allows us to escape if stuck in patches of impassability
 
+	const Grid<u8>* corridor; // if non-NULL, chunks of the hierarchical pathfinder that the search may enter
+
+	bool reverse; // searching outwards from the goal towards many start tiles, so there's no heuristic
+
 	u32 hBest; // heuristic of closest discovered tile to goal
 	u16 iBest, jBest; // closest tile
 
@@ -299,6 +303,10 @@ static void ProcessNeighbour(u16 pi, u16 pj, u16 i, u16 j, u32 pg, PathfinderSta
 	if (!IS_PASSABLE(tileTag, state.passClass) && !state.ignoreImpassable)
 		return;
 
+	// Reject tiles outside the coarse route
+	if (state.corridor && !state.corridor->get(i / HierarchicalPathfinder::CHUNK_SIZE, j / HierarchicalPathfinder::CHUNK_SIZE))
+		return;
+
 	u32 dg = CalculateCostDelta(pi, pj, i, j, state.tiles, state.moveCosts.at(GET_COST_CLASS(tileTag)));
 
 	u32 g = pg + dg; // cost to this tile = cost to predecessor + delta from predecessor
@@ -308,7 +316,7 @@ static void ProcessNeighbour(u16 pi, u16 pj, u16 i, u16 j, u32 pg, PathfinderSta
 	// If this is a new tile, compute the heuristic distance
 	if (n.IsUnexplored())
 	{
-		n.h = CalculateHeuristic(i, j, state.iGoal, state.jGoal, state.rGoal);
+		n.h = state.reverse ? 0 : CalculateHeuristic(i, j, state.iGoal, state.jGoal, state.rGoal);
 		// Remember the best tile we've seen so far, in case we never actually reach the target
 		if (n.h < state.hBest)
 		{
@@ -367,10 +375,78 @@ void CCmpPathfinder::ComputePath(entity_pos_t x0, entity_pos_t z0, const Goal& g
 {
 	UpdateGrid();
 
-	PROFILE3("ComputePath");
+	PROFILE("ComputePath");
+
+	u32 steps;
+	PathfindTileGrid* tiles = ComputePathOnGrid(x0, z0, goal, passClass, costClass, path, steps);
+
+	// Save this grid for debug display
+	if (tiles)
+		SetDebugGrid(tiles, steps);
+}
+
+void CCmpPathfinder::DeletePathfindTileGrid(PathfindTileGrid* tiles)
+{
+	delete tiles;
+}
+
+void CCmpPathfinder::SetDebugGrid(PathfindTileGrid* tiles, u32 steps)
+{
+	delete m_DebugGrid;
+	m_DebugGrid = tiles;
+	m_DebugSteps = steps;
+}
+
+/**
+ * Finds the bounding box of the tiles that might be within the goal
+ * (expanded by more than AtGoal's tolerance).
+ */
+static void GetGoalTileBounds(const ICmpPathfinder::Goal& goal, u16 mapSize, int& i0, int& j0, int& i1, int& j1)
+{
+	entity_pos_t extent;
+	if (goal.type == ICmpPathfinder::Goal::CIRCLE)
+		extent = goal.hw;
+	else if (goal.type == ICmpPathfinder::Goal::SQUARE)
+		extent = goal.hw + goal.hh; // overestimate, to include any rotation
+	extent += entity_pos_t::FromInt(TERRAIN_TILE_SIZE*2);
+
+	i0 = clamp(((goal.x - extent) / (int)TERRAIN_TILE_SIZE).ToInt_RoundToNegInfinity(), 0, mapSize-1);
+	j0 = clamp(((goal.z - extent) / (int)TERRAIN_TILE_SIZE).ToInt_RoundToNegInfinity(), 0, mapSize-1);
+	i1 = clamp(((goal.x + extent) / (int)TERRAIN_TILE_SIZE).ToInt_RoundToInfinity(), 0, mapSize-1);
+	j1 = clamp(((goal.z + extent) / (int)TERRAIN_TILE_SIZE).ToInt_RoundToInfinity(), 0, mapSize-1);
+}
+
+/**
+ * Finds the regions of all the tiles that are within the goal and reachable from tile (i0, j0).
+ */
+static void FindReachableGoalRegions(const HierarchicalPathfinder& hierarchical, u16 i0, u16 j0,
+	const ICmpPathfinder::Goal& goal, ICmpPathfinder::pass_class_t passClass, u16 mapSize,
+	std::set<HierarchicalPathfinder::RegionID>& regions)
+{
+	u32 component = hierarchical.GetGlobalRegion(i0, j0, passClass);
+
+	int i0b, j0b, i1b, j1b;
+	GetGoalTileBounds(goal, mapSize, i0b, j0b, i1b, j1b);
+
+	for (int j = j0b; j <= j1b; ++j)
+	{
+		for (int i = i0b; i <= i1b; ++i)
+		{
+			if (hierarchical.GetGlobalRegion((u16)i, (u16)j, passClass) == component && AtGoal((u16)i, (u16)j, goal))
+				regions.insert(hierarchical.Get((u16)i, (u16)j, passClass));
+		}
+	}
+}
+
+PathfindTileGrid* CCmpPathfinder::ComputePathOnGrid(entity_pos_t x0, entity_pos_t z0, const Goal& requestedGoal, pass_class_t passClass, cost_class_t costClass, Path& path, u32& steps) const
+{
+	PROFILE2("ComputePath");
 
 	PathfinderState state = { 0 };
 
+	// (This might get replaced by a reachable goal below)
+	Goal goal = requestedGoal;
+
 	// Convert the start/end coordinates to tile indexes
 	u16 i0, j0;
 	NearestTile(x0, z0, i0, j0);
@@ -381,7 +457,57 @@ void CCmpPathfinder::ComputePath(entity_pos_t x0, entity_pos_t z0, const Goal& g
 	{
 		Waypoint w = { goal.x, goal.z };
 		path.m_Waypoints.push_back(w);
-		return;
+		steps = 0;
+		return NULL;
+	}
+
+	// Use the hierarchical pathfinder to avoid exhaustively searching for goals that
+	// can't be reached, and to restrict the tile search to a corridor of chunks along
+	// a coarse route to the goal.
+	// (If we start on an impassable tile we're not in any region, so just do a full search.)
+	Grid<u8> corridor(m_Hierarchical.GetChunksW(), m_Hierarchical.GetChunksH());
+	if (m_Hierarchical.HasPassClass(passClass) && IS_PASSABLE(m_Grid->get(i0, j0), passClass))
+	{
+		std::set<HierarchicalPathfinder::RegionID> goalRegions;
+		FindReachableGoalRegions(m_Hierarchical, i0, j0, goal, passClass, m_MapSize, goalRegions);
+
+		if (goalRegions.empty())
+		{
+			// Head for the nearest reachable tile instead
+			u16 i = state.iGoal, j = state.jGoal;
+			m_Hierarchical.FindNearestReachableTile(i0, j0, i, j, passClass);
+			if (i == i0 && j == j0)
+			{
+				// We're already as close as we can get
+				steps = 0;
+				return NULL;
+			}
+
+			goal.type = Goal::POINT;
+			TileCenter(i, j, goal.x, goal.z);
+			state.iGoal = i;
+			state.jGoal = j;
+
+			if (AtGoal(i0, j0, goal))
+			{
+				Waypoint w = { goal.x, goal.z };
+				path.m_Waypoints.push_back(w);
+				steps = 0;
+				return NULL;
+			}
+
+			goalRegions.insert(m_Hierarchical.Get(i, j, passClass));
+		}
+
+		if (m_Hierarchical.ComputeCorridor(i0, j0, state.iGoal, state.jGoal, goalRegions, passClass, corridor))
+			state.corridor = &corridor;
+	}
+
+	// Open water (or any other uniform terrain) with nothing in the way doesn't need a search
+	if (ComputeStraightPath(i0, j0, state.iGoal, state.jGoal, passClass, costClass, path))
+	{
+		steps = 0;
+		return NULL;
 	}
 
 	// If the target is a circle, we want to aim for the edge of it (so e.g. if we're inside
@@ -398,6 +524,7 @@ void CCmpPathfinder::ComputePath(entity_pos_t x0, entity_pos_t z0, const Goal& g
 	state.steps = 0;
 
 	state.tiles = new PathfindTileGrid(m_MapSize, m_MapSize);
+	state.open.reset((size_t)m_MapSize * m_MapSize, TileIDIndexer(m_MapSize));
 	state.terrain = m_Grid;
 
 	state.iBest = i0;
@@ -486,10 +613,7 @@ void CCmpPathfinder::ComputePath(entity_pos_t x0, entity_pos_t z0, const Goal& g
 		jp = n.GetPredJ(jp);
 	}
 
-	// Save this grid for debug display
-	delete m_DebugGrid;
-	m_DebugGrid = state.tiles;
-	m_DebugSteps = state.steps;
+	CompressPath(path, i0, j0, passClass);
 
 	PROFILE2_ATTR("from: (%d, %d)", i0, j0);
 	PROFILE2_ATTR("to: (%d, %d)", state.iGoal, state.jGoal);
@@ -499,4 +623,293 @@ void CCmpPathfinder::ComputePath(entity_pos_t x0, entity_pos_t z0, const Goal& g
 #if PATHFIND_STATS
 	printf("PATHFINDER: steps=%d avgo=%d proc=%d impc=%d impo=%d addo=%d\n", state.steps, state.sumOpenSize/state.steps, state.numProcessed, state.numImproveClosed, state.numImproveOpen, state.numAddToOpen);
 #endif
+
+	steps = state.steps;
+	return state.tiles;
+}
+
+PathfindTileGrid* CCmpPathfinder::ComputeGroupPathsOnGrid(const std::vector<CFixedVector2D>& starts, const Goal& goal, pass_class_t passClass, cost_class_t costClass,
+	std::vector<Path>& paths, std::vector<bool>& found, u32& steps) const
+{
+	PROFILE2("ComputeGroupPaths");
+
+	found.assign(starts.size(), false);
+	steps = 0;
+
+	// We rely on the hierarchical pathfinder to tell us which start tiles can reach the goal,
+	// else we might end up searching the whole map for an unreachable one
+	if (!m_Hierarchical.HasPassClass(passClass))
+		return NULL;
+
+	PathfinderState state = { 0 };
+	state.reverse = true;
+	state.passClass = passClass;
+	state.moveCosts = m_MoveCosts.at(costClass);
+	state.terrain = m_Grid;
+	state.hBest = std::numeric_limits<u32>::max();
+
+	// Every passable tile at the goal is a starting point of the search (with edges in the
+	// reverse direction), so any start tile it reaches can follow the predecessor links
+	// to the goal. Moving between tiles costs the same in either direction, except that
+	// the search counts the start tile's cost rather than the goal tile's, which doesn't
+	// affect the choice of route much.
+
+	int i0b, j0b, i1b, j1b;
+	GetGoalTileBounds(goal, m_MapSize, i0b, j0b, i1b, j1b);
+
+	std::set<u32> goalComponents;
+	std::vector<std::pair<u16, u16> > goalTiles;
+	for (u16 j = (u16)j0b; j <= (u16)j1b; ++j)
+	{
+		for (u16 i = (u16)i0b; i <= (u16)i1b; ++i)
+		{
+			if (IS_PASSABLE(m_Grid->get(i, j), passClass) && AtGoal(i, j, goal))
+			{
+				goalTiles.push_back(std::make_pair(i, j));
+				goalComponents.insert(m_Hierarchical.GetGlobalRegion(i, j, passClass));
+			}
+		}
+	}
+
+	// Find the start tiles that the search should reach
+	std::vector<std::pair<u16, u16> > startTiles(starts.size());
+	std::set<std::pair<u16, u16> > pending;
+	for (size_t n = 0; n < starts.size(); ++n)
+	{
+		u16 i, j;
+		NearestTile(starts[n].X, starts[n].Y, i, j);
+		startTiles[n] = std::make_pair(i, j);
+
+		if (AtGoal(i, j, goal))
+		{
+			// Move directly to the exact goal coordinates, like ComputePathOnGrid
+			Waypoint w = { goal.x, goal.z };
+			paths[n].m_Waypoints.push_back(w);
+			found[n] = true;
+			continue;
+		}
+
+		if (!IS_PASSABLE(m_Grid->get(i, j), passClass))
+			continue;
+		if (goalComponents.find(m_Hierarchical.GetGlobalRegion(i, j, passClass)) == goalComponents.end())
+			continue;
+
+		pending.insert(startTiles[n]);
+	}
+
+	if (pending.empty())
+		return NULL;
+
+	state.tiles = new PathfindTileGrid(m_MapSize, m_MapSize);
+	state.open.reset((size_t)m_MapSize * m_MapSize, TileIDIndexer(m_MapSize));
+
+	for (size_t n = 0; n < goalTiles.size(); ++n)
+	{
+		u16 i = goalTiles[n].first;
+		u16 j = goalTiles[n].second;
+		PriorityQueue::Item t = { goalTiles[n], 0 };
+		state.open.push(t);
+		state.tiles->get(i, j).SetStatusOpen();
+		state.tiles->get(i, j).SetPred(i, j, i, j);
+		state.tiles->get(i, j).cost = 0;
+	}
+
+	// Every tile should only be closed about once, so this is just a safety net
+	const u32 maxSteps = 2 * m_MapSize * m_MapSize;
+
+	while (!pending.empty() && !state.open.empty() && state.steps < maxSteps)
+	{
+		++state.steps;
+
+		PriorityQueue::Item curr = state.open.pop();
+		u16 i = curr.id.first;
+		u16 j = curr.id.second;
+		state.tiles->get(i, j).SetStatusClosed();
+
+		pending.erase(curr.id);
+
+		u32 g = state.tiles->get(i, j).cost;
+		if (i > 0)
+			ProcessNeighbour(i, j, (u16)(i-1), j, g, state);
+		if (i < m_MapSize-1)
+			ProcessNeighbour(i, j, (u16)(i+1), j, g, state);
+		if (j > 0)
+			ProcessNeighbour(i, j, i, (u16)(j-1), g, state);
+		if (j < m_MapSize-1)
+			ProcessNeighbour(i, j, i, (u16)(j+1), g, state);
+	}
+
+	for (size_t n = 0; n < starts.size(); ++n)
+	{
+		if (found[n])
+			continue;
+
+		u16 ip = startTiles[n].first, jp = startTiles[n].second;
+		if (!state.tiles->get(ip, jp).IsClosed())
+			continue;
+
+		// Follow the predecessor links to the goal tile they started from,
+		// which is its own predecessor
+		std::vector<Waypoint>& waypoints = paths[n].m_Waypoints;
+		while (true)
+		{
+			PathfindTile& t = state.tiles->get(ip, jp);
+			u16 pi = t.GetPredI(ip);
+			u16 pj = t.GetPredJ(jp);
+			if (pi == ip && pj == jp)
+				break;
+
+			ip = pi;
+			jp = pj;
+			entity_pos_t x, z;
+			TileCenter(ip, jp, x, z);
+			Waypoint w = { x, z };
+			waypoints.push_back(w);
+		}
+
+		// Waypoints are returned with the earliest at the back
+		std::reverse(waypoints.begin(), waypoints.end());
+		CompressPath(paths[n], startTiles[n].first, startTiles[n].second, passClass);
+		found[n] = true;
+	}
+
+	PROFILE2_ATTR("starts: %u", (u32)starts.size());
+	PROFILE2_ATTR("steps: %u", state.steps);
+
+	steps = state.steps;
+	return state.tiles;
+}
+
+// Longest segment that CompressPath will produce, in tiles.
+// (CCmpUnitMotion skips waypoints within WAYPOINT_ADVANCE_MAX (8 tiles) and searches for
+// short paths within SHORT_PATH_SEARCH_RANGE (10 tiles), so this shouldn't reduce the distance
+// units look ahead while making sure the short pathfinder can still reach the next waypoint.)
+static const int COMPRESS_PATH_MAX_SEGMENT = 8;
+
+bool CCmpPathfinder::CheckLineOfPassability(u16 i0, u16 j0, u16 i1, u16 j1, pass_class_t passClass) const
+{
+	// Walk along the tiles crossed by the line, by comparing where it next crosses
+	// a vertical and a horizontal tile boundary (scaled to stay in integers)
+	int nx = abs((int)i1 - (int)i0);
+	int ny = abs((int)j1 - (int)j0);
+	int si = (i1 > i0 ? 1 : -1);
+	int sj = (j1 > j0 ? 1 : -1);
+
+	int i = i0, j = j0;
+	if (!IS_PASSABLE(m_Grid->get(i, j), passClass))
+		return false;
+
+	for (int ix = 0, iy = 0; ix < nx || iy < ny; )
+	{
+		int decision = (1 + 2*ix) * ny - (1 + 2*iy) * nx;
+		if (decision == 0)
+		{
+			// Passing exactly through a corner - be conservative and require both of
+			// the tiles beside it to be passable too
+			if (!IS_PASSABLE(m_Grid->get(i + si, j), passClass) || !IS_PASSABLE(m_Grid->get(i, j + sj), passClass))
+				return false;
+			i += si;
+			j += sj;
+			++ix;
+			++iy;
+		}
+		else if (decision < 0)
+		{
+			i += si;
+			++ix;
+		}
+		else
+		{
+			j += sj;
+			++iy;
+		}
+
+		if (!IS_PASSABLE(m_Grid->get(i, j), passClass))
+			return false;
+	}
+
+	return true;
+}
+
+bool CCmpPathfinder::ComputeStraightPath(u16 i0, u16 j0, u16 i1, u16 j1, pass_class_t passClass, cost_class_t costClass, Path& path) const
+{
+	const std::vector<u32>& costs = m_MoveCosts.at(costClass);
+	for (size_t n = 1; n < costs.size(); ++n)
+		if (costs[n] != costs[0])
+			return false;
+
+	if (!CheckLineOfPassability(i0, j0, i1, j1, passClass))
+		return false;
+
+	// Split the line into equal segments no longer than CompressPath's, with each
+	// waypoint on the center of the tile containing that point of the line
+	int di = (int)i1 - (int)i0;
+	int dj = (int)j1 - (int)j0;
+	int segments = 1;
+	while (segments * segments * COMPRESS_PATH_MAX_SEGMENT * COMPRESS_PATH_MAX_SEGMENT < di*di + dj*dj)
+		++segments;
+
+	std::vector<Waypoint> waypoints;
+	u16 ia = i1, ja = j1;
+	for (int n = segments; n > 0; --n)
+	{
+		// Round to nearest, away from zero at halves
+		int ni = di * n, nj = dj * n;
+		u16 ib = (u16)(i0 + (ni >= 0 ? (ni + segments/2) / segments : -((-ni + segments/2) / segments)));
+		u16 jb = (u16)(j0 + (nj >= 0 ? (nj + segments/2) / segments : -((-nj + segments/2) / segments)));
+
+		// Rounding might take a segment slightly off the checked line
+		if (n < segments && !CheckLineOfPassability(ib, jb, ia, ja, passClass))
+			return false;
+
+		Waypoint w;
+		TileCenter(ib, jb, w.x, w.z);
+		waypoints.push_back(w);
+		ia = ib;
+		ja = jb;
+	}
+
+	if (!CheckLineOfPassability(i0, j0, ia, ja, passClass))
+		return false;
+
+	// The end of the path goes first, like the tile search's output
+	path.m_Waypoints.insert(path.m_Waypoints.end(), waypoints.begin(), waypoints.end());
+	return true;
+}
+
+void CCmpPathfinder::CompressPath(Path& path, u16 i0, u16 j0, pass_class_t passClass) const
+{
+	std::vector<Waypoint>& waypoints = path.m_Waypoints;
+	if (waypoints.size() < 2)
+		return;
+
+	// The waypoints are all tile centers, so convert them back into tiles
+	std::vector<std::pair<u16, u16> > tiles(waypoints.size());
+	for (size_t n = 0; n < waypoints.size(); ++n)
+		NearestTile(waypoints[n].x, waypoints[n].z, tiles[n].first, tiles[n].second);
+
+	// Going from the start (the back of the list), skip over each waypoint if
+	// we can go straight from the last kept waypoint (or the start) to the next
+	std::vector<Waypoint> compressed;
+	compressed.push_back(waypoints[0]); // always keep the end of the path
+
+	u16 ia = i0, ja = j0; // last kept waypoint
+
+	for (size_t n = waypoints.size() - 1; n > 0; --n)
+	{
+		u16 ib = tiles[n-1].first, jb = tiles[n-1].second;
+		int di = (int)ib - (int)ia;
+		int dj = (int)jb - (int)ja;
+		if (di*di + dj*dj <= COMPRESS_PATH_MAX_SEGMENT*COMPRESS_PATH_MAX_SEGMENT
+			&& CheckLineOfPassability(ia, ja, ib, jb, passClass))
+			continue;
+
+		compressed.push_back(waypoints[n]);
+		ia = tiles[n].first;
+		ja = tiles[n].second;
+	}
+
+	// Put the kept waypoints back in the usual order, with the earliest at the back
+	std::reverse(compressed.begin() + 1, compressed.end());
+	waypoints.swap(compressed);
 }
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -333,65 +333,173 @@ struct TileEdge
 	enum { TOP, BOTTOM, LEFT, RIGHT } dir;
 };
 
-static void AddTerrainEdges(std::vector<Edge>& edgesAA, std::vector<Vertex>& vertexes,
-	u16 i0, u16 j0, u16 i1, u16 j1, fixed r,
+void VertexTerrainEdgeCache::Reset()
+{
+	m_Blocks.clear();
+	m_BlocksW = m_BlocksH = 0;
+}
+
+void VertexTerrainEdgeCache::Invalidate(const GridDirtyRegion& region)
+{
+	if (region.IsEmpty() || m_Blocks.empty())
+		return;
+
+	// A tile's edges depend on its neighbours, so the tiles around the region might change too
+	u16 bi0 = (u16)(std::max((int)region.i0 - 1, 0) / BLOCK_SIZE);
+	u16 bj0 = (u16)(std::max((int)region.j0 - 1, 0) / BLOCK_SIZE);
+	u16 bi1 = (u16)std::min((region.i1 + 1) / BLOCK_SIZE, m_BlocksW - 1);
+	u16 bj1 = (u16)std::min((region.j1 + 1) / BLOCK_SIZE, m_BlocksH - 1);
+
+	for (std::map<ICmpPathfinder::pass_class_t, std::vector<Block> >::iterator it = m_Blocks.begin(); it != m_Blocks.end(); ++it)
+		for (u16 bj = bj0; bj <= bj1; ++bj)
+			for (u16 bi = bi0; bi <= bi1; ++bi)
+				it->second[bi + bj*m_BlocksW].valid = false;
+}
+
+void VertexTerrainEdgeCache::GetTileEdges(std::vector<TileEdges>& out, u16 i0, u16 j0, u16 i1, u16 j1,
 	ICmpPathfinder::pass_class_t passClass, const Grid<TerrainTile>& terrain)
 {
-	PROFILE("AddTerrainEdges");
+	if (m_BlocksW == 0)
+	{
+		m_BlocksW = (u16)((terrain.m_W + BLOCK_SIZE - 1) / BLOCK_SIZE);
+		m_BlocksH = (u16)((terrain.m_H + BLOCK_SIZE - 1) / BLOCK_SIZE);
+	}
 
-	std::vector<TileEdge> tileEdges;
+	std::vector<Block>& blocks = m_Blocks[passClass];
+	if (blocks.empty())
+	{
+		blocks.resize(m_BlocksW * m_BlocksH);
+		for (size_t n = 0; n < blocks.size(); ++n)
+			blocks[n].valid = false;
+	}
 
-	// Find all edges between tiles of differently passability statuses
 	for (u16 j = j0; j <= j1; ++j)
 	{
-		for (u16 i = i0; i <= i1; ++i)
+		u16 bj = j / BLOCK_SIZE;
+		u16 row = j - bj*BLOCK_SIZE;
+		for (u16 bi = i0 / BLOCK_SIZE; bi <= i1 / BLOCK_SIZE; ++bi)
 		{
-			if (!IS_TERRAIN_PASSABLE(terrain.get(i, j), passClass))
+			Block& block = blocks[bi + bj*m_BlocksW];
+			if (!block.valid)
+				ComputeBlock(block, bi, bj, passClass, terrain);
+
+			for (u16 n = block.rows[row]; n < block.rows[row+1]; ++n)
 			{
-				bool any = false; // whether we're adding any edges of this tile
+				const TileEdges& tile = block.tiles[n];
+				if (i0 <= tile.i && tile.i <= i1)
+					out.push_back(tile);
+			}
+		}
+	}
+}
 
-				if (j > 0 && IS_TERRAIN_PASSABLE(terrain.get(i, j-1), passClass))
-				{
-					TileEdge e = { i, j, TileEdge::BOTTOM };
-					tileEdges.push_back(e);
-					any = true;
-				}
+void VertexTerrainEdgeCache::ComputeBlock(Block& block, u16 bi, u16 bj,
+	ICmpPathfinder::pass_class_t passClass, const Grid<TerrainTile>& terrain)
+{
+	block.tiles.clear();
 
-				if (j < terrain.m_H-1 && IS_TERRAIN_PASSABLE(terrain.get(i, j+1), passClass))
-				{
-					TileEdge e = { i, j, TileEdge::TOP };
-					tileEdges.push_back(e);
-					any = true;
-				}
+	// Find all edges between tiles of differently passability statuses
+	for (u16 row = 0; row < BLOCK_SIZE; ++row)
+	{
+		block.rows[row] = (u16)block.tiles.size();
 
-				if (i > 0 && IS_TERRAIN_PASSABLE(terrain.get(i-1, j), passClass))
-				{
-					TileEdge e = { i, j, TileEdge::LEFT };
-					tileEdges.push_back(e);
-					any = true;
-				}
+		u16 j = bj*BLOCK_SIZE + row;
+		if (j >= terrain.m_H)
+			continue;
 
-				if (i < terrain.m_W-1 && IS_TERRAIN_PASSABLE(terrain.get(i+1, j), passClass))
-				{
-					TileEdge e = { i, j, TileEdge::RIGHT };
-					tileEdges.push_back(e);
-					any = true;
-				}
+		for (u16 i = bi*BLOCK_SIZE; i < std::min((bi+1)*BLOCK_SIZE, (int)terrain.m_W); ++i)
+		{
+			if (IS_TERRAIN_PASSABLE(terrain.get(i, j), passClass))
+				continue;
 
-				// If we want to add any edge, then add the whole square to the axis-aligned-edges list.
-				// (The inner edges are redundant but it's easier than trying to split the squares apart.)
-				if (any)
-				{
-					CFixedVector2D v0 = CFixedVector2D(fixed::FromInt(i * (int)TERRAIN_TILE_SIZE) - r, fixed::FromInt(j * (int)TERRAIN_TILE_SIZE) - r);
-					CFixedVector2D v1 = CFixedVector2D(fixed::FromInt((i+1) * (int)TERRAIN_TILE_SIZE) + r, fixed::FromInt((j+1) * (int)TERRAIN_TILE_SIZE) + r);
-					Edge e = { v0, v1 };
-					edgesAA.push_back(e);
-				}
+			u8 edges = 0;
+
+			if (j > 0 && IS_TERRAIN_PASSABLE(terrain.get(i, j-1), passClass))
+				edges |= EDGE_BOTTOM;
+
+			if (j < terrain.m_H-1 && IS_TERRAIN_PASSABLE(terrain.get(i, j+1), passClass))
+				edges |= EDGE_TOP;
+
+			if (i > 0 && IS_TERRAIN_PASSABLE(terrain.get(i-1, j), passClass))
+				edges |= EDGE_LEFT;
+
+			if (i < terrain.m_W-1 && IS_TERRAIN_PASSABLE(terrain.get(i+1, j), passClass))
+				edges |= EDGE_RIGHT;
+
+			if (edges)
+			{
+				TileEdges tile = { i, j, edges };
+				block.tiles.push_back(tile);
 			}
 		}
 	}
+	block.rows[BLOCK_SIZE] = (u16)block.tiles.size();
+
+	block.valid = true;
+}
+
+void CCmpPathfinder::UpdateTerrainEdgeCache()
+{
+	if (!m_Grid || m_TerrainEdgeCache.m_DirtyID == m_Grid->m_DirtyID)
+		return;
+
+	GridDirtyRegion changes;
+	if (GetPassabilityGridChanges(m_TerrainEdgeCache.m_DirtyID, changes))
+		m_TerrainEdgeCache.Invalidate(changes);
+	else
+		m_TerrainEdgeCache.Reset();
+
+	m_TerrainEdgeCache.m_DirtyID = m_Grid->m_DirtyID;
+}
+
+static void AddTerrainEdges(std::vector<Edge>& edgesAA, std::vector<Vertex>& vertexes,
+	u16 i0, u16 j0, u16 i1, u16 j1, fixed r,
+	ICmpPathfinder::pass_class_t passClass, const Grid<TerrainTile>& terrain,
+	VertexTerrainEdgeCache& cache)
+{
+	PROFILE("AddTerrainEdges");
 
-	// TODO: maybe we should precompute these terrain edges since they'll rarely change?
+	std::vector<VertexTerrainEdgeCache::TileEdges> tiles;
+	cache.GetTileEdges(tiles, i0, j0, i1, j1, passClass, terrain);
+
+	std::vector<TileEdge> tileEdges;
+
+	for (size_t n = 0; n < tiles.size(); ++n)
+	{
+		u16 i = tiles[n].i;
+		u16 j = tiles[n].j;
+
+		if (tiles[n].edges & VertexTerrainEdgeCache::EDGE_BOTTOM)
+		{
+			TileEdge e = { i, j, TileEdge::BOTTOM };
+			tileEdges.push_back(e);
+		}
+
+		if (tiles[n].edges & VertexTerrainEdgeCache::EDGE_TOP)
+		{
+			TileEdge e = { i, j, TileEdge::TOP };
+			tileEdges.push_back(e);
+		}
+
+		if (tiles[n].edges & VertexTerrainEdgeCache::EDGE_LEFT)
+		{
+			TileEdge e = { i, j, TileEdge::LEFT };
+			tileEdges.push_back(e);
+		}
+
+		if (tiles[n].edges & VertexTerrainEdgeCache::EDGE_RIGHT)
+		{
+			TileEdge e = { i, j, TileEdge::RIGHT };
+			tileEdges.push_back(e);
+		}
+
+		// Add the whole square to the axis-aligned-edges list.
+		// (The inner edges are redundant but it's easier than trying to split the squares apart.)
+		CFixedVector2D v0 = CFixedVector2D(fixed::FromInt(i * (int)TERRAIN_TILE_SIZE) - r, fixed::FromInt(j * (int)TERRAIN_TILE_SIZE) - r);
+		CFixedVector2D v1 = CFixedVector2D(fixed::FromInt((i+1) * (int)TERRAIN_TILE_SIZE) + r, fixed::FromInt((j+1) * (int)TERRAIN_TILE_SIZE) + r);
+		Edge e = { v0, v1 };
+		edgesAA.push_back(e);
+	}
 
 	// TODO: for efficiency (minimising the A* search space), we should coalesce adjoining edges
 
@@ -498,6 +606,7 @@ void CCmpPathfinder::ComputeShortPath(const IObstructionTestFilter& filter,
 	entity_pos_t range, const Goal& goal, pass_class_t passClass, Path& path)
 {
 	UpdateGrid(); // TODO: only need to bother updating if the terrain changed
+	UpdateTerrainEdgeCache();
 
 	PROFILE3("ComputeShortPath");
 //	ScopeTimer UID__(L"ComputeShortPath");
@@ -576,7 +685,7 @@ void CCmpPathfinder::ComputeShortPath(const IObstructionTestFilter& filter,
 		u16 i0, j0, i1, j1;
 		NearestTile(rangeXMin, rangeZMin, i0, j0);
 		NearestTile(rangeXMax, rangeZMax, i1, j1);
-		AddTerrainEdges(edgesAA, vertexes, i0, j0, i1, j1, r, passClass, *m_Grid);
+		AddTerrainEdges(edgesAA, vertexes, i0, j0, i1, j1, r, passClass, *m_Grid, m_TerrainEdgeCache);
 	}
 
 	// Find all the obstruction squares that might affect us
@@ -866,6 +975,7 @@ bool CCmpPathfinder::CheckMovement(const IObstructionTestFilter& filter,
 	// (TODO: this could probably be a tiny bit faster by not reusing all the vertex computation code)
 
 	UpdateGrid();
+	UpdateTerrainEdgeCache();
 
 	std::vector<Edge> edgesAA;
 	std::vector<Vertex> vertexes;
@@ -873,7 +983,7 @@ bool CCmpPathfinder::CheckMovement(const IObstructionTestFilter& filter,
 	u16 i0, j0, i1, j1;
 	NearestTile(std::min(x0, x1) - r, std::min(z0, z1) - r, i0, j0);
 	NearestTile(std::max(x0, x1) + r, std::max(z0, z1) + r, i1, j1);
-	AddTerrainEdges(edgesAA, vertexes, i0, j0, i1, j1, r, passClass, *m_Grid);
+	AddTerrainEdges(edgesAA, vertexes, i0, j0, i1, j1, r, passClass, *m_Grid, m_TerrainEdgeCache);
 
 	CFixedVector2D a(x0, z0);
 	CFixedVector2D b(x1, z1);
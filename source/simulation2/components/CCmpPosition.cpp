@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -475,15 +475,21 @@ public:
 private:
 	void AdvertisePositionChanges()
 	{
+		CComponentManager& componentManager = GetSimContext().GetComponentManager();
+
+		// Queue the batched change before sending the individual message, so that
+		// anything the handlers query will already see the new position
 		if (m_InWorld)
 		{
+			componentManager.QueuePositionChange(GetEntityId(), true, m_X, m_Z, m_RotY);
 			CMessagePositionChanged msg(GetEntityId(), true, m_X, m_Z, m_RotY);
-			GetSimContext().GetComponentManager().PostMessage(GetEntityId(), msg);
+			componentManager.PostMessage(GetEntityId(), msg);
 		}
 		else
 		{
+			componentManager.QueuePositionChange(GetEntityId(), false, entity_pos_t::Zero(), entity_pos_t::Zero(), entity_angle_t::Zero());
 			CMessagePositionChanged msg(GetEntityId(), false, entity_pos_t::Zero(), entity_pos_t::Zero(), entity_angle_t::Zero());
-			GetSimContext().GetComponentManager().PostMessage(GetEntityId(), msg);
+			componentManager.PostMessage(GetEntityId(), msg);
 		}
 		m_PositionChanged = true;
 	}
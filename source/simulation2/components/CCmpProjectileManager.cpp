@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -32,12 +32,20 @@
 #include "graphics/Model.h"
 #include "graphics/Unit.h"
 #include "graphics/UnitManager.h"
+#include "maths/BoundingBoxAligned.h"
 #include "maths/Matrix3D.h"
-#include "maths/Quaternion.h"
 #include "maths/Vector3D.h"
 #include "ps/CLogger.h"
+#include "ps/Profile.h"
 #include "renderer/Scene.h"
 
+#if ARCH_X86_X64 && HAVE_SSE
+# include <xmmintrin.h>
+# define PROJECTILE_SSE 1
+#else
+# define PROJECTILE_SSE 0
+#endif
+
 // Time (in seconds) before projectiles that stuck in the ground are destroyed
 const static float PROJECTILE_DECAY_TIME = 30.f;
 
@@ -61,13 +69,13 @@ public:
 	{
 		m_ActorSeed = 0;
 		m_NextId = 1;
+		m_NumMoving = 0;
 	}
 
 	virtual void Deinit()
 	{
-		for (size_t i = 0; i < m_Projectiles.size(); ++i)
-			GetSimContext().GetUnitManager().DeleteUnit(m_Projectiles[i].unit);
-		m_Projectiles.clear();
+		while (!m_Units.empty())
+			RemoveProjectileAt(m_Units.size() - 1);
 	}
 
 	virtual void Serialize(ISerializer& serialize)
@@ -115,19 +123,32 @@ public:
 	virtual void RemoveProjectile(uint32_t);
 
 private:
-	struct Projectile
-	{
-		CUnit* unit;
-		CVector3D pos;
-		CVector3D target;
-		float timeLeft;
-		float speedFactor;
-		float gravity;
-		bool stopped;
-		uint32_t id;
-	};
-
-	std::vector<Projectile> m_Projectiles;
+	// Projectile state, kept in separate arrays so Interpolate can advance
+	// several projectiles at once with SIMD. Projectiles that are still flying
+	// are kept before the ones that have stuck in the ground (which only need
+	// their decay timer updating), and there are m_NumMoving of them
+	std::vector<CUnit*> m_Units;
+	std::vector<uint32_t> m_Ids;
+	std::vector<float> m_PosX, m_PosY, m_PosZ;
+	std::vector<float> m_TargetX, m_TargetY, m_TargetZ;
+	std::vector<float> m_TimeLeft;
+	std::vector<float> m_SpeedFactor;
+	std::vector<float> m_Gravity;
+	size_t m_NumMoving;
+
+	// Movement of each flying projectile in the last Interpolate, for orienting its model
+	std::vector<float> m_DeltaX, m_DeltaY, m_DeltaZ;
+
+	// Projectiles that hit the ground in the last Interpolate, reused each frame
+	std::vector<size_t> m_Landed;
+
+	// Ground height under each flying projectile, reused each frame
+	std::vector<float> m_GroundHeight;
+
+	// Culling data, reused each frame (see CFrustum::AreBoxesVisible)
+	std::vector<float> m_MinX, m_MinY, m_MinZ, m_MaxX, m_MaxY, m_MaxZ;
+	std::vector<u8> m_InView;
+	std::vector<CModelAbstract*> m_Submitted;
 
 	uint32_t m_ActorSeed;
 	
@@ -135,7 +156,13 @@ private:
 
 	uint32_t LaunchProjectile(entity_id_t source, CFixedVector3D targetPoint, fixed speed, fixed gravity);
 
-	void AdvanceProjectile(Projectile& projectile, float dt);
+	void SwapProjectiles(size_t a, size_t b);
+
+	void RemoveProjectileAt(size_t i);
+
+	void Advance(size_t begin, size_t end, float dt);
+
+	void UpdateTransform(size_t i);
 
 	void Interpolate(float frameTime);
 
@@ -182,131 +209,242 @@ uint32_t CCmpProjectileManager::LaunchProjectile(entity_id_t source, CFixedVecto
 
     targetVec = CVector3D(targetPoint);
 
-	Projectile projectile;
 	std::set<CStr> selections;
-	projectile.unit = GetSimContext().GetUnitManager().CreateUnit(name, m_ActorSeed++, selections);
-	projectile.id = currentId;
-	if (!projectile.unit)
+	CUnit* unit = GetSimContext().GetUnitManager().CreateUnit(name, m_ActorSeed++, selections);
+	if (!unit)
 	{
 		// The error will have already been logged
 		return 0;
 	}
 
-	projectile.pos = sourceVec;
-	projectile.target = targetVec;
-
-	CVector3D offset = projectile.target - projectile.pos;
+	CVector3D offset = targetVec - sourceVec;
 	float horizDistance = sqrtf(offset.X*offset.X + offset.Z*offset.Z);
 
-	projectile.speedFactor = 1.f;
-	projectile.timeLeft = horizDistance / speed.ToFloat();
-	projectile.stopped = false;
-
-	projectile.gravity = gravity.ToFloat();
+	m_Units.push_back(unit);
+	m_Ids.push_back(currentId);
+	m_PosX.push_back(sourceVec.X);
+	m_PosY.push_back(sourceVec.Y);
+	m_PosZ.push_back(sourceVec.Z);
+	m_TargetX.push_back(targetVec.X);
+	m_TargetY.push_back(targetVec.Y);
+	m_TargetZ.push_back(targetVec.Z);
+	m_TimeLeft.push_back(horizDistance / speed.ToFloat());
+	m_SpeedFactor.push_back(1.f);
+	m_Gravity.push_back(gravity.ToFloat());
+	m_DeltaX.push_back(0.f);
+	m_DeltaY.push_back(0.f);
+	m_DeltaZ.push_back(0.f);
+
+	// Move it into the flying section of the arrays
+	SwapProjectiles(m_NumMoving++, m_Units.size() - 1);
+
+	return currentId;
+}
 
-	m_Projectiles.push_back(projectile);
-	
-	return projectile.id;
+void CCmpProjectileManager::SwapProjectiles(size_t a, size_t b)
+{
+	if (a == b)
+		return;
+
+	std::swap(m_Units[a], m_Units[b]);
+	std::swap(m_Ids[a], m_Ids[b]);
+	std::swap(m_PosX[a], m_PosX[b]);
+	std::swap(m_PosY[a], m_PosY[b]);
+	std::swap(m_PosZ[a], m_PosZ[b]);
+	std::swap(m_TargetX[a], m_TargetX[b]);
+	std::swap(m_TargetY[a], m_TargetY[b]);
+	std::swap(m_TargetZ[a], m_TargetZ[b]);
+	std::swap(m_TimeLeft[a], m_TimeLeft[b]);
+	std::swap(m_SpeedFactor[a], m_SpeedFactor[b]);
+	std::swap(m_Gravity[a], m_Gravity[b]);
+	std::swap(m_DeltaX[a], m_DeltaX[b]);
+	std::swap(m_DeltaY[a], m_DeltaY[b]);
+	std::swap(m_DeltaZ[a], m_DeltaZ[b]);
 }
 
-void CCmpProjectileManager::AdvanceProjectile(Projectile& projectile, float dt)
+void CCmpProjectileManager::RemoveProjectileAt(size_t i)
 {
-	// Do special processing if we've already reached the target
-	if (projectile.timeLeft <= 0)
-	{
-		if (projectile.stopped)
-		{
-			projectile.timeLeft -= dt;
-			return;
-		}
-		// else continue moving the projectile
+	GetSimContext().GetUnitManager().DeleteUnit(m_Units[i]);
 
-		// To prevent arrows going crazily far after missing the target,
-		// apply a bit of drag to them
-		projectile.speedFactor *= powf(1.0f - 0.4f*projectile.speedFactor, dt);
+	// Delete in-place by swapping with the last in the list, keeping
+	// the flying projectiles together at the start
+	if (i < m_NumMoving)
+	{
+		--m_NumMoving;
+		SwapProjectiles(i, m_NumMoving);
+		i = m_NumMoving;
 	}
+	SwapProjectiles(i, m_Units.size() - 1);
+
+	m_Units.pop_back();
+	m_Ids.pop_back();
+	m_PosX.pop_back();
+	m_PosY.pop_back();
+	m_PosZ.pop_back();
+	m_TargetX.pop_back();
+	m_TargetY.pop_back();
+	m_TargetZ.pop_back();
+	m_TimeLeft.pop_back();
+	m_SpeedFactor.pop_back();
+	m_Gravity.pop_back();
+	m_DeltaX.pop_back();
+	m_DeltaY.pop_back();
+	m_DeltaZ.pop_back();
+}
 
-	CVector3D offset = (projectile.target - projectile.pos) * projectile.speedFactor;
-
+void CCmpProjectileManager::Advance(size_t begin, size_t end, float dt)
+{
 	// Compute the vertical velocity that's needed so we travel in a ballistic curve and
-	// reach the target after timeLeft.
+	// reach the target after timeLeft, and move an appropriate fraction towards the target.
 	// (This is just a linear approximation to the curve, but it'll converge to hit the target)
-	float vh = (projectile.gravity / 2.f) * projectile.timeLeft + offset.Y / projectile.timeLeft;
-
-	// Move an appropriate fraction towards the target
-	CVector3D delta (offset.X * dt/projectile.timeLeft, vh * dt, offset.Z * dt/projectile.timeLeft);
 
-	projectile.pos += delta;
-	projectile.timeLeft -= dt;
+	size_t i = begin;
 
-	// If we've passed the target position and haven't stopped yet,
-	// carry on until we reach solid land
-	if (projectile.timeLeft <= 0)
+#if PROJECTILE_SSE
+	const __m128 dtv = _mm_set1_ps(dt);
+	const __m128 half = _mm_set1_ps(0.5f);
+	for (; i + 4 <= end; i += 4)
 	{
-		CmpPtr<ICmpTerrain> cmpTerrain(GetSimContext(), SYSTEM_ENTITY);
-		if (cmpTerrain)
-		{
-			float h = cmpTerrain->GetExactGroundLevel(projectile.pos.X, projectile.pos.Z);
-			if (projectile.pos.Y < h)
-			{
-				projectile.pos.Y = h; // stick precisely to the terrain
-				projectile.stopped = true;
-			}
-		}
+		__m128 timeLeft = _mm_loadu_ps(&m_TimeLeft[i]);
+		__m128 speedFactor = _mm_loadu_ps(&m_SpeedFactor[i]);
+		__m128 posX = _mm_loadu_ps(&m_PosX[i]);
+		__m128 posY = _mm_loadu_ps(&m_PosY[i]);
+		__m128 posZ = _mm_loadu_ps(&m_PosZ[i]);
+
+		__m128 offsetX = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&m_TargetX[i]), posX), speedFactor);
+		__m128 offsetY = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&m_TargetY[i]), posY), speedFactor);
+		__m128 offsetZ = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&m_TargetZ[i]), posZ), speedFactor);
+
+		__m128 vh = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(&m_Gravity[i]), half), timeLeft), _mm_div_ps(offsetY, timeLeft));
+		__m128 fraction = _mm_div_ps(dtv, timeLeft);
+
+		__m128 deltaX = _mm_mul_ps(offsetX, fraction);
+		__m128 deltaY = _mm_mul_ps(vh, dtv);
+		__m128 deltaZ = _mm_mul_ps(offsetZ, fraction);
+
+		_mm_storeu_ps(&m_DeltaX[i], deltaX);
+		_mm_storeu_ps(&m_DeltaY[i], deltaY);
+		_mm_storeu_ps(&m_DeltaZ[i], deltaZ);
+		_mm_storeu_ps(&m_PosX[i], _mm_add_ps(posX, deltaX));
+		_mm_storeu_ps(&m_PosY[i], _mm_add_ps(posY, deltaY));
+		_mm_storeu_ps(&m_PosZ[i], _mm_add_ps(posZ, deltaZ));
+		_mm_storeu_ps(&m_TimeLeft[i], _mm_sub_ps(timeLeft, dtv));
 	}
+#endif
 
-	// Construct a rotation matrix so that (0,1,0) is in the direction of 'delta'
-
-	CVector3D up(0, 1, 0);
-
-	delta.Normalize();
-	CVector3D axis = up.Cross(delta);
-	if (axis.LengthSquared() < 0.0001f)
-		axis = CVector3D(1, 0, 0); // if up & delta are almost collinear, rotate around some other arbitrary axis
-	else
-		axis.Normalize();
+	for (; i < end; ++i)
+	{
+		float timeLeft = m_TimeLeft[i];
+		float speedFactor = m_SpeedFactor[i];
+
+		float offsetX = (m_TargetX[i] - m_PosX[i]) * speedFactor;
+		float offsetY = (m_TargetY[i] - m_PosY[i]) * speedFactor;
+		float offsetZ = (m_TargetZ[i] - m_PosZ[i]) * speedFactor;
+
+		float vh = (m_Gravity[i] / 2.f) * timeLeft + offsetY / timeLeft;
+
+		m_DeltaX[i] = offsetX * dt/timeLeft;
+		m_DeltaY[i] = vh * dt;
+		m_DeltaZ[i] = offsetZ * dt/timeLeft;
+		m_PosX[i] += m_DeltaX[i];
+		m_PosY[i] += m_DeltaY[i];
+		m_PosZ[i] += m_DeltaZ[i];
+		m_TimeLeft[i] = timeLeft - dt;
+	}
+}
 
-	float angle = acosf(up.Dot(delta));
+void CCmpProjectileManager::UpdateTransform(size_t i)
+{
+	// Construct a rotation matrix so that (0,1,0) is in the direction of the movement
+	CVector3D dir(m_DeltaX[i], m_DeltaY[i], m_DeltaZ[i]);
+	dir.Normalize();
 
 	CMatrix3D transform;
-	CQuaternion quat;
-	quat.FromAxisAngle(axis, angle);
-	quat.ToMatrix(transform);
+	if (dir.Y < -0.9999f)
+	{
+		// Pointing straight down, so rotate by 180 degrees around some arbitrary axis
+		transform.SetIdentity();
+		transform._22 = -1.f;
+		transform._33 = -1.f;
+	}
+	else
+	{
+		// Rotation around up x dir, by the angle between them (written out
+		// directly since it's much cheaper than going through a quaternion)
+		float k = 1.f / (1.f + dir.Y);
+		transform._11 = 1.f - k*dir.X*dir.X; transform._12 = dir.X;  transform._13 = -k*dir.X*dir.Z;
+		transform._21 = -dir.X;              transform._22 = dir.Y;  transform._23 = -dir.Z;
+		transform._31 = -k*dir.X*dir.Z;      transform._32 = dir.Z;  transform._33 = 1.f - k*dir.Z*dir.Z;
+		transform._14 = transform._24 = transform._34 = 0.f;
+		transform._41 = transform._42 = transform._43 = 0.f;
+		transform._44 = 1.f;
+	}
 
 	// Then apply the translation
-	transform.Translate(projectile.pos);
+	transform.Translate(m_PosX[i], m_PosY[i], m_PosZ[i]);
 
 	// Move the model
-	projectile.unit->GetModel().SetTransform(transform);
+	m_Units[i]->GetModel().SetTransform(transform);
 }
 
 void CCmpProjectileManager::Interpolate(float frameTime)
 {
-	for (size_t i = 0; i < m_Projectiles.size(); ++i)
-	{
-		AdvanceProjectile(m_Projectiles[i], frameTime);
-	}
+	PROFILE3("interpolate projectiles");
+
+	// Projectiles that are stuck in the ground don't move
+	for (size_t i = m_NumMoving; i < m_Units.size(); ++i)
+		m_TimeLeft[i] -= frameTime;
+
+	// To prevent arrows going crazily far after missing the target,
+	// apply a bit of drag to them
+	for (size_t i = 0; i < m_NumMoving; ++i)
+		if (m_TimeLeft[i] <= 0)
+			m_SpeedFactor[i] *= powf(1.0f - 0.4f*m_SpeedFactor[i], frameTime);
 
-	// Remove the ones that have reached their target
-	for (size_t i = 0; i < m_Projectiles.size(); )
+	Advance(0, m_NumMoving, frameTime);
+
+	// If we've passed the target position and haven't stopped yet,
+	// carry on until we reach solid land
+	m_Landed.clear();
+	CmpPtr<ICmpTerrain> cmpTerrain(GetSimContext(), SYSTEM_ENTITY);
+	if (cmpTerrain && m_NumMoving)
 	{
-		// Projectiles hitting targets get removed immediately.
-		// Those hitting the ground stay for a while, because it looks pretty.
-		if (m_Projectiles[i].timeLeft <= 0.f)
+		m_GroundHeight.resize(m_NumMoving);
+		cmpTerrain->GetExactGroundLevels(m_NumMoving, &m_PosX[0], &m_PosZ[0], &m_GroundHeight[0]);
+		for (size_t i = 0; i < m_NumMoving; ++i)
 		{
-			if (m_Projectiles[i].timeLeft > -PROJECTILE_DECAY_TIME)
-			{
-				// Keep the projectile until it exceeds the decay time
-			}
-			else
+			if (m_TimeLeft[i] > 0)
+				continue;
+
+			float h = m_GroundHeight[i];
+			if (m_PosY[i] < h)
 			{
-				// Delete in-place by swapping with the last in the list
-				std::swap(m_Projectiles[i], m_Projectiles.back());
-				GetSimContext().GetUnitManager().DeleteUnit(m_Projectiles.back().unit);
-				m_Projectiles.pop_back();
-				continue; // don't increment i
+				m_PosY[i] = h; // stick precisely to the terrain
+				m_Landed.push_back(i);
 			}
 		}
+	}
+
+	for (size_t i = 0; i < m_NumMoving; ++i)
+		UpdateTransform(i);
+
+	// Move the landed projectiles out of the flying section. (Do the highest
+	// indexes first, so the swapping doesn't move any we haven't done yet)
+	for (size_t n = m_Landed.size(); n > 0; --n)
+		SwapProjectiles(m_Landed[n-1], --m_NumMoving);
+
+	// Remove the ones that have reached their target.
+	// Projectiles hitting targets get removed immediately.
+	// Those hitting the ground stay for a while, because it looks pretty.
+	for (size_t i = 0; i < m_Units.size(); )
+	{
+		if (m_TimeLeft[i] <= -PROJECTILE_DECAY_TIME)
+		{
+			// (This moves a different projectile into slot i, which
+			// has to be checked too, so don't increment i)
+			RemoveProjectileAt(i);
+			continue;
+		}
 
 		++i;
 	}
@@ -315,14 +453,11 @@ void CCmpProjectileManager::Interpolate(float frameTime)
 void CCmpProjectileManager::RemoveProjectile(uint32_t id)
 {
 	// Scan through the projectile list looking for one with the correct id to remove
-	for (size_t i = 0; i < m_Projectiles.size(); i++)
+	for (size_t i = 0; i < m_Ids.size(); i++)
 	{
-		if (m_Projectiles[i].id == id)
+		if (m_Ids[i] == id)
 		{
-			// Delete in-place by swapping with the last in the list
-			std::swap(m_Projectiles[i], m_Projectiles.back());
-			GetSimContext().GetUnitManager().DeleteUnit(m_Projectiles.back().unit);
-			m_Projectiles.pop_back();
+			RemoveProjectileAt(i);
 			return;
 		}
 	}
@@ -330,28 +465,52 @@ void CCmpProjectileManager::RemoveProjectile(uint32_t id)
 
 void CCmpProjectileManager::RenderSubmit(SceneCollector& collector, const CFrustum& frustum, bool culling)
 {
+	PROFILE3("submit projectiles");
+
 	CmpPtr<ICmpRangeManager> cmpRangeManager(GetSimContext(), SYSTEM_ENTITY);
 	int player = GetSimContext().GetCurrentDisplayedPlayer();
 	ICmpRangeManager::CLosQuerier los (cmpRangeManager->GetLosQuerier(player));
 	bool losRevealAll = cmpRangeManager->GetLosRevealAll(player);
 
-	for (size_t i = 0; i < m_Projectiles.size(); ++i)
+	m_Submitted.clear();
+	m_MinX.clear(); m_MinY.clear(); m_MinZ.clear();
+	m_MaxX.clear(); m_MaxY.clear(); m_MaxZ.clear();
+
+	for (size_t i = 0; i < m_Units.size(); ++i)
 	{
 		// Don't display projectiles outside the visible area
-		ssize_t posi = (ssize_t)(0.5f + m_Projectiles[i].pos.X / TERRAIN_TILE_SIZE);
-		ssize_t posj = (ssize_t)(0.5f + m_Projectiles[i].pos.Z / TERRAIN_TILE_SIZE);
+		ssize_t posi = (ssize_t)(0.5f + m_PosX[i] / TERRAIN_TILE_SIZE);
+		ssize_t posj = (ssize_t)(0.5f + m_PosZ[i] / TERRAIN_TILE_SIZE);
 		if (!losRevealAll && !los.IsVisible(posi, posj))
 			continue;
 
-		CModelAbstract& model = m_Projectiles[i].unit->GetModel();
+		CModelAbstract& model = m_Units[i]->GetModel();
 
 		model.ValidatePosition();
 
-		if (culling && !frustum.IsBoxVisible(CVector3D(0, 0, 0), model.GetWorldBoundsRec()))
-			continue;
-
-		// TODO: do something about LOS (copy from CCmpVisualActor)
+		m_Submitted.push_back(&model);
+		if (culling)
+		{
+			CBoundingBoxAligned bounds = model.GetWorldBoundsRec();
+			m_MinX.push_back(bounds[0].X); m_MinY.push_back(bounds[0].Y); m_MinZ.push_back(bounds[0].Z);
+			m_MaxX.push_back(bounds[1].X); m_MaxY.push_back(bounds[1].Y); m_MaxZ.push_back(bounds[1].Z);
+		}
+	}
 
-		collector.SubmitRecursive(&model);
+	// Test all the bounds at once
+	if (culling && !m_Submitted.empty())
+	{
+		m_InView.resize(m_Submitted.size());
+		frustum.AreBoxesVisible(m_Submitted.size(),
+			&m_MinX[0], &m_MinY[0], &m_MinZ[0], &m_MaxX[0], &m_MaxY[0], &m_MaxZ[0],
+			&m_InView[0]);
 	}
+
+	// TODO: do something about LOS (copy from CCmpVisualActor)
+
+	// (Projectiles using the same actor share a model definition, so the
+	// renderer will draw them together with instancing)
+	for (size_t i = 0; i < m_Submitted.size(); ++i)
+		if (!culling || m_InView[i])
+			collector.SubmitRecursive(m_Submitted[i]);
 }
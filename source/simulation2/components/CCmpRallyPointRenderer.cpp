@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -97,6 +97,11 @@ protected:
 	std::vector<std::vector<CVector2D> > m_Path;
 	/// Visibility segments of the rally point paths; splits the path into SoD/non-SoD segments.
 	std::deque<std::deque<SVisibilitySegment> > m_VisibilitySegments;
+	/// Start and end points that each of the first m_PathEndpoints.size() paths in m_Path were computed for, so paths are
+	/// only recomputed when their endpoints change (e.g. not when the entity is deselected and reselected).
+	std::vector<std::pair<CFixedVector2D, CFixedVector2D> > m_PathEndpoints;
+	/// DirtyID of the pathfinder's passability grid when the paths were computed; they're all recomputed when it changes.
+	size_t m_PathGridDirtyID;
 
 	bool m_Displayed; ///< Should we render the rally points and the path lines? (set from JS when e.g. the unit is selected/deselected)
 	bool m_SmoothPath; ///< Smooth the path before rendering?
@@ -238,6 +243,7 @@ public:
 			break;
 		case MT_TurnStart:
 			{
+				UpdatePaths(); // check for changes to the passability grid
 				UpdateOverlayLines(); // check for changes to the SoD and update the overlay lines accordingly
 			}
 			break;
@@ -256,8 +262,8 @@ public:
 		case MT_PositionChanged:
 			{
 				// Unlikely to happen in-game, but can occur in atlas
-				// Just recompute the path from the entity to the first rally point
-				RecomputeRallyPointPath_wrapper(0);
+				// (This just recomputes the path from the entity to the first rally point)
+				UpdatePaths();
 			}
 			break;
 		}
@@ -265,7 +271,7 @@ public:
 
 	virtual void AddPosition_wrapper(CFixedVector2D pos)
 	{
-		AddPosition(pos, false);
+		AddPosition(pos);
 	}
 
 	virtual void SetPosition(CFixedVector2D pos)
@@ -273,7 +279,7 @@ public:
 		if (!(m_RallyPoints.size() == 1 && m_RallyPoints.front() == pos))
 		{
 			m_RallyPoints.clear();
-			AddPosition(pos, true);
+			AddPosition(pos);
 		}
 	}
 
@@ -285,6 +291,9 @@ public:
 
 			// move the markers out of oblivion and back into the real world, or vice-versa
 			UpdateMarkers();
+
+			// Compute any paths that changed while the rally point wasn't displayed
+			UpdatePaths();
 			
 			// Check for changes to the SoD and update the overlay lines accordingly. We need to do this here because this method
 			// only takes effect when the display flag is active; we need to pick up changes to the SoD that might have occurred 
@@ -298,15 +307,11 @@ private:
 	/**
 	 * Helper function for AddPosition_wrapper and SetPosition.
 	 */
-	void AddPosition(CFixedVector2D pos, bool recompute)
+	void AddPosition(CFixedVector2D pos)
 	{
 		m_RallyPoints.push_back(pos);
 		UpdateMarkers();
-
-		if (recompute)
-			RecomputeAllRallyPointPaths();
-		else
-			RecomputeRallyPointPath_wrapper(m_RallyPoints.size()-1);
+		UpdatePaths();
 	}
 
 	/**
@@ -327,19 +332,14 @@ private:
 	void UpdateMarkers();
 
 	/**
-	 * Recomputes all the full paths from this entity to the rally point and from the rally point to the next, and does all the necessary
-	 * post-processing to make them prettier.
-	 * 
-	 * Should be called whenever all rally points' position changes.
-	 */
-	void RecomputeAllRallyPointPaths();
-
-	/**
-	 * Recomputes the full path for m_Path[ @p index], and does all the necessary post-processing to make it prettier.
-	 * 
-	 * Should be called whenever either the starting position or the rally point's position changes.
+	 * Recomputes the paths from this entity to the rally point and from each rally point to the next whose endpoints have changed
+	 * since they were last computed (or all of them, if the passability grid has changed), and removes the paths of rally points
+	 * that no longer exist. Does nothing if the rally point lines are not currently set to be displayed, so that setting the
+	 * rally points of many entities at once only costs anything for the ones being displayed.
+	 *
+	 * Should be called whenever the number or positions of the rally points, the entity's position, or the display flag changes.
 	 */
-	void RecomputeRallyPointPath_wrapper(size_t index);
+	void UpdatePaths();
 
 	/**
 	 * Recomputes the full path from this entity/the previous rally point to the next rally point, and does all the necessary
@@ -412,6 +412,7 @@ void CCmpRallyPointRenderer::Init(const CParamNode& paramNode)
 	m_SmoothPath = true;
 	m_LastOwner = INVALID_PLAYER;
 	m_LastMarkerCount = 0;
+	m_PathGridDirtyID = 0;
 	m_EnableDebugNodeOverlay = false;
 
 	// ---------------------------------------------------------------------------------------------
@@ -528,46 +529,55 @@ void CCmpRallyPointRenderer::UpdateMarkers()
 	m_LastMarkerCount = m_RallyPoints.size() - 1;
 }
 
-void CCmpRallyPointRenderer::RecomputeAllRallyPointPaths()
+void CCmpRallyPointRenderer::UpdatePaths()
 {
-	m_Path.clear();
-	m_VisibilitySegments.clear();
-	m_TexturedOverlayLines.clear();
-
-	//// <DEBUG> ///////////////////////////////////////////////
-	if (m_EnableDebugNodeOverlay)
-		m_DebugNodeOverlays.clear();
-	//// </DEBUG> //////////////////////////////////////////////
-
-	if (!IsSet())
-		return; // no use computing a path if the rally point isn't set
+	if (!m_Displayed)
+		return;
 
+	// No use computing a path if this entity doesn't have a position or is outside of the world
+	size_t count = m_RallyPoints.size();
 	CmpPtr<ICmpPosition> cmpPosition(GetSimContext(), GetEntityId());
 	if (!cmpPosition || !cmpPosition->IsInWorld())
-		return; // no point going on if this entity doesn't have a position or is outside of the world
+		count = 0;
 
-	CmpPtr<ICmpFootprint> cmpFootprint(GetSimContext(), GetEntityId());
 	CmpPtr<ICmpPathfinder> cmpPathfinder(GetSimContext(), SYSTEM_ENTITY);
+	if (!cmpPathfinder)
+		return;
 
-	for (size_t i = 0; i < m_RallyPoints.size(); ++i)
+	// New obstructions or terrain changes might affect any of the paths
+	size_t gridDirtyID = cmpPathfinder->GetPassabilityGrid().m_DirtyID;
+	if (gridDirtyID != m_PathGridDirtyID)
 	{
-		RecomputeRallyPointPath(i, cmpPosition, cmpFootprint, cmpPathfinder);
+		m_PathEndpoints.clear();
+		m_PathGridDirtyID = gridDirtyID;
 	}
-}
 
-void CCmpRallyPointRenderer::RecomputeRallyPointPath_wrapper(size_t index)
-{
-	if (!IsSet())
-		return; // no use computing a path if the rally point isn't set
-
-	CmpPtr<ICmpPosition> cmpPosition(GetSimContext(), GetEntityId());
-	if (!cmpPosition || !cmpPosition->IsInWorld())
-		return; // no point going on if this entity doesn't have a position or is outside of the world
+	// Forget the paths to rally points that have been removed
+	if (m_Path.size() > count)
+		m_Path.resize(count);
+	if (m_VisibilitySegments.size() > count)
+		m_VisibilitySegments.resize(count);
+	if (m_TexturedOverlayLines.size() > count)
+		m_TexturedOverlayLines.resize(count);
+	if (m_DebugNodeOverlays.size() > count)
+		m_DebugNodeOverlays.resize(count);
+	if (m_PathEndpoints.size() > count)
+		m_PathEndpoints.resize(count);
 
 	CmpPtr<ICmpFootprint> cmpFootprint(GetSimContext(), GetEntityId());
-	CmpPtr<ICmpPathfinder> cmpPathfinder(GetSimContext(), SYSTEM_ENTITY);
 
-	RecomputeRallyPointPath(index, cmpPosition, cmpFootprint, cmpPathfinder);
+	for (size_t i = 0; i < count; ++i)
+	{
+		std::pair<CFixedVector2D, CFixedVector2D> endpoints(i == 0 ? cmpPosition->GetPosition2D() : m_RallyPoints[i-1], m_RallyPoints[i]);
+		if (i < m_PathEndpoints.size() && m_PathEndpoints[i] == endpoints)
+			continue;
+
+		RecomputeRallyPointPath(i, cmpPosition, cmpFootprint, cmpPathfinder);
+
+		if (i >= m_PathEndpoints.size())
+			m_PathEndpoints.resize(i + 1);
+		m_PathEndpoints[i] = endpoints;
+	}
 }
 
 void CCmpRallyPointRenderer::RecomputeRallyPointPath(size_t index, CmpPtr<ICmpPosition>& cmpPosition, CmpPtr<ICmpFootprint>& cmpFootprint, CmpPtr<ICmpPathfinder> cmpPathfinder)
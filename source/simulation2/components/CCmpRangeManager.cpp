@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -24,6 +24,7 @@
 #include "simulation2/components/ICmpPosition.h"
 #include "simulation2/components/ICmpTerritoryManager.h"
 #include "simulation2/components/ICmpVision.h"
+#include "simulation2/helpers/LosCounts.h"
 #include "simulation2/helpers/Render.h"
 #include "simulation2/helpers/Spatial.h"
 
@@ -32,6 +33,7 @@
 #include "lib/timer.h"
 #include "maths/FixedVector2D.h"
 #include "ps/CLogger.h"
+#include "ps/FrameArena.h"
 #include "ps/Overlay.h"
 #include "ps/Profile.h"
 #include "renderer/Scene.h"
@@ -43,6 +45,8 @@
  */
 struct Query
 {
+	Query() : dirty(true) { }
+
 	bool enabled;
 	entity_id_t source;
 	entity_pos_t minRange;
@@ -51,6 +55,10 @@ struct Query
 	i32 interface;
 	std::vector<entity_id_t> lastMatch;
 	u8 flagsMask;
+
+	// Not serialized (queries are always dirty after deserialization):
+	bool dirty; // lastMatch might be outdated, regardless of which divisions have changed
+	CFixedVector2D lastSourcePos; // source position when lastMatch was computed
 };
 
 /**
@@ -185,11 +193,11 @@ public:
 	static void ClassInit(CComponentManager& componentManager)
 	{
 		componentManager.SubscribeGloballyToMessageType(MT_Create);
-		componentManager.SubscribeGloballyToMessageType(MT_PositionChanged);
 		componentManager.SubscribeGloballyToMessageType(MT_OwnershipChanged);
 		componentManager.SubscribeGloballyToMessageType(MT_Destroy);
 		componentManager.SubscribeGloballyToMessageType(MT_VisionRangeChanged);
 
+		componentManager.SubscribeToMessageType(MT_PositionChangedBatch);
 		componentManager.SubscribeToMessageType(MT_Update);
 
 		componentManager.SubscribeToMessageType(MT_RenderSubmit); // for debug overlays
@@ -211,7 +219,29 @@ public:
 	tag_t m_QueryNext; // next allocated id
 	std::map<tag_t, Query> m_Queries;
 	std::map<entity_id_t, EntityData> m_EntityData;
-	SpatialSubdivision<entity_id_t> m_Subdivision; // spatial index of m_EntityData
+	std::vector<entity_id_t> m_QueryCandidates; // scratch space for PerformQuery (not serialized)
+
+	// Spatial indexes of the in-world entities in m_EntityData, one per owner
+	// (indexed by owner+1, matching the bits of CalcOwnerMask), so queries
+	// only have to look at entities with the owners they're interested in.
+	// Only the owners in m_SubdivisionsMask have been initialised.
+	std::vector<SpatialSubdivision<entity_id_t> > m_Subdivisions;
+	u32 m_SubdivisionsMask;
+	entity_pos_t m_SubdivisionsX1, m_SubdivisionsZ1;
+
+	// Entities in m_EntityData (in-world or not) for each owner, indexed like m_Subdivisions
+	std::vector<std::set<entity_id_t> > m_OwnerEntities;
+
+	// Divisions (of the same size as m_Subdivisions') containing entities that have
+	// been added, removed, moved or otherwise changed in a way that could affect
+	// queries, since the last ExecuteActiveQueries. Active queries that don't overlap
+	// any dirty divisions don't need to be recomputed.
+	// (Not serialized; everything is dirty after deserialization.)
+	std::vector<u8> m_DirtyDivisions;
+	u32 m_DirtyDivisionsW;
+	u32 m_DirtyDivisionsH;
+	entity_pos_t m_DivisionSize;
+	bool m_AnyDivisionDirty;
 
 	// LOS state:
 
@@ -220,6 +250,33 @@ public:
 	i32 m_TerrainVerticesPerSide;
 	size_t m_TerritoriesDirtyID;
 
+	// Incremented whenever any entity's position, owner or LOS visibility may have changed
+	// (Not serialized; everything is dirty after deserialization.)
+	size_t m_VisibilityDirtyID;
+
+	// GetLosVisibility results for one player, indexed by entity ID (for the entities in
+	// m_EntityData), as the ELosVisibility plus LOS_VISIBILITY_EXPLORED if the entity is
+	// hidden in an explored region. Entries are only valid if their generation matches the
+	// cache's, so the whole cache can be invalidated by incrementing that.
+	struct LosVisibilityCache
+	{
+		struct Entry
+		{
+			u32 generation;
+			u8 flags;
+		};
+
+		std::vector<Entry> entries;
+		u32 generation;
+		u32 losMask; // the player's shared LOS mask, as of the last invalidation
+		bool dirty; // the player's LOS (or reveal-all flag etc) has changed since the last invalidation
+	};
+
+	// A LosVisibilityCache per player, starting with player 0. Each is invalidated when the
+	// LOS of a player it shares changes, and when its settings change; the entries for a
+	// single entity are invalidated when it moves. (Not serialized.)
+	std::vector<LosVisibilityCache> m_LosVisibilityCaches;
+
 	// Counts of units seeing vertex, per vertex, per player (starting with player 0).
 	// Use u16 to avoid overflows when we have very large (but not infeasibly large) numbers
 	// of units in a very small area.
@@ -231,6 +288,11 @@ public:
 	std::vector<u32> m_LosState;
 	static const player_id_t MAX_LOS_PLAYER_ID = 16;
 
+	// Bounding boxes of the vertexes whose m_LosState may have changed since the last
+	// GetLosDirtyRegion, per player; index 0 is for changes that affect every player.
+	// (Not serialized; everything is dirty after deserialization.)
+	std::vector<GridDirtyRegion> m_LosDirtyRegions;
+
 	// Special static visibility data for the "reveal whole map" mode
 	// (TODO: this is usually a waste of memory)
 	std::vector<u32> m_LosStateRevealed;
@@ -252,6 +314,12 @@ public:
 
 		m_WorldX0 = m_WorldZ0 = m_WorldX1 = m_WorldZ1 = entity_pos_t::Zero();
 
+		m_Subdivisions.clear();
+		m_Subdivisions.resize(32);
+		m_SubdivisionsMask = 0;
+		m_OwnerEntities.clear();
+		m_OwnerEntities.resize(32);
+
 		// Initialise with bogus values (these will get replaced when
 		// SetBounds is called)
 		ResetSubdivisions(entity_pos_t::FromInt(1), entity_pos_t::FromInt(1));
@@ -268,6 +336,13 @@ public:
 		m_TerrainVerticesPerSide = 0;
 
 		m_TerritoriesDirtyID = 0;
+		m_VisibilityDirtyID = 1;
+
+		LosVisibilityCache emptyCache;
+		emptyCache.generation = 1;
+		emptyCache.losMask = 0;
+		emptyCache.dirty = true;
+		m_LosVisibilityCaches.assign(MAX_LOS_PLAYER_ID+1, emptyCache);
 	}
 
 	virtual void Deinit()
@@ -290,17 +365,20 @@ public:
 		serialize.Bool("los circular", m_LosCircular);
 		serialize.NumberI32_Unbounded("terrain verts per side", m_TerrainVerticesPerSide);
 
-		// We don't serialize m_Subdivision or m_LosPlayerCounts
+		// We don't serialize m_Subdivisions, m_OwnerEntities or m_LosPlayerCounts
 		// since they can be recomputed from the entity data when deserializing;
-		// m_LosState must be serialized since it depends on the history of exploration
+		// m_LosState must be serialized since it depends on the history of exploration.
+		// It mostly consists of long runs of identical values (unexplored or fully
+		// explored areas), so it's run-length encoded to keep saves and rejoins small
 
-		SerializeVector<SerializeU32_Unbounded>()(serialize, "los state", m_LosState);
+		SerializeRepetitiveVector<SerializeU32_Unbounded>()(serialize, "los state", m_LosState);
 
 		SerializeMap<SerializeI32_Unbounded, SerializeU32_Unbounded>()(serialize, "shared los masks", m_SharedLosMasks);
 	}
 
 	virtual void Serialize(ISerializer& serialize)
 	{
+		FlushPositionChanges();
 		SerializeCommon(serialize);
 	}
 
@@ -347,54 +425,19 @@ public:
 
 			// Remember this entity
 			m_EntityData.insert(std::make_pair(ent, entdata));
+			m_OwnerEntities[entdata.owner+1].insert(ent);
 
 			break;
 		}
-		case MT_PositionChanged:
+		case MT_PositionChangedBatch:
 		{
-			const CMessagePositionChanged& msgData = static_cast<const CMessagePositionChanged&> (msg);
-			entity_id_t ent = msgData.entity;
-
-			std::map<entity_id_t, EntityData>::iterator it = m_EntityData.find(ent);
-
-			// Ignore if we're not already tracking this entity
-			if (it == m_EntityData.end())
-				break;
-
-			if (msgData.inWorld)
-			{
-				if (it->second.inWorld)
-				{
-					CFixedVector2D from(it->second.x, it->second.z);
-					CFixedVector2D to(msgData.x, msgData.z);
-					m_Subdivision.Move(ent, from, to);
-					LosMove(it->second.owner, it->second.visionRange, from, to);
-				}
-				else
-				{
-					CFixedVector2D to(msgData.x, msgData.z);
-					m_Subdivision.Add(ent, to);
-					LosAdd(it->second.owner, it->second.visionRange, to);
-				}
-
-				it->second.inWorld = 1;
-				it->second.x = msgData.x;
-				it->second.z = msgData.z;
-			}
-			else
+			const CMessagePositionChangedBatch& msgData = static_cast<const CMessagePositionChangedBatch&> (msg);
+			for (size_t i = 0; i < msgData.changes.size(); ++i)
 			{
-				if (it->second.inWorld)
-				{
-					CFixedVector2D from(it->second.x, it->second.z);
-					m_Subdivision.Remove(ent, from);
-					LosRemove(it->second.owner, it->second.visionRange, from);
-				}
-
-				it->second.inWorld = 0;
-				it->second.x = entity_pos_t::Zero();
-				it->second.z = entity_pos_t::Zero();
+				const CMessagePositionChangedBatch::Change& change = msgData.changes[i];
+				UpdatePosition(change.entity, change.inWorld, change.x, change.z);
 			}
-
+			++m_VisibilityDirtyID;
 			break;
 		}
 		case MT_OwnershipChanged:
@@ -402,6 +445,9 @@ public:
 			const CMessageOwnershipChanged& msgData = static_cast<const CMessageOwnershipChanged&> (msg);
 			entity_id_t ent = msgData.entity;
 
+			// Make sure we're using the entity's current position
+			FlushPositionChanges();
+
 			std::map<entity_id_t, EntityData>::iterator it = m_EntityData.find(ent);
 
 			// Ignore if we're not already tracking this entity
@@ -413,10 +459,22 @@ public:
 				CFixedVector2D pos(it->second.x, it->second.z);
 				LosRemove(it->second.owner, it->second.visionRange, pos);
 				LosAdd(msgData.to, it->second.visionRange, pos);
+				MarkDivisionDirty(pos);
+
+				if (SpatialSubdivision<entity_id_t>* subdivision = GetOwnerSubdivision(it->second.owner))
+					subdivision->Remove(ent, pos);
+				if (SpatialSubdivision<entity_id_t>* subdivision = GetOwnerSubdivision(msgData.to))
+					subdivision->Add(ent, pos);
 			}
 
+			if (CalcOwnerMask(it->second.owner))
+				m_OwnerEntities[it->second.owner+1].erase(ent);
+			if (CalcOwnerMask(msgData.to))
+				m_OwnerEntities[msgData.to+1].insert(ent);
+
 			ENSURE(-128 <= msgData.to && msgData.to <= 127);
 			it->second.owner = (i8)msgData.to;
+			++m_VisibilityDirtyID;
 
 			break;
 		}
@@ -425,20 +483,30 @@ public:
 			const CMessageDestroy& msgData = static_cast<const CMessageDestroy&> (msg);
 			entity_id_t ent = msgData.entity;
 
+			// Make sure we're using the entity's current position
+			FlushPositionChanges();
+
 			std::map<entity_id_t, EntityData>::iterator it = m_EntityData.find(ent);
 
 			// Ignore if we're not already tracking this entity
 			if (it == m_EntityData.end())
 				break;
 
-			if (it->second.inWorld)
-				m_Subdivision.Remove(ent, CFixedVector2D(it->second.x, it->second.z));
-
 			// This will be called after Ownership's OnDestroy, so ownership will be set
 			// to -1 already and we don't have to do a LosRemove here
 			ENSURE(it->second.owner == -1);
 
+			if (it->second.inWorld)
+			{
+				GetOwnerSubdivision(-1)->Remove(ent, CFixedVector2D(it->second.x, it->second.z));
+				MarkDivisionDirty(CFixedVector2D(it->second.x, it->second.z));
+			}
+
+			m_OwnerEntities[0].erase(ent);
+
 			m_EntityData.erase(it);
+			InvalidateLosVisibility(ent);
+			++m_VisibilityDirtyID;
 
 			break;
 		}
@@ -447,6 +515,9 @@ public:
 			const CMessageVisionRangeChanged& msgData = static_cast<const CMessageVisionRangeChanged&> (msg);
 			entity_id_t ent = msgData.entity;
 
+			// Make sure we're using the entity's current position
+			FlushPositionChanges();
+
 			std::map<entity_id_t, EntityData>::iterator it = m_EntityData.find(ent);
 
 			// Ignore if we're not already tracking this entity
@@ -470,11 +541,13 @@ public:
 
 			if (it->second.inWorld)
 				LosAdd(it->second.owner, newRange, pos);
+			++m_VisibilityDirtyID;
 
 			break;
 		}
 		case MT_Update:
 		{
+			FlushPositionChanges();
 			m_DebugOverlayDirty = true;
 			UpdateTerritoriesLos();
 			ExecuteActiveQueries();
@@ -483,12 +556,77 @@ public:
 		case MT_RenderSubmit:
 		{
 			const CMessageRenderSubmit& msgData = static_cast<const CMessageRenderSubmit&> (msg);
+			FlushPositionChanges();
 			RenderSubmit(msgData.collector);
 			break;
 		}
 		}
 	}
 
+	/**
+	 * Applies all the position changes queued in the component manager, so that
+	 * m_EntityData, the subdivision and the LOS state are up to date.
+	 * This must be called before anything that depends on entity positions.
+	 */
+	void FlushPositionChanges()
+	{
+		GetSimContext().GetComponentManager().FlushPositionChanges();
+	}
+
+	void UpdatePosition(entity_id_t ent, bool inWorld, entity_pos_t x, entity_pos_t z)
+	{
+		std::map<entity_id_t, EntityData>::iterator it = m_EntityData.find(ent);
+
+		// Ignore if we're not already tracking this entity
+		if (it == m_EntityData.end())
+			return;
+
+		InvalidateLosVisibility(ent);
+
+		SpatialSubdivision<entity_id_t>* subdivision = GetOwnerSubdivision(it->second.owner);
+
+		if (inWorld)
+		{
+			if (it->second.inWorld)
+			{
+				CFixedVector2D from(it->second.x, it->second.z);
+				CFixedVector2D to(x, z);
+				if (subdivision)
+					subdivision->Move(ent, from, to);
+				LosMove(it->second.owner, it->second.visionRange, from, to);
+				MarkDivisionDirty(from);
+				MarkDivisionDirty(to);
+			}
+			else
+			{
+				CFixedVector2D to(x, z);
+				if (subdivision)
+					subdivision->Add(ent, to);
+				LosAdd(it->second.owner, it->second.visionRange, to);
+				MarkDivisionDirty(to);
+			}
+
+			it->second.inWorld = 1;
+			it->second.x = x;
+			it->second.z = z;
+		}
+		else
+		{
+			if (it->second.inWorld)
+			{
+				CFixedVector2D from(it->second.x, it->second.z);
+				if (subdivision)
+					subdivision->Remove(ent, from);
+				LosRemove(it->second.owner, it->second.visionRange, from);
+				MarkDivisionDirty(from);
+			}
+
+			it->second.inWorld = 0;
+			it->second.x = entity_pos_t::Zero();
+			it->second.z = entity_pos_t::Zero();
+		}
+	}
+
 	virtual void SetBounds(entity_pos_t x0, entity_pos_t z0, entity_pos_t x1, entity_pos_t z1, ssize_t vertices)
 	{
 		m_WorldX0 = x0;
@@ -497,6 +635,7 @@ public:
 		m_WorldZ1 = z1;
 		m_TerrainVerticesPerSide = (i32)vertices;
 
+		FlushPositionChanges();
 		ResetDerivedData(false);
 	}
 
@@ -506,12 +645,34 @@ public:
 		if (m_WorldX1.IsZero())
 			return;
 
+		FlushPositionChanges();
+
+		// Check that the active queries we'd skip recomputing really are up to date
+		for (std::map<tag_t, Query>::iterator it = m_Queries.begin(); it != m_Queries.end(); ++it)
+		{
+			Query& q = it->second;
+			if (!q.enabled || q.dirty)
+				continue;
+			CmpPtr<ICmpPosition> cmpSourcePosition(GetSimContext(), q.source);
+			if (!cmpSourcePosition || !cmpSourcePosition->IsInWorld())
+				continue;
+			CFixedVector2D sourcePos = cmpSourcePosition->GetPosition2D();
+			if (sourcePos != q.lastSourcePos || IsQueryAreaDirty(q, sourcePos))
+				continue;
+
+			std::vector<entity_id_t> r;
+			PerformQuery(q, r);
+			if (r != q.lastMatch)
+				debug_warn(L"inconsistent active query");
+		}
+
 		// Check that calling ResetDerivedData (i.e. recomputing all the state from scratch)
 		// does not affect the incrementally-computed state
 
 		std::vector<std::vector<u16> > oldPlayerCounts = m_LosPlayerCounts;
 		std::vector<u32> oldStateRevealed = m_LosStateRevealed;
-		SpatialSubdivision<entity_id_t> oldSubdivision = m_Subdivision;
+		std::vector<SpatialSubdivision<entity_id_t> > oldSubdivisions = m_Subdivisions;
+		std::vector<std::set<entity_id_t> > oldOwnerEntities = m_OwnerEntities;
 
 		ResetDerivedData(true);
 		
@@ -535,8 +696,11 @@ public:
 		}
 		if (oldStateRevealed != m_LosStateRevealed)
 			debug_warn(L"inconsistent revealed");
-		if (oldSubdivision != m_Subdivision)
-			debug_warn(L"inconsistent subdivs");
+		for (size_t i = 0; i < m_Subdivisions.size(); ++i)
+			if (oldSubdivisions[i] != m_Subdivisions[i])
+				debug_warn(L"inconsistent subdivs");
+		if (oldOwnerEntities != m_OwnerEntities)
+			debug_warn(L"inconsistent owner entities");
 	}
 
 	// Reinitialise subdivisions and LOS data, based on entity data
@@ -555,6 +719,11 @@ public:
 		m_LosStateRevealed.clear();
 		m_LosStateRevealed.resize(m_TerrainVerticesPerSide*m_TerrainVerticesPerSide);
 
+		m_LosDirtyRegions.assign(MAX_LOS_PLAYER_ID+1, GridDirtyRegion());
+		m_LosDirtyRegions[0].SetAll((u16)m_TerrainVerticesPerSide, (u16)m_TerrainVerticesPerSide);
+		++m_VisibilityDirtyID;
+		MarkAllLosVisibilityDirty();
+
 		for (std::map<entity_id_t, EntityData>::const_iterator it = m_EntityData.begin(); it != m_EntityData.end(); ++it)
 		{
 			if (it->second.inWorld)
@@ -566,16 +735,53 @@ public:
 				m_LosStateRevealed[i + j*m_TerrainVerticesPerSide] = LosIsOffWorld(i, j) ? 0 : 0xFFFFFFFFu;
 	}
 
+	/**
+	 * Returns the spatial index of in-world entities with the given owner (initialising it
+	 * if necessary), or NULL if the owner is invalid, since such entities never match queries.
+	 */
+	SpatialSubdivision<entity_id_t>* GetOwnerSubdivision(player_id_t owner)
+	{
+		u32 mask = CalcOwnerMask(owner);
+		if (!mask)
+			return NULL;
+
+		SpatialSubdivision<entity_id_t>& subdivision = m_Subdivisions[owner+1];
+		if (!(m_SubdivisionsMask & mask))
+		{
+			subdivision.Reset(m_SubdivisionsX1, m_SubdivisionsZ1, m_DivisionSize);
+			m_SubdivisionsMask |= mask;
+		}
+		return &subdivision;
+	}
+
 	void ResetSubdivisions(entity_pos_t x1, entity_pos_t z1)
 	{
 		// Use 8x8 tile subdivisions
 		// (TODO: find the optimal number instead of blindly guessing)
-		m_Subdivision.Reset(x1, z1, entity_pos_t::FromInt(8*TERRAIN_TILE_SIZE));
+		m_DivisionSize = entity_pos_t::FromInt(8*TERRAIN_TILE_SIZE);
+		m_SubdivisionsX1 = x1;
+		m_SubdivisionsZ1 = z1;
+		for (size_t i = 0; i < m_Subdivisions.size(); ++i)
+			if (m_SubdivisionsMask & (1u << i))
+				m_Subdivisions[i].Reset(x1, z1, m_DivisionSize);
+
+		// Every query needs to be recomputed
+		m_DirtyDivisionsW = (u32)(x1 / m_DivisionSize).ToInt_RoundToInfinity();
+		m_DirtyDivisionsH = (u32)(z1 / m_DivisionSize).ToInt_RoundToInfinity();
+		m_DirtyDivisions.assign(m_DirtyDivisionsW * m_DirtyDivisionsH, 1);
+		m_AnyDivisionDirty = true;
+
+		for (size_t i = 0; i < m_OwnerEntities.size(); ++i)
+			m_OwnerEntities[i].clear();
 
 		for (std::map<entity_id_t, EntityData>::const_iterator it = m_EntityData.begin(); it != m_EntityData.end(); ++it)
 		{
+			if (!CalcOwnerMask(it->second.owner))
+				continue;
+
+			m_OwnerEntities[it->second.owner+1].insert(it->first);
 			if (it->second.inWorld)
-				m_Subdivision.Add(it->first, CFixedVector2D(it->second.x, it->second.z));
+				GetOwnerSubdivision(it->second.owner)->Add(it->first, CFixedVector2D(it->second.x, it->second.z));
 		}
 	}
 
@@ -632,6 +838,8 @@ public:
 	{
 		PROFILE("ExecuteQuery");
 
+		FlushPositionChanges();
+
 		Query q = ConstructQuery(source, minRange, maxRange, owners, requiredInterface, GetEntityFlagMask("normal"));
 
 		std::vector<entity_id_t> r;
@@ -656,6 +864,8 @@ public:
 	{
 		PROFILE("ResetActiveQuery");
 
+		FlushPositionChanges();
+
 		std::vector<entity_id_t> r;
 
 		std::map<tag_t, Query>::iterator it = m_Queries.find(tag);
@@ -680,8 +890,12 @@ public:
 
 		q.lastMatch = r;
 
-		// Return the list sorted by distance from the entity
+		// The result is up to date now, so only later changes need to be checked
 		CFixedVector2D pos = cmpSourcePosition->GetPosition2D();
+		q.dirty = false;
+		q.lastSourcePos = pos;
+
+		// Return the list sorted by distance from the entity
 		std::stable_sort(r.begin(), r.end(), EntityDistanceOrdering(m_EntityData, pos));
 
 		return r;
@@ -691,14 +905,8 @@ public:
 	{
 		std::vector<entity_id_t> entities;
 
-		u32 ownerMask = CalcOwnerMask(player);
-
-		for (std::map<entity_id_t, EntityData>::const_iterator it = m_EntityData.begin(); it != m_EntityData.end(); ++it)
-		{
-			// Check owner and add to list if it matches
-			if (CalcOwnerMask(it->second.owner) & ownerMask)
-				entities.push_back(it->first);
-		}
+		if (CalcOwnerMask(player))
+			entities.assign(m_OwnerEntities[player+1].begin(), m_OwnerEntities[player+1].end());
 
 		return entities;
 	}
@@ -720,18 +928,35 @@ public:
 
 		// Store a queue of all messages before sending any, so we can assume
 		// no entities will move until we've finished checking all the ranges
-		std::vector<std::pair<entity_id_t, CMessageRangeUpdate> > messages;
+		FrameVector<std::pair<entity_id_t, CMessageRangeUpdate> > messages(g_SimTurnArena);
 
 		for (std::map<tag_t, Query>::iterator it = m_Queries.begin(); it != m_Queries.end(); ++it)
 		{
 			Query& q = it->second;
 
+			// Queries that we skip now won't know about the divisions that have changed,
+			// so they must be recomputed next time
 			if (!q.enabled)
+			{
+				q.dirty = true;
 				continue;
+			}
 
 			CmpPtr<ICmpPosition> cmpSourcePosition(GetSimContext(), q.source);
 			if (!cmpSourcePosition || !cmpSourcePosition->IsInWorld())
+			{
+				q.dirty = true;
 				continue;
+			}
+
+			// If neither the source nor anything near it has changed, the result will
+			// be the same as last time
+			CFixedVector2D sourcePos = cmpSourcePosition->GetPosition2D();
+			if (!q.dirty && sourcePos == q.lastSourcePos && !IsQueryAreaDirty(q, sourcePos))
+				continue;
+
+			q.dirty = false;
+			q.lastSourcePos = sourcePos;
 
 			std::vector<entity_id_t> r;
 			r.reserve(q.lastMatch.size());
@@ -759,10 +984,65 @@ public:
 			it->second.lastMatch.swap(r);
 		}
 
+		// Every active query is now up to date with the current divisions
+		// (the message handlers might change things again, so do this before sending them)
+		if (m_AnyDivisionDirty)
+		{
+			std::fill(m_DirtyDivisions.begin(), m_DirtyDivisions.end(), 0);
+			m_AnyDivisionDirty = false;
+		}
+
 		for (size_t i = 0; i < messages.size(); ++i)
 			GetSimContext().GetComponentManager().PostMessage(messages[i].first, messages[i].second);
 	}
 
+	u32 GetDivisionI(entity_pos_t x)
+	{
+		return (u32)Clamp((x / m_DivisionSize).ToInt_RoundToNegInfinity(), 0, (int)m_DirtyDivisionsW-1);
+	}
+
+	u32 GetDivisionJ(entity_pos_t z)
+	{
+		return (u32)Clamp((z / m_DivisionSize).ToInt_RoundToNegInfinity(), 0, (int)m_DirtyDivisionsH-1);
+	}
+
+	/**
+	 * Call this when an entity at the given position changes in any way that might
+	 * affect the result of queries.
+	 */
+	void MarkDivisionDirty(CFixedVector2D pos)
+	{
+		m_DirtyDivisions.at(GetDivisionI(pos.X) + GetDivisionJ(pos.Y)*m_DirtyDivisionsW) = 1;
+		m_AnyDivisionDirty = true;
+	}
+
+	/**
+	 * Returns whether any entities that might match the query, if its source is
+	 * at the given position, have changed since the last ExecuteActiveQueries.
+	 */
+	bool IsQueryAreaDirty(const Query& q, CFixedVector2D pos)
+	{
+		if (!m_AnyDivisionDirty)
+			return false;
+
+		// Queries with infinite range can match anything
+		if (q.maxRange == entity_pos_t::FromInt(-1))
+			return true;
+
+		// Every entity within the range is in one of the divisions overlapping its
+		// bounding square (since the division coordinates are monotonic)
+		u32 i0 = GetDivisionI(pos.X - q.maxRange);
+		u32 j0 = GetDivisionJ(pos.Y - q.maxRange);
+		u32 i1 = GetDivisionI(pos.X + q.maxRange);
+		u32 j1 = GetDivisionJ(pos.Y + q.maxRange);
+		for (u32 j = j0; j <= j1; ++j)
+			for (u32 i = i0; i <= i1; ++i)
+				if (m_DirtyDivisions[i + j*m_DirtyDivisionsW])
+					return true;
+
+		return false;
+	}
+
 	/**
 	 * Returns whether the given entity matches the given query (ignoring maxRange)
 	 */
@@ -814,12 +1094,19 @@ public:
 		}
 		else
 		{
-			// Get a quick list of entities that are potentially in range
-			std::vector<entity_id_t> ents = m_Subdivision.GetNear(pos, q.maxRange);
+			// Get a quick list of entities that are potentially in range,
+			// from only the owners we're interested in
+			m_QueryCandidates.clear();
+			u32 ownersMask = q.ownersMask & m_SubdivisionsMask;
+			for (size_t i = 0; i < m_Subdivisions.size(); ++i)
+				if (ownersMask & (1u << i))
+					m_Subdivisions[i].GetNear(m_QueryCandidates, pos, q.maxRange);
+
+			size_t first = r.size();
 
-			for (size_t i = 0; i < ents.size(); ++i)
+			for (size_t i = 0; i < m_QueryCandidates.size(); ++i)
 			{
-				std::map<entity_id_t, EntityData>::const_iterator it = m_EntityData.find(ents[i]);
+				std::map<entity_id_t, EntityData>::const_iterator it = m_EntityData.find(m_QueryCandidates[i]);
 				ENSURE(it != m_EntityData.end());
 
 				if (!TestEntityQuery(q, it->first, it->second))
@@ -839,6 +1126,10 @@ public:
 
 				r.push_back(it->first);
 			}
+
+			// The subdivision doesn't return the entities in any particular order
+			// (and its order isn't serialized), so sort the matches by ID
+			std::sort(r.begin() + first, r.end());
 		}
 	}
 
@@ -964,6 +1255,9 @@ public:
 			it->second.flags |= flag;
 		else
 			it->second.flags &= ~flag;
+
+		if (it->second.inWorld)
+			MarkDivisionDirty(CFixedVector2D(it->second.x, it->second.z));
 	}
 
 	// ****************************************************************
@@ -972,16 +1266,166 @@ public:
 
 	virtual CLosQuerier GetLosQuerier(player_id_t player)
 	{
+		FlushPositionChanges();
+
 		if (GetLosRevealAll(player))
 			return CLosQuerier(0xFFFFFFFFu, m_LosStateRevealed, m_TerrainVerticesPerSide);
 		else
 			return CLosQuerier(GetSharedLosMask(player), m_LosState, m_TerrainVerticesPerSide);
 	}
 
+	virtual GridDirtyRegion GetLosDirtyRegion(player_id_t player)
+	{
+		FlushPositionChanges();
+
+		GridDirtyRegion region;
+		if (m_LosDirtyRegions.empty())
+			return region;
+
+		region.Add(m_LosDirtyRegions[0]);
+		m_LosDirtyRegions[0] = GridDirtyRegion();
+
+		std::map<player_id_t, u32>::const_iterator it = m_SharedLosMasks.find(player);
+		if (it == m_SharedLosMasks.end())
+			return region;
+
+		for (player_id_t p = 1; p <= MAX_LOS_PLAYER_ID; ++p)
+		{
+			if (it->second & (LOS_MASK << (2*(p-1))))
+			{
+				region.Add(m_LosDirtyRegions[p]);
+				m_LosDirtyRegions[p] = GridDirtyRegion();
+			}
+		}
+
+		return region;
+	}
+
+	virtual bool NeedVisibilityUpdate(size_t* dirtyID)
+	{
+		FlushPositionChanges();
+
+		if (*dirtyID != m_VisibilityDirtyID)
+		{
+			*dirtyID = m_VisibilityDirtyID;
+			return true;
+		}
+		return false;
+	}
+
+	static const u8 LOS_VISIBILITY_EXPLORED = 0x40;
+
 	virtual ELosVisibility GetLosVisibility(entity_id_t ent, player_id_t player, bool forceRetainInFog)
 	{
-		// (We can't use m_EntityData since this needs to handle LOCAL entities too)
+		FlushPositionChanges();
+
+		// LOCAL entities (and any others the range manager isn't tracking) have to be
+		// looked up through their components
+		std::map<entity_id_t, EntityData>::const_iterator it = m_EntityData.find(ent);
+		if (it == m_EntityData.end() || player < 0 || player > MAX_LOS_PLAYER_ID)
+			return ComputeLosVisibility(ent, player, forceRetainInFog);
+
+		LosVisibilityCache& cache = m_LosVisibilityCaches[player];
+		if (cache.dirty)
+		{
+			if (++cache.generation == 0)
+			{
+				// Old entries would look valid again after wrapping around, so clear them
+				LosVisibilityCache::Entry empty = { 0, 0 };
+				std::fill(cache.entries.begin(), cache.entries.end(), empty);
+				cache.generation = 1;
+			}
+
+			std::map<player_id_t, u32>::const_iterator mit = m_SharedLosMasks.find(player);
+			cache.losMask = (mit == m_SharedLosMasks.end() ? 0 : mit->second);
+			cache.dirty = false;
+		}
+
+		if (ent >= cache.entries.size())
+		{
+			LosVisibilityCache::Entry empty = { 0, 0 };
+			cache.entries.resize(ent + 1, empty);
+		}
+
+		LosVisibilityCache::Entry& entry = cache.entries[ent];
+		if (entry.generation != cache.generation)
+		{
+			entry.flags = ComputeLosVisibilityFlags(it->second, player);
+			entry.generation = cache.generation;
+		}
+
+		if (forceRetainInFog && (entry.flags & LOS_VISIBILITY_EXPLORED))
+			return VIS_FOGGED;
+		return (ELosVisibility)(entry.flags & ~LOS_VISIBILITY_EXPLORED);
+	}
+
+	/**
+	 * Invalidates the cached GetLosVisibility results of every player whose shared LOS
+	 * includes @p owner, after owner's LOS has changed.
+	 */
+	void MarkLosVisibilityDirty(player_id_t owner)
+	{
+		u32 mask = CalcPlayerLosMask(owner);
+		for (size_t i = 0; i < m_LosVisibilityCaches.size(); ++i)
+		{
+			if (m_LosVisibilityCaches[i].losMask & mask)
+				m_LosVisibilityCaches[i].dirty = true;
+		}
+	}
 
+	/**
+	 * Invalidates all the cached GetLosVisibility results.
+	 */
+	void MarkAllLosVisibilityDirty()
+	{
+		for (size_t i = 0; i < m_LosVisibilityCaches.size(); ++i)
+			m_LosVisibilityCaches[i].dirty = true;
+	}
+
+	/**
+	 * Invalidates the cached GetLosVisibility results for a single entity, after it has
+	 * moved or been destroyed.
+	 */
+	void InvalidateLosVisibility(entity_id_t ent)
+	{
+		for (size_t i = 0; i < m_LosVisibilityCaches.size(); ++i)
+		{
+			if (ent < m_LosVisibilityCaches[i].entries.size())
+				m_LosVisibilityCaches[i].entries[ent].generation = 0;
+		}
+	}
+
+	/**
+	 * Computes GetLosVisibility for an entity in m_EntityData (without forceRetainInFog),
+	 * in the form stored in LosVisibilityCache::Entry::flags.
+	 */
+	u8 ComputeLosVisibilityFlags(const EntityData& data, player_id_t player)
+	{
+		if (!data.inWorld)
+			return (u8)VIS_HIDDEN;
+
+		int i = (data.x / (int)TERRAIN_TILE_SIZE).ToInt_RoundToNearest();
+		int j = (data.z / (int)TERRAIN_TILE_SIZE).ToInt_RoundToNearest();
+
+		if (GetLosRevealAll(player))
+			return (u8)(LosIsOffWorld(i, j) ? VIS_HIDDEN : VIS_VISIBLE);
+
+		CLosQuerier los(GetSharedLosMask(player), m_LosState, m_TerrainVerticesPerSide);
+		if (los.IsVisible(i, j))
+			return (u8)VIS_VISIBLE;
+
+		if (los.IsExplored(i, j))
+			return (u8)(LOS_VISIBILITY_EXPLORED | (data.retainInFog ? VIS_FOGGED : VIS_HIDDEN));
+
+		return (u8)VIS_HIDDEN;
+	}
+
+	/**
+	 * Computes GetLosVisibility from the entity's components, for entities that aren't
+	 * in m_EntityData.
+	 */
+	ELosVisibility ComputeLosVisibility(entity_id_t ent, player_id_t player, bool forceRetainInFog)
+	{
 		// Entities not with positions in the world are never visible
 		CmpPtr<ICmpPosition> cmpPosition(GetSimContext(), ent);
 		if (!cmpPosition || !cmpPosition->IsInWorld())
@@ -1022,6 +1466,8 @@ public:
 	virtual void SetLosRevealAll(player_id_t player, bool enabled)
 	{
 		m_LosRevealAll[player] = enabled;
+		++m_VisibilityDirtyID;
+		MarkAllLosVisibilityDirty();
 	}
 
 	virtual bool GetLosRevealAll(player_id_t player)
@@ -1056,6 +1502,8 @@ public:
 	virtual void SetSharedLos(player_id_t player, std::vector<player_id_t> players)
 	{
 		m_SharedLosMasks[player] = CalcSharedLosMask(players);
+		++m_VisibilityDirtyID;
+		MarkAllLosVisibilityDirty();
 	}
 
 	virtual u32 GetSharedLosMask(player_id_t player)
@@ -1085,10 +1533,24 @@ public:
 				u8 p = grid.get(i, j) & ICmpTerritoryManager::TERRITORY_PLAYER_MASK;
 				if (p > 0 && p <= MAX_LOS_PLAYER_ID)
 				{
-					m_LosState[i + j*m_TerrainVerticesPerSide] |= (LOS_EXPLORED << (2*(p-1)));
-					m_LosState[i+1 + j*m_TerrainVerticesPerSide] |= (LOS_EXPLORED << (2*(p-1)));
-					m_LosState[i + (j+1)*m_TerrainVerticesPerSide] |= (LOS_EXPLORED << (2*(p-1)));
-					m_LosState[i+1 + (j+1)*m_TerrainVerticesPerSide] |= (LOS_EXPLORED << (2*(p-1)));
+					u32 explored = (LOS_EXPLORED << (2*(p-1)));
+					u32& s00 = m_LosState[i + j*m_TerrainVerticesPerSide];
+					u32& s10 = m_LosState[i+1 + j*m_TerrainVerticesPerSide];
+					u32& s01 = m_LosState[i + (j+1)*m_TerrainVerticesPerSide];
+					u32& s11 = m_LosState[i+1 + (j+1)*m_TerrainVerticesPerSide];
+
+					// Most tiles will already have been explored, so only mark the region as dirty if needed
+					if (!(s00 & s10 & s01 & s11 & explored))
+					{
+						s00 |= explored;
+						s10 |= explored;
+						s01 |= explored;
+						s11 |= explored;
+						m_LosDirtyRegions[p].Add(i, j);
+						m_LosDirtyRegions[p].Add((u16)(i+1), (u16)(j+1));
+						++m_VisibilityDirtyID;
+						MarkLosVisibilityDirty(p);
+					}
 				}
 			}
 		}
@@ -1125,6 +1587,58 @@ public:
 		}
 	}
 
+	/**
+	 * Called by LosIncrementCounts for each vertex in a strip whose count increases from zero.
+	 */
+	struct LosBecameVisible
+	{
+		CCmpRangeManager& cmp;
+		u32* losState;
+		i32 i0;
+		i32 j;
+		u32 bits;
+		bool changed;
+
+		LosBecameVisible(CCmpRangeManager& cmp, u8 owner, i32 i0, i32 j) :
+			cmp(cmp), losState(&cmp.m_LosState[j*cmp.m_TerrainVerticesPerSide + i0]), i0(i0), j(j),
+			bits((LOS_VISIBLE | LOS_EXPLORED) << (2*(owner-1))), changed(false)
+		{
+		}
+
+		void operator()(size_t k)
+		{
+			// Increasing from zero to non-zero - move from unexplored/explored to visible+explored
+			if (!cmp.LosIsOffWorld(i0 + (i32)k, j))
+			{
+				losState[k] |= bits;
+				changed = true;
+			}
+		}
+	};
+
+	/**
+	 * Called by LosDecrementCounts for each vertex in a strip whose count decreases to zero.
+	 */
+	struct LosBecameHidden
+	{
+		u32* losState;
+		u32 mask;
+		bool changed;
+
+		LosBecameHidden(u32* losState, u8 owner) :
+			losState(losState), mask(~(LOS_VISIBLE << (2*(owner-1)))), changed(false)
+		{
+		}
+
+		void operator()(size_t k)
+		{
+			// Decreasing from non-zero to zero - move from visible+explored to explored
+			// (If LosIsOffWorld then this is a no-op, so don't bother doing the check)
+			losState[k] &= mask;
+			changed = true;
+		}
+	};
+
 	/**
 	 * Update the LOS state of tiles within a given horizontal strip (i0,j) to (i1,j) (inclusive).
 	 */
@@ -1133,21 +1647,13 @@ public:
 		if (i1 < i0)
 			return;
 
-		i32 idx0 = j*m_TerrainVerticesPerSide + i0;
-		i32 idx1 = j*m_TerrainVerticesPerSide + i1;
+		LosBecameVisible becameVisible(*this, owner, i0, j);
+		LosIncrementCounts(&counts[j*m_TerrainVerticesPerSide + i0], i1 - i0 + 1, becameVisible);
 
-		for (i32 idx = idx0; idx <= idx1; ++idx)
+		if (becameVisible.changed)
 		{
-			// Increasing from zero to non-zero - move from unexplored/explored to visible+explored
-			if (counts[idx] == 0)
-			{
-				i32 i = i0 + idx - idx0;
-				if (!LosIsOffWorld(i, j))
-					m_LosState[idx] |= ((LOS_VISIBLE | LOS_EXPLORED) << (2*(owner-1)));
-			}
-
-			ASSERT(counts[idx] < 65535);
-			counts[idx] = (u16)(counts[idx] + 1); // ignore overflow; the player should never have 64K units
+			m_LosDirtyRegions[owner].Add((u16)i0, (u16)j);
+			m_LosDirtyRegions[owner].Add((u16)i1, (u16)j);
 		}
 	}
 
@@ -1160,19 +1666,13 @@ public:
 			return;
 
 		i32 idx0 = j*m_TerrainVerticesPerSide + i0;
-		i32 idx1 = j*m_TerrainVerticesPerSide + i1;
+		LosBecameHidden becameHidden(&m_LosState[idx0], owner);
+		LosDecrementCounts(&counts[idx0], i1 - i0 + 1, becameHidden);
 
-		for (i32 idx = idx0; idx <= idx1; ++idx)
+		if (becameHidden.changed)
 		{
-			ASSERT(counts[idx] > 0);
-			counts[idx] = (u16)(counts[idx] - 1);
-
-			// Decreasing from non-zero to zero - move from visible+explored to explored
-			if (counts[idx] == 0)
-			{
-				// (If LosIsOffWorld then this is a no-op, so don't bother doing the check)
-				m_LosState[idx] &= ~(LOS_VISIBLE << (2*(owner-1)));
-			}
+			m_LosDirtyRegions[owner].Add((u16)i0, (u16)j);
+			m_LosDirtyRegions[owner].Add((u16)i1, (u16)j);
 		}
 	}
 
@@ -1402,6 +1902,7 @@ public:
 			return;
 
 		LosUpdateHelper<true>((u8)owner, visionRange, pos);
+		MarkLosVisibilityDirty(owner);
 	}
 
 	void LosRemove(player_id_t owner, entity_pos_t visionRange, CFixedVector2D pos)
@@ -1410,6 +1911,7 @@ public:
 			return;
 
 		LosUpdateHelper<false>((u8)owner, visionRange, pos);
+		MarkLosVisibilityDirty(owner);
 	}
 
 	void LosMove(player_id_t owner, entity_pos_t visionRange, CFixedVector2D from, CFixedVector2D to)
@@ -1417,6 +1919,8 @@ public:
 		if (visionRange.IsZero() || owner <= 0 || owner > MAX_LOS_PLAYER_ID)
 			return;
 
+		MarkLosVisibilityDirty(owner);
+
 		if ((from - to).CompareLength(visionRange) > 0)
 		{
 			// If it's a very large move, then simply remove and add to the new position
@@ -1434,6 +1938,8 @@ public:
 
 	virtual i32 GetPercentMapExplored(player_id_t player)
 	{
+		FlushPositionChanges();
+
 		i32 exploredVertices = 0;
 		i32 overallVisibleVertices = 0;
 		CLosQuerier los(CalcPlayerLosMask(player), m_LosState, m_TerrainVerticesPerSide);
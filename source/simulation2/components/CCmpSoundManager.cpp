@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -25,20 +25,51 @@
 #include "simulation2/MessageTypes.h"
 #include "simulation2/components/ICmpPosition.h"
 #include "simulation2/components/ICmpRangeManager.h"
+#include "simulation2/components/ICmpTemplateManager.h"
+#include "soundmanager/SoundManager.h"
 #include "soundmanager/js/SoundGroup.h"
 
+#if CONFIG2_AUDIO
+// Number of AL sources to leave free for sounds that aren't played through
+// sound groups (e.g. GUI sounds), when deciding how many group sounds to play
+static const size_t RESERVED_SOURCES = 4;
+#endif // CONFIG2_AUDIO
+
 class CCmpSoundManager : public ICmpSoundManager
 {
 public:
 	static void ClassInit(CComponentManager& componentManager)
 	{
 		componentManager.SubscribeToMessageType(MT_Update);
+		componentManager.SubscribeToMessageType(MT_Interpolate);
+		componentManager.SubscribeGloballyToMessageType(MT_Create);
 	}
 
 	DEFAULT_COMPONENT_ALLOCATOR(SoundManager)
 
 #if CONFIG2_AUDIO
 	std::map<std::wstring, CSoundGroup*> m_SoundGroups;
+
+	// templates whose sound groups have been prefetched
+	std::set<std::string> m_PrefetchedTemplates;
+
+	// Sounds requested since the last frame, which compete for the free voices
+	// when they're played in MT_Interpolate (at most one per group)
+	struct PendingSound
+	{
+		CSoundGroup* group;
+		CVector3D position;
+		entity_id_t source;
+		float score;
+	};
+	struct PendingSoundCompare
+	{
+		bool operator()(const PendingSound& a, const PendingSound& b) const
+		{
+			return a.score > b.score;
+		}
+	};
+	std::vector<PendingSound> m_PendingSounds;
 #endif
 
 	static std::string GetSchema()
@@ -56,6 +87,8 @@ public:
 		for (std::map<std::wstring, CSoundGroup*>::iterator it = m_SoundGroups.begin(); it != m_SoundGroups.end(); ++it)
 			delete it->second;
 		m_SoundGroups.clear();
+		m_PrefetchedTemplates.clear();
+		m_PendingSounds.clear();
 #endif // CONFIG2_AUDIO
 	}
 
@@ -90,30 +123,111 @@ public:
 #endif // !CONFIG2_AUDIO
 			break;
 		}
+		case MT_Interpolate:
+		{
+#if CONFIG2_AUDIO
+			PlayPendingSounds();
+#endif // CONFIG2_AUDIO
+			break;
+		}
+		case MT_Create:
+		{
+#if CONFIG2_AUDIO
+			const CMessageCreate& msgData = static_cast<const CMessageCreate&> (msg);
+			PrefetchTemplateSounds(msgData.entity);
+#endif // CONFIG2_AUDIO
+			break;
+		}
 		}
 	}
 
-	virtual void PlaySoundGroup(std::wstring name, entity_id_t source)
-	{
 #if CONFIG2_AUDIO
-		// Make sure the sound group is loaded
-		CSoundGroup* group;
-		if (m_SoundGroups.find(name) == m_SoundGroups.end())
+	/**
+	 * Returns the named sound group, loading it if necessary, or NULL if it failed to load.
+	 */
+	CSoundGroup* GetSoundGroup(const std::wstring& name)
+	{
+		std::map<std::wstring, CSoundGroup*>::iterator it = m_SoundGroups.find(name);
+		if (it != m_SoundGroups.end())
+			return it->second;
+
+		CSoundGroup* group = new CSoundGroup();
+		if (!group->LoadSoundGroup(L"audio/" + name))
 		{
-			group = new CSoundGroup();
-			if (!group->LoadSoundGroup(L"audio/" + name))
-			{
-				LOGERROR(L"Failed to load sound group '%ls'", name.c_str());
-				delete group;
-				group = NULL;
-			}
-			// Cache the sound group (or the null, if it failed)
-			m_SoundGroups[name] = group;
+			LOGERROR(L"Failed to load sound group '%ls'", name.c_str());
+			delete group;
+			group = NULL;
 		}
-		else
+		// Cache the sound group (or the null, if it failed)
+		m_SoundGroups[name] = group;
+		return group;
+	}
+
+	/**
+	 * Play the most important of the sounds requested since the last frame, as far
+	 * as there are voices for them, and drop the rest (rather than running out of
+	 * AL sources in big battles).
+	 */
+	void PlayPendingSounds()
+	{
+		if (m_PendingSounds.empty())
+			return;
+
+		size_t voices = 0;
+		if (g_SoundManager)
+		{
+			size_t freeSources = g_SoundManager->GetFreeSourceCount();
+			voices = freeSources > RESERVED_SOURCES ? freeSources - RESERVED_SOURCES : 0;
+		}
+
+		std::sort(m_PendingSounds.begin(), m_PendingSounds.end(), PendingSoundCompare());
+		for (size_t i = 0; i < std::min(voices, m_PendingSounds.size()); ++i)
+			m_PendingSounds[i].group->PlayNext(m_PendingSounds[i].position, m_PendingSounds[i].source);
+
+		m_PendingSounds.clear();
+	}
+
+	/**
+	 * Start decoding the sounds an entity's template might play, the first time
+	 * an entity of that template is created, so they're ready when it first does.
+	 */
+	void PrefetchTemplateSounds(entity_id_t ent)
+	{
+		if (!g_SoundManager)
+			return;
+
+		CmpPtr<ICmpTemplateManager> cmpTemplateManager(GetSimContext(), SYSTEM_ENTITY);
+		if (!cmpTemplateManager)
+			return;
+
+		if (!m_PrefetchedTemplates.insert(cmpTemplateManager->GetCurrentTemplateName(ent)).second)
+			return;
+
+		const CParamNode* tmpl = cmpTemplateManager->LoadLatestTemplate(ent);
+		if (!tmpl)
+			return;
+
+		const CParamNode::ChildrenMap& groups = tmpl->GetChild("Sound").GetChild("SoundGroups").GetChildren();
+		for (CParamNode::ChildrenMap::const_iterator it = groups.begin(); it != groups.end(); ++it)
 		{
-			group = m_SoundGroups[name];
+			// Names with substitutions (e.g. "{lang}") are only resolved by the Sound component
+			// when played, so we can't tell which group they'll be
+			const std::wstring& name = it->second.ToString();
+			if (name.empty() || name.find(L'{') != std::wstring::npos)
+				continue;
+
+			CSoundGroup* group = GetSoundGroup(name);
+			if (group)
+				group->Prefetch();
 		}
+	}
+#endif // CONFIG2_AUDIO
+
+	virtual void PlaySoundGroup(std::wstring name, entity_id_t source)
+	{
+#if CONFIG2_AUDIO
+		// Make sure the sound group is loaded
+		CSoundGroup* group = GetSoundGroup(name);
 
 		// Failed to load group -> do nothing
 		if (!group)
@@ -135,7 +249,33 @@ public:
 					sourcePos = CVector3D(cmpPosition->GetPosition());
 			}
 
-			group->PlayNext(sourcePos, source);
+			// Cull sounds that wouldn't be heard before they're decoded or take a voice
+			float score;
+			if (!group->IsAudible(sourcePos, score))
+				return;
+
+			// Merge with any sound already requested from this group this frame,
+			// keeping whichever is more important
+			for (size_t i = 0; i < m_PendingSounds.size(); ++i)
+			{
+				if (m_PendingSounds[i].group == group)
+				{
+					if (score > m_PendingSounds[i].score)
+					{
+						m_PendingSounds[i].position = sourcePos;
+						m_PendingSounds[i].source = source;
+						m_PendingSounds[i].score = score;
+					}
+					return;
+				}
+			}
+
+			// Merge with recent sounds from this group too, once it gets too intense
+			if (!group->IncrementIntensity())
+				return;
+
+			PendingSound pending = { group, sourcePos, source, score };
+			m_PendingSounds.push_back(pending);
 		}
 #else // !CONFIG2_AUDIO
 		UNUSED2(name);
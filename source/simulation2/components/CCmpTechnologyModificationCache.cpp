@@ -0,0 +1,169 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "simulation2/system/Component.h"
+#include "ICmpTechnologyModificationCache.h"
+
+#include "simulation2/MessageTypes.h"
+#include "simulation2/components/ICmpOwnership.h"
+#include "simulation2/components/ICmpPlayerManager.h"
+#include "simulation2/components/ICmpTechnologyManager.h"
+#include "simulation2/components/ICmpTemplateManager.h"
+
+class CCmpTechnologyModificationCache : public ICmpTechnologyModificationCache
+{
+public:
+	static void ClassInit(CComponentManager& componentManager)
+	{
+		componentManager.SubscribeGloballyToMessageType(MT_TechnologyModification);
+	}
+
+	DEFAULT_COMPONENT_ALLOCATOR(TechnologyModificationCache)
+
+	template<typename T>
+	struct Key
+	{
+		player_id_t player;
+		std::wstring valueName;
+		std::string templateName;
+		T currentValue;
+
+		bool operator<(const Key& b) const
+		{
+			if (player != b.player)
+				return player < b.player;
+			if (currentValue != b.currentValue)
+				return currentValue < b.currentValue;
+			if (valueName != b.valueName)
+				return valueName < b.valueName;
+			return templateName < b.templateName;
+		}
+	};
+
+	std::map<Key<fixed>, fixed> m_FixedValues;
+	std::map<Key<u32>, u32> m_U32Values;
+	std::map<Key<double>, double> m_DoubleValues;
+
+	static std::string GetSchema()
+	{
+		return "<a:component type='system'/><empty/>";
+	}
+
+	virtual void Init(const CParamNode& UNUSED(paramNode))
+	{
+	}
+
+	virtual void Deinit()
+	{
+	}
+
+	virtual void Serialize(ISerializer& UNUSED(serialize))
+	{
+		// The cache can always be recomputed, so don't serialize anything
+	}
+
+	virtual void Deserialize(const CParamNode& paramNode, IDeserializer& UNUSED(deserialize))
+	{
+		Init(paramNode);
+	}
+
+	virtual void HandleMessage(const CMessage& msg, bool UNUSED(global))
+	{
+		switch (msg.GetType())
+		{
+		case MT_TechnologyModification:
+		{
+			const CMessageTechnologyModification& msgData = static_cast<const CMessageTechnologyModification&> (msg);
+			Invalidate(m_FixedValues, msgData.player);
+			Invalidate(m_U32Values, msgData.player);
+			Invalidate(m_DoubleValues, msgData.player);
+			break;
+		}
+		}
+	}
+
+	virtual fixed ApplyModifications(std::wstring valueName, fixed currentValue, entity_id_t entity)
+	{
+		return Apply(m_FixedValues, valueName, currentValue, entity);
+	}
+
+	virtual u32 ApplyModifications(std::wstring valueName, u32 currentValue, entity_id_t entity)
+	{
+		return Apply(m_U32Values, valueName, currentValue, entity);
+	}
+
+	virtual double ApplyModifications(std::wstring valueName, double currentValue, entity_id_t entity)
+	{
+		return Apply(m_DoubleValues, valueName, currentValue, entity);
+	}
+
+private:
+	template<typename T>
+	T Apply(std::map<Key<T>, T>& cache, const std::wstring& valueName, T currentValue, entity_id_t entity)
+	{
+		CmpPtr<ICmpOwnership> cmpOwnership(GetSimContext(), entity);
+		if (!cmpOwnership || cmpOwnership->GetOwner() == INVALID_PLAYER)
+			return currentValue;
+		player_id_t owner = cmpOwnership->GetOwner();
+
+		CmpPtr<ICmpPlayerManager> cmpPlayerManager(GetSimContext(), SYSTEM_ENTITY);
+		if (!cmpPlayerManager)
+			return currentValue;
+		entity_id_t playerEnt = cmpPlayerManager->GetPlayerByID(owner);
+		if (playerEnt == INVALID_ENTITY)
+			return currentValue;
+
+		CmpPtr<ICmpTechnologyManager> cmpTechnologyManager(GetSimContext(), playerEnt);
+		if (!cmpTechnologyManager)
+			return currentValue;
+
+		// Entities with the same template have the same classes, so they get the same modifications
+		std::string templateName;
+		CmpPtr<ICmpTemplateManager> cmpTemplateManager(GetSimContext(), SYSTEM_ENTITY);
+		if (cmpTemplateManager)
+			templateName = cmpTemplateManager->GetCurrentTemplateName(entity);
+
+		// Entities that weren't created from a template can't share results
+		if (templateName.empty())
+			return cmpTechnologyManager->ApplyModifications(valueName, currentValue, entity);
+
+		Key<T> key = { owner, valueName, templateName, currentValue };
+		typename std::map<Key<T>, T>::iterator it = cache.find(key);
+		if (it != cache.end())
+			return it->second;
+
+		T value = cmpTechnologyManager->ApplyModifications(valueName, currentValue, entity);
+		cache.insert(std::make_pair(key, value));
+		return value;
+	}
+
+	template<typename T>
+	static void Invalidate(std::map<Key<T>, T>& cache, player_id_t player)
+	{
+		for (typename std::map<Key<T>, T>::iterator it = cache.begin(); it != cache.end(); )
+		{
+			if (it->first.player == player)
+				cache.erase(it++);
+			else
+				++it;
+		}
+	}
+};
+
+REGISTER_COMPONENT_TYPE(TechnologyModificationCache)
@@ -22,6 +22,7 @@
 
 #include "simulation2/MessageTypes.h"
 
+#include "graphics/UnitManager.h"
 #include "lib/utf8.h"
 #include "ps/CLogger.h"
 #include "ps/Filesystem.h"
@@ -37,6 +38,7 @@ public:
 	static void ClassInit(CComponentManager& componentManager)
 	{
 		componentManager.SubscribeGloballyToMessageType(MT_Destroy);
+		componentManager.SubscribeToMessageType(MT_ProgressiveLoad);
 	}
 
 	DEFAULT_COMPONENT_ALLOCATOR(TemplateManager)
@@ -49,6 +51,7 @@ public:
 	virtual void Init(const CParamNode& UNUSED(paramNode))
 	{
 		m_DisableValidation = false;
+		m_PreloadTemplatesIdx = 0;
 
 		m_Validator.LoadGrammar(GetSimContext().GetComponentManager().GenerateSchema());
 		// TODO: handle errors loading the grammar here?
@@ -113,6 +116,19 @@ public:
 
 			break;
 		}
+		case MT_ProgressiveLoad:
+		{
+			const CMessageProgressiveLoad& msgData = static_cast<const CMessageProgressiveLoad&> (msg);
+
+			*msgData.total += (int)m_PreloadTemplates.size();
+
+			if (!*msgData.progressed && ContinuePreloadTemplates())
+				*msgData.progressed = true;
+
+			*msgData.progress += (int)m_PreloadTemplatesIdx;
+
+			break;
+		}
 		}
 	}
 
@@ -158,6 +174,23 @@ private:
 	// TODO: should store player ID etc.
 	std::map<entity_id_t, std::string> m_LatestTemplates;
 
+	// Templates referenced by the loaded templates (e.g. units that can be trained by
+	// a building), which are loaded during MT_ProgressiveLoad so they won't have to be
+	// parsed and validated in the middle of the game when they're first used.
+	// (Not serialized; it's purely an optimisation)
+	std::vector<std::string> m_PreloadTemplates;
+	size_t m_PreloadTemplatesIdx;
+
+	// Names of templates that have been queued for preloading, or whose references
+	// have already been queued
+	std::set<std::string> m_PreloadQueued;
+
+	// Adds the templates referenced by the given template to m_PreloadTemplates
+	void QueueReferencedTemplates(const CParamNode& templateRoot);
+
+	// Loads the next template in m_PreloadTemplates. Returns true if we did some work.
+	bool ContinuePreloadTemplates();
+
 	// (Re)loads the given template, regardless of whether it exists already,
 	// and saves into m_TemplateFileData. Also loads any parents that are not yet
 	// loaded. Returns false on error.
@@ -194,11 +227,74 @@ const CParamNode* CCmpTemplateManager::LoadTemplate(entity_id_t ent, const std::
 	if (!templateRoot)
 		return NULL;
 
+	if (m_PreloadQueued.insert(templateName).second)
+		QueueReferencedTemplates(*templateRoot);
+
 	// TODO: Eventually we need to support techs in here, and return a different template per playerID
 
 	return templateRoot;
 }
 
+void CCmpTemplateManager::QueueReferencedTemplates(const CParamNode& templateRoot)
+{
+	// Entity lists can refer to the owner's civ, which will usually be the civ of
+	// the template (if we guess wrong, the nonexistent names are just skipped)
+	std::string civ = utf8_from_wstring(templateRoot.GetChild("Identity").GetChild("Civ").ToString());
+
+	const char* lists[][2] = {
+		{ "ProductionQueue", "Entities" },
+		{ "Builder", "Entities" }
+	};
+
+	for (size_t i = 0; i < ARRAY_SIZE(lists); ++i)
+	{
+		std::wstringstream tokens(templateRoot.GetChild(lists[i][0]).GetChild(lists[i][1]).ToString());
+		std::wstring token;
+		while (tokens >> token)
+		{
+			std::string name = utf8_from_wstring(token);
+			for (size_t pos = name.find("{civ}"); pos != name.npos; pos = name.find("{civ}", pos))
+				name.replace(pos, 5, civ);
+
+			if (name.find('|') != name.npos || !VfsFileExists(VfsPath(TEMPLATE_ROOT) / wstring_from_utf8(name + ".xml")))
+				continue;
+
+			if (m_PreloadQueued.insert(name).second)
+				m_PreloadTemplates.push_back(name);
+
+			// Buildings are placed as foundations first
+			if (i == 1 && m_PreloadQueued.insert("foundation|" + name).second)
+				m_PreloadTemplates.push_back("foundation|" + name);
+		}
+	}
+}
+
+bool CCmpTemplateManager::ContinuePreloadTemplates()
+{
+	if (m_PreloadTemplatesIdx >= m_PreloadTemplates.size())
+		return false;
+
+	// (Copy the name since QueueReferencedTemplates might reallocate the vector)
+	std::string templateName = m_PreloadTemplates[m_PreloadTemplatesIdx++];
+
+	const CParamNode* templateRoot = GetTemplate(templateName);
+	if (!templateRoot)
+		return true;
+
+	QueueReferencedTemplates(*templateRoot);
+
+	// These entities are likely to be created later in the game (when trained
+	// or built), so start loading their graphics now to avoid a stall then
+	if (GetSimContext().HasUnitManager())
+	{
+		std::wstring actorName = templateRoot->GetChild("VisualActor").GetChild("Actor").ToString();
+		if (!actorName.empty())
+			GetSimContext().GetUnitManager().PrefetchActor(actorName);
+	}
+
+	return true;
+}
+
 const CParamNode* CCmpTemplateManager::GetTemplate(std::string templateName)
 {
 	// Load the template if necessary
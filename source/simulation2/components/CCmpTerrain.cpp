@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -37,6 +37,8 @@ public:
 
 	CTerrain* m_Terrain; // not null
 
+	size_t m_DirtyID; // incremented by MakeDirty
+
 	static std::string GetSchema()
 	{
 		return "<a:component type='system'/><empty/>";
@@ -45,6 +47,7 @@ public:
 	virtual void Init(const CParamNode& UNUSED(paramNode))
 	{
 		m_Terrain = &GetSimContext().GetTerrain();
+		m_DirtyID = 1;
 	}
 
 	virtual void Deinit()
@@ -84,6 +87,16 @@ public:
 		return m_Terrain->GetExactGroundLevel(x, z);
 	}
 
+	virtual void GetGroundLevels(size_t count, const entity_pos_t* x, const entity_pos_t* z, entity_pos_t* heights)
+	{
+		m_Terrain->GetExactGroundLevelsFixed(count, x, z, heights);
+	}
+
+	virtual void GetExactGroundLevels(size_t count, const float* x, const float* z, float* heights)
+	{
+		m_Terrain->GetExactGroundLevels(count, x, z, heights);
+	}
+
 	virtual u16 GetTilesPerSide()
 	{
 		ssize_t tiles = m_Terrain->GetTilesPerSide();
@@ -132,9 +145,21 @@ public:
 
 	virtual void MakeDirty(i32 i0, i32 j0, i32 i1, i32 j1)
 	{
+		++m_DirtyID;
+
 		CMessageTerrainChanged msg(i0, j0, i1, j1);
 		GetSimContext().GetComponentManager().PostMessage(GetEntityId(), msg);
 	}
+
+	virtual bool NeedUpdate(size_t* dirtyID)
+	{
+		if (*dirtyID != m_DirtyID)
+		{
+			*dirtyID = m_DirtyID;
+			return true;
+		}
+		return false;
+	}
 };
 
 REGISTER_COMPONENT_TYPE(Terrain)
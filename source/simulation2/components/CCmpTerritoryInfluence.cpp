@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,9 +20,7 @@
 #include "simulation2/system/Component.h"
 #include "ICmpTerritoryInfluence.h"
 
-#include "simulation2/components/ICmpOwnership.h"
-#include "simulation2/components/ICmpPlayerManager.h"
-#include "simulation2/components/ICmpTechnologyManager.h"
+#include "simulation2/components/ICmpTechnologyModificationCache.h"
 
 class CCmpTerritoryInfluence : public ICmpTerritoryInfluence
 {
@@ -101,23 +99,13 @@ public:
 
 	virtual u32 GetRadius()
 	{
-		u32 newRadius = m_Radius;
-
-		CmpPtr<ICmpOwnership> cmpOwnership(GetSimContext(), GetEntityId());
-		if (cmpOwnership && cmpOwnership->GetOwner() != INVALID_PLAYER)
-		{
-			CmpPtr<ICmpPlayerManager> cmpPlayerManager(GetSimContext(), SYSTEM_ENTITY);
-			entity_id_t playerEnt = cmpPlayerManager->GetPlayerByID(cmpOwnership->GetOwner());
-
-			if (playerEnt != INVALID_ENTITY)
-			{
-				CmpPtr<ICmpTechnologyManager> cmpTechnologyManager(GetSimContext(), playerEnt);
-				if (cmpTechnologyManager)
-					newRadius = cmpTechnologyManager->ApplyModifications(L"TerritoryInfluence/Radius", m_Radius, GetEntityId());
-			}
-		}
-
-		return newRadius;
+		// This is called for every influence entity whenever the territories are recomputed,
+		// so use the cache rather than calling each owner's technology manager script
+		CmpPtr<ICmpTechnologyModificationCache> cmpModificationCache(GetSimContext(), SYSTEM_ENTITY);
+		if (!cmpModificationCache)
+			return m_Radius;
+
+		return cmpModificationCache->ApplyModifications(L"TerritoryInfluence/Radius", m_Radius, GetEntityId());
 	}
 };
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -27,6 +27,7 @@
 #include "maths/MathUtil.h"
 #include "maths/Vector2D.h"
 #include "ps/Overlay.h"
+#include "ps/ThreadPool.h"
 #include "renderer/Renderer.h"
 #include "renderer/Scene.h"
 #include "renderer/TerrainOverlay.h"
@@ -46,6 +47,8 @@
 #include "simulation2/helpers/PriorityQueue.h"
 #include "simulation2/helpers/Render.h"
 
+#include <deque>
+
 class CCmpTerritoryManager;
 
 class TerritoryOverlay : public TerrainOverlay
@@ -89,12 +92,34 @@ public:
 	// processed flag in bit 7 (TERRITORY_PROCESSED_MASK)
 	Grid<u8>* m_Territories;
 
+	// The territories from before the last MakeDirty, compared with the new ones
+	// to find the tiles that changed (not serialized)
+	Grid<u8>* m_PreviousTerritories;
+
+	struct SChangedTiles
+	{
+		size_t dirtyID; // m_DirtyID when the territories were calculated
+		u16 i0, j0, i1, j1;
+	};
+
+	// The tiles changed by each of the most recent calculations, oldest first.
+	// Every calculation after m_ChangedTilesStartID is included (not serialized)
+	std::deque<SChangedTiles> m_ChangedTiles;
+	size_t m_ChangedTilesStartID;
+
+	static const size_t MAX_CHANGED_TILES_HISTORY = 16;
+
+	// Per-entity influence grids, kept between calls to CalculateTerritories
+	// to avoid reallocating them every time (not serialized)
+	std::vector<Grid<u32> > m_InfluenceGridPool;
+
 	// Set to true when territories change; will send a TerritoriesChanged message
 	// during the Update phase
 	bool m_TriggerEvent;
 
 	struct SBoundaryLine
 	{
+		u32 id; // STerritoryBoundary::id of the boundary it was made from
 		bool connected;
 		CColor color;
 		SOverlayTexturedLine overlay;
@@ -103,6 +128,12 @@ public:
 	std::vector<SBoundaryLine> m_BoundaryLines;
 	bool m_BoundaryLinesDirty;
 
+	// The boundaries m_BoundaryLines were made from, and the territories they were
+	// computed from, so that unchanged boundaries can be kept when the territories change
+	std::vector<STerritoryBoundary> m_Boundaries;
+	Grid<u8> m_BoundaryTerritories;
+	u32 m_NextBoundaryID;
+
 	double m_AnimTime; // time since start of rendering, in seconds
 
 	TerritoryOverlay* m_DebugOverlay;
@@ -113,12 +144,16 @@ public:
 	virtual void Init(const CParamNode& UNUSED(paramNode))
 	{
 		m_Territories = NULL;
+		m_PreviousTerritories = NULL;
 		m_DebugOverlay = NULL;
 //		m_DebugOverlay = new TerritoryOverlay(*this);
 		m_BoundaryLinesDirty = true;
+		m_NextBoundaryID = 0;
 		m_TriggerEvent = true;
 		m_EnableLineDebugOverlays = false;
 		m_DirtyID = 1;
+		m_ChangedTiles.clear();
+		m_ChangedTilesStartID = m_DirtyID;
 
 		m_AnimTime = 0.0;
 
@@ -135,6 +170,7 @@ public:
 	virtual void Deinit()
 	{
 		SAFE_DELETE(m_Territories);
+		SAFE_DELETE(m_PreviousTerritories);
 		SAFE_DELETE(m_DebugOverlay);
 	}
 
@@ -233,7 +269,13 @@ public:
 
 	void MakeDirty()
 	{
-		SAFE_DELETE(m_Territories);
+		// Keep the old territories until the next calculation, to see what changed
+		if (m_Territories)
+		{
+			delete m_PreviousTerritories;
+			m_PreviousTerritories = m_Territories;
+			m_Territories = NULL;
+		}
 		++m_DirtyID;
 		m_BoundaryLinesDirty = true;
 		m_TriggerEvent = true;
@@ -249,8 +291,16 @@ public:
 		return false;
 	}
 
+	virtual bool GetChangedTiles(size_t dirtyID, u16& i0, u16& j0, u16& i1, u16& j1);
+
 	void CalculateTerritories();
 
+	/**
+	 * Adds the tiles that differ between m_PreviousTerritories and the newly
+	 * calculated m_Territories to m_ChangedTiles.
+	 */
+	void RecordChangedTiles();
+
 	/**
 	 * Updates @p grid based on the obstruction shapes of all entities with
 	 * a TerritoryInfluence component. Grid cells are 0 if no influence,
@@ -258,8 +308,6 @@ public:
 	 */
 	void RasteriseInfluences(CComponentManager::InterfaceList& infls, Grid<u8>& grid);
 
-	std::vector<STerritoryBoundary> ComputeBoundaries();
-
 	void UpdateBoundaryLines();
 
 	void Interpolate(float frameTime, float frameOffset);
@@ -277,12 +325,12 @@ of extending to each neighbour (based on radius-determining 'falloff' value,
 adjusted by terrain movement cost), and repeating until all tiles are processed.
 */
 
-typedef PriorityQueueHeap<std::pair<u16, u16>, u32, std::greater<u32> > OpenQueue;
+typedef PriorityQueueIndexedHeap<std::pair<u16, u16>, u32, TileIDIndexer, std::greater<u32> > OpenQueue;
 
 static void ProcessNeighbour(u32 falloff, u16 i, u16 j, u32 pg, bool diagonal,
-		Grid<u32>& grid, OpenQueue& queue, const Grid<u8>& costGrid)
+		Grid<u32>& grid, OpenQueue& queue, const Grid<u8>& costGrid, u16 i0, u16 j0)
 {
-	u32 dg = falloff * costGrid.get(i, j);
+	u32 dg = falloff * costGrid.get(i0 + i, j0 + j);
 	if (diagonal)
 		dg = (dg * 362) / 256;
 
@@ -294,11 +342,22 @@ static void ProcessNeighbour(u32 falloff, u16 i, u16 j, u32 pg, bool diagonal,
 	u32 g = pg - dg; // cost to this tile = cost to predecessor - falloff from predecessor
 
 	grid.set(i, j, g);
-	OpenQueue::Item tile = { std::make_pair(i, j), g };
-	queue.push(tile);
+	if (queue.find(std::make_pair(i, j)))
+	{
+		queue.promote(std::make_pair(i, j), g);
+	}
+	else
+	{
+		OpenQueue::Item tile = { std::make_pair(i, j), g };
+		queue.push(tile);
+	}
 }
 
-static void FloodFill(Grid<u32>& grid, Grid<u8>& costGrid, OpenQueue& openTiles, u32 falloff)
+/**
+ * Expands the influence in @p grid outwards from @p openTiles.
+ * @p grid covers the tiles of @p costGrid starting at (i0, j0).
+ */
+static void FloodFill(Grid<u32>& grid, const Grid<u8>& costGrid, u16 i0, u16 j0, OpenQueue& openTiles, u32 falloff)
 {
 	u16 tilesW = grid.m_W;
 	u16 tilesH = grid.m_H;
@@ -311,21 +370,68 @@ static void FloodFill(Grid<u32>& grid, Grid<u8>& costGrid, OpenQueue& openTiles,
 		u16 x = tile.id.first;
 		u16 z = tile.id.second;
 		if (x > 0)
-			ProcessNeighbour(falloff, (u16)(x-1), z, tile.rank, false, grid, openTiles, costGrid);
+			ProcessNeighbour(falloff, (u16)(x-1), z, tile.rank, false, grid, openTiles, costGrid, i0, j0);
 		if (x < tilesW-1)
-			ProcessNeighbour(falloff, (u16)(x+1), z, tile.rank, false, grid, openTiles, costGrid);
+			ProcessNeighbour(falloff, (u16)(x+1), z, tile.rank, false, grid, openTiles, costGrid, i0, j0);
 		if (z > 0)
-			ProcessNeighbour(falloff, x, (u16)(z-1), tile.rank, false, grid, openTiles, costGrid);
+			ProcessNeighbour(falloff, x, (u16)(z-1), tile.rank, false, grid, openTiles, costGrid, i0, j0);
 		if (z < tilesH-1)
-			ProcessNeighbour(falloff, x, (u16)(z+1), tile.rank, false, grid, openTiles, costGrid);
+			ProcessNeighbour(falloff, x, (u16)(z+1), tile.rank, false, grid, openTiles, costGrid, i0, j0);
 		if (x > 0 && z > 0)
-			ProcessNeighbour(falloff, (u16)(x-1), (u16)(z-1), tile.rank, true, grid, openTiles, costGrid);
+			ProcessNeighbour(falloff, (u16)(x-1), (u16)(z-1), tile.rank, true, grid, openTiles, costGrid, i0, j0);
 		if (x > 0 && z < tilesH-1)
-			ProcessNeighbour(falloff, (u16)(x-1), (u16)(z+1), tile.rank, true, grid, openTiles, costGrid);
+			ProcessNeighbour(falloff, (u16)(x-1), (u16)(z+1), tile.rank, true, grid, openTiles, costGrid, i0, j0);
 		if (x < tilesW-1 && z > 0)
-			ProcessNeighbour(falloff, (u16)(x+1), (u16)(z-1), tile.rank, true, grid, openTiles, costGrid);
+			ProcessNeighbour(falloff, (u16)(x+1), (u16)(z-1), tile.rank, true, grid, openTiles, costGrid, i0, j0);
 		if (x < tilesW-1 && z < tilesH-1)
-			ProcessNeighbour(falloff, (u16)(x+1), (u16)(z+1), tile.rank, true, grid, openTiles, costGrid);
+			ProcessNeighbour(falloff, (u16)(x+1), (u16)(z+1), tile.rank, true, grid, openTiles, costGrid, i0, j0);
+	}
+}
+
+/**
+ * Influence of a single entity, computed by InfluenceCallback.
+ */
+struct InfluenceSource
+{
+	size_t player; // index of the owner's grid
+	u16 i, j; // tile under the entity
+	u32 weight;
+	u32 falloff;
+
+	// The influence on the tiles near the entity, starting at tile (i0, j0).
+	// Influence decreases by at least the falloff on every step, so it can't reach more
+	// than (weight-1)/falloff tiles away, and computing just that part of the map
+	// gives exactly the same result as computing the whole map
+	u16 i0, j0;
+	Grid<u32>* grid;
+};
+
+struct InfluenceJob
+{
+	const Grid<u8>* costGrid;
+	std::vector<InfluenceSource>* sources;
+};
+
+static void InfluenceCallback(void* cbdata, size_t begin, size_t end)
+{
+	InfluenceJob* job = static_cast<InfluenceJob*>(cbdata);
+	for (size_t n = begin; n < end; ++n)
+	{
+		InfluenceSource& source = (*job->sources)[n];
+		Grid<u32>& grid = *source.grid;
+		grid.reset();
+
+		// Initialise the tile under the entity
+		u16 i = (u16)(source.i - source.i0);
+		u16 j = (u16)(source.j - source.j0);
+		grid.set(i, j, source.weight);
+		OpenQueue openTiles;
+		openTiles.reset((size_t)grid.m_W * grid.m_H, TileIDIndexer(grid.m_W));
+		OpenQueue::Item tile = { std::make_pair(i, j), source.weight };
+		openTiles.push(tile);
+
+		// Expand influences outwards
+		FloodFill(grid, *job->costGrid, source.i0, source.j0, openTiles, source.falloff);
 	}
 }
 
@@ -417,46 +523,68 @@ void CCmpTerritoryManager::CalculateTerritories()
 	// TODO: this is a large waste of memory; we don't really need to store
 	// all the intermediate grids
 
+	std::vector<InfluenceSource> sources;
 	for (std::map<player_id_t, std::vector<entity_id_t> >::iterator it = influenceEntities.begin(); it != influenceEntities.end(); ++it)
 	{
-		Grid<u32> playerGrid(tilesW, tilesH);
+		playerGrids.push_back(std::make_pair(it->first, Grid<u32>(tilesW, tilesH)));
 
 		std::vector<entity_id_t>& ents = it->second;
 		for (std::vector<entity_id_t>::iterator eit = ents.begin(); eit != ents.end(); ++eit)
 		{
-			// Compute the influence map of the current entity, then add it to the player grid
-
-			Grid<u32> entityGrid(tilesW, tilesH);
+			InfluenceSource source;
+			source.player = playerGrids.size() - 1;
 
 			CmpPtr<ICmpPosition> cmpPosition(GetSimContext(), *eit);
 			CFixedVector2D pos = cmpPosition->GetPosition2D();
-			u16 i = (u16)clamp((pos.X / (int)TERRAIN_TILE_SIZE).ToInt_RoundToNegInfinity(), 0, tilesW-1);
-			u16 j = (u16)clamp((pos.Y / (int)TERRAIN_TILE_SIZE).ToInt_RoundToNegInfinity(), 0, tilesH-1);
+			source.i = (u16)clamp((pos.X / (int)TERRAIN_TILE_SIZE).ToInt_RoundToNegInfinity(), 0, tilesW-1);
+			source.j = (u16)clamp((pos.Y / (int)TERRAIN_TILE_SIZE).ToInt_RoundToNegInfinity(), 0, tilesH-1);
 
 			CmpPtr<ICmpTerritoryInfluence> cmpTerritoryInfluence(GetSimContext(), *eit);
-			u32 weight = cmpTerritoryInfluence->GetWeight();
+			source.weight = cmpTerritoryInfluence->GetWeight();
 			u32 radius = cmpTerritoryInfluence->GetRadius() / TERRAIN_TILE_SIZE;
-			u32 falloff = weight / radius; // earlier check for GetRadius() == 0 prevents divide-by-zero
+			source.falloff = source.weight / radius; // earlier check for GetRadius() == 0 prevents divide-by-zero
 
 			// TODO: we should have some maximum value on weight, to avoid overflow
 			// when doing all the sums
 
-			// Initialise the tile under the entity
-			entityGrid.set(i, j, weight);
-			OpenQueue openTiles;
-			OpenQueue::Item tile = { std::make_pair((u16)i, (i16)j), weight };
-			openTiles.push(tile);
+			// (With no falloff the influence can cover the whole map)
+			u32 reach = source.falloff ? (source.weight - 1) / source.falloff : std::max(tilesW, tilesH);
+			source.i0 = (u16)std::max((int)source.i - (int)std::min(reach, (u32)tilesW), 0);
+			source.j0 = (u16)std::max((int)source.j - (int)std::min(reach, (u32)tilesH), 0);
+			u16 i1 = (u16)std::min((u32)source.i + reach, (u32)tilesW - 1);
+			u16 j1 = (u16)std::min((u32)source.j + reach, (u32)tilesH - 1);
+
+			// Reuse the grid from the previous computation if it's the right size
+			if (m_InfluenceGridPool.size() <= sources.size())
+				m_InfluenceGridPool.resize(sources.size() + 1);
+			Grid<u32>& grid = m_InfluenceGridPool[sources.size()];
+			if (grid.m_W != i1 - source.i0 + 1 || grid.m_H != j1 - source.j0 + 1)
+				grid = Grid<u32>((u16)(i1 - source.i0 + 1), (u16)(j1 - source.j0 + 1));
+
+			sources.push_back(source);
+		}
+	}
 
-			// Expand influences outwards
-			FloodFill(entityGrid, influenceGrid, openTiles, falloff);
+	// (Assign the grids after the pool has stopped growing, since that moves its contents)
+	for (size_t n = 0; n < sources.size(); ++n)
+		sources[n].grid = &m_InfluenceGridPool[n];
 
-			// TODO: we should do a sparse grid and only add the non-zero regions, for performance
-			for (u16 j = 0; j < entityGrid.m_H; ++j)
-				for (u16 i = 0; i < entityGrid.m_W; ++i)
-					playerGrid.set(i, j, playerGrid.get(i, j) + entityGrid.get(i, j));
-		}
+	// The entities' influences are independent, so compute them in parallel
+	InfluenceJob job = { &influenceGrid, &sources };
+	if (g_ThreadPool)
+		g_ThreadPool->ParallelFor(sources.size(), 1, &InfluenceCallback, &job);
+	else
+		InfluenceCallback(&job, 0, sources.size());
 
-		playerGrids.push_back(std::make_pair(it->first, playerGrid));
+	// Add each influence to its player's grid, in a fixed order
+	for (size_t n = 0; n < sources.size(); ++n)
+	{
+		const InfluenceSource& source = sources[n];
+		const Grid<u32>& entityGrid = *source.grid;
+		Grid<u32>& playerGrid = playerGrids[source.player].second;
+		for (u16 j = 0; j < entityGrid.m_H; ++j)
+			for (u16 i = 0; i < entityGrid.m_W; ++i)
+				playerGrid.get(source.i0 + i, source.j0 + j) += entityGrid.get(i, j);
 	}
 
 	// Set m_Territories to the player ID with the highest influence for each tile
@@ -535,6 +663,99 @@ void CCmpTerritoryManager::CalculateTerritories()
 
 #undef MARK_AND_PUSH
 	}
+
+	RecordChangedTiles();
+}
+
+void CCmpTerritoryManager::RecordChangedTiles()
+{
+	const Grid<u8>& grid = *m_Territories;
+
+	// Without the previous territories (or if the map size changed), everything has changed
+	SChangedTiles changed = { m_DirtyID, 0, 0, (u16)(grid.m_W-1), (u16)(grid.m_H-1) };
+	bool any = true;
+	if (m_PreviousTerritories && m_PreviousTerritories->m_W == grid.m_W && m_PreviousTerritories->m_H == grid.m_H)
+	{
+		const Grid<u8>& previous = *m_PreviousTerritories;
+		any = false;
+		for (u16 j = 0; j < grid.m_H; ++j)
+		{
+			const u8* row = &grid.get(0, j);
+			const u8* previousRow = &previous.get(0, j);
+			if (memcmp(row, previousRow, grid.m_W) == 0)
+				continue;
+
+			u16 first = 0;
+			while (row[first] == previousRow[first])
+				++first;
+			u16 last = (u16)(grid.m_W-1);
+			while (row[last] == previousRow[last])
+				--last;
+
+			if (!any)
+			{
+				changed.i0 = first;
+				changed.i1 = last;
+				changed.j0 = j;
+				any = true;
+			}
+			changed.i0 = std::min(changed.i0, first);
+			changed.i1 = std::max(changed.i1, last);
+			changed.j1 = j;
+		}
+	}
+	SAFE_DELETE(m_PreviousTerritories);
+
+	if (!any)
+		return;
+
+	m_ChangedTiles.push_back(changed);
+	if (m_ChangedTiles.size() > MAX_CHANGED_TILES_HISTORY)
+	{
+		m_ChangedTilesStartID = m_ChangedTiles.front().dirtyID;
+		m_ChangedTiles.pop_front();
+	}
+}
+
+bool CCmpTerritoryManager::GetChangedTiles(size_t dirtyID, u16& i0, u16& j0, u16& i1, u16& j1)
+{
+	CalculateTerritories();
+	if (!m_Territories)
+		return false;
+
+	// If we don't know what changed since then, the caller has to update everything
+	if (dirtyID < m_ChangedTilesStartID || dirtyID > m_DirtyID)
+	{
+		i0 = j0 = 0;
+		i1 = (u16)(m_Territories->m_W-1);
+		j1 = (u16)(m_Territories->m_H-1);
+		return true;
+	}
+
+	// Otherwise combine the changes from every later calculation
+	bool changed = false;
+	for (std::deque<SChangedTiles>::const_iterator it = m_ChangedTiles.begin(); it != m_ChangedTiles.end(); ++it)
+	{
+		if (it->dirtyID <= dirtyID)
+			continue;
+
+		if (!changed)
+		{
+			i0 = it->i0;
+			j0 = it->j0;
+			i1 = it->i1;
+			j1 = it->j1;
+			changed = true;
+		}
+		else
+		{
+			i0 = std::min(i0, it->i0);
+			j0 = std::min(j0, it->j0);
+			i1 = std::max(i1, it->i1);
+			j1 = std::max(j1, it->j1);
+		}
+	}
+	return changed;
 }
 
 /**
@@ -596,27 +817,32 @@ void CCmpTerritoryManager::RasteriseInfluences(CComponentManager::InterfaceList&
 	}
 }
 
-std::vector<STerritoryBoundary> CCmpTerritoryManager::ComputeBoundaries()
-{
-	PROFILE("ComputeBoundaries");
-
-	CalculateTerritories();
-	ENSURE(m_Territories);
-
-	return CTerritoryBoundaryCalculator::ComputeBoundaries(m_Territories);
-}
-
 void CCmpTerritoryManager::UpdateBoundaryLines()
 {
 	PROFILE("update boundary lines");
 
-	m_BoundaryLines.clear();
 	m_DebugBoundaryLineNodes.clear();
 
 	if (!CRenderer::IsInitialised())
+	{
+		m_BoundaryLines.clear();
 		return;
+	}
+
+	CalculateTerritories();
+	ENSURE(m_Territories);
 
-	std::vector<STerritoryBoundary> boundaries = ComputeBoundaries();
+	// Only retrace the boundaries that might have changed since last time
+	// (unless the debug overlays are enabled, since they're only created for new lines)
+	const Grid<u8>* previousTerritories = NULL;
+	if (!m_EnableLineDebugOverlays && m_BoundaryTerritories.m_Data)
+		previousTerritories = &m_BoundaryTerritories;
+
+	std::vector<STerritoryBoundary> boundaries;
+	{
+		PROFILE("ComputeBoundaries");
+		boundaries = CTerritoryBoundaryCalculator::UpdateBoundaries(m_Territories, previousTerritories, m_Boundaries, m_NextBoundaryID);
+	}
 
 	CTextureProperties texturePropsBase("art/textures/misc/territory_border.png");
 	texturePropsBase.SetWrap(GL_CLAMP_TO_BORDER, GL_CLAMP_TO_EDGE);
@@ -630,7 +856,17 @@ void CCmpTerritoryManager::UpdateBoundaryLines()
 
 	CmpPtr<ICmpPlayerManager> cmpPlayerManager(GetSimContext(), SYSTEM_ENTITY);
 	if (!cmpPlayerManager)
+	{
+		m_BoundaryLines.clear();
 		return;
+	}
+
+	// Lines made from unchanged boundaries can be reused, along with their render data
+	std::map<u32, size_t> oldLines;
+	for (size_t i = 0; i < m_BoundaryLines.size(); ++i)
+		oldLines[m_BoundaryLines[i].id] = i;
+
+	std::vector<SBoundaryLine> boundaryLines;
 
 	for (size_t i = 0; i < boundaries.size(); ++i)
 	{
@@ -642,30 +878,42 @@ void CCmpTerritoryManager::UpdateBoundaryLines()
 		if (cmpPlayer)
 			color = cmpPlayer->GetColour();
 
-		m_BoundaryLines.push_back(SBoundaryLine());
-		m_BoundaryLines.back().connected = boundaries[i].connected;
-		m_BoundaryLines.back().color = color;
-		m_BoundaryLines.back().overlay.m_SimContext = &GetSimContext();
-		m_BoundaryLines.back().overlay.m_TextureBase = textureBase;
-		m_BoundaryLines.back().overlay.m_TextureMask = textureMask;
-		m_BoundaryLines.back().overlay.m_Color = color;
-		m_BoundaryLines.back().overlay.m_Thickness = m_BorderThickness;
-		m_BoundaryLines.back().overlay.m_Closed = true;
-
-		SimRender::SmoothPointsAverage(boundaries[i].points, m_BoundaryLines.back().overlay.m_Closed);
-		SimRender::InterpolatePointsRNS(boundaries[i].points, m_BoundaryLines.back().overlay.m_Closed, m_BorderSeparation);
-
-		std::vector<float>& points = m_BoundaryLines.back().overlay.m_Coords;
-		for (size_t j = 0; j < boundaries[i].points.size(); ++j)
+		std::map<u32, size_t>::const_iterator it = oldLines.find(boundaries[i].id);
+		if (it != oldLines.end())
+		{
+			boundaryLines.push_back(m_BoundaryLines[it->second]);
+			boundaryLines.back().color = color;
+			boundaryLines.back().overlay.m_Color = color;
+			continue;
+		}
+
+		boundaryLines.push_back(SBoundaryLine());
+		boundaryLines.back().id = boundaries[i].id;
+		boundaryLines.back().connected = boundaries[i].connected;
+		boundaryLines.back().color = color;
+		boundaryLines.back().overlay.m_SimContext = &GetSimContext();
+		boundaryLines.back().overlay.m_TextureBase = textureBase;
+		boundaryLines.back().overlay.m_TextureMask = textureMask;
+		boundaryLines.back().overlay.m_Color = color;
+		boundaryLines.back().overlay.m_Thickness = m_BorderThickness;
+		boundaryLines.back().overlay.m_Closed = true;
+
+		// (Smooth a copy of the points, so the original boundary can be compared next time)
+		std::vector<CVector2D> boundaryPoints = boundaries[i].points;
+		SimRender::SmoothPointsAverage(boundaryPoints, boundaryLines.back().overlay.m_Closed);
+		SimRender::InterpolatePointsRNS(boundaryPoints, boundaryLines.back().overlay.m_Closed, m_BorderSeparation);
+
+		std::vector<float>& points = boundaryLines.back().overlay.m_Coords;
+		for (size_t j = 0; j < boundaryPoints.size(); ++j)
 		{
-			points.push_back(boundaries[i].points[j].X);
-			points.push_back(boundaries[i].points[j].Y);
+			points.push_back(boundaryPoints[j].X);
+			points.push_back(boundaryPoints[j].Y);
 
 			if (m_EnableLineDebugOverlays)
 			{
 				const size_t numHighlightNodes = 7; // highlight the X last nodes on either end to see where they meet (if closed)
 				SOverlayLine overlayNode;
-				if (j > boundaries[i].points.size() - 1 - numHighlightNodes)
+				if (j > boundaryPoints.size() - 1 - numHighlightNodes)
 					overlayNode.m_Color = CColor(1.f, 0.f, 0.f, 1.f);
 				else if (j < numHighlightNodes)
 					overlayNode.m_Color = CColor(0.f, 1.f, 0.f, 1.f);
@@ -673,12 +921,16 @@ void CCmpTerritoryManager::UpdateBoundaryLines()
 					overlayNode.m_Color = CColor(1.0f, 1.0f, 1.0f, 1.0f);
 
 				overlayNode.m_Thickness = 1;
-				SimRender::ConstructCircleOnGround(GetSimContext(), boundaries[i].points[j].X, boundaries[i].points[j].Y, 0.1f, overlayNode, true);
+				SimRender::ConstructCircleOnGround(GetSimContext(), boundaryPoints[j].X, boundaryPoints[j].Y, 0.1f, overlayNode, true);
 				m_DebugBoundaryLineNodes.push_back(overlayNode);
 			}
 		}
 
 	}
+
+	m_BoundaryLines.swap(boundaryLines);
+	m_Boundaries.swap(boundaries);
+	m_BoundaryTerritories = *m_Territories;
 }
 
 void CCmpTerritoryManager::Interpolate(float frameTime, float UNUSED(frameOffset))
@@ -0,0 +1,248 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "simulation2/system/Component.h"
+#include "ICmpTimer.h"
+
+#include "ps/CLogger.h"
+#include "simulation2/MessageTypes.h"
+#include "simulation2/serialization/SerializeTemplates.h"
+
+/**
+ * Timers are stored by ID (so they're serialized in a consistent order), and also in a
+ * set ordered by expiry time, to find the ones that need to run without looking at all
+ * the others every turn. Cancelling a timer removes it from both.
+ *
+ * The expired timers run in ID order, which is the order the script Timer component
+ * (which this replaces) ran them in, since it iterated over an object keyed by ID;
+ * running them in expiry order instead would change the simulation.
+ */
+class CCmpTimer : public ICmpTimer
+{
+public:
+	static void ClassInit(CComponentManager& componentManager)
+	{
+		componentManager.SubscribeToMessageType(MT_Update);
+	}
+
+	DEFAULT_COMPONENT_ALLOCATOR(Timer)
+
+	struct Timer
+	{
+		entity_id_t ent;
+		int iid;
+		std::string funcname;
+		u32 time; // expiry time
+		u32 repeattime; // 0 if not repeating
+		CScriptValRooted data;
+	};
+
+	// (expiry time, ID) pairs
+	typedef std::set<std::pair<u32, u32> > TimerQueue;
+
+	u32 m_NextId;
+	u32 m_Time;
+	u32 m_TurnLength;
+	std::map<u32, Timer> m_Timers;
+	TimerQueue m_Queue;
+
+	static std::string GetSchema()
+	{
+		return "<a:component type='system'/><empty/>";
+	}
+
+	virtual void Init(const CParamNode& UNUSED(paramNode))
+	{
+		m_NextId = 1;
+		m_Time = 0;
+		m_TurnLength = 0;
+	}
+
+	virtual void Deinit()
+	{
+	}
+
+	virtual void Serialize(ISerializer& serialize)
+	{
+		serialize.NumberU32_Unbounded("next id", m_NextId);
+		serialize.NumberU32_Unbounded("time", m_Time);
+		serialize.NumberU32_Unbounded("turn length", m_TurnLength);
+
+		serialize.NumberU32_Unbounded("num timers", (u32)m_Timers.size());
+		for (std::map<u32, Timer>::iterator it = m_Timers.begin(); it != m_Timers.end(); ++it)
+		{
+			serialize.NumberU32_Unbounded("id", it->first);
+			serialize.NumberU32_Unbounded("entity", it->second.ent);
+			serialize.NumberI32_Unbounded("iid", it->second.iid);
+			serialize.StringASCII("funcname", it->second.funcname, 0, 256);
+			serialize.NumberU32_Unbounded("time", it->second.time);
+			serialize.NumberU32_Unbounded("repeat time", it->second.repeattime);
+			serialize.ScriptVal("data", it->second.data);
+		}
+	}
+
+	virtual void Deserialize(const CParamNode& paramNode, IDeserializer& deserialize)
+	{
+		Init(paramNode);
+
+		deserialize.NumberU32_Unbounded("next id", m_NextId);
+		deserialize.NumberU32_Unbounded("time", m_Time);
+		deserialize.NumberU32_Unbounded("turn length", m_TurnLength);
+
+		u32 numTimers;
+		deserialize.NumberU32_Unbounded("num timers", numTimers);
+		for (u32 i = 0; i < numTimers; ++i)
+		{
+			u32 id;
+			Timer timer;
+			deserialize.NumberU32_Unbounded("id", id);
+			deserialize.NumberU32_Unbounded("entity", timer.ent);
+			deserialize.NumberI32_Unbounded("iid", timer.iid);
+			deserialize.StringASCII("funcname", timer.funcname, 0, 256);
+			deserialize.NumberU32_Unbounded("time", timer.time);
+			deserialize.NumberU32_Unbounded("repeat time", timer.repeattime);
+			deserialize.ScriptVal("data", timer.data);
+			m_Timers[id] = timer;
+			m_Queue.insert(std::make_pair(timer.time, id));
+		}
+	}
+
+	virtual void HandleMessage(const CMessage& msg, bool UNUSED(global))
+	{
+		switch (msg.GetType())
+		{
+		case MT_Update:
+		{
+			fixed turnLength = static_cast<const CMessageUpdate&> (msg).turnLength;
+			m_TurnLength = (turnLength * 1000).ToInt_RoundToNearest();
+			m_Time += m_TurnLength;
+			RunTimers();
+			break;
+		}
+		}
+	}
+
+	virtual u32 GetTime()
+	{
+		return m_Time;
+	}
+
+	virtual u32 GetLatestTurnLength()
+	{
+		return m_TurnLength;
+	}
+
+	virtual u32 SetTimeout(entity_id_t ent, int iid, std::string funcname, u32 time, CScriptVal data)
+	{
+		return SetInterval(ent, iid, funcname, time, 0, data);
+	}
+
+	virtual u32 SetInterval(entity_id_t ent, int iid, std::string funcname, u32 time, u32 repeattime, CScriptVal data)
+	{
+		u32 id = m_NextId++;
+
+		Timer& timer = m_Timers[id];
+		timer.ent = ent;
+		timer.iid = iid;
+		timer.funcname = funcname;
+		timer.time = m_Time + time;
+		timer.repeattime = repeattime;
+		timer.data = CScriptValRooted(GetSimContext().GetScriptInterface().GetContext(), data);
+		m_Queue.insert(std::make_pair(timer.time, id));
+
+		return id;
+	}
+
+	virtual void UpdateRepeatTime(u32 id, u32 repeattime)
+	{
+		std::map<u32, Timer>::iterator it = m_Timers.find(id);
+		if (it != m_Timers.end())
+			it->second.repeattime = repeattime;
+	}
+
+	virtual void CancelTimer(u32 id)
+	{
+		std::map<u32, Timer>::iterator it = m_Timers.find(id);
+		if (it == m_Timers.end())
+			return;
+
+		m_Queue.erase(std::make_pair(it->second.time, id));
+		m_Timers.erase(it);
+	}
+
+private:
+	void RunTimers()
+	{
+		// Find all the timers that have expired before running any of them,
+		// so the ones added (or repeated) by the callbacks wait until the next turn
+		std::vector<u32> run;
+		TimerQueue::iterator end = m_Queue.upper_bound(std::make_pair(m_Time, std::numeric_limits<u32>::max()));
+		for (TimerQueue::iterator qit = m_Queue.begin(); qit != end; ++qit)
+			run.push_back(qit->second);
+		m_Queue.erase(m_Queue.begin(), end);
+
+		// Run them in the order they were created, regardless of when they expired
+		std::sort(run.begin(), run.end());
+
+		ScriptInterface& scriptInterface = GetSimContext().GetScriptInterface();
+		CComponentManager& componentManager = GetSimContext().GetComponentManager();
+
+		for (size_t i = 0; i < run.size(); ++i)
+		{
+			u32 id = run[i];
+
+			// Skip timers that were cancelled by an earlier callback
+			std::map<u32, Timer>::iterator it = m_Timers.find(id);
+			if (it == m_Timers.end())
+				continue;
+
+			// Copy the timer, since the callback might cancel it
+			Timer timer = it->second;
+
+			IComponent* cmp = componentManager.QueryInterface(timer.ent, timer.iid);
+			if (!cmp)
+			{
+				// The entity was probably destroyed
+				m_Timers.erase(it);
+				continue;
+			}
+
+			u32 lateness = m_Time - timer.time;
+			if (!scriptInterface.CallFunctionVoid(cmp->GetJSInstance(), timer.funcname.c_str(), timer.data, lateness))
+				LOGERROR(L"Error in timer on entity %u, IID %d, function %hs", timer.ent, timer.iid, timer.funcname.c_str());
+
+			// The callback might have cancelled it, or changed its repeat time
+			it = m_Timers.find(id);
+			if (it == m_Timers.end())
+				continue;
+
+			if (it->second.repeattime)
+			{
+				it->second.time += it->second.repeattime;
+				m_Queue.insert(std::make_pair(it->second.time, id));
+			}
+			else
+			{
+				m_Timers.erase(it);
+			}
+		}
+	}
+};
+
+REGISTER_COMPONENT_TYPE(Timer)
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -95,6 +95,32 @@ static const entity_pos_t CHECK_TARGET_MOVEMENT_MIN_DELTA_FORMATION = entity_pos
  */
 static const entity_pos_t CHECK_TARGET_MOVEMENT_AT_MAX_DIST = entity_pos_t::FromInt(TERRAIN_TILE_SIZE*16);
 
+/**
+ * If a unit's step is blocked (typically by another unit), it tries stepping
+ * to the side at these angles (in radians) instead, always trying the left
+ * (anticlockwise) side first so that units walking into each other head-on
+ * both turn the same way and pass each other.
+ */
+static const entity_angle_t AVOIDANCE_ANGLES[] = {
+	entity_angle_t::Pi() / 6,
+	entity_angle_t::Pi() / 3,
+	entity_angle_t::Pi() / 2
+};
+
+/**
+ * If a unit has had to step to the side for this many consecutive turns,
+ * it's not a minor collision, so we give up and recompute the path.
+ */
+static const u8 AVOIDANCE_MAX_TURNS = 4;
+
+/**
+ * If we're following a target entity that has moved, but its new position
+ * is within this distance of the end of our current path, we try to repair
+ * the path by heading straight from its end to the new position, instead
+ * of computing a whole new long path.
+ */
+static const entity_pos_t PATH_REPAIR_MAX_DIST = entity_pos_t::FromInt(TERRAIN_TILE_SIZE*8);
+
 static const CColor OVERLAY_COLOUR_LONG_PATH(1, 1, 1, 1);
 static const CColor OVERLAY_COLOUR_SHORT_PATH(1, 0, 0, 1);
 
@@ -192,7 +218,8 @@ public:
 		/*
 		 * We are following our path, and have an outstanding long path request.
 		 * (This is because our target moved a long way and we need to recompute
-		 * the whole path).
+		 * the whole path, or because the pathfinder deferred our request to a
+		 * later turn and we're following a provisional path until it's done).
 		 * m_LongPath and m_ShortPath are valid.
 		 */
 		PATHSTATE_FOLLOWING_REQUESTING_LONG,
@@ -228,6 +255,9 @@ public:
 
 	fixed m_Speed;
 
+	// Number of consecutive turns we've sidestepped an obstruction
+	u8 m_AvoidanceTurns;
+
 	// Current mean speed (over the last turn).
 	fixed m_CurSpeed;
 
@@ -238,6 +268,13 @@ public:
 
 	ICmpPathfinder::Goal m_FinalGoal;
 
+	// Our formation target position for the current turn, as given by the
+	// formation controller in SetFormationTarget. This is just a cache of what
+	// ComputeTargetPosition would compute, and is only valid between the
+	// MotionFormation and MotionUnit updates, so it doesn't need serializing.
+	bool m_FormationTargetValid;
+	CFixedVector2D m_FormationTarget;
+
 	static std::string GetSchema()
 	{
 		return
@@ -310,11 +347,17 @@ public:
 
 		m_ExpectedPathTicket = 0;
 
+		m_AvoidanceTurns = 0;
+
 		m_TargetEntity = INVALID_ENTITY;
 
 		m_FinalGoal.type = ICmpPathfinder::Goal::POINT;
 
+		m_FormationTargetValid = false;
+
 		m_DebugOverlayEnabled = false;
+
+		UpdateSleeping();
 	}
 
 	virtual void Deinit()
@@ -340,6 +383,7 @@ public:
 		serialize.NumberFixed_Unbounded("target max range", m_TargetMaxRange);
 
 		serialize.NumberFixed_Unbounded("speed", m_Speed);
+		serialize.NumberU8("avoidance turns", m_AvoidanceTurns, 0, AVOIDANCE_MAX_TURNS);
 
 		serialize.Bool("moving", m_Moving);
 
@@ -359,6 +403,8 @@ public:
 		Init(paramNode);
 
 		SerializeCommon(deserialize);
+
+		UpdateSleeping();
 	}
 
 	virtual void HandleMessage(const CMessage& msg, bool UNUSED(global))
@@ -380,6 +426,7 @@ public:
 			{
 				fixed dt = static_cast<const CMessageUpdate_MotionUnit&> (msg).turnLength;
 				Move(dt);
+				m_FormationTargetValid = false;
 			}
 			break;
 		}
@@ -439,6 +486,15 @@ public:
 	virtual bool IsInTargetRange(entity_id_t target, entity_pos_t minRange, entity_pos_t maxRange);
 	virtual void MoveToFormationOffset(entity_id_t target, entity_pos_t x, entity_pos_t z);
 
+	virtual void SetFormationTarget(entity_id_t controller, entity_pos_t x, entity_pos_t z)
+	{
+		if (!IsFormationMember() || controller != m_TargetEntity)
+			return;
+
+		m_FormationTarget = CFixedVector2D(x, z);
+		m_FormationTargetValid = true;
+	}
+
 	virtual void FaceTowardsPoint(entity_pos_t x, entity_pos_t z);
 
 	virtual void StopMoving()
@@ -449,6 +505,7 @@ public:
 		m_PathState = PATHSTATE_NONE;
 		m_LongPath.m_Waypoints.clear();
 		m_ShortPath.m_Waypoints.clear();
+		UpdateSleeping();
 	}
 
 	virtual void SetUnitRadius(fixed radius)
@@ -467,10 +524,20 @@ private:
 		return m_State == STATE_FORMATIONMEMBER_PATH;
 	}
 
+	/**
+	 * Idle units don't do anything in Move, so they sleep instead of receiving the
+	 * update messages. Must be called whenever m_State changes to or from STATE_IDLE.
+	 */
+	void UpdateSleeping()
+	{
+		GetSimContext().GetComponentManager().SetSleeping(this, m_State == STATE_IDLE);
+	}
+
 	void StartFailed()
 	{
 		StopMoving();
 		m_State = STATE_IDLE; // don't go through the STOPPING state since we never even started
+		UpdateSleeping();
 
 		CmpPtr<ICmpObstruction> cmpObstruction(GetSimContext(), GetEntityId());
 		if (cmpObstruction)
@@ -523,6 +590,14 @@ private:
 	 */
 	void Move(fixed dt);
 
+	/**
+	 * Our movement from pos by the given step was obstructed; try to find
+	 * an unobstructed step of the same length to one side instead, so minor
+	 * collisions don't need a new path.
+	 * Returns false if there isn't one, or we've been sidestepping for too long.
+	 */
+	bool TryAvoidingObstruction(const CFixedVector2D& pos, const CFixedVector2D& step, CFixedVector2D& out);
+
 	/**
 	 * Decide whether to approximate the given range from a square target as a circle,
 	 * rather than as a square.
@@ -541,6 +616,13 @@ private:
 	 */
 	bool TryGoingStraightToTargetEntity(CFixedVector2D from);
 
+	/**
+	 * Try to adjust the end of our current path to reach m_FinalGoal (after
+	 * it's moved a short way) with straight lines, instead of recomputing
+	 * the whole path. Returns false if that's not possible.
+	 */
+	bool TryRepairingPath(CFixedVector2D from);
+
 	/**
 	 * Returns whether the target entity has moved more than minDelta since our
 	 * last path computations, and we're close enough to it to care.
@@ -587,6 +669,12 @@ private:
 	 */
 	bool PickNextLongWaypoint(const CFixedVector2D& pos, bool avoidMovingUnits);
 
+	/**
+	 * If our pending long path request was deferred by the pathfinder, start
+	 * following a provisional straight path towards the goal while we wait.
+	 */
+	void TryStartingProvisionalPath();
+
 	/**
 	 * Convert a path into a renderable list of lines
 	 */
@@ -760,6 +848,7 @@ void CCmpUnitMotion::Move(fixed dt)
 	if (m_State == STATE_STOPPING)
 	{
 		m_State = STATE_IDLE;
+		UpdateSleeping();
 		MoveSucceeded();
 		return;
 	}
@@ -769,6 +858,9 @@ void CCmpUnitMotion::Move(fixed dt)
 		return;
 	}
 
+	if (m_PathState == PATHSTATE_WAITING_REQUESTING_LONG)
+		TryStartingProvisionalPath();
+
 	switch (m_PathState)
 	{
 	case PATHSTATE_NONE:
@@ -829,6 +921,7 @@ void CCmpUnitMotion::Move(fixed dt)
 		fixed maxSpeed = basicSpeed.Multiply(terrainSpeed);
 
 		bool wasObstructed = false;
+		bool avoided = false;
 
 		// We want to move (at most) maxSpeed*dt units from pos towards the next waypoint
 
@@ -867,6 +960,13 @@ void CCmpUnitMotion::Move(fixed dt)
 					m_ShortPath.m_Waypoints.pop_back();
 					continue;
 				}
+				else if (TryAvoidingObstruction(pos, offset, target))
+				{
+					// Step around the obstruction, and head for the waypoint again next turn
+					pos = target;
+					avoided = true;
+					break;
+				}
 				else
 				{
 					// Error - path was obstructed
@@ -885,6 +985,12 @@ void CCmpUnitMotion::Move(fixed dt)
 					pos = target;
 					break;
 				}
+				else if (TryAvoidingObstruction(pos, offset, target))
+				{
+					pos = target;
+					avoided = true;
+					break;
+				}
 				else
 				{
 					// Error - path was obstructed
@@ -901,6 +1007,11 @@ void CCmpUnitMotion::Move(fixed dt)
 		// Calculate the mean speed over this past turn.
 		m_CurSpeed = cmpPosition->GetDistanceTravelled() / dt;
 
+		if (avoided)
+			++m_AvoidanceTurns;
+		else
+			m_AvoidanceTurns = 0;
+
 		if (wasObstructed)
 		{
 			// Oops, we hit something (very likely another unit).
@@ -908,8 +1019,17 @@ void CCmpUnitMotion::Move(fixed dt)
 			// TODO: if the target has UnitMotion and is higher priority,
 			// we should wait a little bit.
 
+			// If we're still waiting for a deferred long path, re-requesting it
+			// would just push it further back in the queue, so wait for it here
+			if (m_PathState == PATHSTATE_FOLLOWING_REQUESTING_LONG && cmpPathfinder->IsPathRequestDeferred(m_ExpectedPathTicket))
+			{
+				m_ShortPath.m_Waypoints.clear();
+				return;
+			}
+
 			RequestLongPath(pos, m_FinalGoal);
 			m_PathState = PATHSTATE_WAITING_REQUESTING_LONG;
+			m_AvoidanceTurns = 0;
 
 			return;
 		}
@@ -991,6 +1111,13 @@ bool CCmpUnitMotion::ComputeTargetPosition(CFixedVector2D& out)
 	if (m_TargetEntity == INVALID_ENTITY)
 		return false;
 
+	// The formation controller might have already computed it for us
+	if (m_FormationTargetValid && IsFormationMember())
+	{
+		out = m_FormationTarget;
+		return true;
+	}
+
 	CmpPtr<ICmpPosition> cmpPosition(GetSimContext(), m_TargetEntity);
 	if (!cmpPosition || !cmpPosition->IsInWorld())
 		return false;
@@ -1048,6 +1175,34 @@ bool CCmpUnitMotion::TryGoingStraightToTargetEntity(CFixedVector2D from)
 	return true;
 }
 
+bool CCmpUnitMotion::TryAvoidingObstruction(const CFixedVector2D& pos, const CFixedVector2D& step, CFixedVector2D& out)
+{
+	if (m_AvoidanceTurns >= AVOIDANCE_MAX_TURNS || step.IsZero())
+		return false;
+
+	CmpPtr<ICmpPathfinder> cmpPathfinder (GetSimContext(), SYSTEM_ENTITY);
+	if (!cmpPathfinder)
+		return false;
+
+	// Try increasingly sharp turns, left before right. CheckMovement tests
+	// against the obstruction manager's shapes and the terrain, so any step
+	// we take is as valid as normal movement
+	for (size_t i = 0; i < ARRAY_SIZE(AVOIDANCE_ANGLES); ++i)
+	{
+		for (int side = 1; side >= -1; side -= 2)
+		{
+			CFixedVector2D target = pos + step.Rotate(side > 0 ? AVOIDANCE_ANGLES[i] : -AVOIDANCE_ANGLES[i]);
+			if (cmpPathfinder->CheckMovement(GetObstructionFilter(), pos.X, pos.Y, target.X, target.Y, m_Radius, m_PassClass))
+			{
+				out = target;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
 bool CCmpUnitMotion::CheckTargetMovement(CFixedVector2D from, entity_pos_t minDelta)
 {
 	CFixedVector2D targetPos;
@@ -1065,9 +1220,11 @@ bool CCmpUnitMotion::CheckTargetMovement(CFixedVector2D from, entity_pos_t minDe
 
 	// Fail if the target is no longer visible to this entity's owner
 	// (in which case we'll continue moving to its last known location,
-	// unless it comes back into view before we reach that location)
+	// unless it comes back into view before we reach that location).
+	// (Formation controllers are always visible to their own members, so
+	// don't bother checking for them)
 	CmpPtr<ICmpOwnership> cmpOwnership(GetSimContext(), GetEntityId());
-	if (cmpOwnership)
+	if (cmpOwnership && !IsFormationMember())
 	{
 		CmpPtr<ICmpRangeManager> cmpRangeManager(GetSimContext(), SYSTEM_ENTITY);
 		if (cmpRangeManager)
@@ -1081,12 +1238,81 @@ bool CCmpUnitMotion::CheckTargetMovement(CFixedVector2D from, entity_pos_t minDe
 	// change the goal here and expect our caller to start the path request
 	m_FinalGoal.x = targetPos.X;
 	m_FinalGoal.z = targetPos.Y;
+
+	// If the target has only moved a little from the end of our path,
+	// just adjust the end of it
+	if (TryRepairingPath(from))
+		return true;
+
+	// The formation controller has already computed the long path for the
+	// whole formation, so if we're close to our place in it then a short path
+	// is enough to get around whatever's in the way, which is much cheaper
+	// than every member computing its own long path
+	if (IsFormationMember() && (targetPos - from).CompareLength(SHORT_PATH_SEARCH_RANGE) < 0)
+	{
+		m_LongPath.m_Waypoints.clear();
+		ICmpPathfinder::Waypoint wp = { targetPos.X, targetPos.Y };
+		m_LongPath.m_Waypoints.push_back(wp);
+		if (PickNextLongWaypoint(from, ShouldAvoidMovingUnits()))
+			m_PathState = PATHSTATE_FOLLOWING_REQUESTING_SHORT;
+		return true;
+	}
+
 	RequestLongPath(from, m_FinalGoal);
 	m_PathState = PATHSTATE_FOLLOWING_REQUESTING_LONG;
 
 	return true;
 }
 
+bool CCmpUnitMotion::TryRepairingPath(CFixedVector2D from)
+{
+	// Find the end of our current path (both paths store waypoints in reverse order)
+	ICmpPathfinder::Path* path;
+	if (!m_LongPath.m_Waypoints.empty())
+		path = &m_LongPath;
+	else if (!m_ShortPath.m_Waypoints.empty())
+		path = &m_ShortPath;
+	else
+		return false;
+
+	CmpPtr<ICmpPathfinder> cmpPathfinder (GetSimContext(), SYSTEM_ENTITY);
+	if (!cmpPathfinder)
+		return false;
+
+	// Don't repair it if the goal has moved too far away, since the
+	// route might be very different now
+	CFixedVector2D end(path->m_Waypoints[0].x, path->m_Waypoints[0].z);
+	CFixedVector2D goalPos = cmpPathfinder->GetNearestPointOnGoal(end, m_FinalGoal);
+	if ((goalPos - end).CompareLength(PATH_REPAIR_MAX_DIST) > 0)
+		return false;
+
+	// Preferably replace the old end waypoint with the new goal, so that
+	// repeated repairs don't keep making the path longer
+	// (if we're heading straight for the end, it's replaceable from our current position)
+	if (path->m_Waypoints.size() >= 2 || path == &m_ShortPath)
+	{
+		CFixedVector2D prev = from;
+		if (path->m_Waypoints.size() >= 2)
+			prev = CFixedVector2D(path->m_Waypoints[1].x, path->m_Waypoints[1].z);
+		CFixedVector2D prevGoalPos = cmpPathfinder->GetNearestPointOnGoal(prev, m_FinalGoal);
+		if ((prevGoalPos - prev).CompareLength(PATH_REPAIR_MAX_DIST) <= 0 &&
+			cmpPathfinder->CheckMovement(GetObstructionFilter(), prev.X, prev.Y, prevGoalPos.X, prevGoalPos.Y, m_Radius, m_PassClass))
+		{
+			path->m_Waypoints[0].x = prevGoalPos.X;
+			path->m_Waypoints[0].z = prevGoalPos.Y;
+			return true;
+		}
+	}
+
+	// Otherwise extend the path from its current end
+	if (!cmpPathfinder->CheckMovement(GetObstructionFilter(), end.X, end.Y, goalPos.X, goalPos.Y, m_Radius, m_PassClass))
+		return false;
+
+	ICmpPathfinder::Waypoint wp = { goalPos.X, goalPos.Y };
+	path->m_Waypoints.insert(path->m_Waypoints.begin(), wp);
+	return true;
+}
+
 bool CCmpUnitMotion::PathIsShort(const ICmpPathfinder::Path& path, CFixedVector2D from, entity_pos_t minDistance)
 {
 	CFixedVector2D pos = from;
@@ -1251,6 +1477,34 @@ bool CCmpUnitMotion::PickNextLongWaypoint(const CFixedVector2D& pos, bool avoidM
 	return true;
 }
 
+void CCmpUnitMotion::TryStartingProvisionalPath()
+{
+	CmpPtr<ICmpPathfinder> cmpPathfinder(GetSimContext(), SYSTEM_ENTITY);
+	if (!cmpPathfinder || !cmpPathfinder->IsPathRequestDeferred(m_ExpectedPathTicket))
+		return;
+
+	CmpPtr<ICmpPosition> cmpPosition(GetSimContext(), GetEntityId());
+	if (!cmpPosition || !cmpPosition->IsInWorld())
+		return;
+
+	// Head a short way directly towards the goal (the real path will usually
+	// start out in roughly the same direction), and let the usual movement
+	// obstruction checks stop us if that's blocked
+	CFixedVector2D pos = cmpPosition->GetPosition2D();
+	CFixedVector2D offset = cmpPathfinder->GetNearestPointOnGoal(pos, m_FinalGoal) - pos;
+	if (offset.CompareLength(WAYPOINT_ADVANCE_MAX) > 0)
+		offset.Normalize(WAYPOINT_ADVANCE_MAX);
+
+	m_LongPath.m_Waypoints.clear();
+	m_ShortPath.m_Waypoints.clear();
+	ICmpPathfinder::Waypoint wp = { pos.X + offset.X, pos.Y + offset.Y };
+	m_ShortPath.m_Waypoints.push_back(wp);
+
+	// Keep waiting for the deferred long path, and replace this one when it arrives
+	m_PathState = PATHSTATE_FOLLOWING_REQUESTING_LONG;
+
+	StartSucceeded();
+}
 
 bool CCmpUnitMotion::MoveToPointRange(entity_pos_t x, entity_pos_t z, entity_pos_t minRange, entity_pos_t maxRange)
 {
@@ -1327,6 +1581,7 @@ bool CCmpUnitMotion::MoveToPointRange(entity_pos_t x, entity_pos_t z, entity_pos
 	}
 
 	m_State = STATE_INDIVIDUAL_PATH;
+	UpdateSleeping();
 	m_TargetEntity = INVALID_ENTITY;
 	m_TargetOffset = CFixedVector2D();
 	m_TargetMinRange = minRange;
@@ -1522,6 +1777,7 @@ bool CCmpUnitMotion::MoveToTargetRange(entity_id_t target, entity_pos_t minRange
 		}
 
 		m_State = STATE_INDIVIDUAL_PATH;
+		UpdateSleeping();
 		m_TargetEntity = target;
 		m_TargetOffset = CFixedVector2D();
 		m_TargetMinRange = minRange;
@@ -1626,11 +1882,13 @@ void CCmpUnitMotion::MoveToFormationOffset(entity_id_t target, entity_pos_t x, e
 	goal.z = pos.Y;
 
 	m_State = STATE_FORMATIONMEMBER_PATH;
+	UpdateSleeping();
 	m_TargetEntity = target;
 	m_TargetOffset = CFixedVector2D(x, z);
 	m_TargetMinRange = entity_pos_t::Zero();
 	m_TargetMaxRange = entity_pos_t::Zero();
 	m_FinalGoal = goal;
+	m_FormationTargetValid = false;
 
 	BeginPathing(pos, goal);
 }
@@ -0,0 +1,241 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "simulation2/system/Component.h"
+#include "ICmpUnitRenderer.h"
+
+#include "simulation2/MessageTypes.h"
+
+#include "graphics/Frustum.h"
+#include "graphics/ModelAbstract.h"
+#include "maths/BoundingBoxAligned.h"
+#include "ps/Profile.h"
+#include "ps/ThreadPool.h"
+#include "renderer/Scene.h"
+
+class CCmpUnitRenderer : public ICmpUnitRenderer
+{
+public:
+	static void ClassInit(CComponentManager& componentManager)
+	{
+		componentManager.SubscribeToMessageType(MT_RenderSubmit);
+	}
+
+	DEFAULT_COMPONENT_ALLOCATOR(UnitRenderer)
+
+	// Per-unit data, indexed by tag-1. Bounds are stored as separate arrays of
+	// coordinates so CFrustum::AreBoxesVisible can test several at once
+	std::vector<CModelAbstract*> m_Models;
+	std::vector<entity_id_t> m_Entities;
+	std::vector<u8> m_Visible;
+	std::vector<float> m_MinX, m_MinY, m_MinZ, m_MaxX, m_MaxY, m_MaxZ;
+
+	// Slots of removed units, to be reused by AddUnit
+	std::vector<tag_t> m_FreeTags;
+
+	// Culling results, reused each frame
+	std::vector<u8> m_InView;
+	std::vector<u8> m_InShadow;
+
+	// Entities that were submitted in the last RenderSubmit, for picking
+	std::vector<entity_id_t> m_VisibleEntities;
+	bool m_HasRendered;
+
+	static std::string GetSchema()
+	{
+		return "<a:component type='system'/><empty/>";
+	}
+
+	virtual void Init(const CParamNode& UNUSED(paramNode))
+	{
+		m_HasRendered = false;
+	}
+
+	virtual void Deinit()
+	{
+	}
+
+	virtual void Serialize(ISerializer& UNUSED(serialize))
+	{
+		// Nothing to serialize; the VisualActors register themselves again
+	}
+
+	virtual void Deserialize(const CParamNode& paramNode, IDeserializer& UNUSED(deserialize))
+	{
+		Init(paramNode);
+	}
+
+	virtual void HandleMessage(const CMessage& msg, bool UNUSED(global))
+	{
+		switch (msg.GetType())
+		{
+		case MT_RenderSubmit:
+		{
+			const CMessageRenderSubmit& msgData = static_cast<const CMessageRenderSubmit&> (msg);
+			RenderSubmit(msgData.collector, msgData.frustum, msgData.culling);
+			break;
+		}
+		}
+	}
+
+	virtual tag_t AddUnit(CModelAbstract* model, entity_id_t entity)
+	{
+		tag_t tag;
+		if (!m_FreeTags.empty())
+		{
+			tag = m_FreeTags.back();
+			m_FreeTags.pop_back();
+		}
+		else
+		{
+			m_Models.push_back(NULL);
+			m_Entities.push_back(INVALID_ENTITY);
+			m_Visible.push_back(0);
+			m_MinX.push_back(0.f); m_MinY.push_back(0.f); m_MinZ.push_back(0.f);
+			m_MaxX.push_back(0.f); m_MaxY.push_back(0.f); m_MaxZ.push_back(0.f);
+			tag = (tag_t)m_Models.size();
+		}
+
+		m_Models[tag-1] = model;
+		m_Entities[tag-1] = entity;
+		SetBounds(tag-1, false, CBoundingBoxAligned::EMPTY);
+		return tag;
+	}
+
+	virtual void RemoveUnit(tag_t tag)
+	{
+		ENSURE(tag && tag <= m_Models.size() && m_Models[tag-1]);
+		m_Models[tag-1] = NULL;
+		m_Entities[tag-1] = INVALID_ENTITY;
+		SetBounds(tag-1, false, CBoundingBoxAligned::EMPTY);
+		m_FreeTags.push_back(tag);
+	}
+
+	virtual void UpdateUnit(tag_t tag, bool visible, const CBoundingBoxAligned& bounds)
+	{
+		ASSERT(tag && tag <= m_Models.size() && m_Models[tag-1]);
+		SetBounds(tag-1, visible, bounds);
+	}
+
+	virtual const std::vector<entity_id_t>* GetVisibleEntities()
+	{
+		if (!m_HasRendered)
+			return NULL;
+		return &m_VisibleEntities;
+	}
+
+private:
+	void SetBounds(size_t i, bool visible, const CBoundingBoxAligned& bounds)
+	{
+		// Invisible units get empty bounds, so the culling rejects them without any extra tests
+		const CBoundingBoxAligned& b = (visible ? bounds : CBoundingBoxAligned::EMPTY);
+		m_Visible[i] = visible ? 1 : 0;
+		m_MinX[i] = b[0].X; m_MinY[i] = b[0].Y; m_MinZ[i] = b[0].Z;
+		m_MaxX[i] = b[1].X; m_MaxY[i] = b[1].Y; m_MaxZ[i] = b[1].Z;
+	}
+
+	struct CullJob
+	{
+		CCmpUnitRenderer* cmp;
+		SceneCollector* collector;
+		const CFrustum* frustum;
+		const CFrustum* shadowCasterFrustum;
+	};
+
+	static void CullCallback(void* cbdata, size_t begin, size_t end)
+	{
+		CullJob* job = static_cast<CullJob*>(cbdata);
+		CCmpUnitRenderer& cmp = *job->cmp;
+		size_t count = end - begin;
+
+		job->frustum->AreBoxesVisible(count,
+			&cmp.m_MinX[begin], &cmp.m_MinY[begin], &cmp.m_MinZ[begin],
+			&cmp.m_MaxX[begin], &cmp.m_MaxY[begin], &cmp.m_MaxZ[begin],
+			&cmp.m_InView[begin]);
+
+		if (job->shadowCasterFrustum)
+			job->shadowCasterFrustum->AreBoxesVisible(count,
+				&cmp.m_MinX[begin], &cmp.m_MinY[begin], &cmp.m_MinZ[begin],
+				&cmp.m_MaxX[begin], &cmp.m_MaxY[begin], &cmp.m_MaxZ[begin],
+				&cmp.m_InShadow[begin]);
+
+		// Drop units inside the frustum that are hidden behind the terrain
+		// (they may still cast visible shadows, so m_InShadow is left alone)
+		for (size_t i = begin; i < end; ++i)
+		{
+			if (cmp.m_InView[i] && job->collector->IsOccluded(CBoundingBoxAligned(
+				CVector3D(cmp.m_MinX[i], cmp.m_MinY[i], cmp.m_MinZ[i]),
+				CVector3D(cmp.m_MaxX[i], cmp.m_MaxY[i], cmp.m_MaxZ[i]))))
+				cmp.m_InView[i] = 0;
+		}
+	}
+
+	void RenderSubmit(SceneCollector& collector, const CFrustum& frustum, bool culling)
+	{
+		PROFILE3("submit units");
+
+		size_t numUnits = m_Models.size();
+
+		m_VisibleEntities.clear();
+		m_HasRendered = true;
+
+		if (!culling)
+		{
+			for (size_t i = 0; i < numUnits; ++i)
+			{
+				if (m_Visible[i])
+				{
+					collector.SubmitRecursive(m_Models[i]);
+					m_VisibleEntities.push_back(m_Entities[i]);
+				}
+			}
+			return;
+		}
+
+		if (numUnits == 0)
+			return;
+
+		const CFrustum* shadowCasterFrustum = collector.GetShadowCasterFrustum();
+
+		m_InView.resize(numUnits);
+		m_InShadow.resize(numUnits);
+
+		{
+			PROFILE3("cull units");
+			CullJob job = { this, &collector, &frustum, shadowCasterFrustum };
+			if (g_ThreadPool)
+				g_ThreadPool->ParallelFor(numUnits, 256, &CullCallback, &job);
+			else
+				CullCallback(&job, 0, numUnits);
+		}
+
+		for (size_t i = 0; i < numUnits; ++i)
+		{
+			if (m_InView[i])
+			{
+				collector.SubmitRecursive(m_Models[i]);
+				m_VisibleEntities.push_back(m_Entities[i]);
+			}
+			else if (shadowCasterFrustum && m_InShadow[i])
+				collector.SubmitShadowCasterRecursive(m_Models[i]);
+		}
+	}
+};
+
+REGISTER_COMPONENT_TYPE(UnitRenderer)
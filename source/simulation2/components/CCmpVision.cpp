@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -22,8 +22,7 @@
 
 #include "simulation2/MessageTypes.h"
 #include "simulation2/components/ICmpOwnership.h"
-#include "simulation2/components/ICmpPlayerManager.h"
-#include "simulation2/components/ICmpTechnologyManager.h"
+#include "simulation2/components/ICmpTechnologyModificationCache.h"
 
 class CCmpVision : public ICmpVision
 {
@@ -89,22 +88,18 @@ public:
 				if (cmpOwnership)
 				{
 					player_id_t owner = cmpOwnership->GetOwner();
-					if (owner != INVALID_PLAYER && owner == msgData.player)
+					CmpPtr<ICmpTechnologyModificationCache> cmpModificationCache(GetSimContext(), SYSTEM_ENTITY);
+					if (owner != INVALID_PLAYER && owner == msgData.player && cmpModificationCache)
 					{
-						CmpPtr<ICmpPlayerManager> cmpPlayerManager(GetSimContext(), SYSTEM_ENTITY);
-						entity_id_t playerEnt = cmpPlayerManager->GetPlayerByID(owner);
-						CmpPtr<ICmpTechnologyManager> cmpTechnologyManager(GetSimContext(), playerEnt);
-						if (playerEnt != INVALID_ENTITY && cmpTechnologyManager)
+						// (The cache has already discarded this player's old results, since it handles the message first)
+						entity_pos_t newRange = cmpModificationCache->ApplyModifications(L"Vision/Range", m_BaseRange, GetEntityId());
+						if (newRange != m_Range)
 						{
-							entity_pos_t newRange = cmpTechnologyManager->ApplyModifications(L"Vision/Range", m_BaseRange, GetEntityId());
-							if (newRange != m_Range)
-							{
-								// Update our vision range and broadcast message
-								entity_pos_t oldRange = m_Range;
-								m_Range = newRange;
-								CMessageVisionRangeChanged msg(GetEntityId(), oldRange, newRange);
-								GetSimContext().GetComponentManager().BroadcastMessage(msg);
-							}
+							// Update our vision range and broadcast message
+							entity_pos_t oldRange = m_Range;
+							m_Range = newRange;
+							CMessageVisionRangeChanged msg(GetEntityId(), oldRange, newRange);
+							GetSimContext().GetComponentManager().BroadcastMessage(msg);
 						}
 					}
 				}
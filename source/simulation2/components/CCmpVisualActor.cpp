@@ -30,9 +30,9 @@
 #include "ICmpTemplateManager.h"
 #include "ICmpTerrain.h"
 #include "ICmpUnitMotion.h"
+#include "ICmpUnitRenderer.h"
 #include "ICmpVision.h"
 
-#include "graphics/Frustum.h"
 #include "graphics/Model.h"
 #include "graphics/ObjectBase.h"
 #include "graphics/ObjectEntry.h"
@@ -42,7 +42,6 @@
 #include "maths/Matrix3D.h"
 #include "maths/Vector3D.h"
 #include "ps/CLogger.h"
-#include "renderer/Scene.h"
 
 #include "tools/atlas/GameInterface/GameLoop.h"
 
@@ -53,7 +52,7 @@ public:
 	{
 		componentManager.SubscribeToMessageType(MT_Update_Final);
 		componentManager.SubscribeToMessageType(MT_Interpolate);
-		componentManager.SubscribeToMessageType(MT_RenderSubmit);
+		componentManager.SubscribeToMessageType(MT_InterpolateParallel);
 		componentManager.SubscribeToMessageType(MT_OwnershipChanged);
 		componentManager.SubscribeGloballyToMessageType(MT_TerrainChanged);
 	}
@@ -63,6 +62,10 @@ public:
 	std::wstring m_ActorName;
 	CUnit* m_Unit;
 
+	// Registration of m_Unit's model with the UnitRenderer, which culls and submits it
+	// (0 if not registered yet)
+	ICmpUnitRenderer::tag_t m_ModelTag;
+
 	fixed m_R, m_G, m_B; // shading colour
 
 	std::map<std::string, std::string> m_AnimOverride;
@@ -154,7 +157,9 @@ public:
 	virtual void Init(const CParamNode& paramNode)
 	{
 		m_PreviouslyRendered = false;
+		m_NeedsValidatePosition = false;
 		m_Unit = NULL;
+		m_ModelTag = 0;
 		m_Visibility = ICmpRangeManager::VIS_HIDDEN;
 		m_R = m_G = m_B = fixed::FromInt(1);
 
@@ -176,6 +181,8 @@ public:
 
 	virtual void Deinit()
 	{
+		RemoveFromUnitRenderer();
+
 		if (m_Unit)
 		{
 			GetSimContext().GetUnitManager().DeleteUnit(m_Unit);
@@ -267,10 +274,24 @@ public:
 			Interpolate(msgData.deltaSimTime, msgData.offset);
 			break;
 		}
-		case MT_RenderSubmit:
+		case MT_InterpolateParallel:
 		{
-			const CMessageRenderSubmit& msgData = static_cast<const CMessageRenderSubmit&> (msg);
-			RenderSubmit(msgData.collector, msgData.frustum, msgData.culling);
+			// (This is called from worker threads, so it mustn't touch anything outside this component,
+			// except for this unit's own entry in the UnitRenderer)
+			if (m_Unit && m_NeedsValidatePosition)
+			{
+				m_Unit->GetModel().ValidatePosition();
+				m_NeedsValidatePosition = false;
+			}
+			if (m_ModelTag)
+			{
+				CmpPtr<ICmpUnitRenderer> cmpUnitRenderer(GetSimContext(), SYSTEM_ENTITY);
+				if (cmpUnitRenderer)
+				{
+					bool visible = (m_Visibility != ICmpRangeManager::VIS_HIDDEN);
+					cmpUnitRenderer->UpdateUnit(m_ModelTag, visible, visible ? m_Unit->GetModel().GetWorldBoundsRec() : CBoundingBoxAligned::EMPTY);
+				}
+			}
 			break;
 		}
 		case MT_OwnershipChanged:
@@ -458,7 +479,9 @@ public:
 
 	virtual void Hotload(const VfsPath& name)
 	{
-		if (!m_Unit)
+		// (m_Unit might be NULL because the actor couldn't be loaded until now,
+		// e.g. since its meshes were still being converted)
+		if (!GetSimContext().HasUnitManager())
 			return;
 
 		if (name != m_ActorName)
@@ -473,6 +496,10 @@ private:
 	/// which may not occur immediately if the game starts paused.
 	bool m_PreviouslyRendered;
 
+	/// Whether the model's position needs to be validated in the parallel
+	/// interpolation phase (i.e. by MT_InterpolateParallel, before RenderSubmit).
+	bool m_NeedsValidatePosition;
+
 	/// Helper function shared by component init and actor reloading
 	void InitModel(const CParamNode& paramNode);
 
@@ -481,10 +508,11 @@ private:
 
 	void ReloadActor();
 
+	void RemoveFromUnitRenderer();
+
 	void Update(fixed turnLength);
 	void UpdateVisibility();
 	void Interpolate(float frameTime, float frameOffset);
-	void RenderSubmit(SceneCollector& collector, const CFrustum& frustum, bool culling);
 };
 
 REGISTER_COMPONENT_TYPE(VisualActor)
@@ -602,7 +630,7 @@ void CCmpVisualActor::InitSelectionShapeDescriptor(const CParamNode& paramNode)
 
 void CCmpVisualActor::ReloadActor()
 {
-	if (!m_Unit)
+	if (!GetSimContext().HasUnitManager())
 		return;
 
 	std::set<CStr> selections;
@@ -611,12 +639,28 @@ void CCmpVisualActor::ReloadActor()
 	if (!newUnit)
 		return;
 
-	// Save some data from the old unit
-	CColor shading = m_Unit->GetModel().GetShadingColor();
-	player_id_t playerID = m_Unit->GetModel().GetPlayerID();
+	// (InitModel creates the unit we'll actually use; this one was just to
+	// check that the actor can be loaded now)
+	GetSimContext().GetUnitManager().DeleteUnit(newUnit);
 
-	// Replace with the new unit
-	GetSimContext().GetUnitManager().DeleteUnit(m_Unit);
+	// Save some data from the old unit, if there was one
+	CColor shading(m_R.ToFloat(), m_G.ToFloat(), m_B.ToFloat(), 1.0f);
+	player_id_t playerID = INVALID_PLAYER;
+	if (m_Unit)
+	{
+		shading = m_Unit->GetModel().GetShadingColor();
+		playerID = m_Unit->GetModel().GetPlayerID();
+
+		// Replace with the new unit
+		RemoveFromUnitRenderer();
+		GetSimContext().GetUnitManager().DeleteUnit(m_Unit);
+	}
+	else
+	{
+		CmpPtr<ICmpOwnership> cmpOwnership(GetSimContext(), GetEntityId());
+		if (cmpOwnership)
+			playerID = cmpOwnership->GetOwner();
+	}
 
 	// HACK: selection shape needs template data, but rather than storing all that data
 	//	in the component, we load the template here and pass it into a helper function
@@ -721,11 +765,31 @@ void CCmpVisualActor::UpdateVisibility()
 	}
 }
 
+void CCmpVisualActor::RemoveFromUnitRenderer()
+{
+	if (!m_ModelTag)
+		return;
+
+	CmpPtr<ICmpUnitRenderer> cmpUnitRenderer(GetSimContext(), SYSTEM_ENTITY);
+	if (cmpUnitRenderer)
+		cmpUnitRenderer->RemoveUnit(m_ModelTag);
+	m_ModelTag = 0;
+}
+
 void CCmpVisualActor::Interpolate(float frameTime, float frameOffset)
 {
 	if (m_Unit == NULL)
 		return;
 
+	// Register lazily, since the UnitRenderer might not exist yet when this
+	// component is initialised or deserialized
+	if (!m_ModelTag)
+	{
+		CmpPtr<ICmpUnitRenderer> cmpUnitRenderer(GetSimContext(), SYSTEM_ENTITY);
+		if (cmpUnitRenderer)
+			m_ModelTag = cmpUnitRenderer->AddUnit(&m_Unit->GetModel(), GetEntityId());
+	}
+
 	// Disable rendering of the unit if it has no position
 	CmpPtr<ICmpPosition> cmpPosition(GetSimContext(), GetEntityId());
 	if (!cmpPosition || !cmpPosition->IsInWorld())
@@ -780,26 +844,12 @@ void CCmpVisualActor::Interpolate(float frameTime, float frameOffset)
 	model.SetTransform(transform);
 	m_Unit->UpdateModel(frameTime);
 
-	// If not hidden, then we need to set up some extra state for rendering
+	// If not hidden, then we need to set up some extra state for rendering.
+	// Computing the bone matrices is the expensive part, and only depends on this
+	// model, so it's deferred to MT_InterpolateParallel to run on the worker threads
 	if (m_Visibility != ICmpRangeManager::VIS_HIDDEN)
 	{
-		model.ValidatePosition();
+		m_NeedsValidatePosition = true;
 		model.SetShadingColor(CColor(m_R.ToFloat(), m_G.ToFloat(), m_B.ToFloat(), 1.0f));
 	}
 }
-
-void CCmpVisualActor::RenderSubmit(SceneCollector& collector, const CFrustum& frustum, bool culling)
-{
-	if (m_Unit == NULL)
-		return;
-
-	if (m_Visibility == ICmpRangeManager::VIS_HIDDEN)
-		return;
-
-	CModelAbstract& model = m_Unit->GetModel();
-
-	if (culling && !frustum.IsBoxVisible(CVector3D(0, 0, 0), model.GetWorldBoundsRec()))
-		return;
-
-	collector.SubmitRecursive(&model);
-}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -28,6 +28,7 @@ BEGIN_INTERFACE_WRAPPER(AIManager)
 DEFINE_INTERFACE_METHOD_2("AddPlayer", void, ICmpAIManager, AddPlayer, std::wstring, player_id_t)
 DEFINE_INTERFACE_METHOD_0("TryLoadSharedComponent", void, ICmpAIManager, TryLoadSharedComponent)
 DEFINE_INTERFACE_METHOD_0("RunGamestateInit", void, ICmpAIManager, RunGamestateInit)
+DEFINE_INTERFACE_METHOD_2("SetComputeSchedule", void, ICmpAIManager, SetComputeSchedule, u32, bool)
 END_INTERFACE_WRAPPER(AIManager)
 
 // Implement the static method that finds all AI scripts
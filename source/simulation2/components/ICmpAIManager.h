@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -36,16 +36,26 @@ public:
 
 	/**
 	 * Call this at the end of a turn, to trigger AI computation which will be
-	 * ready for the next turn.
+	 * ready for the next turn (or the one after, if pipelined). Does nothing
+	 * on turns that aren't a multiple of the compute interval.
 	 */
 	virtual void StartComputation() = 0;
 
 	/**
-	 * Call this at the start of a turn, to push the computed AI commands into
-	 * the command queue.
+	 * Call this at the start of a turn, to push the AI commands that are due
+	 * this turn into the command queue.
 	 */
 	virtual void PushCommands() = 0;
 
+	/**
+	 * Makes the AI players compute only every @p interval turns, and if
+	 * @p pipelined, gives them a whole extra turn to compute (their commands are
+	 * pushed two turns after the state they saw, instead of one) so the
+	 * simulation rarely has to wait for them. This is part of the simulation
+	 * state, so it must be set identically on every client (e.g. from the game setup).
+	 */
+	virtual void SetComputeSchedule(u32 interval, bool pipelined) = 0;
+
 	/**
 	 * Returns a vector of {"id":"value-for-AddPlayer", "name":"Human readable name"}
 	 * objects, based on all the available AI scripts.
@@ -0,0 +1,30 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "ICmpFormationController.h"
+
+#include "simulation2/system/InterfaceScripted.h"
+
+BEGIN_INTERFACE_WRAPPER(FormationController)
+DEFINE_INTERFACE_METHOD_3("SetMemberOffset", void, ICmpFormationController, SetMemberOffset, entity_id_t, entity_pos_t, entity_pos_t)
+DEFINE_INTERFACE_METHOD_1("RemoveMember", void, ICmpFormationController, RemoveMember, entity_id_t)
+DEFINE_INTERFACE_METHOD_0("RemoveAllMembers", void, ICmpFormationController, RemoveAllMembers)
+DEFINE_INTERFACE_METHOD_0("GetMembers", std::vector<entity_id_t>, ICmpFormationController, GetMembers)
+DEFINE_INTERFACE_METHOD_1("GetMemberOffset", CFixedVector2D, ICmpFormationController, GetMemberOffset, entity_id_t)
+END_INTERFACE_WRAPPER(FormationController)
@@ -0,0 +1,70 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_ICMPFORMATIONCONTROLLER
+#define INCLUDED_ICMPFORMATIONCONTROLLER
+
+#include "simulation2/system/Interface.h"
+
+#include "simulation2/helpers/Position.h"
+#include "maths/FixedVector2D.h"
+
+/**
+ * Drives the members of a formation, from the formation controller entity
+ * (which also has a UnitMotion with FormationController set, so it computes
+ * the one long path that the whole formation follows).
+ *
+ * Each turn, once the controller has moved, this computes every member's
+ * target point from its offset in one batch and passes them to the members'
+ * UnitMotion (see ICmpUnitMotion::SetFormationTarget), so the members don't
+ * each have to look up and transform the controller's position themselves.
+ */
+class ICmpFormationController : public IComponent
+{
+public:
+	/**
+	 * Add a member to the formation (or change an existing member's offset),
+	 * and make it start following the formation at the given offset
+	 * (relative to the controller's position and rotation).
+	 */
+	virtual void SetMemberOffset(entity_id_t ent, entity_pos_t x, entity_pos_t z) = 0;
+
+	/**
+	 * Stop updating the given member. This doesn't change what the unit is
+	 * doing, so the caller should give it a new order.
+	 */
+	virtual void RemoveMember(entity_id_t ent) = 0;
+
+	/**
+	 * Stop updating all members.
+	 */
+	virtual void RemoveAllMembers() = 0;
+
+	/**
+	 * Returns the members, in the order they were added.
+	 */
+	virtual std::vector<entity_id_t> GetMembers() = 0;
+
+	/**
+	 * Returns the given member's offset, or a zero vector if it's not a member.
+	 */
+	virtual CFixedVector2D GetMemberOffset(entity_id_t ent) = 0;
+
+	DECLARE_INTERFACE_TYPE(FormationController)
+};
+
+#endif // INCLUDED_ICMPFORMATIONCONTROLLER
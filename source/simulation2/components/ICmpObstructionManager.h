@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -220,11 +220,14 @@ public:
 	 * tiles that are intersected by a foundation-blocking shape will also have TILE_OBSTRUCTED_FOUNDATION;
 	 * tiles that are outside the world bounds will also have TILE_OUTOFBOUNDS;
 	 * others will be set to 0.
-	 * This is very cheap if the grid has been rasterised before and the set of shapes has not changed.
+	 * This is very cheap if the grid has been rasterised before and the set of shapes has not changed,
+	 * and only recomputes the tiles near changed shapes if it was rasterised recently.
 	 * @param grid the grid to be updated
+	 * @param dirtyRegion if non-NULL, will be set to the region of the grid that was recomputed
+	 *   (tiles outside it are unchanged; tiles inside it might not have changed either)
 	 * @return true if any changes were made to the grid, false if it was already up-to-date
 	 */
-	virtual bool Rasterise(Grid<u8>& grid) = 0;
+	virtual bool Rasterise(Grid<u8>& grid, GridDirtyRegion* dirtyRegion = NULL) = 0;
 
 	/**
 	 * Standard representation for all types of shapes, for use with geometry processing code.
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -22,5 +22,7 @@
 #include "simulation2/system/InterfaceScripted.h"
 
 BEGIN_INTERFACE_WRAPPER(Pathfinder)
+DEFINE_INTERFACE_METHOD_3("GetConnectivityRegion", u32, ICmpPathfinder, GetConnectivityRegion, entity_pos_t, entity_pos_t, ICmpPathfinder::pass_class_t)
+DEFINE_INTERFACE_METHOD_5("IsReachable", bool, ICmpPathfinder, IsReachable, entity_pos_t, entity_pos_t, entity_pos_t, entity_pos_t, ICmpPathfinder::pass_class_t)
 DEFINE_INTERFACE_METHOD_1("SetDebugOverlay", void, ICmpPathfinder, SetDebugOverlay, bool)
 END_INTERFACE_WRAPPER(Pathfinder)
@@ -31,6 +31,7 @@
 class IObstructionTestFilter;
 
 template<typename T> class Grid;
+struct GridDirtyRegion;
 
 /**
  * Pathfinder algorithms.
@@ -96,6 +97,30 @@ public:
 
 	virtual const Grid<u16>& GetPassabilityGrid() = 0;
 
+	/**
+	 * Get the region of the passability grid that has changed since it had the given
+	 * m_DirtyID, so that copies of the grid can be updated without copying all of it.
+	 * @param dirtyID the m_DirtyID of the copy
+	 * @param region set to the changed region (which is empty if nothing changed)
+	 * @return false if the changes aren't known and the whole grid must be considered changed
+	 */
+	virtual bool GetPassabilityGridChanges(size_t dirtyID, GridDirtyRegion& region) = 0;
+
+	/**
+	 * Returns an ID for the connected area of passable terrain (e.g. a landmass for
+	 * land units, or a body of water for ships) containing the given point,
+	 * or 0 if the point is impassable for the given class.
+	 * Two points with the same nonzero ID are reachable from each other.
+	 */
+	virtual u32 GetConnectivityRegion(entity_pos_t x, entity_pos_t z, pass_class_t passClass) = 0;
+
+	/**
+	 * Returns whether a unit of the given passability class could move from the first
+	 * point to the second, without doing a path search.
+	 * (Obstructions that aren't part of the passability grid, like units, are ignored.)
+	 */
+	virtual bool IsReachable(entity_pos_t x0, entity_pos_t z0, entity_pos_t x1, entity_pos_t z1, pass_class_t passClass) = 0;
+
 	/**
 	 * Compute a tile-based path from the given point to the goal, and return the set of waypoints.
 	 * The waypoints correspond to the centers of horizontally/vertically adjacent tiles
@@ -176,6 +201,13 @@ public:
 	 */
 	virtual void FinishAsyncRequests() = 0;
 
+	/**
+	 * Returns whether the given pending long path request was deferred to a later
+	 * turn because the per-turn pathfinding budget was used up. The result is
+	 * meaningless for requests that have already completed.
+	 */
+	virtual bool IsPathRequestDeferred(u32 ticket) = 0;
+
 	/**
 	 * Process moves during the same turn they were created in to improve responsiveness.
 	 */
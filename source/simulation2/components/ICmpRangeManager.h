@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -19,6 +19,7 @@
 #define INCLUDED_ICMPRANGEMANAGER
 
 #include "simulation2/system/Interface.h"
+#include "simulation2/helpers/Grid.h"
 #include "simulation2/helpers/Position.h"
 #include "simulation2/helpers/Player.h"
 
@@ -267,6 +268,21 @@ public:
 	 */
 	virtual CLosQuerier GetLosQuerier(player_id_t player) = 0;
 
+	/**
+	 * Returns the region of vertexes whose LOS state for the given player (or other players
+	 * it shares LOS with) may have changed since the last call, and resets it.
+	 * This does not detect changes to the reveal-all flag or shared LOS players.
+	 * (Used by the renderer to avoid recomputing the whole LOS texture every turn.)
+	 */
+	virtual GridDirtyRegion GetLosDirtyRegion(player_id_t player) = 0;
+
+	/**
+	 * Returns whether any entity's position, owner or LOS visibility (for any player)
+	 * may have changed since the last call with the same @p dirtyID, and updates it.
+	 * (Used by the minimap to avoid rebuilding its unit markers when nothing has changed.)
+	 */
+	virtual bool NeedVisibilityUpdate(size_t* dirtyID) = 0;
+
 	/**
 	 * Returns the visibility status of the given entity, with respect to the given player.
 	 * Returns VIS_HIDDEN if the entity doesn't exist or is not in the world.
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -28,6 +28,9 @@ class ICmpSoundManager : public IComponent
 public:
 	/**
 	 * Start playing audio defined by a sound group file.
+	 * The sound is started on the next frame, competing with the other requested
+	 * sounds for the available voices; it may be dropped if it can't be heard,
+	 * or if the group has played many sounds recently.
 	 * @param name VFS path of sound group .xml, relative to audio/
 	 * @param source entity emitting the sound (used for positioning)
 	 */
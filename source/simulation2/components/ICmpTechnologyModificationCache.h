@@ -0,0 +1,48 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_ICMPTECHNOLOGYMODIFICATIONCACHE
+#define INCLUDED_ICMPTECHNOLOGYMODIFICATIONCACHE
+
+#include "simulation2/system/Interface.h"
+
+#include "maths/Fixed.h"
+
+/**
+ * Caches the results of the entity owners' ICmpTechnologyManager::ApplyModifications,
+ * so that reading a modified value of many entities with the same template (and owner)
+ * only has to go through the technology manager's script once.
+ *
+ * Results are cached by (owner, value name, template name, current value), so ownership
+ * changes don't need to invalidate anything; a player's results are discarded whenever
+ * MT_TechnologyModification is sent for them. This relies on the technology manager's
+ * modifications only changing when it sends that message.
+ *
+ * Entities without an owner (or whose owner has no technology manager) get their
+ * current value unchanged.
+ */
+class ICmpTechnologyModificationCache : public IComponent
+{
+public:
+	virtual fixed ApplyModifications(std::wstring valueName, fixed currentValue, entity_id_t entity) = 0;
+	virtual u32 ApplyModifications(std::wstring valueName, u32 currentValue, entity_id_t entity) = 0;
+	virtual double ApplyModifications(std::wstring valueName, double currentValue, entity_id_t entity) = 0;
+
+	DECLARE_INTERFACE_TYPE(TechnologyModificationCache)
+};
+
+#endif // INCLUDED_ICMPTECHNOLOGYMODIFICATIONCACHE
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -37,6 +37,18 @@ public:
 
 	virtual float GetExactGroundLevel(float x, float z) = 0;
 
+	/**
+	 * Computes GetGroundLevel for each of the @p count points (x[n], z[n]).
+	 * This avoids a virtual call per point when there are many at once.
+	 */
+	virtual void GetGroundLevels(size_t count, const entity_pos_t* x, const entity_pos_t* z, entity_pos_t* heights) = 0;
+
+	/**
+	 * Computes GetExactGroundLevel for each of the @p count points (x[n], z[n]).
+	 * This avoids a virtual call per point when there are many at once.
+	 */
+	virtual void GetExactGroundLevels(size_t count, const float* x, const float* z, float* heights) = 0;
+
 	/**
 	 * Returns number of tiles per side on the terrain.
 	 * Return value is always non-zero.
@@ -65,6 +77,13 @@ public:
 	 */
 	virtual void MakeDirty(i32 i0, i32 j0, i32 i1, i32 j1) = 0;
 
+	/**
+	 * Returns whether MakeDirty has been called since the last call with the same
+	 * @p dirtyID, and updates it. (Used by renderers that don't receive messages,
+	 * e.g. the minimap.)
+	 */
+	virtual bool NeedUpdate(size_t* dirtyID) = 0;
+
 	DECLARE_INTERFACE_TYPE(Terrain)
 };
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -40,6 +40,15 @@ public:
 	 */
 	virtual const Grid<u8>& GetTerritoryGrid() = 0;
 
+	/**
+	 * Get the rectangle of tiles (from (i0,j0) to (i1,j1) inclusive) that may have changed
+	 * since GetTerritoryGrid was used by a caller that had been given @p dirtyID by NeedUpdate,
+	 * so the caller can update just that part of anything it derived from the grid.
+	 * Returns false if nothing has changed. The whole grid is returned if the changes
+	 * aren't known (e.g. the first time, or if the caller hasn't updated for a long time).
+	 */
+	virtual bool GetChangedTiles(size_t dirtyID, u16& i0, u16& j0, u16& i1, u16& j1) = 0;
+
 	/**
 	 * Get owner of territory at given position.
 	 * @return player ID of owner; 0 if neutral territory
@@ -0,0 +1,74 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "ICmpTimer.h"
+
+#include "simulation2/system/InterfaceScripted.h"
+#include "simulation2/scripting/ScriptComponent.h"
+
+BEGIN_INTERFACE_WRAPPER(Timer)
+DEFINE_INTERFACE_METHOD_0("GetTime", u32, ICmpTimer, GetTime)
+DEFINE_INTERFACE_METHOD_0("GetLatestTurnLength", u32, ICmpTimer, GetLatestTurnLength)
+DEFINE_INTERFACE_METHOD_5("SetTimeout", u32, ICmpTimer, SetTimeout, entity_id_t, int, std::string, u32, CScriptVal)
+DEFINE_INTERFACE_METHOD_6("SetInterval", u32, ICmpTimer, SetInterval, entity_id_t, int, std::string, u32, u32, CScriptVal)
+DEFINE_INTERFACE_METHOD_2("UpdateRepeatTime", void, ICmpTimer, UpdateRepeatTime, u32, u32)
+DEFINE_INTERFACE_METHOD_1("CancelTimer", void, ICmpTimer, CancelTimer, u32)
+END_INTERFACE_WRAPPER(Timer)
+
+/**
+ * Wrapper for script components that implement ICmpTimer, e.g. a mod's Timer
+ * that replaces the native one (see CComponentManager::Script_RegisterComponentType).
+ */
+class CCmpTimerScripted : public ICmpTimer
+{
+public:
+	DEFAULT_SCRIPT_WRAPPER(TimerScripted)
+
+	virtual u32 GetTime()
+	{
+		return m_Script.Call<u32>("GetTime");
+	}
+
+	virtual u32 GetLatestTurnLength()
+	{
+		return m_Script.Call<u32>("GetLatestTurnLength");
+	}
+
+	virtual u32 SetTimeout(entity_id_t ent, int iid, std::string funcname, u32 time, CScriptVal data)
+	{
+		return m_Script.Call<u32>("SetTimeout", ent, iid, funcname, time, data);
+	}
+
+	virtual u32 SetInterval(entity_id_t ent, int iid, std::string funcname, u32 time, u32 repeattime, CScriptVal data)
+	{
+		return m_Script.Call<u32>("SetInterval", ent, iid, funcname, time, repeattime, data);
+	}
+
+	virtual void UpdateRepeatTime(u32 id, u32 repeattime)
+	{
+		m_Script.CallVoid("UpdateRepeatTime", id, repeattime);
+	}
+
+	virtual void CancelTimer(u32 id)
+	{
+		m_Script.CallVoid("CancelTimer", id);
+	}
+};
+
+REGISTER_COMPONENT_SCRIPT_WRAPPER(TimerScripted)
@@ -0,0 +1,75 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_ICMPTIMER
+#define INCLUDED_ICMPTIMER
+
+#include "simulation2/system/Interface.h"
+
+/**
+ * Timers that call methods of script components after some simulation time,
+ * optionally repeating.
+ * Times are in milliseconds of simulation time, since the start of the game.
+ *
+ * All the timers that have expired by the end of a turn's MT_Update are run in
+ * the order they were created (not in order of expiry time), each calling
+ * cmp[funcname](data, lateness) where cmp is Engine.QueryInterface(ent, iid) and
+ * lateness is how many milliseconds after the expiry time it was called.
+ * Timers set by the callbacks won't run until the next turn, even if they've already expired.
+ * Timers whose component no longer exists are cancelled silently.
+ */
+class ICmpTimer : public IComponent
+{
+public:
+	/**
+	 * Returns the time since the start of the game, in milliseconds.
+	 */
+	virtual u32 GetTime() = 0;
+
+	/**
+	 * Returns the duration of the most recent turn, in milliseconds.
+	 */
+	virtual u32 GetLatestTurnLength() = 0;
+
+	/**
+	 * Sets a timer that runs once, @p time milliseconds from now.
+	 * @return ID that can be passed to CancelTimer (IDs are never 0).
+	 */
+	virtual u32 SetTimeout(entity_id_t ent, int iid, std::string funcname, u32 time, CScriptVal data) = 0;
+
+	/**
+	 * Sets a timer that runs @p time milliseconds from now, and then every
+	 * @p repeattime milliseconds until it's cancelled.
+	 * @return ID that can be passed to CancelTimer (IDs are never 0).
+	 */
+	virtual u32 SetInterval(entity_id_t ent, int iid, std::string funcname, u32 time, u32 repeattime, CScriptVal data) = 0;
+
+	/**
+	 * Changes the interval of a repeating timer, from its next repetition onwards.
+	 */
+	virtual void UpdateRepeatTime(u32 id, u32 repeattime) = 0;
+
+	/**
+	 * Cancels a timer. Has no effect if the timer has already run (and doesn't
+	 * repeat), or has already been cancelled.
+	 */
+	virtual void CancelTimer(u32 id) = 0;
+
+	DECLARE_INTERFACE_TYPE(Timer)
+};
+
+#endif // INCLUDED_ICMPTIMER
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -69,6 +69,11 @@ public:
 		m_Script.CallVoid("MoveToFormationOffset", target, x, z);
 	}
 
+	virtual void SetFormationTarget(entity_id_t controller, entity_pos_t x, entity_pos_t z)
+	{
+		m_Script.CallVoid("SetFormationTarget", controller, x, z);
+	}
+
 	virtual void FaceTowardsPoint(entity_pos_t x, entity_pos_t z)
 	{
 		m_Script.CallVoid("FaceTowardsPoint", x, z);
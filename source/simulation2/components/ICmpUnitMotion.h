@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -74,6 +74,14 @@ public:
 	 */
 	virtual void MoveToFormationOffset(entity_id_t target, entity_pos_t x, entity_pos_t z) = 0;
 
+	/**
+	 * Tell a formation member where its offset target is for this turn, so it doesn't
+	 * have to compute that itself. Called by the formation controller (ICmpFormationController)
+	 * once the controller has moved, for all its members in one batch.
+	 * Ignored unless the unit is following the given controller's formation.
+	 */
+	virtual void SetFormationTarget(entity_id_t controller, entity_pos_t x, entity_pos_t z) = 0;
+
 	/**
 	 * Turn to look towards the given point.
 	 */
@@ -0,0 +1,71 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_ICMPUNITRENDERER
+#define INCLUDED_ICMPUNITRENDERER
+
+#include "simulation2/system/Interface.h"
+
+class CBoundingBoxAligned;
+class CModelAbstract;
+
+/**
+ * Keeps the world-space bounds of every unit model in flat arrays, so that
+ * RenderSubmit can frustum-cull them all at once (with SIMD, on the worker threads)
+ * and submit the visible ones to the scene collector in bulk, instead of each
+ * VisualActor testing its own model.
+ *
+ * The entities that were in view are remembered until the next frame, so that
+ * picking can test just those instead of every selectable entity.
+ */
+class ICmpUnitRenderer : public IComponent
+{
+public:
+	/// Handle for a registered unit; 0 is never a valid tag
+	typedef u32 tag_t;
+
+	/**
+	 * Register a model, belonging to the given entity, to be culled and submitted
+	 * for rendering. It won't be rendered until UpdateUnit has been called.
+	 */
+	virtual tag_t AddUnit(CModelAbstract* model, entity_id_t entity) = 0;
+
+	/**
+	 * Unregister a model (e.g. before it's deleted).
+	 */
+	virtual void RemoveUnit(tag_t tag) = 0;
+
+	/**
+	 * Set whether the unit should be rendered, and its recursive world-space bounds.
+	 * Unlike the other methods, this can be called concurrently for different tags
+	 * (from MT_InterpolateParallel).
+	 */
+	virtual void UpdateUnit(tag_t tag, bool visible, const CBoundingBoxAligned& bounds) = 0;
+
+	/**
+	 * Returns the entities whose models were in view (or were rendered at all, if
+	 * culling was disabled) when the last frame was drawn, in no particular order.
+	 * This may include entities that have since been destroyed, and won't include
+	 * ones that only came into view after that frame.
+	 * Returns NULL if nothing has been rendered yet.
+	 */
+	virtual const std::vector<entity_id_t>* GetVisibleEntities() = 0;
+
+	DECLARE_INTERFACE_TYPE(UnitRenderer)
+};
+
+#endif // INCLUDED_ICMPUNITRENDERER
@@ -0,0 +1,156 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "simulation2/system/ComponentTest.h"
+
+#include "simulation2/MessageTypes.h"
+#include "simulation2/components/ICmpFormationController.h"
+#include "simulation2/components/ICmpPosition.h"
+#include "simulation2/components/ICmpUnitMotion.h"
+
+class MockFormationPosition : public ICmpPosition
+{
+public:
+	DEFAULT_MOCK_COMPONENT()
+
+	CFixedVector2D m_Pos;
+	entity_angle_t m_RotY;
+
+	virtual bool IsInWorld() { return true; }
+	virtual void MoveOutOfWorld() { }
+	virtual void MoveTo(entity_pos_t UNUSED(x), entity_pos_t UNUSED(z)) { }
+	virtual void JumpTo(entity_pos_t UNUSED(x), entity_pos_t UNUSED(z)) { }
+	virtual void SetHeightOffset(entity_pos_t UNUSED(dy)) { }
+	virtual entity_pos_t GetHeightOffset() { return entity_pos_t::Zero(); }
+	virtual void SetHeightFixed(entity_pos_t UNUSED(y)) { }
+	virtual bool IsFloating() { return false; }
+	virtual CFixedVector3D GetPosition() { return CFixedVector3D(m_Pos.X, entity_pos_t::Zero(), m_Pos.Y); }
+	virtual CFixedVector2D GetPosition2D() { return m_Pos; }
+	virtual CFixedVector3D GetPreviousPosition() { return GetPosition(); }
+	virtual CFixedVector2D GetPreviousPosition2D() { return m_Pos; }
+	virtual void TurnTo(entity_angle_t UNUSED(y)) { }
+	virtual void SetYRotation(entity_angle_t UNUSED(y)) { }
+	virtual void SetXZRotation(entity_angle_t UNUSED(x), entity_angle_t UNUSED(z)) { }
+	virtual CFixedVector3D GetRotation() { return CFixedVector3D(entity_angle_t::Zero(), m_RotY, entity_angle_t::Zero()); }
+	virtual fixed GetDistanceTravelled() { return fixed::Zero(); }
+	virtual void GetInterpolatedPosition2D(float UNUSED(frameOffset), float& x, float& z, float& rotY) { x = z = rotY = 0; }
+	virtual CMatrix3D GetInterpolatedTransform(float UNUSED(frameOffset), bool UNUSED(forceFloating)) { return CMatrix3D(); }
+	virtual bool GetReinterpolate() { return true; }
+};
+
+/**
+ * Records what the formation controller asks the member to do.
+ */
+class MockFormationMember : public ICmpUnitMotion
+{
+public:
+	DEFAULT_MOCK_COMPONENT()
+
+	MockFormationMember() : m_Controller(INVALID_ENTITY), m_TargetUpdates(0) { }
+
+	virtual bool MoveToPointRange(entity_pos_t UNUSED(x), entity_pos_t UNUSED(z), entity_pos_t UNUSED(minRange), entity_pos_t UNUSED(maxRange)) { return false; }
+	virtual bool IsInPointRange(entity_pos_t UNUSED(x), entity_pos_t UNUSED(z), entity_pos_t UNUSED(minRange), entity_pos_t UNUSED(maxRange)) { return false; }
+	virtual bool IsInTargetRange(entity_id_t UNUSED(target), entity_pos_t UNUSED(minRange), entity_pos_t UNUSED(maxRange)) { return false; }
+	virtual bool MoveToTargetRange(entity_id_t UNUSED(target), entity_pos_t UNUSED(minRange), entity_pos_t UNUSED(maxRange)) { return false; }
+	virtual void MoveToFormationOffset(entity_id_t target, entity_pos_t x, entity_pos_t z) { m_Controller = target; m_Offset = CFixedVector2D(x, z); }
+	virtual void SetFormationTarget(entity_id_t controller, entity_pos_t x, entity_pos_t z)
+	{
+		TS_ASSERT_EQUALS(controller, m_Controller);
+		m_Target = CFixedVector2D(x, z);
+		++m_TargetUpdates;
+	}
+	virtual void FaceTowardsPoint(entity_pos_t UNUSED(x), entity_pos_t UNUSED(z)) { }
+	virtual void StopMoving() { }
+	virtual fixed GetCurrentSpeed() { return fixed::Zero(); }
+	virtual void SetSpeed(fixed UNUSED(speed)) { }
+	virtual bool IsMoving() { return false; }
+	virtual fixed GetWalkSpeed() { return fixed::Zero(); }
+	virtual fixed GetRunSpeed() { return fixed::Zero(); }
+	virtual ICmpPathfinder::pass_class_t GetPassabilityClass() { return 0; }
+	virtual void SetUnitRadius(fixed UNUSED(radius)) { }
+	virtual void SetDebugOverlay(bool UNUSED(enabled)) { }
+
+	entity_id_t m_Controller;
+	CFixedVector2D m_Offset;
+	CFixedVector2D m_Target;
+	int m_TargetUpdates;
+};
+
+class TestCmpFormationController : public CxxTest::TestSuite
+{
+public:
+	void setUp()
+	{
+		CXeromyces::Startup();
+	}
+
+	void tearDown()
+	{
+		CXeromyces::Terminate();
+	}
+
+	void test_members()
+	{
+		ComponentTestHelper test;
+
+		const entity_id_t controller = 10;
+		MockFormationPosition position;
+		position.m_Pos = CFixedVector2D(fixed::FromInt(100), fixed::FromInt(200));
+		position.m_RotY = fixed::FromInt(1);
+		test.AddMock(controller, IID_Position, position);
+
+		MockFormationMember member1, member2, member3;
+		test.AddMock(11, IID_UnitMotion, member1);
+		test.AddMock(12, IID_UnitMotion, member2);
+		test.AddMock(13, IID_UnitMotion, member3);
+
+		ICmpFormationController* cmp = test.Add<ICmpFormationController>(CID_FormationController, "", controller);
+
+		cmp->SetMemberOffset(11, fixed::FromInt(4), fixed::FromInt(-2));
+		cmp->SetMemberOffset(12, fixed::Zero(), fixed::Zero());
+		cmp->SetMemberOffset(13, fixed::FromInt(1), fixed::FromInt(1));
+		cmp->SetMemberOffset(13, fixed::FromInt(-3), fixed::FromInt(5));
+
+		// Members are told to join the formation when they're added
+		TS_ASSERT_EQUALS(member1.m_Controller, controller);
+		TS_ASSERT_EQUALS(member3.m_Offset, CFixedVector2D(fixed::FromInt(-3), fixed::FromInt(5)));
+
+		std::vector<entity_id_t> members = cmp->GetMembers();
+		TS_ASSERT_EQUALS(members.size(), (size_t)3);
+		TS_ASSERT_EQUALS(members[0], (entity_id_t)11);
+		TS_ASSERT_EQUALS(members[2], (entity_id_t)13);
+		TS_ASSERT_EQUALS(cmp->GetMemberOffset(13), CFixedVector2D(fixed::FromInt(-3), fixed::FromInt(5)));
+
+		test.Roundtrip();
+
+		// The targets must match what the members would compute from their offsets
+		test.HandleMessage(cmp, CMessageUpdate_MotionFormation(fixed::FromInt(1)/5), false);
+		TS_ASSERT_EQUALS(member1.m_Target, position.m_Pos + member1.m_Offset.Rotate(position.m_RotY));
+		TS_ASSERT_EQUALS(member2.m_Target, position.m_Pos);
+		TS_ASSERT_EQUALS(member3.m_Target, position.m_Pos + member3.m_Offset.Rotate(position.m_RotY));
+
+		cmp->RemoveMember(12);
+		test.HandleMessage(cmp, CMessageUpdate_MotionFormation(fixed::FromInt(1)/5), false);
+		TS_ASSERT_EQUALS(member1.m_TargetUpdates, 2);
+		TS_ASSERT_EQUALS(member2.m_TargetUpdates, 1);
+		TS_ASSERT_EQUALS(cmp->GetMembers().size(), (size_t)2);
+		TS_ASSERT_EQUALS(cmp->GetMemberOffset(12), CFixedVector2D());
+
+		cmp->RemoveAllMembers();
+		TS_ASSERT(cmp->GetMembers().empty());
+	}
+};
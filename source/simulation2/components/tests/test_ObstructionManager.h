@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -18,6 +18,9 @@
 #include "simulation2/system/ComponentTest.h"
 
 #include "simulation2/components/ICmpObstructionManager.h"
+#include "simulation2/helpers/Grid.h"
+
+#include "ps/ThreadPool.h"
 
 class TestCmpObstructionManager : public CxxTest::TestSuite
 {
@@ -474,4 +477,80 @@ public:
 		TS_ASSERT_EQUALS(obSquare3.u, CFixedVector2D(fixed::FromInt(1), fixed::FromInt(0)));
 		TS_ASSERT_EQUALS(obSquare3.v, CFixedVector2D(fixed::FromInt(0), fixed::FromInt(1)));
 	}
+
+	/**
+	 * Verifies that incrementally rasterising a grid after some changes gives the same
+	 * result as rasterising it from scratch, and only updates the affected tiles.
+	 */
+	void test_rasterise_incremental()
+	{
+		Grid<u8> grid(250, 250);
+		TS_ASSERT(cmp->Rasterise(grid));
+		TS_ASSERT(!cmp->Rasterise(grid));
+
+		tag_t shape4 = cmp->AddStaticShape(4, fixed::FromInt(100), fixed::FromInt(100), fixed::FromFloat(0.5f), fixed::FromInt(12), fixed::FromInt(8),
+			ICmpObstructionManager::FLAG_BLOCK_PATHFINDING | ICmpObstructionManager::FLAG_BLOCK_FOUNDATION, 4);
+		tag_t shape5 = cmp->AddUnitShape(5, fixed::FromInt(300), fixed::FromInt(200), fixed::FromInt(2),
+			ICmpObstructionManager::FLAG_BLOCK_PATHFINDING, 5);
+
+		GridDirtyRegion region;
+		TS_ASSERT(cmp->Rasterise(grid, &region));
+		TS_ASSERT(!region.IsEmpty());
+		TS_ASSERT_LESS_THAN(region.i0, 100/4);
+		TS_ASSERT_LESS_THAN(300/4, region.i1);
+		TS_ASSERT_LESS_THAN(region.i1, 249);
+		AssertGridsEqual(grid);
+
+		cmp->MoveShape(shape4, fixed::FromInt(120), fixed::FromInt(90), fixed::Zero());
+		cmp->MoveShape(shape5, fixed::FromInt(310), fixed::FromInt(205), fixed::Zero());
+		TS_ASSERT(cmp->Rasterise(grid, &region));
+		AssertGridsEqual(grid);
+
+		cmp->RemoveShape(shape4);
+		TS_ASSERT(cmp->Rasterise(grid, &region));
+		TS_ASSERT_LESS_THAN(region.i1, 300/4);
+		AssertGridsEqual(grid);
+	}
+
+	/**
+	 * Verifies that rasterising bands of the grid in parallel gives the same result as
+	 * doing the whole grid on one thread.
+	 */
+	void test_rasterise_parallel()
+	{
+		for (int n = 0; n < 200; ++n)
+		{
+			entity_pos_t x = entity_pos_t::FromInt((n * 397) % 1000);
+			entity_pos_t z = entity_pos_t::FromInt((n * 613) % 1000);
+			if (n % 3)
+				cmp->AddStaticShape(100 + n, x, z, fixed::FromInt(n % 7), fixed::FromInt(4 + n % 20), fixed::FromInt(4 + n % 13),
+					ICmpObstructionManager::FLAG_BLOCK_PATHFINDING | ICmpObstructionManager::FLAG_BLOCK_FOUNDATION, 100 + n);
+			else
+				cmp->AddUnitShape(100 + n, x, z, fixed::FromInt(1 + n % 3),
+					ICmpObstructionManager::FLAG_BLOCK_PATHFINDING, 100 + n);
+		}
+
+		Grid<u8> serial(250, 250);
+		TS_ASSERT(cmp->Rasterise(serial));
+
+		CThreadPool pool(3);
+		g_ThreadPool = &pool;
+		Grid<u8> parallel(250, 250);
+		TS_ASSERT(cmp->Rasterise(parallel));
+		g_ThreadPool = NULL;
+
+		for (u16 j = 0; j < serial.m_H; ++j)
+			for (u16 i = 0; i < serial.m_W; ++i)
+				TS_ASSERT_EQUALS(parallel.get(i, j), serial.get(i, j));
+	}
+
+private:
+	void AssertGridsEqual(const Grid<u8>& grid)
+	{
+		Grid<u8> expected(grid.m_W, grid.m_H);
+		TS_ASSERT(cmp->Rasterise(expected));
+		for (u16 j = 0; j < grid.m_H; ++j)
+			for (u16 i = 0; i < grid.m_W; ++i)
+				TS_ASSERT_EQUALS(grid.get(i, j), expected.get(i, j));
+	}
 };
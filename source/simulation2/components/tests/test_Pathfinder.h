@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -109,6 +109,52 @@ public:
 		printf("[%f]", t);
 	}
 
+	// Measures mass orders, where many units request long paths to the same goal in one turn
+	void test_performance_group_DISABLED()
+	{
+		CTerrain terrain;
+
+		CSimulation2 sim2(NULL, &terrain);
+		sim2.LoadDefaultScripts();
+		sim2.ResetState();
+
+		CMapReader* mapReader = new CMapReader(); // it'll call "delete this" itself
+
+		LDR_BeginRegistering();
+		mapReader->LoadMap(L"maps/scenarios/Median Oasis.pmp", &terrain, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+			&sim2, &sim2.GetSimContext(), -1, false);
+		LDR_EndRegistering();
+		TS_ASSERT_OK(LDR_NonprogressiveLoad());
+
+		sim2.Update(0);
+
+		CmpPtr<ICmpPathfinder> cmp(sim2, SYSTEM_ENTITY);
+
+		double t = timer_Time();
+
+		srand(1234);
+		for (size_t j = 0; j < 32; ++j)
+		{
+			entity_pos_t cx = entity_pos_t::FromInt(64 + rand() % 384);
+			entity_pos_t cz = entity_pos_t::FromInt(64 + rand() % 384);
+			entity_pos_t x1 = entity_pos_t::FromInt(rand() % 512);
+			entity_pos_t z1 = entity_pos_t::FromInt(rand() % 512);
+			ICmpPathfinder::Goal goal = { ICmpPathfinder::Goal::POINT, x1, z1 };
+
+			for (size_t n = 0; n < 100; ++n)
+			{
+				entity_pos_t x0 = cx + entity_pos_t::FromInt(rand() % 32);
+				entity_pos_t z0 = cz + entity_pos_t::FromInt(rand() % 32);
+				cmp->ComputePathAsync(x0, z0, goal, cmp->GetPassabilityClass("default"), cmp->GetCostClass("default"), SYSTEM_ENTITY);
+			}
+
+			cmp->FinishAsyncRequests();
+		}
+
+		t = timer_Time() - t;
+		printf("[%f]", t);
+	}
+
 	void test_performance_short_DISABLED()
 	{
 		CTerrain terrain;
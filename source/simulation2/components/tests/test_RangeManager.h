@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -62,6 +62,14 @@ public:
 	virtual bool GetReinterpolate() { return true; } 
 };
 
+class MockPositionAt : public MockPosition
+{
+public:
+	CFixedVector2D m_Pos;
+
+	virtual CFixedVector2D GetPosition2D() { return m_Pos; }
+};
+
 class TestCmpRangeManager : public CxxTest::TestSuite
 {
 public:
@@ -87,6 +95,10 @@ public:
 		MockPosition position;
 		test.AddMock(100, IID_Position, position);
 
+		// Position changes are delivered in batches by the component manager
+		// (Verify flushes them before checking anything)
+		CComponentManager& componentManager = test.GetSimContext().GetComponentManager();
+
 		// This tests that the incremental computation produces the correct result
 		// in various edge cases
 
@@ -96,26 +108,26 @@ public:
 		cmp->Verify();
 		{ CMessageOwnershipChanged msg(100, -1, 1); cmp->HandleMessage(msg, false); }
 		cmp->Verify();
-		{ CMessagePositionChanged msg(100, true, entity_pos_t::FromInt(247), entity_pos_t::FromDouble(257.95), entity_angle_t::Zero()); cmp->HandleMessage(msg, false); }
+		componentManager.QueuePositionChange(100, true, entity_pos_t::FromInt(247), entity_pos_t::FromDouble(257.95), entity_angle_t::Zero());
 		cmp->Verify();
-		{ CMessagePositionChanged msg(100, true, entity_pos_t::FromInt(247), entity_pos_t::FromInt(253), entity_angle_t::Zero()); cmp->HandleMessage(msg, false); }
+		componentManager.QueuePositionChange(100, true, entity_pos_t::FromInt(247), entity_pos_t::FromInt(253), entity_angle_t::Zero());
 		cmp->Verify();
 
-		{ CMessagePositionChanged msg(100, true, entity_pos_t::FromInt(256), entity_pos_t::FromInt(256), entity_angle_t::Zero()); cmp->HandleMessage(msg, false); }
+		componentManager.QueuePositionChange(100, true, entity_pos_t::FromInt(256), entity_pos_t::FromInt(256), entity_angle_t::Zero());
 		cmp->Verify();
 
-		{ CMessagePositionChanged msg(100, true, entity_pos_t::FromInt(256)+entity_pos_t::Epsilon(), entity_pos_t::FromInt(256), entity_angle_t::Zero()); cmp->HandleMessage(msg, false); }
+		componentManager.QueuePositionChange(100, true, entity_pos_t::FromInt(256)+entity_pos_t::Epsilon(), entity_pos_t::FromInt(256), entity_angle_t::Zero());
 		cmp->Verify();
-		{ CMessagePositionChanged msg(100, true, entity_pos_t::FromInt(256)-entity_pos_t::Epsilon(), entity_pos_t::FromInt(256), entity_angle_t::Zero()); cmp->HandleMessage(msg, false); }
+		componentManager.QueuePositionChange(100, true, entity_pos_t::FromInt(256)-entity_pos_t::Epsilon(), entity_pos_t::FromInt(256), entity_angle_t::Zero());
 		cmp->Verify();
-		{ CMessagePositionChanged msg(100, true, entity_pos_t::FromInt(256), entity_pos_t::FromInt(256)+entity_pos_t::Epsilon(), entity_angle_t::Zero()); cmp->HandleMessage(msg, false); }
+		componentManager.QueuePositionChange(100, true, entity_pos_t::FromInt(256), entity_pos_t::FromInt(256)+entity_pos_t::Epsilon(), entity_angle_t::Zero());
 		cmp->Verify();
-		{ CMessagePositionChanged msg(100, true, entity_pos_t::FromInt(256), entity_pos_t::FromInt(256)-entity_pos_t::Epsilon(), entity_angle_t::Zero()); cmp->HandleMessage(msg, false); }
+		componentManager.QueuePositionChange(100, true, entity_pos_t::FromInt(256), entity_pos_t::FromInt(256)-entity_pos_t::Epsilon(), entity_angle_t::Zero());
 		cmp->Verify();
 
-		{ CMessagePositionChanged msg(100, true, entity_pos_t::FromInt(383), entity_pos_t::FromInt(84), entity_angle_t::Zero()); cmp->HandleMessage(msg, false); }
+		componentManager.QueuePositionChange(100, true, entity_pos_t::FromInt(383), entity_pos_t::FromInt(84), entity_angle_t::Zero());
 		cmp->Verify();
-		{ CMessagePositionChanged msg(100, true, entity_pos_t::FromInt(348), entity_pos_t::FromInt(83), entity_angle_t::Zero()); cmp->HandleMessage(msg, false); }
+		componentManager.QueuePositionChange(100, true, entity_pos_t::FromInt(348), entity_pos_t::FromInt(83), entity_angle_t::Zero());
 		cmp->Verify();
 
 		WELL512 rng;
@@ -123,8 +135,280 @@ public:
 		{
 			double x = boost::uniform_real<>(0.0, 512.0)(rng);
 			double z = boost::uniform_real<>(0.0, 512.0)(rng);
-			{ CMessagePositionChanged msg(100, true, entity_pos_t::FromDouble(x), entity_pos_t::FromDouble(z), entity_angle_t::Zero()); cmp->HandleMessage(msg, false); }
+			componentManager.QueuePositionChange(100, true, entity_pos_t::FromDouble(x), entity_pos_t::FromDouble(z), entity_angle_t::Zero());
 			cmp->Verify();
 		}
+
+		// Several moves of the same entity within a batch must be coalesced
+		// into a single update that still gives the correct result
+		for (size_t i = 0; i < 64; ++i)
+		{
+			for (size_t j = 0; j < 8; ++j)
+			{
+				double x = boost::uniform_real<>(0.0, 512.0)(rng);
+				double z = boost::uniform_real<>(0.0, 512.0)(rng);
+				componentManager.QueuePositionChange(100, true, entity_pos_t::FromDouble(x), entity_pos_t::FromDouble(z), entity_angle_t::Zero());
+			}
+			cmp->Verify();
+		}
+
+		componentManager.QueuePositionChange(100, false, entity_pos_t::Zero(), entity_pos_t::Zero(), entity_angle_t::Zero());
+		cmp->Verify();
+	}
+
+	void test_los_visibility()
+	{
+		ComponentTestHelper test;
+
+		ICmpRangeManager* cmp = test.Add<ICmpRangeManager>(CID_RangeManager, "");
+		CComponentManager& componentManager = test.GetSimContext().GetComponentManager();
+
+		MockVision vision;
+		test.AddMock(100, IID_Vision, vision);
+		MockPosition position1, position2;
+		test.AddMock(100, IID_Position, position1);
+		test.AddMock(101, IID_Position, position2);
+
+		cmp->SetBounds(entity_pos_t::FromInt(0), entity_pos_t::FromInt(0), entity_pos_t::FromInt(512), entity_pos_t::FromInt(512), 512/TERRAIN_TILE_SIZE + 1);
+		std::vector<player_id_t> players(1, 1);
+		cmp->SetSharedLos(1, players);
+		players[0] = 2;
+		cmp->SetSharedLos(2, players);
+
+		{ CMessageCreate msg(100); cmp->HandleMessage(msg, false); }
+		{ CMessageCreate msg(101); cmp->HandleMessage(msg, false); }
+		{ CMessageOwnershipChanged msg(100, -1, 1); cmp->HandleMessage(msg, false); }
+		{ CMessageOwnershipChanged msg(101, -1, 2); cmp->HandleMessage(msg, false); }
+
+		// Entities out of the world are never visible
+		TS_ASSERT_EQUALS(cmp->GetLosVisibility(101, 1), ICmpRangeManager::VIS_HIDDEN);
+
+		componentManager.QueuePositionChange(100, true, entity_pos_t::FromInt(256), entity_pos_t::FromInt(256), entity_angle_t::Zero());
+		componentManager.QueuePositionChange(101, true, entity_pos_t::FromInt(288), entity_pos_t::FromInt(256), entity_angle_t::Zero());
+		TS_ASSERT_EQUALS(cmp->GetLosVisibility(101, 1), ICmpRangeManager::VIS_VISIBLE);
+		TS_ASSERT_EQUALS(cmp->GetLosVisibility(101, 1), ICmpRangeManager::VIS_VISIBLE);
+
+		// The cached results must be updated when the viewer moves away, leaving the
+		// target in an explored but no longer visible region
+		componentManager.QueuePositionChange(100, true, entity_pos_t::FromInt(50), entity_pos_t::FromInt(50), entity_angle_t::Zero());
+		TS_ASSERT_EQUALS(cmp->GetLosVisibility(101, 1), ICmpRangeManager::VIS_HIDDEN);
+		TS_ASSERT_EQUALS(cmp->GetLosVisibility(101, 1, true), ICmpRangeManager::VIS_FOGGED);
+
+		// and for a different player
+		TS_ASSERT_EQUALS(cmp->GetLosVisibility(100, 2), ICmpRangeManager::VIS_HIDDEN);
+		TS_ASSERT_EQUALS(cmp->GetLosVisibility(100, 1), ICmpRangeManager::VIS_VISIBLE);
+
+		// and when revealing the map
+		cmp->SetLosRevealAll(-1, true);
+		TS_ASSERT_EQUALS(cmp->GetLosVisibility(100, 2), ICmpRangeManager::VIS_VISIBLE);
+		TS_ASSERT_EQUALS(cmp->GetLosVisibility(101, 1), ICmpRangeManager::VIS_VISIBLE);
+		cmp->SetLosRevealAll(-1, false);
+		TS_ASSERT_EQUALS(cmp->GetLosVisibility(101, 1), ICmpRangeManager::VIS_HIDDEN);
+	}
+
+	void test_los_visibility_alternating_players()
+	{
+		ComponentTestHelper test;
+
+		ICmpRangeManager* cmp = test.Add<ICmpRangeManager>(CID_RangeManager, "");
+		CComponentManager& componentManager = test.GetSimContext().GetComponentManager();
+
+		MockVision vision1, vision2;
+		test.AddMock(100, IID_Vision, vision1);
+		test.AddMock(101, IID_Vision, vision2);
+		MockPosition position1, position2, position3;
+		test.AddMock(100, IID_Position, position1);
+		test.AddMock(101, IID_Position, position2);
+		test.AddMock(102, IID_Position, position3); // no vision, so moving it doesn't change anyone's LOS
+
+		cmp->SetBounds(entity_pos_t::FromInt(0), entity_pos_t::FromInt(0), entity_pos_t::FromInt(512), entity_pos_t::FromInt(512), 512/TERRAIN_TILE_SIZE + 1);
+		std::vector<player_id_t> players(1, 1);
+		cmp->SetSharedLos(1, players);
+		players[0] = 2;
+		cmp->SetSharedLos(2, players);
+
+		{ CMessageCreate msg(100); cmp->HandleMessage(msg, false); }
+		{ CMessageCreate msg(101); cmp->HandleMessage(msg, false); }
+		{ CMessageCreate msg(102); cmp->HandleMessage(msg, false); }
+		{ CMessageOwnershipChanged msg(100, -1, 1); cmp->HandleMessage(msg, false); }
+		{ CMessageOwnershipChanged msg(101, -1, 2); cmp->HandleMessage(msg, false); }
+		{ CMessageOwnershipChanged msg(102, -1, 2); cmp->HandleMessage(msg, false); }
+
+		componentManager.QueuePositionChange(100, true, entity_pos_t::FromInt(256), entity_pos_t::FromInt(256), entity_angle_t::Zero());
+		componentManager.QueuePositionChange(101, true, entity_pos_t::FromInt(100), entity_pos_t::FromInt(100), entity_angle_t::Zero());
+		componentManager.QueuePositionChange(102, true, entity_pos_t::FromInt(288), entity_pos_t::FromInt(256), entity_angle_t::Zero());
+
+		// Interleaved queries for different players mustn't disturb each other's results
+		for (int i = 0; i < 3; ++i)
+		{
+			TS_ASSERT_EQUALS(cmp->GetLosVisibility(102, 1), ICmpRangeManager::VIS_VISIBLE);
+			TS_ASSERT_EQUALS(cmp->GetLosVisibility(100, 2), ICmpRangeManager::VIS_HIDDEN);
+			TS_ASSERT_EQUALS(cmp->GetLosVisibility(101, 1), ICmpRangeManager::VIS_HIDDEN);
+			TS_ASSERT_EQUALS(cmp->GetLosVisibility(101, 2), ICmpRangeManager::VIS_VISIBLE);
+		}
+
+		// Moving an entity without vision only changes its own visibility
+		componentManager.QueuePositionChange(102, true, entity_pos_t::FromInt(110), entity_pos_t::FromInt(100), entity_angle_t::Zero());
+		for (int i = 0; i < 3; ++i)
+		{
+			TS_ASSERT_EQUALS(cmp->GetLosVisibility(102, 2), ICmpRangeManager::VIS_VISIBLE);
+			TS_ASSERT_EQUALS(cmp->GetLosVisibility(102, 1), ICmpRangeManager::VIS_HIDDEN);
+			TS_ASSERT_EQUALS(cmp->GetLosVisibility(100, 1), ICmpRangeManager::VIS_VISIBLE);
+		}
+
+		// Moving a viewer changes what its owner sees
+		componentManager.QueuePositionChange(101, true, entity_pos_t::FromInt(240), entity_pos_t::FromInt(256), entity_angle_t::Zero());
+		for (int i = 0; i < 3; ++i)
+		{
+			TS_ASSERT_EQUALS(cmp->GetLosVisibility(100, 2), ICmpRangeManager::VIS_VISIBLE);
+			TS_ASSERT_EQUALS(cmp->GetLosVisibility(102, 1), ICmpRangeManager::VIS_HIDDEN);
+			TS_ASSERT_EQUALS(cmp->GetLosVisibility(102, 2), ICmpRangeManager::VIS_HIDDEN);
+			TS_ASSERT_EQUALS(cmp->GetLosVisibility(102, 2, true), ICmpRangeManager::VIS_FOGGED);
+			TS_ASSERT_EQUALS(cmp->GetLosVisibility(101, 1), ICmpRangeManager::VIS_VISIBLE);
+		}
+
+		// and sharing LOS changes what the other player sees
+		players.push_back(1);
+		cmp->SetSharedLos(1, players);
+		TS_ASSERT_EQUALS(cmp->GetLosVisibility(102, 2), ICmpRangeManager::VIS_HIDDEN);
+		TS_ASSERT_EQUALS(cmp->GetLosVisibility(100, 1), ICmpRangeManager::VIS_VISIBLE);
+		componentManager.QueuePositionChange(101, true, entity_pos_t::FromInt(110), entity_pos_t::FromInt(110), entity_angle_t::Zero());
+		TS_ASSERT_EQUALS(cmp->GetLosVisibility(102, 1), ICmpRangeManager::VIS_VISIBLE);
+		TS_ASSERT_EQUALS(cmp->GetLosVisibility(102, 2), ICmpRangeManager::VIS_VISIBLE);
+	}
+
+	void test_active_queries()
+	{
+		ComponentTestHelper test;
+
+		ICmpRangeManager* cmp = test.Add<ICmpRangeManager>(CID_RangeManager, "");
+		CComponentManager& componentManager = test.GetSimContext().GetComponentManager();
+
+		cmp->SetBounds(entity_pos_t::FromInt(0), entity_pos_t::FromInt(0), entity_pos_t::FromInt(512), entity_pos_t::FromInt(512), 512/TERRAIN_TILE_SIZE + 1);
+
+		// Entity 100 is the source of the query; 101-116 move around near it
+		MockPositionAt sourcePosition;
+		sourcePosition.m_Pos = CFixedVector2D(entity_pos_t::FromInt(256), entity_pos_t::FromInt(256));
+		test.AddMock(100, IID_Position, sourcePosition);
+
+		MockPosition position;
+		for (entity_id_t ent = 101; ent <= 116; ++ent)
+		{
+			test.AddMock(ent, IID_Position, position);
+			{ CMessageCreate msg(ent); cmp->HandleMessage(msg, false); }
+			{ CMessageOwnershipChanged msg(ent, -1, 1); cmp->HandleMessage(msg, false); }
+		}
+
+		std::vector<int> owners;
+		owners.push_back(1);
+		ICmpRangeManager::tag_t tag = cmp->CreateActiveQuery(100, entity_pos_t::Zero(), entity_pos_t::FromInt(40), owners, 0, cmp->GetEntityFlagMask("normal"));
+		cmp->EnableActiveQuery(tag);
+
+		// Verify checks that every query that would be skipped by the next update
+		// has the same result as recomputing it from scratch.
+		// (It also marks everything as dirty, so do several updates between calls,
+		// else nothing would ever be skipped.)
+		WELL512 rng;
+		for (size_t i = 0; i < 256; ++i)
+		{
+			// Sometimes move nothing, sometimes just one entity, sometimes the source
+			size_t mode = i % 4;
+			if (mode == 1)
+			{
+				entity_id_t ent = 101 + (entity_id_t)(i/4 % 16);
+				double x = boost::uniform_real<>(160.0, 352.0)(rng);
+				double z = boost::uniform_real<>(160.0, 352.0)(rng);
+				componentManager.QueuePositionChange(ent, true, entity_pos_t::FromDouble(x), entity_pos_t::FromDouble(z), entity_angle_t::Zero());
+			}
+			else if (mode == 2)
+			{
+				double x = boost::uniform_real<>(200.0, 312.0)(rng);
+				double z = boost::uniform_real<>(200.0, 312.0)(rng);
+				sourcePosition.m_Pos = CFixedVector2D(entity_pos_t::FromDouble(x), entity_pos_t::FromDouble(z));
+			}
+			else if (mode == 3)
+			{
+				entity_id_t ent = 101 + (entity_id_t)(i/4 % 16);
+				componentManager.QueuePositionChange(ent, i % 8 == 3, entity_pos_t::FromInt(250), entity_pos_t::FromInt(250), entity_angle_t::Zero());
+				cmp->SetEntityFlag(ent, "injured", i % 16 == 3);
+			}
+
+			{ CMessageUpdate msg(fixed::FromInt(1)); cmp->HandleMessage(msg, false); }
+			if (i % 16 == 15)
+				cmp->Verify();
+		}
+
+		// Queries that were disabled while things moved must be recomputed
+		cmp->DisableActiveQuery(tag);
+		componentManager.QueuePositionChange(101, true, sourcePosition.m_Pos.X, sourcePosition.m_Pos.Y + entity_pos_t::FromInt(1), entity_angle_t::Zero());
+		{ CMessageUpdate msg(fixed::FromInt(1)); cmp->HandleMessage(msg, false); }
+		cmp->EnableActiveQuery(tag);
+		cmp->Verify();
+		{ CMessageUpdate msg(fixed::FromInt(1)); cmp->HandleMessage(msg, false); }
+		cmp->Verify();
+	}
+
+	void test_owners()
+	{
+		ComponentTestHelper test;
+
+		ICmpRangeManager* cmp = test.Add<ICmpRangeManager>(CID_RangeManager, "");
+		CComponentManager& componentManager = test.GetSimContext().GetComponentManager();
+
+		cmp->SetBounds(entity_pos_t::FromInt(0), entity_pos_t::FromInt(0), entity_pos_t::FromInt(512), entity_pos_t::FromInt(512), 512/TERRAIN_TILE_SIZE + 1);
+
+		MockPositionAt sourcePosition;
+		sourcePosition.m_Pos = CFixedVector2D(entity_pos_t::FromInt(256), entity_pos_t::FromInt(256));
+		test.AddMock(100, IID_Position, sourcePosition);
+
+		// Entities 101-108 are all next to the source, owned by players 1-4;
+		// entity 109 is owned by player 1 but out of the world
+		MockPosition position;
+		for (entity_id_t ent = 101; ent <= 109; ++ent)
+		{
+			test.AddMock(ent, IID_Position, position);
+			{ CMessageCreate msg(ent); cmp->HandleMessage(msg, false); }
+			{ CMessageOwnershipChanged msg(ent, -1, 1 + (ent - 101) % 4); cmp->HandleMessage(msg, false); }
+			if (ent != 109)
+				componentManager.QueuePositionChange(ent, true, entity_pos_t::FromInt(250 + ent - 100), entity_pos_t::FromInt(256), entity_angle_t::Zero());
+		}
+		cmp->Verify();
+
+		std::vector<entity_id_t> player1 = cmp->GetEntitiesByPlayer(1);
+		TS_ASSERT_EQUALS(player1.size(), 3u);
+		TS_ASSERT_EQUALS(player1[0], 101u);
+		TS_ASSERT_EQUALS(player1[1], 105u);
+		TS_ASSERT_EQUALS(player1[2], 109u);
+		TS_ASSERT(cmp->GetEntitiesByPlayer(5).empty());
+		TS_ASSERT(cmp->GetEntitiesByPlayer(-2).empty());
+
+		std::vector<int> owners;
+		owners.push_back(2);
+		owners.push_back(3);
+		std::vector<entity_id_t> r = cmp->ExecuteQuery(100, entity_pos_t::Zero(), entity_pos_t::FromInt(40), owners, 0);
+		TS_ASSERT_EQUALS(r.size(), 4u);
+		TS_ASSERT_EQUALS(r[0], 106u); // sorted by distance
+		TS_ASSERT_EQUALS(r[1], 107u);
+		TS_ASSERT_EQUALS(r[2], 103u);
+		TS_ASSERT_EQUALS(r[3], 102u);
+
+		// Changing owner moves the entity between the per-owner indexes
+		{ CMessageOwnershipChanged msg(102, 2, 4); cmp->HandleMessage(msg, false); }
+		{ CMessageOwnershipChanged msg(109, 1, 3); cmp->HandleMessage(msg, false); }
+		cmp->Verify();
+
+		r = cmp->ExecuteQuery(100, entity_pos_t::Zero(), entity_pos_t::FromInt(40), owners, 0);
+		TS_ASSERT_EQUALS(r.size(), 3u);
+		TS_ASSERT_EQUALS(r[2], 103u);
+		TS_ASSERT_EQUALS(cmp->GetEntitiesByPlayer(1).size(), 2u);
+		TS_ASSERT_EQUALS(cmp->GetEntitiesByPlayer(4).size(), 3u);
+
+		// Destroyed entities are removed
+		{ CMessageOwnershipChanged msg(103, 3, -1); cmp->HandleMessage(msg, false); }
+		{ CMessageDestroy msg(103); cmp->HandleMessage(msg, false); }
+		cmp->Verify();
+		r = cmp->ExecuteQuery(100, entity_pos_t::Zero(), entity_pos_t::FromInt(40), owners, 0);
+		TS_ASSERT_EQUALS(r.size(), 2u);
+		TS_ASSERT(cmp->GetEntitiesByPlayer(-1).empty());
 	}
 };
@@ -0,0 +1,165 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "simulation2/system/ComponentTest.h"
+
+#include "simulation2/MessageTypes.h"
+#include "simulation2/components/ICmpOwnership.h"
+#include "simulation2/components/ICmpPlayerManager.h"
+#include "simulation2/components/ICmpTechnologyManager.h"
+#include "simulation2/components/ICmpTechnologyModificationCache.h"
+#include "simulation2/components/ICmpTemplateManager.h"
+
+class MockOwnership : public ICmpOwnership
+{
+public:
+	DEFAULT_MOCK_COMPONENT()
+
+	MockOwnership(player_id_t owner) : m_Owner(owner) { }
+
+	virtual player_id_t GetOwner() { return m_Owner; }
+	virtual void SetOwner(player_id_t playerID) { m_Owner = playerID; }
+	virtual void SetOwnerQuiet(player_id_t playerID) { m_Owner = playerID; }
+
+	player_id_t m_Owner;
+};
+
+class MockPlayerManager : public ICmpPlayerManager
+{
+public:
+	DEFAULT_MOCK_COMPONENT()
+
+	virtual void AddPlayer(entity_id_t UNUSED(ent)) { }
+	virtual int32_t GetNumPlayers() { return 2; }
+	virtual entity_id_t GetPlayerByID(int32_t id) { return 100 + id; }
+};
+
+class MockTemplateManager : public ICmpTemplateManager
+{
+public:
+	DEFAULT_MOCK_COMPONENT()
+
+	virtual const CParamNode* LoadTemplate(entity_id_t UNUSED(ent), const std::string& UNUSED(templateName), int UNUSED(playerID)) { return NULL; }
+	virtual const CParamNode* GetTemplate(std::string UNUSED(templateName)) { return NULL; }
+	virtual const CParamNode* GetTemplateWithoutValidation(std::string UNUSED(templateName)) { return NULL; }
+	virtual const CParamNode* LoadLatestTemplate(entity_id_t UNUSED(ent)) { return NULL; }
+	virtual std::string GetCurrentTemplateName(entity_id_t ent) { return ent == 3 ? "other" : "unit"; }
+	virtual std::vector<entity_id_t> GetEntitiesUsingTemplate(std::string UNUSED(templateName)) { return std::vector<entity_id_t>(); }
+	virtual std::vector<std::string> FindAllTemplates(bool UNUSED(includeActors)) { return std::vector<std::string>(); }
+	virtual void DisableValidation() { }
+};
+
+/**
+ * Adds m_Bonus to every value, and counts how often it's asked.
+ */
+class MockTechnologyManager : public ICmpTechnologyManager
+{
+public:
+	DEFAULT_MOCK_COMPONENT()
+
+	MockTechnologyManager() : m_Bonus(1), m_Calls(0) { }
+
+	virtual fixed ApplyModifications(std::wstring UNUSED(valueName), fixed currentValue, entity_id_t UNUSED(entity))
+	{
+		++m_Calls;
+		return currentValue + fixed::FromInt(m_Bonus);
+	}
+
+	virtual u32 ApplyModifications(std::wstring UNUSED(valueName), u32 currentValue, entity_id_t UNUSED(entity))
+	{
+		++m_Calls;
+		return currentValue + m_Bonus;
+	}
+
+	virtual double ApplyModifications(std::wstring UNUSED(valueName), double currentValue, entity_id_t UNUSED(entity))
+	{
+		++m_Calls;
+		return currentValue + m_Bonus;
+	}
+
+	int m_Bonus;
+	int m_Calls;
+};
+
+class TestCmpTechnologyModificationCache : public CxxTest::TestSuite
+{
+public:
+	void setUp()
+	{
+		CXeromyces::Startup();
+	}
+
+	void tearDown()
+	{
+		CXeromyces::Terminate();
+	}
+
+	void test_basic()
+	{
+		ComponentTestHelper test;
+
+		MockPlayerManager playerManager;
+		test.AddMock(SYSTEM_ENTITY, IID_PlayerManager, playerManager);
+		MockTemplateManager templateManager;
+		test.AddMock(SYSTEM_ENTITY, IID_TemplateManager, templateManager);
+
+		MockTechnologyManager tech1, tech2;
+		test.AddMock(101, IID_TechnologyManager, tech1);
+		test.AddMock(102, IID_TechnologyManager, tech2);
+		tech2.m_Bonus = 10;
+
+		// Entities 1 and 2 share a template, 3 has a different one, 4 has no owner
+		MockOwnership own1(1), own2(1), own3(1), own4(INVALID_PLAYER);
+		test.AddMock(1, IID_Ownership, own1);
+		test.AddMock(2, IID_Ownership, own2);
+		test.AddMock(3, IID_Ownership, own3);
+		test.AddMock(4, IID_Ownership, own4);
+
+		ICmpTechnologyModificationCache* cmp = test.Add<ICmpTechnologyModificationCache>(CID_TechnologyModificationCache, "", SYSTEM_ENTITY);
+
+		TS_ASSERT_EQUALS(cmp->ApplyModifications(L"Vision/Range", fixed::FromInt(5), 1), fixed::FromInt(6));
+		TS_ASSERT_EQUALS(cmp->ApplyModifications(L"Vision/Range", fixed::FromInt(5), 2), fixed::FromInt(6));
+		TS_ASSERT_EQUALS(tech1.m_Calls, 1);
+
+		// Different templates, values, value names and types are all looked up separately
+		TS_ASSERT_EQUALS(cmp->ApplyModifications(L"Vision/Range", fixed::FromInt(5), 3), fixed::FromInt(6));
+		TS_ASSERT_EQUALS(cmp->ApplyModifications(L"Vision/Range", fixed::FromInt(7), 1), fixed::FromInt(8));
+		TS_ASSERT_EQUALS(cmp->ApplyModifications(L"Other", fixed::FromInt(5), 1), fixed::FromInt(6));
+		TS_ASSERT_EQUALS(cmp->ApplyModifications(L"Vision/Range", (u32)5, 1), 6u);
+		TS_ASSERT_EQUALS(cmp->ApplyModifications(L"Vision/Range", 5.0, 1), 6.0);
+		TS_ASSERT_EQUALS(tech1.m_Calls, 6);
+
+		// Unowned entities are unmodified
+		TS_ASSERT_EQUALS(cmp->ApplyModifications(L"Vision/Range", fixed::FromInt(5), 4), fixed::FromInt(5));
+
+		// Changing owner uses the new owner's modifications
+		own2.m_Owner = 2;
+		TS_ASSERT_EQUALS(cmp->ApplyModifications(L"Vision/Range", fixed::FromInt(5), 2), fixed::FromInt(15));
+		TS_ASSERT_EQUALS(tech2.m_Calls, 1);
+
+		// Only the modified player's results are discarded
+		tech1.m_Bonus = 2;
+		tech2.m_Bonus = 20;
+		CMessageTechnologyModification msg(L"Vision", 1);
+		test.HandleMessage(cmp, msg, true);
+		TS_ASSERT_EQUALS(cmp->ApplyModifications(L"Vision/Range", fixed::FromInt(5), 1), fixed::FromInt(7));
+		TS_ASSERT_EQUALS(cmp->ApplyModifications(L"Vision/Range", (u32)5, 1), 7u);
+		TS_ASSERT_EQUALS(cmp->ApplyModifications(L"Vision/Range", fixed::FromInt(5), 2), fixed::FromInt(15));
+		TS_ASSERT_EQUALS(tech1.m_Calls, 8);
+		TS_ASSERT_EQUALS(tech2.m_Calls, 1);
+	}
+};
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -246,6 +246,57 @@ public:
 		TestBoundaryPointsEqual(threesOuter->points, threesOuterExpectedPoints);
 	}
 
+	void test_update_boundaries()
+	{
+		Grid<u8> grid1 = GetGrid("----------"
+		                         "-111---22-"
+		                         "-111---22-"
+		                         "-111------"
+		                         "------333-"
+		                         "------333-", 10, 6);
+
+		u32 nextID = 0;
+		std::vector<STerritoryBoundary> boundaries1 = CTerritoryBoundaryCalculator::UpdateBoundaries(&grid1, NULL, std::vector<STerritoryBoundary>(), nextID);
+		TS_ASSERT_EQUALS(3U, boundaries1.size());
+		TS_ASSERT_EQUALS(3U, nextID);
+
+		// Grow the 3's territory; the other boundaries are unaffected
+		Grid<u8> grid2 = GetGrid("----------"
+		                         "-111---22-"
+		                         "-111---22-"
+		                         "-111------"
+		                         "-----3333-"
+		                         "------333-", 10, 6);
+
+		std::vector<STerritoryBoundary> boundaries2 = CTerritoryBoundaryCalculator::UpdateBoundaries(&grid2, &grid1, boundaries1, nextID);
+		TestBoundariesEqual(boundaries2, CTerritoryBoundaryCalculator::ComputeBoundaries(&grid2));
+		TS_ASSERT_EQUALS(4U, nextID);
+		for (size_t i = 0; i < boundaries2.size(); ++i)
+		{
+			if (boundaries2[i].owner == 3)
+			{
+				TS_ASSERT_EQUALS(3U, boundaries2[i].id);
+			}
+			else
+			{
+				TS_ASSERT_EQUALS(FindBoundaryID(boundaries1, boundaries2[i].owner), boundaries2[i].id);
+			}
+		}
+
+		// Join the 1's and 3's territories together
+		Grid<u8> grid3 = GetGrid("----------"
+		                         "-111---22-"
+		                         "-111---22-"
+		                         "-111------"
+		                         "-1111133--"
+		                         "------333-", 10, 6);
+
+		std::vector<STerritoryBoundary> boundaries3 = CTerritoryBoundaryCalculator::UpdateBoundaries(&grid3, &grid2, boundaries2, nextID);
+		TestBoundariesEqual(boundaries3, CTerritoryBoundaryCalculator::ComputeBoundaries(&grid3));
+		TS_ASSERT_EQUALS(FindBoundaryID(boundaries1, 2), FindBoundaryID(boundaries3, 2));
+		TS_ASSERT_DIFFERS(FindBoundaryID(boundaries2, 1), FindBoundaryID(boundaries3, 1));
+	}
+
 private:
 	/// Parses a string representation of a grid into an actual Grid structure, such that the (i,j) axes are located in the bottom
 	/// left hand side of the map. Note: leaves all custom bits in the grid values at zero (anything outside 
@@ -272,6 +323,31 @@ private:
 		return grid;
 	}
 
+	u32 FindBoundaryID(const std::vector<STerritoryBoundary>& boundaries, player_id_t owner)
+	{
+		for (size_t i = 0; i < boundaries.size(); ++i)
+			if (boundaries[i].owner == owner)
+				return boundaries[i].id;
+		TS_FAIL("No boundary with the given owner");
+		return 0;
+	}
+
+	void TestBoundariesEqual(const std::vector<STerritoryBoundary>& boundaries, const std::vector<STerritoryBoundary>& expected)
+	{
+		TS_ASSERT_EQUALS(boundaries.size(), expected.size());
+		for (size_t i = 0; i < boundaries.size(); ++i)
+		{
+			TS_ASSERT_EQUALS(boundaries[i].owner, expected[i].owner);
+			TS_ASSERT_EQUALS(boundaries[i].connected, expected[i].connected);
+			TS_ASSERT_EQUALS(boundaries[i].points.size(), expected[i].points.size());
+			for (size_t j = 0; j < boundaries[i].points.size(); ++j)
+			{
+				TS_ASSERT_EQUALS(boundaries[i].points[j].X, expected[i].points[j].X);
+				TS_ASSERT_EQUALS(boundaries[i].points[j].Y, expected[i].points[j].Y);
+			}
+		}
+	}
+
 	void TestBoundaryPointsEqual(std::vector<CVector2D> points, int expectedPoints[][2])
 	{
 		// TODO: currently relies on an exact point match, i.e. expectedPoints must be specified going CCW or CW (depending on
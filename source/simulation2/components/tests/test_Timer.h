@@ -0,0 +1,223 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "simulation2/system/ComponentTest.h"
+
+#include "simulation2/components/ICmpTimer.h"
+
+#include "ps/CLogger.h"
+
+class TestCmpTimer : public CxxTest::TestSuite
+{
+public:
+	void setUp()
+	{
+		CXeromyces::Startup();
+	}
+
+	void tearDown()
+	{
+		CXeromyces::Terminate();
+	}
+
+	void test_basic()
+	{
+		ComponentTestHelper test;
+		ScriptInterface& scriptInterface = test.GetScriptInterface();
+		CComponentManager& componentManager = test.GetSimContext().GetComponentManager();
+
+		ICmpTimer* cmp = test.Add<ICmpTimer>(CID_Timer, "", SYSTEM_ENTITY);
+
+		// A script component to receive the callbacks
+		TS_ASSERT(scriptInterface.Eval(
+			"var calls = [];"
+			"function TimerTarget() {}"
+			"TimerTarget.prototype.Callback = function(data, lateness) { calls.push([data, lateness]); };"
+			"Engine.RegisterComponentType(IID_Test1, 'TimerTarget', TimerTarget);"));
+		CParamNode noParam;
+		TS_ASSERT(componentManager.AddComponent(100, componentManager.LookupCID("TimerTarget"), noParam));
+
+		CScriptVal one, two;
+		TS_ASSERT(scriptInterface.Eval("1", one));
+		TS_ASSERT(scriptInterface.Eval("2", two));
+
+		u32 timeout = cmp->SetTimeout(100, IID_Test1, "Callback", 500, one);
+		u32 interval = cmp->SetInterval(100, IID_Test1, "Callback", 300, 200, two);
+		cmp->SetTimeout(101, IID_Test1, "Callback", 100, one); // no such component, so it'll be dropped
+		u32 cancelled = cmp->SetTimeout(100, IID_Test1, "Callback", 100, one);
+		TS_ASSERT_DIFFERS(timeout, 0u);
+		TS_ASSERT_DIFFERS(timeout, interval);
+		cmp->CancelTimer(cancelled);
+
+		CMessageUpdate msg(fixed::FromFloat(0.2f));
+
+		test.HandleMessage(cmp, msg, false);
+		TS_ASSERT_EQUALS(cmp->GetTime(), 200u);
+		TS_ASSERT_EQUALS(cmp->GetLatestTurnLength(), 200u);
+
+		test.Roundtrip();
+
+		// t=400: the interval's first run
+		test.HandleMessage(cmp, msg, false);
+
+		// t=600: both expired at t=500, so they run in the order they were created
+		test.HandleMessage(cmp, msg, false);
+
+		test.Roundtrip();
+
+		cmp->CancelTimer(interval);
+		test.HandleMessage(cmp, msg, false);
+		TS_ASSERT_EQUALS(cmp->GetTime(), 800u);
+
+		std::string output;
+		TS_ASSERT(scriptInterface.Eval("uneval(calls)", output));
+		TS_ASSERT_STR_EQUALS(output, "[[2, 100], [1, 100], [2, 100]]");
+	}
+
+	void test_order()
+	{
+		ComponentTestHelper test;
+		ScriptInterface& scriptInterface = test.GetScriptInterface();
+		CComponentManager& componentManager = test.GetSimContext().GetComponentManager();
+
+		ICmpTimer* cmp = test.Add<ICmpTimer>(CID_Timer, "", SYSTEM_ENTITY);
+
+		// Run the same timers through the native component and through the
+		// script Timer component it replaced, and check they call back in the same order
+		TS_ASSERT(scriptInterface.Eval(
+			"function ScriptTimer() { this.id = 0; this.time = 0; this.timers = {}; }"
+			"ScriptTimer.prototype.GetTime = function() { return this.time; };"
+			"ScriptTimer.prototype.SetTimeout = function(ent, iid, funcname, time, data) {"
+			"  var id = ++this.id; this.timers[id] = [ent, iid, funcname, this.time + time, 0, data]; return id; };"
+			"ScriptTimer.prototype.SetInterval = function(ent, iid, funcname, time, repeattime, data) {"
+			"  var id = ++this.id; this.timers[id] = [ent, iid, funcname, this.time + time, repeattime, data]; return id; };"
+			"ScriptTimer.prototype.CancelTimer = function(id) { delete this.timers[id]; };"
+			"ScriptTimer.prototype.OnUpdate = function(msg) {"
+			"  this.time += Math.round(msg.turnLength * 1000);"
+			"  var run = [];"
+			"  for (var id in this.timers)"
+			"    if (this.timers[id][3] <= this.time)"
+			"      run.push(id);"
+			"  for each (var id in run) {"
+			"    var t = this.timers[id];"
+			"    if (!t) continue;"
+			"    var cmp = Engine.QueryInterface(t[0], t[1]);"
+			"    if (!cmp) { delete this.timers[id]; continue; }"
+			"    cmp[t[2]](t[5], this.time - t[3]);"
+			"    if (this.timers[id]) { if (t[4]) t[3] += t[4]; else delete this.timers[id]; }"
+			"  }"
+			"};"
+			"var scriptTimer = new ScriptTimer();"
+			"var calls = { native: [], script: [] };"
+			"function GetTimer(which) { return which == 'script' ? scriptTimer : Engine.QueryInterface(SYSTEM_ENTITY, IID_Timer); }"
+			"function TimerTarget() {}"
+			"TimerTarget.prototype.Callback = function(data, lateness) {"
+			"  var timer = GetTimer(data.which);"
+			"  calls[data.which].push(data.name + '@' + timer.GetTime() + '+' + lateness);"
+			"  for each (var id in data.cancel || [])"
+			"    timer.CancelTimer(id);"
+			"  if (data.spawn)"
+			"    timer.SetTimeout(100, IID_Test1, 'Callback', 0, { which: data.which, name: data.spawn });"
+			"};"
+			"Engine.RegisterComponentType(IID_Test1, 'TimerTarget', TimerTarget);"
+			"function AddTimers(which) {"
+			"  var timer = GetTimer(which);"
+			"  timer.SetTimeout(100, IID_Test1, 'Callback', 350, { which: which, name: 'a' });" // 1: expires after 2, in the same turn
+			"  timer.SetTimeout(100, IID_Test1, 'Callback', 250, { which: which, name: 'b' });" // 2
+			"  timer.SetTimeout(100, IID_Test1, 'Callback', 400, { which: which, name: 'c' });" // 3: same time as 4
+			"  timer.SetTimeout(100, IID_Test1, 'Callback', 400, { which: which, name: 'd' });" // 4
+			"  timer.SetInterval(100, IID_Test1, 'Callback', 100, 150, { which: which, name: 'e' });" // 5: runs at most once per turn
+			"  timer.SetTimeout(100, IID_Test1, 'Callback', 600, { which: which, name: 'f', cancel: [7, 5] });" // 6
+			"  timer.SetTimeout(100, IID_Test1, 'Callback', 600, { which: which, name: 'g' });" // 7: cancelled by 6 in the same turn
+			"  timer.SetTimeout(100, IID_Test1, 'Callback', 0, { which: which, name: 'h', spawn: 'i' });" // 8: adds 11 for the next turn
+			"  timer.SetTimeout(101, IID_Test1, 'Callback', 300, { which: which, name: 'j' });" // 9: no such component
+			"  timer.CancelTimer(timer.SetTimeout(100, IID_Test1, 'Callback', 200, { which: which, name: 'k' }));" // 10
+			"}"));
+		CParamNode noParam;
+		TS_ASSERT(componentManager.AddComponent(100, componentManager.LookupCID("TimerTarget"), noParam));
+
+		TS_ASSERT(scriptInterface.Eval("AddTimers('native'); AddTimers('script');"));
+
+		CMessageUpdate msg(fixed::FromFloat(0.2f));
+		for (int i = 0; i < 5; ++i)
+		{
+			test.HandleMessage(cmp, msg, false);
+			TS_ASSERT(scriptInterface.Eval("scriptTimer.OnUpdate({ turnLength: 0.2 })"));
+			if (i == 0)
+				test.Roundtrip();
+		}
+
+		std::string native, script;
+		TS_ASSERT(scriptInterface.Eval("uneval(calls.native)", native));
+		TS_ASSERT(scriptInterface.Eval("uneval(calls.script)", script));
+		TS_ASSERT_STR_EQUALS(native, script);
+		TS_ASSERT_STR_EQUALS(native, "[\"e@200+100\", \"h@200+200\", "
+			"\"a@400+50\", \"b@400+150\", \"c@400+0\", \"d@400+0\", \"e@400+150\", \"i@400+200\", "
+			"\"e@600+200\", \"f@600+0\"]");
+	}
+
+	void test_script_override()
+	{
+		ComponentTestHelper test;
+		ScriptInterface& scriptInterface = test.GetScriptInterface();
+		CComponentManager& componentManager = test.GetSimContext().GetComponentManager();
+
+		// Mods with their own Timer.js register the interface and component type again
+		TestLogger logger;
+		TS_ASSERT(scriptInterface.Eval(
+			"Engine.RegisterInterface('Timer');"
+			"function Timer() {}"
+			"Timer.prototype.Init = function() { this.updates = 0; };"
+			"Timer.prototype.GetTime = function() { return 1234 + this.updates; };"
+			"Timer.prototype.OnUpdate = function(msg) { ++this.updates; };"
+			"Engine.RegisterComponentType(IID_Timer, 'Timer', Timer);"));
+		TS_ASSERT_WSTR_EQUALS(logger.GetOutput(), L"");
+
+		// The script type replaces the native one, keeping its cid
+		TS_ASSERT_EQUALS(componentManager.LookupCID("Timer"), (int)CID_Timer);
+		CParamNode noParam;
+		TS_ASSERT(componentManager.AddComponent(SYSTEM_ENTITY, CID_Timer, noParam));
+
+		ICmpTimer* cmp = static_cast<ICmpTimer*> (componentManager.QueryInterface(SYSTEM_ENTITY, IID_Timer));
+		TS_ASSERT(cmp != NULL);
+		if (!cmp)
+			return;
+		TS_ASSERT_EQUALS(cmp->GetTime(), 1234u);
+
+		// It gets the script's message subscriptions rather than the native ones
+		CMessageUpdate msg(fixed::FromFloat(0.2f));
+		componentManager.BroadcastMessage(msg);
+		TS_ASSERT_EQUALS(cmp->GetTime(), 1235u);
+	}
+
+	void test_script_override_in_use()
+	{
+		ComponentTestHelper test;
+		ScriptInterface& scriptInterface = test.GetScriptInterface();
+		CComponentManager& componentManager = test.GetSimContext().GetComponentManager();
+
+		test.Add<ICmpTimer>(CID_Timer, "", SYSTEM_ENTITY);
+
+		// Native components can't be replaced once they've been constructed
+		TestLogger logger;
+		TS_ASSERT(!scriptInterface.Eval(
+			"function Timer() {}"
+			"Engine.RegisterComponentType(IID_Timer, 'Timer', Timer);"));
+		TS_ASSERT_WSTR_CONTAINS(logger.GetOutput(), L"can't replace native component that's already in use");
+		TS_ASSERT_EQUALS(componentManager.LookupCID("Timer"), (int)CID_Timer);
+	}
+};
@@ -0,0 +1,268 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "EntityIndex.h"
+
+// Size of the spatial index's divisions (in world units), which should be
+// comparable to the ranges that scripts typically search
+static const int DIVISION_SIZE = 64;
+
+EntityIndex::EntityIndex() :
+	m_DivisionSize(entity_pos_t::FromInt(DIVISION_SIZE)), m_DivisionsW(1), m_Divisions(1)
+{
+}
+
+void EntityIndex::Reset(entity_pos_t worldSize)
+{
+	m_Entities.clear();
+	m_ByOwner.clear();
+	m_ByTemplate.clear();
+	m_ByClass.clear();
+
+	m_DivisionsW = (u32)std::max(1, (worldSize / m_DivisionSize).ToInt_RoundToInfinity());
+	m_Divisions.clear();
+	m_Divisions.resize(m_DivisionsW * m_DivisionsW);
+}
+
+void EntityIndex::SetTemplateClasses(const std::map<std::string, std::vector<std::string> >& classes)
+{
+	ENSURE(m_Entities.empty());
+	m_TemplateClasses = classes;
+}
+
+const std::vector<std::string>* EntityIndex::GetClasses(const std::string& templateName) const
+{
+	size_t sep = templateName.rfind('|');
+	std::map<std::string, std::vector<std::string> >::const_iterator it =
+		m_TemplateClasses.find(sep == std::string::npos ? templateName : templateName.substr(sep + 1));
+	if (it == m_TemplateClasses.end())
+		return NULL;
+	return &it->second;
+}
+
+u32 EntityIndex::GetDivision(CFixedVector2D position) const
+{
+	int i = Clamp((position.X / m_DivisionSize).ToInt_RoundToNegInfinity(), 0, (int)m_DivisionsW-1);
+	int j = Clamp((position.Y / m_DivisionSize).ToInt_RoundToNegInfinity(), 0, (int)m_DivisionsW-1);
+	return (u32)(i + j*m_DivisionsW);
+}
+
+void EntityIndex::AddToIndexes(entity_id_t ent, const SEntity& data)
+{
+	m_ByOwner[data.owner].insert(ent);
+	m_ByTemplate[data.templateName].insert(ent);
+
+	const std::vector<std::string>* classes = GetClasses(data.templateName);
+	if (classes)
+		for (size_t i = 0; i < classes->size(); ++i)
+			m_ByClass[(*classes)[i]].insert(ent);
+}
+
+template<typename K>
+static void EraseFromSet(std::map<K, std::set<entity_id_t> >& sets, const K& key, entity_id_t ent)
+{
+	typename std::map<K, std::set<entity_id_t> >::iterator it = sets.find(key);
+	if (it == sets.end())
+		return;
+	it->second.erase(ent);
+	if (it->second.empty())
+		sets.erase(it);
+}
+
+static void EraseFromDivision(std::vector<entity_id_t>& div, entity_id_t ent)
+{
+	for (size_t n = 0; n < div.size(); ++n)
+	{
+		if (div[n] == ent)
+		{
+			// Delete by swapping with the last element then popping
+			div[n] = div.back();
+			div.pop_back();
+			return;
+		}
+	}
+}
+
+void EntityIndex::RemoveFromIndexes(entity_id_t ent, const SEntity& data)
+{
+	EraseFromSet(m_ByOwner, data.owner, ent);
+	EraseFromSet(m_ByTemplate, data.templateName, ent);
+
+	const std::vector<std::string>* classes = GetClasses(data.templateName);
+	if (classes)
+		for (size_t i = 0; i < classes->size(); ++i)
+			EraseFromSet(m_ByClass, (*classes)[i], ent);
+}
+
+void EntityIndex::Update(entity_id_t ent, const std::string& templateName, player_id_t owner, bool inWorld, CFixedVector2D position)
+{
+	SEntity data;
+	data.templateName = templateName;
+	data.owner = owner;
+	data.inWorld = inWorld;
+	data.position = position;
+
+	std::pair<EntityMap<SEntity>::iterator, bool> inserted = m_Entities.insert(std::make_pair(ent, data));
+	if (inserted.second)
+	{
+		AddToIndexes(ent, data);
+		if (inWorld)
+			m_Divisions[GetDivision(position)].push_back(ent);
+		return;
+	}
+
+	SEntity& old = inserted.first->second;
+
+	// Most updates are just units moving, so avoid touching the other indexes
+	if (old.owner != owner || old.templateName != templateName)
+	{
+		RemoveFromIndexes(ent, old);
+		AddToIndexes(ent, data);
+	}
+
+	u32 oldDivision = old.inWorld ? GetDivision(old.position) : (u32)-1;
+	u32 newDivision = inWorld ? GetDivision(position) : (u32)-1;
+	if (oldDivision != newDivision)
+	{
+		if (old.inWorld)
+			EraseFromDivision(m_Divisions[oldDivision], ent);
+		if (inWorld)
+			m_Divisions[newDivision].push_back(ent);
+	}
+
+	old = data;
+}
+
+void EntityIndex::Remove(entity_id_t ent)
+{
+	EntityMap<SEntity>::iterator it = m_Entities.find(ent);
+	if (it == m_Entities.end())
+		return;
+
+	RemoveFromIndexes(ent, it->second);
+	if (it->second.inWorld)
+		EraseFromDivision(m_Divisions[GetDivision(it->second.position)], ent);
+	m_Entities.erase(it);
+}
+
+bool EntityIndex::Matches(entity_id_t ent, const SEntity& data, const Filter& filter) const
+{
+	if (filter.hasOwner && data.owner != filter.owner)
+		return false;
+
+	if (!filter.templateName.empty() && data.templateName != filter.templateName)
+		return false;
+
+	if (!filter.className.empty())
+	{
+		std::map<std::string, EntitySet>::const_iterator it = m_ByClass.find(filter.className);
+		if (it == m_ByClass.end() || !it->second.count(ent))
+			return false;
+	}
+
+	if (filter.hasRange && (!data.inWorld || (data.position - filter.position).CompareLength(filter.range) > 0))
+		return false;
+
+	return true;
+}
+
+void EntityIndex::Query(const Filter& filter, std::vector<entity_id_t>& out) const
+{
+	out.clear();
+
+	// Start from whichever index gives the fewest candidates, then check
+	// them against the rest of the filter
+	const EntitySet* candidates = NULL;
+
+	if (filter.hasOwner)
+	{
+		std::map<player_id_t, EntitySet>::const_iterator it = m_ByOwner.find(filter.owner);
+		if (it == m_ByOwner.end())
+			return;
+		candidates = &it->second;
+	}
+
+	if (!filter.templateName.empty())
+	{
+		std::map<std::string, EntitySet>::const_iterator it = m_ByTemplate.find(filter.templateName);
+		if (it == m_ByTemplate.end())
+			return;
+		if (!candidates || it->second.size() < candidates->size())
+			candidates = &it->second;
+	}
+
+	if (!filter.className.empty())
+	{
+		std::map<std::string, EntitySet>::const_iterator it = m_ByClass.find(filter.className);
+		if (it == m_ByClass.end())
+			return;
+		if (!candidates || it->second.size() < candidates->size())
+			candidates = &it->second;
+	}
+
+	if (filter.hasRange)
+	{
+		CFixedVector2D offset(filter.range, filter.range);
+		u32 div0 = GetDivision(filter.position - offset);
+		u32 div1 = GetDivision(filter.position + offset);
+		u32 i0 = div0 % m_DivisionsW, j0 = div0 / m_DivisionsW;
+		u32 i1 = div1 % m_DivisionsW, j1 = div1 / m_DivisionsW;
+
+		size_t count = 0;
+		for (u32 j = j0; j <= j1; ++j)
+			for (u32 i = i0; i <= i1; ++i)
+				count += m_Divisions[i + j*m_DivisionsW].size();
+
+		if (!candidates || count < candidates->size())
+		{
+			for (u32 j = j0; j <= j1; ++j)
+			{
+				for (u32 i = i0; i <= i1; ++i)
+				{
+					const std::vector<entity_id_t>& div = m_Divisions[i + j*m_DivisionsW];
+					for (size_t n = 0; n < div.size(); ++n)
+					{
+						EntityMap<SEntity>::const_iterator it = m_Entities.find(div[n]);
+						if (Matches(div[n], it->second, filter))
+							out.push_back(div[n]);
+					}
+				}
+			}
+
+			// Each entity is in only one division, so there are no duplicates
+			std::sort(out.begin(), out.end());
+			return;
+		}
+	}
+
+	if (candidates)
+	{
+		for (EntitySet::const_iterator cit = candidates->begin(); cit != candidates->end(); ++cit)
+		{
+			EntityMap<SEntity>::const_iterator it = m_Entities.find(*cit);
+			if (Matches(*cit, it->second, filter))
+				out.push_back(*cit);
+		}
+		return;
+	}
+
+	for (EntityMap<SEntity>::const_iterator it = m_Entities.begin(); it != m_Entities.end(); ++it)
+		if (Matches(it->first, it->second, filter))
+			out.push_back(it->first);
+}
@@ -0,0 +1,126 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_ENTITYINDEX
+#define INCLUDED_ENTITYINDEX
+
+#include "maths/FixedVector2D.h"
+#include "simulation2/helpers/EntityMap.h"
+#include "simulation2/helpers/Player.h"
+#include "simulation2/helpers/Position.h"
+
+#include <map>
+#include <set>
+#include <string>
+
+/**
+ * Index of the entities in the AI game state by owner, template, template class
+ * and position, so the AI scripts can find the entities matching a filter without
+ * iterating over every entity.
+ *
+ * It's updated by the main thread (only for the entities that changed since the
+ * previous turn), and the queries are const and don't modify any shared state,
+ * so any number of AI threads can query it in parallel while it's not being updated.
+ */
+class EntityIndex
+{
+	NONCOPYABLE(EntityIndex);
+public:
+	/**
+	 * Conditions that a query's entities must all match. The default matches everything.
+	 */
+	struct Filter
+	{
+		Filter() : hasOwner(false), owner(INVALID_PLAYER), hasRange(false) { }
+
+		bool hasOwner;
+		player_id_t owner;
+		std::string templateName; // empty for any template
+		std::string className; // empty for any class
+		bool hasRange; // if true, only entities in the world within range of position
+		CFixedVector2D position;
+		entity_pos_t range;
+	};
+
+	EntityIndex();
+
+	/**
+	 * Removes all the entities.
+	 * @param worldSize size of the (square) map, used for the spatial index.
+	 */
+	void Reset(entity_pos_t worldSize);
+
+	/**
+	 * Sets the classes of each template, for class filters. Must be called while
+	 * the index is empty.
+	 */
+	void SetTemplateClasses(const std::map<std::string, std::vector<std::string> >& classes);
+
+	/**
+	 * Adds the entity, or updates its data if it was already added.
+	 * @param inWorld false if the entity doesn't have a position (e.g. it's garrisoned)
+	 */
+	void Update(entity_id_t ent, const std::string& templateName, player_id_t owner, bool inWorld, CFixedVector2D position);
+
+	void Remove(entity_id_t ent);
+
+	size_t GetCount() const { return m_Entities.size(); }
+
+	/**
+	 * Sets @p out to the IDs of all the entities matching the filter, in increasing order.
+	 */
+	void Query(const Filter& filter, std::vector<entity_id_t>& out) const;
+
+private:
+	struct SEntity
+	{
+		std::string templateName;
+		player_id_t owner;
+		bool inWorld;
+		CFixedVector2D position;
+	};
+
+	typedef std::set<entity_id_t> EntitySet;
+
+	/**
+	 * Returns the classes of the given template, ignoring any prefix like
+	 * "foundation|", or NULL if it has none.
+	 */
+	const std::vector<std::string>* GetClasses(const std::string& templateName) const;
+
+	void AddToIndexes(entity_id_t ent, const SEntity& data);
+	void RemoveFromIndexes(entity_id_t ent, const SEntity& data);
+
+	bool Matches(entity_id_t ent, const SEntity& data, const Filter& filter) const;
+
+	u32 GetDivision(CFixedVector2D position) const;
+
+	EntityMap<SEntity> m_Entities;
+	std::map<player_id_t, EntitySet> m_ByOwner;
+	std::map<std::string, EntitySet> m_ByTemplate;
+	std::map<std::string, EntitySet> m_ByClass;
+	std::map<std::string, std::vector<std::string> > m_TemplateClasses;
+
+	// Entities in the world, bucketed by position in a grid of square divisions
+	// (like SpatialSubdivision, but with each entity in exactly one division so
+	// queries don't need any per-query state)
+	entity_pos_t m_DivisionSize;
+	u32 m_DivisionsW;
+	std::vector<std::vector<entity_id_t> > m_Divisions;
+};
+
+#endif // INCLUDED_ENTITYINDEX
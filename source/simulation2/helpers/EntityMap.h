@@ -0,0 +1,308 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_ENTITYMAP
+#define INCLUDED_ENTITYMAP
+
+#include "simulation2/system/Entity.h"
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+/**
+ * Dense replacement for std::map<entity_id_t, T>, intended for storing
+ * per-entity data that is looked up and iterated far more often than it is modified.
+ *
+ * The values are stored in a single contiguous array sorted by entity ID, so
+ * iteration is cache-friendly and has the same deterministic order as std::map
+ * (which the simulation relies on to stay in sync across clients).
+ * Lookups go through a paged index from entity ID to array position, so find()
+ * is O(1) and doesn't depend on the number of entities.
+ *
+ * Entity IDs are allocated incrementally, so insertion is usually an O(1) append.
+ * Inserting out of order is O(n) since the later elements have to be shifted
+ * and reindexed.
+ *
+ * Erasing only marks the element as removed (iteration and lookups skip it), so
+ * destroying many entities doesn't shift the array each time. The removed elements
+ * are packed away by compact(), which should be called after a batch of erasures,
+ * or automatically once they make up half the array.
+ */
+template<typename T>
+class EntityMap
+{
+public:
+	typedef entity_id_t key_type;
+	typedef T mapped_type;
+	typedef std::pair<entity_id_t, T> value_type;
+
+private:
+	typedef std::vector<value_type> Data;
+
+	/**
+	 * Forward iterator over the elements of m_Data, skipping the erased ones
+	 * (whose key has been set to INVALID_ENTITY).
+	 */
+	template<typename Iter, typename Value>
+	class Iterator : public std::iterator<std::forward_iterator_tag, Value>
+	{
+		friend class EntityMap;
+		template<typename, typename> friend class Iterator;
+	public:
+		Iterator() { }
+
+		// Allows conversion from iterator to const_iterator
+		template<typename OtherIter, typename OtherValue>
+		Iterator(const Iterator<OtherIter, OtherValue>& other) : m_It(other.m_It), m_End(other.m_End) { }
+
+		Value& operator*() const { return *m_It; }
+		Value* operator->() const { return &*m_It; }
+
+		Iterator& operator++()
+		{
+			++m_It;
+			SkipErased();
+			return *this;
+		}
+
+		Iterator operator++(int)
+		{
+			Iterator ret = *this;
+			++*this;
+			return ret;
+		}
+
+		bool operator==(const Iterator& rhs) const { return m_It == rhs.m_It; }
+		bool operator!=(const Iterator& rhs) const { return m_It != rhs.m_It; }
+
+	private:
+		Iterator(Iter it, Iter end) : m_It(it), m_End(end)
+		{
+			SkipErased();
+		}
+
+		void SkipErased()
+		{
+			while (m_It != m_End && m_It->first == INVALID_ENTITY)
+				++m_It;
+		}
+
+		Iter m_It;
+		Iter m_End;
+	};
+
+public:
+	typedef Iterator<typename Data::iterator, value_type> iterator;
+	typedef Iterator<typename Data::const_iterator, const value_type> const_iterator;
+
+	EntityMap() : m_NumErased(0)
+	{
+	}
+
+	iterator begin() { return iterator(m_Data.begin(), m_Data.end()); }
+	iterator end() { return iterator(m_Data.end(), m_Data.end()); }
+	const_iterator begin() const { return const_iterator(m_Data.begin(), m_Data.end()); }
+	const_iterator end() const { return const_iterator(m_Data.end(), m_Data.end()); }
+
+	size_t size() const { return m_Data.size() - m_NumErased; }
+	bool empty() const { return size() == 0; }
+
+	iterator find(entity_id_t ent)
+	{
+		index_t idx = GetIndex(ent);
+		if (!idx)
+			return end();
+		return iterator(m_Data.begin() + (idx - 1), m_Data.end());
+	}
+
+	const_iterator find(entity_id_t ent) const
+	{
+		index_t idx = GetIndex(ent);
+		if (!idx)
+			return end();
+		return const_iterator(m_Data.begin() + (idx - 1), m_Data.end());
+	}
+
+	size_t count(entity_id_t ent) const
+	{
+		return GetIndex(ent) ? 1 : 0;
+	}
+
+	/**
+	 * Inserts the value if there isn't already one with the same entity ID.
+	 * @return iterator to the element with that ID, and whether it was newly inserted
+	 * (matching std::map::insert)
+	 */
+	std::pair<iterator, bool> insert(const value_type& value)
+	{
+		ENSURE(value.first != INVALID_ENTITY);
+
+		index_t idx = GetIndex(value.first);
+		if (idx)
+			return std::make_pair(iterator(m_Data.begin() + (idx - 1), m_Data.end()), false);
+
+		// Fast path for the common case of increasing entity IDs
+		if (IsAfterLast(value.first))
+		{
+			m_Data.push_back(value);
+			GetOrCreateIndex(value.first) = (index_t)m_Data.size();
+			return std::make_pair(iterator(m_Data.end() - 1, m_Data.end()), true);
+		}
+
+		// The binary search needs the erased elements to be gone
+		compact();
+
+		typename Data::iterator it = std::lower_bound(m_Data.begin(), m_Data.end(), value, CompareKey());
+		size_t pos = it - m_Data.begin();
+		m_Data.insert(it, value);
+		Reindex(pos);
+		return std::make_pair(iterator(m_Data.begin() + pos, m_Data.end()), true);
+	}
+
+	/**
+	 * Removes the value with the given entity ID, if there is one.
+	 * @return number of elements removed
+	 */
+	size_t erase(entity_id_t ent)
+	{
+		index_t idx = GetIndex(ent);
+		if (!idx)
+			return 0;
+
+		erase(iterator(m_Data.begin() + (idx - 1), m_Data.end()));
+		return 1;
+	}
+
+	/**
+	 * Removes the element. Other iterators stay valid unless this triggers a compact().
+	 */
+	void erase(iterator it)
+	{
+		GetOrCreateIndex(it->first) = 0;
+		it.m_It->first = INVALID_ENTITY;
+		it.m_It->second = T(); // release anything the value owns
+		++m_NumErased;
+
+		if (m_NumErased * 2 > m_Data.size())
+			compact();
+	}
+
+	/**
+	 * Packs away the erased elements, with a single pass over the array.
+	 * This invalidates all iterators.
+	 */
+	void compact()
+	{
+		if (!m_NumErased)
+			return;
+
+		typename Data::iterator first = std::find_if(m_Data.begin(), m_Data.end(), IsErased);
+		size_t pos = first - m_Data.begin();
+		m_Data.erase(std::remove_if(first, m_Data.end(), IsErased), m_Data.end());
+		m_NumErased = 0;
+		Reindex(pos);
+	}
+
+	void clear()
+	{
+		m_Data.clear();
+		m_NumErased = 0;
+		m_Pages[0].clear();
+		m_Pages[1].clear();
+	}
+
+	void swap(EntityMap& other)
+	{
+		m_Data.swap(other.m_Data);
+		std::swap(m_NumErased, other.m_NumErased);
+		m_Pages[0].swap(other.m_Pages[0]);
+		m_Pages[1].swap(other.m_Pages[1]);
+	}
+
+private:
+	// Position in m_Data plus one, so that 0 can mean 'not present'
+	typedef u32 index_t;
+
+	enum { PageBits = 8, PageSize = 1 << PageBits };
+
+	struct CompareKey
+	{
+		bool operator()(const value_type& a, const value_type& b) const
+		{
+			return a.first < b.first;
+		}
+	};
+
+	static bool IsErased(const value_type& value)
+	{
+		return value.first == INVALID_ENTITY;
+	}
+
+	/**
+	 * Returns whether @p ent is greater than every element's ID, so it can be appended.
+	 */
+	bool IsAfterLast(entity_id_t ent) const
+	{
+		for (typename Data::const_reverse_iterator it = m_Data.rbegin(); it != m_Data.rend(); ++it)
+			if (!IsErased(*it))
+				return it->first < ent;
+		return true;
+	}
+
+	// Local entity IDs start at a large offset, so they get a separate page table
+	// to avoid allocating a huge number of empty pages between the two ranges
+	static size_t PageTable(entity_id_t ent) { return ENTITY_IS_LOCAL(ent) ? 1 : 0; }
+	static size_t PageNumber(entity_id_t ent) { return (ent & ~ENTITY_TAGMASK) >> PageBits; }
+	static size_t PageOffset(entity_id_t ent) { return ent & (PageSize - 1); }
+
+	index_t GetIndex(entity_id_t ent) const
+	{
+		const std::vector<std::vector<index_t> >& pages = m_Pages[PageTable(ent)];
+		size_t page = PageNumber(ent);
+		if (page >= pages.size() || pages[page].empty())
+			return 0;
+		return pages[page][PageOffset(ent)];
+	}
+
+	index_t& GetOrCreateIndex(entity_id_t ent)
+	{
+		std::vector<std::vector<index_t> >& pages = m_Pages[PageTable(ent)];
+		size_t page = PageNumber(ent);
+		if (page >= pages.size())
+			pages.resize(page + 1);
+		if (pages[page].empty())
+			pages[page].resize(PageSize, 0);
+		return pages[page][PageOffset(ent)];
+	}
+
+	/**
+	 * Updates the index for every element from position @p pos onwards,
+	 * after they've been shifted by an insertion or compaction.
+	 */
+	void Reindex(size_t pos)
+	{
+		for (size_t i = pos; i < m_Data.size(); ++i)
+			GetOrCreateIndex(m_Data[i].first) = (index_t)(i + 1);
+	}
+
+	Data m_Data; // sorted by ID, except for erased elements
+	size_t m_NumErased; // number of erased elements in m_Data
+	std::vector<std::vector<index_t> > m_Pages[2];
+};
+
+#endif // INCLUDED_ENTITYMAP
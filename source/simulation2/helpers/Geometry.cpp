@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -21,8 +21,18 @@
 
 #include "maths/FixedVector2D.h"
 
+#if ARCH_X86_X64 && HAVE_SSE2
+# include <emmintrin.h>
+# define GEOMETRY_SSE2 1
+#else
+# define GEOMETRY_SSE2 0
+#endif
+
 using namespace Geometry;
 
+// The batch functions read arrays of fixed as arrays of their internal values
+cassert(sizeof(fixed) == sizeof(i32));
+
 // TODO: all of these things could be optimised quite easily
 
 bool Geometry::PointIsInSquare(CFixedVector2D point, CFixedVector2D u, CFixedVector2D v, CFixedVector2D halfSize)
@@ -50,7 +60,9 @@ float Geometry::ChordToCentralAngle(const float chordLength, const float radius)
 	return acosf(1.f - SQR(chordLength)/(2.f*SQR(radius))); // cfr. law of cosines
 }
 
-fixed Geometry::DistanceToSquare(CFixedVector2D point, CFixedVector2D u, CFixedVector2D v, CFixedVector2D halfSize)
+// (du, dv are the location of the point in the square's coordinate system,
+// i.e. point.Dot(u) and point.Dot(v))
+static inline fixed DistanceToSquareProjected(CFixedVector2D point, fixed du, fixed dv, CFixedVector2D u, CFixedVector2D v, CFixedVector2D halfSize)
 {
 	/*
 	 * Relative to its own coordinate system, we have a square like:
@@ -78,10 +90,6 @@ fixed Geometry::DistanceToSquare(CFixedVector2D point, CFixedVector2D u, CFixedV
 	 *
 	 */
 
-	// du, dv are the location of the point in the square's coordinate system
-	fixed du = point.Dot(u);
-	fixed dv = point.Dot(v);
-
 	fixed hw = halfSize.X;
 	fixed hh = halfSize.Y;
 
@@ -116,6 +124,11 @@ fixed Geometry::DistanceToSquare(CFixedVector2D point, CFixedVector2D u, CFixedV
 	}
 }
 
+fixed Geometry::DistanceToSquare(CFixedVector2D point, CFixedVector2D u, CFixedVector2D v, CFixedVector2D halfSize)
+{
+	return DistanceToSquareProjected(point, point.Dot(u), point.Dot(v), u, v, halfSize);
+}
+
 CFixedVector2D Geometry::NearestPointOnSquare(CFixedVector2D point, CFixedVector2D u, CFixedVector2D v, CFixedVector2D halfSize)
 {
 	/*
@@ -333,3 +346,142 @@ bool Geometry::TestSquareSquare(
 
 	return true;
 }
+
+//////////////////////////////////////////////////////////////////////////
+// Batch versions
+
+#if GEOMETRY_SSE2
+/*
+ * The SSE2 versions compute the dot products with doubles, which is exact as
+ * long as the axis components are less than 2^21 (so the products of i32s
+ * with them are less than 2^52). CFixedVector2D::Dot computes floor(s / 2^16)
+ * of the 64-bit sum s, and truncates it to i32, so pairs of points where |s|
+ * might be too large for that are handed to the scalar code to get the same
+ * overflow behaviour.
+ */
+
+static const double DOT_EXACT_AXIS_LIMIT = 2097152.0; // 2^21
+static const double DOT_OVERFLOW_LIMIT = 140737488355328.0; // 2^47
+
+static inline bool AxisIsExact(CFixedVector2D axis)
+{
+	return abs(axis.X.GetInternalValue()) < DOT_EXACT_AXIS_LIMIT && abs(axis.Y.GetInternalValue()) < DOT_EXACT_AXIS_LIMIT;
+}
+
+// Returns a mask of the lanes where the sum might not fit in a fixed after
+// shifting down
+static inline __m128d DotMayOverflow(__m128d sum)
+{
+	const __m128d signMask = _mm_set1_pd(-0.0);
+	return _mm_cmpge_pd(_mm_andnot_pd(signMask, sum), _mm_set1_pd(DOT_OVERFLOW_LIMIT));
+}
+#endif
+
+void Geometry::PointsAreInSquare(size_t count, const fixed* x, const fixed* z, CFixedVector2D u, CFixedVector2D v, CFixedVector2D halfSize, u8* inside)
+{
+	size_t k = 0;
+
+#if GEOMETRY_SSE2
+	if (AxisIsExact(u) && AxisIsExact(v))
+	{
+		// -h <= floor(s / 2^16) <= h  iff  -h * 2^16 <= s < (h+1) * 2^16
+		const __m128d ux = _mm_set1_pd(u.X.GetInternalValue());
+		const __m128d uy = _mm_set1_pd(u.Y.GetInternalValue());
+		const __m128d vx = _mm_set1_pd(v.X.GetInternalValue());
+		const __m128d vy = _mm_set1_pd(v.Y.GetInternalValue());
+		const __m128d uMin = _mm_set1_pd((-halfSize.X).GetInternalValue() * 65536.0);
+		const __m128d uMax = _mm_set1_pd((halfSize.X.GetInternalValue() + 1.0) * 65536.0);
+		const __m128d vMin = _mm_set1_pd((-halfSize.Y).GetInternalValue() * 65536.0);
+		const __m128d vMax = _mm_set1_pd((halfSize.Y.GetInternalValue() + 1.0) * 65536.0);
+
+		const i32* xi = reinterpret_cast<const i32*>(x);
+		const i32* zi = reinterpret_cast<const i32*>(z);
+		for (; k + 2 <= count; k += 2)
+		{
+			__m128d px = _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i*)(xi + k)));
+			__m128d pz = _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i*)(zi + k)));
+			__m128d du = _mm_add_pd(_mm_mul_pd(px, ux), _mm_mul_pd(pz, uy));
+			__m128d dv = _mm_add_pd(_mm_mul_pd(px, vx), _mm_mul_pd(pz, vy));
+
+			if (_mm_movemask_pd(_mm_or_pd(DotMayOverflow(du), DotMayOverflow(dv))))
+			{
+				for (size_t n = k; n < k + 2; ++n)
+					inside[n] = PointIsInSquare(CFixedVector2D(x[n], z[n]), u, v, halfSize) ? 1 : 0;
+				continue;
+			}
+
+			__m128d in = _mm_and_pd(
+				_mm_and_pd(_mm_cmple_pd(uMin, du), _mm_cmplt_pd(du, uMax)),
+				_mm_and_pd(_mm_cmple_pd(vMin, dv), _mm_cmplt_pd(dv, vMax)));
+			int mask = _mm_movemask_pd(in);
+			inside[k] = (u8)(mask & 1);
+			inside[k+1] = (u8)((mask >> 1) & 1);
+		}
+	}
+#endif
+
+	for (; k < count; ++k)
+		inside[k] = PointIsInSquare(CFixedVector2D(x[k], z[k]), u, v, halfSize) ? 1 : 0;
+}
+
+/**
+ * Computes CFixedVector2D(x[k], z[k]).Dot(axis) for every k.
+ */
+static void DotProducts(size_t count, const fixed* x, const fixed* z, CFixedVector2D axis, fixed* out)
+{
+	size_t k = 0;
+
+#if GEOMETRY_SSE2
+	if (AxisIsExact(axis))
+	{
+		const __m128d ax = _mm_set1_pd(axis.X.GetInternalValue());
+		const __m128d ay = _mm_set1_pd(axis.Y.GetInternalValue());
+		const __m128d scale = _mm_set1_pd(1.0 / 65536.0);
+		const __m128d one = _mm_set1_pd(1.0);
+
+		const i32* xi = reinterpret_cast<const i32*>(x);
+		const i32* zi = reinterpret_cast<const i32*>(z);
+		i32* outi = reinterpret_cast<i32*>(out);
+		for (; k + 2 <= count; k += 2)
+		{
+			__m128d px = _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i*)(xi + k)));
+			__m128d pz = _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i*)(zi + k)));
+			__m128d sum = _mm_add_pd(_mm_mul_pd(px, ax), _mm_mul_pd(pz, ay));
+
+			if (_mm_movemask_pd(DotMayOverflow(sum)))
+			{
+				for (size_t n = k; n < k + 2; ++n)
+					out[n] = CFixedVector2D(x[n], z[n]).Dot(axis);
+				continue;
+			}
+
+			// Scaling by a power of two is exact, so we just need to round
+			// towards negative infinity (SSE2 can only truncate)
+			__m128d q = _mm_mul_pd(sum, scale);
+			__m128d t = _mm_cvtepi32_pd(_mm_cvttpd_epi32(q));
+			t = _mm_sub_pd(t, _mm_and_pd(_mm_cmpgt_pd(t, q), one));
+			_mm_storel_epi64((__m128i*)(outi + k), _mm_cvttpd_epi32(t));
+		}
+	}
+#endif
+
+	for (; k < count; ++k)
+		out[k] = CFixedVector2D(x[k], z[k]).Dot(axis);
+}
+
+void Geometry::DistancesToSquare(size_t count, const fixed* x, const fixed* z, CFixedVector2D u, CFixedVector2D v, CFixedVector2D halfSize, fixed* distances)
+{
+	// Do the projections in blocks, so they stay in the cache
+	const size_t blockSize = 64;
+	fixed dv[blockSize];
+
+	for (size_t begin = 0; begin < count; begin += blockSize)
+	{
+		size_t n = std::min(blockSize, count - begin);
+		DotProducts(n, x + begin, z + begin, u, distances + begin);
+		DotProducts(n, x + begin, z + begin, v, dv);
+
+		for (size_t k = 0; k < n; ++k)
+			distances[begin+k] = DistanceToSquareProjected(CFixedVector2D(x[begin+k], z[begin+k]), distances[begin+k], dv[k], u, v, halfSize);
+	}
+}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -53,6 +53,21 @@ CFixedVector2D GetHalfBoundingBox(CFixedVector2D u, CFixedVector2D v, CFixedVect
 
 fixed DistanceToSquare(CFixedVector2D point, CFixedVector2D u, CFixedVector2D v, CFixedVector2D halfSize);
 
+/**
+ * Batch version of PointIsInSquare, for testing many points against one square.
+ * Sets @p inside[k] to 1 if the point (@p x[k], @p z[k]), relative to the center
+ * of the square, is inside it, else 0.
+ * The results are always identical to PointIsInSquare (this uses SIMD when possible).
+ */
+void PointsAreInSquare(size_t count, const fixed* x, const fixed* z, CFixedVector2D u, CFixedVector2D v, CFixedVector2D halfSize, u8* inside);
+
+/**
+ * Batch version of DistanceToSquare: sets @p distances[k] to the distance from the
+ * point (@p x[k], @p z[k]), relative to the center of the square, to its edge.
+ * The results are always identical to DistanceToSquare.
+ */
+void DistancesToSquare(size_t count, const fixed* x, const fixed* z, CFixedVector2D u, CFixedVector2D v, CFixedVector2D halfSize, fixed* distances);
+
 /**
  * Given a circle of radius @p radius, and a chord of length @p chordLength on this circle, computes the central angle formed by 
  * connecting the chord's endpoints to the center of the circle.
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -18,6 +18,7 @@
 #ifndef INCLUDED_GRID
 #define INCLUDED_GRID
 
+#include <algorithm>
 #include <cstring>
 
 #ifdef NDEBUG
@@ -46,7 +47,7 @@ public:
 		reset();
 	}
 
-	Grid(const Grid& g)
+	Grid(const Grid& g) : m_Data(NULL)
 	{
 		*this = g;
 	}
@@ -55,6 +56,7 @@ public:
 	{
 		if (this != &g)
 		{
+			delete[] m_Data;
 			m_W = g.m_W;
 			m_H = g.m_H;
 			m_DirtyID = g.m_DirtyID;
@@ -102,6 +104,65 @@ public:
 	size_t m_DirtyID; // if this is < the id maintained by ICmpObstructionManager then it needs to be updated
 };
 
+/**
+ * Inclusive rectangle of tiles [i0, i1] x [j0, j1], used to describe which part
+ * of a Grid has been modified so that data derived from it can be updated
+ * incrementally.
+ */
+struct GridDirtyRegion
+{
+	GridDirtyRegion() : i0(1), j0(1), i1(0), j1(0)
+	{
+	}
+
+	bool IsEmpty() const
+	{
+		return i1 < i0 || j1 < j0;
+	}
+
+	/**
+	 * Expands the region to include the given tile.
+	 */
+	void Add(u16 i, u16 j)
+	{
+		if (IsEmpty())
+		{
+			i0 = i1 = i;
+			j0 = j1 = j;
+			return;
+		}
+		i0 = std::min(i0, i);
+		j0 = std::min(j0, j);
+		i1 = std::max(i1, i);
+		j1 = std::max(j1, j);
+	}
+
+	/**
+	 * Expands the region to include the other region.
+	 */
+	void Add(const GridDirtyRegion& r)
+	{
+		if (r.IsEmpty())
+			return;
+		Add(r.i0, r.j0);
+		Add(r.i1, r.j1);
+	}
+
+	/**
+	 * Sets the region to cover every tile of a grid with the given size.
+	 */
+	void SetAll(u16 w, u16 h)
+	{
+		i0 = j0 = 0;
+		i1 = (u16)(w - 1);
+		j1 = (u16)(h - 1);
+		if (!w || !h)
+			*this = GridDirtyRegion();
+	}
+
+	u16 i0, j0, i1, j1;
+};
+
 /**
  * Similar to Grid, except optimised for sparse usage (the grid is subdivided into
  * buckets whose contents are only initialised on demand, to save on memset cost).
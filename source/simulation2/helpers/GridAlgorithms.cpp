@@ -0,0 +1,334 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "GridAlgorithms.h"
+
+#include "simulation2/components/ICmpTerritoryManager.h"
+
+#include <boost/unordered_map.hpp>
+
+#include <queue>
+
+// Same test as IS_PASSABLE in CCmpPathfinder_Common.h
+static bool IsPassable(u16 tile, u16 passClass)
+{
+	return (tile & (passClass | 1)) == 0;
+}
+
+// Sets the output grid to the given size, with every tile 0
+template<typename T>
+static void ResetGrid(Grid<T>& grid, u16 w, u16 h)
+{
+	if (grid.m_W != w || grid.m_H != h || !grid.m_Data)
+		grid = Grid<T>(w, h);
+	else
+		grid.reset();
+}
+
+u32 GridAlgorithms::LabelRegions(const Grid<u16>& passability, u16 passClass, Grid<u16>& labels)
+{
+	const u16 w = passability.m_W, h = passability.m_H;
+	ResetGrid(labels, w, h);
+
+	// Units can only move diagonally when both the orthogonal tiles are passable,
+	// so 4-connectivity gives the same regions as the pathfinder
+	u32 count = 0;
+	std::vector<std::pair<u16, u16> > stack;
+	for (u16 j = 0; j < h; ++j)
+	{
+		for (u16 i = 0; i < w; ++i)
+		{
+			if (labels.get(i, j) || !IsPassable(passability.get(i, j), passClass))
+				continue;
+
+			++count;
+			u16 label = (u16)std::min(count, (u32)0xFFFF);
+			labels.set(i, j, label);
+			stack.push_back(std::make_pair(i, j));
+			while (!stack.empty())
+			{
+				u16 ti = stack.back().first, tj = stack.back().second;
+				stack.pop_back();
+
+#define VISIT(ni, nj) \
+				if (!labels.get(ni, nj) && IsPassable(passability.get(ni, nj), passClass)) \
+				{ \
+					labels.set(ni, nj, label); \
+					stack.push_back(std::make_pair((u16)(ni), (u16)(nj))); \
+				}
+
+				if (ti > 0)
+					VISIT(ti-1, tj);
+				if (ti < w-1)
+					VISIT(ti+1, tj);
+				if (tj > 0)
+					VISIT(ti, tj-1);
+				if (tj < h-1)
+					VISIT(ti, tj+1);
+
+#undef VISIT
+			}
+		}
+	}
+
+	return count;
+}
+
+void GridAlgorithms::DistanceTransform(const Grid<u16>& passability, u16 passClass, Grid<u16>& distances)
+{
+	const u16 w = passability.m_W, h = passability.m_H;
+	ResetGrid(distances, w, h);
+
+	// Distances are computed in units of 1/3 tile (so that diagonal steps can
+	// cost 4), treating everything outside the map as impassable
+	const u32 STRAIGHT = 3, DIAGONAL = 4;
+
+	for (u16 j = 0; j < h; ++j)
+		for (u16 i = 0; i < w; ++i)
+			distances.set(i, j, IsPassable(passability.get(i, j), passClass) ? 0xFFFF : 0);
+
+#define DIST(ni, nj) (((ni) < 0 || (nj) < 0 || (ni) >= w || (nj) >= h) ? 0u : (u32)distances.get((ni), (nj)))
+
+	// Forward pass, from the neighbours above and to the left
+	for (int j = 0; j < h; ++j)
+	{
+		for (int i = 0; i < w; ++i)
+		{
+			u32 d = distances.get(i, j);
+			if (d == 0)
+				continue;
+			d = std::min(d, DIST(i-1, j) + STRAIGHT);
+			d = std::min(d, DIST(i, j-1) + STRAIGHT);
+			d = std::min(d, DIST(i-1, j-1) + DIAGONAL);
+			d = std::min(d, DIST(i+1, j-1) + DIAGONAL);
+			distances.set(i, j, (u16)d);
+		}
+	}
+
+	// Backward pass, from the neighbours below and to the right
+	for (int j = h-1; j >= 0; --j)
+	{
+		for (int i = w-1; i >= 0; --i)
+		{
+			u32 d = distances.get(i, j);
+			if (d == 0)
+				continue;
+			d = std::min(d, DIST(i+1, j) + STRAIGHT);
+			d = std::min(d, DIST(i, j+1) + STRAIGHT);
+			d = std::min(d, DIST(i+1, j+1) + DIAGONAL);
+			d = std::min(d, DIST(i-1, j+1) + DIAGONAL);
+			distances.set(i, j, (u16)d);
+		}
+	}
+
+#undef DIST
+
+	for (size_t n = 0; n < (size_t)w*h; ++n)
+		distances.m_Data[n] /= STRAIGHT;
+}
+
+bool GridAlgorithms::FindPlacement(const Grid<u16>& distances, const Grid<u8>& territories, player_id_t player,
+	u16 i0, u16 j0, u16 clearance, u16 maxDistance, u16& i, u16& j)
+{
+	const int w = std::min(distances.m_W, territories.m_W);
+	const int h = std::min(distances.m_H, territories.m_H);
+
+	// Impassable tiles are never suitable, even with no clearance
+	const u16 minDistance = std::max(clearance, (u16)1);
+	const int maxDistSq = (int)maxDistance*maxDistance;
+
+	// Search square rings of increasing radius around the start. The closest tile
+	// in ring r is at most r*sqrt(2) away, so once a tile has been found we only
+	// need to continue until the rings are further away than it
+	bool found = false;
+	int bestDistSq = 0;
+	for (int r = 0; r <= (int)maxDistance; ++r)
+	{
+		if (found && r*r > bestDistSq)
+			break;
+
+		for (int dj = -r; dj <= r; ++dj)
+		{
+			// Only the edges of the ring (the inside was done by previous rings)
+			int step = (dj == -r || dj == r) ? 1 : std::max(2*r, 1);
+			for (int di = -r; di <= r; di += step)
+			{
+				int ti = (int)i0 + di, tj = (int)j0 + dj;
+				if (ti < 0 || tj < 0 || ti >= w || tj >= h)
+					continue;
+
+				int distSq = di*di + dj*dj;
+				if (distSq > maxDistSq || (found && distSq >= bestDistSq))
+					continue;
+
+				if (distances.get(ti, tj) < minDistance)
+					continue;
+
+				if ((territories.get(ti, tj) & ICmpTerritoryManager::TERRITORY_PLAYER_MASK) != player)
+					continue;
+
+				found = true;
+				bestDistSq = distSq;
+				i = (u16)ti;
+				j = (u16)tj;
+			}
+		}
+	}
+
+	return found;
+}
+
+namespace
+{
+	struct PathNode
+	{
+		u32 g; // cost of the cheapest known path from the start
+		u32 parent; // tile index of the previous tile on that path
+	};
+
+	struct OpenItem
+	{
+		u32 f; // g + heuristic
+		u32 g;
+		u32 id;
+
+		// Lowest f first, then the furthest along (to head straight for the
+		// goal when there are many equally good paths), then a fixed order
+		// so the results are deterministic
+		bool operator<(const OpenItem& b) const
+		{
+			if (f != b.f)
+				return f > b.f;
+			if (g != b.g)
+				return g < b.g;
+			return id > b.id;
+		}
+	};
+}
+
+// Octile distance, which is never more than the real cost
+static u32 PathHeuristic(int i0, int j0, int i1, int j1)
+{
+	u32 di = (u32)abs(i0 - i1);
+	u32 dj = (u32)abs(j0 - j1);
+	return GridAlgorithms::COST_STRAIGHT * std::max(di, dj) + (GridAlgorithms::COST_DIAGONAL - GridAlgorithms::COST_STRAIGHT) * std::min(di, dj);
+}
+
+bool GridAlgorithms::FindPath(const Grid<u16>& passability, u16 passClass, u16 i0, u16 j0, u16 i1, u16 j1,
+	u32 maxCost, std::vector<std::pair<u16, u16> >& path)
+{
+	path.clear();
+
+	const int w = passability.m_W, h = passability.m_H;
+	if (i0 >= w || j0 >= h || i1 >= w || j1 >= h)
+		return false;
+	if (!IsPassable(passability.get(i1, j1), passClass))
+		return false;
+	if (PathHeuristic(i0, j0, i1, j1) > maxCost)
+		return false;
+
+	const u32 start = j0*w + i0;
+	const u32 goal = j1*w + i1;
+
+	// Most searches only touch a small part of the map, so store the nodes
+	// sparsely instead of allocating grids the size of the map
+	boost::unordered_map<u32, PathNode> nodes;
+	std::priority_queue<OpenItem> open;
+
+	PathNode startNode = { 0, start };
+	nodes[start] = startNode;
+	OpenItem startItem = { PathHeuristic(i0, j0, i1, j1), 0, start };
+	open.push(startItem);
+
+	bool reached = false;
+	while (!open.empty())
+	{
+		OpenItem item = open.top();
+		open.pop();
+
+		// Skip entries that were superseded by a cheaper path to the same tile
+		if (item.g > nodes[item.id].g)
+			continue;
+
+		if (item.id == goal)
+		{
+			reached = true;
+			break;
+		}
+
+		int i = item.id % w, j = item.id / w;
+		for (int dj = -1; dj <= 1; ++dj)
+		{
+			for (int di = -1; di <= 1; ++di)
+			{
+				if (di == 0 && dj == 0)
+					continue;
+
+				int ni = i + di, nj = j + dj;
+				if (ni < 0 || nj < 0 || ni >= w || nj >= h)
+					continue;
+				if (!IsPassable(passability.get(ni, nj), passClass))
+					continue;
+
+				// Don't cut the corners of impassable tiles
+				if (di && dj && (!IsPassable(passability.get(ni, j), passClass) || !IsPassable(passability.get(i, nj), passClass)))
+					continue;
+
+				u32 g = item.g + ((di && dj) ? COST_DIAGONAL : COST_STRAIGHT);
+				u32 f = g + PathHeuristic(ni, nj, i1, j1);
+				if (f > maxCost)
+					continue;
+
+				u32 id = nj*w + ni;
+				boost::unordered_map<u32, PathNode>::iterator it = nodes.find(id);
+				if (it != nodes.end() && it->second.g <= g)
+					continue;
+
+				PathNode node = { g, item.id };
+				nodes[id] = node;
+				OpenItem next = { f, g, id };
+				open.push(next);
+			}
+		}
+	}
+
+	if (!reached)
+		return false;
+
+	// Walk back from the goal, keeping only the tiles where the direction changes
+	std::vector<u32> tiles;
+	tiles.push_back(goal);
+	for (u32 id = goal, next = goal; id != start; next = id, id = nodes[id].parent)
+	{
+		u32 parent = nodes[id].parent;
+		if (id != goal)
+		{
+			int di0 = (int)(next % w) - (int)(id % w), dj0 = (int)(next / w) - (int)(id / w);
+			int di1 = (int)(id % w) - (int)(parent % w), dj1 = (int)(id / w) - (int)(parent / w);
+			if (di0 == di1 && dj0 == dj1)
+				tiles.pop_back();
+		}
+		tiles.push_back(parent);
+	}
+
+	for (std::vector<u32>::reverse_iterator it = tiles.rbegin(); it != tiles.rend(); ++it)
+		path.push_back(std::make_pair((u16)(*it % w), (u16)(*it / w)));
+
+	return true;
+}
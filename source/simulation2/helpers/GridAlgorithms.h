@@ -0,0 +1,91 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_HELPER_GRIDALGORITHMS
+#define INCLUDED_HELPER_GRIDALGORITHMS
+
+/**
+ * @file
+ * Analysis of passability and territory grids, for the AI scripts (which
+ * would otherwise compute the same things much more slowly in JS).
+ *
+ * These only depend on the grids passed in, so they're safe to call from
+ * the AI threads on the worker's copies of the simulation's grids.
+ *
+ * A tile is passable for a class mask if it has none of the mask's bits set,
+ * nor the pathfinding obstruction bit (like IS_PASSABLE in CCmpPathfinder_Common.h).
+ */
+
+#include "simulation2/helpers/Grid.h"
+#include "simulation2/helpers/Player.h"
+
+#include <vector>
+
+namespace GridAlgorithms
+{
+
+/// Cost of moving to an orthogonally adjacent tile in FindPath
+const u32 COST_STRAIGHT = 256;
+/// Cost of moving to a diagonally adjacent tile in FindPath (256*sqrt(2))
+const u32 COST_DIAGONAL = 362;
+
+/**
+ * Splits the passable tiles into regions, such that a unit of the given class
+ * can move between any two tiles in the same region (e.g. separate islands for
+ * land units, or separate lakes for ships).
+ * @param labels is resized to match @p passability, and set to a region ID
+ *   (starting from 1) for each passable tile and 0 for each impassable tile.
+ *   If there are more than 65535 regions, the rest all get 65535.
+ * @return the number of regions
+ */
+u32 LabelRegions(const Grid<u16>& passability, u16 passClass, Grid<u16>& labels);
+
+/**
+ * Computes the approximate distance (in tiles, rounded down) from each passable
+ * tile to the nearest impassable tile or the edge of the map, using a 3-4 chamfer
+ * distance transform. Impassable tiles get 0, and tiles along the edges of the map get 1.
+ * @param distances is resized to match @p passability
+ */
+void DistanceTransform(const Grid<u16>& passability, u16 passClass, Grid<u16>& distances);
+
+/**
+ * Finds the tile closest to (@p i0, @p j0), within @p maxDistance tiles of it,
+ * that's in @p player's territory and has a distance of at least @p clearance
+ * in @p distances (computed by DistanceTransform).
+ * @return false if there's no such tile
+ */
+bool FindPlacement(const Grid<u16>& distances, const Grid<u8>& territories, player_id_t player,
+	u16 i0, u16 j0, u16 clearance, u16 maxDistance, u16& i, u16& j);
+
+/**
+ * Finds the cheapest path of tiles from (@p i0, @p j0) to (@p i1, @p j1) through
+ * passable tiles, using A* with the same movement rules as the long-range
+ * pathfinder (8 directions, not cutting corners of impassable tiles).
+ * The start tile may be impassable (e.g. if the unit is standing next to a building)
+ * but the goal must not be.
+ * @param maxCost the search gives up on paths costing more than this
+ *   (in units of COST_STRAIGHT per tile), to limit the time spent on unreachable goals
+ * @param path set to the start tile, the tiles where the path changes direction,
+ *   and the goal tile, in that order
+ * @return false if there's no path that's cheap enough
+ */
+bool FindPath(const Grid<u16>& passability, u16 passClass, u16 i0, u16 j0, u16 i1, u16 j1,
+	u32 maxCost, std::vector<std::pair<u16, u16> >& path);
+
+}
+
+#endif // INCLUDED_HELPER_GRIDALGORITHMS
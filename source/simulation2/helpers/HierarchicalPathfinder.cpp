@@ -0,0 +1,493 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "HierarchicalPathfinder.h"
+
+#include "ps/Profile.h"
+#include "simulation2/helpers/PriorityQueue.h"
+
+// Same test as IS_PASSABLE in CCmpPathfinder_Common.h
+static bool IsPassable(u16 tile, HierarchicalPathfinder::pass_class_t passClass)
+{
+	return (tile & (passClass | 1)) == 0;
+}
+
+// Cheap integer approximation of the Euclidean distance between two tiles
+static u32 ApproxDistance(u16 i0, u16 j0, u16 i1, u16 j1)
+{
+	u32 di = (u32)abs((int)i0 - (int)i1);
+	u32 dj = (u32)abs((int)j0 - (int)j1);
+	return std::max(di, dj) + std::min(di, dj)/2;
+}
+
+void HierarchicalPathfinder::Chunk::InitRegions(u8 ci, u8 cj, const Grid<u16>& grid, pass_class_t passClass)
+{
+	m_ChunkI = ci;
+	m_ChunkJ = cj;
+	m_NumRegions = 0;
+	memset(m_Regions, 0, sizeof(m_Regions));
+
+	int i0 = ci * CHUNK_SIZE;
+	int j0 = cj * CHUNK_SIZE;
+	// Chunks on the top/right edges of the map might only be partially filled
+	int w = std::min((int)CHUNK_SIZE, grid.m_W - i0);
+	int h = std::min((int)CHUNK_SIZE, grid.m_H - j0);
+
+	// Flood-fill each connected group of passable tiles with a new region ID
+	std::vector<std::pair<int, int> > stack;
+	for (int j = 0; j < h; ++j)
+	{
+		for (int i = 0; i < w; ++i)
+		{
+			if (m_Regions[j][i] || !IsPassable(grid.get(i0+i, j0+j), passClass))
+				continue;
+
+			u16 r = ++m_NumRegions;
+			m_Regions[j][i] = r;
+			stack.push_back(std::make_pair(i, j));
+
+			while (!stack.empty())
+			{
+				int pi = stack.back().first;
+				int pj = stack.back().second;
+				stack.pop_back();
+
+				const int di[4] = { -1, 1, 0, 0 };
+				const int dj[4] = { 0, 0, -1, 1 };
+				for (int n = 0; n < 4; ++n)
+				{
+					int ni = pi + di[n];
+					int nj = pj + dj[n];
+					if (ni < 0 || ni >= w || nj < 0 || nj >= h)
+						continue;
+					if (m_Regions[nj][ni] || !IsPassable(grid.get(i0+ni, j0+nj), passClass))
+						continue;
+					m_Regions[nj][ni] = r;
+					stack.push_back(std::make_pair(ni, nj));
+				}
+			}
+		}
+	}
+
+	m_GlobalRegions.assign(m_NumRegions + 1, 0);
+
+	// Use the tile nearest to the centroid of each region as its representative
+	// (for estimating distances between regions)
+	std::vector<i64> sumI(m_NumRegions + 1, 0), sumJ(m_NumRegions + 1, 0), count(m_NumRegions + 1, 0);
+	for (int j = 0; j < h; ++j)
+	{
+		for (int i = 0; i < w; ++i)
+		{
+			u16 r = m_Regions[j][i];
+			sumI[r] += i;
+			sumJ[r] += j;
+			count[r] += 1;
+		}
+	}
+
+	m_RegionCenters.assign(m_NumRegions + 1, std::make_pair((u16)i0, (u16)j0));
+	std::vector<i64> bestDist(m_NumRegions + 1, std::numeric_limits<i64>::max());
+	for (int j = 0; j < h; ++j)
+	{
+		for (int i = 0; i < w; ++i)
+		{
+			u16 r = m_Regions[j][i];
+			if (!r)
+				continue;
+			i64 di = i*count[r] - sumI[r];
+			i64 dj = j*count[r] - sumJ[r];
+			i64 dist = di*di + dj*dj;
+			if (dist < bestDist[r])
+			{
+				bestDist[r] = dist;
+				m_RegionCenters[r] = std::make_pair((u16)(i0+i), (u16)(j0+j));
+			}
+		}
+	}
+}
+
+HierarchicalPathfinder::HierarchicalPathfinder() :
+	m_W(0), m_H(0), m_ChunksW(0), m_ChunksH(0)
+{
+}
+
+void HierarchicalPathfinder::Recompute(const Grid<u16>& grid, const std::vector<pass_class_t>& passClasses)
+{
+	PROFILE3("hierarchical pathfinder recompute");
+
+	m_W = grid.m_W;
+	m_H = grid.m_H;
+	m_ChunksW = (u16)((m_W + CHUNK_SIZE-1) / CHUNK_SIZE);
+	m_ChunksH = (u16)((m_H + CHUNK_SIZE-1) / CHUNK_SIZE);
+
+	// Chunk coordinates are stored as u8
+	ENSURE(m_ChunksW <= 256 && m_ChunksH <= 256);
+
+	m_Data.clear();
+
+	for (size_t n = 0; n < passClasses.size(); ++n)
+	{
+		PassClassData& data = m_Data[passClasses[n]];
+		data.m_Chunks.resize(m_ChunksW * m_ChunksH);
+
+		for (u16 cj = 0; cj < m_ChunksH; ++cj)
+			for (u16 ci = 0; ci < m_ChunksW; ++ci)
+				data.m_Chunks[cj*m_ChunksW + ci].InitRegions((u8)ci, (u8)cj, grid, passClasses[n]);
+
+		for (u16 cj = 0; cj < m_ChunksH; ++cj)
+		{
+			for (u16 ci = 0; ci < m_ChunksW; ++ci)
+			{
+				if (ci + 1 < m_ChunksW)
+					AddBorderEdges(data, (u8)ci, (u8)cj, (u8)(ci+1), (u8)cj);
+				if (cj + 1 < m_ChunksH)
+					AddBorderEdges(data, (u8)ci, (u8)cj, (u8)ci, (u8)(cj+1));
+			}
+		}
+
+		RecomputeGlobalRegions(data);
+	}
+}
+
+void HierarchicalPathfinder::Update(const Grid<u16>& grid, const GridDirtyRegion& region)
+{
+	PROFILE3("hierarchical pathfinder update");
+
+	if (grid.m_W != m_W || grid.m_H != m_H)
+	{
+		debug_warn(L"grid size changed without a full recompute");
+		return;
+	}
+
+	if (region.IsEmpty())
+		return;
+
+	u16 ci0 = (u16)(region.i0 / CHUNK_SIZE);
+	u16 cj0 = (u16)(region.j0 / CHUNK_SIZE);
+	u16 ci1 = (u16)(std::min(region.i1, (u16)(m_W-1)) / CHUNK_SIZE);
+	u16 cj1 = (u16)(std::min(region.j1, (u16)(m_H-1)) / CHUNK_SIZE);
+
+	for (std::map<pass_class_t, PassClassData>::iterator it = m_Data.begin(); it != m_Data.end(); ++it)
+	{
+		PassClassData& data = it->second;
+
+		for (u16 cj = cj0; cj <= cj1; ++cj)
+		{
+			for (u16 ci = ci0; ci <= ci1; ++ci)
+			{
+				RemoveChunkEdges(data, (u8)ci, (u8)cj);
+				data.m_Chunks[cj*m_ChunksW + ci].InitRegions((u8)ci, (u8)cj, grid, it->first);
+			}
+		}
+
+		// Reconnect the updated chunks to all their neighbours (including the
+		// other updated ones; duplicate edges are ignored)
+		for (u16 cj = cj0; cj <= cj1; ++cj)
+		{
+			for (u16 ci = ci0; ci <= ci1; ++ci)
+			{
+				if (ci > 0)
+					AddBorderEdges(data, (u8)(ci-1), (u8)cj, (u8)ci, (u8)cj);
+				if (ci + 1 < m_ChunksW)
+					AddBorderEdges(data, (u8)ci, (u8)cj, (u8)(ci+1), (u8)cj);
+				if (cj > 0)
+					AddBorderEdges(data, (u8)ci, (u8)(cj-1), (u8)ci, (u8)cj);
+				if (cj + 1 < m_ChunksH)
+					AddBorderEdges(data, (u8)ci, (u8)cj, (u8)ci, (u8)(cj+1));
+			}
+		}
+
+		// The connectivity of the whole map might have changed, but the region graph
+		// is small compared to the grid so it's cheap to relabel everything
+		RecomputeGlobalRegions(data);
+	}
+}
+
+bool HierarchicalPathfinder::HasPassClass(pass_class_t passClass) const
+{
+	return m_Data.find(passClass) != m_Data.end();
+}
+
+HierarchicalPathfinder::RegionID HierarchicalPathfinder::Get(u16 i, u16 j, pass_class_t passClass) const
+{
+	std::map<pass_class_t, PassClassData>::const_iterator it = m_Data.find(passClass);
+	if (it == m_Data.end() || i >= m_W || j >= m_H)
+		return RegionID(0, 0, 0);
+
+	u8 ci = (u8)(i / CHUNK_SIZE);
+	u8 cj = (u8)(j / CHUNK_SIZE);
+	const Chunk& chunk = GetChunk(it->second, ci, cj);
+	return RegionID(ci, cj, chunk.m_Regions[j % CHUNK_SIZE][i % CHUNK_SIZE]);
+}
+
+u32 HierarchicalPathfinder::GetGlobalRegion(u16 i, u16 j, pass_class_t passClass) const
+{
+	RegionID region = Get(i, j, passClass);
+	if (!region.r)
+		return 0;
+
+	const Chunk& chunk = GetChunk(m_Data.find(passClass)->second, region.ci, region.cj);
+	return chunk.m_GlobalRegions[region.r];
+}
+
+bool HierarchicalPathfinder::FindNearestReachableTile(u16 i0, u16 j0, u16& i, u16& j, pass_class_t passClass) const
+{
+	u32 component = GetGlobalRegion(i0, j0, passClass);
+	if (!component)
+		return false;
+
+	const PassClassData& data = m_Data.find(passClass)->second;
+
+	// Find the chunks containing part of the component, sorted by the
+	// smallest possible squared distance from the target to any of their tiles
+	std::vector<std::pair<u32, size_t> > candidates;
+	for (size_t n = 0; n < data.m_Chunks.size(); ++n)
+	{
+		const Chunk& chunk = data.m_Chunks[n];
+		if (std::find(chunk.m_GlobalRegions.begin(), chunk.m_GlobalRegions.end(), component) == chunk.m_GlobalRegions.end())
+			continue;
+
+		int ci0 = chunk.m_ChunkI * CHUNK_SIZE;
+		int cj0 = chunk.m_ChunkJ * CHUNK_SIZE;
+		int di = std::max(0, std::max(ci0 - (int)i, (int)i - (ci0 + CHUNK_SIZE - 1)));
+		int dj = std::max(0, std::max(cj0 - (int)j, (int)j - (cj0 + CHUNK_SIZE - 1)));
+		candidates.push_back(std::make_pair((u32)(di*di + dj*dj), n));
+	}
+	std::sort(candidates.begin(), candidates.end());
+
+	u32 bestDist = std::numeric_limits<u32>::max();
+	u16 bestI = i0, bestJ = j0;
+	for (size_t n = 0; n < candidates.size(); ++n)
+	{
+		// Stop once no remaining chunk can contain a nearer tile
+		if (candidates[n].first >= bestDist)
+			break;
+
+		const Chunk& chunk = data.m_Chunks[candidates[n].second];
+		int ci0 = chunk.m_ChunkI * CHUNK_SIZE;
+		int cj0 = chunk.m_ChunkJ * CHUNK_SIZE;
+		for (int tj = 0; tj < CHUNK_SIZE; ++tj)
+		{
+			for (int ti = 0; ti < CHUNK_SIZE; ++ti)
+			{
+				u16 r = chunk.m_Regions[tj][ti];
+				if (!r || chunk.m_GlobalRegions[r] != component)
+					continue;
+
+				int di = ci0 + ti - (int)i;
+				int dj = cj0 + tj - (int)j;
+				u32 dist = (u32)(di*di + dj*dj);
+				if (dist < bestDist)
+				{
+					bestDist = dist;
+					bestI = (u16)(ci0 + ti);
+					bestJ = (u16)(cj0 + tj);
+				}
+			}
+		}
+	}
+
+	i = bestI;
+	j = bestJ;
+	return true;
+}
+
+bool HierarchicalPathfinder::ComputeCorridor(u16 i0, u16 j0, u16 iGoal, u16 jGoal, const std::set<RegionID>& goals,
+	pass_class_t passClass, Grid<u8>& corridor) const
+{
+	RegionID start = Get(i0, j0, passClass);
+	if (!start.r)
+		return false;
+
+	const PassClassData& data = m_Data.find(passClass)->second;
+
+	// A* over the region graph, using the distances between region centers as costs
+	typedef PriorityQueueHeap<RegionID, u32> RegionQueue;
+	RegionQueue open;
+	std::map<RegionID, u32> costs;
+	std::map<RegionID, RegionID> preds;
+	std::set<RegionID> closed;
+
+	const std::pair<u16, u16>& startCenter = GetChunk(data, start.ci, start.cj).m_RegionCenters[start.r];
+	RegionQueue::Item startItem = { start, ApproxDistance(startCenter.first, startCenter.second, iGoal, jGoal) };
+	open.push(startItem);
+	costs.insert(std::make_pair(start, 0u));
+
+	bool found = false;
+	RegionID curr = start;
+	while (!open.empty())
+	{
+		curr = open.pop().id;
+		if (goals.count(curr))
+		{
+			found = true;
+			break;
+		}
+
+		closed.insert(curr);
+
+		EdgesMap::const_iterator edges = data.m_Edges.find(curr);
+		if (edges == data.m_Edges.end())
+			continue;
+
+		u32 g = costs.find(curr)->second;
+		const std::pair<u16, u16>& center = GetChunk(data, curr.ci, curr.cj).m_RegionCenters[curr.r];
+
+		for (std::set<RegionID>::const_iterator it = edges->second.begin(); it != edges->second.end(); ++it)
+		{
+			if (closed.count(*it))
+				continue;
+
+			const std::pair<u16, u16>& neighbourCenter = GetChunk(data, it->ci, it->cj).m_RegionCenters[it->r];
+			u32 dg = g + ApproxDistance(center.first, center.second, neighbourCenter.first, neighbourCenter.second);
+			u32 h = ApproxDistance(neighbourCenter.first, neighbourCenter.second, iGoal, jGoal);
+
+			std::map<RegionID, u32>::iterator cost = costs.find(*it);
+			if (cost == costs.end())
+			{
+				costs.insert(std::make_pair(*it, dg));
+				preds.insert(std::make_pair(*it, curr));
+				RegionQueue::Item item = { *it, dg + h };
+				open.push(item);
+			}
+			else if (dg < cost->second)
+			{
+				cost->second = dg;
+				preds.find(*it)->second = curr;
+				open.promote(*it, dg + h);
+			}
+		}
+	}
+
+	if (!found)
+		return false;
+
+	// Mark every chunk along the route, with a margin so the tile search
+	// has a bit of freedom to smooth out the path
+	while (true)
+	{
+		for (int dj = -1; dj <= 1; ++dj)
+		{
+			for (int di = -1; di <= 1; ++di)
+			{
+				int ci = curr.ci + di;
+				int cj = curr.cj + dj;
+				if (ci >= 0 && ci < m_ChunksW && cj >= 0 && cj < m_ChunksH)
+					corridor.set(ci, cj, 1);
+			}
+		}
+
+		if (curr == start)
+			break;
+		curr = preds.find(curr)->second;
+	}
+
+	return true;
+}
+
+void HierarchicalPathfinder::AddBorderEdges(PassClassData& data, u8 ci, u8 cj, u8 ci2, u8 cj2)
+{
+	const Chunk& a = GetChunk(data, ci, cj);
+	const Chunk& b = GetChunk(data, ci2, cj2);
+
+	// (a is always to the left of or below b, and is a full-sized chunk since
+	// there's another chunk after it)
+	for (int n = 0; n < CHUNK_SIZE; ++n)
+	{
+		u16 ra, rb;
+		if (ci2 != ci)
+		{
+			ra = a.m_Regions[n][CHUNK_SIZE-1];
+			rb = b.m_Regions[n][0];
+		}
+		else
+		{
+			ra = a.m_Regions[CHUNK_SIZE-1][n];
+			rb = b.m_Regions[0][n];
+		}
+
+		if (ra && rb)
+		{
+			RegionID idA(ci, cj, ra);
+			RegionID idB(ci2, cj2, rb);
+			data.m_Edges[idA].insert(idB);
+			data.m_Edges[idB].insert(idA);
+		}
+	}
+}
+
+void HierarchicalPathfinder::RemoveChunkEdges(PassClassData& data, u8 ci, u8 cj)
+{
+	const Chunk& chunk = GetChunk(data, ci, cj);
+	for (u16 r = 1; r <= chunk.m_NumRegions; ++r)
+	{
+		RegionID id(ci, cj, r);
+		EdgesMap::iterator edges = data.m_Edges.find(id);
+		if (edges == data.m_Edges.end())
+			continue;
+
+		for (std::set<RegionID>::const_iterator it = edges->second.begin(); it != edges->second.end(); ++it)
+			data.m_Edges[*it].erase(id);
+
+		data.m_Edges.erase(edges);
+	}
+}
+
+void HierarchicalPathfinder::RecomputeGlobalRegions(PassClassData& data)
+{
+	for (size_t n = 0; n < data.m_Chunks.size(); ++n)
+		data.m_Chunks[n].m_GlobalRegions.assign(data.m_Chunks[n].m_NumRegions + 1, 0);
+
+	// Flood-fill the region graph, assigning IDs in chunk order so the labels are deterministic
+	u32 nextID = 1;
+	std::vector<RegionID> stack;
+	for (size_t n = 0; n < data.m_Chunks.size(); ++n)
+	{
+		Chunk& chunk = data.m_Chunks[n];
+		for (u16 r = 1; r <= chunk.m_NumRegions; ++r)
+		{
+			if (chunk.m_GlobalRegions[r])
+				continue;
+
+			u32 id = nextID++;
+			chunk.m_GlobalRegions[r] = id;
+			stack.push_back(RegionID(chunk.m_ChunkI, chunk.m_ChunkJ, r));
+
+			while (!stack.empty())
+			{
+				RegionID curr = stack.back();
+				stack.pop_back();
+
+				EdgesMap::const_iterator edges = data.m_Edges.find(curr);
+				if (edges == data.m_Edges.end())
+					continue;
+
+				for (std::set<RegionID>::const_iterator it = edges->second.begin(); it != edges->second.end(); ++it)
+				{
+					u32& neighbourID = data.m_Chunks[it->cj*m_ChunksW + it->ci].m_GlobalRegions[it->r];
+					if (!neighbourID)
+					{
+						neighbourID = id;
+						stack.push_back(*it);
+					}
+				}
+			}
+		}
+	}
+}
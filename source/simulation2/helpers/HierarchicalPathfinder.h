@@ -0,0 +1,164 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_HIERARCHICALPATHFINDER
+#define INCLUDED_HIERARCHICALPATHFINDER
+
+#include "simulation2/components/ICmpPathfinder.h"
+#include "simulation2/helpers/Grid.h"
+
+#include <map>
+#include <set>
+
+/**
+ * Coarse abstraction of the tile pathfinder's passability grid, used to
+ * speed up long paths.
+ *
+ * The map is split into square chunks of CHUNK_SIZE tiles, and the passable
+ * tiles of each chunk are split into regions that are (4-)connected within
+ * that chunk. Regions in adjacent chunks are linked when they share a border,
+ * and the resulting graph is labelled with connected component ('global region')
+ * IDs. That lets us tell in constant time whether one tile is reachable from
+ * another, and quickly find a corridor of chunks that a tile-level search
+ * can be restricted to.
+ *
+ * The data is computed separately for each passability class. It's derived
+ * entirely from the passability grid so it doesn't need to be serialized,
+ * and can be updated incrementally when only part of the grid changes.
+ *
+ * A tile is passable if IS_PASSABLE(tile, passClass), i.e. it has neither the
+ * class's bit nor the pathfinding obstruction bit set.
+ */
+class HierarchicalPathfinder
+{
+public:
+	typedef ICmpPathfinder::pass_class_t pass_class_t;
+
+	/// Number of tiles along each side of a chunk
+	static const u16 CHUNK_SIZE = 16;
+
+	struct RegionID
+	{
+		u8 ci, cj; // chunk coordinates
+		u16 r; // region ID within the chunk; 0 means impassable
+
+		RegionID(u8 ci, u8 cj, u16 r) : ci(ci), cj(cj), r(r) { }
+
+		bool operator<(const RegionID& b) const
+		{
+			if (cj != b.cj)
+				return cj < b.cj;
+			if (ci != b.ci)
+				return ci < b.ci;
+			return r < b.r;
+		}
+
+		bool operator==(const RegionID& b) const
+		{
+			return ci == b.ci && cj == b.cj && r == b.r;
+		}
+	};
+
+	HierarchicalPathfinder();
+
+	/**
+	 * Recomputes all the data from the given passability grid.
+	 * @param passClasses masks of the passability classes to compute regions for
+	 */
+	void Recompute(const Grid<u16>& grid, const std::vector<pass_class_t>& passClasses);
+
+	/**
+	 * Recomputes the chunks overlapping the given region, when the rest of
+	 * the grid hasn't changed since the last call to Recompute or Update.
+	 */
+	void Update(const Grid<u16>& grid, const GridDirtyRegion& region);
+
+	/**
+	 * Returns whether there is any data for the given passability class.
+	 */
+	bool HasPassClass(pass_class_t passClass) const;
+
+	u16 GetChunksW() const { return m_ChunksW; }
+	u16 GetChunksH() const { return m_ChunksH; }
+
+	/**
+	 * Returns the region containing the given tile (with r = 0 if the tile is impassable).
+	 */
+	RegionID Get(u16 i, u16 j, pass_class_t passClass) const;
+
+	/**
+	 * Returns the connected component ID of the given tile, or 0 if the tile is
+	 * impassable. Two passable tiles are reachable from each other if and only if
+	 * they have the same ID.
+	 */
+	u32 GetGlobalRegion(u16 i, u16 j, pass_class_t passClass) const;
+
+	/**
+	 * Replaces (i, j) with the tile nearest to it (by Euclidean distance) that is
+	 * reachable from the passable tile (i0, j0).
+	 * @return false, leaving (i, j) unchanged, if (i0, j0) is impassable
+	 */
+	bool FindNearestReachableTile(u16 i0, u16 j0, u16& i, u16& j, pass_class_t passClass) const;
+
+	/**
+	 * Searches the region graph for a route from the region containing the tile (i0, j0)
+	 * to any of the @p goals regions, heading towards the tile (iGoal, jGoal).
+	 * The chunks along the route plus a margin of one chunk around them are set to 1
+	 * in @p corridor, which must have GetChunksW() x GetChunksH() cells.
+	 * @return false if none of the goals are reachable
+	 */
+	bool ComputeCorridor(u16 i0, u16 j0, u16 iGoal, u16 jGoal, const std::set<RegionID>& goals,
+		pass_class_t passClass, Grid<u8>& corridor) const;
+
+private:
+	struct Chunk
+	{
+		u8 m_ChunkI, m_ChunkJ;
+		u16 m_NumRegions;
+		u16 m_Regions[CHUNK_SIZE][CHUNK_SIZE]; // region ID of each tile, [j][i] relative to the chunk corner
+
+		// Indexed by region ID (entry 0 is unused):
+		std::vector<u32> m_GlobalRegions;
+		std::vector<std::pair<u16, u16> > m_RegionCenters; // representative tile of each region
+
+		void InitRegions(u8 ci, u8 cj, const Grid<u16>& grid, pass_class_t passClass);
+	};
+
+	typedef std::map<RegionID, std::set<RegionID> > EdgesMap;
+
+	struct PassClassData
+	{
+		std::vector<Chunk> m_Chunks; // [cj*m_ChunksW + ci]
+		EdgesMap m_Edges;
+	};
+
+	const Chunk& GetChunk(const PassClassData& data, u8 ci, u8 cj) const
+	{
+		return data.m_Chunks[cj*m_ChunksW + ci];
+	}
+
+	void AddBorderEdges(PassClassData& data, u8 ci, u8 cj, u8 ci2, u8 cj2);
+	void RemoveChunkEdges(PassClassData& data, u8 ci, u8 cj);
+	void RecomputeGlobalRegions(PassClassData& data);
+
+	u16 m_W, m_H; // size of the grid in tiles
+	u16 m_ChunksW, m_ChunksH;
+
+	std::map<pass_class_t, PassClassData> m_Data;
+};
+
+#endif // INCLUDED_HIERARCHICALPATHFINDER
@@ -0,0 +1,176 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_LOSCOUNTS
+#define INCLUDED_LOSCOUNTS
+
+/**
+ * @file
+ * Helpers for updating strips of the per-vertex LOS counters in CCmpRangeManager.
+ *
+ * Each counter is the number of a player's units that can see a vertex, and the
+ * LOS state only needs updating when a counter changes to or from zero. Most
+ * updates don't cross zero (units usually overlap their neighbours' vision), so
+ * the counters are updated several at a time with SIMD instructions when
+ * available, and a callback is only called for the few that cross zero.
+ */
+
+#if ARCH_X86_X64 && HAVE_SSE2
+# include <emmintrin.h>
+# define LOS_COUNTS_SSE2 1
+#else
+# define LOS_COUNTS_SSE2 0
+#endif
+
+#if ARCH_ARM && (defined(__ARM_NEON__) || defined(__ARM_NEON))
+# include <arm_neon.h>
+# define LOS_COUNTS_NEON 1
+#else
+# define LOS_COUNTS_NEON 0
+#endif
+
+/**
+ * Increments counts[start..n-1], calling becameVisible(k) (before incrementing) for each k
+ * where counts[k] was zero.
+ * This is the plain implementation, which LosIncrementCounts must match.
+ */
+template<typename F>
+inline void LosIncrementCountsScalar(u16* counts, size_t n, F& becameVisible, size_t start = 0)
+{
+	for (size_t k = start; k < n; ++k)
+	{
+		if (counts[k] == 0)
+			becameVisible(k);
+
+		ASSERT(counts[k] < 65535);
+		counts[k] = (u16)(counts[k] + 1); // ignore overflow; the player should never have 64K units
+	}
+}
+
+/**
+ * Decrements counts[start..n-1] (which must all be non-zero), calling becameHidden(k)
+ * (after decrementing) for each k where counts[k] becomes zero.
+ * This is the plain implementation, which LosDecrementCounts must match.
+ */
+template<typename F>
+inline void LosDecrementCountsScalar(u16* counts, size_t n, F& becameHidden, size_t start = 0)
+{
+	for (size_t k = start; k < n; ++k)
+	{
+		ASSERT(counts[k] > 0);
+		counts[k] = (u16)(counts[k] - 1);
+
+		if (counts[k] == 0)
+			becameHidden(k);
+	}
+}
+
+/**
+ * Equivalent to LosIncrementCountsScalar, but faster.
+ */
+template<typename F>
+inline void LosIncrementCounts(u16* counts, size_t n, F& becameVisible)
+{
+	size_t k = 0;
+
+#if LOS_COUNTS_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16(1);
+	for (; k + 8 <= n; k += 8)
+	{
+		__m128i c = _mm_loadu_si128((const __m128i*)(counts + k));
+		ASSERT(_mm_movemask_epi8(_mm_cmpeq_epi16(c, _mm_set1_epi16(-1))) == 0);
+
+		// Two bits per counter that was zero
+		int wasZero = _mm_movemask_epi8(_mm_cmpeq_epi16(c, zero));
+		_mm_storeu_si128((__m128i*)(counts + k), _mm_add_epi16(c, one));
+
+		if (wasZero)
+		{
+			for (size_t l = 0; l < 8; ++l)
+				if (wasZero & (1 << (2*l)))
+					becameVisible(k + l);
+		}
+	}
+#elif LOS_COUNTS_NEON
+	const uint16x8_t one = vdupq_n_u16(1);
+	for (; k + 8 <= n; k += 8)
+	{
+		uint16x8_t c = vld1q_u16(counts + k);
+		uint64x2_t wasZero = vreinterpretq_u64_u16(vceqq_u16(c, vdupq_n_u16(0)));
+		vst1q_u16(counts + k, vaddq_u16(c, one));
+
+		if (vgetq_lane_u64(wasZero, 0) | vgetq_lane_u64(wasZero, 1))
+		{
+			for (size_t l = 0; l < 8; ++l)
+				if (counts[k + l] == 1)
+					becameVisible(k + l);
+		}
+	}
+#endif
+
+	LosIncrementCountsScalar(counts, n, becameVisible, k);
+}
+
+/**
+ * Equivalent to LosDecrementCountsScalar, but faster.
+ */
+template<typename F>
+inline void LosDecrementCounts(u16* counts, size_t n, F& becameHidden)
+{
+	size_t k = 0;
+
+#if LOS_COUNTS_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16(1);
+	for (; k + 8 <= n; k += 8)
+	{
+		__m128i c = _mm_loadu_si128((const __m128i*)(counts + k));
+		ASSERT(_mm_movemask_epi8(_mm_cmpeq_epi16(c, zero)) == 0);
+
+		c = _mm_sub_epi16(c, one);
+		_mm_storeu_si128((__m128i*)(counts + k), c);
+
+		int isZero = _mm_movemask_epi8(_mm_cmpeq_epi16(c, zero));
+		if (isZero)
+		{
+			for (size_t l = 0; l < 8; ++l)
+				if (isZero & (1 << (2*l)))
+					becameHidden(k + l);
+		}
+	}
+#elif LOS_COUNTS_NEON
+	const uint16x8_t one = vdupq_n_u16(1);
+	for (; k + 8 <= n; k += 8)
+	{
+		uint16x8_t c = vsubq_u16(vld1q_u16(counts + k), one);
+		vst1q_u16(counts + k, c);
+
+		uint64x2_t isZero = vreinterpretq_u64_u16(vceqq_u16(c, vdupq_n_u16(0)));
+		if (vgetq_lane_u64(isZero, 0) | vgetq_lane_u64(isZero, 1))
+		{
+			for (size_t l = 0; l < 8; ++l)
+				if (counts[k + l] == 0)
+					becameHidden(k + l);
+		}
+	}
+#endif
+
+	LosDecrementCountsScalar(counts, n, becameHidden, k);
+}
+
+#endif // INCLUDED_LOSCOUNTS
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -123,6 +123,162 @@ public:
 	std::vector<Item> m_Heap;
 };
 
+/**
+ * Priority queue implemented as a D-ary heap (4-ary by default, which keeps each
+ * node's children in a single cache line and makes the heap shallower), which
+ * also records the heap position of every queued ID so that find() and
+ * promote() are O(1) and O(log n) instead of a linear search.
+ *
+ * IDs are mapped onto the position array by @p Indexer, which must give each ID
+ * a distinct index less than the size passed to reset(); reset() must be called
+ * before using the queue.
+ */
+template <typename ID, typename R, typename Indexer, typename CMP = std::less<R>, size_t D = 4>
+class PriorityQueueIndexedHeap
+{
+public:
+	struct Item
+	{
+		ID id;
+		R rank; // f = g+h (estimated total cost of path through here)
+	};
+
+	/**
+	 * Empty the queue, and prepare it for IDs with indexes less than @p numIndexes.
+	 */
+	void reset(size_t numIndexes, const Indexer& indexer)
+	{
+		m_Heap.clear();
+		m_Positions.assign(numIndexes, (u32)NOT_QUEUED); // (cast to avoid binding a reference to the static constant)
+		m_Indexer = indexer;
+	}
+
+	void push(const Item& item)
+	{
+#if PRIORITYQUEUE_DEBUG
+		ENSURE(m_Positions.at(m_Indexer(item.id)) == NOT_QUEUED);
+#endif
+		m_Heap.push_back(item);
+		SiftUp(m_Heap.size()-1);
+	}
+
+	Item* find(ID id)
+	{
+		u32 pos = m_Positions[m_Indexer(id)];
+		if (pos == NOT_QUEUED)
+			return NULL;
+		return &m_Heap[pos];
+	}
+
+	void promote(ID id, R newrank)
+	{
+		u32 pos = m_Positions[m_Indexer(id)];
+		if (pos == NOT_QUEUED)
+		{
+			debug_warn(L"promoting tile that isn't in queue");
+			return;
+		}
+#if PRIORITYQUEUE_DEBUG
+		ENSURE(!CMP()(m_Heap[pos].rank, newrank));
+#endif
+		m_Heap[pos].rank = newrank;
+		SiftUp(pos);
+	}
+
+	Item pop()
+	{
+#if PRIORITYQUEUE_DEBUG
+		ENSURE(m_Heap.size());
+#endif
+		Item r = m_Heap.front();
+		m_Positions[m_Indexer(r.id)] = NOT_QUEUED;
+		if (m_Heap.size() > 1)
+		{
+			m_Heap.front() = m_Heap.back();
+			m_Heap.pop_back();
+			SiftDown(0);
+		}
+		else
+		{
+			m_Heap.pop_back();
+		}
+		return r;
+	}
+
+	bool empty()
+	{
+		return m_Heap.empty();
+	}
+
+	size_t size()
+	{
+		return m_Heap.size();
+	}
+
+	std::vector<Item> m_Heap;
+
+private:
+	static const u32 NOT_QUEUED = 0xFFFFFFFF;
+
+	// Store item at the given heap position
+	void Place(size_t pos, const Item& item)
+	{
+		m_Heap[pos] = item;
+		m_Positions[m_Indexer(item.id)] = (u32)pos;
+	}
+
+	// Move the item at pos towards the root until it's below a higher-priority one
+	void SiftUp(size_t pos)
+	{
+		Item item = m_Heap[pos];
+		while (pos > 0)
+		{
+			size_t parent = (pos - 1) / D;
+			if (!QueueItemPriority<Item, CMP>()(m_Heap[parent], item))
+				break;
+			Place(pos, m_Heap[parent]);
+			pos = parent;
+		}
+		Place(pos, item);
+	}
+
+	// Move the item at pos towards the leaves until its children are all lower priority
+	void SiftDown(size_t pos)
+	{
+		Item item = m_Heap[pos];
+		const size_t n = m_Heap.size();
+		while (true)
+		{
+			size_t first = pos*D + 1;
+			if (first >= n)
+				break;
+			size_t last = std::min(first + D, n);
+			size_t best = first;
+			for (size_t c = first + 1; c < last; ++c)
+				if (QueueItemPriority<Item, CMP>()(m_Heap[best], m_Heap[c]))
+					best = c;
+			if (!QueueItemPriority<Item, CMP>()(item, m_Heap[best]))
+				break;
+			Place(pos, m_Heap[best]);
+			pos = best;
+		}
+		Place(pos, item);
+	}
+
+	std::vector<u32> m_Positions; // index into m_Heap for each ID's index, or NOT_QUEUED
+	Indexer m_Indexer;
+};
+
+/**
+ * Indexer for PriorityQueueIndexedHeap with (i, j) tile IDs on a grid of the given width.
+ */
+struct TileIDIndexer
+{
+	TileIDIndexer(u16 w = 0) : w(w) { }
+	size_t operator()(const std::pair<u16, u16>& id) const { return (size_t)id.second * w + id.first; }
+	u16 w;
+};
+
 /**
  * Priority queue implemented as an unsorted array.
  * This means pop() is O(n), but push and promote are O(1), and n is typically small
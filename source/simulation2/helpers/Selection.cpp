@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -26,9 +26,40 @@
 #include "simulation2/components/ICmpRangeManager.h"
 #include "simulation2/components/ICmpTemplateManager.h"
 #include "simulation2/components/ICmpSelectable.h"
+#include "simulation2/components/ICmpUnitRenderer.h"
 #include "simulation2/components/ICmpVisual.h"
 #include "ps/CLogger.h"
 
+typedef std::vector<std::pair<entity_id_t, ICmpSelectable*> > SelectableList;
+
+/**
+ * Finds the selectable entities that might be on screen: the ones that the
+ * UnitRenderer drew in the last frame (so picking scales with what's visible,
+ * not with the total number of entities), or every selectable entity if
+ * nothing has been rendered yet.
+ */
+static void GetOnScreenSelectables(CSimulation2& simulation, SelectableList& selectables)
+{
+	CmpPtr<ICmpUnitRenderer> cmpUnitRenderer(simulation, SYSTEM_ENTITY);
+	const std::vector<entity_id_t>* visible = cmpUnitRenderer ? cmpUnitRenderer->GetVisibleEntities() : NULL;
+	if (visible)
+	{
+		selectables.reserve(visible->size());
+		for (size_t i = 0; i < visible->size(); ++i)
+		{
+			ICmpSelectable* cmpSelectable = static_cast<ICmpSelectable*>(simulation.QueryInterface((*visible)[i], IID_Selectable));
+			if (cmpSelectable)
+				selectables.push_back(std::make_pair((*visible)[i], cmpSelectable));
+		}
+		return;
+	}
+
+	const CSimulation2::InterfaceListUnordered& ents = simulation.GetEntitiesWithInterfaceUnordered(IID_Selectable);
+	selectables.reserve(ents.size());
+	for (CSimulation2::InterfaceListUnordered::const_iterator it = ents.begin(); it != ents.end(); ++it)
+		selectables.push_back(std::make_pair(it->first, static_cast<ICmpSelectable*>(it->second)));
+}
+
 std::vector<entity_id_t> EntitySelection::PickEntitiesAtPoint(CSimulation2& simulation, const CCamera& camera, int screenX, int screenY, player_id_t player, bool allowEditorSelectables)
 {
 	CVector3D origin, dir;
@@ -39,13 +70,14 @@ std::vector<entity_id_t> EntitySelection::PickEntitiesAtPoint(CSimulation2& simu
 
 	std::vector<std::pair<float, entity_id_t> > hits; // (dist^2, entity) pairs
 
-	const CSimulation2::InterfaceListUnordered& ents = simulation.GetEntitiesWithInterfaceUnordered(IID_Selectable);
-	for (CSimulation2::InterfaceListUnordered::const_iterator it = ents.begin(); it != ents.end(); ++it)
+	SelectableList ents;
+	GetOnScreenSelectables(simulation, ents);
+	for (SelectableList::const_iterator it = ents.begin(); it != ents.end(); ++it)
 	{
 		entity_id_t ent = it->first;
 
 		// Check if this entity is only selectable in Atlas
-		if (!allowEditorSelectables && static_cast<ICmpSelectable*>(it->second)->IsEditorOnly())
+		if (!allowEditorSelectables && it->second->IsEditorOnly())
 			continue;
 
 		// Ignore entities hidden by LOS (or otherwise hidden, e.g. when not IsInWorld)
@@ -117,13 +149,14 @@ std::vector<entity_id_t> EntitySelection::PickEntitiesInRect(CSimulation2& simul
 
 	std::vector<entity_id_t> hitEnts;
 
-	const CSimulation2::InterfaceListUnordered& ents = simulation.GetEntitiesWithInterfaceUnordered(IID_Selectable);
-	for (CSimulation2::InterfaceListUnordered::const_iterator it = ents.begin(); it != ents.end(); ++it)
+	SelectableList ents;
+	GetOnScreenSelectables(simulation, ents);
+	for (SelectableList::const_iterator it = ents.begin(); it != ents.end(); ++it)
 	{
 		entity_id_t ent = it->first;
 
 		// Check if this entity is only selectable in Atlas
-		if (static_cast<ICmpSelectable*>(it->second)->IsEditorOnly() && !allowEditorSelectables)
+		if (it->second->IsEditorOnly() && !allowEditorSelectables)
 			continue;
 
 		// Ignore entities hidden by LOS (or otherwise hidden, e.g. when not IsInWorld)
@@ -171,13 +204,25 @@ std::vector<entity_id_t> EntitySelection::PickSimilarEntities(CSimulation2& simu
 
 	std::vector<entity_id_t> hitEnts;
 
- 	const CSimulation2::InterfaceListUnordered& ents = simulation.GetEntitiesWithInterfaceUnordered(IID_Selectable);
-	for (CSimulation2::InterfaceListUnordered::const_iterator it = ents.begin(); it != ents.end(); ++it)
+	SelectableList ents;
+	if (includeOffScreen)
+	{
+		const CSimulation2::InterfaceListUnordered& allEnts = simulation.GetEntitiesWithInterfaceUnordered(IID_Selectable);
+		ents.reserve(allEnts.size());
+		for (CSimulation2::InterfaceListUnordered::const_iterator it = allEnts.begin(); it != allEnts.end(); ++it)
+			ents.push_back(std::make_pair(it->first, static_cast<ICmpSelectable*>(it->second)));
+	}
+	else
+	{
+		GetOnScreenSelectables(simulation, ents);
+	}
+
+	for (SelectableList::const_iterator it = ents.begin(); it != ents.end(); ++it)
 	{
  		entity_id_t ent = it->first;
 
 		// Check if this entity is only selectable in Atlas
-		if (static_cast<ICmpSelectable*>(it->second)->IsEditorOnly() && !allowEditorSelectables)
+		if (it->second->IsEditorOnly() && !allowEditorSelectables)
 			continue;
 
 		if (matchRank)
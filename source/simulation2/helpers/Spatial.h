@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -20,6 +20,71 @@
 
 #include "simulation2/serialization/SerializeTemplates.h"
 
+/**
+ * Open-addressing hash set of the items returned by the current query, used by the
+ * subdivisions to remove duplicates without allocating memory in the common case.
+ * A slot is occupied if its tag equals m_Tag, so the set can be emptied
+ * by just incrementing the tag.
+ */
+template<typename T>
+class SpatialSeenSet
+{
+public:
+	SpatialSeenSet() :
+		m_Tag(0)
+	{
+	}
+
+	/**
+	 * Empty the set, and make sure it has room for @p count items.
+	 */
+	void Begin(size_t count)
+	{
+		// Keep the load factor at most 1/2
+		size_t size = 16;
+		while (size < count*2)
+			size *= 2;
+
+		if (size > m_Items.size())
+		{
+			m_Items.resize(size);
+			m_Tags.assign(size, 0);
+			m_Tag = 0;
+		}
+
+		if (++m_Tag == 0)
+		{
+			// The tag wrapped around, so we have to clear the old ones
+			std::fill(m_Tags.begin(), m_Tags.end(), 0);
+			m_Tag = 1;
+		}
+	}
+
+	/**
+	 * Adds the item to the set.
+	 * @return true if it wasn't already in the set
+	 */
+	bool Mark(T item)
+	{
+		size_t mask = m_Items.size() - 1;
+		size_t n = ((u32)item * 2654435761u) & mask;
+		while (m_Tags[n] == m_Tag)
+		{
+			if (m_Items[n] == item)
+				return false;
+			n = (n + 1) & mask;
+		}
+		m_Tags[n] = m_Tag;
+		m_Items[n] = item;
+		return true;
+	}
+
+private:
+	std::vector<T> m_Items;
+	std::vector<u32> m_Tags;
+	u32 m_Tag;
+};
+
 /**
  * A very basic subdivision scheme for finding items in ranges.
  * Items are stored in lists in fixed-size divisions.
@@ -32,6 +97,11 @@
  * to Add (since this class doesn't remember which divisions an item
  * occupies).
  *
+ * Queries write into a caller-provided vector (which can be reused
+ * between queries to avoid reallocating) and remove duplicates with a
+ * hash table that's kept between queries, so they don't need to allocate
+ * any memory in the common case. T must be an integer type.
+ *
  * (TODO: maybe an adaptive quadtree would be better than fixed sizes?)
  */
 template<typename T>
@@ -175,45 +245,63 @@ public:
 	}
 
 	/**
-	 * Returns a sorted list of unique items that includes all items
+	 * Appends to @p out a list of unique items that includes all items
 	 * within the given axis-aligned square range.
+	 * The items are in an arbitrary (but deterministic) order.
+	 * @p out can be any std::vector of T, e.g. a FrameVector<T>.
 	 */
-	std::vector<T> GetInRange(CFixedVector2D posMin, CFixedVector2D posMax)
+	template<typename Vector>
+	void GetInRange(Vector& out, CFixedVector2D posMin, CFixedVector2D posMax)
 	{
-		std::vector<T> ret;
-
 		ENSURE(posMin.X <= posMax.X && posMin.Y <= posMax.Y);
 
 		u32 i0 = GetI0(posMin.X);
 		u32 j0 = GetJ0(posMin.Y);
 		u32 i1 = GetI1(posMax.X);
 		u32 j1 = GetJ1(posMax.Y);
+
+		// Items are only stored once per division, so there can't be any duplicates
+		// unless we look at several divisions
+		if (i0 == i1 && j0 == j1)
+		{
+			const std::vector<T>& div = m_Divisions.at(i0 + j0*m_DivisionsW);
+			out.insert(out.end(), div.begin(), div.end());
+			return;
+		}
+
+		size_t count = 0;
+		for (u32 j = j0; j <= j1; ++j)
+			for (u32 i = i0; i <= i1; ++i)
+				count += m_Divisions.at(i + j*m_DivisionsW).size();
+
+		m_Seen.Begin(count);
+
 		for (u32 j = j0; j <= j1; ++j)
 		{
 			for (u32 i = i0; i <= i1; ++i)
 			{
-				std::vector<T>& div = m_Divisions.at(i + j*m_DivisionsW);
-				ret.insert(ret.end(), div.begin(), div.end());
+				const std::vector<T>& div = m_Divisions.at(i + j*m_DivisionsW);
+				for (size_t n = 0; n < div.size(); ++n)
+				{
+					if (m_Seen.Mark(div[n]))
+						out.push_back(div[n]);
+				}
 			}
 		}
-
-		// Remove duplicates
-		std::sort(ret.begin(), ret.end());
-		ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
-
-		return ret;
 	}
 
 	/**
-	 * Returns a sorted list of unique items that includes all items
+	 * Appends to @p out a list of unique items that includes all items
 	 * within the given circular distance of the given point.
+	 * The items are in an arbitrary (but deterministic) order.
 	 */
-	std::vector<T> GetNear(CFixedVector2D pos, entity_pos_t range)
+	template<typename Vector>
+	void GetNear(Vector& out, CFixedVector2D pos, entity_pos_t range)
 	{
 		// TODO: be cleverer and return a circular pattern of divisions,
 		// not this square over-approximation
 
-		return GetInRange(pos - CFixedVector2D(range, range), pos + CFixedVector2D(range, range));
+		GetInRange(out, pos - CFixedVector2D(range, range), pos + CFixedVector2D(range, range));
 	}
 
 private:
@@ -256,9 +344,201 @@ private:
 	u32 m_DivisionsW;
 	u32 m_DivisionsH;
 
+	// Query scratch space (not part of the subdivision's state)
+	SpatialSeenSet<T> m_Seen;
+
 	template<typename ELEM> friend struct SerializeSpatialSubdivision;
 };
 
+/**
+ * A variant of SpatialSubdivision for items that rarely change, e.g. static obstructions.
+ * Instead of being updated one item at a time, it's built from the complete set of
+ * items in one go (by calling Add for every item and then Build), and stores each
+ * division's items in a contiguous range of a single array. That makes queries touch
+ * less memory, and avoids the per-division allocations and item searches needed to
+ * keep a SpatialSubdivision up to date. Changing any item requires a rebuild.
+ *
+ * Queries return the items in the order they were added (within each division),
+ * so the results are deterministic if the items are always added in the same order.
+ * T must be an integer type.
+ */
+template<typename T>
+class StaticSpatialSubdivision
+{
+public:
+	StaticSpatialSubdivision() :
+		m_DivisionsW(0), m_DivisionsH(0)
+	{
+	}
+
+	void Reset(entity_pos_t maxX, entity_pos_t maxZ, entity_pos_t divisionSize)
+	{
+		m_DivisionSize = divisionSize;
+		m_DivisionsW = (maxX / m_DivisionSize).ToInt_RoundToInfinity();
+		m_DivisionsH = (maxZ / m_DivisionSize).ToInt_RoundToInfinity();
+		Clear();
+	}
+
+	/**
+	 * Remove all items (keeping the current division size).
+	 */
+	void Clear()
+	{
+		m_Added.clear();
+		m_Items.clear();
+		m_Offsets.assign(m_DivisionsW * m_DivisionsH + 1, 0);
+	}
+
+	/**
+	 * Add an item with the given size. It won't be returned by queries until
+	 * the next call to Build.
+	 */
+	void Add(T item, CFixedVector2D toMin, CFixedVector2D toMax)
+	{
+		ENSURE(toMin.X <= toMax.X && toMin.Y <= toMax.Y);
+
+		AddedItem added = { item, GetI0(toMin.X), GetJ0(toMin.Y), GetI1(toMax.X), GetJ1(toMax.Y) };
+		m_Added.push_back(added);
+	}
+
+	/**
+	 * Convenience function for Add() of individual points.
+	 */
+	void Add(T item, CFixedVector2D to)
+	{
+		Add(item, to, to);
+	}
+
+	/**
+	 * Replace the contents of the subdivision with all the items added since
+	 * the last Build, Clear or Reset.
+	 */
+	void Build()
+	{
+		// Count the items in each division (shifted by one, so the running
+		// total gives the offset of each division's first item)
+		m_Offsets.assign(m_DivisionsW * m_DivisionsH + 1, 0);
+		for (size_t n = 0; n < m_Added.size(); ++n)
+		{
+			const AddedItem& added = m_Added[n];
+			for (u32 j = added.j0; j <= added.j1; ++j)
+				for (u32 i = added.i0; i <= added.i1; ++i)
+					++m_Offsets[i + j*m_DivisionsW + 1];
+		}
+
+		for (size_t k = 1; k < m_Offsets.size(); ++k)
+			m_Offsets[k] += m_Offsets[k-1];
+
+		m_Items.resize(m_Offsets.back());
+
+		std::vector<u32> next(m_Offsets.begin(), m_Offsets.end() - 1);
+		for (size_t n = 0; n < m_Added.size(); ++n)
+		{
+			const AddedItem& added = m_Added[n];
+			for (u32 j = added.j0; j <= added.j1; ++j)
+				for (u32 i = added.i0; i <= added.i1; ++i)
+					m_Items[next[i + j*m_DivisionsW]++] = added.item;
+		}
+
+		m_Added.clear();
+	}
+
+	/**
+	 * Appends to @p out a list of unique items that includes all items
+	 * within the given axis-aligned square range.
+	 * The items are in an arbitrary (but deterministic) order.
+	 * @p out can be any std::vector of T, e.g. a FrameVector<T>.
+	 */
+	template<typename Vector>
+	void GetInRange(Vector& out, CFixedVector2D posMin, CFixedVector2D posMax)
+	{
+		ENSURE(posMin.X <= posMax.X && posMin.Y <= posMax.Y);
+
+		u32 i0 = GetI0(posMin.X);
+		u32 j0 = GetJ0(posMin.Y);
+		u32 i1 = GetI1(posMax.X);
+		u32 j1 = GetJ1(posMax.Y);
+
+		// Items are only stored once per division, so there can't be any duplicates
+		// unless we look at several divisions
+		if (i0 == i1 && j0 == j1)
+		{
+			u32 div = i0 + j0*m_DivisionsW;
+			out.insert(out.end(), m_Items.begin() + m_Offsets[div], m_Items.begin() + m_Offsets[div+1]);
+			return;
+		}
+
+		size_t count = 0;
+		for (u32 j = j0; j <= j1; ++j)
+			count += m_Offsets[i1 + j*m_DivisionsW + 1] - m_Offsets[i0 + j*m_DivisionsW];
+
+		m_Seen.Begin(count);
+
+		for (u32 j = j0; j <= j1; ++j)
+		{
+			// The divisions in each row are adjacent, so their items are too
+			u32 begin = m_Offsets[i0 + j*m_DivisionsW];
+			u32 end = m_Offsets[i1 + j*m_DivisionsW + 1];
+			for (u32 n = begin; n < end; ++n)
+			{
+				if (m_Seen.Mark(m_Items[n]))
+					out.push_back(m_Items[n]);
+			}
+		}
+	}
+
+	/**
+	 * Appends to @p out a list of unique items that includes all items
+	 * within the given circular distance of the given point.
+	 * The items are in an arbitrary (but deterministic) order.
+	 */
+	template<typename Vector>
+	void GetNear(Vector& out, CFixedVector2D pos, entity_pos_t range)
+	{
+		GetInRange(out, pos - CFixedVector2D(range, range), pos + CFixedVector2D(range, range));
+	}
+
+private:
+	// (These match SpatialSubdivision's helper functions)
+
+	u32 GetI0(entity_pos_t x)
+	{
+		return Clamp((x / m_DivisionSize).ToInt_RoundToInfinity()-1, 0, (int)m_DivisionsW-1);
+	}
+
+	u32 GetJ0(entity_pos_t z)
+	{
+		return Clamp((z / m_DivisionSize).ToInt_RoundToInfinity()-1, 0, (int)m_DivisionsH-1);
+	}
+
+	u32 GetI1(entity_pos_t x)
+	{
+		return Clamp((x / m_DivisionSize).ToInt_RoundToNegInfinity(), 0, (int)m_DivisionsW-1);
+	}
+
+	u32 GetJ1(entity_pos_t z)
+	{
+		return Clamp((z / m_DivisionSize).ToInt_RoundToNegInfinity(), 0, (int)m_DivisionsH-1);
+	}
+
+	struct AddedItem
+	{
+		T item;
+		u32 i0, j0, i1, j1;
+	};
+
+	entity_pos_t m_DivisionSize;
+	u32 m_DivisionsW;
+	u32 m_DivisionsH;
+
+	std::vector<T> m_Items; // the items in each division, one division after another
+	std::vector<u32> m_Offsets; // index in m_Items of each division's first item, plus the total count
+	std::vector<AddedItem> m_Added; // items to be included in the next Build
+
+	// Query scratch space (not part of the subdivision's state)
+	SpatialSeenSet<T> m_Seen;
+};
+
 /**
  * Serialization helper template for SpatialSubdivision
  */
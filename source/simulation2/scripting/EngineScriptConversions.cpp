@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -42,8 +42,11 @@ template<> jsval ScriptInterface::ToJSVal<IComponent*>(JSContext* cx, IComponent
 	if (!JSVAL_IS_NULL(instance))
 		return instance;
 
-	// Otherwise we need to construct a wrapper object
-	// (TODO: cache wrapper objects?)
+	// Otherwise we need a wrapper object, which is shared by every query for
+	// this component (scripts call QueryInterface a lot)
+	if (!val->GetJSWrapper().uninitialised())
+		return val->GetJSWrapper().get();
+
 	JSClass* cls = val->GetJSClass();
 	if (!cls)
 	{
@@ -60,6 +63,7 @@ template<> jsval ScriptInterface::ToJSVal<IComponent*>(JSContext* cx, IComponent
 	}
 	JS_SetPrivate(cx, obj, static_cast<void*>(val));
 
+	val->SetJSWrapper(CScriptValRooted(cx, OBJECT_TO_JSVAL(obj)));
 	return OBJECT_TO_JSVAL(obj);
 }
 
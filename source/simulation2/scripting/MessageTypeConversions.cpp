@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -18,6 +18,7 @@
 #include "precompiled.h"
 
 #include "ps/CLogger.h"
+#include "scriptinterface/ScriptExtraHeaders.h" // for typed arrays
 #include "scriptinterface/ScriptInterface.h"
 #include "simulation2/MessageTypes.h"
 
@@ -35,6 +36,25 @@
 			return JSVAL_VOID; \
 	} while (0);
 
+#define UPDATEJSVAL_SETUP() \
+	if (JSVAL_IS_PRIMITIVE(val)) \
+		return false; \
+	JSObject* obj = JSVAL_TO_OBJECT(val);
+
+#define UPDATE_MSG_PROPERTY(name) \
+	do { \
+		jsval prop = ScriptInterface::ToJSVal(scriptInterface.GetContext(), this->name); \
+		if (! JS_SetProperty(scriptInterface.GetContext(), obj, #name, &prop)) \
+			return false; \
+	} while (0);
+
+// For message types whose UpdateJSVal sets the same properties as ToJSVal would
+#define TOJSVAL_FROM_UPDATEJSVAL() \
+	TOJSVAL_SETUP(); \
+	if (! UpdateJSVal(scriptInterface, OBJECT_TO_JSVAL(obj))) \
+		return JSVAL_VOID; \
+	return OBJECT_TO_JSVAL(obj);
+
 #define FROMJSVAL_SETUP() \
 	if (! JSVAL_IS_OBJECT(val)) \
 		return NULL; \
@@ -74,9 +94,13 @@ CMessage* CMessageTurnStart::FromJSVal(ScriptInterface& UNUSED(scriptInterface),
 #define MESSAGE_1(name, t0, a0) \
 	jsval CMessage##name::ToJSVal(ScriptInterface& scriptInterface) const \
 	{ \
-		TOJSVAL_SETUP(); \
-		SET_MSG_PROPERTY(a0); \
-		return OBJECT_TO_JSVAL(obj); \
+		TOJSVAL_FROM_UPDATEJSVAL(); \
+	} \
+	bool CMessage##name::UpdateJSVal(ScriptInterface& scriptInterface, jsval val) const \
+	{ \
+		UPDATEJSVAL_SETUP(); \
+		UPDATE_MSG_PROPERTY(a0); \
+		return true; \
 	} \
 	CMessage* CMessage##name::FromJSVal(ScriptInterface& scriptInterface, jsval val) \
 	{ \
@@ -94,11 +118,16 @@ MESSAGE_1(Update_Final, fixed, turnLength)
 
 jsval CMessageInterpolate::ToJSVal(ScriptInterface& scriptInterface) const
 {
-	TOJSVAL_SETUP();
-	SET_MSG_PROPERTY(deltaSimTime);
-	SET_MSG_PROPERTY(offset);
-	SET_MSG_PROPERTY(deltaRealTime);
-	return OBJECT_TO_JSVAL(obj);
+	TOJSVAL_FROM_UPDATEJSVAL();
+}
+
+bool CMessageInterpolate::UpdateJSVal(ScriptInterface& scriptInterface, jsval val) const
+{
+	UPDATEJSVAL_SETUP();
+	UPDATE_MSG_PROPERTY(deltaSimTime);
+	UPDATE_MSG_PROPERTY(offset);
+	UPDATE_MSG_PROPERTY(deltaRealTime);
+	return true;
 }
 
 CMessage* CMessageInterpolate::FromJSVal(ScriptInterface& scriptInterface, jsval val)
@@ -112,6 +141,20 @@ CMessage* CMessageInterpolate::FromJSVal(ScriptInterface& scriptInterface, jsval
 
 ////////////////////////////////
 
+jsval CMessageInterpolateParallel::ToJSVal(ScriptInterface& UNUSED(scriptInterface)) const
+{
+	LOGWARNING(L"CMessageInterpolateParallel::ToJSVal not implemented");
+	return JSVAL_VOID;
+}
+
+CMessage* CMessageInterpolateParallel::FromJSVal(ScriptInterface& UNUSED(scriptInterface), jsval UNUSED(val))
+{
+	LOGWARNING(L"CMessageInterpolateParallel::FromJSVal not implemented");
+	return NULL;
+}
+
+////////////////////////////////
+
 jsval CMessageRenderSubmit::ToJSVal(ScriptInterface& UNUSED(scriptInterface)) const
 {
 	LOGWARNING(L"CMessageRenderSubmit::ToJSVal not implemented");
@@ -174,11 +217,16 @@ CMessage* CMessageDestroy::FromJSVal(ScriptInterface& scriptInterface, jsval val
 
 jsval CMessageOwnershipChanged::ToJSVal(ScriptInterface& scriptInterface) const
 {
-	TOJSVAL_SETUP();
-	SET_MSG_PROPERTY(entity);
-	SET_MSG_PROPERTY(from);
-	SET_MSG_PROPERTY(to);
-	return OBJECT_TO_JSVAL(obj);
+	TOJSVAL_FROM_UPDATEJSVAL();
+}
+
+bool CMessageOwnershipChanged::UpdateJSVal(ScriptInterface& scriptInterface, jsval val) const
+{
+	UPDATEJSVAL_SETUP();
+	UPDATE_MSG_PROPERTY(entity);
+	UPDATE_MSG_PROPERTY(from);
+	UPDATE_MSG_PROPERTY(to);
+	return true;
 }
 
 CMessage* CMessageOwnershipChanged::FromJSVal(ScriptInterface& scriptInterface, jsval val)
@@ -194,13 +242,18 @@ CMessage* CMessageOwnershipChanged::FromJSVal(ScriptInterface& scriptInterface,
 
 jsval CMessagePositionChanged::ToJSVal(ScriptInterface& scriptInterface) const
 {
-	TOJSVAL_SETUP();
-	SET_MSG_PROPERTY(entity);
-	SET_MSG_PROPERTY(inWorld);
-	SET_MSG_PROPERTY(x);
-	SET_MSG_PROPERTY(z);
-	SET_MSG_PROPERTY(a);
-	return OBJECT_TO_JSVAL(obj);
+	TOJSVAL_FROM_UPDATEJSVAL();
+}
+
+bool CMessagePositionChanged::UpdateJSVal(ScriptInterface& scriptInterface, jsval val) const
+{
+	UPDATEJSVAL_SETUP();
+	UPDATE_MSG_PROPERTY(entity);
+	UPDATE_MSG_PROPERTY(inWorld);
+	UPDATE_MSG_PROPERTY(x);
+	UPDATE_MSG_PROPERTY(z);
+	UPDATE_MSG_PROPERTY(a);
+	return true;
 }
 
 CMessage* CMessagePositionChanged::FromJSVal(ScriptInterface& scriptInterface, jsval val)
@@ -216,12 +269,31 @@ CMessage* CMessagePositionChanged::FromJSVal(ScriptInterface& scriptInterface, j
 
 ////////////////////////////////
 
+jsval CMessagePositionChangedBatch::ToJSVal(ScriptInterface& UNUSED(scriptInterface)) const
+{
+	LOGWARNING(L"CMessagePositionChangedBatch::ToJSVal not implemented");
+	return JSVAL_VOID;
+}
+
+CMessage* CMessagePositionChangedBatch::FromJSVal(ScriptInterface& UNUSED(scriptInterface), jsval UNUSED(val))
+{
+	LOGWARNING(L"CMessagePositionChangedBatch::FromJSVal not implemented");
+	return NULL;
+}
+
+////////////////////////////////
+
 jsval CMessageMotionChanged::ToJSVal(ScriptInterface& scriptInterface) const
 {
-	TOJSVAL_SETUP();
-	SET_MSG_PROPERTY(starting);
-	SET_MSG_PROPERTY(error);
-	return OBJECT_TO_JSVAL(obj);
+	TOJSVAL_FROM_UPDATEJSVAL();
+}
+
+bool CMessageMotionChanged::UpdateJSVal(ScriptInterface& scriptInterface, jsval val) const
+{
+	UPDATEJSVAL_SETUP();
+	UPDATE_MSG_PROPERTY(starting);
+	UPDATE_MSG_PROPERTY(error);
+	return true;
 }
 
 CMessage* CMessageMotionChanged::FromJSVal(ScriptInterface& scriptInterface, jsval val)
@@ -278,6 +350,56 @@ jsval CMessageRangeUpdate::ToJSVal(ScriptInterface& scriptInterface) const
 	return OBJECT_TO_JSVAL(obj);
 }
 
+/**
+ * Sets obj[name] to a Uint32Array of the given entities, reusing the previous
+ * message's array if it has the right length.
+ */
+static bool SetEntityTypedArrayProperty(ScriptInterface& scriptInterface, JSObject* obj, const char* name, const std::vector<entity_id_t>& entities)
+{
+	JSContext* cx = scriptInterface.GetContext();
+
+	jsval prop;
+	if (! JS_GetProperty(cx, obj, name, &prop))
+		return false;
+
+	js::TypedArray* array = NULL;
+	if (! JSVAL_IS_PRIMITIVE(prop) && js_IsTypedArray(JSVAL_TO_OBJECT(prop)))
+	{
+		array = js::TypedArray::fromJSObject(JSVAL_TO_OBJECT(prop));
+		if (array->type != js::TypedArray::TYPE_UINT32 || array->length != entities.size())
+			array = NULL;
+	}
+
+	if (! array)
+	{
+		JSObject* arrayObj = js_CreateTypedArray(cx, js::TypedArray::TYPE_UINT32, (jsuint)entities.size());
+		if (! arrayObj)
+			return false;
+		prop = OBJECT_TO_JSVAL(arrayObj);
+		if (! JS_SetProperty(cx, obj, name, &prop))
+			return false;
+		array = js::TypedArray::fromJSObject(arrayObj);
+	}
+
+	cassert(sizeof(entity_id_t) == sizeof(u32));
+	if (! entities.empty())
+		memcpy(array->data, &entities[0], entities.size()*sizeof(entity_id_t));
+	return true;
+}
+
+// When reused, the added and removed lists are typed arrays (so they can be overwritten
+// in place too) instead of the normal arrays that ToJSVal gives
+bool CMessageRangeUpdate::UpdateJSVal(ScriptInterface& scriptInterface, jsval val) const
+{
+	UPDATEJSVAL_SETUP();
+	UPDATE_MSG_PROPERTY(tag);
+	if (! SetEntityTypedArrayProperty(scriptInterface, obj, "added", added))
+		return false;
+	if (! SetEntityTypedArrayProperty(scriptInterface, obj, "removed", removed))
+		return false;
+	return true;
+}
+
 CMessage* CMessageRangeUpdate::FromJSVal(ScriptInterface& UNUSED(scriptInterface), jsval UNUSED(val))
 {
 	LOGWARNING(L"CMessageRangeUpdate::FromJSVal not implemented");
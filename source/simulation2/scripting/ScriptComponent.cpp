@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -21,6 +21,7 @@
 
 #include "simulation2/serialization/ISerializer.h"
 #include "simulation2/serialization/IDeserializer.h"
+#include "simulation2/system/ComponentManager.h"
 
 CComponentTypeScript::CComponentTypeScript(ScriptInterface& scriptInterface, jsval instance) :
 	m_ScriptInterface(scriptInterface), m_Instance(CScriptValRooted(scriptInterface.GetContext(), instance))
@@ -36,6 +37,12 @@ CComponentTypeScript::CComponentTypeScript(ScriptInterface& scriptInterface, jsv
 		if (m_ScriptInterface.GetProperty(m_Instance.get(), "Serialize", val) && JSVAL_IS_NULL(val.get()))
 			m_HasNullSerialize = true;
 	}
+
+	// Components can promise not to retain their messages, so they can be given reused message objects
+	m_TransientMessages = false;
+	CScriptVal transient;
+	if (m_ScriptInterface.GetProperty(m_Instance.get(), "TransientMessages", transient) && JSVAL_IS_BOOLEAN(transient.get()))
+		m_TransientMessages = JSVAL_TO_BOOLEAN(transient.get());
 }
 
 void CComponentTypeScript::Init(const CParamNode& paramNode, entity_id_t ent)
@@ -54,10 +61,23 @@ void CComponentTypeScript::HandleMessage(const CMessage& msg, bool global)
 {
 	const char* name = global ? msg.GetScriptGlobalHandlerName() : msg.GetScriptHandlerName();
 
-	CScriptVal msgVal = msg.ToJSValCached(m_ScriptInterface);
+	CComponentManager* transientOwner = NULL;
+	CScriptVal msgVal;
+	if (m_TransientMessages)
+	{
+		transientOwner = static_cast<CComponentManager*> (ScriptInterface::GetCallbackData(m_ScriptInterface.GetContext()));
+		msgVal = transientOwner->AcquireTransientMessage(msg);
+		if (JSVAL_IS_VOID(msgVal.get()))
+			transientOwner = NULL;
+	}
+	if (!transientOwner)
+		msgVal = msg.ToJSValCached(m_ScriptInterface);
 
 	if (!m_ScriptInterface.CallFunctionVoid(m_Instance.get(), name, msgVal))
 		LOGERROR(L"Script message handler %hs failed", name);
+
+	if (transientOwner)
+		transientOwner->ReleaseTransientMessage(msg);
 }
 
 void CComponentTypeScript::Serialize(ISerializer& serialize)
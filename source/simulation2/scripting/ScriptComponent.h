@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -78,6 +78,7 @@ private:
 	bool m_HasCustomSerialize;
 	bool m_HasCustomDeserialize;
 	bool m_HasNullSerialize;
+	bool m_TransientMessages;
 
 	NONCOPYABLE(CComponentTypeScript);
 };
@@ -0,0 +1,176 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "precompiled.h"
+
+#include "ScriptComponentStats.h"
+
+CScriptComponentStatsTable* g_ScriptComponentStatsTable;
+
+enum
+{
+	Col_Name,
+	Col_Calls,
+	Col_TotalTime,
+	Col_TimePerCall,
+	NumberColumns
+};
+
+/**
+ * Child table listing the message handlers of a single component type.
+ */
+class CScriptComponentStatsTable::CHandlerTable : public AbstractProfileTable
+{
+	NONCOPYABLE(CHandlerTable);
+public:
+	CHandlerTable(const std::string& name, const SComponentStats& stats, const std::vector<ProfileColumn>& columns) :
+		m_Name(name), m_Stats(stats), m_Columns(columns)
+	{
+	}
+
+	virtual CStr GetName()
+	{
+		return "script_component_" + m_Name;
+	}
+
+	virtual CStr GetTitle()
+	{
+		return m_Name;
+	}
+
+	virtual size_t GetNumberRows()
+	{
+		return m_Stats.handlers.size();
+	}
+
+	virtual const std::vector<ProfileColumn>& GetColumns()
+	{
+		return m_Columns;
+	}
+
+	virtual CStr GetCellText(size_t row, size_t col)
+	{
+		std::map<std::string, SStats>::const_iterator it = m_Stats.handlers.begin();
+		std::advance(it, row);
+		return CScriptComponentStatsTable::GetStatsCellText(it->first, it->second, col);
+	}
+
+	virtual AbstractProfileTable* GetChild(size_t UNUSED(row))
+	{
+		return 0;
+	}
+
+private:
+	std::string m_Name;
+	const SComponentStats& m_Stats;
+	const std::vector<ProfileColumn>& m_Columns;
+};
+
+CScriptComponentStatsTable::CScriptComponentStatsTable()
+{
+	m_ColumnDescriptions.push_back(ProfileColumn("Name", 230));
+	m_ColumnDescriptions.push_back(ProfileColumn("calls", 80));
+	m_ColumnDescriptions.push_back(ProfileColumn("msec total", 100));
+	m_ColumnDescriptions.push_back(ProfileColumn("msec/call", 80));
+}
+
+void CScriptComponentStatsTable::Add(const std::string& componentType, const char* handlerName, size_t calls, double time)
+{
+	std::map<std::string, SComponentStats>::iterator it = m_Components.find(componentType);
+	if (it == m_Components.end())
+	{
+		it = m_Components.insert(std::make_pair(componentType, SComponentStats())).first;
+		it->second.table.reset(new CHandlerTable(componentType, it->second, m_ColumnDescriptions));
+	}
+
+	SComponentStats& stats = it->second;
+	stats.total.calls += calls;
+	stats.total.time += time;
+
+	SStats& handler = stats.handlers[handlerName];
+	handler.calls += calls;
+	handler.time += time;
+}
+
+const char* CScriptComponentStatsTable::InternName(const std::string& name)
+{
+	return m_Names.insert(name).first->c_str();
+}
+
+void CScriptComponentStatsTable::Reset()
+{
+	// Only reset the values (and keep the interned names), since the profiler
+	// might still refer to the tables and names
+	for (std::map<std::string, SComponentStats>::iterator it = m_Components.begin(); it != m_Components.end(); ++it)
+	{
+		it->second.total = SStats();
+		for (std::map<std::string, SStats>::iterator hit = it->second.handlers.begin(); hit != it->second.handlers.end(); ++hit)
+			hit->second = SStats();
+	}
+}
+
+CStr CScriptComponentStatsTable::GetName()
+{
+	return "script_components";
+}
+
+CStr CScriptComponentStatsTable::GetTitle()
+{
+	return "Script component messages";
+}
+
+size_t CScriptComponentStatsTable::GetNumberRows()
+{
+	return m_Components.size();
+}
+
+const std::vector<ProfileColumn>& CScriptComponentStatsTable::GetColumns()
+{
+	return m_ColumnDescriptions;
+}
+
+CStr CScriptComponentStatsTable::GetCellText(size_t row, size_t col)
+{
+	std::map<std::string, SComponentStats>::const_iterator it = m_Components.begin();
+	std::advance(it, row);
+	return GetStatsCellText(it->first, it->second.total, col);
+}
+
+AbstractProfileTable* CScriptComponentStatsTable::GetChild(size_t row)
+{
+	std::map<std::string, SComponentStats>::const_iterator it = m_Components.begin();
+	std::advance(it, row);
+	return it->second.table.get();
+}
+
+CStr CScriptComponentStatsTable::GetStatsCellText(const std::string& name, const SStats& stats, size_t col)
+{
+	switch (col)
+	{
+	case Col_Name:
+		return name;
+	case Col_Calls:
+		return CStr::FromUInt(stats.calls);
+	case Col_TotalTime:
+		return CStr::FromDouble(stats.time * 1000.0);
+	case Col_TimePerCall:
+		return CStr::FromDouble(stats.calls ? stats.time * 1000.0 / stats.calls : 0.0);
+	default:
+		return "???";
+	}
+}
@@ -0,0 +1,86 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef INCLUDED_SCRIPTCOMPONENTSTATS
+#define INCLUDED_SCRIPTCOMPONENTSTATS
+
+#include "ps/ProfileViewer.h"
+
+#include <map>
+#include <set>
+
+/**
+ * Profile table showing how much time the script components spend handling
+ * messages, per component type (with a child table per message handler).
+ * The times are accumulated since the table was created (or last reset).
+ */
+class CScriptComponentStatsTable : public AbstractProfileTable
+{
+	NONCOPYABLE(CScriptComponentStatsTable);
+public:
+	CScriptComponentStatsTable();
+
+	/**
+	 * Records that calls to the given component type's message handler took a total of time seconds.
+	 */
+	void Add(const std::string& componentType, const char* handlerName, size_t calls, double time);
+
+	/**
+	 * Returns a copy of the given name that remains valid for as long as this table exists
+	 * (e.g. for use as a CProfiler2 region name).
+	 */
+	const char* InternName(const std::string& name);
+
+	void Reset();
+
+	virtual CStr GetName();
+	virtual CStr GetTitle();
+	virtual size_t GetNumberRows();
+	virtual const std::vector<ProfileColumn>& GetColumns();
+	virtual CStr GetCellText(size_t row, size_t col);
+	virtual AbstractProfileTable* GetChild(size_t row);
+
+private:
+	struct SStats
+	{
+		SStats() : calls(0), time(0.0) { }
+		size_t calls;
+		double time;
+	};
+
+	class CHandlerTable;
+
+	struct SComponentStats
+	{
+		SStats total;
+		std::map<std::string, SStats> handlers;
+		shared_ptr<CHandlerTable> table;
+	};
+
+	static CStr GetStatsCellText(const std::string& name, const SStats& stats, size_t col);
+
+	std::map<std::string, SComponentStats> m_Components;
+	std::set<std::string> m_Names;
+	std::vector<ProfileColumn> m_ColumnDescriptions;
+};
+
+// Like g_ScriptStatsTable, this is NULL if nobody is displaying the statistics
+// (in which case the components don't need to be timed)
+extern CScriptComponentStatsTable* g_ScriptComponentStatsTable;
+
+#endif // INCLUDED_SCRIPTCOMPONENTSTATS
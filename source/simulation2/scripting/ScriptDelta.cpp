@@ -0,0 +1,667 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "ScriptDelta.h"
+
+#include "ps/CLogger.h"
+#include "scriptinterface/AutoRooters.h"
+#include "scriptinterface/ScriptExtraHeaders.h" // for typed arrays
+
+/*
+ * The deltas are script objects of the form
+ *   { value: v }   to replace the whole value with v, or
+ *   { changes: d } to change the previous value, where d is
+ *   { set: { key: value, ... }, remove: [ key, ... ], nested: { key: d, ... }, order: [ key, ... ] }
+ * (with each part omitted if empty). 'nested' changes the properties of a child object,
+ * and 'order' (sent if properties were added or reordered) lists all the property names
+ * in their new order.
+ */
+
+namespace
+{
+
+// Values nested deeper than this are hashed as if they were equal
+// (to avoid infinite loops on cyclic objects)
+const int MAX_HASH_DEPTH = 64;
+
+enum
+{
+	TAG_UNDEFINED,
+	TAG_NULL,
+	TAG_BOOLEAN,
+	TAG_NUMBER,
+	TAG_STRING,
+	TAG_ARRAY,
+	TAG_OBJECT,
+	TAG_OTHER
+};
+
+// Incremental FNV-1a (as in fnv_hash64)
+const u64 HASH_INIT = 0xCBF29CE484222325ull;
+
+inline u64 HashBytes(u64 h, const void* data, size_t len)
+{
+	const u8* p = (const u8*)data;
+	for (size_t i = 0; i < len; ++i)
+	{
+		h ^= p[i];
+		h *= 0x100000001B3ull;
+	}
+	return h;
+}
+
+inline u64 HashTag(u64 h, u8 tag)
+{
+	return HashBytes(h, &tag, sizeof(tag));
+}
+
+inline u64 HashString(u64 h, const jschar* chars, size_t len)
+{
+	h = HashBytes(h, &len, sizeof(len));
+	return HashBytes(h, chars, len*sizeof(jschar));
+}
+
+bool GetPropertyName(JSContext* cx, jsid id, std::wstring& out)
+{
+	jsval idval;
+	if (!JS_IdToValue(cx, id, &idval))
+		return false;
+	JSString* idstr = JS_ValueToString(cx, idval);
+	if (!idstr)
+		return false;
+	size_t len;
+	const jschar* chars = JS_GetStringCharsAndLength(cx, idstr, &len);
+	if (!chars)
+		return false;
+	out.assign(chars, chars + len);
+	return true;
+}
+
+std::vector<jschar> ToChars(const std::wstring& str)
+{
+	return std::vector<jschar>(str.begin(), str.end());
+}
+
+bool SetProperty(JSContext* cx, JSObject* obj, const std::wstring& name, jsval value)
+{
+	std::vector<jschar> chars = ToChars(name);
+	return JS_SetUCProperty(cx, obj, chars.empty() ? NULL : &chars[0], chars.size(), &value) ? true : false;
+}
+
+bool GetProperty(JSContext* cx, JSObject* obj, const std::wstring& name, jsval& value)
+{
+	std::vector<jschar> chars = ToChars(name);
+	return JS_GetUCProperty(cx, obj, chars.empty() ? NULL : &chars[0], chars.size(), &value) ? true : false;
+}
+
+bool IsContainer(JSContext* cx, jsval val)
+{
+	if (!JSVAL_IS_OBJECT(val) || JSVAL_IS_NULL(val))
+		return false;
+	JSObject* obj = JSVAL_TO_OBJECT(val);
+	return !JS_IsArrayObject(cx, obj) && !js_IsTypedArray(obj) && !JS_ObjectIsFunction(cx, obj);
+}
+
+u64 HashValue(JSContext* cx, jsval val, u64 h, int depth)
+{
+	if (JSVAL_IS_VOID(val))
+		return HashTag(h, TAG_UNDEFINED);
+
+	if (JSVAL_IS_NULL(val))
+		return HashTag(h, TAG_NULL);
+
+	if (JSVAL_IS_BOOLEAN(val))
+	{
+		h = HashTag(h, TAG_BOOLEAN);
+		u8 b = JSVAL_TO_BOOLEAN(val) ? 1 : 0;
+		return HashBytes(h, &b, sizeof(b));
+	}
+
+	if (JSVAL_IS_NUMBER(val))
+	{
+		// Ints and doubles with the same value are equal
+		h = HashTag(h, TAG_NUMBER);
+		jsdouble d = JSVAL_IS_INT(val) ? (jsdouble)JSVAL_TO_INT(val) : JSVAL_TO_DOUBLE(val);
+		return HashBytes(h, &d, sizeof(d));
+	}
+
+	if (JSVAL_IS_STRING(val))
+	{
+		h = HashTag(h, TAG_STRING);
+		size_t len;
+		const jschar* chars = JS_GetStringCharsAndLength(cx, JSVAL_TO_STRING(val), &len);
+		if (!chars)
+			return h;
+		return HashString(h, chars, len);
+	}
+
+	JSObject* obj = JSVAL_TO_OBJECT(val);
+	if (JS_ObjectIsFunction(cx, obj) || depth >= MAX_HASH_DEPTH)
+		return HashTag(h, TAG_OTHER);
+
+	if (js_IsTypedArray(obj))
+	{
+		// Typed arrays don't enumerate their elements, so hash them explicitly
+		h = HashTag(h, TAG_ARRAY);
+		jsuint length = 0;
+		JS_GetArrayLength(cx, obj, &length);
+		for (jsuint i = 0; i < length; ++i)
+		{
+			jsval el;
+			if (JS_GetElement(cx, obj, i, &el))
+				h = HashValue(cx, el, h, depth + 1);
+		}
+		return h;
+	}
+
+	if (JS_IsArrayObject(cx, obj))
+	{
+		h = HashTag(h, TAG_ARRAY);
+		// (Trailing holes aren't enumerated, so include the length)
+		jsuint length = 0;
+		JS_GetArrayLength(cx, obj, &length);
+		h = HashBytes(h, &length, sizeof(length));
+	}
+	else
+	{
+		h = HashTag(h, TAG_OBJECT);
+	}
+
+	AutoJSIdArray ida (cx, JS_Enumerate(cx, obj));
+	if (!ida.get())
+		return h;
+
+	for (size_t i = 0; i < ida.length(); ++i)
+	{
+		jsval idval, propval;
+		if (!JS_IdToValue(cx, ida[i], &idval) || !JS_GetPropertyById(cx, obj, ida[i], &propval))
+			continue;
+		h = HashValue(cx, idval, h, depth + 1);
+		h = HashValue(cx, propval, h, depth + 1);
+	}
+
+	return h;
+}
+
+JSObject* NewArrayOfNames(JSContext* cx, const std::vector<std::wstring>& names, AutoGCRooter& rooter)
+{
+	JSObject* arr = JS_NewArrayObject(cx, 0, NULL);
+	if (!arr)
+		return NULL;
+	rooter.Push(arr);
+
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		std::vector<jschar> chars = ToChars(names[i]);
+		JSString* str = JS_NewUCStringCopyN(cx, chars.empty() ? NULL : &chars[0], chars.size());
+		if (!str)
+			return NULL;
+		jsval val = STRING_TO_JSVAL(str);
+		if (!JS_SetElement(cx, arr, (jsint)i, &val))
+			return NULL;
+	}
+
+	return arr;
+}
+
+bool GetArrayOfNames(JSContext* cx, jsval val, std::vector<std::wstring>& names)
+{
+	if (!JSVAL_IS_OBJECT(val) || JSVAL_IS_NULL(val) || !JS_IsArrayObject(cx, JSVAL_TO_OBJECT(val)))
+		return false;
+
+	JSObject* arr = JSVAL_TO_OBJECT(val);
+	jsuint length;
+	if (!JS_GetArrayLength(cx, arr, &length))
+		return false;
+
+	names.resize(length);
+	for (jsuint i = 0; i < length; ++i)
+	{
+		jsval el;
+		if (!JS_GetElement(cx, arr, i, &el) || !JSVAL_IS_STRING(el))
+			return false;
+		size_t len;
+		const jschar* chars = JS_GetStringCharsAndLength(cx, JSVAL_TO_STRING(el), &len);
+		if (!chars)
+			return false;
+		names[i].assign(chars, chars + len);
+	}
+
+	return true;
+}
+
+/**
+ * Applies the changes d (see the comment at the top of this file) to the object target.
+ * Returns the changed object (which might be a new object, if the properties were
+ * reordered), or NULL on error.
+ */
+bool AppendPropertyNames(JSContext* cx, JSObject* obj, std::vector<std::wstring>& names)
+{
+	AutoJSIdArray ida (cx, JS_Enumerate(cx, obj));
+	if (!ida.get())
+		return false;
+	for (size_t i = 0; i < ida.length(); ++i)
+	{
+		std::wstring name;
+		if (!GetPropertyName(cx, ida[i], name))
+			return false;
+		names.push_back(name);
+	}
+	return true;
+}
+
+JSObject* ApplyChanges(JSContext* cx, JSObject* target, JSObject* delta, AutoGCRooter& rooter)
+{
+	jsval removeVal, nestedVal, setVal, orderVal;
+	if (!JS_GetProperty(cx, delta, "remove", &removeVal)
+		|| !JS_GetProperty(cx, delta, "nested", &nestedVal)
+		|| !JS_GetProperty(cx, delta, "set", &setVal)
+		|| !JS_GetProperty(cx, delta, "order", &orderVal))
+		return NULL;
+
+	if (!JSVAL_IS_VOID(removeVal))
+	{
+		std::vector<std::wstring> names;
+		if (!GetArrayOfNames(cx, removeVal, names))
+			return NULL;
+		for (size_t i = 0; i < names.size(); ++i)
+		{
+			std::vector<jschar> chars = ToChars(names[i]);
+			jsval rval;
+			if (!JS_DeleteUCProperty2(cx, target, chars.empty() ? NULL : &chars[0], chars.size(), &rval))
+				return NULL;
+		}
+	}
+
+	if (!JSVAL_IS_VOID(nestedVal))
+	{
+		if (!JSVAL_IS_OBJECT(nestedVal) || JSVAL_IS_NULL(nestedVal))
+			return NULL;
+		JSObject* nested = JSVAL_TO_OBJECT(nestedVal);
+
+		AutoJSIdArray ida (cx, JS_Enumerate(cx, nested));
+		if (!ida.get())
+			return NULL;
+		for (size_t i = 0; i < ida.length(); ++i)
+		{
+			std::wstring name;
+			jsval childDelta, child;
+			if (!GetPropertyName(cx, ida[i], name)
+				|| !JS_GetPropertyById(cx, nested, ida[i], &childDelta)
+				|| !GetProperty(cx, target, name, child))
+				return NULL;
+			if (!IsContainer(cx, child) || !JSVAL_IS_OBJECT(childDelta) || JSVAL_IS_NULL(childDelta))
+				return NULL;
+
+			JSObject* newChild = ApplyChanges(cx, JSVAL_TO_OBJECT(child), JSVAL_TO_OBJECT(childDelta), rooter);
+			if (!newChild)
+				return NULL;
+			if (newChild != JSVAL_TO_OBJECT(child) && !SetProperty(cx, target, name, OBJECT_TO_JSVAL(newChild)))
+				return NULL;
+		}
+	}
+
+	if (!JSVAL_IS_VOID(setVal))
+	{
+		if (!JSVAL_IS_OBJECT(setVal) || JSVAL_IS_NULL(setVal))
+			return NULL;
+		JSObject* set = JSVAL_TO_OBJECT(setVal);
+
+		AutoJSIdArray ida (cx, JS_Enumerate(cx, set));
+		if (!ida.get())
+			return NULL;
+		for (size_t i = 0; i < ida.length(); ++i)
+		{
+			std::wstring name;
+			jsval value;
+			if (!GetPropertyName(cx, ida[i], name)
+				|| !JS_GetPropertyById(cx, set, ida[i], &value)
+				|| !SetProperty(cx, target, name, value))
+				return NULL;
+		}
+	}
+
+	if (!JSVAL_IS_VOID(orderVal))
+	{
+		// Properties were added or reordered, so copy them into a new object
+		// in the right order
+		std::vector<std::wstring> names;
+		if (!GetArrayOfNames(cx, orderVal, names))
+			return NULL;
+
+		JSObject* obj = JS_NewObject(cx, NULL, NULL, NULL);
+		if (!obj)
+			return NULL;
+		rooter.Push(obj);
+
+		for (size_t i = 0; i < names.size(); ++i)
+		{
+			jsval value;
+			if (!GetProperty(cx, target, names[i], value) || !SetProperty(cx, obj, names[i], value))
+				return NULL;
+		}
+
+		return obj;
+	}
+
+	return target;
+}
+
+} // anonymous namespace
+
+CScriptDeltaEncoder::CScriptDeltaEncoder(int maxDepth) :
+	m_MaxDepth(maxDepth), m_HasPrevious(false)
+{
+}
+
+void CScriptDeltaEncoder::Reset()
+{
+	m_HasPrevious = false;
+	m_Previous = SNode();
+}
+
+void CScriptDeltaEncoder::BuildNode(JSContext* cx, jsval val, int depth, SNode& node)
+{
+	node.container = false;
+
+	if (depth >= m_MaxDepth || !IsContainer(cx, val))
+	{
+		node.hash = HashValue(cx, val, HASH_INIT, 0);
+		return;
+	}
+
+	node.container = true;
+	node.hash = HashTag(HASH_INIT, TAG_OBJECT);
+
+	JSObject* obj = JSVAL_TO_OBJECT(val);
+	AutoJSIdArray ida (cx, JS_Enumerate(cx, obj));
+	if (!ida.get())
+		return;
+
+	node.keys.reserve(ida.length());
+	for (size_t i = 0; i < ida.length(); ++i)
+	{
+		std::wstring name;
+		jsval propval;
+		if (!GetPropertyName(cx, ida[i], name) || !JS_GetPropertyById(cx, obj, ida[i], &propval))
+			continue;
+
+		SNode& child = node.children[name];
+		child.index = node.keys.size();
+		BuildNode(cx, propval, depth + 1, child);
+		node.keys.push_back(name);
+
+		std::vector<jschar> chars = ToChars(name);
+		node.hash = HashString(node.hash, chars.empty() ? NULL : &chars[0], chars.size());
+		node.hash = HashBytes(node.hash, &child.hash, sizeof(child.hash));
+	}
+}
+
+JSObject* CScriptDeltaEncoder::Diff(ScriptInterface& scriptInterface, const SNode& oldNode, const SNode& newNode, JSObject* newObj)
+{
+	JSContext* cx = scriptInterface.GetContext();
+	AutoGCRooter rooter(scriptInterface);
+
+	JSObject* delta = JS_NewObject(cx, NULL, NULL, NULL);
+	if (!delta)
+		return NULL;
+	rooter.Push(delta);
+
+	JSObject* set = NULL;
+	JSObject* nested = NULL;
+	bool reordered = false;
+	size_t lastIndex = 0;
+
+	for (size_t i = 0; i < newNode.keys.size(); ++i)
+	{
+		const std::wstring& name = newNode.keys[i];
+		const SNode& newChild = newNode.children.find(name)->second;
+		std::map<std::wstring, SNode>::const_iterator it = oldNode.children.find(name);
+
+		if (it != oldNode.children.end())
+		{
+			if (i > 0 && it->second.index < lastIndex)
+				reordered = true;
+			lastIndex = it->second.index;
+
+			if (it->second.hash == newChild.hash)
+				continue;
+		}
+		else
+		{
+			reordered = true;
+		}
+
+		jsval value;
+		if (!GetProperty(cx, newObj, name, value))
+			return NULL;
+
+		if (it != oldNode.children.end() && it->second.container && newChild.container)
+		{
+			JSObject* childDelta = Diff(scriptInterface, it->second, newChild, JSVAL_TO_OBJECT(value));
+			if (!childDelta)
+				return NULL;
+			rooter.Push(childDelta);
+
+			if (!nested)
+			{
+				nested = JS_NewObject(cx, NULL, NULL, NULL);
+				if (!nested || !JS_DefineProperty(cx, delta, "nested", OBJECT_TO_JSVAL(nested), NULL, NULL, JSPROP_ENUMERATE))
+					return NULL;
+			}
+			if (!SetProperty(cx, nested, name, OBJECT_TO_JSVAL(childDelta)))
+				return NULL;
+		}
+		else
+		{
+			if (!set)
+			{
+				set = JS_NewObject(cx, NULL, NULL, NULL);
+				if (!set || !JS_DefineProperty(cx, delta, "set", OBJECT_TO_JSVAL(set), NULL, NULL, JSPROP_ENUMERATE))
+					return NULL;
+			}
+			if (!SetProperty(cx, set, name, value))
+				return NULL;
+		}
+	}
+
+	std::vector<std::wstring> removed;
+	for (size_t i = 0; i < oldNode.keys.size(); ++i)
+		if (newNode.children.find(oldNode.keys[i]) == newNode.children.end())
+			removed.push_back(oldNode.keys[i]);
+
+	if (!removed.empty())
+	{
+		JSObject* arr = NewArrayOfNames(cx, removed, rooter);
+		if (!arr || !JS_DefineProperty(cx, delta, "remove", OBJECT_TO_JSVAL(arr), NULL, NULL, JSPROP_ENUMERATE))
+			return NULL;
+	}
+
+	if (reordered)
+	{
+		JSObject* arr = NewArrayOfNames(cx, newNode.keys, rooter);
+		if (!arr || !JS_DefineProperty(cx, delta, "order", OBJECT_TO_JSVAL(arr), NULL, NULL, JSPROP_ENUMERATE))
+			return NULL;
+	}
+
+	return delta;
+}
+
+CScriptVal CScriptDeltaEncoder::Encode(ScriptInterface& scriptInterface, CScriptVal value)
+{
+	JSContext* cx = scriptInterface.GetContext();
+	AutoGCRooter rooter(scriptInterface);
+
+	SNode node;
+	BuildNode(cx, value.get(), 0, node);
+
+	JSObject* ret = JS_NewObject(cx, NULL, NULL, NULL);
+	if (!ret)
+		return CScriptVal();
+	rooter.Push(ret);
+
+	JSObject* changes = NULL;
+	if (m_HasPrevious && m_Previous.container && node.container)
+	{
+		if (m_Previous.hash == node.hash)
+			changes = JS_NewObject(cx, NULL, NULL, NULL);
+		else
+			changes = Diff(scriptInterface, m_Previous, node, JSVAL_TO_OBJECT(value.get()));
+	}
+
+	if (changes)
+	{
+		rooter.Push(changes);
+		if (!JS_DefineProperty(cx, ret, "changes", OBJECT_TO_JSVAL(changes), NULL, NULL, JSPROP_ENUMERATE))
+			return CScriptVal();
+	}
+	else
+	{
+		if (!JS_DefineProperty(cx, ret, "value", value.get(), NULL, NULL, JSPROP_ENUMERATE))
+			return CScriptVal();
+	}
+
+	std::swap(m_Previous, node);
+	m_HasPrevious = true;
+
+	return OBJECT_TO_JSVAL(ret);
+}
+
+CScriptDeltaDecoder::CScriptDeltaDecoder()
+{
+}
+
+void CScriptDeltaDecoder::Reset()
+{
+	m_Value = CScriptValRooted();
+}
+
+bool CScriptDeltaDecoder::Apply(ScriptInterface& scriptInterface, CScriptVal delta)
+{
+	JSContext* cx = scriptInterface.GetContext();
+
+	if (!JSVAL_IS_OBJECT(delta.get()) || JSVAL_IS_NULL(delta.get()))
+		return false;
+	JSObject* deltaObj = JSVAL_TO_OBJECT(delta.get());
+
+	JSBool hasValue;
+	jsval value, changes;
+	if (!JS_HasProperty(cx, deltaObj, "value", &hasValue)
+		|| !JS_GetProperty(cx, deltaObj, "value", &value)
+		|| !JS_GetProperty(cx, deltaObj, "changes", &changes))
+		return false;
+
+	if (hasValue)
+	{
+		m_Value = CScriptValRooted(cx, value);
+		return true;
+	}
+
+	if (m_Value.uninitialised() || !IsContainer(cx, m_Value.get()) || !JSVAL_IS_OBJECT(changes) || JSVAL_IS_NULL(changes))
+	{
+		LOGERROR(L"Invalid script value delta");
+		return false;
+	}
+
+	AutoGCRooter rooter(scriptInterface);
+	JSObject* obj = ApplyChanges(cx, JSVAL_TO_OBJECT(m_Value.get()), JSVAL_TO_OBJECT(changes), rooter);
+	if (!obj)
+	{
+		LOGERROR(L"Failed to apply script value delta");
+		return false;
+	}
+
+	if (obj != JSVAL_TO_OBJECT(m_Value.get()))
+		m_Value = CScriptValRooted(cx, OBJECT_TO_JSVAL(obj));
+
+	return true;
+}
+
+bool CScriptDeltaDecoder::GetChangedProperties(ScriptInterface& scriptInterface, CScriptVal delta, const std::wstring& name, std::vector<std::wstring>& changed)
+{
+	JSContext* cx = scriptInterface.GetContext();
+	changed.clear();
+
+	jsval changes;
+	if (!JSVAL_IS_OBJECT(delta.get()) || JSVAL_IS_NULL(delta.get())
+		|| !JS_GetProperty(cx, JSVAL_TO_OBJECT(delta.get()), "changes", &changes)
+		|| !JSVAL_IS_OBJECT(changes) || JSVAL_IS_NULL(changes))
+		return false;
+	JSObject* changesObj = JSVAL_TO_OBJECT(changes);
+
+	jsval removeVal, nestedVal, setVal, child;
+	if (!JS_GetProperty(cx, changesObj, "remove", &removeVal)
+		|| !JS_GetProperty(cx, changesObj, "nested", &nestedVal)
+		|| !JS_GetProperty(cx, changesObj, "set", &setVal))
+		return false;
+
+	// The child was replaced or removed as a whole
+	if (!JSVAL_IS_VOID(setVal))
+	{
+		JSBool found;
+		if (!JSVAL_IS_OBJECT(setVal) || JSVAL_IS_NULL(setVal))
+			return false;
+		std::vector<jschar> chars = ToChars(name);
+		if (!JS_HasUCProperty(cx, JSVAL_TO_OBJECT(setVal), chars.empty() ? NULL : &chars[0], chars.size(), &found) || found)
+			return false;
+	}
+	if (!JSVAL_IS_VOID(removeVal))
+	{
+		std::vector<std::wstring> names;
+		if (!GetArrayOfNames(cx, removeVal, names) || std::find(names.begin(), names.end(), name) != names.end())
+			return false;
+	}
+
+	if (JSVAL_IS_VOID(nestedVal))
+		return true;
+	if (!JSVAL_IS_OBJECT(nestedVal) || JSVAL_IS_NULL(nestedVal) || !GetProperty(cx, JSVAL_TO_OBJECT(nestedVal), name, child))
+		return false;
+
+	// The child's properties are unchanged
+	if (JSVAL_IS_VOID(child))
+		return true;
+	if (!JSVAL_IS_OBJECT(child) || JSVAL_IS_NULL(child))
+		return false;
+	JSObject* childObj = JSVAL_TO_OBJECT(child);
+
+	if (!JS_GetProperty(cx, childObj, "remove", &removeVal)
+		|| !JS_GetProperty(cx, childObj, "nested", &nestedVal)
+		|| !JS_GetProperty(cx, childObj, "set", &setVal))
+		return false;
+
+	if (!JSVAL_IS_VOID(removeVal))
+	{
+		std::vector<std::wstring> names;
+		if (!GetArrayOfNames(cx, removeVal, names))
+			return false;
+		changed.insert(changed.end(), names.begin(), names.end());
+	}
+	if (!JSVAL_IS_VOID(nestedVal))
+	{
+		if (!JSVAL_IS_OBJECT(nestedVal) || JSVAL_IS_NULL(nestedVal) || !AppendPropertyNames(cx, JSVAL_TO_OBJECT(nestedVal), changed))
+			return false;
+	}
+	if (!JSVAL_IS_VOID(setVal))
+	{
+		if (!JSVAL_IS_OBJECT(setVal) || JSVAL_IS_NULL(setVal) || !AppendPropertyNames(cx, JSVAL_TO_OBJECT(setVal), changed))
+			return false;
+	}
+
+	return true;
+}
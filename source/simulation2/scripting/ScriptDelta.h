@@ -0,0 +1,125 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_SCRIPTDELTA
+#define INCLUDED_SCRIPTDELTA
+
+#include "scriptinterface/ScriptInterface.h"
+
+#include <map>
+
+/**
+ * @file
+ * Incremental transfer of a large, slowly-changing script value (like the AI
+ * game state) from one script runtime to another.
+ *
+ * Instead of cloning the whole value every time, CScriptDeltaEncoder compares it
+ * against the previous value it encoded and produces a small script object that
+ * describes just the changes (added, removed and changed properties), which can
+ * be passed through a StructuredClone. CScriptDeltaDecoder applies these changes
+ * to a persistent copy of the value in the other runtime.
+ *
+ * Plain objects are compared property-by-property down to a maximum depth (e.g.
+ * state / entities / entity / property); any other changed value is sent as a whole.
+ * The encoder only remembers hashes of the previous values, not the values themselves,
+ * so it doesn't matter if the caller modifies or reuses the objects it passes in.
+ * The decoded copy has the same properties in the same order as the encoded value,
+ * so it's only a function of the current value and not of the earlier ones.
+ */
+
+/**
+ * Encodes successive versions of a script value as deltas against the previous version.
+ * All values must be from the same ScriptInterface.
+ */
+class CScriptDeltaEncoder
+{
+	NONCOPYABLE(CScriptDeltaEncoder);
+public:
+	/**
+	 * @param maxDepth number of levels of plain objects that are compared property-by-property
+	 */
+	CScriptDeltaEncoder(int maxDepth);
+
+	/**
+	 * Forget the previous value, so the next Encode will contain the whole value
+	 * (e.g. because the decoder has been reset).
+	 */
+	void Reset();
+
+	/**
+	 * Returns a script object describing how to change the previously encoded value
+	 * into the given value, to pass to CScriptDeltaDecoder::Apply.
+	 */
+	CScriptVal Encode(ScriptInterface& scriptInterface, CScriptVal value);
+
+private:
+	struct SNode
+	{
+		u64 hash; // hash of the whole value (including the order of properties)
+		bool container; // whether the children are stored
+		size_t index; // position in the parent's properties
+		std::vector<std::wstring> keys; // property names in enumeration order
+		std::map<std::wstring, SNode> children;
+	};
+
+	void BuildNode(JSContext* cx, jsval val, int depth, SNode& node);
+	JSObject* Diff(ScriptInterface& scriptInterface, const SNode& oldNode, const SNode& newNode, JSObject* newObj);
+
+	int m_MaxDepth;
+	bool m_HasPrevious;
+	SNode m_Previous;
+};
+
+/**
+ * Maintains a copy of a script value from the deltas produced by CScriptDeltaEncoder.
+ * The copy's rooted value must be released (by Reset) before its ScriptInterface is destroyed.
+ */
+class CScriptDeltaDecoder
+{
+	NONCOPYABLE(CScriptDeltaDecoder);
+public:
+	CScriptDeltaDecoder();
+
+	void Reset();
+
+	/**
+	 * Updates the copy with the given delta (which must be from the next Encode after
+	 * the one that produced the previous delta).
+	 * @return false on error
+	 */
+	bool Apply(ScriptInterface& scriptInterface, CScriptVal delta);
+
+	/**
+	 * Returns the current copy of the value. It's updated in-place by Apply, so callers
+	 * shouldn't modify it (otherwise the modifications might persist).
+	 */
+	CScriptVal GetValue() const { return m_Value.get(); }
+
+	/**
+	 * Gets the names of the properties of the child object @p name of the root value
+	 * (e.g. the IDs in state.entities) that the given delta adds, removes or changes,
+	 * so the caller can update its own data about just those properties.
+	 * @return false if the delta replaces the whole child (or the whole value),
+	 *   or isn't valid, in which case every property must be assumed to have changed
+	 */
+	static bool GetChangedProperties(ScriptInterface& scriptInterface, CScriptVal delta, const std::wstring& name, std::vector<std::wstring>& changed);
+
+private:
+	CScriptValRooted m_Value;
+};
+
+#endif // INCLUDED_SCRIPTDELTA
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -29,7 +29,8 @@
 
 CBinarySerializerScriptImpl::CBinarySerializerScriptImpl(ScriptInterface& scriptInterface, ISerializer& serializer) :
 	m_ScriptInterface(scriptInterface), m_Serializer(serializer), m_Rooter(m_ScriptInterface),
-	m_ScriptBackrefsArena(8*MiB), m_ScriptBackrefs(backrefs_t::key_compare(), ScriptBackrefsAlloc(m_ScriptBackrefsArena)), m_ScriptBackrefsNext(1)
+	m_ScriptBackrefsArena(8*MiB), m_ScriptBackrefs(backrefs_t::key_compare(), ScriptBackrefsAlloc(m_ScriptBackrefsArena)), m_ScriptBackrefsNext(1),
+	m_ScriptPropNames(propnames_t::key_compare(), ScriptPropNamesAlloc(m_ScriptBackrefsArena)), m_ScriptPropNamesNext(1)
 {
 }
 
@@ -68,16 +69,41 @@ void CBinarySerializerScriptImpl::HandleScriptVal(jsval val)
 			break;
 		}
 
-		if (JS_IsArrayObject(cx, obj))
+		// Find all properties (ordered by insertion time)
+
+		// (Note that we don't do any rooting, because we assume nothing is going to trigger GC.
+		// I'm not absolute certain that's necessarily a valid assumption.)
+
+		AutoJSIdArray ida (cx, JS_Enumerate(cx, obj));
+		if (!ida.get())
+			throw PSERROR_Serialize_ScriptError("JS_Enumerate failed");
+
+		// Use LookupProperty instead of GetProperty to avoid the danger of getters
+		// (they might delete values and trigger GC)
+		std::vector<jsval> values(ida.length());
+		for (size_t i = 0; i < ida.length(); ++i)
 		{
-			m_Serializer.NumberU8_Unbounded("type", SCRIPT_TYPE_ARRAY);
-			// TODO: probably should have a more efficient storage format
+			if (!JS_LookupPropertyById(cx, obj, ida[i], &values[i]))
+				throw PSERROR_Serialize_ScriptError("JS_LookupPropertyById failed");
+		}
 
+		if (JS_IsArrayObject(cx, obj))
+		{
 			// Arrays like [1, 2, ] have an 'undefined' at the end which is part of the
 			// length but seemingly isn't enumerated, so store the length explicitly
 			jsuint length = 0;
 			if (!JS_GetArrayLength(cx, obj, &length))
 				throw PSERROR_Serialize_ScriptError("JS_GetArrayLength failed");
+
+			// Arrays of numbers with no holes or extra properties (like lists of
+			// entity IDs) can be stored much more compactly
+			bool dense = (length > 0 && length == ida.length());
+			for (size_t i = 0; dense && i < ida.length(); ++i)
+				dense = (JSID_IS_INT(ida[i]) && JSID_TO_INT(ida[i]) == (int)i);
+			if (dense && HandleDenseArray(values))
+				break;
+
+			m_Serializer.NumberU8_Unbounded("type", SCRIPT_TYPE_ARRAY);
 			m_Serializer.NumberU32_Unbounded("array length", length);
 		}
 		else
@@ -94,38 +120,12 @@ void CBinarySerializerScriptImpl::HandleScriptVal(jsval val)
 			// (See Trac #406, #407)
 		}
 
-		// Find all properties (ordered by insertion time)
-
-		// (Note that we don't do any rooting, because we assume nothing is going to trigger GC.
-		// I'm not absolute certain that's necessarily a valid assumption.)
-
-		AutoJSIdArray ida (cx, JS_Enumerate(cx, obj));
-		if (!ida.get())
-			throw PSERROR_Serialize_ScriptError("JS_Enumerate failed");
-
 		m_Serializer.NumberU32_Unbounded("num props", (uint32_t)ida.length());
 
 		for (size_t i = 0; i < ida.length(); ++i)
 		{
-			jsid id = ida[i];
-
-			jsval idval, propval;
-
-			// Get the property name as a string
-			if (!JS_IdToValue(cx, id, &idval))
-				throw PSERROR_Serialize_ScriptError("JS_IdToValue failed");
-			JSString* idstr = JS_ValueToString(cx, idval);
-			if (!idstr)
-				throw PSERROR_Serialize_ScriptError("JS_ValueToString failed");
-
-			ScriptString("prop name", idstr);
-
-			// Use LookupProperty instead of GetProperty to avoid the danger of getters
-			// (they might delete values and trigger GC)
-			if (!JS_LookupPropertyById(cx, obj, id, &propval))
-				throw PSERROR_Serialize_ScriptError("JS_LookupPropertyById failed");
-
-			HandleScriptVal(propval);
+			ScriptPropName(ida[i]);
+			HandleScriptVal(values[i]);
 		}
 
 		break;
@@ -223,6 +223,62 @@ void CBinarySerializerScriptImpl::ScriptString(const char* name, JSString* strin
 	m_Serializer.RawBytes(name, (const u8*)chars, length*2);
 }
 
+void CBinarySerializerScriptImpl::ScriptPropName(jsid id)
+{
+	// Objects of the same kind (e.g. every UnitAI's state) mostly have the same property
+	// names, so each name is only stored the first time it's seen
+	std::pair<propnames_t::iterator, bool> it = m_ScriptPropNames.insert(std::make_pair((size_t)JSID_BITS(id), m_ScriptPropNamesNext));
+	if (!it.second)
+	{
+		m_Serializer.NumberU32_Unbounded("prop name id", it.first->second);
+		return;
+	}
+
+	m_ScriptPropNamesNext++;
+	m_Serializer.NumberU32_Unbounded("prop name id", 0);
+
+	JSContext* cx = m_ScriptInterface.GetContext();
+
+	// Get the property name as a string
+	jsval idval;
+	if (!JS_IdToValue(cx, id, &idval))
+		throw PSERROR_Serialize_ScriptError("JS_IdToValue failed");
+	JSString* idstr = JS_ValueToString(cx, idval);
+	if (!idstr)
+		throw PSERROR_Serialize_ScriptError("JS_ValueToString failed");
+
+	ScriptString("prop name", idstr);
+}
+
+bool CBinarySerializerScriptImpl::HandleDenseArray(const std::vector<jsval>& values)
+{
+	// Use ints if every element is an int (or a double with an int value, which
+	// would be serialized as an int anyway), else doubles if they're all numbers
+	bool allInts = true;
+	for (size_t i = 0; i < values.size(); ++i)
+	{
+		if (JSVAL_IS_INT(values[i]))
+			continue;
+		if (!JSVAL_IS_DOUBLE(values[i]))
+			return false;
+		int32_t n;
+		if (!JSDOUBLE_IS_INT32(JSVAL_TO_DOUBLE(values[i]), &n))
+			allInts = false;
+	}
+
+	m_Serializer.NumberU8_Unbounded("type", allInts ? SCRIPT_TYPE_ARRAY_INT32 : SCRIPT_TYPE_ARRAY_DOUBLE);
+	m_Serializer.NumberU32_Unbounded("array length", (uint32_t)values.size());
+	for (size_t i = 0; i < values.size(); ++i)
+	{
+		jsdouble d = JSVAL_IS_INT(values[i]) ? JSVAL_TO_INT(values[i]) : JSVAL_TO_DOUBLE(values[i]);
+		if (allInts)
+			m_Serializer.NumberI32_Unbounded("value", (int32_t)d);
+		else
+			m_Serializer.NumberDouble_Unbounded("value", d);
+	}
+	return true;
+}
+
 u32 CBinarySerializerScriptImpl::GetScriptBackrefTag(JSObject* obj)
 {
 	// To support non-tree structures (e.g. "var x = []; var y = [x, x];"), we need a way
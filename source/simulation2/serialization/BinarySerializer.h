@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -26,6 +26,7 @@
 #include "lib/allocators/arena.h"
 
 #include <map>
+#include <vector>
 
 /**
  * Wrapper for redirecting ostream writes to CBinarySerializer's impl
@@ -60,6 +61,9 @@ public:
 	void ScriptString(const char* name, JSString* string);
 	void HandleScriptVal(jsval val);
 private:
+	void ScriptPropName(jsid id);
+	bool HandleDenseArray(const std::vector<jsval>& values);
+
 	ScriptInterface& m_ScriptInterface;
 	ISerializer& m_Serializer;
 
@@ -72,6 +76,13 @@ private:
 	u32 m_ScriptBackrefsNext;
 	u32 GetScriptBackrefTag(JSObject* obj);
 
+	// Ids of the property names already stored, indexed by the bits of their jsid
+	// (which are unique per name)
+	typedef ProxyAllocator<std::pair<const size_t, u32>, Allocators::Arena<> > ScriptPropNamesAlloc;
+	typedef std::map<size_t, u32, std::less<size_t>, ScriptPropNamesAlloc> propnames_t;
+	propnames_t m_ScriptPropNames;
+	u32 m_ScriptPropNamesNext;
+
 	AutoGCRooter m_Rooter;
 };
 
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -19,8 +19,8 @@
 
 #include "HashSerializer.h"
 
-CHashSerializer::CHashSerializer(ScriptInterface& scriptInterface) :
-	CBinarySerializer<CHashSerializerImpl>(scriptInterface)
+CHashSerializer::CHashSerializer(ScriptInterface& scriptInterface, StateHashFunction func) :
+	CBinarySerializer<CHashSerializerImpl>(scriptInterface, func)
 {
 }
 
@@ -34,13 +34,21 @@ const u8* CHashSerializer::ComputeHash()
 	return m_Impl.ComputeHash();
 }
 
+CHashSerializerImpl::CHashSerializerImpl(StateHashFunction func) :
+	m_Func(func)
+{
+}
+
 size_t CHashSerializerImpl::GetHashLength()
 {
-	return HashFunc::DIGESTSIZE;
+	return sizeof(m_HashData);
 }
 
 const u8* CHashSerializerImpl::ComputeHash()
 {
-	m_Hash.Final(m_HashData);
+	if (m_Func == STATE_HASH_MURMUR3)
+		m_Murmur.Final(m_HashData);
+	else
+		m_MD5.Final(m_HashData);
 	return m_HashData;
 }
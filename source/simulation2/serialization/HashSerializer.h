@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -21,31 +21,56 @@
 #include "BinarySerializer.h"
 
 #include "maths/MD5.h"
+#include "maths/MurmurHash3.h"
 
-class CHashSerializerImpl
+/**
+ * Hash functions that CHashSerializer can use.
+ * We don't care about cryptographic strength, just about detection of
+ * unintended changes and about performance.
+ *
+ * Every peer in a networked game must use the same hash function for the
+ * out-of-sync checks, so changing DEFAULT_STATE_HASH must be accompanied by
+ * a change of PS_PROTOCOL_VERSION (to stop old and new versions connecting).
+ */
+enum StateHashFunction
 {
-	// We don't care about cryptographic strength, just about detection of
-	// unintended changes and about performance, so MD5 is an adequate choice
-	typedef MD5 HashFunc;
+	STATE_HASH_MD5,
+	STATE_HASH_MURMUR3
+};
+
+static const StateHashFunction DEFAULT_STATE_HASH = STATE_HASH_MURMUR3;
 
+class CHashSerializerImpl
+{
 public:
+	CHashSerializerImpl(StateHashFunction func);
+
 	size_t GetHashLength();
 	const u8* ComputeHash();
 
 	void Put(const char* UNUSED(name), const u8* data, size_t len)
 	{
-		m_Hash.Update(data, len);
+		// (The branch is trivially predictable, so this is much cheaper
+		// than the hashing itself)
+		if (m_Func == STATE_HASH_MURMUR3)
+			m_Murmur.Update(data, len);
+		else
+			m_MD5.Update(data, len);
 	}
 
 private:
-	HashFunc m_Hash;
-	u8 m_HashData[HashFunc::DIGESTSIZE];
+	StateHashFunction m_Func;
+	MurmurHash3 m_Murmur;
+	MD5 m_MD5;
+	u8 m_HashData[16];
 };
 
+cassert(MurmurHash3::DIGESTSIZE == 16 && MD5::DIGESTSIZE == 16);
+
 class CHashSerializer : public CBinarySerializer<CHashSerializerImpl>
 {
 public:
-	CHashSerializer(ScriptInterface& scriptInterface);
+	CHashSerializer(ScriptInterface& scriptInterface, StateHashFunction func = DEFAULT_STATE_HASH);
 
 	size_t GetHashLength();
 	const u8* ComputeHash();
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -25,6 +25,8 @@
 
 #include "simulation2/components/ICmpPathfinder.h"
 
+#include <boost/unordered_map.hpp>
+
 template<typename ELEM>
 struct SerializeVector
 {
@@ -53,6 +55,51 @@ struct SerializeVector
 	}
 };
 
+/**
+ * Serializes a vector as a sequence of runs of equal elements, which is much
+ * more compact than SerializeVector for data with large uniform regions
+ * (e.g. unexplored or fully explored areas of the LOS map).
+ */
+template<typename ELEM>
+struct SerializeRepetitiveVector
+{
+	template<typename T>
+	void operator()(ISerializer& serialize, const char* name, std::vector<T>& value)
+	{
+		size_t len = value.size();
+		serialize.NumberU32_Unbounded("length", (u32)len);
+		size_t i = 0;
+		while (i < len)
+		{
+			size_t j = i + 1;
+			while (j < len && value[j] == value[i])
+				++j;
+			serialize.NumberU32_Unbounded("run", (u32)(j - i));
+			ELEM()(serialize, name, value[i]);
+			i = j;
+		}
+	}
+
+	template<typename T>
+	void operator()(IDeserializer& deserialize, const char* name, std::vector<T>& value)
+	{
+		value.clear();
+		u32 len;
+		deserialize.NumberU32_Unbounded("length", len);
+		value.reserve(len); // TODO: watch out for out-of-memory
+		while (value.size() < len)
+		{
+			u32 run;
+			deserialize.NumberU32_Unbounded("run", run);
+			if (run == 0 || run > len - value.size())
+				throw PSERROR_Deserialize_OutOfBounds("SerializeRepetitiveVector");
+			T el;
+			ELEM()(deserialize, name, el);
+			value.insert(value.end(), run, el);
+		}
+	}
+};
+
 template<typename KS, typename VS>
 struct SerializeMap
 {
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -28,7 +28,13 @@ enum
 	SCRIPT_TYPE_INT = 5,
 	SCRIPT_TYPE_DOUBLE = 6,
 	SCRIPT_TYPE_BOOLEAN = 7,
-	SCRIPT_TYPE_BACKREF = 8
+	SCRIPT_TYPE_BACKREF = 8,
+	SCRIPT_TYPE_ARRAY_INT32 = 9, // dense array of ints, stored without property names
+	SCRIPT_TYPE_ARRAY_DOUBLE = 10 // dense array of numbers, stored without property names
 };
 
+// Object property names are stored as a "prop name id": 0 means a new name follows
+// as a string (and gets the next id, starting from 1); otherwise it's the id of a name
+// that was already stored in the same serialization
+
 #endif // INCLUDED_SERIALIZEDSCRIPTTYPES
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -57,8 +57,9 @@ void CStdDeserializer::Get(const char* name, u8* data, size_t len)
 #else
 	UNUSED2(name);
 #endif
-	m_Stream.read((char*)data, (std::streamsize)len);
-	if (!m_Stream.good()) // hit eof before len, or other errors
+	// Read from the stream buffer directly, since istream::read's overhead per call
+	// is significant when deserializing lots of small values
+	if (m_Stream.rdbuf()->sgetn((char*)data, (std::streamsize)len) != (std::streamsize)len) // hit eof before len
 		throw PSERROR_Deserialize_ReadFailed();
 }
 
@@ -154,8 +155,7 @@ jsval CStdDeserializer::ReadScriptVal(const char* UNUSED(name), JSObject* append
 
 		for (uint32_t i = 0; i < numProps; ++i)
 		{
-			utf16string propname;
-			ReadStringUTF16("prop name", propname);
+			const utf16string& propname = ReadPropName();
 
 			jsval propval = ReadScriptVal("prop value", NULL);
 			CScriptValRooted propvalRoot(cx, propval);
@@ -202,11 +202,75 @@ jsval CStdDeserializer::ReadScriptVal(const char* UNUSED(name), JSObject* append
 			throw PSERROR_Deserialize_ScriptError("Invalid backref tag");
 		return OBJECT_TO_JSVAL(obj);
 	}
+	case SCRIPT_TYPE_ARRAY_INT32:
+	case SCRIPT_TYPE_ARRAY_DOUBLE:
+		return ReadDenseArray(type, appendParent);
 	default:
 		throw PSERROR_Deserialize_OutOfBounds();
 	}
 }
 
+const utf16string& CStdDeserializer::ReadPropName()
+{
+	u32 id;
+	NumberU32_Unbounded("prop name id", id);
+	if (id == 0)
+	{
+		m_ScriptPropNames.push_back(utf16string());
+		ReadStringUTF16("prop name", m_ScriptPropNames.back());
+		return m_ScriptPropNames.back();
+	}
+
+	if (id > m_ScriptPropNames.size())
+		throw PSERROR_Deserialize_ScriptError("Invalid prop name id");
+	return m_ScriptPropNames[id-1];
+}
+
+jsval CStdDeserializer::ReadDenseArray(u8 type, JSObject* appendParent)
+{
+	JSContext* cx = m_ScriptInterface.GetContext();
+
+	u32 length;
+	NumberU32_Unbounded("array length", length);
+	RequireBytesInStream((size_t)length * (type == SCRIPT_TYPE_ARRAY_INT32 ? 4 : 8));
+
+	// Numbers aren't GC things, so they don't need rooting before they're in the array
+	std::vector<jsval> values(length);
+	for (u32 i = 0; i < length; ++i)
+	{
+		if (type == SCRIPT_TYPE_ARRAY_INT32)
+		{
+			int32_t value;
+			NumberI32("value", value, JSVAL_INT_MIN, JSVAL_INT_MAX);
+			values[i] = INT_TO_JSVAL(value);
+		}
+		else
+		{
+			double value;
+			NumberDouble_Unbounded("value", value);
+			if (!JS_NewNumberValue(cx, value, &values[i]))
+				throw PSERROR_Deserialize_ScriptError("JS_NewNumberValue failed");
+		}
+	}
+
+	JSObject* obj = appendParent;
+	if (obj)
+	{
+		for (u32 i = 0; i < length; ++i)
+			if (!JS_SetElement(cx, obj, (jsint)i, &values[i]))
+				throw PSERROR_Deserialize_ScriptError();
+	}
+	else
+	{
+		obj = JS_NewArrayObject(cx, (jsint)length, length ? &values[0] : NULL);
+		if (!obj)
+			throw PSERROR_Deserialize_ScriptError();
+	}
+
+	AddScriptBackref(obj);
+	return OBJECT_TO_JSVAL(obj);
+}
+
 void CStdDeserializer::ReadStringUTF16(const char* name, utf16string& str)
 {
 	uint32_t len;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -22,6 +22,7 @@
 
 #include "ps/utf16string.h"
 
+#include <deque>
 #include <map>
 
 class CStdDeserializer : public IDeserializer
@@ -46,14 +47,34 @@ protected:
 private:
 	jsval ReadScriptVal(const char* name, JSObject* appendParent);
 	void ReadStringUTF16(const char* name, utf16string& str);
+	const utf16string& ReadPropName();
+	jsval ReadDenseArray(u8 type, JSObject* appendParent);
 
 	virtual void AddScriptBackref(JSObject* obj);
 	virtual JSObject* GetScriptBackref(u32 tag);
 	void FreeScriptBackrefs();
 	std::map<u32, JSObject*> m_ScriptBackrefs; // vector would be nice but maintaining JS roots would be harder
+	std::deque<utf16string> m_ScriptPropNames; // indexed by prop name id - 1; deque so ReadPropName's references survive nested push_backs
 	ScriptInterface& m_ScriptInterface;
 
 	std::istream& m_Stream;
 };
 
+/**
+ * Read-only stream buffer over an existing block of memory, so that data which is
+ * already in memory (e.g. a quicksaved state) can be deserialized without copying
+ * it into a std::stringstream first.
+ * The memory must remain valid and unchanged for the lifetime of this object.
+ */
+class CBufferStreamBuf : public std::streambuf
+{
+	NONCOPYABLE(CBufferStreamBuf);
+public:
+	CBufferStreamBuf(const char* data, size_t len)
+	{
+		char* p = const_cast<char*>(data); // (the get area is never written to)
+		setg(p, p, p + len);
+	}
+};
+
 #endif // INCLUDED_STDDESERIALIZER
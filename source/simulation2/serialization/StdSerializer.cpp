@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -33,3 +33,13 @@ std::ostream& CStdSerializer::GetStream()
 {
 	return m_Impl.GetStream();
 }
+
+CBufferSerializerImpl::CBufferSerializerImpl(std::string& buffer) :
+	m_Buffer(buffer)
+{
+}
+
+CBufferSerializer::CBufferSerializer(ScriptInterface& scriptInterface, std::string& buffer) :
+	CBinarySerializer<CBufferSerializerImpl>(scriptInterface, buffer)
+{
+}
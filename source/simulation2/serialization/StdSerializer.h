@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -59,4 +59,42 @@ public:
 	virtual std::ostream& GetStream();
 };
 
+/**
+ * Serializer output that appends directly to a contiguous string buffer,
+ * avoiding the overhead of std::ostream and the copy out of a std::stringstream
+ * when the caller wants the serialized data in memory anyway.
+ */
+class CBufferSerializerImpl
+{
+	NONCOPYABLE(CBufferSerializerImpl);
+public:
+	CBufferSerializerImpl(std::string& buffer);
+
+	void Put(const char* name, const u8* data, size_t len)
+	{
+#if DEBUG_SERIALIZER_ANNOTATE
+		m_Buffer += '<';
+		m_Buffer.append(name);
+		m_Buffer += '>';
+#else
+		UNUSED2(name);
+#endif
+		m_Buffer.append((const char*)data, len);
+	}
+
+private:
+	std::string& m_Buffer;
+};
+
+/**
+ * Binary serializer that appends to a std::string.
+ * Callers that serialize repeatedly should reserve() the buffer based on
+ * the size of the previous output, to avoid reallocation as it grows.
+ */
+class CBufferSerializer : public CBinarySerializer<CBufferSerializerImpl>
+{
+public:
+	CBufferSerializer(ScriptInterface& scriptInterface, std::string& buffer);
+};
+
 #endif // INCLUDED_STDSERIALIZER
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -21,6 +21,7 @@
 #include "simulation2/system/CmpPtr.h"
 #include "simulation2/system/Components.h"
 #include "simulation2/system/ComponentManager.h"
+#include "simulation2/system/ComponentPool.h"
 #include "simulation2/system/IComponent.h"
 #include "simulation2/system/ParamNode.h"
 #include "simulation2/system/SimContext.h"
@@ -42,18 +43,25 @@
 	}
 
 #define DEFAULT_COMPONENT_ALLOCATOR(cname) \
-	static IComponent* Allocate(ScriptInterface&, jsval) { return new CCmp##cname(); } \
-	static void Deallocate(IComponent* cmp) { delete static_cast<CCmp##cname*> (cmp); } \
+	static IComponent* Allocate(ScriptInterface&, jsval) { return new (ComponentPool<CCmp##cname>::Allocate()) CCmp##cname(); } \
+	static void Deallocate(IComponent* cmp) \
+	{ \
+		CCmp##cname* c = static_cast<CCmp##cname*> (cmp); \
+		c->~CCmp##cname(); \
+		ComponentPool<CCmp##cname>::Deallocate(c); \
+	} \
 
 #define DEFAULT_SCRIPT_WRAPPER(cname) \
 	static void ClassInit(CComponentManager& UNUSED(componentManager)) { } \
 	static IComponent* Allocate(ScriptInterface& scriptInterface, jsval instance) \
 	{ \
-		return new CCmp##cname(scriptInterface, instance); \
+		return new (ComponentPool<CCmp##cname>::Allocate()) CCmp##cname(scriptInterface, instance); \
 	} \
 	static void Deallocate(IComponent* cmp) \
 	{ \
-		delete static_cast<CCmp##cname*> (cmp); \
+		CCmp##cname* c = static_cast<CCmp##cname*> (cmp); \
+		c->~CCmp##cname(); \
+		ComponentPool<CCmp##cname>::Deallocate(c); \
 	} \
 	CCmp##cname(ScriptInterface& scriptInterface, jsval instance) : m_Script(scriptInterface, instance) { } \
 	static std::string GetSchema() \
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -26,9 +26,14 @@
 #include "simulation2/MessageTypes.h"
 #include "simulation2/components/ICmpTemplateManager.h"
 
+#include "lib/timer.h"
 #include "lib/utf8.h"
 #include "ps/CLogger.h"
 #include "ps/Filesystem.h"
+#include "ps/Profile.h"
+#include "ps/Profiler2.h"
+#include "ps/ThreadPool.h"
+#include "simulation2/scripting/ScriptComponentStats.h"
 
 /**
  * Used for script-only message types.
@@ -55,7 +60,7 @@ public:
 CComponentManager::CComponentManager(CSimContext& context, bool skipScriptFunctions) :
 	m_NextScriptComponentTypeId(CID__LastNative),
 	m_ScriptInterface("Engine", "Simulation", ScriptInterface::CreateRuntime()),
-	m_SimContext(context), m_CurrentlyHotloading(false)
+	m_SimContext(context), m_CurrentlyHotloading(false), m_LastSerializedStateSize(0)
 {
 	context.SetComponentManager(this);
 
@@ -81,6 +86,7 @@ CComponentManager::CComponentManager(CSimContext& context, bool skipScriptFuncti
 		m_ScriptInterface.RegisterFunction<int, std::string, CComponentManager::Script_AddEntity> ("AddEntity");
 		m_ScriptInterface.RegisterFunction<int, std::string, CComponentManager::Script_AddLocalEntity> ("AddLocalEntity");
 		m_ScriptInterface.RegisterFunction<void, int, CComponentManager::Script_DestroyEntity> ("DestroyEntity");
+		m_ScriptInterface.RegisterFunction<void, int, int, bool, CComponentManager::Script_SetSleeping> ("SetSleeping");
 		m_ScriptInterface.RegisterFunction<CScriptVal, std::wstring, CComponentManager::Script_ReadJSONFile> ("ReadJSONFile");
 		m_ScriptInterface.RegisterFunction<CScriptVal, std::wstring, CComponentManager::Script_ReadCivJSONFile> ("ReadCivJSONFile");
 		m_ScriptInterface.RegisterFunction<std::vector<std::string>, std::wstring, bool, CComponentManager::Script_FindJSONFiles> ("FindJSONFiles");
@@ -101,6 +107,7 @@ CComponentManager::CComponentManager(CSimContext& context, bool skipScriptFuncti
 	m_ScriptInterface.SetGlobal("SYSTEM_ENTITY", (int)SYSTEM_ENTITY);
 
 	m_ComponentsByInterface.resize(IID__LastNative);
+	m_ComponentsByTypeId.resize(CID__LastNative);
 
 	ResetState();
 }
@@ -135,12 +142,7 @@ void CComponentManager::LoadComponentTypes()
 bool CComponentManager::LoadScript(const VfsPath& filename, bool hotload)
 {
 	m_CurrentlyHotloading = hotload;
-	CVFSFile file;
-	PSRETURN loadOk = file.Load(g_VFS, filename);
-	ENSURE(loadOk == PSRETURN_OK); // TODO
-	std::string content = file.DecodeUTF8(); // assume it's UTF-8
-	bool ok = m_ScriptInterface.LoadScript(filename, content);
-	return ok;
+	return m_ScriptInterface.LoadScriptFile(filename);
 }
 
 void CComponentManager::Script_RegisterComponentType(void* cbdata, int iid, std::string cname, CScriptVal ctor)
@@ -164,56 +166,71 @@ void CComponentManager::Script_RegisterComponentType(void* cbdata, int iid, std:
 		// Allocate a new cid number
 		cid = componentManager->m_NextScriptComponentTypeId++;
 		componentManager->m_ComponentTypeIdsByName[cname] = cid;
+		componentManager->m_ComponentsByTypeId.resize(cid+1); // add one so we can index by ComponentTypeId
 	}
 	else
 	{
-		// Component type is already loaded, so do hotloading:
+		const ComponentType& ctPrevious = componentManager->m_ComponentTypesById[cid];
 
-		if (!componentManager->m_CurrentlyHotloading)
+		if (ctPrevious.type == CT_Script)
 		{
-			componentManager->m_ScriptInterface.ReportError("Registering component type with already-registered name"); // TODO: report the actual name
-			return;
-		}
+			// Component type is already loaded, so do hotloading:
 
-		const ComponentType& ctPrevious = componentManager->m_ComponentTypesById[cid];
+			if (!componentManager->m_CurrentlyHotloading)
+			{
+				componentManager->m_ScriptInterface.ReportError("Registering component type with already-registered name"); // TODO: report the actual name
+				return;
+			}
 
-		// We can only replace scripted component types, not native ones
-		if (ctPrevious.type != CT_Script)
-		{
-			componentManager->m_ScriptInterface.ReportError("Hotloading script component type with same name as native component");
-			return;
-		}
+			// We don't support changing the IID of a component type (it would require fiddling
+			// around with m_ComponentsByInterface and being careful to guarantee uniqueness per entity)
+			if (ctPrevious.iid != iid)
+			{
+				// ...though it only matters if any components exist with this type
+				if (!componentManager->m_ComponentsByTypeId[cid].empty())
+				{
+					componentManager->m_ScriptInterface.ReportError("Hotloading script component type mustn't change interface ID");
+					return;
+				}
+			}
 
-		// We don't support changing the IID of a component type (it would require fiddling
-		// around with m_ComponentsByInterface and being careful to guarantee uniqueness per entity)
-		if (ctPrevious.iid != iid)
+			mustReloadComponents = true;
+		}
+		else
 		{
-			// ...though it only matters if any components exist with this type
+			// Script types can replace the native type with the same name (so mods can
+			// provide their own versions of native components), keeping its cid, as long
+			// as they implement the same interface and no native instances exist yet
+			if (ctPrevious.iid != iid)
+			{
+				componentManager->m_ScriptInterface.ReportError("Script component type replacing native component must have the same interface ID");
+				return;
+			}
+
 			if (!componentManager->m_ComponentsByTypeId[cid].empty())
 			{
-				componentManager->m_ScriptInterface.ReportError("Hotloading script component type mustn't change interface ID");
+				componentManager->m_ScriptInterface.ReportError("Script component type can't replace native component that's already in use");
 				return;
 			}
 		}
 
 		// Remove the old component type's message subscriptions
-		std::map<MessageTypeId, std::vector<ComponentTypeId> >::iterator it;
+		std::vector<std::vector<ComponentTypeId> >::iterator it;
 		for (it = componentManager->m_LocalMessageSubscriptions.begin(); it != componentManager->m_LocalMessageSubscriptions.end(); ++it)
 		{
-			std::vector<ComponentTypeId>& types = it->second;
+			std::vector<ComponentTypeId>& types = *it;
 			std::vector<ComponentTypeId>::iterator ctit = find(types.begin(), types.end(), cid);
 			if (ctit != types.end())
 				types.erase(ctit);
 		}
 		for (it = componentManager->m_GlobalMessageSubscriptions.begin(); it != componentManager->m_GlobalMessageSubscriptions.end(); ++it)
 		{
-			std::vector<ComponentTypeId>& types = it->second;
+			std::vector<ComponentTypeId>& types = *it;
 			std::vector<ComponentTypeId>::iterator ctit = find(types.begin(), types.end(), cid);
 			if (ctit != types.end())
 				types.erase(ctit);
 		}
-
-		mustReloadComponents = true;
+		componentManager->InvalidateMessageRecipients();
 	}
 
 	std::string schema = "<empty/>";
@@ -283,8 +300,8 @@ void CComponentManager::Script_RegisterComponentType(void* cbdata, int iid, std:
 	{
 		// For every script component with this cid, we need to switch its
 		// prototype from the old constructor's prototype property to the new one's
-		const std::map<entity_id_t, IComponent*>& comps = componentManager->m_ComponentsByTypeId[cid];
-		std::map<entity_id_t, IComponent*>::const_iterator eit = comps.begin();
+		const EntityMap<IComponent*>& comps = componentManager->m_ComponentsByTypeId[cid];
+		EntityMap<IComponent*>::const_iterator eit = comps.begin();
 		for (; eit != comps.end(); ++eit)
 		{
 			jsval instance = eit->second->GetJSInstance();
@@ -301,9 +318,10 @@ void CComponentManager::Script_RegisterInterface(void* cbdata, std::string name)
 	std::map<std::string, InterfaceId>::iterator it = componentManager->m_InterfaceIdsByName.find(name);
 	if (it != componentManager->m_InterfaceIdsByName.end())
 	{
-		// Redefinitions are fine (and just get ignored) when hotloading; otherwise
-		// they're probably unintentional and should be reported
-		if (!componentManager->m_CurrentlyHotloading)
+		// Redefinitions are fine (and just get ignored) when hotloading, or for native
+		// interfaces (which scripts that replace native components may register again);
+		// otherwise they're probably unintentional and should be reported
+		if (!componentManager->m_CurrentlyHotloading && it->second >= IID__LastNative)
 			componentManager->m_ScriptInterface.ReportError("Registering interface with already-registered name"); // TODO: report the actual name
 		return;
 	}
@@ -357,9 +375,9 @@ std::vector<int> CComponentManager::Script_GetEntitiesWithInterface(void* cbdata
 
 	std::vector<int> ret;
 	const InterfaceListUnordered& ents = componentManager->GetEntitiesWithInterfaceUnordered(iid);
+	ret.reserve(ents.size());
 	for (InterfaceListUnordered::const_iterator it = ents.begin(); it != ents.end(); ++it)
 		ret.push_back(it->first); // TODO: maybe we should exclude local entities
-	std::sort(ret.begin(), ret.end());
 	return ret;
 }
 
@@ -368,8 +386,9 @@ std::vector<IComponent*> CComponentManager::Script_GetComponentsWithInterface(vo
 	CComponentManager* componentManager = static_cast<CComponentManager*> (cbdata);
 
 	std::vector<IComponent*> ret;
-	InterfaceList ents = componentManager->GetEntitiesWithInterface(iid);
-	for (InterfaceList::const_iterator it = ents.begin(); it != ents.end(); ++it)
+	const InterfaceListUnordered& ents = componentManager->GetEntitiesWithInterfaceUnordered(iid);
+	ret.reserve(ents.size());
+	for (InterfaceListUnordered::const_iterator it = ents.begin(); it != ents.end(); ++it)
 		ret.push_back(it->second); // TODO: maybe we should exclude local entities
 	return ret;
 }
@@ -447,28 +466,45 @@ void CComponentManager::Script_DestroyEntity(void* cbdata, int ent)
 	componentManager->DestroyComponentsSoon(ent);
 }
 
+void CComponentManager::Script_SetSleeping(void* cbdata, int ent, int iid, bool sleeping)
+{
+	CComponentManager* componentManager = static_cast<CComponentManager*> (cbdata);
+
+	IComponent* component = componentManager->QueryInterface((entity_id_t)ent, iid);
+	if (!component)
+	{
+		LOGERROR(L"SetSleeping: entity %d has no component with interface %d", ent, iid);
+		return;
+	}
+
+	componentManager->SetSleeping(component, sleeping);
+}
+
 void CComponentManager::ResetState()
 {
 	// Delete all IComponents
-	std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> >::iterator iit = m_ComponentsByTypeId.begin();
-	for (; iit != m_ComponentsByTypeId.end(); ++iit)
+	for (size_t cid = 0; cid < m_ComponentsByTypeId.size(); ++cid)
 	{
-		std::map<entity_id_t, IComponent*>::iterator eit = iit->second.begin();
-		for (; eit != iit->second.end(); ++eit)
+		EntityMap<IComponent*>& emap = m_ComponentsByTypeId[cid];
+		for (EntityMap<IComponent*>::iterator eit = emap.begin(); eit != emap.end(); ++eit)
 		{
 			eit->second->Deinit();
-			m_ComponentTypesById[iit->first].dealloc(eit->second);
+			m_ComponentTypesById[(ComponentTypeId)cid].dealloc(eit->second);
 		}
+		emap.clear();
 	}
 
-	std::vector<boost::unordered_map<entity_id_t, IComponent*> >::iterator ifcit = m_ComponentsByInterface.begin();
+	std::vector<EntityMap<IComponent*> >::iterator ifcit = m_ComponentsByInterface.begin();
 	for (; ifcit != m_ComponentsByInterface.end(); ++ifcit)
 		ifcit->clear();
 
-	m_ComponentsByTypeId.clear();
+	InvalidateMessageRecipients();
 
 	m_DestructionQueue.clear();
 
+	m_PositionChanges.clear();
+	m_PositionChangeIndex.clear();
+
 	// Reset IDs
 	m_NextEntityId = SYSTEM_ENTITY + 1;
 	m_NextLocalEntityId = FIRST_LOCAL_ENTITY;
@@ -480,6 +516,8 @@ void CComponentManager::RegisterComponentType(InterfaceId iid, ComponentTypeId c
 	ComponentType c = { CT_Native, iid, alloc, dealloc, name, schema, CScriptValRooted() };
 	m_ComponentTypesById.insert(std::make_pair(cid, c));
 	m_ComponentTypeIdsByName[name] = cid;
+	if ((size_t)cid >= m_ComponentsByTypeId.size())
+		m_ComponentsByTypeId.resize(cid+1);
 }
 
 void CComponentManager::RegisterComponentTypeScriptWrapper(InterfaceId iid, ComponentTypeId cid, AllocFunc alloc,
@@ -488,6 +526,8 @@ void CComponentManager::RegisterComponentTypeScriptWrapper(InterfaceId iid, Comp
 	ComponentType c = { CT_ScriptWrapper, iid, alloc, dealloc, name, schema, CScriptValRooted() };
 	m_ComponentTypesById.insert(std::make_pair(cid, c));
 	m_ComponentTypeIdsByName[name] = cid;
+	if ((size_t)cid >= m_ComponentsByTypeId.size())
+		m_ComponentsByTypeId.resize(cid+1);
 	// TODO: merge with RegisterComponentType
 }
 
@@ -501,18 +541,26 @@ void CComponentManager::SubscribeToMessageType(MessageTypeId mtid)
 {
 	// TODO: verify mtid
 	ENSURE(m_CurrentComponent != CID__Invalid);
+	if ((size_t)mtid >= m_LocalMessageSubscriptions.size())
+		m_LocalMessageSubscriptions.resize(mtid+1);
 	std::vector<ComponentTypeId>& types = m_LocalMessageSubscriptions[mtid];
 	types.push_back(m_CurrentComponent);
 	std::sort(types.begin(), types.end()); // TODO: just sort once at the end of LoadComponents
+	m_ComponentTypesById[m_CurrentComponent].localSubscriptions.push_back(mtid);
+	InvalidateMessageRecipients();
 }
 
 void CComponentManager::SubscribeGloballyToMessageType(MessageTypeId mtid)
 {
 	// TODO: verify mtid
 	ENSURE(m_CurrentComponent != CID__Invalid);
+	if ((size_t)mtid >= m_GlobalMessageSubscriptions.size())
+		m_GlobalMessageSubscriptions.resize(mtid+1);
 	std::vector<ComponentTypeId>& types = m_GlobalMessageSubscriptions[mtid];
 	types.push_back(m_CurrentComponent);
 	std::sort(types.begin(), types.end()); // TODO: just sort once at the end of LoadComponents
+	m_ComponentTypesById[m_CurrentComponent].globalSubscriptions.push_back(mtid);
+	InvalidateMessageRecipients();
 }
 
 CComponentManager::ComponentTypeId CComponentManager::LookupCID(const std::string& cname) const
@@ -594,15 +642,16 @@ IComponent* CComponentManager::ConstructComponent(entity_id_t ent, ComponentType
 	const ComponentType& ct = it->second;
 
 	ENSURE((size_t)ct.iid < m_ComponentsByInterface.size());
+	ENSURE((size_t)cid < m_ComponentsByTypeId.size());
 
-	boost::unordered_map<entity_id_t, IComponent*>& emap1 = m_ComponentsByInterface[ct.iid];
+	EntityMap<IComponent*>& emap1 = m_ComponentsByInterface[ct.iid];
 	if (emap1.find(ent) != emap1.end())
 	{
 		LOGERROR(L"Multiple components for interface %d", ct.iid);
 		return NULL;
 	}
 
-	std::map<entity_id_t, IComponent*>& emap2 = m_ComponentsByTypeId[cid];
+	EntityMap<IComponent*>& emap2 = m_ComponentsByTypeId[cid];
 
 	// If this is a scripted component, construct the appropriate JS object first
 	jsval obj = JSVAL_NULL;
@@ -622,10 +671,12 @@ IComponent* CComponentManager::ConstructComponent(entity_id_t ent, ComponentType
 
 	component->SetEntityId(ent);
 	component->SetSimContext(m_SimContext);
+	component->m_ComponentTypeId = cid;
 
 	// Store a reference to the new component
 	emap1.insert(std::make_pair(ent, component));
 	emap2.insert(std::make_pair(ent, component));
+	InvalidateMessageRecipients(cid);
 	// TODO: We need to more careful about this - if an entity is constructed by a component
 	// while we're iterating over all components, this will invalidate the iterators and everything
 	// will break.
@@ -640,7 +691,7 @@ void CComponentManager::AddMockComponent(entity_id_t ent, InterfaceId iid, IComp
 	// Just add it into the by-interface map, not the by-component-type map,
 	// so it won't be considered for messages or deletion etc
 
-	boost::unordered_map<entity_id_t, IComponent*>& emap1 = m_ComponentsByInterface.at(iid);
+	EntityMap<IComponent*>& emap1 = m_ComponentsByInterface.at(iid);
 	if (emap1.find(ent) != emap1.end())
 		debug_warn(L"Multiple components for interface");
 	emap1.insert(std::make_pair(ent, &component));
@@ -666,10 +717,10 @@ entity_id_t CComponentManager::AddEntity(const std::wstring& templateName, entit
 	for (CParamNode::ChildrenMap::const_iterator it = tmplChilds.begin(); it != tmplChilds.end(); ++it)
 	{
 		// Ignore attributes on the root element
-		if (it->first.length() && it->first[0] == '@')
+		if (it->first.c_str()[0] == '@')
 			continue;
 
-		CComponentManager::ComponentTypeId cid = LookupCID(it->first);
+		CComponentManager::ComponentTypeId cid = LookupCID(it->first.string());
 		if (cid == CID__Invalid)
 		{
 			LOGERROR(L"Unrecognised component type name '%hs' in entity template '%ls'", it->first.c_str(), templateName.c_str());
@@ -691,6 +742,77 @@ entity_id_t CComponentManager::AddEntity(const std::wstring& templateName, entit
 	return ent;
 }
 
+void CComponentManager::AddEntities(const std::wstring& templateName, std::vector<entity_id_t>& ents)
+{
+	if (ents.empty())
+		return;
+
+	ICmpTemplateManager *cmpTemplateManager = static_cast<ICmpTemplateManager*> (QueryInterface(SYSTEM_ENTITY, IID_TemplateManager));
+	if (!cmpTemplateManager)
+	{
+		debug_warn(L"No ICmpTemplateManager loaded");
+		std::fill(ents.begin(), ents.end(), INVALID_ENTITY);
+		return;
+	}
+
+	std::string templateNameUTF8 = utf8_from_wstring(templateName);
+
+	const CParamNode* tmpl = cmpTemplateManager->LoadTemplate(ents[0], templateNameUTF8, -1);
+	if (!tmpl)
+	{
+		// LoadTemplate will have reported the error
+		std::fill(ents.begin(), ents.end(), INVALID_ENTITY);
+		return;
+	}
+
+	// Find the component types once for the whole batch
+	std::vector<std::pair<ComponentTypeId, const CParamNode*> > components;
+	const CParamNode::ChildrenMap& tmplChilds = tmpl->GetChildren();
+	for (CParamNode::ChildrenMap::const_iterator it = tmplChilds.begin(); it != tmplChilds.end(); ++it)
+	{
+		// Ignore attributes on the root element
+		if (it->first.c_str()[0] == '@')
+			continue;
+
+		CComponentManager::ComponentTypeId cid = LookupCID(it->first.string());
+		if (cid == CID__Invalid)
+		{
+			LOGERROR(L"Unrecognised component type name '%hs' in entity template '%ls'", it->first.c_str(), templateName.c_str());
+			std::fill(ents.begin(), ents.end(), INVALID_ENTITY);
+			return;
+		}
+
+		components.push_back(std::make_pair(cid, &it->second));
+	}
+
+	for (size_t i = 0; i < ents.size(); ++i)
+	{
+		// (The template manager needs to remember the template of every entity)
+		if (i > 0)
+			cmpTemplateManager->LoadTemplate(ents[i], templateNameUTF8, -1);
+
+		bool ok = true;
+		for (size_t j = 0; j < components.size(); ++j)
+		{
+			if (!AddComponent(ents[i], components[j].first, *components[j].second))
+			{
+				LOGERROR(L"Failed to construct component type name '%hs' in entity template '%ls'", LookupComponentTypeName(components[j].first).c_str(), templateName.c_str());
+				ok = false;
+				break;
+			}
+		}
+
+		if (!ok)
+		{
+			ents[i] = INVALID_ENTITY;
+			continue;
+		}
+
+		CMessageCreate msg(ents[i]);
+		PostMessage(ents[i], msg);
+	}
+}
+
 void CComponentManager::DestroyComponentsSoon(entity_id_t ent)
 {
 	m_DestructionQueue.push_back(ent);
@@ -713,25 +835,32 @@ void CComponentManager::FlushDestroyedComponents()
 			PostMessage(ent, msg);
 
 			// Destroy the components, and remove from m_ComponentsByTypeId:
-			std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> >::iterator iit = m_ComponentsByTypeId.begin();
-			for (; iit != m_ComponentsByTypeId.end(); ++iit)
+			for (size_t cid = 0; cid < m_ComponentsByTypeId.size(); ++cid)
 			{
-				std::map<entity_id_t, IComponent*>::iterator eit = iit->second.find(ent);
-				if (eit != iit->second.end())
+				EntityMap<IComponent*>& emap = m_ComponentsByTypeId[cid];
+				EntityMap<IComponent*>::iterator eit = emap.find(ent);
+				if (eit != emap.end())
 				{
 					eit->second->Deinit();
-					m_ComponentTypesById[iit->first].dealloc(eit->second);
-					iit->second.erase(ent);
+					m_ComponentTypesById[(ComponentTypeId)cid].dealloc(eit->second);
+					emap.erase(eit);
+					InvalidateMessageRecipients((ComponentTypeId)cid);
 				}
 			}
 
 			// Remove from m_ComponentsByInterface
-			std::vector<boost::unordered_map<entity_id_t, IComponent*> >::iterator ifcit = m_ComponentsByInterface.begin();
+			std::vector<EntityMap<IComponent*> >::iterator ifcit = m_ComponentsByInterface.begin();
 			for (; ifcit != m_ComponentsByInterface.end(); ++ifcit)
 			{
 				ifcit->erase(ent);
 			}
 		}
+
+		// Erasing only marked the entries as removed, so pack each map once for the whole batch
+		for (size_t cid = 0; cid < m_ComponentsByTypeId.size(); ++cid)
+			m_ComponentsByTypeId[cid].compact();
+		for (size_t iid = 0; iid < m_ComponentsByInterface.size(); ++iid)
+			m_ComponentsByInterface[iid].compact();
 	}
 }
 
@@ -743,8 +872,9 @@ IComponent* CComponentManager::QueryInterface(entity_id_t ent, InterfaceId iid)
 		return NULL;
 	}
 
-	boost::unordered_map<entity_id_t, IComponent*>::const_iterator eit = m_ComponentsByInterface[iid].find(ent);
-	if (eit == m_ComponentsByInterface[iid].end())
+	const EntityMap<IComponent*>& emap = m_ComponentsByInterface[iid];
+	EntityMap<IComponent*>::const_iterator eit = emap.find(ent);
+	if (eit == emap.end())
 	{
 		// This entity doesn't implement this interface
 		return NULL;
@@ -763,13 +893,8 @@ CComponentManager::InterfaceList CComponentManager::GetEntitiesWithInterface(Int
 		return ret;
 	}
 
-	ret.reserve(m_ComponentsByInterface[iid].size());
-
-	boost::unordered_map<entity_id_t, IComponent*>::const_iterator it = m_ComponentsByInterface[iid].begin();
-	for (; it != m_ComponentsByInterface[iid].end(); ++it)
-		ret.push_back(*it);
-
-	std::sort(ret.begin(), ret.end()); // lexicographic pair comparison means this'll sort by entity ID
+	// The storage is already sorted by entity ID, so this is just a copy
+	ret.assign(m_ComponentsByInterface[iid].begin(), m_ComponentsByInterface[iid].end());
 
 	return ret;
 }
@@ -786,91 +911,431 @@ const CComponentManager::InterfaceListUnordered& CComponentManager::GetEntitiesW
 	return m_ComponentsByInterface[iid];
 }
 
-void CComponentManager::PostMessage(entity_id_t ent, const CMessage& msg) const
+void CComponentManager::InvalidateMessageRecipients()
 {
-	// Send the message to components of ent, that subscribed locally to this message
-	std::map<MessageTypeId, std::vector<ComponentTypeId> >::const_iterator it;
-	it = m_LocalMessageSubscriptions.find(msg.GetType());
-	if (it != m_LocalMessageSubscriptions.end())
+	m_LocalMessageRecipients.clear();
+	m_GlobalMessageRecipients.clear();
+	m_LocalSleepingChanges.clear();
+	m_GlobalSleepingChanges.clear();
+}
+
+void CComponentManager::InvalidateMessageRecipients(ComponentTypeId cid)
+{
+	std::map<ComponentTypeId, ComponentType>::const_iterator it = m_ComponentTypesById.find(cid);
+	if (it == m_ComponentTypesById.end())
+		return;
+
+	// (The queued sleeping changes go too, since they might refer to a destroyed component)
+	const std::vector<MessageTypeId>& local = it->second.localSubscriptions;
+	for (size_t i = 0; i < local.size(); ++i)
+	{
+		if ((size_t)local[i] < m_LocalMessageRecipients.size())
+			m_LocalMessageRecipients[local[i]].reset();
+		if ((size_t)local[i] < m_LocalSleepingChanges.size())
+			m_LocalSleepingChanges[local[i]].clear();
+	}
+
+	const std::vector<MessageTypeId>& global = it->second.globalSubscriptions;
+	for (size_t i = 0; i < global.size(); ++i)
+	{
+		if ((size_t)global[i] < m_GlobalMessageRecipients.size())
+			m_GlobalMessageRecipients[global[i]].reset();
+		if ((size_t)global[i] < m_GlobalSleepingChanges.size())
+			m_GlobalSleepingChanges[global[i]].clear();
+	}
+}
+
+bool CComponentManager::IsSleepingSkipped(MessageTypeId mtid)
+{
+	switch (mtid)
+	{
+	case MT_Update:
+	case MT_Update_MotionFormation:
+	case MT_Update_MotionUnit:
+	case MT_Update_Final:
+	case MT_Interpolate:
+	case MT_InterpolateParallel:
+		return true;
+	default:
+		return false;
+	}
+}
+
+void CComponentManager::SetSleeping(IComponent* component, bool sleeping)
+{
+	if (component->m_Sleeping == sleeping)
+		return;
+
+	component->m_Sleeping = sleeping;
+
+	// Queue the change for the cached lists that skip sleeping components, of the message
+	// types this component's type subscribes to (lists that haven't been built yet will
+	// pick up the new state anyway)
+	std::map<ComponentTypeId, ComponentType>::const_iterator it = m_ComponentTypesById.find(component->m_ComponentTypeId);
+	if (it == m_ComponentTypesById.end())
+	{
+		debug_warn(L"SetSleeping called on component that wasn't constructed by the component manager");
+		return;
+	}
+
+	const std::vector<MessageTypeId>& local = it->second.localSubscriptions;
+	for (size_t i = 0; i < local.size(); ++i)
+	{
+		MessageTypeId mtid = local[i];
+		if (!IsSleepingSkipped(mtid) || (size_t)mtid >= m_LocalMessageRecipients.size() || !m_LocalMessageRecipients[mtid])
+			continue;
+		if ((size_t)mtid >= m_LocalSleepingChanges.size())
+			m_LocalSleepingChanges.resize(mtid+1);
+		m_LocalSleepingChanges[mtid].push_back(component);
+	}
+
+	const std::vector<MessageTypeId>& global = it->second.globalSubscriptions;
+	for (size_t i = 0; i < global.size(); ++i)
+	{
+		MessageTypeId mtid = global[i];
+		if (!IsSleepingSkipped(mtid) || (size_t)mtid >= m_GlobalMessageRecipients.size() || !m_GlobalMessageRecipients[mtid])
+			continue;
+		if ((size_t)mtid >= m_GlobalSleepingChanges.size())
+			m_GlobalSleepingChanges.resize(mtid+1);
+		m_GlobalSleepingChanges[mtid].push_back(component);
+	}
+}
+
+bool CComponentManager::IsBeforeInDispatchOrder(const IComponent* a, const IComponent* b)
+{
+	if (a->m_ComponentTypeId != b->m_ComponentTypeId)
+		return a->m_ComponentTypeId < b->m_ComponentTypeId;
+	return a->GetEntityId() < b->GetEntityId();
+}
+
+CComponentManager::MessageRecipientsPtr CComponentManager::ApplySleepingChanges(const MessageRecipients& recipients, std::vector<IComponent*>& changes) const
+{
+	// A component might have changed more than once, possibly back to its original state
+	std::sort(changes.begin(), changes.end(), IsBeforeInDispatchOrder);
+	changes.erase(std::unique(changes.begin(), changes.end()), changes.end());
+
+	// Merge the changes into a copy of the list, since a broadcast that's currently in
+	// progress might still be using the old one
+	shared_ptr<MessageRecipients> list(new MessageRecipients());
+	list->reserve(recipients.size() + changes.size());
+
+	MessageRecipients::const_iterator rit = recipients.begin();
+	std::vector<IComponent*>::const_iterator cit = changes.begin();
+	while (rit != recipients.end() || cit != changes.end())
 	{
-		std::vector<ComponentTypeId>::const_iterator ctit = it->second.begin();
-		for (; ctit != it->second.end(); ++ctit)
+		if (cit == changes.end() || (rit != recipients.end() && IsBeforeInDispatchOrder(rit->component, *cit)))
 		{
-			// Find the component instances of this type (if any)
-			std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> >::const_iterator emap = m_ComponentsByTypeId.find(*ctit);
-			if (emap == m_ComponentsByTypeId.end())
+			// Unchanged recipient
+			list->push_back(*rit);
+			++rit;
+			continue;
+		}
+
+		// Whether the changed component is already in the list or not, it belongs
+		// there (in this position) only if it's awake now
+		bool inList = (rit != recipients.end() && rit->component == *cit);
+		if (!(*cit)->m_Sleeping)
+		{
+			if (inList)
+			{
+				list->push_back(*rit);
+			}
+			else
+			{
+				ComponentTypeId cid = (*cit)->m_ComponentTypeId;
+				std::map<ComponentTypeId, ComponentType>::const_iterator it = m_ComponentTypesById.find(cid);
+				bool isScript = (it != m_ComponentTypesById.end() && it->second.type == CT_Script);
+				MessageRecipient recipient = { *cit, isScript, cid };
+				list->push_back(recipient);
+			}
+		}
+
+		if (inList)
+			++rit;
+		++cit;
+	}
+
+	changes.clear();
+	return list;
+}
+
+jsval CComponentManager::AcquireTransientMessage(const CMessage& msg)
+{
+	int mtid = msg.GetType();
+	if (mtid < 0)
+		return JSVAL_VOID;
+	if ((size_t)mtid >= m_TransientMessages.size())
+		m_TransientMessages.resize(mtid + 1);
+
+	TransientMessage& transient = m_TransientMessages[mtid];
+	if (transient.inUse)
+		return JSVAL_VOID;
+
+	if (transient.val.uninitialised())
+	{
+		JSObject* obj = JS_NewObject(m_ScriptInterface.GetContext(), NULL, NULL, NULL);
+		if (!obj)
+			return JSVAL_VOID;
+		transient.val = CScriptValRooted(m_ScriptInterface.GetContext(), OBJECT_TO_JSVAL(obj));
+	}
+
+	if (!msg.UpdateJSVal(m_ScriptInterface, transient.val.get()))
+		return JSVAL_VOID;
+
+	transient.inUse = true;
+	return transient.val.get();
+}
+
+void CComponentManager::ReleaseTransientMessage(const CMessage& msg)
+{
+	int mtid = msg.GetType();
+	ENSURE(mtid >= 0 && (size_t)mtid < m_TransientMessages.size());
+	m_TransientMessages[mtid].inUse = false;
+}
+
+const CComponentManager::MessageRecipientsPtr& CComponentManager::GetMessageRecipients(MessageTypeId mtid, bool global) const
+{
+	const std::vector<std::vector<ComponentTypeId> >& subscriptions = global ? m_GlobalMessageSubscriptions : m_LocalMessageSubscriptions;
+	std::vector<MessageRecipientsPtr>& cache = global ? m_GlobalMessageRecipients : m_LocalMessageRecipients;
+
+	// Don't bother caching anything for message types with no subscriptions
+	// (this also protects against scripts sending invalid message type IDs)
+	if (mtid < 0 || (size_t)mtid >= subscriptions.size())
+	{
+		static const MessageRecipientsPtr empty(new MessageRecipients());
+		return empty;
+	}
+
+	if (cache.size() != subscriptions.size())
+		cache.resize(subscriptions.size());
+
+	MessageRecipientsPtr& recipients = cache[mtid];
+	if (recipients)
+	{
+		std::vector<std::vector<IComponent*> >& sleepingChanges = global ? m_GlobalSleepingChanges : m_LocalSleepingChanges;
+		if ((size_t)mtid < sleepingChanges.size() && !sleepingChanges[mtid].empty())
+			recipients = ApplySleepingChanges(*recipients, sleepingChanges[mtid]);
+		return recipients;
+	}
+
+	// Rebuild the list, in the same order that the subscribed types and their
+	// entities are stored, so the dispatch order is deterministic
+	const bool skipSleeping = IsSleepingSkipped(mtid);
+	shared_ptr<MessageRecipients> list(new MessageRecipients());
+	const std::vector<ComponentTypeId>& types = subscriptions[mtid];
+	for (std::vector<ComponentTypeId>::const_iterator ctit = types.begin(); ctit != types.end(); ++ctit)
+	{
+		// Find the component instances of this type (if any)
+		if ((size_t)*ctit >= m_ComponentsByTypeId.size())
+			continue;
+		const EntityMap<IComponent*>& emap = m_ComponentsByTypeId[*ctit];
+
+		std::map<ComponentTypeId, ComponentType>::const_iterator it = m_ComponentTypesById.find(*ctit);
+		bool isScript = (it != m_ComponentTypesById.end() && it->second.type == CT_Script);
+
+		for (EntityMap<IComponent*>::const_iterator eit = emap.begin(); eit != emap.end(); ++eit)
+		{
+			if (skipSleeping && eit->second->m_Sleeping)
 				continue;
 
-			// Send the message to all of them
-			std::map<entity_id_t, IComponent*>::const_iterator eit = emap->second.find(ent);
-			if (eit != emap->second.end())
-				eit->second->HandleMessage(msg, false);
+			MessageRecipient recipient = { eit->second, isScript, *ctit };
+			list->push_back(recipient);
 		}
 	}
 
-	SendGlobalMessage(ent, msg);
+	recipients = list;
+	return recipients;
 }
 
-void CComponentManager::BroadcastMessage(const CMessage& msg) const
+void CComponentManager::PostMessage(entity_id_t ent, const CMessage& msg) const
 {
-	// Send the message to components of all entities that subscribed locally to this message
-	std::map<MessageTypeId, std::vector<ComponentTypeId> >::const_iterator it;
-	it = m_LocalMessageSubscriptions.find(msg.GetType());
-	if (it != m_LocalMessageSubscriptions.end())
+	// Send the message to components of ent, that subscribed locally to this message
+	MessageTypeId mtid = msg.GetType();
+	if (mtid >= 0 && (size_t)mtid < m_LocalMessageSubscriptions.size())
 	{
-		std::vector<ComponentTypeId>::const_iterator ctit = it->second.begin();
-		for (; ctit != it->second.end(); ++ctit)
+		const std::vector<ComponentTypeId>& types = m_LocalMessageSubscriptions[mtid];
+		std::vector<ComponentTypeId>::const_iterator ctit = types.begin();
+		for (; ctit != types.end(); ++ctit)
 		{
 			// Find the component instances of this type (if any)
-			std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> >::const_iterator emap = m_ComponentsByTypeId.find(*ctit);
-			if (emap == m_ComponentsByTypeId.end())
+			if ((size_t)*ctit >= m_ComponentsByTypeId.size())
 				continue;
+			const EntityMap<IComponent*>& emap = m_ComponentsByTypeId[*ctit];
 
 			// Send the message to all of them
-			std::map<entity_id_t, IComponent*>::const_iterator eit = emap->second.begin();
-			for (; eit != emap->second.end(); ++eit)
-				eit->second->HandleMessage(msg, false);
+			EntityMap<IComponent*>::const_iterator eit = emap.find(ent);
+			if (eit == emap.end())
+				continue;
+
+			if (g_ScriptComponentStatsTable)
+			{
+				std::map<ComponentTypeId, ComponentType>::const_iterator it = m_ComponentTypesById.find(*ctit);
+				if (it != m_ComponentTypesById.end() && it->second.type == CT_Script)
+				{
+					double time = timer_Time();
+					eit->second->HandleMessage(msg, false);
+					g_ScriptComponentStatsTable->Add(it->second.name, msg.GetScriptHandlerName(), 1, timer_Time() - time);
+					continue;
+				}
+			}
+
+			eit->second->HandleMessage(msg, false);
 		}
 	}
 
+	SendGlobalMessage(ent, msg);
+}
+
+void CComponentManager::BroadcastMessage(const CMessage& msg) const
+{
+	// Send the message to components of all entities that subscribed locally to this message.
+	// Take a copy of the pointer, so the list stays valid even if a handler adds or removes
+	// components (components added during this dispatch won't receive the message)
+	MessageRecipientsPtr recipients = GetMessageRecipients(msg.GetType(), false);
+	SendMessageToRecipients(*recipients, msg, false, false);
+
 	SendGlobalMessage(INVALID_ENTITY, msg);
 }
 
+void CComponentManager::ParallelMessageCallback(void* cbdata, size_t begin, size_t end)
+{
+	const ParallelMessageJob* job = static_cast<const ParallelMessageJob*>(cbdata);
+	for (size_t i = begin; i < end; ++i)
+	{
+		const MessageRecipient& recipient = (*job->recipients)[i];
+		if (!recipient.isScript)
+			recipient.component->HandleMessage(*job->msg, false);
+	}
+}
+
+void CComponentManager::BroadcastMessageParallel(const CMessage& msg) const
+{
+	MessageRecipientsPtr recipients = GetMessageRecipients(msg.GetType(), false);
+
+	ParallelMessageJob job = { recipients.get(), &msg };
+
+	// Use small enough chunks that the threads still get similar amounts of work
+	// when some components are much more expensive than others
+	const size_t chunkSize = 32;
+
+	if (g_ThreadPool)
+		g_ThreadPool->ParallelFor(recipients->size(), chunkSize, &ParallelMessageCallback, &job);
+	else
+		ParallelMessageCallback(&job, 0, recipients->size());
+}
+
 void CComponentManager::SendGlobalMessage(entity_id_t ent, const CMessage& msg) const
 {
 	// (Common functionality for PostMessage and BroadcastMessage)
 
-	// Send the message to components of all entities that subscribed globally to this message
-	std::map<MessageTypeId, std::vector<ComponentTypeId> >::const_iterator it;
-	it = m_GlobalMessageSubscriptions.find(msg.GetType());
-	if (it != m_GlobalMessageSubscriptions.end())
+	// Send the message to components of all entities that subscribed globally to this message.
+	// Special case: Messages for non-local entities shouldn't be sent to script
+	// components that subscribed globally, so that we don't have to worry about
+	// them accidentally picking up non-network-synchronised data.
+	MessageRecipientsPtr recipients = GetMessageRecipients(msg.GetType(), true);
+	SendMessageToRecipients(*recipients, msg, true, ENTITY_IS_LOCAL(ent));
+}
+
+void CComponentManager::SendMessageToRecipients(const MessageRecipients& recipients, const CMessage& msg, bool global, bool skipScripts) const
+{
+	MessageRecipients::const_iterator it = recipients.begin();
+	while (it != recipients.end())
 	{
-		std::vector<ComponentTypeId>::const_iterator ctit = it->second.begin();
-		for (; ctit != it->second.end(); ++ctit)
+		if (!it->isScript)
 		{
-			// Special case: Messages for non-local entities shouldn't be sent to script
-			// components that subscribed globally, so that we don't have to worry about
-			// them accidentally picking up non-network-synchronised data.
-			if (ENTITY_IS_LOCAL(ent))
-			{
-				std::map<ComponentTypeId, ComponentType>::const_iterator it = m_ComponentTypesById.find(*ctit);
-				if (it != m_ComponentTypesById.end() && it->second.type == CT_Script)
-					continue;
-			}
+			it->component->HandleMessage(msg, global);
+			++it;
+			continue;
+		}
 
-			// Find the component instances of this type (if any)
-			std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> >::const_iterator emap = m_ComponentsByTypeId.find(*ctit);
-			if (emap == m_ComponentsByTypeId.end())
-				continue;
+		if (skipScripts)
+		{
+			++it;
+			continue;
+		}
 
-			// Send the message to all of them
-			std::map<entity_id_t, IComponent*>::const_iterator eit = emap->second.begin();
-			for (; eit != emap->second.end(); ++eit)
-				eit->second->HandleMessage(msg, true);
+		if (!g_ScriptComponentStatsTable)
+		{
+			it->component->HandleMessage(msg, global);
+			++it;
+			continue;
 		}
+
+		// The recipients are grouped by component type, so time each group
+		// together (to keep the profiling overhead low)
+		MessageRecipients::const_iterator end = it;
+		while (end != recipients.end() && end->cid == it->cid)
+			++end;
+
+		std::map<ComponentTypeId, ComponentType>::const_iterator ctit = m_ComponentTypesById.find(it->cid);
+		const std::string& typeName = (ctit != m_ComponentTypesById.end() ? ctit->second.name : "?");
+		const char* handlerName = global ? msg.GetScriptGlobalHandlerName() : msg.GetScriptHandlerName();
+		size_t calls = end - it;
+
+		PROFILE2(g_ScriptComponentStatsTable->InternName(typeName));
+		PROFILE2_ATTR("handler: %s", handlerName);
+		PROFILE2_ATTR("calls: %d", (int)calls);
+
+		double time = timer_Time();
+		for (; it != end; ++it)
+			it->component->HandleMessage(msg, global);
+		g_ScriptComponentStatsTable->Add(typeName, handlerName, calls, timer_Time() - time);
+	}
+}
+
+void CComponentManager::QueuePositionChange(entity_id_t ent, bool inWorld, entity_pos_t x, entity_pos_t z, entity_angle_t a)
+{
+	if (ENTITY_IS_LOCAL(ent))
+		return;
+
+	// Don't bother queueing anything if nobody's going to receive the batch
+	MessageTypeId mtid = MT_PositionChangedBatch;
+	if (((size_t)mtid >= m_LocalMessageSubscriptions.size() || m_LocalMessageSubscriptions[mtid].empty()) &&
+		((size_t)mtid >= m_GlobalMessageSubscriptions.size() || m_GlobalMessageSubscriptions[mtid].empty()))
+		return;
+
+	CMessagePositionChangedBatch::Change change = { ent, inWorld, x, z, a };
+
+	if (ent >= m_PositionChangeIndex.size())
+		m_PositionChangeIndex.resize(ent + 1, 0);
+
+	u32& idx = m_PositionChangeIndex[ent];
+	if (idx)
+	{
+		// Replace the earlier change, so only the latest position gets reported
+		m_PositionChanges[idx - 1] = change;
+	}
+	else
+	{
+		m_PositionChanges.push_back(change);
+		idx = (u32)m_PositionChanges.size();
 	}
 }
 
+void CComponentManager::FlushPositionChanges()
+{
+	if (m_PositionChanges.empty())
+		return;
+
+	PROFILE("flush position changes");
+
+	// Move the queue out first, since handlers might move entities again (or flush
+	// recursively) and any new changes must go into the next batch
+	std::vector<CMessagePositionChangedBatch::Change> changes;
+	changes.swap(m_PositionChanges);
+	for (size_t i = 0; i < changes.size(); ++i)
+		m_PositionChangeIndex[changes[i].entity] = 0;
+
+	CMessagePositionChangedBatch msg(changes);
+	BroadcastMessage(msg);
+
+	// Reuse the allocation for the next batch, if nothing was queued in the meantime
+	if (m_PositionChanges.empty())
+	{
+		changes.clear();
+		m_PositionChanges.swap(changes);
+	}
+}
 
 std::string CComponentManager::GenerateSchema()
 {
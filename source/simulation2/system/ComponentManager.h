@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -21,11 +21,12 @@
 #include "Entity.h"
 #include "Components.h"
 #include "scriptinterface/ScriptInterface.h"
+#include "simulation2/MessageTypes.h"
+#include "simulation2/helpers/EntityMap.h"
 #include "simulation2/helpers/Player.h"
 #include "ps/Filesystem.h"
 
 #include <boost/random/linear_congruential.hpp>
-#include <boost/unordered_map.hpp>
 
 #include <map>
 
@@ -33,6 +34,7 @@ class IComponent;
 class CParamNode;
 class CMessage;
 class CSimContext;
+class ISerializer;
 
 class CComponentManager
 {
@@ -70,8 +72,27 @@ private:
 		std::string name;
 		std::string schema; // RelaxNG fragment
 		CScriptValRooted ctor; // only valid if type == CT_Script
+		std::vector<MessageTypeId> localSubscriptions; // message types subscribed to by SubscribeToMessageType
+		std::vector<MessageTypeId> globalSubscriptions; // message types subscribed to by SubscribeGloballyToMessageType
 	};
 	
+	// Flattened entry in the list of components that a message type gets sent to
+	struct MessageRecipient
+	{
+		IComponent* component;
+		bool isScript; // whether the component's type is CT_Script
+		ComponentTypeId cid;
+	};
+	typedef std::vector<MessageRecipient> MessageRecipients;
+	typedef shared_ptr<const MessageRecipients> MessageRecipientsPtr;
+
+	// Job data for BroadcastMessageParallel
+	struct ParallelMessageJob
+	{
+		const MessageRecipients* recipients;
+		const CMessage* msg;
+	};
+
 	struct FindJSONFilesCallbackData {
 		VfsPath path;
 		std::vector<std::string> templates;
@@ -172,6 +193,14 @@ public:
 	 */
 	entity_id_t AddEntity(const std::wstring& templateName, entity_id_t ent);
 
+	/**
+	 * Constructs several entities based on the same template, like AddEntity, but
+	 * only looking up the template's component types once (which is faster when
+	 * loading maps with many copies of each entity).
+	 * @param ents entity IDs to add; any that fail are replaced with INVALID_ENTITY
+	 */
+	void AddEntities(const std::wstring& templateName, std::vector<entity_id_t>& ents);
+
 	/**
 	 * Destroys all the components belonging to the specified entity when FlushDestroyedComponents is called.
 	 * Has no effect if the entity does not exist, or has already been added to the destruction queue.
@@ -185,12 +214,52 @@ public:
 	 */
 	void FlushDestroyedComponents();
 
+	/**
+	 * Puts the component to sleep, or wakes it up. Sleeping components don't receive
+	 * broadcasts of the per-turn and per-frame messages (MT_Update, MT_Update_MotionFormation,
+	 * MT_Update_MotionUnit, MT_Update_Final, MT_Interpolate and MT_InterpolateParallel),
+	 * so they cost nothing while idle. They still receive every other message, and
+	 * messages posted to their entity, so they can wake themselves up when something
+	 * changes (or use a timer to do so).
+	 *
+	 * The sleeping state isn't serialized, so a component must only sleep while
+	 * receiving those messages would have no effect on the simulation state (e.g.
+	 * an idle UnitMotion); it should set its sleeping state again when it's deserialized.
+	 * This can be called from Init, and from message handlers (changes during a
+	 * broadcast take effect from the next broadcast).
+	 */
+	void SetSleeping(IComponent* component, bool sleeping);
+
+	/**
+	 * Returns a script object for msg that's shared by every message of the same type,
+	 * with its properties overwritten by each message. This is for script components whose
+	 * prototype sets TransientMessages = true, promising that their handlers never keep a
+	 * reference to the message (or anything in it) after they return, so the frequent
+	 * messages don't each allocate new objects.
+	 * Returns JSVAL_VOID if the message type doesn't support that, or if the object is
+	 * still in use by a handler further up the stack (when a handler sends another message
+	 * of the same type), in which case the caller should use msg.ToJSValCached instead.
+	 * Otherwise ReleaseTransientMessage must be called once the handler returns.
+	 */
+	jsval AcquireTransientMessage(const CMessage& msg);
+	void ReleaseTransientMessage(const CMessage& msg);
+
 	IComponent* QueryInterface(entity_id_t ent, InterfaceId iid) const;
 
 	typedef std::vector<std::pair<entity_id_t, IComponent*> > InterfaceList;
-	typedef boost::unordered_map<entity_id_t, IComponent*> InterfaceListUnordered;
+	typedef EntityMap<IComponent*> InterfaceListUnordered;
 
+	/**
+	 * Returns a copy of the list of components implementing the given interface,
+	 * sorted by entity ID.
+	 */
 	InterfaceList GetEntitiesWithInterface(InterfaceId iid) const;
+
+	/**
+	 * Returns the internal storage of components implementing the given interface.
+	 * This is also sorted by entity ID, and avoids the copy in GetEntitiesWithInterface,
+	 * but must not be held across any calls that might add or destroy components.
+	 */
 	const InterfaceListUnordered& GetEntitiesWithInterfaceUnordered(InterfaceId iid) const;
 
 	/**
@@ -206,6 +275,32 @@ public:
 	 */
 	void BroadcastMessage(const CMessage& msg) const;
 
+	/**
+	 * Send a message to all the components that subscribed (locally) to the message type,
+	 * split across the threads of g_ThreadPool, and wait for them all to finish.
+	 * This is only valid for message types whose handlers are thread-safe
+	 * (see CMessageInterpolateParallel). Global subscribers and script components
+	 * don't receive the message.
+	 */
+	void BroadcastMessageParallel(const CMessage& msg) const;
+
+	/**
+	 * Records an entity's new position for the next MT_PositionChangedBatch.
+	 * If the entity already has a queued change, it is replaced, so each entity is
+	 * reported at most once per batch.
+	 * Local entities are ignored, since they mustn't affect the simulation state.
+	 * Does nothing if no component has subscribed to MT_PositionChangedBatch.
+	 */
+	void QueuePositionChange(entity_id_t ent, bool inWorld, entity_pos_t x, entity_pos_t z, entity_angle_t a);
+
+	/**
+	 * Broadcasts MT_PositionChangedBatch with all the queued position changes (if there are any),
+	 * and clears the queue. This is called at the end of every turn, and must also be called by
+	 * subscribers of MT_PositionChangedBatch before they use any position-dependent state,
+	 * so that they never see stale positions.
+	 */
+	void FlushPositionChanges();
+
 	/**
 	 * Resets the dynamic simulation state (deletes all entities, resets entity ID counters;
 	 * doesn't unload/reload component scripts).
@@ -214,11 +309,19 @@ public:
 
 	// Various state serialization functions:
 	bool ComputeStateHash(std::string& outHash, bool quick);
+	// Computes the separate hash of each (non-empty) component type that ComputeStateHash
+	// combines, to help find which component caused an out-of-sync
+	bool ComputeComponentStateHashes(std::vector<std::pair<ComponentTypeId, std::string> >& outHashes, bool quick);
 	bool DumpDebugState(std::ostream& stream, bool includeDebugInfo);
-	// FlushDestroyedComponents must be called before SerializeState (since the destruction queue
-	// won't get serialized)
+	// FlushDestroyedComponents and FlushPositionChanges must be called before SerializeState
+	// (since the destruction queue and position changes won't get serialized)
 	bool SerializeState(std::ostream& stream);
+	// Appends the serialized state to the buffer (which is the fastest way to
+	// get the state in memory, e.g. for saved games and rejoining players)
+	bool SerializeState(std::string& buffer);
 	bool DeserializeState(std::istream& stream);
+	// Deserializes directly from the buffer (which is faster than copying it into a stream)
+	bool DeserializeState(const std::string& buffer);
 
 	std::string GenerateSchema();
 
@@ -238,6 +341,7 @@ private:
 	static int Script_AddEntity(void* cbdata, std::string templateName);
 	static int Script_AddLocalEntity(void* cbdata, std::string templateName);
 	static void Script_DestroyEntity(void* cbdata, int ent);
+	static void Script_SetSleeping(void* cbdata, int ent, int iid, bool sleeping);
 	static CScriptVal Script_ReadJSONFile(void* cbdata, std::wstring fileName);
 	static CScriptVal Script_ReadCivJSONFile(void* cbdata, std::wstring fileName);
 	static std::vector<std::string> Script_FindJSONFiles(void* cbdata, std::wstring subPath, bool recursive);
@@ -247,9 +351,56 @@ private:
 	// callback function to handle recursively finding files in a directory
 	static Status FindJSONFilesCallback(const VfsPath&, const FileInfo&, const uintptr_t);
 
+	// CThreadPool callback for BroadcastMessageParallel
+	static void ParallelMessageCallback(void* cbdata, size_t begin, size_t end);
+
+	bool SerializeState(ISerializer& serializer);
+
 	CMessage* ConstructMessage(int mtid, CScriptVal data);
 	void SendGlobalMessage(entity_id_t ent, const CMessage& msg) const;
 
+	/**
+	 * Sends msg to each of the recipients (skipping the script components if skipScripts).
+	 * If g_ScriptComponentStatsTable is enabled, the script components' handlers
+	 * are timed (per component type) for the profilers.
+	 */
+	void SendMessageToRecipients(const MessageRecipients& recipients, const CMessage& msg, bool global, bool skipScripts) const;
+
+	/**
+	 * Returns the flattened list of components subscribed (locally or globally) to the
+	 * given message type, in dispatch order, rebuilding it if it has been invalidated.
+	 */
+	const MessageRecipientsPtr& GetMessageRecipients(MessageTypeId mtid, bool global) const;
+
+	/**
+	 * Discards the cached message recipient lists. Must be called whenever message
+	 * subscriptions are removed.
+	 */
+	void InvalidateMessageRecipients();
+
+	/**
+	 * Discards the cached recipient lists of the message types that the given component
+	 * type subscribes to. Must be called whenever a component of that type is added or removed.
+	 */
+	void InvalidateMessageRecipients(ComponentTypeId cid);
+
+	/**
+	 * Returns whether sleeping components are left out of the broadcasts of this message type.
+	 */
+	static bool IsSleepingSkipped(MessageTypeId mtid);
+
+	/**
+	 * Returns whether component @p a comes before @p b in the recipient lists (which are
+	 * ordered by component type, then by entity).
+	 */
+	static bool IsBeforeInDispatchOrder(const IComponent* a, const IComponent* b);
+
+	/**
+	 * Returns a copy of the recipient list with the components in @p changes (whose sleeping
+	 * state has changed since the list was built) added or removed, keeping the dispatch order.
+	 */
+	MessageRecipientsPtr ApplySleepingChanges(const MessageRecipients& recipients, std::vector<IComponent*>& changes) const;
+
 	ComponentTypeId GetScriptWrapper(InterfaceId iid);
 
 	ScriptInterface m_ScriptInterface;
@@ -260,10 +411,10 @@ private:
 
 	// TODO: some of these should be vectors
 	std::map<ComponentTypeId, ComponentType> m_ComponentTypesById;
-	std::vector<boost::unordered_map<entity_id_t, IComponent*> > m_ComponentsByInterface; // indexed by InterfaceId
-	std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> > m_ComponentsByTypeId;
-	std::map<MessageTypeId, std::vector<ComponentTypeId> > m_LocalMessageSubscriptions;
-	std::map<MessageTypeId, std::vector<ComponentTypeId> > m_GlobalMessageSubscriptions;
+	std::vector<EntityMap<IComponent*> > m_ComponentsByInterface; // indexed by InterfaceId
+	std::vector<EntityMap<IComponent*> > m_ComponentsByTypeId; // indexed by ComponentTypeId
+	std::vector<std::vector<ComponentTypeId> > m_LocalMessageSubscriptions; // indexed by MessageTypeId
+	std::vector<std::vector<ComponentTypeId> > m_GlobalMessageSubscriptions; // indexed by MessageTypeId
 	std::map<std::string, ComponentTypeId> m_ComponentTypeIdsByName;
 	std::map<std::string, MessageTypeId> m_MessageTypeIdsByName;
 	std::map<MessageTypeId, std::string> m_MessageTypeNamesById;
@@ -272,12 +423,41 @@ private:
 	// TODO: maintaining both ComponentsBy* is nasty; can we get rid of one,
 	// while keeping QueryInterface and PostMessage sufficiently efficient?
 
+	// Caches of every component that receives each message type, indexed by MessageTypeId,
+	// built on demand by GetMessageRecipients and discarded whenever components of a
+	// subscribed type are added or removed.
+	mutable std::vector<MessageRecipientsPtr> m_LocalMessageRecipients;
+	mutable std::vector<MessageRecipientsPtr> m_GlobalMessageRecipients;
+
+	// Components whose sleeping state changed since the cached list of each message type
+	// was built, indexed by MessageTypeId. GetMessageRecipients applies them all in one pass
+	// when the message is next sent, instead of rebuilding the list for every change.
+	mutable std::vector<std::vector<IComponent*> > m_LocalSleepingChanges;
+	mutable std::vector<std::vector<IComponent*> > m_GlobalSleepingChanges;
+
 	std::vector<entity_id_t> m_DestructionQueue;
 
+	struct TransientMessage
+	{
+		TransientMessage() : inUse(false) { }
+		CScriptValRooted val;
+		bool inUse;
+	};
+	// Indexed by MessageTypeId; must be destroyed before m_ScriptInterface
+	std::vector<TransientMessage> m_TransientMessages;
+
+	// Position changes waiting for FlushPositionChanges, and the index of each entity's
+	// change in that list plus one (indexed by entity ID, 0 meaning not queued)
+	std::vector<CMessagePositionChangedBatch::Change> m_PositionChanges;
+	std::vector<u32> m_PositionChangeIndex;
+
 	ComponentTypeId m_NextScriptComponentTypeId;
 	entity_id_t m_NextEntityId;
 	entity_id_t m_NextLocalEntityId;
 
+	// Size of the most recent SerializeState output into a buffer, used as a hint for the next one
+	size_t m_LastSerializedStateSize;
+
 	boost::rand48 m_RNG;
 
 	friend class TestComponentManager;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -63,13 +63,12 @@ bool CComponentManager::DumpDebugState(std::ostream& stream, bool includeDebugIn
 	std::map<entity_id_t, std::map<ComponentTypeId, IComponent*> > components;
 	std::map<ComponentTypeId, std::string> names;
 
-	std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> >::const_iterator ctit = m_ComponentsByTypeId.begin();
-	for (; ctit != m_ComponentsByTypeId.end(); ++ctit)
+	for (size_t cid = 0; cid < m_ComponentsByTypeId.size(); ++cid)
 	{
-		std::map<entity_id_t, IComponent*>::const_iterator eit = ctit->second.begin();
-		for (; eit != ctit->second.end(); ++eit)
+		const EntityMap<IComponent*>& emap = m_ComponentsByTypeId[cid];
+		for (EntityMap<IComponent*>::const_iterator eit = emap.begin(); eit != emap.end(); ++eit)
 		{
-			components[eit->first][ctit->first] = eit->second;
+			components[eit->first][(ComponentTypeId)cid] = eit->second;
 		}
 	}
 
@@ -109,20 +108,45 @@ bool CComponentManager::ComputeStateHash(std::string& outHash, bool quick)
 	// be fast enough to run every turn but will typically detect any
 	// out-of-syncs fairly soon
 
+	// The state hash is a hash of the RNG state and of the hash of each
+	// component type, so that when two states differ, comparing the output
+	// of ComputeComponentStateHashes will show which component type diverged
+
+	std::vector<std::pair<ComponentTypeId, std::string> > componentHashes;
+	if (!ComputeComponentStateHashes(componentHashes, quick))
+		return false;
+
 	CHashSerializer serializer(m_ScriptInterface);
 
 	serializer.StringASCII("rng", SerializeRNG(m_RNG), 0, 32);
 
-	std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> >::const_iterator cit = m_ComponentsByTypeId.begin();
-	for (; cit != m_ComponentsByTypeId.end(); ++cit)
+	for (size_t i = 0; i < componentHashes.size(); ++i)
+	{
+		serializer.NumberI32_Unbounded("component type id", (i32)componentHashes[i].first);
+		serializer.RawBytes("component hash", (const u8*)componentHashes[i].second.data(), componentHashes[i].second.length());
+	}
+
+	outHash = std::string((const char*)serializer.ComputeHash(), serializer.GetHashLength());
+
+	// TODO: catch exceptions
+	return true;
+}
+
+bool CComponentManager::ComputeComponentStateHashes(std::vector<std::pair<ComponentTypeId, std::string> >& outHashes, bool quick)
+{
+	outHashes.clear();
+
+	for (size_t cid = 0; cid < m_ComponentsByTypeId.size(); ++cid)
 	{
 		// In quick mode, only check unit positions
-		if (quick && !(cit->first == CID_Position))
+		if (quick && !(cid == CID_Position))
 			continue;
 
+		const EntityMap<IComponent*>& emap = m_ComponentsByTypeId[cid];
+
 		// Only emit component types if they have a component that will be serialized
 		bool needsSerialization = false;
-		for (std::map<entity_id_t, IComponent*>::const_iterator eit = cit->second.begin(); eit != cit->second.end(); ++eit)
+		for (EntityMap<IComponent*>::const_iterator eit = emap.begin(); eit != emap.end(); ++eit)
 		{
 			// Don't serialize local entities
 			if (ENTITY_IS_LOCAL(eit->first))
@@ -135,9 +159,9 @@ bool CComponentManager::ComputeStateHash(std::string& outHash, bool quick)
 		if (!needsSerialization)
 			continue;
 
-		serializer.NumberI32_Unbounded("component type id", cit->first);
+		CHashSerializer serializer(m_ScriptInterface);
 
-		for (std::map<entity_id_t, IComponent*>::const_iterator eit = cit->second.begin(); eit != cit->second.end(); ++eit)
+		for (EntityMap<IComponent*>::const_iterator eit = emap.begin(); eit != emap.end(); ++eit)
 		{
 			// Don't serialize local entities
 			if (ENTITY_IS_LOCAL(eit->first))
@@ -146,9 +170,9 @@ bool CComponentManager::ComputeStateHash(std::string& outHash, bool quick)
 			serializer.NumberU32_Unbounded("entity id", eit->first);
 			eit->second->Serialize(serializer);
 		}
-	}
 
-	outHash = std::string((const char*)serializer.ComputeHash(), serializer.GetHashLength());
+		outHashes.push_back(std::make_pair((ComponentTypeId)cid, std::string((const char*)serializer.ComputeHash(), serializer.GetHashLength())));
+	}
 
 	// TODO: catch exceptions
 	return true;
@@ -163,9 +187,11 @@ bool CComponentManager::ComputeStateHash(std::string& outHash, bool quick)
  *   Component type name.
  *   TODO: Component type version number.
  *   Number of entities.
- *   For each entity:
- *     Entity id.
- *     Component state.
+ *   Size in bytes of the following block, which is serialized independently
+ *   of the others (i.e. script objects are never shared between blocks):
+ *     For each entity:
+ *       Entity id.
+ *       Component state.
  *
  * Rationale:
  * Saved games should be valid across patches, which might change component
@@ -174,12 +200,32 @@ bool CComponentManager::ComputeStateHash(std::string& outHash, bool quick)
  * and those from older versions can be fixed up to work with the latest version.
  * (These aren't really needed for networked games (where everyone will have the same
  * version), but it doesn't seem worth having a separate codepath for that.)
+ * The block sizes let the deserializer skip component types that no longer exist,
+ * and detect components whose Deserialize doesn't match their Serialize.
  */
 
 bool CComponentManager::SerializeState(std::ostream& stream)
 {
 	CStdSerializer serializer(m_ScriptInterface, stream);
+	return SerializeState(serializer);
+}
 
+bool CComponentManager::SerializeState(std::string& buffer)
+{
+	// Reserve enough space for the state to grow a bit since the last time,
+	// so the buffer (which might be huge) is generally allocated just once
+	size_t initialSize = buffer.size();
+	buffer.reserve(initialSize + m_LastSerializedStateSize + m_LastSerializedStateSize/8);
+
+	CBufferSerializer serializer(m_ScriptInterface, buffer);
+	bool ok = SerializeState(serializer);
+
+	m_LastSerializedStateSize = buffer.size() - initialSize;
+	return ok;
+}
+
+bool CComponentManager::SerializeState(ISerializer& serializer)
+{
 	// We don't serialize the destruction queue, since we'd have to be careful to skip local entities etc
 	// and it's (hopefully) easier to just expect callers to flush the queue before serializing
 	ENSURE(m_DestructionQueue.empty());
@@ -187,16 +233,16 @@ bool CComponentManager::SerializeState(std::ostream& stream)
 	serializer.StringASCII("rng", SerializeRNG(m_RNG), 0, 32);
 	serializer.NumberU32_Unbounded("next entity id", m_NextEntityId);
 
-	std::map<ComponentTypeId, std::map<entity_id_t, IComponent*> >::const_iterator cit;
-	
 	uint32_t numComponentTypes = 0;
 	std::set<ComponentTypeId> serializedComponentTypes;
 
-	for (cit = m_ComponentsByTypeId.begin(); cit != m_ComponentsByTypeId.end(); ++cit)
+	for (size_t cid = 0; cid < m_ComponentsByTypeId.size(); ++cid)
 	{
+		const EntityMap<IComponent*>& emap = m_ComponentsByTypeId[cid];
+
 		// Only emit component types if they have a component that will be serialized
 		bool needsSerialization = false;
-		for (std::map<entity_id_t, IComponent*>::const_iterator eit = cit->second.begin(); eit != cit->second.end(); ++eit)
+		for (EntityMap<IComponent*>::const_iterator eit = emap.begin(); eit != emap.end(); ++eit)
 		{
 			// Don't serialize local entities
 			if (ENTITY_IS_LOCAL(eit->first))
@@ -210,17 +256,22 @@ bool CComponentManager::SerializeState(std::ostream& stream)
 			continue;
 
 		numComponentTypes++;
-		serializedComponentTypes.insert(cit->first);
+		serializedComponentTypes.insert((ComponentTypeId)cid);
 	}
 
 	serializer.NumberU32_Unbounded("num component types", numComponentTypes);
 
-	for (cit = m_ComponentsByTypeId.begin(); cit != m_ComponentsByTypeId.end(); ++cit)
+	// Buffer for each component type's block (reused to avoid reallocating it)
+	std::string block;
+
+	for (size_t cid = 0; cid < m_ComponentsByTypeId.size(); ++cid)
 	{
-		if (serializedComponentTypes.find(cit->first) == serializedComponentTypes.end())
+		if (serializedComponentTypes.find((ComponentTypeId)cid) == serializedComponentTypes.end())
 			continue;
 
-		std::map<ComponentTypeId, ComponentType>::const_iterator ctit = m_ComponentTypesById.find(cit->first);
+		const EntityMap<IComponent*>& emap = m_ComponentsByTypeId[cid];
+
+		std::map<ComponentTypeId, ComponentType>::const_iterator ctit = m_ComponentTypesById.find((ComponentTypeId)cid);
 		if (ctit == m_ComponentTypesById.end())
 		{
 			debug_warn(L"Invalid ctit"); // this should never happen
@@ -231,7 +282,7 @@ bool CComponentManager::SerializeState(std::ostream& stream)
 
 		// Count the components before serializing any of them
 		uint32_t numComponents = 0;
-		for (std::map<entity_id_t, IComponent*>::const_iterator eit = cit->second.begin(); eit != cit->second.end(); ++eit)
+		for (EntityMap<IComponent*>::const_iterator eit = emap.begin(); eit != emap.end(); ++eit)
 		{
 			// Don't serialize local entities
 			if (ENTITY_IS_LOCAL(eit->first))
@@ -244,15 +295,22 @@ bool CComponentManager::SerializeState(std::ostream& stream)
 		serializer.NumberU32_Unbounded("num components", numComponents);
 
 		// Serialize the components now
-		for (std::map<entity_id_t, IComponent*>::const_iterator eit = cit->second.begin(); eit != cit->second.end(); ++eit)
+		block.clear();
 		{
-			// Don't serialize local entities
-			if (ENTITY_IS_LOCAL(eit->first))
-				continue;
+			CBufferSerializer blockSerializer(m_ScriptInterface, block);
+			for (EntityMap<IComponent*>::const_iterator eit = emap.begin(); eit != emap.end(); ++eit)
+			{
+				// Don't serialize local entities
+				if (ENTITY_IS_LOCAL(eit->first))
+					continue;
 
-			serializer.NumberU32_Unbounded("entity id", eit->first);
-			eit->second->Serialize(serializer);
+				blockSerializer.NumberU32_Unbounded("entity id", eit->first);
+				eit->second->Serialize(blockSerializer);
+			}
 		}
+
+		serializer.NumberU32_Unbounded("block size", (u32)block.size());
+		serializer.RawBytes("block", (const u8*)block.data(), block.size());
 	}
 
 	// TODO: catch exceptions
@@ -280,25 +338,41 @@ bool CComponentManager::DeserializeState(std::istream& stream)
 		ICmpTemplateManager* templateManager = NULL;
 		CParamNode noParam;
 
+		// Buffer for each component type's block (reused to avoid reallocating it)
+		std::string block;
+
 		for (size_t i = 0; i < numComponentTypes; ++i)
 		{
 			std::string ctname;
 			deserializer.StringASCII("name", ctname, 0, 255);
 
+			uint32_t numComponents;
+			deserializer.NumberU32_Unbounded("num components", numComponents);
+
+			uint32_t blockSize;
+			deserializer.NumberU32_Unbounded("block size", blockSize);
+			deserializer.RequireBytesInStream(blockSize);
+			block.resize(blockSize);
+			if (blockSize)
+				deserializer.RawBytes("block", (u8*)&block[0], blockSize);
+
 			ComponentTypeId ctid = LookupCID(ctname);
 			if (ctid == CID__Invalid)
 			{
-				LOGERROR(L"Deserialization saw unrecognised component type '%hs'", ctname.c_str());
-				return false;
+				// The component type might have been removed since the state was saved;
+				// the game will probably still work without it, so just skip it
+				LOGWARNING(L"Deserialization skipped unrecognised component type '%hs'", ctname.c_str());
+				continue;
 			}
 
-			uint32_t numComponents;
-			deserializer.NumberU32_Unbounded("num components", numComponents);
+			CBufferStreamBuf blockStreamBuf(block.data(), block.size());
+			std::istream blockStream(&blockStreamBuf);
+			CStdDeserializer blockDeserializer(m_ScriptInterface, blockStream);
 
 			for (size_t j = 0; j < numComponents; ++j)
 			{
 				entity_id_t ent;
-				deserializer.NumberU32_Unbounded("entity id", ent);
+				blockDeserializer.NumberU32_Unbounded("entity id", ent);
 				IComponent* component = ConstructComponent(ent, ctid);
 				if (!component)
 					return false;
@@ -310,15 +384,21 @@ bool CComponentManager::DeserializeState(std::istream& stream)
 
 				// Deserialize, with the appropriate template for this component
 				if (entTemplate)
-					component->Deserialize(entTemplate->GetChild(ctname.c_str()), deserializer);
+					component->Deserialize(entTemplate->GetChild(ctname.c_str()), blockDeserializer);
 				else
-					component->Deserialize(noParam, deserializer);
+					component->Deserialize(noParam, blockDeserializer);
 
 				// If this was the template manager, remember it so we can use it when
 				// deserializing any further non-system entities
 				if (ent == SYSTEM_ENTITY && ctid == CID_TemplateManager)
 					templateManager = static_cast<ICmpTemplateManager*> (component);
 			}
+
+			if (blockStream.peek() != EOF)
+			{
+				LOGERROR(L"Deserialization of component type '%hs' didn't read all of its data", ctname.c_str());
+				return false;
+			}
 		}
 
 		if (stream.peek() != EOF)
@@ -335,3 +415,10 @@ bool CComponentManager::DeserializeState(std::istream& stream)
 		return false;
 	}
 }
+
+bool CComponentManager::DeserializeState(const std::string& buffer)
+{
+	CBufferStreamBuf streamBuf(buffer.data(), buffer.size());
+	std::istream stream(&streamBuf);
+	return DeserializeState(stream);
+}
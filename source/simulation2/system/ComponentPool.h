@@ -0,0 +1,78 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_COMPONENTPOOL
+#define INCLUDED_COMPONENTPOOL
+
+#include "lib/allocators/pool.h"
+#include "ps/MemoryStats.h"
+
+/**
+ * Storage for every instance of the component class T, used by
+ * DEFAULT_COMPONENT_ALLOCATOR and DEFAULT_SCRIPT_WRAPPER.
+ *
+ * Instances are packed into a single reserved block of address space (committed
+ * as it's needed), so components of the same type are close together in memory
+ * when messages are broadcast to them, and creating and destroying entities
+ * just pushes and pops the pool's freelist instead of going through the heap.
+ *
+ * If the pool is full, it falls back to the heap.
+ * The pool is shared by all component managers and is never freed (since
+ * components might be destroyed arbitrarily late), and it isn't thread-safe,
+ * so components must only be created and destroyed by the main thread.
+ */
+template<typename T>
+class ComponentPool
+{
+public:
+	static void* Allocate()
+	{
+		Pool* pool = GetPool();
+		void* p = pool ? pool_alloc(pool, sizeof(T)) : NULL;
+		if (!p)
+			p = ::operator new(sizeof(T));
+		MemoryStats::Add(MEMORY_COMPONENTS, sizeof(T));
+		return p;
+	}
+
+	static void Deallocate(void* p)
+	{
+		MemoryStats::Add(MEMORY_COMPONENTS, -(ssize_t)sizeof(T));
+		Pool* pool = GetPool();
+		if (pool && pool_contains(pool, p))
+			pool_free(pool, p);
+		else
+			::operator delete(p);
+	}
+
+private:
+	// Enough for tens of thousands of most components, without using
+	// much address space on 32-bit systems
+	static const size_t MAX_POOL_SIZE = 4*MiB;
+
+	/**
+	 * Returns NULL if the pool couldn't be created.
+	 */
+	static Pool* GetPool()
+	{
+		static Pool pool;
+		static Status status = pool_create(&pool, MAX_POOL_SIZE, sizeof(T));
+		return (status < 0) ? NULL : &pool;
+	}
+};
+
+#endif // INCLUDED_COMPONENTPOOL
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -182,6 +182,16 @@ public:
 		return 50.f;
 	}
 
+	virtual void GetGroundLevels(size_t count, const entity_pos_t* UNUSED(x), const entity_pos_t* UNUSED(z), entity_pos_t* heights)
+	{
+		std::fill(heights, heights + count, entity_pos_t::FromInt(50));
+	}
+
+	virtual void GetExactGroundLevels(size_t count, const float* UNUSED(x), const float* UNUSED(z), float* heights)
+	{
+		std::fill(heights, heights + count, 50.f);
+	}
+
 	virtual u16 GetTilesPerSide()
 	{
 		return 16;
@@ -201,6 +211,11 @@ public:
 	{
 	}
 
+	virtual bool NeedUpdate(size_t* UNUSED(dirtyID))
+	{
+		return false;
+	}
+
 	virtual void ReloadTerrain()
 	{
 	}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -23,6 +23,7 @@
 #include "Entity.h"
 
 #include "scriptinterface/ScriptTypes.h"
+#include "scriptinterface/ScriptVal.h"
 
 class CParamNode;
 class CSimContext;
@@ -33,6 +34,7 @@ class IDeserializer;
 class IComponent
 {
 public:
+	IComponent() : m_ComponentTypeId(CID__Invalid), m_Sleeping(false) { }
 	virtual ~IComponent();
 
 	static std::string GetSchema();
@@ -48,6 +50,12 @@ public:
 	const CSimContext& GetSimContext() const { return *m_SimContext; }
 	void SetSimContext(const CSimContext& context) { m_SimContext = &context; }
 
+	/**
+	 * Returns whether this component is skipped by broadcasts of the per-turn
+	 * and per-frame messages (see CComponentManager::SetSleeping).
+	 */
+	bool IsSleeping() const { return m_Sleeping; }
+
 	static u8 GetSerializationVersion() { return 0; }
 	virtual void Serialize(ISerializer& serialize) = 0;
 	virtual void Deserialize(const CParamNode& paramNode, IDeserializer& deserialize) = 0;
@@ -55,9 +63,21 @@ public:
 	virtual JSClass* GetJSClass() const;
 	virtual jsval GetJSInstance() const;
 
+	/**
+	 * The script object wrapping this native component, created by the first
+	 * QueryInterface from scripts and reused by later ones (or uninitialised).
+	 */
+	const CScriptValRooted& GetJSWrapper() const { return m_JSWrapper; }
+	void SetJSWrapper(const CScriptValRooted& wrapper) { m_JSWrapper = wrapper; }
+
 private:
+	friend class CComponentManager;
+
 	entity_id_t m_EntityId;
 	const CSimContext* m_SimContext;
+	int m_ComponentTypeId; // set by CComponentManager::ConstructComponent
+	bool m_Sleeping;
+	CScriptValRooted m_JSWrapper;
 };
 
 #endif // INCLUDED_ICOMPONENT
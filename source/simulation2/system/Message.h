@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -33,6 +33,15 @@ public:
 	virtual const char* GetScriptGlobalHandlerName() const = 0;
 	virtual jsval ToJSVal(ScriptInterface&) const = 0;
 	jsval ToJSValCached(ScriptInterface&) const;
+
+	/**
+	 * Overwrites the properties of val (an object previously used for a message
+	 * of the same type) with this message's data, so that script components that
+	 * don't retain their messages can be given one reused object instead of a new
+	 * one per message (see CComponentManager::AcquireTransientMessage).
+	 * Returns false if this message type doesn't support that, or on failure.
+	 */
+	virtual bool UpdateJSVal(ScriptInterface&, jsval UNUSED(val)) const { return false; }
 private:
 	mutable CScriptValRooted m_Cached;
 };
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -40,7 +40,7 @@
 static CParamNode g_NullNode(false);
 
 CParamNode::CParamNode(bool isOk) :
-	m_IsOk(isOk)
+	m_IsOk(isOk), m_ScriptVal(new CScriptValRooted())
 {
 }
 
@@ -75,7 +75,7 @@ void CParamNode::ApplyLayer(const XMBFile& xmb, const XMBElement& element, const
 {
 	ResetScriptVal();
 
-	std::string name = xmb.GetElementString(element.GetNodeName()); // TODO: is GetElementString inefficient?
+	CStrIntern name(xmb.GetElementString(element.GetNodeName())); // TODO: is GetElementString inefficient?
 	CStrW value = element.GetText().FromUTF8();
 
 	bool hasSetValue = false;
@@ -147,6 +147,7 @@ void CParamNode::ApplyLayer(const XMBFile& xmb, const XMBElement& element, const
 
 	// Add this element as a child node
 	CParamNode& node = m_Childs[name];
+	node.ResetScriptVal(); // (its value or attributes might change even if it has no child elements)
 	if (!hasSetValue)
 		node.m_Value = value;
 
@@ -163,7 +164,7 @@ void CParamNode::ApplyLayer(const XMBFile& xmb, const XMBElement& element, const
 		if (attr.Name == at_replace) continue;
 		// Add any others
 		std::string attrName = xmb.GetAttributeString(attr.Name);
-		node.m_Childs["@" + attrName].m_Value = attr.Value.FromUTF8();
+		node.m_Childs[CStrIntern("@" + attrName)].m_Value = attr.Value.FromUTF8();
 	}
 }
 
@@ -171,18 +172,26 @@ void CParamNode::CopyFilteredChildrenOfChild(const CParamNode& src, const char*
 {
 	ResetScriptVal();
 
-	ChildrenMap::iterator dstChild = m_Childs.find(name);
-	ChildrenMap::const_iterator srcChild = src.m_Childs.find(name);
+	CStrIntern internedName(name);
+	ChildrenMap::iterator dstChild = m_Childs.find(internedName);
+	ChildrenMap::const_iterator srcChild = src.m_Childs.find(internedName);
 	if (dstChild == m_Childs.end() || srcChild == src.m_Childs.end())
 		return; // error
 
+	dstChild->second.ResetScriptVal();
+
 	ChildrenMap::const_iterator it = srcChild->second.m_Childs.begin();
 	for (; it != srcChild->second.m_Childs.end(); ++it)
-		if (permitted.count(it->first))
+		if (permitted.count(it->first.string()))
 			dstChild->second.m_Childs[it->first] = it->second;
 }
 
 const CParamNode& CParamNode::GetChild(const char* name) const
+{
+	return GetChild(CStrIntern(name));
+}
+
+const CParamNode& CParamNode::GetChild(CStrIntern name) const
 {
 	ChildrenMap::const_iterator it = m_Childs.find(name);
 	if (it == m_Childs.end())
@@ -287,10 +296,10 @@ void CParamNode::ToXML(std::wostream& strm) const
 	for (; it != m_Childs.end(); ++it)
 	{
 		// Skip attributes here (they were handled when the caller output the tag)
-		if (it->first.length() && it->first[0] == '@')
+		if (it->first.c_str()[0] == '@')
 			continue;
 
-		std::wstring name (it->first.begin(), it->first.end());
+		std::wstring name (it->first.string().begin(), it->first.string().end());
 
 		strm << L"<" << name;
 
@@ -298,9 +307,9 @@ void CParamNode::ToXML(std::wostream& strm) const
 		ChildrenMap::const_iterator cit = it->second.m_Childs.begin();
 		for (; cit != it->second.m_Childs.end(); ++cit)
 		{
-			if (cit->first.length() && cit->first[0] == '@')
+			if (cit->first.c_str()[0] == '@')
 			{
-				std::wstring attrname (cit->first.begin()+1, cit->first.end());
+				std::wstring attrname (cit->first.string().begin()+1, cit->first.string().end());
 				strm << L" " << attrname << L"=\"" << EscapeXMLString(cit->second.m_Value) << L"\"";
 			}
 		}
@@ -315,13 +324,14 @@ void CParamNode::ToXML(std::wostream& strm) const
 
 jsval CParamNode::ToJSVal(JSContext* cx, bool cacheValue) const
 {
-	if (cacheValue && !m_ScriptVal.uninitialised())
-		return m_ScriptVal.get();
+	if (cacheValue && !m_ScriptVal->uninitialised())
+		return m_ScriptVal->get();
 
 	jsval val = ConstructJSVal(cx);
 
+	// Assign through the pointer so that every copy sharing this cache sees the value
 	if (cacheValue)
-		m_ScriptVal = CScriptValRooted(cx, val);
+		*m_ScriptVal = CScriptValRooted(cx, val);
 
 	return val;
 }
@@ -349,7 +359,7 @@ jsval CParamNode::ConstructJSVal(JSContext* cx) const
 	if (!obj)
 		return JSVAL_VOID; // TODO: report error
 
-	for (std::map<std::string, CParamNode>::const_iterator it = m_Childs.begin(); it != m_Childs.end(); ++it)
+	for (ChildrenMap::const_iterator it = m_Childs.begin(); it != m_Childs.end(); ++it)
 	{
 		jsval childVal = it->second.ConstructJSVal(cx);
 		if (!JS_SetProperty(cx, obj, it->first.c_str(), &childVal))
@@ -373,5 +383,7 @@ jsval CParamNode::ConstructJSVal(JSContext* cx) const
 
 void CParamNode::ResetScriptVal()
 {
-	m_ScriptVal = CScriptValRooted();
+	// Replace (rather than clear) the cache, so that copies of this node
+	// that are sharing it won't be affected
+	m_ScriptVal.reset(new CScriptValRooted());
 }
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -112,7 +112,25 @@ class XMBElement;
 class CParamNode
 {
 public:
-	typedef std::map<std::string, CParamNode> ChildrenMap;
+	/**
+	 * Orders child names alphabetically (unlike CStrIntern's own operator<), so that
+	 * children (and e.g. the components constructed from a template) are always
+	 * visited in the same order. Equal names are detected by a pointer comparison.
+	 */
+	struct ChildNameLess
+	{
+		bool operator()(const CStrIntern& a, const CStrIntern& b) const
+		{
+			return !(a == b) && strcmp(a.c_str(), b.c_str()) < 0;
+		}
+	};
+
+	/**
+	 * Child nodes, indexed by interned name. Node and attribute names come from a
+	 * small set, so interning them saves a copy of every name in every node of every
+	 * template, and lets GetChild look up names without allocating strings.
+	 */
+	typedef std::map<CStrIntern, CParamNode, ChildNameLess> ChildrenMap;
 
 	/**
 	 * Constructs a new, empty node.
@@ -157,6 +175,11 @@ public:
 	 * Returns the (unique) child node with the given name, or a node with IsOk() == false if there is none.
 	 */
 	const CParamNode& GetChild(const char* name) const;
+
+	/**
+	 * As GetChild(const char*), but for callers that have already interned the name.
+	 */
+	const CParamNode& GetChild(CStrIntern name) const;
 	// (Children are returned as const in order to allow future optimisations, where we assume
 	// a node is always modified explicitly and not indirectly via its children, e.g. to cache jsvals)
 
@@ -219,6 +242,9 @@ public:
 	 * When caching, the lifetime of @p cx must be longer than the lifetime of this node.
 	 * The cache will be reset if *this* node is modified (e.g. by LoadXML),
 	 * but *not* if any child nodes are modified (so don't do that).
+	 * Copies of a node share its cache until one of them is modified, so e.g.
+	 * components that a template inherits unchanged from its parent will be
+	 * converted into a single (frozen) object shared by both templates.
 	 */
 	jsval ToJSVal(JSContext* cx, bool cacheValue) const;
 
@@ -255,8 +281,10 @@ private:
 
 	/**
 	 * Caches the ToJSVal script representation of this node.
+	 * This is shared between copies of the node, and replaced by ResetScriptVal
+	 * whenever the node is modified.
 	 */
-	mutable CScriptValRooted m_ScriptVal;
+	boost::shared_ptr<CScriptValRooted> m_ScriptVal;
 };
 
 #endif // INCLUDED_PARAMNODE
@@ -0,0 +1,374 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "simulation2/system/ComponentTest.h"
+
+#include "simulation2/components/ICmpObstructionManager.h"
+#include "simulation2/components/ICmpPathfinder.h"
+#include "simulation2/components/ICmpPosition.h"
+#include "simulation2/components/ICmpRangeManager.h"
+#include "simulation2/components/ICmpTerritoryManager.h"
+#include "simulation2/components/ICmpVision.h"
+#include "simulation2/helpers/Spatial.h"
+
+#include "graphics/MapReader.h"
+#include "graphics/Terrain.h"
+#include "graphics/TerrainTextureManager.h"
+#include "lib/timer.h"
+#include "lib/tex/tex.h"
+#include "ps/Loader.h"
+#include "simulation2/MessageTypes.h"
+#include "simulation2/Simulation2.h"
+
+#include <boost/random/mersenne_twister.hpp>
+
+/**
+ * Microbenchmarks of the simulation's most expensive components, on fixed maps
+ * with fixed random seeds so the results can be compared between builds.
+ *
+ * They're all disabled by default; run them with "-test TestSimulationBenchmarks"
+ * (or "-test TestSimulationBenchmarks::test_spatial_DISABLED" for a single one).
+ * Each prints a single line of JSON, which is easy to collect from the output
+ * of several runs.
+ */
+class TestSimulationBenchmarks : public CxxTest::TestSuite
+{
+	static void PrintResult(const char* name, size_t reps, double t)
+	{
+		printf("\n{\"benchmark\": \"%s\", \"reps\": %d, \"total_s\": %f, \"per_rep_ms\": %f}\n",
+			name, (int)reps, t, 1000.0 * t / reps);
+	}
+
+	static void LoadMap(const VfsPath& path, CTerrain& terrain, CSimulation2& sim2)
+	{
+		sim2.LoadDefaultScripts();
+		sim2.ResetState();
+
+		CMapReader* mapReader = new CMapReader(); // it'll call "delete this" itself
+
+		LDR_BeginRegistering();
+		mapReader->LoadMap(path, &terrain, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+			&sim2, &sim2.GetSimContext(), -1, false);
+		LDR_EndRegistering();
+		TS_ASSERT_OK(LDR_NonprogressiveLoad());
+
+		sim2.Update(0);
+	}
+
+	static entity_pos_t RandomPos(boost::mt19937& rng, int max)
+	{
+		return entity_pos_t::FromInt(rng() % max);
+	}
+
+public:
+	void setUp()
+	{
+		CXeromyces::Startup();
+
+		g_VFS = CreateVfs(20 * MiB);
+		TS_ASSERT_OK(g_VFS->Mount(L"", DataDir()/"mods"/"public", VFS_MOUNT_MUST_EXIST));
+		TS_ASSERT_OK(g_VFS->Mount(L"cache/", DataDir()/"cache"));
+
+		// The pathfinder needs the terrain textures for movement costs
+		tex_codec_register_all();
+		new CTerrainTextureManager;
+		g_TexMan.LoadTerrainTextures();
+	}
+
+	void tearDown()
+	{
+		delete &g_TexMan;
+		tex_codec_unregister_all();
+
+		g_VFS.reset();
+
+		CXeromyces::Terminate();
+	}
+
+	void test_spatial_DISABLED()
+	{
+		const int mapSize = 1024;
+		const size_t numItems = 4096;
+
+		boost::mt19937 rng(1234);
+		SpatialSubdivision<u32> subdiv;
+		subdiv.Reset(entity_pos_t::FromInt(mapSize), entity_pos_t::FromInt(mapSize), entity_pos_t::FromInt(8*TERRAIN_TILE_SIZE));
+
+		std::vector<CFixedVector2D> positions(numItems);
+		for (size_t i = 0; i < numItems; ++i)
+		{
+			positions[i] = CFixedVector2D(RandomPos(rng, mapSize), RandomPos(rng, mapSize));
+			subdiv.Add((u32)i, positions[i]);
+		}
+
+		// Mostly queries, with some of the items moving between them, like the range manager
+		size_t reps = 16384;
+		std::vector<u32> results;
+		double t = timer_Time();
+		for (size_t i = 0; i < reps; ++i)
+		{
+			u32 item = rng() % numItems;
+			CFixedVector2D to(RandomPos(rng, mapSize), RandomPos(rng, mapSize));
+			subdiv.Move(item, positions[item], to);
+			positions[item] = to;
+
+			results.clear();
+			subdiv.GetNear(results, CFixedVector2D(RandomPos(rng, mapSize), RandomPos(rng, mapSize)), entity_pos_t::FromInt(rng() % 128));
+		}
+		t = timer_Time() - t;
+		PrintResult("spatial_query", reps, t);
+	}
+
+	void test_los_DISABLED()
+	{
+		CTerrain terrain;
+		CSimulation2 sim2(NULL, &terrain);
+		LoadMap(L"maps/scenarios/Median Oasis.pmp", terrain, sim2);
+
+		std::vector<entity_id_t> ents;
+		CSimulation2::InterfaceList visions = sim2.GetEntitiesWithInterface(IID_Vision);
+		for (size_t i = 0; i < visions.size(); ++i)
+		{
+			CmpPtr<ICmpPosition> cmpPosition(sim2, visions[i].first);
+			if (cmpPosition && cmpPosition->IsInWorld())
+				ents.push_back(visions[i].first);
+		}
+		TS_ASSERT(!ents.empty());
+		if (ents.empty())
+			return;
+
+		// Each move sends PositionChanged, which makes the range manager
+		// update the LOS of the entity's owner around the old and new positions
+		boost::mt19937 rng(1234);
+		int mapSize = (int)(terrain.GetTilesPerSide() * TERRAIN_TILE_SIZE);
+		size_t reps = 16384;
+		double t = timer_Time();
+		for (size_t i = 0; i < reps; ++i)
+		{
+			CmpPtr<ICmpPosition> cmpPosition(sim2, ents[rng() % ents.size()]);
+			cmpPosition->JumpTo(RandomPos(rng, mapSize), RandomPos(rng, mapSize));
+		}
+		t = timer_Time() - t;
+		PrintResult("los_update", reps, t);
+	}
+
+	void test_los_visibility_DISABLED()
+	{
+		CTerrain terrain;
+		CSimulation2 sim2(NULL, &terrain);
+		LoadMap(L"maps/scenarios/Median Oasis.pmp", terrain, sim2);
+
+		CmpPtr<ICmpRangeManager> cmpRangeManager(sim2, SYSTEM_ENTITY);
+		std::vector<entity_id_t> ents;
+		CSimulation2::InterfaceList visions = sim2.GetEntitiesWithInterface(IID_Vision);
+		for (size_t i = 0; i < visions.size(); ++i)
+		{
+			CmpPtr<ICmpPosition> cmpPosition(sim2, visions[i].first);
+			if (cmpPosition && cmpPosition->IsInWorld())
+				ents.push_back(visions[i].first);
+		}
+		TS_ASSERT(!ents.empty());
+		if (ents.empty())
+			return;
+
+		// Visibility checks for alternating players, with units moving between them,
+		// like UnitAI and the renderer interleave them during a battle
+		boost::mt19937 rng(1234);
+		int mapSize = (int)(terrain.GetTilesPerSide() * TERRAIN_TILE_SIZE);
+		size_t reps = 65536;
+		double t = timer_Time();
+		for (size_t i = 0; i < reps; ++i)
+		{
+			if (i % 16 == 0)
+			{
+				CmpPtr<ICmpPosition> cmpPosition(sim2, ents[rng() % ents.size()]);
+				cmpPosition->JumpTo(RandomPos(rng, mapSize), RandomPos(rng, mapSize));
+			}
+			cmpRangeManager->GetLosVisibility(ents[rng() % ents.size()], (player_id_t)(1 + i % 2));
+		}
+		t = timer_Time() - t;
+		PrintResult("los_visibility", reps, t);
+	}
+
+	void test_pathfinder_tile_DISABLED()
+	{
+		CTerrain terrain;
+		CSimulation2 sim2(NULL, &terrain);
+		LoadMap(L"maps/scenarios/Median Oasis.pmp", terrain, sim2);
+
+		CmpPtr<ICmpPathfinder> cmpPathfinder(sim2, SYSTEM_ENTITY);
+		ICmpPathfinder::pass_class_t passClass = cmpPathfinder->GetPassabilityClass("default");
+		ICmpPathfinder::cost_class_t costClass = cmpPathfinder->GetCostClass("default");
+
+		boost::mt19937 rng(1234);
+		size_t reps = 2048;
+		double t = timer_Time();
+		for (size_t i = 0; i < reps; ++i)
+		{
+			entity_pos_t x0 = RandomPos(rng, 512);
+			entity_pos_t z0 = RandomPos(rng, 512);
+			ICmpPathfinder::Goal goal = { ICmpPathfinder::Goal::POINT, x0 + RandomPos(rng, 64), z0 + RandomPos(rng, 64) };
+
+			ICmpPathfinder::Path path;
+			cmpPathfinder->ComputePath(x0, z0, goal, passClass, costClass, path);
+		}
+		t = timer_Time() - t;
+		PrintResult("pathfinder_tile", reps, t);
+	}
+
+	void test_pathfinder_vertex_DISABLED()
+	{
+		CTerrain terrain;
+		terrain.Initialize(5, NULL);
+
+		CSimulation2 sim2(NULL, &terrain);
+		sim2.LoadDefaultScripts();
+		sim2.ResetState();
+
+		const entity_pos_t range = entity_pos_t::FromInt(TERRAIN_TILE_SIZE*12);
+
+		CmpPtr<ICmpObstructionManager> cmpObstructionMan(sim2, SYSTEM_ENTITY);
+		CmpPtr<ICmpPathfinder> cmpPathfinder(sim2, SYSTEM_ENTITY);
+
+		boost::mt19937 rng(1234);
+		int maxPos = (int)(1.5f * range.ToFloat());
+		for (size_t i = 0; i < 200; ++i)
+			cmpObstructionMan->AddUnitShape(INVALID_ENTITY, RandomPos(rng, maxPos), RandomPos(rng, maxPos), fixed::FromInt(2), 0, INVALID_ENTITY);
+
+		NullObstructionFilter filter;
+		size_t reps = 256;
+		double t = timer_Time();
+		for (size_t i = 0; i < reps; ++i)
+		{
+			ICmpPathfinder::Goal goal = { ICmpPathfinder::Goal::POINT, RandomPos(rng, maxPos), RandomPos(rng, maxPos) };
+			ICmpPathfinder::Path path;
+			cmpPathfinder->ComputeShortPath(filter, RandomPos(rng, maxPos), RandomPos(rng, maxPos), fixed::FromInt(2), range, goal, 0, path);
+		}
+		t = timer_Time() - t;
+		PrintResult("pathfinder_vertex", reps, t);
+	}
+
+	void test_rasterise_DISABLED()
+	{
+		CTerrain terrain;
+		CSimulation2 sim2(NULL, &terrain);
+		LoadMap(L"maps/scenarios/Median Oasis.pmp", terrain, sim2);
+
+		CmpPtr<ICmpObstructionManager> cmpObstructionMan(sim2, SYSTEM_ENTITY);
+		u16 size = (u16)terrain.GetTilesPerSide();
+		Grid<u8> grid(size, size);
+
+		// Changing the passability shape dirties everything, so each rep is a full rasterisation
+		size_t reps = 64;
+		double t = timer_Time();
+		for (size_t i = 0; i < reps; ++i)
+		{
+			cmpObstructionMan->SetPassabilityCircular(false);
+			cmpObstructionMan->Rasterise(grid);
+		}
+		t = timer_Time() - t;
+		PrintResult("rasterise_full", reps, t);
+
+		// Moving a single unit only needs the tiles around it to be updated
+		std::vector<entity_id_t> ents;
+		CSimulation2::InterfaceList positions = sim2.GetEntitiesWithInterface(IID_Position);
+		for (size_t i = 0; i < positions.size(); ++i)
+			if (static_cast<ICmpPosition*>(positions[i].second)->IsInWorld())
+				ents.push_back(positions[i].first);
+		if (ents.empty())
+			return;
+
+		boost::mt19937 rng(1234);
+		int mapSize = size * TERRAIN_TILE_SIZE;
+		reps = 1024;
+		t = timer_Time();
+		for (size_t i = 0; i < reps; ++i)
+		{
+			CmpPtr<ICmpPosition> cmpPosition(sim2, ents[rng() % ents.size()]);
+			cmpPosition->JumpTo(RandomPos(rng, mapSize), RandomPos(rng, mapSize));
+			cmpObstructionMan->Rasterise(grid);
+		}
+		t = timer_Time() - t;
+		PrintResult("rasterise_incremental", reps, t);
+	}
+
+	void test_territory_DISABLED()
+	{
+		CTerrain terrain;
+		CSimulation2 sim2(NULL, &terrain);
+		LoadMap(L"maps/scenarios/Median Oasis.pmp", terrain, sim2);
+
+		CmpPtr<ICmpTerritoryManager> cmpTerritoryManager(sim2, SYSTEM_ENTITY);
+		cmpTerritoryManager->GetTerritoryGrid();
+
+		// A terrain change makes the territory manager redo the whole flood fill
+		size_t reps = 64;
+		int32_t size = (int32_t)terrain.GetVerticesPerSide();
+		double t = timer_Time();
+		for (size_t i = 0; i < reps; ++i)
+		{
+			sim2.BroadcastMessage(CMessageTerrainChanged(0, 0, size, size));
+			cmpTerritoryManager->GetTerritoryGrid();
+		}
+		t = timer_Time() - t;
+		PrintResult("territory_flood_fill", reps, t);
+	}
+
+	void test_serialize_DISABLED()
+	{
+		CTerrain terrain;
+		CSimulation2 sim2(NULL, &terrain);
+		LoadMap(L"maps/scenarios/Latium.pmp", terrain, sim2);
+
+		// Run the simulation for a while so the state is more like a game in progress
+		// than a freshly loaded map (the entities have their timers, AI state etc set up)
+		for (size_t i = 0; i < 100; ++i)
+			sim2.Update(200);
+
+		std::string state;
+		sim2.SerializeState(state);
+		printf("\n{\"benchmark\": \"state_size\", \"bytes\": %d}\n", (int)state.size());
+
+		size_t reps = 32;
+		double t = timer_Time();
+		for (size_t i = 0; i < reps; ++i)
+		{
+			std::string buffer;
+			sim2.SerializeState(buffer);
+		}
+		t = timer_Time() - t;
+		PrintResult("serialize_binary", reps, t);
+
+		t = timer_Time();
+		for (size_t i = 0; i < reps; ++i)
+		{
+			std::string hash;
+			sim2.ComputeStateHash(hash, false);
+		}
+		t = timer_Time() - t;
+		PrintResult("serialize_hash", reps, t);
+
+		t = timer_Time();
+		for (size_t i = 0; i < reps; ++i)
+		{
+			std::string hash;
+			sim2.ComputeStateHash(hash, true);
+		}
+		t = timer_Time() - t;
+		PrintResult("serialize_hash_quick", reps, t);
+	}
+};
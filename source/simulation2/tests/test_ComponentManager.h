@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -18,6 +18,7 @@
 #include "lib/self_test.h"
 
 #include "simulation2/system/ComponentManager.h"
+#include "simulation2/system/ComponentPool.h"
 
 #include "simulation2/MessageTypes.h"
 #include "simulation2/system/ParamNode.h"
@@ -26,6 +27,7 @@
 #include "simulation2/components/ICmpTest.h"
 #include "simulation2/components/ICmpTemplateManager.h"
 
+#include "lib/timer.h"
 #include "ps/CLogger.h"
 #include "ps/Filesystem.h"
 #include "ps/XML/Xeromyces.h"
@@ -40,6 +42,11 @@
 
 class TestComponentManager : public CxxTest::TestSuite
 {
+	struct PoolItem
+	{
+		u8 data[40];
+	};
+
 public:
 	void setUp()
 	{
@@ -73,6 +80,107 @@ public:
 		TS_ASSERT_EQUALS(man.LookupCID("Test1B"), (int)CID_Test1B);
 	}
 
+	void test_ComponentPool()
+	{
+		// Items are packed together, and freed ones get reused
+		// (sizes are rounded up to allocationAlignment)
+		u8* a = (u8*)ComponentPool<PoolItem>::Allocate();
+		u8* b = (u8*)ComponentPool<PoolItem>::Allocate();
+		TS_ASSERT_EQUALS(b - a, 48);
+		ComponentPool<PoolItem>::Deallocate(a);
+		TS_ASSERT_EQUALS((u8*)ComponentPool<PoolItem>::Allocate(), a);
+		ComponentPool<PoolItem>::Deallocate(a);
+		ComponentPool<PoolItem>::Deallocate(b);
+
+		// Memory from outside the pool is returned to the heap
+		ComponentPool<PoolItem>::Deallocate(::operator new(sizeof(PoolItem)));
+
+		// Components allocated by the manager should still work as normal
+		CSimContext context;
+		CComponentManager man(context);
+		man.LoadComponentTypes();
+		for (entity_id_t ent = 100; ent < 200; ++ent)
+			man.AddComponent(ent, CID_Test1A, CParamNode());
+		for (entity_id_t ent = 100; ent < 200; ++ent)
+			TS_ASSERT_EQUALS(static_cast<ICmpTest1*> (man.QueryInterface(ent, IID_Test1))->GetX(), 11000);
+		for (entity_id_t ent = 100; ent < 200; ++ent)
+			man.DestroyComponentsSoon(ent);
+		man.FlushDestroyedComponents();
+		TS_ASSERT(man.QueryInterface(100, IID_Test1) == NULL);
+	}
+
+	void test_destroy_many()
+	{
+		CSimContext context;
+		CComponentManager man(context);
+		man.LoadComponentTypes();
+
+		CParamNode noParam;
+		for (entity_id_t ent = 100; ent < 1100; ++ent)
+		{
+			man.AddComponent(ent, CID_Test1A, noParam);
+			if (ent % 3 == 0)
+				man.AddComponent(ent, CID_Test2A, noParam);
+		}
+		for (entity_id_t ent = FIRST_LOCAL_ENTITY; ent < FIRST_LOCAL_ENTITY + 100; ++ent)
+			man.AddComponent(ent, CID_Test1A, noParam);
+
+		// Every other entity, including all the local ones, in a single batch
+		for (entity_id_t ent = 100; ent < 1100; ent += 2)
+			man.DestroyComponentsSoon(ent);
+		for (entity_id_t ent = FIRST_LOCAL_ENTITY; ent < FIRST_LOCAL_ENTITY + 100; ++ent)
+			man.DestroyComponentsSoon(ent);
+		man.FlushDestroyedComponents();
+
+		CComponentManager::InterfaceList ents1 = man.GetEntitiesWithInterface(IID_Test1);
+		TS_ASSERT_EQUALS(ents1.size(), (size_t)500);
+		for (size_t i = 0; i < ents1.size(); ++i)
+			TS_ASSERT_EQUALS(ents1[i].first, (entity_id_t)(101 + 2*i));
+
+		CComponentManager::InterfaceList ents2 = man.GetEntitiesWithInterface(IID_Test2);
+		TS_ASSERT_EQUALS(ents2.size(), (size_t)166);
+		for (size_t i = 0; i < ents2.size(); ++i)
+			TS_ASSERT_EQUALS(ents2[i].first % 6, 3u);
+
+		TS_ASSERT(man.QueryInterface(100, IID_Test1) == NULL);
+		TS_ASSERT(man.QueryInterface(102, IID_Test2) == NULL);
+		TS_ASSERT(man.QueryInterface(FIRST_LOCAL_ENTITY, IID_Test1) == NULL);
+		TS_ASSERT(man.QueryInterface(1099, IID_Test1) != NULL);
+		TS_ASSERT(man.QueryInterface(1095, IID_Test2) != NULL);
+
+		// New entities still get added in order after the erasures
+		man.AddComponent(1100, CID_Test2A, noParam);
+		man.AddComponent(50, CID_Test2A, noParam);
+		ents2 = man.GetEntitiesWithInterface(IID_Test2);
+		TS_ASSERT_EQUALS(ents2.size(), (size_t)168);
+		TS_ASSERT_EQUALS(ents2.front().first, 50u);
+		TS_ASSERT_EQUALS(ents2.back().first, 1100u);
+	}
+
+	// Measures a mass death, where a large part of a big game's entities are destroyed in one turn;
+	// disabled by default, run with "-test TestComponentManager::test_destroy_many_performance_DISABLED"
+	void test_destroy_many_performance_DISABLED()
+	{
+		CSimContext context;
+		CComponentManager man(context);
+		man.LoadComponentTypes();
+
+		const entity_id_t numEnts = 20000;
+		CParamNode noParam;
+		for (entity_id_t ent = 100; ent < 100 + numEnts; ++ent)
+		{
+			man.AddComponent(ent, CID_Test1A, noParam);
+			man.AddComponent(ent, CID_Test2A, noParam);
+		}
+
+		double t = timer_Time();
+		for (entity_id_t ent = 100; ent < 100 + numEnts; ent += 4)
+			man.DestroyComponentsSoon(ent);
+		man.FlushDestroyedComponents();
+		t = timer_Time() - t;
+		printf("\n# destroyed %d of %d entities in %f ms\n", (int)numEnts/4, (int)numEnts, t*1000.0);
+	}
+
 	void test_AllocateNewEntity()
 	{
 		CSimContext context;
@@ -211,6 +319,175 @@ public:
 		TS_ASSERT_EQUALS(static_cast<ICmpTest2*> (man.QueryInterface(ent4, IID_Test2))->GetX(), 21150);
 	}
 
+	void test_SendMessage_changes()
+	{
+		CSimContext context;
+		CComponentManager man(context);
+		man.LoadComponentTypes();
+
+		entity_id_t ent1 = 1, ent2 = 2;
+		CParamNode noParam;
+
+		CMessageTurnStart msg1;
+
+		man.AddComponent(ent1, CID_Test1A, noParam);
+		man.BroadcastMessage(msg1);
+		TS_ASSERT_EQUALS(static_cast<ICmpTest1*> (man.QueryInterface(ent1, IID_Test1))->GetX(), 11001);
+
+		// Newly added components must receive later broadcasts
+		man.AddComponent(ent2, CID_Test1A, noParam);
+		man.BroadcastMessage(msg1);
+		TS_ASSERT_EQUALS(static_cast<ICmpTest1*> (man.QueryInterface(ent1, IID_Test1))->GetX(), 11002);
+		TS_ASSERT_EQUALS(static_cast<ICmpTest1*> (man.QueryInterface(ent2, IID_Test1))->GetX(), 11001);
+
+		// Destroyed components mustn't receive any more
+		man.DestroyComponentsSoon(ent1);
+		man.FlushDestroyedComponents();
+		TS_ASSERT(man.QueryInterface(ent1, IID_Test1) == NULL);
+		man.BroadcastMessage(msg1);
+		TS_ASSERT_EQUALS(static_cast<ICmpTest1*> (man.QueryInterface(ent2, IID_Test1))->GetX(), 11002);
+	}
+
+	void test_SendMessage_changes_unsubscribed()
+	{
+		CSimContext context;
+		CComponentManager man(context);
+		man.LoadComponentTypes();
+
+		entity_id_t ent1 = 1, ent2 = 2;
+		CParamNode noParam;
+
+		CMessageTurnStart msg1;
+		CMessageUpdate msg2(fixed::FromInt(100));
+
+		man.AddComponent(ent1, CID_Test2A, noParam);
+		man.BroadcastMessage(msg1);
+		man.BroadcastMessage(msg2);
+		const CComponentManager::MessageRecipients* updateRecipients = man.m_LocalMessageRecipients[MT_Update].get();
+		TS_ASSERT(updateRecipients != NULL);
+
+		// Adding or removing components only discards the lists of the message types
+		// their type subscribes to (Test1A gets TurnStart and Interpolate, not Update)
+		man.AddComponent(ent2, CID_Test1A, noParam);
+		TS_ASSERT(!man.m_LocalMessageRecipients[MT_TurnStart]);
+		TS_ASSERT_EQUALS(man.m_LocalMessageRecipients[MT_Update].get(), updateRecipients);
+
+		man.BroadcastMessage(msg1);
+		TS_ASSERT_EQUALS(static_cast<ICmpTest1*> (man.QueryInterface(ent2, IID_Test1))->GetX(), 11001);
+
+		man.DestroyComponentsSoon(ent2);
+		man.FlushDestroyedComponents();
+		TS_ASSERT(!man.m_LocalMessageRecipients[MT_TurnStart]);
+		TS_ASSERT_EQUALS(man.m_LocalMessageRecipients[MT_Update].get(), updateRecipients);
+
+		man.BroadcastMessage(msg2);
+		TS_ASSERT_EQUALS(static_cast<ICmpTest2*> (man.QueryInterface(ent1, IID_Test2))->GetX(), 21250);
+	}
+
+	void test_SetSleeping()
+	{
+		CSimContext context;
+		CComponentManager man(context);
+		man.LoadComponentTypes();
+
+		entity_id_t ent1 = 1, ent2 = 2;
+		CParamNode noParam;
+
+		man.AddComponent(ent1, CID_Test2A, noParam);
+		man.AddComponent(ent2, CID_Test2A, noParam);
+		ICmpTest2* cmp1 = static_cast<ICmpTest2*> (man.QueryInterface(ent1, IID_Test2));
+		ICmpTest2* cmp2 = static_cast<ICmpTest2*> (man.QueryInterface(ent2, IID_Test2));
+
+		CMessageTurnStart msg1;
+		CMessageUpdate msg2(fixed::FromInt(100));
+
+		man.BroadcastMessage(msg2);
+		TS_ASSERT_EQUALS(cmp1->GetX(), 21100);
+		TS_ASSERT_EQUALS(cmp2->GetX(), 21100);
+
+		// Sleeping components are skipped by MT_Update broadcasts only
+		man.SetSleeping(cmp1, true);
+		TS_ASSERT(cmp1->IsSleeping());
+		man.BroadcastMessage(msg2);
+		man.BroadcastMessage(msg1);
+		TS_ASSERT_EQUALS(cmp1->GetX(), 21150);
+		TS_ASSERT_EQUALS(cmp2->GetX(), 21250);
+
+		// Messages posted to the entity are still received
+		man.PostMessage(ent1, msg2);
+		TS_ASSERT_EQUALS(cmp1->GetX(), 21250);
+
+		man.SetSleeping(cmp1, false);
+		man.BroadcastMessage(msg2);
+		TS_ASSERT_EQUALS(cmp1->GetX(), 21350);
+		TS_ASSERT_EQUALS(cmp2->GetX(), 21350);
+	}
+
+	static std::vector<entity_id_t> GetRecipientEntities(CComponentManager& man, CComponentManager::MessageTypeId mtid)
+	{
+		std::vector<entity_id_t> ents;
+		const CComponentManager::MessageRecipientsPtr& recipients = man.GetMessageRecipients(mtid, false);
+		for (size_t i = 0; i < recipients->size(); ++i)
+			ents.push_back((*recipients)[i].component->GetEntityId());
+		return ents;
+	}
+
+	void test_SetSleeping_incremental()
+	{
+		CSimContext context;
+		CComponentManager man(context);
+		man.LoadComponentTypes();
+
+		CParamNode noParam;
+		std::vector<ICmpTest2*> cmps;
+		for (entity_id_t ent = 1; ent <= 10; ++ent)
+		{
+			man.AddComponent(ent, CID_Test2A, noParam);
+			cmps.push_back(static_cast<ICmpTest2*> (man.QueryInterface(ent, IID_Test2)));
+		}
+
+		CMessageUpdate msg(fixed::FromInt(100));
+		man.BroadcastMessage(msg);
+
+		// Changes are patched into the cached list, including components that change
+		// more than once (possibly back to their original state)
+		man.SetSleeping(cmps[4], true);
+		man.SetSleeping(cmps[0], true);
+		man.SetSleeping(cmps[9], true);
+		man.SetSleeping(cmps[2], true);
+		man.SetSleeping(cmps[2], false);
+		man.SetSleeping(cmps[6], true);
+		man.SetSleeping(cmps[6], false);
+		man.SetSleeping(cmps[6], true);
+		man.BroadcastMessage(msg);
+
+		entity_id_t expected1[] = { 2, 3, 4, 6, 8, 9 };
+		std::vector<entity_id_t> patched = GetRecipientEntities(man, MT_Update);
+		TS_ASSERT_EQUALS(patched, std::vector<entity_id_t>(expected1, expected1 + ARRAY_SIZE(expected1)));
+		TS_ASSERT_EQUALS(cmps[0]->GetX(), 21100);
+		TS_ASSERT_EQUALS(cmps[1]->GetX(), 21200);
+
+		man.SetSleeping(cmps[0], false);
+		man.SetSleeping(cmps[9], false);
+		man.SetSleeping(cmps[3], true);
+		man.SetSleeping(cmps[5], true);
+		man.SetSleeping(cmps[5], false);
+		man.BroadcastMessage(msg);
+
+		entity_id_t expected2[] = { 1, 2, 3, 6, 8, 9, 10 };
+		patched = GetRecipientEntities(man, MT_Update);
+		TS_ASSERT_EQUALS(patched, std::vector<entity_id_t>(expected2, expected2 + ARRAY_SIZE(expected2)));
+
+		// The patched list matches one built from scratch
+		man.InvalidateMessageRecipients();
+		TS_ASSERT_EQUALS(GetRecipientEntities(man, MT_Update), patched);
+
+		TS_ASSERT_EQUALS(cmps[0]->GetX(), 21200);
+		TS_ASSERT_EQUALS(cmps[3]->GetX(), 21200);
+		TS_ASSERT_EQUALS(cmps[4]->GetX(), 21100);
+		TS_ASSERT_EQUALS(cmps[5]->GetX(), 21300);
+	}
+
 	void test_ParamNode()
 	{
 		CSimContext context;
@@ -302,6 +579,33 @@ public:
 		TS_ASSERT_EQUALS(static_cast<ICmpTest1*> (man.QueryInterface(ent1, IID_Test1))->GetX(), 2);
 	}
 
+	void test_script_cached()
+	{
+		entity_id_t ent1 = 1;
+		CParamNode noParam;
+
+		{
+			CSimContext context;
+			CComponentManager man(context);
+			man.LoadComponentTypes();
+			TS_ASSERT(man.LoadScript(L"simulation/components/test.js"));
+		}
+
+		// The compiled script should have been cached
+		VfsPaths cached;
+		TS_ASSERT_OK(vfs::GetPathnames(g_VFS, L"cache/simulation/components/", L"test.js.*.jsc", cached));
+		TS_ASSERT_EQUALS(cached.size(), (size_t)1);
+
+		// and should behave identically when loaded from the cache
+		CSimContext context;
+		CComponentManager man(context);
+		man.LoadComponentTypes();
+		TS_ASSERT(man.LoadScript(L"simulation/components/test.js"));
+
+		man.AddComponent(ent1, man.LookupCID("TestScript1A"), noParam);
+		TS_ASSERT_EQUALS(static_cast<ICmpTest1*> (man.QueryInterface(ent1, IID_Test1))->GetX(), 101000);
+	}
+
 	void test_script_interface()
 	{
 		CSimContext context;
@@ -484,6 +788,69 @@ public:
 		TS_ASSERT_EQUALS(static_cast<ICmpTest1*> (man.QueryInterface(ent3, IID_Test1))->GetX(), 5650);
 	}
 
+	void test_script_transient_messages()
+	{
+		CSimContext context;
+		CComponentManager man(context);
+		man.LoadComponentTypes();
+
+		// (These handlers break the TransientMessages promise by keeping the previous
+		// message, so they can check whether it's reused)
+		TS_ASSERT(man.GetScriptInterface().LoadScript(L"test-transient.js",
+			"function TestTransient() {}"
+			"TestTransient.prototype.TransientMessages = true;"
+			"TestTransient.prototype.Init = function() { this.x = 0; this.prev = null; };"
+			"TestTransient.prototype.OnUpdate = function(msg) {"
+			"  if (msg === this.prev) this.x += 1000;"
+			"  this.prev = msg;"
+			"  this.x += msg.turnLength;"
+			"};"
+			"TestTransient.prototype.OnRangeUpdate = function(msg) {"
+			"  if (msg.added instanceof Uint32Array) this.x += 100000;"
+			"  this.x += msg.tag * 10000 + msg.added[msg.added.length - 1] * 100;"
+			"};"
+			"TestTransient.prototype.GetX = function() { return this.x; };"
+			"Engine.RegisterComponentType(IID_Test1, 'TestTransient', TestTransient);"
+			"function TestRetained() {}"
+			"TestRetained.prototype = Object.create(TestTransient.prototype);"
+			"TestRetained.prototype.TransientMessages = false;"
+			"Engine.RegisterComponentType(IID_Test1, 'TestRetained', TestRetained);"
+		));
+
+		entity_id_t ent1 = 1, ent2 = 2;
+		CParamNode noParam;
+		man.AddComponent(ent1, man.LookupCID("TestTransient"), noParam);
+		man.AddComponent(ent2, man.LookupCID("TestRetained"), noParam);
+		ICmpTest1* cmp1 = static_cast<ICmpTest1*> (man.QueryInterface(ent1, IID_Test1));
+		ICmpTest1* cmp2 = static_cast<ICmpTest1*> (man.QueryInterface(ent2, IID_Test1));
+
+		{
+			CMessageUpdate msg(fixed::FromInt(1));
+			man.BroadcastMessage(msg);
+		}
+		{
+			CMessageUpdate msg(fixed::FromInt(2));
+			man.BroadcastMessage(msg);
+		}
+		TS_ASSERT_EQUALS(cmp1->GetX(), 1003);
+		TS_ASSERT_EQUALS(cmp2->GetX(), 3);
+
+		std::vector<entity_id_t> added, removed;
+		added.push_back(5);
+		added.push_back(7);
+		CMessageRangeUpdate msg1(2, added, removed);
+		man.PostMessage(ent1, msg1);
+		man.PostMessage(ent2, msg1);
+		TS_ASSERT_EQUALS(cmp1->GetX(), 1003 + 100000 + 20700);
+		TS_ASSERT_EQUALS(cmp2->GetX(), 3 + 20700);
+
+		// The reused typed arrays get the new message's contents
+		added[1] = 8;
+		CMessageRangeUpdate msg2(3, added, removed);
+		man.PostMessage(ent1, msg2);
+		TS_ASSERT_EQUALS(cmp1->GetX(), 1003 + 200000 + 20700 + 30800);
+	}
+
 	void test_script_template()
 	{
 		CSimContext context;
@@ -603,9 +970,21 @@ public:
 		std::string hash;
 		TS_ASSERT(man.ComputeStateHash(hash, false));
 		TS_ASSERT_EQUALS(hash.length(), (size_t)16);
-		TS_ASSERT_SAME_DATA(hash.data(), "\x1c\x45\x2b\x20\x1f\x0c\x00\x93\x60\x78\xe2\x63\xb1\x47\x08\x19", 16);
-		// echo -en "\x05\x00\x00\x0078606\x01\0\0\0\x01\0\0\0\xf8\x2a\0\0\x02\0\0\0\xd2\x04\0\0\x04\0\0\0\x01\0\0\0\x08\x52\0\0" | openssl md5 | perl -pe 's/(..)/\\x$1/g'
-		//           ^^^^^^^^ rng ^^^^^^^^ ^^Test1A^^ ^^^ent1^^ ^^^11000^^^ ^^^ent2^^ ^^^1234^^^ ^^Test2A^^ ^^ent1^^ ^^^21000^^^
+		TS_ASSERT_SAME_DATA(hash.data(), "\xf4\x82\x49\xe7\x01\x20\x98\x27\xd0\x53\x73\xae\xa8\x3a\xdb\x4c", 16);
+		// echo -en "\x05\x00\x00\x0078606\x01\0\0\0<Test1A hash>\x04\0\0\0<Test2A hash>" | openssl md5 | perl -pe 's/(..)/\\x$1/g'
+		//           ^^^^^^^^ rng ^^^^^^^^ ^^Test1A^^                ^^Test2A^^
+
+		std::vector<std::pair<CComponentManager::ComponentTypeId, std::string> > componentHashes;
+		TS_ASSERT(man.ComputeComponentStateHashes(componentHashes, false));
+		TS_ASSERT_EQUALS(componentHashes.size(), (size_t)2);
+		TS_ASSERT_EQUALS(componentHashes[0].first, CID_Test1A);
+		TS_ASSERT_SAME_DATA(componentHashes[0].second.data(), "\xb8\x83\x7b\xfa\x4b\x35\xe3\x9b\xe8\x3b\xd8\x4a\xcb\x88\x81\xb3", 16);
+		// echo -en "\x01\0\0\0\xf8\x2a\0\0\x02\0\0\0\xd2\x04\0\0" | openssl md5 | perl -pe 's/(..)/\\x$1/g'
+		//           ^^^ent1^^ ^^^11000^^^ ^^^ent2^^ ^^^1234^^^
+		TS_ASSERT_EQUALS(componentHashes[1].first, CID_Test2A);
+		TS_ASSERT_SAME_DATA(componentHashes[1].second.data(), "\x0d\x03\xec\xd7\xc5\xbd\xfe\x58\xdf\xde\xf6\x44\x73\x66\x9b\xca", 16);
+		// echo -en "\x01\0\0\0\x08\x52\0\0" | openssl md5 | perl -pe 's/(..)/\\x$1/g'
+		//           ^^ent1^^ ^^^21000^^^
 
 		std::stringstream stateStream;
 		TS_ASSERT(man.SerializeState(stateStream));
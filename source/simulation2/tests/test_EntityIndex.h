@@ -0,0 +1,193 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "simulation2/helpers/EntityIndex.h"
+
+#include <boost/random/mersenne_twister.hpp>
+
+class TestEntityIndex : public CxxTest::TestSuite
+{
+	struct Ent
+	{
+		bool exists;
+		int tmpl;
+		player_id_t owner;
+		bool inWorld;
+		CFixedVector2D pos;
+	};
+
+	static CFixedVector2D Pos(int x, int z)
+	{
+		return CFixedVector2D(entity_pos_t::FromInt(x), entity_pos_t::FromInt(z));
+	}
+
+	static std::string Query(const EntityIndex& index, const EntityIndex::Filter& filter)
+	{
+		std::vector<entity_id_t> ents;
+		index.Query(filter, ents);
+		std::string ret;
+		for (size_t i = 0; i < ents.size(); ++i)
+			ret += (i ? " " : "") + CStr::FromUInt(ents[i]);
+		return ret;
+	}
+
+	static void SetClasses(EntityIndex& index)
+	{
+		std::map<std::string, std::vector<std::string> > classes;
+		classes["units/infantry"].push_back("Unit");
+		classes["units/infantry"].push_back("Infantry");
+		classes["units/cavalry"].push_back("Unit");
+		classes["structures/house"].push_back("Structure");
+		index.SetTemplateClasses(classes);
+	}
+
+public:
+	void test_filters()
+	{
+		EntityIndex index;
+		index.Reset(entity_pos_t::FromInt(1024));
+		SetClasses(index);
+
+		index.Update(10, "units/infantry", 1, true, Pos(100, 100));
+		index.Update(11, "units/cavalry", 1, true, Pos(110, 100));
+		index.Update(12, "units/infantry", 2, true, Pos(500, 500));
+		index.Update(13, "foundation|structures/house", 1, true, Pos(120, 120));
+		index.Update(14, "units/infantry", 1, false, Pos(0, 0));
+		index.Update(15, "other", 0, true, Pos(2000, 2000)); // outside the map
+		TS_ASSERT_EQUALS(index.GetCount(), 6u);
+
+		EntityIndex::Filter filter;
+		TS_ASSERT_STR_EQUALS(Query(index, filter), "10 11 12 13 14 15");
+
+		filter.hasOwner = true;
+		filter.owner = 1;
+		TS_ASSERT_STR_EQUALS(Query(index, filter), "10 11 13 14");
+
+		filter.className = "Infantry";
+		TS_ASSERT_STR_EQUALS(Query(index, filter), "10 14");
+
+		filter.hasRange = true;
+		filter.position = Pos(100, 100);
+		filter.range = entity_pos_t::FromInt(50);
+		TS_ASSERT_STR_EQUALS(Query(index, filter), "10");
+
+		filter = EntityIndex::Filter();
+		filter.className = "Structure";
+		TS_ASSERT_STR_EQUALS(Query(index, filter), "13");
+
+		filter = EntityIndex::Filter();
+		filter.templateName = "units/infantry";
+		TS_ASSERT_STR_EQUALS(Query(index, filter), "10 12 14");
+
+		filter = EntityIndex::Filter();
+		filter.hasRange = true;
+		filter.position = Pos(2000, 2000);
+		filter.range = entity_pos_t::FromInt(1);
+		TS_ASSERT_STR_EQUALS(Query(index, filter), "15");
+
+		filter.className = "Missing";
+		TS_ASSERT_STR_EQUALS(Query(index, filter), "");
+
+		// Changing owner and position
+		index.Update(10, "units/infantry", 2, true, Pos(510, 500));
+		index.Update(14, "units/infantry", 1, true, Pos(105, 105));
+		index.Remove(11);
+		index.Remove(99);
+		filter = EntityIndex::Filter();
+		filter.hasRange = true;
+		filter.position = Pos(100, 100);
+		filter.range = entity_pos_t::FromInt(50);
+		TS_ASSERT_STR_EQUALS(Query(index, filter), "13 14");
+		filter.hasOwner = true;
+		filter.owner = 2;
+		filter.position = Pos(500, 500);
+		TS_ASSERT_STR_EQUALS(Query(index, filter), "10 12");
+
+		index.Reset(entity_pos_t::FromInt(1024));
+		TS_ASSERT_STR_EQUALS(Query(index, EntityIndex::Filter()), "");
+	}
+
+	void test_random()
+	{
+		// Compare indexed queries against checking every entity
+		boost::mt19937 rng(1234);
+		EntityIndex index;
+		index.Reset(entity_pos_t::FromInt(1000));
+		SetClasses(index);
+
+		const char* templates[] = { "units/infantry", "units/cavalry", "structures/house" };
+		std::vector<Ent> ents(200);
+		for (size_t i = 0; i < ents.size(); ++i)
+			ents[i].exists = false;
+
+		for (int iter = 0; iter < 2000; ++iter)
+		{
+			entity_id_t id = rng() % ents.size();
+			Ent& e = ents[id];
+			if (rng() % 5 == 0)
+			{
+				e.exists = false;
+				index.Remove(id);
+			}
+			else
+			{
+				e.exists = true;
+				e.tmpl = rng() % 3;
+				e.owner = rng() % 3;
+				e.inWorld = (rng() % 8 != 0);
+				e.pos = Pos(rng() % 1100, rng() % 1100);
+				index.Update(id, templates[e.tmpl], e.owner, e.inWorld, e.pos);
+			}
+
+			EntityIndex::Filter filter;
+			filter.hasOwner = (rng() % 2 == 0);
+			filter.owner = rng() % 3;
+			if (rng() % 3 == 0)
+				filter.templateName = templates[rng() % 3];
+			if (rng() % 3 == 0)
+				filter.className = (rng() % 2) ? "Unit" : "Structure";
+			filter.hasRange = (rng() % 2 == 0);
+			filter.position = Pos(rng() % 1000, rng() % 1000);
+			filter.range = entity_pos_t::FromInt(rng() % 300);
+
+			std::vector<entity_id_t> expected;
+			for (size_t i = 0; i < ents.size(); ++i)
+			{
+				const Ent& c = ents[i];
+				if (!c.exists)
+					continue;
+				if (filter.hasOwner && c.owner != filter.owner)
+					continue;
+				if (!filter.templateName.empty() && filter.templateName != templates[c.tmpl])
+					continue;
+				if (filter.className == "Unit" && c.tmpl == 2)
+					continue;
+				if (filter.className == "Structure" && c.tmpl != 2)
+					continue;
+				if (filter.hasRange && (!c.inWorld || (c.pos - filter.position).CompareLength(filter.range) > 0))
+					continue;
+				expected.push_back((entity_id_t)i);
+			}
+
+			std::vector<entity_id_t> result;
+			index.Query(filter, result);
+			TS_ASSERT_EQUALS(result, expected);
+		}
+	}
+};
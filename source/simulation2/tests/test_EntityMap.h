@@ -0,0 +1,128 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "simulation2/helpers/EntityMap.h"
+
+class TestEntityMap : public CxxTest::TestSuite
+{
+public:
+	void test_basic()
+	{
+		EntityMap<int> map;
+		TS_ASSERT(map.empty());
+		TS_ASSERT(map.find(1) == map.end());
+
+		TS_ASSERT(map.insert(std::make_pair(1, 10)).second);
+		TS_ASSERT(map.insert(std::make_pair(5, 50)).second);
+		TS_ASSERT(!map.insert(std::make_pair(5, 55)).second);
+		TS_ASSERT_EQUALS(map.size(), (size_t)2);
+
+		TS_ASSERT_EQUALS(map.find(1)->second, 10);
+		TS_ASSERT_EQUALS(map.find(5)->second, 50);
+		TS_ASSERT(map.find(2) == map.end());
+		TS_ASSERT(map.find(100000) == map.end());
+
+		TS_ASSERT_EQUALS(map.erase(1), (size_t)1);
+		TS_ASSERT_EQUALS(map.erase(1), (size_t)0);
+		TS_ASSERT(map.find(1) == map.end());
+		TS_ASSERT_EQUALS(map.find(5)->second, 50);
+
+		map.clear();
+		TS_ASSERT(map.empty());
+		TS_ASSERT(map.find(5) == map.end());
+	}
+
+	void test_order()
+	{
+		EntityMap<int> map;
+		map.insert(std::make_pair(FIRST_LOCAL_ENTITY + 2, 4));
+		map.insert(std::make_pair(300u, 2));
+		map.insert(std::make_pair(2u, 1));
+		map.insert(std::make_pair(FIRST_LOCAL_ENTITY, 3));
+		map.insert(std::make_pair(1000u, 0));
+		map.erase(1000);
+
+		// Iteration must be sorted by entity ID regardless of insertion order
+		int expected = 1;
+		entity_id_t prev = INVALID_ENTITY;
+		for (EntityMap<int>::const_iterator it = map.begin(); it != map.end(); ++it, ++expected)
+		{
+			TS_ASSERT_LESS_THAN(prev, it->first);
+			TS_ASSERT_EQUALS(it->second, expected);
+			prev = it->first;
+		}
+		TS_ASSERT_EQUALS(expected, 5);
+
+		// Lookups must still work after elements have been shifted
+		TS_ASSERT_EQUALS(map.find(2)->second, 1);
+		TS_ASSERT_EQUALS(map.find(300)->second, 2);
+		TS_ASSERT_EQUALS(map.find(FIRST_LOCAL_ENTITY)->second, 3);
+		TS_ASSERT_EQUALS(map.find(FIRST_LOCAL_ENTITY + 2)->second, 4);
+	}
+
+	void test_erase_batch()
+	{
+		EntityMap<int> map;
+		for (entity_id_t ent = 1; ent <= 100; ++ent)
+			map.insert(std::make_pair(ent, (int)ent * 10));
+
+		// Erased elements are skipped straight away, before being compacted
+		for (entity_id_t ent = 2; ent <= 60; ent += 2)
+			map.erase(ent);
+		TS_ASSERT_EQUALS(map.size(), (size_t)70);
+		TS_ASSERT(map.find(2) == map.end());
+		TS_ASSERT_EQUALS(map.count(2), (size_t)0);
+		TS_ASSERT_EQUALS(map.find(3)->second, 30);
+		TS_ASSERT_EQUALS(map.begin()->first, 1u);
+		TS_ASSERT_EQUALS((++map.begin())->first, 3u);
+
+		// Appending and inserting out of order while there are erased elements
+		map.insert(std::make_pair(200u, 2000));
+		map.insert(std::make_pair(4u, 41));
+		TS_ASSERT_EQUALS(map.size(), (size_t)72);
+
+		map.erase(1);
+		map.erase(200);
+		map.compact();
+		TS_ASSERT_EQUALS(map.size(), (size_t)70);
+
+		size_t count = 0;
+		entity_id_t prev = INVALID_ENTITY;
+		for (EntityMap<int>::const_iterator it = map.begin(); it != map.end(); ++it, ++count)
+		{
+			TS_ASSERT_LESS_THAN(prev, it->first);
+			TS_ASSERT_EQUALS(it->second, it->first == 4 ? 41 : (int)it->first * 10);
+			TS_ASSERT_EQUALS(map.find(it->first)->second, it->second);
+			prev = it->first;
+		}
+		TS_ASSERT_EQUALS(count, map.size());
+
+		// Erasing more than half the elements compacts automatically
+		for (entity_id_t ent = 61; ent <= 100; ++ent)
+			map.erase(ent);
+		TS_ASSERT_EQUALS(map.size(), (size_t)30);
+		TS_ASSERT_EQUALS(map.find(59)->second, 590);
+
+		while (!map.empty())
+			map.erase(map.begin());
+		TS_ASSERT(map.begin() == map.end());
+		map.insert(std::make_pair(5u, 50));
+		TS_ASSERT_EQUALS(map.begin()->second, 50);
+	}
+};
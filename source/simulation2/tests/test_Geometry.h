@@ -0,0 +1,94 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "maths/FixedVector2D.h"
+#include "simulation2/helpers/Geometry.h"
+
+#include <boost/random/mersenne_twister.hpp>
+
+class TestGeometry : public CxxTest::TestSuite
+{
+	boost::mt19937 m_Rng;
+
+	fixed RandomFixed(int mode)
+	{
+		fixed f;
+		if (mode == 0) // typical map coordinates
+			f.SetInternalValue((i32)(m_Rng() % 4000000) - 2000000);
+		else if (mode == 1) // anything, so the overflow behaviour gets tested too
+			f.SetInternalValue((i32)m_Rng());
+		else // close to the origin
+			f.SetInternalValue((i32)(m_Rng() % 1000) - 500);
+		return f;
+	}
+
+public:
+	void test_batch_matches_scalar()
+	{
+		for (int iter = 0; iter < 5000; ++iter)
+		{
+			int mode = iter % 3;
+
+			float angle = (m_Rng() % 10000) / 1000.f;
+			CFixedVector2D u(fixed::FromFloat(cosf(angle)), fixed::FromFloat(-sinf(angle)));
+			CFixedVector2D v(fixed::FromFloat(sinf(angle)), fixed::FromFloat(cosf(angle)));
+			if (iter % 7 == 0)
+			{
+				u = CFixedVector2D(RandomFixed(1), RandomFixed(1));
+				v = CFixedVector2D(RandomFixed(1), RandomFixed(1));
+			}
+			else if (iter % 11 == 0)
+			{
+				u = CFixedVector2D(fixed::FromInt(1), fixed::Zero());
+				v = CFixedVector2D(fixed::Zero(), fixed::FromInt(1));
+			}
+
+			CFixedVector2D halfSize(RandomFixed(0).Absolute(), RandomFixed(0).Absolute());
+			if (iter % 5 == 0)
+				halfSize = CFixedVector2D(RandomFixed(1), RandomFixed(1));
+
+			// Try every length up to a few SIMD widths
+			size_t count = iter % 20;
+			std::vector<fixed> x(count+1), z(count+1), distances(count+1);
+			std::vector<u8> inside(count+1);
+			for (size_t k = 0; k < count; ++k)
+			{
+				x[k] = RandomFixed(mode);
+				z[k] = RandomFixed(mode);
+
+				// Put some points very close to the corners
+				if (k % 4 == 1)
+				{
+					x[k] = u.X.Multiply(halfSize.X) + v.X.Multiply(halfSize.Y);
+					z[k] = u.Y.Multiply(halfSize.X) + v.Y.Multiply(halfSize.Y);
+					x[k].SetInternalValue(x[k].GetInternalValue() + (i32)(m_Rng() % 5) - 2);
+				}
+			}
+
+			Geometry::PointsAreInSquare(count, &x[0], &z[0], u, v, halfSize, &inside[0]);
+			Geometry::DistancesToSquare(count, &x[0], &z[0], u, v, halfSize, &distances[0]);
+			for (size_t k = 0; k < count; ++k)
+			{
+				CFixedVector2D point(x[k], z[k]);
+				TS_ASSERT_EQUALS(inside[k], Geometry::PointIsInSquare(point, u, v, halfSize) ? 1 : 0);
+				TS_ASSERT_EQUALS(distances[k], Geometry::DistanceToSquare(point, u, v, halfSize));
+			}
+		}
+	}
+};
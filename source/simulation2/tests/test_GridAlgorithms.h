@@ -0,0 +1,177 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "simulation2/helpers/GridAlgorithms.h"
+
+class TestGridAlgorithms : public CxxTest::TestSuite
+{
+	static const u16 LAND = 2;
+	static const u16 WATER = 4;
+
+	/**
+	 * Builds a grid from rows of characters: '.' is land, '~' is water,
+	 * '#' is an obstruction.
+	 */
+	static void MakeGrid(Grid<u16>& grid, const char* const* rows, u16 h)
+	{
+		u16 w = (u16)strlen(rows[0]);
+		grid = Grid<u16>(w, h);
+		for (u16 j = 0; j < h; ++j)
+		{
+			for (u16 i = 0; i < w; ++i)
+			{
+				char c = rows[j][i];
+				// Land units can't go in water and ships can't go on land
+				grid.set(i, j, c == '.' ? WATER : c == '~' ? LAND : 1);
+			}
+		}
+	}
+
+public:
+	void test_regions()
+	{
+		const char* rows[] = {
+			"...~~...",
+			"...~~...",
+			"~~~~~~..",
+			"..#~~...",
+			".#.~~~~~",
+		};
+		Grid<u16> grid, labels;
+		MakeGrid(grid, rows, ARRAY_SIZE(rows));
+
+		// Land: top-left, right, bottom-left, and the corner tile cut off diagonally
+		TS_ASSERT_EQUALS(GridAlgorithms::LabelRegions(grid, LAND, labels), 4u);
+		TS_ASSERT_EQUALS(labels.m_W, 8);
+		TS_ASSERT_EQUALS(labels.get(0, 0), 1);
+		TS_ASSERT_EQUALS(labels.get(2, 1), 1);
+		TS_ASSERT_EQUALS(labels.get(5, 0), 2);
+		TS_ASSERT_EQUALS(labels.get(7, 3), 2);
+		TS_ASSERT_EQUALS(labels.get(0, 3), 3);
+		TS_ASSERT_EQUALS(labels.get(0, 4), 3);
+		TS_ASSERT_EQUALS(labels.get(2, 4), 4);
+		TS_ASSERT_EQUALS(labels.get(3, 0), 0);
+		TS_ASSERT_EQUALS(labels.get(2, 3), 0);
+
+		// All the water is connected
+		TS_ASSERT_EQUALS(GridAlgorithms::LabelRegions(grid, WATER, labels), 1u);
+		TS_ASSERT_EQUALS(labels.get(0, 2), 1);
+		TS_ASSERT_EQUALS(labels.get(7, 4), 1);
+		TS_ASSERT_EQUALS(labels.get(0, 0), 0);
+	}
+
+	void test_distances()
+	{
+		const char* rows[] = {
+			"..........",
+			"..........",
+			"..........",
+			"..........",
+			"....#.....",
+			"..........",
+			"..........",
+		};
+		Grid<u16> grid, distances;
+		MakeGrid(grid, rows, ARRAY_SIZE(rows));
+
+		GridAlgorithms::DistanceTransform(grid, LAND, distances);
+		TS_ASSERT_EQUALS(distances.get(4, 4), 0);
+		TS_ASSERT_EQUALS(distances.get(0, 0), 1);
+		TS_ASSERT_EQUALS(distances.get(9, 6), 1);
+		TS_ASSERT_EQUALS(distances.get(5, 4), 1);
+		TS_ASSERT_EQUALS(distances.get(1, 2), 2);
+		TS_ASSERT_EQUALS(distances.get(4, 1), 2); // closer to the edge than the obstruction
+		TS_ASSERT_EQUALS(distances.get(7, 2), 3);
+		TS_ASSERT_EQUALS(distances.get(6, 2), 2); // diagonal from the obstruction: 8/3
+	}
+
+	void test_placement()
+	{
+		const char* rows[] = {
+			"..........",
+			"..........",
+			"..........",
+			"..........",
+			"..........",
+			"..........",
+			"..........",
+		};
+		Grid<u16> grid, distances;
+		MakeGrid(grid, rows, ARRAY_SIZE(rows));
+		GridAlgorithms::DistanceTransform(grid, LAND, distances);
+
+		// Player 2 owns the right half, player 1 the rest
+		Grid<u8> territories(10, 7);
+		for (u16 j = 0; j < 7; ++j)
+			for (u16 i = 0; i < 10; ++i)
+				territories.set(i, j, i >= 5 ? 0x42 : 0x01);
+
+		u16 i = 0, j = 0;
+		TS_ASSERT(GridAlgorithms::FindPlacement(distances, territories, 2, 1, 3, 0, 10, i, j));
+		TS_ASSERT_EQUALS(i, 5);
+		TS_ASSERT_EQUALS(j, 3);
+
+		// Needs to be away from the edge of the map
+		TS_ASSERT(GridAlgorithms::FindPlacement(distances, territories, 2, 9, 0, 3, 10, i, j));
+		TS_ASSERT_EQUALS(i, 7);
+		TS_ASSERT_EQUALS(j, 2);
+
+		TS_ASSERT(!GridAlgorithms::FindPlacement(distances, territories, 2, 1, 3, 0, 3, i, j));
+		TS_ASSERT(!GridAlgorithms::FindPlacement(distances, territories, 3, 1, 3, 0, 10, i, j));
+		TS_ASSERT(!GridAlgorithms::FindPlacement(distances, territories, 1, 1, 3, 5, 10, i, j));
+	}
+
+	void test_path()
+	{
+		const char* rows[] = {
+			"..........",
+			".######...",
+			"......#...",
+			"..........",
+			"~~~~~~~~~~",
+			"..........",
+		};
+		Grid<u16> grid;
+		MakeGrid(grid, rows, ARRAY_SIZE(rows));
+
+		std::vector<std::pair<u16, u16> > path;
+		TS_ASSERT(GridAlgorithms::FindPath(grid, LAND, 0, 0, 3, 2, 100*GridAlgorithms::COST_STRAIGHT, path));
+		TS_ASSERT_EQUALS(path.size(), 3u);
+		TS_ASSERT_EQUALS(path[0], std::make_pair((u16)0, (u16)0));
+		TS_ASSERT_EQUALS(path[1], std::make_pair((u16)0, (u16)2));
+		TS_ASSERT_EQUALS(path[2], std::make_pair((u16)3, (u16)2));
+
+		// Going around the wall costs more than the limit
+		TS_ASSERT(!GridAlgorithms::FindPath(grid, LAND, 0, 0, 3, 2, 4*GridAlgorithms::COST_STRAIGHT, path));
+		TS_ASSERT(path.empty());
+
+		// Can't cross the water
+		TS_ASSERT(!GridAlgorithms::FindPath(grid, LAND, 0, 0, 0, 5, 100*GridAlgorithms::COST_STRAIGHT, path));
+
+		// Diagonal moves can't cut the corner of the wall
+		TS_ASSERT(GridAlgorithms::FindPath(grid, LAND, 5, 2, 7, 0, 100*GridAlgorithms::COST_STRAIGHT, path));
+		TS_ASSERT_EQUALS(path.size(), 4u);
+		TS_ASSERT_EQUALS(path[1], std::make_pair((u16)5, (u16)3));
+		TS_ASSERT_EQUALS(path[2], std::make_pair((u16)7, (u16)3));
+		TS_ASSERT_EQUALS(path[3], std::make_pair((u16)7, (u16)0));
+
+		TS_ASSERT(GridAlgorithms::FindPath(grid, LAND, 8, 3, 8, 3, 0, path));
+		TS_ASSERT_EQUALS(path.size(), 1u);
+	}
+};
@@ -0,0 +1,109 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "simulation2/helpers/HierarchicalPathfinder.h"
+
+const HierarchicalPathfinder::pass_class_t PASS_CLASS = 4;
+
+class TestHierarchicalPathfinder : public CxxTest::TestSuite
+{
+	// Builds a map split in half by a vertical wall of the given obstruction bits, at tile x = 40
+	static void MakeWall(Grid<u16>& grid, u16 bits)
+	{
+		for (u16 j = 0; j < grid.m_H; ++j)
+			grid.set(40, j, bits);
+	}
+
+public:
+	void test_regions()
+	{
+		Grid<u16> grid(100, 100);
+		MakeWall(grid, PASS_CLASS);
+
+		std::vector<HierarchicalPathfinder::pass_class_t> passClasses;
+		passClasses.push_back(PASS_CLASS);
+		passClasses.push_back(8);
+
+		HierarchicalPathfinder hier;
+		hier.Recompute(grid, passClasses);
+		TS_ASSERT(hier.HasPassClass(PASS_CLASS));
+		TS_ASSERT(!hier.HasPassClass(16));
+		TS_ASSERT_EQUALS(hier.GetChunksW(), 7);
+
+		// The wall is impassable for PASS_CLASS and splits the map into two
+		TS_ASSERT_EQUALS(hier.GetGlobalRegion(40, 10, PASS_CLASS), 0u);
+		TS_ASSERT_EQUALS(hier.GetGlobalRegion(0, 0, PASS_CLASS), hier.GetGlobalRegion(39, 99, PASS_CLASS));
+		TS_ASSERT_EQUALS(hier.GetGlobalRegion(41, 0, PASS_CLASS), hier.GetGlobalRegion(99, 99, PASS_CLASS));
+		TS_ASSERT_DIFFERS(hier.GetGlobalRegion(0, 0, PASS_CLASS), hier.GetGlobalRegion(99, 99, PASS_CLASS));
+
+		// but not for the other class
+		TS_ASSERT_DIFFERS(hier.GetGlobalRegion(40, 10, 8), 0u);
+		TS_ASSERT_EQUALS(hier.GetGlobalRegion(0, 0, 8), hier.GetGlobalRegion(99, 99, 8));
+
+		// The wall is in the middle of a chunk, so that chunk has two regions
+		TS_ASSERT_EQUALS(hier.Get(32, 5, PASS_CLASS).ci, 2);
+		TS_ASSERT(!(hier.Get(39, 5, PASS_CLASS) == hier.Get(41, 5, PASS_CLASS)));
+
+		u16 i = 80, j = 50;
+		TS_ASSERT(hier.FindNearestReachableTile(10, 10, i, j, PASS_CLASS));
+		TS_ASSERT_EQUALS(i, 39);
+		TS_ASSERT_EQUALS(j, 50);
+
+		i = 50;
+		j = 50;
+		TS_ASSERT(!hier.FindNearestReachableTile(40, 10, i, j, PASS_CLASS));
+	}
+
+	void test_update()
+	{
+		Grid<u16> grid(100, 100);
+		MakeWall(grid, 1);
+
+		std::vector<HierarchicalPathfinder::pass_class_t> passClasses;
+		passClasses.push_back(PASS_CLASS);
+
+		HierarchicalPathfinder hier;
+		hier.Recompute(grid, passClasses);
+		TS_ASSERT_DIFFERS(hier.GetGlobalRegion(0, 0, PASS_CLASS), hier.GetGlobalRegion(99, 99, PASS_CLASS));
+
+		// Open a gap in the wall
+		GridDirtyRegion region;
+		region.Add(40, 70);
+		grid.set(40, 70, 0);
+		hier.Update(grid, region);
+		TS_ASSERT_EQUALS(hier.GetGlobalRegion(0, 0, PASS_CLASS), hier.GetGlobalRegion(99, 99, PASS_CLASS));
+
+		Grid<u8> corridor(hier.GetChunksW(), hier.GetChunksH());
+		std::set<HierarchicalPathfinder::RegionID> goals;
+		goals.insert(hier.Get(90, 10, PASS_CLASS));
+		TS_ASSERT(hier.ComputeCorridor(10, 10, 90, 10, goals, PASS_CLASS, corridor));
+
+		// The route has to go through the gap's chunk, plus a margin around it
+		TS_ASSERT_EQUALS(corridor.get(0, 0), 1);
+		TS_ASSERT_EQUALS(corridor.get(2, 4), 1);
+		TS_ASSERT_EQUALS(corridor.get(5, 0), 1);
+		TS_ASSERT_EQUALS(corridor.get(6, 6), 0);
+
+		// Close it again
+		grid.set(40, 70, 1);
+		hier.Update(grid, region);
+		TS_ASSERT_DIFFERS(hier.GetGlobalRegion(0, 0, PASS_CLASS), hier.GetGlobalRegion(99, 99, PASS_CLASS));
+		TS_ASSERT(!hier.ComputeCorridor(10, 10, 90, 10, goals, PASS_CLASS, corridor));
+	}
+};
@@ -0,0 +1,131 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "lib/timer.h"
+#include "simulation2/helpers/LosCounts.h"
+
+class TestLosCounts : public CxxTest::TestSuite
+{
+	// Records which counters crossed zero
+	struct Recorder
+	{
+		std::vector<size_t> indexes;
+		void operator()(size_t k) { indexes.push_back(k); }
+	};
+
+	struct Counter
+	{
+		size_t n;
+		Counter() : n(0) { }
+		void operator()(size_t UNUSED(k)) { ++n; }
+	};
+
+public:
+	void test_matches_scalar()
+	{
+		// Try every length and alignment up to a few SIMD widths,
+		// with a mixture of zero and non-zero counts
+		const size_t size = 64;
+		for (size_t offset = 0; offset < 8; ++offset)
+		{
+			for (size_t n = 0; n + offset <= size; ++n)
+			{
+				std::vector<u16> a(size), b(size);
+				for (size_t k = 0; k < size; ++k)
+					a[k] = b[k] = (u16)((k * 7 + n) % 5 == 0 ? 0 : (k % 3) + 1);
+
+				Recorder ra, rb;
+				LosIncrementCounts(&a[offset], n, ra);
+				LosIncrementCountsScalar(&b[offset], n, rb);
+				TS_ASSERT(a == b);
+				TS_ASSERT(ra.indexes == rb.indexes);
+
+				ra.indexes.clear();
+				rb.indexes.clear();
+				LosDecrementCounts(&a[offset], n, ra);
+				LosDecrementCountsScalar(&b[offset], n, rb);
+				TS_ASSERT(a == b);
+				TS_ASSERT(ra.indexes == rb.indexes);
+
+				// Decrement again so some counts reach zero
+				for (size_t k = 0; k < size; ++k)
+					a[k] = b[k] = (u16)(a[k] + 1);
+				ra.indexes.clear();
+				rb.indexes.clear();
+				LosDecrementCounts(&a[offset], n, ra);
+				LosDecrementCountsScalar(&b[offset], n, rb);
+				TS_ASSERT(a == b);
+				TS_ASSERT(ra.indexes == rb.indexes);
+			}
+		}
+	}
+
+	void test_zero_crossings()
+	{
+		std::vector<u16> counts(20);
+		counts[3] = 1;
+		counts[17] = 1;
+
+		Recorder r;
+		LosIncrementCounts(&counts[0], counts.size(), r);
+		TS_ASSERT_EQUALS(r.indexes.size(), 18u);
+		TS_ASSERT_EQUALS(counts[3], 2);
+		TS_ASSERT_EQUALS(counts[4], 1);
+
+		r.indexes.clear();
+		LosDecrementCounts(&counts[0], counts.size(), r);
+		TS_ASSERT_EQUALS(r.indexes.size(), 18u);
+		TS_ASSERT_EQUALS(r.indexes[3], 4u);
+		TS_ASSERT_EQUALS(counts[3], 1);
+		TS_ASSERT_EQUALS(counts[17], 1);
+	}
+
+	void test_performance_DISABLED()
+	{
+		// Typical vision strips are a few dozen vertices wide, and mostly overlap other units' vision
+		const size_t size = 256*256;
+		const size_t strip = 40;
+		const size_t repeats = 20000;
+
+		std::vector<u16> counts(size);
+		for (size_t k = 0; k < size; ++k)
+			counts[k] = (u16)(k % 1024 < 16 ? 0 : 2); // a few unseen patches
+
+		Counter c;
+		double t = timer_Time();
+		for (size_t r = 0; r < repeats; ++r)
+		{
+			size_t start = (r * 4099) % (size - strip);
+			LosIncrementCountsScalar(&counts[start], strip, c);
+			LosDecrementCountsScalar(&counts[start], strip, c);
+		}
+		double tScalar = timer_Time() - t;
+
+		t = timer_Time();
+		for (size_t r = 0; r < repeats; ++r)
+		{
+			size_t start = (r * 4099) % (size - strip);
+			LosIncrementCounts(&counts[start], strip, c);
+			LosDecrementCounts(&counts[start], strip, c);
+		}
+		double tSimd = timer_Time() - t;
+
+		printf("\nLOS counts: scalar %f, SIMD %f (%d zero crossings)\n", tScalar, tSimd, (int)c.n);
+	}
+};
@@ -1,4 +1,4 @@
-/* Copyright (C) 2010 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -21,6 +21,7 @@
 
 #include "ps/CLogger.h"
 #include "ps/XML/Xeromyces.h"
+#include "scriptinterface/ScriptInterface.h"
 
 class TestParamNode : public CxxTest::TestSuite
 {
@@ -50,6 +51,8 @@ public:
 		TS_ASSERT_EQUALS(node.GetChild("test").GetChild("Bar").GetChild("Baz").ToInt(), 3);
 		TS_ASSERT(node.GetChild("test").GetChild("Qux").IsOk());
 		TS_ASSERT(!node.GetChild("test").GetChild("Qux").GetChild("Baz").IsOk());
+		TS_ASSERT_EQUALS(&node.GetChild(CStrIntern("test")).GetChild(CStrIntern("Foo")), &node.GetChild("test").GetChild("Foo"));
+		TS_ASSERT(!node.GetChild(CStrIntern("test")).GetChild(CStrIntern("foo")).IsOk());
 
 		CParamNode nullOne(false);
 		CParamNode nullTwo = nullOne;
@@ -148,6 +151,41 @@ public:
 		TS_ASSERT_EQUALS(node.GetChild("test").GetChild("t").ToBool(), true);
 	}
 
+	void test_script_shared()
+	{
+		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
+		JSContext* cx = script.GetContext();
+
+		CParamNode parent;
+		TS_ASSERT_EQUALS(CParamNode::LoadXMLString(parent, "<test><a><x>1</x></a><b><y>2</y></b><c z='3'/></test>"), PSRETURN_OK);
+
+		// Copies that are modified by a later layer must not share the parent's cached values
+		CParamNode child = parent;
+		TS_ASSERT_EQUALS(CParamNode::LoadXMLString(child, "<test><b><y>4</y></b><c z='5'/></test>"), PSRETURN_OK);
+
+		const CParamNode& parentTest = parent.GetChild("test");
+		const CParamNode& childTest = child.GetChild("test");
+
+		// Unmodified nodes share the same value, even if it was cached after copying
+		jsval a = childTest.GetChild("a").ToJSVal(cx, true);
+		TS_ASSERT(JSVAL_IS_OBJECT(a));
+		TS_ASSERT_EQUALS(parentTest.GetChild("a").ToJSVal(cx, true), a);
+
+		jsval parentB = parentTest.GetChild("b").ToJSVal(cx, true);
+		jsval childB = childTest.GetChild("b").ToJSVal(cx, true);
+		TS_ASSERT_DIFFERS(parentB, childB);
+		std::wstring y;
+		TS_ASSERT(script.GetProperty(childB, "y", y));
+		TS_ASSERT_WSTR_EQUALS(y, L"4");
+
+		// Nodes with only attributes changed are not shared either
+		jsval childC = childTest.GetChild("c").ToJSVal(cx, true);
+		TS_ASSERT_DIFFERS(parentTest.GetChild("c").ToJSVal(cx, true), childC);
+		std::wstring z;
+		TS_ASSERT(script.GetProperty(childC, "@z", z));
+		TS_ASSERT_WSTR_EQUALS(z, L"5");
+	}
+
 	void test_escape()
 	{
 		TS_ASSERT_WSTR_EQUALS(CParamNode::EscapeXMLString(L"test"), L"test");
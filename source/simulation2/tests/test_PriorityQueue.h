@@ -0,0 +1,190 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "lib/timer.h"
+#include "simulation2/helpers/PriorityQueue.h"
+
+class TestPriorityQueue : public CxxTest::TestSuite
+{
+	typedef std::pair<u16, u16> TileID;
+	typedef PriorityQueueHeap<TileID, u32> Heap;
+	typedef PriorityQueueList<TileID, u32> List;
+	typedef PriorityQueueIndexedHeap<TileID, u32, TileIDIndexer> IndexedHeap;
+	typedef PriorityQueueIndexedHeap<TileID, u32, TileIDIndexer, std::less<u32>, 2> IndexedBinaryHeap;
+
+	static const u16 W = 64;
+
+	/**
+	 * Run a Dijkstra-like fill of a W*W grid with pseudo-random edge costs,
+	 * returning the order in which tiles were popped. Tiles are promoted when
+	 * a cheaper route is found, so this exercises push, find, promote and pop.
+	 */
+	template<typename Q>
+	static std::vector<TileID> Fill(Q& queue)
+	{
+		std::vector<u32> cost(W*W, std::numeric_limits<u32>::max());
+		std::vector<bool> closed(W*W, false);
+		std::vector<TileID> order;
+
+		typename Q::Item start = { std::make_pair(W/2, W/2), 0 };
+		cost[start.id.second*W + start.id.first] = 0;
+		queue.push(start);
+
+		while (!queue.empty())
+		{
+			typename Q::Item curr = queue.pop();
+			u16 i = curr.id.first, j = curr.id.second;
+			closed[j*W + i] = true;
+			order.push_back(curr.id);
+
+			for (int dj = -1; dj <= 1; ++dj)
+			{
+				for (int di = -1; di <= 1; ++di)
+				{
+					int ni = i + di, nj = j + dj;
+					if ((di == 0 && dj == 0) || ni < 0 || nj < 0 || ni >= W || nj >= W || closed[nj*W + ni])
+						continue;
+
+					u32 g = curr.rank + 1 + (u32)((ni * 7 + nj * 13) % 5) * (di && dj ? 2 : 1);
+					u32& c = cost[nj*W + ni];
+					if (g >= c)
+						continue;
+					TileID id = std::make_pair((u16)ni, (u16)nj);
+					if (c != std::numeric_limits<u32>::max())
+					{
+						TS_ASSERT(queue.find(id));
+						queue.promote(id, g);
+					}
+					else
+					{
+						typename Q::Item t = { id, g };
+						queue.push(t);
+					}
+					c = g;
+				}
+			}
+		}
+		return order;
+	}
+
+public:
+	void test_basic()
+	{
+		IndexedHeap queue;
+		queue.reset(16, TileIDIndexer(4));
+		TS_ASSERT(queue.empty());
+
+		IndexedHeap::Item a = { std::make_pair(1, 0), 30 };
+		IndexedHeap::Item b = { std::make_pair(2, 3), 10 };
+		IndexedHeap::Item c = { std::make_pair(3, 1), 20 };
+		queue.push(a);
+		queue.push(b);
+		queue.push(c);
+		TS_ASSERT_EQUALS(queue.size(), 3u);
+		TS_ASSERT(queue.find(std::make_pair(1, 0)));
+		TS_ASSERT(!queue.find(std::make_pair(0, 1)));
+
+		queue.promote(std::make_pair(1, 0), 5);
+		TS_ASSERT_EQUALS(queue.find(std::make_pair(1, 0))->rank, 5u);
+
+		TS_ASSERT(queue.pop().id == TileID(1, 0));
+		TS_ASSERT(!queue.find(std::make_pair(1, 0)));
+		TS_ASSERT(queue.pop().id == TileID(3, 1));
+		TS_ASSERT(queue.pop().id == TileID(2, 3));
+		TS_ASSERT(queue.empty());
+
+		// Popped items can be pushed again
+		queue.push(a);
+		TS_ASSERT(queue.pop().id == TileID(1, 0));
+	}
+
+	void test_max_heap()
+	{
+		PriorityQueueIndexedHeap<TileID, u32, TileIDIndexer, std::greater<u32> > queue;
+		queue.reset(16, TileIDIndexer(4));
+		for (u16 n = 0; n < 16; ++n)
+		{
+			PriorityQueueIndexedHeap<TileID, u32, TileIDIndexer, std::greater<u32> >::Item t = { std::make_pair((u16)(n % 4), (u16)(n / 4)), (u32)((n * 5) % 16) };
+			queue.push(t);
+		}
+		queue.promote(std::make_pair(0, 0), 100);
+		TS_ASSERT_EQUALS(queue.pop().rank, 100u);
+		for (u32 r = 15; r > 0; --r)
+			TS_ASSERT_EQUALS(queue.pop().rank, r);
+		TS_ASSERT(queue.empty());
+	}
+
+	void test_matches_heap()
+	{
+		// All the variants use the same tie-breaking, so should pop in exactly the same order
+		Heap heap;
+		List list;
+		IndexedHeap indexed;
+		indexed.reset(W*W, TileIDIndexer(W));
+		IndexedBinaryHeap binary;
+		binary.reset(W*W, TileIDIndexer(W));
+
+		std::vector<TileID> expected = Fill(heap);
+		TS_ASSERT_EQUALS(expected.size(), (size_t)W*W);
+		TS_ASSERT(Fill(list) == expected);
+		TS_ASSERT(Fill(indexed) == expected);
+		TS_ASSERT(Fill(binary) == expected);
+	}
+
+	void test_performance_DISABLED()
+	{
+		const size_t repeats = 20;
+
+		double t = timer_Time();
+		for (size_t r = 0; r < repeats; ++r)
+		{
+			Heap heap;
+			Fill(heap);
+		}
+		double tHeap = timer_Time() - t;
+
+		t = timer_Time();
+		for (size_t r = 0; r < repeats; ++r)
+		{
+			List list;
+			Fill(list);
+		}
+		double tList = timer_Time() - t;
+
+		t = timer_Time();
+		for (size_t r = 0; r < repeats; ++r)
+		{
+			IndexedBinaryHeap binary;
+			binary.reset(W*W, TileIDIndexer(W));
+			Fill(binary);
+		}
+		double tBinary = timer_Time() - t;
+
+		t = timer_Time();
+		for (size_t r = 0; r < repeats; ++r)
+		{
+			IndexedHeap indexed;
+			indexed.reset(W*W, TileIDIndexer(W));
+			Fill(indexed);
+		}
+		double tIndexed = timer_Time() - t;
+
+		printf("\nPriority queues: heap %f, list %f, indexed 2-ary %f, indexed 4-ary %f\n", tHeap, tList, tBinary, tIndexed);
+	}
+};
@@ -0,0 +1,173 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "simulation2/scripting/ScriptDelta.h"
+
+#include "ps/CLogger.h"
+
+class TestScriptDelta : public CxxTest::TestSuite
+{
+	std::string ToSource(ScriptInterface& script, CScriptVal val)
+	{
+		std::string source;
+		TS_ASSERT(script.CallFunction(val.get(), "toSource", source));
+		return source;
+	}
+
+	/**
+	 * Encodes the value (in script1), applies it to the decoder (in script2), and checks
+	 * the decoded value matches. Returns the source of the delta.
+	 */
+	std::string Transfer(ScriptInterface& script1, ScriptInterface& script2,
+		CScriptDeltaEncoder& encoder, CScriptDeltaDecoder& decoder, const char* code)
+	{
+		CScriptVal val;
+		TS_ASSERT(script1.Eval(code, val));
+
+		CScriptVal delta = encoder.Encode(script1, val);
+		TS_ASSERT(decoder.Apply(script2, script2.CloneValueFromOtherContext(script1, delta.get())));
+		TS_ASSERT_STR_EQUALS(ToSource(script2, decoder.GetValue()), ToSource(script1, val));
+
+		return ToSource(script1, delta);
+	}
+
+public:
+	void test_basic()
+	{
+		ScriptInterface script1("Test", "Test", ScriptInterface::CreateRuntime());
+		ScriptInterface script2("Test", "Test", ScriptInterface::CreateRuntime());
+		CScriptDeltaEncoder encoder(3);
+		CScriptDeltaDecoder decoder;
+
+		TS_ASSERT_STR_EQUALS(Transfer(script1, script2, encoder, decoder,
+			"({turn: 1, entities: {1: {hp: 100, pos: [1, 2]}, 2: {hp: 50, pos: [3, 4]}}})"),
+			"({value:{turn:1, entities:{1:{hp:100, pos:[1, 2]}, 2:{hp:50, pos:[3, 4]}}}})");
+
+		// Unchanged values send nothing
+		TS_ASSERT_STR_EQUALS(Transfer(script1, script2, encoder, decoder,
+			"({turn: 1, entities: {1: {hp: 100, pos: [1, 2]}, 2: {hp: 50, pos: [3, 4]}}})"),
+			"({changes:{}})");
+
+		// Changes are sent just for the changed properties
+		TS_ASSERT_STR_EQUALS(Transfer(script1, script2, encoder, decoder,
+			"({turn: 2, entities: {1: {hp: 100, pos: [1, 2]}, 2: {hp: 40, pos: [3, 4]}}})"),
+			"({changes:{set:{turn:2}, nested:{entities:{nested:{2:{set:{hp:40}}}}}}})");
+
+		// Arrays are sent as a whole
+		TS_ASSERT_STR_EQUALS(Transfer(script1, script2, encoder, decoder,
+			"({turn: 2, entities: {1: {hp: 100, pos: [1, 3]}, 2: {hp: 40, pos: [3, 4]}}})"),
+			"({changes:{nested:{entities:{nested:{1:{set:{pos:[1, 3]}}}}}}})");
+
+		// Removed properties
+		TS_ASSERT_STR_EQUALS(Transfer(script1, script2, encoder, decoder,
+			"({turn: 2, entities: {1: {pos: [1, 3]}}})"),
+			"({changes:{nested:{entities:{remove:[\"2\"], nested:{1:{remove:[\"hp\"]}}}}}})");
+	}
+
+	void test_order()
+	{
+		ScriptInterface script1("Test", "Test", ScriptInterface::CreateRuntime());
+		ScriptInterface script2("Test", "Test", ScriptInterface::CreateRuntime());
+		CScriptDeltaEncoder encoder(3);
+		CScriptDeltaDecoder decoder;
+
+		Transfer(script1, script2, encoder, decoder, "({a: {x: 1, y: 2}, b: 2})");
+
+		// Added and reordered properties must end up in the same order as the original
+		Transfer(script1, script2, encoder, decoder, "({a: {x: 1, y: 2}, c: 3, b: 2})");
+		Transfer(script1, script2, encoder, decoder, "({b: 2, a: {y: 2, x: 1}, c: 3})");
+		Transfer(script1, script2, encoder, decoder, "({b: 2, a: {y: 3, z: 1, x: 1}})");
+	}
+
+	void test_types()
+	{
+		ScriptInterface script1("Test", "Test", ScriptInterface::CreateRuntime());
+		ScriptInterface script2("Test", "Test", ScriptInterface::CreateRuntime());
+		CScriptDeltaEncoder encoder(3);
+		CScriptDeltaDecoder decoder;
+
+		Transfer(script1, script2, encoder, decoder, "({a: 1, b: 'x', c: null, d: undefined, e: true, f: {g: [1, {h: 2}]}})");
+
+		// Values of different types must be detected as changes
+		TS_ASSERT_STR_EQUALS(Transfer(script1, script2, encoder, decoder,
+			"({a: '1', b: 'x', c: undefined, d: null, e: 1, f: {g: [1, {h: 3}]}})"),
+			"({changes:{set:{a:\"1\", c:(void 0), d:null, e:1}, nested:{f:{set:{g:[1, {h:3}]}}}}})");
+
+		// Ints and doubles with the same value are equal
+		TS_ASSERT_STR_EQUALS(Transfer(script1, script2, encoder, decoder,
+			"({a: '1', b: 'x', c: undefined, d: null, e: 0.5*2, f: {g: [1, {h: 3}]}})"),
+			"({changes:{}})");
+
+		// Replacing the root with a non-object sends the whole value
+		TS_ASSERT_STR_EQUALS(Transfer(script1, script2, encoder, decoder, "[1, 2]"), "({value:[1, 2]})");
+		Transfer(script1, script2, encoder, decoder, "({a: 1})");
+	}
+
+	void test_reset()
+	{
+		ScriptInterface script1("Test", "Test", ScriptInterface::CreateRuntime());
+		ScriptInterface script2("Test", "Test", ScriptInterface::CreateRuntime());
+		CScriptDeltaEncoder encoder(3);
+		CScriptDeltaDecoder decoder;
+
+		Transfer(script1, script2, encoder, decoder, "({a: 1})");
+
+		encoder.Reset();
+		decoder.Reset();
+		TS_ASSERT_STR_EQUALS(Transfer(script1, script2, encoder, decoder, "({a: 1})"), "({value:{a:1}})");
+
+		// Deltas can't be applied without a previous value
+		CScriptVal val;
+		TS_ASSERT(script1.Eval("({a: 2})", val));
+		CScriptVal delta = encoder.Encode(script1, val);
+		decoder.Reset();
+		TestLogger logger;
+		TS_ASSERT(!decoder.Apply(script2, script2.CloneValueFromOtherContext(script1, delta.get())));
+		TS_ASSERT_WSTR_CONTAINS(logger.GetOutput(), L"Invalid script value delta");
+	}
+
+	std::string ChangedEntities(ScriptInterface& script, CScriptDeltaEncoder& encoder, const char* code)
+	{
+		CScriptVal val;
+		TS_ASSERT(script.Eval(code, val));
+		CScriptVal delta = encoder.Encode(script, val);
+
+		std::vector<std::wstring> changed;
+		if (!CScriptDeltaDecoder::GetChangedProperties(script, delta, L"entities", changed))
+			return "all";
+		std::string ret;
+		for (size_t i = 0; i < changed.size(); ++i)
+			ret += (i ? " " : "") + CStrW(changed[i]).ToUTF8();
+		return ret;
+	}
+
+	void test_changed_properties()
+	{
+		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
+		CScriptDeltaEncoder encoder(3);
+
+		TS_ASSERT_STR_EQUALS(ChangedEntities(script, encoder, "({turn: 1, entities: {1: {hp: 100}, 2: {hp: 50}}})"), "all");
+		TS_ASSERT_STR_EQUALS(ChangedEntities(script, encoder, "({turn: 1, entities: {1: {hp: 100}, 2: {hp: 50}}})"), "");
+		TS_ASSERT_STR_EQUALS(ChangedEntities(script, encoder, "({turn: 2, entities: {1: {hp: 100}, 2: {hp: 50}}})"), "");
+		TS_ASSERT_STR_EQUALS(ChangedEntities(script, encoder, "({turn: 2, entities: {1: {hp: 90}, 2: {hp: 50}}})"), "1");
+		TS_ASSERT_STR_EQUALS(ChangedEntities(script, encoder, "({turn: 2, entities: {2: {hp: 50}, 3: {hp: 10}}})"), "1 3");
+		TS_ASSERT_STR_EQUALS(ChangedEntities(script, encoder, "({turn: 2, entities: 4})"), "all");
+		TS_ASSERT_STR_EQUALS(ChangedEntities(script, encoder, "({turn: 2})"), "all");
+	}
+};
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -21,6 +21,7 @@
 #include "simulation2/serialization/HashSerializer.h"
 #include "simulation2/serialization/StdSerializer.h"
 #include "simulation2/serialization/StdDeserializer.h"
+#include "simulation2/serialization/SerializeTemplates.h"
 #include "scriptinterface/ScriptInterface.h"
 
 #include "graphics/MapReader.h"
@@ -236,10 +237,87 @@ public:
 		TS_ASSERT_EQUALS(stream.peek(), EOF);
 	}
 
+	void test_Buffer_types()
+	{
+		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
+
+		std::stringstream stream;
+		CStdSerializer serializeStd(script, stream);
+		serialize_types(serializeStd);
+
+		// The buffer serializer must produce the same data, appended to the buffer,
+		// including anything written through its stream
+		std::string buffer = "prefix";
+		CBufferSerializer serialize(script, buffer);
+		serialize_types(serialize);
+		static_cast<ISerializer&>(serialize).GetStream() << "stream";
+		stream << "stream";
+
+		TS_ASSERT_EQUALS(buffer.substr(0, 6), "prefix");
+		TS_ASSERT_EQUALS(buffer.substr(6), stream.str());
+	}
+
+	void test_Buffer_deserialize()
+	{
+		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
+
+		std::string buffer;
+		CBufferSerializer serialize(script, buffer);
+		serialize.NumberI32_Unbounded("x", -123);
+		serialize.StringASCII("string", "example", 0, 255);
+
+		// Read directly from the buffer, and make sure we can't read past its end
+		CBufferStreamBuf streamBuf(buffer.data(), buffer.size());
+		std::istream stream(&streamBuf);
+		CStdDeserializer deserialize(script, stream);
+		int32_t n;
+		std::string str;
+		u8 c;
+
+		deserialize.NumberI32_Unbounded("x", n);
+		TS_ASSERT_EQUALS(n, -123);
+		deserialize.StringASCII("string", str, 0, 255);
+		TS_ASSERT_STR_EQUALS(str, "example");
+
+		TS_ASSERT_EQUALS(stream.peek(), EOF);
+		TS_ASSERT_THROWS(deserialize.NumberU8_Unbounded("c", c), PSERROR_Deserialize_ReadFailed);
+	}
+
+	void test_repetitive_vector()
+	{
+		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
+		std::stringstream stream;
+		CStdSerializer serialize(script, stream);
+
+		std::vector<u32> in;
+		in.resize(1000, 5);
+		in[500] = 7;
+		in.push_back(9);
+		SerializeRepetitiveVector<SerializeU32_Unbounded>()(serialize, "vec", in);
+
+		// Length, then (run, value) pairs for the four runs
+		TS_ASSERT_EQUALS(stream.str().size(), (size_t)(4 + 4*8));
+
+		CStdDeserializer deserialize(script, stream);
+		std::vector<u32> out;
+		SerializeRepetitiveVector<SerializeU32_Unbounded>()(deserialize, "vec", out);
+		TS_ASSERT(out == in);
+		TS_ASSERT_EQUALS(stream.peek(), EOF);
+
+		// Runs must not extend past the vector's length
+		std::stringstream bad;
+		CStdSerializer badSerialize(script, bad);
+		badSerialize.NumberU32_Unbounded("length", 2);
+		badSerialize.NumberU32_Unbounded("run", 3);
+		badSerialize.NumberU32_Unbounded("value", 1);
+		CStdDeserializer badDeserialize(script, bad);
+		TS_ASSERT_THROWS(SerializeRepetitiveVector<SerializeU32_Unbounded>()(badDeserialize, "vec", out), PSERROR_Deserialize_OutOfBounds);
+	}
+
 	void test_Hash_basic()
 	{
 		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
-		CHashSerializer serialize(script);
+		CHashSerializer serialize(script, STATE_HASH_MD5);
 
 		serialize.NumberI32_Unbounded("x", -123);
 		serialize.NumberU32_Unbounded("y", 1234);
@@ -250,6 +328,20 @@ public:
 		// echo -en "\x85\xff\xff\xff\xd2\x04\x00\x00\x39\x30\x00\x00" | openssl md5 | perl -pe 's/(..)/\\x$1/g'
 	}
 
+	void test_Hash_murmur3()
+	{
+		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
+		CHashSerializer serialize(script, STATE_HASH_MURMUR3);
+
+		serialize.NumberI32_Unbounded("x", -123);
+		serialize.NumberU32_Unbounded("y", 1234);
+		serialize.NumberI32("z", 12345, 0, 65535);
+
+		TS_ASSERT_EQUALS(serialize.GetHashLength(), (size_t)16);
+		TS_ASSERT_SAME_DATA(serialize.ComputeHash(), "\xf0\x81\x76\x54\x39\x76\x7b\x42\x7d\x26\xdd\xba\x72\x68\x3d\x29", 16);
+		// (MurmurHash3_x64_128 with seed 0 of the same bytes as test_Hash_basic)
+	}
+
 	void test_bounds()
 	{
 		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
@@ -295,31 +387,31 @@ public:
 
 			serialize.ScriptVal("script", obj);
 
-			TS_ASSERT_STREAM(stream, 119,
+			TS_ASSERT_STREAM(stream, 159,
 					"\x03" // SCRIPT_TYPE_OBJECT
 					"\x02\0\0\0" // num props
-					"\x01\0\0\0" "x\0" // "x"
+					"\0\0\0\0" "\x01\0\0\0" "x\0" // new prop name "x"
 					"\x05" // SCRIPT_TYPE_INT
 					"\x7b\0\0\0" // 123
-					"\x01\0\0\0" "y\0" // "y"
+					"\0\0\0\0" "\x01\0\0\0" "y\0" // new prop name "y"
 					"\x02" // SCRIPT_TYPE_ARRAY
 					"\x08\0\0\0" // array length
 					"\x08\0\0\0" // num props
-					"\x01\0\0\0" "0\0" // "0"
+					"\0\0\0\0" "\x01\0\0\0" "0\0" // "0"
 					"\x05" "\x01\0\0\0" // SCRIPT_TYPE_INT 1
-					"\x01\0\0\0" "1\0" // "1"
+					"\0\0\0\0" "\x01\0\0\0" "1\0" // "1"
 					"\x06" "\0\0\0\0\0\0\xf8\x3f" // SCRIPT_TYPE_DOUBLE 1.5
-					"\x01\0\0\0" "2\0" // "2"
+					"\0\0\0\0" "\x01\0\0\0" "2\0" // "2"
 					"\x04" "\x01\0\0\0" "2\0" // SCRIPT_TYPE_STRING "2"
-					"\x01\0\0\0" "3\0" // "3"
+					"\0\0\0\0" "\x01\0\0\0" "3\0" // "3"
 					"\x04" "\x04\0\0\0" "t\0e\0s\0t\0" // SCRIPT_TYPE_STRING "test"
-					"\x01\0\0\0" "4\0" // "4"
+					"\0\0\0\0" "\x01\0\0\0" "4\0" // "4"
 					"\x00" // SCRIPT_TYPE_VOID
-					"\x01\0\0\0" "5\0" // "5"
+					"\0\0\0\0" "\x01\0\0\0" "5\0" // "5"
 					"\x01" // SCRIPT_TYPE_NULL
-					"\x01\0\0\0" "6\0" // "6"
+					"\0\0\0\0" "\x01\0\0\0" "6\0" // "6"
 					"\x07" "\x01" // SCRIPT_TYPE_BOOLEAN true
-					"\x01\0\0\0" "7\0" // "7"
+					"\0\0\0\0" "\x01\0\0\0" "7\0" // "7"
 					"\x07" "\x00" // SCRIPT_TYPE_BOOLEAN false
 			);
 
@@ -408,23 +500,77 @@ public:
 
 	void test_script_numbers()
 	{
-		const char stream[] = "\x02" // SCRIPT_TYPE_ARRAY
-					"\x04\0\0\0" // num props
+		const char stream[] = "\x0a" // SCRIPT_TYPE_ARRAY_DOUBLE
 					"\x04\0\0\0" // array length
-					"\x01\0\0\0" "0\0" // "0"
-					"\x05" "\0\0\0\x80" // SCRIPT_TYPE_INT -2147483648 (JS_INT_MIN)
-					"\x01\0\0\0" "1\0" // "1"
-					"\x06" "\0\0\x20\0\0\0\xE0\xC1" // SCRIPT_TYPE_DOUBLE -2147483649 (JS_INT_MIN-1)
-					"\x01\0\0\0" "2\0" // "2"
-					"\x05" "\xFF\xFF\xFF\x7F" // SCRIPT_TYPE_INT 2147483647 (JS_INT_MAX)
-					"\x01\0\0\0" "3\0" // "3"
-					"\x06" "\0\0\0\0\0\0\xE0\x41" // SCRIPT_TYPE_DOUBLE 2147483648 (JS_INT_MAX+1)
+					"\0\0\0\0\0\0\xE0\xC1" // -2147483648 (JS_INT_MIN)
+					"\0\0\x20\0\0\0\xE0\xC1" // -2147483649 (JS_INT_MIN-1)
+					"\0\0\xC0\xFF\xFF\xFF\xDF\x41" // 2147483647 (JS_INT_MAX)
+					"\0\0\0\0\0\0\xE0\x41" // 2147483648 (JS_INT_MAX+1)
 		;
 
 		helper_script_roundtrip("numbers", "[-2147483648, -2147483649, 2.147483647e+9, 2147483648]",
 				"[-2147483648, -2147483649, 2147483647, 2147483648]", sizeof(stream) - 1, stream);
 	}
 
+	void test_script_dense_arrays()
+	{
+		const char stream[] = "\x02" // SCRIPT_TYPE_ARRAY
+					"\x02\0\0\0" // array length
+					"\x02\0\0\0" // num props
+					"\0\0\0\0" "\x01\0\0\0" "0\0" // new prop name "0"
+					"\x09" // SCRIPT_TYPE_ARRAY_INT32
+					"\x03\0\0\0" // array length
+					"\x01\0\0\0" "\xFF\xFF\xFF\xFF" "\x00\0\0\x40" // 1, -1, 2^30
+					"\0\0\0\0" "\x01\0\0\0" "1\0" // new prop name "1"
+					"\x0a" // SCRIPT_TYPE_ARRAY_DOUBLE
+					"\x02\0\0\0" // array length
+					"\0\0\0\0\0\0\xf8\x3f" "\0\0\0\0\0\0\0\x40" // 1.5, 2
+		;
+
+		helper_script_roundtrip("dense", "[[1, -1, 1073741824], [1.5, 2]]", "[[1, -1, 1073741824], [1.5, 2]]", sizeof(stream) - 1, stream);
+
+		// Arrays with holes, extra properties or non-numbers use the normal format
+		helper_script_roundtrip("dense holes", "[[1, , 3], [1, 2, ,]]", "[[1, , 3], [1, 2, ,]]");
+		helper_script_roundtrip("dense props", "var a = [1, 2]; a.x = 3; a", "[1, 2]"); // (toSource doesn't show x)
+		helper_script_roundtrip("dense mixed", "[[1, '2'], [true], [null], []]", "[[1, \"2\"], [true], [null], []]");
+		helper_script_roundtrip("dense nonfinite", "[NaN, Infinity, -0]", "[NaN, Infinity, -0]");
+	}
+
+	void test_script_prop_names()
+	{
+		const char stream[] = "\x02" // SCRIPT_TYPE_ARRAY
+					"\x02\0\0\0" // array length
+					"\x02\0\0\0" // num props
+					"\0\0\0\0" "\x01\0\0\0" "0\0" // new prop name "0" (id 1)
+					"\x03" // SCRIPT_TYPE_OBJECT
+					"\x01\0\0\0" // num props
+					"\0\0\0\0" "\x03\0\0\0" "a\0b\0c\0" // new prop name "abc" (id 2)
+					"\x03" // SCRIPT_TYPE_OBJECT
+					"\x01\0\0\0" // num props
+					"\x02\0\0\0" // prop name id 2 ("abc")
+					"\x05" "\x01\0\0\0" // SCRIPT_TYPE_INT 1
+					"\0\0\0\0" "\x01\0\0\0" "1\0" // new prop name "1" (id 3)
+					"\x03" // SCRIPT_TYPE_OBJECT
+					"\x01\0\0\0" // num props
+					"\x02\0\0\0" // prop name id 2 ("abc")
+					"\x05" "\x02\0\0\0" // SCRIPT_TYPE_INT 2
+		;
+
+		helper_script_roundtrip("prop names", "[{abc: {abc: 1}}, {abc: 2}]", "[{abc:{abc:1}}, {abc:2}]", sizeof(stream) - 1, stream);
+	}
+
+	void test_script_prop_names_nested()
+	{
+		// Each level reads a new property name and then a value that adds
+		// many more, so the name table grows while that name is in use
+		std::string obj = "{a0:1}";
+		for (int i = 1; i <= 200; ++i)
+			obj = "{p" + CStr::FromInt(i) + ":" + obj + ", q" + CStr::FromInt(i) + ":" + CStr::FromInt(i) + "}";
+
+		std::string input = "(" + obj + ")";
+		helper_script_roundtrip("nested prop names", input.c_str(), input.c_str());
+	}
+
 	void test_script_exceptions()
 	{
 		ScriptInterface script("Test", "Test", ScriptInterface::CreateRuntime());
@@ -538,6 +684,28 @@ public:
 		t = timer_Time() - t;
 		debug_printf(L"# time = %f (%f/%d)\n", t/reps, t, (int)reps);
 
+		// Compare the raw throughput of the hash functions on the serialized state,
+		// fed in the small pieces that the serializer typically produces
+		std::stringstream stateStream;
+		sim2.SerializeState(stateStream);
+		std::string state = stateStream.str();
+		StateHashFunction funcs[] = { STATE_HASH_MD5, STATE_HASH_MURMUR3 };
+		const wchar_t* funcNames[] = { L"md5", L"murmur3" };
+		for (size_t f = 0; f < ARRAY_SIZE(funcs); ++f)
+		{
+			ScriptInterface& script = sim2.GetScriptInterface();
+			double tf = timer_Time();
+			for (size_t i = 0; i < reps; ++i)
+			{
+				CHashSerializer serializer(script, funcs[f]);
+				for (size_t j = 0; j + 4 <= state.size(); j += 4)
+					serializer.RawBytes("data", (const u8*)state.data() + j, 4);
+				serializer.ComputeHash();
+			}
+			tf = timer_Time() - tf;
+			debug_printf(L"# %ls = %f MB/s\n", funcNames[f], reps*state.size() / tf / 1e6);
+		}
+
 		// Shut down the world
 		g_VFS.reset();
 		CXeromyces::Terminate();
@@ -0,0 +1,158 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lib/self_test.h"
+
+#include "simulation2/serialization/ISerializer.h"
+#include "simulation2/serialization/IDeserializer.h"
+#include "simulation2/helpers/Spatial.h"
+
+class TestSpatial : public CxxTest::TestSuite
+{
+	static CFixedVector2D Pos(int x, int z)
+	{
+		return CFixedVector2D(entity_pos_t::FromInt(x), entity_pos_t::FromInt(z));
+	}
+
+	static std::vector<u32> Sorted(std::vector<u32> items)
+	{
+		std::sort(items.begin(), items.end());
+		return items;
+	}
+
+public:
+	void test_basic()
+	{
+		SpatialSubdivision<u32> subdiv;
+		subdiv.Reset(entity_pos_t::FromInt(100), entity_pos_t::FromInt(100), entity_pos_t::FromInt(10));
+
+		subdiv.Add(1, Pos(5, 5));
+		subdiv.Add(2, Pos(15, 5));
+		subdiv.Add(3, Pos(10, 10)); // on the corner of four divisions
+		subdiv.Add(4, Pos(0, 40), Pos(30, 60)); // spanning many divisions
+		subdiv.Add(5, Pos(95, 95));
+
+		std::vector<u32> items;
+		subdiv.GetInRange(items, Pos(1, 1), Pos(2, 2));
+		TS_ASSERT_EQUALS(Sorted(items).size(), 2u);
+		TS_ASSERT_EQUALS(Sorted(items)[0], 1u);
+		TS_ASSERT_EQUALS(Sorted(items)[1], 3u);
+
+		// Each item is only returned once, however many divisions it's in
+		items.clear();
+		subdiv.GetInRange(items, Pos(0, 0), Pos(80, 80));
+		std::vector<u32> expected;
+		expected.push_back(1);
+		expected.push_back(2);
+		expected.push_back(3);
+		expected.push_back(4);
+		TS_ASSERT_EQUALS(Sorted(items), expected);
+
+		// Results are appended to the output
+		subdiv.GetNear(items, Pos(95, 95), entity_pos_t::FromInt(1));
+		TS_ASSERT_EQUALS(items.size(), 5u);
+		TS_ASSERT_EQUALS(items.back(), 5u);
+
+		subdiv.Remove(4, Pos(0, 40), Pos(30, 60));
+		subdiv.Move(3, Pos(10, 10), Pos(50, 50));
+		items.clear();
+		subdiv.GetInRange(items, Pos(0, 0), Pos(100, 100));
+		expected.pop_back();
+		expected.push_back(5);
+		TS_ASSERT_EQUALS(Sorted(items), expected);
+
+		items.clear();
+		subdiv.GetInRange(items, Pos(0, 40), Pos(30, 60));
+		TS_ASSERT(items.empty());
+	}
+
+	void test_many()
+	{
+		// Enough items to make the duplicate-removal table grow
+		SpatialSubdivision<u32> subdiv;
+		subdiv.Reset(entity_pos_t::FromInt(256), entity_pos_t::FromInt(256), entity_pos_t::FromInt(8));
+
+		for (u32 n = 0; n < 1000; ++n)
+			subdiv.Add(n, Pos(n % 50, n / 50), Pos(n % 50 + 20, n / 50 + 20));
+
+		std::vector<u32> items;
+		for (int k = 0; k < 3; ++k)
+		{
+			items.clear();
+			subdiv.GetInRange(items, Pos(0, 0), Pos(256, 256));
+			std::vector<u32> sorted = Sorted(items);
+			TS_ASSERT_EQUALS(sorted.size(), 1000u);
+			for (u32 n = 0; n < sorted.size(); ++n)
+				TS_ASSERT_EQUALS(sorted[n], n);
+		}
+	}
+
+	void test_static()
+	{
+		// The static subdivision should find the same items as the dynamic one
+		SpatialSubdivision<u32> subdiv;
+		StaticSpatialSubdivision<u32> staticSubdiv;
+		subdiv.Reset(entity_pos_t::FromInt(256), entity_pos_t::FromInt(256), entity_pos_t::FromInt(16));
+		staticSubdiv.Reset(entity_pos_t::FromInt(256), entity_pos_t::FromInt(256), entity_pos_t::FromInt(16));
+
+		for (u32 n = 0; n < 500; ++n)
+		{
+			int x = (n * 37) % 256;
+			int z = (n * 91) % 256;
+			int size = n % 40;
+			subdiv.Add(n, Pos(x, z), Pos(x + size, z + size/2));
+			staticSubdiv.Add(n, Pos(x, z), Pos(x + size, z + size/2));
+		}
+
+		// Nothing is visible until it's built
+		std::vector<u32> items;
+		staticSubdiv.GetInRange(items, Pos(0, 0), Pos(256, 256));
+		TS_ASSERT(items.empty());
+
+		staticSubdiv.Build();
+
+		for (int k = 0; k < 100; ++k)
+		{
+			int x = (k * 53) % 256;
+			int z = (k * 29) % 256;
+			int size = (k * 7) % 100;
+
+			std::vector<u32> expected;
+			subdiv.GetInRange(expected, Pos(x, z), Pos(x + size, z + size));
+			items.clear();
+			staticSubdiv.GetInRange(items, Pos(x, z), Pos(x + size, z + size));
+			TS_ASSERT_EQUALS(Sorted(items), Sorted(expected));
+		}
+
+		// Items in a single division are returned in the order they were added
+		staticSubdiv.Clear();
+		staticSubdiv.Add(3, Pos(1, 1));
+		staticSubdiv.Add(1, Pos(2, 2));
+		staticSubdiv.Add(2, Pos(0, 0), Pos(100, 100));
+		staticSubdiv.Build();
+		items.clear();
+		staticSubdiv.GetInRange(items, Pos(4, 4), Pos(5, 5));
+		TS_ASSERT_EQUALS(items.size(), 3u);
+		TS_ASSERT_EQUALS(items[0], 3u);
+		TS_ASSERT_EQUALS(items[1], 1u);
+		TS_ASSERT_EQUALS(items[2], 2u);
+
+		items.clear();
+		staticSubdiv.GetInRange(items, Pos(50, 50), Pos(200, 200));
+		TS_ASSERT_EQUALS(items.size(), 1u);
+	}
+};
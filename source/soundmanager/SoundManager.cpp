@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -36,6 +36,9 @@ CSoundManager* g_SoundManager = NULL;
 
 #define		SOURCE_NUM		64
 
+// Number of prefetched sounds the worker thread decodes between item updates
+#define		PREFETCHES_PER_UPDATE	4
+
 #if CONFIG2_AUDIO
 
 class CSoundManagerWorker
@@ -102,6 +105,12 @@ public:
 		m_Items->push_back( anItem );
 	}
 
+	void QueuePrefetch(const VfsPath& itemPath)
+	{
+		CScopeLock lock(m_WorkerMutex);
+		m_Prefetches.push_back(itemPath);
+	}
+
 	void CleanupItems()
 	{
 		CScopeLock lock(m_DeadItemsMutex);
@@ -148,6 +157,24 @@ private:
 			if ( g_SoundManager->InDistress() )
 				pauseTime = 50;
 
+			// Decode a few queued sounds (without holding the lock, so the main
+			// thread isn't blocked meanwhile), and come back for more soon
+			std::vector<VfsPath> prefetches;
+			{
+				CScopeLock lock(m_WorkerMutex);
+				size_t count = std::min(m_Prefetches.size(), (size_t)PREFETCHES_PER_UPDATE);
+				prefetches.assign(m_Prefetches.begin(), m_Prefetches.begin() + count);
+				m_Prefetches.erase(m_Prefetches.begin(), m_Prefetches.begin() + count);
+				if (!m_Prefetches.empty())
+					pauseTime = 0;
+			}
+			for (size_t i = 0; i < prefetches.size(); ++i)
+			{
+				PROFILE2("prefetch sound");
+				CSoundData::PrefetchSoundData(prefetches[i]);
+				AL_CHECK
+			}
+
 			{
 				CScopeLock lock(m_WorkerMutex);
 		
@@ -208,6 +235,7 @@ private:
 	// These variables are all protected by m_WorkerMutex
 	ItemsList* m_Items;
 	ItemsList* m_DeadItems;
+	std::vector<VfsPath> m_Prefetches;
 
 	bool m_Enabled;
 	bool m_Shutdown;
@@ -412,6 +440,11 @@ ALuint CSoundManager::GetALSource( ISoundItem* anItem)
 	return 0;
 }
 
+size_t CSoundManager::GetFreeSourceCount()
+{
+	return m_SourceCOunt < SOURCE_NUM ? (size_t)(SOURCE_NUM - m_SourceCOunt) : 0;
+}
+
 void CSoundManager::ReleaseALSource(ALuint theSource)
 {
 	for ( int x=0; x<SOURCE_NUM;x++)
@@ -502,6 +535,12 @@ ISoundItem* CSoundManager::ItemForData(CSoundData* itemData)
 	return answer;
 }
 
+void CSoundManager::PrefetchItem(const VfsPath& itemPath)
+{
+	if (m_Worker)
+		m_Worker->QueuePrefetch(itemPath);
+}
+
 void CSoundManager::IdleTask()
 {
 	AL_CHECK
@@ -514,6 +553,8 @@ void CSoundManager::IdleTask()
 	if (m_Worker)
 		m_Worker->CleanupItems();
 	AL_CHECK
+	CSoundData::TrimCache();
+	AL_CHECK
 }
 
 ISoundItem*	CSoundManager::ItemForEntity( entity_id_t source, CSoundData* sndData)
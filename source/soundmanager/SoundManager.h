@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -82,6 +82,12 @@ public:
 
 	ISoundItem* LoadItem(const VfsPath& itemPath);
 	ISoundItem* ItemForData(CSoundData* itemData);
+
+	/**
+	 * Decode the given sound on the worker thread, so that a later LoadItem
+	 * of it won't have to (if it's a one-shot sound small enough to cache).
+	 */
+	void PrefetchItem(const VfsPath& itemPath);
 	ISoundItem* ItemForEntity( entity_id_t source, CSoundData* sndData);
 
 	static void ScriptingInit();
@@ -95,6 +101,8 @@ public:
 	void setSoundEnabled( bool enabled );
 
 	ALuint GetALSource(ISoundItem* anItem);
+	// Number of AL sources not currently used by any item
+	size_t GetFreeSourceCount();
 	void ReleaseALSource(ALuint theSource);
 	ISoundItem* ItemFromData(CSoundData* itemData);
 
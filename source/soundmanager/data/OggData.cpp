@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -119,6 +119,7 @@ int COggData::FetchDataIntoBuffer(int count, ALuint* buffers)
 		{
 			buffersWritten++;
 			alBufferData(buffers[i], m_Format, pcmout, (ALsizei)totalRet, (int)m_Frequency);
+			m_DataSize += (size_t)totalRet;
 		}
 	}
 	delete[] pcmout;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -22,12 +22,28 @@
 #if CONFIG2_AUDIO
 
 #include "OggData.h"
+#include "lib/alignment.h"
 #include "ps/CLogger.h"
+#include "ps/ThreadUtil.h"
 
 #include <iostream>
+#include <list>
 
 DataMap* CSoundData::sSoundData = NULL;
 
+// Decoded one-shot sounds stay in sSoundData after their last user has released them,
+// until they've used up this much memory (so frequently played effects aren't decoded
+// every time), and are then deleted in least recently used order
+static const size_t IDLE_CACHE_SIZE = 16*MiB;
+
+// Unreferenced sounds in sSoundData, most recently used first, and their total size
+static std::list<CSoundData*> g_IdleSoundData;
+static size_t g_IdleSoundDataSize = 0;
+
+// Protects sSoundData and g_IdleSoundData, which the worker thread adds prefetched
+// sounds to. (Only the main thread changes retention counts or deletes cached data.)
+static CMutex g_SoundDataMutex;
+
 CSoundData::CSoundData()
 {
 	InitProperties();
@@ -48,49 +64,130 @@ void CSoundData::InitProperties()
 	m_ALBuffer = 0;
 	m_RetentionCount = 0;
 	m_FileName = NULL;
+	m_DataSize = 0;
 }
 
 void CSoundData::ReleaseSoundData(CSoundData* theData)
 {
-	DataMap::iterator itemFind;
+	if (!theData->DecrementCount())
+		return;
 
-	if (theData->DecrementCount())
 	{
-		if ((itemFind = CSoundData::sSoundData->find( *theData->GetFileName() )) != sSoundData->end())
+		CScopeLock lock(g_SoundDataMutex);
+
+		// Keep cached sounds around in case they're played again soon
+		DataMap::iterator itemFind;
+		if (sSoundData && (itemFind = sSoundData->find(*theData->GetFileName())) != sSoundData->end() && itemFind->second == theData)
 		{
-			CSoundData::sSoundData->erase(itemFind);
+			g_IdleSoundData.push_front(theData);
+			g_IdleSoundDataSize += theData->m_DataSize;
+			theData = NULL;
 		}
+	}
+
+	if (theData)
 		delete theData;
+	else
+		TrimCache();
+}
+
+void CSoundData::TrimCache()
+{
+	std::vector<CSoundData*> evicted;
+
+	{
+		CScopeLock lock(g_SoundDataMutex);
+		while (g_IdleSoundDataSize > IDLE_CACHE_SIZE && !g_IdleSoundData.empty())
+		{
+			CSoundData* data = g_IdleSoundData.back();
+			g_IdleSoundData.pop_back();
+			g_IdleSoundDataSize -= data->m_DataSize;
+			sSoundData->erase(*data->GetFileName());
+			evicted.push_back(data);
+		}
 	}
+
+	for (size_t i = 0; i < evicted.size(); ++i)
+		delete evicted[i];
+}
+
+CSoundData* CSoundData::AddToCache(const VfsPath& itemPath, CSoundData* data, bool idle)
+{
+	if (!data || !data->IsOneShot())
+		return data;
+
+	CSoundData* existing = NULL;
+	{
+		CScopeLock lock(g_SoundDataMutex);
+		DataMap::iterator itemFind = sSoundData->find(itemPath.string());
+		if (itemFind != sSoundData->end())
+		{
+			existing = itemFind->second;
+		}
+		else
+		{
+			(*sSoundData)[itemPath.string()] = data;
+			if (idle)
+			{
+				g_IdleSoundData.push_front(data);
+				g_IdleSoundDataSize += data->m_DataSize;
+			}
+		}
+	}
+
+	if (!existing)
+		return data;
+
+	delete data;
+	return existing;
 }
 
 CSoundData* CSoundData::SoundDataFromFile(const VfsPath& itemPath)
 {
-	if (CSoundData::sSoundData == NULL)
-		CSoundData::sSoundData = new DataMap;
-	
-	Path fExt = itemPath.Extension();
-	DataMap::iterator itemFind;
+	{
+		CScopeLock lock(g_SoundDataMutex);
+
+		if (CSoundData::sSoundData == NULL)
+			CSoundData::sSoundData = new DataMap;
+
+		DataMap::iterator itemFind = CSoundData::sSoundData->find(itemPath.string());
+		if (itemFind != sSoundData->end())
+			return itemFind->second;
+	}
+
+	// Not cached (or prefetched), so we'll have to decode it now
 	CSoundData* answer = NULL;
+	if (itemPath.Extension() == ".ogg")
+		answer = SoundDataFromOgg(itemPath);
 
+	return AddToCache(itemPath, answer, false);
+}
 
-	if ((itemFind = CSoundData::sSoundData->find(itemPath.string())) != sSoundData->end())
+void CSoundData::PrefetchSoundData(const VfsPath& itemPath)
+{
 	{
-		answer = itemFind->second;
+		CScopeLock lock(g_SoundDataMutex);
+
+		if (CSoundData::sSoundData == NULL)
+			CSoundData::sSoundData = new DataMap;
+
+		if (sSoundData->find(itemPath.string()) != sSoundData->end())
+			return;
 	}
-	else
+
+	if (itemPath.Extension() != ".ogg")
+		return;
+
+	CSoundData* data = SoundDataFromOgg(itemPath);
+
+	// Streamed sounds can't be shared, so there's no point keeping them
+	if (data && !data->IsOneShot())
 	{
-	   	if (fExt == ".ogg")
-			answer = SoundDataFromOgg(itemPath);
-	
-		if (answer && answer->IsOneShot()) 
-		{
-			(*CSoundData::sSoundData)[itemPath.string()] = answer;
-		}
-	
+		delete data;
+		return;
 	}
 
-	return answer;
+	AddToCache(itemPath, data, true);
 }
 
 bool CSoundData::IsOneShot()
@@ -136,7 +233,17 @@ void CSoundData::SetFileName(const Path& aName)
 
 CSoundData* CSoundData::IncrementCount()
 {
-	m_RetentionCount++;
+	if (m_RetentionCount++ == 0)
+	{
+		// Stop treating this as an unused cached (or prefetched) sound
+		CScopeLock lock(g_SoundDataMutex);
+		std::list<CSoundData*>::iterator it = std::find(g_IdleSoundData.begin(), g_IdleSoundData.end(), this);
+		if (it != g_IdleSoundData.end())
+		{
+			g_IdleSoundData.erase(it);
+			g_IdleSoundDataSize -= m_DataSize;
+		}
+	}
 	return this;
 }
 
@@ -147,6 +254,11 @@ bool CSoundData::DecrementCount()
 	return (m_RetentionCount <= 0);
 }
 
+size_t CSoundData::GetDataSize()
+{
+	return m_DataSize;
+}
+
 unsigned int CSoundData::GetBuffer()
 {
 	return m_ALBuffer;
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -39,6 +39,18 @@ public:
 
 	static void ReleaseSoundData(CSoundData* theData);
 
+	/**
+	 * Decode a one-shot sound into the cache, if it isn't there already, so that
+	 * SoundDataFromFile won't have to. Called by the sound manager's worker thread.
+	 */
+	static void PrefetchSoundData(const VfsPath& itemPath);
+
+	/**
+	 * Delete the least recently used unreferenced sounds until the cache fits
+	 * its memory budget. Must be called from the main thread.
+	 */
+	static void TrimCache();
+
 	CSoundData();
 	virtual ~CSoundData();
 	
@@ -48,6 +60,8 @@ public:
 	virtual bool IsOneShot();
 
 	
+	size_t GetDataSize();
+
 	virtual unsigned int GetBuffer();
 	virtual int GetBufferCount();
 	virtual CStrW* GetFileName();
@@ -56,12 +70,22 @@ public:
 	virtual unsigned int* GetBufferPtr();
 
 protected:
+	/**
+	 * Add newly decoded data to the cache, unless another thread got there first,
+	 * in which case @p data is deleted and the existing data is returned.
+	 * Cacheable data is added as unreferenced if @p idle.
+	 */
+	static CSoundData* AddToCache(const VfsPath& itemPath, CSoundData* data, bool idle);
+
 	static DataMap* sSoundData;
 
 	unsigned int m_ALBuffer;
 	int m_RetentionCount;
 	CStrW* m_FileName;
 
+	// size [bytes] of the decoded audio in our buffers
+	size_t m_DataSize;
+
 };
 
 #endif // CONFIG2_AUDIO
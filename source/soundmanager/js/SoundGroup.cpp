@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -60,7 +60,7 @@ void CSoundGroup::SetDefaultValues()
 {
 	m_index = 0;
 	m_Flags = 0;
-	m_Intensity = 0;
+	m_Intensity = 0.0f;
 	m_CurTime = 0.0f;
 
 	// sane defaults; will probably be replaced by the values read during LoadSoundGroup.
@@ -157,6 +157,44 @@ float CSoundGroup::RadiansOffCenter(const CVector3D& position, bool& onScreen, f
 	return answer;
 }
 
+bool CSoundGroup::IsAudible(const CVector3D& position, float& score)
+{
+#if CONFIG2_AUDIO
+	if (!g_SoundManager || filenames.empty())
+		return false;
+
+	float distance = 0.0f;
+	if (!TestFlag(eDistanceless) && !TestFlag(eOmnipresent))
+	{
+		bool isOnscreen;
+		float itemRollOff;
+		RadiansOffCenter(position, isOnscreen, itemRollOff);
+		if (!isOnscreen)
+			return false;
+
+		distance = (position - g_Game->GetView()->GetCamera()->GetOrientation().GetTranslation()).Length();
+	}
+
+	// Halve the importance every AUDIBLE_DISTANCE_SCALE units from the camera
+	const float AUDIBLE_DISTANCE_SCALE = 100.0f;
+	score = m_Priority / (1.0f + distance / AUDIBLE_DISTANCE_SCALE);
+	return true;
+#else // !CONFIG2_AUDIO
+	UNUSED2(position);
+	UNUSED2(score);
+	return false;
+#endif // !CONFIG2_AUDIO
+}
+
+bool CSoundGroup::IncrementIntensity()
+{
+	if (m_Intensity >= (float)m_IntensityThreshold)
+		return false;
+
+	m_Intensity += 1.0f;
+	return true;
+}
+
 void CSoundGroup::UploadPropertiesAndPlay(int theIndex, const CVector3D& position, entity_id_t source)
 {
 #if CONFIG2_AUDIO
@@ -257,6 +295,17 @@ void CSoundGroup::Reload()
 #endif // CONFIG2_AUDIO
 }
 
+void CSoundGroup::Prefetch()
+{
+#if CONFIG2_AUDIO
+	if (g_SoundManager && snd_group.empty())
+	{
+		for (size_t i = 0; i < filenames.size(); i++)
+			g_SoundManager->PrefetchItem(m_filepath/filenames[i]);
+	}
+#endif // CONFIG2_AUDIO
+}
+
 void CSoundGroup::ReleaseGroup()
 {
 #if CONFIG2_AUDIO
@@ -268,8 +317,12 @@ void CSoundGroup::ReleaseGroup()
 #endif // CONFIG2_AUDIO
 }
 
-void CSoundGroup::Update(float UNUSED(TimeSinceLastFrame))
+void CSoundGroup::Update(float TimeSinceLastFrame)
 {
+	if (m_Decay > 0.0f)
+		m_Intensity = std::max(0.0f, m_Intensity - TimeSinceLastFrame * m_IntensityThreshold / m_Decay);
+	else
+		m_Intensity = 0.0f;
 }
 
 bool CSoundGroup::LoadSoundGroup(const VfsPath& pathnameXML)
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -88,15 +88,30 @@ public:
 
 	float RadiansOffCenter(const CVector3D& position, bool& onScreen, float& itemRollOff);
 
+	// Returns false if a sound from this group at the given position couldn't be heard
+	// (i.e. it's off screen, unless the group is omnipresent or distanceless). Otherwise
+	// sets score to rank it against other sounds competing for a voice: higher is more
+	// important, based on the group's priority and the distance from the camera.
+	bool IsAudible(const CVector3D& position, float& score);
+
+	// Count another sound towards the group's intensity, returning false (and not
+	// counting it) if the threshold has already been reached - i.e. the group has
+	// played enough sounds recently that another one would just add noise.
+	bool IncrementIntensity();
+
 	// Load a group
 	bool LoadSoundGroup(const VfsPath& pathnameXML);
 
 	void Reload();
 
+	// Start decoding the group's sounds on the sound manager's worker thread,
+	// so the first PlayNext doesn't have to wait for them
+	void Prefetch();
+
 	// Release all remaining loaded handles
 	void ReleaseGroup();
 
-	// Update SoundGroup, remove dead sounds from intensity count
+	// Update SoundGroup, decaying the intensity count
 	void Update(float TimeSinceLastFrame);
 
 	// Set a flag using a value from eSndGrpFlags
@@ -124,8 +139,8 @@ private:
 	float m_CurTime; // Time elapsed since soundgroup was created
 	float m_TimeWindow; // The Intensity Threshold Window
 	size_t m_IntensityThreshold; // the allowable intensity before a sound switch	
-	size_t m_Intensity;  // our current intensity(number of sounds played since m_CurTime - m_TimeWindow) 
-	float m_Decay; // 
+	float m_Intensity;  // our current intensity (number of recent sounds, decaying by m_IntensityThreshold every m_Decay seconds)
+	float m_Decay; // time [s] for a full intensity to decay
 	unsigned char m_Flags; // up to eight individual parameters, use with eSndGrpFlags.
 	
 	float m_Gain;  
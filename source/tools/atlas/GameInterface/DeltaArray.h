@@ -1,4 +1,4 @@
-/* Copyright (C) 2009 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -18,9 +18,23 @@
 #ifndef INCLUDED_DELTAARRAY
 #define INCLUDED_DELTAARRAY
 
+#include <boost/unordered_map.hpp>
+
+/**
+ * Records the changes made to a 2D array (e.g. the terrain heightmap), so they
+ * can be undone and redone.
+ *
+ * Brush strokes change compact areas of the array, so the changes are stored
+ * in square blocks of BLOCK_SIZE*BLOCK_SIZE elements: each block has a small
+ * table of indexes into a packed vector of the changed elements' old and new
+ * values. That's a few bytes per change instead of a hash table node, and
+ * lookups are mostly in the same block as the previous one.
+ */
 template<typename T> class DeltaArray2D
 {
+	NONCOPYABLE(DeltaArray2D); // since m_LastBlock points into m_Data
 public:
+	DeltaArray2D() : m_LastBlock(NULL) {}
 	virtual ~DeltaArray2D() {}
 
 	T get(ssize_t x, ssize_t y);
@@ -35,39 +49,97 @@ protected:
 	virtual void setNew(ssize_t x, ssize_t y, const T& val) = 0;
 
 private:
-	std::size_t hash_value(const std::pair<ssize_t, ssize_t>& p)
+	static const ssize_t BLOCK_SIZE = 16;
+
+	struct Block
+	{
+		Block()
+		{
+			std::fill(index, index + BLOCK_SIZE*BLOCK_SIZE, (u16)0);
+		}
+
+		// 1 + the position in values of each element's change, or 0 if it's unchanged
+		u16 index[BLOCK_SIZE*BLOCK_SIZE];
+		std::vector<std::pair<T, T> > values; // <old_val, new_val>
+	};
+
+	typedef std::pair<ssize_t, ssize_t> BlockKey;
+	typedef boost::unordered_map<BlockKey, Block> Data;
+
+	static ssize_t BlockCoord(ssize_t x)
 	{
-		std::size_t seed = 0;
-		boost::hash_combine(seed, p.first << 16);
-		boost::hash_combine(seed, p.second);
-		return seed;
+		// Round towards negative infinity
+		return (x >= 0 ? x : x - (BLOCK_SIZE-1)) / BLOCK_SIZE;
 	}
 
-	// TODO: more efficient representation
-	typedef boost::unordered_map<std::pair<ssize_t, ssize_t>, std::pair<T, T> > Data; // map of <x,y> -> <old_val, new_val>
+	static size_t CellIndex(ssize_t x, ssize_t y, const BlockKey& key)
+	{
+		return (size_t)((y - key.second*BLOCK_SIZE)*BLOCK_SIZE + (x - key.first*BLOCK_SIZE));
+	}
+
+	/// Returns the block containing (x,y), or NULL if it doesn't exist and !create
+	Block* GetBlock(ssize_t x, ssize_t y, bool create, BlockKey& key);
+
+	/// Calls setNew on every changed element, with either its old or new value
+	void Apply(bool useNew);
+
 	Data m_Data;
+
+	// Cache of the most recently used block (elements of unordered_map
+	// aren't moved by inserting other elements)
+	BlockKey m_LastKey;
+	Block* m_LastBlock;
 };
 
 //////////////////////////////////////////////////////////////////////////
 
 template<typename T>
-T DeltaArray2D<T>::get(ssize_t x, ssize_t y)
+typename DeltaArray2D<T>::Block* DeltaArray2D<T>::GetBlock(ssize_t x, ssize_t y, bool create, BlockKey& key)
 {
-	typename Data::iterator it = m_Data.find(std::make_pair(x, y));
+	key = BlockKey(BlockCoord(x), BlockCoord(y));
+	if (m_LastBlock && key == m_LastKey)
+		return m_LastBlock;
+
+	typename Data::iterator it = m_Data.find(key);
 	if (it == m_Data.end())
-		return getOld(x, y);
-	else
-		return it->second.second;
+	{
+		if (!create)
+			return NULL;
+		it = m_Data.insert(std::make_pair(key, Block())).first;
+	}
+
+	m_LastKey = key;
+	m_LastBlock = &it->second;
+	return m_LastBlock;
+}
+
+template<typename T>
+T DeltaArray2D<T>::get(ssize_t x, ssize_t y)
+{
+	BlockKey key;
+	Block* block = GetBlock(x, y, false, key);
+	if (block)
+	{
+		u16 idx = block->index[CellIndex(x, y, key)];
+		if (idx)
+			return block->values[idx-1].second;
+	}
+	return getOld(x, y);
 }
 
 template<typename T>
 void DeltaArray2D<T>::set(ssize_t x, ssize_t y, const T& val)
 {
-	typename Data::iterator it = m_Data.find(std::make_pair(x, y));
-	if (it == m_Data.end())
-		m_Data.insert(std::make_pair(std::make_pair(x, y), std::make_pair(getOld(x, y), val)));
+	BlockKey key;
+	Block* block = GetBlock(x, y, true, key);
+	u16& idx = block->index[CellIndex(x, y, key)];
+	if (idx)
+		block->values[idx-1].second = val;
 	else
-		it->second.second = val;
+	{
+		block->values.push_back(std::make_pair(getOld(x, y), val));
+		idx = (u16)block->values.size();
+	}
 	setNew(x, y, val);
 }
 
@@ -78,28 +150,62 @@ void DeltaArray2D<T>::OverlayWith(const DeltaArray2D<T>& overlayer)
 	{
 		typename Data::iterator it2 = m_Data.find(it->first);
 		if (it2 == m_Data.end())
+		{
 			m_Data.insert(*it);
-		else
+			continue;
+		}
+
+		const Block& src = it->second;
+		Block& dst = it2->second;
+		for (size_t n = 0; n < BLOCK_SIZE*BLOCK_SIZE; ++n)
 		{
-			//ENSURE(it2->second.second == it->second.first);
-			it2->second.second = it->second.second;
+			if (!src.index[n])
+				continue;
+			const std::pair<T, T>& change = src.values[src.index[n]-1];
+			if (dst.index[n])
+			{
+				//ENSURE(dst.values[dst.index[n]-1].second == change.first);
+				dst.values[dst.index[n]-1].second = change.second;
+			}
+			else
+			{
+				dst.values.push_back(change);
+				dst.index[n] = (u16)dst.values.size();
+			}
 		}
 	}
+}
 
+template <typename T>
+void DeltaArray2D<T>::Apply(bool useNew)
+{
+	for (typename Data::iterator it = m_Data.begin(); it != m_Data.end(); ++it)
+	{
+		const Block& block = it->second;
+		for (ssize_t dy = 0; dy < BLOCK_SIZE; ++dy)
+		{
+			for (ssize_t dx = 0; dx < BLOCK_SIZE; ++dx)
+			{
+				u16 idx = block.index[dy*BLOCK_SIZE + dx];
+				if (!idx)
+					continue;
+				const std::pair<T, T>& change = block.values[idx-1];
+				setNew(it->first.first*BLOCK_SIZE + dx, it->first.second*BLOCK_SIZE + dy, useNew ? change.second : change.first);
+			}
+		}
+	}
 }
 
 template <typename T>
 void DeltaArray2D<T>::Undo()
 {
-	for (typename Data::iterator it = m_Data.begin(); it != m_Data.end(); ++it)
-		setNew(it->first.first, it->first.second, it->second.first);
+	Apply(false);
 }
 
 template <typename T>
 void DeltaArray2D<T>::Redo()
 {
-	for (typename Data::iterator it = m_Data.begin(); it != m_Data.end(); ++it)
-		setNew(it->first.first, it->first.second, it->second.second);
+	Apply(true);
 }
 
 #endif // INCLUDED_DELTAARRAY
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -22,6 +22,7 @@
 #include "MessagePasserImpl.h"
 #include "Messages.h"
 #include "SharedMemory.h"
+#include "TerrainDirty.h"
 #include "Handlers/MessageHandler.h"
 #include "ActorViewer.h"
 #include "View.h"
@@ -38,6 +39,7 @@
 #include "ps/Filesystem.h"
 #include "ps/Profile.h"
 #include "ps/GameSetup/Paths.h"
+#include "ps/Util.h"
 #include "renderer/Renderer.h"
 #include "scripting/ScriptingHost.h"
 
@@ -210,10 +212,16 @@ static void* RunEngine(void* data)
 
 		// Do per-frame processing:
 
+		// Apply all of this frame's terrain changes at once, before the
+		// simulation and renderer use them
+		AtlasMessage::FlushTerrainDirty();
+
 		ReloadChangedFiles();
 
 		RendererIncrementalLoad();
 
+		PollScreenshots();
+
 		// Pump SDL events (e.g. hotkeys)
 		SDL_Event_ ev;
 		while (SDL_PollEvent(&ev.ev))
@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -27,11 +27,10 @@
 #include "ps/World.h"
 #include "maths/MathUtil.h"
 #include "graphics/RenderableObject.h"
-#include "simulation2/Simulation2.h"
-#include "simulation2/components/ICmpTerrain.h"
 
 #include "../Brushes.h"
 #include "../DeltaArray.h"
+#include "../TerrainDirty.h"
 
 namespace AtlasMessage {
 
@@ -110,10 +109,7 @@ BEGIN_COMMAND(AlterElevation)
 
 	void MakeDirty()
 	{
-		g_Game->GetWorld()->GetTerrain()->MakeDirty(m_i0, m_j0, m_i1, m_j1, RENDERDATA_UPDATE_VERTICES);
-		CmpPtr<ICmpTerrain> cmpTerrain(*g_Game->GetSimulation2(), SYSTEM_ENTITY);
-		if (cmpTerrain)
-			cmpTerrain->MakeDirty(m_i0, m_j0, m_i1, m_j1);
+		MakeTerrainDirty(m_i0, m_j0, m_i1, m_j1, RENDERDATA_UPDATE_VERTICES);
 	}
 
 	void Do()
@@ -192,10 +188,7 @@ BEGIN_COMMAND(SmoothElevation)
 
 	void MakeDirty()
 	{
-		g_Game->GetWorld()->GetTerrain()->MakeDirty(m_i0, m_j0, m_i1, m_j1, RENDERDATA_UPDATE_VERTICES);
-		CmpPtr<ICmpTerrain> cmpTerrain(*g_Game->GetSimulation2(), SYSTEM_ENTITY);
-		if (cmpTerrain)
-			cmpTerrain->MakeDirty(m_i0, m_j0, m_i1, m_j1);
+		MakeTerrainDirty(m_i0, m_j0, m_i1, m_j1, RENDERDATA_UPDATE_VERTICES);
 	}
 
 	void Do()
@@ -304,10 +297,7 @@ BEGIN_COMMAND(FlattenElevation)
 
 	void MakeDirty()
 	{
-		g_Game->GetWorld()->GetTerrain()->MakeDirty(m_i0, m_j0, m_i1, m_j1, RENDERDATA_UPDATE_VERTICES);
-		CmpPtr<ICmpTerrain> cmpTerrain(*g_Game->GetSimulation2(), SYSTEM_ENTITY);
-		if (cmpTerrain)
-			cmpTerrain->MakeDirty(m_i0, m_j0, m_i1, m_j1);
+		MakeTerrainDirty(m_i0, m_j0, m_i1, m_j1, RENDERDATA_UPDATE_VERTICES);
 	}
 
 	void Do()
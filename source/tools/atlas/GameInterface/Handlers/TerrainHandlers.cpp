@@ -1,4 +1,4 @@
-/* Copyright (C) 2012 Wildfire Games.
+/* Copyright (C) 2013 Wildfire Games.
  * This file is part of 0 A.D.
  *
  * 0 A.D. is free software: you can redistribute it and/or modify
@@ -31,11 +31,11 @@
 #include "lib/res/graphics/ogl_tex.h"
 #include "simulation2/Simulation2.h"
 #include "simulation2/components/ICmpPathfinder.h"
-#include "simulation2/components/ICmpTerrain.h"
 #include "simulation2/helpers/Grid.h"
 
 #include "../Brushes.h"
 #include "../DeltaArray.h"
+#include "../TerrainDirty.h"
 #include "../View.h"
 
 #include <queue>
@@ -279,10 +279,7 @@ BEGIN_COMMAND(PaintTerrain)
 
 	void MakeDirty()
 	{
-		g_Game->GetWorld()->GetTerrain()->MakeDirty(m_i0, m_j0, m_i1, m_j1, RENDERDATA_UPDATE_INDICES);
-		CmpPtr<ICmpTerrain> cmpTerrain(*g_Game->GetSimulation2(), SYSTEM_ENTITY);
-		if (cmpTerrain)
-			cmpTerrain->MakeDirty(m_i0, m_j0, m_i1, m_j1);
+		MakeTerrainDirty(m_i0, m_j0, m_i1, m_j1, RENDERDATA_UPDATE_INDICES);
 	}
 
 	void Do()
@@ -368,10 +365,7 @@ BEGIN_COMMAND(ReplaceTerrain)
 
 	void MakeDirty()
 	{
-		g_Game->GetWorld()->GetTerrain()->MakeDirty(m_i0, m_j0, m_i1, m_j1, RENDERDATA_UPDATE_INDICES);
-		CmpPtr<ICmpTerrain> cmpTerrain(*g_Game->GetSimulation2(), SYSTEM_ENTITY);
-		if (cmpTerrain)
-			cmpTerrain->MakeDirty(m_i0, m_j0, m_i1, m_j1);
+		MakeTerrainDirty(m_i0, m_j0, m_i1, m_j1, RENDERDATA_UPDATE_INDICES);
 	}
 
 	void Do()
@@ -447,10 +441,7 @@ BEGIN_COMMAND(FillTerrain)
 
 	void MakeDirty()
 	{
-		g_Game->GetWorld()->GetTerrain()->MakeDirty(m_i0, m_j0, m_i1, m_j1, RENDERDATA_UPDATE_INDICES);
-		CmpPtr<ICmpTerrain> cmpTerrain(*g_Game->GetSimulation2(), SYSTEM_ENTITY);
-		if (cmpTerrain)
-			cmpTerrain->MakeDirty(m_i0, m_j0, m_i1, m_j1);
+		MakeTerrainDirty(m_i0, m_j0, m_i1, m_j1, RENDERDATA_UPDATE_INDICES);
 	}
 
 	void Do()
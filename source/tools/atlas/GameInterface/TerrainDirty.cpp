@@ -0,0 +1,81 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "precompiled.h"
+
+#include "TerrainDirty.h"
+
+#include "graphics/Terrain.h"
+#include "maths/MathUtil.h"
+#include "ps/Game.h"
+#include "ps/World.h"
+#include "simulation2/Simulation2.h"
+#include "simulation2/components/ICmpTerrain.h"
+
+namespace
+{
+	bool g_TerrainDirty = false;
+	ssize_t g_DirtyI0, g_DirtyJ0, g_DirtyI1, g_DirtyJ1;
+	int g_DirtyFlags;
+}
+
+void AtlasMessage::MakeTerrainDirty(ssize_t i0, ssize_t j0, ssize_t i1, ssize_t j1, int dirtyFlags)
+{
+	if (!g_TerrainDirty)
+	{
+		g_TerrainDirty = true;
+		g_DirtyI0 = i0;
+		g_DirtyJ0 = j0;
+		g_DirtyI1 = i1;
+		g_DirtyJ1 = j1;
+		g_DirtyFlags = dirtyFlags;
+		return;
+	}
+
+	g_DirtyI0 = std::min(g_DirtyI0, i0);
+	g_DirtyJ0 = std::min(g_DirtyJ0, j0);
+	g_DirtyI1 = std::max(g_DirtyI1, i1);
+	g_DirtyJ1 = std::max(g_DirtyJ1, j1);
+	g_DirtyFlags |= dirtyFlags;
+}
+
+void AtlasMessage::FlushTerrainDirty()
+{
+	if (!g_TerrainDirty)
+		return;
+	g_TerrainDirty = false;
+
+	if (!g_Game)
+		return;
+
+	// The map might have been replaced since the changes were made,
+	// so keep the range within the current one (which always includes
+	// the vertexes on the far edges)
+	CTerrain* terrain = g_Game->GetWorld()->GetTerrain();
+	ssize_t verts = terrain->GetVerticesPerSide();
+	ssize_t i0 = clamp(g_DirtyI0, (ssize_t)0, verts);
+	ssize_t j0 = clamp(g_DirtyJ0, (ssize_t)0, verts);
+	ssize_t i1 = clamp(g_DirtyI1, (ssize_t)0, verts);
+	ssize_t j1 = clamp(g_DirtyJ1, (ssize_t)0, verts);
+	if (i0 >= i1 || j0 >= j1)
+		return;
+
+	terrain->MakeDirty(i0, j0, i1, j1, g_DirtyFlags);
+	CmpPtr<ICmpTerrain> cmpTerrain(*g_Game->GetSimulation2(), SYSTEM_ENTITY);
+	if (cmpTerrain)
+		cmpTerrain->MakeDirty(i0, j0, i1, j1);
+}
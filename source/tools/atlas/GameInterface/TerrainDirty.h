@@ -0,0 +1,43 @@
+/* Copyright (C) 2013 Wildfire Games.
+ * This file is part of 0 A.D.
+ *
+ * 0 A.D. is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * 0 A.D. is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with 0 A.D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INCLUDED_TERRAINDIRTY
+#define INCLUDED_TERRAINDIRTY
+
+namespace AtlasMessage
+{
+
+/**
+ * Records that the given range of terrain tiles (inclusive lower bound,
+ * exclusive upper) has been changed, with the given RENDERDATA_UPDATE_* flags.
+ *
+ * Brush commands can run many times per frame, and every change makes the
+ * simulation recompute its pathfinding/obstruction data and the renderer recompute
+ * patch bounds, so the changes are accumulated and applied once per frame
+ * (covering the union of the changed ranges) by FlushTerrainDirty.
+ */
+void MakeTerrainDirty(ssize_t i0, ssize_t j0, ssize_t i1, ssize_t j1, int dirtyFlags);
+
+/**
+ * Notifies the terrain renderer and simulation of all the changes since the
+ * previous call. Called by the game loop after processing each frame's messages.
+ */
+void FlushTerrainDirty();
+
+}
+
+#endif // INCLUDED_TERRAINDIRTY